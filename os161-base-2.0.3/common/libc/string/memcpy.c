@@ -39,6 +39,7 @@
 #include <stdint.h>
 #include <string.h>
 #endif
+#include "wordcopy.h"
 
 /*
  * C standard function - copy a block of memory.
@@ -47,39 +48,67 @@
 void *
 memcpy(void *dst, const void *src, size_t len)
 {
-	size_t i;
+	char *d = dst;
+	const char *s = src;
+	wc_word *dw;
+	const wc_word *sw;
 
 	/*
 	 * memcpy does not support overlapping buffers, so always do it
-	 * forwards. (Don't change this without adjusting memmove.)
+	 * forwards. (Don't change this without adjusting memmove.) Each
+	 * word is loaded before it is stored, and no store reaches past
+	 * the next load, so a destination below an overlapping source
+	 * still comes out right; memmove counts on that.
 	 *
-	 * For speedy copying, optimize the common case where both pointers
-	 * and the length are word-aligned, and copy word-at-a-time instead
-	 * of byte-at-a-time. Otherwise, copy by bytes.
-	 *
-	 * The alignment logic below should be portable. We rely on
-	 * the compiler to be reasonably intelligent about optimizing
-	 * the divides and modulos out. Fortunately, it is.
+	 * See wordcopy.h for how the words are done.
 	 */
 
-	if ((uintptr_t)dst % sizeof(long) == 0 &&
-	    (uintptr_t)src % sizeof(long) == 0 &&
-	    len % sizeof(long) == 0) {
-
-		long *d = dst;
-		const long *s = src;
+	if (len >= WC_MIN) {
+		while (!WC_ALIGNED(d)) {
+			*d++ = *s++;
+			len--;
+		}
+		dw = (wc_word *)d;
 
-		for (i=0; i<len/sizeof(long); i++) {
-			d[i] = s[i];
+		if (WC_ALIGNED(s)) {
+			sw = (const wc_word *)s;
+			while (len >= WC_UNROLL * WC_SIZE) {
+				dw[0] = sw[0];
+				dw[1] = sw[1];
+				dw[2] = sw[2];
+				dw[3] = sw[3];
+				dw += WC_UNROLL;
+				sw += WC_UNROLL;
+				len -= WC_UNROLL * WC_SIZE;
+			}
+			while (len >= WC_SIZE) {
+				*dw++ = *sw++;
+				len -= WC_SIZE;
+			}
+			s = (const char *)sw;
 		}
+		else {
+			while (len >= WC_UNROLL * WC_SIZE) {
+				dw[0] = wc_loadu(s);
+				dw[1] = wc_loadu(s + WC_SIZE);
+				dw[2] = wc_loadu(s + 2 * WC_SIZE);
+				dw[3] = wc_loadu(s + 3 * WC_SIZE);
+				dw += WC_UNROLL;
+				s += WC_UNROLL * WC_SIZE;
+				len -= WC_UNROLL * WC_SIZE;
+			}
+			while (len >= WC_SIZE) {
+				*dw++ = wc_loadu(s);
+				s += WC_SIZE;
+				len -= WC_SIZE;
+			}
+		}
+		d = (char *)dw;
 	}
-	else {
-		char *d = dst;
-		const char *s = src;
 
-		for (i=0; i<len; i++) {
-			d[i] = s[i];
-		}
+	while (len > 0) {
+		*d++ = *s++;
+		len--;
 	}
 
 	return dst;
@@ -39,6 +39,7 @@
 #include <stdint.h>
 #include <string.h>
 #endif
+#include "wordcopy.h"
 
 /*
  * C standard function - copy a block of memory, handling overlapping
@@ -48,7 +49,10 @@
 void *
 memmove(void *dst, const void *src, size_t len)
 {
-	size_t i;
+	char *d;
+	const char *s;
+	wc_word *dw;
+	const wc_word *sw;
 
 	/*
 	 * If the buffers don't overlap, it doesn't matter what direction
@@ -84,33 +88,53 @@ memmove(void *dst, const void *src, size_t len)
 	}
 
 	/*
-	 * Copy by words in the common case. Look in memcpy.c for more
-	 * information.
+	 * Otherwise go back to front, by words when we can, the same way
+	 * memcpy goes forwards (see wordcopy.h): by bytes until the end
+	 * of the destination is aligned, then words, then the bytes left
+	 * at the front. Since the destination is above the source, each
+	 * word stored lies above the next one loaded.
 	 */
 
-	if ((uintptr_t)dst % sizeof(long) == 0 &&
-	    (uintptr_t)src % sizeof(long) == 0 &&
-	    len % sizeof(long) == 0) {
+	d = (char *)dst + len;
+	s = (const char *)src + len;
 
-		long *d = dst;
-		const long *s = src;
-
-		/*
-		 * The reason we copy index i-1 and test i>0 is that
-		 * i is unsigned -- so testing i>=0 doesn't work.
-		 */
+	if (len >= WC_MIN) {
+		while (!WC_ALIGNED(d)) {
+			*--d = *--s;
+			len--;
+		}
+		dw = (wc_word *)d;
 
-		for (i=len/sizeof(long); i>0; i--) {
-			d[i-1] = s[i-1];
+		if (WC_ALIGNED(s)) {
+			sw = (const wc_word *)s;
+			while (len >= WC_UNROLL * WC_SIZE) {
+				dw[-1] = sw[-1];
+				dw[-2] = sw[-2];
+				dw[-3] = sw[-3];
+				dw[-4] = sw[-4];
+				dw -= WC_UNROLL;
+				sw -= WC_UNROLL;
+				len -= WC_UNROLL * WC_SIZE;
+			}
+			while (len >= WC_SIZE) {
+				*--dw = *--sw;
+				len -= WC_SIZE;
+			}
+			s = (const char *)sw;
+		}
+		else {
+			while (len >= WC_SIZE) {
+				s -= WC_SIZE;
+				*--dw = wc_loadu(s);
+				len -= WC_SIZE;
+			}
 		}
+		d = (char *)dw;
 	}
-	else {
-		char *d = dst;
-		const char *s = src;
 
-		for (i=len; i>0; i--) {
-			d[i-1] = s[i-1];
-		}
+	while (len > 0) {
+		*--d = *--s;
+		len--;
 	}
 
 	return dst;
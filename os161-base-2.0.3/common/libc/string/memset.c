@@ -31,8 +31,10 @@
 #include <types.h>
 #include <lib.h>
 #else
+#include <stdint.h>
 #include <string.h>
 #endif
+#include "wordcopy.h"
 
 /*
  * C standard function - initialize a block of memory
@@ -42,10 +44,45 @@ void *
 memset(void *ptr, int ch, size_t len)
 {
 	char *p = ptr;
-	size_t i;
+	wc_word *pw;
+	wc_word w;
+	unsigned i;
 
-	for (i=0; i<len; i++) {
-		p[i] = ch;
+	/*
+	 * Bytes until aligned, then whole words of CH, then the bytes
+	 * left over; see wordcopy.h.
+	 */
+
+	if (len >= WC_MIN) {
+		while (!WC_ALIGNED(p)) {
+			*p++ = ch;
+			len--;
+		}
+
+		w = (unsigned char)ch;
+		for (i=8; i<8*WC_SIZE; i*=2) {
+			w |= w << i;
+		}
+
+		pw = (wc_word *)p;
+		while (len >= WC_UNROLL * WC_SIZE) {
+			pw[0] = w;
+			pw[1] = w;
+			pw[2] = w;
+			pw[3] = w;
+			pw += WC_UNROLL;
+			len -= WC_UNROLL * WC_SIZE;
+		}
+		while (len >= WC_SIZE) {
+			*pw++ = w;
+			len -= WC_SIZE;
+		}
+		p = (char *)pw;
+	}
+
+	while (len > 0) {
+		*p++ = ch;
+		len--;
 	}
 
 	return ptr;
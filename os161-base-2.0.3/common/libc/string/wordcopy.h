@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _WORDCOPY_H_
+#define _WORDCOPY_H_
+
+/*
+ * Private to memcpy.c, memmove.c and memset.c, which are shared
+ * between libc and the kernel; include this after their system
+ * headers.
+ *
+ * These copy by words where they can. Each one first goes by bytes
+ * until the destination is word-aligned, then moves WC_UNROLL words
+ * per loop iteration, then single words, and then finishes up the
+ * leftover bytes by bytes. Below WC_MIN bytes that is not worth the
+ * bother and it is all done by bytes.
+ *
+ * If the source is not aligned the same way as the destination,
+ * every word is fetched with wc_loadu. On big-endian MIPS that is the
+ * lwl/lwr pair, which loads an unaligned word in two instructions;
+ * elsewhere it puts the word together a byte at a time.
+ */
+
+typedef unsigned long wc_word;
+
+#define WC_SIZE		sizeof(wc_word)
+#define WC_MASK		(WC_SIZE - 1)
+#define WC_UNROLL	4
+#define WC_MIN		(2 * WC_SIZE)
+
+#define WC_ALIGNED(p)	(((uintptr_t)(p) & WC_MASK) == 0)
+
+static inline
+wc_word
+wc_loadu(const char *p)
+{
+#if defined(__mips__) && defined(__MIPSEB__)
+	wc_word w;
+
+	__asm(
+		"lwl %0, 0(%1);"	/* the bytes up to the word boundary */
+		"lwr %0, 3(%1)"		/* and the rest, from the next word */
+		: "=&r" (w)
+		: "r" (p), "m" (*(const char (*)[4])p));
+	return w;
+#else
+	union {
+		wc_word w;
+		char c[WC_SIZE];
+	} u;
+	unsigned i;
+
+	for (i=0; i<WC_SIZE; i++) {
+		u.c[i] = p[i];
+	}
+	return u.w;
+#endif
+}
+
+
+#endif /* _WORDCOPY_H_ */
@@ -46,6 +46,9 @@ SPINLOCK_INLINE
 spinlock_data_t spinlock_data_get(volatile spinlock_data_t *sd);
 SPINLOCK_INLINE
 spinlock_data_t spinlock_data_testandset(volatile spinlock_data_t *sd);
+SPINLOCK_INLINE
+bool spinlock_data_cas(volatile spinlock_data_t *sd,
+		       spinlock_data_t old, spinlock_data_t new);
 
 ////////////////////////////////////////////////////////////
 
@@ -118,5 +121,48 @@ spinlock_data_testandset(volatile spinlock_data_t *sd)
 	return x;
 }
 
+/*
+ * Compare-and-swap a spinlock_data_t: if it holds OLD, replace it
+ * with NEW and return true; otherwise leave it alone and return
+ * false. Also uses LL/SC (see above), so it can fail spuriously if
+ * the SC loses its mark; callers retry in a loop.
+ *
+ * This is not used by the spinlocks themselves, but by code that
+ * wants to update a word atomically without taking a spinlock (see
+ * the semaphore fast path in synch.c). It implies no memory barrier.
+ */
+SPINLOCK_INLINE
+bool
+spinlock_data_cas(volatile spinlock_data_t *sd,
+		  spinlock_data_t old, spinlock_data_t new)
+{
+	spinlock_data_t x;
+	spinlock_data_t y;
+
+	/*
+	 * Load the existing value into X; if it is OLD, use Y to
+	 * store NEW. After the SC, Y contains 1 if the store
+	 * succeeded, 0 if it failed. If X isn't OLD the SC is
+	 * skipped and Y is meaningless.
+	 *
+	 * Fill the branch delay slot by hand so the SC isn't in it.
+	 */
+
+	y = new;
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set volatile;"	/* avoid unwanted optimization */
+		".set noreorder;"	/* we handle the delay slot */
+		"ll %0, 0(%3);"		/*   x = *sd */
+		"bne %0, %2, 1f;"	/*   if (x != old) goto out */
+		" nop;"			/*   (delay slot) */
+		"sc %1, 0(%3);"		/*   *sd = y; y = success? */
+		"1:"			/* out: */
+		".set pop"		/* restore assembler mode */
+		: "=&r" (x), "+r" (y) : "r" (old), "r" (sd) : "memory");
+	return x == old && y != 0;
+}
+
 
 #endif /* _MIPS_SPINLOCK_H_ */
@@ -92,6 +92,17 @@ struct trapframe {
 #define EX_CPU    11   /* Coprocessor unusable */
 #define EX_OVF    12   /* Arithmetic overflow */
 
+/*
+ * For exception-*.S: which system calls, by number, need the whole
+ * trapframe saved and restored (those whose syscalls.def entry takes
+ * A_TF). The others get one in which only v0, v1, a0-a3, ra, gp, sp,
+ * s7, status and epc are valid, and only those fields are put back on
+ * return; s0-s6 and s8 keep their values through the C code, and the
+ * other registers are cleared.
+ */
+extern const unsigned char syscall_fullsave[];
+extern const unsigned syscall_nfullsave;
+
 /*
  * Function to enter user mode. Does not return. The trapframe must
  * be on the thread's own stack or bad things will happen.
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _MIPS_UCOPY_H_
+#define _MIPS_UCOPY_H_
+
+/*
+ * MIPS primitives under the small copyin/copyout variants (see
+ * vm/copyinout.c and arch/mips/vm/ucopy.S).
+ *
+ *   ufetch_8/16/32: copy one naturally aligned 1, 2 or 4 byte value
+ *        from user address USERSRC to DEST.
+ *
+ *   ustore_8/16/32: store VAL at the naturally aligned user address
+ *        USERDEST.
+ *
+ * All return 0. The caller checks the address and must have set
+ * tm_badfaultfunc to ucopy_fault, in which case a fault makes the
+ * primitive return EFAULT instead.
+ */
+
+int ufetch_8(const_userptr_t usersrc, uint8_t *dest);
+int ufetch_16(const_userptr_t usersrc, uint16_t *dest);
+int ufetch_32(const_userptr_t usersrc, uint32_t *dest);
+int ustore_8(uint8_t val, userptr_t userdest);
+int ustore_16(uint16_t val, userptr_t userdest);
+int ustore_32(uint32_t val, userptr_t userdest);
+void ucopy_fault(void);
+
+#endif /* _MIPS_UCOPY_H_ */
@@ -53,6 +53,14 @@
 #define MIPS_KSEG1  0xa0000000
 #define MIPS_KSEG2  0xc0000000
 
+/*
+ * The bottom 8M of kseg2 is where vmalloc maps kernel allocations
+ * that are made of pages scattered in physical memory.
+ */
+#define VMALLOC_BASE    MIPS_KSEG2
+#define VMALLOC_NPAGES  2048
+#define VMALLOC_TOP     (VMALLOC_BASE + VMALLOC_NPAGES * PAGE_SIZE)
+
 /*
  * The first 512 megs of physical space can be addressed in both kseg0 and
  * kseg1. We use kseg0 for the kernel. This macro returns the kernel virtual
@@ -116,11 +124,14 @@ paddr_t ram_getfirstfree(void);
  * We'll take up to 16 invalidations before just flushing the whole TLB.
  */
 
+struct addrspace;
+struct semaphore;
+
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	int ts_placeholder;
+	struct addrspace *ts_as;	/* whose translations to drop */
+	vaddr_t ts_vaddr;		/* first page to drop */
+	unsigned ts_npages;		/* ...and how many */
+	struct semaphore *ts_done;	/* V'd when done */
 };
 
 #define TLBSHOOTDOWN_MAX 16
@@ -39,6 +39,9 @@
 #include <vm.h>
 #include <mainbus.h>
 #include <syscall.h>
+#include <proc.h>
+#include <kern/wait.h>
+#include "opt-shell.h"
 
 
 /* in exception-*.S */
@@ -46,6 +49,7 @@ extern __DEAD void asm_usermode(struct trapframe *tf);
 
 /* called only from assembler, so not declared in a header */
 void mips_trap(struct trapframe *tf);
+void mips_syscall(struct trapframe *tf);
 
 
 /* Names for trap codes */
@@ -108,6 +112,21 @@ kill_curthread(vaddr_t epc, unsigned code, vaddr_t vaddr)
 		break;
 	}
 
+#if OPT_SHELL
+	/*
+	 * Kill the whole process, as if by the signal; the thread
+	 * leaves on the way out of mips_trap. If the process is
+	 * already exiting (as when it was killed for running the
+	 * system out of memory, see vm_fault) that is all there is
+	 * to do.
+	 */
+	if (curproc->p_exiting) {
+		return;
+	}
+	kprintf("Fatal user mode trap %u sig %d (%s, epc 0x%x, vaddr 0x%x)\n",
+		code, sig, trapcodenames[code], epc, vaddr);
+	proc_setexiting(curproc, _MKWAIT_SIG(sig));
+#else
 	/*
 	 * You will probably want to change this.
 	 */
@@ -115,6 +134,7 @@ kill_curthread(vaddr_t epc, unsigned code, vaddr_t vaddr)
 	kprintf("Fatal user mode trap %u sig %d (%s, epc 0x%x, vaddr 0x%x)\n",
 		code, sig, trapcodenames[code], epc, vaddr);
 	panic("I don't know how to handle this\n");
+#endif
 }
 
 /*
@@ -185,6 +205,15 @@ mips_trap(struct trapframe *tf)
 			doadjust = false;
 		}
 
+#if OPT_SHELL
+		/* Tells hardclock whom to charge the tick to */
+		curthread->t_intr_user = !iskern;
+#endif
+#if OPT_PROF
+		/* Tells hardclock where we were, for the profiler */
+		curthread->t_intr_epc = tf->tf_epc;
+#endif
+
 		mainbus_interrupt(tf);
 
 		if (doadjust) {
@@ -195,6 +224,19 @@ mips_trap(struct trapframe *tf)
 		}
 
 		curthread->t_in_interrupt = old_in;
+
+#if OPT_SHELL
+		/*
+		 * Another thread of the process called _exit(): don't go
+		 * back to user mode. We came from there, so the recorded
+		 * spl is 0; turn interrupts on again to match it before
+		 * leaving, as that may sleep.
+		 */
+		if (!iskern && curproc != NULL && curproc->p_exiting) {
+			cpu_irqon();
+			proc_thread_exit(0);
+		}
+#endif
 		goto done2;
 	}
 
@@ -315,6 +357,13 @@ mips_trap(struct trapframe *tf)
 	panic("I can't handle this... I think I'll just die now...\n");
 
  done:
+#if OPT_SHELL
+	/* Likewise after a system call or a fault */
+	if (!iskern && curproc != NULL && curproc->p_exiting) {
+		proc_thread_exit(0);
+	}
+#endif
+
 	/*
 	 * Turn interrupts off on the processor, without affecting the
 	 * stored interrupt state.
@@ -347,6 +396,50 @@ mips_trap(struct trapframe *tf)
 	KASSERT(SAME_STACK(cpustacks[curcpu->c_number]-1, (vaddr_t)tf));
 }
 
+/*
+ * System call handling function for mips, called by the short entry
+ * path in exception-*.S for every system call not marked in
+ * syscall_fullsave (those that take the trapframe, A_TF in
+ * syscalls.def, go through mips_trap with a full save). This is what
+ * mips_trap does for EX_SYS, without the decoding; the trapframe only
+ * holds what syscall() looks at (see the assembler for which).
+ */
+void
+mips_syscall(struct trapframe *tf)
+{
+	int spl;
+
+	KASSERT(curthread != NULL && curthread->t_stack != NULL);
+	KASSERT((vaddr_t)tf > (vaddr_t)curthread->t_stack);
+	KASSERT((vaddr_t)tf < (vaddr_t)(curthread->t_stack + STACK_SIZE));
+
+	/* Interrupts should have been on while in user mode. */
+	KASSERT(curthread->t_curspl == 0);
+	KASSERT(curthread->t_iplhigh_count == 0);
+
+	/* Put the interrupt state back in sync, as in mips_trap. */
+	spl = splhigh();
+	splx(spl);
+
+	DEBUG(DB_SYSCALL, "syscall: #%d, args %x %x %x %x\n",
+	      tf->tf_v0, tf->tf_a0, tf->tf_a1, tf->tf_a2, tf->tf_a3);
+
+	syscall(tf);
+
+#if OPT_SHELL
+	if (curproc != NULL && curproc->p_exiting) {
+		proc_thread_exit(0);
+	}
+#endif
+
+	cpu_irqoff();
+
+	/* We may have moved to another cpu while in the call. */
+	cputhreads[curcpu->c_number] = (vaddr_t)curthread;
+	cpustacks[curcpu->c_number] = (vaddr_t)curthread->t_stack + STACK_SIZE;
+	KASSERT(SAME_STACK(cpustacks[curcpu->c_number]-1, (vaddr_t)tf));
+}
+
 /*
  * Function for entering user mode.
  *
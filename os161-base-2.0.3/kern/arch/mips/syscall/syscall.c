@@ -36,11 +36,423 @@
 #include <current.h>
 #include <addrspace.h>
 #include <syscall.h>
+#include <copyinout.h>
+#include <proc.h>
+#include <spl.h>
+#include <clock.h>
+#include <cpu.h>
+#include <membar.h>
+#include <kstat.h>
 
 /* INCLUDES FOR NEW SYSTEM CALLS FOR SHELL PROJECT */
 #include "syscall_SHELL.h"
 
 
+/*
+ * Argument decoders for syscalls.def: A holds the argument words of
+ * the call and RV the two words of its result.
+ */
+#define A_INT(n)	((int)a[n])
+#define A_UINT(n)	((unsigned)a[n])
+#define A_SIZE(n)	((size_t)a[n])
+#define A_PTR(n)	((void *)(uintptr_t)a[n])
+#define A_OFF(n)	((off_t)(((uint64_t)a[n] << 32) | a[(n)+1]))
+#define A_TF		tf
+#define A_RET		((void *)&rv[0])
+#define A_RETHI		((void *)&rv[1])
+
+#define SC_CALL_INT(func, args)		return func args;
+#define SC_CALL_VOID(func, args)	func args; return 0;
+
+/* Most argument words a call may have (sp+16 to sp+31 on the stack) */
+#define SYSCALL_MAXWORDS 8
+
+/*
+ * For each call, a stub that decodes its arguments and calls the
+ * function that does the work.
+ */
+#define SYSCALL(name, kind, nwords, func, args)				\
+	static								\
+	int								\
+	sc_##name(struct trapframe *tf, const uint32_t *a, int32_t *rv)	\
+	{								\
+		(void)tf;						\
+		(void)a;						\
+		(void)rv;						\
+		SC_CALL_##kind(func, args)				\
+	}
+#include "syscalls.def"
+#undef SYSCALL
+
+/*
+ * The dispatch table, indexed by call number. Numbers with no call
+ * have a null sd_func.
+ */
+struct syscall_desc {
+	const char *sd_name;
+	unsigned sd_nwords;
+	int (*sd_func)(struct trapframe *tf, const uint32_t *a, int32_t *rv);
+};
+
+#define SYSCALL(name, kind, nwords, func, args)				\
+	[SYS_##name] = { #name, nwords, sc_##name },
+static const struct syscall_desc syscall_table[] = {
+#include "syscalls.def"
+};
+#undef SYSCALL
+
+#define NSYSCALLTAB ARRAYCOUNT(syscall_table)
+
+/*
+ * Which calls take the trapframe (A_TF). exception-mips1.S sends all
+ * other calls down its short path, which saves only part of the
+ * trapframe and restores even less of it on return; these go through
+ * the full path instead, so that they can read every register and
+ * whatever they write into the trapframe is what user level gets
+ * back. The decoders are redefined to say whether they are A_TF, and
+ * SC_USES_TF is true if any of those in the list is (at most one
+ * per argument word, plus A_TF, A_RET and A_RETHI; the +0 is for calls
+ * with none).
+ */
+#undef A_INT
+#undef A_UINT
+#undef A_SIZE
+#undef A_PTR
+#undef A_OFF
+#undef A_TF
+#undef A_RET
+#undef A_RETHI
+#define A_INT(n)	0
+#define A_UINT(n)	0
+#define A_SIZE(n)	0
+#define A_PTR(n)	0
+#define A_OFF(n)	0
+#define A_TF		1
+#define A_RET		0
+#define A_RETHI		0
+
+#define SC_USES_TF(...)							\
+	SC_USES_TF_(__VA_ARGS__, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0)
+#define SC_USES_TF_(x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, ...)	\
+	(x0+0 || x1+0 || x2+0 || x3+0 || x4+0 || x5+0 || x6+0 ||	\
+	 x7+0 || x8+0 || x9+0 || x10+0)
+
+#define SYSCALL(name, kind, nwords, func, args)				\
+	[SYS_##name] = SC_USES_TF args,
+const unsigned char syscall_fullsave[NSYSCALLTAB] = {
+#include "syscalls.def"
+};
+#undef SYSCALL
+const unsigned syscall_nfullsave = NSYSCALLTAB;
+
+/*
+ * Statistics: how many times each call was made and how long it took
+ * in all, from entry to return (so including any time spent asleep).
+ * Each cpu has its own row, which only it writes, with interrupts off
+ * so that nothing else on the cpu gets in between; a call that moves
+ * to another cpu while it runs has its time added there. Reading the
+ * rows isn't synchronized, so totals may be slightly stale.
+ */
+struct syscall_stat {
+	uint64_t ss_nsecs;		/* time spent in the call */
+	uint32_t ss_calls;		/* times it was made */
+};
+static struct syscall_stat syscall_stats[MAXCPUS][NSYSCALLTAB];
+
+static
+void
+syscall_count(unsigned callno)
+{
+	int spl;
+
+	spl = splhigh();
+	syscall_stats[curcpu->c_number][callno].ss_calls++;
+	splx(spl);
+}
+
+/* Returns the time taken, for the trace. */
+static
+uint64_t
+syscall_addtime(unsigned callno, const struct timespec *start)
+{
+	struct timespec end, diff;
+	uint64_t nsecs;
+	int spl;
+
+	gettime(&end);
+	timespec_sub(&end, start, &diff);
+	nsecs = (uint64_t)diff.tv_sec * 1000000000 + diff.tv_nsec;
+
+	spl = splhigh();
+	syscall_stats[curcpu->c_number][callno].ss_nsecs += nsecs;
+	splx(spl);
+	return nsecs;
+}
+
+/*
+ * Print the statistics of every call that has been made (for the
+ * kernel menu).
+ */
+void
+syscall_printstats(void)
+{
+	unsigned callno, i;
+	uint64_t nsecs;
+	uint32_t calls;
+
+	kprintf("%-20s %10s %12s %10s\n", "syscall", "calls", "total ms",
+		"avg us");
+	for (callno = 0; callno < NSYSCALLTAB; callno++) {
+		if (syscall_table[callno].sd_func == NULL) {
+			continue;
+		}
+		calls = 0;
+		nsecs = 0;
+		/* rows of cpus that don't exist are all zero */
+		for (i = 0; i < MAXCPUS; i++) {
+			calls += syscall_stats[i][callno].ss_calls;
+			nsecs += syscall_stats[i][callno].ss_nsecs;
+		}
+		if (calls == 0) {
+			continue;
+		}
+		kprintf("%-20s %10u %12llu %10llu\n",
+			syscall_table[callno].sd_name, calls,
+			(unsigned long long)(nsecs / 1000000),
+			(unsigned long long)(nsecs / calls / 1000));
+	}
+}
+
+/*
+ * The same, for kstat: syscall.NAME.calls and syscall.NAME.nsecs.
+ */
+void
+syscall_kstat(struct kstat *ks)
+{
+	unsigned callno, i;
+	uint64_t nsecs;
+	uint32_t calls;
+
+	for (callno = 0; callno < NSYSCALLTAB; callno++) {
+		if (syscall_table[callno].sd_func == NULL) {
+			continue;
+		}
+		calls = 0;
+		nsecs = 0;
+		for (i = 0; i < MAXCPUS; i++) {
+			calls += syscall_stats[i][callno].ss_calls;
+			nsecs += syscall_stats[i][callno].ss_nsecs;
+		}
+		if (calls == 0) {
+			continue;
+		}
+		kstat_put(ks, calls, "syscall.%s.calls",
+			  syscall_table[callno].sd_name);
+		kstat_put(ks, nsecs, "syscall.%s.nsecs",
+			  syscall_table[callno].sd_name);
+	}
+}
+
+/*
+ * Tracing. When it's on, each call (of one process, or of all) is
+ * recorded in a ring of the cpu it was made on, oldest records being
+ * overwritten. The record is filled in at entry, so calls that never
+ * come back (_exit, a successful execv) show up too, and completed
+ * with the result and the time taken when the call returns, unless
+ * by then the ring has gone all the way round over it. Only the
+ * first four argument words are kept.
+ *
+ * The rings are allocated the first time tracing is turned on and
+ * are never freed. With tracing off, all a call costs is the test of
+ * syscall_tracing.
+ */
+#define SYSCALL_TRACE_RECS	128
+#define SYSCALL_TRACE_ARGS	4
+
+struct syscall_tracerec {
+	uint32_t tr_seq;		/* 0 if the slot was never used */
+	pid_t tr_pid;
+	int tr_callno;
+	uint32_t tr_args[SYSCALL_TRACE_ARGS];
+	bool tr_done;			/* the call has returned */
+	int tr_err;
+	int32_t tr_ret;
+	uint32_t tr_usecs;
+};
+
+struct syscall_tracering {
+	uint32_t sr_seq;		/* last sequence number given out */
+	unsigned sr_next;		/* slot to use next */
+	struct syscall_tracerec sr_recs[SYSCALL_TRACE_RECS];
+};
+
+static struct syscall_tracering *syscall_tracerings[MAXCPUS];
+static volatile bool syscall_tracing;
+static volatile pid_t syscall_tracepid;		/* 0 for every process */
+
+/*
+ * Turn tracing on, for process PID only or, if PID is 0, for all of
+ * them. If it was off, the rings are emptied first.
+ */
+int
+syscall_trace_start(pid_t pid)
+{
+	struct syscall_tracering *sr;
+	unsigned i, n;
+
+	n = cpu_count();
+	KASSERT(n <= MAXCPUS);
+	for (i = 0; i < n; i++) {
+		if (syscall_tracerings[i] != NULL) {
+			continue;
+		}
+		sr = kmalloc(sizeof(*sr));
+		if (sr == NULL) {
+			return ENOMEM;
+		}
+		bzero(sr, sizeof(*sr));
+		syscall_tracerings[i] = sr;
+	}
+
+	if (!syscall_tracing) {
+		for (i = 0; i < n; i++) {
+			sr = syscall_tracerings[i];
+			bzero(sr, sizeof(*sr));
+		}
+	}
+	syscall_tracepid = pid;
+	membar_store_store();
+	syscall_tracing = true;
+	return 0;
+}
+
+void
+syscall_trace_stop(void)
+{
+	syscall_tracing = false;
+}
+
+/*
+ * At entry to a traced call: take a slot and fill in what is known.
+ * Returns the slot, or NULL if the call isn't traced, and in SEQ its
+ * sequence number, which tells whether the slot is still ours when
+ * the call returns.
+ */
+static
+struct syscall_tracerec *
+syscall_trace_enter(int callno, const uint32_t *a, uint32_t *seq)
+{
+	struct syscall_tracering *sr;
+	struct syscall_tracerec *tr;
+	pid_t pid, tracepid;
+	int spl;
+
+	pid = curproc->p_pid;
+	tracepid = syscall_tracepid;
+	if (tracepid != 0 && pid != tracepid) {
+		return NULL;
+	}
+
+	spl = splhigh();
+	sr = syscall_tracerings[curcpu->c_number];
+	if (sr == NULL) {
+		/* cpu came up after tracing was turned on */
+		splx(spl);
+		return NULL;
+	}
+	tr = &sr->sr_recs[sr->sr_next];
+	sr->sr_next = (sr->sr_next + 1) % SYSCALL_TRACE_RECS;
+	if (++sr->sr_seq == 0) {
+		sr->sr_seq = 1;
+	}
+	*seq = sr->sr_seq;
+
+	tr->tr_seq = *seq;
+	tr->tr_pid = pid;
+	tr->tr_callno = callno;
+	memcpy(tr->tr_args, a, sizeof(tr->tr_args));
+	tr->tr_done = false;
+	splx(spl);
+	return tr;
+}
+
+/*
+ * When a traced call returns. This may be on another cpu than the
+ * one the call started on; splhigh isn't enough to keep that cpu
+ * from reusing the slot meanwhile, but a record that races with it
+ * is at worst mixed up, and the rings are only diagnostics.
+ */
+static
+void
+syscall_trace_exit(struct syscall_tracerec *tr, uint32_t seq,
+		   int err, int32_t ret, uint64_t nsecs)
+{
+	int spl;
+
+	spl = splhigh();
+	if (tr->tr_seq == seq) {
+		tr->tr_err = err;
+		tr->tr_ret = ret;
+		tr->tr_usecs = nsecs / 1000;
+		tr->tr_done = true;
+	}
+	splx(spl);
+}
+
+/*
+ * Print the contents of the rings, oldest first, one cpu at a time
+ * (for the kernel menu).
+ */
+void
+syscall_trace_print(void)
+{
+	struct syscall_tracering *sr;
+	struct syscall_tracerec *tr;
+	unsigned i, j, k, nargs;
+	const char *name;
+
+	kprintf("Tracing is %s", syscall_tracing ? "on" : "off");
+	if (syscall_tracing && syscall_tracepid != 0) {
+		kprintf(" for pid %d", syscall_tracepid);
+	}
+	kprintf("\n");
+
+	for (i = 0; i < MAXCPUS; i++) {
+		sr = syscall_tracerings[i];
+		if (sr == NULL) {
+			continue;
+		}
+		kprintf("cpu%u:\n", i);
+		for (j = 0; j < SYSCALL_TRACE_RECS; j++) {
+			tr = &sr->sr_recs[(sr->sr_next + j) % SYSCALL_TRACE_RECS];
+			if (tr->tr_seq == 0) {
+				continue;
+			}
+			name = syscall_table[tr->tr_callno].sd_name;
+			nargs = syscall_table[tr->tr_callno].sd_nwords;
+			if (nargs > SYSCALL_TRACE_ARGS) {
+				nargs = SYSCALL_TRACE_ARGS;
+			}
+			kprintf("%8u pid %d %s(", tr->tr_seq, tr->tr_pid, name);
+			for (k = 0; k < nargs; k++) {
+				kprintf("%s0x%x", k > 0 ? ", " : "",
+					tr->tr_args[k]);
+			}
+			if (!tr->tr_done) {
+				kprintf(") ...\n");
+			}
+			else if (tr->tr_err) {
+				kprintf(") = -1 %s, %u us\n",
+					strerror(tr->tr_err), tr->tr_usecs);
+			}
+			else {
+				kprintf(") = %d, %u us\n", tr->tr_ret,
+					tr->tr_usecs);
+			}
+		}
+	}
+}
+
 /*
  * System call dispatcher.
  *
@@ -78,13 +490,21 @@
  * values) further arguments must be fetched from the user-level
  * stack, starting at sp+16 to skip over the slots for the
  * registerized values, with copyin().
+ *
+ * All of this is done here, the same way for every call, from the
+ * description of its arguments in syscalls.def.
  */
 void
 syscall(struct trapframe *tf)
 {
+	const struct syscall_desc *sd;
+	struct syscall_tracerec *tr;
+	struct timespec start;
+	uint64_t nsecs;
+	uint32_t trseq;
+	uint32_t a[SYSCALL_MAXWORDS];
+	int32_t rv[2];
 	int callno;
-	int32_t retval_low32, retval_upp32;
-	off_t pos;
 	int err;
 
 	KASSERT(curthread != NULL);
@@ -102,149 +522,46 @@ syscall(struct trapframe *tf)
 	 * like write.
 	 */
 
-	retval_low32 = 0;
-	retval_upp32 = 0;
-
-	switch (callno) {
-	    case SYS_reboot:
-			err = sys_reboot(tf->tf_a0);
-		break;
-
-	    case SYS___time:
-			err = sys___time((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1);
-		break;
+	rv[0] = 0;
+	rv[1] = 0;
 
 #if OPT_SHELL
-
-		/* write() SYSTEM CALL */
-		case SYS_write:
-			err = sys_write_SHELL(
-				(int) tf->tf_a0, 
-				(void *) tf->tf_a1, 
-				(size_t) tf->tf_a2, 
-				&retval_low32
-			);
-		break;
-
-		/* read() SYSTEM CALL */
-		case SYS_read:
-			err = sys_read_SHELL(
-				(int) tf->tf_a0, 
-				(void *) tf->tf_a1, 
-				(size_t) tf->tf_a2, 
-				&retval_low32
-			);
-		break;
-
-		/* open() SYSTEM CALL */
-		case SYS_open:
-			err = sys_open_SHELL(
-				(userptr_t) tf->tf_a0, 
-				(int) tf->tf_a1, 
-				(mode_t) tf->tf_a2, 
-				&retval_low32
-			);
-		break;
-
-		/* close() SYSTEM CALL */
-		case SYS_close:
-			err = sys_close_SHELL(
-				(int) tf->tf_a0
-			);
-		break;
-
-		/* remove() SYSTEM CALL */
-		case SYS_remove:
-			err = sys_remove_SHELL(
-				(char *) tf->tf_a0
-			);
-		break;
-
-		/* chdir() SYSTEM CALL */
-		case SYS_chdir:
-			err = sys_chdir_SHELL(
-				(char *) tf->tf_a0
-			);
-		break;
-
-		/* lseek() SYSTEM CALL */
-		case SYS_lseek:
-			pos = tf->tf_a2;
-			pos <<= 32;
-			pos |= tf->tf_a3;
-			err = sys_lseek_SHELL(
-				(int) tf->tf_a0,	/* file descriptor fd */
-				pos,	/* pos */
-				*(int32_t *)(tf->tf_sp+16),
-				(int32_t *) &retval_low32,
-				(int32_t *) &retval_upp32
-			);
-		break;
-
-		/* dup2() SYSTEM CALL */
-		case SYS_dup2:
-			err = sys_dup2_SHELL(
-				(int) tf->tf_a0,
-				(int) tf->tf_a1,
-				&retval_low32
-			);
-		break;
-
-		/* __getcwd() SYSTEM CALL */
-		case SYS___getcwd:
-			err = sys_getcwd_SHELL(
-				(char *) tf->tf_a0,
-				(size_t) tf->tf_a1,
-				&retval_low32
-			);
-		break;
-
-		/* getpid() SYSTEM CALL */
-		case SYS_getpid:
-			err = sys_getpid_SHELL(
-				(pid_t *) &retval_low32
-			);
-		break;
-
-		/* waitpid() SYSTEM CALL */
-		case SYS_waitpid:
-			err = sys_waitpid_SHELL(
-				(pid_t) tf->tf_a0,
-				(int *) tf->tf_a1,
-				(int) tf->tf_a2,
-				(pid_t *) &retval_low32
-			);
-		break;
-
-		/* _exit() SYSTEM CALL */
-		case SYS__exit:
-			sys_exit_SHELL(
-				(int) tf->tf_a0
-			);
-			err = 0;		
-		break;
-
-		/* fork() SYSTEM CALL */
-		case SYS_fork:
-			err = sys_fork_SHELL(
-				tf, 
-				(pid_t *) &retval_low32
-			);
-		break;
-
-		/* execv() SYSTEM CALL */
-		case SYS_execv:
-			err = sys_execv_SHELL(
-				(char *) tf->tf_a0,
-				(char **) tf->tf_a1
-			);
-		break;
+	proc_charge_syscall(callno);
 #endif
 
-	    default:
-			kprintf("Unknown syscall %d\n", callno);
-			err = ENOSYS;
-		break;
+	if (callno < 0 || (unsigned)callno >= NSYSCALLTAB ||
+	    syscall_table[callno].sd_func == NULL) {
+		kprintf("Unknown syscall %d\n", callno);
+		err = ENOSYS;
+	}
+	else {
+		sd = &syscall_table[callno];
+		KASSERT(sd->sd_nwords <= SYSCALL_MAXWORDS);
+
+		a[0] = tf->tf_a0;
+		a[1] = tf->tf_a1;
+		a[2] = tf->tf_a2;
+		a[3] = tf->tf_a3;
+		err = 0;
+		if (sd->sd_nwords > 4) {
+			err = copyin((const_userptr_t)(tf->tf_sp + 16), &a[4],
+				     (sd->sd_nwords - 4) * sizeof(a[0]));
+		}
+		if (!err) {
+			/* counted first, since _exit doesn't come back */
+			syscall_count(callno);
+			tr = NULL;
+			if (__predict_false(syscall_tracing)) {
+				tr = syscall_trace_enter(callno, a, &trseq);
+			}
+			gettime(&start);
+			err = sd->sd_func(tf, a, rv);
+			nsecs = syscall_addtime(callno, &start);
+			if (tr != NULL) {
+				syscall_trace_exit(tr, trseq, err, rv[0],
+						   nsecs);
+			}
+		}
 	}
 
 
@@ -259,8 +576,8 @@ syscall(struct trapframe *tf)
 	}
 	else {
 		/* Success. */
-		tf->tf_v0 = retval_low32;
-		tf->tf_v1 = retval_upp32;
+		tf->tf_v0 = rv[0];
+		tf->tf_v1 = rv[1];
 		tf->tf_a3 = 0;      /* signal no error */
 	}
 
@@ -29,15 +29,44 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/mman.h>
 #include <lib.h>
 #include <spl.h>
 #include <cpu.h>
+#include <counter.h>
 #include <spinlock.h>
+#include <membar.h>
+#include <synch.h>
+#include <wchan.h>
+#include <thread.h>
 #include <proc.h>
 #include <current.h>
 #include <mips/tlb.h>
+#include <uio.h>
+#include <stat.h>
+#include <vnode.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <kstat.h>
+#include <clock.h>
+#include <kern/time.h>
+#include <kern/kinfo.h>
+#include <kern/shm.h>
+#include <checkpoint.h>
+#include <vmprivate.h>
+#include <buddy.h>
+#include <pcpcache.h>
+#include <frame.h>
+#include <zpool.h>
+#include <compact.h>
+#include <cow.h>
+#include <textcache.h>
+#include <mapcache.h>
+#include <mmap.h>
+#include <shm.h>
+#include <kinfo.h>
+#include <vmalloc.h>
+#include <platform/maxcpus.h>
 
 /*
  * Dumb MIPS-only "VM system" that is intended to only be just barely
@@ -59,273 +88,2010 @@
 /* (this must be > 64K so argument blocks of size ARG_MAX will fit) */
 #define DUMBVM_STACKPAGES    18
 
+/* how far a lazily grown stack may go, in pages (tunable) */
+unsigned vm_stackpages = 64;
+
+#if OPT_SHELL
+/*
+ * With page tables the stack starts out STACK_INITPAGES long and grows
+ * down on fault to as much as vm_stackpages (clamped to between
+ * DUMBVM_STACKPAGES and STACK_MAXPAGES, which stops short of the
+ * kernel info pages), keeping a guard page clear below it.
+ */
+#define STACK_INITPAGES      1
+#define STACK_MAXPAGES \
+	((USERSTACK - KINFO_VADDR) / PAGE_SIZE - KINFO_NPAGES - 1)
+
+/*
+ * How far stacks set up now may grow: vm_stackpages, within bounds.
+ */
+size_t
+stack_maxpages(void)
+{
+	if (vm_stackpages < DUMBVM_STACKPAGES) {
+		return DUMBVM_STACKPAGES;
+	}
+	if (vm_stackpages > STACK_MAXPAGES) {
+		return STACK_MAXPAGES;
+	}
+	return vm_stackpages;
+}
+#endif
+
+/*
+ * Wrap ram_stealmem in a spinlock.
+ */
+static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
+
+#if OPT_SHELL
+/*
+ * Everything but the TLB refill fast path runs under vm_lock (see
+ * below). shootdown_sem counts the shootdowns other cpus have done.
+ */
+struct lock *vm_lock;
+static struct semaphore *shootdown_sem;
+
+static void as_printstats(void);
+static void as_kstat(struct kstat *ks);
+static void as_printfaults(void);
+#endif
+
+/**
+ * @brief Initialize allocation table and stuff
+ * 
+ */
+void vm_bootstrap(void) {
+#if OPT_SHELL
+	/* TAKING OVER ALL REMAINING MEMORY (ram_stealmem WILL FAIL FROM NOW ON) */
+	if (buddy_bootstrap()) {
+		return;
+	}
+
+	vm_lock = lock_create("vm");
+	shootdown_sem = sem_create("vm shootdown", 0);
+	if (vm_lock == NULL || shootdown_sem == NULL) {
+		panic("dumbvm: cannot create the vm lock\n");
+	}
+
+	/* REFERENCE COUNTS FOR FRAMES SHARED BY COPY-ON-WRITE */
+	if (frame_bootstrap()) {
+		panic("dumbvm: no memory for frame reference counts\n");
+	}
+
+	/* PRE-ZEROED PAGES FOR PAGE FAULTS */
+	if (zpool_bootstrap()) {
+		panic("dumbvm: cannot start the page zeroing thread\n");
+	}
+
+	/* THE TIME PAGE OF THE KERNEL INFO PAGES */
+	if (kinfo_bootstrap()) {
+		panic("dumbvm: no memory for the kernel info page\n");
+	}
+
+	/* THE PAGE TABLE OF THE VMALLOC AREA */
+	if (kvm_bootstrap()) {
+		panic("dumbvm: no memory for the vmalloc page table\n");
+	}
+
+	return;
+#endif
+}
+
+
+/*
+ * Check if we're in a context that can sleep. While most of the
+ * operations in dumbvm don't in fact sleep, in a real VM system many
+ * of them would. In those, assert that sleeping is ok. This helps
+ * avoid the situation where syscall-layer code that works ok with
+ * dumbvm starts blowing up during the VM assignment.
+ */
+void
+dumbvm_can_sleep(void)
+{
+	if (CURCPU_EXISTS()) {
+		/* must not hold spinlocks */
+		KASSERT(curcpu->c_spinlocks == 0);
+
+		/* must not be in an interrupt handler */
+		KASSERT(curthread->t_in_interrupt == 0);
+	}
+}
+
+
+/**
+ * @brief retrieves a valid address in which space in memory starts, based on the amount 
+ * 		  of pages (unsigned long npages) required by the process,
+ * 
+ * @param npages number of pages required by the process
+ * @return paddr_t a valid address
+ */
+static paddr_t getppages(unsigned long npages) {
+#if OPT_SHELL
+	/* GETTING PHYSICAL ADDRESS OF THE FREE PAGES */
+	paddr_t addr = getfreeppages(npages);
+#else
+	paddr_t addr = 0;
+#endif
+	
+	if (addr == 0) {
+
+		/* NO FREE PAGES FOUND (ONLY USEFUL BEFORE vm_bootstrap) */
+		spinlock_acquire(&stealmem_lock);
+		addr = ram_stealmem(npages);							
+		spinlock_release(&stealmem_lock);
+	}
+
+	return addr;
+}
+
+/* Allocate/free some kernel-space virtual pages */
+vaddr_t
+alloc_kpages(unsigned npages)
+{
+	paddr_t pa;
+
+	dumbvm_can_sleep();
+	pa = getppages(npages);
+#if OPT_SHELL
+	if (pa == 0 && thread_reclaim() > 0) {
+		/* Spare thread stacks and structures go first */
+		pa = getppages(npages);
+	}
+	if (pa == 0 && npages == 1) {
+		/* The zeroed pool is memory too */
+		pa = zpool_take();
+	}
+	if (pa == 0 && npages > 1) {
+		/* Enough pages free, maybe, but not next to each other */
+		pa = compact_kpages(npages);
+	}
+#endif
+	if (pa==0) {
+		return 0;
+	}
+	return PADDR_TO_KVADDR(pa);
+}
+
+
+/**
+ * @brief release memory starting at the address given, based on the size recorded at allocation
+ * 
+ * @param addr starting address of the memory block to release
+ */
+void free_kpages(vaddr_t addr) {
+#if OPT_SHELL
+	/* FREEING THE PAGES */
+	freeppages(addr - MIPS_KSEG0);
+#else
+	(void) addr;
+#endif
+}
+
+/**
+ * @brief Print physical memory statistics: free pages in the buddy allocator,
+ *        the hit rate of the per-cpu page caches and how many free blocks there
+ *        are of each size, which shows how fragmented memory is, then those of
+ *        the rest of the VM system. Counters are read without synchronization,
+ *        so they may be slightly stale.
+ */
+void vm_printstats(void) {
+#if OPT_SHELL
+	if (!buddy_isactive()) {
+		kprintf("dumbvm: page allocator not active\n");
+		return;
+	}
+
+	buddy_printstats();
+	pcp_printstats();
+	vmalloc_printstats();
+	as_printstats();
+#endif
+}
+
+
+/**
+ * @brief Print the faults and TLB refills of each cpu: loads, stores that missed,
+ *        stores to read-only entries and faults that failed; misses refilled by the
+ *        fast path and faults that took the slow one; and the entries loaded into a
+ *        random slot, each of which may have evicted a live one. The faults of each
+ *        process are shown by ps.
+ */
+void vm_printfaults(void) {
+#if OPT_SHELL
+	as_printfaults();
+#endif
+}
+
+/**
+ * @brief The statistics of vm_printstats, for kstat (vm.*, swap.*). The per-cpu
+ *        cache counters are per-cpu counters, and go in with the others.
+ */
+void vm_kstat(struct kstat *ks) {
+#if OPT_SHELL
+	if (!buddy_isactive()) {
+		return;
+	}
+
+	buddy_kstat(ks);
+	pcp_kstat(ks);
+	as_kstat(ks);
+#else
+	(void)ks;
+#endif
+}
+
+/**
+ * @brief Report the number of free pages (including those sitting in the per-cpu
+ *        caches) and the size, in pages, of the largest free block. Used by the
+ *        kernel heap timeline; callable from interrupt context.
+ */
+void vm_freestats(unsigned long *freepages, unsigned long *largest) {
+#if OPT_SHELL
+	buddy_freestats(freepages, largest);
+#else
+	*freepages = 0;
+	*largest = 0;
+#endif
+}
+
+
+#if OPT_SHELL
+/*
+ *  +----------------------------+
+ *  | PAGE-TABLE ADDRESS SPACES  |
+ *  +----------------------------+
+ *
+ * User memory is mapped page by page through a two-level page table:
+ * as_pagetable is a directory of PT_DIRSIZE pointers, each to a
+ * second-level table of PT_TABSIZE entries (allocated when first
+ * needed). An entry holds the physical frame plus the PTE_* flags
+ * (vmprivate.h).
+ * Which addresses are valid at all is given by as_regions, a sorted
+ * list of regions (one per ELF segment, plus the stack); their pages
+ * are not physically contiguous, and writes to a region that was not
+ * defined writeable fault. The list is mirrored in as_regindex, an
+ * array rebuilt after regions come or go, so that the region of an
+ * address is found by binary search; as_checkrange uses it to tell a
+ * system call whether a user buffer is valid before touching it. The stack region grows down when a fault
+ * lands below it, as far as as_stackmax pages; mmap leaves that room
+ * free, plus a guard page.
+ *
+ * as_copy does not copy memory: both address spaces map the same
+ * frames, copy-on-write (vm/cow.c).
+ *
+ * Nothing is allocated when a program is loaded: load_elf only records
+ * where in the executable each segment's contents live (as_define_file)
+ * and pages are filled in by vm_fault on first touch, either read from
+ * the executable or zero-filled.
+ *
+ * TLB entries are tagged with an address-space ID, so switching
+ * between processes does not flush the TLB. ASIDs are handed out per
+ * cpu: each cpu gives out 1..NUM_ASID-1 in turn and, when it runs out,
+ * flushes its TLB and starts a new generation. An address space
+ * remembers the ASID and generation it got on each cpu; if the
+ * generation is stale it gets a new ASID when next activated there.
+ * Forgetting an address space's ASIDs is also how stale translations
+ * are discarded on other cpus when a mapping changes.
+ *
+ * A TLB miss on a page that is already mapped with the right
+ * permissions is the common case; vm_fault handles it straight from
+ * the page table without looking at the region list.
+ *
+ * The physical page allocator, the frame table and paging, the text
+ * and file caches, copy-on-write, mmap, shared memory, the vmalloc
+ * area and the kernel info pages are machine-independent and live in
+ * kern/vm; they work on the page tables and the TLB through what this
+ * file exports in vmprivate.h.
+ *
+ * Everything except the TLB refill fast path runs under vm_lock.
+ * Changing a valid PTE is always followed by invalidating it in every
+ * TLB that may hold it, so the fast path (which runs with interrupts
+ * off, and so cannot miss a shootdown) needs no lock.
+ */
+#define PT_DIRSIZE	1024
+#define PT_TABSIZE	1024
+#define PT_DIRINDEX(va)	(((va) >> 22) & (PT_DIRSIZE - 1))
+#define PT_TABINDEX(va)	(((va) >> 12) & (PT_TABSIZE - 1))
+
+
+#define NUM_ASID	64		/* 6-bit TLBHI_PID field */
+#define TS_NEWASID	1		/* ts_vaddr meaning "switch ASID", not a page */
+#define TLB_PROBEMAX	8		/* probe up to this many pages; else scan */
+#define TLBHI_PIDSHIFT	6
+#define TLBHI_PID	0x00000fc0
+#define TLBLO_GLOBAL	0x00000100	/* matches under every ASID */
+
+/*
+ * Per-cpu ASID allocator state, and TLB refill statistics. Written
+ * by its own cpu on every TLB miss, so each gets its own cache line.
+ */
+struct asid_cpu {
+	uint32_t ac_gen;		/* current generation, from 1 */
+	unsigned ac_next;		/* next ASID to hand out */
+	unsigned ac_fast;		/* misses refilled by the fast path */
+	unsigned ac_slow;		/* faults that took the full path */
+	unsigned ac_rollovers;		/* times we ran out of ASIDs */
+} __cacheline_aligned;
+
+static struct asid_cpu asid_cpus[MAXCPUS];
+
+/*
+ * Memory accounting.
+ *
+ * Each page an address space may need a frame of its own for is
+ * committed up front: the writable pages of its program segments,
+ * heap and stack, its anonymous and writable private mappings, and
+ * (in as_copy) whatever its parent had committed, since copy-on-write
+ * pages may all turn into copies. Shared memory segments are committed
+ * when they are made. A request that would take the total past the
+ * limit is refused there and then with ENOMEM, in exec, fork, sbrk,
+ * mmap or shmget, rather than in a page fault later on. Read-only text
+ * and shared file pages are not committed, as they can always be
+ * dropped and read in again.
+ *
+ * The limit is COMMIT_RATIO times what RAM and swap can hold, as
+ * programs often use large arrays sparsely (see testbin/huge). Neither
+ * that nor the kernel heap is accounted for, so faults can still run
+ * short of frames; vm_oom then has the largest process killed.
+ */
+#define COMMIT_RATIO	2
+#define OOM_WAITNS	10000000	/* 10 ms */
+#define OOM_WAITS	100		/* for the victim to go away */
+
+static struct spinlock commit_lock = SPINLOCK_INITIALIZER;
+static unsigned long vm_committed;	/* pages, over all address spaces */
+static unsigned vm_commitfails;		/* requests refused */
+static unsigned oom_pending;		/* victims not gone yet */
+static bool oom_killing;		/* a victim is being picked */
+static unsigned oom_kills, oom_waits;
+
+static
+unsigned long
+vm_commitlimit(void)
+{
+	return COMMIT_RATIO * (buddy_npages - FRAME_RESERVE + swap_size());
+}
+
+/*
+ * Commit NPAGES more pages, if the limit allows.
+ */
+bool
+vm_commit(unsigned long npages)
+{
+	unsigned long limit = vm_commitlimit();
+	bool ok;
+
+	spinlock_acquire(&commit_lock);
+	ok = vm_committed <= limit && npages <= limit - vm_committed;
+	if (ok) {
+		vm_committed += npages;
+	}
+	else {
+		vm_commitfails++;
+	}
+	spinlock_release(&commit_lock);
+	return ok;
+}
+
+void
+vm_uncommit(unsigned long npages)
+{
+	spinlock_acquire(&commit_lock);
+	KASSERT(vm_committed >= npages);
+	vm_committed -= npages;
+	spinlock_release(&commit_lock);
+}
+
+/*
+ * Commit NPAGES more pages to AS, or fail with ENOMEM.
+ */
+int
+as_reserve(struct addrspace *as, unsigned long npages)
+{
+	if (!vm_commit(npages)) {
+		return ENOMEM;
+	}
+	spinlock_acquire(&commit_lock);
+	as->as_commit += npages;
+	spinlock_release(&commit_lock);
+	return 0;
+}
+
+void
+as_unreserve(struct addrspace *as, unsigned long npages)
+{
+	spinlock_acquire(&commit_lock);
+	KASSERT(as->as_commit >= npages);
+	as->as_commit -= npages;
+	spinlock_release(&commit_lock);
+	vm_uncommit(npages);
+}
+
+unsigned long
+as_committed(struct addrspace *as)
+{
+	return as->as_commit;
+}
+
+void
+as_oomvictim(struct addrspace *as)
+{
+	spinlock_acquire(&commit_lock);
+	if (!as->as_oomkilled) {
+		as->as_oomkilled = true;
+		oom_pending++;
+	}
+	spinlock_release(&commit_lock);
+}
+
+/*
+ * A page fault of the current process found no frame. Unless a victim
+ * killed earlier is still on its way out, have the process with the
+ * most memory committed killed (proc_oomkill); then wait a while for
+ * the victim to go away. Returns true if the fault should be retried,
+ * false if it should fail (as when the current process was the one).
+ */
+static
+bool
+vm_oom(void)
+{
+	struct timespec deadline, step;
+	bool kill;
+	unsigned i;
+
+	if (curproc->p_exiting) {
+		return false;
+	}
+
+	spinlock_acquire(&commit_lock);
+	kill = oom_pending == 0 && !oom_killing;
+	if (kill) {
+		oom_killing = true;
+	}
+	else {
+		oom_waits++;
+	}
+	spinlock_release(&commit_lock);
+
+	if (kill) {
+		kill = proc_oomkill() > 0;
+		spinlock_acquire(&commit_lock);
+		oom_killing = false;
+		if (kill) {
+			oom_kills++;
+		}
+		spinlock_release(&commit_lock);
+		if (!kill) {
+			/* Nobody left to kill */
+			return false;
+		}
+	}
+
+	step.tv_sec = 0;
+	step.tv_nsec = OOM_WAITNS;
+	for (i=0; i<OOM_WAITS && oom_pending > 0 && !curproc->p_exiting; i++) {
+		gettime(&deadline);
+		timespec_add(&deadline, &step, &deadline);
+		timer_sleep(&deadline);
+	}
+	return !curproc->p_exiting;
+}
+
+static
+void
+as_printstats(void)
+{
+	unsigned fast = 0, slow = 0, rollovers = 0;
+
+	for (int i = 0; i < MAXCPUS; i++) {
+		fast += asid_cpus[i].ac_fast;
+		slow += asid_cpus[i].ac_slow;
+		rollovers += asid_cpus[i].ac_rollovers;
+	}
+	kprintf("dumbvm: tlb refills: %u fast, %u slow; %u asid rollovers\n",
+		fast, slow, rollovers);
+	frame_printstats();
+	kprintf("dumbvm: new user stacks grow to %u pages\n",
+		(unsigned)stack_maxpages());
+	compact_printstats();
+	textcache_printstats();
+	mapcache_printstats();
+	zpool_printstats();
+	kprintf("dumbvm: committed: %lu of %lu pages, %u requests refused\n",
+		vm_committed, vm_commitlimit(), vm_commitfails);
+	kprintf("dumbvm: out of memory: %u processes killed, %u faults "
+		"waited\n", oom_kills, oom_waits);
+	swap_printstats();
+}
+
+static
+void
+as_kstat(struct kstat *ks)
+{
+	unsigned fast = 0, slow = 0, rollovers = 0;
+
+	for (int i = 0; i < MAXCPUS; i++) {
+		fast += asid_cpus[i].ac_fast;
+		slow += asid_cpus[i].ac_slow;
+		rollovers += asid_cpus[i].ac_rollovers;
+	}
+	kstat_put(ks, fast, "vm.tlb.fast");
+	kstat_put(ks, slow, "vm.tlb.slow");
+	kstat_put(ks, rollovers, "vm.asid.rollovers");
+	frame_kstat(ks);
+	compact_kstat(ks);
+	textcache_kstat(ks);
+	mapcache_kstat(ks);
+	zpool_kstat(ks);
+	kstat_put(ks, vm_committed, "vm.commit.pages");
+	kstat_put(ks, vm_commitlimit(), "vm.commit.limit");
+	kstat_put(ks, vm_commitfails, "vm.commit.refused");
+	kstat_put(ks, oom_kills, "vm.oom.kills");
+	kstat_put(ks, oom_waits, "vm.oom.waits");
+	swap_kstat(ks);
+}
+
+static
+void
+as_printfaults(void)
+{
+	static const unsigned ids[] = {
+		COUNTER_VM_READFAULTS, COUNTER_VM_WRITEFAULTS,
+		COUNTER_VM_ROFAULTS, COUNTER_VM_BADFAULTS, COUNTER_TLB_RANDOM,
+	};
+	unsigned n[ARRAYCOUNT(ids)], total[ARRAYCOUNT(ids)];
+	unsigned fast = 0, slow = 0;
+	unsigned i, j, ncpus;
+
+	kprintf("%3s %9s %9s %9s %6s %9s %9s %9s\n", "cpu", "read", "write",
+		"readonly", "bad", "fast", "slow", "random");
+	ncpus = cpu_count();
+	for (j = 0; j < ARRAYCOUNT(ids); j++) {
+		total[j] = 0;
+	}
+	for (i = 0; i < ncpus; i++) {
+		for (j = 0; j < ARRAYCOUNT(ids); j++) {
+			n[j] = counter_cpu(ids[j], i);
+			total[j] += n[j];
+		}
+		fast += asid_cpus[i].ac_fast;
+		slow += asid_cpus[i].ac_slow;
+		kprintf("%3u %9u %9u %9u %6u %9u %9u %9u\n", i, n[0], n[1],
+			n[2], n[3], asid_cpus[i].ac_fast, asid_cpus[i].ac_slow,
+			n[4]);
+	}
+	kprintf("all %9u %9u %9u %6u %9u %9u %9u\n", total[0], total[1],
+		total[2], total[3], fast, slow, total[4]);
+}
+
+/*
+ * Find the page table entry for VA. If CREATE is set, the
+ * second-level table is allocated if missing; otherwise NULL is
+ * returned for unmapped parts of the address space.
+ */
+uint32_t *
+pt_lookup(struct addrspace *as, vaddr_t va, bool create)
+{
+	uint32_t *table;
+
+	table = as->as_pagetable[PT_DIRINDEX(va)];
+	if (table == NULL) {
+		if (!create) {
+			return NULL;
+		}
+		table = kmalloc(PT_TABSIZE * sizeof(uint32_t));
+		if (table == NULL) {
+			return NULL;
+		}
+		bzero(table, PT_TABSIZE * sizeof(uint32_t));
+		as->as_pagetable[PT_DIRINDEX(va)] = table;
+	}
+	return &table[PT_TABINDEX(va)];
+}
+
+/*
+ * Set the current ASID, which lives in the PID field of c0_entryhi.
+ * Every tlb_* call overwrites c0_entryhi, so this must be redone after
+ * anything that passes a different PID or reads an entry back.
+ * Interrupts must be off.
+ */
+static
+void
+tlb_setasid(unsigned asid)
+{
+	uint32_t ehi = asid << TLBHI_PIDSHIFT;
+
+	__asm volatile("mtc0 %0, $10" :: "r" (ehi));	/* c0_entryhi */
+}
+
+/*
+ * Invalidate the whole TLB of this cpu. Interrupts must be off; the
+ * caller restores the current ASID.
+ */
+static
+void
+tlb_flushall(void)
+{
+	int i;
+
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+}
+
+/*
+ * Return this cpu's ASID for AS, giving it a new one if it has none in
+ * the current generation. Interrupts must be off.
+ */
+static
+unsigned
+as_getasid(struct addrspace *as)
+{
+	unsigned cpu = curcpu->c_number;
+	struct asid_cpu *ac = &asid_cpus[cpu];
+
+	if (ac->ac_gen == 0) {
+		ac->ac_gen = 1;
+		ac->ac_next = 1;
+	}
+	if (as->as_asidgen[cpu] != ac->ac_gen) {
+		if (ac->ac_next >= NUM_ASID) {
+			/* Out of ASIDs: everyone has to get a new one */
+			tlb_flushall();
+			ac->ac_gen++;
+			ac->ac_next = 1;
+			ac->ac_rollovers++;
+		}
+		as->as_asid[cpu] = ac->ac_next++;
+		as->as_asidgen[cpu] = ac->ac_gen;
+	}
+	return as->as_asid[cpu];
+}
+
+/*
+ * Make AS forget its ASIDs, so that no translation cached for it in
+ * any TLB can be used again; except on this cpu if KEEPCUR is set.
+ */
+static
+void
+as_dropasids(struct addrspace *as, bool keepcur)
+{
+	unsigned i, cpu;
+	int spl;
+
+	spl = splhigh();
+	cpu = curcpu->c_number;
+	for (i=0; i<MAXCPUS; i++) {
+		if (i != cpu || !keepcur) {
+			as->as_asidgen[i] = 0;
+		}
+	}
+	splx(spl);
+}
+
+/*
+ * Drop the translations for the NPAGES pages from VA in AS from this
+ * cpu's TLB. A few pages are probed for one by one; for more it is
+ * cheaper to read through the whole TLB once. Interrupts must be off.
+ */
+static
+void
+tlb_invalidate_local(struct addrspace *as, vaddr_t va, unsigned npages)
+{
+	unsigned cpu = curcpu->c_number;
+	uint32_t ehi, hi, lo, asid;
+	vaddr_t end;
+	int i;
+
+	if (as->as_asidgen[cpu] != asid_cpus[cpu].ac_gen) {
+		/* Nothing of AS can be in this TLB */
+		return;
+	}
+	asid = as->as_asid[cpu] << TLBHI_PIDSHIFT;
+	end = va + npages * PAGE_SIZE;
+
+	__asm volatile("mfc0 %0, $10" : "=r" (ehi));	/* c0_entryhi */
+	if (npages <= TLB_PROBEMAX) {
+		for (; va < end; va += PAGE_SIZE) {
+			i = tlb_probe(va | asid, 0);
+			if (i >= 0) {
+				tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(),
+					  i);
+			}
+		}
+	}
+	else {
+		for (i=0; i<NUM_TLB; i++) {
+			tlb_read(&hi, &lo, i);
+			if ((hi & TLBHI_PID) == asid &&
+			    (hi & TLBHI_VPAGE) >= va &&
+			    (hi & TLBHI_VPAGE) < end) {
+				tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(),
+					  i);
+			}
+		}
+	}
+	tlb_setasid((ehi & TLBHI_PID) >> TLBHI_PIDSHIFT);
+}
+
+/*
+ * Drop the translations for the NPAGES pages from VA in AS from this
+ * cpu's TLB, and queue a shootdown for them to each other cpu that
+ * may have some cached: one whose ASID for AS is still current. A cpu
+ * that never ran AS, or ran it only in an old ASID generation, is
+ * left alone. Returns how many cpus were sent one; the caller waits
+ * for them with tlb_shootdown_wait, and may queue several (no more
+ * than TLBSHOOTDOWN_MAX) first so that each cpu is interrupted once.
+ * vm_lock must be held, so no one else is using shootdown_sem.
+ */
+unsigned
+tlb_shootdown(struct addrspace *as, vaddr_t va, unsigned npages)
+{
+	struct tlbshootdown ts;
+	uint32_t mask;
+	unsigned i;
+	int spl;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+
+	spl = splhigh();
+	tlb_invalidate_local(as, va, npages);
+	splx(spl);
+
+	/*
+	 * The PTEs were changed before we get here; a cpu that gets an
+	 * ASID for AS after we look at it reloads from the new PTEs.
+	 */
+	membar_any_any();
+	mask = 0;
+	for (i=0; i<MAXCPUS; i++) {
+		if (asid_cpus[i].ac_gen != 0 &&
+		    as->as_asidgen[i] == asid_cpus[i].ac_gen) {
+			mask |= (uint32_t)1 << i;
+		}
+	}
+	if (mask == 0) {
+		return 0;
+	}
+
+	ts.ts_as = as;
+	ts.ts_vaddr = va;
+	ts.ts_npages = npages;
+	ts.ts_done = shootdown_sem;
+	return ipi_tlbshootdown_mask(&ts, mask);
+}
+
+/*
+ * Wait for N shootdowns queued by tlb_shootdown to be done.
+ */
+void
+tlb_shootdown_wait(unsigned n)
+{
+	while (n-- > 0) {
+		P(shootdown_sem);
+	}
+}
+
+/*
+ * Drop the translations for the NPAGES pages from VA in AS from every
+ * TLB, waiting for the other cpus to do it.
+ */
+void
+tlb_invalidate(struct addrspace *as, vaddr_t va, unsigned npages)
+{
+	tlb_shootdown_wait(tlb_shootdown(as, va, npages));
+}
+
+/*
+ * Make every other cpu that is running in AS (another thread of the
+ * same process) move to the fresh ASID AS got from as_dropasids, so
+ * that none of them keeps using translations cached under the old
+ * one. vm_lock must be held, as for tlb_invalidate.
+ */
+static
+void
+tlb_renewasid(struct addrspace *as)
+{
+	struct tlbshootdown ts;
+	unsigned n;
+
+	ts.ts_as = as;
+	ts.ts_vaddr = TS_NEWASID;
+	ts.ts_npages = 0;
+	ts.ts_done = shootdown_sem;
+	n = ipi_tlbshootdown_broadcast(&ts);
+	tlb_shootdown_wait(n);
+}
+
+/*
+ * Load a translation for VA into the TLB under the current ASID,
+ * replacing the existing entry for the page if there is one.
+ */
+static
+void
+tlb_load(struct addrspace *as, vaddr_t va, uint32_t elo)
+{
+	uint32_t ehi;
+	int i, spl;
+
+	spl = splhigh();
+
+	ehi = va | (as_getasid(as) << TLBHI_PIDSHIFT);
+	i = tlb_probe(ehi, 0);
+	if (i >= 0) {
+		tlb_write(ehi, elo, i);
+	}
+	else {
+		tlb_random(ehi, elo);
+		COUNTER_INC(COUNTER_TLB_RANDOM);
+	}
+
+	splx(spl);
+}
+
+/*
+ * Drop the translations for the NPAGES pages from VA of the vmalloc
+ * area from this cpu's TLB. Interrupts must be off.
+ */
+static
+void
+kvm_invalidate_local(vaddr_t va, unsigned npages)
+{
+	uint32_t ehi, hi, lo;
+	vaddr_t end;
+	int i;
+
+	end = va + npages * PAGE_SIZE;
+
+	__asm volatile("mfc0 %0, $10" : "=r" (ehi));	/* c0_entryhi */
+	if (npages <= TLB_PROBEMAX) {
+		for (; va < end; va += PAGE_SIZE) {
+			/* global entries match whatever the PID */
+			i = tlb_probe(va, 0);
+			if (i >= 0) {
+				tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(),
+					  i);
+			}
+		}
+	}
+	else {
+		for (i=0; i<NUM_TLB; i++) {
+			tlb_read(&hi, &lo, i);
+			if ((lo & TLBLO_GLOBAL) &&
+			    (hi & TLBHI_VPAGE) >= va &&
+			    (hi & TLBHI_VPAGE) < end) {
+				tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(),
+					  i);
+			}
+		}
+	}
+	tlb_setasid((ehi & TLBHI_PID) >> TLBHI_PIDSHIFT);
+}
+
+/*
+ * Drop the translations for the NPAGES pages from VA of the vmalloc
+ * area from every TLB. May sleep.
+ */
+void
+kvm_invalidate(vaddr_t va, unsigned npages)
+{
+	struct tlbshootdown ts;
+	unsigned n;
+	int spl;
+
+	spl = splhigh();
+	kvm_invalidate_local(va, npages);
+	splx(spl);
+
+	ts.ts_as = NULL;
+	ts.ts_vaddr = va;
+	ts.ts_npages = npages;
+	ts.ts_done = shootdown_sem;
+	lock_acquire(vm_lock);
+	n = ipi_tlbshootdown_broadcast(&ts);
+	tlb_shootdown_wait(n);
+	lock_release(vm_lock);
+}
+
+/*
+ * Load the translation for VA, in the vmalloc area, after a miss. Runs
+ * with whatever locks the faulting code holds, so takes none.
+ */
+static
+int
+kvm_fault(int faulttype, vaddr_t va)
+{
+	uint32_t ehi, pte;
+	int spl;
+
+	if (va >= VMALLOC_TOP || faulttype == VM_FAULT_READONLY) {
+		return EFAULT;
+	}
+	pte = kvm_getpte(va);
+	if ((pte & PTE_VALID) == 0) {
+		/* Not allocated, a guard page, or being freed */
+		COUNTER_INC(COUNTER_VM_BADFAULTS);
+		return EFAULT;
+	}
+
+	spl = splhigh();
+	/* Keep the current ASID in c0_entryhi */
+	__asm volatile("mfc0 %0, $10" : "=r" (ehi));	/* c0_entryhi */
+	tlb_random(va | (ehi & TLBHI_PID),
+		   (pte & PTE_FRAME) | TLBLO_VALID | TLBLO_DIRTY | TLBLO_GLOBAL);
+	COUNTER_INC(COUNTER_TLB_RANDOM);
+	splx(spl);
+	return 0;
+}
+
+
+/*
+ * Note that regions were added to or taken off the list of AS, so
+ * as_regindex has to be rebuilt. (Resizing a region in place keeps
+ * the order, and needs nothing.)
+ */
+void
+as_regionschanged(struct addrspace *as)
+{
+	as->as_regstale = true;
+}
+
+/*
+ * Rebuild as_regindex from the region list. Returns false if there
+ * is no memory for it.
+ */
+static
+bool
+as_buildindex(struct addrspace *as)
+{
+	struct region *reg, **index;
+	unsigned n;
+
+	n = 0;
+	for (reg = as->as_regions; reg != NULL; reg = reg->next) {
+		n++;
+	}
+	if (n > as->as_regindexmax) {
+		index = kmalloc(2 * n * sizeof(*index));
+		if (index == NULL) {
+			return false;
+		}
+		if (as->as_regindex != NULL) {
+			kfree(as->as_regindex);
+		}
+		as->as_regindex = index;
+		as->as_regindexmax = 2 * n;
+	}
+	n = 0;
+	for (reg = as->as_regions; reg != NULL; reg = reg->next) {
+		as->as_regindex[n++] = reg;
+	}
+	as->as_nregindex = n;
+	as->as_regstale = false;
+	return true;
+}
+
+/*
+ * Find the region containing VA, or NULL: by binary search on
+ * as_regindex, or walking the list if the index can't be rebuilt.
+ */
+struct region *
+as_findregion(struct addrspace *as, vaddr_t va)
+{
+	struct region *reg;
+	unsigned lo, hi, mid;
+
+	if (as->as_regstale && !as_buildindex(as)) {
+		for (reg = as->as_regions; reg != NULL; reg = reg->next) {
+			if (va >= reg->vbase &&
+			    va < reg->vbase + reg->npages * PAGE_SIZE) {
+				return reg;
+			}
+		}
+		return NULL;
+	}
+
+	/* the last region starting at or below VA */
+	lo = 0;
+	hi = as->as_nregindex;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (as->as_regindex[mid]->vbase <= va) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	if (lo == 0) {
+		return NULL;
+	}
+	reg = as->as_regindex[lo - 1];
+	if (va >= reg->vbase + reg->npages * PAGE_SIZE) {
+		return NULL;
+	}
+	return reg;
+}
+
+/*
+ * Bring the page at VA, whose PTE is PTE, back from swap.
+ */
+static
+int
+page_swapin(struct addrspace *as, vaddr_t va, uint32_t *pte)
+{
+	unsigned slot = *pte >> PTE_SLOTSHIFT;
+	paddr_t pa;
+	int result;
+
+	KASSERT(*pte & PTE_SWAP);
+
+	pa = frame_alloc(false);
+	if (pa == 0) {
+		return ENOMEM;
+	}
+	result = swap_read(slot, pa);
+	if (result) {
+		frame_decref(pa);
+		return result;
+	}
+	swap_free(slot);
+
+	*pte = pa | PTE_VALID | (*pte & PTE_WRITE);
+	frame_setowner(pa, as, va);
+	return 0;
+}
+
+/*
+ * First touch of the page at VA in region REG, or first touch since
+ * it was paged out: give it a frame, with its contents read from swap,
+ * from the executable, or from a mapped file.
+ */
+static
+int
+page_fill(struct addrspace *as, struct region *reg, vaddr_t va, uint32_t *pte)
+{
+	paddr_t pa;
+	bool shared;
+	int result;
+
+	if (*pte & PTE_SWAP) {
+		curthread->t_majfaults++;
+		return page_swapin(as, va, pte);
+	}
+
+	if (reg->mapvn != NULL) {
+		return page_fillmap(as, reg, va, pte);
+	}
+
+	if (reg->mapanon && reg->mapshared) {
+		return page_fillanon(reg, pte);
+	}
+
+	if (reg->shm != NULL) {
+		return page_fillshm(reg, va, pte);
+	}
+
+	if (reg->kinfo) {
+		pa = kinfo_page(as, va);
+		KASSERT(pa != 0);
+		frame_incref(pa);
+		*pte = pa | PTE_VALID;
+		return 0;
+	}
+
+	/* Program text: map the copy other processes already use */
+	shared = !reg->writeable_bit && reg->filesz > 0;
+	if (shared) {
+		pa = textcache_lookup(as->as_file, va);
+		if (pa != 0) {
+			frame_incref(pa);
+			*pte = pa | PTE_VALID;
+			return 0;
+		}
+	}
+
+	pa = frame_alloc(true);
+	if (pa == 0) {
+		return ENOMEM;
+	}
+
+	if (reg->filesz > 0) {
+		KASSERT(as->as_file != NULL);
+		/*
+		 * Don't hold vm_lock across filesystem I/O: the
+		 * filesystem may fault on user memory while holding
+		 * its own locks. Nothing else touches this PTE, and
+		 * the frame can't be paged out before it has an owner.
+		 */
+		lock_release(vm_lock);
+		result = page_readin(as->as_file, va, pa, reg->filevaddr,
+				     reg->fileoff, reg->filesz);
+		lock_acquire(vm_lock);
+		if (result) {
+			frame_decref(pa);
+			return result;
+		}
+	}
+
+	*pte = pa | PTE_VALID | (reg->writeable_bit ? PTE_WRITE : 0);
+	if (shared) {
+		textcache_enter(as->as_file, va, pa);
+	}
+	else {
+		frame_setowner(pa, as, va);
+	}
+	return 0;
+}
+
+/*
+ * Whether the stack of AS may grow down to VA, which is in no region.
+ */
+static
+bool
+as_stackroom(struct addrspace *as, vaddr_t va)
+{
+	struct region *stack = as->as_stack, *reg;
+
+	if (stack == NULL || va >= stack->vbase ||
+	    va < USERSTACK - as->as_stackmax * PAGE_SIZE) {
+		return false;
+	}
+
+	/* Whatever is mapped below (with MAP_FIXED), keep a page clear */
+	for (reg = as->as_regions; reg != NULL && reg->next != stack;
+	     reg = reg->next);
+	if (reg != NULL && reg->vbase + (reg->npages + 1) * PAGE_SIZE > va) {
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Grow the stack of AS down to VA, if it may, for a fault that hit no
+ * region. Returns the stack region, or NULL. Called with vm_lock held.
+ */
+static
+struct region *
+as_growstack(struct addrspace *as, vaddr_t va)
+{
+	struct region *stack = as->as_stack;
+	size_t grow;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+
+	if (!as_stackroom(as, va)) {
+		return NULL;
+	}
+
+	grow = (stack->vbase - va) / PAGE_SIZE;
+	if (as_reserve(as, grow)) {
+		return NULL;
+	}
+	stack->vbase = va;
+	stack->npages += grow;
+	return stack;
+}
+
+/*
+ * Check that the LEN bytes at VA are all valid in AS, and writeable
+ * if WRITE; the stack counts down to as far as it may grow. This only
+ * looks at the regions, one binary search per region the range goes
+ * through: nothing is faulted in, so pages that are paged out or not
+ * yet touched pass. Returns 0 or EFAULT.
+ */
+int
+as_checkrange(struct addrspace *as, vaddr_t va, size_t len, bool write)
+{
+	struct region *reg;
+	vaddr_t end;
+	int result = 0;
+
+	end = va + len;
+	if (end < va || end > USERSPACETOP) {
+		return EFAULT;
+	}
+
+	lock_acquire(vm_lock);
+	while (va < end) {
+		reg = as_findregion(as, va);
+		if (reg == NULL) {
+			if (!as_stackroom(as, va)) {
+				result = EFAULT;
+				break;
+			}
+			/* the stack would grow; the rest is in the stack */
+			reg = as->as_stack;
+		}
+		if (write && !reg->writeable_bit) {
+			result = EFAULT;
+			break;
+		}
+		va = reg->vbase + reg->npages * PAGE_SIZE;
+	}
+	lock_release(vm_lock);
+	return result;
+}
+
+/*
+ * The part of vm_fault that needs the region list or has to change
+ * the page table. Called with vm_lock held.
+ */
+static
+int
+vm_fault_slow(struct addrspace *as, int faulttype, vaddr_t faultaddress)
+{
+	struct region *reg;
+	uint32_t *pte;
+	uint32_t elo;
+	int result;
+
+ again:
+	reg = as_findregion(as, faultaddress);
+	if (reg == NULL) {
+		reg = as_growstack(as, faultaddress);
+	}
+	if (reg == NULL) {
+		return EFAULT;
+	}
+	if (faulttype != VM_FAULT_READ && !reg->writeable_bit) {
+		return EFAULT;
+	}
+
+	pte = pt_lookup(as, faultaddress, true);
+	if (pte == NULL) {
+		return ENOMEM;
+	}
+
+	/* Not touched yet, or paged out: fill it in */
+	if ((*pte & PTE_VALID) == 0) {
+		result = page_fill(as, reg, faultaddress, pte);
+		if (result == EAGAIN) {
+			/* A mapped file page; the mapping changed meanwhile */
+			goto again;
+		}
+		if (result) {
+			return result;
+		}
+	}
+
+	/*
+	 * (A VM_FAULT_READONLY on a private page is a stale read-only
+	 * entry from before the page stopped being shared; reloading
+	 * it below is all that is needed.)
+	 */
+
+	/* Writing to a shared page: get our own copy first */
+	if (faulttype != VM_FAULT_READ && (*pte & PTE_COW)) {
+		result = cow_break(as, faultaddress, pte);
+		if (result) {
+			return result;
+		}
+	}
+
+	elo = (*pte & PTE_FRAME) | TLBLO_VALID;
+	if (reg->writeable_bit && (*pte & PTE_COW) == 0) {
+		elo |= TLBLO_DIRTY;
+	}
+	frames[frame_index(*pte & PTE_FRAME)].fr_referenced = 1;
+	DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, elo & PTE_FRAME);
+	tlb_load(as, faultaddress, elo);
+	return 0;
+}
+
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+	struct addrspace *as;
+	uint32_t *pte;
+	uint32_t elo;
+	int result, spl;
+
+	faultaddress &= PAGE_FRAME;
+
+	DEBUG(DB_VM, "dumbvm: fault: 0x%x\n", faultaddress);
+
+	switch (faulttype) {
+	    case VM_FAULT_READONLY:
+	    case VM_FAULT_READ:
+	    case VM_FAULT_WRITE:
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	if (faultaddress >= VMALLOC_BASE) {
+		/* The kernel touching memory from vmalloc */
+		return kvm_fault(faulttype, faultaddress);
+	}
+
+	if (curproc == NULL) {
+		/*
+		 * No process. This is probably a kernel fault early
+		 * in boot. Return EFAULT so as to panic instead of
+		 * getting into an infinite faulting loop.
+		 */
+		return EFAULT;
+	}
+
+	as = proc_getas();
+	if (as == NULL) {
+		/*
+		 * No address space set up. This is probably also a
+		 * kernel fault early in boot.
+		 */
+		return EFAULT;
+	}
+
+	/* Assert that the address space has been set up properly. */
+	KASSERT(as->as_pagetable != NULL);
+
+	/*
+	 * Fast path: a plain TLB miss on a page that is mapped and
+	 * allows the access. (A miss means there is no entry to
+	 * replace.) Interrupts stay off from reading the PTE to
+	 * loading the TLB, so a shootdown for it can't slip between.
+	 */
+	spl = splhigh();
+	curthread->t_faults++;
+	COUNTER_INC(faulttype == VM_FAULT_READ ? COUNTER_VM_READFAULTS :
+		    faulttype == VM_FAULT_WRITE ? COUNTER_VM_WRITEFAULTS :
+		    COUNTER_VM_ROFAULTS);
+	if (faulttype != VM_FAULT_READONLY) {
+		pte = pt_lookup(as, faultaddress, false);
+		if (pte != NULL && (*pte & PTE_VALID) &&
+		    (faulttype == VM_FAULT_READ ||
+		     (*pte & (PTE_WRITE | PTE_COW)) == PTE_WRITE)) {
+			elo = (*pte & PTE_FRAME) | TLBLO_VALID;
+			if ((*pte & (PTE_WRITE | PTE_COW)) == PTE_WRITE) {
+				elo |= TLBLO_DIRTY;
+			}
+			frames[frame_index(*pte & PTE_FRAME)].fr_referenced = 1;
+			tlb_random(faultaddress |
+				   (as_getasid(as) << TLBHI_PIDSHIFT), elo);
+			COUNTER_INC(COUNTER_TLB_RANDOM);
+			asid_cpus[curcpu->c_number].ac_fast++;
+			splx(spl);
+			return 0;
+		}
+	}
+	asid_cpus[curcpu->c_number].ac_slow++;
+	splx(spl);
+
+	lock_acquire(vm_lock);
+	result = vm_fault_slow(as, faulttype, faultaddress);
+	lock_release(vm_lock);
+	while (result == ENOMEM && vm_oom()) {
+		lock_acquire(vm_lock);
+		result = vm_fault_slow(as, faulttype, faultaddress);
+		lock_release(vm_lock);
+	}
+	if (result == EFAULT) {
+		COUNTER_INC(COUNTER_VM_BADFAULTS);
+	}
+	return result;
+}
+
+struct addrspace *
+as_create(void)
+{
+	struct addrspace *as = kmalloc(sizeof(struct addrspace));
+	if (as==NULL) {
+		return NULL;
+	}
+
+	as->as_pagetable = kmalloc(PT_DIRSIZE * sizeof(uint32_t *));
+	if (as->as_pagetable == NULL) {
+		kfree(as);
+		return NULL;
+	}
+	bzero(as->as_pagetable, PT_DIRSIZE * sizeof(uint32_t *));
+
+	as->as_regions = NULL;
+	as->as_regindex = NULL;
+	as->as_nregindex = 0;
+	as->as_regindexmax = 0;
+	as->as_regstale = false;
+	as->as_heap = NULL;
+	as->as_heapbrk = 0;
+	as->as_stack = NULL;
+	as->as_stackmax = 0;
+	as->as_file = NULL;
+	as->as_kinfo = 0;
+	as->as_mapgen = 0;
+	as->as_commit = 0;
+	as->as_oomkilled = false;
+	as->as_loaded = false;
+	for (unsigned i = 0; i < MAXCPUS; i++) {
+		as->as_asid[i] = 0;
+		as->as_asidgen[i] = 0;
+	}
+
+	return as;
+}
+
+void
+as_destroy(struct addrspace *as)
+{
+	struct region *reg;
+	unsigned i, j;
+
+	dumbvm_can_sleep();
+
+	/* DROP EVERY MAPPING, THEN THE TABLES THEMSELVES */
+	lock_acquire(vm_lock);
+	for (reg = as->as_regions; reg != NULL; reg = reg->next) {
+		if (reg->mapvn != NULL) {
+			/* FILE MAPPINGS FIRST, AS THEY MAY NEED WRITING BACK */
+			map_release(as, reg, NULL);
+		}
+	}
+	for (i=0; i<PT_DIRSIZE; i++) {
+		uint32_t *table = as->as_pagetable[i];
+
+		if (table == NULL) {
+			continue;
+		}
+		for (j=0; j<PT_TABSIZE; j++) {
+			if (table[j] & PTE_VALID) {
+				frame_decref(table[j] & PTE_FRAME);
+			}
+			else if (table[j] & PTE_SWAP) {
+				swap_free(table[j] >> PTE_SLOTSHIFT);
+			}
+		}
+		kfree(table);
+	}
+	if (as->as_kinfo != 0) {
+		frame_decref(as->as_kinfo);
+	}
+	for (reg = as->as_regions; reg != NULL; reg = reg->next) {
+		if (reg->shm != NULL) {
+			shm_release(reg->shm);
+		}
+	}
+	lock_release(vm_lock);
+	kfree(as->as_pagetable);
+
+	while (as->as_regions != NULL) {
+		reg = as->as_regions;
+		as->as_regions = reg->next;
+		if (reg->mapvn != NULL) {
+			VOP_DECREF(reg->mapvn);
+		}
+		kfree(reg);
+	}
+	if (as->as_regindex != NULL) {
+		kfree(as->as_regindex);
+	}
+	if (as->as_file != NULL) {
+		VOP_DECREF(as->as_file);
+	}
+
+	vm_uncommit(as->as_commit);
+	if (as->as_oomkilled) {
+		spinlock_acquire(&commit_lock);
+		KASSERT(oom_pending > 0);
+		oom_pending--;
+		spinlock_release(&commit_lock);
+	}
+	kfree(as);
+}
+
+void
+as_activate(void)
+{
+	struct addrspace *as;
+	int spl;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return;
+	}
+
+	/* No flush: the TLB keeps other address spaces' entries */
+	spl = splhigh();
+	tlb_setasid(as_getasid(as));
+	splx(spl);
+}
+
+void
+as_deactivate(void)
+{
+	/* nothing */
+}
+
 /*
- * Wrap ram_stealmem in a spinlock.
+ * Add a region of NPAGES pages at VBASE, keeping the list sorted by
+ * address, and hand it back in RET unless that is NULL. Regions may
+ * not overlap. An empty region (an empty heap) is added too.
  */
-static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
+int
+as_insertregion(struct addrspace *as, vaddr_t vbase, size_t npages,
+		int writeable, struct region **ret)
+{
+	struct region *reg, **pp;
+	vaddr_t vtop = vbase + npages * PAGE_SIZE;
 
-/*
- * Wrap getfreepages in a spinlock 
-*/
-#if OPT_SHELL
-static struct spinlock freemem_lock = SPINLOCK_INITIALIZER;
-#endif
+	if (vtop < vbase || vtop > USERSPACETOP) {
+		return EFAULT;
+	}
 
-/*
- *  +------+
- *  | DATA |
- *  +------+
-*/
-#if OPT_SHELL
-static int number_ram_pages = 0;					/* TOTAL NUMBER OF PAGES AT THE BEGINNING OF THE BOOTSTRAP 	*/
-static unsigned int *bitmap_freePages = NULL;		/* BITMAP STORING THE POSITION OF THE FREE PAGES 			*/
-static unsigned long *bitmap_sizePages = NULL; 		/* BITMAP STORING THE SIZE OF THE FREE PAGES 				*/
+	for (pp = &as->as_regions; *pp != NULL; pp = &(*pp)->next) {
+		if ((*pp)->vbase >= vtop) {
+			break;
+		}
+		if ((*pp)->vbase + (*pp)->npages * PAGE_SIZE > vbase) {
+			kprintf("dumbvm: Warning: overlapping regions\n");
+			return EINVAL;
+		}
+	}
 
-static bool allocTableActive = false;				
-#endif
+	reg = kmalloc(sizeof(struct region));
+	if (reg == NULL) {
+		return ENOMEM;
+	}
+	reg->vbase = vbase;
+	reg->npages = npages;
+	reg->writeable_bit = writeable ? 1 : 0;
+	reg->old_writeable_bit = reg->writeable_bit;
+	reg->filevaddr = 0;
+	reg->fileoff = 0;
+	reg->filesz = 0;
+	reg->mapvn = NULL;
+	reg->mapoff = 0;
+	reg->mapshared = false;
+	reg->mapanon = false;
+	reg->kinfo = false;
+	reg->shm = NULL;
+	reg->advice = MADV_NORMAL;
+
+	reg->next = *pp;
+	*pp = reg;
+	as_regionschanged(as);
+	if (ret != NULL) {
+		*ret = reg;
+	}
+	return 0;
+}
 
 /*
- *  +-----------+
- *  | FUNCTIONS |
- *  +-----------+
-*/
-
-/**
- * @brief Check if the allocation table is currently active or not
- * 
- * @return true if the table is active 
+ * Add a region of NPAGES pages at VBASE, unless it would be empty.
  */
-#if OPT_SHELL
-static bool isTableActive(void) {
-	spinlock_acquire(&freemem_lock);
-	bool active = allocTableActive;
-	spinlock_release(&freemem_lock);
-	return active;
+static
+int
+as_addregion(struct addrspace *as, vaddr_t vbase, size_t npages,
+	     int writeable)
+{
+	if (npages == 0) {
+		return 0;
+	}
+	return as_insertregion(as, vbase, npages, writeable, NULL);
 }
-#endif
 
-/**
- * @brief Initialize allocation table and stuff
- * 
+int
+as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
+		 int readable, int writeable, int executable)
+{
+	int result;
+
+	dumbvm_can_sleep();
+
+	/* Align the region. First, the base... */
+	sz += vaddr & ~(vaddr_t)PAGE_FRAME;
+	vaddr &= PAGE_FRAME;
+
+	/* ...and now the length. */
+	sz = (sz + PAGE_SIZE - 1) & PAGE_FRAME;
+
+	/* Every page can be read (and executed); only writes are checked */
+	(void)readable;
+	(void)executable;
+
+	if (writeable) {
+		result = as_reserve(as, sz / PAGE_SIZE);
+		if (result) {
+			return result;
+		}
+	}
+	result = as_addregion(as, vaddr, sz / PAGE_SIZE, writeable);
+	if (result && writeable) {
+		as_unreserve(as, sz / PAGE_SIZE);
+	}
+	return result;
+}
+
+/*
+ * Note that the part of the segment starting at VADDR holds FILESIZE
+ * bytes found at OFFSET in the executable V. The pages are read in by
+ * vm_fault when first touched; the address space keeps a reference
+ * to V until it is destroyed.
  */
-void vm_bootstrap(void) {
-#if OPT_SHELL
-	/* DISCOVER HOW MANY PAGES CAN BE AVAILABLE IN RAM */
-	number_ram_pages = ((int) ram_getsize()) / PAGE_SIZE;
-
-	/* ALLOCATING BITMAP */
-	bitmap_freePages = (unsigned int *) kmalloc(number_ram_pages * sizeof(unsigned int));
-	bitmap_sizePages = (unsigned long *) kmalloc(number_ram_pages * sizeof(unsigned long));
-	if (bitmap_freePages == NULL || bitmap_sizePages == NULL) {
-		bitmap_freePages = NULL;
-		bitmap_sizePages = NULL;
-		return;
+int
+as_define_file(struct addrspace *as, struct vnode *v, off_t offset,
+	       vaddr_t vaddr, size_t filesize)
+{
+	struct region *reg;
+
+	if (filesize == 0) {
+		return 0;
+	}
+
+	/* Not done by uiomove any more, so check for kernel addresses */
+	if (vaddr + filesize < vaddr || vaddr + filesize > USERSPACETOP) {
+		return EFAULT;
 	}
-		
-	/* INITIALIZE BITMAP */
-	for (int i = 0; i < number_ram_pages; i++) {
-		bitmap_freePages[i] = 0;
-		bitmap_sizePages[i] = 0;
+	if (as->as_file != NULL && as->as_file != v) {
+		return EINVAL;
 	}
 
-	/* ENABLING ALLOCATION TABLE */
-	spinlock_acquire(&freemem_lock);
-	allocTableActive = true;
-	spinlock_release(&freemem_lock);
+	reg = as_findregion(as, vaddr);
+	if (reg == NULL || reg->filesz != 0 ||
+	    vaddr + filesize > reg->vbase + reg->npages * PAGE_SIZE) {
+		return EINVAL;
+	}
+	reg->filevaddr = vaddr;
+	reg->fileoff = offset;
+	reg->filesz = filesize;
 
-	return;
-#endif
+	if (as->as_file == NULL) {
+		VOP_INCREF(v);
+		as->as_file = v;
+	}
+	return 0;
 }
 
+int
+as_prepare_load(struct addrspace *as)
+{
+	KASSERT(!as->as_loaded);
+
+	dumbvm_can_sleep();
+
+	/* Pages are allocated on demand by vm_fault */
+	as->as_loaded = true;
+	return 0;
+}
 
 /*
- * Check if we're in a context that can sleep. While most of the
- * operations in dumbvm don't in fact sleep, in a real VM system many
- * of them would. In those, assert that sleeping is ok. This helps
- * avoid the situation where syscall-layer code that works ok with
- * dumbvm starts blowing up during the VM assignment.
+ * Add the (empty) heap region, right after the highest segment.
  */
-static
-void
-dumbvm_can_sleep(void)
+int
+as_complete_load(struct addrspace *as)
 {
-	if (CURCPU_EXISTS()) {
-		/* must not hold spinlocks */
-		KASSERT(curcpu->c_spinlocks == 0);
+	struct region *reg, **pp;
+	vaddr_t top = 0;
 
-		/* must not be in an interrupt handler */
-		KASSERT(curthread->t_in_interrupt == 0);
+	dumbvm_can_sleep();
+
+	for (pp = &as->as_regions; *pp != NULL; pp = &(*pp)->next) {
+		top = (*pp)->vbase + (*pp)->npages * PAGE_SIZE;
 	}
+
+	reg = kmalloc(sizeof(struct region));
+	if (reg == NULL) {
+		return ENOMEM;
+	}
+	reg->vbase = top;
+	reg->npages = 0;
+	reg->writeable_bit = 1;
+	reg->old_writeable_bit = 1;
+	reg->filevaddr = 0;
+	reg->fileoff = 0;
+	reg->filesz = 0;
+	reg->mapvn = NULL;
+	reg->mapoff = 0;
+	reg->mapshared = false;
+	reg->mapanon = false;
+	reg->kinfo = false;
+	reg->shm = NULL;
+	reg->advice = MADV_NORMAL;
+	reg->next = NULL;
+	*pp = reg;
+	as_regionschanged(as);
+
+	as->as_heap = reg;
+	as->as_heapbrk = top;
+	return 0;
 }
 
-/**
- * @brief Return the physical address of the memory based on a bitmap-allocation strategy
- *        Moreover, it updates the underlaying data structure. 
- * 
- * @param npages number of pages required to be allocated
- * @return paddr_t physical address
+/*
+ * Move the break of AS by AMOUNT bytes, handing back the old break in
+ * OLDBRK. Growing only extends the heap region (vm_fault supplies the
+ * pages); shrinking gives back the frames and swap of the pages that
+ * are no longer part of it.
  */
-#if OPT_SHELL
-static paddr_t getfreeppages(unsigned long npages) {
-
-	paddr_t addr = 0;
+int
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbrk)
+{
+	struct region *heap = as->as_heap;
+	vaddr_t newbrk, oldtop, newtop, va;
+	uint32_t *pte;
 
-	/* CHECKING IF ALLOCATION TABLE IS ACTIVE (i.e., can use the LAB02 methods) */
-	if (!isTableActive()) {
-		return 0;
+	if (heap == NULL) {
+		return ENOMEM;
 	}
 
-	/* GETTING LOCK ON MEMORY */
-	spinlock_acquire(&freemem_lock);
+	newbrk = as->as_heapbrk + amount;
+	if (amount < 0 && (newbrk > as->as_heapbrk || newbrk < heap->vbase)) {
+		return EINVAL;
+	}
+	if (amount > 0 && newbrk < as->as_heapbrk) {
+		return ENOMEM;
+	}
 
-	/* ALGORITHM FOR SEARCHING FREE PAGES */
-	long int start_tmp = -1;
-	long int start_adr = -1;
-	for (long int i = 0; i < number_ram_pages; i++) {
+	oldtop = heap->vbase + heap->npages * PAGE_SIZE;
+	newtop = (newbrk + PAGE_SIZE - 1) & PAGE_FRAME;
 
-		/* CHECKING IF THE POSITION IS AVAILABLE */
-		if (bitmap_freePages[i]) {
+	/* Don't run into the stack (or whatever comes next) */
+	if (newtop > oldtop) {
+		if (newtop > USERSPACETOP ||
+		    (heap->next != NULL && newtop > heap->next->vbase)) {
+			return ENOMEM;
+		}
+		if (as_reserve(as, (newtop - oldtop) / PAGE_SIZE)) {
+			return ENOMEM;
+		}
+	}
 
-			/* CASE IN WHICH START IS THE BEGINNING OF THE BITMAP */
-			if (i == 0 || bitmap_freePages[i-1] == 0) {
-				start_tmp = i;
+	lock_acquire(vm_lock);
+	heap->npages = (newtop - heap->vbase) / PAGE_SIZE;
+	if (newtop < oldtop) {
+		/*
+		 * Unmap the pages (a resident PTE keeps its frame bits
+		 * meanwhile), shoot the whole range down at once, and
+		 * only then give the frames back.
+		 */
+		for (va = newtop; va < oldtop; va += PAGE_SIZE) {
+			pte = pt_lookup(as, va, false);
+			if (pte != NULL) {
+				*pte &= ~PTE_VALID;
 			}
-
-			/* CHECKING IF THE AVAILABLE POSITION IS SUFFICIENT FROM THE LAST START FOUND */
-			if (i - start_tmp + 1 >= (long int)npages) {
-				start_adr = start_tmp;
-				break;
+		}
+		tlb_invalidate(as, newtop, (oldtop - newtop) / PAGE_SIZE);
+		for (va = newtop; va < oldtop; va += PAGE_SIZE) {
+			pte = pt_lookup(as, va, false);
+			if (pte == NULL) {
+				continue;
+			}
+			if (*pte & PTE_SWAP) {
+				swap_free(*pte >> PTE_SLOTSHIFT);
+			}
+			else if (*pte & PTE_FRAME) {
+				frame_decref(*pte & PTE_FRAME);
 			}
+			*pte = 0;
 		}
 	}
-
-	/* CHECKING IF WE HAVE FOUND AN AVAILABLE SPACE */
-	if (start_adr != -1) {
-		for (long int i = 0; i < start_adr + (long int)npages; i++) {
-			bitmap_freePages[i] = 0;				/* UPDATING BITMAP OF POSITIONS */
-		}
-		bitmap_sizePages[start_adr] = npages;		/* UPDATING BITMAP OF DIMENSIONS */
-		addr = (paddr_t) start_adr * PAGE_SIZE; 
-	} else {
-		addr = 0;
+	lock_release(vm_lock);
+	if (newtop < oldtop) {
+		as_unreserve(as, (oldtop - newtop) / PAGE_SIZE);
 	}
 
-	/* RELEASING SPINLOCK */
-	spinlock_release(&freemem_lock);
-
-	return addr;
+	*oldbrk = as->as_heapbrk;
+	as->as_heapbrk = newbrk;
+	return 0;
 }
-#endif
 
-/**
- * @brief retrieves a valid address in which space in memory starts, based on the amount 
- * 		  of pages (unsigned long npages) required by the process,
- * 
- * @param npages number of pages required by the process
- * @return paddr_t a valid address
- */
-static paddr_t getppages(unsigned long npages) {
-#if OPT_SHELL
-	/* GETTING PHYSICAL ADDRESS OF THE FREE PAGES */
-	paddr_t addr = getfreeppages(npages);
-#else
-	paddr_t addr = 0;
-#endif
-	
-	if (addr == 0) {
+int
+as_define_stack(struct addrspace *as, vaddr_t *stackptr)
+{
+	int result;
 
-		/* NO FREEE PAGES FOUND */
-		spinlock_acquire(&stealmem_lock);
-		addr = ram_stealmem(npages);							
-		spinlock_release(&stealmem_lock);
-	}
+	KASSERT(as->as_loaded);
 
-#if OPT_SHELL
-	if (addr != 0 && isTableActive()) {
+	/* Only what is touched is committed, as the stack grows */
+	result = as_reserve(as, STACK_INITPAGES);
+	if (result) {
+		return result;
+	}
+	result = as_addregion(as, USERSTACK - STACK_INITPAGES * PAGE_SIZE,
+			      STACK_INITPAGES, 1);
+	if (result) {
+		as_unreserve(as, STACK_INITPAGES);
+		return result;
+	}
+	as->as_stack = as_findregion(as, USERSTACK - PAGE_SIZE);
+	as->as_stackmax = stack_maxpages();
 
-		/* UPDATING BITMAP */
-		spinlock_acquire(&freemem_lock);
-		bitmap_sizePages[addr/PAGE_SIZE] = npages;				/* ALLOCATION OF THE VIRTUAL SPACE */
-		spinlock_release(&freemem_lock);
+	result = as_define_kinfo(as);
+	if (result) {
+		return result;
 	}
-#endif
 
-	return addr;
+	*stackptr = USERSTACK;
+	return 0;
 }
 
-/* Allocate/free some kernel-space virtual pages */
-vaddr_t
-alloc_kpages(unsigned npages)
+int
+as_copy(struct addrspace *old, struct addrspace **ret)
 {
-	paddr_t pa;
+	struct addrspace *new;
+	struct region *oldreg, *reg, **tail;
+	uint32_t *newtable;
+	vaddr_t va;
+	unsigned i, j;
+	int result;
 
 	dumbvm_can_sleep();
-	pa = getppages(npages);
-	if (pa==0) {
-		return 0;
-	}
-	return PADDR_TO_KVADDR(pa);
-}
 
-/**
- * @brief set to 1 the specific position of the bitmap_freePages data structure, in order to 
- * 		  indicates that those pages are free to be used from now on.
- * 
- * @param paddr starting address of the memory to release
- * @param size number of pages
- */
-#if OPT_SHELL
-static void freeppages(paddr_t paddr, unsigned long size) {
+	new = as_create();
+	if (new==NULL) {
+		return ENOMEM;
+	}
 
-	/* CHECKING IF TABLE IS ACTIVE */
-	if (!isTableActive()) {
-		return;
+	/* Whatever the parent may still write, the child may too */
+	result = as_reserve(new, old->as_commit);
+	if (result) {
+		as_destroy(new);
+		return result;
 	}
 
-	/* COMPUTING PHYSICAL ADDRESS */
-	unsigned long start_addr = paddr/PAGE_SIZE;
+	new->as_loaded = old->as_loaded;
+	if (old->as_file != NULL) {
+		VOP_INCREF(old->as_file);
+		new->as_file = old->as_file;
+	}
 
-	/* GET LOCK ON MEMORY */
-	spinlock_acquire(&freemem_lock);
+	tail = &new->as_regions;
+	for (oldreg = old->as_regions; oldreg != NULL; oldreg = oldreg->next) {
+		reg = kmalloc(sizeof(struct region));
+		if (reg == NULL) {
+			as_destroy(new);
+			return ENOMEM;
+		}
+		*reg = *oldreg;
+		reg->next = NULL;
+		if (reg->mapvn != NULL) {
+			VOP_INCREF(reg->mapvn);
+		}
+		if (reg->shm != NULL) {
+			lock_acquire(vm_lock);
+			shm_attach(reg->shm);
+			lock_release(vm_lock);
+		}
+		*tail = reg;
+		tail = &reg->next;
+		if (oldreg == old->as_heap) {
+			new->as_heap = reg;
+		}
+		if (oldreg == old->as_stack) {
+			new->as_stack = reg;
+		}
+	}
+	as_regionschanged(new);
+	new->as_heapbrk = old->as_heapbrk;
+	new->as_stackmax = old->as_stackmax;
 
-	/* FREEING (VIRTUALLY OBV) THE PAGES */
-	for (unsigned long i = start_addr; i < start_addr + size; i++) {
-		bitmap_freePages[i] = 1;
+	/*
+	 * Share every frame, marking it copy-on-write on both sides
+	 * (except for shared mappings, which stay shared). Paged-out
+	 * pages are brought back in first; only frames are shared, not
+	 * swap slots.
+	 */
+	lock_acquire(vm_lock);
+	if (old->as_kinfo != 0) {
+		/* Not shared: the child has its own pid */
+		new->as_kinfo = frame_alloc(true);
+		if (new->as_kinfo == 0) {
+			lock_release(vm_lock);
+			as_destroy(new);
+			return ENOMEM;
+		}
 	}
+	/*
+	 * Pages of shared anonymous mappings that haven't been touched
+	 * yet have nothing to share: fill them in now, or each side
+	 * would get its own when it first touches them.
+	 */
+	for (oldreg = old->as_regions; oldreg != NULL; oldreg = oldreg->next) {
+		if (!oldreg->mapanon || !oldreg->mapshared) {
+			continue;
+		}
+		for (i=0; i<oldreg->npages; i++) {
+			uint32_t *pte;
 
-	/* RELEASE LOCK */
-	spinlock_release(&freemem_lock);
+			va = oldreg->vbase + i * PAGE_SIZE;
+			pte = pt_lookup(old, va, true);
+			if (pte == NULL) {
+				result = ENOMEM;
+			}
+			else if ((*pte & PTE_VALID) == 0) {
+				result = page_fillanon(oldreg, pte);
+			}
+			else {
+				result = 0;
+			}
+			if (result) {
+				lock_release(vm_lock);
+				as_destroy(new);
+				return result;
+			}
+		}
+	}
+	for (i=0; i<PT_DIRSIZE; i++) {
+		uint32_t *oldtable = old->as_pagetable[i];
 
-	return;
-}
-#endif
+		if (oldtable == NULL) {
+			continue;
+		}
+		newtable = kmalloc(PT_TABSIZE * sizeof(uint32_t));
+		if (newtable == NULL) {
+			lock_release(vm_lock);
+			as_destroy(new);
+			return ENOMEM;
+		}
+		bzero(newtable, PT_TABSIZE * sizeof(uint32_t));
+		new->as_pagetable[i] = newtable;
+
+		for (j=0; j<PT_TABSIZE; j++) {
+			va = (i << 22) | (j << PTE_SLOTSHIFT);
+			if (va >= KINFO_VADDR &&
+			    va < KINFO_VADDR + KINFO_NPAGES * PAGE_SIZE) {
+				/* left for page_fill, for the child's own */
+				continue;
+			}
+			if (oldtable[j] & PTE_SWAP) {
+				result = page_swapin(old, va, &oldtable[j]);
+				if (result) {
+					lock_release(vm_lock);
+					as_destroy(new);
+					return result;
+				}
+			}
+			if (oldtable[j] & PTE_SHARED) {
+				frame_incref(oldtable[j] & PTE_FRAME);
+				newtable[j] = oldtable[j];
+			}
+			else if (oldtable[j] & PTE_VALID) {
+				oldtable[j] |= PTE_COW;
+				frame_incref(oldtable[j] & PTE_FRAME);
+				newtable[j] = oldtable[j];
+			}
+		}
+	}
+	lock_release(vm_lock);
 
-/**
- * @brief release memory starting at the address given based on the size stored in the bitmap
- * 
- * @param addr starting address of the memory block to release
- */
-void free_kpages(vaddr_t addr) {
-#if OPT_SHELL
-	/* SEE IF FREE IS ABILITATED */
-	if (isTableActive()) {
+	/*
+	 * The parent (which is running on this cpu) may still have
+	 * writable TLB entries for the pages just shared: switch it to
+	 * a fresh ASID everywhere.
+	 */
+	as_dropasids(old, false);
+	as_activate();
+
+	/* ...and so may the other threads of the parent, on other cpus */
+	if (curproc->p_numthreads > 1) {
+		lock_acquire(vm_lock);
+		tlb_renewasid(old);
+		lock_release(vm_lock);
+	}
 
-		/* COMPUTING PHYSICAL ADDRESS */
-		paddr_t paddr = addr - MIPS_KSEG0;
-		long int start_addr = paddr/PAGE_SIZE;
+	*ret = new;
+	return 0;
+}
 
-		/* FREEING THE PAGES */
-		freeppages(paddr, bitmap_sizePages[start_addr]);
+void
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	int spl;
 
-	} else {
-		(void) addr;
+	spl = splhigh();
+	if (ts->ts_as == NULL) {
+		/* Pages of the vmalloc area */
+		kvm_invalidate_local(ts->ts_vaddr, ts->ts_npages);
 	}
-#else
-	(void) addr;
-#endif
+	else if (ts->ts_vaddr != TS_NEWASID) {
+		tlb_invalidate_local(ts->ts_as, ts->ts_vaddr, ts->ts_npages);
+	}
+	else if (proc_getas() == ts->ts_as) {
+		tlb_setasid(as_getasid(ts->ts_as));
+	}
+	splx(spl);
+	V(ts->ts_done);
 }
 
-
+#else /* !OPT_SHELL */
 
 void
 vm_tlbshootdown(const struct tlbshootdown *ts)
@@ -334,6 +2100,7 @@ vm_tlbshootdown(const struct tlbshootdown *ts)
 	panic("dumbvm tried to do tlb shootdown?!\n");
 }
 
+
 int
 vm_fault(int faulttype, vaddr_t faultaddress)
 {
@@ -626,3 +2393,19 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 	*ret = new;
 	return 0;
 }
+
+/* Without the buddy allocator there is nothing to map scattered pages from */
+void *
+vmalloc(size_t size)
+{
+	(void)size;
+	return NULL;
+}
+
+void
+vfree(void *ptr)
+{
+	KASSERT(ptr == NULL);
+}
+
+#endif /* OPT_SHELL */
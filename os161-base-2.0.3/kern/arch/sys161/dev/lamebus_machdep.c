@@ -76,6 +76,24 @@ mips_timer_set(uint32_t count)
 		:: "r" (count));
 }
 
+/*
+ * Start the count over from zero. (Programming c0_compare alone only
+ * works at a match, when the count wraps back to zero by itself.)
+ */
+static
+void
+mips_timer_restart(uint32_t count)
+{
+	/* $9 == c0_count */
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 registers */
+		"mtc0 $0, $9;"		/* zero the count */
+		".set pop"		/* restore assembler mode */
+		);
+	mips_timer_set(count);
+}
+
 /*
  * LAMEbus data for the system. (We have only one LAMEbus per system.)
  * This does not need to be locked, because it's constant once
@@ -114,9 +132,9 @@ mainbus_bootstrap(void)
 	autoconf_lamebus(lamebus, 0);
 
 	/*
-	 * Configure the MIPS on-chip timer to interrupt HZ times a second.
+	 * Configure the MIPS on-chip timer to interrupt hz times a second.
 	 */
-	mips_timer_set(CPU_FREQUENCY / HZ);
+	mips_timer_set(CPU_FREQUENCY / hz);
 }
 
 /*
@@ -276,6 +294,31 @@ mainbus_send_ipi(struct cpu *target)
 	lamebus_assert_ipi(lamebus, target);
 }
 
+/*
+ * Program the current CPU's on-chip timer to interrupt once, NSECS
+ * nanoseconds from now, rounded up to a cycle and to at least
+ * TIMER_MINCYCLES so it can't go off before we're out of here. The
+ * clock code (clock_interrupt) decides each time what comes next.
+ * Called with interrupts off. NSECS is capped at a second, which
+ * keeps the count well within 32 bits.
+ */
+#define TIMER_MINCYCLES 100
+
+void
+mainbus_timer_oneshot(uint64_t nsecs)
+{
+	uint32_t count;
+
+	if (nsecs > 1000000000) {
+		nsecs = 1000000000;
+	}
+	count = (nsecs * (CPU_FREQUENCY / 1000000) + 999) / 1000;
+	if (count < TIMER_MINCYCLES) {
+		count = TIMER_MINCYCLES;
+	}
+	mips_timer_restart(count);
+}
+
 /*
  * Trigger the debugger.
  */
@@ -309,15 +352,18 @@ mainbus_interrupt(struct trapframe *tf)
 		seen = true;
 	}
 	if (cause & LAMEBUS_IPI_BIT) {
-		interprocessor_interrupt();
+		/*
+		 * Clear the IPI before handling it: ipi_send doesn't
+		 * raise it again while codes are pending, so one sent
+		 * between handling and clearing would be lost.
+		 */
 		lamebus_clear_ipi(lamebus, curcpu);
+		interprocessor_interrupt();
 		seen = true;
 	}
 	if (cause & MIPS_TIMER_BIT) {
-		/* Reset the timer (this clears the interrupt) */
-		mips_timer_set(CPU_FREQUENCY / HZ);
-		/* and call hardclock */
-		hardclock();
+		/* Run what's due; this also reprograms (and clears) it */
+		clock_interrupt();
 		seen = true;
 	}
 
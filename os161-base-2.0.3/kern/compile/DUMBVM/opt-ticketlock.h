@@ -0,0 +1,5 @@
+/* Automatically generated; do not edit */
+#ifndef _OPT_TICKETLOCK_H_
+#define _OPT_TICKETLOCK_H_
+#define OPT_TICKETLOCK 0
+#endif /* _OPT_TICKETLOCK_H_ */
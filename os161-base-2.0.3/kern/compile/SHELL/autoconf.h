@@ -9,6 +9,7 @@ struct ltimer_softc;
 struct lrandom_softc;
 struct lhd_softc;
 struct lser_softc;
+struct lnet_softc;
 struct beep_softc;
 struct con_softc;
 struct rtclock_softc;
@@ -22,6 +23,7 @@ struct ltimer_softc *attach_ltimer_to_lamebus(int devunit, struct lamebus_softc
 struct lrandom_softc *attach_lrandom_to_lamebus(int devunit, struct lamebus_softc *bus);
 struct lhd_softc *attach_lhd_to_lamebus(int devunit, struct lamebus_softc *bus);
 struct lser_softc *attach_lser_to_lamebus(int devunit, struct lamebus_softc *bus);
+struct lnet_softc *attach_lnet_to_lamebus(int devunit, struct lamebus_softc *bus);
 struct beep_softc *attach_beep_to_ltimer(int devunit, struct ltimer_softc *bus);
 struct con_softc *attach_con_to_lser(int devunit, struct lser_softc *bus);
 struct rtclock_softc *attach_rtclock_to_ltimer(int devunit, struct ltimer_softc *bus);
@@ -33,6 +35,7 @@ int config_ltimer(struct ltimer_softc *dev, int unit);
 int config_lrandom(struct lrandom_softc *dev, int unit);
 int config_lhd(struct lhd_softc *dev, int unit);
 int config_lser(struct lser_softc *dev, int unit);
+int config_lnet(struct lnet_softc *dev, int unit);
 int config_beep(struct beep_softc *dev, int unit);
 int config_con(struct con_softc *dev, int unit);
 int config_rtclock(struct rtclock_softc *dev, int unit);
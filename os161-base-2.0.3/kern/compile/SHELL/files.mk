@@ -20,19 +20,21 @@ SRCS+=$(KTOP)/dev/generic/random.c
 SRCS+=$(KTOP)/dev/generic/rtclock.c
 SRCS+=$(KTOP)/dev/lamebus/beep_ltimer.c
 SRCS+=$(KTOP)/dev/lamebus/con_lser.c
-SRCS+=$(KTOP)/dev/lamebus/emu_att.c
 SRCS+=$(KTOP)/dev/lamebus/emu.c
+SRCS+=$(KTOP)/dev/lamebus/emu_att.c
 SRCS+=$(KTOP)/dev/lamebus/lamebus.c
-SRCS+=$(KTOP)/dev/lamebus/lhd_att.c
 SRCS+=$(KTOP)/dev/lamebus/lhd.c
-SRCS+=$(KTOP)/dev/lamebus/lrandom_att.c
+SRCS+=$(KTOP)/dev/lamebus/lhd_att.c
+SRCS+=$(KTOP)/dev/lamebus/lnet.c
+SRCS+=$(KTOP)/dev/lamebus/lnet_att.c
 SRCS+=$(KTOP)/dev/lamebus/lrandom.c
-SRCS+=$(KTOP)/dev/lamebus/lser_att.c
+SRCS+=$(KTOP)/dev/lamebus/lrandom_att.c
 SRCS+=$(KTOP)/dev/lamebus/lser.c
-SRCS+=$(KTOP)/dev/lamebus/ltimer_att.c
+SRCS+=$(KTOP)/dev/lamebus/lser_att.c
 SRCS+=$(KTOP)/dev/lamebus/ltimer.c
-SRCS+=$(KTOP)/dev/lamebus/ltrace_att.c
+SRCS+=$(KTOP)/dev/lamebus/ltimer_att.c
 SRCS+=$(KTOP)/dev/lamebus/ltrace.c
+SRCS+=$(KTOP)/dev/lamebus/ltrace_att.c
 SRCS+=$(KTOP)/dev/lamebus/random_lrandom.c
 SRCS+=$(KTOP)/dev/lamebus/rtclock_ltimer.c
 SRCS+=$(KTOP)/fs/semfs/semfs_fsops.c
@@ -40,57 +42,32 @@ SRCS+=$(KTOP)/fs/semfs/semfs_obj.c
 SRCS+=$(KTOP)/fs/semfs/semfs_vnops.c
 SRCS+=$(KTOP)/fs/sfs/sfs_balloc.c
 SRCS+=$(KTOP)/fs/sfs/sfs_bmap.c
+SRCS+=$(KTOP)/fs/sfs/sfs_buf.c
 SRCS+=$(KTOP)/fs/sfs/sfs_dir.c
 SRCS+=$(KTOP)/fs/sfs/sfs_fsops.c
 SRCS+=$(KTOP)/fs/sfs/sfs_inode.c
 SRCS+=$(KTOP)/fs/sfs/sfs_io.c
+SRCS+=$(KTOP)/fs/sfs/sfs_journal.c
 SRCS+=$(KTOP)/fs/sfs/sfs_vnops.c
 SRCS+=$(KTOP)/lib/array.c
 SRCS+=$(KTOP)/lib/bitmap.c
 SRCS+=$(KTOP)/lib/bswap.c
+SRCS+=$(KTOP)/lib/hashtable.c
 SRCS+=$(KTOP)/lib/kgets.c
 SRCS+=$(KTOP)/lib/kprintf.c
+SRCS+=$(KTOP)/lib/lz.c
 SRCS+=$(KTOP)/lib/misc.c
+SRCS+=$(KTOP)/lib/pqueue.c
+SRCS+=$(KTOP)/lib/radixtree.c
+SRCS+=$(KTOP)/lib/ringbuf.c
 SRCS+=$(KTOP)/lib/time.c
 SRCS+=$(KTOP)/lib/uio.c
 SRCS+=$(KTOP)/main/main.c
 SRCS+=$(KTOP)/main/menu.c
-SRCS.MACHINE.mips+=$(KTOP)/arch/mips/locore/trap.c
-SRCS.MACHINE.mips+=$(KTOP)/arch/mips/syscall/syscall.c
-SRCS.MACHINE.mips+=$(KTOP)/arch/mips/thread/cpu.c
-SRCS.MACHINE.mips+=$(KTOP)/arch/mips/thread/switchframe.c
-SRCS.MACHINE.mips+=$(KTOP)/arch/mips/thread/switch.S
-SRCS.MACHINE.mips+=$(KTOP)/arch/mips/thread/thread_machdep.c
-SRCS.MACHINE.mips+=$(KTOP)/arch/mips/thread/threadstart.S
-SRCS.MACHINE.mips+=$(KTOP)/arch/mips/vm/dumbvm.c
-SRCS.MACHINE.mips+=$(KTOP)/arch/mips/vm/ram.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/adddi3.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/anddi3.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/ashldi3.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/ashrdi3.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/cmpdi2.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/divdi3.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/iordi3.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/lshldi3.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/lshrdi3.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/moddi3.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/muldi3.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/negdi2.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/notdi2.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/qdivrem.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/subdi3.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/ucmpdi2.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/udivdi3.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/umoddi3.c
-SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/xordi3.c
-SRCS.MACHINE.mips+=$(TOP)/common/libc/arch/mips/setjmp.S
-SRCS.MACHINE.mips+=$(KTOP)/vm/copyinout.c
+SRCS+=$(KTOP)/net/net.c
+SRCS+=$(KTOP)/proc/futex.c
 SRCS+=$(KTOP)/proc/proc.c
-SRCS.PLATFORM.sys161+=$(KTOP)/arch/mips/locore/cache-mips161.S
-SRCS.PLATFORM.sys161+=$(KTOP)/arch/mips/locore/exception-mips1.S
-SRCS.PLATFORM.sys161+=$(KTOP)/arch/mips/vm/tlb-mips161.S
-SRCS.PLATFORM.sys161+=$(KTOP)/arch/sys161/dev/lamebus_machdep.c
-SRCS.PLATFORM.sys161+=$(KTOP)/arch/sys161/main/start.S
+SRCS+=$(KTOP)/syscall/checkpoint.c
 SRCS+=$(KTOP)/syscall/exec.c
 SRCS+=$(KTOP)/syscall/loadelf.c
 SRCS+=$(KTOP)/syscall/runprogram.c
@@ -98,26 +75,94 @@ SRCS+=$(KTOP)/syscall/syscall_FILE.c
 SRCS+=$(KTOP)/syscall/syscall_PROC.c
 SRCS+=$(KTOP)/syscall/time_syscalls.c
 SRCS+=$(KTOP)/test/arraytest.c
+SRCS+=$(KTOP)/test/benchtest.c
 SRCS+=$(KTOP)/test/bitmaptest.c
 SRCS+=$(KTOP)/test/fstest.c
+SRCS+=$(KTOP)/test/hashtest.c
 SRCS+=$(KTOP)/test/kmalloctest.c
+SRCS+=$(KTOP)/test/lztest.c
+SRCS+=$(KTOP)/test/nettest.c
+SRCS+=$(KTOP)/test/pqueuetest.c
+SRCS+=$(KTOP)/test/radixtest.c
+SRCS+=$(KTOP)/test/ringtest.c
 SRCS+=$(KTOP)/test/semunit.c
+SRCS+=$(KTOP)/test/spinlocktest.c
 SRCS+=$(KTOP)/test/synchtest.c
 SRCS+=$(KTOP)/test/threadlisttest.c
 SRCS+=$(KTOP)/test/threadtest.c
 SRCS+=$(KTOP)/test/tt3.c
 SRCS+=$(KTOP)/thread/clock.c
+SRCS+=$(KTOP)/thread/hangman.c
 SRCS+=$(KTOP)/thread/spinlock.c
 SRCS+=$(KTOP)/thread/spl.c
 SRCS+=$(KTOP)/thread/synch.c
 SRCS+=$(KTOP)/thread/thread.c
 SRCS+=$(KTOP)/thread/threadlist.c
+SRCS+=$(KTOP)/thread/workqueue.c
+SRCS+=$(KTOP)/vfs/appendlog.c
+SRCS+=$(KTOP)/vfs/childfd.c
 SRCS+=$(KTOP)/vfs/device.c
+SRCS+=$(KTOP)/vfs/devkstat.c
 SRCS+=$(KTOP)/vfs/devnull.c
+SRCS+=$(KTOP)/vfs/pipe.c
+SRCS+=$(KTOP)/vfs/rangelock.c
+SRCS+=$(KTOP)/vfs/vfscache.c
 SRCS+=$(KTOP)/vfs/vfscwd.c
 SRCS+=$(KTOP)/vfs/vfsfail.c
 SRCS+=$(KTOP)/vfs/vfslist.c
 SRCS+=$(KTOP)/vfs/vfslookup.c
 SRCS+=$(KTOP)/vfs/vfspath.c
+SRCS+=$(KTOP)/vfs/vfspoll.c
 SRCS+=$(KTOP)/vfs/vnode.c
+SRCS+=$(KTOP)/vm/buddy.c
+SRCS+=$(KTOP)/vm/compact.c
+SRCS+=$(KTOP)/vm/cow.c
+SRCS+=$(KTOP)/vm/frame.c
+SRCS+=$(KTOP)/vm/kinfo.c
 SRCS+=$(KTOP)/vm/kmalloc.c
+SRCS+=$(KTOP)/vm/kmem_cache.c
+SRCS+=$(KTOP)/vm/mapcache.c
+SRCS+=$(KTOP)/vm/mmap.c
+SRCS+=$(KTOP)/vm/pcpcache.c
+SRCS+=$(KTOP)/vm/shm.c
+SRCS+=$(KTOP)/vm/swap.c
+SRCS+=$(KTOP)/vm/textcache.c
+SRCS+=$(KTOP)/vm/vmalloc.c
+SRCS+=$(KTOP)/vm/vmckpt.c
+SRCS+=$(KTOP)/vm/zpool.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/adddi3.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/anddi3.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/ashldi3.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/ashrdi3.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/cmpdi2.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/divdi3.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/iordi3.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/lshldi3.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/lshrdi3.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/moddi3.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/muldi3.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/negdi2.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/notdi2.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/qdivrem.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/subdi3.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/ucmpdi2.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/udivdi3.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/umoddi3.c
+SRCS.MACHINE.mips+=$(TOP)/common/gcc-millicode/xordi3.c
+SRCS.MACHINE.mips+=$(TOP)/common/libc/arch/mips/setjmp.S
+SRCS.MACHINE.mips+=$(KTOP)/arch/mips/locore/trap.c
+SRCS.MACHINE.mips+=$(KTOP)/arch/mips/syscall/syscall.c
+SRCS.MACHINE.mips+=$(KTOP)/arch/mips/thread/cpu.c
+SRCS.MACHINE.mips+=$(KTOP)/arch/mips/thread/switch.S
+SRCS.MACHINE.mips+=$(KTOP)/arch/mips/thread/switchframe.c
+SRCS.MACHINE.mips+=$(KTOP)/arch/mips/thread/thread_machdep.c
+SRCS.MACHINE.mips+=$(KTOP)/arch/mips/thread/threadstart.S
+SRCS.MACHINE.mips+=$(KTOP)/arch/mips/vm/dumbvm.c
+SRCS.MACHINE.mips+=$(KTOP)/arch/mips/vm/ram.c
+SRCS.MACHINE.mips+=$(KTOP)/arch/mips/vm/ucopy.S
+SRCS.MACHINE.mips+=$(KTOP)/vm/copyinout.c
+SRCS.PLATFORM.sys161+=$(KTOP)/arch/mips/locore/cache-mips161.S
+SRCS.PLATFORM.sys161+=$(KTOP)/arch/mips/locore/exception-mips1.S
+SRCS.PLATFORM.sys161+=$(KTOP)/arch/mips/vm/tlb-mips161.S
+SRCS.PLATFORM.sys161+=$(KTOP)/arch/sys161/dev/lamebus_machdep.c
+SRCS.PLATFORM.sys161+=$(KTOP)/arch/sys161/main/start.S
@@ -1,5 +1,5 @@
 /* Automatically generated; do not edit */
 #ifndef _OPT_HANGMAN_H_
 #define _OPT_HANGMAN_H_
-#define OPT_HANGMAN 0
+#define OPT_HANGMAN 1
 #endif /* _OPT_HANGMAN_H_ */
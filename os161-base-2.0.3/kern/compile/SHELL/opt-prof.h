@@ -0,0 +1,5 @@
+/* Automatically generated; do not edit */
+#ifndef _OPT_PROF_H_
+#define _OPT_PROF_H_
+#define OPT_PROF 0
+#endif /* _OPT_PROF_H_ */
@@ -39,6 +39,10 @@
  * supported, although such support could be added without undue
  * difficulty.
  *
+ * Under OPT_SHELL, further devices that could be the console are
+ * attached too, as plain terminals con1:, con2:... with rings and
+ * locks of their own; kprintf output only ever goes to con0.
+ *
  * Note that nothing happens until we have a device to write to. A
  * buffer of size DELAYBUFSIZE is used to hold output that is
  * generated before this point. This means that (1) using kprintf for
@@ -49,12 +53,15 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/ioctl.h>
 #include <lib.h>
 #include <uio.h>
+#include <copyinout.h>
 #include <cpu.h>
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#include <wchan.h>
 #include <generic/console.h>
 #include <vfs.h>
 #include <device.h>
@@ -65,13 +72,6 @@
  */
 static struct con_softc *the_console = NULL;
 
-/*
- * Lock so user I/Os are atomic.
- * We use two locks so readers waiting for input don't lock out writers.
- */
-static struct lock *con_userlock_read = NULL;
-static struct lock *con_userlock_write = NULL;
-
 //////////////////////////////////////////////////
 
 /*
@@ -109,6 +109,75 @@ flush_delay_buf(void)
 
 //////////////////////////////////////////////////
 
+#if OPT_SHELL
+/*
+ * Number of free slots in the output ring. Called with cs_outlock held.
+ */
+static
+unsigned
+con_outroom(struct con_softc *cs)
+{
+	return (cs->cs_outtail + CONSOLE_OUTPUT_BUFFER_SIZE - cs->cs_outhead
+		- 1) % CONSOLE_OUTPUT_BUFFER_SIZE;
+}
+
+/*
+ * If the device is idle and the output ring isn't empty, send the
+ * next character. Called with cs_outlock held.
+ */
+static
+void
+con_kick(struct con_softc *cs)
+{
+	unsigned n;
+
+	if (cs->cs_sending || cs->cs_outtail == cs->cs_outhead) {
+		return;
+	}
+	if (cs->cs_sendbuf != NULL) {
+		/* Hand over the whole ring, in at most two pieces */
+		while (cs->cs_outtail != cs->cs_outhead) {
+			n = (cs->cs_outhead > cs->cs_outtail ?
+			     cs->cs_outhead : CONSOLE_OUTPUT_BUFFER_SIZE)
+				- cs->cs_outtail;
+			cs->cs_sendbuf(cs->cs_devdata,
+				       &cs->cs_outbuf[cs->cs_outtail], n);
+			cs->cs_outtail = (cs->cs_outtail + n) %
+				CONSOLE_OUTPUT_BUFFER_SIZE;
+		}
+		return;
+	}
+	cs->cs_sending = true;
+	cs->cs_send(cs->cs_devdata, cs->cs_outbuf[cs->cs_outtail]);
+	cs->cs_outtail = (cs->cs_outtail + 1) % CONSOLE_OUTPUT_BUFFER_SIZE;
+}
+
+/*
+ * Queue LEN characters for output, sleeping only while the ring is
+ * full.
+ */
+static
+void
+con_output(struct con_softc *cs, const char *buf, size_t len)
+{
+	size_t i;
+
+	spinlock_acquire(&cs->cs_outlock);
+	for (i=0; i<len; i++) {
+		while (con_outroom(cs) == 0) {
+			con_kick(cs);
+			if (con_outroom(cs) == 0) {
+				wchan_sleep(cs->cs_outwchan, &cs->cs_outlock);
+			}
+		}
+		cs->cs_outbuf[cs->cs_outhead] = buf[i];
+		cs->cs_outhead = (cs->cs_outhead + 1) % CONSOLE_OUTPUT_BUFFER_SIZE;
+	}
+	con_kick(cs);
+	spinlock_release(&cs->cs_outlock);
+}
+#endif
+
 /*
  * Print a character, using polling instead of interrupts to wait for
  * I/O completion.
@@ -117,6 +186,24 @@ static
 void
 putch_polled(struct con_softc *cs, int ch)
 {
+#if OPT_SHELL
+	/*
+	 * Whatever is still in the output ring was printed first; get
+	 * it out ahead of this, so that nothing is lost (or reordered)
+	 * if, say, this is a panic message. If we're inside the ring
+	 * code ourselves, just go ahead.
+	 */
+	if (!spinlock_do_i_hold(&cs->cs_outlock)) {
+		spinlock_acquire(&cs->cs_outlock);
+		while (cs->cs_outtail != cs->cs_outhead) {
+			cs->cs_sendpolled(cs->cs_devdata,
+					  cs->cs_outbuf[cs->cs_outtail]);
+			cs->cs_outtail = (cs->cs_outtail + 1) %
+				CONSOLE_OUTPUT_BUFFER_SIZE;
+		}
+		spinlock_release(&cs->cs_outlock);
+	}
+#endif
 	cs->cs_sendpolled(cs->cs_devdata, ch);
 }
 
@@ -129,8 +216,14 @@ static
 void
 putch_intr(struct con_softc *cs, int ch)
 {
+#if OPT_SHELL
+	char c = ch;
+
+	con_output(cs, &c, 1);
+#else
 	P(cs->cs_wsem);
 	cs->cs_send(cs->cs_devdata, ch);
+#endif
 }
 
 /*
@@ -142,13 +235,199 @@ getch_intr(struct con_softc *cs)
 {
 	unsigned char ret;
 
+#if OPT_SHELL
+	spinlock_acquire(&cs->cs_inlock);
+	while (cs->cs_gotchars_head == cs->cs_gotchars_tail) {
+		wchan_sleep(cs->cs_inwchan, &cs->cs_inlock);
+	}
+#else
 	P(cs->cs_rsem);
+#endif
 	ret = cs->cs_gotchars[cs->cs_gotchars_tail];
 	cs->cs_gotchars_tail =
 		(cs->cs_gotchars_tail + 1) % CONSOLE_INPUT_BUFFER_SIZE;
+#if OPT_SHELL
+	spinlock_release(&cs->cs_inlock);
+#endif
 	return ret;
 }
 
+#if OPT_SHELL
+/* Marks a line ended with ^D in the cooked ring; not passed on */
+#define CON_EOF 4
+
+/*
+ * Echo a typed character. This mustn't sleep, so if the output ring
+ * is full the echo is dropped.
+ */
+static
+void
+con_echo(struct con_softc *cs, int ch)
+{
+	spinlock_acquire(&cs->cs_outlock);
+	if (ch == '\n' && con_outroom(cs) > 0) {
+		cs->cs_outbuf[cs->cs_outhead] = '\r';
+		cs->cs_outhead = (cs->cs_outhead + 1) % CONSOLE_OUTPUT_BUFFER_SIZE;
+	}
+	if (con_outroom(cs) > 0) {
+		cs->cs_outbuf[cs->cs_outhead] = ch;
+		cs->cs_outhead = (cs->cs_outhead + 1) % CONSOLE_OUTPUT_BUFFER_SIZE;
+	}
+	con_kick(cs);
+	spinlock_release(&cs->cs_outlock);
+}
+
+/*
+ * Finish the line being typed, ending it with TERM, and move it to
+ * the cooked ring. If there's no room, the line is lost. Returns true
+ * if there is a new line to read. Called with cs_inlock held.
+ */
+static
+bool
+con_endline(struct con_softc *cs, char term)
+{
+	unsigned room, i;
+
+	room = (cs->cs_cookedtail + CONSOLE_COOKED_SIZE - cs->cs_cookedhead
+		- 1) % CONSOLE_COOKED_SIZE;
+	if (room < cs->cs_linelen + 1) {
+		cs->cs_linelen = 0;
+		con_echo(cs, '\a');
+		return false;
+	}
+	for (i=0; i<cs->cs_linelen; i++) {
+		cs->cs_cooked[cs->cs_cookedhead] = cs->cs_line[i];
+		cs->cs_cookedhead = (cs->cs_cookedhead + 1) %
+			CONSOLE_COOKED_SIZE;
+	}
+	cs->cs_cooked[cs->cs_cookedhead] = term;
+	cs->cs_cookedhead = (cs->cs_cookedhead + 1) % CONSOLE_COOKED_SIZE;
+	cs->cs_linelen = 0;
+	cs->cs_nlines++;
+	return true;
+}
+
+/*
+ * Canonical-mode handling of one input character. Returns true if it
+ * finished a line. Called with cs_inlock held.
+ */
+static
+bool
+con_canon(struct con_softc *cs, int ch)
+{
+	switch (ch) {
+	    case '\b':
+	    case 127:
+		/* backspace */
+		if (cs->cs_linelen > 0) {
+			cs->cs_linelen--;
+			con_echo(cs, '\b');
+			con_echo(cs, ' ');
+			con_echo(cs, '\b');
+		}
+		return false;
+	    case 21:
+		/* ^U - erase line */
+		while (cs->cs_linelen > 0) {
+			cs->cs_linelen--;
+			con_echo(cs, '\b');
+			con_echo(cs, ' ');
+			con_echo(cs, '\b');
+		}
+		return false;
+	    case CON_EOF:
+		return con_endline(cs, CON_EOF);
+	    case '\r':
+	    case '\n':
+		con_echo(cs, '\n');
+		return con_endline(cs, '\n');
+	}
+
+	/* Only allow the normal 7-bit ascii */
+	if (ch >= 32 && ch < 127 && cs->cs_linelen < CONSOLE_LINE_MAX - 1) {
+		cs->cs_line[cs->cs_linelen++] = ch;
+		con_echo(cs, ch);
+	}
+	else {
+		con_echo(cs, '\a');
+	}
+	return false;
+}
+
+/*
+ * Switch the line discipline to MODE. Characters that came in raw
+ * and haven't been read yet go through the line editor when switching
+ * to canonical mode; a half-typed line is dropped when switching back.
+ */
+static
+void
+con_setmode(struct con_softc *cs, int mode)
+{
+	bool newline = false;
+	int ch;
+
+	spinlock_acquire(&cs->cs_inlock);
+	if (mode == CONMODE_CANON && cs->cs_mode != CONMODE_CANON) {
+		while (cs->cs_gotchars_tail != cs->cs_gotchars_head) {
+			ch = cs->cs_gotchars[cs->cs_gotchars_tail];
+			cs->cs_gotchars_tail = (cs->cs_gotchars_tail + 1) %
+				CONSOLE_INPUT_BUFFER_SIZE;
+			newline |= con_canon(cs, ch);
+		}
+	}
+	else if (mode == CONMODE_RAW) {
+		cs->cs_linelen = 0;
+	}
+	cs->cs_mode = mode;
+	if (newline) {
+		wchan_wakeall(cs->cs_inwchan, &cs->cs_inlock);
+		pollhead_wakeup(&cs->cs_poll);
+	}
+	spinlock_release(&cs->cs_inlock);
+}
+
+/*
+ * Canonical-mode read: wait for a finished line and hand over as much
+ * of it as fits, with one uiomove.
+ */
+static
+int
+con_readline(struct con_softc *cs, struct uio *uio)
+{
+	char buf[CONSOLE_LINE_MAX];
+	size_t n;
+	char ch;
+
+	if (uio->uio_resid == 0) {
+		return 0;
+	}
+
+	spinlock_acquire(&cs->cs_inlock);
+	while (cs->cs_nlines == 0) {
+		wchan_sleep(cs->cs_inwchan, &cs->cs_inlock);
+	}
+	n = 0;
+	while (n < uio->uio_resid) {
+		KASSERT(n < sizeof(buf));
+		ch = cs->cs_cooked[cs->cs_cookedtail];
+		cs->cs_cookedtail = (cs->cs_cookedtail + 1) %
+			CONSOLE_COOKED_SIZE;
+		if (ch == CON_EOF) {
+			cs->cs_nlines--;
+			break;
+		}
+		buf[n++] = ch;
+		if (ch == '\n') {
+			cs->cs_nlines--;
+			break;
+		}
+	}
+	spinlock_release(&cs->cs_inlock);
+
+	return uiomove(buf, n, uio);
+}
+#endif
+
 /*
  * Called from underlying device when a read-ready interrupt occurs.
  *
@@ -164,6 +443,26 @@ con_input(void *vcs, int ch)
 	struct con_softc *cs = vcs;
 	unsigned nexthead;
 
+#if OPT_SHELL
+	spinlock_acquire(&cs->cs_inlock);
+	if (cs->cs_mode == CONMODE_CANON) {
+		if (con_canon(cs, ch)) {
+			wchan_wakeall(cs->cs_inwchan, &cs->cs_inlock);
+			pollhead_wakeup(&cs->cs_poll);
+		}
+		spinlock_release(&cs->cs_inlock);
+		return;
+	}
+	nexthead = (cs->cs_gotchars_head + 1) % CONSOLE_INPUT_BUFFER_SIZE;
+	if (nexthead != cs->cs_gotchars_tail) {
+		cs->cs_gotchars[cs->cs_gotchars_head] = ch;
+		cs->cs_gotchars_head = nexthead;
+		wchan_wakeall(cs->cs_inwchan, &cs->cs_inlock);
+		pollhead_wakeup(&cs->cs_poll);
+	}
+	/* else overflow; drop character */
+	spinlock_release(&cs->cs_inlock);
+#else
 	nexthead = (cs->cs_gotchars_head + 1) % CONSOLE_INPUT_BUFFER_SIZE;
 	if (nexthead == cs->cs_gotchars_tail) {
 		/* overflow; drop character */
@@ -174,6 +473,7 @@ con_input(void *vcs, int ch)
 	cs->cs_gotchars_head = nexthead;
 
 	V(cs->cs_rsem);
+#endif
 }
 
 /*
@@ -184,7 +484,19 @@ con_start(void *vcs)
 {
 	struct con_softc *cs = vcs;
 
+#if OPT_SHELL
+	/* Send the next character; once half the ring is free, wake writers */
+	spinlock_acquire(&cs->cs_outlock);
+	cs->cs_sending = false;
+	con_kick(cs);
+	if (con_outroom(cs) >= CONSOLE_OUTPUT_BUFFER_SIZE / 2) {
+		wchan_wakeall(cs->cs_outwchan, &cs->cs_outlock);
+		pollhead_wakeup(&cs->cs_poll);
+	}
+	spinlock_release(&cs->cs_outlock);
+#else
 	V(cs->cs_wsem);
+#endif
 }
 
 //////////////////////////////////////////////////
@@ -222,6 +534,12 @@ getch(void)
 	KASSERT(cs != NULL);
 	KASSERT(!curthread->t_in_interrupt && curthread->t_iplhigh_count == 0);
 
+#if OPT_SHELL
+	/* The kernel always reads raw characters, whatever a program set */
+	if (cs->cs_mode != CONMODE_RAW) {
+		con_setmode(cs, CONMODE_RAW);
+	}
+#endif
 	return getch_intr(cs);
 }
 
@@ -240,29 +558,73 @@ con_eachopen(struct device *dev, int openflags)
 	return 0;
 }
 
+#if OPT_SHELL
+/*
+ * Console write: copy the data in a chunk at a time, turn newlines
+ * into CR-LF, and queue it in the output ring.
+ */
+static
+int
+con_write(struct con_softc *cs, struct uio *uio)
+{
+	char in[64], out[2 * sizeof(in)];
+	size_t len, i, n;
+	int result;
+
+	while (uio->uio_resid > 0) {
+		len = uio->uio_resid < sizeof(in) ? uio->uio_resid : sizeof(in);
+		result = uiomove(in, len, uio);
+		if (result) {
+			return result;
+		}
+		for (i = n = 0; i < len; i++) {
+			if (in[i] == '\n') {
+				out[n++] = '\r';
+			}
+			out[n++] = in[i];
+		}
+		con_output(cs, out, n);
+	}
+	return 0;
+}
+#endif
+
 static
 int
 con_io(struct device *dev, struct uio *uio)
 {
+	struct con_softc *cs = dev->d_data;
 	int result;
 	char ch;
 	struct lock *lk;
 
-	(void)dev;  // unused
-
 	if (uio->uio_rw==UIO_READ) {
-		lk = con_userlock_read;
+		lk = cs->cs_userlock_read;
 	}
 	else {
-		lk = con_userlock_write;
+		lk = cs->cs_userlock_write;
 	}
 
 	KASSERT(lk != NULL);
 	lock_acquire(lk);
 
+#if OPT_SHELL
+	if (uio->uio_rw == UIO_WRITE) {
+		result = con_write(cs, uio);
+		lock_release(lk);
+		return result;
+	}
+	if (cs->cs_mode == CONMODE_CANON) {
+		result = con_readline(cs, uio);
+		lock_release(lk);
+		return result;
+	}
+#endif
+
 	while (uio->uio_resid > 0) {
 		if (uio->uio_rw==UIO_READ) {
-			ch = getch();
+			/* (raw mode, as getch would have it) */
+			ch = getch_intr(cs);
 			if (ch=='\r') {
 				ch = '\n';
 			}
@@ -295,17 +657,73 @@ static
 int
 con_ioctl(struct device *dev, int op, userptr_t data)
 {
+#if OPT_SHELL
+	struct con_softc *cs = dev->d_data;
+	int mode, result;
+
+	switch (op) {
+	    case CONIOC_GETMODE:
+		mode = cs->cs_mode;
+		return copyout(&mode, data, sizeof(mode));
+	    case CONIOC_SETMODE:
+		result = copyin(data, &mode, sizeof(mode));
+		if (result) {
+			return result;
+		}
+		if (mode != CONMODE_RAW && mode != CONMODE_CANON) {
+			return EINVAL;
+		}
+		con_setmode(cs, mode);
+		return 0;
+	}
+	return EINVAL;
+#else
 	/* No ioctls. */
 	(void)dev;
 	(void)op;
 	(void)data;
 	return EINVAL;
+#endif
 }
 
+#if OPT_SHELL
+/*
+ * poll(): there is input once a whole line is in (canonical mode) or
+ * any character is (raw mode), and room for output while the ring
+ * isn't full. Both locks are held, so that wakeups from either side
+ * are seen.
+ */
+static
+int
+con_poll(struct device *dev, int events, struct pollent *pe)
+{
+	struct con_softc *cs = dev->d_data;
+	int ready = 0;
+
+	spinlock_acquire(&cs->cs_inlock);
+	spinlock_acquire(&cs->cs_outlock);
+	pollhead_register(&cs->cs_poll, pe);
+	if (cs->cs_mode == CONMODE_CANON ? cs->cs_nlines > 0 :
+	    cs->cs_gotchars_head != cs->cs_gotchars_tail) {
+		ready |= POLLIN;
+	}
+	if (con_outroom(cs) > 0) {
+		ready |= POLLOUT;
+	}
+	spinlock_release(&cs->cs_outlock);
+	spinlock_release(&cs->cs_inlock);
+
+	return ready & events;
+}
+#endif
+
 static const struct device_ops console_devops = {
 	.devop_eachopen = con_eachopen,
 	.devop_io = con_io,
 	.devop_ioctl = con_ioctl,
+#if OPT_SHELL
+	.devop_poll = con_poll,
+#endif
 };
 
 static
@@ -313,6 +731,7 @@ int
 attach_console_to_vfs(struct con_softc *cs)
 {
 	struct device *dev;
+	char name[16];
 	int result;
 
 	dev = kmalloc(sizeof(*dev));
@@ -325,7 +744,14 @@ attach_console_to_vfs(struct con_softc *cs)
 	dev->d_blocksize = 1;
 	dev->d_data = cs;
 
-	result = vfs_adddev("con", dev, 0);
+	/* The system console is con:, the others con1:, con2:... */
+	if (cs->cs_unit == 0) {
+		strcpy(name, "con");
+	}
+	else {
+		snprintf(name, sizeof(name), "con%d", cs->cs_unit);
+	}
+	result = vfs_adddev(name, dev, 0);
 	if (result) {
 		kfree(dev);
 		return result;
@@ -348,16 +774,21 @@ config_con(struct con_softc *cs, int unit)
 
 	/*
 	 * Only allow one system console.
-	 * Further devices that could be the system console are ignored.
+	 * Further devices that could be the system console are ignored,
+	 * or (OPT_SHELL) attached as extra terminals.
 	 *
 	 * Do not hardwire the console to be "con1" instead of "con0",
 	 * or these asserts will go off.
 	 */
 	if (unit>0) {
 		KASSERT(the_console!=NULL);
+#if !OPT_SHELL
 		return ENODEV;
+#endif
+	}
+	else {
+		KASSERT(the_console==NULL);
 	}
-	KASSERT(the_console==NULL);
 
 	rsem = sem_create("console read", 0);
 	if (rsem == NULL) {
@@ -382,16 +813,49 @@ config_con(struct con_softc *cs, int unit)
 		return ENOMEM;
 	}
 
+	cs->cs_unit = unit;
+	cs->cs_userlock_read = rlk;
+	cs->cs_userlock_write = wlk;
 	cs->cs_rsem = rsem;
 	cs->cs_wsem = wsem;
 	cs->cs_gotchars_head = 0;
 	cs->cs_gotchars_tail = 0;
-
-	the_console = cs;
-	con_userlock_read = rlk;
-	con_userlock_write = wlk;
-
-	flush_delay_buf();
+#if OPT_SHELL
+	spinlock_init(&cs->cs_outlock);
+	cs->cs_outwchan = wchan_create("console output");
+	if (cs->cs_outwchan == NULL) {
+		lock_destroy(wlk);
+		lock_destroy(rlk);
+		sem_destroy(rsem);
+		sem_destroy(wsem);
+		return ENOMEM;
+	}
+	cs->cs_outhead = 0;
+	cs->cs_outtail = 0;
+	cs->cs_sending = false;
+
+	spinlock_init(&cs->cs_inlock);
+	cs->cs_inwchan = wchan_create("console input");
+	if (cs->cs_inwchan == NULL) {
+		wchan_destroy(cs->cs_outwchan);
+		lock_destroy(wlk);
+		lock_destroy(rlk);
+		sem_destroy(rsem);
+		sem_destroy(wsem);
+		return ENOMEM;
+	}
+	cs->cs_mode = CONMODE_RAW;
+	cs->cs_linelen = 0;
+	cs->cs_cookedhead = 0;
+	cs->cs_cookedtail = 0;
+	cs->cs_nlines = 0;
+	pollhead_init(&cs->cs_poll);
+#endif
+
+	if (unit == 0) {
+		the_console = cs;
+		flush_delay_buf();
+	}
 
 	return attach_console_to_vfs(cs);
 }
@@ -37,20 +37,77 @@
  * device, and are to be initialized by the attach routine.
  */
 
+#include <spinlock.h>
+#include "opt-shell.h"
+#if OPT_SHELL
+#include <poll.h>
+#endif
+
+#if OPT_SHELL
+#define CONSOLE_INPUT_BUFFER_SIZE 256
+#define CONSOLE_OUTPUT_BUFFER_SIZE 1024
+#define CONSOLE_LINE_MAX 256
+#define CONSOLE_COOKED_SIZE 1024
+#else
 #define CONSOLE_INPUT_BUFFER_SIZE 32
+#endif
 
 struct con_softc {
 	/* initialized by attach routine */
 	void *cs_devdata;
 	void (*cs_send)(void *devdata, int ch);
 	void (*cs_sendpolled)(void *devdata, int ch);
+#if OPT_SHELL
+	/*
+	 * Optional (else NULL): send LEN characters at once, finishing
+	 * before it returns, for devices like memory-mapped screens
+	 * that don't need to be fed a character per interrupt.
+	 */
+	void (*cs_sendbuf)(void *devdata, const char *buf, size_t len);
+#endif
 
 	/* initialized by config routine */
+	int cs_unit;			/* con0 is the system console */
+	struct lock *cs_userlock_read;	/* so user I/Os are atomic; two, */
+	struct lock *cs_userlock_write;	/* so readers don't lock out writers */
 	struct semaphore *cs_rsem;
 	struct semaphore *cs_wsem;
 	unsigned char cs_gotchars[CONSOLE_INPUT_BUFFER_SIZE];
 	unsigned cs_gotchars_head;	/* next slot to put a char in */
 	unsigned cs_gotchars_tail;	/* next slot to take a char out */
+#if OPT_SHELL
+	/*
+	 * Output ring. Characters are queued at the head and sent one
+	 * at a time from the tail, the next one each time the device
+	 * says it is done with the last (con_start).
+	 */
+	struct spinlock cs_outlock;	/* protects the output ring */
+	struct wchan *cs_outwchan;	/* writers wait here for room */
+	char cs_outbuf[CONSOLE_OUTPUT_BUFFER_SIZE];
+	unsigned cs_outhead;		/* next slot to put a char in */
+	unsigned cs_outtail;		/* next slot to send from */
+	bool cs_sending;		/* device is busy with a char */
+
+	/*
+	 * Line discipline (see <kern/ioctl.h>). In raw mode input goes
+	 * to cs_gotchars as it arrives. In canonical mode con_input
+	 * edits the line being typed in cs_line, and moves it to the
+	 * cooked ring once it is finished; readers take whole lines
+	 * from there. Both rings are protected by cs_inlock.
+	 */
+	struct spinlock cs_inlock;
+	struct wchan *cs_inwchan;	/* readers wait here for input */
+	int cs_mode;			/* CONMODE_* */
+	char cs_line[CONSOLE_LINE_MAX];
+	unsigned cs_linelen;
+	char cs_cooked[CONSOLE_COOKED_SIZE];
+	unsigned cs_cookedhead;		/* next slot to put a char in */
+	unsigned cs_cookedtail;		/* next slot to take a char out */
+	unsigned cs_nlines;		/* finished lines in the cooked ring */
+
+	/* poll() waits here, for either ring; woken with either lock */
+	struct pollhead cs_poll;
+#endif
 };
 
 /*
@@ -32,9 +32,12 @@
 #include <kern/fcntl.h>
 #include <lib.h>
 #include <uio.h>
+#include <spinlock.h>
 #include <vfs.h>
+#include <workqueue.h>
 #include <generic/random.h>
 #include "autoconf.h"
+#include "opt-shell.h"
 
 /*
  * Machine-independent generic randomness device.
@@ -49,6 +52,141 @@
 
 static struct random_softc *the_random = NULL;
 
+#if OPT_SHELL
+/*
+ * Entropy pool and output stream.
+ *
+ * Reading the device costs a bus access per word, so words are taken
+ * from it in bulk into random_pool, by a work item scheduled whenever
+ * the pool gets down to half full. Output comes from a xoshiro128**
+ * generator that mixes in a fresh pool word every RANDOM_RESEED
+ * outputs, so both random() and reads of the random device are
+ * served from memory. Should the pool run dry, the device is read
+ * directly.
+ */
+#define RANDOM_POOLWORDS	256
+#define RANDOM_RESEED		16
+
+static struct spinlock random_lock = SPINLOCK_INITIALIZER;
+static uint32_t random_pool[RANDOM_POOLWORDS];
+static unsigned random_poolcount;	/* words left in random_pool */
+static bool random_refilling;		/* random_refillwork is scheduled */
+static struct work random_refillwork;
+static uint32_t random_state[4];	/* generator state, never all 0 */
+static unsigned random_untilreseed;
+
+/*
+ * Top up the pool from the device. Runs on a worker thread.
+ */
+static
+void
+random_refill(void *unused)
+{
+	uint32_t buf[RANDOM_POOLWORDS / 2];
+	unsigned i;
+
+	(void)unused;
+
+	for (i=0; i<RANDOM_POOLWORDS / 2; i++) {
+		buf[i] = the_random->rs_random(the_random->rs_devdata);
+	}
+
+	spinlock_acquire(&random_lock);
+	for (i=0; i<RANDOM_POOLWORDS / 2 &&
+		     random_poolcount < RANDOM_POOLWORDS; i++) {
+		random_pool[random_poolcount++] = buf[i];
+	}
+	random_refilling = false;
+	spinlock_release(&random_lock);
+}
+
+/*
+ * Take a word from the pool, or from the device if it is empty.
+ * Called with random_lock held.
+ */
+static
+uint32_t
+random_poolword(void)
+{
+	if (random_poolcount == 0) {
+		return the_random->rs_random(the_random->rs_devdata);
+	}
+	return random_pool[--random_poolcount];
+}
+
+static
+inline
+uint32_t
+random_rotl(uint32_t x, int k)
+{
+	return (x << k) | (x >> (32 - k));
+}
+
+/*
+ * Fill BUF with N random words.
+ */
+static
+void
+random_fill(uint32_t *buf, unsigned n)
+{
+	uint32_t *st = random_state;
+	uint32_t t;
+	unsigned i;
+
+	spinlock_acquire(&random_lock);
+	for (i=0; i<n; i++) {
+		if (random_untilreseed == 0) {
+			st[random_poolcount % 4] ^= random_poolword();
+			if ((st[0] | st[1] | st[2] | st[3]) == 0) {
+				st[0] = 1;
+			}
+			random_untilreseed = RANDOM_RESEED;
+		}
+		random_untilreseed--;
+
+		/* xoshiro128** */
+		buf[i] = random_rotl(st[1] * 5, 7) * 9;
+		t = st[1] << 9;
+		st[2] ^= st[0];
+		st[3] ^= st[1];
+		st[1] ^= st[2];
+		st[0] ^= st[3];
+		st[2] ^= t;
+		st[3] = random_rotl(st[3], 11);
+	}
+	if (random_poolcount < RANDOM_POOLWORDS / 2 && !random_refilling) {
+		random_refilling = true;
+		work_schedule(&random_refillwork);
+	}
+	spinlock_release(&random_lock);
+}
+
+/*
+ * Fill the pool and seed the generator, from the device.
+ */
+static
+void
+random_seed(struct random_softc *rs)
+{
+	unsigned i;
+
+	for (i=0; i<RANDOM_POOLWORDS; i++) {
+		random_pool[i] = rs->rs_random(rs->rs_devdata);
+	}
+	random_poolcount = RANDOM_POOLWORDS;
+	for (i=0; i<4; i++) {
+		random_state[i] = rs->rs_random(rs->rs_devdata);
+	}
+	if ((random_state[0] | random_state[1] |
+	     random_state[2] | random_state[3]) == 0) {
+		random_state[0] = 1;
+	}
+	random_untilreseed = RANDOM_RESEED;
+	random_refilling = false;
+	work_init(&random_refillwork, random_refill, NULL);
+}
+#endif
+
 /*
  * VFS device functions.
  * open: allow reading only.
@@ -74,12 +212,33 @@ int
 randio(struct device *dev, struct uio *uio)
 {
 	struct random_softc *rs = dev->d_data;
+#if OPT_SHELL
+	uint32_t buf[64];
+	size_t len;
+	int result;
+#endif
 
 	if (uio->uio_rw != UIO_READ) {
 		return EIO;
 	}
 
+#if OPT_SHELL
+	(void)rs;
+	while (uio->uio_resid > 0) {
+		len = uio->uio_resid;
+		if (len > sizeof(buf)) {
+			len = sizeof(buf);
+		}
+		random_fill(buf, (len + sizeof(buf[0]) - 1) / sizeof(buf[0]));
+		result = uiomove(buf, len, uio);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+#else
 	return rs->rs_read(rs->rs_devdata, uio);
+#endif
 }
 
 /*
@@ -119,6 +278,9 @@ config_random(struct random_softc *rs, int unit)
 
 	KASSERT(the_random==NULL);
 	the_random = rs;
+#if OPT_SHELL
+	random_seed(rs);
+#endif
 
 	rs->rs_dev.d_ops = &random_devops;
 	rs->rs_dev.d_blocks = 0;
@@ -142,10 +304,19 @@ config_random(struct random_softc *rs, int unit)
 uint32_t
 random(void)
 {
+#if OPT_SHELL
+	uint32_t val;
+#endif
+
 	if (the_random==NULL) {
 		panic("No random device\n");
 	}
+#if OPT_SHELL
+	random_fill(&val, 1);
+	return val;
+#else
 	return the_random->rs_random(the_random->rs_devdata);
+#endif
 }
 
 uint32_t
@@ -154,5 +325,10 @@ randmax(void)
 	if (the_random==NULL) {
 		panic("No random device\n");
 	}
+#if OPT_SHELL
+	/* The generator's output covers all 32 bits */
+	return 0xffffffff;
+#else
 	return the_random->rs_randmax(the_random->rs_devdata);
+#endif
 }
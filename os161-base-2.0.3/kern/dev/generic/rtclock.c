@@ -38,6 +38,9 @@
  * of the available clocks to use, if more than one is available.
  *
  * The system will panic if gettime() is called and there is no clock.
+ *
+ * The same clock also drives clock_monotonic(), counted from when the
+ * clock was configured.
  */
 
 #include <types.h>
@@ -47,11 +50,35 @@
 #include <generic/rtclock.h>
 #include "autoconf.h"
 
+/* Back-to-back reads timed when calibrating */
+#define RTCLOCK_CALIBRATE_READS 16
+
 static struct rtclock_softc *the_clock = NULL;
+static uint64_t monotonic_base;		/* Clock reading at boot */
+static uint32_t monotonic_overhead;	/* Cost of one reading (ns) */
+
+/*
+ * Read the clock in nanoseconds, the cheap way if there is one.
+ */
+static
+uint64_t
+rtclock_getns(void)
+{
+	struct timespec ts;
+
+	if (the_clock->rtc_getns != NULL) {
+		return the_clock->rtc_getns(the_clock->rtc_devdata);
+	}
+	the_clock->rtc_gettime(the_clock->rtc_devdata, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
 int
 config_rtclock(struct rtclock_softc *rtc, int unit)
 {
+	uint64_t end = 0;
+	unsigned i;
+
 	/* We use only the first clock device. */
 	if (unit!=0) {
 		return ENODEV;
@@ -59,6 +86,13 @@ config_rtclock(struct rtclock_softc *rtc, int unit)
 
 	KASSERT(the_clock==NULL);
 	the_clock = rtc;
+
+	/* Start the monotonic clock at zero and see what a read costs */
+	monotonic_base = rtclock_getns();
+	for (i=0; i<RTCLOCK_CALIBRATE_READS; i++) {
+		end = rtclock_getns();
+	}
+	monotonic_overhead = (end - monotonic_base) / RTCLOCK_CALIBRATE_READS;
 	return 0;
 }
 
@@ -68,3 +102,32 @@ gettime(struct timespec *ts)
 	KASSERT(the_clock!=NULL);
 	the_clock->rtc_gettime(the_clock->rtc_devdata, ts);
 }
+
+bool
+clock_ready(void)
+{
+	return the_clock != NULL;
+}
+
+uint64_t
+clock_monotonic(void)
+{
+	KASSERT(the_clock!=NULL);
+	return rtclock_getns() - monotonic_base;
+}
+
+void
+clock_monotonic_ts(struct timespec *ts)
+{
+	uint64_t ns;
+
+	ns = clock_monotonic();
+	ts->tv_sec = ns / 1000000000;
+	ts->tv_nsec = ns % 1000000000;
+}
+
+uint32_t
+clock_monotonic_overhead(void)
+{
+	return monotonic_overhead;
+}
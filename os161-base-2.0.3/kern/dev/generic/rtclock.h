@@ -40,6 +40,11 @@ struct timespec;
 struct rtclock_softc {
 	void *rtc_devdata;
 	void (*rtc_gettime)(void *devdata, struct timespec *);
+	/*
+	 * Optional: the same clock in nanoseconds, as cheaply as
+	 * possible. Must never go backwards.
+	 */
+	uint64_t (*rtc_getns)(void *devdata);
 };
 
 #endif /* _GENERIC_RTCLOCK_H_ */
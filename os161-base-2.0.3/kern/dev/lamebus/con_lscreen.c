@@ -49,6 +49,10 @@ attach_con_to_lscreen(int consno, struct lscreen_softc *ls)
 	cs->cs_devdata = ls;
 	cs->cs_send = lscreen_write;
 	cs->cs_sendpolled = lscreen_write;
+#if OPT_SHELL
+	/* The screen is memory; whole batches are drawn at once */
+	cs->cs_sendbuf = lscreen_writebuf;
+#endif
 
 	ls->ls_devdata = cs;
 	ls->ls_start = con_start;
@@ -41,7 +41,14 @@
 struct con_softc *
 attach_con_to_lser(int consno, struct lser_softc *ls)
 {
-	struct con_softc *cs = kmalloc(sizeof(struct con_softc));
+	struct con_softc *cs;
+
+	/* One console per serial port */
+	if (ls->ls_devdata != NULL) {
+		return NULL;
+	}
+
+	cs = kmalloc(sizeof(struct con_softc));
 	if (cs==NULL) {
 		return NULL;
 	}
@@ -51,6 +58,9 @@ attach_con_to_lser(int consno, struct lser_softc *ls)
 	cs->cs_devdata = ls;
 	cs->cs_send = lser_write;
 	cs->cs_sendpolled = lser_writepolled;
+#if OPT_SHELL
+	cs->cs_sendbuf = NULL;
+#endif
 
 	ls->ls_devdata = cs;
 	ls->ls_start = con_start;
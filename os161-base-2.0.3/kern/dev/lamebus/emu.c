@@ -43,8 +43,10 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/fcntl.h>
+#include <kern/dirent.h>
 #include <stat.h>
 #include <lib.h>
+#include <limits.h>
 #include <array.h>
 #include <uio.h>
 #include <membar.h>
@@ -54,6 +56,7 @@
 #include <vfs.h>
 #include <emufs.h>
 #include "autoconf.h"
+#include "opt-shell.h"
 
 /* Register offsets */
 #define REG_HANDLE    0
@@ -299,6 +302,7 @@ emu_doread(struct emu_softc *sc, uint32_t handle, uint32_t len,
 	return result;
 }
 
+#if !OPT_SHELL
 /*
  * Read from a hardware-level file handle.
  */
@@ -309,6 +313,7 @@ emu_read(struct emu_softc *sc, uint32_t handle, uint32_t len,
 {
 	return emu_doread(sc, handle, len, EMU_OP_READ, uio);
 }
+#endif
 
 /*
  * Read a directory entry from a hardware-level file handle.
@@ -321,6 +326,7 @@ emu_readdir(struct emu_softc *sc, uint32_t handle, uint32_t len,
 	return emu_doread(sc, handle, len, EMU_OP_READDIR, uio);
 }
 
+#if !OPT_SHELL
 /*
  * Write to a hardware-level file handle.
  */
@@ -356,6 +362,186 @@ emu_write(struct emu_softc *sc, uint32_t handle, uint32_t len,
 	lock_release(sc->e_lock);
 	return result;
 }
+#endif
+
+#if OPT_SHELL
+/*
+ * Staging buffers. The device has a single register set and buffer,
+ * so e_lock is held for one operation at a time, and given back
+ * between the chunks of a transfer so others queued for the device
+ * (lock_release hands it on in order) get their turn in between.
+ * Moving data to or from user memory can fault, and the fault may
+ * need this very device (to page in a program run from emu0:), so
+ * user transfers go through one of EMU_NSTAGE staging buffers and the
+ * copy to or from the user runs while the device does something else.
+ * Kernel memory doesn't fault and is copied straight from or to the
+ * device buffer.
+ */
+static
+void *
+emu_stage_get(struct emu_softc *sc)
+{
+	void *buf = NULL;
+	unsigned i;
+
+	P(sc->e_stagesem);
+	spinlock_acquire(&sc->e_stagelock);
+	for (i=0; i<EMU_NSTAGE; i++) {
+		if (sc->e_stage[i] != NULL) {
+			buf = sc->e_stage[i];
+			sc->e_stage[i] = NULL;
+			break;
+		}
+	}
+	spinlock_release(&sc->e_stagelock);
+	KASSERT(buf != NULL);
+	return buf;
+}
+
+static
+void
+emu_stage_put(struct emu_softc *sc, void *buf)
+{
+	unsigned i;
+
+	spinlock_acquire(&sc->e_stagelock);
+	for (i=0; i<EMU_NSTAGE && sc->e_stage[i] != NULL; i++);
+	KASSERT(i < EMU_NSTAGE);
+	sc->e_stage[i] = buf;
+	spinlock_release(&sc->e_stagelock);
+	V(sc->e_stagesem);
+}
+
+/*
+ * Read from a hardware-level file handle into all of UIO, a full
+ * buffer at a time. A short read means end of file, so no further
+ * operation is made just to find that out.
+ */
+static
+int
+emu_readall(struct emu_softc *sc, uint32_t handle, struct uio *uio)
+{
+	uint32_t amt, got;
+	void *stage;
+	int result = 0;
+
+	KASSERT(uio->uio_rw == UIO_READ);
+
+	/* Past the largest size the file can have is EOF */
+	while (uio->uio_resid > 0 && uio->uio_offset <= (off_t)0xffffffff) {
+		amt = uio->uio_resid;
+		if (amt > EMU_MAXIO) {
+			amt = EMU_MAXIO;
+		}
+		stage = uio->uio_segflg == UIO_SYSSPACE ?
+			NULL : emu_stage_get(sc);
+
+		lock_acquire(sc->e_lock);
+		emu_wreg(sc, REG_HANDLE, handle);
+		emu_wreg(sc, REG_IOLEN, amt);
+		emu_wreg(sc, REG_OFFSET, uio->uio_offset);
+		emu_wreg(sc, REG_OPER, EMU_OP_READ);
+		result = emu_waitdone(sc);
+		got = 0;
+		if (result == 0) {
+			membar_load_load();
+			got = emu_rreg(sc, REG_IOLEN);
+			if (stage != NULL) {
+				memcpy(stage, sc->e_iobuf, got);
+			}
+			else {
+				result = uiomove(sc->e_iobuf, got, uio);
+			}
+		}
+		lock_release(sc->e_lock);
+
+		if (stage != NULL) {
+			if (result == 0) {
+				result = uiomove(stage, got, uio);
+			}
+			emu_stage_put(sc, stage);
+		}
+		if (result || got < amt) {
+			break;
+		}
+	}
+
+	return result;
+}
+
+/*
+ * Write all of UIO to the file of EV, a full buffer at a time. The
+ * cached size is brought up to date along with each operation.
+ */
+static
+int
+emu_writeall(struct emufs_vnode *ev, struct uio *uio)
+{
+	struct emu_softc *sc = ev->ev_emu;
+	uint32_t amt;
+	off_t pos;
+	void *stage;
+	int result = 0;
+
+	KASSERT(uio->uio_rw == UIO_WRITE);
+
+	while (uio->uio_resid > 0) {
+		if (uio->uio_offset > (off_t)0xffffffff) {
+			result = EFBIG;
+			break;
+		}
+		amt = uio->uio_resid;
+		if (amt > EMU_MAXIO) {
+			amt = EMU_MAXIO;
+		}
+		pos = uio->uio_offset;
+
+		stage = NULL;
+		if (uio->uio_segflg != UIO_SYSSPACE) {
+			stage = emu_stage_get(sc);
+			result = uiomove(stage, amt, uio);
+			if (result) {
+				emu_stage_put(sc, stage);
+				break;
+			}
+		}
+
+		lock_acquire(sc->e_lock);
+		if (stage != NULL) {
+			memcpy(sc->e_iobuf, stage, amt);
+		}
+		else {
+			result = uiomove(sc->e_iobuf, amt, uio);
+		}
+		if (result == 0) {
+			membar_store_store();
+			emu_wreg(sc, REG_HANDLE, ev->ev_handle);
+			emu_wreg(sc, REG_IOLEN, amt);
+			emu_wreg(sc, REG_OFFSET, pos);
+			emu_wreg(sc, REG_OPER, EMU_OP_WRITE);
+			result = emu_waitdone(sc);
+		}
+
+		/* Keep the cached size right: extend it, or forget it */
+		if (result) {
+			ev->ev_sizevalid = false;
+		}
+		else if (ev->ev_sizevalid && pos + amt > ev->ev_size) {
+			ev->ev_size = pos + amt;
+		}
+		lock_release(sc->e_lock);
+
+		if (stage != NULL) {
+			emu_stage_put(sc, stage);
+		}
+		if (result) {
+			break;
+		}
+	}
+
+	return result;
+}
+#endif
 
 /*
  * Get the file size associated with a hardware-level file handle.
@@ -365,8 +551,16 @@ int
 emu_getsize(struct emu_softc *sc, uint32_t handle, off_t *retval)
 {
 	int result;
+#if OPT_SHELL
+	bool mine;
 
+	mine = lock_do_i_hold(sc->e_lock);
+	if (!mine) {
+		lock_acquire(sc->e_lock);
+	}
+#else
 	lock_acquire(sc->e_lock);
+#endif
 
 	emu_wreg(sc, REG_HANDLE, handle);
 	emu_wreg(sc, REG_OPER, EMU_OP_GETSIZE);
@@ -375,7 +569,13 @@ emu_getsize(struct emu_softc *sc, uint32_t handle, off_t *retval)
 		*retval = emu_rreg(sc, REG_IOLEN);
 	}
 
+#if OPT_SHELL
+	if (!mine) {
+		lock_release(sc->e_lock);
+	}
+#else
 	lock_release(sc->e_lock);
+#endif
 	return result;
 }
 
@@ -387,17 +587,33 @@ int
 emu_trunc(struct emu_softc *sc, uint32_t handle, off_t len)
 {
 	int result;
+#if OPT_SHELL
+	bool mine;
+#endif
 
 	KASSERT(len >= 0);
 
+#if OPT_SHELL
+	mine = lock_do_i_hold(sc->e_lock);
+	if (!mine) {
+		lock_acquire(sc->e_lock);
+	}
+#else
 	lock_acquire(sc->e_lock);
+#endif
 
 	emu_wreg(sc, REG_HANDLE, handle);
 	emu_wreg(sc, REG_IOLEN, len);
 	emu_wreg(sc, REG_OPER, EMU_OP_TRUNC);
 	result = emu_waitdone(sc);
 
+#if OPT_SHELL
+	if (!mine) {
+		lock_release(sc->e_lock);
+	}
+#else
 	lock_release(sc->e_lock);
+#endif
 	return result;
 }
 
@@ -473,22 +689,19 @@ emufs_reclaim(struct vnode *v)
 	int result;
 
 	/*
-	 * Need all of these locks, e_lock to protect the device,
-	 * vfs_biglock to protect the fs-related material, and
-	 * vn_countlock for the reference count.
+	 * Need both of these locks, e_lock to protect the device and
+	 * the vnode table, and vn_countlock for the reference count.
+	 * The vnode table belongs to this one device, so there's no
+	 * need for the big VFS lock: other filesystems carry on.
 	 */
 
-	vfs_biglock_acquire();
 	lock_acquire(ef->ef_emu->e_lock);
 	spinlock_acquire(&ev->ev_v.vn_countlock);
 
-	if (ev->ev_v.vn_refcount > 1) {
-		/* consume the reference VOP_DECREF passed us */
-		ev->ev_v.vn_refcount--;
-
+	if (vnode_dropref_unless_last(&ev->ev_v)) {
+		/* consumed the reference VOP_DECREF passed us */
 		spinlock_release(&ev->ev_v.vn_countlock);
 		lock_release(ef->ef_emu->e_lock);
-		vfs_biglock_release();
 		return EBUSY;
 	}
 	KASSERT(ev->ev_v.vn_refcount == 1);
@@ -503,7 +716,6 @@ emufs_reclaim(struct vnode *v)
 	result = emu_close(ev->ev_emu, ev->ev_handle);
 	if (result) {
 		lock_release(ef->ef_emu->e_lock);
-		vfs_biglock_release();
 		return result;
 	}
 
@@ -527,7 +739,6 @@ emufs_reclaim(struct vnode *v)
 	vnode_cleanup(&ev->ev_v);
 
 	lock_release(ef->ef_emu->e_lock);
-	vfs_biglock_release();
 
 	kfree(ev);
 	return 0;
@@ -541,6 +752,9 @@ int
 emufs_read(struct vnode *v, struct uio *uio)
 {
 	struct emufs_vnode *ev = v->vn_data;
+#if OPT_SHELL
+	return emu_readall(ev->ev_emu, ev->ev_handle, uio);
+#else
 	uint32_t amt;
 	size_t oldresid;
 	int result;
@@ -567,6 +781,7 @@ emufs_read(struct vnode *v, struct uio *uio)
 	}
 
 	return 0;
+#endif
 }
 
 /*
@@ -589,6 +804,55 @@ emufs_getdirentry(struct vnode *v, struct uio *uio)
 	return emu_readdir(ev->ev_emu, ev->ev_handle, amt, uio);
 }
 
+/*
+ * VOP_GETDIRENTS
+ *
+ * The device hands out one name per operation, so this saves system
+ * calls rather than device operations. The offset is the device's.
+ */
+static
+int
+emufs_getdirents(struct vnode *v, struct uio *uio)
+{
+	struct emufs_vnode *ev = v->vn_data;
+	char name[NAME_MAX+1];
+	struct iovec iov;
+	struct uio kuio;
+	off_t pos;
+	bool any;
+	int result;
+
+	KASSERT(uio->uio_rw==UIO_READ);
+
+	pos = uio->uio_offset;
+	any = false;
+	while (1) {
+		uio_kinit(&iov, &kuio, name, NAME_MAX, pos, UIO_READ);
+		result = emu_readdir(ev->ev_emu, ev->ev_handle, NAME_MAX,
+				     &kuio);
+		if (result || kuio.uio_resid == NAME_MAX) {
+			/* error, or nothing read - EOF */
+			break;
+		}
+		name[NAME_MAX - kuio.uio_resid] = 0;
+
+		/* If it doesn't fit, it's read again next time */
+		result = vnode_putdirent(uio, 0, DT_UNKNOWN, name);
+		if (result == ENOSPC) {
+			result = any ? 0 : EINVAL;
+			break;
+		}
+		if (result) {
+			break;
+		}
+		any = true;
+		pos = kuio.uio_offset;
+	}
+
+	uio->uio_offset = pos;
+	return result;
+}
+
 /*
  * VOP_WRITE
  */
@@ -597,6 +861,9 @@ int
 emufs_write(struct vnode *v, struct uio *uio)
 {
 	struct emufs_vnode *ev = v->vn_data;
+#if OPT_SHELL
+	return emu_writeall(ev, uio);
+#else
 	uint32_t amt;
 	size_t oldresid;
 	int result;
@@ -623,6 +890,7 @@ emufs_write(struct vnode *v, struct uio *uio)
 	}
 
 	return 0;
+#endif
 }
 
 /*
@@ -643,6 +911,33 @@ emufs_ioctl(struct vnode *v, int op, userptr_t data)
 	return EINVAL;
 }
 
+#if OPT_SHELL
+/*
+ * Get the size of a file, from the cache if we have it.
+ */
+static
+int
+emufs_getsize(struct emufs_vnode *ev, off_t *retval)
+{
+	struct emu_softc *sc = ev->ev_emu;
+	int result = 0;
+
+	lock_acquire(sc->e_lock);
+	if (ev->ev_sizevalid) {
+		*retval = ev->ev_size;
+	}
+	else {
+		result = emu_getsize(sc, ev->ev_handle, retval);
+		if (result == 0 && !ev->ev_isdir) {
+			ev->ev_size = *retval;
+			ev->ev_sizevalid = true;
+		}
+	}
+	lock_release(sc->e_lock);
+	return result;
+}
+#endif
+
 /*
  * VOP_STAT
  */
@@ -655,7 +950,11 @@ emufs_stat(struct vnode *v, struct stat *statbuf)
 
 	bzero(statbuf, sizeof(struct stat));
 
+#if OPT_SHELL
+	result = emufs_getsize(ev, &statbuf->st_size);
+#else
 	result = emu_getsize(ev->ev_emu, ev->ev_handle, &statbuf->st_size);
+#endif
 	if (result) {
 		return result;
 	}
@@ -667,6 +966,7 @@ emufs_stat(struct vnode *v, struct stat *statbuf)
 	statbuf->st_mode |= 0644; /* possibly a lie */
 	statbuf->st_nlink = 1;    /* might be a lie, but doesn't matter much */
 	statbuf->st_blocks = 0;   /* almost certainly a lie */
+	statbuf->st_blksize = EMU_MAXIO;
 
 	return 0;
 }
@@ -725,7 +1025,19 @@ int
 emufs_truncate(struct vnode *v, off_t len)
 {
 	struct emufs_vnode *ev = v->vn_data;
+#if OPT_SHELL
+	struct emu_softc *sc = ev->ev_emu;
+	int result;
+
+	lock_acquire(sc->e_lock);
+	result = emu_trunc(sc, ev->ev_handle, len);
+	ev->ev_size = len;
+	ev->ev_sizevalid = (result == 0);
+	lock_release(sc->e_lock);
+	return result;
+#else
 	return emu_trunc(ev->ev_emu, ev->ev_handle, len);
+#endif
 }
 
 /*
@@ -851,7 +1163,7 @@ int
 emufs_mmap(struct vnode *v)
 {
 	(void)v;
-	return ENOSYS;
+	return 0;
 }
 
 //////////////////////////////
@@ -1081,6 +1393,7 @@ static const struct vnode_ops emufs_fileops = {
 	.vop_read = emufs_read,
 	.vop_readlink = emufs_readlink_notlink,
 	.vop_getdirentry = emufs_uio_op_notdir,
+	.vop_getdirents = emufs_uio_op_notdir,
 	.vop_write = emufs_write,
 	.vop_ioctl = emufs_ioctl,
 	.vop_stat = emufs_stat,
@@ -1089,6 +1402,10 @@ static const struct vnode_ops emufs_fileops = {
 	.vop_fsync = emufs_fsync,
 	.vop_mmap = emufs_mmap,
 	.vop_truncate = emufs_truncate,
+	.vop_punch = vopfail_punch_nosys,
+	.vop_poll = vnode_poll_ready,
+	.vop_prefetch = vnode_prefetch_none,
+	.vop_dontneed = vnode_dontneed_none,
 	.vop_namefile = emufs_uio_op_notdir,
 
 	.vop_creat = emufs_creat_notdir,
@@ -1115,6 +1432,7 @@ static const struct vnode_ops emufs_dirops = {
 	.vop_read = emufs_uio_op_isdir,
 	.vop_readlink = emufs_uio_op_isdir,
 	.vop_getdirentry = emufs_getdirentry,
+	.vop_getdirents = emufs_getdirents,
 	.vop_write = emufs_uio_op_isdir,
 	.vop_ioctl = emufs_ioctl,
 	.vop_stat = emufs_stat,
@@ -1123,6 +1441,10 @@ static const struct vnode_ops emufs_dirops = {
 	.vop_fsync = emufs_void_op_isdir,
 	.vop_mmap = emufs_void_op_isdir,
 	.vop_truncate = emufs_truncate_isdir,
+	.vop_punch = vopfail_punch_isdir,
+	.vop_poll = vnode_poll_ready,
+	.vop_prefetch = vnode_prefetch_none,
+	.vop_dontneed = vnode_dontneed_none,
 	.vop_namefile = emufs_namefile,
 
 	.vop_creat = emufs_creat,
@@ -1150,7 +1472,7 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 	unsigned i, num;
 	int result;
 
-	vfs_biglock_acquire();
+	/* The vnode table is protected by the device's e_lock */
 	lock_acquire(ef->ef_emu->e_lock);
 
 	num = vnodearray_num(ef->ef_vnodes);
@@ -1163,7 +1485,6 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 			VOP_INCREF(&ev->ev_v);
 
 			lock_release(ef->ef_emu->e_lock);
-			vfs_biglock_release();
 			*ret = ev;
 			return 0;
 		}
@@ -1179,12 +1500,16 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 
 	ev->ev_emu = ef->ef_emu;
 	ev->ev_handle = handle;
+#if OPT_SHELL
+	ev->ev_isdir = isdir;
+	ev->ev_sizevalid = false;
+	ev->ev_size = 0;
+#endif
 
 	result = vnode_init(&ev->ev_v, isdir ? &emufs_dirops : &emufs_fileops,
 			    &ef->ef_fs, ev);
 	if (result) {
 		lock_release(ef->ef_emu->e_lock);
-		vfs_biglock_release();
 		kfree(ev);
 		return result;
 	}
@@ -1194,13 +1519,11 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 		/* note: vnode_cleanup undoes vnode_init - it does not kfree */
 		vnode_cleanup(&ev->ev_v);
 		lock_release(ef->ef_emu->e_lock);
-		vfs_biglock_release();
 		kfree(ev);
 		return result;
 	}
 
 	lock_release(ef->ef_emu->e_lock);
-	vfs_biglock_release();
 
 	*ret = ev;
 	return 0;
@@ -1351,6 +1674,20 @@ config_emu(struct emu_softc *sc, int emuno)
 	}
 	sc->e_iobuf = bus_map_area(sc->e_busdata, sc->e_buspos, EMU_BUFFER);
 
+#if OPT_SHELL
+	spinlock_init(&sc->e_stagelock);
+	sc->e_stagesem = sem_create("emufs-stage", EMU_NSTAGE);
+	if (sc->e_stagesem == NULL) {
+		return ENOMEM;
+	}
+	for (unsigned i = 0; i < EMU_NSTAGE; i++) {
+		sc->e_stage[i] = kmalloc(EMU_MAXIO);
+		if (sc->e_stage[i] == NULL) {
+			return ENOMEM;
+		}
+	}
+#endif
+
 	snprintf(name, sizeof(name), "emu%d", emuno);
 
 	return emufs_addtovfs(sc, name);
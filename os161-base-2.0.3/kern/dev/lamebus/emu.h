@@ -31,8 +31,11 @@
 #define _LAMEBUS_EMU_H_
 
 
+#include <spinlock.h>
+
 #define EMU_MAXIO       16384
 #define EMU_ROOTHANDLE  0
+#define EMU_NSTAGE      4	/* staging buffers for user transfers */
 
 /*
  * The per-device data used by the emufs device driver.
@@ -51,6 +54,12 @@ struct emu_softc {
 	struct semaphore *e_sem;
 	void *e_iobuf;
 
+	/* Staging buffers, for moving data to and from user memory
+	 * without holding the device (OPT_SHELL) */
+	struct spinlock e_stagelock;
+	struct semaphore *e_stagesem;	/* counts the free ones */
+	void *e_stage[EMU_NSTAGE];	/* NULL while in use */
+
 	/* Written by the interrupt handler */
 	uint32_t e_result;
 };
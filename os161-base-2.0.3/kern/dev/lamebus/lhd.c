@@ -37,6 +37,7 @@
 #include <uio.h>
 #include <membar.h>
 #include <synch.h>
+#include <wchan.h>
 #include <platform/bus.h>
 #include <vfs.h>
 #include <lamebus/lhd.h>
@@ -60,6 +61,16 @@
 /* Buffer (offset within slot)  */
 #define LHD_BUFFER      32768
 
+#if OPT_SHELL
+/*
+ * A request is normally started in C-SCAN order: the nearest one at
+ * or past the head going up, wrapping around to the lowest sector.
+ * Once more than this many requests have been submitted after the
+ * oldest waiting one, it goes next regardless, so none can starve.
+ */
+#define LHD_MAXPASS     32
+#endif
+
 /*
  * Shortcut for reading a register.
  */
@@ -95,6 +106,160 @@ int lhd_code_to_errno(struct lhd_softc *lh, int code)
 	return EAGAIN;
 }
 
+#if OPT_SHELL
+/*
+ * Start the operation for the current sector of the current request.
+ * Called with lh_lock held.
+ */
+static
+void
+lhd_startsect(struct lhd_softc *lh)
+{
+	struct devreq *req = lh->lh_cur;
+	uint32_t statval = LHD_WORKING;
+	int result;
+
+	if (req->dr_uio->uio_rw == UIO_WRITE) {
+		result = uiomove(lh->lh_buf, LHD_SECTSIZE, req->dr_uio);
+		KASSERT(result == 0);
+		membar_store_store();
+		statval |= LHD_ISWRITE;
+	}
+	lhd_wreg(lh, LHD_REG_SECT, lh->lh_cursect);
+	lhd_wreg(lh, LHD_REG_STAT, statval);
+}
+
+/*
+ * Take the next request to do off the queue. Called with lh_lock held
+ * and the queue not empty.
+ */
+static
+struct devreq *
+lhd_pick(struct lhd_softc *lh)
+{
+	struct devreq *req, *prev, *pick, *pickprev, *low, *lowprev;
+
+	pick = pickprev = NULL;
+	if (lh->lh_seq - lh->lh_queue->dr_seq > LHD_MAXPASS) {
+		/* The oldest one has waited long enough */
+		pick = lh->lh_queue;
+	}
+	else {
+		low = lowprev = NULL;
+		for (prev = NULL, req = lh->lh_queue; req != NULL;
+		     prev = req, req = req->dr_next) {
+			if (low == NULL || req->dr_block < low->dr_block) {
+				low = req;
+				lowprev = prev;
+			}
+			if (req->dr_block >= lh->lh_headpos &&
+			    (pick == NULL || req->dr_block < pick->dr_block)) {
+				pick = req;
+				pickprev = prev;
+			}
+		}
+		if (pick == NULL) {
+			/* Nothing further up; go back to the start */
+			pick = low;
+			pickprev = lowprev;
+		}
+	}
+
+	if (pickprev == NULL) {
+		lh->lh_queue = pick->dr_next;
+	}
+	else {
+		pickprev->dr_next = pick->dr_next;
+	}
+	if (lh->lh_qtail == pick) {
+		lh->lh_qtail = pickprev;
+	}
+	pick->dr_next = NULL;
+	return pick;
+}
+
+/*
+ * If the disk is idle and there is something queued, start it.
+ * Called with lh_lock held.
+ */
+static
+void
+lhd_kick(struct lhd_softc *lh)
+{
+	if (lh->lh_cur != NULL || lh->lh_queue == NULL) {
+		return;
+	}
+	lh->lh_cur = lhd_pick(lh);
+	lh->lh_cursect = lh->lh_cur->dr_block;
+	lhd_startsect(lh);
+}
+
+/*
+ * The operation on the current sector has finished with result ERR.
+ * Move on to the next sector, or return the request if it is done.
+ * Called with lh_lock held.
+ */
+static
+struct devreq *
+lhd_sectdone(struct lhd_softc *lh, int err)
+{
+	struct devreq *req = lh->lh_cur;
+
+	if (req == NULL) {
+		/* Left over from before we were configured */
+		return NULL;
+	}
+	if (err == 0 && req->dr_uio->uio_rw == UIO_READ) {
+		membar_load_load();
+		err = uiomove(lh->lh_buf, LHD_SECTSIZE, req->dr_uio);
+		KASSERT(err == 0);
+	}
+	lh->lh_headpos = lh->lh_cursect++;
+	if (err == 0 && lh->lh_cursect < req->dr_block + req->dr_nblocks) {
+		lhd_startsect(lh);
+		return NULL;
+	}
+	req->dr_result = err;
+	lh->lh_cur = NULL;
+	return req;
+}
+
+/*
+ * Interrupt handler for lhd.
+ * Read the status register; if an operation finished, clear the status
+ * register, go on with the current request or start the next one, and
+ * report completion of any request that is now done.
+ */
+void
+lhd_irq(void *vlh)
+{
+	struct lhd_softc *lh = vlh;
+	struct devreq *done;
+	uint32_t val;
+
+	val = lhd_rdreg(lh, LHD_REG_STAT);
+
+	switch (val & LHD_STATEMASK) {
+	    case LHD_IDLE:
+	    case LHD_WORKING:
+		break;
+	    case LHD_OK:
+	    case LHD_INVSECT:
+	    case LHD_MEDIA:
+		lhd_wreg(lh, LHD_REG_STAT, 0);
+		spinlock_acquire(&lh->lh_lock);
+		done = lhd_sectdone(lh, lhd_code_to_errno(lh, val));
+		lhd_kick(lh);
+		spinlock_release(&lh->lh_lock);
+		if (done != NULL) {
+			done->dr_done(done);
+		}
+		break;
+	}
+}
+
+#else /* !OPT_SHELL */
+
 /*
  * Record that an I/O has completed: save the result and poke the
  * completion semaphore.
@@ -133,6 +298,8 @@ lhd_irq(void *vlh)
 	}
 }
 
+#endif /* OPT_SHELL */
+
 /*
  * Function called when we are open()'d.
  */
@@ -179,8 +346,160 @@ lhd_reset(struct lhd_softc *lh)
 }
 #endif
 
+#if OPT_SHELL
+/*
+ * Queue an asynchronous transfer.
+ */
+static
+int
+lhd_submit(struct device *d, struct devreq *req)
+{
+	struct lhd_softc *lh = d->d_data;
+	struct uio *uio = req->dr_uio;
+
+	KASSERT(uio->uio_segflg == UIO_SYSSPACE);
+
+	/* Don't allow I/O that isn't sector-aligned, or past the end. */
+	if (uio->uio_offset < 0 || uio->uio_offset % LHD_SECTSIZE != 0 ||
+	    uio->uio_resid % LHD_SECTSIZE != 0) {
+		return EINVAL;
+	}
+	if (uio->uio_offset / LHD_SECTSIZE > lh->lh_dev.d_blocks) {
+		return EINVAL;
+	}
+	req->dr_block = uio->uio_offset / LHD_SECTSIZE;
+	req->dr_nblocks = uio->uio_resid / LHD_SECTSIZE;
+	if (req->dr_nblocks > lh->lh_dev.d_blocks - req->dr_block) {
+		return EINVAL;
+	}
+
+	if (req->dr_nblocks == 0) {
+		req->dr_result = 0;
+		req->dr_done(req);
+		return 0;
+	}
+
+	spinlock_acquire(&lh->lh_lock);
+	req->dr_seq = lh->lh_seq++;
+	req->dr_next = NULL;
+	if (lh->lh_qtail == NULL) {
+		lh->lh_queue = req;
+	}
+	else {
+		lh->lh_qtail->dr_next = req;
+	}
+	lh->lh_qtail = req;
+	lhd_kick(lh);
+	spinlock_release(&lh->lh_lock);
+	return 0;
+}
+
+/*
+ * A synchronous transfer, and the completion callback for it.
+ */
+struct lhd_sync {
+	struct devreq ls_req;
+	struct lhd_softc *ls_lh;
+	bool ls_done;
+};
+
+static
+void
+lhd_syncdone(struct devreq *req)
+{
+	struct lhd_sync *ls = req->dr_data;
+	struct lhd_softc *lh = ls->ls_lh;
+
+	spinlock_acquire(&lh->lh_lock);
+	ls->ls_done = true;
+	wchan_wakeall(lh->lh_wchan, &lh->lh_lock);
+	spinlock_release(&lh->lh_lock);
+}
+
+static
+int
+lhd_syncio(struct lhd_softc *lh, struct uio *uio)
+{
+	struct lhd_sync ls;
+	int result;
+
+	ls.ls_req.dr_uio = uio;
+	ls.ls_req.dr_done = lhd_syncdone;
+	ls.ls_req.dr_data = &ls;
+	ls.ls_lh = lh;
+	ls.ls_done = false;
+
+	result = lhd_submit(&lh->lh_dev, &ls.ls_req);
+	if (result) {
+		return result;
+	}
+	spinlock_acquire(&lh->lh_lock);
+	while (!ls.ls_done) {
+		wchan_sleep(lh->lh_wchan, &lh->lh_lock);
+	}
+	spinlock_release(&lh->lh_lock);
+	return ls.ls_req.dr_result;
+}
+
+/*
+ * I/O function (for both reads and writes)
+ *
+ * This goes through the request queue and waits for it. Kernel
+ * buffers are handed down as they are; user buffers go through a
+ * bounce buffer a sector at a time, since the transfer itself runs
+ * in the interrupt handler.
+ */
+static
+int
+lhd_io(struct device *d, struct uio *uio)
+{
+	struct lhd_softc *lh = d->d_data;
+	char buf[LHD_SECTSIZE];
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	if (uio->uio_segflg == UIO_SYSSPACE) {
+		return lhd_syncio(lh, uio);
+	}
+
+	if (uio->uio_offset % LHD_SECTSIZE != 0 ||
+	    uio->uio_resid % LHD_SECTSIZE != 0) {
+		return EINVAL;
+	}
+	while (uio->uio_resid > 0) {
+		uio_kinit(&iov, &ku, buf, LHD_SECTSIZE, uio->uio_offset,
+			  uio->uio_rw);
+		if (uio->uio_rw == UIO_WRITE) {
+			result = uiomove(buf, LHD_SECTSIZE, uio);
+			if (result) {
+				return result;
+			}
+		}
+		result = lhd_syncio(lh, &ku);
+		if (result) {
+			return result;
+		}
+		if (uio->uio_rw == UIO_READ) {
+			result = uiomove(buf, LHD_SECTSIZE, uio);
+			if (result) {
+				return result;
+			}
+		}
+	}
+	return 0;
+}
+
+#else /* !OPT_SHELL */
+
 /*
  * I/O function (for both reads and writes)
+ *
+ * The on-card buffer holds one sector, so each sector is still its
+ * own operation and interrupt. But a request for several sectors
+ * (SFS hands down whole runs of blocks) keeps the device for all of
+ * them, rather than competing for it again sector by sector, so it
+ * goes to the disk as one unbroken transfer.
  */
 static
 int
@@ -194,7 +513,7 @@ lhd_io(struct device *d, struct uio *uio)
 	uint32_t lenoff = uio->uio_resid % LHD_SECTSIZE;
 	uint32_t i;
 	uint32_t statval = LHD_WORKING;
-	int result;
+	int result = 0;
 
 	/* Don't allow I/O that isn't sector-aligned. */
 	if (sectoff != 0 || lenoff != 0) {
@@ -202,8 +521,8 @@ lhd_io(struct device *d, struct uio *uio)
 	}
 
 	/* Don't allow I/O past the end of the disk. */
-	/* XXX this check can overflow */
-	if (sector+len > lh->lh_dev.d_blocks) {
+	if (sector > lh->lh_dev.d_blocks ||
+	    len > lh->lh_dev.d_blocks - sector) {
 		return EINVAL;
 	}
 
@@ -212,11 +531,11 @@ lhd_io(struct device *d, struct uio *uio)
 		statval |= LHD_ISWRITE;
 	}
 
-	/* Loop over all the sectors we were asked to do. */
-	for (i=0; i<len; i++) {
+	/* Wait until nobody else is using the device. */
+	P(lh->lh_clear);
 
-		/* Wait until nobody else is using the device. */
-		P(lh->lh_clear);
+	/* Loop over all the sectors we were asked to do. */
+	for (i=0; i<len && result == 0; i++) {
 
 		/*
 		 * Are we writing? If so, transfer the data to the
@@ -226,8 +545,7 @@ lhd_io(struct device *d, struct uio *uio)
 			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
 			membar_store_store();
 			if (result) {
-				V(lh->lh_clear);
-				return result;
+				break;
 			}
 		}
 
@@ -251,23 +569,23 @@ lhd_io(struct device *d, struct uio *uio)
 			membar_load_load();
 			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
 		}
-
-		/* Tell another thread it's cleared to go ahead. */
-		V(lh->lh_clear);
-
-		/* If we failed, return the error. */
-		if (result) {
-			return result;
-		}
 	}
 
-	return 0;
+	/* Tell another thread it's cleared to go ahead. */
+	V(lh->lh_clear);
+
+	return result;
 }
 
+#endif /* OPT_SHELL */
+
 static const struct device_ops lhd_devops = {
 	.devop_eachopen = lhd_eachopen,
 	.devop_io = lhd_io,
 	.devop_ioctl = lhd_ioctl,
+#if OPT_SHELL
+	.devop_submit = lhd_submit,
+#endif
 };
 
 /*
@@ -284,6 +602,17 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 	/* Get a pointer to the on-chip buffer. */
 	lh->lh_buf = bus_map_area(lh->lh_busdata, lh->lh_buspos, LHD_BUFFER);
 
+#if OPT_SHELL
+	/* Set up the request queue. */
+	spinlock_init(&lh->lh_lock);
+	lh->lh_queue = lh->lh_qtail = lh->lh_cur = NULL;
+	lh->lh_cursect = lh->lh_headpos = 0;
+	lh->lh_seq = 0;
+	lh->lh_wchan = wchan_create(name);
+	if (lh->lh_wchan == NULL) {
+		return ENOMEM;
+	}
+#else
 	/* Create the semaphores. */
 	lh->lh_clear = sem_create("lhd-clear", 1);
 	if (lh->lh_clear == NULL) {
@@ -295,6 +624,7 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 		lh->lh_clear = NULL;
 		return ENOMEM;
 	}
+#endif
 
 	/* Set up the VFS device structure. */
 	lh->lh_dev.d_ops = &lhd_devops;
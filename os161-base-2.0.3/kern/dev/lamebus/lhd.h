@@ -31,6 +31,7 @@
 #define _LAMEBUS_LHD_H_
 
 #include <device.h>
+#include <spinlock.h>
 
 /*
  * Our sector size
@@ -51,9 +52,25 @@ struct lhd_softc {
 	 */
 
 	void *lh_buf;			/* Pointer to on-card I/O buffer */
+#if OPT_SHELL
+	/*
+	 * Request queue. Requests wait in lh_queue in submission order
+	 * and are started one at a time, C-SCAN order, from the interrupt
+	 * handler as the previous one finishes.
+	 */
+	struct spinlock lh_lock;	/* Protects the queue */
+	struct devreq *lh_queue;	/* Waiting requests, oldest first */
+	struct devreq *lh_qtail;
+	struct devreq *lh_cur;		/* Request being transferred */
+	uint32_t lh_cursect;		/* ...and its sector in progress */
+	uint32_t lh_headpos;		/* Last sector transferred */
+	unsigned lh_seq;		/* Requests submitted so far */
+	struct wchan *lh_wchan;		/* Synchronous callers wait here */
+#else
 	int lh_result;			/* Result from I/O operation */
 	struct semaphore *lh_clear;	/* Synchronization */
 	struct semaphore *lh_done;
+#endif
 
 	struct device lh_dev;		/* VFS device structure */
 };
@@ -27,20 +27,462 @@
  * SUCH DAMAGE.
  */
 
+/*
+ * LAMEbus network card (lnet) driver.
+ */
+
 #include <types.h>
 #include <kern/errno.h>
+#include <endian.h>
 #include <lib.h>
-/*#include <lamebus/lnet.h>*/ /* not yet */
+#include <spinlock.h>
+#include <wchan.h>
+#include <platform/bus.h>
+#include <lamebus/lnet.h>
 #include "autoconf.h"
 
+/* Registers (offsets within slot) */
+#define LNET_REG_RIRQ   0   /* Receive interrupt */
+#define LNET_REG_TIRQ   4   /* Transmit interrupt */
+#define LNET_REG_CTL    8   /* Control */
+#define LNET_REG_STAT   12  /* Status; low 16 bits are our address */
+
+/* Interrupt register bits */
+#define LNET_IRQ_DONE   0x1 /* Frame received or sent */
+#define LNET_IRQ_ZAP    0x2 /* Frame lost or garbled */
+
+/* Control register bits */
+#define LNET_CTL_PROMISC 0x1 /* Receive frames for anyone */
+#define LNET_CTL_START   0x2 /* Send the transmit buffer */
+
+/* Buffer offsets (within slot) */
+#define LNET_RXBUF      32768
+#define LNET_TXBUF      (LNET_RXBUF + LNET_BUFSIZE)
+
+#define LNET_HDRSIZE    sizeof(struct lnet_linkheader)
+#define LNET_MAXDATA    (LNET_BUFSIZE - LNET_HDRSIZE)
+
+/*
+ * nb_slot numbers receive slots first, then transmit slots.
+ */
+#define LNET_TXSLOT(n)  (LNET_RXSLOTS + (n))
+#define LNET_ISTX(slot) ((slot) >= LNET_RXSLOTS)
+
+/*
+ * Shorthand for register access.
+ */
+static
+uint32_t
+lnet_rdreg(struct lnet_softc *ln, uint32_t reg)
+{
+	return bus_read_register(ln->ln_busdata, ln->ln_buspos, reg);
+}
+
+static
+void
+lnet_wrreg(struct lnet_softc *ln, uint32_t reg, uint32_t val)
+{
+	bus_write_register(ln->ln_busdata, ln->ln_buspos, reg, val);
+}
+
+/*
+ * Copy the frame in the card's receive buffer into the next ring
+ * slot, if there's room and it looks sane. Called from the interrupt
+ * handler; the card can't take another frame until we're done.
+ */
+static
+void
+lnet_rxframe(struct lnet_softc *ln)
+{
+	const struct lnet_linkheader *lh = ln->ln_rxbuf;
+	struct lnet_desc *ld;
+	size_t len;
+
+	KASSERT(spinlock_do_i_hold(&ln->ln_lock));
+
+	len = ntohs(lh->lh_packetlen);
+	if (ntohl(lh->lh_frame) != LNET_FRAME_MAGIC ||
+	    len < LNET_HDRSIZE || len > LNET_BUFSIZE) {
+		ln->ln_rxbad++;
+		return;
+	}
+
+	ld = &ln->ln_rx[ln->ln_rxhead];
+	if (ld->ld_state != LNET_DESC_FREE) {
+		/* Ring full, or its oldest buffer is still lent out */
+		ln->ln_rxdropped++;
+		return;
+	}
+
+	memcpy(ld->ld_buf, ln->ln_rxbuf, len);
+	ld->ld_len = len;
+	ld->ld_state = LNET_DESC_FULL;
+	ln->ln_rxhead = (ln->ln_rxhead + 1) % LNET_RXSLOTS;
+	ln->ln_rxready++;
+	ln->ln_rxframes++;
+}
+
+/*
+ * If the card is idle, hand it the next queued transmit slot.
+ * Slots released without being sent are recycled on the way.
+ */
+static
+void
+lnet_txstart(struct lnet_softc *ln)
+{
+	struct lnet_desc *ld;
+
+	KASSERT(spinlock_do_i_hold(&ln->ln_lock));
+
+	while (!ln->ln_txbusy) {
+		ld = &ln->ln_tx[ln->ln_txhead];
+		if (ld->ld_state != LNET_DESC_FULL) {
+			return;
+		}
+		if (ld->ld_len == 0) {
+			/* Abandoned by net_release */
+			ld->ld_state = LNET_DESC_FREE;
+			ln->ln_txhead = (ln->ln_txhead + 1) % LNET_TXSLOTS;
+			wchan_wakeone(ln->ln_txwchan, &ln->ln_lock);
+			continue;
+		}
+		memcpy(ln->ln_txbuf, ld->ld_buf, ld->ld_len);
+		ln->ln_txbusy = true;
+		lnet_wrreg(ln, LNET_REG_CTL, LNET_CTL_START);
+	}
+}
+
+/*
+ * Interrupt handler. Receive and transmit completions are both
+ * looked at on every interrupt, so one interrupt can retire both.
+ */
+void
+lnet_irq(void *vln)
+{
+	struct lnet_softc *ln = vln;
+	uint32_t rirq, tirq;
+	bool rxwasempty;
+
+	spinlock_acquire(&ln->ln_lock);
+
+	rirq = lnet_rdreg(ln, LNET_REG_RIRQ);
+	tirq = lnet_rdreg(ln, LNET_REG_TIRQ);
+
+	if (!ln->ln_ready) {
+		/* Not configured yet; drop whatever it is */
+		if (rirq != 0) {
+			lnet_wrreg(ln, LNET_REG_RIRQ, 0);
+		}
+		if (tirq != 0) {
+			lnet_wrreg(ln, LNET_REG_TIRQ, 0);
+		}
+		spinlock_release(&ln->ln_lock);
+		return;
+	}
+
+	rxwasempty = ln->ln_rxready == 0;
+
+	if (rirq != 0) {
+		if (rirq & LNET_IRQ_ZAP) {
+			ln->ln_rxbad++;
+		}
+		else {
+			lnet_rxframe(ln);
+		}
+		/* Free the card for the next frame */
+		lnet_wrreg(ln, LNET_REG_RIRQ, 0);
+	}
+
+	if (tirq != 0) {
+		lnet_wrreg(ln, LNET_REG_TIRQ, 0);
+		if (ln->ln_txbusy) {
+			if (tirq & LNET_IRQ_DONE) {
+				ln->ln_txframes++;
+			}
+			ln->ln_tx[ln->ln_txhead].ld_state = LNET_DESC_FREE;
+			ln->ln_txhead = (ln->ln_txhead + 1) % LNET_TXSLOTS;
+			ln->ln_txbusy = false;
+			wchan_wakeone(ln->ln_txwchan, &ln->ln_lock);
+			lnet_txstart(ln);
+		}
+	}
+
+	/*
+	 * Receivers only sleep when the ring is empty and take
+	 * everything that's ready before sleeping again, so only the
+	 * frame that makes the ring non-empty needs to wake anyone.
+	 */
+	if (rxwasempty && ln->ln_rxready > 0) {
+		wchan_wakeall(ln->ln_rxwchan, &ln->ln_lock);
+	}
+
+	spinlock_release(&ln->ln_lock);
+}
+
+/*
+ * Lend out the next free transmit slot.
+ */
+static
 int
-config_lnet(struct lnet_softc *sc, int lnetno)
+lnet_getbuf(void *vln, struct netbuf *nb, bool wait)
 {
-	(void)sc;
+	struct lnet_softc *ln = vln;
+	struct lnet_desc *ld;
+	unsigned slot;
 
-	kprintf("lnet%d: No network support in system\n", lnetno);
+	spinlock_acquire(&ln->ln_lock);
+	while (ln->ln_tx[ln->ln_txlend].ld_state != LNET_DESC_FREE) {
+		if (!wait) {
+			spinlock_release(&ln->ln_lock);
+			return EAGAIN;
+		}
+		wchan_sleep(ln->ln_txwchan, &ln->ln_lock);
+	}
+	slot = ln->ln_txlend;
+	ld = &ln->ln_tx[slot];
+	ld->ld_state = LNET_DESC_LENT;
+	ln->ln_txlend = (slot + 1) % LNET_TXSLOTS;
+	spinlock_release(&ln->ln_lock);
 
-	return ENODEV;
+	nb->nb_data = ld->ld_buf + LNET_HDRSIZE;
+	nb->nb_len = 0;
+	nb->nb_max = LNET_MAXDATA;
+	nb->nb_from = ln->ln_netif.ni_addr;
+	nb->nb_to = 0;
+	nb->nb_slot = LNET_TXSLOT(slot);
+	return 0;
 }
 
+/*
+ * Queue a lent transmit slot for sending.
+ */
+static
+int
+lnet_send(void *vln, struct netbuf *nb, uint16_t to, size_t len)
+{
+	struct lnet_softc *ln = vln;
+	struct lnet_linkheader *lh;
+	struct lnet_desc *ld;
+
+	KASSERT(LNET_ISTX(nb->nb_slot));
+	KASSERT(nb->nb_slot < LNET_TXSLOT(LNET_TXSLOTS));
+
+	if (len > LNET_MAXDATA) {
+		return EMSGSIZE;
+	}
+
+	/* The slot is ours until we mark it full */
+	ld = &ln->ln_tx[nb->nb_slot - LNET_RXSLOTS];
+	lh = (struct lnet_linkheader *)ld->ld_buf;
+	lh->lh_frame = htonl(LNET_FRAME_MAGIC);
+	lh->lh_from = htons(ln->ln_netif.ni_addr);
+	lh->lh_packetlen = htons(len + LNET_HDRSIZE);
+	lh->lh_to = htons(to);
+	lh->lh_unused = 0;
+
+	spinlock_acquire(&ln->ln_lock);
+	KASSERT(ld->ld_state == LNET_DESC_LENT);
+	ld->ld_len = len + LNET_HDRSIZE;
+	ld->ld_to = to;
+	ld->ld_state = LNET_DESC_FULL;
+	lnet_txstart(ln);
+	spinlock_release(&ln->ln_lock);
+
+	return 0;
+}
+
+/*
+ * Lend out the oldest received frame.
+ */
+static
+int
+lnet_recv(void *vln, struct netbuf *nb, bool wait)
+{
+	struct lnet_softc *ln = vln;
+	const struct lnet_linkheader *lh;
+	struct lnet_desc *ld;
+	unsigned slot;
+
+	spinlock_acquire(&ln->ln_lock);
+	while (ln->ln_rxready == 0) {
+		if (!wait) {
+			spinlock_release(&ln->ln_lock);
+			return EAGAIN;
+		}
+		wchan_sleep(ln->ln_rxwchan, &ln->ln_lock);
+	}
+	slot = ln->ln_rxlend;
+	ld = &ln->ln_rx[slot];
+	KASSERT(ld->ld_state == LNET_DESC_FULL);
+	ld->ld_state = LNET_DESC_LENT;
+	ln->ln_rxlend = (slot + 1) % LNET_RXSLOTS;
+	ln->ln_rxready--;
+	spinlock_release(&ln->ln_lock);
+
+	lh = (const struct lnet_linkheader *)ld->ld_buf;
+	nb->nb_data = ld->ld_buf + LNET_HDRSIZE;
+	nb->nb_len = ld->ld_len - LNET_HDRSIZE;
+	nb->nb_max = LNET_MAXDATA;
+	nb->nb_from = ntohs(lh->lh_from);
+	nb->nb_to = ntohs(lh->lh_to);
+	nb->nb_slot = slot;
+	return 0;
+}
+
+/*
+ * Take back a lent slot. A transmit slot is marked full but empty
+ * so lnet_txstart recycles it in its turn without breaking ring order.
+ */
+static
+void
+lnet_release(void *vln, struct netbuf *nb)
+{
+	struct lnet_softc *ln = vln;
+	struct lnet_desc *ld;
+
+	KASSERT(nb->nb_slot < LNET_TXSLOT(LNET_TXSLOTS));
+
+	spinlock_acquire(&ln->ln_lock);
+	if (LNET_ISTX(nb->nb_slot)) {
+		ld = &ln->ln_tx[nb->nb_slot - LNET_RXSLOTS];
+		KASSERT(ld->ld_state == LNET_DESC_LENT);
+		ld->ld_len = 0;
+		ld->ld_state = LNET_DESC_FULL;
+		lnet_txstart(ln);
+	}
+	else {
+		ld = &ln->ln_rx[nb->nb_slot];
+		KASSERT(ld->ld_state == LNET_DESC_LENT);
+		ld->ld_state = LNET_DESC_FREE;
+	}
+	spinlock_release(&ln->ln_lock);
+}
 
+static
+void
+lnet_stats(void *vln, struct netstats *ns)
+{
+	struct lnet_softc *ln = vln;
+
+	spinlock_acquire(&ln->ln_lock);
+	ns->ns_rxframes = ln->ln_rxframes;
+	ns->ns_rxdropped = ln->ln_rxdropped;
+	ns->ns_rxbad = ln->ln_rxbad;
+	ns->ns_txframes = ln->ln_txframes;
+	spinlock_release(&ln->ln_lock);
+}
+
+static const struct netif_ops lnet_netif_ops = {
+	.nio_getbuf = lnet_getbuf,
+	.nio_send = lnet_send,
+	.nio_recv = lnet_recv,
+	.nio_release = lnet_release,
+	.nio_stats = lnet_stats,
+};
+
+/*
+ * Free whatever config_lnet managed to allocate.
+ */
+static
+void
+lnet_cleanup(struct lnet_softc *ln)
+{
+	unsigned i;
+
+	for (i=0; i<LNET_RXSLOTS; i++) {
+		kfree(ln->ln_rx[i].ld_buf);
+		ln->ln_rx[i].ld_buf = NULL;
+	}
+	for (i=0; i<LNET_TXSLOTS; i++) {
+		kfree(ln->ln_tx[i].ld_buf);
+		ln->ln_tx[i].ld_buf = NULL;
+	}
+	if (ln->ln_rxwchan != NULL) {
+		wchan_destroy(ln->ln_rxwchan);
+		ln->ln_rxwchan = NULL;
+	}
+	if (ln->ln_txwchan != NULL) {
+		wchan_destroy(ln->ln_txwchan);
+		ln->ln_txwchan = NULL;
+	}
+}
+
+/*
+ * Setup routine called by autoconf.c when an lnet is found.
+ * All ring buffers are allocated here, once.
+ */
+int
+config_lnet(struct lnet_softc *ln, int lnetno)
+{
+	unsigned i;
+	int result;
+
+	(void)lnetno;
+
+	for (i=0; i<LNET_RXSLOTS; i++) {
+		ln->ln_rx[i].ld_buf = NULL;
+		ln->ln_rx[i].ld_len = 0;
+		ln->ln_rx[i].ld_to = 0;
+		ln->ln_rx[i].ld_state = LNET_DESC_FREE;
+	}
+	for (i=0; i<LNET_TXSLOTS; i++) {
+		ln->ln_tx[i].ld_buf = NULL;
+		ln->ln_tx[i].ld_len = 0;
+		ln->ln_tx[i].ld_to = 0;
+		ln->ln_tx[i].ld_state = LNET_DESC_FREE;
+	}
+	ln->ln_rxwchan = wchan_create("lnet rx");
+	ln->ln_txwchan = wchan_create("lnet tx");
+	if (ln->ln_rxwchan == NULL || ln->ln_txwchan == NULL) {
+		lnet_cleanup(ln);
+		return ENOMEM;
+	}
+	for (i=0; i<LNET_RXSLOTS; i++) {
+		ln->ln_rx[i].ld_buf = kmalloc(LNET_BUFSIZE);
+		if (ln->ln_rx[i].ld_buf == NULL) {
+			lnet_cleanup(ln);
+			return ENOMEM;
+		}
+	}
+	for (i=0; i<LNET_TXSLOTS; i++) {
+		ln->ln_tx[i].ld_buf = kmalloc(LNET_BUFSIZE);
+		if (ln->ln_tx[i].ld_buf == NULL) {
+			lnet_cleanup(ln);
+			return ENOMEM;
+		}
+	}
+
+	ln->ln_rxbuf = bus_map_area(ln->ln_busdata, ln->ln_buspos,
+				    LNET_RXBUF);
+	ln->ln_txbuf = bus_map_area(ln->ln_busdata, ln->ln_buspos,
+				    LNET_TXBUF);
+	ln->ln_rxhead = ln->ln_rxlend = 0;
+	ln->ln_txhead = ln->ln_txlend = 0;
+	ln->ln_rxready = 0;
+	ln->ln_txbusy = false;
+	ln->ln_rxframes = ln->ln_rxdropped = ln->ln_rxbad = 0;
+	ln->ln_txframes = 0;
+
+	ln->ln_netif.ni_ops = &lnet_netif_ops;
+	ln->ln_netif.ni_devdata = ln;
+	ln->ln_netif.ni_addr = lnet_rdreg(ln, LNET_REG_STAT) & 0xffff;
+	ln->ln_netif.ni_open = false;
+
+	/* Only our own frames and broadcasts, please */
+	lnet_wrreg(ln, LNET_REG_CTL, 0);
+
+	spinlock_acquire(&ln->ln_lock);
+	ln->ln_ready = true;
+	spinlock_release(&ln->ln_lock);
+
+	result = net_attach(&ln->ln_netif);
+	if (result) {
+		spinlock_acquire(&ln->ln_lock);
+		ln->ln_ready = false;
+		spinlock_release(&ln->ln_lock);
+		lnet_cleanup(ln);
+		return result;
+	}
+
+	return 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _LAMEBUS_LNET_H_
+#define _LAMEBUS_LNET_H_
+
+#include <spinlock.h>
+#include <net.h>
+
+/*
+ * The card has one receive buffer and one transmit buffer, each big
+ * enough for a maximal frame. A frame arriving while the receive
+ * buffer is still full is lost, so the interrupt handler copies each
+ * frame straight out into a ring of pre-allocated buffers and frees
+ * the card up again; consumers are then lent ring buffers in place.
+ * Transmit is the same in reverse.
+ */
+#define LNET_BUFSIZE	4096		/* Size of each card buffer */
+#define LNET_RXSLOTS	8		/* Receive ring size */
+#define LNET_TXSLOTS	4		/* Transmit ring size */
+
+/*
+ * Link-level header at the front of every frame, in network order.
+ * lh_packetlen counts the header too.
+ */
+struct lnet_linkheader {
+	uint32_t lh_frame;		/* LNET_FRAME_MAGIC */
+	uint16_t lh_from;		/* Sender's hardware address */
+	uint16_t lh_packetlen;		/* Whole frame length */
+	uint16_t lh_to;			/* Receiver's hardware address */
+	uint16_t lh_unused;
+};
+
+#define LNET_FRAME_MAGIC	0xa4b3c2d1
+
+/*
+ * One ring slot. A slot is owned by exactly one of the card, the
+ * driver or a consumer at a time, as recorded in ld_state.
+ */
+struct lnet_desc {
+	char *ld_buf;			/* LNET_BUFSIZE bytes */
+	size_t ld_len;			/* Frame length, header included */
+	uint16_t ld_to;			/* Destination (transmit only) */
+	unsigned ld_state;		/* LNET_DESC_* */
+};
+
+#define LNET_DESC_FREE		0	/* Empty, available to the driver */
+#define LNET_DESC_FULL		1	/* Holds a frame not yet lent out */
+#define LNET_DESC_LENT		2	/* Lent to a consumer */
+
+/*
+ * Hardware device data associated with lnet (LAMEbus network card)
+ */
+struct lnet_softc {
+	/* Initialized by lower-level attach code */
+	void *ln_busdata;		/* The bus we're on */
+	uint32_t ln_buspos;		/* Our slot on that bus */
+	int ln_unit;			/* What number lnet we are */
+
+	/*
+	 * Initialized by config_lnet; until ln_ready is set the
+	 * interrupt handler just throws frames away.
+	 */
+	bool ln_ready;			/* Rings are set up */
+	void *ln_rxbuf;			/* On-card receive buffer */
+	void *ln_txbuf;			/* On-card transmit buffer */
+	struct netif ln_netif;		/* What the network layer sees */
+
+	/*
+	 * The rings. Receive slots are filled at ln_rxhead by the
+	 * interrupt handler and lent out from ln_rxlend; transmit
+	 * slots are lent out from ln_txlend and go to the card from
+	 * ln_txhead, both in ring order. (ln_lock is initialized at
+	 * attach time, as it also covers ln_ready.)
+	 */
+	struct spinlock ln_lock;	/* Protects everything below */
+	struct lnet_desc ln_rx[LNET_RXSLOTS];
+	struct lnet_desc ln_tx[LNET_TXSLOTS];
+	unsigned ln_rxhead, ln_rxlend;
+	unsigned ln_txhead, ln_txlend;
+	unsigned ln_rxready;		/* Full receive slots */
+	bool ln_txbusy;			/* Card is sending ln_tx[ln_txhead] */
+	struct wchan *ln_rxwchan;	/* Waiting for a frame */
+	struct wchan *ln_txwchan;	/* Waiting for a transmit slot */
+
+	/* Statistics */
+	unsigned ln_rxframes;		/* Frames received */
+	unsigned ln_rxdropped;		/* ...lost for lack of a slot */
+	unsigned ln_rxbad;		/* ...lost to the card or malformed */
+	unsigned ln_txframes;		/* Frames sent */
+};
+
+/* Functions called by lower-level drivers */
+void lnet_irq(/*struct lnet_softc*/ void *);	/* Interrupt handler */
+
+#endif /* _LAMEBUS_LNET_H_ */
@@ -34,6 +34,7 @@
  * System/161, so this driver is untested and probably broken.
  */
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <spinlock.h>
 #include <platform/bus.h>
@@ -106,6 +107,66 @@ lscreen_irq(void *vsc)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Text is drawn into ls_shadow, an in-memory copy of the screen, and
+ * the range of cells changed since the last flush is remembered. Each
+ * batch of output then goes to the device with one copy of the
+ * changed range and one write of the cursor register, and scrolling
+ * is a single memmove within ls_shadow however many lines go by.
+ */
+
+/*
+ * Note that cells [START, END) of the shadow have changed.
+ */
+static
+void
+lscreen_dirty(struct lscreen_softc *sc, unsigned start, unsigned end)
+{
+	if (sc->ls_dirtystart >= sc->ls_dirtyend) {
+		sc->ls_dirtystart = start;
+		sc->ls_dirtyend = end;
+		return;
+	}
+	if (start < sc->ls_dirtystart) {
+		sc->ls_dirtystart = start;
+	}
+	if (end > sc->ls_dirtyend) {
+		sc->ls_dirtyend = end;
+	}
+}
+
+/*
+ * Copy the changed cells to the screen and put the cursor in place.
+ */
+static
+void
+lscreen_flush(struct lscreen_softc *sc)
+{
+	unsigned ccx, ccy;
+
+	if (sc->ls_dirtystart < sc->ls_dirtyend) {
+		memcpy(sc->ls_screen + sc->ls_dirtystart,
+		       sc->ls_shadow + sc->ls_dirtystart,
+		       sc->ls_dirtyend - sc->ls_dirtystart);
+		sc->ls_dirtystart = sc->ls_dirtyend = 0;
+	}
+
+	/*
+	 * ccx/ccy = corrected cursor position
+	 * (The cursor marks the next space text will appear in. But
+	 * at the very end of the line, it should not move off the edge.)
+	 */
+	ccx = sc->ls_cx;
+	ccy = sc->ls_cy;
+	if (ccx==sc->ls_width) {
+		ccx--;
+	}
+
+	/* Set the cursor position */
+	bus_write_register(sc->ls_busdata, sc->ls_buspos,
+			   LSCR_REG_POSN, mergexy(ccx, ccy));
+}
+
 /*
  * Handle a newline on the screen.
  */
@@ -113,15 +174,17 @@ static
 void
 lscreen_newline(struct lscreen_softc *sc)
 {
+	unsigned ncells = sc->ls_width * sc->ls_height;
+
 	if (sc->ls_cy >= sc->ls_height-1) {
 		/*
 		 * Scroll
 		 */
 
-		memmove(sc->ls_screen, sc->ls_screen + sc->ls_width,
-			sc->ls_width * (sc->ls_height-1));
-		bzero(sc->ls_screen + sc->ls_width * (sc->ls_height-1),
-		      sc->ls_width);
+		memmove(sc->ls_shadow, sc->ls_shadow + sc->ls_width,
+			ncells - sc->ls_width);
+		bzero(sc->ls_shadow + ncells - sc->ls_width, sc->ls_width);
+		lscreen_dirty(sc, 0, ncells);
 	}
 	else {
 		sc->ls_cy++;
@@ -140,7 +203,10 @@ lscreen_char(struct lscreen_softc *sc, int ch)
 		lscreen_newline(sc);
 	}
 
-	sc->ls_screen[sc->ls_cy*sc->ls_width + sc->ls_cx] = ch;
+	unsigned cell = sc->ls_cy*sc->ls_width + sc->ls_cx;
+
+	sc->ls_shadow[cell] = ch;
+	lscreen_dirty(sc, cell, cell + 1);
 	sc->ls_cx++;
 }
 
@@ -148,34 +214,42 @@ lscreen_char(struct lscreen_softc *sc, int ch)
  * Send a character to the screen.
  * This should probably know about backspace and tab.
  */
+static
 void
-lscreen_write(void *vsc, int ch)
+lscreen_put(struct lscreen_softc *sc, int ch)
 {
-	struct lscreen_softc *sc = vsc;
-	int ccx, ccy;
-
-	spinlock_acquire(&sc->ls_lock);
-
 	switch (ch) {
 	    case '\n': lscreen_newline(sc); break;
 	    default: lscreen_char(sc, ch); break;
 	}
+}
 
-	/*
-	 * ccx/ccy = corrected cursor position
-	 * (The cursor marks the next space text will appear in. But
-	 * at the very end of the line, it should not move off the edge.)
-	 */
-	ccx = sc->ls_cx;
-	ccy = sc->ls_cy;
-	if (ccx==sc->ls_width) {
-		ccx--;
-	}
+void
+lscreen_write(void *vsc, int ch)
+{
+	struct lscreen_softc *sc = vsc;
 
-	/* Set the cursor position */
-	bus_write_register(sc->ls_busdata, sc->ls_buspos,
-			   LSCR_REG_POSN, mergexy(ccx, ccy));
+	spinlock_acquire(&sc->ls_lock);
+	lscreen_put(sc, ch);
+	lscreen_flush(sc);
+	spinlock_release(&sc->ls_lock);
+}
 
+/*
+ * Send LEN characters to the screen, updating it once at the end.
+ * Like lscreen_write, completes before returning.
+ */
+void
+lscreen_writebuf(void *vsc, const char *buf, size_t len)
+{
+	struct lscreen_softc *sc = vsc;
+	size_t i;
+
+	spinlock_acquire(&sc->ls_lock);
+	for (i=0; i<len; i++) {
+		lscreen_put(sc, buf[i]);
+	}
+	lscreen_flush(sc);
 	spinlock_release(&sc->ls_lock);
 }
 
@@ -220,6 +294,16 @@ config_lscreen(struct lscreen_softc *sc, int lscreenno)
 	sc->ls_screen = bus_map_area(sc->ls_busdata, sc->ls_buspos,
 				     LSCR_SCREEN);
 
+	/*
+	 * Start the shadow copy off with what is on the screen now.
+	 */
+	sc->ls_shadow = kmalloc(sc->ls_width * sc->ls_height);
+	if (sc->ls_shadow == NULL) {
+		return ENOMEM;
+	}
+	memcpy(sc->ls_shadow, sc->ls_screen, sc->ls_width * sc->ls_height);
+	sc->ls_dirtystart = sc->ls_dirtyend = 0;
+
 	return 0;
 }
 
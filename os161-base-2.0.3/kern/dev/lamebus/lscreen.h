@@ -39,6 +39,9 @@ struct lscreen_softc {
 	unsigned ls_width, ls_height; // screen size
 	unsigned ls_cx, ls_cy;        // cursor position
 	char *ls_screen;              // memory-mapped screen buffer
+	char *ls_shadow;              // what ls_screen should hold
+	unsigned ls_dirtystart;       // cells [start, end) of ls_shadow
+	unsigned ls_dirtyend;         //   not yet copied to ls_screen
 
 	/* Initialized by lower-level attachment function */
 	void *ls_busdata;		// bus we're on
@@ -55,5 +58,7 @@ void lscreen_irq(/*struct lser_softc*/ void *sc);  // interrupt handler
 
 /* Functions called by higher-level drivers */
 void lscreen_write(/*struct lser_softc*/ void *sc, int ch); // output function
+void lscreen_writebuf(/*struct lser_softc*/ void *sc,       // the same, for
+		      const char *buf, size_t len);         //   many at once
 
 #endif /* _LAMEBUS_LSCREEN_H_ */
@@ -183,6 +183,11 @@ config_lser(struct lser_softc *sc, int lserno)
 	spinlock_init(&sc->ls_lock);
 	sc->ls_wbusy = false;
 
+	/* Nothing attached on top yet */
+	sc->ls_devdata = NULL;
+	sc->ls_start = NULL;
+	sc->ls_input = NULL;
+
 	bus_write_register(sc->ls_busdata, sc->ls_buspos,
 			   LSER_REG_RIRQ, LSER_IRQ_ENABLE);
 	bus_write_register(sc->ls_busdata, sc->ls_buspos,
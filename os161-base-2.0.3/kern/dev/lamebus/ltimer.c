@@ -185,3 +185,28 @@ ltimer_gettime(void *vlt, struct timespec *ts)
 		ts->tv_sec = secs1;
 	}
 }
+
+/*
+ * The same clock as one count of nanoseconds, for the monotonic
+ * clock. This gets called a lot, so instead of turning interrupts off
+ * and guessing which seconds value goes with the nanoseconds, just
+ * read again if the seconds turned over; an interrupt in between only
+ * makes the answer a little late.
+ */
+uint64_t
+ltimer_getns(void *vlt)
+{
+	struct ltimer_softc *lt = vlt;
+	uint32_t secs1, secs2, nsecs;
+
+	do {
+		secs1 = bus_read_register(lt->lt_bus, lt->lt_buspos,
+					  LT_REG_SEC);
+		nsecs = bus_read_register(lt->lt_bus, lt->lt_buspos,
+					  LT_REG_NSEC);
+		secs2 = bus_read_register(lt->lt_bus, lt->lt_buspos,
+					  LT_REG_SEC);
+	} while (secs1 != secs2);
+
+	return (uint64_t)secs1 * 1000000000 + nsecs;
+}
@@ -52,5 +52,6 @@ void ltimer_irq(/*struct ltimer_softc*/ void *lt);  // interrupt handler
 void ltimer_beep(/*struct ltimer_softc*/ void *devdata);   // for beep device
 void ltimer_gettime(/*struct ltimer_softc*/ void *devdata,
 		    struct timespec *ts);     	    // for rtclock
+uint64_t ltimer_getns(/*struct ltimer_softc*/ void *devdata); // for rtclock
 
 #endif /* _LAMEBUS_LTIMER_H_ */
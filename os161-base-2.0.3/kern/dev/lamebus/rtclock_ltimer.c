@@ -61,6 +61,7 @@ attach_rtclock_to_ltimer(int rtclockno, struct ltimer_softc *ls)
 
 	rtc->rtc_devdata = ls;
 	rtc->rtc_gettime = ltimer_gettime;
+	rtc->rtc_getns = ltimer_getns;
 
 	return rtc;
 }
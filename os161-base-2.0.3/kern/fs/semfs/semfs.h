@@ -33,6 +33,7 @@
 #include <array.h>
 #include <fs.h>
 #include <vnode.h>
+#include <poll.h>
 
 #ifndef SEMFS_INLINE
 #define SEMFS_INLINE INLINE
@@ -43,6 +44,7 @@
  */
 
 #define SEMFS_ROOTDIR	0xffffffffU		/* semnum for root dir */
+#define SEMFS_NHASH	64			/* name hash chains (power of 2) */
 
 /*
  * A user-facing semaphore.
@@ -55,6 +57,7 @@ struct semfs_sem {
 	struct lock *sems_lock;			/* Lock to protect count */
 	struct cv *sems_cv;			/* CV to wait */
 	unsigned sems_count;			/* Semaphore count */
+	struct pollhead sems_poll;		/* poll() waits here */
 	bool sems_hasvnode;			/* The vnode exists */
 	bool sems_linked;			/* In the directory */
 };
@@ -66,6 +69,9 @@ DECLARRAY(semfs_sem, SEMFS_INLINE);
 struct semfs_direntry {
 	char *semd_name;			/* Name */
 	unsigned semd_semnum;			/* Which semaphore */
+	uint32_t semd_hash;			/* Hash of the name */
+	unsigned semd_slot;			/* Index in semfs_dents */
+	struct semfs_direntry *semd_hashnext;	/* Chain in semfs_dhash */
 };
 DECLARRAY(semfs_direntry, SEMFS_INLINE);
 
@@ -80,6 +86,7 @@ struct semfs_vnode {
 	struct vnode semv_absvn;		/* Abstract vnode */
 	struct semfs *semv_semfs;		/* Back-pointer to fs */
 	unsigned semv_semnum;			/* Which semaphore */
+	struct semfs_sem *semv_sem;		/* It, or NULL for the root */
 };
 
 /*
@@ -93,8 +100,9 @@ struct semfs {
 	struct vnodearray *semfs_vnodes;	/* Currently extant vnodes */
 	struct semfs_semarray *semfs_sems;	/* Semaphores */
 
-	struct lock *semfs_dirlock;		/* Lock for following */
+	struct rwlock *semfs_dirlock;		/* Lock for following */
 	struct semfs_direntryarray *semfs_dents; /* The root directory */
+	struct semfs_direntry *semfs_dhash[SEMFS_NHASH]; /* Same, by name */
 };
 
 /*
@@ -115,6 +123,9 @@ int semfs_sem_insert(struct semfs *, struct semfs_sem *, unsigned *);
 void semfs_sem_destroy(struct semfs_sem *);
 struct semfs_direntry *semfs_direntry_create(const char *name, unsigned semno);
 void semfs_direntry_destroy(struct semfs_direntry *);
+struct semfs_direntry *semfs_dir_find(struct semfs *, const char *name);
+void semfs_dir_hashadd(struct semfs *, struct semfs_direntry *);
+void semfs_dir_hashremove(struct semfs *, struct semfs_direntry *);
 
 /* in semfs_vnops.c */
 int semfs_getvnode(struct semfs *, unsigned, struct vnode **ret);
@@ -100,19 +100,23 @@ semfs_destroy(struct semfs *semfs)
 	num = semfs_semarray_num(semfs->semfs_sems);
 	for (i=0; i<num; i++) {
 		sem = semfs_semarray_get(semfs->semfs_sems, i);
-		semfs_sem_destroy(sem);
+		if (sem != NULL) {
+			semfs_sem_destroy(sem);
+		}
 	}
 	semfs_semarray_setsize(semfs->semfs_sems, 0);
 
 	num = semfs_direntryarray_num(semfs->semfs_dents);
 	for (i=0; i<num; i++) {
 		dent = semfs_direntryarray_get(semfs->semfs_dents, i);
-		semfs_direntry_destroy(dent);
+		if (dent != NULL) {
+			semfs_direntry_destroy(dent);
+		}
 	}
 	semfs_direntryarray_setsize(semfs->semfs_dents, 0);
 
 	semfs_direntryarray_destroy(semfs->semfs_dents);
-	lock_destroy(semfs->semfs_dirlock);
+	rwlock_destroy(semfs->semfs_dirlock);
 	semfs_semarray_destroy(semfs->semfs_sems);
 	vnodearray_destroy(semfs->semfs_vnodes);
 	lock_destroy(semfs->semfs_tablelock);
@@ -178,7 +182,7 @@ semfs_create(void)
 		goto fail_vnodes;
 	}
 
-	semfs->semfs_dirlock = lock_create("semfs_dir");
+	semfs->semfs_dirlock = rwlock_create("semfs_dir");
 	if (semfs->semfs_dirlock == NULL) {
 		goto fail_sems;
 	}
@@ -186,13 +190,14 @@ semfs_create(void)
 	if (semfs->semfs_dents == NULL) {
 		goto fail_dirlock;
 	}
+	bzero(semfs->semfs_dhash, sizeof(semfs->semfs_dhash));
 
 	semfs->semfs_absfs.fs_data = semfs;
 	semfs->semfs_absfs.fs_ops = &semfs_fsops;
 	return semfs;
 
  fail_dirlock:
-	lock_destroy(semfs->semfs_dirlock);
+	rwlock_destroy(semfs->semfs_dirlock);
  fail_sems:
 	semfs_semarray_destroy(semfs->semfs_sems);
  fail_vnodes:
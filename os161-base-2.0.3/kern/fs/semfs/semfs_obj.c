@@ -63,6 +63,7 @@ semfs_sem_create(const char *name)
 		goto fail_lock;
 	}
 	sem->sems_count = 0;
+	pollhead_init(&sem->sems_poll);
 	sem->sems_hasvnode = false;
 	sem->sems_linked = false;
 	return sem;
@@ -81,6 +82,7 @@ semfs_sem_create(const char *name)
 void
 semfs_sem_destroy(struct semfs_sem *sem)
 {
+	pollhead_cleanup(&sem->sems_poll);
 	cv_destroy(sem->sems_cv);
 	lock_destroy(sem->sems_lock);
 	kfree(sem);
@@ -113,6 +115,22 @@ semfs_sem_insert(struct semfs *semfs, struct semfs_sem *sem, unsigned *ret)
 ////////////////////////////////////////////////////////////
 // semfs_direntry
 
+/*
+ * Hash function for names (FNV-1a).
+ */
+static
+uint32_t
+semfs_namehash(const char *name)
+{
+	uint32_t h = 2166136261U;
+
+	while (*name) {
+		h ^= (unsigned char)*name++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
 /*
  * Constructor for semfs_direntry.
  */
@@ -131,6 +149,9 @@ semfs_direntry_create(const char *name, unsigned semnum)
 		return NULL;
 	}
 	dent->semd_semnum = semnum;
+	dent->semd_hash = semfs_namehash(name);
+	dent->semd_slot = 0;
+	dent->semd_hashnext = NULL;
 	return dent;
 }
 
@@ -143,3 +164,50 @@ semfs_direntry_destroy(struct semfs_direntry *dent)
 	kfree(dent->semd_name);
 	kfree(dent);
 }
+
+/*
+ * Name lookup in the root directory. The directory entries are kept
+ * in an array so they can be read back in order, but looking one up
+ * by name goes through a hash table over the same entries. All of
+ * these are called with semfs_dirlock held (for writing, to change
+ * the table).
+ */
+struct semfs_direntry *
+semfs_dir_find(struct semfs *semfs, const char *name)
+{
+	struct semfs_direntry *dent;
+	uint32_t hash;
+
+	hash = semfs_namehash(name);
+	for (dent = semfs->semfs_dhash[hash & (SEMFS_NHASH - 1)];
+	     dent != NULL; dent = dent->semd_hashnext) {
+		if (dent->semd_hash == hash && !strcmp(dent->semd_name, name)) {
+			return dent;
+		}
+	}
+	return NULL;
+}
+
+void
+semfs_dir_hashadd(struct semfs *semfs, struct semfs_direntry *dent)
+{
+	struct semfs_direntry **head;
+
+	head = &semfs->semfs_dhash[dent->semd_hash & (SEMFS_NHASH - 1)];
+	dent->semd_hashnext = *head;
+	*head = dent;
+}
+
+void
+semfs_dir_hashremove(struct semfs *semfs, struct semfs_direntry *dent)
+{
+	struct semfs_direntry **pp;
+
+	pp = &semfs->semfs_dhash[dent->semd_hash & (SEMFS_NHASH - 1)];
+	while (*pp != dent) {
+		KASSERT(*pp != NULL);
+		pp = &(*pp)->semd_hashnext;
+	}
+	*pp = dent->semd_hashnext;
+	dent->semd_hashnext = NULL;
+}
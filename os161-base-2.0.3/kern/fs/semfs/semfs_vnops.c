@@ -30,6 +30,7 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/fcntl.h>
+#include <kern/dirent.h>
 #include <stat.h>
 #include <uio.h>
 #include <synch.h>
@@ -106,10 +107,6 @@ semfs_fsync(struct vnode *vn)
 ////////////////////////////////////////////////////////////
 // semaphore ops
 
-/*
- * XXX fold these two together
- */
-
 static
 struct semfs_sem *
 semfs_getsembynum(struct semfs *semfs, unsigned semnum)
@@ -123,20 +120,24 @@ semfs_getsembynum(struct semfs *semfs, unsigned semnum)
 	return sem;
 }
 
+/*
+ * The semaphore of a vnode. It can't go away while the vnode exists,
+ * so the vnode keeps a pointer to it and P and V don't need to go
+ * through the table.
+ */
 static
 struct semfs_sem *
 semfs_getsem(struct semfs_vnode *semv)
 {
-	struct semfs *semfs = semv->semv_semfs;
-
-	return semfs_getsembynum(semfs, semv->semv_semnum);
+	KASSERT(semv->semv_sem != NULL);
+	return semv->semv_sem;
 }
 
 /*
  * Wakeup helper. We only need to wake up if there are sleepers, which
  * should only be the case if the old count is 0; and we only
  * potentially need to wake more than one sleeper if the new count
- * will be more than 1.
+ * will be more than 1. Pollers are waiting for the same thing.
  */
 static
 void
@@ -151,6 +152,7 @@ semfs_wakeup(struct semfs_sem *sem, unsigned newcount)
 	else {
 		cv_broadcast(sem->sems_cv, sem->sems_lock);
 	}
+	pollhead_wakeup(&sem->sems_poll);
 }
 
 /*
@@ -181,23 +183,47 @@ semfs_semstat(struct vnode *vn, struct stat *buf)
 }
 
 /*
- * Read. This is P(); decrease the count by the amount read.
- * Don't actually bother to transfer any data.
+ * poll() for semaphore vnodes: P would go ahead (without waiting)
+ * when the count isn't 0, and V always can.
  */
 static
 int
-semfs_read(struct vnode *vn, struct uio *uio)
+semfs_poll(struct vnode *vn, int events, struct pollent *pe)
 {
 	struct semfs_vnode *semv = vn->vn_data;
+	struct semfs_sem *sem;
+	int ready = POLLOUT;
+
+	sem = semfs_getsem(semv);
+
+	lock_acquire(sem->sems_lock);
+	pollhead_register(&sem->sems_poll, pe);
+	if (sem->sems_count > 0) {
+		ready |= POLLIN;
+	}
+	lock_release(sem->sems_lock);
+
+	return ready & events;
+}
+
+/*
+ * P(): decrease the count by COUNT, waiting as needed for it to be
+ * large enough. Takes what there is as it goes rather than waiting
+ * for all of COUNT at once.
+ */
+static
+void
+semfs_P(struct semfs_vnode *semv, size_t count)
+{
 	struct semfs_sem *sem;
 	size_t consume;
 
 	sem = semfs_getsem(semv);
 
 	lock_acquire(sem->sems_lock);
-	while (uio->uio_resid > 0) {
+	while (count > 0) {
 		if (sem->sems_count > 0) {
-			consume = uio->uio_resid;
+			consume = count;
 			if (consume > sem->sems_count) {
 				consume = sem->sems_count;
 			}
@@ -205,11 +231,9 @@ semfs_read(struct vnode *vn, struct uio *uio)
 			      semv->semv_semnum, sem->sems_count,
 			      sem->sems_count - consume);
 			sem->sems_count -= consume;
-			/* don't bother advancing the uio data pointers */
-			uio->uio_offset += consume;
-			uio->uio_resid -= consume;
+			count -= consume;
 		}
-		if (uio->uio_resid == 0) {
+		if (count == 0) {
 			break;
 		}
 		if (sem->sems_count == 0) {
@@ -219,42 +243,72 @@ semfs_read(struct vnode *vn, struct uio *uio)
 		}
 	}
 	lock_release(sem->sems_lock);
-	return 0;
 }
 
 /*
- * Write. This is V(); increase the count by the amount written.
- * Don't actually bother to transfer any data.
+ * V(): increase the count by COUNT.
  */
 static
 int
-semfs_write(struct vnode *vn, struct uio *uio)
+semfs_V(struct semfs_vnode *semv, size_t count)
 {
-	struct semfs_vnode *semv = vn->vn_data;
 	struct semfs_sem *sem;
 	unsigned newcount;
 
 	sem = semfs_getsem(semv);
 
 	lock_acquire(sem->sems_lock);
-	while (uio->uio_resid > 0) {
-		newcount = sem->sems_count + uio->uio_resid;
-		if (newcount < sem->sems_count) {
-			/* overflow */
-			lock_release(sem->sems_lock);
-			return EFBIG;
-		}
-		DEBUG(DB_SEMFS, "semfs: sem%u: V, count %u -> %u\n",
-		      semv->semv_semnum, sem->sems_count, newcount);
-		semfs_wakeup(sem, newcount);
-		sem->sems_count = newcount;
-		uio->uio_offset += uio->uio_resid;
-		uio->uio_resid = 0;
+	newcount = sem->sems_count + count;
+	if (newcount < sem->sems_count) {
+		/* overflow */
+		lock_release(sem->sems_lock);
+		return EFBIG;
 	}
+	DEBUG(DB_SEMFS, "semfs: sem%u: V, count %u -> %u\n",
+	      semv->semv_semnum, sem->sems_count, newcount);
+	semfs_wakeup(sem, newcount);
+	sem->sems_count = newcount;
 	lock_release(sem->sems_lock);
 	return 0;
 }
 
+/*
+ * Read. This is P(); decrease the count by the amount read.
+ * Don't actually bother to transfer any data.
+ */
+static
+int
+semfs_read(struct vnode *vn, struct uio *uio)
+{
+	struct semfs_vnode *semv = vn->vn_data;
+
+	semfs_P(semv, uio->uio_resid);
+	/* don't bother advancing the uio data pointers */
+	uio->uio_offset += uio->uio_resid;
+	uio->uio_resid = 0;
+	return 0;
+}
+
+/*
+ * Write. This is V(); increase the count by the amount written.
+ * Don't actually bother to transfer any data.
+ */
+static
+int
+semfs_write(struct vnode *vn, struct uio *uio)
+{
+	struct semfs_vnode *semv = vn->vn_data;
+	int result;
+
+	result = semfs_V(semv, uio->uio_resid);
+	if (result) {
+		return result;
+	}
+	uio->uio_offset += uio->uio_resid;
+	uio->uio_resid = 0;
+	return 0;
+}
+
 /*
  * Truncate. Set the count to the specified value.
  *
@@ -311,7 +365,7 @@ semfs_getdirentry(struct vnode *dirvn, struct uio *uio)
 	KASSERT(uio->uio_offset >= 0);
 	pos = uio->uio_offset;
 
-	lock_acquire(semfs->semfs_dirlock);
+	rwlock_acquire_read(semfs->semfs_dirlock);
 
 	num = semfs_direntryarray_num(semfs->semfs_dents);
 	if (pos >= num) {
@@ -320,11 +374,60 @@ semfs_getdirentry(struct vnode *dirvn, struct uio *uio)
 	}
 	else {
 		dent = semfs_direntryarray_get(semfs->semfs_dents, pos);
-		result = uiomove(dent->semd_name, strlen(dent->semd_name),
-				 uio);
+		if (dent == NULL) {
+			/* removed; an empty name, as for other holes */
+			result = 0;
+		}
+		else {
+			result = uiomove(dent->semd_name,
+					 strlen(dent->semd_name), uio);
+		}
+	}
+
+	rwlock_release_read(semfs->semfs_dirlock);
+	return result;
+}
+
+/*
+ * Batched directory read: all the names that fit, starting at the
+ * offset, which is the index of the next semaphore.
+ */
+static
+int
+semfs_getdirents(struct vnode *dirvn, struct uio *uio)
+{
+	struct semfs_vnode *dirsemv = dirvn->vn_data;
+	struct semfs *semfs = dirsemv->semv_semfs;
+	struct semfs_direntry *dent;
+	unsigned num, start, pos;
+	int result;
+
+	KASSERT(uio->uio_offset >= 0);
+	start = uio->uio_offset;
+	result = 0;
+
+	rwlock_acquire_read(semfs->semfs_dirlock);
+
+	num = semfs_direntryarray_num(semfs->semfs_dents);
+	for (pos = start; pos < num; pos++) {
+		dent = semfs_direntryarray_get(semfs->semfs_dents, pos);
+		if (dent == NULL) {
+			/* removed */
+			continue;
+		}
+		result = vnode_putdirent(uio, 0, DT_UNKNOWN, dent->semd_name);
+		if (result) {
+			break;
+		}
+	}
+	if (result == ENOSPC) {
+		/* Full; but if nothing went in, the buffer's too small */
+		result = (pos == start) ? EINVAL : 0;
 	}
+	/* uiomove counted bytes; the offset is the next index */
+	uio->uio_offset = pos;
 
-	lock_release(semfs->semfs_dirlock);
+	rwlock_release_read(semfs->semfs_dirlock);
 	return result;
 }
 
@@ -340,9 +443,9 @@ semfs_dirstat(struct vnode *vn, struct stat *buf)
 
 	bzero(buf, sizeof(*buf));
 
-	lock_acquire(semfs->semfs_dirlock);
+	rwlock_acquire_read(semfs->semfs_dirlock);
 	buf->st_size = semfs_direntryarray_num(semfs->semfs_dents);
-	lock_release(semfs->semfs_dirlock);
+	rwlock_release_read(semfs->semfs_dirlock);
 
 	buf->st_mode = S_IFDIR | 1777;
 	buf->st_nlink = 2;
@@ -378,7 +481,7 @@ semfs_creat(struct vnode *dirvn, const char *name, bool excl, mode_t mode,
 	struct semfs *semfs = dirsemv->semv_semfs;
 	struct semfs_direntry *dent;
 	struct semfs_sem *sem;
-	unsigned i, num, empty, semnum;
+	unsigned num, empty, semnum;
 	int result;
 
 	(void)mode;
@@ -386,27 +489,24 @@ semfs_creat(struct vnode *dirvn, const char *name, bool excl, mode_t mode,
 		return EEXIST;
 	}
 
-	lock_acquire(semfs->semfs_dirlock);
-	num = semfs_direntryarray_num(semfs->semfs_dents);
-	empty = num;
-	for (i=0; i<num; i++) {
-		dent = semfs_direntryarray_get(semfs->semfs_dents, i);
-		if (dent == NULL) {
-			if (empty == num) {
-				empty = i;
-			}
-			continue;
+	rwlock_acquire_write(semfs->semfs_dirlock);
+	dent = semfs_dir_find(semfs, name);
+	if (dent != NULL) {
+		/* found */
+		if (excl) {
+			rwlock_release_write(semfs->semfs_dirlock);
+			return EEXIST;
 		}
-		if (!strcmp(dent->semd_name, name)) {
-			/* found */
-			if (excl) {
-				lock_release(semfs->semfs_dirlock);
-				return EEXIST;
-			}
-			result = semfs_getvnode(semfs, dent->semd_semnum,
-						resultvn);
-			lock_release(semfs->semfs_dirlock);
-			return result;
+		result = semfs_getvnode(semfs, dent->semd_semnum, resultvn);
+		rwlock_release_write(semfs->semfs_dirlock);
+		return result;
+	}
+
+	/* find a free slot, if any */
+	num = semfs_direntryarray_num(semfs->semfs_dents);
+	for (empty=0; empty<num; empty++) {
+		if (semfs_direntryarray_get(semfs->semfs_dents, empty) == NULL) {
+			break;
 		}
 	}
 
@@ -439,13 +539,16 @@ semfs_creat(struct vnode *dirvn, const char *name, bool excl, mode_t mode,
 		}
 	}
 
+	dent->semd_slot = empty;
+
 	result = semfs_getvnode(semfs, semnum, resultvn);
 	if (result) {
 		goto fail_undir;
 	}
 
+	semfs_dir_hashadd(semfs, dent);
 	sem->sems_linked = true;
-	lock_release(semfs->semfs_dirlock);
+	rwlock_release_write(semfs->semfs_dirlock);
 	return 0;
 
  fail_undir:
@@ -459,7 +562,7 @@ semfs_creat(struct vnode *dirvn, const char *name, bool excl, mode_t mode,
  fail_uncreate:
 	semfs_sem_destroy(sem);
  fail_unlock:
-	lock_release(semfs->semfs_dirlock);
+	rwlock_release_write(semfs->semfs_dirlock);
 	return result;
 }
 
@@ -475,47 +578,38 @@ semfs_remove(struct vnode *dirvn, const char *name)
 	struct semfs *semfs = dirsemv->semv_semfs;
 	struct semfs_direntry *dent;
 	struct semfs_sem *sem;
-	unsigned i, num;
-	int result;
 
 	if (!strcmp(name, ".") || !strcmp(name, "..")) {
 		return EINVAL;
 	}
 
-	lock_acquire(semfs->semfs_dirlock);
-	num = semfs_direntryarray_num(semfs->semfs_dents);
-	for (i=0; i<num; i++) {
-		dent = semfs_direntryarray_get(semfs->semfs_dents, i);
-		if (dent == NULL) {
-			continue;
-		}
-		if (!strcmp(name, dent->semd_name)) {
-			/* found */
-			sem = semfs_getsembynum(semfs, dent->semd_semnum);
-			lock_acquire(sem->sems_lock);
-			KASSERT(sem->sems_linked);
-			sem->sems_linked = false;
-			if (sem->sems_hasvnode == false) {
-				lock_acquire(semfs->semfs_tablelock);
-				semfs_semarray_set(semfs->semfs_sems,
-						   dent->semd_semnum, NULL);
-				lock_release(semfs->semfs_tablelock);
-				lock_release(sem->sems_lock);
-				semfs_sem_destroy(sem);
-			}
-			else {
-				lock_release(sem->sems_lock);
-			}
-			semfs_direntryarray_set(semfs->semfs_dents, i, NULL);
-			semfs_direntry_destroy(dent);
-			result = 0;
-			goto out;
-		}
+	rwlock_acquire_write(semfs->semfs_dirlock);
+	dent = semfs_dir_find(semfs, name);
+	if (dent == NULL) {
+		rwlock_release_write(semfs->semfs_dirlock);
+		return ENOENT;
 	}
-	result = ENOENT;
- out:
-	lock_release(semfs->semfs_dirlock);
-	return result;
+
+	sem = semfs_getsembynum(semfs, dent->semd_semnum);
+	lock_acquire(sem->sems_lock);
+	KASSERT(sem->sems_linked);
+	sem->sems_linked = false;
+	if (sem->sems_hasvnode == false) {
+		lock_acquire(semfs->semfs_tablelock);
+		semfs_semarray_set(semfs->semfs_sems, dent->semd_semnum, NULL);
+		lock_release(semfs->semfs_tablelock);
+		lock_release(sem->sems_lock);
+		semfs_sem_destroy(sem);
+	}
+	else {
+		lock_release(sem->sems_lock);
+	}
+	semfs_dir_hashremove(semfs, dent);
+	semfs_direntryarray_set(semfs->semfs_dents, dent->semd_slot, NULL);
+	semfs_direntry_destroy(dent);
+
+	rwlock_release_write(semfs->semfs_dirlock);
+	return 0;
 }
 
 /*
@@ -528,7 +622,6 @@ semfs_lookup(struct vnode *dirvn, char *path, struct vnode **resultvn)
 	struct semfs_vnode *dirsemv = dirvn->vn_data;
 	struct semfs *semfs = dirsemv->semv_semfs;
 	struct semfs_direntry *dent;
-	unsigned i, num;
 	int result;
 
 	if (!strcmp(path, ".") || !strcmp(path, "..")) {
@@ -537,22 +630,15 @@ semfs_lookup(struct vnode *dirvn, char *path, struct vnode **resultvn)
 		return 0;
 	}
 
-	lock_acquire(semfs->semfs_dirlock);
-	num = semfs_direntryarray_num(semfs->semfs_dents);
-	for (i=0; i<num; i++) {
-		dent = semfs_direntryarray_get(semfs->semfs_dents, i);
-		if (dent == NULL) {
-			continue;
-		}
-		if (!strcmp(path, dent->semd_name)) {
-			result = semfs_getvnode(semfs, dent->semd_semnum,
-						resultvn);
-			lock_release(semfs->semfs_dirlock);
-			return result;
-		}
+	rwlock_acquire_read(semfs->semfs_dirlock);
+	dent = semfs_dir_find(semfs, path);
+	if (dent == NULL) {
+		rwlock_release_read(semfs->semfs_dirlock);
+		return ENOENT;
 	}
-	lock_release(semfs->semfs_dirlock);
-	return ENOENT;
+	result = semfs_getvnode(semfs, dent->semd_semnum, resultvn);
+	rwlock_release_read(semfs->semfs_dirlock);
+	return result;
 }
 
 /*
@@ -603,12 +689,10 @@ semfs_reclaim(struct vnode *vn)
 
 	lock_acquire(semfs->semfs_tablelock);
 
-	/* vnode refcount is protected by the vnode's ->vn_countlock */
+	/* the last reference is decided under the vnode's ->vn_countlock */
 	spinlock_acquire(&vn->vn_countlock);
-	if (vn->vn_refcount > 1) {
-		/* consume the reference VOP_DECREF passed us */
-		vn->vn_refcount--;
-
+	if (vnode_dropref_unless_last(vn)) {
+		/* consumed the reference VOP_DECREF passed us */
 		spinlock_release(&vn->vn_countlock);
 		lock_release(semfs->semfs_tablelock);
 		return EBUSY;
@@ -657,6 +741,7 @@ static const struct vnode_ops semfs_dirops = {
 	.vop_read = vopfail_uio_isdir,
 	.vop_readlink = vopfail_uio_isdir,
 	.vop_getdirentry = semfs_getdirentry,
+	.vop_getdirents = semfs_getdirents,
 	.vop_write = vopfail_uio_isdir,
 	.vop_ioctl = semfs_ioctl,
 	.vop_stat = semfs_dirstat,
@@ -665,6 +750,10 @@ static const struct vnode_ops semfs_dirops = {
 	.vop_fsync = semfs_fsync,
 	.vop_mmap = vopfail_mmap_isdir,
 	.vop_truncate = vopfail_truncate_isdir,
+	.vop_punch = vopfail_punch_isdir,
+	.vop_poll = vnode_poll_ready,
+	.vop_prefetch = vnode_prefetch_none,
+	.vop_dontneed = vnode_dontneed_none,
 	.vop_namefile = semfs_namefile,
 
 	.vop_creat = semfs_creat,
@@ -690,6 +779,7 @@ static const struct vnode_ops semfs_semops = {
 	.vop_read = semfs_read,
 	.vop_readlink = vopfail_uio_inval,
 	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_getdirents = vopfail_uio_notdir,
 	.vop_write = semfs_write,
 	.vop_ioctl = semfs_ioctl,
 	.vop_stat = semfs_semstat,
@@ -698,6 +788,10 @@ static const struct vnode_ops semfs_semops = {
 	.vop_fsync = semfs_fsync,
 	.vop_mmap = vopfail_mmap_perm,
 	.vop_truncate = semfs_truncate,
+	.vop_punch = vopfail_punch_nosys,
+	.vop_poll = semfs_poll,
+	.vop_prefetch = vnode_prefetch_none,
+	.vop_dontneed = vnode_dontneed_none,
 	.vop_namefile = vopfail_uio_notdir,
 
 	.vop_creat = vopfail_creat_notdir,
@@ -736,6 +830,7 @@ semfs_vnode_create(struct semfs *semfs, unsigned semnum)
 
 	semv->semv_semfs = semfs;
 	semv->semv_semnum = semnum;
+	semv->semv_sem = NULL;
 
 	result = vnode_init(&semv->semv_absvn, optable,
 			    &semfs->semfs_absfs, semv);
@@ -791,9 +886,32 @@ semfs_getvnode(struct semfs *semfs, unsigned semnum, struct vnode **ret)
 		KASSERT(sem != NULL);
 		KASSERT(sem->sems_hasvnode == false);
 		sem->sems_hasvnode = true;
+		semv->semv_sem = sem;
 	}
 	lock_release(semfs->semfs_tablelock);
 
 	*ret = &semv->semv_absvn;
 	return 0;
 }
+
+/*
+ * P or V on a semaphore vnode without going through read or write,
+ * for the sem_op system call. A negative DELTA is P(-DELTA) and a
+ * positive one V(DELTA). Fails with EINVAL if VN is not a semaphore.
+ */
+int
+semfs_semop(struct vnode *vn, int delta)
+{
+	struct semfs_vnode *semv;
+
+	if (vn->vn_ops != &semfs_semops) {
+		return EINVAL;
+	}
+	semv = vn->vn_data;
+
+	if (delta < 0) {
+		semfs_P(semv, -(unsigned)delta);
+		return 0;
+	}
+	return semfs_V(semv, delta);
+}
@@ -33,59 +33,163 @@
  * Block allocation.
  */
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <bitmap.h>
+#include <synch.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
 /*
- * Zero out a disk block.
+ * Zero out a disk block, right in its cache buffer; there's no need
+ * to read it first or to copy from a block of zeros.
  */
 static
 int
 sfs_clearblock(struct sfs_fs *sfs, daddr_t block)
 {
-	/* static -> automatically initialized to zero */
-	static char zeros[SFS_BLOCKSIZE];
+	struct sfs_buf *buf;
+	int result;
 
-	return sfs_writeblock(sfs, block, zeros, SFS_BLOCKSIZE);
+	result = sfs_buf_get(sfs, block, false, &buf);
+	if (result) {
+		return result;
+	}
+	bzero(sfs_buf_data(buf), SFS_FS_BLOCKSIZE(sfs));
+	sfs_buf_markdirty(buf);
+	sfs_buf_release(buf);
+	return 0;
 }
 
 /*
- * Allocate a block.
+ * Where to look for a free block when the goal itself is taken: the
+ * first free block after the goal that starts a run of at least
+ * SFS_BALLOC_RUN free blocks, so the file can keep growing in place.
  */
+#define SFS_BALLOC_RUN 8
+
+/*
+ * Pick a free block, trying GOAL first. Failing that, take the start
+ * of the first free run of SFS_BALLOC_RUN blocks after GOAL (wrapping
+ * around at the end of the volume), and if no run is that long, the
+ * first free block after GOAL. Returns ENOSPC if the disk is full.
+ * Must hold the freemap lock.
+ */
+static
 int
-sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock)
+sfs_balloc_pick(struct sfs_fs *sfs, daddr_t goal, daddr_t *ret)
+{
+	struct bitmap *map = sfs->sfs_freemap;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_freemaplock));
+
+	if (goal >= sfs->sfs_sb.sb_nblocks) {
+		goal = 0;
+	}
+	if (!bitmap_isset(map, goal)) {
+		*ret = goal;
+		return 0;
+	}
+	if (bitmap_findrun(map, goal, SFS_BALLOC_RUN, ret) == 0 ||
+	    bitmap_findrun(map, 0, SFS_BALLOC_RUN, ret) == 0 ||
+	    bitmap_findrun(map, goal, 1, ret) == 0 ||
+	    bitmap_findrun(map, 0, 1, ret) == 0) {
+		return 0;
+	}
+	return ENOSPC;
+}
+
+/*
+ * Allocate a block, preferably at or close after GOAL. Callers pass
+ * the block that should physically precede the new one (the file's
+ * previous block, or the inode for a file's first block), plus one;
+ * a GOAL of 0 means no preference.
+ */
+int
+sfs_balloc(struct sfs_fs *sfs, daddr_t goal, daddr_t *diskblock)
 {
 	int result;
 
-	result = bitmap_alloc(sfs->sfs_freemap, diskblock);
+	lock_acquire(sfs->sfs_freemaplock);
+	result = sfs_balloc_pick(sfs, goal, diskblock);
 	if (result) {
+		lock_release(sfs->sfs_freemaplock);
 		return result;
 	}
+	bitmap_mark(sfs->sfs_freemap, *diskblock);
 	sfs->sfs_freemapdirty = true;
+	lock_release(sfs->sfs_freemaplock);
 
 	if (*diskblock >= sfs->sfs_sb.sb_nblocks) {
 		panic("sfs: %s: balloc: invalid block %u\n",
 		      sfs->sfs_sb.sb_volname, *diskblock);
 	}
 
-	/* Clear block before returning it */
+	/* Clear block before returning it; it's ours, so no lock needed */
 	result = sfs_clearblock(sfs, *diskblock);
 	if (result) {
+		lock_acquire(sfs->sfs_freemaplock);
 		bitmap_unmark(sfs->sfs_freemap, *diskblock);
+		lock_release(sfs->sfs_freemaplock);
 	}
 	return result;
 }
 
+/*
+ * Choose where an extent of N blocks that would ideally start at
+ * GOAL should go: GOAL itself if the N blocks there are free, else
+ * the first free run of N blocks after GOAL (wrapping around). If
+ * there's no such run, just GOAL, and the blocks end up wherever
+ * sfs_balloc can put them. Nothing is allocated.
+ */
+daddr_t
+sfs_balloc_extent(struct sfs_fs *sfs, daddr_t goal, unsigned n)
+{
+	struct bitmap *map = sfs->sfs_freemap;
+	unsigned start;
+
+	lock_acquire(sfs->sfs_freemaplock);
+	if (goal >= sfs->sfs_sb.sb_nblocks) {
+		goal = 0;
+	}
+	if (bitmap_findrun(map, goal, n, &start) != 0 &&
+	    bitmap_findrun(map, 0, n, &start) != 0) {
+		start = goal;
+	}
+	lock_release(sfs->sfs_freemaplock);
+	return start;
+}
+
+/*
+ * Free the N blocks in BLOCKS.
+ */
+void
+sfs_bfreelist(struct sfs_fs *sfs, const daddr_t *blocks, unsigned n)
+{
+	unsigned i;
+
+	if (n == 0) {
+		return;
+	}
+
+	/* Whatever is cached for the blocks is garbage now */
+	sfs_buf_forget(sfs, blocks, n);
+
+	lock_acquire(sfs->sfs_freemaplock);
+	for (i=0; i<n; i++) {
+		bitmap_unmark(sfs->sfs_freemap, blocks[i]);
+	}
+	sfs->sfs_freemapdirty = true;
+	lock_release(sfs->sfs_freemaplock);
+}
+
 /*
  * Free a block.
  */
 void
 sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock)
 {
-	bitmap_unmark(sfs->sfs_freemap, diskblock);
-	sfs->sfs_freemapdirty = true;
+	sfs_bfreelist(sfs, &diskblock, 1);
 }
 
 /*
@@ -94,10 +198,15 @@ sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock)
 int
 sfs_bused(struct sfs_fs *sfs, daddr_t diskblock)
 {
+	int ret;
+
 	if (diskblock >= sfs->sfs_sb.sb_nblocks) {
 		panic("sfs: %s: sfs_bused called on out of range block %u\n",
 		      sfs->sfs_sb.sb_volname, diskblock);
 	}
-	return bitmap_isset(sfs->sfs_freemap, diskblock);
+	lock_acquire(sfs->sfs_freemaplock);
+	ret = bitmap_isset(sfs->sfs_freemap, diskblock);
+	lock_release(sfs->sfs_freemaplock);
+	return ret;
 }
 
@@ -35,39 +35,66 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
 #include <vfs.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
+/*
+ * Allocation goal for a new block following PREV, the disk block of
+ * the file's previous block (0 if none): right after PREV, or right
+ * after the inode if the file has nothing before it.
+ */
+static
+daddr_t
+sfs_bmap_goal(struct sfs_vnode *sv, daddr_t prev)
+{
+	return (prev != 0 ? prev : sv->sv_ino) + 1;
+}
+
+/*
+ * Each vnode keeps a copy of the window of SFS_BMAP_CACHE indirect
+ * block entries it used last, so mapping file blocks past the direct
+ * blocks usually doesn't need to go to the indirect block in the
+ * buffer cache (or on disk) at all. The copy is kept up to date as
+ * blocks get allocated and thrown out by sfs_itrunc.
+ */
+static
+void
+sfs_bmap_cachefill(struct sfs_vnode *sv, const uint32_t *iddata,
+		   uint32_t idoff)
+{
+	unsigned i;
+
+	sv->sv_bmc_base = idoff - idoff % SFS_BMAP_CACHE;
+	sv->sv_bmc_count = SFS_BMAP_CACHE;
+	for (i=0; i<SFS_BMAP_CACHE; i++) {
+		sv->sv_bmc_blocks[i] = iddata[sv->sv_bmc_base + i];
+	}
+}
+
 /*
  * Look up the disk block number (from 0 up to the number of blocks on
  * the disk) given a file and the logical block number within that
  * file. If DOALLOC is set, and no such block exists, one will be
- * allocated.
+ * allocated, at GOAL if that's nonzero and the usual place following
+ * the file's previous block otherwise.
  */
+static
 int
-sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
-	 daddr_t *diskblock)
+sfs_bmap_lookup(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
+		daddr_t goal, daddr_t *diskblock)
 {
-	/*
-	 * I/O buffer for handling indirect blocks.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *idbuf;
+	uint32_t *iddata;
 	daddr_t block;
 	daddr_t idblock;
+	daddr_t prev;
 	uint32_t idnum, idoff;
 	int result;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
-
-	/* Since we're using a static buffer, we'd better be locked. */
-	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(lock_do_i_hold(sv->sv_lock));
 
 	/*
 	 * If the block we want is one of the direct blocks...
@@ -82,7 +109,12 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		 * Do we need to allocate?
 		 */
 		if (block==0 && doalloc) {
-			result = sfs_balloc(sfs, &block);
+			prev = fileblock > 0 ?
+				sv->sv_i.sfi_direct[fileblock - 1] : 0;
+			if (goal == 0) {
+				goal = sfs_bmap_goal(sv, prev);
+			}
+			result = sfs_balloc(sfs, goal, &block);
 			if (result) {
 				return result;
 			}
@@ -113,8 +145,8 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 	fileblock -= SFS_NDIRECT;
 
 	/* Get the indirect block number and offset w/i that indirect block */
-	idnum = fileblock / SFS_DBPERIDB;
-	idoff = fileblock % SFS_DBPERIDB;
+	idnum = fileblock / SFS_FS_DBPERIDB(sfs);
+	idoff = fileblock % SFS_FS_DBPERIDB(sfs);
 
 	/*
 	 * We only have one indirect block. If the offset we were asked for
@@ -124,6 +156,15 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		return EFBIG;
 	}
 
+	/* Check the translation cache */
+	if (sv->sv_bmc_count > 0 && idoff >= sv->sv_bmc_base &&
+	    idoff < sv->sv_bmc_base + sv->sv_bmc_count) {
+		block = sv->sv_bmc_blocks[idoff - sv->sv_bmc_base];
+		if (block != 0 || !doalloc) {
+			goto done;
+		}
+	}
+
 	/* Get the disk block number of the indirect block. */
 	idblock = sv->sv_i.sfi_indirect;
 
@@ -143,7 +184,8 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		 * the indirect block. Thus, we need to allocate an
 		 * indirect block.
 		 */
-		result = sfs_balloc(sfs, &idblock);
+		prev = sv->sv_i.sfi_direct[SFS_NDIRECT - 1];
+		result = sfs_balloc(sfs, sfs_bmap_goal(sv, prev), &idblock);
 		if (result) {
 			return result;
 		}
@@ -154,39 +196,45 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		/* Mark the inode dirty */
 		sv->sv_dirty = true;
 
-		/* Clear the indirect block buffer */
-		bzero(idbuf, sizeof(idbuf));
+		/* sfs_balloc has zeroed it in the buffer cache */
 	}
-	else {
-		/*
-		 * We already have an indirect block allocated; load it.
-		 */
-		result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
-		if (result) {
-			return result;
-		}
+
+	/*
+	 * Work on the indirect block in place in the buffer cache.
+	 */
+	result = sfs_buf_get(sfs, idblock, true, &idbuf);
+	if (result) {
+		return result;
 	}
+	iddata = sfs_buf_data(idbuf);
+	sfs_bmap_cachefill(sv, iddata, idoff);
 
-	/* Get the block out of the indirect block buffer */
-	block = idbuf[idoff];
+	/* Get the block out of the indirect block */
+	block = iddata[idoff];
 
 	/* If there's no block there, allocate one */
 	if (block==0 && doalloc) {
-		result = sfs_balloc(sfs, &block);
+		prev = idoff > 0 ? iddata[idoff - 1] :
+			sv->sv_i.sfi_direct[SFS_NDIRECT - 1];
+		if (goal == 0) {
+			goal = sfs_bmap_goal(sv, prev);
+		}
+		result = sfs_balloc(sfs, goal, &block);
 		if (result) {
+			sfs_buf_release(idbuf);
 			return result;
 		}
 
 		/* Remember the block we allocated */
-		idbuf[idoff] = block;
+		iddata[idoff] = block;
+		sv->sv_bmc_blocks[idoff - sv->sv_bmc_base] = block;
 
-		/* The indirect block is now dirty; write it back */
-		result = sfs_writeblock(sfs, idblock, idbuf, sizeof(idbuf));
-		if (result) {
-			return result;
-		}
+		/* The indirect block is now dirty */
+		sfs_buf_markmeta(idbuf);
 	}
+	sfs_buf_release(idbuf);
 
+ done:
 	/* Hand back the result and return. */
 	if (block != 0 && !sfs_bused(sfs, block)) {
 		panic("sfs: %s: Data block %u (block %u of file %u) "
@@ -197,98 +245,195 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 	return 0;
 }
 
+int
+sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
+	 daddr_t *diskblock)
+{
+	return sfs_bmap_lookup(sv, fileblock, doalloc, 0, diskblock);
+}
+
 /*
- * Called for ftruncate() and from sfs_reclaim.
+ * Map file blocks FILEBLOCK through FILEBLOCK+N-1, allocating disk
+ * blocks for any that have none, and return their disk blocks in
+ * DISKBLOCKS. The new blocks are placed as one contiguous extent
+ * if there's a free run that long anywhere: right after the file's
+ * previous block if possible. On error some of the blocks may
+ * already have been allocated; calling again picks up where it left
+ * off.
  */
 int
-sfs_itrunc(struct sfs_vnode *sv, off_t len)
+sfs_bmap_extent(struct sfs_vnode *sv, uint32_t fileblock, unsigned n,
+		daddr_t *diskblocks)
 {
-	/*
-	 * I/O buffer for handling the indirect block.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static uint32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	daddr_t prev, goal;
+	unsigned i;
+	int result;
+
+	KASSERT(n > 0);
+
+	prev = 0;
+	if (fileblock > 0) {
+		result = sfs_bmap(sv, fileblock - 1, false, &prev);
+		if (result) {
+			return result;
+		}
+	}
+	goal = sfs_balloc_extent(sfs, sfs_bmap_goal(sv, prev), n);
+
+	/* Each later block goes right after the one before it */
+	for (i=0; i<n; i++) {
+		result = sfs_bmap_lookup(sv, fileblock + i, true,
+					 i == 0 ? goal : 0, &diskblocks[i]);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Number of file blocks an inode can map; depends on the block size.
+ */
+#define SFS_FILEBLOCKS(sfs) \
+	(SFS_NDIRECT + SFS_NINDIRECT * SFS_FS_DBPERIDB(sfs))
+
+/*
+ * Blocks to be freed are collected and handed to sfs_bfreelist this
+ * many at a time, so the freemap and the buffer cache are locked once
+ * per batch instead of once per block.
+ */
+#define SFS_FREEBATCH 32
 
-	/* Length in blocks (divide rounding up) */
-	uint32_t blocklen = DIVROUNDUP(len, SFS_BLOCKSIZE);
+struct sfs_freebatch {
+	struct sfs_fs *fb_sfs;
+	unsigned fb_num;
+	daddr_t fb_blocks[SFS_FREEBATCH];
+};
+
+static
+void
+sfs_freebatch_flush(struct sfs_freebatch *fb)
+{
+	sfs_bfreelist(fb->fb_sfs, fb->fb_blocks, fb->fb_num);
+	fb->fb_num = 0;
+}
+
+static
+void
+sfs_freebatch_add(struct sfs_freebatch *fb, daddr_t block)
+{
+	if (fb->fb_num == SFS_FREEBATCH) {
+		sfs_freebatch_flush(fb);
+	}
+	fb->fb_blocks[fb->fb_num++] = block;
+}
 
-	uint32_t i, j;
-	daddr_t block, idblock;
-	uint32_t baseblock, highblock;
+/*
+ * Free the disk blocks of file blocks FROM up to but not including
+ * TO, leaving holes, and the indirect block if nothing is left in it.
+ * The file size is not changed.
+ */
+int
+sfs_ifree(struct sfs_vnode *sv, uint32_t from, uint32_t to)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_freebatch fb;
+	struct sfs_buf *idbuf;
+	uint32_t *iddata;
+	uint32_t i, lo, hi;
+	daddr_t idblock;
+	bool hasnonzero, iddirty;
 	int result;
-	int hasnonzero, iddirty;
 
-	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
+	KASSERT(lock_do_i_hold(sv->sv_lock));
 
-	vfs_biglock_acquire();
+	if (to > SFS_FILEBLOCKS(sfs)) {
+		to = SFS_FILEBLOCKS(sfs);
+	}
+	if (from >= to) {
+		return 0;
+	}
 
-	/*
-	 * Go through the direct blocks. Discard any that are
-	 * past the limit we're truncating to.
-	 */
-	for (i=0; i<SFS_NDIRECT; i++) {
-		block = sv->sv_i.sfi_direct[i];
-		if (i >= blocklen && block != 0) {
-			sfs_bfree(sfs, block);
+	/* Drop written data in the range that never got a block */
+	sfs_delay_discard(sv, from, to);
+
+	/* Indirect block entries may change; forget the cached ones */
+	sv->sv_bmc_count = 0;
+
+	fb.fb_sfs = sfs;
+	fb.fb_num = 0;
+
+	/* The direct blocks */
+	for (i = from; i < to && i < SFS_NDIRECT; i++) {
+		if (sv->sv_i.sfi_direct[i] != 0) {
+			sfs_freebatch_add(&fb, sv->sv_i.sfi_direct[i]);
 			sv->sv_i.sfi_direct[i] = 0;
 			sv->sv_dirty = true;
 		}
 	}
 
-	/* Indirect block number */
+	/* The blocks in the indirect block */
 	idblock = sv->sv_i.sfi_indirect;
+	if (to > SFS_NDIRECT && idblock != 0) {
+		lo = from > SFS_NDIRECT ? from - SFS_NDIRECT : 0;
+		hi = to - SFS_NDIRECT;
 
-	/* The lowest block in the indirect block */
-	baseblock = SFS_NDIRECT;
-
-	/* The highest block in the indirect block */
-	highblock = baseblock + SFS_DBPERIDB - 1;
-
-	if (blocklen < highblock && idblock != 0) {
-		/* We're past the proposed EOF; may need to free stuff */
-
-		/* Read the indirect block */
-		result = sfs_readblock(sfs, idblock, idbuf, sizeof(idbuf));
+		result = sfs_buf_get(fb.fb_sfs, idblock, true, &idbuf);
 		if (result) {
-			vfs_biglock_release();
+			sfs_freebatch_flush(&fb);
 			return result;
 		}
-
-		hasnonzero = 0;
-		iddirty = 0;
-		for (j=0; j<SFS_DBPERIDB; j++) {
-			/* Discard any blocks that are past the new EOF */
-			if (blocklen < baseblock+j && idbuf[j] != 0) {
-				sfs_bfree(sfs, idbuf[j]);
-				idbuf[j] = 0;
-				iddirty = 1;
+		iddata = sfs_buf_data(idbuf);
+
+		hasnonzero = false;
+		iddirty = false;
+		for (i=0; i<SFS_FS_DBPERIDB(sfs); i++) {
+			if (i >= lo && i < hi && iddata[i] != 0) {
+				sfs_freebatch_add(&fb, iddata[i]);
+				iddata[i] = 0;
+				iddirty = true;
 			}
 			/* Remember if we see any nonzero blocks in here */
-			if (idbuf[j]!=0) {
-				hasnonzero=1;
+			if (iddata[i] != 0) {
+				hasnonzero = true;
 			}
 		}
 
+		if (iddirty) {
+			/* The indirect block has changed */
+			sfs_buf_markmeta(idbuf);
+		}
+		sfs_buf_release(idbuf);
+
 		if (!hasnonzero) {
 			/* The whole indirect block is empty now; free it */
-			sfs_bfree(sfs, idblock);
+			sfs_freebatch_add(&fb, idblock);
 			sv->sv_i.sfi_indirect = 0;
 			sv->sv_dirty = true;
 		}
-		else if (iddirty) {
-			/* The indirect block is dirty; write it back */
-			result = sfs_writeblock(sfs, idblock, idbuf,
-						sizeof(idbuf));
-			if (result) {
-				vfs_biglock_release();
-				return result;
-			}
-		}
+	}
+
+	sfs_freebatch_flush(&fb);
+	return 0;
+}
+
+/*
+ * Called for ftruncate() and from sfs_reclaim.
+ */
+int
+sfs_itrunc(struct sfs_vnode *sv, off_t len)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	int result;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	/* Discard everything past the new length, rounded up to a block */
+	result = sfs_ifree(sv, DIVROUNDUP(len, SFS_FS_BLOCKSIZE(sfs)),
+			   SFS_FILEBLOCKS(sfs));
+	if (result) {
+		return result;
 	}
 
 	/* Set the file size */
@@ -297,7 +442,5 @@ sfs_itrunc(struct sfs_vnode *sv, off_t len)
 	/* Mark the inode dirty */
 	sv->sv_dirty = true;
 
-	vfs_biglock_release();
 	return 0;
 }
-
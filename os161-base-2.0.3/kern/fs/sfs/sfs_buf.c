@@ -0,0 +1,1384 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * SFS filesystem
+ *
+ * Buffer cache.
+ *
+ * Each mounted SFS volume has its own fixed-size pool of block
+ * buffers, with its own lock, hash table and LRU list, so that work
+ * on one volume never waits for I/O to another. Within a pool a
+ * buffer is named by its disk block and found through the hash
+ * table. Buffers nobody holds a reference to sit on the LRU list;
+ * when a buffer for a new block is needed the least recently used one
+ * is recycled, writing it back first if it is dirty.
+ *
+ * All block I/O in SFS goes through here (sfs_readblock and
+ * sfs_writeblock are thin wrappers), so metadata and file data share
+ * the cache and a block is never cached twice. Writes only dirty the
+ * buffer; dirty buffers reach the disk when they are evicted, when
+ * the volume is synced, or when the flusher thread gets to them.
+ *
+ * One flusher thread serves every volume. It wakes up once a second
+ * and, for each volume in turn, writes back buffers that have been
+ * dirty for SFS_FLUSH_AGE seconds or more, plus the oldest ones while
+ * more than SFS_DIRTY_BACKGROUND buffers are dirty. If writers outrun
+ * it and SFS_DIRTY_MAX buffers of a volume become dirty, whoever
+ * releases a dirty buffer does the same work inline. All write-back
+ * (including sync) is done in runs: dirty buffers for consecutive
+ * disk blocks are gathered into a single device request.
+ *
+ * A volume's cache is protected by its bc_lock, the innermost SFS
+ * lock. It is a sleep lock and is held across device I/O, so a block
+ * is never read in twice at once; since it covers only the one
+ * volume, that I/O holds up nobody working elsewhere. A reference to
+ * a buffer does not lock its contents: those belong to whoever owns
+ * the block (the vnode lock of the file, or the freemap lock) and are
+ * used without bc_lock. Should the flusher write a buffer out while
+ * its owner is changing it, the owner's sfs_buf_markdirty afterwards
+ * makes it dirty again.
+ *
+ * The list of caches is protected by sfs_bufcachelock, which comes
+ * before every bc_lock. Only mount, unmount, the flusher and the
+ * statistics take it, and they take one bc_lock at a time under it.
+ *
+ * On a journaled volume, metadata is dirtied with sfs_buf_markmeta
+ * instead. Such a buffer is pinned: it is not written back, evicted
+ * or included in a run until the journal has committed it, after
+ * which sfs_buf_checkpoint turns it back into an ordinary dirty
+ * buffer and writes it home (see sfs_journal.c).
+ *
+ * File data whose disk block hasn't been allocated yet (see
+ * sfs_io.c) is kept in anonymous buffers: buffers taken out of the
+ * volume's pool that belong to no block and stay referenced by their
+ * vnode until it gives them a block. At most SFS_ANON_MAX exist at
+ * once on each volume.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <uio.h>
+#include <clock.h>
+#include <thread.h>
+#include <synch.h>
+#include <vfs.h>
+#include <sfs.h>
+#include <kstat.h>
+#include "sfsprivate.h"
+
+/*
+ * Size of each volume's cache: SFS_BUFBYTES worth of blocks, but no
+ * fewer than SFS_NBUF_MIN buffers however big the blocks are.
+ */
+#define SFS_BUFBYTES   (128 * SFS_BLOCKSIZE)
+#define SFS_NBUF_MIN   32
+
+/* Number of hash chains (prime, so block numbers spread well) */
+#define SFS_BUFHASH    61
+
+/* Write-back policy (see above) */
+#define SFS_FLUSH_AGE          2                   /* seconds */
+#define SFS_DIRTY_BACKGROUND(bc)   ((bc)->bc_nbuf / 4)
+#define SFS_DIRTY_MAX(bc)          ((bc)->bc_nbuf / 2)
+
+/* Longest run of blocks written with one request */
+#define SFS_BUF_MAXRUN         16
+
+/* Most anonymous buffers out at once */
+#define SFS_ANON_MAX(bc)       ((bc)->bc_nbuf / 4)
+
+struct sfs_buf {
+	struct sfs_bufcache *b_cache;   /* pool this buffer belongs to */
+	struct sfs_fs *b_fs;            /* volume, or NULL if not in use */
+	daddr_t b_block;                /* disk block number */
+	unsigned b_refcount;            /* number of holders */
+	bool b_valid;                   /* b_data holds the block contents */
+	bool b_dirty;                   /* b_data newer than the disk */
+	bool b_meta;                    /* dirty metadata, not yet journaled */
+	time_t b_dirtysince;            /* when b_dirty was last set */
+	struct sfs_buf *b_hashnext;     /* hash chain */
+	struct sfs_buf *b_lruprev;      /* LRU list (only if refcount 0) */
+	struct sfs_buf *b_lrunext;
+	char *b_data;                   /* one block (bc_bsize bytes) */
+};
+
+/* Statistics */
+struct sfs_bufstats {
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long prefetches;
+	unsigned long evictions;
+	unsigned long writebacks;
+	unsigned long writeruns;
+	unsigned long flusherwakes;
+	unsigned long direct;
+};
+
+/*
+ * The cache of one volume. Everything but bc_next is protected by
+ * bc_lock.
+ */
+struct sfs_bufcache {
+	struct sfs_fs *bc_fs;           /* volume the cache is for */
+	struct lock *bc_lock;
+	uint32_t bc_bsize;              /* block size of the volume */
+	unsigned bc_nbuf;               /* number of buffers */
+	struct sfs_buf *bc_bufs;        /* the pool, bc_nbuf of them */
+	struct sfs_buf *bc_hash[SFS_BUFHASH];
+
+	/* LRU list: head is the next victim, tail the most recently used */
+	struct sfs_buf *bc_lruhead, *bc_lrutail;
+
+	unsigned bc_ndirty;             /* number of dirty buffers */
+	unsigned bc_nanon;              /* number of anonymous buffers */
+	struct sfs_buf **bc_sorted;     /* scratch for sfs_buf_sync */
+	struct sfs_bufstats bc_stats;
+	struct sfs_bufcache *bc_next;   /* all caches (sfs_bufcachelock) */
+};
+
+/* All the caches; sfs_bufcachelock protects the list and the below */
+static struct lock *sfs_bufcachelock;
+static struct sfs_bufcache *sfs_bufcaches;
+static unsigned sfs_nbufcaches;
+static unsigned sfs_nbufs;
+
+/* Statistics of volumes since unmounted */
+static struct sfs_bufstats sfs_bufretired;
+
+////////////////////////////////////////////////////////////
+//
+// Internal list handling
+
+static
+unsigned
+sfs_buf_hashval(daddr_t block)
+{
+	return block % SFS_BUFHASH;
+}
+
+static
+void
+sfs_lru_remove(struct sfs_bufcache *bc, struct sfs_buf *b)
+{
+	if (b->b_lruprev != NULL) {
+		b->b_lruprev->b_lrunext = b->b_lrunext;
+	}
+	else {
+		bc->bc_lruhead = b->b_lrunext;
+	}
+	if (b->b_lrunext != NULL) {
+		b->b_lrunext->b_lruprev = b->b_lruprev;
+	}
+	else {
+		bc->bc_lrutail = b->b_lruprev;
+	}
+	b->b_lruprev = b->b_lrunext = NULL;
+}
+
+static
+void
+sfs_lru_addtail(struct sfs_bufcache *bc, struct sfs_buf *b)
+{
+	b->b_lrunext = NULL;
+	b->b_lruprev = bc->bc_lrutail;
+	if (bc->bc_lrutail != NULL) {
+		bc->bc_lrutail->b_lrunext = b;
+	}
+	else {
+		bc->bc_lruhead = b;
+	}
+	bc->bc_lrutail = b;
+}
+
+static
+void
+sfs_lru_addhead(struct sfs_bufcache *bc, struct sfs_buf *b)
+{
+	b->b_lruprev = NULL;
+	b->b_lrunext = bc->bc_lruhead;
+	if (bc->bc_lruhead != NULL) {
+		bc->bc_lruhead->b_lruprev = b;
+	}
+	else {
+		bc->bc_lrutail = b;
+	}
+	bc->bc_lruhead = b;
+}
+
+static
+void
+sfs_hash_remove(struct sfs_bufcache *bc, struct sfs_buf *b)
+{
+	struct sfs_buf **pp;
+
+	pp = &bc->bc_hash[sfs_buf_hashval(b->b_block)];
+	while (*pp != b) {
+		KASSERT(*pp != NULL);
+		pp = &(*pp)->b_hashnext;
+	}
+	*pp = b->b_hashnext;
+	b->b_hashnext = NULL;
+}
+
+static
+struct sfs_buf *
+sfs_buf_lookup(struct sfs_bufcache *bc, daddr_t block)
+{
+	struct sfs_buf *b;
+
+	b = bc->bc_hash[sfs_buf_hashval(block)];
+	while (b != NULL) {
+		if (b->b_block == block) {
+			KASSERT(b->b_fs == bc->bc_fs);
+			return b;
+		}
+		b = b->b_hashnext;
+	}
+	return NULL;
+}
+
+/*
+ * Disconnect a buffer from its block, leaving it unused.
+ */
+static
+void
+sfs_buf_disown(struct sfs_buf *b)
+{
+	KASSERT(!b->b_dirty);
+	if (b->b_fs != NULL) {
+		sfs_hash_remove(b->b_cache, b);
+	}
+	b->b_fs = NULL;
+	b->b_block = 0;
+	b->b_valid = false;
+}
+
+/*
+ * Clear a buffer's dirty bit.
+ */
+static
+void
+sfs_buf_clean(struct sfs_buf *b)
+{
+	if (b->b_dirty) {
+		KASSERT(b->b_cache->bc_ndirty > 0);
+		b->b_cache->bc_ndirty--;
+		b->b_dirty = false;
+	}
+	if (b->b_meta) {
+		KASSERT(b->b_fs->sfs_jmetadirty > 0);
+		b->b_fs->sfs_jmetadirty--;
+		b->b_meta = false;
+	}
+}
+
+/*
+ * Can a buffer be written back now?
+ */
+static
+inline
+bool
+sfs_buf_writable(struct sfs_buf *b)
+{
+	return b != NULL && b->b_dirty && !b->b_meta;
+}
+
+/*
+ * Write a dirty buffer to disk, along with any dirty buffers for the
+ * blocks on either side of it, in a single request.
+ */
+static
+int
+sfs_buf_writeout(struct sfs_buf *b)
+{
+	struct sfs_bufcache *bc = b->b_cache;
+	struct sfs_buf *run[SFS_BUF_MAXRUN];
+	struct iovec iov[SFS_BUF_MAXRUN];
+	struct sfs_buf *b2;
+	struct uio ku;
+	daddr_t first;
+	unsigned i, n;
+	int result;
+
+	KASSERT(b->b_valid && sfs_buf_writable(b));
+
+	/* Back up over dirty predecessors */
+	first = b->b_block;
+	n = 1;
+	while (first > 0 && n < SFS_BUF_MAXRUN) {
+		b2 = sfs_buf_lookup(bc, first - 1);
+		if (!sfs_buf_writable(b2)) {
+			break;
+		}
+		first--;
+		n++;
+	}
+
+	/* Gather the run going forward */
+	for (n=0; n<SFS_BUF_MAXRUN; n++) {
+		b2 = sfs_buf_lookup(bc, first + n);
+		if (!sfs_buf_writable(b2)) {
+			break;
+		}
+		KASSERT(b2->b_valid);
+		run[n] = b2;
+		iov[n].iov_kbase = b2->b_data;
+		iov[n].iov_len = bc->bc_bsize;
+	}
+	KASSERT(n > 0);
+
+	ku.uio_iov = iov;
+	ku.uio_iovcnt = n;
+	ku.uio_offset = ((off_t)first) * bc->bc_bsize;
+	ku.uio_resid = n * bc->bc_bsize;
+	ku.uio_segflg = UIO_SYSSPACE;
+	ku.uio_rw = UIO_WRITE;
+	ku.uio_space = NULL;
+	ku.uio_direct = false;
+	ku.uio_advice = POSIX_FADV_NORMAL;
+	result = sfs_rwblock(b->b_fs, &ku);
+	if (result) {
+		return result;
+	}
+
+	for (i=0; i<n; i++) {
+		sfs_buf_clean(run[i]);
+	}
+	bc->bc_stats.writebacks += n;
+	bc->bc_stats.writeruns++;
+	return 0;
+}
+
+/*
+ * Find the writable buffer that has been dirty the longest, or NULL.
+ */
+static
+struct sfs_buf *
+sfs_buf_oldestdirty(struct sfs_bufcache *bc)
+{
+	struct sfs_buf *oldest = NULL;
+	unsigned i;
+
+	for (i=0; i<bc->bc_nbuf; i++) {
+		struct sfs_buf *b = &bc->bc_bufs[i];
+
+		if (sfs_buf_writable(b) &&
+		    (oldest == NULL ||
+		     b->b_dirtysince < oldest->b_dirtysince)) {
+			oldest = b;
+		}
+	}
+	return oldest;
+}
+
+/*
+ * Write back buffers, oldest first, until no more than TARGET are
+ * dirty or only pinned metadata is left. Errors stop the loop; the
+ * buffers stay dirty and will be tried again later.
+ */
+static
+void
+sfs_buf_trim(struct sfs_bufcache *bc, unsigned target)
+{
+	struct sfs_buf *b;
+
+	while (bc->bc_ndirty > target) {
+		b = sfs_buf_oldestdirty(bc);
+		if (b == NULL || sfs_buf_writeout(b)) {
+			return;
+		}
+	}
+}
+
+/*
+ * Write back everything that has been dirty for SFS_FLUSH_AGE seconds
+ * or more.
+ */
+static
+void
+sfs_buf_flushaged(struct sfs_bufcache *bc)
+{
+	struct timespec now;
+	unsigned i;
+
+	gettime_coarse(&now);
+	for (i=0; i<bc->bc_nbuf; i++) {
+		struct sfs_buf *b = &bc->bc_bufs[i];
+
+		if (sfs_buf_writable(b) &&
+		    now.tv_sec - b->b_dirtysince >= SFS_FLUSH_AGE) {
+			if (sfs_buf_writeout(b)) {
+				return;
+			}
+		}
+	}
+}
+
+/*
+ * The flusher thread.
+ */
+static
+void
+sfs_flusher(void *data1, unsigned long data2)
+{
+	struct sfs_bufcache *bc;
+
+	(void)data1;
+	(void)data2;
+
+	while (1) {
+		clocksleep(1);
+
+		lock_acquire(sfs_bufcachelock);
+		for (bc = sfs_bufcaches; bc != NULL; bc = bc->bc_next) {
+			lock_acquire(bc->bc_lock);
+			if (bc->bc_ndirty > 0) {
+				bc->bc_stats.flusherwakes++;
+				sfs_buf_flushaged(bc);
+				sfs_buf_trim(bc, SFS_DIRTY_BACKGROUND(bc));
+			}
+			lock_release(bc->bc_lock);
+		}
+		lock_release(sfs_bufcachelock);
+	}
+}
+
+/*
+ * Take the least recently used unreferenced buffer of BC and attach
+ * it to (SFS, BLOCK), or to nothing if SFS is NULL. The buffer is
+ * returned holding one reference and not yet valid.
+ */
+static
+int
+sfs_buf_recycle(struct sfs_bufcache *bc, struct sfs_fs *sfs, daddr_t block,
+		struct sfs_buf **ret)
+{
+	struct sfs_buf *b;
+	int result;
+
+	KASSERT(sfs == NULL || sfs == bc->bc_fs);
+
+	/* Pinned metadata can't be evicted; pass over it */
+	for (b = bc->bc_lruhead; b != NULL && b->b_meta; b = b->b_lrunext) {
+		/* nothing */
+	}
+	if (b == NULL) {
+		/* Every buffer is in use */
+		return ENOMEM;
+	}
+	KASSERT(b->b_refcount == 0);
+	sfs_lru_remove(bc, b);
+
+	if (b->b_fs != NULL) {
+		if (b->b_dirty) {
+			result = sfs_buf_writeout(b);
+			if (result) {
+				/* Keep it; maybe the error is transient */
+				sfs_lru_addtail(bc, b);
+				return result;
+			}
+		}
+		bc->bc_stats.evictions++;
+		sfs_buf_disown(b);
+	}
+
+	b->b_fs = sfs;
+	b->b_block = block;
+	b->b_refcount = 1;
+	b->b_valid = false;
+	b->b_dirty = false;
+	b->b_meta = false;
+	b->b_hashnext = NULL;
+	if (sfs != NULL) {
+		b->b_hashnext = bc->bc_hash[sfs_buf_hashval(block)];
+		bc->bc_hash[sfs_buf_hashval(block)] = b;
+	}
+
+	*ret = b;
+	return 0;
+}
+
+/*
+ * Drop a reference to a buffer; its cache's bc_lock is held.
+ */
+static
+void
+sfs_buf_drop(struct sfs_buf *b)
+{
+	struct sfs_bufcache *bc = b->b_cache;
+
+	KASSERT(b->b_refcount > 0);
+
+	b->b_refcount--;
+	if (b->b_refcount > 0) {
+		return;
+	}
+
+	/* If the flusher is falling behind, help it out */
+	if (b->b_dirty && bc->bc_ndirty >= SFS_DIRTY_MAX(bc)) {
+		sfs_buf_trim(bc, SFS_DIRTY_BACKGROUND(bc));
+	}
+
+	if (b->b_valid) {
+		sfs_lru_addtail(bc, b);
+	}
+	else {
+		/* Nothing worth keeping; reuse it first */
+		sfs_buf_disown(b);
+		sfs_lru_addhead(bc, b);
+	}
+}
+
+/*
+ * Add the counts in FROM to TO.
+ */
+static
+void
+sfs_bufstats_add(struct sfs_bufstats *to, const struct sfs_bufstats *from)
+{
+	to->hits += from->hits;
+	to->misses += from->misses;
+	to->prefetches += from->prefetches;
+	to->evictions += from->evictions;
+	to->writebacks += from->writebacks;
+	to->writeruns += from->writeruns;
+	to->flusherwakes += from->flusherwakes;
+	to->direct += from->direct;
+}
+
+/*
+ * Free a cache's buffers and the cache itself. It must not be on the
+ * list of caches.
+ */
+static
+void
+sfs_bufcache_destroy(struct sfs_bufcache *bc)
+{
+	unsigned i;
+
+	if (bc->bc_bufs != NULL) {
+		for (i=0; i<bc->bc_nbuf; i++) {
+			kfree(bc->bc_bufs[i].b_data);
+		}
+		kfree(bc->bc_bufs);
+	}
+	kfree(bc->bc_sorted);
+	if (bc->bc_lock != NULL) {
+		lock_destroy(bc->bc_lock);
+	}
+	kfree(bc);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Interface
+
+/*
+ * Set up what the caches share and start the flusher. Called at
+ * mount time, under the big VFS lock; does nothing if it's already
+ * been done.
+ */
+int
+sfs_buf_bootstrap(void)
+{
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (sfs_bufcachelock != NULL) {
+		return 0;
+	}
+
+	sfs_bufcachelock = lock_create("sfs buffer caches");
+	if (sfs_bufcachelock == NULL) {
+		return ENOMEM;
+	}
+
+	result = thread_fork("sfs flusher", NULL, sfs_flusher, NULL, 0);
+	if (result) {
+		/* Not fatal: buffers still get written on eviction and sync */
+		kprintf("sfs: cannot start flusher thread: %s\n",
+			strerror(result));
+	}
+	return 0;
+}
+
+/*
+ * Allocate the buffer pool of a volume being mounted. Undone by
+ * sfs_buf_detach.
+ */
+int
+sfs_buf_attach(struct sfs_fs *sfs)
+{
+	struct sfs_bufcache *bc;
+	unsigned i;
+
+	KASSERT(sfs_bufcachelock != NULL);
+	KASSERT(sfs->sfs_bufcache == NULL);
+
+	bc = kmalloc(sizeof(*bc));
+	if (bc == NULL) {
+		return ENOMEM;
+	}
+	bzero(bc, sizeof(*bc));
+	bc->bc_fs = sfs;
+	bc->bc_bsize = SFS_FS_BLOCKSIZE(sfs);
+	bc->bc_nbuf = SFS_BUFBYTES / bc->bc_bsize;
+	if (bc->bc_nbuf < SFS_NBUF_MIN) {
+		bc->bc_nbuf = SFS_NBUF_MIN;
+	}
+
+	bc->bc_lock = lock_create("sfs buffer cache");
+	if (bc->bc_lock == NULL) {
+		sfs_bufcache_destroy(bc);
+		return ENOMEM;
+	}
+
+	bc->bc_sorted = kmalloc(bc->bc_nbuf * sizeof(struct sfs_buf *));
+	if (bc->bc_sorted == NULL) {
+		sfs_bufcache_destroy(bc);
+		return ENOMEM;
+	}
+
+	bc->bc_bufs = kmalloc(bc->bc_nbuf * sizeof(struct sfs_buf));
+	if (bc->bc_bufs == NULL) {
+		sfs_bufcache_destroy(bc);
+		return ENOMEM;
+	}
+
+	for (i=0; i<bc->bc_nbuf; i++) {
+		struct sfs_buf *b = &bc->bc_bufs[i];
+
+		b->b_data = kmalloc(bc->bc_bsize);
+		if (b->b_data == NULL) {
+			while (i > 0) {
+				i--;
+				kfree(bc->bc_bufs[i].b_data);
+			}
+			kfree(bc->bc_bufs);
+			bc->bc_bufs = NULL;
+			sfs_bufcache_destroy(bc);
+			return ENOMEM;
+		}
+		b->b_cache = bc;
+		b->b_fs = NULL;
+		b->b_block = 0;
+		b->b_refcount = 0;
+		b->b_valid = false;
+		b->b_dirty = false;
+		b->b_meta = false;
+		b->b_hashnext = NULL;
+		sfs_lru_addtail(bc, b);
+	}
+
+	lock_acquire(sfs_bufcachelock);
+	bc->bc_next = sfs_bufcaches;
+	sfs_bufcaches = bc;
+	sfs_nbufcaches++;
+	sfs_nbufs += bc->bc_nbuf;
+	lock_release(sfs_bufcachelock);
+
+	sfs->sfs_bufcache = bc;
+	return 0;
+}
+
+/*
+ * Get the buffer for block BLOCK of volume SFS, with a reference held.
+ *
+ * If FILL is true the buffer is read from disk if not already cached.
+ * If FILL is false the caller intends to overwrite the whole block;
+ * the buffer may come back without valid contents, and the caller
+ * must call sfs_buf_markdirty once the new contents are in place.
+ */
+int
+sfs_buf_get(struct sfs_fs *sfs, daddr_t block, bool fill,
+	    struct sfs_buf **ret)
+{
+	struct sfs_bufcache *bc = sfs->sfs_bufcache;
+	struct sfs_buf *b;
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	KASSERT(bc != NULL);
+
+	lock_acquire(bc->bc_lock);
+
+	b = sfs_buf_lookup(bc, block);
+	if (b != NULL) {
+		if (b->b_refcount == 0) {
+			sfs_lru_remove(bc, b);
+		}
+		b->b_refcount++;
+		if (b->b_valid) {
+			bc->bc_stats.hits++;
+			lock_release(bc->bc_lock);
+			*ret = b;
+			return 0;
+		}
+	}
+	else {
+		result = sfs_buf_recycle(bc, sfs, block, &b);
+		if (result) {
+			lock_release(bc->bc_lock);
+			return result;
+		}
+	}
+
+	bc->bc_stats.misses++;
+	if (fill) {
+		SFSUIO(sfs, &iov, &ku, b->b_data, block, UIO_READ);
+		result = sfs_rwblock(sfs, &ku);
+		if (result) {
+			sfs_buf_drop(b);
+			lock_release(bc->bc_lock);
+			return result;
+		}
+		b->b_valid = true;
+	}
+
+	lock_release(bc->bc_lock);
+	*ret = b;
+	return 0;
+}
+
+/*
+ * Return the data area of a buffer.
+ */
+void *
+sfs_buf_data(struct sfs_buf *b)
+{
+	KASSERT(b->b_refcount > 0);
+	return b->b_data;
+}
+
+/*
+ * Check whether a buffer has valid contents.
+ */
+bool
+sfs_buf_valid(struct sfs_buf *b)
+{
+	return b->b_valid;
+}
+
+/*
+ * Note that the contents of a buffer have been changed.
+ */
+void
+sfs_buf_markdirty(struct sfs_buf *b)
+{
+	struct sfs_bufcache *bc = b->b_cache;
+
+	KASSERT(b->b_refcount > 0);
+
+	lock_acquire(bc->bc_lock);
+	b->b_valid = true;
+	/* Anonymous buffers have nowhere to be written back to */
+	if (!b->b_dirty && b->b_fs != NULL) {
+		struct timespec now;
+
+		gettime_coarse(&now);
+		b->b_dirtysince = now.tv_sec;
+		b->b_dirty = true;
+		bc->bc_ndirty++;
+	}
+	lock_release(bc->bc_lock);
+}
+
+/*
+ * Note that the contents of a metadata buffer have been changed. On
+ * a journaled volume this pins the buffer until the next commit.
+ */
+void
+sfs_buf_markmeta(struct sfs_buf *b)
+{
+	struct sfs_fs *sfs = b->b_fs;
+
+	sfs_buf_markdirty(b);
+	if (sfs->sfs_sb.sb_journalblocks == 0) {
+		return;
+	}
+
+	lock_acquire(b->b_cache->bc_lock);
+	if (!b->b_meta) {
+		b->b_meta = true;
+		sfs->sfs_jmetadirty++;
+	}
+	lock_release(b->b_cache->bc_lock);
+}
+
+/*
+ * Drop a reference to a buffer.
+ */
+void
+sfs_buf_release(struct sfs_buf *b)
+{
+	struct sfs_bufcache *bc = b->b_cache;
+
+	lock_acquire(bc->bc_lock);
+	sfs_buf_drop(b);
+	lock_release(bc->bc_lock);
+}
+
+/*
+ * Take another reference to a buffer the caller already holds.
+ */
+void
+sfs_buf_hold(struct sfs_buf *b)
+{
+	struct sfs_bufcache *bc = b->b_cache;
+
+	lock_acquire(bc->bc_lock);
+	KASSERT(b->b_refcount > 0);
+	b->b_refcount++;
+	lock_release(bc->bc_lock);
+}
+
+/*
+ * Get an anonymous buffer from the pool of SFS, zero-filled, for data
+ * that has no disk block yet. Fails with ENOMEM if too many are out
+ * already, in which case the caller should put the data in its block
+ * right away.
+ */
+int
+sfs_buf_getanon(struct sfs_fs *sfs, struct sfs_buf **ret)
+{
+	struct sfs_bufcache *bc = sfs->sfs_bufcache;
+	struct sfs_buf *b;
+	int result;
+
+	KASSERT(bc != NULL);
+
+	lock_acquire(bc->bc_lock);
+	if (bc->bc_nanon >= SFS_ANON_MAX(bc)) {
+		lock_release(bc->bc_lock);
+		return ENOMEM;
+	}
+	result = sfs_buf_recycle(bc, NULL, 0, &b);
+	if (result) {
+		lock_release(bc->bc_lock);
+		return result;
+	}
+	bc->bc_nanon++;
+	lock_release(bc->bc_lock);
+
+	bzero(b->b_data, bc->bc_bsize);
+	b->b_valid = true;
+	*ret = b;
+	return 0;
+}
+
+/*
+ * Give back an anonymous buffer, dropping its last reference; its
+ * contents are discarded.
+ */
+void
+sfs_buf_putanon(struct sfs_buf *b)
+{
+	struct sfs_bufcache *bc = b->b_cache;
+
+	lock_acquire(bc->bc_lock);
+	KASSERT(b->b_fs == NULL);
+	KASSERT(b->b_refcount == 1);
+	KASSERT(bc->bc_nanon > 0);
+	bc->bc_nanon--;
+	b->b_valid = false;
+	sfs_buf_drop(b);
+	lock_release(bc->bc_lock);
+}
+
+/*
+ * Read NBLOCKS consecutive disk blocks starting at BLOCK into the
+ * cache ahead of need. Blocks already cached are skipped; each run of
+ * uncached blocks is read with a single device request. Failures
+ * are not reported - the blocks will be read on demand instead.
+ */
+void
+sfs_buf_prefetch(struct sfs_fs *sfs, daddr_t block, unsigned nblocks)
+{
+	struct sfs_bufcache *bc = sfs->sfs_bufcache;
+	struct sfs_buf *run[SFS_RA_MAXBLOCKS];
+	struct iovec iov[SFS_RA_MAXBLOCKS];
+	struct uio ku;
+	struct sfs_buf *b;
+	unsigned i, n, j;
+	int result;
+
+	KASSERT(nblocks <= SFS_RA_MAXBLOCKS);
+
+	/* With big blocks the pool is small; don't let this flush it */
+	if (nblocks > bc->bc_nbuf / 4) {
+		nblocks = bc->bc_nbuf / 4;
+	}
+
+	lock_acquire(bc->bc_lock);
+
+	i = 0;
+	while (i < nblocks) {
+		/* Skip anything already here */
+		if (sfs_buf_lookup(bc, block + i) != NULL) {
+			i++;
+			continue;
+		}
+
+		/* Collect a run of uncached blocks */
+		n = 0;
+		while (i + n < nblocks &&
+		       sfs_buf_lookup(bc, block + i + n) == NULL) {
+			if (sfs_buf_recycle(bc, sfs, block + i + n, &b)) {
+				break;
+			}
+			run[n] = b;
+			iov[n].iov_kbase = b->b_data;
+			iov[n].iov_len = bc->bc_bsize;
+			n++;
+		}
+		if (n == 0) {
+			/* Out of buffers */
+			break;
+		}
+
+		ku.uio_iov = iov;
+		ku.uio_iovcnt = n;
+		ku.uio_offset = ((off_t)(block + i)) * bc->bc_bsize;
+		ku.uio_resid = n * bc->bc_bsize;
+		ku.uio_segflg = UIO_SYSSPACE;
+		ku.uio_rw = UIO_READ;
+		ku.uio_space = NULL;
+		ku.uio_direct = false;
+		ku.uio_advice = POSIX_FADV_NORMAL;
+		result = sfs_rwblock(sfs, &ku);
+
+		for (j=0; j<n; j++) {
+			if (result == 0) {
+				run[j]->b_valid = true;
+				bc->bc_stats.prefetches++;
+			}
+			sfs_buf_drop(run[j]);
+		}
+		if (result) {
+			break;
+		}
+		i += n;
+	}
+
+	lock_release(bc->bc_lock);
+}
+
+/*
+ * The N blocks in BLOCKS have been freed; drop their buffers without
+ * writing them back.
+ */
+void
+sfs_buf_forget(struct sfs_fs *sfs, const daddr_t *blocks, unsigned n)
+{
+	struct sfs_bufcache *bc = sfs->sfs_bufcache;
+	struct sfs_buf *b;
+	unsigned i;
+
+	lock_acquire(bc->bc_lock);
+
+	for (i=0; i<n; i++) {
+		b = sfs_buf_lookup(bc, blocks[i]);
+		if (b == NULL) {
+			continue;
+		}
+		sfs_buf_clean(b);
+		if (b->b_refcount == 0) {
+			sfs_lru_remove(bc, b);
+			sfs_buf_disown(b);
+			sfs_lru_addhead(bc, b);
+		}
+	}
+
+	lock_release(bc->bc_lock);
+}
+
+/*
+ * The N blocks in BLOCKS won't be needed again soon: move those of
+ * their buffers nobody is using to the front of the LRU list, so they
+ * are reused first. Dirty ones are written back when that happens,
+ * as usual; pinned metadata stays where it is.
+ */
+void
+sfs_buf_demote(struct sfs_fs *sfs, const daddr_t *blocks, unsigned n)
+{
+	struct sfs_bufcache *bc = sfs->sfs_bufcache;
+	struct sfs_buf *b;
+	unsigned i;
+
+	lock_acquire(bc->bc_lock);
+
+	for (i=0; i<n; i++) {
+		b = sfs_buf_lookup(bc, blocks[i]);
+		if (b == NULL || b->b_refcount > 0 || b->b_meta) {
+			continue;
+		}
+		sfs_lru_remove(bc, b);
+		sfs_lru_addhead(bc, b);
+	}
+
+	lock_release(bc->bc_lock);
+}
+
+/*
+ * Get the cache out of the way of O_DIRECT I/O to the NBLOCKS disk
+ * blocks starting at BLOCK, which is about to go straight between
+ * the device and a user buffer. Before a read, dirty buffers in the
+ * range are written back so that the disk is current; before a
+ * write, buffers in the range are dropped, dirty or not, since the
+ * write replaces them. The caller holds the lock of the vnode the
+ * blocks belong to, so nothing brings them back in meanwhile, and
+ * does the I/O after this returns: bc_lock can't be held while user
+ * memory is touched, as a page fault may need the cache.
+ */
+int
+sfs_buf_direct(struct sfs_fs *sfs, daddr_t block, unsigned nblocks,
+	       enum uio_rw rw)
+{
+	struct sfs_bufcache *bc = sfs->sfs_bufcache;
+	struct sfs_buf *b;
+	unsigned i;
+	int result;
+
+	lock_acquire(bc->bc_lock);
+
+	for (i=0; i<nblocks; i++) {
+		b = sfs_buf_lookup(bc, block + i);
+		if (b == NULL) {
+			continue;
+		}
+		if (rw == UIO_READ) {
+			if (sfs_buf_writable(b)) {
+				result = sfs_buf_writeout(b);
+				if (result) {
+					lock_release(bc->bc_lock);
+					return result;
+				}
+			}
+			continue;
+		}
+		sfs_buf_clean(b);
+		if (b->b_refcount == 0) {
+			sfs_lru_remove(bc, b);
+			sfs_buf_disown(b);
+			sfs_lru_addhead(bc, b);
+		}
+		else {
+			/* Disowned when the last holder lets go */
+			b->b_valid = false;
+		}
+	}
+	bc->bc_stats.direct += nblocks;
+
+	lock_release(bc->bc_lock);
+	return 0;
+}
+
+/*
+ * Collect up to MAX pinned metadata buffers of SFS into BUFS, sorted
+ * by block, taking a reference to each; their block numbers go in
+ * BLOCKS. Returns how many there were. For the journal commit; the
+ * caller has made sure nobody is changing metadata meanwhile.
+ */
+unsigned
+sfs_buf_getmeta(struct sfs_fs *sfs, struct sfs_buf **bufs, daddr_t *blocks,
+		unsigned max)
+{
+	struct sfs_bufcache *bc = sfs->sfs_bufcache;
+	struct sfs_buf *b;
+	unsigned i, j, n;
+
+	lock_acquire(bc->bc_lock);
+	n = 0;
+	for (i=0; i<bc->bc_nbuf; i++) {
+		b = &bc->bc_bufs[i];
+		if (b->b_fs != sfs || !b->b_meta) {
+			continue;
+		}
+		if (n == max) {
+			if (bufs[n-1]->b_block < b->b_block) {
+				continue;
+			}
+			/* Bump the highest; it goes in the next batch */
+			n--;
+		}
+		KASSERT(b->b_valid && b->b_dirty);
+		for (j = n; j > 0 && bufs[j-1]->b_block > b->b_block; j--) {
+			bufs[j] = bufs[j-1];
+		}
+		bufs[j] = b;
+		n++;
+	}
+	for (i=0; i<n; i++) {
+		if (bufs[i]->b_refcount == 0) {
+			sfs_lru_remove(bc, bufs[i]);
+		}
+		bufs[i]->b_refcount++;
+		blocks[i] = bufs[i]->b_block;
+	}
+	lock_release(bc->bc_lock);
+	return n;
+}
+
+/*
+ * The N buffers from sfs_buf_getmeta are safely in the journal:
+ * unpin them, write them to their home locations, and drop the
+ * references. Whatever can't be written stays dirty for the flusher.
+ */
+int
+sfs_buf_checkpoint(struct sfs_buf **bufs, unsigned n)
+{
+	struct sfs_bufcache *bc;
+	unsigned i;
+	int result = 0;
+
+	if (n == 0) {
+		return 0;
+	}
+	/* They all come from one volume */
+	bc = bufs[0]->b_cache;
+
+	lock_acquire(bc->bc_lock);
+	for (i=0; i<n; i++) {
+		KASSERT(bufs[i]->b_cache == bc);
+		KASSERT(bufs[i]->b_meta);
+		bufs[i]->b_meta = false;
+		bufs[i]->b_fs->sfs_jmetadirty--;
+	}
+	for (i=0; i<n; i++) {
+		if (result == 0 && sfs_buf_writable(bufs[i])) {
+			result = sfs_buf_writeout(bufs[i]);
+		}
+		sfs_buf_drop(bufs[i]);
+	}
+	lock_release(bc->bc_lock);
+	return result;
+}
+
+/*
+ * Write back every dirty buffer belonging to SFS. The buffers are
+ * written in ascending block order, so the disk sweeps across the
+ * volume once and neighbouring blocks (inodes allocated near each
+ * other, the superblock and the freemap) go out as single runs.
+ */
+int
+sfs_buf_sync(struct sfs_fs *sfs)
+{
+	struct sfs_bufcache *bc = sfs->sfs_bufcache;
+	struct sfs_buf **dirty;
+	struct sfs_buf *b;
+	unsigned i, j, n;
+	int result;
+
+	if (bc == NULL) {
+		return 0;
+	}
+
+	lock_acquire(bc->bc_lock);
+	dirty = bc->bc_sorted;
+
+	/* Gather the dirty buffers, sorted by block (insertion sort) */
+	n = 0;
+	for (i=0; i<bc->bc_nbuf; i++) {
+		b = &bc->bc_bufs[i];
+		if (b->b_fs != sfs || !sfs_buf_writable(b)) {
+			continue;
+		}
+		for (j = n; j > 0 && dirty[j-1]->b_block > b->b_block; j--) {
+			dirty[j] = dirty[j-1];
+		}
+		dirty[j] = b;
+		n++;
+	}
+
+	/* Writing one out also cleans the rest of its run */
+	for (i=0; i<n; i++) {
+		if (sfs_buf_writable(dirty[i])) {
+			result = sfs_buf_writeout(dirty[i]);
+			if (result) {
+				lock_release(bc->bc_lock);
+				return result;
+			}
+		}
+	}
+	lock_release(bc->bc_lock);
+	return 0;
+}
+
+/*
+ * Free the buffer pool of SFS; the volume is going away. It must have
+ * been synced already.
+ */
+void
+sfs_buf_detach(struct sfs_fs *sfs)
+{
+	struct sfs_bufcache *bc = sfs->sfs_bufcache;
+	struct sfs_bufcache **pp;
+	unsigned i;
+
+	if (bc == NULL) {
+		return;
+	}
+
+	/* Once off the list the flusher can't find it */
+	lock_acquire(sfs_bufcachelock);
+	for (pp = &sfs_bufcaches; *pp != bc; pp = &(*pp)->bc_next) {
+		KASSERT(*pp != NULL);
+	}
+	*pp = bc->bc_next;
+	sfs_nbufcaches--;
+	sfs_nbufs -= bc->bc_nbuf;
+	sfs_bufstats_add(&sfs_bufretired, &bc->bc_stats);
+	lock_release(sfs_bufcachelock);
+
+	KASSERT(bc->bc_nanon == 0);
+	for (i=0; i<bc->bc_nbuf; i++) {
+		struct sfs_buf *b = &bc->bc_bufs[i];
+
+		KASSERT(b->b_refcount == 0);
+		KASSERT(!b->b_meta);
+		KASSERT(!b->b_dirty);
+	}
+	sfs->sfs_bufcache = NULL;
+	sfs_bufcache_destroy(bc);
+}
+
+/*
+ * Count the buffers of BC that are in use, dirty, pinned, and held;
+ * bc_lock is held.
+ */
+static
+void
+sfs_bufcache_count(struct sfs_bufcache *bc, unsigned *used, unsigned *dirty,
+		   unsigned *pinned, unsigned *busy)
+{
+	unsigned i;
+
+	for (i=0; i<bc->bc_nbuf; i++) {
+		if (bc->bc_bufs[i].b_fs != NULL) {
+			(*used)++;
+		}
+		if (bc->bc_bufs[i].b_dirty) {
+			(*dirty)++;
+		}
+		if (bc->bc_bufs[i].b_meta) {
+			(*pinned)++;
+		}
+		if (bc->bc_bufs[i].b_refcount > 0) {
+			(*busy)++;
+		}
+	}
+}
+
+/*
+ * Print buffer cache statistics, totalled over all volumes (the
+ * counters include volumes since unmounted).
+ */
+void
+sfs_buf_printstats(void)
+{
+	struct sfs_bufcache *bc;
+	struct sfs_bufstats st;
+	unsigned used = 0, dirty = 0, pinned = 0, busy = 0, nanon = 0;
+	unsigned long lookups;
+
+	if (sfs_bufcachelock == NULL) {
+		kprintf("sfs buffer cache: not set up yet\n");
+		return;
+	}
+
+	lock_acquire(sfs_bufcachelock);
+
+	st = sfs_bufretired;
+	for (bc = sfs_bufcaches; bc != NULL; bc = bc->bc_next) {
+		lock_acquire(bc->bc_lock);
+		sfs_bufcache_count(bc, &used, &dirty, &pinned, &busy);
+		nanon += bc->bc_nanon;
+		sfs_bufstats_add(&st, &bc->bc_stats);
+		lock_release(bc->bc_lock);
+	}
+	lookups = st.hits + st.misses;
+
+	kprintf("sfs buffer cache: %u volumes, %u buffers\n",
+		sfs_nbufcaches, sfs_nbufs);
+	kprintf("    %u in use, %u dirty (%u awaiting the journal), "
+		"%u busy\n", used, dirty, pinned, busy);
+	kprintf("    %u holding data with no disk block yet\n", nanon);
+	kprintf("    %lu hits, %lu misses (%lu%% hit rate)\n",
+		st.hits, st.misses, lookups ? st.hits * 100 / lookups : 0);
+	kprintf("    %lu blocks read ahead, %lu evictions, "
+		"%lu blocks written back\n", st.prefetches,
+		st.evictions, st.writebacks);
+	kprintf("    %lu write requests, %lu flusher passes\n",
+		st.writeruns, st.flusherwakes);
+	kprintf("    %lu blocks moved with O_DIRECT\n", st.direct);
+
+	lock_release(sfs_bufcachelock);
+}
+
+/*
+ * The same, for kstat (sfs.buf.*).
+ */
+void
+sfs_buf_kstat(struct kstat *ks)
+{
+	struct sfs_bufcache *bc;
+	struct sfs_bufstats st;
+	unsigned used = 0, dirty = 0, pinned = 0, busy = 0;
+
+	if (sfs_bufcachelock == NULL) {
+		return;
+	}
+
+	lock_acquire(sfs_bufcachelock);
+
+	st = sfs_bufretired;
+	for (bc = sfs_bufcaches; bc != NULL; bc = bc->bc_next) {
+		lock_acquire(bc->bc_lock);
+		sfs_bufcache_count(bc, &used, &dirty, &pinned, &busy);
+		sfs_bufstats_add(&st, &bc->bc_stats);
+		lock_release(bc->bc_lock);
+	}
+	kstat_put(ks, sfs_nbufcaches, "sfs.buf.volumes");
+	kstat_put(ks, sfs_nbufs, "sfs.buf.buffers");
+	kstat_put(ks, used, "sfs.buf.used");
+	kstat_put(ks, dirty, "sfs.buf.dirty");
+	kstat_put(ks, st.hits, "sfs.buf.hits");
+	kstat_put(ks, st.misses, "sfs.buf.misses");
+	kstat_put(ks, st.prefetches, "sfs.buf.prefetches");
+	kstat_put(ks, st.evictions, "sfs.buf.evictions");
+	kstat_put(ks, st.writebacks, "sfs.buf.writebacks");
+	kstat_put(ks, st.writeruns, "sfs.buf.writeruns");
+	kstat_put(ks, st.direct, "sfs.buf.direct");
+
+	lock_release(sfs_bufcachelock);
+}
@@ -34,11 +34,21 @@
  */
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/dirent.h>
 #include <lib.h>
+#include <uio.h>
 #include <vfs.h>
+#include <vnode.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
+/*
+ * Directory entries per smallest block. Entries never cross a block
+ * boundary, and every block size is a multiple of this, so reading
+ * this many at a time never crosses one either.
+ */
+#define SFS_DIRPERBLOCK	(SFS_BLOCKSIZE / sizeof(struct sfs_direntry))
+
 /*
  * Read the directory entry out of slot SLOT of a directory vnode.
  * The "slot" is the index of the directory entry, starting at 0.
@@ -95,6 +105,301 @@ sfs_dir_nentries(struct sfs_vnode *sv)
 	return size / sizeof(struct sfs_direntry);
 }
 
+/*
+ * Directory name index.
+ *
+ * Looking a name up in a directory means reading every slot, and so
+ * does creating one (to make sure it doesn't exist yet). For large
+ * directories we therefore keep an in-memory hash index from name to
+ * slot, built by one scan of the directory the first time it is
+ * searched and kept up to date by sfs_dir_link and sfs_dir_unlink.
+ * Only the hash of each name is kept; a candidate slot is read back
+ * through the buffer cache to compare the name itself. The empty
+ * slots are kept on a list so linking doesn't need a scan either.
+ * Nothing about the index is stored on disk.
+ *
+ * Chains and the free list are threaded through dh_next, which is
+ * indexed by slot. The index may be dropped at any time (e.g. when
+ * it can't grow for lack of memory); the directory is then searched
+ * linearly until the index is rebuilt. It is protected by the
+ * directory's sv_lock.
+ */
+
+/* Directories with fewer slots than this are just scanned */
+#define SFS_DIRHASH_MINSLOTS	32
+
+struct sfs_dirhash {
+	unsigned dh_nslots;	/* slots in the directory */
+	unsigned dh_maxslots;	/* slots dh_next and dh_hash can hold */
+	unsigned dh_nbuckets;	/* number of chains; a power of 2 */
+	int *dh_buckets;	/* first slot on each chain, or -1 */
+	int *dh_next;		/* next slot on the same chain/free list */
+	uint32_t *dh_hash;	/* hash of the name in each used slot */
+	int dh_free;		/* first empty slot, or -1 */
+};
+
+/*
+ * Hash function for names (FNV-1a).
+ */
+static
+uint32_t
+sfs_dirhash_name(const char *name)
+{
+	uint32_t h = 2166136261U;
+
+	while (*name) {
+		h ^= (unsigned char)*name++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static
+void
+sfs_dirhash_destroy(struct sfs_dirhash *dh)
+{
+	kfree(dh->dh_buckets);
+	kfree(dh->dh_next);
+	kfree(dh->dh_hash);
+	kfree(dh);
+}
+
+/*
+ * Make room for MAXSLOTS slots and rehash. Leaves the index
+ * untouched on failure.
+ */
+static
+int
+sfs_dirhash_resize(struct sfs_dirhash *dh, unsigned maxslots)
+{
+	unsigned nbuckets, i;
+	int *buckets, *next;
+	uint32_t *hash;
+	int slot, nextslot;
+
+	KASSERT(maxslots >= dh->dh_nslots);
+
+	nbuckets = 1;
+	while (nbuckets < maxslots) {
+		nbuckets *= 2;
+	}
+
+	buckets = kmalloc(nbuckets * sizeof(int));
+	next = kmalloc(maxslots * sizeof(int));
+	hash = kmalloc(maxslots * sizeof(uint32_t));
+	if (buckets == NULL || next == NULL || hash == NULL) {
+		kfree(buckets);
+		kfree(next);
+		kfree(hash);
+		return ENOMEM;
+	}
+	for (i=0; i<nbuckets; i++) {
+		buckets[i] = -1;
+	}
+	if (dh->dh_nslots > 0) {
+		/* This carries the free list over as is */
+		memcpy(next, dh->dh_next, dh->dh_nslots * sizeof(int));
+		memcpy(hash, dh->dh_hash, dh->dh_nslots * sizeof(uint32_t));
+	}
+
+	/* Move each used slot to its new chain */
+	for (i=0; i<dh->dh_nbuckets; i++) {
+		for (slot = dh->dh_buckets[i]; slot >= 0; slot = nextslot) {
+			nextslot = dh->dh_next[slot];
+			next[slot] = buckets[hash[slot] & (nbuckets - 1)];
+			buckets[hash[slot] & (nbuckets - 1)] = slot;
+		}
+	}
+
+	kfree(dh->dh_buckets);
+	kfree(dh->dh_next);
+	kfree(dh->dh_hash);
+	dh->dh_buckets = buckets;
+	dh->dh_next = next;
+	dh->dh_hash = hash;
+	dh->dh_nbuckets = nbuckets;
+	dh->dh_maxslots = maxslots;
+	return 0;
+}
+
+/*
+ * Enter the name with hash HASH in the index at SLOT, which must be
+ * empty or just past the end of the directory.
+ */
+static
+int
+sfs_dirhash_add(struct sfs_dirhash *dh, int slot, uint32_t hash)
+{
+	unsigned bucket;
+	int *pp;
+	int result;
+
+	KASSERT(slot >= 0 && (unsigned)slot <= dh->dh_nslots);
+
+	if ((unsigned)slot == dh->dh_nslots) {
+		if (dh->dh_nslots == dh->dh_maxslots) {
+			result = sfs_dirhash_resize(dh, dh->dh_maxslots * 2);
+			if (result) {
+				return result;
+			}
+		}
+		dh->dh_nslots++;
+	}
+	else {
+		/* Take the slot off the free list */
+		pp = &dh->dh_free;
+		while (*pp != slot) {
+			KASSERT(*pp >= 0);
+			pp = &dh->dh_next[*pp];
+		}
+		*pp = dh->dh_next[slot];
+	}
+
+	bucket = hash & (dh->dh_nbuckets - 1);
+	dh->dh_hash[slot] = hash;
+	dh->dh_next[slot] = dh->dh_buckets[bucket];
+	dh->dh_buckets[bucket] = slot;
+	return 0;
+}
+
+/*
+ * Remove the name in SLOT from the index and put the slot on the
+ * free list.
+ */
+static
+void
+sfs_dirhash_remove(struct sfs_dirhash *dh, int slot)
+{
+	int *pp;
+
+	KASSERT(slot >= 0 && (unsigned)slot < dh->dh_nslots);
+
+	pp = &dh->dh_buckets[dh->dh_hash[slot] & (dh->dh_nbuckets - 1)];
+	while (*pp != slot) {
+		KASSERT(*pp >= 0);
+		pp = &dh->dh_next[*pp];
+	}
+	*pp = dh->dh_next[slot];
+
+	dh->dh_next[slot] = dh->dh_free;
+	dh->dh_free = slot;
+}
+
+/*
+ * Build the index for a directory, if it's big enough to want one.
+ */
+static
+int
+sfs_dirhash_build(struct sfs_vnode *sv)
+{
+	struct sfs_dirhash *dh;
+	struct sfs_direntry tsd;
+	int nentries, i, result;
+
+	KASSERT(sv->sv_dirhash == NULL);
+
+	nentries = sfs_dir_nentries(sv);
+	if (nentries < SFS_DIRHASH_MINSLOTS) {
+		return 0;
+	}
+
+	dh = kmalloc(sizeof(*dh));
+	if (dh == NULL) {
+		return ENOMEM;
+	}
+	dh->dh_nslots = 0;
+	dh->dh_maxslots = 0;
+	dh->dh_nbuckets = 0;
+	dh->dh_buckets = NULL;
+	dh->dh_next = NULL;
+	dh->dh_hash = NULL;
+	dh->dh_free = -1;
+
+	result = sfs_dirhash_resize(dh, 2 * nentries);
+	if (result) {
+		sfs_dirhash_destroy(dh);
+		return result;
+	}
+
+	for (i=0; i<nentries; i++) {
+		result = sfs_readdir(sv, i, &tsd);
+		if (result) {
+			sfs_dirhash_destroy(dh);
+			return result;
+		}
+		if (tsd.sfd_ino == SFS_NOINO) {
+			/* Counts as appended, then freed */
+			dh->dh_nslots++;
+			dh->dh_next[i] = dh->dh_free;
+			dh->dh_free = i;
+			continue;
+		}
+		tsd.sfd_name[sizeof(tsd.sfd_name)-1] = 0;
+		/* Can't fail: there's room for 2*nentries slots */
+		result = sfs_dirhash_add(dh, i, sfs_dirhash_name(tsd.sfd_name));
+		KASSERT(result == 0);
+	}
+
+	sv->sv_dirhash = dh;
+	return 0;
+}
+
+/*
+ * Throw away a directory's index, if it has one.
+ */
+void
+sfs_dir_dropindex(struct sfs_vnode *sv)
+{
+	if (sv->sv_dirhash != NULL) {
+		sfs_dirhash_destroy(sv->sv_dirhash);
+		sv->sv_dirhash = NULL;
+	}
+}
+
+/*
+ * Look up NAME using the index.
+ */
+static
+int
+sfs_dirhash_findname(struct sfs_vnode *sv, const char *name,
+		     uint32_t *ino, int *slot, int *emptyslot)
+{
+	struct sfs_dirhash *dh = sv->sv_dirhash;
+	struct sfs_direntry tsd;
+	uint32_t hash;
+	int i, result;
+
+	KASSERT(dh->dh_nslots == (unsigned)sfs_dir_nentries(sv));
+
+	if (emptyslot != NULL && dh->dh_free >= 0) {
+		*emptyslot = dh->dh_free;
+	}
+
+	hash = sfs_dirhash_name(name);
+	for (i = dh->dh_buckets[hash & (dh->dh_nbuckets - 1)];
+	     i >= 0; i = dh->dh_next[i]) {
+		if (dh->dh_hash[i] != hash) {
+			continue;
+		}
+		result = sfs_readdir(sv, i, &tsd);
+		if (result) {
+			return result;
+		}
+		KASSERT(tsd.sfd_ino != SFS_NOINO);
+		tsd.sfd_name[sizeof(tsd.sfd_name)-1] = 0;
+		if (!strcmp(tsd.sfd_name, name)) {
+			if (slot != NULL) {
+				*slot = i;
+			}
+			if (ino != NULL) {
+				*ino = tsd.sfd_ino;
+			}
+			return 0;
+		}
+	}
+	return ENOENT;
+}
+
 /*
  * Search a directory for a particular filename in a directory, and
  * return its inode number, its slot, and/or the slot number of an
@@ -107,6 +412,14 @@ sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 	struct sfs_direntry tsd;
 	int found, nentries, i, result;
 
+	if (sv->sv_dirhash == NULL) {
+		/* If this fails we can still do it the slow way */
+		(void)sfs_dirhash_build(sv);
+	}
+	if (sv->sv_dirhash != NULL) {
+		return sfs_dirhash_findname(sv, name, ino, slot, emptyslot);
+	}
+
 	nentries = sfs_dir_nentries(sv);
 
 	/* For each slot... */
@@ -146,6 +459,69 @@ sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 	return found ? 0 : ENOENT;
 }
 
+/*
+ * Read as many entries as fit into UIO, for VOP_GETDIRENTS, starting
+ * at slot number uio_offset. The slots are read SFS_DIRPERBLOCK at a
+ * time. There are no subdirectories, so everything listed other than
+ * the directory itself is a file.
+ */
+int
+sfs_dir_getdirents(struct sfs_vnode *sv, struct uio *uio)
+{
+	struct sfs_direntry sds[SFS_DIRPERBLOCK];
+	int nentries, start, slot, n, i, result;
+	unsigned type;
+
+	KASSERT(uio->uio_offset >= 0);
+	if (uio->uio_offset >= 0x7fffffff) {
+		return 0;
+	}
+	start = uio->uio_offset;
+
+	nentries = sfs_dir_nentries(sv);
+	result = 0;
+	for (slot = start; slot < nentries; slot += n) {
+
+		/* Up to the end of the block SLOT is in */
+		n = SFS_DIRPERBLOCK - slot % SFS_DIRPERBLOCK;
+		if (n > nentries - slot) {
+			n = nentries - slot;
+		}
+		result = sfs_metaio(sv, slot * sizeof(struct sfs_direntry),
+				    sds, n * sizeof(struct sfs_direntry),
+				    UIO_READ);
+		if (result) {
+			break;
+		}
+
+		for (i=0; i<n; i++) {
+			if (sds[i].sfd_ino == SFS_NOINO) {
+				continue;
+			}
+			sds[i].sfd_name[sizeof(sds[i].sfd_name)-1] = 0;
+			type = sds[i].sfd_ino == sv->sv_ino ? DT_DIR : DT_REG;
+			result = vnode_putdirent(uio, sds[i].sfd_ino, type,
+						 sds[i].sfd_name);
+			if (result) {
+				break;
+			}
+		}
+		if (result) {
+			/* Start from the one that didn't go in next time */
+			slot += i;
+			break;
+		}
+	}
+
+	if (result == ENOSPC) {
+		/* Full; but if nothing went in, the buffer's too small */
+		result = (slot == start) ? EINVAL : 0;
+	}
+	/* uiomove counted bytes; the offset is the next slot */
+	uio->uio_offset = slot;
+	return result;
+}
+
 /*
  * Create a link in a directory to the specified inode by number, with
  * the specified name, and optionally hand back the slot.
@@ -186,7 +562,15 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 	}
 
 	/* Write the entry. */
-	return sfs_writedir(sv, emptyslot, &sd);
+	result = sfs_writedir(sv, emptyslot, &sd);
+
+	/* Update the index; if it can't be, stop using it */
+	if (sv->sv_dirhash != NULL && (result ||
+	    sfs_dirhash_add(sv->sv_dirhash, emptyslot,
+			    sfs_dirhash_name(name)))) {
+		sfs_dir_dropindex(sv);
+	}
+	return result;
 }
 
 /*
@@ -196,13 +580,24 @@ int
 sfs_dir_unlink(struct sfs_vnode *sv, int slot)
 {
 	struct sfs_direntry sd;
+	int result;
 
 	/* Initialize a suitable directory entry... */
 	bzero(&sd, sizeof(sd));
 	sd.sfd_ino = SFS_NOINO;
 
 	/* ... and write it */
-	return sfs_writedir(sv, slot, &sd);
+	result = sfs_writedir(sv, slot, &sd);
+
+	if (sv->sv_dirhash != NULL) {
+		if (result) {
+			sfs_dir_dropindex(sv);
+		}
+		else {
+			sfs_dirhash_remove(sv->sv_dirhash, slot);
+		}
+	}
+	return result;
 }
 
 /*
@@ -39,6 +39,7 @@
 #include <array.h>
 #include <bitmap.h>
 #include <uio.h>
+#include <synch.h>
 #include <vfs.h>
 #include <device.h>
 #include <sfs.h>
@@ -47,18 +48,21 @@
 
 /* Shortcuts for the size macros in kern/sfs.h */
 #define SFS_FS_NBLOCKS(sfs)        ((sfs)->sfs_sb.sb_nblocks)
-#define SFS_FS_FREEMAPBITS(sfs)    SFS_FREEMAPBITS(SFS_FS_NBLOCKS(sfs))
-#define SFS_FS_FREEMAPBLOCKS(sfs)  SFS_FREEMAPBLOCKS(SFS_FS_NBLOCKS(sfs))
+#define SFS_FS_FREEMAPBITS(sfs) \
+	SFS_FREEMAPBITS(SFS_FS_NBLOCKS(sfs), SFS_FS_BLOCKSIZE(sfs))
+#define SFS_FS_FREEMAPBLOCKS(sfs) \
+	SFS_FREEMAPBLOCKS(SFS_FS_NBLOCKS(sfs), SFS_FS_BLOCKSIZE(sfs))
 
 /*
  * Routine for doing I/O (reads or writes) on the free block bitmap.
  * We always do the whole bitmap at once; writing individual sectors
  * might or might not be a worthwhile optimization.
  *
- * The free block bitmap consists of SFS_FREEMAPBLOCKS 512-byte
- * sectors of bits, one bit for each sector on the filesystem. The
- * number of blocks in the bitmap is thus rounded up to the nearest
- * multiple of 512*8 = 4096. (This rounded number is SFS_FREEMAPBITS.)
+ * The free block bitmap consists of SFS_FREEMAPBLOCKS blocks of
+ * bits, one bit for each block on the filesystem. The number of
+ * blocks in the bitmap is thus rounded up to the nearest multiple of
+ * the bits in a block, 4096 for 512-byte blocks. (This rounded number
+ * is SFS_FREEMAPBITS.)
  * This means that the bitmap will (in general) contain space for some
  * number of invalid sectors that are actually beyond the end of the
  * disk device. This is ok. These sectors are supposed to be marked
@@ -85,16 +89,16 @@ sfs_freemapio(struct sfs_fs *sfs, enum uio_rw rw)
 	for (j=0; j<freemapblocks; j++) {
 
 		/* Get a pointer to its data */
-		void *ptr = freemapdata + j*SFS_BLOCKSIZE;
+		void *ptr = freemapdata + j*SFS_FS_BLOCKSIZE(sfs);
 
 		/* and read or write it. The freemap starts at sector 2. */
 		if (rw == UIO_READ) {
 			result = sfs_readblock(sfs, SFS_FREEMAP_START+j, ptr,
-					       SFS_BLOCKSIZE);
+					       SFS_FS_BLOCKSIZE(sfs));
 		}
 		else {
-			result = sfs_writeblock(sfs, SFS_FREEMAP_START+j, ptr,
-						SFS_BLOCKSIZE);
+			result = sfs_writemeta(sfs, SFS_FREEMAP_START+j, ptr,
+						SFS_FS_BLOCKSIZE(sfs));
 		}
 
 		/* If we failed, stop. */
@@ -107,20 +111,55 @@ sfs_freemapio(struct sfs_fs *sfs, enum uio_rw rw)
 
 /*
  * Sync routine for the vnode table.
+ *
+ * This only copies dirty inodes into the buffer cache; sfs_sync
+ * writes them out afterwards together with everything else, sorted
+ * by block, rather than flushing the cache once per vnode as
+ * VOP_FSYNC would.
+ *
+ * The vnode lock comes before sfs_vnlock, so grab a reference to
+ * everything in the table first and sync with the table unlocked.
  */
 static
 int
 sfs_sync_vnodes(struct sfs_fs *sfs)
 {
+	struct vnode **vns;
+	struct sfs_vnode *sv;
 	unsigned i, num;
+	int result, ret;
 
-	/* Go over the array of loaded vnodes, syncing as we go. */
+	lock_acquire(sfs->sfs_vnlock);
 	num = vnodearray_num(sfs->sfs_vnodes);
+	if (num == 0) {
+		lock_release(sfs->sfs_vnlock);
+		return 0;
+	}
+	vns = kmalloc(num * sizeof(*vns));
+	if (vns == NULL) {
+		lock_release(sfs->sfs_vnlock);
+		return ENOMEM;
+	}
 	for (i=0; i<num; i++) {
-		struct vnode *v = vnodearray_get(sfs->sfs_vnodes, i);
-		VOP_FSYNC(v);
+		vns[i] = vnodearray_get(sfs->sfs_vnodes, i);
+		VOP_INCREF(vns[i]);
 	}
-	return 0;
+	lock_release(sfs->sfs_vnlock);
+
+	/* Go over the loaded vnodes; keep going past errors. */
+	ret = 0;
+	for (i=0; i<num; i++) {
+		sv = vns[i]->vn_data;
+		lock_acquire(sv->sv_lock);
+		result = sfs_sync_inode(sv);
+		lock_release(sv->sv_lock);
+		if (result && ret == 0) {
+			ret = result;
+		}
+		VOP_DECREF(vns[i]);
+	}
+	kfree(vns);
+	return ret;
 }
 
 /*
@@ -132,13 +171,16 @@ sfs_sync_freemap(struct sfs_fs *sfs)
 {
 	int result;
 
+	lock_acquire(sfs->sfs_freemaplock);
 	if (sfs->sfs_freemapdirty) {
 		result = sfs_freemapio(sfs, UIO_WRITE);
 		if (result) {
+			lock_release(sfs->sfs_freemaplock);
 			return result;
 		}
 		sfs->sfs_freemapdirty = false;
 	}
+	lock_release(sfs->sfs_freemaplock);
 
 	return 0;
 }
@@ -152,17 +194,69 @@ sfs_sync_superblock(struct sfs_fs *sfs)
 {
 	int result;
 
+	lock_acquire(sfs->sfs_freemaplock);
 	if (sfs->sfs_superdirty) {
-		result = sfs_writeblock(sfs, SFS_SUPER_BLOCK, &sfs->sfs_sb,
+		result = sfs_writemeta(sfs, SFS_SUPER_BLOCK, &sfs->sfs_sb,
 					sizeof(sfs->sfs_sb));
 		if (result) {
+			lock_release(sfs->sfs_freemaplock);
 			return result;
 		}
 		sfs->sfs_superdirty = false;
 	}
+	lock_release(sfs->sfs_freemaplock);
 	return 0;
 }
 
+/*
+ * Set the superblock's clean flag and get it to disk now, along with
+ * anything else dirty. This bypasses the journal: it is only done
+ * when nothing else is in flight (at mount, and at unmount after the
+ * final sync).
+ */
+static
+int
+sfs_setclean(struct sfs_fs *sfs, bool clean)
+{
+	int result;
+
+	lock_acquire(sfs->sfs_freemaplock);
+	sfs->sfs_sb.sb_clean = clean ? SFS_CLEAN : 0;
+	result = sfs_writeblock(sfs, SFS_SUPER_BLOCK, &sfs->sfs_sb,
+				sizeof(sfs->sfs_sb));
+	lock_release(sfs->sfs_freemaplock);
+	if (result) {
+		return result;
+	}
+	return sfs_buf_sync(sfs);
+}
+
+/*
+ * Put the dirty inodes, the free block map, and the superblock into
+ * the buffer cache. On a journaled volume this is called by the
+ * journal commit.
+ */
+int
+sfs_sync_meta(struct sfs_fs *sfs)
+{
+	int result;
+
+	/* If any vnodes need to be written, write them. */
+	result = sfs_sync_vnodes(sfs);
+	if (result) {
+		return result;
+	}
+
+	/* If the free block map needs to be written, write it. */
+	result = sfs_sync_freemap(sfs);
+	if (result) {
+		return result;
+	}
+
+	/* If the superblock needs to be written, write it. */
+	return sfs_sync_superblock(sfs);
+}
+
 /*
  * Sync routine. This is what gets invoked if you do FS_SYNC on the
  * sfs filesystem structure.
@@ -174,8 +268,6 @@ sfs_sync(struct fs *fs)
 	struct sfs_fs *sfs;
 	int result;
 
-	vfs_biglock_acquire();
-
 	/*
 	 * Get the sfs_fs from the generic abstract fs.
 	 *
@@ -208,28 +300,27 @@ sfs_sync(struct fs *fs)
 
 	sfs = fs->fs_data;
 
-	/* If any vnodes need to be written, write them. */
-	result = sfs_sync_vnodes(sfs);
-	if (result) {
-		vfs_biglock_release();
-		return result;
+	/*
+	 * On a journaled volume the metadata goes through a commit;
+	 * otherwise it is just put in the buffer cache. Either way,
+	 * then write the lot out in one sorted pass.
+	 */
+	if (sfs->sfs_sb.sb_journalblocks != 0) {
+		result = sfs_journal_commit(sfs);
+	}
+	else {
+		result = sfs_sync_meta(sfs);
 	}
-
-	/* If the free block map needs to be written, write it. */
-	result = sfs_sync_freemap(sfs);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
-	/* If the superblock needs to be written, write it. */
-	result = sfs_sync_superblock(sfs);
+	/* Write back everything the above left in the buffer cache. */
+	result = sfs_buf_sync(sfs);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
-	vfs_biglock_release();
 	return 0;
 }
 
@@ -237,19 +328,16 @@ sfs_sync(struct fs *fs)
  * Routine to retrieve the volume name. Filesystems can be referred
  * to by their volume name followed by a colon as well as the name
  * of the device they're mounted on.
+ *
+ * The name doesn't change once mounted, so no locking is needed.
  */
 static
 const char *
 sfs_getvolname(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
-	const char *ret;
 
-	vfs_biglock_acquire();
-	ret = sfs->sfs_sb.sb_volname;
-	vfs_biglock_release();
-
-	return ret;
+	return sfs->sfs_sb.sb_volname;
 }
 
 /*
@@ -262,34 +350,59 @@ sfs_fs_destroy(struct sfs_fs *sfs)
 	if (sfs->sfs_freemap != NULL) {
 		bitmap_destroy(sfs->sfs_freemap);
 	}
+	sfs_journal_destroy(sfs);
+	lock_destroy(sfs->sfs_freemaplock);
+	KASSERT(sfs->sfs_nidle == 0);
 	vnodearray_destroy(sfs->sfs_vnodes);
+	lock_destroy(sfs->sfs_vnlock);
 	KASSERT(sfs->sfs_device == NULL);
+	sfs_buf_detach(sfs);
 	kfree(sfs);
 }
 
 /*
  * Unmount code.
  *
- * VFS calls FS_SYNC on the filesystem prior to unmounting it.
+ * VFS calls FS_SYNC on the filesystem prior to unmounting it. Like
+ * mount, this runs under the big VFS lock, so no new vnodes can be
+ * looked up behind our back once the table is found empty.
  */
 static
 int
 sfs_unmount(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
+	int result;
 
 	vfs_biglock_acquire();
 
-	/* Do we have any files open? If so, can't unmount. */
+	/*
+	 * Get rid of the vnodes nobody is using. Then, do we have any
+	 * files open? If so, can't unmount.
+	 */
+	sfs_jbegin_nested(sfs);
+	lock_acquire(sfs->sfs_vnlock);
+	(void)sfs_idle_trim(sfs, 0, false);
 	if (vnodearray_num(sfs->sfs_vnodes) > 0) {
+		lock_release(sfs->sfs_vnlock);
+		sfs_jend_nested(sfs);
 		vfs_biglock_release();
 		return EBUSY;
 	}
+	lock_release(sfs->sfs_vnlock);
+	sfs_jend_nested(sfs);
 
 	/* We should have just had sfs_sync called. */
 	KASSERT(sfs->sfs_superdirty == false);
 	KASSERT(sfs->sfs_freemapdirty == false);
 
+	/* Make sure no dirty buffers are left behind, and say so */
+	result = sfs_setclean(sfs, true);
+	if (result) {
+		vfs_biglock_release();
+		return result;
+	}
+
 	/* The vfs layer takes care of the device for us */
 	sfs->sfs_device = NULL;
 
@@ -351,17 +464,49 @@ sfs_fs_create(void)
 	sfs->sfs_device = NULL;
 
 	/* vnode table */
+	sfs->sfs_vnlock = lock_create("sfs vnode table");
+	if (sfs->sfs_vnlock == NULL) {
+		goto cleanup_object;
+	}
 	sfs->sfs_vnodes = vnodearray_create();
 	if (sfs->sfs_vnodes == NULL) {
-		goto cleanup_object;
+		goto cleanup_vnlock;
 	}
+	bzero(sfs->sfs_vnhash, sizeof(sfs->sfs_vnhash));
+	sfs->sfs_idlehead = sfs->sfs_idletail = NULL;
+	sfs->sfs_nidle = 0;
 
 	/* freemap */
+	sfs->sfs_freemaplock = lock_create("sfs freemap");
+	if (sfs->sfs_freemaplock == NULL) {
+		goto cleanup_vnodes;
+	}
 	sfs->sfs_freemap = NULL;
 	sfs->sfs_freemapdirty = false;
 
+	/* journal (set up by sfs_journal_mount) */
+	sfs->sfs_jlock = NULL;
+	sfs->sfs_jcv = NULL;
+	sfs->sfs_jactive = 0;
+	sfs->sfs_jwant = false;
+	sfs->sfs_jcommitter = NULL;
+	sfs->sfs_jseq = 0;
+	sfs->sfs_jlastcommit = 0;
+	sfs->sfs_jmetadirty = 0;
+	sfs->sfs_jscratch = NULL;
+
+	/* until the superblock is read, just enough to read it */
+	sfs->sfs_blocksize = SFS_BLOCKSIZE;
+
+	/* buffer cache (set up by sfs_buf_attach) */
+	sfs->sfs_bufcache = NULL;
+
 	return sfs;
 
+cleanup_vnodes:
+	vnodearray_destroy(sfs->sfs_vnodes);
+cleanup_vnlock:
+	lock_destroy(sfs->sfs_vnlock);
 cleanup_object:
 	kfree(sfs);
 fail:
@@ -387,6 +532,9 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 {
 	int result;
 	struct sfs_fs *sfs;
+	struct iovec iov;
+	struct uio ku;
+	uint32_t bsize;
 
 	vfs_biglock_acquire();
 
@@ -394,32 +542,38 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	(void)options;
 
 	/*
-	 * We can't mount on devices with the wrong sector size.
-	 *
-	 * (Note: for all intents and purposes here, "sector" and
-	 * "block" are interchangeable terms. Technically a filesystem
-	 * block may be composed of several hardware sectors, but we
-	 * don't do that in sfs.)
+	 * We can't mount on devices whose sectors don't divide our
+	 * smallest block. Larger blocks are made of several sectors.
 	 */
-	if (dev->d_blocksize != SFS_BLOCKSIZE) {
+	if (dev->d_blocksize == 0 || SFS_BLOCKSIZE % dev->d_blocksize != 0) {
 		vfs_biglock_release();
 		kprintf("sfs: Cannot mount on device with blocksize %zu\n",
 			dev->d_blocksize);
 		return ENXIO;
 	}
 
+	/* Start the buffer cache flusher if this is the first mount */
+	result = sfs_buf_bootstrap();
+	if (result) {
+		vfs_biglock_release();
+		return result;
+	}
+
 	sfs = sfs_fs_create();
 	if (sfs == NULL) {
 		vfs_biglock_release();
 		return ENOMEM;
 	}
 
-	/* Set the device so we can use sfs_readblock() */
+	/* Set the device so we can use sfs_rwblock() */
 	sfs->sfs_device = dev;
 
-	/* Load superblock */
-	result = sfs_readblock(sfs, SFS_SUPER_BLOCK, &sfs->sfs_sb,
-			       sizeof(sfs->sfs_sb));
+	/*
+	 * Load superblock. It says how big the blocks are, which the
+	 * buffer cache needs to know, so read it around the cache.
+	 */
+	SFSUIO(sfs, &iov, &ku, &sfs->sfs_sb, SFS_SUPER_BLOCK, UIO_READ);
+	result = sfs_rwblock(sfs, &ku);
 	if (result) {
 		sfs->sfs_device = NULL;
 		sfs_fs_destroy(sfs);
@@ -440,14 +594,48 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 		return EINVAL;
 	}
 
-	if (sfs->sfs_sb.sb_nblocks > dev->d_blocks) {
-		kprintf("sfs: warning - fs has %u blocks, device has %u\n",
-			sfs->sfs_sb.sb_nblocks, dev->d_blocks);
+	bsize = SFS_SB_BLOCKSIZE(&sfs->sfs_sb);
+	if (bsize < SFS_BLOCKSIZE || bsize > SFS_MAXBLOCKSIZE ||
+	    (bsize & (bsize - 1)) != 0) {
+		kprintf("sfs: Bad block size %u in superblock\n", bsize);
+		sfs->sfs_device = NULL;
+		sfs_fs_destroy(sfs);
+		vfs_biglock_release();
+		return EINVAL;
+	}
+	sfs->sfs_blocksize = bsize;
+
+	if ((uint64_t)sfs->sfs_sb.sb_nblocks * bsize >
+	    (uint64_t)dev->d_blocks * dev->d_blocksize) {
+		kprintf("sfs: warning - fs has %u %u-byte blocks, "
+			"device has %u %zu-byte blocks\n",
+			sfs->sfs_sb.sb_nblocks, bsize,
+			dev->d_blocks, dev->d_blocksize);
+	}
+
+	/* Give the volume its own buffers, so it doesn't wait on others */
+	result = sfs_buf_attach(sfs);
+	if (result) {
+		sfs->sfs_device = NULL;
+		sfs_fs_destroy(sfs);
+		vfs_biglock_release();
+		return result;
 	}
 
 	/* Ensure null termination of the volume name */
 	sfs->sfs_sb.sb_volname[sizeof(sfs->sfs_sb.sb_volname)-1] = 0;
 
+	/* Recover from the journal before reading anything else */
+	result = sfs_journal_mount(sfs);
+	if (result) {
+		/* Whatever was replayed must not be left dirty */
+		(void)sfs_buf_sync(sfs);
+		sfs->sfs_device = NULL;
+		sfs_fs_destroy(sfs);
+		vfs_biglock_release();
+		return result;
+	}
+
 	/* Load free block bitmap */
 	sfs->sfs_freemap = bitmap_create(SFS_FS_FREEMAPBITS(sfs));
 	if (sfs->sfs_freemap == NULL) {
@@ -464,6 +652,15 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 		return result;
 	}
 
+	/* Until unmounted, the volume may need checking after a crash */
+	result = sfs_setclean(sfs, false);
+	if (result) {
+		sfs->sfs_device = NULL;
+		sfs_fs_destroy(sfs);
+		vfs_biglock_release();
+		return result;
+	}
+
 	/* Hand back the abstract fs */
 	*ret = &sfs->sfs_absfs;
 
@@ -35,13 +35,18 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
 #include <vfs.h>
 #include <sfs.h>
+#include <kstat.h>
 #include "sfsprivate.h"
 
 
 /*
- * Write an on-disk inode structure back out to disk.
+ * Write an on-disk inode structure back out to disk. Any file data
+ * still waiting for disk blocks gets them first, since that changes
+ * the inode.
  */
 int
 sfs_sync_inode(struct sfs_vnode *sv)
@@ -49,8 +54,15 @@ sfs_sync_inode(struct sfs_vnode *sv)
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
 	int result;
 
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	result = sfs_delay_flush(sv);
+	if (result) {
+		return result;
+	}
+
 	if (sv->sv_dirty) {
-		result = sfs_writeblock(sfs, sv->sv_ino, &sv->sv_i,
+		result = sfs_writemeta(sfs, sv->sv_ino, &sv->sv_i,
 					sizeof(sv->sv_i));
 		if (result) {
 			return result;
@@ -61,43 +73,112 @@ sfs_sync_inode(struct sfs_vnode *sv)
 }
 
 /*
- * Called when the vnode refcount (in-memory usage count) hits zero.
+ * Idle vnodes.
  *
- * This function should try to avoid returning errors other than EBUSY.
+ * When the last reference to a vnode whose file still exists goes
+ * away, the vnode is not torn down but put at the head of the
+ * volume's idle list, in case the file is wanted again soon;
+ * sfs_loadvnode then takes it back without reading the inode. The
+ * list holds the vnode's one remaining reference. At most
+ * sfs_idle_max vnodes are kept per volume, and past that the ones at
+ * the tail (least recently released) are destroyed. When memory for
+ * a new vnode can't be had, idle vnodes that don't need writing back
+ * are dropped to make room. Unmount destroys them all. The list is
+ * protected by sfs_vnlock.
+ *
+ * Destroying an idle vnode takes its sv_lock while holding
+ * sfs_vnlock, against the usual order. This is safe because nobody
+ * can hold the lock of a vnode they have no reference to, and new
+ * references are only handed out under sfs_vnlock.
  */
-int
-sfs_reclaim(struct vnode *v)
+static unsigned sfs_idle_max = SFS_IDLE_DEFAULT;
+
+/* Statistics, for all volumes */
+static struct spinlock sfs_idle_statlock = SPINLOCK_INITIALIZER;
+static unsigned sfs_idle_hits;		/* loads that found an idle vnode */
+static unsigned sfs_idle_misses;	/* loads that read the inode */
+static unsigned sfs_idle_drops;		/* idle vnodes destroyed */
+
+static
+void
+sfs_idle_count(unsigned *counter)
 {
-	struct sfs_vnode *sv = v->vn_data;
-	struct sfs_fs *sfs = v->vn_fs->fs_data;
-	unsigned ix, i, num;
-	int result;
+	spinlock_acquire(&sfs_idle_statlock);
+	(*counter)++;
+	spinlock_release(&sfs_idle_statlock);
+}
 
-	vfs_biglock_acquire();
+/*
+ * Put SV at the head of the idle list, or take it off.
+ */
+static
+void
+sfs_idle_add(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	KASSERT(lock_do_i_hold(sfs->sfs_vnlock));
+	KASSERT(!sv->sv_idle);
 
-	/*
-	 * Make sure someone else hasn't picked up the vnode since the
-	 * decision was made to reclaim it. (You must also synchronize
-	 * this with sfs_loadvnode.)
-	 */
-	spinlock_acquire(&v->vn_countlock);
-	if (v->vn_refcount != 1) {
+	sv->sv_idleprev = NULL;
+	sv->sv_idlenext = sfs->sfs_idlehead;
+	if (sfs->sfs_idlehead != NULL) {
+		sfs->sfs_idlehead->sv_idleprev = sv;
+	}
+	else {
+		sfs->sfs_idletail = sv;
+	}
+	sfs->sfs_idlehead = sv;
+	sfs->sfs_nidle++;
+	sv->sv_idle = true;
+}
 
-		/* consume the reference VOP_DECREF gave us */
-		KASSERT(v->vn_refcount>1);
-		v->vn_refcount--;
+static
+void
+sfs_idle_remove(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	KASSERT(lock_do_i_hold(sfs->sfs_vnlock));
+	KASSERT(sv->sv_idle);
 
-		spinlock_release(&v->vn_countlock);
-		vfs_biglock_release();
-		return EBUSY;
+	if (sv->sv_idleprev != NULL) {
+		sv->sv_idleprev->sv_idlenext = sv->sv_idlenext;
 	}
-	spinlock_release(&v->vn_countlock);
+	else {
+		sfs->sfs_idlehead = sv->sv_idlenext;
+	}
+	if (sv->sv_idlenext != NULL) {
+		sv->sv_idlenext->sv_idleprev = sv->sv_idleprev;
+	}
+	else {
+		sfs->sfs_idletail = sv->sv_idleprev;
+	}
+	KASSERT(sfs->sfs_nidle > 0);
+	sfs->sfs_nidle--;
+	sv->sv_idle = false;
+}
+
+/*
+ * Tear down a vnode whose last reference is going away: erase the
+ * file if it has no links left, write the inode back, and take the
+ * vnode out of the tables and free it. Called with sv_lock and
+ * sfs_vnlock held; on success sv_lock is gone with the vnode, and on
+ * failure nothing has changed and both locks are still held.
+ */
+static
+int
+sfs_vnode_destroy(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	struct vnode *v = &sv->sv_absvn;
+	struct sfs_vnode **pp;
+	unsigned ix, num;
+	int result;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+	KASSERT(lock_do_i_hold(sfs->sfs_vnlock));
+	KASSERT(!sv->sv_idle);
 
 	/* If there are no on-disk references to the file either, erase it. */
 	if (sv->sv_i.sfi_linkcount == 0) {
 		result = sfs_itrunc(sv, 0);
 		if (result) {
-			vfs_biglock_release();
 			return result;
 		}
 	}
@@ -105,7 +186,6 @@ sfs_reclaim(struct vnode *v)
 	/* Sync the inode to disk */
 	result = sfs_sync_inode(sv);
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
@@ -114,34 +194,173 @@ sfs_reclaim(struct vnode *v)
 		sfs_bfree(sfs, sv->sv_ino);
 	}
 
-	/* Remove the vnode structure from the table in the struct sfs_fs. */
+	/*
+	 * Remove the vnode structure from the tables in the struct
+	 * sfs_fs. The array is unordered, so fill our slot with the
+	 * last entry rather than shifting everything down.
+	 */
 	num = vnodearray_num(sfs->sfs_vnodes);
-	ix = num;
-	for (i=0; i<num; i++) {
-		struct vnode *v2 = vnodearray_get(sfs->sfs_vnodes, i);
-		struct sfs_vnode *sv2 = v2->vn_data;
-		if (sv2 == sv) {
-			ix = i;
-			break;
-		}
-	}
-	if (ix == num) {
+	ix = sv->sv_vnindex;
+	if (ix >= num || vnodearray_get(sfs->sfs_vnodes, ix) != v) {
 		panic("sfs: %s: reclaim vnode %u not in vnode pool\n",
 		      sfs->sfs_sb.sb_volname, sv->sv_ino);
 	}
-	vnodearray_remove(sfs->sfs_vnodes, ix);
+	if (ix != num - 1) {
+		struct vnode *last = vnodearray_get(sfs->sfs_vnodes, num - 1);
+		struct sfs_vnode *svlast = last->vn_data;
+
+		vnodearray_set(sfs->sfs_vnodes, ix, last);
+		svlast->sv_vnindex = ix;
+	}
+	result = vnodearray_setsize(sfs->sfs_vnodes, num - 1);
+	/* shrinking an array never fails */
+	KASSERT(result == 0);
+
+	pp = &sfs->sfs_vnhash[sv->sv_ino % SFS_VNHASH];
+	while (*pp != sv) {
+		KASSERT(*pp != NULL);
+		pp = &(*pp)->sv_hashnext;
+	}
+	*pp = sv->sv_hashnext;
 
 	vnode_cleanup(&sv->sv_absvn);
+	sfs_dir_dropindex(sv);
+	KASSERT(sv->sv_ndelayed == 0);
 
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
 
 	/* Release the storage for the vnode structure itself. */
+	lock_destroy(sv->sv_lock);
 	kfree(sv);
 
+	return 0;
+}
+
+/*
+ * Destroy idle vnodes, least recently released first, until only KEEP
+ * are left. With CLEANONLY, skip those that would need writing back
+ * (for callers that can't do I/O). Returns how many were destroyed.
+ * Called with sfs_vnlock held, and for !CLEANONLY inside a journal
+ * handle.
+ */
+unsigned
+sfs_idle_trim(struct sfs_fs *sfs, unsigned keep, bool cleanonly)
+{
+	struct sfs_vnode *sv, *prev;
+	struct vnode *v;
+	unsigned count;
+
+	KASSERT(lock_do_i_hold(sfs->sfs_vnlock));
+
+	count = 0;
+	for (sv = sfs->sfs_idletail;
+	     sv != NULL && sfs->sfs_nidle > keep; sv = prev) {
+		prev = sv->sv_idleprev;
+		v = &sv->sv_absvn;
+		if (cleanonly && (sv->sv_dirty || sv->sv_ndelayed > 0)) {
+			continue;
+		}
+		sfs_idle_remove(sfs, sv);
+
+		/*
+		 * Someone (sfs_sync_vnodes) may have a reference too;
+		 * then give ours back, and it goes through reclaim
+		 * again when they're done.
+		 */
+		spinlock_acquire(&v->vn_countlock);
+		if (vnode_dropref_unless_last(v)) {
+			spinlock_release(&v->vn_countlock);
+			continue;
+		}
+		spinlock_release(&v->vn_countlock);
+
+		lock_acquire(sv->sv_lock);
+		if (sfs_vnode_destroy(sfs, sv)) {
+			/* Keep it then; try again later */
+			lock_release(sv->sv_lock);
+			sfs_idle_add(sfs, sv);
+			break;
+		}
+		sfs_idle_count(&sfs_idle_drops);
+		count++;
+	}
+	return count;
+}
+
+/*
+ * Called when the vnode refcount (in-memory usage count) hits zero.
+ *
+ * This function should try to avoid returning errors other than EBUSY.
+ */
+static
+int
+sfs_doreclaim(struct vnode *v)
+{
+	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	int result;
+
+	/*
+	 * Nobody else can be holding the vnode lock without holding a
+	 * reference too, so this only waits if the vnode is about to
+	 * turn out to be busy.
+	 */
+	lock_acquire(sv->sv_lock);
+	lock_acquire(sfs->sfs_vnlock);
+
+	/*
+	 * Make sure someone else hasn't picked up the vnode since the
+	 * decision was made to reclaim it. sfs_loadvnode only hands
+	 * out new references while holding sfs_vnlock, so once we have
+	 * it the count can't go back up.
+	 */
+	spinlock_acquire(&v->vn_countlock);
+	if (vnode_dropref_unless_last(v)) {
+		/* consumed the reference VOP_DECREF gave us */
+		spinlock_release(&v->vn_countlock);
+		lock_release(sfs->sfs_vnlock);
+		lock_release(sv->sv_lock);
+		return EBUSY;
+	}
+	spinlock_release(&v->vn_countlock);
+
+	/* If the file is still there, keep the vnode for a while */
+	if (sv->sv_i.sfi_linkcount > 0 && sfs_idle_max > 0) {
+		sfs_idle_add(sfs, sv);
+		(void)sfs_idle_trim(sfs, sfs_idle_max, false);
+		lock_release(sfs->sfs_vnlock);
+		lock_release(sv->sv_lock);
+		return 0;
+	}
+
+	result = sfs_vnode_destroy(sfs, sv);
+	if (result) {
+		lock_release(sfs->sfs_vnlock);
+		lock_release(sv->sv_lock);
+		return result;
+	}
+	lock_release(sfs->sfs_vnlock);
+
 	/* Done */
 	return 0;
 }
 
+/*
+ * Reclaim may be called from inside another operation, when that
+ * drops a vnode reference, so it takes a nested journal handle.
+ */
+int
+sfs_reclaim(struct vnode *v)
+{
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	int result;
+
+	sfs_jbegin_nested(sfs);
+	result = sfs_doreclaim(v);
+	sfs_jend_nested(sfs);
+	return result;
+}
+
 /*
  * Function to load a inode into memory as a vnode, or dig up one
  * that's already resident.
@@ -150,33 +369,42 @@ int
 sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		 struct sfs_vnode **ret)
 {
-	struct vnode *v;
 	struct sfs_vnode *sv;
 	const struct vnode_ops *ops;
-	unsigned i, num;
+	unsigned bucket;
 	int result;
 
-	/* Look in the vnodes table */
-	num = vnodearray_num(sfs->sfs_vnodes);
-
-	/* Linear search. Is this too slow? You decide. */
-	for (i=0; i<num; i++) {
-		v = vnodearray_get(sfs->sfs_vnodes, i);
-		sv = v->vn_data;
-
-		/* Every inode in memory must be in an allocated block */
-		if (!sfs_bused(sfs, sv->sv_ino)) {
-			panic("sfs: %s: Found inode %u in unallocated block\n",
-			      sfs->sfs_sb.sb_volname, sv->sv_ino);
-		}
+	/*
+	 * Hold the table lock across the load, so nobody else can
+	 * load the same inode meanwhile.
+	 */
+	lock_acquire(sfs->sfs_vnlock);
 
+	/* Look in the vnodes table */
+	bucket = ino % SFS_VNHASH;
+	for (sv = sfs->sfs_vnhash[bucket]; sv != NULL; sv = sv->sv_hashnext) {
 		if (sv->sv_ino==ino) {
 			/* Found */
 
+			/* Every inode in memory must be in an allocated block */
+			if (!sfs_bused(sfs, sv->sv_ino)) {
+				panic("sfs: %s: Found inode %u in "
+				      "unallocated block\n",
+				      sfs->sfs_sb.sb_volname, sv->sv_ino);
+			}
+
 			/* forcetype is only allowed when creating objects */
 			KASSERT(forcetype==SFS_TYPE_INVAL);
 
-			VOP_INCREF(&sv->sv_absvn);
+			if (sv->sv_idle) {
+				/* take over the idle list's reference */
+				sfs_idle_remove(sfs, sv);
+				sfs_idle_count(&sfs_idle_hits);
+			}
+			else {
+				VOP_INCREF(&sv->sv_absvn);
+			}
+			lock_release(sfs->sfs_vnlock);
 			*ret = sv;
 			return 0;
 		}
@@ -184,8 +412,14 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 
 	/* Didn't have it loaded; load it */
 
+	sfs_idle_count(&sfs_idle_misses);
 	sv = kmalloc(sizeof(struct sfs_vnode));
+	if (sv == NULL && sfs_idle_trim(sfs, 0, true) > 0) {
+		/* Made some room */
+		sv = kmalloc(sizeof(struct sfs_vnode));
+	}
 	if (sv==NULL) {
+		lock_release(sfs->sfs_vnlock);
 		return ENOMEM;
 	}
 
@@ -199,6 +433,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	result = sfs_readblock(sfs, ino, &sv->sv_i, sizeof(sv->sv_i));
 	if (result) {
 		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
 
@@ -232,23 +467,45 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		      ino, sv->sv_i.sfi_type);
 	}
 
+	sv->sv_lock = lock_create("sfs vnode");
+	if (sv->sv_lock == NULL) {
+		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
+		return ENOMEM;
+	}
+
 	/* Call the common vnode initializer */
 	result = vnode_init(&sv->sv_absvn, ops, &sfs->sfs_absfs, sv);
 	if (result) {
+		lock_destroy(sv->sv_lock);
 		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
 
 	/* Set the other fields in our vnode structure */
 	sv->sv_ino = ino;
-
-	/* Add it to our table */
-	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_absvn, NULL);
+	sfs_ra_init(sv);
+	sv->sv_dirhash = NULL;
+	sv->sv_ndelayed = 0;
+	sv->sv_bmc_count = 0;
+	sv->sv_idle = false;
+	sv->sv_idlenext = sv->sv_idleprev = NULL;
+
+	/* Add it to our tables */
+	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_absvn,
+				&sv->sv_vnindex);
 	if (result) {
 		vnode_cleanup(&sv->sv_absvn);
+		lock_destroy(sv->sv_lock);
 		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
+	sv->sv_hashnext = sfs->sfs_vnhash[bucket];
+	sfs->sfs_vnhash[bucket] = sv;
+
+	lock_release(sfs->sfs_vnlock);
 
 	/* Hand it back */
 	*ret = sv;
@@ -256,10 +513,13 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 }
 
 /*
- * Create a new filesystem object and hand back its vnode.
+ * Create a new filesystem object and hand back its vnode. The inode
+ * is placed as close after block NEAR (typically the parent
+ * directory's inode) as the freemap allows.
  */
 int
-sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret)
+sfs_makeobj(struct sfs_fs *sfs, int type, daddr_t near,
+	    struct sfs_vnode **ret)
 {
 	uint32_t ino;
 	int result;
@@ -269,7 +529,7 @@ sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret)
 	 * number is the block number, so just get a block.)
 	 */
 
-	result = sfs_balloc(sfs, &ino);
+	result = sfs_balloc(sfs, near + 1, &ino);
 	if (result) {
 		return result;
 	}
@@ -296,25 +556,68 @@ sfs_getroot(struct fs *fs, struct vnode **ret)
 	struct sfs_vnode *sv;
 	int result;
 
-	vfs_biglock_acquire();
-
 	result = sfs_loadvnode(sfs, SFS_ROOTDIR_INO, SFS_TYPE_INVAL, &sv);
 	if (result) {
 		kprintf("sfs: %s: getroot: Cannot load root vnode\n",
 			sfs->sfs_sb.sb_volname);
-		vfs_biglock_release();
 		return result;
 	}
 
 	if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
 		kprintf("sfs: %s: getroot: not directory (type %u)\n",
 			sfs->sfs_sb.sb_volname, sv->sv_i.sfi_type);
-		vfs_biglock_release();
 		return EINVAL;
 	}
 
-	vfs_biglock_release();
-
 	*ret = &sv->sv_absvn;
 	return 0;
 }
+
+/*
+ * Set the most idle vnodes kept per volume; volumes with more shed
+ * them the next time a vnode is released there.
+ */
+void
+sfs_vncache_setmax(unsigned max)
+{
+	sfs_idle_max = max;
+}
+
+/*
+ * Print idle vnode statistics (for the kernel menu)
+ */
+void
+sfs_vncache_printstats(void)
+{
+	unsigned hits, misses, drops;
+
+	spinlock_acquire(&sfs_idle_statlock);
+	hits = sfs_idle_hits;
+	misses = sfs_idle_misses;
+	drops = sfs_idle_drops;
+	spinlock_release(&sfs_idle_statlock);
+
+	kprintf("sfs vnode cache: up to %u idle vnodes per volume\n",
+		sfs_idle_max);
+	kprintf("    %u loads found idle, %u read the inode, "
+		"%u idle destroyed\n", hits, misses, drops);
+}
+
+/*
+ * The same, for kstat (sfs.vncache.*).
+ */
+void
+sfs_vncache_kstat(struct kstat *ks)
+{
+	unsigned hits, misses, drops;
+
+	spinlock_acquire(&sfs_idle_statlock);
+	hits = sfs_idle_hits;
+	misses = sfs_idle_misses;
+	drops = sfs_idle_drops;
+	spinlock_release(&sfs_idle_statlock);
+
+	kstat_put(ks, hits, "sfs.vncache.hits");
+	kstat_put(ks, misses, "sfs.vncache.misses");
+	kstat_put(ks, drops, "sfs.vncache.drops");
+}
@@ -34,8 +34,10 @@
  */
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/fcntl.h>
 #include <lib.h>
 #include <uio.h>
+#include <synch.h>
 #include <vfs.h>
 #include <device.h>
 #include <sfs.h>
@@ -53,20 +55,21 @@
  */
 
 /*
- * Read or write a block, retrying I/O errors.
+ * Read or write a block, retrying I/O errors. This goes straight to
+ * the device; everything else should go through the buffer cache,
+ * which calls this with its lock held. The exception is O_DIRECT
+ * file I/O (sfs_directio), which hands down the caller's uio after
+ * getting the cache out of the way.
  */
-static
 int
 sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 {
 	int result;
 	int tries=0;
 
-	KASSERT(vfs_biglock_do_i_hold());
-
 	DEBUG(DB_SFS, "sfs: %s %llu\n",
 	      uio->uio_rw == UIO_READ ? "read" : "write",
-	      uio->uio_offset / SFS_BLOCKSIZE);
+	      uio->uio_offset / SFS_FS_BLOCKSIZE(sfs));
 
  retry:
 	result = DEVOP_IO(sfs->sfs_device, uio);
@@ -84,7 +87,7 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 			tries++;
 			kprintf("sfs: %s: block %llu I/O error, retrying\n",
 				sfs->sfs_sb.sb_volname,
-				uio->uio_offset / SFS_BLOCKSIZE);
+				uio->uio_offset / SFS_FS_BLOCKSIZE(sfs));
 			goto retry;
 		}
 		else if (tries < 10) {
@@ -95,46 +98,553 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 			kprintf("sfs: %s: block %llu I/O error, giving up "
 				"after %d retries\n",
 				sfs->sfs_sb.sb_volname,
-				uio->uio_offset / SFS_BLOCKSIZE, tries);
+				uio->uio_offset / SFS_FS_BLOCKSIZE(sfs), tries);
 		}
 	}
 	return result;
 }
 
 /*
- * Read a block.
+ * Read a block (through the buffer cache). LEN may be less than the
+ * block size, for structures kept at the start of a block.
  */
 int
 sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 {
-	struct iovec iov;
-	struct uio ku;
+	struct sfs_buf *buf;
+	int result;
 
-	KASSERT(len == SFS_BLOCKSIZE);
+	KASSERT(len <= SFS_FS_BLOCKSIZE(sfs));
 
-	SFSUIO(&iov, &ku, data, block, UIO_READ);
-	return sfs_rwblock(sfs, &ku);
+	result = sfs_buf_get(sfs, block, true, &buf);
+	if (result) {
+		return result;
+	}
+	memcpy(data, sfs_buf_data(buf), len);
+	sfs_buf_release(buf);
+	return 0;
 }
 
 /*
- * Write a block.
+ * Write a block (through the buffer cache). If LEN is less than the
+ * block size, the rest of the block is zeroed rather than read in.
  */
 int
 sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
 {
-	struct iovec iov;
-	struct uio ku;
+	struct sfs_buf *buf;
+	int result;
+
+	KASSERT(len <= SFS_FS_BLOCKSIZE(sfs));
+
+	result = sfs_buf_get(sfs, block, false, &buf);
+	if (result) {
+		return result;
+	}
+	memcpy(sfs_buf_data(buf), data, len);
+	bzero((char *)sfs_buf_data(buf) + len, SFS_FS_BLOCKSIZE(sfs) - len);
+	sfs_buf_markdirty(buf);
+	sfs_buf_release(buf);
+	return 0;
+}
+
+/*
+ * Write a metadata block (through the buffer cache, and through the
+ * journal if there is one). Short writes zero the rest, as above.
+ */
+int
+sfs_writemeta(struct sfs_fs *sfs, daddr_t block, void *data, size_t len)
+{
+	struct sfs_buf *buf;
+	int result;
+
+	KASSERT(len <= SFS_FS_BLOCKSIZE(sfs));
+
+	result = sfs_buf_get(sfs, block, false, &buf);
+	if (result) {
+		return result;
+	}
+	memcpy(sfs_buf_data(buf), data, len);
+	bzero((char *)sfs_buf_data(buf) + len, SFS_FS_BLOCKSIZE(sfs) - len);
+	sfs_buf_markmeta(buf);
+	sfs_buf_release(buf);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Sequential read-ahead
+//
+// Each vnode remembers the file block a sequential reader would ask
+// for next (sv_ra_next). When a read hits exactly that block, the
+// access is considered sequential and a window of following blocks
+// is prefetched into the buffer cache; runs of blocks that are
+// contiguous on disk are fetched with a single device request. The
+// window starts at 2 blocks and doubles on every refill up to
+// SFS_RA_MAXBLOCKS; a non-sequential read shrinks it back.
+//
+// sv_ra_start and sv_ra_count remember the range prefetched last so
+// reads inside it don't trigger another prefetch. Since the data
+// itself lives in the buffer cache it never goes stale.
+//
+// The reader's access pattern hint (uio_advice, from posix_fadvise
+// or madvise) overrides the guess: under POSIX_FADV_SEQUENTIAL every
+// read counts as sequential and the window opens at full size right
+// away; under POSIX_FADV_RANDOM there is no read-ahead at all.
+//
+
+/*
+ * Initialize the read-ahead state of a freshly loaded vnode.
+ */
+void
+sfs_ra_init(struct sfs_vnode *sv)
+{
+	sv->sv_ra_next = 0;
+	sv->sv_ra_window = 0;
+	sv->sv_ra_start = 0;
+	sv->sv_ra_count = 0;
+}
+
+/*
+ * Prefetch up to NBLOCKS file blocks starting at FILEBLOCK, stopping
+ * at EOF. Holes are skipped.
+ */
+static
+void
+sfs_ra_fill(struct sfs_vnode *sv, uint32_t fileblock, uint32_t nblocks)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	uint32_t fileblocks, i, runlen;
+	daddr_t diskblock, rundisk;
+
+	/* Don't read past EOF */
+	fileblocks = DIVROUNDUP(sv->sv_i.sfi_size, SFS_FS_BLOCKSIZE(sfs));
+	if (fileblock >= fileblocks) {
+		return;
+	}
+	if (nblocks > fileblocks - fileblock) {
+		nblocks = fileblocks - fileblock;
+	}
+
+	sv->sv_ra_start = fileblock;
+	sv->sv_ra_count = nblocks;
+
+	/*
+	 * Walk the blocks, accumulating runs that are contiguous on
+	 * disk and prefetching one run at a time.
+	 */
+	runlen = 0;
+	rundisk = 0;
+	for (i=0; i<nblocks; i++) {
+		if (sfs_bmap(sv, fileblock + i, false, &diskblock)) {
+			break;
+		}
+		if (runlen > 0 && diskblock != 0 &&
+		    diskblock == rundisk + runlen) {
+			runlen++;
+			continue;
+		}
+		if (runlen > 0) {
+			sfs_buf_prefetch(sfs, rundisk, runlen);
+		}
+		rundisk = diskblock;
+		runlen = (diskblock != 0) ? 1 : 0;
+	}
+	if (runlen > 0) {
+		sfs_buf_prefetch(sfs, rundisk, runlen);
+	}
+}
+
+/*
+ * Called for each file block about to be read, with the reader's
+ * ADVICE; starts read-ahead if the access pattern is sequential.
+ */
+static
+void
+sfs_readahead(struct sfs_vnode *sv, uint32_t fileblock, int advice)
+{
+	bool sequential;
+
+	sequential = (fileblock == sv->sv_ra_next && fileblock > 0);
+	sv->sv_ra_next = fileblock + 1;
+
+	if (advice == POSIX_FADV_RANDOM) {
+		sv->sv_ra_window = 0;
+		return;
+	}
+
+	/* Already prefetched? */
+	if (sv->sv_ra_count > 0 && fileblock >= sv->sv_ra_start &&
+	    fileblock < sv->sv_ra_start + sv->sv_ra_count) {
+		return;
+	}
+
+	if (advice == POSIX_FADV_SEQUENTIAL) {
+		/* Told so: no need to wait for the window to grow */
+		sequential = true;
+		sv->sv_ra_window = SFS_RA_MAXBLOCKS;
+	}
+
+	if (!sequential) {
+		/* Random access: forget about reading ahead for now */
+		sv->sv_ra_window = 0;
+		return;
+	}
+
+	/* Sequential: open up the window and read ahead */
+	if (sv->sv_ra_window == 0) {
+		sv->sv_ra_window = 2;
+	}
+	else if (sv->sv_ra_window < SFS_RA_MAXBLOCKS) {
+		sv->sv_ra_window *= 2;
+	}
+
+	sfs_ra_fill(sv, fileblock, sv->sv_ra_window);
+}
+
+/*
+ * Prefetch the blocks covering LEN bytes at POS, which the caller
+ * says will be read soon, in windows of SFS_RA_MAXBLOCKS and at most
+ * SFS_PREFETCH_MAXBLOCKS in all so one hint can't flush the cache.
+ * The sequential read-ahead then carries on from the end of it.
+ * Called with the vnode locked.
+ */
+void
+sfs_ra_prefetch(struct sfs_vnode *sv, off_t pos, off_t len)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	uint32_t bsize = SFS_FS_BLOCKSIZE(sfs);
+	uint32_t fileblock, nblocks, n;
+	off_t size;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	size = sv->sv_i.sfi_size;
+	if (pos < 0 || len <= 0 || pos >= size) {
+		return;
+	}
+	if (len > size - pos) {
+		len = size - pos;
+	}
+
+	fileblock = pos / bsize;
+	nblocks = (pos + len - 1) / bsize - fileblock + 1;
+	if (nblocks > SFS_PREFETCH_MAXBLOCKS) {
+		nblocks = SFS_PREFETCH_MAXBLOCKS;
+	}
+
+	while (nblocks > 0) {
+		n = (nblocks < SFS_RA_MAXBLOCKS) ? nblocks : SFS_RA_MAXBLOCKS;
+		sfs_ra_fill(sv, fileblock, n);
+		fileblock += n;
+		nblocks -= n;
+	}
+	sv->sv_ra_next = fileblock;
+}
+
+/*
+ * Blocks looked up per sfs_buf_demote call by sfs_ra_dontneed.
+ */
+#define SFS_DONTNEED_BATCH 16
+
+/*
+ * The caller says the blocks covering LEN bytes at POS won't be read
+ * again soon: make their buffers the next ones the cache reuses.
+ * Blocks still waiting for a disk block (delayed allocation) are
+ * left alone. Called with the vnode locked.
+ */
+void
+sfs_ra_dontneed(struct sfs_vnode *sv, off_t pos, off_t len)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	uint32_t bsize = SFS_FS_BLOCKSIZE(sfs);
+	uint32_t fileblock, endblock;
+	daddr_t blocks[SFS_DONTNEED_BATCH];
+	daddr_t diskblock;
+	unsigned n;
+	off_t size;
+
+	KASSERT(lock_do_i_hold(sv->sv_lock));
+
+	size = sv->sv_i.sfi_size;
+	if (pos < 0 || len <= 0 || pos >= size) {
+		return;
+	}
+	if (len > size - pos) {
+		len = size - pos;
+	}
+
+	fileblock = pos / bsize;
+	endblock = (pos + len - 1) / bsize + 1;
+
+	/* Don't skip reading ahead into blocks about to go */
+	if (sv->sv_ra_count > 0 && sv->sv_ra_start < endblock &&
+	    sv->sv_ra_start + sv->sv_ra_count > fileblock) {
+		sv->sv_ra_count = 0;
+	}
+
+	n = 0;
+	for (; fileblock < endblock; fileblock++) {
+		if (sfs_bmap(sv, fileblock, false, &diskblock)) {
+			break;
+		}
+		if (diskblock == 0) {
+			continue;
+		}
+		blocks[n++] = diskblock;
+		if (n == SFS_DONTNEED_BATCH) {
+			sfs_buf_demote(sfs, blocks, n);
+			n = 0;
+		}
+	}
+	if (n > 0) {
+		sfs_buf_demote(sfs, blocks, n);
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Delayed allocation
+//
+// Writing into a hole or past EOF doesn't allocate a disk block
+// right away. The data goes into an anonymous buffer (see
+// sfs_buf.c) listed in the vnode's sv_delayblock/sv_delaybuf, and
+// disk blocks are handed out later for all of the vnode's pending
+// blocks at once, each run of consecutive file blocks as one
+// contiguous extent (sfs_bmap_extent). A file written in small
+// appends, or several files written at once, thus still lay out
+// contiguously, and the freemap, the inode and any indirect block
+// are updated once per batch rather than once per write.
+//
+// The blocks get allocated when the list fills up, when the inode is
+// synced (sync, fsync, a journal commit, or reclaim), and when no
+// anonymous buffer is available, in which case the write allocates
+// as it goes. Truncation just drops pending blocks past the new end.
+//
+// Since there is no reservation, running out of space shows up when
+// the blocks are allocated, not at write time: the error is
+// reported by whatever triggered the allocation (fsync and sync
+// return ENOSPC) and the data stays pending.
+//
+
+/*
+ * Find the pending data for file block FILEBLOCK, if any.
+ */
+static
+struct sfs_buf *
+sfs_delay_find(struct sfs_vnode *sv, uint32_t fileblock)
+{
+	unsigned i;
+
+	for (i=0; i<sv->sv_ndelayed; i++) {
+		if (sv->sv_delayblock[i] == fileblock) {
+			return sv->sv_delaybuf[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Start pending data for file block FILEBLOCK, which must have no
+ * disk block. Returns the (zeroed) buffer with a reference for the
+ * caller.
+ */
+static
+int
+sfs_delay_add(struct sfs_vnode *sv, uint32_t fileblock,
+	      struct sfs_buf **ret)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *buf;
+	int result;
+
+	if (sv->sv_ndelayed == SFS_DELAY_MAX) {
+		result = sfs_delay_flush(sv);
+		if (result) {
+			return result;
+		}
+	}
+
+	result = sfs_buf_getanon(sfs, &buf);
+	if (result) {
+		return result;
+	}
+	sv->sv_delayblock[sv->sv_ndelayed] = fileblock;
+	sv->sv_delaybuf[sv->sv_ndelayed] = buf;
+	sv->sv_ndelayed++;
+
+	sfs_buf_hold(buf);
+	*ret = buf;
+	return 0;
+}
+
+/*
+ * Copy pending data into the cache buffer of its new disk block
+ * DISKBLOCK, and give up the anonymous buffer.
+ */
+static
+int
+sfs_delay_bind(struct sfs_fs *sfs, struct sfs_buf *anon, daddr_t diskblock)
+{
+	struct sfs_buf *buf;
+	int result;
+
+	result = sfs_buf_get(sfs, diskblock, false, &buf);
+	if (result) {
+		return result;
+	}
+	memcpy(sfs_buf_data(buf), sfs_buf_data(anon), SFS_FS_BLOCKSIZE(sfs));
+	sfs_buf_markdirty(buf);
+	sfs_buf_release(buf);
+
+	sfs_buf_putanon(anon);
+	return 0;
+}
+
+/*
+ * Allocate disk blocks for all of SV's pending data. On error, the
+ * blocks not yet dealt with stay pending.
+ */
+int
+sfs_delay_flush(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	daddr_t diskblocks[SFS_DELAY_MAX];
+	uint32_t fileblock;
+	struct sfs_buf *buf;
+	unsigned i, j, n, len, done;
+	int result;
 
-	KASSERT(len == SFS_BLOCKSIZE);
+	KASSERT(lock_do_i_hold(sv->sv_lock));
 
-	SFSUIO(&iov, &ku, data, block, UIO_WRITE);
-	return sfs_rwblock(sfs, &ku);
+	n = sv->sv_ndelayed;
+	if (n == 0) {
+		return 0;
+	}
+
+	/* Sort by file block (insertion sort; the list is short) */
+	for (i=1; i<n; i++) {
+		fileblock = sv->sv_delayblock[i];
+		buf = sv->sv_delaybuf[i];
+		for (j = i; j > 0 && sv->sv_delayblock[j-1] > fileblock; j--) {
+			sv->sv_delayblock[j] = sv->sv_delayblock[j-1];
+			sv->sv_delaybuf[j] = sv->sv_delaybuf[j-1];
+		}
+		sv->sv_delayblock[j] = fileblock;
+		sv->sv_delaybuf[j] = buf;
+	}
+
+	/* Allocate each run of consecutive file blocks as one extent */
+	result = 0;
+	for (done = 0; done < n; done += len) {
+		for (len = 1; done + len < n &&
+			     sv->sv_delayblock[done + len] ==
+			     sv->sv_delayblock[done] + len; len++) {
+			/* nothing */
+		}
+		result = sfs_bmap_extent(sv, sv->sv_delayblock[done], len,
+					 diskblocks);
+		if (result) {
+			break;
+		}
+		for (i=0; i<len; i++) {
+			result = sfs_delay_bind(sfs, sv->sv_delaybuf[done + i],
+						diskblocks[i]);
+			if (result) {
+				/* The rest of the run is still pending */
+				len = i;
+				break;
+			}
+		}
+		if (result) {
+			done += len;
+			break;
+		}
+	}
+
+	/* Keep whatever is left */
+	for (i=done; i<n; i++) {
+		sv->sv_delayblock[i - done] = sv->sv_delayblock[i];
+		sv->sv_delaybuf[i - done] = sv->sv_delaybuf[i];
+	}
+	sv->sv_ndelayed = n - done;
+	return result;
+}
+
+/*
+ * Throw away pending data for file blocks FROM up to but not
+ * including TO.
+ */
+void
+sfs_delay_discard(struct sfs_vnode *sv, uint32_t from, uint32_t to)
+{
+	unsigned i, n;
+
+	n = 0;
+	for (i=0; i<sv->sv_ndelayed; i++) {
+		if (sv->sv_delayblock[i] >= from &&
+		    sv->sv_delayblock[i] < to) {
+			sfs_buf_putanon(sv->sv_delaybuf[i]);
+			continue;
+		}
+		sv->sv_delayblock[n] = sv->sv_delayblock[i];
+		sv->sv_delaybuf[n] = sv->sv_delaybuf[i];
+		n++;
+	}
+	sv->sv_ndelayed = n;
 }
 
 ////////////////////////////////////////////////////////////
 //
 // File-level I/O
 
+/*
+ * Get the buffer holding file block FILEBLOCK, reading it in if FILL
+ * is set, for I/O in direction RW. For a read of a hole, returns
+ * NULL. For a write of a hole, returns new pending data if possible
+ * and allocates a disk block otherwise.
+ */
+static
+int
+sfs_filebuf(struct sfs_vnode *sv, uint32_t fileblock, enum uio_rw rw,
+	    bool fill, struct sfs_buf **ret)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *buf;
+	daddr_t diskblock;
+	int result;
+
+	buf = sfs_delay_find(sv, fileblock);
+	if (buf != NULL) {
+		sfs_buf_hold(buf);
+		*ret = buf;
+		return 0;
+	}
+
+	result = sfs_bmap(sv, fileblock, false, &diskblock);
+	if (result) {
+		return result;
+	}
+
+	if (diskblock == 0) {
+		if (rw == UIO_READ) {
+			*ret = NULL;
+			return 0;
+		}
+		if (sfs_delay_add(sv, fileblock, ret) == 0) {
+			return 0;
+		}
+
+		/* Can't put it off; allocate now */
+		result = sfs_bmap(sv, fileblock, true, &diskblock);
+		if (result) {
+			return result;
+		}
+	}
+
+	return sfs_buf_get(sfs, diskblock, fill, ret);
+}
+
 /*
  * Do I/O to a block of a file that doesn't cover the whole block.  We
  * need to read in the original block first, even if we're writing, so
@@ -150,74 +660,51 @@ int
 sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	      uint32_t skipstart, uint32_t len)
 {
-	/*
-	 * I/O buffer for handling partial sectors.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static char iobuf[SFS_BLOCKSIZE];
-
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
-	daddr_t diskblock;
+	struct sfs_buf *buf;
 	uint32_t fileblock;
 	int result;
 
-	/* Allocate missing blocks if and only if we're writing */
-	bool doalloc = (uio->uio_rw==UIO_WRITE);
-
-	KASSERT(skipstart + len <= SFS_BLOCKSIZE);
-
-	/* We're using a global static buffer; it had better be locked */
-	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(skipstart + len <= SFS_FS_BLOCKSIZE(sfs));
 
 	/* Compute the block offset of this block in the file */
-	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
+	fileblock = uio->uio_offset / SFS_FS_BLOCKSIZE(sfs);
 
-	/* Get the disk block number */
-	result = sfs_bmap(sv, fileblock, doalloc, &diskblock);
+	/* If reading, maybe start read-ahead */
+	if (uio->uio_rw == UIO_READ) {
+		sfs_readahead(sv, fileblock, uio->uio_advice);
+	}
+
+	/*
+	 * Get the block, and perform the requested operation
+	 * into/out of it right in the buffer cache.
+	 */
+	result = sfs_filebuf(sv, fileblock, uio->uio_rw, true, &buf);
 	if (result) {
 		return result;
 	}
 
-	if (diskblock == 0) {
+	if (buf == NULL) {
 		/*
 		 * There was no block mapped at this point in the file.
-		 * Zero the buffer.
+		 * Read zeros.
 		 */
 		KASSERT(uio->uio_rw == UIO_READ);
-		bzero(iobuf, sizeof(iobuf));
-	}
-	else {
-		/*
-		 * Read the block.
-		 */
-		result = sfs_readblock(sfs, diskblock, iobuf, sizeof(iobuf));
-		if (result) {
-			return result;
-		}
+		return uiomovezeros(len, uio);
 	}
 
-	/*
-	 * Now perform the requested operation into/out of the buffer.
-	 */
-	result = uiomove(iobuf+skipstart, len, uio);
-	if (result) {
-		return result;
-	}
+	result = uiomove((char *)sfs_buf_data(buf) + skipstart, len, uio);
 
 	/*
-	 * If it was a write, write back the modified block.
+	 * If it was a write, the block has changed, even if the copy
+	 * failed partway.
 	 */
 	if (uio->uio_rw == UIO_WRITE) {
-		result = sfs_writeblock(sfs, diskblock, iobuf, sizeof(iobuf));
-		if (result) {
-			return result;
-		}
+		sfs_buf_markdirty(buf);
 	}
+	sfs_buf_release(buf);
 
-	return 0;
+	return result;
 }
 
 /*
@@ -228,69 +715,184 @@ int
 sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
-	daddr_t diskblock;
+	struct sfs_buf *buf;
 	uint32_t fileblock;
 	int result;
-	bool doalloc = (uio->uio_rw==UIO_WRITE);
-	off_t saveoff;
-	off_t diskoff;
-	off_t saveres;
-	off_t diskres;
 
 	/* Get the block number within the file */
-	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
+	fileblock = uio->uio_offset / SFS_FS_BLOCKSIZE(sfs);
 
-	/* Look up the disk block number */
-	result = sfs_bmap(sv, fileblock, doalloc, &diskblock);
+	/* If reading, maybe start read-ahead */
+	if (uio->uio_rw == UIO_READ) {
+		sfs_readahead(sv, fileblock, uio->uio_advice);
+	}
+
+	/*
+	 * Get the buffer. A write replaces the whole block, so there's
+	 * no need to read it in first.
+	 */
+	result = sfs_filebuf(sv, fileblock, uio->uio_rw,
+			     uio->uio_rw == UIO_READ, &buf);
 	if (result) {
 		return result;
 	}
 
-	if (diskblock == 0) {
+	if (buf == NULL) {
 		/*
 		 * No block - fill with zeros.
 		 *
-		 * We must be reading, or sfs_bmap would have
-		 * allocated a block for us.
+		 * We must be reading, or sfs_filebuf would have
+		 * found or made a buffer for us.
 		 */
 		KASSERT(uio->uio_rw == UIO_READ);
-		return uiomovezeros(SFS_BLOCKSIZE, uio);
+		return uiomovezeros(SFS_FS_BLOCKSIZE(sfs), uio);
 	}
 
-	/*
-	 * Do the I/O directly to the uio region. Save the uio_offset,
-	 * and substitute one that makes sense to the device.
-	 */
-	saveoff = uio->uio_offset;
-	diskoff = diskblock * SFS_BLOCKSIZE;
-	uio->uio_offset = diskoff;
+	result = uiomove(sfs_buf_data(buf), SFS_FS_BLOCKSIZE(sfs), uio);
 
 	/*
-	 * Temporarily set the residue to be one block size.
+	 * If a write failed partway and the buffer had no valid
+	 * contents before, leave it invalid rather than caching
+	 * garbage; otherwise whatever got copied is the new data.
 	 */
-	KASSERT(uio->uio_resid >= SFS_BLOCKSIZE);
-	saveres = uio->uio_resid;
-	diskres = SFS_BLOCKSIZE;
-	uio->uio_resid = diskres;
+	if (uio->uio_rw == UIO_WRITE && (result == 0 || sfs_buf_valid(buf))) {
+		sfs_buf_markdirty(buf);
+	}
+	sfs_buf_release(buf);
 
-	result = sfs_rwblock(sfs, uio);
+	return result;
+}
 
-	/*
-	 * Now, restore the original uio_offset and uio_resid and update
-	 * them by the amount of I/O done.
-	 */
-	uio->uio_offset = (uio->uio_offset - diskoff) + saveoff;
-	uio->uio_resid = (uio->uio_resid - diskres) + saveres;
+/*
+ * Longest run of blocks handed to the device at once by O_DIRECT I/O.
+ */
+#define SFS_DIRECT_MAXRUN 16
+
+/*
+ * Move NBLOCKS disk blocks starting at DISKBLOCK straight between
+ * the device and UIO, which is positioned in the file, not on disk.
+ */
+static
+int
+sfs_directrun(struct sfs_fs *sfs, daddr_t diskblock, uint32_t nblocks,
+	      struct uio *uio)
+{
+	off_t filepos;
+	size_t resid, len, done;
+	int result;
+
+	result = sfs_buf_direct(sfs, diskblock, nblocks, uio->uio_rw);
+	if (result) {
+		return result;
+	}
+
+	/* Point the uio at the disk for the transfer, then back */
+	filepos = uio->uio_offset;
+	resid = uio->uio_resid;
+	len = nblocks * SFS_FS_BLOCKSIZE(sfs);
+	KASSERT(len <= resid);
+
+	uio->uio_offset = ((off_t)diskblock) * SFS_FS_BLOCKSIZE(sfs);
+	uio->uio_resid = len;
+	result = sfs_rwblock(sfs, uio);
+	done = len - uio->uio_resid;
 
+	uio->uio_offset = filepos + done;
+	uio->uio_resid = resid - done;
 	return result;
 }
 
+/*
+ * Do I/O of NBLOCKS whole blocks for a file opened with O_DIRECT.
+ * The data goes straight between the device and the uio, leaving the
+ * buffer cache alone; each run of blocks that are contiguous on disk
+ * is one device request. Holes read as zeros, and a write maps its
+ * blocks an extent at a time, allocating any that are missing.
+ *
+ * Pending data (see "Delayed allocation" above) is dropped by a
+ * write, which replaces it, and flushed to the cache before a read,
+ * which can then find it on disk.
+ */
+static
+int
+sfs_directio(struct sfs_vnode *sv, struct uio *uio, uint32_t nblocks)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	daddr_t diskblocks[SFS_DIRECT_MAXRUN];
+	uint32_t fileblock, n, i, run;
+	int result;
+
+	KASSERT(uio->uio_offset % SFS_FS_BLOCKSIZE(sfs) == 0);
+	fileblock = uio->uio_offset / SFS_FS_BLOCKSIZE(sfs);
+
+	if (uio->uio_rw == UIO_WRITE) {
+		sfs_delay_discard(sv, fileblock, fileblock + nblocks);
+	}
+	else {
+		result = sfs_delay_flush(sv);
+		if (result) {
+			return result;
+		}
+	}
+
+	while (nblocks > 0) {
+		n = nblocks < SFS_DIRECT_MAXRUN ? nblocks : SFS_DIRECT_MAXRUN;
+
+		/* Map this batch of file blocks */
+		if (uio->uio_rw == UIO_WRITE) {
+			result = sfs_bmap_extent(sv, fileblock, n, diskblocks);
+		}
+		else {
+			result = 0;
+			for (i=0; i<n && result == 0; i++) {
+				result = sfs_bmap(sv, fileblock + i, false,
+						  &diskblocks[i]);
+			}
+		}
+		if (result) {
+			return result;
+		}
+
+		/* Transfer runs of holes, or of blocks contiguous on disk */
+		for (i=0; i<n; i += run) {
+			for (run = 1; i + run < n; run++) {
+				if (diskblocks[i] == 0 ?
+				    diskblocks[i + run] != 0 :
+				    diskblocks[i + run] != diskblocks[i] + run) {
+					break;
+				}
+			}
+			if (diskblocks[i] == 0) {
+				KASSERT(uio->uio_rw == UIO_READ);
+				result = uiomovezeros(run * SFS_FS_BLOCKSIZE(sfs),
+							      uio);
+			}
+			else {
+				result = sfs_directrun(sfs, diskblocks[i], run,
+						       uio);
+			}
+			if (result) {
+				return result;
+			}
+		}
+
+		fileblock += n;
+		nblocks -= n;
+	}
+	return 0;
+}
+
 /*
  * Do I/O of a whole region of data, whether or not it's block-aligned.
+ * With uio_direct set, the whole blocks in the middle bypass the
+ * buffer cache (see sfs_directio); partial blocks at either end still
+ * go through it.
  */
 int
 sfs_io(struct sfs_vnode *sv, struct uio *uio)
 {
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	uint32_t bsize = SFS_FS_BLOCKSIZE(sfs);
 	uint32_t blkoff;
 	uint32_t nblocks, i;
 	int result = 0;
@@ -322,13 +924,13 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	/*
 	 * First, do any leading partial block.
 	 */
-	blkoff = uio->uio_offset % SFS_BLOCKSIZE;
+	blkoff = uio->uio_offset % bsize;
 	if (blkoff != 0) {
 		/* Number of bytes at beginning of block to skip */
 		uint32_t skip = blkoff;
 
 		/* Number of bytes to read/write after that point */
-		uint32_t len = SFS_BLOCKSIZE - blkoff;
+		uint32_t len = bsize - blkoff;
 
 		/* ...which might be less than the rest of the block */
 		if (len > uio->uio_resid) {
@@ -350,19 +952,27 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	/*
 	 * Now we should be block-aligned. Do the remaining whole blocks.
 	 */
-	KASSERT(uio->uio_offset % SFS_BLOCKSIZE == 0);
-	nblocks = uio->uio_resid / SFS_BLOCKSIZE;
-	for (i=0; i<nblocks; i++) {
-		result = sfs_blockio(sv, uio);
+	KASSERT(uio->uio_offset % bsize == 0);
+	nblocks = uio->uio_resid / bsize;
+	if (uio->uio_direct && nblocks > 0) {
+		result = sfs_directio(sv, uio, nblocks);
 		if (result) {
 			goto out;
 		}
 	}
+	else {
+		for (i=0; i<nblocks; i++) {
+			result = sfs_blockio(sv, uio);
+			if (result) {
+				goto out;
+			}
+		}
+	}
 
 	/*
 	 * Now do any remaining partial block at the end.
 	 */
-	KASSERT(uio->uio_resid < SFS_BLOCKSIZE);
+	KASSERT(uio->uio_resid < bsize);
 
 	if (uio->uio_resid > 0) {
 		result = sfs_partialio(sv, uio, 0, uio->uio_resid);
@@ -388,6 +998,35 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	return result;
 }
 
+/*
+ * Zero LEN bytes of a file starting at POS, all within one block,
+ * without allocating anything: a hole is left alone.
+ */
+int
+sfs_zeroblock(struct sfs_vnode *sv, off_t pos, uint32_t len)
+{
+	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *buf;
+	uint32_t skip;
+	int result;
+
+	skip = pos % SFS_FS_BLOCKSIZE(sfs);
+	KASSERT(skip + len <= SFS_FS_BLOCKSIZE(sfs));
+
+	result = sfs_filebuf(sv, pos / SFS_FS_BLOCKSIZE(sfs), UIO_READ, true,
+			     &buf);
+	if (result) {
+		return result;
+	}
+	if (buf == NULL) {
+		return 0;
+	}
+	bzero((char *)sfs_buf_data(buf) + skip, len);
+	sfs_buf_markdirty(buf);
+	sfs_buf_release(buf);
+	return 0;
+}
+
 ////////////////////////////////////////////////////////////
 // Metadata I/O
 
@@ -407,6 +1046,8 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 	   enum uio_rw rw)
 {
 	struct sfs_fs *sfs = sv->sv_absvn.vn_fs->fs_data;
+	struct sfs_buf *buf;
+	char *blockdata;
 	off_t endpos;
 	uint32_t vnblock;
 	uint32_t blockoffset;
@@ -414,21 +1055,9 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 	bool doalloc;
 	int result;
 
-	/*
-	 * I/O buffer for metadata ops.
-	 *
-	 * Note: in real life (and when you've done the fs assignment) you
-	 * would get space from the disk buffer cache for this, not use a
-	 * static area.
-	 */
-	static char metaiobuf[SFS_BLOCKSIZE];
-
-	/* We're using a global static buffer; it had better be locked */
-	KASSERT(vfs_biglock_do_i_hold());
-
 	/* Figure out which block of the vnode (directory, whatever) this is */
-	vnblock = actualpos / SFS_BLOCKSIZE;
-	blockoffset = actualpos % SFS_BLOCKSIZE;
+	vnblock = actualpos / SFS_FS_BLOCKSIZE(sfs);
+	blockoffset = actualpos % SFS_FS_BLOCKSIZE(sfs);
 
 	/* Get the disk block number */
 	doalloc = (rw == UIO_WRITE);
@@ -446,26 +1075,23 @@ sfs_metaio(struct sfs_vnode *sv, off_t actualpos, void *data, size_t len,
 		return 0;
 	}
 
-	/* Read the block */
-	result = sfs_readblock(sfs, diskblock, metaiobuf, sizeof(metaiobuf));
+	/* Get the block */
+	result = sfs_buf_get(sfs, diskblock, true, &buf);
 	if (result) {
 		return result;
 	}
+	blockdata = sfs_buf_data(buf);
 
 	if (rw == UIO_READ) {
 		/* Copy out the selected region */
-		memcpy(data, metaiobuf + blockoffset, len);
+		memcpy(data, blockdata + blockoffset, len);
+		sfs_buf_release(buf);
 	}
 	else {
 		/* Update the selected region */
-		memcpy(metaiobuf + blockoffset, data, len);
-
-		/* Write the block back */
-		result = sfs_writeblock(sfs, diskblock,
-					metaiobuf, sizeof(metaiobuf));
-		if (result) {
-			return result;
-		}
+		memcpy(blockdata + blockoffset, data, len);
+		sfs_buf_markmeta(buf);
+		sfs_buf_release(buf);
 
 		/* Update the vnode size if needed */
 		endpos = actualpos + len;
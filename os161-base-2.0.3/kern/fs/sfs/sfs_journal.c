@@ -0,0 +1,559 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * SFS filesystem
+ *
+ * Metadata journal.
+ *
+ * On volumes made with a journal (sb_journalblocks != 0), metadata
+ * reaches its home location only after it has been written to the
+ * journal together with everything else that changed with it, so
+ * after a crash the volume is always in the state of some complete
+ * commit and mount only needs to copy the last one back into place.
+ * The on-disk layout is described in <kern/sfs.h>.
+ *
+ * Each operation that changes metadata runs between sfs_jbegin and
+ * sfs_jend. Metadata it changes is dirtied with sfs_buf_markmeta,
+ * which pins the buffer in the cache. A commit waits for all open
+ * handles to close (holding off new ones), copies the dirty inodes,
+ * the freemap and the superblock into the cache, writes the pinned
+ * buffers to the journal in one request followed by a commit block,
+ * and then writes them home (checkpoints them). No handle is open
+ * while that happens, so each commit covers whole operations only.
+ *
+ * Commits are grouped: they happen when the last open handle closes
+ * and either SFS_JOURNAL_HIWAT buffers are pinned or SFS_JOURNAL_AGE
+ * seconds have passed since the last one, and on sync and fsync.
+ * Metadata changed on an otherwise idle volume thus waits for the
+ * next operation or sync.
+ *
+ * File data is not journaled; it is written in place as before.
+ *
+ * sfs_reclaim can be called from inside an operation (when it drops
+ * a vnode reference) as well as from outside, so it uses the nested
+ * forms, which neither wait for a pending commit nor start one. The
+ * committer itself drops vnode references while gathering inodes,
+ * and may reclaim without waiting for itself.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <uio.h>
+#include <clock.h>
+#include <current.h>
+#include <synch.h>
+#include <sfs.h>
+#include "sfsprivate.h"
+
+/* Commit once this many buffers are pinned... */
+#define SFS_JOURNAL_HIWAT	32
+
+/* ... or this many seconds have passed since the last commit */
+#define SFS_JOURNAL_AGE		2
+
+/*
+ * Scratch space for a commit, allocated at mount since it's too big
+ * for the stack. The descriptor, commit record and replay buffer are
+ * each a whole block, carved out of js_space; the records themselves
+ * only use the start of theirs.
+ */
+struct sfs_jscratch {
+	char *js_space;
+	struct sfs_jdesc *js_desc;
+	struct sfs_jcommit *js_commit;
+	char *js_block;
+	struct sfs_buf *js_bufs[SFS_JOURNAL_MAXBLOCKS];
+	daddr_t js_blocks[SFS_JOURNAL_MAXBLOCKS];
+	struct iovec js_iov[SFS_JOURNAL_MAXBLOCKS + 1];
+};
+
+/*
+ * Is there a journal?
+ */
+static
+inline
+bool
+sfs_journaled(struct sfs_fs *sfs)
+{
+	return sfs->sfs_sb.sb_journalblocks != 0;
+}
+
+/*
+ * Most block images one transaction can hold.
+ */
+static
+unsigned
+sfs_journal_max(struct sfs_fs *sfs)
+{
+	unsigned max = sfs->sfs_sb.sb_journalblocks - 2;
+
+	return max < SFS_JOURNAL_MAXBLOCKS ? max : SFS_JOURNAL_MAXBLOCKS;
+}
+
+/*
+ * Checksum (32-bit FNV-1a), continuing from H.
+ */
+static
+uint32_t
+sfs_journal_cksum(uint32_t h, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		h ^= p[i];
+		h *= 16777619U;
+	}
+	return h;
+}
+
+#define SFS_JOURNAL_CKSUM_INIT	2166136261U
+
+/*
+ * Read or write journal block WHICH directly, bypassing the cache;
+ * journal blocks are never cached.
+ */
+static
+int
+sfs_journal_io(struct sfs_fs *sfs, unsigned which, void *data,
+	       enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio ku;
+
+	KASSERT(which < sfs->sfs_sb.sb_journalblocks);
+	SFSUIO(sfs, &iov, &ku, data, sfs->sfs_sb.sb_journalstart + which, rw);
+	return sfs_rwblock(sfs, &ku);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Handles
+
+/*
+ * Start an operation that changes metadata. Waits for any pending
+ * commit first. Must not be holding any other SFS lock.
+ */
+void
+sfs_jbegin(struct sfs_fs *sfs)
+{
+	if (!sfs_journaled(sfs)) {
+		return;
+	}
+	lock_acquire(sfs->sfs_jlock);
+	while (sfs->sfs_jwant || sfs->sfs_jcommitter != NULL) {
+		cv_wait(sfs->sfs_jcv, sfs->sfs_jlock);
+	}
+	sfs->sfs_jactive++;
+	lock_release(sfs->sfs_jlock);
+}
+
+/*
+ * Same, for code that may run inside another operation. Only waits
+ * for a commit that is already being written by someone else.
+ */
+void
+sfs_jbegin_nested(struct sfs_fs *sfs)
+{
+	if (!sfs_journaled(sfs)) {
+		return;
+	}
+	lock_acquire(sfs->sfs_jlock);
+	while (sfs->sfs_jcommitter != NULL &&
+	       sfs->sfs_jcommitter != curthread) {
+		cv_wait(sfs->sfs_jcv, sfs->sfs_jlock);
+	}
+	sfs->sfs_jactive++;
+	lock_release(sfs->sfs_jlock);
+}
+
+/*
+ * Close a handle; returns true if it was the last one.
+ */
+static
+bool
+sfs_jclose(struct sfs_fs *sfs)
+{
+	bool last;
+
+	lock_acquire(sfs->sfs_jlock);
+	KASSERT(sfs->sfs_jactive > 0);
+	sfs->sfs_jactive--;
+	last = sfs->sfs_jactive == 0 && sfs->sfs_jcommitter == NULL;
+	if (sfs->sfs_jactive == 0) {
+		cv_broadcast(sfs->sfs_jcv, sfs->sfs_jlock);
+	}
+	lock_release(sfs->sfs_jlock);
+	return last;
+}
+
+/*
+ * Finish an operation started with sfs_jbegin, committing if it's
+ * time to. Errors from the commit are not reported here; the
+ * metadata stays pinned and goes with the next commit.
+ */
+void
+sfs_jend(struct sfs_fs *sfs)
+{
+	struct timespec now;
+
+	if (!sfs_journaled(sfs)) {
+		return;
+	}
+	if (!sfs_jclose(sfs)) {
+		return;
+	}
+
+	/* Unlocked peeks; being off by one only shifts a commit */
+	gettime_coarse(&now);
+	if (sfs->sfs_jmetadirty >= SFS_JOURNAL_HIWAT ||
+	    now.tv_sec - sfs->sfs_jlastcommit >= SFS_JOURNAL_AGE) {
+		(void)sfs_journal_commit(sfs);
+	}
+}
+
+/*
+ * Finish an operation started with sfs_jbegin_nested.
+ */
+void
+sfs_jend_nested(struct sfs_fs *sfs)
+{
+	if (!sfs_journaled(sfs)) {
+		return;
+	}
+	(void)sfs_jclose(sfs);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Commit
+
+/*
+ * Write one transaction: up to sfs_journal_max pinned buffers, in a
+ * single request with the descriptor, then the commit block, then
+ * the buffers themselves at home. Sets *DONE if that was all of them.
+ */
+static
+int
+sfs_journal_writeone(struct sfs_fs *sfs, bool *done)
+{
+	struct sfs_jscratch *js = sfs->sfs_jscratch;
+	unsigned max = sfs_journal_max(sfs);
+	uint32_t bsize = SFS_FS_BLOCKSIZE(sfs);
+	struct uio ku;
+	uint32_t cksum;
+	unsigned i, n;
+	int result;
+
+	n = sfs_buf_getmeta(sfs, js->js_bufs, js->js_blocks, max);
+	*done = (n < max);
+	if (n == 0) {
+		return 0;
+	}
+
+	bzero(js->js_desc, bsize);
+	js->js_desc->jd_magic = SFS_JDESC_MAGIC;
+	js->js_desc->jd_seq = sfs->sfs_jseq;
+	js->js_desc->jd_count = n;
+	js->js_iov[0].iov_kbase = js->js_desc;
+	js->js_iov[0].iov_len = bsize;
+
+	cksum = SFS_JOURNAL_CKSUM_INIT;
+	for (i=0; i<n; i++) {
+		void *data = sfs_buf_data(js->js_bufs[i]);
+
+		js->js_desc->jd_blocks[i] = js->js_blocks[i];
+		cksum = sfs_journal_cksum(cksum, data, bsize);
+		js->js_iov[i+1].iov_kbase = data;
+		js->js_iov[i+1].iov_len = bsize;
+	}
+
+	ku.uio_iov = js->js_iov;
+	ku.uio_iovcnt = n + 1;
+	ku.uio_offset = ((off_t)sfs->sfs_sb.sb_journalstart) * bsize;
+	ku.uio_resid = (n + 1) * bsize;
+	ku.uio_segflg = UIO_SYSSPACE;
+	ku.uio_rw = UIO_WRITE;
+	ku.uio_space = NULL;
+	ku.uio_direct = false;
+	ku.uio_advice = POSIX_FADV_NORMAL;
+	result = sfs_rwblock(sfs, &ku);
+	if (result) {
+		goto fail;
+	}
+
+	/* Device requests complete in order, so this lands after them */
+	bzero(js->js_commit, bsize);
+	js->js_commit->jc_magic = SFS_JCOMMIT_MAGIC;
+	js->js_commit->jc_seq = sfs->sfs_jseq;
+	js->js_commit->jc_count = n;
+	js->js_commit->jc_checksum = cksum;
+	result = sfs_journal_io(sfs, n + 1, js->js_commit, UIO_WRITE);
+	if (result) {
+		goto fail;
+	}
+	sfs->sfs_jseq++;
+
+	/* Committed; now they may go home */
+	return sfs_buf_checkpoint(js->js_bufs, n);
+
+ fail:
+	/* Leave them pinned for the next try */
+	for (i=0; i<n; i++) {
+		sfs_buf_release(js->js_bufs[i]);
+	}
+	*done = true;
+	return result;
+}
+
+/*
+ * Commit everything changed so far. Waits for open handles to close
+ * and keeps new ones from opening meanwhile. Must not be called with
+ * a handle open or any other SFS lock held.
+ */
+int
+sfs_journal_commit(struct sfs_fs *sfs)
+{
+	struct timespec now;
+	bool done;
+	int result;
+
+	if (!sfs_journaled(sfs)) {
+		return 0;
+	}
+
+	lock_acquire(sfs->sfs_jlock);
+	KASSERT(sfs->sfs_jcommitter != curthread);
+	while (sfs->sfs_jactive > 0 || sfs->sfs_jcommitter != NULL) {
+		sfs->sfs_jwant = true;
+		cv_wait(sfs->sfs_jcv, sfs->sfs_jlock);
+	}
+	sfs->sfs_jcommitter = curthread;
+	lock_release(sfs->sfs_jlock);
+
+	/* Get the inodes, the freemap and the superblock into the cache */
+	result = sfs_sync_meta(sfs);
+
+	done = false;
+	while (result == 0 && !done) {
+		result = sfs_journal_writeone(sfs, &done);
+	}
+
+	gettime_coarse(&now);
+	lock_acquire(sfs->sfs_jlock);
+	sfs->sfs_jcommitter = NULL;
+	sfs->sfs_jwant = false;
+	sfs->sfs_jlastcommit = now.tv_sec;
+	cv_broadcast(sfs->sfs_jcv, sfs->sfs_jlock);
+	lock_release(sfs->sfs_jlock);
+
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Mount and unmount
+
+/*
+ * If the journal holds a complete transaction, copy its images to
+ * their home locations, then mark the journal empty.
+ */
+static
+int
+sfs_journal_replay(struct sfs_fs *sfs)
+{
+	struct sfs_jscratch *js = sfs->sfs_jscratch;
+	struct sfs_jdesc *jd = js->js_desc;
+	struct sfs_jcommit *jc = js->js_commit;
+	uint32_t cksum;
+	unsigned i, n;
+	bool gotsuper;
+	int result;
+
+	result = sfs_journal_io(sfs, 0, jd, UIO_READ);
+	if (result) {
+		return result;
+	}
+	if (jd->jd_magic != SFS_JDESC_MAGIC) {
+		/* Never used */
+		sfs->sfs_jseq = 1;
+		return 0;
+	}
+	sfs->sfs_jseq = jd->jd_seq + 1;
+	n = jd->jd_count;
+	if (n == 0 || n > sfs_journal_max(sfs)) {
+		return 0;
+	}
+
+	result = sfs_journal_io(sfs, n + 1, jc, UIO_READ);
+	if (result) {
+		return result;
+	}
+	if (jc->jc_magic != SFS_JCOMMIT_MAGIC || jc->jc_seq != jd->jd_seq ||
+	    jc->jc_count != n) {
+		/* Crashed before the commit block went out; nothing to do */
+		return 0;
+	}
+	cksum = SFS_JOURNAL_CKSUM_INIT;
+	for (i=0; i<n; i++) {
+		result = sfs_journal_io(sfs, i + 1, js->js_block, UIO_READ);
+		if (result) {
+			return result;
+		}
+		cksum = sfs_journal_cksum(cksum, js->js_block,
+					  SFS_FS_BLOCKSIZE(sfs));
+	}
+	if (cksum != jc->jc_checksum) {
+		kprintf("sfs: %s: journal checksum mismatch; not replayed\n",
+			sfs->sfs_sb.sb_volname);
+		return 0;
+	}
+
+	/* It's good; put it in place */
+	gotsuper = false;
+	for (i=0; i<n; i++) {
+		if (jd->jd_blocks[i] >= sfs->sfs_sb.sb_nblocks) {
+			kprintf("sfs: %s: journal block %u out of range\n",
+				sfs->sfs_sb.sb_volname, jd->jd_blocks[i]);
+			return EINVAL;
+		}
+		result = sfs_journal_io(sfs, i + 1, js->js_block, UIO_READ);
+		if (result) {
+			return result;
+		}
+		result = sfs_writeblock(sfs, jd->jd_blocks[i], js->js_block,
+					SFS_FS_BLOCKSIZE(sfs));
+		if (result) {
+			return result;
+		}
+		if (jd->jd_blocks[i] == SFS_SUPER_BLOCK) {
+			gotsuper = true;
+		}
+	}
+	result = sfs_buf_sync(sfs);
+	if (result) {
+		return result;
+	}
+	kprintf("sfs: %s: replayed %u blocks from the journal\n",
+		sfs->sfs_sb.sb_volname, n);
+
+	/* Keep the sequence number going; just drop the contents */
+	jd->jd_count = 0;
+	result = sfs_journal_io(sfs, 0, jd, UIO_WRITE);
+	if (result) {
+		return result;
+	}
+
+	if (gotsuper) {
+		result = sfs_readblock(sfs, SFS_SUPER_BLOCK, &sfs->sfs_sb,
+				       sizeof(sfs->sfs_sb));
+		if (result) {
+			return result;
+		}
+		sfs->sfs_sb.sb_volname[sizeof(sfs->sfs_sb.sb_volname)-1] = 0;
+	}
+	return 0;
+}
+
+/*
+ * Set up the journal at mount time, replaying it if need be. Called
+ * after the superblock is loaded and before anything else is read.
+ */
+int
+sfs_journal_mount(struct sfs_fs *sfs)
+{
+	struct sfs_superblock *sb = &sfs->sfs_sb;
+	uint32_t bsize = SFS_FS_BLOCKSIZE(sfs);
+	struct sfs_jscratch *js;
+	struct timespec now;
+	uint32_t jstart, jblocks;
+
+	if (!sfs_journaled(sfs)) {
+		return 0;
+	}
+
+	jstart = sb->sb_journalstart;
+	jblocks = sb->sb_journalblocks;
+	if (jblocks < 3 ||
+	    jstart < SFS_FREEMAP_START +
+	    SFS_FREEMAPBLOCKS(sb->sb_nblocks, bsize) ||
+	    jstart >= sb->sb_nblocks || jblocks > sb->sb_nblocks - jstart) {
+		kprintf("sfs: %s: bad journal location %u, size %u\n",
+			sb->sb_volname, jstart, jblocks);
+		return EINVAL;
+	}
+
+	sfs->sfs_jlock = lock_create("sfs journal");
+	sfs->sfs_jcv = cv_create("sfs journal");
+	sfs->sfs_jscratch = js = kmalloc(sizeof(*js));
+	if (js != NULL) {
+		js->js_space = kmalloc(3 * bsize);
+	}
+	if (sfs->sfs_jlock == NULL || sfs->sfs_jcv == NULL || js == NULL ||
+	    js->js_space == NULL) {
+		return ENOMEM;
+	}
+	js->js_desc = (struct sfs_jdesc *)js->js_space;
+	js->js_commit = (struct sfs_jcommit *)(js->js_space + bsize);
+	js->js_block = js->js_space + 2 * bsize;
+	sfs->sfs_jactive = 0;
+	sfs->sfs_jwant = false;
+	sfs->sfs_jcommitter = NULL;
+	sfs->sfs_jmetadirty = 0;
+	gettime_coarse(&now);
+	sfs->sfs_jlastcommit = now.tv_sec;
+
+	return sfs_journal_replay(sfs);
+}
+
+/*
+ * Release the journal's resources. Safe to call however far
+ * sfs_journal_mount got.
+ */
+void
+sfs_journal_destroy(struct sfs_fs *sfs)
+{
+	KASSERT(sfs->sfs_jactive == 0 && sfs->sfs_jmetadirty == 0);
+
+	if (sfs->sfs_jlock != NULL) {
+		lock_destroy(sfs->sfs_jlock);
+		sfs->sfs_jlock = NULL;
+	}
+	if (sfs->sfs_jcv != NULL) {
+		cv_destroy(sfs->sfs_jcv);
+		sfs->sfs_jcv = NULL;
+	}
+	if (sfs->sfs_jscratch != NULL) {
+		kfree(sfs->sfs_jscratch->js_space);
+		kfree(sfs->sfs_jscratch);
+		sfs->sfs_jscratch = NULL;
+	}
+}
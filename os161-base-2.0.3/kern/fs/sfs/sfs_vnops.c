@@ -38,6 +38,7 @@
 #include <stat.h>
 #include <lib.h>
 #include <uio.h>
+#include <synch.h>
 #include <vfs.h>
 #include <sfs.h>
 #include "sfsprivate.h"
@@ -102,9 +103,9 @@ sfs_read(struct vnode *v, struct uio *uio)
 
 	KASSERT(uio->uio_rw==UIO_READ);
 
-	vfs_biglock_acquire();
+	lock_acquire(sv->sv_lock);
 	result = sfs_io(sv, uio);
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
 
 	return result;
 }
@@ -116,14 +117,17 @@ static
 int
 sfs_write(struct vnode *v, struct uio *uio)
 {
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
 	struct sfs_vnode *sv = v->vn_data;
 	int result;
 
 	KASSERT(uio->uio_rw==UIO_WRITE);
 
-	vfs_biglock_acquire();
+	sfs_jbegin(sfs);
+	lock_acquire(sv->sv_lock);
 	result = sfs_io(sv, uio);
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
+	sfs_jend(sfs);
 
 	return result;
 }
@@ -153,6 +157,7 @@ static
 int
 sfs_stat(struct vnode *v, struct stat *statbuf)
 {
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
 	struct sfs_vnode *sv = v->vn_data;
 	int result;
 
@@ -164,11 +169,14 @@ sfs_stat(struct vnode *v, struct stat *statbuf)
 		return result;
 	}
 
+	lock_acquire(sv->sv_lock);
 	statbuf->st_size = sv->sv_i.sfi_size;
 	statbuf->st_nlink = sv->sv_i.sfi_linkcount;
+	lock_release(sv->sv_lock);
 
 	/* We don't support this yet */
 	statbuf->st_blocks = 0;
+	statbuf->st_blksize = SFS_FS_BLOCKSIZE(sfs);
 
 	/* Fill in other fields as desired/possible... */
 
@@ -177,6 +185,8 @@ sfs_stat(struct vnode *v, struct stat *statbuf)
 
 /*
  * Return the type of the file (types as per kern/stat.h)
+ *
+ * The type never changes once the vnode is loaded, so no locking.
  */
 static
 int
@@ -185,16 +195,12 @@ sfs_gettype(struct vnode *v, uint32_t *ret)
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = v->vn_fs->fs_data;
 
-	vfs_biglock_acquire();
-
 	switch (sv->sv_i.sfi_type) {
 	case SFS_TYPE_FILE:
 		*ret = S_IFREG;
-		vfs_biglock_release();
 		return 0;
 	case SFS_TYPE_DIR:
 		*ret = S_IFDIR;
-		vfs_biglock_release();
 		return 0;
 	}
 	panic("sfs: %s: gettype: Invalid inode type (inode %u, type %u)\n",
@@ -221,25 +227,69 @@ static
 int
 sfs_fsync(struct vnode *v)
 {
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
 	struct sfs_vnode *sv = v->vn_data;
 	int result;
 
-	vfs_biglock_acquire();
+	if (sfs->sfs_sb.sb_journalblocks != 0) {
+		/* The inode can only go to disk with a commit */
+		result = sfs_journal_commit(sfs);
+		if (result == 0) {
+			result = sfs_buf_sync(sfs);
+		}
+		return result;
+	}
+
+	lock_acquire(sv->sv_lock);
 	result = sfs_sync_inode(sv);
-	vfs_biglock_release();
+	if (result == 0) {
+		/* Get the inode and everything else cached to disk */
+		result = sfs_buf_sync(sv->sv_absvn.vn_fs->fs_data);
+	}
+	lock_release(sv->sv_lock);
 
 	return result;
 }
 
 /*
- * Called for mmap().
+ * Called for mmap(). Any file can be mapped; the VM system reads and
+ * writes the pages itself.
  */
 static
 int
-sfs_mmap(struct vnode *v   /* add stuff as needed */)
+sfs_mmap(struct vnode *v)
 {
 	(void)v;
-	return ENOSYS;
+	return 0;
+}
+
+/*
+ * Called for prefetch hints, such as exec's for the segments of a
+ * program about to be loaded.
+ */
+static
+void
+sfs_prefetch(struct vnode *v, off_t pos, off_t len)
+{
+	struct sfs_vnode *sv = v->vn_data;
+
+	lock_acquire(sv->sv_lock);
+	sfs_ra_prefetch(sv, pos, len);
+	lock_release(sv->sv_lock);
+}
+
+/*
+ * Called for hints that part of a file won't be read again soon.
+ */
+static
+void
+sfs_dontneed(struct vnode *v, off_t pos, off_t len)
+{
+	struct sfs_vnode *sv = v->vn_data;
+
+	lock_acquire(sv->sv_lock);
+	sfs_ra_dontneed(sv, pos, len);
+	lock_release(sv->sv_lock);
 }
 
 /*
@@ -249,9 +299,79 @@ static
 int
 sfs_truncate(struct vnode *v, off_t len)
 {
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	struct sfs_vnode *sv = v->vn_data;
+	int result;
+
+	sfs_jbegin(sfs);
+	lock_acquire(sv->sv_lock);
+	result = sfs_itrunc(sv, len);
+	lock_release(sv->sv_lock);
+	sfs_jend(sfs);
+
+	return result;
+}
+
+/*
+ * Punch a hole in a file. Whole blocks in the range are freed; the
+ * parts of partial blocks at either end are zeroed in place. Nothing
+ * past EOF needs discarding, and the last block of the file is freed
+ * whole if the range runs to EOF.
+ */
+static
+int
+sfs_punch(struct vnode *v, off_t pos, off_t len)
+{
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
 	struct sfs_vnode *sv = v->vn_data;
+	uint32_t bsize = SFS_FS_BLOCKSIZE(sfs);
+	off_t size, end;
+	uint32_t n, first, last;
+	int result = 0;
+
+	if (pos < 0 || len <= 0) {
+		return EINVAL;
+	}
+
+	sfs_jbegin(sfs);
+	lock_acquire(sv->sv_lock);
+
+	size = sv->sv_i.sfi_size;
+	if (pos >= size) {
+		goto out;
+	}
+	end = (len > size - pos) ? size : pos + len;
 
-	return sfs_itrunc(sv, len);
+	/* Partial block at the start */
+	if (pos % bsize != 0) {
+		n = bsize - pos % bsize;
+		if (n > end - pos) {
+			n = end - pos;
+		}
+		result = sfs_zeroblock(sv, pos, n);
+		if (result) {
+			goto out;
+		}
+		pos += n;
+	}
+
+	/* Partial block at the end, unless it's the file's last */
+	if (end > pos && end < size && end % bsize != 0) {
+		result = sfs_zeroblock(sv, end - end % bsize, end % bsize);
+		if (result) {
+			goto out;
+		}
+	}
+
+	/* Whole blocks in between */
+	first = DIVROUNDUP(pos, bsize);
+	last = (end == size) ? DIVROUNDUP(end, bsize) : end / bsize;
+	result = sfs_ifree(sv, first, last);
+
+ out:
+	lock_release(sv->sv_lock);
+	sfs_jend(sfs);
+	return result;
 }
 
 /*
@@ -280,7 +400,7 @@ sfs_namefile(struct vnode *vv, struct uio *uio)
  */
 static
 int
-sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
+sfs_docreat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	  struct vnode **ret)
 {
 	struct sfs_fs *sfs = v->vn_fs->fs_data;
@@ -289,18 +409,18 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	uint32_t ino;
 	int result;
 
-	vfs_biglock_acquire();
+	lock_acquire(sv->sv_lock);
 
 	/* Look up the name */
 	result = sfs_dir_findname(sv, name, &ino, NULL, NULL);
 	if (result!=0 && result!=ENOENT) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
 	/* If it exists and we didn't want it to, fail */
 	if (result==0 && excl) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return EEXIST;
 	}
 
@@ -308,18 +428,18 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 		/* We got something; load its vnode and return */
 		result = sfs_loadvnode(sfs, ino, SFS_TYPE_INVAL, &newguy);
 		if (result) {
-			vfs_biglock_release();
+			lock_release(sv->sv_lock);
 			return result;
 		}
 		*ret = &newguy->sv_absvn;
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return 0;
 	}
 
 	/* Didn't exist - create it */
-	result = sfs_makeobj(sfs, SFS_TYPE_FILE, &newguy);
+	result = sfs_makeobj(sfs, SFS_TYPE_FILE, sv->sv_ino, &newguy);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
@@ -330,22 +450,42 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
 	result = sfs_dir_link(sv, name, newguy->sv_ino, NULL);
 	if (result) {
 		VOP_DECREF(&newguy->sv_absvn);
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
 	/* Update the linkcount of the new file */
+	lock_acquire(newguy->sv_lock);
 	newguy->sv_i.sfi_linkcount++;
 
 	/* and consequently mark it dirty. */
 	newguy->sv_dirty = true;
+	lock_release(newguy->sv_lock);
 
 	*ret = &newguy->sv_absvn;
 
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
 	return 0;
 }
 
+/*
+ * Journal handle around sfs_docreat, and likewise for the other
+ * directory operations below.
+ */
+static
+int
+sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
+	  struct vnode **ret)
+{
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	int result;
+
+	sfs_jbegin(sfs);
+	result = sfs_docreat(v, name, excl, mode, ret);
+	sfs_jend(sfs);
+	return result;
+}
+
 /*
  * Make a hard link to a file.
  * The VFS layer should prevent this being called unless both
@@ -353,7 +493,7 @@ sfs_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
  */
 static
 int
-sfs_link(struct vnode *dir, const char *name, struct vnode *file)
+sfs_dolink(struct vnode *dir, const char *name, struct vnode *file)
 {
 	struct sfs_vnode *sv = dir->vn_data;
 	struct sfs_vnode *f = file->vn_data;
@@ -361,47 +501,65 @@ sfs_link(struct vnode *dir, const char *name, struct vnode *file)
 
 	KASSERT(file->vn_fs == dir->vn_fs);
 
-	vfs_biglock_acquire();
+	lock_acquire(sv->sv_lock);
 
 	/* Hard links to directories aren't allowed. */
 	if (f->sv_i.sfi_type == SFS_TYPE_DIR) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return EINVAL;
 	}
 
 	/* Create the link */
 	result = sfs_dir_link(sv, name, f->sv_ino, NULL);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
 	/* and update the link count, marking the inode dirty */
+	lock_acquire(f->sv_lock);
 	f->sv_i.sfi_linkcount++;
 	f->sv_dirty = true;
+	lock_release(f->sv_lock);
 
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
 	return 0;
 }
 
+/*
+ * Journal handle around sfs_dolink.
+ */
+static
+int
+sfs_link(struct vnode *dir, const char *name, struct vnode *file)
+{
+	struct sfs_fs *sfs = dir->vn_fs->fs_data;
+	int result;
+
+	sfs_jbegin(sfs);
+	result = sfs_dolink(dir, name, file);
+	sfs_jend(sfs);
+	return result;
+}
+
 /*
  * Delete a file.
  */
 static
 int
-sfs_remove(struct vnode *dir, const char *name)
+sfs_doremove(struct vnode *dir, const char *name)
 {
 	struct sfs_vnode *sv = dir->vn_data;
 	struct sfs_vnode *victim;
 	int slot;
 	int result;
 
-	vfs_biglock_acquire();
+	lock_acquire(sv->sv_lock);
 
 	/* Look for the file and fetch a vnode for it. */
 	result = sfs_lookonce(sv, name, &victim, &slot);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
@@ -409,15 +567,33 @@ sfs_remove(struct vnode *dir, const char *name)
 	result = sfs_dir_unlink(sv, slot);
 	if (result==0) {
 		/* If we succeeded, decrement the link count. */
+		lock_acquire(victim->sv_lock);
 		KASSERT(victim->sv_i.sfi_linkcount > 0);
 		victim->sv_i.sfi_linkcount--;
 		victim->sv_dirty = true;
+		lock_release(victim->sv_lock);
 	}
 
 	/* Discard the reference that sfs_lookonce got us */
 	VOP_DECREF(&victim->sv_absvn);
 
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
+	return result;
+}
+
+/*
+ * Journal handle around sfs_doremove.
+ */
+static
+int
+sfs_remove(struct vnode *dir, const char *name)
+{
+	struct sfs_fs *sfs = dir->vn_fs->fs_data;
+	int result;
+
+	sfs_jbegin(sfs);
+	result = sfs_doremove(dir, name);
+	sfs_jend(sfs);
 	return result;
 }
 
@@ -429,7 +605,7 @@ sfs_remove(struct vnode *dir, const char *name)
  */
 static
 int
-sfs_rename(struct vnode *d1, const char *n1,
+sfs_dorename(struct vnode *d1, const char *n1,
 	   struct vnode *d2, const char *n2)
 {
 	struct sfs_vnode *sv = d1->vn_data;
@@ -438,15 +614,15 @@ sfs_rename(struct vnode *d1, const char *n1,
 	int slot1, slot2;
 	int result, result2;
 
-	vfs_biglock_acquire();
-
 	KASSERT(d1==d2);
 	KASSERT(sv->sv_ino == SFS_ROOTDIR_INO);
 
+	lock_acquire(sv->sv_lock);
+
 	/* Look up the old name of the file and get its inode and slot number*/
 	result = sfs_lookonce(sv, n1, &g1, &slot1);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
@@ -467,8 +643,10 @@ sfs_rename(struct vnode *d1, const char *n1,
 	}
 
 	/* Increment the link count, and mark inode dirty */
+	lock_acquire(g1->sv_lock);
 	g1->sv_i.sfi_linkcount++;
 	g1->sv_dirty = true;
+	lock_release(g1->sv_lock);
 
 	/* Unlink the old slot */
 	result = sfs_dir_unlink(sv, slot1);
@@ -480,14 +658,16 @@ sfs_rename(struct vnode *d1, const char *n1,
 	 * Decrement the link count again, and mark the inode dirty again,
 	 * in case it's been synced behind our back.
 	 */
+	lock_acquire(g1->sv_lock);
 	KASSERT(g1->sv_i.sfi_linkcount>0);
 	g1->sv_i.sfi_linkcount--;
 	g1->sv_dirty = true;
+	lock_release(g1->sv_lock);
 
 	/* Let go of the reference to g1 */
 	VOP_DECREF(&g1->sv_absvn);
 
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
 	return 0;
 
  puke_harder:
@@ -503,11 +683,30 @@ sfs_rename(struct vnode *d1, const char *n1,
 		panic("sfs: %s: rename: Cannot recover\n",
 		      sfs->sfs_sb.sb_volname);
 	}
+	lock_acquire(g1->sv_lock);
 	g1->sv_i.sfi_linkcount--;
+	lock_release(g1->sv_lock);
  puke:
 	/* Let go of the reference to g1 */
 	VOP_DECREF(&g1->sv_absvn);
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
+	return result;
+}
+
+/*
+ * Journal handle around sfs_dorename.
+ */
+static
+int
+sfs_rename(struct vnode *d1, const char *n1,
+	   struct vnode *d2, const char *n2)
+{
+	struct sfs_fs *sfs = d1->vn_fs->fs_data;
+	int result;
+
+	sfs_jbegin(sfs);
+	result = sfs_dorename(d1, n1, d2, n2);
+	sfs_jend(sfs);
 	return result;
 }
 
@@ -525,15 +724,13 @@ sfs_lookparent(struct vnode *v, char *path, struct vnode **ret,
 {
 	struct sfs_vnode *sv = v->vn_data;
 
-	vfs_biglock_acquire();
+	/* Nothing here changes, so the vnode needn't be locked */
 
 	if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
-		vfs_biglock_release();
 		return ENOTDIR;
 	}
 
 	if (strlen(path)+1 > buflen) {
-		vfs_biglock_release();
 		return ENAMETOOLONG;
 	}
 	strcpy(buf, path);
@@ -541,10 +738,27 @@ sfs_lookparent(struct vnode *v, char *path, struct vnode **ret,
 	VOP_INCREF(&sv->sv_absvn);
 	*ret = &sv->sv_absvn;
 
-	vfs_biglock_release();
 	return 0;
 }
 
+/*
+ * Batched directory read.
+ */
+static
+int
+sfs_getdirents(struct vnode *v, struct uio *uio)
+{
+	struct sfs_vnode *sv = v->vn_data;
+	int result;
+
+	KASSERT(uio->uio_rw == UIO_READ);
+
+	lock_acquire(sv->sv_lock);
+	result = sfs_dir_getdirents(sv, uio);
+	lock_release(sv->sv_lock);
+	return result;
+}
+
 /*
  * Lookup gets a vnode for a pathname.
  *
@@ -559,22 +773,22 @@ sfs_lookup(struct vnode *v, char *path, struct vnode **ret)
 	struct sfs_vnode *final;
 	int result;
 
-	vfs_biglock_acquire();
+	lock_acquire(sv->sv_lock);
 
 	if (sv->sv_i.sfi_type != SFS_TYPE_DIR) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return ENOTDIR;
 	}
 
 	result = sfs_lookonce(sv, path, &final, NULL);
 	if (result) {
-		vfs_biglock_release();
+		lock_release(sv->sv_lock);
 		return result;
 	}
 
 	*ret = &final->sv_absvn;
 
-	vfs_biglock_release();
+	lock_release(sv->sv_lock);
 	return 0;
 }
 
@@ -593,6 +807,7 @@ const struct vnode_ops sfs_fileops = {
 	.vop_read = sfs_read,
 	.vop_readlink = vopfail_uio_notdir,
 	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_getdirents = vopfail_uio_notdir,
 	.vop_write = sfs_write,
 	.vop_ioctl = sfs_ioctl,
 	.vop_stat = sfs_stat,
@@ -601,6 +816,10 @@ const struct vnode_ops sfs_fileops = {
 	.vop_fsync = sfs_fsync,
 	.vop_mmap = sfs_mmap,
 	.vop_truncate = sfs_truncate,
+	.vop_punch = sfs_punch,
+	.vop_poll = vnode_poll_ready,
+	.vop_prefetch = sfs_prefetch,
+	.vop_dontneed = sfs_dontneed,
 	.vop_namefile = vopfail_uio_notdir,
 
 	.vop_creat = vopfail_creat_notdir,
@@ -627,6 +846,7 @@ const struct vnode_ops sfs_dirops = {
 	.vop_read = vopfail_uio_isdir,
 	.vop_readlink = vopfail_uio_inval,
 	.vop_getdirentry = vopfail_uio_nosys,
+	.vop_getdirents = sfs_getdirents,
 	.vop_write = vopfail_uio_isdir,
 	.vop_ioctl = sfs_ioctl,
 	.vop_stat = sfs_stat,
@@ -635,6 +855,10 @@ const struct vnode_ops sfs_dirops = {
 	.vop_fsync = sfs_fsync,
 	.vop_mmap = vopfail_mmap_isdir,
 	.vop_truncate = vopfail_truncate_isdir,
+	.vop_punch = vopfail_punch_isdir,
+	.vop_poll = vnode_poll_ready,
+	.vop_prefetch = vnode_prefetch_none,
+	.vop_dontneed = vnode_dontneed_none,
 	.vop_namefile = sfs_namefile,
 
 	.vop_creat = sfs_creat,
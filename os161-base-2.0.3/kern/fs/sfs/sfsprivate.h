@@ -38,18 +38,49 @@ extern const struct vnode_ops sfs_fileops;
 extern const struct vnode_ops sfs_dirops;
 
 /* Macro for initializing a uio structure */
-#define SFSUIO(iov, uio, ptr, block, rw) \
-    uio_kinit(iov, uio, ptr, SFS_BLOCKSIZE, ((off_t)(block))*SFS_BLOCKSIZE, rw)
+#define SFSUIO(sfs, iov, uio, ptr, block, rw) \
+    uio_kinit(iov, uio, ptr, SFS_FS_BLOCKSIZE(sfs), \
+	      ((off_t)(block))*SFS_FS_BLOCKSIZE(sfs), rw)
 
 
 /* Functions in sfs_balloc.c */
-int sfs_balloc(struct sfs_fs *sfs, daddr_t *diskblock);
+int sfs_balloc(struct sfs_fs *sfs, daddr_t goal, daddr_t *diskblock);
+daddr_t sfs_balloc_extent(struct sfs_fs *sfs, daddr_t goal, unsigned n);
 void sfs_bfree(struct sfs_fs *sfs, daddr_t diskblock);
+void sfs_bfreelist(struct sfs_fs *sfs, const daddr_t *blocks, unsigned n);
 int sfs_bused(struct sfs_fs *sfs, daddr_t diskblock);
 
+/* Functions in sfs_buf.c */
+struct sfs_buf;
+int sfs_buf_bootstrap(void);
+int sfs_buf_attach(struct sfs_fs *sfs);
+int sfs_buf_get(struct sfs_fs *sfs, daddr_t block, bool fill,
+		struct sfs_buf **ret);
+void *sfs_buf_data(struct sfs_buf *buf);
+bool sfs_buf_valid(struct sfs_buf *buf);
+void sfs_buf_markdirty(struct sfs_buf *buf);
+void sfs_buf_markmeta(struct sfs_buf *buf);
+void sfs_buf_release(struct sfs_buf *buf);
+void sfs_buf_hold(struct sfs_buf *buf);
+int sfs_buf_getanon(struct sfs_fs *sfs, struct sfs_buf **ret);
+void sfs_buf_putanon(struct sfs_buf *buf);
+void sfs_buf_prefetch(struct sfs_fs *sfs, daddr_t block, unsigned nblocks);
+void sfs_buf_forget(struct sfs_fs *sfs, const daddr_t *blocks, unsigned n);
+void sfs_buf_demote(struct sfs_fs *sfs, const daddr_t *blocks, unsigned n);
+int sfs_buf_direct(struct sfs_fs *sfs, daddr_t block, unsigned nblocks,
+		enum uio_rw rw);
+unsigned sfs_buf_getmeta(struct sfs_fs *sfs, struct sfs_buf **bufs,
+		daddr_t *blocks, unsigned max);
+int sfs_buf_checkpoint(struct sfs_buf **bufs, unsigned n);
+int sfs_buf_sync(struct sfs_fs *sfs);
+void sfs_buf_detach(struct sfs_fs *sfs);
+
 /* Functions in sfs_bmap.c */
 int sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, bool doalloc,
 		daddr_t *diskblock);
+int sfs_bmap_extent(struct sfs_vnode *sv, uint32_t fileblock, unsigned n,
+		daddr_t *diskblocks);
+int sfs_ifree(struct sfs_vnode *sv, uint32_t from, uint32_t to);
 int sfs_itrunc(struct sfs_vnode *sv, off_t len);
 
 /* Functions in sfs_dir.c */
@@ -58,24 +89,48 @@ int sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 int sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino,
 		int *slot);
 int sfs_dir_unlink(struct sfs_vnode *sv, int slot);
+void sfs_dir_dropindex(struct sfs_vnode *sv);
+int sfs_dir_getdirents(struct sfs_vnode *sv, struct uio *uio);
 int sfs_lookonce(struct sfs_vnode *sv, const char *name,
 		struct sfs_vnode **ret,
 		int *slot);
 
+/* Functions in sfs_fsops.c */
+int sfs_sync_meta(struct sfs_fs *sfs);
+
+/* Functions in sfs_journal.c */
+void sfs_jbegin(struct sfs_fs *sfs);
+void sfs_jbegin_nested(struct sfs_fs *sfs);
+void sfs_jend(struct sfs_fs *sfs);
+void sfs_jend_nested(struct sfs_fs *sfs);
+int sfs_journal_commit(struct sfs_fs *sfs);
+int sfs_journal_mount(struct sfs_fs *sfs);
+void sfs_journal_destroy(struct sfs_fs *sfs);
+
 /* Functions in sfs_inode.c */
 int sfs_sync_inode(struct sfs_vnode *sv);
 int sfs_reclaim(struct vnode *v);
 int sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 		struct sfs_vnode **ret);
-int sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret);
+int sfs_makeobj(struct sfs_fs *sfs, int type, daddr_t near,
+		struct sfs_vnode **ret);
 int sfs_getroot(struct fs *fs, struct vnode **ret);
+unsigned sfs_idle_trim(struct sfs_fs *sfs, unsigned keep, bool cleanonly);
 
 /* Functions in sfs_io.c */
+int sfs_rwblock(struct sfs_fs *sfs, struct uio *uio);
 int sfs_readblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len);
 int sfs_writeblock(struct sfs_fs *sfs, daddr_t block, void *data, size_t len);
+int sfs_writemeta(struct sfs_fs *sfs, daddr_t block, void *data, size_t len);
 int sfs_io(struct sfs_vnode *sv, struct uio *uio);
 int sfs_metaio(struct sfs_vnode *sv, off_t pos, void *data, size_t len,
 	       enum uio_rw rw);
+void sfs_ra_init(struct sfs_vnode *sv);
+void sfs_ra_prefetch(struct sfs_vnode *sv, off_t pos, off_t len);
+void sfs_ra_dontneed(struct sfs_vnode *sv, off_t pos, off_t len);
+int sfs_delay_flush(struct sfs_vnode *sv);
+void sfs_delay_discard(struct sfs_vnode *sv, uint32_t from, uint32_t to);
+int sfs_zeroblock(struct sfs_vnode *sv, off_t pos, uint32_t len);
 
 
 #endif /* _SFSPRIVATE_H_ */
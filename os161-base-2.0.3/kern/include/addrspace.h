@@ -38,15 +38,32 @@
 
 
 #include <vm.h>
+#include <platform/maxcpus.h>
 #include "opt-dumbvm.h"
+#include "opt-shell.h"
 
 struct vnode;
+struct kinfo_proc;
+struct shmseg;
+struct ckpt_region;
 
 struct region {     
     vaddr_t vbase;
     size_t npages;
     uint32_t writeable_bit;
     uint32_t old_writeable_bit;
+#if OPT_SHELL
+    vaddr_t filevaddr;      /* contents read from the executable, */
+    off_t fileoff;          /* as recorded by as_define_file */
+    size_t filesz;
+    struct vnode *mapvn;    /* file mapped by mmap, or NULL; */
+    off_t mapoff;           /* its offset at vbase, */
+    bool mapshared;         /* and whether stores go to the file */
+    bool mapanon;           /* anonymous mapping (mapvn is NULL) */
+    bool kinfo;             /* the kernel info pages (kern/kinfo.h) */
+    struct shmseg *shm;     /* shared memory segment attached, or NULL */
+    int advice;             /* access pattern given to madvise (MADV_*) */
+#endif
     struct region *next;
 };
 
@@ -59,6 +76,26 @@ struct region {
 
 struct addrspace {
 #if OPT_DUMBVM
+#if OPT_SHELL
+        struct region *as_regions;      /* sorted by address */
+        struct region **as_regindex;    /* as_regions as an array, for binary search */
+        unsigned as_nregindex;          /* entries in as_regindex */
+        unsigned as_regindexmax;        /* ...and room for them */
+        bool as_regstale;               /* as_regions changed since it was built */
+        struct region *as_heap;         /* heap region (in as_regions) */
+        vaddr_t as_heapbrk;             /* current break */
+        struct region *as_stack;        /* stack region (in as_regions) */
+        size_t as_stackmax;             /* pages it may grow to */
+        uint32_t **as_pagetable;        /* two-level page table */
+        struct vnode *as_file;          /* executable, for demand paging */
+        paddr_t as_kinfo;               /* own kernel info page, or 0 */
+        unsigned as_mapgen;             /* bumped whenever pages are unmapped */
+        unsigned long as_commit;        /* pages of memory committed to it */
+        bool as_oomkilled;              /* its process was killed for memory */
+        bool as_loaded;                 /* as_prepare_load has been called */
+        uint8_t as_asid[MAXCPUS];       /* TLB address-space ID on each cpu */
+        uint32_t as_asidgen[MAXCPUS];   /* ...valid if this is the cpu's generation */
+#else
         vaddr_t as_vbase1;
         paddr_t as_pbase1;
         size_t as_npages1;
@@ -66,6 +103,7 @@ struct addrspace {
         paddr_t as_pbase2;
         size_t as_npages2;
         paddr_t as_stackpbase;
+#endif
 #else
         /* Put stuff here for your VM system */
         
@@ -114,6 +152,73 @@ struct addrspace {
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
  *
+ *    as_define_file - (OPT_SHELL) record that part of a region is
+ *                backed by an executable, so that its pages can be read
+ *                in on first access instead of at load time.
+ *
+ *    as_sbrk   - (OPT_SHELL) move the end of the heap, which starts
+ *                right after the program's segments, by AMOUNT bytes
+ *                and hand back the old end.
+ *
+ *    as_mmap   - (OPT_SHELL) map LEN bytes of V from OFFSET (page
+ *                aligned) into a new region, and hand back its address.
+ *                SHARED mappings write through to the file; private
+ *                ones get copies of pages as they are written. If V
+ *                is NULL the pages are zero-filled instead, and if
+ *                SHARED, stay shared with children across as_copy.
+ *
+ *    as_munmap - (OPT_SHELL) remove the pages from VADDR to VADDR+LEN
+ *                from whatever mappings they are in, writing shared
+ *                file pages back to their files.
+ *
+ *    as_msync  - (OPT_SHELL) write the shared mapped pages from VADDR
+ *                to VADDR+LEN back to their files, and if WAIT is set
+ *                push them to disk.
+ *
+ *    as_madvise - (OPT_SHELL) take ADVICE (MADV_*) about how the pages
+ *                from VADDR to VADDR+LEN will be used: the access
+ *                pattern is kept per region and sizes the read-ahead of
+ *                file mappings; MADV_WILLNEED and MADV_DONTNEED are
+ *                passed on to the file and the page replacement.
+ *
+ *    as_shmat  - (OPT_SHELL) attach the shared memory segment ID (see
+ *                vm_shmget) as a new region, read-only if READONLY
+ *                is set, and hand back its address. The region stays
+ *                attached in children across as_copy.
+ *
+ *    as_shmdt  - (OPT_SHELL) detach the shared memory segment attached
+ *                at VADDR. The segment goes away with its last
+ *                attachment.
+ *
+ *    as_committed - (OPT_SHELL) the number of pages of memory committed
+ *                to the address space, which are what requests to
+ *                define, grow or copy it are refused for.
+ *
+ *    as_oomvictim - (OPT_SHELL) note that the process of the address
+ *                space is being killed to free memory, so page faults
+ *                short of memory wait for it to go away.
+ *
+ *    as_checkrange - (OPT_SHELL) check, against the regions of the
+ *                address space, that the LEN bytes at VA are valid user
+ *                memory, and writeable if WRITE is set. Returns EFAULT
+ *                if they aren't. Takes O(log n) steps per region the
+ *                range goes through, and touches no page.
+ *
+ *    as_kinfo  - (OPT_SHELL) the process part of the kernel info pages
+ *                of the address space (see kern/kinfo.h), for the
+ *                kernel to fill in, or NULL if it has none. They are
+ *                set up by as_define_stack.
+ *
+ *    as_checkpoint - (OPT_SHELL) describe the regions of the address
+ *                space for a checkpoint image (see checkpoint.h), with
+ *                how much of each has ever been touched, and hand back
+ *                the break. Fails for shared mappings and segments.
+ *
+ *    as_restore - (OPT_SHELL) fill an address space fresh from
+ *                as_create with the regions of the checkpoint image
+ *                VN. Their pages are read from VN on first access, as
+ *                an executable's are; nothing is read here.
+ *
  * Note that when using dumbvm, addrspace.c is not used and these
  * functions are found in dumbvm.c.
  */
@@ -132,6 +237,34 @@ int               as_define_region(struct addrspace *as,
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+#if OPT_SHELL
+int               as_define_file(struct addrspace *as, struct vnode *v,
+                                 off_t offset, vaddr_t vaddr, size_t filesize);
+int               as_sbrk(struct addrspace *as, intptr_t amount,
+                          vaddr_t *oldbrk);
+int               as_mmap(struct addrspace *as, size_t len, int writeable,
+                          bool shared, struct vnode *v, off_t offset,
+                          vaddr_t *ret);
+int               as_munmap(struct addrspace *as, vaddr_t vaddr, size_t len);
+int               as_msync(struct addrspace *as, vaddr_t vaddr, size_t len,
+                           bool wait);
+int               as_madvise(struct addrspace *as, vaddr_t vaddr, size_t len,
+                             int advice);
+int               as_shmat(struct addrspace *as, int id, bool readonly,
+                           vaddr_t *ret);
+int               as_shmdt(struct addrspace *as, vaddr_t vaddr);
+unsigned long     as_committed(struct addrspace *as);
+void              as_oomvictim(struct addrspace *as);
+int               as_checkrange(struct addrspace *as, vaddr_t va,
+                                size_t len, bool write);
+struct kinfo_proc *as_kinfo(struct addrspace *as);
+int               as_checkpoint(struct addrspace *as,
+                                struct ckpt_region *regs, unsigned max,
+                                unsigned *nret, vaddr_t *heapbrk);
+int               as_restore(struct addrspace *as, struct vnode *vn,
+                             const struct ckpt_region *regs, unsigned n,
+                             vaddr_t heapbrk);
+#endif
 
 
 /*
@@ -142,6 +275,12 @@ int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
  */
 
 int load_elf(struct vnode *v, vaddr_t *entrypoint);
+#if OPT_SHELL
+/* Drop the cached ELF headers of a vnode (reclaimed or opened for writing) */
+void load_elf_purge(struct vnode *v);
+/* Read a program's headers and text into the caches ahead of its exec */
+unsigned load_elf_prefetch(struct vnode *v);
+#endif
 
 
 #endif /* _ADDRSPACE_H_ */
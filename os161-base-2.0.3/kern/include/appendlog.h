@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _APPENDLOG_H_
+#define _APPENDLOG_H_
+
+/*
+ * Group commit of O_APPEND writes.
+ *
+ * Every write through a descriptor opened with O_APPEND lands at the
+ * end of the file. Small writes that arrive while another append to
+ * the same file is on its way to the file system are gathered into
+ * one batch of up to APPENDLOG_BATCH bytes, which is then written
+ * with a single VOP_WRITE: so many processes logging short records
+ * to the same file cost one read-modify-write of the last block per
+ * batch instead of one per record. Each writer still gets back the
+ * offset its own record ended up at.
+ */
+
+struct vnode;
+struct uio;
+
+/* Largest batch, and largest write that is coalesced (an SFS block) */
+#define APPENDLOG_BATCH  512
+
+/* Called once at boot. */
+void appendlog_bootstrap(void);
+
+/*
+ * Write UIO at the end of VN, ignoring its uio_offset. On return
+ * uio_resid tells how much was written, as with VOP_WRITE, and
+ * uio_offset is just past the data written.
+ */
+int appendlog_write(struct vnode *vn, struct uio *uio);
+
+#endif /* _APPENDLOG_H_ */
@@ -38,6 +38,13 @@
  *                      Returns NULL on error.
  *     bitmap_getdata - return pointer to raw bit data (for I/O).
  *     bitmap_alloc   - locate a cleared bit, set it, and return its index.
+ *                      The search starts where the last allocation left
+ *                      off and wraps around (next-fit).
+ *     bitmap_alloc_range - likewise, but for N consecutive cleared bits;
+ *                      returns the index of the first.
+ *     bitmap_findrun - return the index of the first run of N cleared
+ *                      bits at or after START, without setting them.
+ *                      Does not wrap around.
  *     bitmap_mark    - set a clear bit by its index.
  *     bitmap_unmark  - clear a set bit by its index.
  *     bitmap_isset   - return whether a particular bit is set or not.
@@ -50,6 +57,9 @@ struct bitmap;  /* Opaque. */
 struct bitmap *bitmap_create(unsigned nbits);
 void          *bitmap_getdata(struct bitmap *);
 int            bitmap_alloc(struct bitmap *, unsigned *index);
+int            bitmap_alloc_range(struct bitmap *, unsigned n, unsigned *index);
+int            bitmap_findrun(struct bitmap *, unsigned start, unsigned n,
+                              unsigned *index);
 void           bitmap_mark(struct bitmap *, unsigned index);
 void           bitmap_unmark(struct bitmap *, unsigned index);
 int            bitmap_isset(struct bitmap *, unsigned index);
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _BUDDY_H_
+#define _BUDDY_H_
+
+/*
+ * Physical page allocator (vm/buddy.c).
+ *
+ * Pages are managed by a binary buddy allocator from vm_bootstrap on;
+ * single pages go through the per-cpu caches of pcpcache.h first.
+ * Pages are numbered from buddy_base: page IDX is at physical address
+ * buddy_base + IDX * PAGE_SIZE.
+ *
+ * Functions:
+ *     buddy_bootstrap  - take over the memory ram_stealmem hasn't given
+ *                        out. Returns ENOMEM if the bitmaps don't fit.
+ *     buddy_isactive   - whether buddy_bootstrap has run.
+ *     getfreeppages    - allocate a run of NPAGES pages. Returns 0 if
+ *                        there is none.
+ *     freeppages       - free a run returned by getfreeppages.
+ *     buddy_allocbatch - allocate up to N single pages under one lock.
+ *     buddy_freebatch  - free N single pages under one lock.
+ *     buddy_claim      - for compaction: take the free pages of the
+ *                        block of 2^ORDER pages with the fewest MOVABLE
+ *                        pages and nothing else in it.
+ *     buddy_unclaim    - give back claimed pages.
+ *     buddy_allocclaimed - turn a claimed block into an allocation.
+ */
+
+/* Largest block is 2^BUDDY_MAXORDER pages; largest allocation BUDDY_MAXALLOC */
+#define BUDDY_MAXORDER  16
+#define BUDDY_MAXALLOC  0x7fff
+
+extern paddr_t buddy_base;		/* first page managed */
+extern unsigned long buddy_npages;	/* pages managed */
+extern unsigned long buddy_nfree;	/* pages free (not counting pcp caches) */
+
+int buddy_bootstrap(void);
+bool buddy_isactive(void);
+paddr_t getfreeppages(unsigned long npages);
+void freeppages(paddr_t paddr);
+unsigned buddy_allocbatch(paddr_t *pages, unsigned n);
+void buddy_freebatch(const paddr_t *pages, unsigned n);
+unsigned long buddy_claim(unsigned order, bool (*movable)(unsigned long idx));
+void buddy_unclaim(unsigned long idx, unsigned long npages);
+paddr_t buddy_allocclaimed(unsigned long start, unsigned long npages,
+			   unsigned order);
+
+struct kstat;
+void buddy_printstats(void);
+void buddy_kstat(struct kstat *ks);
+void buddy_freestats(unsigned long *freepages, unsigned long *largest);
+
+#endif /* _BUDDY_H_ */
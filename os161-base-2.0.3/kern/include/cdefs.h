@@ -64,6 +64,35 @@
 #endif
 
 
+/*
+ * Tell GCC that a condition is almost never true, so the code for it
+ * goes out of the way of the common path.
+ */
+#ifdef __GNUC__
+#define __predict_false(x) __builtin_expect((x) != 0, 0)
+#else
+#define __predict_false(x) (x)
+#endif
+
+
+/*
+ * Start a variable, struct member, or struct type on a cache line of
+ * its own, so that data one cpu writes doesn't share a line with data
+ * other cpus write ("false sharing"), which would make the line bounce
+ * between their caches on every write. A struct type so marked is also
+ * padded out to whole lines, so each element of an array of it, say
+ * one per cpu, gets lines of its own. CACHELINE_SIZE is an upper bound
+ * on the line size of the machines we care about.
+ */
+#define CACHELINE_SIZE 64
+
+#ifdef __GNUC__
+#define __cacheline_aligned __attribute__((__aligned__(CACHELINE_SIZE)))
+#else
+#define __cacheline_aligned
+#endif
+
+
 /*
  * Material for supporting inline functions.
  *
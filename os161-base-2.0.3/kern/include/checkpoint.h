@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+/*
+ * Process checkpoint images.
+ *
+ * checkpoint() writes the state of the calling (single-threaded)
+ * process to a file: its registers, the regions of its address
+ * space with the pages in use, and the files it has open by path
+ * with their offsets. restore() replaces the image of the calling
+ * process with one so saved, which then carries on as if its
+ * checkpoint() call had just returned 1.
+ *
+ * Nothing is copied at restore time: each region is read from the
+ * image by vm_fault when first touched, just like an executable
+ * (read-only regions even share their frames through the text cache
+ * with other processes restored from the same image). So a process
+ * with a large, mostly idle heap starts in the time it takes to read
+ * the tables at the front of the file.
+ *
+ * The image is laid out as:
+ *
+ *	struct ckpt_header
+ *	struct ckpt_region	[ch_nregions]
+ *	struct ckpt_file	[ch_nfiles], each followed by cf_pathlen
+ *				bytes of path (no terminator), padded to
+ *				a multiple of 4
+ *	region pages, from the first page boundary after the tables:
+ *				cr_filesz bytes for each region in turn,
+ *				each starting on a page boundary
+ *
+ * The pages of a region past cr_filesz were never touched and start
+ * zero-filled. Restored processes keep reading the image, so it must
+ * not be rewritten while any of them runs.
+ */
+
+#include <mips/trapframe.h>
+
+#define CKPT_MAGIC	0x434b5054	/* "CKPT" */
+#define CKPT_VERSION	1
+#define CKPT_NAMELEN	32		/* bytes of process name kept */
+#define CKPT_MAXREGIONS	64		/* most regions in an image */
+#define CKPT_MAXFILES	64		/* most open files in an image */
+
+struct ckpt_header {
+	uint32_t ch_magic;		/* CKPT_MAGIC */
+	uint32_t ch_version;		/* CKPT_VERSION */
+	uint32_t ch_nregions;		/* entries in the region table */
+	uint32_t ch_nfiles;		/* entries in the file table */
+	uint32_t ch_heapbrk;		/* the break */
+	uint32_t ch_datastart;		/* offset of the first region page */
+	char ch_name[CKPT_NAMELEN];	/* process name, 0-terminated */
+	struct trapframe ch_tf;		/* registers at the checkpoint() call */
+};
+
+/* Region flags */
+#define CKPT_REG_WRITE	0x1		/* writeable */
+#define CKPT_REG_HEAP	0x2		/* the heap (exactly one) */
+#define CKPT_REG_STACK	0x4		/* the stack (exactly one) */
+#define CKPT_REG_MAP	0x8		/* private mapping (munmap-able) */
+
+struct ckpt_region {
+	uint32_t cr_vbase;		/* page-aligned start */
+	uint32_t cr_npages;		/* its size */
+	uint32_t cr_flags;		/* CKPT_REG_* */
+	uint32_t cr_fileoff;		/* page-aligned offset of its pages */
+	uint32_t cr_filesz;		/* bytes of them in the image */
+};
+
+struct ckpt_file {
+	int32_t cf_fd;			/* descriptor */
+	int32_t cf_flags;		/* O_ACCMODE | O_APPEND | O_DIRECT */
+	int32_t cf_advice;		/* POSIX_FADV_* given to it */
+	uint32_t cf_pathlen;		/* bytes of path that follow */
+	off_t cf_offset;		/* seek position */
+};
+
+#endif /* _CHECKPOINT_H_ */
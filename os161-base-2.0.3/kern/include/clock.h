@@ -35,18 +35,32 @@
  */
 
 #include <kern/time.h>
+#include <pqueue.h>
 
 
 /*
- * hardclock() is called on every CPU HZ times a second, possibly only
- * when the CPU is not idle, for scheduling.
+ * hardclock() is called on every CPU hz times a second, only when the
+ * CPU is not idle, for scheduling. hardclock_idle() idles the CPU with
+ * the periodic tick stopped. Both come from clock_interrupt(), which
+ * the platform calls on each interrupt of the CPU's one-shot timer
+ * (mainbus_timer_oneshot) and which also runs the CPU's timers.
+ *
+ * The rate can be changed with clock_sethz(), e.g. from the boot
+ * command line ("hz 1000"); it is HZ_DEFAULT otherwise.
  */
 
 /* hardclocks per second */
-#define HZ  100
+#define HZ_DEFAULT	100
+#define HZ_MIN		10
+#define HZ_MAX		1000
+
+extern unsigned hz;
 
 void hardclock_bootstrap(void);
+void clock_interrupt(void);
 void hardclock(void);
+void hardclock_idle(void);
+int clock_sethz(unsigned newhz);
 
 /*
  * timerclock() is called on one CPU once a second to allow simple
@@ -56,8 +70,29 @@ void timerclock(void);
 
 /*
  * gettime() may be used to fetch the current time of day.
+ *
+ * gettime_coarse() returns the time of day as of the last hardclock,
+ * which is behind by up to 1/hz seconds, instead of asking the clock
+ * device; it takes no locks and is much cheaper.
  */
 void gettime(struct timespec *ret);
+void gettime_coarse(struct timespec *ret);
+
+/*
+ * clock_monotonic() returns nanoseconds since boot, from the cheapest
+ * clock there is. It never goes backwards and is the thing to use for
+ * timing how long something takes. clock_monotonic_ts() is the same
+ * as a timespec. clock_monotonic_overhead() is the cost of one
+ * reading in nanoseconds, as measured at boot, for taking out of
+ * very short measurements.
+ *
+ * clock_ready() is true once the clock device has attached; until
+ * then none of the above may be called.
+ */
+bool clock_ready(void);
+uint64_t clock_monotonic(void);
+void clock_monotonic_ts(struct timespec *ret);
+uint32_t clock_monotonic_overhead(void);
 
 /*
  * arithmetic on times
@@ -79,5 +114,36 @@ void timespec_sub(const struct timespec *t1,
  */
 void clocksleep(int seconds);
 
+/*
+ * Timers, for doing things at a given time of day.
+ *
+ * init		Set up a timer that calls FUNC(DATA) when it expires.
+ * start	Arm the timer for an absolute deadline; rearms if armed.
+ * cancel	Disarm the timer. Returns false if it wasn't armed.
+ *
+ * A timer is kept by the CPU that started it, and FUNC is called from
+ * that CPU's timer interrupt, which is programmed for the deadline
+ * (not the next hardclock); it must not sleep. The struct timer
+ * belongs to the caller and must stay put until the timer expires or
+ * is cancelled.
+ *
+ * timer_sleep() suspends execution until the time of day reaches
+ * DEADLINE, which is what nanosleep is made of.
+ */
+struct cpu;
+
+struct timer {
+	struct pqnode tm_node;		/* In the timer queue; key is ns */
+	struct cpu *tm_cpu;		/* Whose queue; NULL if not armed */
+	void (*tm_func)(void *);
+	void *tm_data;
+};
+
+void timer_init(struct timer *tm, void (*func)(void *), void *data);
+void timer_start(struct timer *tm, const struct timespec *deadline);
+bool timer_cancel(struct timer *tm);
+
+void timer_sleep(const struct timespec *deadline);
+
 
 #endif /* _CLOCK_H_ */
@@ -69,5 +69,49 @@ int copyout(const void *src, userptr_t userdest, size_t len);
 int copyinstr(const_userptr_t usersrc, char *dest, size_t len, size_t *got);
 int copyoutstr(const char *src, userptr_t userdest, size_t len, size_t *got);
 
+/*
+ * Small fixed-size copies, for the many system calls that only pass
+ * an int or an off_t through memory (waitpid's status, argv
+ * pointers, ...). copyinN copies an N-bit value in from USERSRC to
+ * DEST; copyoutN stores VAL at USERDEST. They behave like copyin and
+ * copyout of that size, but a naturally aligned address skips the
+ * general setup and costs about one load or store.
+ */
+int copyin8(const_userptr_t usersrc, uint8_t *dest);
+int copyin16(const_userptr_t usersrc, uint16_t *dest);
+int copyin32(const_userptr_t usersrc, uint32_t *dest);
+int copyin64(const_userptr_t usersrc, uint64_t *dest);
+int copyout8(uint8_t val, userptr_t userdest);
+int copyout16(uint16_t val, userptr_t userdest);
+int copyout32(uint32_t val, userptr_t userdest);
+int copyout64(uint64_t val, userptr_t userdest);
+
+/*
+ * Vectored copies, for uiomove. copyinv gathers LEN bytes from the
+ * user segments IOV[0..IOVCNT) into DEST; copyoutv scatters LEN bytes
+ * from SRC over them. The segments must hold at least LEN bytes in
+ * all; the iovecs are not changed. Every segment the copy will touch
+ * is checked before anything is moved, and the copy itself runs with
+ * one fault handler setup for the lot, so many small segments cost
+ * little more than one big one. On EFAULT some of the data may have
+ * been moved already.
+ */
+struct iovec;
+int copyinv(const struct iovec *iov, unsigned iovcnt, void *dest, size_t len);
+int copyoutv(const void *src, const struct iovec *iov, unsigned iovcnt,
+	     size_t len);
+
+/*
+ * usercheck checks, without copying anything, that LEN bytes at
+ * USERPTR are user memory the current process has mapped, writeable
+ * if WRITE is set; it fails with EFAULT if not. The answer comes from
+ * the region table of the address space, not from taking a fault, so
+ * system calls use it to turn away bad pointers before doing work
+ * that could not be undone (like consuming input). The copies
+ * themselves are still protected as usual, since a mapping may go
+ * away meanwhile.
+ */
+int usercheck(const_userptr_t userptr, size_t len, bool write);
+
 
 #endif /* _COPYINOUT_H_ */
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _COUNTER_H_
+#define _COUNTER_H_
+
+/*
+ * Per-cpu counters, for statistics.
+ *
+ * A counter shared by all cpus would bounce its cache line between
+ * them on every increment. Instead each cpu keeps its own copy of
+ * every counter in struct cpu (c_counters), and only the cpu itself
+ * ever writes it, so counting is cheap wherever it happens. Reading
+ * a counter adds up all the copies; nothing is locked, so the total
+ * may be slightly stale while others are counting.
+ *
+ * counter_add is atomic (it uses LL/SC), so it may be used in any
+ * context, including interrupt handlers and with spinlocks held.
+ *
+ * Counters are identified by number; add new ones here, and give
+ * them a name in counter_names in thread.c.
+ *
+ *    counter_add   - Add N to counter ID on the current cpu.
+ *    counter_local - The current cpu's own share of counter ID.
+ *    counter_read  - The total of counter ID over all cpus.
+ *    counter_cpu   - Cpu N's share of counter ID (0 if there is no
+ *                    such cpu).
+ *    counter_kstat - Add all counters, totals and per-cpu shares,
+ *                    to a kstat snapshot.
+ */
+
+#define COUNTER_HARDCLOCKS	0	/* hardclock() calls */
+#define COUNTER_LOCK_ACQUIRES	1	/* lock_acquire calls */
+#define COUNTER_LOCK_CONTENDED	2	/* ... that found the lock held */
+#define COUNTER_LOCK_SPUN	3	/* ... and got it by spinning */
+#define COUNTER_LOCK_SLEPT	4	/* ... and had to sleep */
+#define COUNTER_LOCK_POLLS	5	/* lock_acquire spin polls, in all */
+#define COUNTER_PCP_HITS	6	/* page allocs served by a cpu's cache */
+#define COUNTER_PCP_MISSES	7	/* ... that had to refill it */
+#define COUNTER_PCP_DRAINS	8	/* page frees that had to drain it */
+#define COUNTER_SWITCHES	9	/* thread_switch to another thread */
+#define COUNTER_STOLEN		10	/* threads taken from other cpus */
+#define COUNTER_VM_READFAULTS	11	/* vm_fault for a load */
+#define COUNTER_VM_WRITEFAULTS	12	/* ... for a store, TLB miss */
+#define COUNTER_VM_ROFAULTS	13	/* ... for a store, read-only entry */
+#define COUNTER_VM_BADFAULTS	14	/* ... that ended in EFAULT */
+#define COUNTER_TLB_RANDOM	15	/* TLB entries loaded into a random slot */
+#define NCOUNTERS		16
+
+void counter_add(unsigned id, unsigned n);
+unsigned counter_local(unsigned id);
+unsigned counter_read(unsigned id);
+unsigned counter_cpu(unsigned id, unsigned n);
+struct kstat;
+void counter_kstat(struct kstat *ks);
+
+#define COUNTER_INC(id)		counter_add(id, 1)
+
+
+#endif /* _COUNTER_H_ */
@@ -33,8 +33,14 @@
 
 #include <spinlock.h>
 #include <threadlist.h>
+#include <counter.h>
+#include <pqueue.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
+#include "opt-shell.h"
 
+/* Sizes of the scheduler histograms in struct cpu */
+#define SCHEDHIST_BUCKETS	24	/* log2 buckets, up to 2^23 usecs */
+#define SCHEDHIST_RQLEN		16	/* run queue lengths 0..15, and more */
 
 /*
  * Per-cpu structure
@@ -46,6 +52,14 @@
  * a pointer with a fixed address and a per-cpu mapping in the MMU.
  */
 
+/*
+ * The fields are in groups by who writes them, and each group starts
+ * on a cache line of its own (see __cacheline_aligned), so that this
+ * cpu's own bookkeeping doesn't share lines with what other cpus write
+ * when they wake threads up or send IPIs: first what never changes,
+ * then what only this cpu writes, then one group per lock other cpus
+ * write under.
+ */
 struct cpu {
 	/*
 	 * Fixed after allocation.
@@ -57,19 +71,54 @@ struct cpu {
 	/*
 	 * Accessed only by this cpu.
 	 */
-	struct thread *c_curthread;	/* Current thread on cpu */
+	struct thread *c_curthread __cacheline_aligned;	/* Current thread */
 	struct threadlist c_zombies;	/* List of exited threads */
-	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
+	struct thread *c_idlethread;	/* Runs when there's nothing else */
+	struct thread *c_leaving;	/* Switched out, moving to another cpu */
+
+	/*
+	 * Written only by this cpu, but read by others (see counter.h).
+	 */
+	volatile unsigned c_counters[NCOUNTERS];
+
+	/*
+	 * Scheduler histograms (see thread_schedhist_start), written
+	 * only by this cpu with interrupts off and read by others.
+	 * c_waithist and c_slicehist count wakeup-to-run latencies and
+	 * timeslices in log2 buckets of microseconds; c_rqhist counts
+	 * run queue lengths seen at hardclock.
+	 */
+	unsigned c_waithist[SCHEDHIST_BUCKETS];
+	unsigned c_slicehist[SCHEDHIST_BUCKETS];
+	unsigned c_rqhist[SCHEDHIST_RQLEN];
+
+	/*
+	 * Timers armed on this cpu, earliest deadline first, and when its
+	 * next hardclock is due, in ns (see clock.c). Others may take
+	 * timers off the queue, hence the lock.
+	 */
+	struct pqueue c_timers __cacheline_aligned;
+	struct spinlock c_timers_lock;
+	uint64_t c_nexttick;
 
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
 	 */
-	bool c_isidle;			/* True if this cpu is idle */
+	bool c_isidle __cacheline_aligned; /* True if this cpu is idle */
 	struct threadlist c_runqueue;	/* Run queue for this cpu */
 	struct spinlock c_runqueue_lock;
 
+#if OPT_SHELL
+	/*
+	 * Accessed by other cpus (to reclaim memory).
+	 * Protected by the thread pool lock.
+	 */
+	struct threadlist c_threadpool __cacheline_aligned; /* Kept for reuse */
+	struct spinlock c_threadpool_lock;
+#endif
+
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the IPI lock.
@@ -83,13 +132,14 @@ struct cpu {
 	 * dependent and might reasonably be either an address space
 	 * and vaddr pair, or a paddr, or something else.
 	 */
-	uint32_t c_ipi_pending;		/* One bit for each IPI number */
+	uint32_t c_ipi_pending __cacheline_aligned; /* Bit per IPI number */
 	struct tlbshootdown c_shootdown[TLBSHOOTDOWN_MAX];
 	unsigned c_numshootdown;
 	struct spinlock c_ipi_lock;
 
 	/*
 	 * Accessed by other cpus. Protected inside hangman.c.
+	 * (Shares the IPI group's lines; it's only for debugging.)
 	 */
 	HANGMAN_ACTOR(c_hangman);
 };
@@ -112,6 +162,11 @@ void cpu_machdep_init(struct cpu *);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
 
+/*
+ * Number of cpus; once boot is over, c_number is always less.
+ */
+unsigned cpu_count(void);
+
 /*
  * Produce a string describing the CPU type.
  */
@@ -155,6 +210,9 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_broadcast sends it to all CPUs except the current
+ * one, and returns how many that was. ipi_tlbshootdown_mask does the
+ * same for only the CPUs whose numbers are set in a bit mask.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -169,6 +227,11 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+#if OPT_SHELL
+unsigned ipi_tlbshootdown_broadcast(const struct tlbshootdown *mapping);
+unsigned ipi_tlbshootdown_mask(const struct tlbshootdown *mapping,
+			       uint32_t mask);
+#endif
 
 void interprocessor_interrupt(void);
 
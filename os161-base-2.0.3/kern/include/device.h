@@ -34,8 +34,10 @@
  * Devices.
  */
 
+#include "opt-shell.h"
 
 struct uio;  /* in <uio.h> */
+struct pollent;  /* in <poll.h> */
 
 /*
  * Filesystem-namespace-accessible device.
@@ -51,16 +53,47 @@ struct device {
 	void *d_data;		/* device-specific data */
 };
 
+#if OPT_SHELL
+/*
+ * Asynchronous device request, for devop_submit. The caller fills in
+ * dr_uio (which must be UIO_SYSSPACE and stay valid until the request
+ * is done), dr_done, and dr_data; the rest belongs to the driver.
+ * When the transfer finishes dr_result holds the outcome and dr_done
+ * is called, possibly from the device's interrupt handler, so it must
+ * not sleep (waking a thread or scheduling work is fine).
+ */
+struct devreq {
+	struct uio *dr_uio;		/* what to transfer */
+	void (*dr_done)(struct devreq *);	/* called when finished */
+	void *dr_data;			/* for the caller */
+	int dr_result;			/* errno, or 0 */
+
+	/* Driver-private */
+	struct devreq *dr_next;		/* queue link */
+	uint32_t dr_block;		/* first block */
+	uint32_t dr_nblocks;		/* length in blocks */
+	unsigned dr_seq;		/* submission order */
+};
+#endif
+
 /*
  * Device operations.
  *      devop_eachopen - called on each open call to allow denying the open
  *      devop_io - for both reads and writes (the uio indicates the direction)
  *      devop_ioctl - miscellaneous control operations
+ *      devop_submit - (OPT_SHELL) start an asynchronous transfer and
+ *                     return at once; NULL if the device has none
+ *      devop_poll - (OPT_SHELL) as VOP_POLL; NULL if the device never
+ *                   makes anyone wait
  */
 struct device_ops {
 	int (*devop_eachopen)(struct device *, int flags_from_open);
 	int (*devop_io)(struct device *, struct uio *);
 	int (*devop_ioctl)(struct device *, int op, userptr_t data);
+#if OPT_SHELL
+	int (*devop_submit)(struct device *, struct devreq *);
+	int (*devop_poll)(struct device *, int events, struct pollent *);
+#endif
 };
 
 /*
@@ -69,6 +102,10 @@ struct device_ops {
 #define DEVOP_EACHOPEN(d, f)	((d)->d_ops->devop_eachopen(d, f))
 #define DEVOP_IO(d, u)		((d)->d_ops->devop_io(d, u))
 #define DEVOP_IOCTL(d, op, p)	((d)->d_ops->devop_ioctl(d, op, p))
+#if OPT_SHELL
+#define DEVOP_SUBMIT(d, r)	((d)->d_ops->devop_submit(d, r))
+#define DEVOP_POLL(d, e, pe)	((d)->d_ops->devop_poll(d, e, pe))
+#endif
 
 
 /* Create vnode for a vfs-level device. */
@@ -79,6 +116,8 @@ void dev_uncreate_vnode(struct vnode *vn);
 
 /* Initialization functions for builtin vfs-level devices. */
 void devnull_create(void);
+void devzero_create(void);
+void devkstat_create(void);
 
 /* Function that kicks off device probe and attach. */
 void dev_bootstrap(void);
@@ -193,8 +193,49 @@ typedef struct {
 #define	PF_X		0x1	/* Segment is executable */
 
 
+/*
+ * Section headers and symbols. Nothing needs these to load a
+ * program; they're for finding the symbol table (see prof.c).
+ */
+typedef struct {
+	uint32_t	sh_name;     /* Section name (string table index) */
+	uint32_t	sh_type;     /* Type of section */
+	uint32_t	sh_flags;    /* Flags */
+	uint32_t	sh_addr;     /* Address when loaded */
+	uint32_t	sh_offset;   /* Location of data within file */
+	uint32_t	sh_size;     /* Size of data within file */
+	uint32_t	sh_link;     /* Associated section */
+	uint32_t	sh_info;     /* Extra information */
+	uint32_t	sh_addralign;/* Alignment */
+	uint32_t	sh_entsize;  /* Size of entries, for tables */
+} Elf32_Shdr;
+
+/* values for sh_type */
+#define	SHT_NULL	0		/* Unused */
+#define	SHT_PROGBITS	1		/* Program data */
+#define	SHT_SYMTAB	2		/* Symbol table */
+#define	SHT_STRTAB	3		/* String table */
+
+typedef struct {
+	uint32_t	st_name;     /* Symbol name (string table index) */
+	uint32_t	st_value;    /* Symbol value (address) */
+	uint32_t	st_size;     /* Size of object */
+	unsigned char	st_info;     /* Type and binding */
+	unsigned char	st_other;    /* Ignore */
+	uint16_t	st_shndx;    /* Section index */
+} Elf32_Sym;
+
+/* st_info contents */
+#define	ELF32_ST_TYPE(info)	((info) & 0xf)
+#define	STT_NOTYPE	0		/* No type */
+#define	STT_OBJECT	1		/* Data object */
+#define	STT_FUNC	2		/* Function */
+
+
 typedef Elf32_Ehdr Elf_Ehdr;
 typedef Elf32_Phdr Elf_Phdr;
+typedef Elf32_Shdr Elf_Shdr;
+typedef Elf32_Sym Elf_Sym;
 
 
 #endif /* _ELF_H_ */
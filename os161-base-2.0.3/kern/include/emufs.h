@@ -36,6 +36,7 @@
  */
 #include <fs.h>
 #include <vnode.h>
+#include "opt-shell.h"
 
 /*
  * Our structures
@@ -45,6 +46,17 @@ struct emufs_vnode {
 	struct vnode ev_v;		/* abstract vnode structure */
 	struct emu_softc *ev_emu;	/* device */
 	uint32_t ev_handle;		/* file handle */
+#if OPT_SHELL
+	/*
+	 * Cached size of a file, kept up to date by our own writes and
+	 * truncates; both fields are protected by the device's e_lock.
+	 * (Directories change size behind our back as entries come and
+	 * go, so they aren't cached.)
+	 */
+	bool ev_isdir;
+	bool ev_sizevalid;
+	off_t ev_size;
+#endif
 };
 
 struct emufs_fs {
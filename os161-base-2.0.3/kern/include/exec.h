@@ -22,27 +22,46 @@
 #include "opt-shell.h"
 
 /*
- * Throttle to limit the number of processes in exec at once. Or,
- * rather, the number trying to use large exec buffers at once.
+ * Argument arena. An argv is kept in whole pages, so it never has to
+ * be copied into a bigger buffer. The first page of every exec is
+ * free; the ones beyond it are drawn from a budget shared by all the
+ * execs in progress, so large execs run concurrently until together
+ * they would hold more than EXEC_ARGBUDGET pages. A few freed pages
+ * are kept around for the next exec.
+ *
+ * Within an argv buffer the strings and the argv array are laid out
+ * as on the user stack, so they go out with one copyout per page.
  */
-#define EXEC_BIGBUF_THROTTLE	1
-#if OPT_SHELL
-struct semaphore *execthrottle;
-#endif
+#define EXEC_ARGPAGES	(ARG_MAX / PAGE_SIZE)	/* most pages one argv needs */
+#define EXEC_ARGBUDGET	(4 * EXEC_ARGPAGES)	/* extra pages for all execs */
+#define EXEC_ARGKEEP	EXEC_ARGPAGES		/* free pages kept cached */
+
+/*
+ * Exec history. The last EXEC_HISTSIZE programs run by absolute path
+ * are kept most recent first, and saved to EXEC_PREFETCHFILE on the
+ * boot filesystem at shutdown, one path per line (lines starting with
+ * '#' are comments, so the file can be edited by hand). At boot a
+ * kernel thread reads the file back and prefetches each program, so
+ * the first run of the shell and friends does not wait on the disk.
+ */
+#define EXEC_HISTSIZE		16
+#define EXEC_PREFETCHFILE	"/.prefetch"
+#define EXEC_PREFETCHMAX	4096		/* bytes of the file looked at */
 
 /**
  * @brief ARGV BUFFER
- *      
+ *
  *  An abstraction that wraps an argv in the kernel side during the execv()
  */
 #if OPT_SHELL
 typedef struct argbuf_s {
 
-	char *data;	
+	char *pages[EXEC_ARGPAGES];	/* STRINGS FROM THE START, ARGV SLOTS AT THE END */
+	unsigned npages;
+	unsigned reserved;		/* PAGES TAKEN FROM THE ARENA BUDGET */
 	size_t len;
 	size_t max;
 	int nargs;
-	bool tooksem;
 
 } argbuf_t;
 #endif
@@ -54,6 +73,39 @@ typedef struct argbuf_s {
 void exec_bootstrap(void);
 #endif
 
+/**
+ * @brief Copy of PATH for exec_remember, or NULL if PATH is relative
+ *        (and so means nothing at the next boot). Take it before
+ *        vfs_open, which may destroy PATH.
+ */
+#if OPT_SHELL
+char *exec_histname(const char *path);
+#endif
+
+/**
+ * @brief Move a program just loaded to the front of the exec history.
+ *
+ * @param name string from exec_histname, consumed (NULL is fine)
+ */
+#if OPT_SHELL
+void exec_remember(char *name);
+#endif
+
+/**
+ * @brief Start prefetching the programs listed in EXEC_PREFETCHFILE, in
+ *        a kernel thread. Call once the boot filesystem is set.
+ */
+#if OPT_SHELL
+void exec_prefetch_start(void);
+#endif
+
+/**
+ * @brief Write the exec history to EXEC_PREFETCHFILE. Errors are ignored.
+ */
+#if OPT_SHELL
+void exec_history_save(void);
+#endif
+
 /**
  * @brief Initialize an argv buffer.
  * 
@@ -96,10 +148,11 @@ int argbuf_copyout(argbuf_t *buf, vaddr_t *ustackp, int *argc_ret, userptr_t *ua
 #endif
 
 /**
- * @brief Initialize size of the buffer
+ * @brief Grow the buffer to hold at least size bytes, waiting for the
+ *        arena budget if needed
  * 
  * @param buf argv buffer
- * @param size size of the buffer
+ * @param size size of the buffer (at most ARG_MAX)
  * @return zero on success, an error value in case of failure 
  */
 #if OPT_SHELL
@@ -127,4 +180,21 @@ void argbuf_cleanup(argbuf_t *buf);
 int loadexec(char *path, vaddr_t *entrypoint, vaddr_t *stackptr);
 #endif
 
+/**
+ * @brief Build the address space of a freshly spawned process, which has none yet, from
+ *        an executable and an argv. Called by the first thread of that process (used by spawn)
+ * 
+ * @param path pathname of the executable to run
+ * @param args argv in the kernel side
+ * @param entrypoint virtual address of the starting point
+ * @param stackptr virtual address of the stack
+ * @param argc_ret number of arguments
+ * @param uargv_ret user argv
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int loadspawn(char *path, argbuf_t *args, vaddr_t *entrypoint, vaddr_t *stackptr,
+	      int *argc_ret, userptr_t *uargv_ret);
+#endif
+
 #endif /* _EXEC_H_ */
\ No newline at end of file
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _FRAME_H_
+#define _FRAME_H_
+
+/*
+ * Frame table (vm/frame.c): one entry per page of the buddy allocator,
+ * counting the mappings of each frame of user memory and, for the
+ * frames that can be paged out, which address space owns them. Frames
+ * for user pages come from frame_alloc, which pages something out if
+ * memory is short.
+ *
+ * Functions:
+ *     frame_bootstrap - allocate the table. Returns ENOMEM if it doesn't fit.
+ *     frame_index     - the entry of the frame at PA.
+ *     frame_alloc     - get a frame, with one reference; zero-filled if
+ *                       ZERO. Returns 0 if out of memory.
+ *     frame_setowner  - record that PA is mapped only by AS, at VA,
+ *                       which makes it pageable.
+ *     frame_disown    - make PA unpageable again.
+ *     frame_incref    - add a reference to PA (which is then shared).
+ *     frame_decref    - drop one, freeing PA with the last.
+ *     frame_refs      - number of references to PA.
+ *     frame_reclaim   - free some user memory. Returns 0 or ENOMEM.
+ *
+ * frame_alloc and frame_reclaim must be called with vm_lock held.
+ * The entries themselves are covered by frame_lock.
+ */
+
+#include <spinlock.h>
+
+struct addrspace;
+
+/*
+ * fr_as is set only for frames mapped by exactly one address space,
+ * which are the ones that can be paged out; it is cleared while a
+ * frame is being set up or written out.
+ */
+struct frame {
+	struct addrspace *fr_as;	/* owner, if private */
+	vaddr_t fr_va;			/* ...and where it maps the frame */
+	uint16_t fr_refs;		/* number of mappings */
+	uint8_t fr_referenced;		/* used since the clock last passed */
+};
+
+#define FRAME_RESERVE	16		/* keep this many pages for the kernel */
+
+extern struct spinlock frame_lock;
+extern struct frame *frames;
+
+int frame_bootstrap(void);
+unsigned long frame_index(paddr_t pa);
+paddr_t frame_alloc(bool zero);
+void frame_setowner(paddr_t pa, struct addrspace *as, vaddr_t va);
+void frame_disown(paddr_t pa);
+void frame_incref(paddr_t pa);
+void frame_decref(paddr_t pa);
+unsigned frame_refs(paddr_t pa);
+int frame_reclaim(void);
+
+struct kstat;
+void frame_printstats(void);
+void frame_kstat(struct kstat *ks);
+
+#endif /* _FRAME_H_ */
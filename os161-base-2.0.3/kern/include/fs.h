@@ -87,5 +87,8 @@ struct fs_ops {
 /* Initialization functions for builtin fake file systems. */
 void semfs_bootstrap(void);
 
+/* Fast P and V on a semfs semaphore (see semfs_vnops.c). */
+int semfs_semop(struct vnode *vn, int delta);
+
 
 #endif /* _FS_H_ */
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _FUTEX_H_
+#define _FUTEX_H_
+
+/*
+ * Futexes: sleeping on a word of user memory.
+ *
+ * A futex is any aligned int in a user address space, named by the
+ * address space and the user address. Nothing is kept for a futex
+ * nobody is waiting on. User code does the fast path itself with
+ * atomic operations on the word and only calls into the kernel to
+ * sleep (futex_wait) or to wake sleepers (futex_wake).
+ */
+
+struct proc;
+
+/* Called once at boot. */
+void futex_bootstrap(void);
+
+/*
+ * Sleep on UADDR until woken, provided it still holds VAL once the
+ * futex is locked; otherwise fail with EAGAIN. Returns EINTR if the
+ * process starts exiting meanwhile.
+ */
+int futex_wait(userptr_t uaddr, int val);
+
+/* Wake up to N sleepers on UADDR, oldest first; *WOKEN says how many. */
+int futex_wake(userptr_t uaddr, int n, int *woken);
+
+/* PROC is exiting: wake all of its threads sleeping on futexes. */
+void futex_wakeproc(struct proc *proc);
+
+#endif /* _FUTEX_H_ */
@@ -32,7 +32,14 @@
 
 /*
  * Simple deadlock detector. Enable with "options hangman" in the
- * kernel config.
+ * kernel config, then turn it on from the menu with "hm on" (before
+ * reproducing the hang: it catches deadlocks as they form, not ones
+ * already there). While it is off, each lock operation costs one
+ * predicted branch on hangman_on.
+ *
+ * Each time it is turned on starts a new generation, and records
+ * from earlier ones count as empty, so whatever was held or waited
+ * for while it was off doesn't confuse it.
  */
 
 #include "opt-hangman.h"
@@ -42,28 +49,38 @@
 struct hangman_actor {
 	const char *a_name;
 	const struct hangman_lockable *a_waiting;
+	unsigned a_gen;			/* generation of a_waiting */
 };
 
 struct hangman_lockable {
 	const char *l_name;
 	const struct hangman_actor *l_holding;
+	unsigned l_gen;			/* generation of l_holding */
 };
 
+extern volatile bool hangman_on;
+
 void hangman_wait(struct hangman_actor *a, struct hangman_lockable *l);
 void hangman_acquire(struct hangman_actor *a, struct hangman_lockable *l);
 void hangman_release(struct hangman_actor *a, struct hangman_lockable *l);
+void hangman_enable(bool on);
 
 #define HANGMAN_ACTOR(sym)	struct hangman_actor sym
 #define HANGMAN_LOCKABLE(sym)	struct hangman_lockable sym
 
-#define HANGMAN_ACTORINIT(a, n)	    ((a)->a_name = (n), (a)->a_waiting = NULL)
-#define HANGMAN_LOCKABLEINIT(l, n)  ((l)->l_name = (n), (l)->l_holding = NULL)
+#define HANGMAN_ACTORINIT(a, n) \
+	((a)->a_name = (n), (a)->a_waiting = NULL, (a)->a_gen = 0)
+#define HANGMAN_LOCKABLEINIT(l, n) \
+	((l)->l_name = (n), (l)->l_holding = NULL, (l)->l_gen = 0)
 
-#define HANGMAN_LOCKABLE_INITIALIZER	{ "spinlock", NULL }
+#define HANGMAN_LOCKABLE_INITIALIZER	{ "spinlock", NULL, 0 }
 
-#define HANGMAN_WAIT(a, l)	hangman_wait(a, l)
-#define HANGMAN_ACQUIRE(a, l)	hangman_acquire(a, l)
-#define HANGMAN_RELEASE(a, l)	hangman_release(a, l)
+#define HANGMAN_WAIT(a, l) \
+	(__predict_false(hangman_on) ? hangman_wait(a, l) : (void)0)
+#define HANGMAN_ACQUIRE(a, l) \
+	(__predict_false(hangman_on) ? hangman_acquire(a, l) : (void)0)
+#define HANGMAN_RELEASE(a, l) \
+	(__predict_false(hangman_on) ? hangman_release(a, l) : (void)0)
 
 #else
 
@@ -0,0 +1,256 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _HASHTABLE_H_
+#define _HASHTABLE_H_
+
+#include <cdefs.h>
+#include <lib.h>
+
+#ifndef HASHINLINE
+#define HASHINLINE INLINE
+#endif
+
+/*
+ * Intrusive hash table.
+ *
+ * The objects carry a struct hashnode, which links them into a chain
+ * and remembers their hash value; the table itself is only an array
+ * of chains, of a power of 2 size, so adding never allocates except
+ * to resize. ->hn_self points back to the object, as in threadlist.h.
+ *
+ * The table doubles when there are more than two objects per chain
+ * and halves when there are fewer than one per eight. Resizing is
+ * incremental: the new array takes over at once and every later add
+ * or remove moves a few of the old chains into it, so that no single
+ * operation has to move the lot. Until it is done a lookup looks in
+ * the old array for chains not yet moved.
+ *
+ * The table does no locking; that's up to the user.
+ *
+ * init - initialize a table in space externally allocated.
+ * cleanup - clean up a table, which must be empty.
+ * count - number of objects in the table.
+ * add - add node HN with hash value HASH; may fail and return error,
+ *       but only if the table has no array at all yet.
+ * remove - remove node HN, which has to be in the table.
+ * chain - the first node of the chain where objects with hash value
+ *       HASH are, for lookups; follow ->hn_next and compare ->hn_hash
+ *       before comparing keys.
+ * iterinit/iternext - visit every node, in no particular order; the
+ *       table must not change meanwhile. iternext returns NULL at the
+ *       end.
+ *
+ * hash_uint and hash_string are hash functions for use with it.
+ */
+
+struct hashnode {
+	struct hashnode *hn_next;	/* Next in the chain */
+	void *hn_self;			/* The object containing this node */
+	unsigned hn_hash;		/* The object's hash value */
+};
+
+struct hashtable {
+	struct hashnode **ht_chains;	/* The array in use */
+	unsigned ht_size;		/* ... its size (0 or a power of 2) */
+	struct hashnode **ht_old;	/* The previous one, or NULL */
+	unsigned ht_oldsize;		/* ... its size */
+	unsigned ht_moved;		/* ... chains already moved from it */
+	unsigned ht_count;		/* Number of objects */
+};
+
+struct hashiter {
+	const struct hashtable *hi_ht;
+	bool hi_old;			/* Walking the old array */
+	unsigned hi_pos;		/* Next chain */
+	struct hashnode *hi_next;	/* Next node */
+};
+
+void hashnode_init(struct hashnode *hn, void *self);
+void hashnode_cleanup(struct hashnode *hn);
+
+void hashtable_init(struct hashtable *ht);
+void hashtable_cleanup(struct hashtable *ht);
+HASHINLINE unsigned hashtable_count(const struct hashtable *ht);
+int hashtable_add(struct hashtable *ht, struct hashnode *hn, unsigned hash);
+void hashtable_remove(struct hashtable *ht, struct hashnode *hn);
+HASHINLINE struct hashnode *hashtable_chain(const struct hashtable *ht,
+					     unsigned hash);
+void hashtable_iterinit(struct hashiter *hi, const struct hashtable *ht);
+struct hashnode *hashtable_iternext(struct hashiter *hi);
+
+unsigned hash_uint(unsigned val);
+unsigned hash_string(const char *str);
+
+/*
+ * Inlining for base operations
+ */
+
+HASHINLINE unsigned
+hashtable_count(const struct hashtable *ht)
+{
+	return ht->ht_count;
+}
+
+HASHINLINE struct hashnode *
+hashtable_chain(const struct hashtable *ht, unsigned hash)
+{
+	unsigned pos;
+
+	if (ht->ht_old != NULL) {
+		pos = hash & (ht->ht_oldsize - 1);
+		if (pos >= ht->ht_moved) {
+			return ht->ht_old[pos];
+		}
+	}
+	if (ht->ht_size == 0) {
+		return NULL;
+	}
+	return ht->ht_chains[hash & (ht->ht_size - 1)];
+}
+
+/*
+ * Bits for declaring and defining typed hash tables, in the manner
+ * of DECLARRAY in array.h.
+ *
+ * Usage:
+ *
+ * DECLHASH_BYTYPE(foo, bar, K, INLINE) declares "struct foo", a hash
+ * table of "bar" objects looked up by keys of type K, plus the
+ * operations on it.
+ *
+ * DEFHASH_BYTYPE(foo, bar, K, FIELD, HASHFN, MATCHFN, INLINE) defines
+ * the operations. FIELD is the struct hashnode in "bar"; HASHFN(key)
+ * returns the hash value of a key, and MATCHFN(obj, key) is true if
+ * OBJ has key KEY.
+ *
+ * DECLHASH(foo, K, INLINE) and DEFHASH(foo, K, ...) are the same with
+ * "struct foohash" as the table and "struct foo" as the objects.
+ *
+ * Example usage, for processes by pid:
+ *
+ * DECLHASH(proc, pid_t, PROCINLINE);
+ * DEFHASH(proc, pid_t, p_hashnode, proc_hashpid, proc_haspid,
+ *         PROCINLINE);
+ *
+ * with the hashnode initialized by
+ * "hashnode_init(&proc->p_hashnode, proc)". This gives
+ * "struct prochash" with, among others,
+ *
+ *    int prochash_add(struct prochash *h, pid_t key, struct proc *obj);
+ *    struct proc *prochash_find(const struct prochash *h, pid_t key);
+ *    void prochash_remove(struct prochash *h, struct proc *obj);
+ *
+ * The other operations on typed tables are the same as the ones on
+ * the base table, except typed.
+ */
+
+#define DECLHASH_BYTYPE(HT, T, K, INLINE) \
+	struct HT {						\
+		struct hashtable ht;				\
+	};							\
+								\
+	INLINE void HT##_init(struct HT *h);			\
+	INLINE void HT##_cleanup(struct HT *h);			\
+	INLINE unsigned HT##_count(const struct HT *h);		\
+	INLINE int HT##_add(struct HT *h, K key, T *obj);	\
+	INLINE T *HT##_find(const struct HT *h, K key);		\
+	INLINE void HT##_remove(struct HT *h, T *obj);		\
+	INLINE void HT##_iterinit(const struct HT *h, struct hashiter *hi); \
+	INLINE T *HT##_iternext(struct hashiter *hi)
+
+#define DEFHASH_BYTYPE(HT, T, K, FIELD, HASHFN, MATCHFN, INLINE) \
+	INLINE void						\
+	HT##_init(struct HT *h)					\
+	{							\
+		hashtable_init(&h->ht);				\
+	}							\
+								\
+	INLINE void						\
+	HT##_cleanup(struct HT *h)				\
+	{							\
+		hashtable_cleanup(&h->ht);			\
+	}							\
+								\
+	INLINE unsigned						\
+	HT##_count(const struct HT *h)				\
+	{							\
+		return hashtable_count(&h->ht);			\
+	}							\
+								\
+	INLINE int						\
+	HT##_add(struct HT *h, K key, T *obj)			\
+	{							\
+		return hashtable_add(&h->ht, &obj->FIELD, HASHFN(key)); \
+	}							\
+								\
+	INLINE T *						\
+	HT##_find(const struct HT *h, K key)			\
+	{							\
+		struct hashnode *hn;				\
+		unsigned hash;					\
+								\
+		hash = HASHFN(key);				\
+		for (hn = hashtable_chain(&h->ht, hash); hn != NULL; \
+		     hn = hn->hn_next) {			\
+			if (hn->hn_hash == hash &&		\
+			    MATCHFN((T *)hn->hn_self, key)) {	\
+				return hn->hn_self;		\
+			}					\
+		}						\
+		return NULL;					\
+	}							\
+								\
+	INLINE void						\
+	HT##_remove(struct HT *h, T *obj)			\
+	{							\
+		hashtable_remove(&h->ht, &obj->FIELD);		\
+	}							\
+								\
+	INLINE void						\
+	HT##_iterinit(const struct HT *h, struct hashiter *hi)	\
+	{							\
+		hashtable_iterinit(hi, &h->ht);			\
+	}							\
+								\
+	INLINE T *						\
+	HT##_iternext(struct hashiter *hi)			\
+	{							\
+		struct hashnode *hn;				\
+								\
+		hn = hashtable_iternext(hi);			\
+		return hn == NULL ? NULL : hn->hn_self;		\
+	}
+
+#define DECLHASH(T, K, INLINE) DECLHASH_BYTYPE(T##hash, struct T, K, INLINE)
+#define DEFHASH(T, K, FIELD, HASHFN, MATCHFN, INLINE) \
+	DEFHASH_BYTYPE(T##hash, struct T, K, FIELD, HASHFN, MATCHFN, INLINE)
+
+
+#endif /* _HASHTABLE_H_ */
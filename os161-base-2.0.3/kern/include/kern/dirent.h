@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_DIRENT_H_
+#define _KERN_DIRENT_H_
+
+#include <kern/limits.h>
+
+/*
+ * Directory entries, as returned by getdents(), packed one after the
+ * other into the caller's buffer. Each record is d_reclen bytes long:
+ * the fixed fields, the name with its NUL terminator, and padding up
+ * to a multiple of 4. struct dirent has room for the longest name but
+ * records are generally shorter, so step through a buffer by d_reclen.
+ *
+ * A filesystem that doesn't know an entry's inode number or type
+ * reports 0 and DT_UNKNOWN; use stat/fstat to find out.
+ */
+struct dirent {
+	ino_t d_ino;			/* inode number, or 0 */
+	__u16 d_reclen;			/* size of this record in bytes */
+	__u8 d_type;			/* one of DT_* below */
+	__u8 d_namlen;			/* length of d_name, excluding NUL */
+	char d_name[__NAME_MAX+1];	/* NUL-terminated name */
+};
+
+/* Size of the record for a name NAMLEN bytes long (8 is the fixed part) */
+#define _DIRENT_RECLEN(namlen)  ((8 + (namlen) + 1 + 3) & ~3)
+
+/* Values for d_type */
+#define DT_UNKNOWN  0
+#define DT_FIFO     1
+#define DT_CHR      2
+#define DT_DIR      4
+#define DT_BLK      6
+#define DT_REG      8
+#define DT_LNK      10
+#define DT_SOCK     12
+
+
+#endif /* _KERN_DIRENT_H_ */
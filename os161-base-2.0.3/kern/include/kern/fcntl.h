@@ -49,10 +49,19 @@
 #define O_TRUNC      16      /* Truncate file upon open */
 #define O_APPEND     32      /* All writes happen at EOF (optional feature) */
 #define O_NOCTTY     64      /* Required by POSIX, != 0, but does nothing */
+#define O_DIRECT    128      /* Bypass the buffer cache (optional feature) */
+#define O_CLOEXEC   256      /* Set FD_CLOEXEC on the new descriptor */
 
 /* Additional related definition */
 #define O_ACCMODE     3      /* mask for O_RDONLY/O_WRONLY/O_RDWR */
 
+/* Access pattern hints for posix_fadvise() */
+#define POSIX_FADV_NORMAL     0  /* no particular pattern (the default) */
+#define POSIX_FADV_RANDOM     1  /* random access: don't read ahead */
+#define POSIX_FADV_SEQUENTIAL 2  /* sequential access: read ahead eagerly */
+#define POSIX_FADV_WILLNEED   3  /* the range will be read soon */
+#define POSIX_FADV_DONTNEED   4  /* the range won't be read again soon */
+
 /*
  * Not so important
  */
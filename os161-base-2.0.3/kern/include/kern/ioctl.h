@@ -34,6 +34,20 @@
  * ioctl operation codes
  */
 
-/* (none yet) */
+/*
+ * Console line discipline. The data argument points to an int.
+ *
+ * In raw mode (the default) reads return characters as they are
+ * typed, with no echo or editing. In canonical mode the kernel
+ * assembles a line at a time, echoing it and handling backspace
+ * and ^U (erase line); a read returns at most one line, including
+ * its newline. ^D ends a line without a newline, so at the start
+ * of one a read returns 0.
+ */
+#define CONIOC_GETMODE	1	/* *data = current mode */
+#define CONIOC_SETMODE	2	/* mode = *data */
+
+#define CONMODE_RAW	0
+#define CONMODE_CANON	1
 
 #endif /* _KERN_IOCTL_H_*/
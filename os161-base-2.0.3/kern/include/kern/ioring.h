@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_IORING_H_
+#define _KERN_IORING_H_
+
+/*
+ * Submission and completion rings for ioring_enter(), shared between
+ * the kernel and <sys/ioring.h>.
+ *
+ * Both rings live in the process's memory and have ir_entries slots
+ * (a power of 2). The indices run freely and are reduced modulo
+ * ir_entries to find the slot. The process fills in submissions at
+ * ir_sqtail and advances it; ioring_enter() carries out the ones from
+ * ir_sqhead on, in order, as long as there is room for completions,
+ * posts a completion for each at ir_cqtail, and advances ir_sqhead
+ * and ir_cqtail. The process takes completions from ir_cqhead and
+ * advances it.
+ */
+
+/* Operations */
+#define IORING_OP_READ     1     /* read(fd, buf, len) */
+#define IORING_OP_WRITE    2     /* write(fd, buf, len) */
+#define IORING_OP_PREAD    3     /* pread(fd, buf, len, offset) */
+#define IORING_OP_PWRITE   4     /* pwrite(fd, buf, len, offset) */
+#define IORING_OP_OPEN     5     /* open(buf, flags, mode) */
+#define IORING_OP_CLOSE    6     /* close(fd) */
+
+/* Largest ring ioring_enter() accepts */
+#define IORING_MAX_ENTRIES 4096
+
+struct ioring_sqe {
+	off_t sqe_offset;	/* file position, for pread and pwrite */
+	int sqe_op;		/* IORING_OP_* */
+	int sqe_fd;		/* file, for all but open */
+	void *sqe_buf;		/* buffer, or the pathname for open */
+	size_t sqe_len;		/* bytes to transfer */
+	int sqe_flags;		/* open flags */
+	mode_t sqe_mode;	/* open mode */
+	unsigned sqe_data;	/* handed back in the completion */
+};
+
+struct ioring_cqe {
+	unsigned cqe_data;	/* sqe_data of the submission */
+	int cqe_res;		/* what the call returns, or -errno */
+};
+
+struct ioring {
+	unsigned ir_entries;		/* slots in each ring */
+	unsigned ir_sqhead;		/* next submission (kernel advances) */
+	unsigned ir_sqtail;		/* end of submissions (process) */
+	unsigned ir_cqhead;		/* next completion (process) */
+	unsigned ir_cqtail;		/* end of completions (kernel) */
+	struct ioring_sqe *ir_sq;
+	struct ioring_cqe *ir_cq;
+};
+
+#endif /* _KERN_IORING_H_ */
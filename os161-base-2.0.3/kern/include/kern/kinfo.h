@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_KINFO_H_
+#define _KERN_KINFO_H_
+
+/*
+ * The kernel info pages, mapped read-only at KINFO_VADDR in every
+ * process from exec on, so that libc can answer getpid(), getppid(),
+ * time() and ncpus() without a system call.
+ *
+ * The first page is the same for all processes and holds the number
+ * of cpus and the time of day as of the last clock tick. The kernel
+ * bumps kt_seq before and after changing the time, so it is odd
+ * during an update: a reader takes kt_seq, copies the time, and
+ * starts over if kt_seq was odd or is no longer the same. The second
+ * page is the process's own.
+ */
+
+#define KINFO_VADDR     0x7ff00000
+#define KINFO_PAGESIZE  4096
+#define KINFO_NPAGES    2
+
+struct kinfo_time {
+	volatile unsigned kt_seq;	/* odd while being updated */
+	time_t kt_sec;			/* seconds */
+	unsigned long kt_nsec;		/* nanoseconds */
+	unsigned kt_ncpus;		/* cpus (set once, at boot) */
+};
+
+struct kinfo_proc {
+	pid_t kp_pid;			/* this process */
+	pid_t kp_ppid;			/* its parent, or -1 if none */
+};
+
+#define KINFO_TIME ((const volatile struct kinfo_time *)KINFO_VADDR)
+#define KINFO_PROC ((const volatile struct kinfo_proc *) \
+		    (KINFO_VADDR + KINFO_PAGESIZE))
+
+#endif /* _KERN_KINFO_H_ */
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_MMAN_H_
+#define _KERN_MMAN_H_
+
+/*
+ * Constants for mmap(), munmap(), msync() and madvise(), shared
+ * between the kernel and <sys/mman.h>.
+ */
+
+/* Page protection (mmap prot argument) */
+#define PROT_NONE     0x0     /* No access */
+#define PROT_READ     0x1     /* Pages can be read */
+#define PROT_WRITE    0x2     /* Pages can be written */
+#define PROT_EXEC     0x4     /* Pages can be executed */
+
+/* Mapping type (mmap flags argument); exactly one must be given */
+#define MAP_SHARED    0x1     /* Stores go to the file, seen by all mappers */
+#define MAP_PRIVATE   0x2     /* Stores make private copies of pages */
+
+/* Other mmap flags */
+#define MAP_ANON      0x4     /* No file (fd is ignored): zero-filled pages */
+
+/* msync flags */
+#define MS_ASYNC      0x1     /* Start writing back; don't wait */
+#define MS_SYNC       0x2     /* Write back and wait for the disk */
+#define MS_INVALIDATE 0x4     /* Drop other cached copies */
+
+/* madvise advice (same values as POSIX_FADV_* in <kern/fcntl.h>) */
+#define MADV_NORMAL     0     /* No particular pattern (the default) */
+#define MADV_RANDOM     1     /* Random access: fault in single pages */
+#define MADV_SEQUENTIAL 2     /* Sequential access: read the file ahead */
+#define MADV_WILLNEED   3     /* The range will be touched soon */
+#define MADV_DONTNEED   4     /* The range won't be touched again soon */
+
+
+#endif /* _KERN_MMAN_H_ */
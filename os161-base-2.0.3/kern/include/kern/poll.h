@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_POLL_H_
+#define _KERN_POLL_H_
+
+/*
+ * Definitions for poll(), shared between the kernel and <poll.h>.
+ *
+ * The caller sets events for each descriptor; poll() fills in
+ * revents with those of them that are ready, plus POLLERR, POLLHUP
+ * and POLLNVAL, which are reported whether they were asked for or
+ * not. A negative fd is ignored and gets no revents.
+ */
+
+#define POLLIN      0x001   /* Data to read (or EOF) */
+#define POLLPRI     0x002   /* Urgent data to read (never set) */
+#define POLLOUT     0x004   /* Room to write */
+#define POLLERR     0x008   /* Error; for a pipe, no reader */
+#define POLLHUP     0x010   /* Hung up: no writer, or no children */
+#define POLLNVAL    0x020   /* Not an open file */
+
+#define POLLRDNORM  POLLIN
+#define POLLWRNORM  POLLOUT
+
+/* Timeout that waits forever */
+#define INFTIM      (-1)
+
+struct pollfd {
+	int fd;			/* file to look at */
+	short events;		/* what to wait for */
+	short revents;		/* what happened */
+};
+
+#endif /* _KERN_POLL_H_ */
@@ -67,6 +67,10 @@ struct rusage {
 	__counter_t ru_nsignals;	/* signals delivered (count) */
 	__counter_t ru_nvcsw;		/* voluntary context switches (count)*/
 	__counter_t ru_nivcsw;		/* involuntary ditto (count) */
+	/* OS/161 additions */
+	__counter_t ru_nsyscalls;	/* system calls made (count) */
+	__counter_t ru_inbytes;		/* bytes read from files (count) */
+	__counter_t ru_outbytes;	/* bytes written to files (count) */
 };
 
 /* limit codes for getrusage/setrusage */
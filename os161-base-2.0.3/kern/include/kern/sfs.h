@@ -37,30 +37,47 @@
  */
 
 #define SFS_MAGIC         0xabadf001    /* magic number identifying us */
-#define SFS_BLOCKSIZE     512           /* size of our blocks */
+#define SFS_BLOCKSIZE     512           /* default (and smallest) block size */
+#define SFS_MAXBLOCKSIZE  16384         /* largest block size */
 #define SFS_VOLNAME_SIZE  32            /* max length of volume name */
 #define SFS_NDIRECT       15            /* # of direct blocks in inode */
 #define SFS_NINDIRECT     1             /* # of indirect blocks in inode */
 #define SFS_NDINDIRECT    0             /* # of 2x indirect blocks in inode */
 #define SFS_NTINDIRECT    0             /* # of 3x indirect blocks in inode */
-#define SFS_DBPERIDB      128           /* # direct blks per indirect blk */
 #define SFS_NAMELEN       60            /* max length of filename */
 #define SFS_SUPER_BLOCK   0             /* block the superblock lives in */
 #define SFS_FREEMAP_START 2             /* 1st block of the freemap */
 #define SFS_NOINO         0             /* inode # for free dir entry */
 #define SFS_ROOTDIR_INO   1             /* loc'n of the root dir inode */
 
+/*
+ * The block size of a volume is in its superblock. It is a power of
+ * two from SFS_BLOCKSIZE to SFS_MAXBLOCKSIZE; volumes made before it
+ * was recorded have 0 there, meaning SFS_BLOCKSIZE. Block numbers
+ * everywhere (sb_nblocks, inode numbers, block pointers) count blocks
+ * of this size. The superblock, inodes and journal descriptor and
+ * commit blocks use the first SFS_BLOCKSIZE bytes of their blocks;
+ * the rest is unused and set to 0.
+ */
+#define SFS_SB_BLOCKSIZE(sb) \
+	((sb)->sb_blocksize != 0 ? (sb)->sb_blocksize : SFS_BLOCKSIZE)
+
+/* Number of block pointers in an indirect block */
+#define SFS_DBPERIDB(bsize)    ((bsize) / sizeof(uint32_t))
+
 /* Number of bits in a block */
-#define SFS_BITSPERBLOCK (SFS_BLOCKSIZE * CHAR_BIT)
+#define SFS_BITSPERBLOCK(bsize) ((bsize) * 8)
 
 /* Utility macro */
-#define SFS_ROUNDUP(a,b)       ((((a)+(b)-1)/(b))*b)
+#define SFS_ROUNDUP(a,b)       ((((a)+(b)-1)/(b))*(b))
 
 /* Size of free block bitmap (in bits) */
-#define SFS_FREEMAPBITS(nblocks) SFS_ROUNDUP(nblocks, SFS_BITSPERBLOCK)
+#define SFS_FREEMAPBITS(nblocks, bsize) \
+	SFS_ROUNDUP(nblocks, SFS_BITSPERBLOCK(bsize))
 
 /* Size of free block bitmap (in blocks) */
-#define SFS_FREEMAPBLOCKS(nblocks)  (SFS_FREEMAPBITS(nblocks)/SFS_BITSPERBLOCK)
+#define SFS_FREEMAPBLOCKS(nblocks, bsize) \
+	(SFS_FREEMAPBITS(nblocks, bsize)/SFS_BITSPERBLOCK(bsize))
 
 /* File types for sfi_type */
 #define SFS_TYPE_INVAL    0       /* Should not appear on disk */
@@ -74,9 +91,21 @@ struct sfs_superblock {
 	uint32_t sb_magic;		/* Magic number; should be SFS_MAGIC */
 	uint32_t sb_nblocks;			/* Number of blocks in fs */
 	char sb_volname[SFS_VOLNAME_SIZE];	/* Name of this volume */
-	uint32_t reserved[118];			/* unused, set to 0 */
+	uint32_t sb_journalstart;		/* First block of the journal */
+	uint32_t sb_journalblocks;		/* Journal size; 0 if none */
+	uint32_t sb_clean;			/* SFS_CLEAN if unmounted cleanly */
+	uint32_t sb_blocksize;			/* Block size; 0 if SFS_BLOCKSIZE */
+	uint32_t reserved[114];			/* unused, set to 0 */
 };
 
+/*
+ * sb_clean is cleared when the volume is mounted and set back to
+ * SFS_CLEAN once everything has been written by a clean unmount;
+ * mksfs and sfsck set it too. A volume marked clean does not need
+ * checking.
+ */
+#define SFS_CLEAN 0x636c6e21		/* "cln!" */
+
 /*
  * On-disk inode
  */
@@ -97,5 +126,42 @@ struct sfs_direntry {
 	char sfd_name[SFS_NAMELEN];		/* Filename */
 };
 
+/*
+ * Metadata journal.
+ *
+ * If sb_journalblocks is nonzero, blocks sb_journalstart through
+ * sb_journalstart+sb_journalblocks-1 hold a write-ahead log of
+ * metadata (inodes, directory and indirect blocks, the freemap and
+ * the superblock). It holds at most one transaction: a descriptor in
+ * the first block listing the home locations of jd_count blocks, the
+ * images of those blocks in the following jd_count blocks, and then
+ * a commit block. A transaction counts only if the commit block's
+ * magic, sequence number and count match the descriptor and its
+ * checksum matches the images; the images may then be copied to
+ * their home locations, any number of times. A descriptor with
+ * jd_count 0 means the journal is empty.
+ *
+ * The checksum is 32-bit FNV-1a over the bytes of the images, in
+ * order.
+ */
+#define SFS_JDESC_MAGIC   0x6a646573    /* "jdes" */
+#define SFS_JCOMMIT_MAGIC 0x6a636d74    /* "jcmt" */
+#define SFS_JOURNAL_MAXBLOCKS 125       /* images per transaction */
+
+struct sfs_jdesc {
+	uint32_t jd_magic;			/* SFS_JDESC_MAGIC */
+	uint32_t jd_seq;			/* transaction sequence number */
+	uint32_t jd_count;			/* number of block images */
+	uint32_t jd_blocks[SFS_JOURNAL_MAXBLOCKS]; /* their home blocks */
+};
+
+struct sfs_jcommit {
+	uint32_t jc_magic;			/* SFS_JCOMMIT_MAGIC */
+	uint32_t jc_seq;			/* same as jd_seq */
+	uint32_t jc_count;			/* same as jd_count */
+	uint32_t jc_checksum;			/* see above */
+	uint32_t jc_reserved[124];		/* unused, set to 0 */
+};
+
 
 #endif /* _KERN_SFS_H_ */
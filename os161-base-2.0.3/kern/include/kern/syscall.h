@@ -59,7 +59,7 @@
 #define SYS_mmap         8
 #define SYS_munmap       9
 #define SYS_mprotect     10
-//#define SYS_madvise    11
+#define SYS_madvise      11
 //#define SYS_mincore    12
 //#define SYS_mlock      13
 //#define SYS_munlock    14
@@ -86,13 +86,13 @@
 //#define SYS_sigaltstack 33
 //                              (resource tracking and usage)
 //#define SYS_wait4      34
-//#define SYS_getrusage  35
+#define SYS_getrusage    35
 //                              (resource limits)
 //#define SYS_getrlimit  36
 //#define SYS_setrlimit  37
 //                              (process priority control)
-//#define SYS_getpriority 38
-//#define SYS_setpriority 39
+#define SYS_getpriority  38
+#define SYS_setpriority  39
 //                              (process groups, sessions, and job control)
 //#define SYS_getpgid    40
 //#define SYS_setpgid    41
@@ -109,12 +109,12 @@
 #define SYS_close        49
 #define SYS_read         50
 #define SYS_pread        51
-//#define SYS_readv      52
+#define SYS_readv        52
 //#define SYS_preadv     53
 #define SYS_getdirentry  54
 #define SYS_write        55
 #define SYS_pwrite       56
-//#define SYS_writev     57
+#define SYS_writev       57
 //#define SYS_pwritev    58
 #define SYS_lseek        59
 #define SYS_flock        60
@@ -197,6 +197,31 @@
 #define SYS_reboot       119
 //#define SYS___sysctl   120
 
+//                              -- OS/161 extensions --
+#define SYS_spawn        121
+#define SYS___thread_create 122
+#define SYS___thread_join 123
+#define SYS___thread_exit 124
+#define SYS_sched_setaffinity 125
+#define SYS_sched_getaffinity 126
+#define SYS___futex_wait  127
+#define SYS___futex_wake  128
+#define SYS_clock_gettime 129
+#define SYS_fpunch       130
+#define SYS_msync        131
+#define SYS_sendfile     132
+#define SYS_getdents     133
+#define SYS_sem_op       134
+#define SYS_ioring_enter 135
+#define SYS_childfd      136
+#define SYS_sched_yield  137
+#define SYS_shmget       138
+#define SYS_shmat        139
+#define SYS_shmdt        140
+#define SYS_posix_fadvise 141
+#define SYS_checkpoint   142
+#define SYS_restore      143
+
 /*CALLEND*/
 
 
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2000, 2001
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KMEM_CACHE_H_
+#define _KMEM_CACHE_H_
+
+/*
+ * Object caches.
+ *
+ * A kmem_cache hands out objects of one type and size. Free objects
+ * stay on the cache's own free lists instead of going back to the
+ * general heap, so objects that are created and destroyed all the
+ * time (procs, threads, stacks, locks...) don't fragment it.
+ *
+ * Small objects are carved out of whole-page slabs. Big ones (over
+ * an eighth of a page) come from kmalloc one at a time, and up to
+ * KMEM_STASH of them are kept when freed.
+ *
+ * CTOR, if not NULL, is run on each object when its memory comes
+ * into the cache, and DTOR when it goes back to the system, not on
+ * every alloc and free. Objects must therefore be freed in their
+ * constructed state, so a constructor can keep things like locks
+ * set up across reuse. CTOR returns 0 or an error code; if it fails,
+ * kmem_cache_alloc returns NULL.
+ *
+ * Caches are usually statically allocated with KMEM_CACHE_INITIALIZER
+ * and need no setup; kmem_cache_create makes one dynamically.
+ *
+ * Functions:
+ *     kmem_cache_create     - allocate a new cache. Returns NULL on error.
+ *     kmem_cache_destroy    - destroy a cache; all objects must be free.
+ *     kmem_cache_alloc      - get an object. Returns NULL if out of memory.
+ *     kmem_cache_free       - give back an object.
+ *     kmem_cache_reap       - give the cache's spare memory back to the
+ *                             system. Returns the number of pages.
+ *     kmem_cache_printstats - print statistics for every cache in use.
+ */
+
+#include <spinlock.h>
+
+/* Number of free big objects kept per cache */
+#define KMEM_STASH		8
+
+struct kmem_slab;		/* Private to kmem_cache.c */
+
+struct kmem_cache {
+	const char *kc_name;
+	size_t kc_size;				/* object size */
+	int (*kc_ctor)(void *obj);
+	void (*kc_dtor)(void *obj);
+	struct spinlock kc_lock;
+
+	/* Set up the first time the cache is used */
+	bool kc_ready;
+	size_t kc_stride;			/* bytes per object in a slab */
+	unsigned kc_perslab;			/* objects per slab, 0 if big */
+	struct kmem_cache *kc_next;		/* list of all caches */
+
+	struct kmem_slab *kc_partial;		/* slabs with some free objects */
+	struct kmem_slab *kc_full;		/* slabs with none */
+	struct kmem_slab *kc_empty;		/* at most one all-free slab */
+	void *kc_stash[KMEM_STASH];		/* free big objects */
+	unsigned kc_nstash;
+
+	/* Statistics */
+	unsigned kc_allocs, kc_frees;		/* calls */
+	unsigned kc_inuse, kc_peak;		/* objects handed out */
+	unsigned kc_nslabs;			/* slabs, or big objects, owned */
+	unsigned kc_grows;			/* times new memory was needed */
+};
+
+#define KMEM_CACHE_INITIALIZER(name, size, ctor, dtor) \
+	{ .kc_name = (name), .kc_size = (size), .kc_ctor = (ctor), \
+	  .kc_dtor = (dtor), .kc_lock = SPINLOCK_INITIALIZER }
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     int (*ctor)(void *obj),
+				     void (*dtor)(void *obj));
+void kmem_cache_destroy(struct kmem_cache *kc);
+void *kmem_cache_alloc(struct kmem_cache *kc);
+void kmem_cache_free(struct kmem_cache *kc, void *obj);
+unsigned kmem_cache_reap(struct kmem_cache *kc);
+void kmem_cache_printstats(void);
+struct kstat;
+void kmem_cache_kstat(struct kstat *ks);
+
+#endif /* _KMEM_CACHE_H_ */
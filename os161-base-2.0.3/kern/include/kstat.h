@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KSTAT_H_
+#define _KSTAT_H_
+
+/*
+ * Kernel statistics.
+ *
+ * kstat_snapshot collects every statistic the kernel keeps into one
+ * buffer of text, one "name value" line each. Names are dot-separated,
+ * subsystem first (vm.tlb.fast, syscall.read.calls, proc.12.faults,
+ * cpu.1.runqueue...), and values are unsigned decimal integers, so a
+ * snapshot can be parsed with nothing more than sscanf. The snapshot
+ * is what the kstat: device returns, for monitoring tools in userland.
+ *
+ * Each subsystem has a function foo_kstat(struct kstat *) that adds
+ * its counters with kstat_put, next to the foo_printstats that shows
+ * them on the console. The counters are read the same way the print
+ * functions read them, which is mostly without synchronization, so a
+ * snapshot is not atomic: counters may be slightly stale relative to
+ * each other. kstat_put never sleeps or allocates, so it may be called
+ * with spinlocks held.
+ *
+ * Functions:
+ *     kstat_put      - add a counter to a snapshot. NAMEFMT is a printf
+ *                      format for the name.
+ *     kstat_snapshot - take a snapshot; returns 0 or an error code, and
+ *                      hands back a null-terminated buffer from
+ *                      kvmalloc (free it with kvfree) and its length.
+ */
+
+#include <cdefs.h>
+
+struct kstat;
+
+void kstat_put(struct kstat *ks, uint64_t value, const char *namefmt, ...)
+	__PF(3,4);
+int kstat_snapshot(char **bufret, size_t *lenret);
+
+#endif /* _KSTAT_H_ */
@@ -124,14 +124,45 @@ uint32_t random(void);
  * If out of memory, kmalloc returns NULL.
  *
  * kheap_nextgeneration, dump, and dumpall do nothing unless heap
- * labeling (for leak detection) in kmalloc.c (q.v.) is enabled.
+ * labeling (for leak detection) in kmalloc.c (q.v.) is enabled;
+ * kheap_profile does nothing unless per-site profiling is.
+ *
+ * kvmalloc is for big buffers that don't need to be physically
+ * contiguous: it tries kmalloc, and if that fails maps scattered
+ * pages with vmalloc. Free with kvfree, which takes either.
+ * kheap_lockstats reports how often the allocator's spinlock has
+ * been taken since boot, and how often it was contended.
  */
 void *kmalloc(size_t size);
 void kfree(void *ptr);
+void *kvmalloc(size_t size);
+void kvfree(void *ptr);
 void kheap_printstats(void);
+struct kstat;
+void kheap_kstat(struct kstat *ks);
 void kheap_nextgeneration(void);
 void kheap_dump(void);
 void kheap_dumpall(void);
+void kheap_profile(void);
+void kheap_lockstats(unsigned *acquires, unsigned *contended);
+
+/*
+ * Kernel heap timeline: kheap_sample is called every few seconds by
+ * the timer code, with the time since boot; kheap_timeline prints the
+ * samples kept.
+ */
+void kheap_sample(unsigned secs);
+void kheap_timeline(void);
+
+/*
+ * PATH_MAX-sized scratch buffers for path-taking system calls, kept
+ * in a small per-cpu pool in front of kmalloc. pathbuf_get returns
+ * NULL if out of memory. The pool statistics are also printed by
+ * kheap_printstats, and put in snapshots by kheap_kstat.
+ */
+char *pathbuf_get(void);
+void pathbuf_put(char *buf);
+void pathbuf_printstats(void);
 
 /*
  * C string functions.
@@ -177,6 +208,13 @@ void beep(void);
  * kprintf_bootstrap sets up a lock for kprintf and should be called
  * during boot once malloc is available and before any additional
  * threads are created.
+ *
+ * kprintf_async_bootstrap switches kprintf over to per-cpu log rings
+ * drained by a kernel thread, so printing doesn't wait for the
+ * console; it is called once all cpus are up. kprintf_setasync turns
+ * the rings on and off, printing whatever they hold when turned off.
+ * kprintf_tick is called from hardclock to pass on wakeups that
+ * kprintf had to put off. kprintf_printstats prints ring statistics.
  */
 int kprintf(const char *format, ...) __PF(1,2);
 __DEAD void panic(const char *format, ...) __PF(1,2);
@@ -186,6 +224,10 @@ __DEAD void badassert(const char *expr, const char *file,
 void kgets(char *buf, size_t maxbuflen);
 
 void kprintf_bootstrap(void);
+void kprintf_async_bootstrap(void);
+void kprintf_setasync(bool on);
+void kprintf_tick(void);
+void kprintf_printstats(void);
 
 /*
  * Other miscellaneous stuff
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _LOCKPROF_H_
+#define _LOCKPROF_H_
+
+/*
+ * Lock contention profiler. Enable with "options lockprof" in the
+ * kernel config, then turn it on from the menu with "lp on".
+ *
+ * Statistics are kept per class of locks rather than per lock, so
+ * that short-lived locks (one per vnode, per process...) still add
+ * up to something. Sleep locks are classed by the name passed to
+ * lock_create, spinlocks by the code that called spinlock_init, and
+ * statically initialized spinlocks all go in one class.
+ *
+ * For each class we count acquisitions and contended acquisitions
+ * (the lock was held when we got there), and add up the time spent
+ * waiting, the longest wait, and the time held, in nanoseconds.
+ */
+
+#include "opt-lockprof.h"
+
+#if OPT_LOCKPROF
+
+struct lockprof_class;	/* Opaque. */
+
+/* Per-lock part. */
+struct lockprof {
+	struct lockprof_class *lp_class;	/* NULL until first use */
+	uint64_t lp_acquired;			/* When the holder got it */
+};
+
+/* Per-acquire part, on the waiter's stack. */
+struct lockprof_waiter {
+	uint64_t lw_start;			/* When we started waiting */
+	bool lw_contended;			/* Found the lock held */
+};
+
+void lockprof_init(struct lockprof *lp, const char *name, const void *site);
+void lockprof_wait(struct lockprof_waiter *w);
+void lockprof_acquire(struct lockprof *lp, struct lockprof_waiter *w);
+void lockprof_release(struct lockprof *lp);
+
+void lockprof_enable(bool on);
+void lockprof_reset(void);
+void lockprof_print(void);
+struct kstat;
+void lockprof_kstat(struct kstat *ks);
+
+#define LOCKPROF_LOCKABLE(sym)		struct lockprof sym
+#define LOCKPROF_WAITER(sym)		struct lockprof_waiter sym
+
+/* Static spinlocks get a class on first use. */
+#define LOCKPROF_LOCKABLE_INITIALIZER	{ NULL, 0 }
+
+#define LOCKPROF_LOCKABLEINIT(lp, n)	lockprof_init(lp, n, NULL)
+#define LOCKPROF_SPINLOCKINIT(lp, s)	lockprof_init(lp, NULL, s)
+
+#define LOCKPROF_WAIT(w)		lockprof_wait(w)
+#define LOCKPROF_CONTENDED(w)		((w)->lw_contended = true)
+#define LOCKPROF_ACQUIRE(lp, w)		lockprof_acquire(lp, w)
+#define LOCKPROF_RELEASE(lp)		lockprof_release(lp)
+
+#else
+
+#define LOCKPROF_LOCKABLE(sym)
+#define LOCKPROF_WAITER(sym)
+
+#define LOCKPROF_LOCKABLE_INITIALIZER
+
+#define LOCKPROF_LOCKABLEINIT(lp, n)
+#define LOCKPROF_SPINLOCKINIT(lp, s)
+
+#define LOCKPROF_WAIT(w)
+#define LOCKPROF_CONTENDED(w)
+#define LOCKPROF_ACQUIRE(lp, w)
+#define LOCKPROF_RELEASE(lp)
+
+#endif
+
+#endif /* _LOCKPROF_H_ */
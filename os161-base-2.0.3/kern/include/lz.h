@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _LZ_H_
+#define _LZ_H_
+
+/*
+ * A small, fast LZ77 compressor, for data that is compressed and
+ * decompressed in memory (such as pages on their way to swap).
+ *
+ * The output is a sequence of items, each starting with a control
+ * byte C: below 0x80, C+1 literal bytes follow; otherwise it is a
+ * match of (C & 0x7f) + LZ_MINMATCH bytes, copied from the output
+ * at the distance in the next two bytes (big-endian, at least 1).
+ * Matches are found through a hash table of LZ_HASHSIZE entries
+ * holding the last position seen for each hash of four bytes; it is
+ * scratch space handed in by the caller, so that compressing needs
+ * neither allocation nor much stack.
+ *
+ * lz_compress - compress LEN (at most 65535) bytes of SRC into DST,
+ *       which has room for MAX bytes. Returns the compressed length,
+ *       or 0 if it would not fit.
+ * lz_decompress - decompress the LEN bytes at SRC into DST, which
+ *       has room for MAX bytes. Returns the decompressed length, or
+ *       0 if the input is malformed or does not fit.
+ */
+
+#define LZ_HASHBITS	10
+#define LZ_HASHSIZE	(1 << LZ_HASHBITS)
+#define LZ_MINMATCH	4
+
+size_t lz_compress(const void *src, size_t len, void *dst, size_t max,
+		   uint16_t *table);
+size_t lz_decompress(const void *src, size_t len, void *dst, size_t max);
+
+
+#endif /* _LZ_H_ */
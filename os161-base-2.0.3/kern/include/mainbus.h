@@ -55,6 +55,9 @@ size_t mainbus_ramsize(void);
 /* Switch on an inter-processor interrupt. (Low-level.) */
 void mainbus_send_ipi(struct cpu *target);
 
+/* Interrupt the current CPU once, NSECS from now (at most a second). */
+void mainbus_timer_oneshot(uint64_t nsecs);
+
 /* Request breaking into the debugger, where available. */
 void mainbus_debugger(void);
 
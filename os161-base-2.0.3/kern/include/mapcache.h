@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _MAPCACHE_H_
+#define _MAPCACHE_H_
+
+/*
+ * File page cache, for mmap (vm/mapcache.c), keyed by vnode and file
+ * offset. Each entry holds a reference on its frame.
+ *
+ * Functions:
+ *     mapcache_find       - the entry for page OFF of VN, or NULL.
+ *     mapcache_lookup     - the same, counted as a hit or a miss.
+ *     mapcache_enter      - enter frame PA as page OFF of VN. Returns
+ *                           NULL if out of memory.
+ *     mapcache_release    - drop entries nobody maps. Returns how many.
+ *     mapcache_count      - number of entries.
+ *     mapcache_countwrite - count a page written back to its file.
+ *     page_readfile       - read a page of a file into a frame.
+ *     page_writefile      - write a frame back as a page of a file.
+ *     page_filesize       - size of a file, for page_writefile.
+ *
+ * The mapcache_* functions but mapcache_count must be called with
+ * vm_lock held, and the page_* ones without.
+ */
+
+struct vnode;
+
+struct mappage {
+	struct vnode *mp_vn;		/* file */
+	off_t mp_off;			/* page offset in the file */
+	paddr_t mp_pa;			/* frame (one reference is ours) */
+	bool mp_dirty;			/* may be newer than the file */
+	struct mappage *mp_hashnext;
+};
+
+struct mappage *mapcache_find(struct vnode *vn, off_t off);
+struct mappage *mapcache_lookup(struct vnode *vn, off_t off);
+struct mappage *mapcache_enter(struct vnode *vn, off_t off, paddr_t pa);
+unsigned mapcache_release(struct vnode *vn, unsigned max);
+unsigned mapcache_count(void);
+void mapcache_countwrite(void);
+int page_readfile(struct vnode *v, off_t off, paddr_t pa, int advice);
+int page_writefile(struct vnode *v, off_t off, paddr_t pa, off_t size);
+off_t page_filesize(struct vnode *v);
+
+struct kstat;
+void mapcache_printstats(void);
+void mapcache_kstat(struct kstat *ks);
+
+#endif /* _MAPCACHE_H_ */
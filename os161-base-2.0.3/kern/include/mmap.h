@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _MMAP_H_
+#define _MMAP_H_
+
+/*
+ * Mappings (vm/mmap.c). as_mmap and the rest of the system call side
+ * are declared in addrspace.h. All of these are called with vm_lock
+ * held.
+ *
+ * Functions:
+ *     page_fillmap   - first touch of a page of a file mapping.
+ *                      Returns EAGAIN if the fault has to be looked at
+ *                      again.
+ *     page_fillanon  - first touch of a page of a shared anonymous
+ *                      mapping.
+ *     map_release    - unmap the pages of a mapping, writing back
+ *                      shared file pages that need it.
+ *     as_placeregion - find room for a new region between the heap and
+ *                      the stack.
+ */
+
+struct addrspace;
+struct region;
+
+int page_fillmap(struct addrspace *as, struct region *reg, vaddr_t va,
+		 uint32_t *pte);
+int page_fillanon(const struct region *reg, uint32_t *pte);
+void map_release(struct addrspace *as, const struct region *reg,
+		 uint32_t *ptes);
+int as_placeregion(struct addrspace *as, size_t npages,
+		   struct region **prevret, vaddr_t *ret);
+
+#endif /* _MMAP_H_ */
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _NET_H_
+#define _NET_H_
+
+/*
+ * Network interfaces: a minimal, socket-like packet interface.
+ *
+ * Packets are link-level frames between 16-bit hardware addresses.
+ * Their buffers belong to the driver and are lent out rather than
+ * copied: net_getbuf lends a free transmit buffer to be filled in
+ * and handed back with net_send, and net_recv lends a buffer holding
+ * a received packet, which goes back with net_release. Each network
+ * interface can be opened by one user at a time.
+ */
+
+#define NET_BROADCAST	0xffff		/* Hardware broadcast address */
+#define NET_MAXIF	4		/* Max number of interfaces */
+
+/*
+ * A lent packet buffer.
+ */
+struct netbuf {
+	void *nb_data;			/* Payload */
+	size_t nb_len;			/* Payload length (received) */
+	size_t nb_max;			/* Room at nb_data (to send) */
+	uint16_t nb_from;		/* Sender (received) */
+	uint16_t nb_to;			/* Destination (received) */
+	unsigned nb_slot;		/* Private to the driver */
+};
+
+/*
+ * Interface counters.
+ */
+struct netstats {
+	unsigned ns_rxframes;		/* Packets received */
+	unsigned ns_rxdropped;		/* ...lost for lack of buffers */
+	unsigned ns_rxbad;		/* ...lost to errors */
+	unsigned ns_txframes;		/* Packets sent */
+};
+
+/*
+ * Operations a driver provides.
+ *
+ * nio_getbuf - lend a transmit buffer, waiting for one if WAIT.
+ * nio_send   - queue a lent transmit buffer holding LEN bytes for TO.
+ * nio_recv   - lend the next received packet, waiting for one if WAIT.
+ * nio_release - take back a lent buffer without sending it.
+ * nio_stats  - fetch the interface counters.
+ *
+ * Buffers are sent, and received packets are lent out, in the order
+ * their buffers were lent.
+ */
+struct netif_ops {
+	int (*nio_getbuf)(void *devdata, struct netbuf *nb, bool wait);
+	int (*nio_send)(void *devdata, struct netbuf *nb,
+			uint16_t to, size_t len);
+	int (*nio_recv)(void *devdata, struct netbuf *nb, bool wait);
+	void (*nio_release)(void *devdata, struct netbuf *nb);
+	void (*nio_stats)(void *devdata, struct netstats *ns);
+};
+
+struct netif {
+	const struct netif_ops *ni_ops;
+	void *ni_devdata;
+	uint16_t ni_addr;		/* Our hardware address */
+	bool ni_open;			/* Opened by someone */
+};
+
+/* Called by drivers at config time to make an interface available. */
+int net_attach(struct netif *ni);
+
+/*
+ * Socket-like interface.
+ *
+ * net_open   - claim interface number UNIT; ENXIO if there's no such
+ *              interface, EBUSY if it's already open. Stale received
+ *              packets are discarded.
+ * net_close  - give up an interface; nothing may be lent out.
+ *
+ * net_getbuf and net_recv fail with EAGAIN if WAIT is false and
+ * nothing is ready; net_send fails with EMSGSIZE if LEN won't fit.
+ */
+int net_open(unsigned unit, struct netif **ret);
+void net_close(struct netif *ni);
+uint16_t net_addr(struct netif *ni);
+int net_getbuf(struct netif *ni, struct netbuf *nb, bool wait);
+int net_send(struct netif *ni, struct netbuf *nb, uint16_t to, size_t len);
+int net_recv(struct netif *ni, struct netbuf *nb, bool wait);
+void net_release(struct netif *ni, struct netbuf *nb);
+void net_stats(struct netif *ni, struct netstats *ns);
+
+#endif /* _NET_H_ */
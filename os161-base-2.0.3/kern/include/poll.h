@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _POLL_H_
+#define _POLL_H_
+
+/*
+ * Poll support: how a thread in poll() waits on many objects at once.
+ *
+ * An object that can be polled keeps a struct pollhead. Its VOP_POLL
+ * takes the object's own lock, hooks the caller's pollent onto the
+ * pollhead with pollhead_register, and returns the events that are
+ * ready; whoever makes the object ready calls pollhead_wakeup, with
+ * that same lock held, which wakes every thread registered. Because
+ * both happen under the object's lock, a wakeup can't fall between
+ * the check and the sleep.
+ *
+ * The thread in poll() owns a pollwaiter and one pollent per object.
+ * It registers all of them, and sleeps with pollwaiter_sleep if none
+ * was ready; then it takes them all off with pollent_unregister
+ * before the pollents and the objects go away.
+ *
+ * pollhead_wakeup takes only spinlocks, so it can be called from an
+ * interrupt handler. The lock order is: object lock, ph_lock, then
+ * the wait queue lock inside the pollwaiter code.
+ */
+
+#include <spinlock.h>
+#include <clock.h>
+#include <kern/poll.h>
+
+struct pollent;
+
+struct pollhead {
+	struct spinlock ph_lock;
+	struct pollent *ph_first;	/* registered pollents */
+};
+
+struct pollwaiter {
+	unsigned pw_queue;		/* wait queue, picked by thread */
+	volatile bool pw_woken;		/* some object became ready */
+	volatile bool pw_timedout;	/* the timer went off */
+	bool pw_timed;			/* the timer was started */
+	struct timer pw_timer;
+};
+
+struct pollent {
+	struct pollhead *pe_head;	/* where registered, or NULL */
+	struct pollwaiter *pe_waiter;
+	struct pollent *pe_next;	/* on pe_head */
+};
+
+/* Set up the wait queues. */
+void poll_bootstrap(void);
+
+/* Object side. */
+void pollhead_init(struct pollhead *ph);
+void pollhead_cleanup(struct pollhead *ph);
+void pollhead_register(struct pollhead *ph, struct pollent *pe);
+void pollhead_wakeup(struct pollhead *ph);
+
+/*
+ * Poller side. A NULL pollent, which VOP_POLL may be passed to just
+ * look, is never registered. pollwaiter_sleep waits until an object
+ * is ready or the time of day reaches DEADLINE (if not NULL), and
+ * returns false on timeout.
+ */
+void pollent_init(struct pollent *pe, struct pollwaiter *pw);
+void pollent_unregister(struct pollent *pe);
+void pollwaiter_init(struct pollwaiter *pw);
+bool pollwaiter_sleep(struct pollwaiter *pw, const struct timespec *deadline);
+void pollwaiter_cleanup(struct pollwaiter *pw);
+
+#endif /* _POLL_H_ */
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PQUEUE_H_
+#define _PQUEUE_H_
+
+/*
+ * Intrusive priority queue (pairing heap), keyed by 64-bit numbers,
+ * smallest first.
+ *
+ * The objects carry a struct pqnode, which holds the key and links
+ * them into the heap; ->pn_self points back to the object, as in
+ * threadlist.h. Nothing is ever allocated, so it can be used with
+ * spinlocks held and in interrupt handlers.
+ *
+ * Each node has a list of children, every one of them with a key no
+ * smaller than its own. Adding just makes the new node a child of
+ * the root or the other way round, in constant time. Removing the
+ * smallest pairs up the root's children left to right and then folds
+ * the pairs together right to left, which keeps the tree shallow; it
+ * takes O(log n) amortized. Removing any other node cuts it out of
+ * its parent's list and does the same with its children, so
+ * cancelling is O(log n) amortized too. Nodes with equal keys come
+ * out in no particular order.
+ *
+ * The queue does no locking; that's up to the user.
+ *
+ * init - initialize a queue in space externally allocated.
+ * cleanup - clean up a queue, which must be empty.
+ * count - number of nodes.
+ * isempty - whether there are none.
+ * insert - add node PN, which must not be in a queue, with key KEY.
+ * min - the node with the smallest key, or NULL if empty.
+ * removemin - remove and return the node with the smallest key, or
+ *       NULL if empty.
+ * remove - remove node PN, which has to be in the queue.
+ * inqueue - whether node PN is in queue PQ.
+ * key - the key node PN was inserted with.
+ */
+
+#include <cdefs.h>
+
+#ifndef PQUEUEINLINE
+#define PQUEUEINLINE INLINE
+#endif
+
+struct pqnode {
+	struct pqnode *pn_child;	/* First child */
+	struct pqnode *pn_next;		/* Next sibling */
+	struct pqnode *pn_prev;		/* Previous sibling, or the parent */
+	uint64_t pn_key;
+	void *pn_self;			/* The object containing this node */
+};
+
+struct pqueue {
+	struct pqnode *pq_root;
+	unsigned pq_count;
+};
+
+void pqnode_init(struct pqnode *pn, void *self);
+void pqnode_cleanup(struct pqnode *pn);
+
+void pqueue_init(struct pqueue *pq);
+void pqueue_cleanup(struct pqueue *pq);
+PQUEUEINLINE unsigned pqueue_count(const struct pqueue *pq);
+PQUEUEINLINE bool pqueue_isempty(const struct pqueue *pq);
+void pqueue_insert(struct pqueue *pq, struct pqnode *pn, uint64_t key);
+PQUEUEINLINE struct pqnode *pqueue_min(const struct pqueue *pq);
+struct pqnode *pqueue_removemin(struct pqueue *pq);
+void pqueue_remove(struct pqueue *pq, struct pqnode *pn);
+PQUEUEINLINE bool pqueue_inqueue(const struct pqueue *pq,
+				 const struct pqnode *pn);
+PQUEUEINLINE uint64_t pqnode_key(const struct pqnode *pn);
+
+/*
+ * Inlining for base operations
+ */
+
+PQUEUEINLINE unsigned
+pqueue_count(const struct pqueue *pq)
+{
+	return pq->pq_count;
+}
+
+PQUEUEINLINE bool
+pqueue_isempty(const struct pqueue *pq)
+{
+	return pq->pq_root == NULL;
+}
+
+PQUEUEINLINE struct pqnode *
+pqueue_min(const struct pqueue *pq)
+{
+	return pq->pq_root;
+}
+
+PQUEUEINLINE bool
+pqueue_inqueue(const struct pqueue *pq, const struct pqnode *pn)
+{
+	/* Every node but the root has a parent or previous sibling */
+	return pn->pn_prev != NULL || pq->pq_root == pn;
+}
+
+PQUEUEINLINE uint64_t
+pqnode_key(const struct pqnode *pn)
+{
+	return pn->pn_key;
+}
+
+
+#endif /* _PQUEUE_H_ */
@@ -41,23 +41,72 @@
 
 #if OPT_SHELL
 #include <limits.h>				// to use OPEN_MAX
+#include <poll.h>				// to use pollhead
+
+/* Number of file descriptors every file table starts with, inside the table itself */
+#define FDTABLE_INLINE 16
 #endif
 
 struct addrspace;
 struct thread;
 struct vnode;
 
+
+
+/**
+ * @brief The fdtable structure is the file table of a process. It starts with the
+ *        FDTABLE_INLINE slots embedded in it and is grown on demand, by doubling, up
+ *        to OPEN_MAX slots. After a fork() parent and child share the same table
+ *        (ft_refs counts them), and whichever changes it first gets a private copy.
+ */
+#if OPT_SHELL
+struct fdtable {
+	struct spinlock ft_lock;		/* protects ft_refs							*/
+	unsigned ft_refs;				/* number of processes sharing the table	*/
+	unsigned ft_size;				/* number of slots in ft_files				*/
+	unsigned ft_hint;				/* lowest word of ft_bitmap which may still contain a free bit */
+	struct openfile **ft_files;		/* the slots (ft_inline while small)		*/
+	uint32_t *ft_bitmap;			/* bit set = fd in use (ft_inlinemap while small) */
+	uint32_t *ft_cloexec;			/* bit set = close at exec (ft_inlinecloexec while small) */
+	struct openfile *ft_inline[FDTABLE_INLINE];
+	uint32_t ft_inlinemap[(FDTABLE_INLINE + 31) / 32];
+	uint32_t ft_inlinecloexec[(FDTABLE_INLINE + 31) / 32];
+};
+#endif
+
 /**
- * @brief The child_list structure stores the pid of each children of a process and a 
- * pointer to the next children
+ * @brief Join record of a user thread started by __thread_create(). It lives on the
+ * 		  p_uthreads list of its process until another thread joins it (or the process
+ * 		  is destroyed). Guarded by the family lock.
  */
 #if OPT_SHELL
-struct child_list {
-	pid_t child_pid;				/* pid of the child							*/
-	struct child_list* next_child;	/* next_child						        */
+struct uthread {
+	pid_t ut_tid;				/* thread id, unique within the process		*/
+	int ut_status;				/* value passed to __thread_exit()			*/
+	bool ut_exited;				/* the thread is gone, ut_status is valid	*/
+	bool ut_joining;			/* somebody is already waiting for it		*/
+	struct uthread *ut_next;
 };
 #endif
 
+/**
+ * @brief Resource usage of a process, as charged by its threads (see proc_charge_*()).
+ * 		  Guarded by p_lock.
+ */
+#if OPT_SHELL
+#define PROC_NSYSCALLS 128			/* system call numbers counted one by one */
+
+struct procusage {
+	uint64_t pu_utime;				/* usecs spent in user mode, by hardclock	*/
+	uint64_t pu_stime;				/* usecs spent in the kernel, by hardclock	*/
+	uint32_t pu_faults;				/* VM faults								*/
+	uint32_t pu_majfaults;			/* VM faults which read from swap			*/
+	uint64_t pu_inbytes;			/* bytes read by read, readv and pread		*/
+	uint64_t pu_outbytes;			/* bytes written by write, writev and pwrite */
+	uint32_t pu_nsyscalls;			/* system calls made						*/
+	uint32_t pu_syscalls[PROC_NSYSCALLS];	/* ... by number					*/
+};
+#endif
 
 /*
  * Process structure.
@@ -90,18 +139,46 @@ struct proc {
 #if OPT_SHELL
 	int p_status;				/* current process status 	*/
 	pid_t p_pid;				/* current process PID		*/
+	unsigned p_refcount;		/* process table + proc_search() users */
 	pid_t parent_pid;			/* parent process PID		*/
-	struct child_list* children_list;  /*list of children          */
-	struct cv *p_cv;			/* used for waitpid() syscall */
-	struct lock *p_locklock;	/* used for waitpid() syscall */
+	struct proc *p_children;	/* newest child; guarded by the family lock */
+	struct proc *p_sibprev;		/* siblings, in the parent's list */
+	struct proc *p_sibnext;
+	struct proc *p_lastchild;	/* newest child still linked, or NULL; family lock */
+	struct cv *p_cv;			/* signalled when a child, or one of our threads, exits */
+	bool p_exited;				/* zombie, waiting to be reaped */
+	bool p_exiting;				/* _exit() called, the other threads are leaving (p_lock) */
+	struct pollhead p_childpoll;	/* poll() on a child exiting, or on p_exiting */
+
+	/* USER THREADS OTHER THAN THE FIRST ONE; guarded by the family lock */
+	struct uthread *p_uthreads;	/* threads not joined yet */
+	pid_t p_nexttid;			/* id of the next thread to create */
 
 	/**
-	 * @brief file table of this specific process. Each process can have at maximum 
-	 * 		  OPEN_MAX files opened in the table.
+	 * @brief file table of this specific process, possibly shared copy-on-write with
+	 * 		  its parent or children. NULL until the first file is opened.
 	 * 
-	 * 		  This struct will be initialized in proc_create() and freed in proc_destroy().
+	 * 		  Access it through fd_acquire() or, holding p_fdlock, fd_get(); it is
+	 * 		  freed in proc_destroy().
 	 */
-	struct openfile *fileTable[OPEN_MAX];
+	struct fdtable *p_fdtable;
+	struct lock *p_fdlock;		/* serializes the threads changing p_fdtable */
+
+	/* RESOURCE USAGE (p_lock) */
+	struct procusage p_usage;	/* of this process */
+	struct procusage p_cusage;	/* of the children it has reaped */
+
+	/* CPUS ITS THREADS MAY RUN ON (p_lock), SEE proc_setaffinity() */
+	uint32_t p_affinity;
+
+	/* NICE VALUE OF ITS THREADS (p_lock), SEE proc_setnice() */
+	int p_nice;
+
+	/* BYTE-RANGE LOCKS IT HOLDS ON FILES (p_lock), SEE rangelock.h */
+	unsigned p_nrangelocks;
+
+	/* DESTROYS THE ZOMBIE IN A WORKER THREAD ONCE IT IS REAPED, SEE sys_waitpid() */
+	struct work p_reapwork;
 #endif
 };
 
@@ -114,14 +191,19 @@ void proc_bootstrap(void);
 /* Create a fresh process for use by runprogram(). */
 struct proc *proc_create_runprogram(const char *name);
 
+#if OPT_SHELL
+/* Create a proc for fork(), sharing the current process's file table. */
+struct proc *proc_create_fork(const char *name);
+#endif
+
 /* Destroy a process. */
 void proc_destroy(struct proc *proc);
 
 /* Attach a thread to a process. Must not already have a process. */
 int proc_addthread(struct proc *proc, struct thread *t);
 
-/* Detach a thread from its process. */
-void proc_remthread(struct thread *t);
+/* Detach a thread from its process; returns the number of threads left in it. */
+unsigned proc_remthread(struct thread *t);
 
 /* Fetch the address space of the current process. */
 struct addrspace *proc_getas(void);
@@ -129,16 +211,32 @@ struct addrspace *proc_getas(void);
 /* Change the address space of the current process, and return the old one. */
 struct addrspace *proc_setas(struct addrspace *);
 
+#if OPT_SHELL
+/* Fill in the pid and parent pid in the kernel info page of the process's address space. */
+void proc_kinfo_update(struct proc *proc);
+#endif
+
 /**
- * @brief Return the process associated to the given PID
+ * @brief Return the process associated to the given PID, with a reference that
+ * 		  keeps the structure alive until proc_release()
  * 
  * @param pid pid of the process to retrieve
- * @return struct proc* process associated to the pid
+ * @return struct proc* process associated to the pid, NULL if there is none
  */
 #if OPT_SHELL
 struct proc *proc_search(pid_t pid);
 #endif
 
+/**
+ * @brief Drop a reference to a process obtained from proc_search(). The structure is
+ * 		  freed when the last reference goes away, which is after proc_destroy().
+ * 
+ * @param proc process to release
+ */
+#if OPT_SHELL
+void proc_release(struct proc *proc);
+#endif
+
 /**
  * @brief Starts the new generated thread
  * 
@@ -150,75 +248,251 @@ void call_enter_forked_process(void *tfv, unsigned long dummy);
 #endif
 
 /**
- * @brief Search in the process table a valid PID for an eventual
- * 		  new process.
+ * @brief Starts a new user thread of a process, made by __thread_create()
  * 
- * @return PID on success, an error value in case of failure.
+ * @param tfv trapframe holding entry point, stack and the two arguments (a0, a1).
+ * @param utv join record of the thread (struct uthread *).
  */
 #if OPT_SHELL
-int find_valid_pid(void);
+void call_enter_new_thread(void *tfv, unsigned long utv);
 #endif
 
 /**
- * @brief Add the given process to the process table, at the given index.
+ * @brief Allocate and free the copy of the parent's trapframe that fork hands to
+ * 		  the child. call_enter_forked_process frees it.
+ */
+#if OPT_SHELL
+struct trapframe;
+struct trapframe *proc_trapframe_alloc(void);
+void proc_trapframe_free(struct trapframe *tf);
+#endif
+
+/**
+ * @brief Tell whether the process table has run out of PIDs (so that fork can fail
+ * 		  with ENPROC rather than ENOMEM).
  * 
- * @param pid index in the table (PID)
- * @param proc process to be added
+ * @return true if no PID can be allocated
+ */
+#if OPT_SHELL
+bool proc_table_full(void);
+#endif
+
+/**
+ * @brief Turn the exiting process into a zombie and wake up its parent.
  * 
- * @return zero on success, an error value in case of failure
+ * @param proc exiting process, with no threads left
+ * @return true if the parent will reap it, false if the caller must destroy it
  */
 #if OPT_SHELL
-int proc_add(pid_t pid, struct proc *proc);
+bool proc_exit(struct proc *proc);
 #endif
 
 /**
- * @brief Remove the process associated to the given pid from the process 
- * 		  table.
+ * @brief Wait for a child of the current process (or any, with WAIT_ANY) to exit
+ * 		  and reap it. With WNOHANG, *retpid is 0 if no child has exited yet.
  * 
- * @param pid pid of the process.
+ * @return zero on success, ECHILD if there is no such child, EINVAL for bad options
  */
 #if OPT_SHELL
-void proc_remove(pid_t pid);
+int proc_wait(pid_t pid, int options, int *status, pid_t *retpid);
 #endif
 
 /**
- * @brief Adds a new child to the child_list of a parent process
+ * @brief For poll(): register pe (unless NULL) to be woken when a child of the current
+ * 		  process exits, or when the process starts exiting.
  * 
- * @param proc parent process.
- * @param child_pid pid of the child process.
+ * @return proc_pollchildren(): POLLIN if a child can be reaped, POLLHUP if there are
+ * 		   no children; proc_pollexiting(): true if the process is exiting
+ */
+#if OPT_SHELL
+int proc_pollchildren(struct pollent *pe);
+bool proc_pollexiting(struct pollent *pe);
+#endif
+
+/**
+ * @brief Make the join record of a new user thread of the given process, with a fresh
+ * 		  thread id. proc_uthread_forget() undoes it if the thread cannot be started.
  * 
- * @return 0 on success, -1 in case of failure
+ * @return the record, NULL if out of memory
  */
 #if OPT_SHELL
-int add_new_child(struct proc* proc, pid_t child_pid);
+struct uthread *proc_uthread_add(struct proc *proc);
+void proc_uthread_forget(struct proc *proc, struct uthread *ut);
 #endif
 
 /**
- * @brief Destroys the child_list of a parent process which is being destroyed.
- * Sets the childrens's parent pid to -1, the "root" process. 
+ * @brief Wait for the user thread tid of the current process to exit, then free its
+ * 		  record.
  * 
- * @param proc parent process.
+ * @return zero on success, ESRCH if there is no such thread, EINVAL if it is the caller
+ * 		   or another thread is already joining it, EINTR if the process is exiting
+ */
+#if OPT_SHELL
+int proc_uthread_join(pid_t tid, int *status);
+#endif
+
+/**
+ * @brief Start the exit of the whole process: the first caller sets p_status, the other
+ * 		  threads leave at their next return to user mode.
+ */
+#if OPT_SHELL
+void proc_setexiting(struct proc *proc, int status);
+#endif
+
+/**
+ * @brief Kill the user process with the most memory committed, for the VM system when it
+ * 		  runs out; returns its pid, or 0 if there was none.
+ */
+#if OPT_SHELL
+pid_t proc_oomkill(void);
+#endif
+
+/**
+ * @brief Make the current thread leave its user process. status goes to whoever joins
+ * 		  the thread; the last thread to leave releases the address space and the files
+ * 		  and turns the process into a zombie (or destroys it, if it is an orphan).
+ */
+#if OPT_SHELL
+__DEAD void proc_thread_exit(int status);
+#endif
+
+/**
+ * @brief Charge a hardclock to the current process, to user or system time. Called in
+ * 		  interrupt context.
+ */
+#if OPT_SHELL
+void proc_charge_tick(bool user);
+#endif
+
+/**
+ * @brief Charge a system call (by number) to the current process.
+ */
+#if OPT_SHELL
+void proc_charge_syscall(int callno);
+#endif
+
+/**
+ * @brief Charge the bytes moved by a read or a write to the current process.
+ */
+#if OPT_SHELL
+void proc_charge_io(bool write, size_t len);
+#endif
+
+/**
+ * @brief Fill in a struct rusage with the usage of the current process (RUSAGE_SELF)
+ * 		  or of its reaped children (RUSAGE_CHILDREN).
  * 
- * @return 0 on success, -1 in case of failure
+ * @return zero on success, EINVAL for a bad who
+ */
+#if OPT_SHELL
+struct rusage;
+int proc_getusage(int who, struct rusage *ru);
+#endif
+
+/**
+ * @brief Print the processes and their resource usage (the "ps" menu command). With a
+ * 		  pid, also print that process's system calls by number.
+ */
+#if OPT_SHELL
+void proc_printstats(pid_t pid);
+#endif
+
+/**
+ * @brief Add the resource usage of every process to a kstat snapshot (proc.PID.*).
+ */
+#if OPT_SHELL
+struct kstat;
+void proc_kstat(struct kstat *ks);
+#endif
+
+/**
+ * @brief Restrict the threads of a process to the CPUs in a mask (bit N = cpu N). The
+ * 		  calling thread, if it belongs to the process, moves at once; the other ones
+ * 		  take the new mask the next time they enter the kernel. Threads created later
+ * 		  by the process, and children it forks, inherit it.
+ *
+ * @param pid process id, 0 for the current process
+ * @param mask the CPUs allowed
+ * @return zero on success, ESRCH if there is no such process, EINVAL if the mask has
+ * 		   no CPU of the system
+ */
+#if OPT_SHELL
+int proc_setaffinity(pid_t pid, uint32_t mask);
+#endif
+
+/**
+ * @brief Get the CPU mask of a process (see proc_setaffinity()).
+ *
+ * @param pid process id, 0 for the current process
+ * @param mask where to store the mask
+ * @return zero on success, ESRCH if there is no such process
+ */
+#if OPT_SHELL
+int proc_getaffinity(pid_t pid, uint32_t *mask);
+#endif
+
+/**
+ * @brief Set the nice value of a process, clamped to PRIO_MIN..PRIO_MAX (lower runs
+ * 		  sooner and longer, see thread_tick()). Like the CPU mask, the calling thread
+ * 		  takes it at once and the other threads of the process the next time they
+ * 		  enter the kernel; new threads and children inherit it.
+ *
+ * @param pid process id, 0 for the current process
+ * @param nice the new nice value
+ * @return zero on success, ESRCH if there is no such process
+ */
+#if OPT_SHELL
+int proc_setnice(pid_t pid, int nice);
+#endif
+
+/**
+ * @brief Get the nice value of a process (see proc_setnice()).
+ *
+ * @param pid process id, 0 for the current process
+ * @param nice where to store the nice value
+ * @return zero on success, ESRCH if there is no such process
  */
 #if OPT_SHELL
-int destroy_child_list(struct proc* proc);
+int proc_getnice(pid_t pid, int *nice);
 #endif
 
 /**
- * @brief Removes the child (which is being destroyed) from the child list of its parent process.
+ * @brief Adds a new child to the children list of a parent process and sets its
+ * 		  parent pid, in constant time.
  * 
  * @param proc parent process.
- * @param child_pid pid of the child process.
+ * @param child child process, not yet linked to any parent.
+ */
+#if OPT_SHELL
+void add_new_child(struct proc* proc, struct proc* child);
+#endif
+
+/**
+ * @brief Destroys the child list of a parent process which is exiting or being destroyed.
+ * Sets the childrens's parent pid to -1, the "root" process, and destroys the
+ * children which already exited.
  * 
- * @return 0 on success, -1 in case of failure
+ * @param proc parent process.
+ */
+#if OPT_SHELL
+void destroy_child_list(struct proc* proc);
+#endif
+
+/**
+ * @brief Removes the child (which is being destroyed) from the child list of its parent
+ * process, in constant time, and sets its parent pid to -1.
+ * The family lock must be held.
+ * 
+ * @param proc parent process.
+ * @param child child process.
  */
 #if OPT_SHELL
-int remove_child_from_list(struct proc* proc, pid_t child_pid);
+void remove_child_from_list(struct proc* proc, struct proc* child);
 #endif
 
 /**
  * @brief Checks if the process with pid child_pid is a son of the parent process.
+ * The family lock must be held.
  * 
  * @param proc parent process.
  * @param child_pid pid of the child process.
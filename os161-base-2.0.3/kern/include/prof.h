@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PROF_H_
+#define _PROF_H_
+
+/*
+ * Kernel PC-sampling profiler. Enable with "options prof" in the
+ * kernel config, then run a command under it from the menu with
+ * "prof COMMAND [ARGS]".
+ *
+ * While it's on, every hardclock records the PC the clock interrupt
+ * came in at into a ring on the interrupted cpu; samples from user
+ * mode are only counted. Afterwards the samples are matched up with
+ * functions from the kernel's own ELF symbol table, read from a file,
+ * and the busiest functions are printed. There is one sample per cpu
+ * per hardclock, so raising hz ("hz" in the menu) gives more detail.
+ */
+
+#include "opt-prof.h"
+
+#if OPT_PROF
+
+/* Where prof_report finds the kernel image by default */
+#define PROF_SYMFILE	"emu0:kernel"
+
+int prof_start(void);
+void prof_stop(void);
+void prof_sample(vaddr_t pc);	/* From hardclock */
+void prof_report(const char *symfile, unsigned topn);
+
+#endif /* OPT_PROF */
+
+#endif /* _PROF_H_ */
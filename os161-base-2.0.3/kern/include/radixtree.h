@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _RADIXTREE_H_
+#define _RADIXTREE_H_
+
+/*
+ * Radix tree: a sparse map from 32-bit keys to non-NULL pointers.
+ *
+ * Each node covers RADIX_BITS bits of the key, and the tree is only
+ * as tall as the largest key needs; keys that are close together
+ * share their nodes, so a dense run of keys costs about one pointer
+ * each and a lookup touches one node per level.
+ *
+ * Each item can have RADIX_NTAGS tags set (meant for things like
+ * dirty and under-writeback pages). Every node keeps, per tag, which
+ * of its slots lead to a tagged item, so finding tagged items skips
+ * whole untagged subtrees.
+ *
+ * Changes (insert, remove, tag set/clear) must be serialized by the
+ * caller. radix_lookup, radix_tag_get and the gang lookups may run
+ * without that lock concurrently with inserts and tag changes: a new
+ * node is set up completely before it is linked in, and the old root
+ * stays in the tree when it grows. They may not run concurrently with
+ * radix_remove, which frees nodes.
+ *
+ * init - initialize a tree in space externally allocated.
+ * cleanup - clean up a tree, which must be empty.
+ * count - number of items.
+ * insert - add ITEM under KEY. Returns EEXIST if KEY is there already
+ *       and ENOMEM if a node can't be allocated.
+ * lookup - the item under KEY, or NULL.
+ * remove - remove the item under KEY and return it, or NULL if none.
+ * gang_lookup - fill ITEMS (and, unless it is NULL, KEYS) with up to
+ *       MAX items whose keys are FIRST or more, in key order; returns
+ *       how many. gang_lookup_tag is the same for items with tag TAG.
+ * tag_set/tag_clear - set or clear tag TAG of the item under KEY,
+ *       which has to exist.
+ * tag_get - whether the item under KEY has tag TAG.
+ * tagged - whether any item has tag TAG.
+ */
+
+#define RADIX_BITS	5
+#define RADIX_SLOTS	(1U << RADIX_BITS)
+#define RADIX_NTAGS	2
+
+#define RADIX_TAG_DIRTY		0
+#define RADIX_TAG_WRITEBACK	1
+
+struct radixnode;	/* Opaque */
+
+struct radixtree {
+	struct radixnode *volatile rt_root;
+	unsigned rt_count;
+};
+
+void radix_init(struct radixtree *rt);
+void radix_cleanup(struct radixtree *rt);
+unsigned radix_count(const struct radixtree *rt);
+int radix_insert(struct radixtree *rt, uint32_t key, void *item);
+void *radix_lookup(const struct radixtree *rt, uint32_t key);
+void *radix_remove(struct radixtree *rt, uint32_t key);
+unsigned radix_gang_lookup(const struct radixtree *rt, uint32_t first,
+			   void **items, uint32_t *keys, unsigned max);
+unsigned radix_gang_lookup_tag(const struct radixtree *rt, uint32_t first,
+			       void **items, uint32_t *keys, unsigned max,
+			       unsigned tag);
+void radix_tag_set(struct radixtree *rt, uint32_t key, unsigned tag);
+void radix_tag_clear(struct radixtree *rt, uint32_t key, unsigned tag);
+bool radix_tag_get(const struct radixtree *rt, uint32_t key, unsigned tag);
+bool radix_tagged(const struct radixtree *rt, unsigned tag);
+
+
+#endif /* _RADIXTREE_H_ */
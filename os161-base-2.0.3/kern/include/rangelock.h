@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _RANGELOCK_H_
+#define _RANGELOCK_H_
+
+/*
+ * Byte-range locks: the advisory record locks of fcntl() F_GETLK,
+ * F_SETLK and F_SETLKW.
+ *
+ * A lock covers the bytes [start, end) of a file (a vnode) and is
+ * either shared (F_RDLCK) or exclusive (F_WRLCK). As in POSIX, locks
+ * belong to processes: a process never conflicts with itself, a new
+ * lock replaces whatever the process held over the same bytes, and
+ * all of its locks on a file go away when it closes any descriptor
+ * of the file, or exits. Locks of different processes conflict when
+ * they overlap and at least one of them is exclusive; disjoint
+ * ranges never do, so writers to different parts of a file can go
+ * on in parallel.
+ */
+
+struct proc;
+struct vnode;
+struct flock;
+
+/* End of a lock which extends to the end of the file, however far */
+#define RANGELOCK_EOF  ((off_t)0x7fffffffffffffffLL)
+
+/* Called once at boot. */
+void rangelock_bootstrap(void);
+
+/*
+ * F_GETLK: if a lock of another process stands in the way of a lock
+ * of type TYPE on [START, END) of VN, describe it in *FL (with
+ * l_whence SEEK_SET) and return true; otherwise return false.
+ */
+bool rangelock_test(struct vnode *vn, off_t start, off_t end, int type,
+		    struct flock *fl);
+
+/*
+ * F_SETLK, F_SETLKW: make TYPE (F_RDLCK, F_WRLCK or F_UNLCK) the
+ * lock of the current process on [START, END) of VN. If another
+ * process is in the way, fail with EAGAIN or, if WAIT, sleep until
+ * it is not; then EDEADLK means that the wait would never end and
+ * EINTR that the process started exiting.
+ */
+int rangelock_set(struct vnode *vn, off_t start, off_t end, int type,
+		  bool wait);
+
+/* PROC closed a descriptor of VN: drop all of its locks on VN. */
+void rangelock_close(struct proc *proc, struct vnode *vn);
+
+/* PROC is leaving: drop all of its locks. */
+void rangelock_exit(struct proc *proc);
+
+/* PROC is exiting: wake its threads waiting for a lock. */
+void rangelock_wakeproc(struct proc *proc);
+
+#endif /* _RANGELOCK_H_ */
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _RINGBUF_H_
+#define _RINGBUF_H_
+
+/*
+ * Bounded byte rings, for passing a stream of bytes from whoever
+ * produces it to whoever consumes it without taking a lock.
+ *
+ * The ring is a power-of-2 sized buffer with two free-running
+ * counts: rb_head, bytes ever published, and rb_tail, bytes ever
+ * consumed. Only producers write rb_head and only the consumer
+ * writes rb_tail, so with one of each nothing needs to be atomic;
+ * membar_* orders the data against the counts.
+ *
+ * ringbuf_put takes as much of LEN as fits and returns how much it
+ * took; there may be only one producer using it at a time.
+ * ringbuf_mput is for several producers (SPSC and MPSC rings are
+ * the same struct, just used differently): each first claims space
+ * by advancing rb_reserve with compare-and-swap, copies in, and then
+ * waits for earlier claims to be published before publishing its
+ * own, so the consumer never sees a gap. It stores all of LEN or
+ * nothing. It runs at splhigh so a producer can't be switched out
+ * holding a claim that others are waiting on; it may be used in
+ * interrupt handlers. Don't mix put and mput on one ring.
+ *
+ * ringbuf_get takes up to LEN bytes and returns how many; there may
+ * be only one consumer at a time. used and space are snapshots.
+ *
+ * init - set up a ring of SIZE bytes, a power of 2, in space
+ *       from kvmalloc (so a big ring needn't be physically
+ *       contiguous). Returns ENOMEM if the buffer can't be allocated.
+ * cleanup - free the buffer; the ring may hold unread data.
+ *
+ * struct bringbuf wraps a ring with wait channels for a reader and a
+ * writer that sleep when it is empty or full. bringbuf_write returns
+ * only when all of LEN has gone in, and bringbuf_read when at least
+ * one byte has come out; bringbuf_tryread and bringbuf_trywrite are
+ * ringbuf_get and ringbuf_put plus the wakeups, and do not sleep, so
+ * they can be used from interrupt handlers. As with the bare ring,
+ * there is one reader and one writer at a time. The fast path takes
+ * no lock: a sleeper announces itself in br_readwait/br_writewait
+ * under br_lock and checks the ring once more before sleeping, and
+ * the other side looks at that flag after its full barrier and only
+ * then takes the lock to wake it.
+ */
+
+#include <spinlock.h>
+
+struct wchan;	/* in wchan.h */
+
+struct ringbuf {
+	char *rb_buf;
+	unsigned rb_mask;			/* size - 1 */
+	volatile unsigned rb_head;		/* Bytes published */
+	volatile unsigned rb_tail;		/* Bytes consumed */
+	volatile spinlock_data_t rb_reserve;	/* Bytes claimed (mput) */
+};
+
+int ringbuf_init(struct ringbuf *rb, unsigned size);
+void ringbuf_cleanup(struct ringbuf *rb);
+unsigned ringbuf_size(const struct ringbuf *rb);
+unsigned ringbuf_used(const struct ringbuf *rb);
+unsigned ringbuf_space(const struct ringbuf *rb);
+size_t ringbuf_put(struct ringbuf *rb, const void *data, size_t len);
+bool ringbuf_mput(struct ringbuf *rb, const void *data, size_t len);
+size_t ringbuf_get(struct ringbuf *rb, void *data, size_t len);
+
+struct bringbuf {
+	struct ringbuf br_ring;
+	struct spinlock br_lock;		/* For the wchans */
+	struct wchan *br_readwc;
+	struct wchan *br_writewc;
+	volatile bool br_readwait;		/* Reader is (about to be) asleep */
+	volatile bool br_writewait;		/* Writer is (about to be) asleep */
+};
+
+int bringbuf_init(struct bringbuf *br, const char *name, unsigned size);
+void bringbuf_cleanup(struct bringbuf *br);
+size_t bringbuf_read(struct bringbuf *br, void *data, size_t len);
+void bringbuf_write(struct bringbuf *br, const void *data, size_t len);
+size_t bringbuf_tryread(struct bringbuf *br, void *data, size_t len);
+size_t bringbuf_trywrite(struct bringbuf *br, const void *data, size_t len);
+
+
+#endif /* _RINGBUF_H_ */
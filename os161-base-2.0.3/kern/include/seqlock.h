@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SEQLOCK_H_
+#define _SEQLOCK_H_
+
+/*
+ * Sequence locks, for data that is read much more often than it is
+ * written, and that is small enough to copy.
+ *
+ * Writers exclude each other with a spinlock and bump a sequence
+ * number before and after changing the data, so it is odd while a
+ * write is in progress. Readers take no lock at all: they note the
+ * sequence number, copy the data, and start over if the number has
+ * changed meanwhile (or was odd). So readers never delay writers or
+ * each other, and never bounce a lock's cache line around; the price
+ * is that a reader may have to retry, and must not act on what it
+ * read before seqlock_read_retry says it is consistent.
+ *
+ * Usage:
+ *
+ *	do {
+ *		seq = seqlock_read_begin(&sl);
+ *		copy = data;
+ *	} while (seqlock_read_retry(&sl, seq));
+ *
+ *	seqlock_write_begin(&sl);
+ *	data = newdata;
+ *	seqlock_write_end(&sl);
+ *
+ * As writers hold a spinlock, they may run in interrupt handlers, and
+ * readers may run anywhere. A reader must not be the writer.
+ */
+
+#include <spinlock.h>
+#include <membar.h>
+
+/* Inlining support - for making sure an out-of-line copy gets built */
+#ifndef SEQLOCK_INLINE
+#define SEQLOCK_INLINE INLINE
+#endif
+
+struct seqlock {
+	volatile unsigned sl_seq;	/* Odd while being written */
+	struct spinlock sl_lock;	/* Between writers */
+};
+
+void seqlock_init(struct seqlock *sl);
+void seqlock_cleanup(struct seqlock *sl);
+
+SEQLOCK_INLINE unsigned seqlock_read_begin(struct seqlock *sl);
+SEQLOCK_INLINE bool seqlock_read_retry(struct seqlock *sl, unsigned seq);
+SEQLOCK_INLINE void seqlock_write_begin(struct seqlock *sl);
+SEQLOCK_INLINE void seqlock_write_end(struct seqlock *sl);
+
+////////////////////////////////////////////////////////////
+
+SEQLOCK_INLINE
+unsigned
+seqlock_read_begin(struct seqlock *sl)
+{
+	unsigned seq;
+
+	while ((seq = sl->sl_seq) & 1) {
+		/* wait for the writer */
+	}
+	membar_load_load();
+	return seq;
+}
+
+SEQLOCK_INLINE
+bool
+seqlock_read_retry(struct seqlock *sl, unsigned seq)
+{
+	membar_load_load();
+	return sl->sl_seq != seq;
+}
+
+SEQLOCK_INLINE
+void
+seqlock_write_begin(struct seqlock *sl)
+{
+	spinlock_acquire(&sl->sl_lock);
+	sl->sl_seq++;
+	membar_store_store();
+}
+
+SEQLOCK_INLINE
+void
+seqlock_write_end(struct seqlock *sl)
+{
+	membar_store_store();
+	sl->sl_seq++;
+	spinlock_release(&sl->sl_lock);
+}
+
+
+#endif /* _SEQLOCK_H_ */
@@ -48,6 +48,56 @@
  */
 #include <kern/sfs.h>
 
+struct lock;
+struct cv;
+struct thread;
+struct sfs_jscratch;
+struct sfs_bufcache;
+
+/*
+ * Locking. There is no filesystem-wide lock; independent files can
+ * be read and written at the same time. From outermost to innermost:
+ *
+ *    vfs_biglock       still held by VFS around mount and unmount and
+ *                      while it picks the vnode a name lookup starts
+ *                      from, but not during the lookup (see vfs/)
+ *    journal handle    sfs_jbegin/sfs_jend around each operation that
+ *                      changes metadata, on journaled volumes (see
+ *                      sfs_journal.c); commits wait for all of them
+ *    sv_lock           one vnode: sv_i, sv_dirty, read-ahead state and
+ *                      the contents of the file; when two are needed
+ *                      the directory's is taken before the file's
+ *    sfs_vnlock        the table of loaded vnodes
+ *    sfs_freemaplock   the freemap and the superblock
+ *    buffer cache lock one per volume (private to sfs_buf.c)
+ *
+ * A lock may only be acquired while holding locks that come before
+ * it in the list. sfs_reclaim takes sv_lock and then sfs_vnlock, so
+ * nothing may drop a reference to a vnode while holding sfs_vnlock.
+ *
+ * The one exception is a page fault during uiomove in sfs_io, which
+ * may page in from an executable (another sv_lock) while the file's
+ * sv_lock is held. Reading a program's own image into pages of it
+ * that haven't been loaded yet would therefore deadlock. The other
+ * is destroying an idle vnode (see sfs_inode.c), which nobody else
+ * can hold the sv_lock of.
+ */
+
+struct sfs_dirhash;	/* Opaque; see sfs_dir.c */
+struct sfs_buf;		/* Opaque; see sfs_buf.c */
+
+/*
+ * Most file blocks a vnode holds in the buffer cache without having
+ * allocated disk blocks for them (delayed allocation).
+ */
+#define SFS_DELAY_MAX 16
+
+/*
+ * Number of indirect block entries a vnode keeps a copy of; must
+ * divide SFS_DBPERIDB of the smallest block size.
+ */
+#define SFS_BMAP_CACHE 32
+
 /*
  * In-memory inode
  */
@@ -56,25 +106,111 @@ struct sfs_vnode {
 	struct sfs_dinode sv_i;		/* copy of on-disk inode */
 	uint32_t sv_ino;                /* inode number */
 	bool sv_dirty;                  /* true if sv_i modified */
+	struct sfs_vnode *sv_hashnext;  /* chain in sfs_vnhash */
+	bool sv_idle;                   /* on the idle list (no users) */
+	struct sfs_vnode *sv_idlenext;  /* idle list, toward the tail */
+	struct sfs_vnode *sv_idleprev;  /* idle list, toward the head */
+	unsigned sv_vnindex;            /* our slot in sfs_vnodes */
+	struct lock *sv_lock;           /* protects the vnode and the file */
+
+	/* Sequential read-ahead state (see sfs_io.c) */
+	uint32_t sv_ra_next;            /* file block expected next if sequential */
+	uint32_t sv_ra_window;          /* current read-ahead window, in blocks */
+	uint32_t sv_ra_start;           /* first file block last prefetched */
+	uint32_t sv_ra_count;           /* number of blocks last prefetched */
+
+	/* Name index for large directories, or NULL (see sfs_dir.c) */
+	struct sfs_dirhash *sv_dirhash;
+
+	/* Recently used indirect block entries (see sfs_bmap.c) */
+	uint32_t sv_bmc_base;           /* indirect entry of sv_bmc_blocks[0] */
+	uint32_t sv_bmc_count;          /* entries cached, 0 if none */
+	daddr_t sv_bmc_blocks[SFS_BMAP_CACHE];
+
+	/* Written file blocks with no disk block yet (see sfs_io.c) */
+	unsigned sv_ndelayed;
+	uint32_t sv_delayblock[SFS_DELAY_MAX];   /* file block numbers */
+	struct sfs_buf *sv_delaybuf[SFS_DELAY_MAX]; /* their data */
 };
 
+/*
+ * Largest read-ahead window, in blocks.
+ */
+#define SFS_RA_MAXBLOCKS 16
+
+/*
+ * Most blocks one VOP_PREFETCH hint brings in.
+ */
+#define SFS_PREFETCH_MAXBLOCKS (4 * SFS_RA_MAXBLOCKS)
+
+/*
+ * Number of chains in the per-volume table of loaded vnodes.
+ */
+#define SFS_VNHASH 64
+
+/*
+ * Default for the most unused vnodes kept loaded per volume.
+ */
+#define SFS_IDLE_DEFAULT 128
+
 /*
  * In-memory info for a whole fs volume
  */
 struct sfs_fs {
 	struct fs sfs_absfs;            /* abstract filesystem structure */
 	struct sfs_superblock sfs_sb;	/* copy of on-disk superblock */
+	uint32_t sfs_blocksize;         /* bytes per block (from sfs_sb) */
 	bool sfs_superdirty;            /* true if superblock modified */
 	struct device *sfs_device;      /* device mounted on */
+	struct lock *sfs_vnlock;        /* protects sfs_vnodes through sfs_nidle */
 	struct vnodearray *sfs_vnodes;  /* vnodes loaded into memory */
+	struct sfs_vnode *sfs_vnhash[SFS_VNHASH]; /* same, by inode number */
+	struct sfs_vnode *sfs_idlehead; /* unused vnodes, most recent first */
+	struct sfs_vnode *sfs_idletail; /* least recently used one */
+	unsigned sfs_nidle;             /* how many */
+	struct lock *sfs_freemaplock;   /* protects freemap and superblock */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	bool sfs_freemapdirty;          /* true if freemap modified */
+
+	/* Metadata journal; only used if sb_journalblocks != 0 */
+	struct lock *sfs_jlock;         /* protects the fields below */
+	struct cv *sfs_jcv;             /* signalled when they change */
+	unsigned sfs_jactive;           /* journal handles open */
+	bool sfs_jwant;                 /* a commit waits for them to close */
+	struct thread *sfs_jcommitter;  /* thread committing, or NULL */
+	uint32_t sfs_jseq;              /* sequence number of next commit */
+	time_t sfs_jlastcommit;         /* when the last commit finished */
+	unsigned sfs_jmetadirty;        /* dirty metadata buffers (under the
+					   volume's buffer cache lock) */
+	struct sfs_jscratch *sfs_jscratch; /* commit buffers (sfs_journal.c) */
+
+	struct sfs_bufcache *sfs_bufcache; /* block buffers (sfs_buf.c) */
 };
 
+/* Block size of a volume, and the number of entries in an indirect block */
+#define SFS_FS_BLOCKSIZE(sfs)  ((sfs)->sfs_blocksize)
+#define SFS_FS_DBPERIDB(sfs)   SFS_DBPERIDB(SFS_FS_BLOCKSIZE(sfs))
+
 /*
  * Function for mounting a sfs (calls vfs_mount)
  */
 int sfs_mount(const char *device);
 
+/*
+ * Print buffer cache statistics (for the kernel menu), or add them to
+ * a kstat snapshot
+ */
+struct kstat;
+void sfs_buf_printstats(void);
+void sfs_buf_kstat(struct kstat *ks);
+
+/*
+ * Set the most unused vnodes kept per volume, and print statistics
+ * about them (for the kernel menu)
+ */
+void sfs_vncache_setmax(unsigned max);
+void sfs_vncache_printstats(void);
+void sfs_vncache_kstat(struct kstat *ks);
+
 
 #endif /* _SFS_H_ */
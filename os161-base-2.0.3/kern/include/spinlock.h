@@ -37,6 +37,8 @@
 
 #include <cdefs.h>
 #include <hangman.h>
+#include <lockprof.h>
+#include "opt-ticketlock.h"
 
 /* Inlining support - for making sure an out-of-line copy gets built */
 #ifndef SPINLOCK_INLINE
@@ -54,39 +56,74 @@
  * This structure is made public so spinlocks do not have to be
  * malloc'd; however, code that uses spinlocks should not look inside
  * the structure directly but always use the spinlock API functions.
+ *
+ * A spinlock is either a test-and-set lock or a ticket lock; which
+ * one is fixed when it is initialized and recorded in the lock word
+ * (see spinlock.c). Ticket locks are granted in arrival order, and
+ * waiters back off in proportion to how many are ahead of them, so
+ * under contention they are fair and poll the lock word less.
+ * Test-and-set locks are a little cheaper when uncontended.
  */
 struct spinlock {
 	volatile spinlock_data_t splk_lock; /* Memory word where we spin. */
 	struct cpu *splk_holder;	    /* CPU holding this lock. */
 	HANGMAN_LOCKABLE(splk_hangman);     /* Deadlock detector hook. */
+	LOCKPROF_LOCKABLE(splk_prof);       /* Contention profiler hook. */
 };
 
+/*
+ * Lock word of a fresh spinlock of the kernel-wide kind: ticket locks
+ * with "options ticketlock", test-and-set locks otherwise.
+ */
+#define SPINLOCK_TICKET		0x80000000	/* Lock word flag */
+#if OPT_TICKETLOCK
+#define SPINLOCK_WORD_INITIALIZER	SPINLOCK_TICKET
+#else
+#define SPINLOCK_WORD_INITIALIZER	SPINLOCK_DATA_INITIALIZER
+#endif
+
 /*
  * Initializer for cases where a spinlock needs to be static or global.
  */
-#ifdef OPT_HANGMAN
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL, \
+#if OPT_HANGMAN && OPT_LOCKPROF
+#define SPINLOCK_INITIALIZER	{ SPINLOCK_WORD_INITIALIZER, NULL, \
+				  HANGMAN_LOCKABLE_INITIALIZER, \
+				  LOCKPROF_LOCKABLE_INITIALIZER }
+#elif OPT_HANGMAN
+#define SPINLOCK_INITIALIZER	{ SPINLOCK_WORD_INITIALIZER, NULL, \
 				  HANGMAN_LOCKABLE_INITIALIZER }
+#elif OPT_LOCKPROF
+#define SPINLOCK_INITIALIZER	{ SPINLOCK_WORD_INITIALIZER, NULL, \
+				  LOCKPROF_LOCKABLE_INITIALIZER }
 #else
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#define SPINLOCK_INITIALIZER	{ SPINLOCK_WORD_INITIALIZER, NULL }
 #endif
 
 /*
  * Spinlock functions.
  *
- * init		Initialize the contents of a spinlock.
+ * init		Initialize the contents of a spinlock, of the kernel-wide
+ *		kind.
+ * init_ticket	Same, but always a ticket lock.
+ * init_tas	Same, but always a test-and-set lock.
  * cleanup	Opposite of init. Lock must be unlocked.
  *
  * acquire	Get the lock, spinning as necessary. Also disables interrupts.
+ * acquire_contended
+ *		Same, and return whether the lock was held by someone
+ *		else when we got there.
  * release	Release the lock. May re-enable interrupts.
  *
  * do_i_hold	Check if the current CPU holds the lock.
  */
 
 void spinlock_init(struct spinlock *lk);
+void spinlock_init_ticket(struct spinlock *lk);
+void spinlock_init_tas(struct spinlock *lk);
 void spinlock_cleanup(struct spinlock *lk);
 
 void spinlock_acquire(struct spinlock *lk);
+bool spinlock_acquire_contended(struct spinlock *lk);
 void spinlock_release(struct spinlock *lk);
 
 bool spinlock_do_i_hold(struct spinlock *lk);
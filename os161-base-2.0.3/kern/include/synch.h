@@ -49,6 +49,10 @@ struct semaphore {
 	struct wchan *sem_wchan;
 	struct spinlock sem_lock;
         volatile unsigned sem_count;
+#if OPT_SHELL
+        volatile unsigned sem_nwaiters; /* threads in P's slow path */
+        volatile unsigned sem_vinflight; /* V calls not yet done with it */
+#endif
 };
 
 struct semaphore *sem_create(const char *name, unsigned initial_count);
@@ -59,6 +63,13 @@ void sem_destroy(struct semaphore *);
  *     P (proberen): decrement count. If the count is 0, block until
  *                   the count is 1 again before decrementing.
  *     V (verhogen): increment count.
+ *
+ * With options shell, sem_count is updated with compare-and-swap,
+ * so P on a positive count and V with nobody waiting don't take
+ * sem_lock at all. Only threads that have to sleep (counted in
+ * sem_nwaiters) use sem_lock and the wchan. sem_destroy waits for
+ * V calls that have raised the count but may still be waking a
+ * sleeper (counted in sem_vinflight).
  */
 void P(struct semaphore *);
 void V(struct semaphore *);
@@ -76,11 +87,22 @@ void V(struct semaphore *);
 struct lock {
         char *lk_name;
         HANGMAN_LOCKABLE(lk_hangman);   /* Deadlock detector hook. */
+        LOCKPROF_LOCKABLE(lk_prof);     /* Contention profiler hook. */
 
 #if OPT_SHELL
         struct wchan *lk_wchan;
         struct spinlock lk_lock;
         volatile struct thread *lk_owner;     /* pointer to the thread who owns the lock */
+
+        /* CONTENTION COUNTERS (lk_lock) */
+        unsigned lk_contended;          /* acquires that found the lock held */
+        unsigned lk_spun;               /* ... and got it by spinning */
+        unsigned lk_slept;              /* ... and had to sleep */
+
+        /* PRIORITY INHERITANCE (pi_lock in synch.c) */
+        struct thread *lk_piwaiters;    /* sleepers lending their nice */
+        struct thread *lk_piowner;      /* who they lend it to */
+        struct lock *lk_pinext;         /* next on lk_piowner->t_pilocks */
 #endif
 };
 
@@ -102,6 +124,26 @@ void lock_acquire(struct lock *);
 void lock_release(struct lock *);
 bool lock_do_i_hold(struct lock *);
 
+#if OPT_SHELL
+/*
+ * Locks are adaptive: lock_acquire spins, up to lock_spinlimit polls,
+ * while the owner is running on another CPU, as it will probably let
+ * go sooner than two context switches would take, and sleeps if the
+ * owner is not running or the limit is reached.
+ *
+ *    lock_tryacquire - Get the lock if nobody holds it, without waiting;
+ *                   return true if we got it. For taking a lock out of
+ *                   the usual order, where waiting could deadlock.
+ *
+ *    lock_printstats - Print the contention counters of all locks
+ *                   together, to tune lock_spinlimit by.
+ */
+#define LOCK_SPINLIMIT 1000
+extern unsigned lock_spinlimit;
+bool lock_tryacquire(struct lock *);
+void lock_printstats(void);
+#endif
+
 
 /*
  * Condition variable.
@@ -147,4 +189,48 @@ void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
 
+/*
+ * Reader-writer lock.
+ *
+ * Any number of threads may hold the lock for reading at once, or
+ * one thread for writing. Writers are preferred: once a writer is
+ * waiting, new readers wait behind it. So that readers don't starve
+ * in turn, when a writer releases the lock the readers waiting at
+ * that point go first (rw_readpass counts the ones yet to come in),
+ * and only then the next writer.
+ *
+ * Writers are tracked by the deadlock detector like sleep locks;
+ * readers are not, as it only understands locks with one holder.
+ *
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading.
+ *    rwlock_release_read  - Release it after reading.
+ *    rwlock_acquire_write - Get the lock for writing.
+ *    rwlock_release_write - Release it after writing.
+ *    rwlock_do_i_write    - Return true if the current thread holds
+ *                           the lock for writing.
+ */
+struct rwlock {
+	char *rw_name;
+	HANGMAN_LOCKABLE(rw_hangman);	/* Deadlock detector hook. */
+	struct spinlock rw_lock;	/* Protects the rest */
+	struct wchan *rw_readwchan;	/* Readers wait here */
+	struct wchan *rw_writewchan;	/* Writers wait here */
+	struct thread *rw_writer;	/* Writing now, or NULL */
+	unsigned rw_readers;		/* Reading now */
+	unsigned rw_readwaiting;	/* Readers waiting */
+	unsigned rw_writewaiting;	/* Writers waiting */
+	unsigned rw_readpass;		/* Readers let in ahead of writers */
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+bool rwlock_do_i_write(struct rwlock *);
+
+
 #endif /* _SYNCH_H_ */
@@ -33,6 +33,7 @@
 
 #include <cdefs.h> /* for __DEAD */
 struct trapframe; /* from <machine/trapframe.h> */
+struct kstat; /* from <kstat.h> */
 
 /*
  * The system call dispatcher.
@@ -40,6 +41,15 @@ struct trapframe; /* from <machine/trapframe.h> */
 
 void syscall(struct trapframe *tf);
 
+/* Print how often each call was made and how long it took (for the menu). */
+void syscall_printstats(void);
+void syscall_kstat(struct kstat *ks);
+
+/* Trace calls of process PID (0 for all), stop, and print the trace. */
+int syscall_trace_start(pid_t pid);
+void syscall_trace_stop(void);
+void syscall_trace_print(void);
+
 /*
  * Support functions.
  */
@@ -58,5 +68,7 @@ __DEAD void enter_new_process(int argc, userptr_t argv, userptr_t env,
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_nanosleep(userptr_t user_req, userptr_t user_rem);
+int sys_clock_gettime(int clockid, userptr_t user_ts);
 
 #endif /* _SYSCALL_H_ */
@@ -19,9 +19,14 @@
 
 #include <types.h>
 #include <lib.h>
+#include <spinlock.h>
 #include <mips/trapframe.h>
+#include <workqueue.h>
 #include "opt-shell.h"
 
+struct proc;
+struct iovec;
+
 /**
  * @brief struct defining a pointer to a specific vnode.
  *        Used to build an array of pointers to vnodes (i.e. files) opened for
@@ -31,10 +36,181 @@ struct openfile {
     struct vnode *vn;           /* Pointer to the vnode storing the file                                                */
     off_t offset;               /* Define the current offset for the file                                               */
     int mode_open;              /* Define the opening mode for the current file (i.e., read-only, write-only, etc...)   */
-    unsigned int count_refs;    /* Count the number of processes which have currently opened this file                  */
-    struct lock *lock;          /* Define the lock for this open file                                                   */
+    bool direct;                /* Opened with O_DIRECT: reads and writes bypass the file system's buffer cache        */
+    bool append;                /* Opened with O_APPEND on a seekable file: writes go at its end (see appendlog.h)      */
+    int advice;                 /* Access pattern set by posix_fadvise(): NORMAL, SEQUENTIAL or RANDOM (POSIX_FADV_*)   */
+    char *path;                 /* Absolute name it was opened by, for checkpoint() (seekable files only, else NULL)  */
+    unsigned int count_refs;    /* Count the file table slots, and the system calls in progress, which refer to this file */
+    struct spinlock ref_lock;   /* Protects count_refs, so that it can change while the file lock is held during I/O    */
+    struct lock *lock;          /* Define the lock for this open file (skipped while it is unshared, see fd_acquire_io()) */
+    struct openfile *next_free; /* Next free entry of the system file table (meaningful only while the entry is unused)  */
+    struct work close_work;     /* Closes the vnode in a worker thread once the last reference is gone                  */
 };
 
+/**
+ * @brief Size of the system file table, i.e. the maximum number of files which can
+ *        be open at the same time in the whole system.
+ */
+#define SYSTEM_OPEN_MAX (10*OPEN_MAX)
+
+/**
+ * @brief Initialize the system file table, threading all its entries on the free list.
+ *        Must be called once during the boot, before any process is created.
+ */
+#if OPT_SHELL
+void openfile_bootstrap(void);
+#endif
+
+/**
+ * @brief Take a free entry from the system file table in constant time. The returned
+ *        entry has no vnode, no references and offset zero; its lock is already created.
+ * 
+ * @param retval free entry of the system file table
+ * @return zero on success, ENFILE if the system file table is full, ENOMEM if the lock
+ *         of the entry could not be created
+ */
+#if OPT_SHELL
+int openfile_alloc(struct openfile **retval);
+#endif
+
+/**
+ * @brief Give back an entry to the free list of the system file table. The vnode of
+ *        the entry must have already been closed and no process may refer to it.
+ * 
+ * @param of entry to release
+ */
+#if OPT_SHELL
+void openfile_release(struct openfile *of);
+#endif
+
+/**
+ * @brief Assign the lowest free file descriptor of the given process to the given
+ *        open file, using the bitmap of the process file table.
+ * 
+ * @param proc process owning the file table
+ * @param of open file to install
+ * @param retval file descriptor assigned
+ * @return zero on success, EMFILE if the process file table is full
+ */
+#if OPT_SHELL
+int fd_alloc(struct proc *proc, struct openfile *of, int *retval);
+#endif
+
+/**
+ * @brief Make the file table of the given process private (copying it if it is shared
+ *        after a fork) and large enough to hold the file descriptor fd. Must be called
+ *        before fd_install() or fd_close() on that descriptor.
+ * 
+ * @param proc process owning the file table
+ * @param fd file descriptor about to be modified
+ * @return zero on success, ENOMEM if the table could not be copied or grown
+ */
+#if OPT_SHELL
+int fdtable_prepare(struct proc *proc, int fd);
+#endif
+
+/**
+ * @brief Install the given open file on a specific (free) file descriptor of the given process.
+ * 
+ * @param proc process owning the file table, already prepared for fd
+ * @param fd file descriptor, which must be currently unused
+ * @param of open file to install
+ */
+#if OPT_SHELL
+void fd_install(struct proc *proc, int fd, struct openfile *of);
+#endif
+
+/**
+ * @brief Detach the file descriptor fd from the given process and drop the reference it
+ *        held on its open file. When the last reference goes away, the vnode is closed and
+ *        the entry goes back to the system file table.
+ * 
+ * @param proc process owning the file table, already prepared for fd
+ * @param fd file descriptor, which must refer to an open file
+ */
+#if OPT_SHELL
+void fd_close(struct proc *proc, int fd);
+#endif
+
+/**
+ * @brief Set or clear the close-on-exec flag (FD_CLOEXEC) of a file descriptor. A
+ *        descriptor starts without it, whether from open(), dup2() or pipe().
+ * 
+ * @param proc process owning the file table, already prepared for fd
+ * @param fd file descriptor, which must refer to an open file
+ * @param on whether the descriptor is to be closed by execv() and spawn()
+ */
+#if OPT_SHELL
+void fd_setcloexec(struct proc *proc, int fd, bool on);
+#endif
+
+/**
+ * @brief Get ready to close the descriptors flagged close-on-exec: if there are any,
+ *        make the file table private, so that fdtable_closeexec() cannot fail. Called
+ *        before the point of no return of an exec, with no other thread in the process.
+ * 
+ * @param proc process about to exec
+ * @return zero on success, ENOMEM if the table could not be copied
+ */
+#if OPT_SHELL
+int fdtable_prepare_exec(struct proc *proc);
+#endif
+
+/**
+ * @brief Close all the descriptors flagged close-on-exec, in one pass over the bitmap.
+ * 
+ * @param proc process whose new image is loaded, prepared by fdtable_prepare_exec()
+ */
+#if OPT_SHELL
+void fdtable_closeexec(struct proc *proc);
+#endif
+
+/**
+ * @brief Look up a file descriptor of the given process. The caller must hold p_fdlock
+ *        of the process, or be the only one who can reach it (e.g. it is being created).
+ * 
+ * @param proc process owning the file table
+ * @param fd file descriptor, in the range [0, OPEN_MAX)
+ * @return the open file, or NULL if fd is not in use
+ */
+#if OPT_SHELL
+struct openfile *fd_get(struct proc *proc, int fd);
+#endif
+
+/**
+ * @brief Look up a file descriptor of the given process and take a reference to its open
+ *        file, so that it stays valid even if another thread closes the descriptor.
+ *        Every successful call must be paired with fd_release().
+ * 
+ * @param proc process owning the file table
+ * @param fd file descriptor (any value; out of range means not in use)
+ * @return the open file, or NULL if fd is not in use
+ */
+#if OPT_SHELL
+struct openfile *fd_acquire(struct proc *proc, int fd);
+void fd_release(struct openfile *of);
+#endif
+
+/**
+ * @brief Let the child process share the file table of the parent (copy-on-write).
+ * 
+ * @param parent process whose table is shared
+ * @param child newly created process, which has no file table yet
+ */
+#if OPT_SHELL
+void fdtable_share(struct proc *parent, struct proc *child);
+#endif
+
+/**
+ * @brief Drop the reference of the given process to its file table. The last process
+ *        to leave closes all the files still open and frees the table.
+ * 
+ * @param proc process being destroyed
+ */
+#if OPT_SHELL
+void fdtable_release(struct proc *proc);
+#endif
+
 
 /**
  * @brief sys_write_SHELL() writes up to buflen bytes to the file specified by fd, 
@@ -166,6 +342,289 @@ int sys_lseek_SHELL(int fd, off_t pos, int whence, int32_t *retval_low32, int32_
 int sys_dup2_SHELL(int oldfd, int newfd, int32_t *retval);
 #endif
 
+/**
+ * @brief Gets or sets the FD_CLOEXEC flag of fd (F_GETFD, F_SETFD), or gets the mode
+ *        its file was opened with (F_GETFL).
+ * 
+ * @param fd file descriptor
+ * @param cmd operation to perform
+ * @param arg F_SETFD: the new flags
+ * @param retval F_GETFD, F_GETFL: the flags
+ * @return zero on success, an error value on failure 
+ */
+#if OPT_SHELL
+int sys_fcntl_SHELL(int fd, int cmd, int arg, int32_t *retval);
+#endif
+
+/**
+ * @brief Performs the device-specific operation code on the object open as fd (see
+ *        <kern/ioctl.h>), passing it the user pointer data.
+ * 
+ * @param fd file descriptor
+ * @param code operation to perform
+ * @param data operation argument (user pointer)
+ * @return zero on success, an error value on failure 
+ */
+#if OPT_SHELL
+int sys_ioctl_SHELL(int fd, int code, userptr_t data);
+#endif
+
+/**
+ * @brief Close a file descriptor, or clone one onto another, in the file table of the
+ *        given process (which need not be the current one). sys_close_SHELL() and
+ *        sys_dup2_SHELL() use them on curproc, spawn() on the child it creates.
+ * 
+ * @return zero on success, an error value on failure 
+ */
+#if OPT_SHELL
+int file_close(struct proc *proc, int fd);
+int file_dup2(struct proc *proc, int oldfd, int newfd);
+#endif
+
+/**
+ * @brief sys_readv_SHELL() reads from the file specified by fd into the iovcnt buffers 
+ *        described by iov, filling each buffer completely before moving to the next one.
+ *        The whole transfer is performed by a single VOP_READ(), so it is atomic with 
+ *        respect to the seek position of the file, which is advanced by the bytes read.
+ * 
+ * @param fd source file
+ * @param iov user array of iovec structures describing the destination buffers
+ * @param iovcnt number of entries of iov (between 1 and IOV_MAX)
+ * @param retval actual number of bytes read
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_readv_SHELL(int fd, const struct iovec *iov, int iovcnt, int32_t *retval);
+#endif
+
+/**
+ * @brief sys_writev_SHELL() writes to the file specified by fd the data gathered from the 
+ *        iovcnt buffers described by iov, in order. The whole transfer is performed by a 
+ *        single VOP_WRITE(), so it is atomic with respect to the seek position of the file, 
+ *        which is advanced by the bytes written.
+ * 
+ * @param fd destination file
+ * @param iov user array of iovec structures describing the source buffers
+ * @param iovcnt number of entries of iov (between 1 and IOV_MAX)
+ * @param retval actual number of bytes written
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_writev_SHELL(int fd, const struct iovec *iov, int iovcnt, int32_t *retval);
+#endif
+
+/**
+ * @brief sys_pread_SHELL() reads up to buflen bytes from the file specified by fd, starting 
+ *        at the explicit position offset, and stores them in buf. The seek position of the 
+ *        file is neither used nor updated, so the lock of the open file is not taken and 
+ *        concurrent positional reads of a shared file can proceed in parallel.
+ * 
+ * @param fd source file (must be seekable)
+ * @param buf destination buffer
+ * @param buflen number of bytes to be read
+ * @param offset position of the file from which to read
+ * @param retval actual number of bytes read
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_pread_SHELL(int fd, void *buf, size_t buflen, off_t offset, int32_t *retval);
+#endif
+
+/**
+ * @brief sys_pwrite_SHELL() writes up to buflen bytes taken from buf to the file specified 
+ *        by fd, starting at the explicit position offset. The seek position of the file is 
+ *        neither used nor updated, and the lock of the open file is not taken.
+ * 
+ * @param fd destination file (must be seekable)
+ * @param buf source buffer
+ * @param buflen number of bytes to be written
+ * @param offset position of the file at which to write
+ * @param retval actual number of bytes written
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_pwrite_SHELL(int fd, const void *buf, size_t buflen, off_t offset, int32_t *retval);
+#endif
+
+/**
+ * @brief sys_ftruncate_SHELL() sets the size of the file specified by fd to length,
+ *        discarding its data past that point or extending it with zeros.
+ * 
+ * @param fd file to truncate (must be open for writing)
+ * @param length new size of the file
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_ftruncate_SHELL(int fd, off_t length);
+#endif
+
+/**
+ * @brief sys_fpunch_SHELL() deallocates the storage of length bytes of the file specified
+ *        by fd, starting at offset; that range then reads as zeros. The size of the file
+ *        does not change, and nothing past the end of the file is affected.
+ * 
+ * @param fd file to punch a hole in (must be open for writing)
+ * @param offset start of the hole
+ * @param length size of the hole (must be positive)
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_fpunch_SHELL(int fd, off_t offset, off_t length);
+#endif
+
+/**
+ * @brief sys_posix_fadvise_SHELL() tells how the file specified by fd is going to be read.
+ *        POSIX_FADV_NORMAL, POSIX_FADV_SEQUENTIAL and POSIX_FADV_RANDOM are remembered in
+ *        the open file (for the whole file, whatever the range) and size the read-ahead
+ *        of every later read through it; POSIX_FADV_WILLNEED starts reading the range into
+ *        the buffer cache, and POSIX_FADV_DONTNEED makes the cached blocks of the range the
+ *        first to be reused.
+ * 
+ * @param fd file the advice is about
+ * @param offset start of the range
+ * @param length size of the range, or zero for up to the end of the file
+ * @param advice one of the POSIX_FADV_* values
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_posix_fadvise_SHELL(int fd, off_t offset, off_t length, int advice);
+#endif
+
+/**
+ * @brief sys_sendfile_SHELL() copies up to count bytes from the file specified by infd
+ *        to the file specified by outfd without passing them through user space. The
+ *        data is read at *offset if offset is not NULL (and *offset is then advanced),
+ *        otherwise at the seek position of infd; it is written at the seek position of
+ *        outfd. The copy stops early at end of file or after a short read.
+ * 
+ * @param outfd destination file (must be open for writing)
+ * @param infd source file (must be open for reading)
+ * @param offset user pointer to the position to read from, or NULL
+ * @param count maximum number of bytes to copy
+ * @param retval actual number of bytes copied (0 at end of file)
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_sendfile_SHELL(int outfd, int infd, userptr_t offset, size_t count, int32_t *retval);
+#endif
+
+/**
+ * @brief sys_fstat_SHELL() retrieves the status (size, type, inode number...) of the
+ *        file specified by fd.
+ * 
+ * @param fd file to examine
+ * @param statbuf where to store the struct stat (user pointer)
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_fstat_SHELL(int fd, userptr_t statbuf);
+#endif
+
+/**
+ * @brief sys_stat_SHELL() retrieves the status of the file named by pathname, without
+ *        opening it.
+ * 
+ * @param pathname relative or absolute path of the file
+ * @param statbuf where to store the struct stat (user pointer)
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_stat_SHELL(userptr_t pathname, userptr_t statbuf);
+#endif
+
+/**
+ * @brief sys_lstat_SHELL() is like sys_stat_SHELL(), but a symbolic link named by
+ *        pathname is examined itself rather than followed.
+ * 
+ * @param pathname relative or absolute path of the file
+ * @param statbuf where to store the struct stat (user pointer)
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_lstat_SHELL(userptr_t pathname, userptr_t statbuf);
+#endif
+
+/**
+ * @brief sys_getdents_SHELL() reads as many entries of the directory open as fd as fit
+ *        into buf, as packed struct dirent records (see kern/dirent.h), starting at the
+ *        seek position of the directory, which is advanced past them.
+ * 
+ * @param fd directory to read
+ * @param buf destination buffer
+ * @param buflen size of buf
+ * @param retval number of bytes of records put into buf (0 at end of directory)
+ * @return zero on success, EINVAL if buf cannot hold the next entry, an error value in
+ *         case of failure
+ */
+#if OPT_SHELL
+int sys_getdents_SHELL(int fd, userptr_t buf, size_t buflen, int32_t *retval);
+#endif
+
+/**
+ * @brief sys_sem_op_SHELL() does P(-delta) (delta < 0) or V(delta) (delta > 0) on the
+ *        semfs semaphore open as fd, without the data transfer of read() and write().
+ * 
+ * @param fd semaphore (open for reading to P, for writing to V)
+ * @param delta amount to add to the count
+ * @return zero on success, EINVAL if fd is not a semaphore, an error value in case of
+ *         failure
+ */
+#if OPT_SHELL
+int sys_sem_op_SHELL(int fd, int delta);
+#endif
+
+/**
+ * @brief sys_pipe_SHELL() creates a pipe and opens its two ends in the current process:
+ *        filehandles[0] for reading and filehandles[1] for writing.
+ * 
+ * @param filehandles where to store the two file descriptors (user pointer to int[2])
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_pipe_SHELL(userptr_t filehandles);
+#endif
+
+/**
+ * @brief sys_ioring_enter_SHELL() carries out, in order, the read, write, open and close
+ *        requests queued in the submission ring of a user struct ioring, posting the
+ *        result of each in its completion ring, so that many small calls cost one trap.
+ * 
+ * @param ring user pointer to the struct ioring
+ * @param retval number of submissions taken
+ * @return zero on success, EINVAL if the ring is malformed, an error value in case of
+ *         failure
+ */
+#if OPT_SHELL
+int sys_ioring_enter_SHELL(userptr_t ring, int32_t *retval);
+#endif
+
+/**
+ * @brief sys_poll_SHELL() waits until one of the files in the user struct pollfd array
+ *        fds is ready for the events asked for, or timeout milliseconds pass (see
+ *        kern/poll.h).
+ * 
+ * @param fds user array of struct pollfd, whose revents are filled in
+ * @param nfds number of entries of fds
+ * @param timeout milliseconds to wait, 0 not to wait, negative to wait forever
+ * @param retval number of entries with revents set, 0 on timeout
+ * @return zero on success, EINTR if the process is exiting, an error value in case of
+ *         failure
+ */
+#if OPT_SHELL
+int sys_poll_SHELL(userptr_t fds, unsigned nfds, int timeout, int32_t *retval);
+#endif
+
+/**
+ * @brief sys_childfd_SHELL() opens a descriptor that poll() reports readable when a
+ *        child of the calling process has exited (see childfd.h).
+ * 
+ * @param retval file descriptor of the new open file
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_childfd_SHELL(int32_t *retval);
+#endif
+
 
 
 
@@ -212,7 +671,8 @@ int sys_waitpid_SHELL(pid_t pid, int *status, int options, int32_t *retval);
 #endif
 
 /**
- * @brief Cause the current process to exit.
+ * @brief Cause the current process to exit. The other threads of the process, if any,
+ *        leave at their next return to user mode.
  * 
  * @param exitcode reported back to other process(es) via the waitpid() call.
  * @return does not return.
@@ -242,7 +702,8 @@ int sys_fork_SHELL(struct trapframe *ctf, pid_t *retval);
 
 /**
  * @brief Replaces the currently executing program with a newly loaded program image. This occurs 
- *        within one process; the process id is unchanged. 
+ *        within one process; the process id is unchanged. Fails with EBUSY if the process
+ *        has more than one thread.
  * 
  * @param pathname pathname of the program to run 
  * @param argv an array of 0-terminated strings. The array itself should be terminated by a NULL pointer. 
@@ -252,6 +713,313 @@ int sys_fork_SHELL(struct trapframe *ctf, pid_t *retval);
 int sys_execv_SHELL(const char *pathname, char *argv[]);
 #endif
 
+/**
+ * @brief Saves the image of the process to the file pathname (see checkpoint.h): its
+ *        registers, its regions with the pages touched so far, and the files it has
+ *        open by name with their offsets. Fails with EBUSY if the process has more than
+ *        one thread, and with EINVAL if it has shared mappings or segments attached.
+ * 
+ * @param tf trapframe of the process, saved as the registers of the image
+ * @param pathname file to write the image to (created or truncated)
+ * @return zero on success (a process restored from the image sees 1 instead), an error
+ *         value in case of failure
+ */
+#if OPT_SHELL
+int sys_checkpoint_SHELL(struct trapframe *tf, const char *pathname);
+#endif
+
+/**
+ * @brief Replaces the image of the process with the one saved in the file pathname by
+ *        checkpoint(), which then returns 1. The pages are read from the file as they
+ *        are touched, so nothing but the tables is read here. The files of the image
+ *        are reopened on their descriptors; other descriptors stay open. Fails with
+ *        EBUSY if the process has more than one thread, and with ENOEXEC if the file is
+ *        not an image.
+ * 
+ * @param tf trapframe of the process, replaced with the registers of the image
+ * @param pathname file the image was saved to
+ * @param retval return value of checkpoint() in the restored image
+ * @return zero on success, an error value in case of failure (the process is unchanged)
+ */
+#if OPT_SHELL
+int sys_restore_SHELL(struct trapframe *tf, const char *pathname, int32_t *retval);
+#endif
+
+/**
+ * @brief Start the program pathname in a new child process, as fork() followed by execv()
+ *        would, but without ever copying the address space of the caller. The child
+ *        shares the file table of the caller, to which the given file actions are applied
+ *        first (copying it on the first change).
+ * 
+ * @param pathname pathname of the program to run 
+ * @param argv an array of 0-terminated strings, terminated by a NULL pointer
+ * @param actions array of dup2/close actions for the child (may be NULL if nactions is 0)
+ * @param nactions number of entries of actions (at most SPAWN_MAXACTIONS)
+ * @param retval PID of the newly created process
+ * @return zero on success, and error value in case of failure 
+ */
+#if OPT_SHELL
+struct spawn_action;
+int sys_spawn_SHELL(const char *pathname, char *argv[], const struct spawn_action *actions,
+                    int nactions, pid_t *retval);
+#endif
+
+/**
+ * @brief Moves the end of the heap of the current process ("break") by amount bytes,
+ *        which may be negative. Pages are allocated when first touched; shrinking the
+ *        heap releases the memory behind the new break.
+ * 
+ * @param amount number of bytes to grow (or, if negative, shrink) the heap by
+ * @param retval previous break
+ * @return zero on success, ENOMEM if the heap can't grow that much, EINVAL if it would
+ *         shrink below its start
+ */
+#if OPT_SHELL
+int sys_sbrk_SHELL(intptr_t amount, int32_t *retval);
+#endif
+
+/**
+ * @brief Maps length bytes of the file open as fd, starting at offset, into a new
+ *        region of the current process. Pages are read from the file when first
+ *        touched; with MAP_SHARED, stores go back to the file (on msync, munmap or
+ *        exit), with MAP_PRIVATE they stay private to the process. With MAP_ANON
+ *        the pages are zero-filled instead, and MAP_SHARED ones are shared with
+ *        the children forked afterwards.
+ * 
+ * @param addr address hint (ignored: the kernel picks the address)
+ * @param length number of bytes to map (must be positive)
+ * @param prot PROT_READ, PROT_WRITE and/or PROT_EXEC
+ * @param flags exactly one of MAP_SHARED and MAP_PRIVATE, possibly with MAP_ANON
+ * @param fd file to map (must be open for reading; ignored with MAP_ANON)
+ * @param offset offset in the file of the first byte to map (must be page-aligned)
+ * @param retval address of the mapping
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_mmap_SHELL(userptr_t addr, size_t length, int prot, int flags, int fd,
+                   off_t offset, int32_t *retval);
+#endif
+
+/**
+ * @brief Removes the pages from addr to addr+length from the file mappings of the
+ *        current process, writing shared pages back to their file.
+ * 
+ * @param addr start of the range (must be page-aligned)
+ * @param length size of the range (must be positive)
+ * @return zero on success, EINVAL if the range is not valid
+ */
+#if OPT_SHELL
+int sys_munmap_SHELL(userptr_t addr, size_t length);
+#endif
+
+/**
+ * @brief Writes back to their files the pages of the shared file mappings from addr
+ *        to addr+length.
+ * 
+ * @param addr start of the range (must be page-aligned)
+ * @param length size of the range
+ * @param flags MS_ASYNC or MS_SYNC (which also waits for the data to reach the disk),
+ *        possibly with MS_INVALIDATE
+ * @return zero on success, ENOMEM if part of the range is not mapped, an error value
+ *         in case of failure
+ */
+#if OPT_SHELL
+int sys_msync_SHELL(userptr_t addr, size_t length, int flags);
+#endif
+
+/**
+ * @brief Takes advice about how the pages from addr to addr+length will be used.
+ *        MADV_NORMAL, MADV_SEQUENTIAL and MADV_RANDOM are kept in the regions the
+ *        range touches and decide how far a file mapping's file is read ahead on a
+ *        fault; MADV_WILLNEED starts reading the file of file mappings in, and
+ *        MADV_DONTNEED makes the pages of the range the first to be paged out and
+ *        their file blocks the first to leave the buffer cache.
+ * 
+ * @param addr start of the range (must be page-aligned)
+ * @param length size of the range
+ * @param advice one of the MADV_* values
+ * @return zero on success, ENOMEM if part of the range is not mapped, EINVAL if the
+ *         advice or the range is not valid
+ */
+#if OPT_SHELL
+int sys_madvise_SHELL(userptr_t addr, size_t length, int advice);
+#endif
+
+/**
+ * @brief Hands back the ID of the shared memory segment with the given key, which
+ *        any process can attach with shmat. With IPC_CREAT the segment is made if
+ *        there is none, and with IPC_EXCL too there must be none; IPC_PRIVATE always
+ *        makes a new one. Pages are zero-filled when first touched.
+ * 
+ * @param key key of the segment, or IPC_PRIVATE
+ * @param size size of the segment in bytes (at most its size, if it exists)
+ * @param flags IPC_CREAT, possibly with IPC_EXCL, or 0
+ * @param retval ID of the segment
+ * @return zero on success, ENOENT if there is no such segment, EEXIST if there is
+ *         one and IPC_EXCL was given, EINVAL for a bad size or flags, ENOSPC if
+ *         there are too many segments, ENOMEM if it is too big
+ */
+#if OPT_SHELL
+int sys_shmget_SHELL(int key, size_t size, int flags, int32_t *retval);
+#endif
+
+/**
+ * @brief Attaches the shared memory segment id to the current process, which sees
+ *        the same pages as every other process it is attached to. It stays attached
+ *        in children across fork, and until shmdt, exec or exit.
+ * 
+ * @param id ID of the segment, from shmget
+ * @param addr address hint (ignored: the kernel picks the address)
+ * @param flags SHM_RDONLY or 0
+ * @param retval address the segment is attached at
+ * @return zero on success, EINVAL for a bad ID or flags, ENOMEM if there is no room
+ */
+#if OPT_SHELL
+int sys_shmat_SHELL(int id, userptr_t addr, int flags, int32_t *retval);
+#endif
+
+/**
+ * @brief Detaches the shared memory segment attached at addr from the current
+ *        process. The segment goes away when the last process attached to it
+ *        detaches it.
+ * 
+ * @param addr address the segment is attached at, from shmat
+ * @return zero on success, EINVAL if no segment is attached there
+ */
+#if OPT_SHELL
+int sys_shmdt_SHELL(userptr_t addr);
+#endif
+
+/**
+ * @brief Report the resource usage of the current process (RUSAGE_SELF) or of the
+ *        children it has reaped (RUSAGE_CHILDREN).
+ * 
+ * @param who RUSAGE_SELF or RUSAGE_CHILDREN
+ * @param usage struct rusage to fill in (user pointer)
+ * @return zero on success, EINVAL for a bad who, EFAULT for a bad pointer
+ */
+#if OPT_SHELL
+int sys_getrusage_SHELL(int who, userptr_t usage);
+#endif
+
+/**
+ * @brief Start a new thread in the current process, sharing its address space and its
+ *        file table. The thread begins at entry, on the user stack stack, with arg0 and
+ *        arg1 as its first two arguments.
+ * 
+ * @param entry user address where the thread starts
+ * @param arg0 first argument of entry
+ * @param arg1 second argument of entry
+ * @param stack initial stack pointer (8-byte aligned)
+ * @param retval id of the new thread
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys___thread_create_SHELL(userptr_t entry, userptr_t arg0, userptr_t arg1, userptr_t stack,
+                              pid_t *retval);
+#endif
+
+/**
+ * @brief Wait for the thread tid of the current process to exit, and collect the status
+ *        it passed to __thread_exit().
+ * 
+ * @param tid thread to wait for
+ * @param status where to store its exit status (may be NULL)
+ * @return zero on success, ESRCH if there is no such thread, EINVAL if it is the caller
+ *         or is already being joined, EINTR if the process is exiting
+ */
+#if OPT_SHELL
+int sys___thread_join_SHELL(pid_t tid, int *status);
+#endif
+
+/**
+ * @brief Terminate the calling thread. If it is the last thread of the process, the
+ *        process exits with status 0.
+ * 
+ * @param status exit status of the thread, for __thread_join()
+ * @return does not return.
+ */
+#if OPT_SHELL
+void sys___thread_exit_SHELL(int status);
+#endif
+
+/**
+ * @brief Restrict a process to the CPUs in a mask (bit N = cpu N). The calling thread
+ *        moves at once if it has to, the other threads of the process when they next
+ *        enter the kernel.
+ * 
+ * @param pid process id, 0 for the current process
+ * @param mask the CPUs allowed
+ * @return zero on success, ESRCH if there is no such process, EINVAL if the mask
+ *         has no CPU of the system
+ */
+#if OPT_SHELL
+int sys_sched_setaffinity_SHELL(pid_t pid, unsigned mask);
+#endif
+
+/**
+ * @brief Get the CPU mask of a process.
+ * 
+ * @param pid process id, 0 for the current process
+ * @param mask where to store the mask (user pointer)
+ * @return zero on success, ESRCH if there is no such process, EFAULT for a bad pointer
+ */
+#if OPT_SHELL
+int sys_sched_getaffinity_SHELL(pid_t pid, userptr_t mask);
+#endif
+
+/**
+ * @brief Set the nice value of a process: from PRIO_MIN, which runs soonest and longest,
+ *        to PRIO_MAX. The calling thread takes it at once, the other threads of the
+ *        process when they next enter the kernel; children inherit it.
+ * 
+ * @param which PRIO_PROCESS (there are no process groups or users)
+ * @param who process id, 0 for the current process
+ * @param prio the new nice value, clamped to PRIO_MIN..PRIO_MAX
+ * @return zero on success, EINVAL for a bad which, ESRCH if there is no such process
+ */
+#if OPT_SHELL
+int sys_setpriority_SHELL(int which, pid_t who, int prio);
+#endif
+
+/**
+ * @brief Get the nice value of a process.
+ * 
+ * @param which PRIO_PROCESS
+ * @param who process id, 0 for the current process
+ * @param retval the nice value
+ * @return zero on success, EINVAL for a bad which, ESRCH if there is no such process
+ */
+#if OPT_SHELL
+int sys_getpriority_SHELL(int which, pid_t who, int *retval);
+#endif
+
+/**
+ * @brief Sleep on the int at uaddr until another thread of the process wakes it with
+ *        __futex_wake(), provided it still holds val (checked atomically with respect
+ *        to __futex_wake()).
+ * 
+ * @param uaddr user address of the futex word (int-aligned)
+ * @param val value the caller expects the word to hold
+ * @return zero when woken, EAGAIN if the word does not hold val, EINTR if the process
+ *         is exiting, EFAULT or EINVAL for a bad address
+ */
+#if OPT_SHELL
+int sys___futex_wait_SHELL(userptr_t uaddr, int val);
+#endif
+
+/**
+ * @brief Wake up to n threads of the process sleeping on the int at uaddr.
+ * 
+ * @param uaddr user address of the futex word (int-aligned)
+ * @param n most threads to wake (at least one)
+ * @param retval number of threads woken
+ * @return zero on success, EINVAL for a bad address or n
+ */
+#if OPT_SHELL
+int sys___futex_wake_SHELL(userptr_t uaddr, int n, int32_t *retval);
+#endif
+
 #if OPT_SHELL
 /* Setup function for exec. */
 void exec_bootstrap(void);
@@ -44,6 +44,11 @@
 int arraytest(int, char **);
 int arraytest2(int, char **);
 int bitmaptest(int, char **);
+int hashtest(int, char **);
+int radixtest(int, char **);
+int ringtest(int, char **);
+int pqueuetest(int, char **);
+int lztest(int, char **);
 int threadlisttest(int, char **);
 
 /* thread tests */
@@ -54,6 +59,8 @@ int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
 int cvtest2(int, char **);
+int locktest2(int, char **);
+int spinlocktest(int, char **);
 
 /* semaphore unit tests */
 int semu1(int, char **);
@@ -86,6 +93,7 @@ int writestress(int, char **);
 int writestress2(int, char **);
 int longstress(int, char **);
 int createstress(int, char **);
+int multivolstress(int, char **);
 int printfile(int, char **);
 
 /* other tests */
@@ -93,8 +101,22 @@ int kmalloctest(int, char **);
 int kmallocstress(int, char **);
 int kmalloctest3(int, char **);
 int kmalloctest4(int, char **);
+int kmalloctest5(int, char **);
+int kmalloctest6(int, char **);
 int nettest(int, char **);
 
+/* kernel benchmarks */
+int benchthread(int, char **);
+int benchswitch(int, char **);
+int benchlock(int, char **);
+int benchsem(int, char **);
+int benchcv(int, char **);
+int benchkmalloc(int, char **);
+int benchpages(int, char **);
+int benchvfs(int, char **);
+int benchmem(int, char **);
+int benchall(int, char **);
+
 /* Routine for running a user-level program. */
 int runprogram(char *progname);
 
@@ -104,5 +126,10 @@ void menu(char *argstr);
 /* The main function, called from start.S. */
 void kmain(char *bootstring);
 
+/* Print how long each phase of boot took, or add it to a kstat snapshot. */
+struct kstat;
+void boot_printphases(void);
+void boot_kstat(struct kstat *ks);
+
 
 #endif /* _TEST_H_ */
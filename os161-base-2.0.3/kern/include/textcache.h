@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _TEXTCACHE_H_
+#define _TEXTCACHE_H_
+
+/*
+ * Text cache (vm/textcache.c): the pages of read-only segments of
+ * executables, shared by every process running the same program.
+ * vm_textcache_purge and vm_textprefetch, in vm.h, are its interface
+ * to the rest of the kernel.
+ *
+ * Functions:
+ *     textcache_lookup  - the cached frame for page VA of executable VN,
+ *                         or 0.
+ *     textcache_enter   - remember that page VA of VN is in frame PA.
+ *     textcache_reclaim - free up to SWAP_MAXCLUSTER frames only the
+ *                         cache uses. Returns how many.
+ *     page_readin       - read the part of a page of a segment that
+ *                         comes from its file.
+ *
+ * All but page_readin must be called with vm_lock held, and it without.
+ */
+
+struct vnode;
+
+paddr_t textcache_lookup(struct vnode *vn, vaddr_t va);
+void textcache_enter(struct vnode *vn, vaddr_t va, paddr_t pa);
+unsigned textcache_reclaim(void);
+int page_readin(struct vnode *v, vaddr_t va, paddr_t pa,
+		vaddr_t fvaddr, off_t fileoff, size_t filesz);
+
+struct kstat;
+void textcache_printstats(void);
+void textcache_kstat(struct kstat *ks);
+
+#endif /* _TEXTCACHE_H_ */
@@ -39,13 +39,22 @@
 #include <array.h>
 #include <spinlock.h>
 #include <threadlist.h>
+#include "opt-shell.h"
+#include "opt-mlfq.h"
+#include "opt-prof.h"
 
 struct cpu;
+#if OPT_SHELL
+struct uthread;
+#endif
 
 /* get machine-dependent defs */
 #include <machine/thread.h>
 
 
+/* Affinity mask allowing every CPU (MAXCPUS is at most 32) */
+#define THREAD_ANYCPU ((uint32_t)0xffffffff)
+
 /* Size of kernel stacks; must be power of 2 */
 #define STACK_SIZE 4096
 
@@ -83,6 +92,9 @@ struct thread {
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
 	struct proc *t_proc;		/* Process thread belongs to */
+	uint32_t t_affinity;		/* CPUs it may run on, bit N = cpu N */
+	int t_nice;			/* PRIO_MIN..PRIO_MAX, see thread_tick */
+	int t_boost;			/* Nice lent by lock waiters, or PRIO_MAX */
 	HANGMAN_ACTOR(t_hangman);	/* Deadlock detector hook */
 
 	/*
@@ -102,10 +114,51 @@ struct thread {
 	int t_curspl;			/* Current spl*() state */
 	int t_iplhigh_count;		/* # of times IPL has been raised */
 
+	/* Scheduler state; protected by the runqueue lock */
+	unsigned t_ticks;		/* Hardclocks used of the current quantum */
+#if OPT_MLFQ
+	unsigned t_level;		/* Queue level, 0 = highest priority */
+	unsigned t_waits;		/* schedule() calls spent waiting to run */
+#else
+	unsigned t_skips;		/* Turns passed over for its nice value */
+#endif
+
+	/* Scheduler histograms; see thread_schedhist_start */
+	uint64_t t_readyat;		/* When put on a run queue, or 0 */
+	uint64_t t_runat;		/* When last switched in, or 0 */
+
 	/*
 	 * Public fields
 	 */
 
+#if OPT_SHELL
+	struct uthread *t_uthread;	/* join record, for threads made by __thread_create */
+
+	/*
+	 * Priority inheritance (see synch.c), protected by pi_lock:
+	 * the locks it holds that others sleep on, the lock it sleeps
+	 * on itself, and its link among that lock's sleepers.
+	 */
+	struct lock *t_pilocks;
+	struct lock *t_piwait;
+	struct thread *t_pinext;
+
+	/*
+	 * Resource accounting. The fault counters only ever grow and
+	 * are written only by the thread itself; proc_charge_*() adds
+	 * what they gained since the last time to the process, on the
+	 * thread's own cpu, so no lock is needed to count a fault.
+	 */
+	bool t_intr_user;		/* Interrupt came from user mode */
+	unsigned t_faults;		/* vm_fault calls */
+	unsigned t_majfaults;		/* ... that read the page from swap */
+	unsigned t_faults_charged;	/* t_faults already charged */
+	unsigned t_majfaults_charged;	/* t_majfaults already charged */
+#endif
+#if OPT_PROF
+	vaddr_t t_intr_epc;		/* PC the interrupt came in at */
+#endif
+
 	/* add more here as needed */
 };
 
@@ -122,8 +175,14 @@ DEFARRAY(thread, THREADINLINE);
 /* Call once during system startup to allocate data structures. */
 void thread_bootstrap(void);
 
-/* Call late in system startup to get secondary CPUs running. */
+/*
+ * Call late in system startup to get secondary CPUs running.
+ * thread_start_cpus starts them all and returns at once, so that the
+ * rest of boot can go on while they come up; thread_wait_cpus waits
+ * until they all have.
+ */
 void thread_start_cpus(void);
+void thread_wait_cpus(void);
 
 /* Call during panic to stop other threads in their tracks */
 void thread_panic(void);
@@ -164,10 +223,69 @@ void thread_yield(void);
 void schedule(void);
 
 /*
- * Potentially migrate ready threads to other CPUs. Called from the
- * timer interrupt.
+ * Charge a hardclock to the current thread's quantum, and yield if
+ * the quantum is used up or a thread of higher priority is waiting.
+ * The quantum is longer for a negative nice value (t_nice), and a
+ * positive one makes the thread wait longer for its turn. Called
+ * from the timer interrupt.
+ */
+void thread_tick(void);
+
+/*
+ * Priority inheritance. thread_effnice is the nice value thread T is
+ * scheduled by: its own, or the one lent to it by the threads waiting
+ * for the locks it holds (t_boost) if that is lower. thread_boosted
+ * is called when the loan grew, to move T up if it is waiting to run.
+ */
+int thread_effnice(struct thread *t);
+void thread_boosted(struct thread *t);
+
+/*
+ * Potentially migrate ready threads from busier CPUs to this one.
+ * Called from the timer interrupt.
  */
 void thread_consider_migration(void);
 
+/*
+ * CPU affinity. thread_setaffinity restricts thread T to the CPUs
+ * whose bits are set in MASK; it fails with EINVAL if none of them
+ * exists. The new mask applies the next time T is put on a run
+ * queue; if it is on the run queue of a CPU it may no longer use,
+ * it moves right away. If T is the current thread, it moves off the
+ * current CPU, if need be, before returning. New threads inherit
+ * the mask of the thread that forks them.
+ *
+ * thread_cpumask returns the mask of the CPUs in the system.
+ */
+int thread_setaffinity(struct thread *t, uint32_t mask);
+uint32_t thread_getaffinity(struct thread *t);
+uint32_t thread_cpumask(void);
+
+/* Add the length of each cpu's run queue, and whether it's idle, to a kstat snapshot. */
+struct kstat;
+void thread_kstat(struct kstat *ks);
+
+/*
+ * Scheduler histograms, per cpu: how long threads wait on the run
+ * queue from being made runnable until they run, how long they then
+ * run before switching out, and how long the run queue is at each
+ * hardclock. thread_schedhist_start clears them and starts
+ * collecting, thread_schedhist_stop stops, and
+ * thread_schedhist_print prints them. thread_schedhist_sample is the
+ * run queue sample, called from hardclock.
+ */
+void thread_schedhist_start(void);
+void thread_schedhist_stop(void);
+void thread_schedhist_print(void);
+void thread_schedhist_sample(void);
+
+#if OPT_SHELL
+/*
+ * Give back the memory kept for making new threads quickly. Returns
+ * the number of pages freed. Called when kernel memory runs short.
+ */
+unsigned thread_reclaim(void);
+#endif
+
 
 #endif /* _THREAD_H_ */
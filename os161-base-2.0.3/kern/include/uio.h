@@ -78,6 +78,8 @@ struct uio {
 	enum uio_seg      uio_segflg;	/* What kind of pointer we have */
 	enum uio_rw       uio_rw;	/* Whether op is a read or write */
 	struct addrspace *uio_space;	/* Address space for user pointer */
+	bool              uio_direct;	/* Bypass caches (O_DIRECT) */
+	int               uio_advice;	/* Access pattern (POSIX_FADV_*) */
 };
 
 
@@ -95,14 +97,21 @@ struct uio {
  *   (4) set up uio_seg and uio_rw correctly;
  *   (5) if uio_seg is UIO_SYSSPACE, set uio_space to NULL; otherwise,
  *       initialize uio_space to the address space in which the buffer
- *       should be found.
+ *       should be found;
+ *   (6) set uio_direct if the file system should move the data
+ *       straight to or from the device rather than through its
+ *       cache, where it can (files opened with O_DIRECT);
+ *   (7) set uio_advice to the access pattern expected of the caller
+ *       (a POSIX_FADV_* value from <kern/fcntl.h>), which the file
+ *       system may use to size its read-ahead.
  *
  * After calling,
  *   (1) the contents of uio_iov and uio_iovcnt may be altered and
  *       should not be interpreted;
  *   (2) uio_offset will have been incremented by the amount transferred;
  *   (3) uio_resid will have been decremented by the amount transferred;
- *   (4) uio_segflg, uio_rw, and uio_space will be unchanged.
+ *   (4) uio_segflg, uio_rw, uio_space, uio_direct, and uio_advice will
+ *       be unchanged.
  *
  * uiomove() may be called repeatedly on the same uio to transfer
  * additional data until the available buffer space the uio refers to
@@ -115,6 +124,12 @@ struct uio {
  * When uiomove is called, the address space presently in context must
  * be the same as the one recorded in uio_space. This is an important
  * sanity check if I/O has been queued.
+ *
+ * For user-space uios, all the iovecs a call covers are checked and
+ * copied in one pass (copyinv/copyoutv), so readv/writev-style
+ * vectors of many small buffers don't pay for a full copyin or
+ * copyout per segment. If that fails with EFAULT the uio is left
+ * untouched, though some of the data may have been moved.
  */
 int uiomove(void *kbuffer, size_t len, struct uio *uio);
 
@@ -138,5 +153,21 @@ int uiomovezeros(size_t len, struct uio *uio);
 void uio_kinit(struct iovec *, struct uio *,
 	       void *kbuf, size_t len, off_t pos, enum uio_rw rw);
 
+/*
+ * Initialize a uio suitable for I/O straight to or from a user buffer
+ * of the current process. The data is moved by copyin/copyout inside
+ * uiomove, so no intermediate kernel buffer is needed.
+ *
+ * Usage example;
+ *	struct iovec iov;
+ *	struct uio myuio;
+ *
+ *	uio_uinit(&iov, &myuio, ubuf, buflen, offset, UIO_WRITE);
+ *      result = VOP_WRITE(vn, &myuio);
+ *      ...
+ */
+void uio_uinit(struct iovec *, struct uio *,
+	       userptr_t ubuf, size_t len, off_t pos, enum uio_rw rw);
+
 
 #endif /* _UIO_H_ */
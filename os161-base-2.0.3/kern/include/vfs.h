@@ -193,6 +193,30 @@ int vfs_unmountall(void);
 DECLARRAY(vnode, VFSINLINE);
 DEFARRAY(vnode, VFSINLINE);
 
+/*
+ * Name lookup cache (vfscache.c), used by vfs_lookup.
+ *
+ *    vfs_dcache_lookup  - Look up (DIR, NAME). Returns true on a hit, in
+ *                         which case *RESULT and *RET hold what
+ *                         VOP_LOOKUP would have returned. Negative
+ *                         entries give ENOENT.
+ *    vfs_dcache_enter   - Record the result of a lookup (VN is NULL for
+ *                         ENOENT).
+ *    vfs_dcache_invalidate_one - Drop the entry for exactly (DIR, NAME).
+ *    vfs_dcache_invalidate - NAME in DIR was created, removed or renamed.
+ *    vfs_dcache_purgefs - Drop all entries for FS (before unmount).
+ *
+ * Names longer than VFS_DCACHE_NAMELEN are not cached.
+ */
+#define VFS_DCACHE_NAMELEN 63
+
+bool vfs_dcache_lookup(struct vnode *dir, const char *name,
+		       struct vnode **ret, int *result);
+void vfs_dcache_enter(struct vnode *dir, const char *name, struct vnode *vn);
+void vfs_dcache_invalidate_one(struct vnode *dir, const char *name);
+void vfs_dcache_invalidate(struct vnode *dir, const char *name);
+void vfs_dcache_purgefs(struct fs *fs);
+
 /*
  * Global one-big-lock for all filesystem operations.
  * You must remove this for the filesystem assignment.
@@ -55,8 +55,56 @@ int vm_fault(int faulttype, vaddr_t faultaddress);
 vaddr_t alloc_kpages(unsigned npages);
 void free_kpages(vaddr_t addr);
 
+/* Allocate/free kernel memory mapped in kseg2, which need not be contiguous (see kvmalloc) */
+void *vmalloc(size_t size);
+void vfree(void *ptr);
+
+/* Print physical memory statistics (for the kernel menu), or add them to a kstat snapshot */
+struct kstat;
+void vm_printstats(void);
+void vm_kstat(struct kstat *ks);
+
+/* Print the faults and TLB refills of each cpu (for the kernel menu) */
+void vm_printfaults(void);
+
+/* Free pages and largest free block, in pages (for the kernel heap timeline) */
+void vm_freestats(unsigned long *freepages, unsigned long *largest);
+
+/* Publish the time of day in the kernel info page (called by hardclock) */
+struct timespec;
+void vm_kinfo_settime(const struct timespec *now);
+
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown(const struct tlbshootdown *);
 
+/* Drop cached program text and unused mapped pages of a vnode (reclaimed or opened for writing) */
+struct vnode;
+void vm_textcache_purge(struct vnode *vn);
+
+/* Read a read-only segment of an executable into the text cache ahead of time */
+unsigned vm_textprefetch(struct vnode *vn, vaddr_t vaddr, off_t fileoff, size_t filesz);
+
+/* Find or create the shared memory segment KEY (see kern/shm.h), for as_shmat */
+int vm_shmget(int key, size_t size, int flags, int *ret);
+
+/* Pages a user stack may grow to, for address spaces set up from now on (tunable) */
+extern unsigned vm_stackpages;
+
+/*
+ * Swap space (vm/swap.c). Slots are page-sized; up to SWAP_MAXCLUSTER
+ * pages in consecutive slots can be written with one swap_write.
+ */
+#define SWAP_MAXCLUSTER 8
+
+void swap_bootstrap(void);
+bool swap_enabled(void);
+unsigned swap_size(void);
+int swap_alloc(unsigned npages, unsigned *ret);
+void swap_free(unsigned slot);
+int swap_write(unsigned slot, const paddr_t *frames, unsigned npages);
+int swap_read(unsigned slot, paddr_t pa);
+void swap_printstats(void);
+void swap_kstat(struct kstat *ks);
+
 
 #endif /* _VM_H_ */
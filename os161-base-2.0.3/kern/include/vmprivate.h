@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _VMPRIVATE_H_
+#define _VMPRIVATE_H_
+
+struct addrspace;	/* from <addrspace.h> */
+struct region;		/* from <addrspace.h> */
+struct lock;		/* from <synch.h> */
+
+
+/*
+ * Subsystem-private VM defs.
+ *
+ * The page tables, the TLB and the region lists belong to the
+ * machine-dependent VM system (arch/mips/vm/dumbvm.c); the frame
+ * table, the page caches and the other machine-independent parts in
+ * kern/vm work through what it exports here. This file is to be used
+ * only by the VM system.
+ */
+
+
+/*
+ * Page table entries: the physical frame plus these flags. A paged-out
+ * entry holds its swap slot, shifted by PTE_SLOTSHIFT, instead.
+ */
+#define PTE_VALID	0x001		/* entry maps a frame */
+#define PTE_COW		0x002		/* frame is shared; copy before writing */
+#define PTE_WRITE	0x004		/* region is writeable */
+#define PTE_SWAP	0x008		/* paged out; frame bits hold the slot */
+#define PTE_SHARED	0x010		/* frame of a shared file mapping */
+#define PTE_SLOTSHIFT	12
+#define PTE_FRAME	0xfffff000
+
+/* Everything but the TLB refill fast path runs under this lock. */
+extern struct lock *vm_lock;
+
+/* Assert that the caller may sleep. */
+void dumbvm_can_sleep(void);
+
+/* Pages new user stacks may grow to: vm_stackpages, within bounds. */
+size_t stack_maxpages(void);
+
+/* Page table entry for VA in AS, allocating the table if CREATE. */
+uint32_t *pt_lookup(struct addrspace *as, vaddr_t va, bool create);
+
+/*
+ * TLB shootdowns. tlb_shootdown drops the translations for NPAGES
+ * pages from VA in AS here and queues their shootdown on the other
+ * cpus, returning how many; tlb_shootdown_wait waits for that many.
+ * tlb_invalidate does both. kvm_invalidate is the same for pages of
+ * the vmalloc area. All but kvm_invalidate need vm_lock held.
+ */
+unsigned tlb_shootdown(struct addrspace *as, vaddr_t va, unsigned npages);
+void tlb_shootdown_wait(unsigned n);
+void tlb_invalidate(struct addrspace *as, vaddr_t va, unsigned npages);
+void kvm_invalidate(vaddr_t va, unsigned npages);
+
+/* Region list of an address space. */
+struct region *as_findregion(struct addrspace *as, vaddr_t va);
+int as_insertregion(struct addrspace *as, vaddr_t vbase, size_t npages,
+		    int writeable, struct region **ret);
+void as_regionschanged(struct addrspace *as);
+
+/* Memory accounting: commit NPAGES pages, overall or to an address space. */
+bool vm_commit(unsigned long npages);
+void vm_uncommit(unsigned long npages);
+int as_reserve(struct addrspace *as, unsigned long npages);
+void as_unreserve(struct addrspace *as, unsigned long npages);
+
+
+#endif /* _VMPRIVATE_H_ */
@@ -33,6 +33,7 @@
 #include <spinlock.h>
 struct uio;
 struct stat;
+struct pollent;
 
 
 /*
@@ -49,8 +50,8 @@ struct stat;
  * Note: vn_fs may be null if the vnode refers to a device.
  */
 struct vnode {
-	int vn_refcount;                /* Reference count */
-	struct spinlock vn_countlock;   /* Lock for vn_refcount */
+	volatile unsigned vn_refcount;  /* Reference count (atomic) */
+	struct spinlock vn_countlock;   /* Held when dropping the last ref */
 
 	struct fs *vn_fs;               /* Filesystem vnode belongs to */
 
@@ -98,6 +99,14 @@ struct vnode {
  *                      handled in the normal fashion.
  *                      On non-directory objects, return ENOTDIR.
  *
+ *    vop_getdirents  - Like vop_getdirentry, but read as many entries
+ *                      as fit into the uio, as struct dirent records
+ *                      (see kern/dirent.h) put there with
+ *                      vnode_putdirent, and leave uio_offset at the
+ *                      next entry. If not even the first entry fits,
+ *                      return EINVAL. At end of directory nothing is
+ *                      read. On non-directory objects, return ENOTDIR.
+ *
  *    vop_write       - Write data from uio to file at offset specified
  *                      in the uio, updating uio_resid to reflect the
  *                      amount written, and updating uio_offset to match.
@@ -120,13 +129,36 @@ struct vnode {
  *    vop_fsync       - Force any dirty buffers associated with this file
  *                      to stable storage.
  *
- *    vop_mmap        - Map file into memory. If you implement this
- *                      feature, you're responsible for choosing the
- *                      arguments for this operation.
+ *    vop_mmap        - Check that the file can be mapped into memory.
+ *                      The VM system then reads and writes the pages
+ *                      with VOP_READ and VOP_WRITE.
  *
  *    vop_truncate    - Forcibly set size of file to the length passed
  *                      in, discarding any excess blocks.
  *
+ *    vop_punch       - Discard the storage for LEN bytes of the file
+ *                      starting at POS, which then read as zeros. The
+ *                      size of the file does not change.
+ *
+ *    vop_poll        - Return those of the poll EVENTS (see kern/poll.h)
+ *                      that are ready, plus POLLERR and POLLHUP if
+ *                      they apply. Unless PE is NULL, also register it
+ *                      so that the poller is woken when that changes
+ *                      (see poll.h). Objects that never make anyone
+ *                      wait can use vnode_poll_ready.
+ *
+ *    vop_prefetch    - Hint that LEN bytes of the file starting at POS
+ *                      are about to be read, so the file system can
+ *                      start bringing them in. Purely advisory; errors
+ *                      are not reported. Objects with nothing to gain
+ *                      can use vnode_prefetch_none.
+ *
+ *    vop_dontneed    - Hint that LEN bytes of the file starting at POS
+ *                      won't be read again soon, so the file system
+ *                      can reuse whatever it caches of them first.
+ *                      Like vop_prefetch, purely advisory. Objects
+ *                      with no cache can use vnode_dontneed_none.
+ *
  *    vop_namefile    - Compute pathname relative to filesystem root
  *                      of the file and copy to the specified
  *                      uio. Need not work on objects that are not
@@ -187,14 +219,19 @@ struct vnode_ops {
 	int (*vop_read)(struct vnode *file, struct uio *uio);
 	int (*vop_readlink)(struct vnode *link, struct uio *uio);
 	int (*vop_getdirentry)(struct vnode *dir, struct uio *uio);
+	int (*vop_getdirents)(struct vnode *dir, struct uio *uio);
 	int (*vop_write)(struct vnode *file, struct uio *uio);
 	int (*vop_ioctl)(struct vnode *object, int op, userptr_t data);
 	int (*vop_stat)(struct vnode *object, struct stat *statbuf);
 	int (*vop_gettype)(struct vnode *object, mode_t *result);
 	bool (*vop_isseekable)(struct vnode *object);
 	int (*vop_fsync)(struct vnode *object);
-	int (*vop_mmap)(struct vnode *file /* add stuff */);
+	int (*vop_mmap)(struct vnode *file);
 	int (*vop_truncate)(struct vnode *file, off_t len);
+	int (*vop_punch)(struct vnode *file, off_t pos, off_t len);
+	int (*vop_poll)(struct vnode *object, int events, struct pollent *pe);
+	void (*vop_prefetch)(struct vnode *file, off_t pos, off_t len);
+	void (*vop_dontneed)(struct vnode *file, off_t pos, off_t len);
 	int (*vop_namefile)(struct vnode *file, struct uio *uio);
 
 
@@ -231,14 +268,19 @@ struct vnode_ops {
 #define VOP_READ(vn, uio)               (__VOP(vn, read)(vn, uio))
 #define VOP_READLINK(vn, uio)           (__VOP(vn, readlink)(vn, uio))
 #define VOP_GETDIRENTRY(vn, uio)        (__VOP(vn,getdirentry)(vn, uio))
+#define VOP_GETDIRENTS(vn, uio)         (__VOP(vn,getdirents)(vn, uio))
 #define VOP_WRITE(vn, uio)              (__VOP(vn, write)(vn, uio))
 #define VOP_IOCTL(vn, code, buf)        (__VOP(vn, ioctl)(vn,code,buf))
 #define VOP_STAT(vn, ptr) 	        (__VOP(vn, stat)(vn, ptr))
 #define VOP_GETTYPE(vn, result)         (__VOP(vn, gettype)(vn, result))
 #define VOP_ISSEEKABLE(vn)              (__VOP(vn, isseekable)(vn))
 #define VOP_FSYNC(vn)                   (__VOP(vn, fsync)(vn))
-#define VOP_MMAP(vn /*add stuff */)     (__VOP(vn, mmap)(vn /*add stuff */))
+#define VOP_MMAP(vn)                    (__VOP(vn, mmap)(vn))
 #define VOP_TRUNCATE(vn, pos)           (__VOP(vn, truncate)(vn, pos))
+#define VOP_PUNCH(vn, pos, len)         (__VOP(vn, punch)(vn, pos, len))
+#define VOP_POLL(vn, events, pe)        (__VOP(vn, poll)(vn, events, pe))
+#define VOP_PREFETCH(vn, pos, len)      (__VOP(vn, prefetch)(vn, pos, len))
+#define VOP_DONTNEED(vn, pos, len)      (__VOP(vn, dontneed)(vn, pos, len))
 #define VOP_NAMEFILE(vn, uio)           (__VOP(vn, namefile)(vn, uio))
 
 #define VOP_CREAT(vn,nm,excl,mode,res)  (__VOP(vn, creat)(vn,nm,excl,mode,res))
@@ -259,9 +301,21 @@ void vnode_check(struct vnode *, const char *op);
 
 /*
  * Reference count manipulation (handled above filesystem level)
+ *
+ * The count is updated with atomic operations, so taking and dropping
+ * references that aren't the last doesn't lock anything. Dropping
+ * the last reference leaves the count at 1 and passes the reference
+ * to VOP_RECLAIM, which holds vn_countlock while it decides whether
+ * someone got a new reference in the meantime; if so it gives its
+ * own back with vnode_dropref_unless_last and fails with EBUSY.
+ *
+ * vnode_dropref_unless_last drops a reference and returns true,
+ * unless it's the only one, in which case it returns false and
+ * leaves the count alone.
  */
 void vnode_incref(struct vnode *);
 void vnode_decref(struct vnode *);
+bool vnode_dropref_unless_last(struct vnode *);
 
 #define VOP_INCREF(vn) 			vnode_incref(vn)
 #define VOP_DECREF(vn) 			vnode_decref(vn)
@@ -279,6 +333,30 @@ int vnode_init(struct vnode *, const struct vnode_ops *ops,
  */
 void vnode_cleanup(struct vnode *);
 
+/*
+ * Helper for VOP_GETDIRENTS: add the entry NAME, with inode number INO
+ * (or 0) and type TYPE (one of DT_*), to UIO. Returns ENOSPC, having
+ * moved nothing, if the record doesn't fit.
+ */
+int vnode_putdirent(struct uio *uio, uint32_t ino, unsigned type,
+		    const char *name);
+
+/*
+ * VOP_POLL for objects that are always ready for reading and writing,
+ * like regular files and directories.
+ */
+int vnode_poll_ready(struct vnode *vn, int events, struct pollent *pe);
+
+/*
+ * VOP_PREFETCH for objects that don't read ahead.
+ */
+void vnode_prefetch_none(struct vnode *vn, off_t pos, off_t len);
+
+/*
+ * VOP_DONTNEED for objects that cache nothing.
+ */
+void vnode_dontneed_none(struct vnode *vn, off_t pos, off_t len);
+
 /*
  * Common stubs for vnode functions that just fail, in various ways.
  */
@@ -290,6 +368,8 @@ int vopfail_mmap_isdir(struct vnode *vn /* add stuff */);
 int vopfail_mmap_perm(struct vnode *vn /* add stuff */);
 int vopfail_mmap_nosys(struct vnode *vn /* add stuff */);
 int vopfail_truncate_isdir(struct vnode *vn, off_t pos);
+int vopfail_punch_isdir(struct vnode *vn, off_t pos, off_t len);
+int vopfail_punch_nosys(struct vnode *vn, off_t pos, off_t len);
 int vopfail_creat_notdir(struct vnode *vn, const char *name, bool excl,
 			 mode_t mode, struct vnode **result);
 int vopfail_symlink_notdir(struct vnode *vn, const char *contents,
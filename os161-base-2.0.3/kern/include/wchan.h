@@ -36,6 +36,7 @@
 
 
 struct spinlock; /* in spinlock.h */
+struct thread; /* in thread.h */
 struct wchan; /* Opaque */
 
 /*
@@ -76,5 +77,20 @@ void wchan_sleep(struct wchan *wc, struct spinlock *lk);
 void wchan_wakeone(struct wchan *wc, struct spinlock *lk);
 void wchan_wakeall(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Wake up the first thread sleeping on a wait channel, like
+ * wchan_wakeone, and return it, or NULL if nobody was sleeping. The
+ * caller can hand that thread something (such as ownership of a
+ * lock) while still holding LK.
+ */
+struct thread *wchan_wakehead(struct wchan *wc, struct spinlock *lk);
+
+/*
+ * Move all threads sleeping on FROM to the end of TO, without waking
+ * them; they wake up when TO is woken. Both spinlocks must be locked.
+ */
+void wchan_moveall(struct wchan *from, struct spinlock *fromlk,
+		   struct wchan *to, struct spinlock *tolk);
+
 
 #endif /* _WCHAN_H_ */
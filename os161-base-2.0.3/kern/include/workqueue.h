@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _WORKQUEUE_H_
+#define _WORKQUEUE_H_
+
+/*
+ * Work queues: deferring work to a kernel thread.
+ *
+ * Each cpu has a worker thread and a queue of work items for it.
+ * work_schedule puts an item on the current cpu's queue without
+ * taking any lock, so it may be called from an interrupt handler or
+ * holding spinlocks (but not a run queue lock, since it may have to
+ * wake the worker up). The worker then calls the item's function in
+ * thread context, where it may sleep; items on one cpu run one at a
+ * time, in the order they were scheduled.
+ *
+ * Work items are owned by the caller, usually embedded in whatever
+ * the work is to be done on, so scheduling work never fails for lack
+ * of memory. An item must not be scheduled again before its function
+ * has been called; the function may free the item.
+ */
+
+struct work {
+	void (*w_func)(void *);
+	void *w_arg;
+	struct work *w_next;		/* on the queue */
+};
+
+/* Called once at boot, after the other cpus are started. */
+void workqueue_bootstrap(void);
+
+/* Set up W to call FUNC(ARG). */
+void work_init(struct work *w, void (*func)(void *), void *arg);
+
+/* Have the current cpu's worker thread run W soon. */
+void work_schedule(struct work *w);
+
+
+#endif /* _WORKQUEUE_H_ */
@@ -47,8 +47,16 @@
 #define WORD_TYPE       unsigned char
 #define WORD_ALLBITS    (0xff)
 
+/*
+ * Scanning is done 32 bits at a time where the data is suitably
+ * aligned. Only whole-word comparisons against all-zeros and all-ones
+ * are made this way, so byte order does not matter.
+ */
+#define SCAN_BYTES      (sizeof(uint32_t))
+
 struct bitmap {
         unsigned nbits;
+        unsigned hint;          /* where the next search starts */
         WORD_TYPE *v;
 };
 
@@ -72,6 +80,7 @@ bitmap_create(unsigned nbits)
 
         bzero(b->v, words*sizeof(WORD_TYPE));
         b->nbits = nbits;
+        b->hint = 0;
 
         /* Mark any leftover bits at the end in use */
         if (words > nbits / BITS_PER_WORD) {
@@ -95,29 +104,156 @@ bitmap_getdata(struct bitmap *b)
         return b->v;
 }
 
-int
-bitmap_alloc(struct bitmap *b, unsigned *index)
+/*
+ * Index of the lowest set bit in X, which must be nonzero.
+ */
+static
+inline
+unsigned
+bitmap_ffs(WORD_TYPE x)
+{
+        unsigned n = 0;
+
+        KASSERT(x != 0);
+        if ((x & 0x0f) == 0) {
+                n += 4;
+                x >>= 4;
+        }
+        if ((x & 0x03) == 0) {
+                n += 2;
+                x >>= 2;
+        }
+        if ((x & 0x01) == 0) {
+                n += 1;
+        }
+        return n;
+}
+
+/*
+ * Is word IX the start of an aligned 32-bit group equal to FILL
+ * (0 or 0xffffffff)?
+ */
+static
+inline
+bool
+bitmap_wholeword(struct bitmap *b, unsigned ix, unsigned maxix,
+                 uint32_t fill)
+{
+        WORD_TYPE *p = &b->v[ix];
+
+        return ((uintptr_t)p % SCAN_BYTES) == 0 && ix + SCAN_BYTES <= maxix
+                && *(uint32_t *)p == fill;
+}
+
+/*
+ * Index of the first clear bit at or after START, or nbits if there
+ * is none. The padding bits past nbits are always set, so they are
+ * never returned.
+ */
+static
+unsigned
+bitmap_nextclear(struct bitmap *b, unsigned start)
 {
-        unsigned ix;
         unsigned maxix = DIVROUNDUP(b->nbits, BITS_PER_WORD);
-        unsigned offset;
+        unsigned ix = start / BITS_PER_WORD;
+        WORD_TYPE x;
 
-        for (ix=0; ix<maxix; ix++) {
-                if (b->v[ix]!=WORD_ALLBITS) {
-                        for (offset = 0; offset < BITS_PER_WORD; offset++) {
-                                WORD_TYPE mask = ((WORD_TYPE)1) << offset;
-
-                                if ((b->v[ix] & mask)==0) {
-                                        b->v[ix] |= mask;
-                                        *index = (ix*BITS_PER_WORD)+offset;
-                                        KASSERT(*index < b->nbits);
-                                        return 0;
-                                }
-                        }
-                        KASSERT(0);
+        if (start >= b->nbits) {
+                return b->nbits;
+        }
+
+        /* Pretend the bits below START in its word are set */
+        x = b->v[ix] | (WORD_TYPE)((1U << (start % BITS_PER_WORD)) - 1);
+        while (x == WORD_ALLBITS) {
+                ix++;
+                while (bitmap_wholeword(b, ix, maxix, 0xffffffff)) {
+                        ix += SCAN_BYTES;
                 }
+                if (ix >= maxix) {
+                        return b->nbits;
+                }
+                x = b->v[ix];
         }
-        return ENOSPC;
+        return ix * BITS_PER_WORD + bitmap_ffs(~x & WORD_ALLBITS);
+}
+
+/*
+ * Index of the first set bit at or after START, or LIMIT if there is
+ * none before LIMIT (which may not exceed nbits).
+ */
+static
+unsigned
+bitmap_nextset(struct bitmap *b, unsigned start, unsigned limit)
+{
+        unsigned maxix = DIVROUNDUP(limit, BITS_PER_WORD);
+        unsigned ix = start / BITS_PER_WORD;
+        unsigned ret;
+        WORD_TYPE x;
+
+        KASSERT(limit <= b->nbits);
+        if (start >= limit) {
+                return limit;
+        }
+
+        /* Ignore the bits below START in its word */
+        x = b->v[ix] & (WORD_TYPE)~((1U << (start % BITS_PER_WORD)) - 1);
+        while (x == 0) {
+                ix++;
+                while (bitmap_wholeword(b, ix, maxix, 0)) {
+                        ix += SCAN_BYTES;
+                }
+                if (ix >= maxix) {
+                        return limit;
+                }
+                x = b->v[ix];
+        }
+        ret = ix * BITS_PER_WORD + bitmap_ffs(x);
+        return ret < limit ? ret : limit;
+}
+
+int
+bitmap_findrun(struct bitmap *b, unsigned start, unsigned n, unsigned *index)
+{
+        unsigned i, end;
+
+        KASSERT(n > 0);
+
+        i = start;
+        while (1) {
+                i = bitmap_nextclear(b, i);
+                if (i >= b->nbits || n > b->nbits - i) {
+                        return ENOSPC;
+                }
+                end = bitmap_nextset(b, i, i + n);
+                if (end == i + n) {
+                        *index = i;
+                        return 0;
+                }
+                i = end;
+        }
+}
+
+int
+bitmap_alloc_range(struct bitmap *b, unsigned n, unsigned *index)
+{
+        unsigned i, j;
+
+        if (bitmap_findrun(b, b->hint, n, &i) &&
+            bitmap_findrun(b, 0, n, &i)) {
+                return ENOSPC;
+        }
+        for (j=0; j<n; j++) {
+                bitmap_mark(b, i + j);
+        }
+        b->hint = (i + n < b->nbits) ? i + n : 0;
+        *index = i;
+        return 0;
+}
+
+int
+bitmap_alloc(struct bitmap *b, unsigned *index)
+{
+        return bitmap_alloc_range(b, 1, index);
 }
 
 static
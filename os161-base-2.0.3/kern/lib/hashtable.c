@@ -0,0 +1,273 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Intrusive hash table; see hashtable.h.
+ */
+
+#define HASHINLINE
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <hashtable.h>
+
+#define HASHTABLE_MINSIZE	8	/* Chains; a power of 2 */
+#define HASHTABLE_MOVESTEP	4	/* Old chains moved per add or remove */
+
+void
+hashnode_init(struct hashnode *hn, void *self)
+{
+	KASSERT(self != NULL);
+	hn->hn_next = NULL;
+	hn->hn_self = self;
+	hn->hn_hash = 0;
+}
+
+void
+hashnode_cleanup(struct hashnode *hn)
+{
+	KASSERT(hn->hn_next == NULL);
+	hn->hn_self = NULL;
+}
+
+void
+hashtable_init(struct hashtable *ht)
+{
+	ht->ht_chains = NULL;
+	ht->ht_size = 0;
+	ht->ht_old = NULL;
+	ht->ht_oldsize = 0;
+	ht->ht_moved = 0;
+	ht->ht_count = 0;
+}
+
+void
+hashtable_cleanup(struct hashtable *ht)
+{
+	KASSERT(ht->ht_count == 0);
+	kfree(ht->ht_chains);
+	kfree(ht->ht_old);
+	ht->ht_chains = ht->ht_old = NULL;
+	ht->ht_size = ht->ht_oldsize = 0;
+}
+
+/*
+ * The head of the chain for hash value HASH: in the old array if
+ * that chain hasn't been moved yet, otherwise in the new one.
+ */
+static
+struct hashnode **
+hashtable_head(struct hashtable *ht, unsigned hash)
+{
+	unsigned pos;
+
+	if (ht->ht_old != NULL) {
+		pos = hash & (ht->ht_oldsize - 1);
+		if (pos >= ht->ht_moved) {
+			return &ht->ht_old[pos];
+		}
+	}
+	KASSERT(ht->ht_size > 0);
+	return &ht->ht_chains[hash & (ht->ht_size - 1)];
+}
+
+/*
+ * Move up to N chains from the old array to the new one, and free the
+ * old array once it is empty.
+ */
+static
+void
+hashtable_move(struct hashtable *ht, unsigned n)
+{
+	struct hashnode *hn, *next, **head;
+
+	while (ht->ht_old != NULL && n-- > 0) {
+		for (hn = ht->ht_old[ht->ht_moved]; hn != NULL; hn = next) {
+			next = hn->hn_next;
+			head = &ht->ht_chains[hn->hn_hash & (ht->ht_size - 1)];
+			hn->hn_next = *head;
+			*head = hn;
+		}
+		ht->ht_old[ht->ht_moved] = NULL;
+		ht->ht_moved++;
+		if (ht->ht_moved == ht->ht_oldsize) {
+			kfree(ht->ht_old);
+			ht->ht_old = NULL;
+			ht->ht_oldsize = ht->ht_moved = 0;
+		}
+	}
+}
+
+/*
+ * Start moving to an array of NEWSIZE chains, unless a move is still
+ * going on. If there is no memory, stay as we are; the chains just
+ * get longer (or stay short).
+ */
+static
+void
+hashtable_resize(struct hashtable *ht, unsigned newsize)
+{
+	struct hashnode **chains;
+	unsigned i;
+
+	if (ht->ht_old != NULL) {
+		return;
+	}
+	chains = kmalloc(newsize * sizeof(*chains));
+	if (chains == NULL) {
+		return;
+	}
+	for (i=0; i<newsize; i++) {
+		chains[i] = NULL;
+	}
+	if (ht->ht_size > 0) {
+		ht->ht_old = ht->ht_chains;
+		ht->ht_oldsize = ht->ht_size;
+		ht->ht_moved = 0;
+	}
+	ht->ht_chains = chains;
+	ht->ht_size = newsize;
+}
+
+int
+hashtable_add(struct hashtable *ht, struct hashnode *hn, unsigned hash)
+{
+	struct hashnode **head;
+
+	KASSERT(hn->hn_self != NULL);
+	KASSERT(hn->hn_next == NULL);
+
+	if (ht->ht_size == 0) {
+		hashtable_resize(ht, HASHTABLE_MINSIZE);
+		if (ht->ht_size == 0) {
+			return ENOMEM;
+		}
+	}
+	else if (ht->ht_count >= ht->ht_size * 2) {
+		hashtable_resize(ht, ht->ht_size * 2);
+	}
+
+	hn->hn_hash = hash;
+	head = hashtable_head(ht, hash);
+	hn->hn_next = *head;
+	*head = hn;
+	ht->ht_count++;
+
+	hashtable_move(ht, HASHTABLE_MOVESTEP);
+	return 0;
+}
+
+void
+hashtable_remove(struct hashtable *ht, struct hashnode *hn)
+{
+	struct hashnode **pp;
+
+	KASSERT(ht->ht_count > 0);
+	for (pp = hashtable_head(ht, hn->hn_hash); *pp != hn;
+	     pp = &(*pp)->hn_next) {
+		/* If it isn't on the chain, it isn't in the table */
+		KASSERT(*pp != NULL);
+	}
+	*pp = hn->hn_next;
+	hn->hn_next = NULL;
+	ht->ht_count--;
+
+	if (ht->ht_size > HASHTABLE_MINSIZE &&
+	    ht->ht_count < ht->ht_size / 8) {
+		hashtable_resize(ht, ht->ht_size / 2);
+	}
+	hashtable_move(ht, HASHTABLE_MOVESTEP);
+}
+
+void
+hashtable_iterinit(struct hashiter *hi, const struct hashtable *ht)
+{
+	hi->hi_ht = ht;
+	hi->hi_old = ht->ht_old != NULL;
+	hi->hi_pos = hi->hi_old ? ht->ht_moved : 0;
+	hi->hi_next = NULL;
+}
+
+struct hashnode *
+hashtable_iternext(struct hashiter *hi)
+{
+	const struct hashtable *ht = hi->hi_ht;
+	struct hashnode *hn;
+
+	while (hi->hi_next == NULL) {
+		if (hi->hi_old) {
+			if (hi->hi_pos < ht->ht_oldsize) {
+				hi->hi_next = ht->ht_old[hi->hi_pos++];
+			}
+			else {
+				hi->hi_old = false;
+				hi->hi_pos = 0;
+			}
+			continue;
+		}
+		if (hi->hi_pos >= ht->ht_size) {
+			return NULL;
+		}
+		hi->hi_next = ht->ht_chains[hi->hi_pos++];
+	}
+	hn = hi->hi_next;
+	hi->hi_next = hn->hn_next;
+	return hn;
+}
+
+/*
+ * Integer hash (the finalizer of MurmurHash3). The table uses the low
+ * bits, so every bit of VAL has to reach them.
+ */
+unsigned
+hash_uint(unsigned val)
+{
+	val ^= val >> 16;
+	val *= 0x85ebca6bU;
+	val ^= val >> 13;
+	val *= 0xc2b2ae35U;
+	val ^= val >> 16;
+	return val;
+}
+
+/*
+ * String hash (32-bit FNV-1a).
+ */
+unsigned
+hash_string(const char *str)
+{
+	unsigned hash = 2166136261U;
+
+	while (*str != '\0') {
+		hash ^= (unsigned char)*str++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
@@ -36,9 +36,11 @@
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#include <membar.h>
 #include <mainbus.h>
 #include <vfs.h>          // for vfs_sync()
 #include <lamebus/ltrace.h> // for ltrace_stop()
+#include <platform/maxcpus.h>
 
 
 /* Flags word for DEBUG() macro. */
@@ -50,6 +52,53 @@ static struct lock *kprintf_lock;
 /* Lock for polled kprintfs */
 static struct spinlock kprintf_spinlock;
 
+/*
+ * Log rings. Once kprintf_async_bootstrap has run, kprintf formats
+ * into a ring of its own cpu's, with interrupts off but no lock, and
+ * the klog thread copies the rings to the console, so a cpu that
+ * prints doesn't wait for the console. Each record starts with a
+ * struct klog_hdr; the sequence numbers put the records of all the
+ * cpus back in order. kr_head is written only by the ring's cpu,
+ * and kr_tail only by whoever drains, holding kprintf_lock. Both
+ * count bytes from the start and are reduced mod KLOG_RINGSIZE.
+ *
+ * When a message doesn't fit (or the rings are off, or we're
+ * panicking) kprintf prints it synchronously as before. If it can
+ * sleep it drains the rings first, to keep the order.
+ */
+#define KLOG_RINGSIZE	4096	/* Bytes per cpu; a power of 2 */
+
+struct klog_ring {
+	char *kr_buf;			/* KLOG_RINGSIZE bytes, or NULL */
+	volatile unsigned kr_head;	/* Where the next record goes */
+	volatile unsigned kr_tail;	/* The first record not yet printed */
+};
+
+struct klog_hdr {
+	unsigned kh_seq;		/* Global sequence number */
+	unsigned kh_len;		/* Bytes of text that follow */
+};
+
+/* Where __vprintf output goes while a record is being formatted */
+struct klog_out {
+	struct klog_ring *ko_ring;
+	unsigned ko_pos;		/* Next byte */
+	unsigned ko_free;		/* Bytes left in the ring */
+	bool ko_overflow;		/* Ran out of room */
+};
+
+static struct klog_ring klog_rings[MAXCPUS];
+static volatile bool klog_async;	/* Records go to the rings */
+static volatile spinlock_data_t klog_seq;	/* Next sequence number */
+static volatile bool klog_wanted;	/* klog_sem has been V'd */
+static volatile bool klog_pending;	/* A wakeup was put off */
+static struct semaphore *klog_sem;	/* Wakes the klog thread */
+
+/* Statistics */
+static unsigned klog_records;		/* Messages that went to a ring */
+static unsigned klog_fallbacks;		/* ... that didn't fit */
+static unsigned klog_drains;		/* Times the rings were emptied */
+
 
 /*
  * Warning: all this has to work from interrupt handlers and when
@@ -89,6 +138,271 @@ console_send(void *junk, const char *data, size_t len)
 	}
 }
 
+////////////////////////////////////////////////////////////
+// log rings
+
+static
+void
+klog_copyin(struct klog_ring *kr, unsigned pos, const void *data, size_t len)
+{
+	const char *p = data;
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		kr->kr_buf[(pos + i) % KLOG_RINGSIZE] = p[i];
+	}
+}
+
+static
+void
+klog_copyout(struct klog_ring *kr, unsigned pos, void *data, size_t len)
+{
+	char *p = data;
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		p[i] = kr->kr_buf[(pos + i) % KLOG_RINGSIZE];
+	}
+}
+
+/*
+ * Backend for __printf that puts the message in a ring.
+ */
+static
+void
+klog_send(void *vko, const char *data, size_t len)
+{
+	struct klog_out *ko = vko;
+
+	if (ko->ko_overflow || len > ko->ko_free) {
+		ko->ko_overflow = true;
+		return;
+	}
+	klog_copyin(ko->ko_ring, ko->ko_pos, data, len);
+	ko->ko_pos += len;
+	ko->ko_free -= len;
+}
+
+/*
+ * Format a message into the current cpu's ring. Returns false,
+ * having stored nothing, if the rings are off or it doesn't fit.
+ */
+static
+bool
+klog_append(const char *fmt, va_list ap, int *charsret)
+{
+	struct klog_ring *kr;
+	struct klog_out ko;
+	struct klog_hdr kh;
+	unsigned start, used, seq;
+	int spl;
+
+	/* Interrupts off, so we stay on this cpu and own its ring */
+	spl = splhigh();
+	kr = &klog_rings[curcpu->c_number];
+	if (!klog_async || kr->kr_buf == NULL) {
+		splx(spl);
+		return false;
+	}
+
+	start = kr->kr_head;
+	used = start - kr->kr_tail;
+	if (used + sizeof(kh) > KLOG_RINGSIZE) {
+		splx(spl);
+		return false;
+	}
+	ko.ko_ring = kr;
+	ko.ko_pos = start + sizeof(kh);
+	ko.ko_free = KLOG_RINGSIZE - used - sizeof(kh);
+	ko.ko_overflow = false;
+
+	*charsret = __vprintf(klog_send, &ko, fmt, ap);
+	if (ko.ko_overflow) {
+		splx(spl);
+		return false;
+	}
+	if (ko.ko_pos > start + sizeof(kh)) {
+		do {
+			seq = klog_seq;
+		} while (!spinlock_data_cas(&klog_seq, seq, seq + 1));
+		kh.kh_seq = seq;
+		kh.kh_len = ko.ko_pos - start - sizeof(kh);
+		klog_copyin(kr, start, &kh, sizeof(kh));
+		/* The record has to be complete before the drainer sees it */
+		membar_store_store();
+		kr->kr_head = ko.ko_pos;
+		klog_records++;
+	}
+	splx(spl);
+	return true;
+}
+
+/*
+ * Print everything in the rings, oldest first. The caller holds
+ * kprintf_lock, or is panicking.
+ */
+static
+void
+klog_drain(void)
+{
+	struct klog_ring *kr, *best;
+	struct klog_hdr kh, bestkh;
+	unsigned i, tail;
+	char ch;
+
+	for (;;) {
+		best = NULL;
+		bestkh.kh_seq = bestkh.kh_len = 0;
+		for (i=0; i<MAXCPUS; i++) {
+			kr = &klog_rings[i];
+			if (kr->kr_buf == NULL || kr->kr_tail == kr->kr_head) {
+				continue;
+			}
+			/* Read the head before the record it covers */
+			membar_load_load();
+			klog_copyout(kr, kr->kr_tail, &kh, sizeof(kh));
+			if (best == NULL ||
+			    (int)(kh.kh_seq - bestkh.kh_seq) < 0) {
+				best = kr;
+				bestkh = kh;
+			}
+		}
+		if (best == NULL) {
+			break;
+		}
+		tail = best->kr_tail + sizeof(bestkh);
+		for (i=0; i<bestkh.kh_len; i++) {
+			klog_copyout(best, tail + i, &ch, 1);
+			putch(ch);
+		}
+		/* Done reading before the cpu may write over it */
+		membar_any_any();
+		best->kr_tail = tail + bestkh.kh_len;
+	}
+	klog_drains++;
+}
+
+/*
+ * Get the klog thread to drain the rings. It can't be woken while
+ * holding a spinlock (it might be the run queue lock), so then the
+ * next hardclock on any cpu does it, through kprintf_tick.
+ */
+static
+void
+klog_wake(void)
+{
+	if (curcpu->c_spinlocks > 0) {
+		klog_pending = true;
+		return;
+	}
+	if (!klog_wanted) {
+		klog_wanted = true;
+		V(klog_sem);
+	}
+}
+
+void
+kprintf_tick(void)
+{
+	if (klog_pending) {
+		klog_pending = false;
+		klog_wake();
+	}
+}
+
+/*
+ * The klog thread.
+ */
+static
+void
+klog_thread(void *junk1, unsigned long junk2)
+{
+	(void)junk1;
+	(void)junk2;
+
+	for (;;) {
+		P(klog_sem);
+		klog_wanted = false;
+		membar_any_any();
+		lock_acquire(kprintf_lock);
+		klog_drain();
+		lock_release(kprintf_lock);
+	}
+}
+
+/*
+ * Set up the rings and the klog thread, and start using them. Called
+ * once all the cpus are up.
+ */
+void
+kprintf_async_bootstrap(void)
+{
+	uint32_t mask;
+	unsigned i;
+	int result;
+
+	KASSERT(kprintf_lock != NULL);
+	klog_sem = sem_create("klog", 0);
+	if (klog_sem == NULL) {
+		panic("kprintf_async_bootstrap: Out of memory\n");
+	}
+	mask = thread_cpumask();
+	for (i=0; i<MAXCPUS; i++) {
+		if ((mask & ((uint32_t)1 << i)) == 0) {
+			continue;
+		}
+		klog_rings[i].kr_buf = kmalloc(KLOG_RINGSIZE);
+		if (klog_rings[i].kr_buf == NULL) {
+			panic("kprintf_async_bootstrap: Out of memory\n");
+		}
+		klog_rings[i].kr_head = klog_rings[i].kr_tail = 0;
+	}
+	result = thread_fork("klog", NULL, klog_thread, NULL, 0);
+	if (result) {
+		panic("kprintf_async_bootstrap: thread_fork: %s\n",
+		      strerror(result));
+	}
+	klog_async = true;
+}
+
+/*
+ * Turn the rings on or off. Turning them off prints what they hold,
+ * so that the console is up to date when this returns; it may sleep.
+ */
+void
+kprintf_setasync(bool on)
+{
+	if (klog_sem == NULL) {
+		/* Not set up yet (or ever) */
+		return;
+	}
+	klog_async = on;
+	if (!on) {
+		lock_acquire(kprintf_lock);
+		klog_drain();
+		lock_release(kprintf_lock);
+	}
+}
+
+void
+kprintf_printstats(void)
+{
+	unsigned i, pending;
+
+	pending = 0;
+	for (i=0; i<MAXCPUS; i++) {
+		pending += klog_rings[i].kr_head - klog_rings[i].kr_tail;
+	}
+	kprintf("kprintf: %s, %u messages logged, %u printed directly "
+		"for want of room\n",
+		klog_async ? "asynchronous" : "synchronous",
+		klog_records, klog_fallbacks);
+	kprintf("kprintf: %u drains, %u bytes waiting\n",
+		klog_drains, pending);
+}
+
+////////////////////////////////////////////////////////////
+
 /*
  * Printf to the console.
  */
@@ -97,7 +411,18 @@ kprintf(const char *fmt, ...)
 {
 	int chars;
 	va_list ap;
-	bool dolock;
+	bool dolock, done;
+
+	if (klog_async) {
+		va_start(ap, fmt);
+		done = klog_append(fmt, ap, &chars);
+		va_end(ap);
+		if (done) {
+			klog_wake();
+			return chars;
+		}
+		klog_fallbacks++;
+	}
 
 	dolock = kprintf_lock != NULL
 		&& curthread->t_in_interrupt == false
@@ -106,6 +431,8 @@ kprintf(const char *fmt, ...)
 
 	if (dolock) {
 		lock_acquire(kprintf_lock);
+		/* Whatever is already in the rings goes first */
+		klog_drain();
 	}
 	else {
 		spinlock_acquire(&kprintf_spinlock);
@@ -156,8 +483,11 @@ panic(const char *fmt, ...)
 		 * panicking, but we also want the console to be
 		 * printing in polling mode so as not to do context
 		 * switches. So turn interrupts off on this CPU.
+		 * Nothing may go to the log rings from here on,
+		 * as the klog thread won't run again.
 		 */
 		splhigh();
+		klog_async = false;
 	}
 
 	if (evil == 1) {
@@ -170,7 +500,8 @@ panic(const char *fmt, ...)
 	if (evil == 2) {
 		evil = 3;
 
-		/* Print the message. */
+		/* Print what was still queued, then the message. */
+		klog_drain();
 		kprintf("panic: ");
 		va_start(ap, fmt);
 		__vprintf(console_send, NULL, fmt, ap);
@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * LZ77 compression; see lz.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <lz.h>
+
+#define LZ_MAXLIT	0x80			/* longest literal run */
+#define LZ_MAXMATCH	(0x7f + LZ_MINMATCH)	/* longest match */
+#define LZ_MAXDIST	0xffff			/* farthest match */
+
+static
+inline
+uint32_t
+lz_read32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+		((uint32_t)p[2] << 8) | p[3];
+}
+
+static
+inline
+unsigned
+lz_hash(uint32_t v)
+{
+	return (v * 2654435761U) >> (32 - LZ_HASHBITS);
+}
+
+/*
+ * Append the literals [LIT, END) of S to the output at *OP, in runs
+ * of up to LZ_MAXLIT. Returns false if they don't fit.
+ */
+static
+bool
+lz_literals(const unsigned char *s, size_t lit, size_t end,
+	    unsigned char *d, size_t *op, size_t max)
+{
+	size_t run;
+
+	while (lit < end) {
+		run = end - lit;
+		if (run > LZ_MAXLIT) {
+			run = LZ_MAXLIT;
+		}
+		if (*op + 1 + run > max) {
+			return false;
+		}
+		d[(*op)++] = run - 1;
+		memcpy(d + *op, s + lit, run);
+		*op += run;
+		lit += run;
+	}
+	return true;
+}
+
+size_t
+lz_compress(const void *src, size_t len, void *dst, size_t max,
+	    uint16_t *table)
+{
+	const unsigned char *s = src;
+	unsigned char *d = dst;
+	size_t ip, lit, op, cand, m;
+	unsigned h;
+
+	KASSERT(len <= 0xffff);
+
+	/* table entries are positions plus one; 0 is none */
+	bzero(table, LZ_HASHSIZE * sizeof(*table));
+
+	ip = lit = op = 0;
+	while (ip + LZ_MINMATCH <= len) {
+		h = lz_hash(lz_read32(s + ip));
+		cand = table[h];
+		table[h] = ip + 1;
+		if (cand == 0 || ip - (cand - 1) > LZ_MAXDIST ||
+		    lz_read32(s + cand - 1) != lz_read32(s + ip)) {
+			ip++;
+			continue;
+		}
+		cand--;
+
+		/* the match may overlap what it copies */
+		m = LZ_MINMATCH;
+		while (ip + m < len && m < LZ_MAXMATCH &&
+		       s[cand + m] == s[ip + m]) {
+			m++;
+		}
+
+		if (!lz_literals(s, lit, ip, d, &op, max) || op + 3 > max) {
+			return 0;
+		}
+		d[op++] = 0x80 | (m - LZ_MINMATCH);
+		d[op++] = (ip - cand) >> 8;
+		d[op++] = (ip - cand) & 0xff;
+		ip += m;
+		lit = ip;
+	}
+	if (!lz_literals(s, lit, len, d, &op, max)) {
+		return 0;
+	}
+	return op;
+}
+
+size_t
+lz_decompress(const void *src, size_t len, void *dst, size_t max)
+{
+	const unsigned char *s = src;
+	unsigned char *d = dst;
+	size_t ip, op, n, dist;
+	unsigned c;
+
+	ip = op = 0;
+	while (ip < len) {
+		c = s[ip++];
+		if (c < 0x80) {
+			n = c + 1;
+			if (ip + n > len || op + n > max) {
+				return 0;
+			}
+			memcpy(d + op, s + ip, n);
+			ip += n;
+			op += n;
+			continue;
+		}
+		n = (c & 0x7f) + LZ_MINMATCH;
+		if (ip + 2 > len) {
+			return 0;
+		}
+		dist = ((size_t)s[ip] << 8) | s[ip + 1];
+		ip += 2;
+		if (dist == 0 || dist > op || op + n > max) {
+			return 0;
+		}
+		/* byte by byte, as the source may overlap */
+		for (; n > 0; n--, op++) {
+			d[op] = d[op - dist];
+		}
+	}
+	return op;
+}
@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Pairing heap priority queue; see pqueue.h.
+ */
+
+#define PQUEUEINLINE
+
+#include <types.h>
+#include <lib.h>
+#include <pqueue.h>
+
+void
+pqnode_init(struct pqnode *pn, void *self)
+{
+	KASSERT(self != NULL);
+	pn->pn_child = NULL;
+	pn->pn_next = NULL;
+	pn->pn_prev = NULL;
+	pn->pn_key = 0;
+	pn->pn_self = self;
+}
+
+void
+pqnode_cleanup(struct pqnode *pn)
+{
+	KASSERT(pn->pn_prev == NULL);
+	pn->pn_self = NULL;
+}
+
+void
+pqueue_init(struct pqueue *pq)
+{
+	pq->pq_root = NULL;
+	pq->pq_count = 0;
+}
+
+void
+pqueue_cleanup(struct pqueue *pq)
+{
+	KASSERT(pq->pq_root == NULL);
+	KASSERT(pq->pq_count == 0);
+}
+
+/*
+ * Join two trees, either of which may be NULL, by making the root
+ * with the larger key the first child of the other. Both roots must
+ * be detached (no siblings, no parent). Returns the new root.
+ */
+static
+struct pqnode *
+pqueue_meld(struct pqnode *a, struct pqnode *b)
+{
+	struct pqnode *t;
+
+	if (a == NULL) {
+		return b;
+	}
+	if (b == NULL) {
+		return a;
+	}
+	if (b->pn_key < a->pn_key) {
+		t = a;
+		a = b;
+		b = t;
+	}
+	b->pn_prev = a;
+	b->pn_next = a->pn_child;
+	if (a->pn_child != NULL) {
+		a->pn_child->pn_prev = b;
+	}
+	a->pn_child = b;
+	return a;
+}
+
+/*
+ * Combine a list of sibling trees into one: meld them in pairs left
+ * to right, then fold the pairs together right to left. The pairs
+ * are kept on a list in reverse, linked through pn_next, so the
+ * second pass can start from the right without recursing.
+ */
+static
+struct pqnode *
+pqueue_mergepairs(struct pqnode *first)
+{
+	struct pqnode *a, *b, *next, *pairs, *root;
+
+	pairs = NULL;
+	while (first != NULL) {
+		a = first;
+		b = a->pn_next;
+		next = b != NULL ? b->pn_next : NULL;
+		a->pn_next = a->pn_prev = NULL;
+		if (b != NULL) {
+			b->pn_next = b->pn_prev = NULL;
+		}
+		a = pqueue_meld(a, b);
+		a->pn_next = pairs;
+		pairs = a;
+		first = next;
+	}
+
+	root = NULL;
+	while (pairs != NULL) {
+		next = pairs->pn_next;
+		pairs->pn_next = NULL;
+		root = pqueue_meld(root, pairs);
+		pairs = next;
+	}
+	return root;
+}
+
+void
+pqueue_insert(struct pqueue *pq, struct pqnode *pn, uint64_t key)
+{
+	KASSERT(!pqueue_inqueue(pq, pn));
+	KASSERT(pn->pn_child == NULL && pn->pn_next == NULL);
+
+	pn->pn_key = key;
+	pq->pq_root = pqueue_meld(pq->pq_root, pn);
+	pq->pq_count++;
+}
+
+struct pqnode *
+pqueue_removemin(struct pqueue *pq)
+{
+	struct pqnode *pn;
+
+	pn = pq->pq_root;
+	if (pn == NULL) {
+		return NULL;
+	}
+	pq->pq_root = pqueue_mergepairs(pn->pn_child);
+	pn->pn_child = NULL;
+	KASSERT(pq->pq_count > 0);
+	pq->pq_count--;
+	return pn;
+}
+
+void
+pqueue_remove(struct pqueue *pq, struct pqnode *pn)
+{
+	KASSERT(pqueue_inqueue(pq, pn));
+
+	if (pn == pq->pq_root) {
+		pqueue_removemin(pq);
+		return;
+	}
+
+	/* Cut PN, with its subtree, out of its parent's child list */
+	if (pn->pn_prev->pn_child == pn) {
+		pn->pn_prev->pn_child = pn->pn_next;
+	}
+	else {
+		pn->pn_prev->pn_next = pn->pn_next;
+	}
+	if (pn->pn_next != NULL) {
+		pn->pn_next->pn_prev = pn->pn_prev;
+	}
+	pn->pn_next = pn->pn_prev = NULL;
+
+	/* Its children go back in as one tree */
+	pq->pq_root = pqueue_meld(pq->pq_root, pqueue_mergepairs(pn->pn_child));
+	pn->pn_child = NULL;
+	KASSERT(pq->pq_count > 0);
+	pq->pq_count--;
+}
@@ -0,0 +1,481 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Radix tree; see radixtree.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <membar.h>
+#include <radixtree.h>
+
+#define RADIX_MASK	(RADIX_SLOTS - 1)
+#define RADIX_LEVELS	((32 + RADIX_BITS - 1) / RADIX_BITS)
+
+/*
+ * A node. The slots of a node with rn_shift 0 hold items; those of
+ * the others hold nodes with rn_shift RADIX_BITS smaller. Bit I of
+ * rn_tags[T] is set if slot I holds an item with tag T, or a node
+ * with any such item under it.
+ */
+struct radixnode {
+	unsigned rn_shift;		/* Key bits below this level */
+	unsigned rn_count;		/* Slots in use */
+	uint32_t rn_tags[RADIX_NTAGS];
+	void *volatile rn_slots[RADIX_SLOTS];
+};
+
+/* The largest key a tree whose root has SHIFT can hold */
+static
+uint32_t
+radix_maxkey(unsigned shift)
+{
+	if (shift + RADIX_BITS >= 32) {
+		return 0xffffffff;
+	}
+	return ((uint32_t)1 << (shift + RADIX_BITS)) - 1;
+}
+
+static
+unsigned
+radix_index(const struct radixnode *node, uint32_t key)
+{
+	return (key >> node->rn_shift) & RADIX_MASK;
+}
+
+static
+struct radixnode *
+radixnode_create(unsigned shift)
+{
+	struct radixnode *node;
+	unsigned i;
+
+	node = kmalloc(sizeof(*node));
+	if (node == NULL) {
+		return NULL;
+	}
+	node->rn_shift = shift;
+	node->rn_count = 0;
+	for (i=0; i<RADIX_NTAGS; i++) {
+		node->rn_tags[i] = 0;
+	}
+	for (i=0; i<RADIX_SLOTS; i++) {
+		node->rn_slots[i] = NULL;
+	}
+	return node;
+}
+
+/* Free a chain of new nodes, leading to KEY, that was never linked in */
+static
+void
+radixnode_freechain(struct radixnode *node, uint32_t key)
+{
+	struct radixnode *next;
+
+	while (node != NULL) {
+		next = node->rn_shift > 0 ?
+			node->rn_slots[radix_index(node, key)] : NULL;
+		kfree(node);
+		node = next;
+	}
+}
+
+void
+radix_init(struct radixtree *rt)
+{
+	rt->rt_root = NULL;
+	rt->rt_count = 0;
+}
+
+void
+radix_cleanup(struct radixtree *rt)
+{
+	KASSERT(rt->rt_count == 0);
+	KASSERT(rt->rt_root == NULL);
+}
+
+unsigned
+radix_count(const struct radixtree *rt)
+{
+	return rt->rt_count;
+}
+
+int
+radix_insert(struct radixtree *rt, uint32_t key, void *item)
+{
+	struct radixnode *root, *node, *child, *top, *parent;
+	unsigned shift, i;
+	bool fresh;
+
+	KASSERT(item != NULL);
+
+	/* A new root is linked in only once the item is in it */
+	root = rt->rt_root;
+	fresh = root == NULL;
+	if (fresh) {
+		shift = 0;
+		while (key > radix_maxkey(shift)) {
+			shift += RADIX_BITS;
+		}
+		root = radixnode_create(shift);
+		if (root == NULL) {
+			return ENOMEM;
+		}
+	}
+
+	/* Grow upwards until the root covers KEY; the old root stays valid */
+	while (key > radix_maxkey(root->rn_shift)) {
+		node = radixnode_create(root->rn_shift + RADIX_BITS);
+		if (node == NULL) {
+			return ENOMEM;
+		}
+		node->rn_slots[0] = root;
+		node->rn_count = 1;
+		for (i=0; i<RADIX_NTAGS; i++) {
+			if (root->rn_tags[i] != 0) {
+				node->rn_tags[i] = 1;
+			}
+		}
+		membar_store_store();
+		rt->rt_root = root = node;
+	}
+
+	/* Go down as far as there are nodes */
+	node = root;
+	while (node->rn_shift > 0) {
+		child = node->rn_slots[radix_index(node, key)];
+		if (child == NULL) {
+			break;
+		}
+		node = child;
+	}
+
+	if (node->rn_shift == 0) {
+		if (node->rn_slots[radix_index(node, key)] != NULL) {
+			return EEXIST;
+		}
+		/* The item has to be set up before it can be found */
+		membar_store_store();
+		node->rn_slots[radix_index(node, key)] = item;
+	}
+	else {
+		/*
+		 * Make the missing nodes, with the item at the bottom,
+		 * and link them in all at once, so that lookups never
+		 * see a half-built branch and a failure has nothing to
+		 * undo in the tree.
+		 */
+		top = parent = NULL;
+		for (shift = node->rn_shift; shift > 0; ) {
+			shift -= RADIX_BITS;
+			child = radixnode_create(shift);
+			if (child == NULL) {
+				radixnode_freechain(top, key);
+				if (fresh) {
+					kfree(root);
+				}
+				return ENOMEM;
+			}
+			if (parent == NULL) {
+				top = child;
+			}
+			else {
+				parent->rn_slots[radix_index(parent, key)] = child;
+				parent->rn_count = 1;
+			}
+			parent = child;
+		}
+		parent->rn_slots[radix_index(parent, key)] = item;
+		parent->rn_count = 1;
+		membar_store_store();
+		node->rn_slots[radix_index(node, key)] = top;
+	}
+	node->rn_count++;
+	rt->rt_count++;
+	if (fresh) {
+		membar_store_store();
+		rt->rt_root = root;
+	}
+	return 0;
+}
+
+void *
+radix_lookup(const struct radixtree *rt, uint32_t key)
+{
+	struct radixnode *node;
+	void *p;
+
+	node = rt->rt_root;
+	if (node == NULL) {
+		return NULL;
+	}
+	/* Pairs with the membar_store_store before linking a node in */
+	membar_load_load();
+	if (key > radix_maxkey(node->rn_shift)) {
+		return NULL;
+	}
+	for (;;) {
+		p = node->rn_slots[radix_index(node, key)];
+		if (node->rn_shift == 0 || p == NULL) {
+			return p;
+		}
+		membar_load_load();
+		node = p;
+	}
+}
+
+/*
+ * For changes: the nodes from the root down to the leaf node for KEY,
+ * and the slot taken in each. Returns the number of levels, or 0 if
+ * the leaf node for KEY doesn't exist.
+ */
+static
+unsigned
+radix_path(const struct radixtree *rt, uint32_t key,
+	   struct radixnode **path, unsigned *slots)
+{
+	struct radixnode *node;
+	unsigned depth;
+
+	node = rt->rt_root;
+	if (node == NULL || key > radix_maxkey(node->rn_shift)) {
+		return 0;
+	}
+	for (depth = 0; ; depth++) {
+		KASSERT(depth < RADIX_LEVELS);
+		path[depth] = node;
+		slots[depth] = radix_index(node, key);
+		if (node->rn_shift == 0) {
+			return depth + 1;
+		}
+		node = node->rn_slots[slots[depth]];
+		if (node == NULL) {
+			return 0;
+		}
+	}
+}
+
+/* Clear tag TAG at the bottom of PATH, and above while nothing else has it */
+static
+void
+radix_untag(struct radixnode **path, unsigned *slots, unsigned depth,
+	    unsigned tag)
+{
+	while (depth-- > 0) {
+		path[depth]->rn_tags[tag] &= ~((uint32_t)1 << slots[depth]);
+		if (path[depth]->rn_tags[tag] != 0) {
+			break;
+		}
+	}
+}
+
+void *
+radix_remove(struct radixtree *rt, uint32_t key)
+{
+	struct radixnode *path[RADIX_LEVELS], *root;
+	unsigned slots[RADIX_LEVELS];
+	unsigned depth, i;
+	void *item;
+
+	depth = radix_path(rt, key, path, slots);
+	if (depth == 0) {
+		return NULL;
+	}
+	item = path[depth-1]->rn_slots[slots[depth-1]];
+	if (item == NULL) {
+		return NULL;
+	}
+	for (i=0; i<RADIX_NTAGS; i++) {
+		radix_untag(path, slots, depth, i);
+	}
+	path[depth-1]->rn_slots[slots[depth-1]] = NULL;
+	path[depth-1]->rn_count--;
+	rt->rt_count--;
+
+	/* Free the nodes left empty */
+	for (i = depth - 1; i > 0 && path[i]->rn_count == 0; i--) {
+		kfree(path[i]);
+		path[i-1]->rn_slots[slots[i-1]] = NULL;
+		path[i-1]->rn_count--;
+	}
+	root = path[0];
+	if (root->rn_count == 0) {
+		kfree(root);
+		rt->rt_root = NULL;
+		return item;
+	}
+
+	/* Shrink while everything is under slot 0 of the root */
+	while (root->rn_shift > 0 && root->rn_count == 1 &&
+	       root->rn_slots[0] != NULL) {
+		rt->rt_root = root->rn_slots[0];
+		kfree(root);
+		root = rt->rt_root;
+	}
+	return item;
+}
+
+/*
+ * Gang lookup in the subtree NODE, whose first slot is key BASE: up
+ * to MAX items from key FIRST on, tagged TAG unless TAG is RADIX_NTAGS.
+ */
+static
+unsigned
+radix_gang(const struct radixnode *node, uint32_t base, uint32_t first,
+	   void **items, uint32_t *keys, unsigned max, unsigned tag)
+{
+	unsigned i, found;
+	uint32_t slotbase;
+	void *p;
+
+	i = first > base ? (first - base) >> node->rn_shift : 0;
+	found = 0;
+	for (; i<RADIX_SLOTS && found < max; i++) {
+		p = node->rn_slots[i];
+		if (p == NULL) {
+			continue;
+		}
+		if (tag < RADIX_NTAGS &&
+		    (node->rn_tags[tag] & ((uint32_t)1 << i)) == 0) {
+			continue;
+		}
+		slotbase = base + ((uint32_t)i << node->rn_shift);
+		if (node->rn_shift == 0) {
+			items[found] = p;
+			if (keys != NULL) {
+				keys[found] = slotbase;
+			}
+			found++;
+		}
+		else {
+			membar_load_load();
+			found += radix_gang(p, slotbase, first, items + found,
+					    keys != NULL ? keys + found : NULL,
+					    max - found, tag);
+		}
+	}
+	return found;
+}
+
+unsigned
+radix_gang_lookup(const struct radixtree *rt, uint32_t first,
+		  void **items, uint32_t *keys, unsigned max)
+{
+	return radix_gang_lookup_tag(rt, first, items, keys, max,
+				     RADIX_NTAGS);
+}
+
+unsigned
+radix_gang_lookup_tag(const struct radixtree *rt, uint32_t first,
+		      void **items, uint32_t *keys, unsigned max,
+		      unsigned tag)
+{
+	struct radixnode *root;
+
+	KASSERT(tag <= RADIX_NTAGS);
+	root = rt->rt_root;
+	if (root == NULL) {
+		return 0;
+	}
+	membar_load_load();
+	if (first > radix_maxkey(root->rn_shift)) {
+		return 0;
+	}
+	return radix_gang(root, 0, first, items, keys, max, tag);
+}
+
+void
+radix_tag_set(struct radixtree *rt, uint32_t key, unsigned tag)
+{
+	struct radixnode *path[RADIX_LEVELS];
+	unsigned slots[RADIX_LEVELS];
+	unsigned depth, i;
+
+	KASSERT(tag < RADIX_NTAGS);
+	depth = radix_path(rt, key, path, slots);
+	KASSERT(depth > 0);
+	KASSERT(path[depth-1]->rn_slots[slots[depth-1]] != NULL);
+	for (i=0; i<depth; i++) {
+		path[i]->rn_tags[tag] |= (uint32_t)1 << slots[i];
+	}
+}
+
+void
+radix_tag_clear(struct radixtree *rt, uint32_t key, unsigned tag)
+{
+	struct radixnode *path[RADIX_LEVELS];
+	unsigned slots[RADIX_LEVELS];
+	unsigned depth;
+
+	KASSERT(tag < RADIX_NTAGS);
+	depth = radix_path(rt, key, path, slots);
+	KASSERT(depth > 0);
+	KASSERT(path[depth-1]->rn_slots[slots[depth-1]] != NULL);
+	radix_untag(path, slots, depth, tag);
+}
+
+bool
+radix_tag_get(const struct radixtree *rt, uint32_t key, unsigned tag)
+{
+	struct radixnode *node;
+	unsigned i;
+
+	KASSERT(tag < RADIX_NTAGS);
+	node = rt->rt_root;
+	if (node == NULL) {
+		return false;
+	}
+	membar_load_load();
+	if (key > radix_maxkey(node->rn_shift)) {
+		return false;
+	}
+	for (;;) {
+		i = radix_index(node, key);
+		if ((node->rn_tags[tag] & ((uint32_t)1 << i)) == 0) {
+			return false;
+		}
+		if (node->rn_shift == 0) {
+			return node->rn_slots[i] != NULL;
+		}
+		node = node->rn_slots[i];
+		membar_load_load();
+	}
+}
+
+bool
+radix_tagged(const struct radixtree *rt, unsigned tag)
+{
+	struct radixnode *root;
+
+	KASSERT(tag < RADIX_NTAGS);
+	root = rt->rt_root;
+	return root != NULL && root->rn_tags[tag] != 0;
+}
@@ -0,0 +1,308 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Lock-free byte rings; see ringbuf.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spl.h>
+#include <membar.h>
+#include <wchan.h>
+#include <ringbuf.h>
+
+int
+ringbuf_init(struct ringbuf *rb, unsigned size)
+{
+	KASSERT(size > 0 && (size & (size - 1)) == 0);
+
+	rb->rb_buf = kvmalloc(size);
+	if (rb->rb_buf == NULL) {
+		return ENOMEM;
+	}
+	rb->rb_mask = size - 1;
+	rb->rb_head = 0;
+	rb->rb_tail = 0;
+	spinlock_data_set(&rb->rb_reserve, 0);
+	return 0;
+}
+
+void
+ringbuf_cleanup(struct ringbuf *rb)
+{
+	kvfree(rb->rb_buf);
+	rb->rb_buf = NULL;
+}
+
+unsigned
+ringbuf_size(const struct ringbuf *rb)
+{
+	return rb->rb_mask + 1;
+}
+
+unsigned
+ringbuf_used(const struct ringbuf *rb)
+{
+	return rb->rb_head - rb->rb_tail;
+}
+
+unsigned
+ringbuf_space(const struct ringbuf *rb)
+{
+	return ringbuf_size(rb) - ringbuf_used(rb);
+}
+
+/*
+ * Copy LEN bytes in or out at free-running position POS, in two
+ * pieces if it wraps past the end of the buffer.
+ */
+static
+void
+ringbuf_copyin(struct ringbuf *rb, unsigned pos, const char *data,
+	       unsigned len)
+{
+	unsigned off, first;
+
+	off = pos & rb->rb_mask;
+	first = ringbuf_size(rb) - off;
+	if (first > len) {
+		first = len;
+	}
+	memcpy(rb->rb_buf + off, data, first);
+	memcpy(rb->rb_buf, data + first, len - first);
+}
+
+static
+void
+ringbuf_copyout(struct ringbuf *rb, unsigned pos, char *data, unsigned len)
+{
+	unsigned off, first;
+
+	off = pos & rb->rb_mask;
+	first = ringbuf_size(rb) - off;
+	if (first > len) {
+		first = len;
+	}
+	memcpy(data, rb->rb_buf + off, first);
+	memcpy(data + first, rb->rb_buf, len - first);
+}
+
+size_t
+ringbuf_put(struct ringbuf *rb, const void *data, size_t len)
+{
+	unsigned head, space;
+
+	head = rb->rb_head;
+	space = ringbuf_size(rb) - (head - rb->rb_tail);
+	/* Don't overwrite bytes until the consumer is done reading them */
+	membar_any_store();
+	if (len > space) {
+		len = space;
+	}
+	ringbuf_copyin(rb, head, data, len);
+	membar_store_store();
+	rb->rb_head = head + len;
+	return len;
+}
+
+bool
+ringbuf_mput(struct ringbuf *rb, const void *data, size_t len)
+{
+	unsigned start;
+	int spl;
+
+	if (len == 0) {
+		return true;
+	}
+	if (len > ringbuf_size(rb)) {
+		return false;
+	}
+
+	spl = splhigh();
+	do {
+		start = spinlock_data_get(&rb->rb_reserve);
+		if (start + len - rb->rb_tail > ringbuf_size(rb)) {
+			splx(spl);
+			return false;
+		}
+	} while (!spinlock_data_cas(&rb->rb_reserve, start, start + len));
+	membar_any_store();
+
+	ringbuf_copyin(rb, start, data, len);
+
+	/* Earlier claims go out first; they're at splhigh too */
+	while (rb->rb_head != start) {
+		/* spin */
+	}
+	membar_store_store();
+	rb->rb_head = start + len;
+	splx(spl);
+	return true;
+}
+
+size_t
+ringbuf_get(struct ringbuf *rb, void *data, size_t len)
+{
+	unsigned tail, used;
+
+	tail = rb->rb_tail;
+	used = rb->rb_head - tail;
+	/* Don't read the bytes before the count that covers them */
+	membar_load_load();
+	if (len > used) {
+		len = used;
+	}
+	ringbuf_copyout(rb, tail, data, len);
+	membar_any_store();
+	rb->rb_tail = tail + len;
+	return len;
+}
+
+////////////////////////////////////////////////////////////
+// blocking rings
+
+int
+bringbuf_init(struct bringbuf *br, const char *name, unsigned size)
+{
+	int result;
+
+	result = ringbuf_init(&br->br_ring, size);
+	if (result) {
+		return result;
+	}
+	br->br_readwc = wchan_create(name);
+	if (br->br_readwc == NULL) {
+		ringbuf_cleanup(&br->br_ring);
+		return ENOMEM;
+	}
+	br->br_writewc = wchan_create(name);
+	if (br->br_writewc == NULL) {
+		wchan_destroy(br->br_readwc);
+		ringbuf_cleanup(&br->br_ring);
+		return ENOMEM;
+	}
+	spinlock_init(&br->br_lock);
+	br->br_readwait = false;
+	br->br_writewait = false;
+	return 0;
+}
+
+void
+bringbuf_cleanup(struct bringbuf *br)
+{
+	KASSERT(!br->br_readwait);
+	KASSERT(!br->br_writewait);
+	spinlock_cleanup(&br->br_lock);
+	wchan_destroy(br->br_writewc);
+	wchan_destroy(br->br_readwc);
+	ringbuf_cleanup(&br->br_ring);
+}
+
+size_t
+bringbuf_tryread(struct bringbuf *br, void *data, size_t len)
+{
+	size_t n;
+
+	n = ringbuf_get(&br->br_ring, data, len);
+	if (n > 0) {
+		/* Pairs with the barrier in bringbuf_write */
+		membar_any_any();
+		if (br->br_writewait) {
+			spinlock_acquire(&br->br_lock);
+			wchan_wakeall(br->br_writewc, &br->br_lock);
+			spinlock_release(&br->br_lock);
+		}
+	}
+	return n;
+}
+
+size_t
+bringbuf_trywrite(struct bringbuf *br, const void *data, size_t len)
+{
+	size_t n;
+
+	n = ringbuf_put(&br->br_ring, data, len);
+	if (n > 0) {
+		/* Pairs with the barrier in bringbuf_read */
+		membar_any_any();
+		if (br->br_readwait) {
+			spinlock_acquire(&br->br_lock);
+			wchan_wakeall(br->br_readwc, &br->br_lock);
+			spinlock_release(&br->br_lock);
+		}
+	}
+	return n;
+}
+
+size_t
+bringbuf_read(struct bringbuf *br, void *data, size_t len)
+{
+	size_t n;
+
+	if (len == 0) {
+		return 0;
+	}
+	while ((n = bringbuf_tryread(br, data, len)) == 0) {
+		spinlock_acquire(&br->br_lock);
+		br->br_readwait = true;
+		membar_any_any();
+		if (ringbuf_used(&br->br_ring) == 0) {
+			wchan_sleep(br->br_readwc, &br->br_lock);
+		}
+		br->br_readwait = false;
+		spinlock_release(&br->br_lock);
+	}
+	return n;
+}
+
+void
+bringbuf_write(struct bringbuf *br, const void *data, size_t len)
+{
+	const char *p = data;
+	size_t n;
+
+	while (len > 0) {
+		n = bringbuf_trywrite(br, p, len);
+		p += n;
+		len -= n;
+		if (n > 0) {
+			continue;
+		}
+		spinlock_acquire(&br->br_lock);
+		br->br_writewait = true;
+		membar_any_any();
+		if (ringbuf_space(&br->br_ring) == 0) {
+			wchan_sleep(br->br_writewc, &br->br_lock);
+		}
+		br->br_writewait = false;
+		spinlock_release(&br->br_lock);
+	}
+}
@@ -28,6 +28,7 @@
  */
 
 #include <types.h>
+#include <kern/fcntl.h>
 #include <lib.h>
 #include <uio.h>
 #include <proc.h>
@@ -38,6 +39,38 @@
  * See uio.h for a description.
  */
 
+/*
+ * Move data for a user-space uio: work out which iovecs the N bytes
+ * span and hand them all to copyinv/copyoutv in one go, so that the
+ * address checks and fault handler setup are done once per call
+ * rather than once per segment. The iovecs themselves are advanced
+ * afterwards by uiomove.
+ */
+static
+int
+uiomove_user(void *ptr, size_t n, struct uio *uio)
+{
+	unsigned cnt;
+	size_t left, size;
+
+	left = n;
+	for (cnt = 0; left > 0; cnt++) {
+		if (cnt == uio->uio_iovcnt) {
+			/* uio_resid is more than the buffers hold */
+			panic("uiomove: ran out of buffers\n");
+		}
+		size = uio->uio_iov[cnt].iov_len;
+		left -= size < left ? size : left;
+	}
+
+	if (uio->uio_rw == UIO_READ) {
+		return copyoutv(ptr, uio->uio_iov, cnt, n);
+	}
+	else {
+		return copyinv(uio->uio_iov, cnt, ptr, n);
+	}
+}
+
 int
 uiomove(void *ptr, size_t n, struct uio *uio)
 {
@@ -55,7 +88,27 @@ uiomove(void *ptr, size_t n, struct uio *uio)
 		KASSERT(uio->uio_space == proc_getas());
 	}
 
-	while (n > 0 && uio->uio_resid > 0) {
+	if (n > uio->uio_resid) {
+		n = uio->uio_resid;
+	}
+
+	switch (uio->uio_segflg) {
+	    case UIO_SYSSPACE:
+		break;
+	    case UIO_USERSPACE:
+	    case UIO_USERISPACE:
+		/* All the copying at once; below just does the accounting */
+		result = uiomove_user(ptr, n, uio);
+		if (result) {
+			return result;
+		}
+		break;
+	    default:
+		panic("uiomove: Invalid uio_segflg %d\n",
+		      (int)uio->uio_segflg);
+	}
+
+	while (n > 0) {
 		/* get the first iovec */
 		iov = uio->uio_iov;
 		size = iov->iov_len;
@@ -80,32 +133,17 @@ uiomove(void *ptr, size_t n, struct uio *uio)
 			continue;
 		}
 
-		switch (uio->uio_segflg) {
-		    case UIO_SYSSPACE:
-			    if (uio->uio_rw == UIO_READ) {
-				    memmove(iov->iov_kbase, ptr, size);
-			    }
-			    else {
-				    memmove(ptr, iov->iov_kbase, size);
-			    }
-			    iov->iov_kbase = ((char *)iov->iov_kbase+size);
-			    break;
-		    case UIO_USERSPACE:
-		    case UIO_USERISPACE:
-			    if (uio->uio_rw == UIO_READ) {
-				    result = copyout(ptr, iov->iov_ubase,size);
-			    }
-			    else {
-				    result = copyin(iov->iov_ubase, ptr, size);
-			    }
-			    if (result) {
-				    return result;
-			    }
-			    iov->iov_ubase += size;
-			    break;
-		    default:
-			    panic("uiomove: Invalid uio_segflg %d\n",
-				  (int)uio->uio_segflg);
+		if (uio->uio_segflg == UIO_SYSSPACE) {
+			if (uio->uio_rw == UIO_READ) {
+				memmove(iov->iov_kbase, ptr, size);
+			}
+			else {
+				memmove(ptr, iov->iov_kbase, size);
+			}
+			iov->iov_kbase = ((char *)iov->iov_kbase+size);
+		}
+		else {
+			iov->iov_ubase += size;
 		}
 
 		iov->iov_len -= size;
@@ -121,8 +159,11 @@ uiomove(void *ptr, size_t n, struct uio *uio)
 int
 uiomovezeros(size_t n, struct uio *uio)
 {
-	/* static, so initialized as zero */
-	static char zeros[16];
+	/*
+	 * static, so initialized as zero; big enough that reading a
+	 * hole or zero: takes a uiomove per block, not per few bytes
+	 */
+	static char zeros[1024];
 	size_t amt;
 	int result;
 
@@ -161,4 +202,28 @@ uio_kinit(struct iovec *iov, struct uio *u,
 	u->uio_segflg = UIO_SYSSPACE;
 	u->uio_rw = rw;
 	u->uio_space = NULL;
+	u->uio_direct = false;
+	u->uio_advice = POSIX_FADV_NORMAL;
+}
+
+/*
+ * Convenience function to initialize an iovec and uio for user I/O
+ * on behalf of the current process.
+ */
+
+void
+uio_uinit(struct iovec *iov, struct uio *u,
+	  userptr_t ubuf, size_t len, off_t pos, enum uio_rw rw)
+{
+	iov->iov_ubase = ubuf;
+	iov->iov_len = len;
+	u->uio_iov = iov;
+	u->uio_iovcnt = 1;
+	u->uio_offset = pos;
+	u->uio_resid = len;
+	u->uio_segflg = UIO_USERSPACE;
+	u->uio_rw = rw;
+	u->uio_space = proc_getas();
+	u->uio_direct = false;
+	u->uio_advice = POSIX_FADV_NORMAL;
 }
@@ -47,9 +47,14 @@
 #include <vfs.h>
 #include <device.h>
 #include <syscall.h>
+#include <kstat.h>
 #if OPT_SHELL
 #include "syscall_SHELL.h"
 #include "exec.h"
+#include <futex.h>
+#include <rangelock.h>
+#include <appendlog.h>
+#include <workqueue.h>
 #endif
 #include <test.h>
 #include <version.h>
@@ -76,6 +81,91 @@ static const char harvard_copyright[] =
     "   President and Fellows of Harvard College.  All rights reserved.\n";
 
 
+/*
+ * Boot phase times. boot() calls boot_phase after each step, which
+ * records the time since the previous one. There is no clock until
+ * mainbus_bootstrap attaches it, so the steps before that can't be
+ * timed at all, and mainbus_bootstrap itself only from the moment
+ * the clock came up (time zero of clock_monotonic). Nothing is
+ * printed here, as the console isn't there yet either; the table is
+ * printed at the end of boot() and kept for the menu and kstat:.
+ */
+#define BOOT_MAXPHASES	24
+
+struct boot_phase {
+	const char *bp_name;
+	uint64_t bp_nsecs;
+	bool bp_timed;		/* the clock was there at the start */
+};
+
+static struct boot_phase boot_phases[BOOT_MAXPHASES];
+static unsigned boot_nphases;
+static uint64_t boot_lastmark;
+static bool boot_lastready;
+
+static
+void
+boot_phase(const char *name)
+{
+	struct boot_phase *bp;
+	uint64_t now;
+	bool ready;
+
+	ready = clock_ready();
+	now = ready ? clock_monotonic() : 0;
+	KASSERT(boot_nphases < BOOT_MAXPHASES);
+	bp = &boot_phases[boot_nphases++];
+	bp->bp_name = name;
+	bp->bp_nsecs = now - boot_lastmark;
+	bp->bp_timed = boot_lastready;
+	boot_lastmark = now;
+	boot_lastready = ready;
+}
+
+/*
+ * Print the table (also the "boot" menu command).
+ */
+void
+boot_printphases(void)
+{
+	const struct boot_phase *bp;
+	unsigned i;
+
+	kprintf("Boot phases:\n");
+	for (i=0; i<boot_nphases; i++) {
+		bp = &boot_phases[i];
+		if (bp->bp_nsecs == 0 && !bp->bp_timed) {
+			kprintf("    %-22s (before the clock)\n", bp->bp_name);
+			continue;
+		}
+		kprintf("    %-22s %s%llu.%03llu ms\n", bp->bp_name,
+			bp->bp_timed ? "" : ">",
+			(unsigned long long)(bp->bp_nsecs / 1000000),
+			(unsigned long long)(bp->bp_nsecs / 1000 % 1000));
+	}
+	kprintf("    %-22s >%llu.%03llu ms\n", "total",
+		(unsigned long long)(boot_lastmark / 1000000),
+		(unsigned long long)(boot_lastmark / 1000 % 1000));
+}
+
+/*
+ * The timed phases, for kstat: boot.NAME, in nanoseconds (the
+ * untimed ones are left out, and mainbus only counts from the clock).
+ */
+void
+boot_kstat(struct kstat *ks)
+{
+	unsigned i;
+
+	for (i=0; i<boot_nphases; i++) {
+		if (boot_phases[i].bp_timed || boot_phases[i].bp_nsecs > 0) {
+			kstat_put(ks, boot_phases[i].bp_nsecs, "boot.%s",
+				  boot_phases[i].bp_name);
+		}
+	}
+	kstat_put(ks, boot_lastmark, "boot.total");
+}
+
 /*
  * Initial boot sequence.
  */
@@ -111,34 +201,73 @@ boot(void)
 
 	/* Early initialization. */
 	ram_bootstrap();
+	boot_phase("ram");
 	proc_bootstrap();
+	boot_phase("proc");
 	thread_bootstrap();
+	boot_phase("thread");
 	hardclock_bootstrap();
+	boot_phase("hardclock");
 	vfs_bootstrap();
+	boot_phase("vfs");
 	kheap_nextgeneration();
 
 	/* Probe and initialize devices. Interrupts should come on. */
 	kprintf("Device probe...\n");
 	KASSERT(curthread->t_curspl > 0);
 	mainbus_bootstrap();
+	boot_phase("mainbus");
 	KASSERT(curthread->t_curspl == 0);
 	/* Now do pseudo-devices. */
 	pseudoconfig();
+	boot_phase("pseudoconfig");
 	kprintf("\n");
 	kheap_nextgeneration();
 
 	/* Late phase of initialization. */
 	vm_bootstrap();
+	boot_phase("vm");
 	kprintf_bootstrap();
+	boot_phase("kprintf");
+	/* The other cpus come up while we finish the rest */
+	thread_start_cpus();
+	boot_phase("start_cpus");
 #if OPT_SHELL
+	openfile_bootstrap();
+	boot_phase("openfile");
 	exec_bootstrap();
+	boot_phase("exec");
+	futex_bootstrap();
+	boot_phase("futex");
+	rangelock_bootstrap();
+	boot_phase("rangelock");
+	appendlog_bootstrap();
+	boot_phase("appendlog");
+#endif
+	thread_wait_cpus();
+	boot_phase("wait_cpus");
+	kprintf_async_bootstrap();
+	boot_phase("klog");
+#if OPT_SHELL
+	workqueue_bootstrap();
+	boot_phase("workqueue");
 #endif
-	thread_start_cpus();
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
 	vfs_setbootfs("emu0");
+	boot_phase("bootfs");
+#if OPT_SHELL
+	/* Swap, if there is a swap disk */
+	swap_bootstrap();
+	boot_phase("swap");
+	/* Warm the caches up with the programs run last time */
+	exec_prefetch_start();
+	boot_phase("prefetch");
+#endif
 
 	kheap_nextgeneration();
+	boot_printphases();
+	kprintf("\n");
 
 	/*
 	 * Make sure various things aren't screwed up.
@@ -154,9 +283,14 @@ static
 void
 shutdown(void)
 {
+	/* From here on the console has to be up to date at all times */
+	kprintf_setasync(false);
 
 	kprintf("Shutting down.\n");
 
+#if OPT_SHELL
+	exec_history_save();
+#endif
 	vfs_clearbootfs();
 	vfs_clearcurdir();
 	vfs_unmountall();
@@ -31,6 +31,7 @@
 #include <kern/errno.h>
 #include <kern/reboot.h>
 #include <kern/unistd.h>
+#include <kern/wait.h>
 #include <limits.h>
 #include <lib.h>
 #include <uio.h>
@@ -39,6 +40,7 @@
 #include <synch.h>
 #include <thread.h>
 #include <proc.h>
+#include <vm.h>
 #include <vfs.h>
 #include <sfs.h>
 #include <syscall.h>
@@ -54,6 +56,14 @@
 #include "opt-shell.h"
 #include "syscall_SHELL.h"
 #include <current.h>
+#include <kmem_cache.h>
+#include <lockprof.h>
+#include <hangman.h>
+#include <kstat.h>
+#include <prof.h>
+#if OPT_PROF
+#include <lamebus/ltrace.h> // for ltrace_setprof()
+#endif
 
 /*
  * In-kernel menu and command dispatcher.
@@ -134,15 +144,8 @@ common_prog(int nargs, char **args)
 
 #if OPT_SHELL
 
-	/*ADDING NEW CHILD TO FATHER*/
-    if(add_new_child(curproc, proc->p_pid)==-1){
-        proc_destroy(proc);
-        return ENOMEM; 
-    }
-
-
-    /*LINKING CHILD TO FATHER*/
-    proc->parent_pid=curproc->p_pid;
+	/*LINKING CHILD TO FATHER*/
+	add_new_child(curproc, proc);
 #endif
 
 	result = thread_fork(args[0] /* thread name */,
@@ -160,7 +163,7 @@ common_prog(int nargs, char **args)
 	int exitstatus;
 	pid_t returnpid;
 	kprintf("[!] %d is waiting for %d...\n", curproc->p_pid, pid);
-	int err = sys_waitpid_SHELL(pid, &exitstatus, 0, &returnpid);
+	int err = proc_wait(pid, 0, &exitstatus, &returnpid);
 	if (err != 0) {
 		return err;
 	} else {
@@ -190,6 +193,97 @@ cmd_prog(int nargs, char **args)
 	return common_prog(nargs, args);
 }
 
+#if OPT_SHELL
+/*
+ * Command for running programs concurrently: "pb [-n N] program ..."
+ * starts N copies (default 1) of each program listed, all at once,
+ * and waits for them all. Each process's wall time is printed as it
+ * exits, and the total at the end. Like "p", it can't pass arguments.
+ */
+#define PROGBATCH_MAX 64
+
+static
+int
+cmd_progbatch(int nargs, char **args)
+{
+	struct batchproc {
+		pid_t bp_pid;
+		const char *bp_name;
+	} procs[PROGBATCH_MAX];
+	struct proc *proc;
+	unsigned copies, nprocs, running, i, j;
+	uint64_t start, now, sum;
+	int exitstatus, result, err;
+	pid_t pid;
+
+	copies = 1;
+	args++;
+	nargs--;
+	if (nargs >= 2 && !strcmp(args[0], "-n")) {
+		copies = atoi(args[1]);
+		args += 2;
+		nargs -= 2;
+	}
+	if (nargs < 1 || copies < 1 || copies * nargs > PROGBATCH_MAX) {
+		kprintf("Usage: pb [-n copies] program [program...]\n");
+		kprintf("    (at most %u processes in all)\n", PROGBATCH_MAX);
+		return EINVAL;
+	}
+
+	/* The threads use args until they exec, so we must wait for all */
+	result = 0;
+	nprocs = 0;
+	start = clock_monotonic();
+	for (i=0; i<copies && result == 0; i++) {
+		for (j=0; j<(unsigned)nargs && result == 0; j++) {
+			proc = proc_create_runprogram(args[j]);
+			if (proc == NULL) {
+				result = ENOMEM;
+				break;
+			}
+			add_new_child(curproc, proc);
+			result = thread_fork(args[j], proc, cmd_progthread,
+					     &args[j], 1);
+			if (result) {
+				kprintf("thread_fork failed: %s\n",
+					strerror(result));
+				proc_destroy(proc);
+				break;
+			}
+			procs[nprocs].bp_pid = proc->p_pid;
+			procs[nprocs].bp_name = args[j];
+			nprocs++;
+		}
+	}
+	kprintf("[!] %d started %u processes\n", curproc->p_pid, nprocs);
+
+	sum = 0;
+	for (running = nprocs; running > 0; running--) {
+		err = proc_wait(WAIT_ANY, 0, &exitstatus, &pid);
+		if (err) {
+			return err;
+		}
+		now = clock_monotonic() - start;
+		sum += now;
+		for (i=0; i<nprocs && procs[i].bp_pid != pid; i++) {
+			/* nothing */
+		}
+		kprintf("[!] process %d (%s) terminated with exit status %d "
+			"after %llu.%03llu ms\n", pid,
+			i < nprocs ? procs[i].bp_name : "?", exitstatus,
+			now / 1000000, (now / 1000) % 1000);
+	}
+	now = clock_monotonic() - start;
+	if (nprocs > 0) {
+		kprintf("[!] %u processes: %llu.%03llu ms wall time, "
+			"%llu.%03llu ms per process on average\n", nprocs,
+			now / 1000000, (now / 1000) % 1000,
+			sum / nprocs / 1000000, (sum / nprocs / 1000) % 1000);
+	}
+	return result;
+}
+#endif
+
 /*
  * Command for starting the system shell.
  */
@@ -524,6 +618,383 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+#if OPT_SHELL
+static
+int
+cmd_kcachestats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	kmem_cache_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_ps(int nargs, char **args)
+{
+	if (nargs == 1) {
+		proc_printstats(0);
+	}
+	else if (nargs == 2 && atoi(args[1]) > 0) {
+		proc_printstats(atoi(args[1]));
+	}
+	else {
+		kprintf("Usage: ps [pid]\n");
+	}
+
+	return 0;
+}
+#endif
+
+static
+int
+cmd_kheapprofile(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	kheap_profile();
+
+	return 0;
+}
+
+static
+int
+cmd_kheaptimeline(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	kheap_timeline();
+
+	return 0;
+}
+
+#if OPT_SHELL
+static
+int
+cmd_lockstats(int nargs, char **args)
+{
+	if (nargs == 2) {
+		lock_spinlimit = atoi(args[1]);
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: lk [spinlimit]\n");
+		return 0;
+	}
+
+	lock_printstats();
+
+	return 0;
+}
+#endif
+
+#if OPT_LOCKPROF
+static
+int
+cmd_lockprof(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		lockprof_enable(true);
+	}
+	else if (nargs == 2 && !strcmp(args[1], "off")) {
+		lockprof_enable(false);
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		lockprof_reset();
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: lp [on|off|reset]\n");
+		return 0;
+	}
+
+	lockprof_print();
+
+	return 0;
+}
+#endif
+
+#if OPT_HANGMAN
+static
+int
+cmd_hangman(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		hangman_enable(true);
+	}
+	else if (nargs == 2 && !strcmp(args[1], "off")) {
+		hangman_enable(false);
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: hm [on|off]\n");
+		return 0;
+	}
+
+	kprintf("Deadlock detection is %s\n", hangman_on ? "on" : "off");
+
+	return 0;
+}
+#endif
+
+#if OPT_PROF
+static int cmd_run(int nargs, char **args);
+
+/*
+ * Command for profiling another command: samples the kernel PC in
+ * hardclock while it runs, and turns on trace161's profiler too (if
+ * trace161 is collecting one, that is), so the two can be compared.
+ */
+static
+int
+cmd_prof(int nargs, char **args)
+{
+	int result;
+
+	if (nargs < 2) {
+		kprintf("Usage: prof command [args]\n");
+		return EINVAL;
+	}
+
+	result = prof_start();
+	if (result) {
+		kprintf("prof: %s\n", strerror(result));
+		return result;
+	}
+	ltrace_eraseprof();
+	ltrace_setprof(1);
+
+	result = cmd_run(nargs - 1, args + 1);
+
+	ltrace_setprof(0);
+	prof_stop();
+	prof_report(PROF_SYMFILE, 20);
+
+	return result;
+}
+#endif
+
+/*
+ * Command for showing or changing the hardclock rate. Best given on
+ * the boot command line.
+ */
+static
+int
+cmd_hz(int nargs, char **args)
+{
+	int result;
+
+	if (nargs == 2) {
+		result = clock_sethz(atoi(args[1]));
+		if (result) {
+			kprintf("hz: must be between %u and %u\n",
+				HZ_MIN, HZ_MAX);
+			return result;
+		}
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: hz [rate]\n");
+		return EINVAL;
+	}
+
+	kprintf("%u hardclocks per second\n", hz);
+	return 0;
+}
+
+static
+int
+cmd_vmstats(int nargs, char **args)
+{
+	if (nargs == 2) {
+		vm_stackpages = atoi(args[1]);
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: vm [stackpages]\n");
+		return 0;
+	}
+
+	vm_printstats();
+
+	return 0;
+}
+
+/*
+ * Command for printing how long each phase of boot took.
+ */
+static
+int
+cmd_boottimes(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	boot_printphases();
+
+	return 0;
+}
+
+/*
+ * Command for printing VM fault and TLB statistics.
+ */
+static
+int
+cmd_vmfaults(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	vm_printfaults();
+
+	return 0;
+}
+
+/*
+ * Command for printing system call statistics.
+ */
+static
+int
+cmd_syscallstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	syscall_printstats();
+
+	return 0;
+}
+
+/*
+ * Command for printing a snapshot of all the counters, the same that
+ * reading kstat: returns.
+ */
+static
+int
+cmd_kstat(int nargs, char **args)
+{
+	char *buf;
+	size_t len;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	result = kstat_snapshot(&buf, &len);
+	if (result) {
+		return result;
+	}
+	kprintf("%s", buf);
+	kvfree(buf);
+
+	return 0;
+}
+
+/*
+ * Command for the kprintf log rings: "kl on" and "kl off" make
+ * kprintf asynchronous or synchronous, and plain "kl" prints stats.
+ */
+static
+int
+cmd_klog(int nargs, char **args)
+{
+	if (nargs == 1) {
+		kprintf_printstats();
+		return 0;
+	}
+	if (!strcmp(args[1], "on") && nargs == 2) {
+		kprintf_setasync(true);
+		return 0;
+	}
+	if (!strcmp(args[1], "off") && nargs == 2) {
+		kprintf_setasync(false);
+		return 0;
+	}
+	kprintf("Usage: kl [on | off]\n");
+	return EINVAL;
+}
+
+/*
+ * Command for the scheduler histograms: "slh on" clears them and
+ * starts collecting, "slh off" stops, and plain "slh" prints them.
+ */
+static
+int
+cmd_schedhist(int nargs, char **args)
+{
+	if (nargs == 1) {
+		thread_schedhist_print();
+		return 0;
+	}
+	if (!strcmp(args[1], "on") && nargs == 2) {
+		thread_schedhist_start();
+		return 0;
+	}
+	if (!strcmp(args[1], "off") && nargs == 2) {
+		thread_schedhist_stop();
+		return 0;
+	}
+	kprintf("Usage: slh [on | off]\n");
+	return EINVAL;
+}
+
+/*
+ * Command for the system call trace: "st on [pid]" starts tracing,
+ * "st off" stops it, and plain "st" prints what has been traced.
+ */
+static
+int
+cmd_systrace(int nargs, char **args)
+{
+	if (nargs == 1) {
+		syscall_trace_print();
+		return 0;
+	}
+	if (!strcmp(args[1], "on") && nargs <= 3) {
+		return syscall_trace_start(nargs == 3 ? atoi(args[2]) : 0);
+	}
+	if (!strcmp(args[1], "off") && nargs == 2) {
+		syscall_trace_stop();
+		return 0;
+	}
+	kprintf("Usage: st [on [pid] | off]\n");
+	return EINVAL;
+}
+
+#if OPT_SFS
+static
+int
+cmd_bufstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	sfs_buf_printstats();
+
+	return 0;
+}
+
+/*
+ * Command for showing the SFS vnode cache, or setting how many
+ * unused vnodes it keeps per volume.
+ */
+static
+int
+cmd_vncache(int nargs, char **args)
+{
+	if (nargs == 2) {
+		sfs_vncache_setmax(atoi(args[1]));
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: vc [max]\n");
+		return EINVAL;
+	}
+
+	sfs_vncache_printstats();
+	return 0;
+}
+#endif
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -556,6 +1027,9 @@ showmenu(const char *name, const char *x[])
 static const char *opsmenu[] = {
 	"[s]       Shell                     ",
 	"[p]       Other program             ",
+#if OPT_SHELL
+	"[pb]      Programs, concurrently    ",
+#endif
 	"[mount]   Mount a filesystem        ",
 	"[unmount] Unmount a filesystem      ",
 	"[bootfs]  Set \"boot\" filesystem     ",
@@ -585,11 +1059,18 @@ static const char *testmenu[] = {
 	"[at]  Array test                    ",
 	"[at2] Large array test              ",
 	"[bt]  Bitmap test                   ",
+	"[ht]  Hash table test               ",
+	"[rt]  Radix tree test               ",
+	"[rbt] Ring buffer test              ",
+	"[pqt] Priority queue test           ",
+	"[lzt] LZ compressor test            ",
 	"[tlt] Threadlist test               ",
 	"[km1] Kernel malloc test            ",
 	"[km2] kmalloc stress test           ",
 	"[km3] Large kmalloc test            ",
 	"[km4] Multipage kmalloc test        ",
+	"[km5] kmalloc scalability (cpus)    ",
+	"[km6] vmalloc test                  ",
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
@@ -600,6 +1081,8 @@ static const char *testmenu[] = {
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
 	"[sy4] CV test #2            (1)     ",
+	"[sy5] Lock priority inheritance     ",
+	"[sp1] Contended spinlock test       ",
 	"[semu1-22] Semaphore unit tests     ",
 	"[fs1] Filesystem test               ",
 	"[fs2] FS read stress                ",
@@ -607,6 +1090,7 @@ static const char *testmenu[] = {
 	"[fs4] FS write stress 2             ",
 	"[fs5] FS long stress                ",
 	"[fs6] FS create stress              ",
+	"[fs7] FS multi-volume throughput    ",
 	NULL
 };
 
@@ -625,12 +1109,71 @@ cmd_testmenu(int n, char **a)
 	return 0;
 }
 
+static const char *benchmenu[] = {
+	"[bn1] Thread create/exit            ",
+	"[bn2] Context switch ping-pong      ",
+	"[bn3] Locks                         ",
+	"[bn4] Semaphores                    ",
+	"[bn5] Condition variables           ",
+	"[bn6] kmalloc/kfree by size         ",
+	"[bn7] Page allocation               ",
+	"[bn8] vfs_open/close [files]        ",
+	"[bn9] memcpy/memmove/memset         ",
+	"[bench] All of the above            ",
+	NULL
+};
+
+static
+int
+cmd_benchmenu(int n, char **a)
+{
+	(void)n;
+	(void)a;
+
+	showmenu("OS/161 benchmarks menu", benchmenu);
+	kprintf("    Latencies are per operation, in ns; cheap operations\n");
+	kprintf("    are timed in batches and averaged.\n");
+	kprintf("\n");
+
+	return 0;
+}
+
 static const char *mainmenu[] = {
 	"[?o] Operations menu                ",
 	"[?t] Tests menu                     ",
+	"[?b] Benchmarks menu                ",
 	"[kh] Kernel heap stats              ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[khprof] Kernel heap alloc sites    ",
+	"[khtl] Kernel heap timeline         ",
+#if OPT_SHELL
+	"[kc] Kernel object cache stats      ",
+	"[ps] Process resource usage         ",
+	"[lk] Lock contention stats          ",
+#endif
+#if OPT_LOCKPROF
+	"[lp] Lock profile by class          ",
+#endif
+#if OPT_HANGMAN
+	"[hm] Deadlock detection on/off      ",
+#endif
+#if OPT_PROF
+	"[prof] Profile a command            ",
+#endif
+	"[vm] Physical memory stats          ",
+	"[vmf] VM fault and TLB stats        ",
+	"[scs] System call stats             ",
+	"[kstat] All counters, as in kstat:  ",
+	"[st] System call trace              ",
+	"[hz] Show or set hardclock rate     ",
+	"[boot] Boot phase times             ",
+	"[slh] Scheduler latency histograms  ",
+	"[kl] Asynchronous kprintf on/off    ",
+#if OPT_SFS
+	"[bc] SFS buffer cache stats         ",
+	"[vc] SFS vnode cache stats/limit    ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -660,10 +1203,14 @@ static struct {
 	{ "help",	cmd_mainmenu },
 	{ "?o",		cmd_opsmenu },
 	{ "?t",		cmd_testmenu },
+	{ "?b",		cmd_benchmenu },
 
 	/* operations */
 	{ "s",		cmd_shell },
 	{ "p",		cmd_prog },
+#if OPT_SHELL
+	{ "pb",		cmd_progbatch },
+#endif
 	{ "mount",	cmd_mount },
 	{ "unmount",	cmd_unmount },
 	{ "bootfs",	cmd_bootfs },
@@ -682,16 +1229,52 @@ static struct {
 	{ "kh",         cmd_kheapstats },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "khprof",     cmd_kheapprofile },
+	{ "khtl",       cmd_kheaptimeline },
+#if OPT_SHELL
+	{ "kc",         cmd_kcachestats },
+	{ "ps",         cmd_ps },
+	{ "lk",         cmd_lockstats },
+#endif
+#if OPT_LOCKPROF
+	{ "lp",         cmd_lockprof },
+#endif
+#if OPT_HANGMAN
+	{ "hm",         cmd_hangman },
+#endif
+#if OPT_PROF
+	{ "prof",       cmd_prof },
+#endif
+	{ "vm",         cmd_vmstats },
+	{ "vmf",        cmd_vmfaults },
+	{ "scs",        cmd_syscallstats },
+	{ "kstat",      cmd_kstat },
+	{ "st",         cmd_systrace },
+	{ "hz",         cmd_hz },
+	{ "boot",       cmd_boottimes },
+	{ "slh",        cmd_schedhist },
+	{ "kl",         cmd_klog },
+#if OPT_SFS
+	{ "bc",         cmd_bufstats },
+	{ "vc",         cmd_vncache },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
 	{ "at2",	arraytest2 },
 	{ "bt",		bitmaptest },
+	{ "ht",		hashtest },
+	{ "rt",		radixtest },
+	{ "rbt",	ringtest },
+	{ "pqt",	pqueuetest },
+	{ "lzt",	lztest },
 	{ "tlt",	threadlisttest },
 	{ "km1",	kmalloctest },
 	{ "km2",	kmallocstress },
 	{ "km3",	kmalloctest3 },
 	{ "km4",	kmalloctest4 },
+	{ "km5",	kmalloctest5 },
+	{ "km6",	kmalloctest6 },
 #if OPT_NET
 	{ "net",	nettest },
 #endif
@@ -704,6 +1287,8 @@ static struct {
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
 	{ "sy4",	cvtest2 },
+	{ "sy5",	locktest2 },
+	{ "sp1",	spinlocktest },
 
 	/* semaphore unit tests */
 	{ "semu1",	semu1 },
@@ -736,10 +1321,46 @@ static struct {
 	{ "fs4",	writestress2 },
 	{ "fs5",	longstress },
 	{ "fs6",	createstress },
+	{ "fs7",	multivolstress },
+
+	/* benchmarks */
+	{ "bn1",	benchthread },
+	{ "bn2",	benchswitch },
+	{ "bn3",	benchlock },
+	{ "bn4",	benchsem },
+	{ "bn5",	benchcv },
+	{ "bn6",	benchkmalloc },
+	{ "bn7",	benchpages },
+	{ "bn8",	benchvfs },
+	{ "bn9",	benchmem },
+	{ "bench",	benchall },
 
 	{ NULL, NULL }
 };
 
+#if OPT_PROF
+/*
+ * Run an already split-up command, for commands that take another
+ * command as their arguments.
+ */
+static
+int
+cmd_run(int nargs, char **args)
+{
+	int i;
+
+	for (i=0; cmdtable[i].name; i++) {
+		if (*cmdtable[i].name && !strcmp(args[0], cmdtable[i].name)) {
+			KASSERT(cmdtable[i].func!=NULL);
+			return cmdtable[i].func(nargs, args);
+		}
+	}
+
+	kprintf("%s: Command not found\n", args[0]);
+	return EINVAL;
+}
+#endif
+
 /*
  * Process a single command.
  */
@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Network interface list and the socket-like interface on top of it.
+ * Drivers do all the real work; this just keeps track of who has
+ * which interface open.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <net.h>
+
+static struct spinlock net_lock = SPINLOCK_INITIALIZER;	/* Protects: */
+static struct netif *net_ifs[NET_MAXIF];
+static unsigned net_nifs;
+
+/*
+ * Make an interface available. Interfaces are numbered in the order
+ * they attach.
+ */
+int
+net_attach(struct netif *ni)
+{
+	spinlock_acquire(&net_lock);
+	if (net_nifs >= NET_MAXIF) {
+		spinlock_release(&net_lock);
+		return ENOSPC;
+	}
+	ni->ni_open = false;
+	net_ifs[net_nifs++] = ni;
+	spinlock_release(&net_lock);
+	return 0;
+}
+
+int
+net_open(unsigned unit, struct netif **ret)
+{
+	struct netif *ni;
+	struct netbuf nb;
+
+	spinlock_acquire(&net_lock);
+	if (unit >= net_nifs) {
+		spinlock_release(&net_lock);
+		return ENXIO;
+	}
+	ni = net_ifs[unit];
+	if (ni->ni_open) {
+		spinlock_release(&net_lock);
+		return EBUSY;
+	}
+	ni->ni_open = true;
+	spinlock_release(&net_lock);
+
+	/* Throw away whatever came in while nobody was listening */
+	while (ni->ni_ops->nio_recv(ni->ni_devdata, &nb, false) == 0) {
+		ni->ni_ops->nio_release(ni->ni_devdata, &nb);
+	}
+
+	*ret = ni;
+	return 0;
+}
+
+void
+net_close(struct netif *ni)
+{
+	spinlock_acquire(&net_lock);
+	KASSERT(ni->ni_open);
+	ni->ni_open = false;
+	spinlock_release(&net_lock);
+}
+
+uint16_t
+net_addr(struct netif *ni)
+{
+	return ni->ni_addr;
+}
+
+int
+net_getbuf(struct netif *ni, struct netbuf *nb, bool wait)
+{
+	KASSERT(ni->ni_open);
+	return ni->ni_ops->nio_getbuf(ni->ni_devdata, nb, wait);
+}
+
+int
+net_send(struct netif *ni, struct netbuf *nb, uint16_t to, size_t len)
+{
+	KASSERT(ni->ni_open);
+	return ni->ni_ops->nio_send(ni->ni_devdata, nb, to, len);
+}
+
+int
+net_recv(struct netif *ni, struct netbuf *nb, bool wait)
+{
+	KASSERT(ni->ni_open);
+	return ni->ni_ops->nio_recv(ni->ni_devdata, nb, wait);
+}
+
+void
+net_release(struct netif *ni, struct netbuf *nb)
+{
+	KASSERT(ni->ni_open);
+	ni->ni_ops->nio_release(ni->ni_devdata, nb);
+}
+
+void
+net_stats(struct netif *ni, struct netstats *ns)
+{
+	ni->ni_ops->nio_stats(ni->ni_devdata, ns);
+}
@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Futexes.
+ *
+ * Sleepers are kept in FUTEX_NHASH chains hashed on (address space,
+ * user address). Each chain has a sleep lock, held while the futex
+ * word is read with copyin - which may fault and sleep - so a wakeup
+ * that comes between the user's check and the sleep is not lost, and
+ * a CV the chain's sleepers wait on. Each sleeper has a record on the
+ * chain, in arrival order; futex_wake marks the ones it wakes, and
+ * since a chain may be shared by several futexes, sleepers that find
+ * themselves unmarked go back to sleep.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <copyinout.h>
+#include <synch.h>
+#include <current.h>
+#include <proc.h>
+#include <futex.h>
+
+#define FUTEX_NHASH  64		/* number of chains (power of two) */
+
+struct futex_waiter {
+	struct addrspace *fw_as;	/* together with fw_uaddr, the futex */
+	vaddr_t fw_uaddr;
+	struct proc *fw_proc;		/* for futex_wakeproc */
+	bool fw_woken;
+	struct futex_waiter *fw_next;
+};
+
+struct futex_chain {
+	struct lock *fc_lock;
+	struct cv *fc_cv;
+	struct futex_waiter *fc_head;	/* oldest first */
+	struct futex_waiter **fc_tailp;
+};
+
+static struct futex_chain futex_chains[FUTEX_NHASH];
+
+static
+struct futex_chain *
+futex_chain(struct addrspace *as, vaddr_t uaddr)
+{
+	unsigned h;
+
+	h = ((uintptr_t)as >> 6) ^ (uaddr >> 2);
+	h ^= h >> 11;
+	return &futex_chains[h & (FUTEX_NHASH - 1)];
+}
+
+/*
+ * Take W off chain FC.
+ */
+static
+void
+futex_unlink(struct futex_chain *fc, struct futex_waiter *w)
+{
+	struct futex_waiter **pp;
+
+	for (pp = &fc->fc_head; *pp != w; pp = &(*pp)->fw_next) {
+		KASSERT(*pp != NULL);
+	}
+	*pp = w->fw_next;
+	if (fc->fc_tailp == &w->fw_next) {
+		fc->fc_tailp = pp;
+	}
+	w->fw_next = NULL;
+}
+
+void
+futex_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<FUTEX_NHASH; i++) {
+		futex_chains[i].fc_lock = lock_create("futex");
+		futex_chains[i].fc_cv = cv_create("futex");
+		if (futex_chains[i].fc_lock == NULL ||
+		    futex_chains[i].fc_cv == NULL) {
+			panic("futex_bootstrap: Out of memory\n");
+		}
+		futex_chains[i].fc_head = NULL;
+		futex_chains[i].fc_tailp = &futex_chains[i].fc_head;
+	}
+}
+
+int
+futex_wait(userptr_t uaddr, int val)
+{
+	struct addrspace *as;
+	struct futex_chain *fc;
+	struct futex_waiter w;
+	int cur, result;
+
+	if ((vaddr_t)uaddr % sizeof(int) != 0) {
+		return EINVAL;
+	}
+	as = proc_getas();
+	KASSERT(as != NULL);
+
+	fc = futex_chain(as, (vaddr_t)uaddr);
+	lock_acquire(fc->fc_lock);
+
+	result = copyin32(uaddr, (uint32_t *)&cur);
+	if (result) {
+		lock_release(fc->fc_lock);
+		return result;
+	}
+	if (cur != val) {
+		lock_release(fc->fc_lock);
+		return EAGAIN;
+	}
+	if (curproc->p_exiting) {
+		lock_release(fc->fc_lock);
+		return EINTR;
+	}
+
+	w.fw_as = as;
+	w.fw_uaddr = (vaddr_t)uaddr;
+	w.fw_proc = curproc;
+	w.fw_woken = false;
+	w.fw_next = NULL;
+	*fc->fc_tailp = &w;
+	fc->fc_tailp = &w.fw_next;
+
+	while (!w.fw_woken) {
+		cv_wait(fc->fc_cv, fc->fc_lock);
+	}
+
+	/* Whoever woke us took us off the chain */
+	lock_release(fc->fc_lock);
+
+	return curproc->p_exiting ? EINTR : 0;
+}
+
+int
+futex_wake(userptr_t uaddr, int n, int *woken)
+{
+	struct addrspace *as;
+	struct futex_chain *fc;
+	struct futex_waiter *w, *next;
+	int count;
+
+	if ((vaddr_t)uaddr % sizeof(int) != 0) {
+		return EINVAL;
+	}
+	as = proc_getas();
+	KASSERT(as != NULL);
+
+	fc = futex_chain(as, (vaddr_t)uaddr);
+	lock_acquire(fc->fc_lock);
+
+	count = 0;
+	for (w = fc->fc_head; w != NULL && count < n; w = next) {
+		next = w->fw_next;
+		if (w->fw_as == as && w->fw_uaddr == (vaddr_t)uaddr) {
+			futex_unlink(fc, w);
+			w->fw_woken = true;
+			count++;
+		}
+	}
+	if (count > 0) {
+		cv_broadcast(fc->fc_cv, fc->fc_lock);
+	}
+
+	lock_release(fc->fc_lock);
+
+	*woken = count;
+	return 0;
+}
+
+void
+futex_wakeproc(struct proc *proc)
+{
+	struct futex_chain *fc;
+	struct futex_waiter *w, *next;
+	unsigned i;
+	bool any;
+
+	for (i=0; i<FUTEX_NHASH; i++) {
+		fc = &futex_chains[i];
+
+		lock_acquire(fc->fc_lock);
+		any = false;
+		for (w = fc->fc_head; w != NULL; w = next) {
+			next = w->fw_next;
+			if (w->fw_proc == proc) {
+				futex_unlink(fc, w);
+				w->fw_woken = true;
+				any = true;
+			}
+		}
+		if (any) {
+			cv_broadcast(fc->fc_cv, fc->fc_lock);
+		}
+		lock_release(fc->fc_lock);
+	}
+}
@@ -43,10 +43,12 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <spl.h>
 #include <proc.h>
 #include <current.h>
 #include <addrspace.h>
+#include <kern/kinfo.h>
 #include <vnode.h>
 #include <syscall.h>
 
@@ -54,6 +56,12 @@
 #include <synch.h>
 #include <kern/fcntl.h>
 #include <vfs.h>
+#include <mips/trapframe.h>
+
+/* INCLUDES FOR RESOURCE ACCOUNTING */
+#include <kern/time.h>
+#include <kern/resource.h>
+#include <clock.h>
 
 
 /*
@@ -61,94 +69,290 @@
  */
 struct proc *kproc;
 
+#if OPT_SHELL
+#include <kmem_cache.h>
+#include <kern/wait.h>
+#include <thread.h>
+#include <futex.h>
+#include <rangelock.h>
+#include <kstat.h>
+#include <kern/signal.h>
+
+static int proc_ctor(void *obj);
+static void proc_dtor(void *obj);
+
+/**
+ * @brief Object caches for process structures and for the trapframe copies handed
+ * 		  from fork to the child. A cached process keeps its p_cv, so it is created
+ * 		  once per object instead of once per fork.
+ */
+static struct kmem_cache proc_cache =
+	KMEM_CACHE_INITIALIZER("proc", sizeof(struct proc), proc_ctor, proc_dtor);
+static struct kmem_cache trapframe_cache =
+	KMEM_CACHE_INITIALIZER("trapframe", sizeof(struct trapframe), NULL, NULL);
+
+#define PROC_ALLOC()	kmem_cache_alloc(&proc_cache)
+#define PROC_FREE(p)	kmem_cache_free(&proc_cache, (p))
+#else
+#define PROC_ALLOC()	kmalloc(sizeof(struct proc))
+#define PROC_FREE(p)	kfree(p)
+#endif
+
+/**
+ * @brief Constructor and destructor for the process cache: create and destroy the
+ * 		  process CV, file table lock and poll head, which survive while the structure
+ * 		  is cached.
+ */
+#if OPT_SHELL
+static int proc_ctor(void *obj) {
+
+	struct proc *proc = obj;
+
+	proc->p_cv = cv_create("proc");
+	if (proc->p_cv == NULL) {
+		return ENOMEM;
+	}
+	proc->p_fdlock = lock_create("proc fd");
+	if (proc->p_fdlock == NULL) {
+		cv_destroy(proc->p_cv);
+		return ENOMEM;
+	}
+	pollhead_init(&proc->p_childpoll);
+	return 0;
+}
+
+static void proc_dtor(void *obj) {
+
+	struct proc *proc = obj;
+
+	pollhead_cleanup(&proc->p_childpoll);
+	lock_destroy(proc->p_fdlock);
+	cv_destroy(proc->p_cv);
+}
+#endif
+
+/**
+ * @brief Allocate and free trapframe copies for fork.
+ */
+#if OPT_SHELL
+struct trapframe *proc_trapframe_alloc(void) {
+	return kmem_cache_alloc(&trapframe_cache);
+}
+
+void proc_trapframe_free(struct trapframe *tf) {
+	kmem_cache_free(&trapframe_cache, tf);
+}
+#endif
+
 /**
  * @brief The process table stuct stores an array of user processes, each identified by
- * 		  a specific PID
+ * 		  a specific PID, which is its index in the table.
+ * 
+ * 		  Free PIDs are kept in a FIFO threaded through next_free, so a PID that has just
+ * 		  been released is handed out again only after every other free one; allocation
+ * 		  and release are O(1). The table starts with PROC_TABLE_INIT slots and doubles
+ * 		  (up to PID_MAX) whenever fewer than PID_REUSE_DELAY PIDs are free, so at least
+ * 		  that many other PIDs are used before one is reused.
  */
 #if OPT_SHELL
-#define PROC_MAX 100				/* maximum number of allowed running process 	*/
+#define PROC_TABLE_INIT 64				/* slots of the initial (static) table 		*/
+#define PROC_TABLE_MAX (PID_MAX + 1)	/* PIDs are indexes, so this bounds both 	*/
+#define PID_REUSE_DELAY 32				/* grow rather than keep fewer free PIDs 	*/
+
 static struct _processTable {
 	bool is_active;					/* table is active and ready to use 			*/
-	struct proc *proc[PROC_MAX+1];	/* [0] not used, PID >= 1 						*/
-	pid_t last_pid;					/* last PID used in the table 					*/
+	struct proc **proc;				/* [0] kernel, PID >= 1; NULL = free 			*/
+	pid_t *next_free;				/* FIFO link of each free PID 					*/
+	unsigned size;					/* number of slots 								*/
+	unsigned nfree;					/* number of free PIDs 							*/
+	pid_t free_head;				/* oldest free PID (next to be used), 0 = none 	*/
+	pid_t free_tail;				/* most recently freed PID 						*/
 	struct spinlock lk;				/* lock for this table 							*/
 } processTable;
+
+static struct proc *processTable_initproc[PROC_TABLE_INIT];
+static pid_t processTable_initnext[PROC_TABLE_INIT];
+
+/**
+ * @brief Lookups by PID don't take processTable.lk: slot pid is read, and the process
+ * 		  in it referenced, under the stripe lock PROC_STRIPE(pid) only, so lookups of
+ * 		  different PIDs proceed in parallel. Writing a slot takes processTable.lk and
+ * 		  then the slot's stripe; growing the table takes every stripe, in order.
+ * 		  p_refcount is protected by the stripe of p_pid.
+ */
+#define PROC_NSTRIPES 16
+#define PROC_STRIPE(pid) (&proc_stripes[(unsigned) (pid) % PROC_NSTRIPES])
+static struct spinlock proc_stripes[PROC_NSTRIPES];
 #endif
 
 /**
- * @brief Search in the process table a valid PID for an eventual
- * 		  new process.
- * 
- * @return PID on success, an error value in case of failure.
+ * @brief Protects the parent/child relationships: parent_pid, the child and sibling
+ * 		  links and p_exited of every process. A parent sleeps on its own p_cv, with this lock,
+ * 		  until one of its children exits. It also protects the user thread records
+ * 		  (p_uthreads, p_nexttid) and p_exiting; a thread joining another one sleeps on
+ * 		  p_cv of its own process too.
  */
 #if OPT_SHELL
-int find_valid_pid(void) {
-	
-	/* CHECKING SPACE AVAILABILITY IN PROCESS TABLE WITH CIRCULAR BUFFER */
-	int index = (processTable.last_pid + 1 > PROC_MAX) ? 1 : processTable.last_pid + 1;
-	while (index != processTable.last_pid) {
-        if (processTable.proc[index] == NULL) {
-            break;
-        }
+static struct lock *proc_familylock;
+#endif
 
-        index ++;
-        index = (index > PROC_MAX) ? 1 : index;
-    }
+/**
+ * @brief Append a PID to the tail of the free FIFO. Table lock must be held.
+ */
+#if OPT_SHELL
+static void pid_pushfree(pid_t pid) {
 
-	/* POSITION NOT FOUND */
-	if (index == processTable.last_pid) {
-        return -1; 
-    }
+	KASSERT(spinlock_do_i_hold(&processTable.lk));
 
-	/* POSITION FOUND */
-	return index;
+	spinlock_acquire(PROC_STRIPE(pid));
+	processTable.proc[pid] = NULL;
+	spinlock_release(PROC_STRIPE(pid));
+	processTable.next_free[pid] = 0;
+	if (processTable.free_tail == 0) {
+		processTable.free_head = pid;
+	} else {
+		processTable.next_free[processTable.free_tail] = pid;
+	}
+	processTable.free_tail = pid;
+	processTable.nfree++;
 }
 #endif
 
 /**
- * @brief Add the given process to the process table, at the given index.
+ * @brief Double the process table. Called and returns with the table lock held, but
+ * 		  drops it to allocate; the caller must recheck why it wanted to grow.
  * 
- * @param pid index in the table (PID)
- * @param proc process to be added
+ * @return false if there was no memory
+ */
+#if OPT_SHELL
+static bool proc_table_grow(void) {
+
+	unsigned oldsize = processTable.size;
+	unsigned newsize = oldsize * 2;
+	struct proc **procs, **oldprocs;
+	pid_t *next, *oldnext;
+
+	if (newsize > PROC_TABLE_MAX) {
+		newsize = PROC_TABLE_MAX;
+	}
+
+	/* ALLOCATING WITHOUT THE SPINLOCK (kmalloc may sleep) */
+	spinlock_release(&processTable.lk);
+	procs = kmalloc(newsize * sizeof(struct proc *));
+	next = kmalloc(newsize * sizeof(pid_t));
+	spinlock_acquire(&processTable.lk);
+
+	if (procs == NULL || next == NULL || processTable.size != oldsize) {
+		/* OUT OF MEMORY, OR SOMEBODY ELSE GREW IT FIRST */
+		spinlock_release(&processTable.lk);
+		kfree(procs);
+		kfree(next);
+		spinlock_acquire(&processTable.lk);
+		return procs != NULL && next != NULL;
+	}
+
+	/* MOVING THE TABLE (WITH ALL LOOKUPS HELD OFF), THE NEW PIDS GO TO THE END OF THE FREE FIFO */
+	for (unsigned i = 0; i < PROC_NSTRIPES; i++) {
+		spinlock_acquire(&proc_stripes[i]);
+	}
+	memcpy(procs, processTable.proc, oldsize * sizeof(struct proc *));
+	memcpy(next, processTable.next_free, oldsize * sizeof(pid_t));
+	oldprocs = processTable.proc;
+	oldnext = processTable.next_free;
+	processTable.proc = procs;
+	processTable.next_free = next;
+	processTable.size = newsize;
+	for (unsigned i = PROC_NSTRIPES; i > 0; i--) {
+		spinlock_release(&proc_stripes[i - 1]);
+	}
+	for (unsigned pid = oldsize; pid < newsize; pid++) {
+		pid_pushfree(pid);
+	}
+
+	/* THE FIRST TABLE IS STATIC, THE OTHERS CAME FROM kmalloc */
+	if (oldprocs != processTable_initproc) {
+		spinlock_release(&processTable.lk);
+		kfree(oldprocs);
+		kfree(oldnext);
+		spinlock_acquire(&processTable.lk);
+	}
+	return true;
+}
+#endif
+
+/**
+ * @brief Take the oldest free PID and register the given process under it, growing
+ * 		  the table first if too few PIDs are free.
  * 
- * @return zero on success, an error value in case of failure
+ * @param proc process to register
+ * @return the PID, or -1 if no PID is available
  */
 #if OPT_SHELL
-int proc_add(pid_t pid, struct proc *proc) {
+static pid_t pid_alloc(struct proc *proc) {
+
+	pid_t pid;
+
+	spinlock_acquire(&processTable.lk);
+	while (processTable.nfree < PID_REUSE_DELAY && processTable.size < PROC_TABLE_MAX) {
+		if (!proc_table_grow()) {
+			break;		// make do with the PIDs we have
+		}
+	}
 
-	/* EVALUATING PARAMETERS */
-	if (pid <= 0 || pid > PROC_MAX+1 || proc == NULL) {
+	if (processTable.nfree == 0) {
+		spinlock_release(&processTable.lk);
 		return -1;
 	}
 
-	/* ADDING PROCESS */
-	spinlock_acquire(&processTable.lk);
-	processTable.proc[pid] = proc;
+	/* POPPING THE HEAD OF THE FREE FIFO */
+	pid = processTable.free_head;
+	processTable.free_head = processTable.next_free[pid];
+	if (processTable.free_head == 0) {
+		processTable.free_tail = 0;
+	}
+	processTable.nfree--;
 
-	/* UPDATE LAST PID POSITION */
-	processTable.last_pid = pid;
+	/* THE TABLE HOLDS THE FIRST REFERENCE */
+	spinlock_acquire(PROC_STRIPE(pid));
+	proc->p_pid = pid;
+	proc->p_refcount = 1;
+	processTable.proc[pid] = proc;
+	spinlock_release(PROC_STRIPE(pid));
 	spinlock_release(&processTable.lk);
 
-	/* TASK COMPLETED SUCCESSFULLY */
-	return 0;
+	return pid;
 }
 #endif
 
 /**
- * @brief Remove the process associated to the given pid from the process 
- * 		  table.
- * 
- * @param pid pid of the process.
+ * @brief Release a PID, unregistering its process.
  */
 #if OPT_SHELL
-void proc_remove(pid_t pid) {
+static void pid_free(pid_t pid) {
 
-	/* REMOVING PROCESS */
 	spinlock_acquire(&processTable.lk);
-	processTable.proc[pid] = NULL;
+	KASSERT(pid > 0 && (unsigned) pid < processTable.size);
+	KASSERT(processTable.proc[pid] != NULL);
+	pid_pushfree(pid);
 	spinlock_release(&processTable.lk);
+}
+#endif
+
+/**
+ * @brief Tell whether the process table has run out of PIDs (so that fork can fail
+ * 		  with ENPROC rather than ENOMEM).
+ * 
+ * @return true if no PID can be allocated
+ */
+#if OPT_SHELL
+bool proc_table_full(void) {
 
+	bool full;
 
+	spinlock_acquire(&processTable.lk);
+	full = processTable.nfree == 0 && processTable.size >= PROC_TABLE_MAX;
+	spinlock_release(&processTable.lk);
+	return full;
 }
 #endif
 
@@ -163,9 +367,12 @@ void call_enter_forked_process(void *tfv, unsigned long dummy) {
 
 	(void) dummy;
 
+	/* MOVING THE TRAPFRAME ONTO OUR STACK AND GIVING THE COPY BACK */
+	struct trapframe tf = *(struct trapframe *) tfv;
+	proc_trapframe_free(tfv);
+
 	/* CALLING BUILT-IN FUNCTION */
-	struct trapframe *tf = (struct trapframe *) tfv;
-	enter_forked_process(tf); 
+	enter_forked_process(&tf); 
 
 	/* SHOULD NOT GET HERE */
 	panic("[!] enter_forked_process() returned unexpectedly\n");
@@ -173,41 +380,108 @@ void call_enter_forked_process(void *tfv, unsigned long dummy) {
 #endif
 
 /**
- * @brief Return the process associated to the given PID
+ * @brief Starts a new user thread of a process, made by __thread_create()
+ * 
+ * @param tfv trapframe carrying the entry point (tf_epc), the stack (tf_sp) and the
+ * 		  two arguments of the entry point (tf_a0, tf_a1).
+ * @param utv join record of the thread
+ */
+#if OPT_SHELL
+void call_enter_new_thread(void *tfv, unsigned long utv) {
+
+	curthread->t_uthread = (struct uthread *) utv;
+
+	/* TAKING WHAT WE NEED AND GIVING THE TRAPFRAME BACK */
+	struct trapframe *tf = tfv;
+	vaddr_t entrypoint = tf->tf_epc;
+	vaddr_t stackptr = tf->tf_sp;
+	int arg0 = tf->tf_a0;
+	userptr_t arg1 = (userptr_t) tf->tf_a1;
+	proc_trapframe_free(tfv);
+
+	/* THE PROCESS MAY HAVE STARTED EXITING BEFORE WE RAN */
+	if (curproc->p_exiting) {
+		proc_thread_exit(0);
+	}
+
+	/* Warp to user mode. */
+	enter_new_process(arg0, arg1, NULL /*uenv*/, stackptr, entrypoint);
+
+	/* SHOULD NOT GET HERE */
+	panic("[!] enter_new_process() returned unexpectedly\n");
+}
+#endif
+
+/**
+ * @brief Return the process associated to the given PID, with a reference that
+ * 		  keeps the structure alive until proc_release()
  * 
  * @param pid pid of the process to retrieve
- * @return struct proc* process associated to the pid
+ * @return struct proc* process associated to the pid, NULL if there is none
  */
 #if OPT_SHELL
 struct proc *proc_search(pid_t pid) {
 
+	struct proc *proc = NULL;
+
 	/* CHECKING PID CONSTRAINTS */
-	if (pid <= 0 || pid > PROC_MAX) {
+	if (pid <= 0) {
 		return NULL;
 	}
 
-	/* RETRIEVING PROCESS BASED ON THE INDEX PID */
-	struct proc *proc = processTable.proc[pid];
-	if (proc->p_pid != pid) {
-		return NULL;
+	/* RETRIEVING PROCESS BASED ON THE INDEX PID, AND PINNING IT */
+	spinlock_acquire(PROC_STRIPE(pid));
+	if ((unsigned) pid < processTable.size) {
+		proc = processTable.proc[pid];
+		if (proc != NULL) {
+			KASSERT(proc->p_pid == pid);
+			proc->p_refcount++;
+		}
 	}
+	spinlock_release(PROC_STRIPE(pid));
 
 	/* TASK COMPLETED SUCCESSFULLY */
 	return proc;
 }
 #endif
 
+/**
+ * @brief Drop a reference to a process obtained from proc_search(). The structure is
+ * 		  freed when the last reference goes away, which is after proc_destroy().
+ * 
+ * @param proc process to release
+ */
+#if OPT_SHELL
+void proc_release(struct proc *proc) {
+
+	unsigned refs;
+
+	KASSERT(proc->p_pid > 0);
+	spinlock_acquire(PROC_STRIPE(proc->p_pid));
+	KASSERT(proc->p_refcount > 0);
+	refs = --proc->p_refcount;
+	spinlock_release(PROC_STRIPE(proc->p_pid));
+
+	if (refs == 0) {
+		kfree(proc->p_name);
+		PROC_FREE(proc);
+	}
+}
+#endif
+
 /**
  * @brief For any given process, the first file descriptors (0, 1, and 2) are 
  * 		  considered to be standard input (stdin), standard output (stdout), and
  * 		  standard error (stderr). These file descriptors should start out attached 
  * 		  to the console device ("con:").
  * 
- * @param name name that will be assigned to the lock
- * @return int 
+ * @param proc process whose file table is initialized
+ * @param fd file descriptor to initialize
+ * @param flag opening mode of the console
+ * @return zero on success, -1 in case of failure
  */
 #if OPT_SHELL
-static int console_init(const char *lock_name, struct proc *proc, int fd, int flag) {
+static int console_init(struct proc *proc, int fd, int flag) {
 
 	/* ASSIGNMENT OF THE CONSOLE NAME */
 	char *con = kstrdup("con:");
@@ -215,37 +489,44 @@ static int console_init(const char *lock_name, struct proc *proc, int fd, int fl
 		return -1;
 	}
 
-	/* ALLOCATING SPACE IN THE FILETABLE */
-	proc->fileTable[fd] = (struct openfile *) kmalloc(sizeof(struct openfile));
-	if (proc->fileTable[fd] == NULL) {
+	/* ALLOCATING SPACE IN THE SYSTEM FILETABLE */
+	struct openfile *of;
+	if (openfile_alloc(&of) != 0) {
 		kfree(con);
 		return -1;
 	}
 
 	/* OPENING ASSOCIATED FILE */
-	int err = vfs_open(con, flag, 0644, &proc->fileTable[fd]->vn);
+	int err = vfs_open(con, flag, 0644, &of->vn);
 	if (err) {
 		kfree(con);
-		kfree(proc->fileTable[fd]);
+		openfile_release(of);
 		return -1;
 	}
 	kfree(con);
 
 	/* INITIALIZATION OF VALUES */
-	proc->fileTable[fd]->offset = 0;
-	proc->fileTable[fd]->lock = lock_create(lock_name);
-	if (proc->fileTable[fd]->lock == NULL) {
-		vfs_close(proc->fileTable[fd]->vn);
-		kfree(proc->fileTable[fd]);
+	of->offset = 0;
+	of->count_refs = 1;
+	of->mode_open = flag;
+
+	/* INSTALLING ON THE REQUESTED FILE DESCRIPTOR */
+	if (fdtable_prepare(proc, fd) != 0) {
+		vfs_close(of->vn);
+		openfile_release(of);
 		return -1;
 	}
-	proc->fileTable[fd]->count_refs = 1;
-	proc->fileTable[fd]->mode_open = flag;
+	fd_install(proc, fd, of);
 
 	return 0;
 }
 #endif
 
+#if OPT_SHELL
+static struct proc *proc_getparent(struct proc *proc);
+static void proc_charge_faults(struct proc *proc, struct thread *t);
+#endif
+
 /**
  * @brief Add the given process to the process table and manage the PID initialization.
  * 
@@ -256,46 +537,33 @@ static int console_init(const char *lock_name, struct proc *proc, int fd, int fl
 #if OPT_SHELL
 static int proc_init(struct proc *proc, const char *name) {
 
-	/* ACQUIRING THE SPINLOCK */
-	spinlock_acquire(&processTable.lk);
-	proc->p_pid = -1;
-
-	/* SEARCH FREE INDEX IN THE TABLE USING CIRCULAR STRATEGY */
-	int index = processTable.last_pid + 1;
-	index = (index > PROC_MAX) ? 1 : index;		// skipping [0] (kernel process)
-	while (index != processTable.last_pid) {
-		if (processTable.proc[index] == NULL) {
-			processTable.proc[index] = proc;
-			processTable.last_pid = index;
-			proc->p_pid = index;
-			break;
-		}
-		index++;
-		index = (index > PROC_MAX) ? 1 : index;
-	}
-
-	/* RELEASING THE SPINLOCK */
-	spinlock_release(&processTable.lk);
-	if (proc->p_pid <= 0) {
+	/* TAKING A FREE PID AND REGISTERING IN THE PROCESS TABLE (sets p_pid) */
+	if (pid_alloc(proc) <= 0) {
+		proc->p_pid = -1;
 		return proc->p_pid;
 	}
 
 	/* PROCESS STATUS INITIALIZATION */
 	proc->p_status = 0;
+	proc->p_exited = false;
+	proc->p_exiting = false;
+
+	/* ONLY THE FIRST THREAD, FOR NOW */
+	proc->p_uthreads = NULL;
+	proc->p_nexttid = 1;
 
 	/*SETTING FATHER PID AS -1*/
 	/*FOR THE FIRST PROCESS IT WILL NOT BE CHANGED*/
 	proc->parent_pid=-1;
 
 	/*PROCESS CHILDREN LIST INITIALIZATION*/
-	proc->children_list= NULL;
+	proc->p_children = NULL;
+	proc->p_sibprev = NULL;
+	proc->p_sibnext = NULL;
+	proc->p_lastchild = NULL;
 
-	/* PROCESS CV AND LOCK INITIALIZATION */
-	proc->p_cv = cv_create(name);
-  	proc->p_locklock = lock_create(name);
-	if (proc->p_cv == NULL || proc->p_locklock == NULL) {
-		return -1;
-	}
+	/* PROCESS CV IS KEPT BY THE PROCESS CACHE (see proc_ctor) */
+	(void)name;
 
 	/* TASK COMPLETED SUCCESSFULLY */
 	return proc->p_pid;
@@ -311,40 +579,32 @@ static int proc_init(struct proc *proc, const char *name) {
 static int proc_deinit(struct proc *proc) {
 #if OPT_SHELL
 	struct proc* parent_proc;
-	/* ACQUIRING THE SPINLOCK */
-	spinlock_acquire(&processTable.lk);
-
 	/* ACQUIRING PROCESS PID */
 	int index = proc->p_pid;
-	if (index <= 0 || index > PROC_MAX) {
+	if (index <= 0) {
 		return -1;
 	}
 
-	/* RELEASING ENTRY IN PROCESS TABLE */
-	processTable.proc[index] = NULL;
-
-	/* PROCESS CV AND LOCK DESTROY */
-	cv_destroy(proc->p_cv);
-  	lock_destroy(proc->p_locklock);
-
-	/* RELEASING THE SPINLOCK */
-	spinlock_release(&processTable.lk);
+	/* RELEASING ENTRY IN PROCESS TABLE (the PID goes to the end of the free FIFO) */
+	pid_free(index);
 
 	/*DESTROYING THE CHILD LIST AND SETTING CHILDREN AS ORPHANS*/
-	if(destroy_child_list(proc)==-1)
-		return -1;
+	destroy_child_list(proc);
+
+	/* FREEING THE RECORDS OF THREADS NOBODY JOINED */
+	while (proc->p_uthreads != NULL) {
+		struct uthread *ut = proc->p_uthreads;
+		proc->p_uthreads = ut->ut_next;
+		kfree(ut);
+	}
 	
 	/*REMOVING THE PROCESS FROM THE CHILD LIST OF ITS PARENT*/
-	if(proc->parent_pid!=-1){
-		parent_proc=proc_search(proc->parent_pid);
-		if(proc->parent_pid==kproc->p_pid)
-			parent_proc=kproc;			
-		if(parent_proc==NULL)
-			return -1;
-
-		if((remove_child_from_list(parent_proc, proc->p_pid)==-1))
-			return -1;
+	lock_acquire(proc_familylock);
+	parent_proc=proc_getparent(proc);
+	if(parent_proc!=NULL){
+		remove_child_from_list(parent_proc, proc);
 	}
+	lock_release(proc_familylock);
 
 	/* TASK COMPLETED SUCCESSFULLY */
 	return 0;
@@ -360,13 +620,13 @@ proc_create(const char *name)
 {
 	struct proc *proc;
 
-	proc = kmalloc(sizeof(*proc));
+	proc = PROC_ALLOC();
 	if (proc == NULL) {
 		return NULL;
 	}
 	proc->p_name = kstrdup(name);
 	if (proc->p_name == NULL) {
-		kfree(proc);
+		PROC_FREE(proc);
 		return NULL;
 	}
 
@@ -381,15 +641,24 @@ proc_create(const char *name)
 
 #if OPT_SHELL
 
-	/**
-	 * @brief Zeroing out the block of memory used by the process fileTable (i.e.
-	 * 		  initializing the struct).
-	 */
-	bzero(proc->fileTable, OPEN_MAX * sizeof(struct openfile*));
+	/* NO FILE TABLE UNTIL THE FIRST FILE IS OPENED (OR ONE IS SHARED BY fork()) */
+	proc->p_fdtable = NULL;
+
+	/* NOTHING USED YET */
+	bzero(&proc->p_usage, sizeof(proc->p_usage));
+	bzero(&proc->p_cusage, sizeof(proc->p_cusage));
+
+	/* ANY CPU, AT THE DEFAULT PRIORITY */
+	proc->p_affinity = THREAD_ANYCPU;
+	proc->p_nice = 0;
+
+	/* NO FILE LOCKS */
+	proc->p_nrangelocks = 0;
 
 	/* ADD PROCESS TO THE PROCESS TABLE */
 	if (strcmp(name, "[kernel]") != 0 && proc_init(proc, name) <= 0) {
-		kfree(proc);
+		kfree(proc->p_name);
+		PROC_FREE(proc);
 		return NULL;
 	}
 #endif
@@ -429,6 +698,12 @@ proc_destroy(struct proc *proc)
 		proc->p_cwd = NULL;
 	}
 
+#if OPT_SHELL
+	/* DROPPING THE FILE LOCKS AND THE FILE TABLE (the last user closes the files still open) */
+	rangelock_exit(proc);
+	fdtable_release(proc);
+#endif
+
 	/* VM fields */
 	if (proc->p_addrspace) {
 		/*
@@ -484,10 +759,13 @@ proc_destroy(struct proc *proc)
 	if (proc_deinit(proc) != 0) {
 		panic("[ERROR] some errors occurred in the management of the process table\n");
 	}
-#endif
 
+	/* DROPPING THE REFERENCE OF THE TABLE; LOOKUPS STILL IN PROGRESS MAY OUTLIVE US */
+	proc_release(proc);
+#else
 	kfree(proc->p_name);
-	kfree(proc);
+	PROC_FREE(proc);
+#endif
 }
 
 /*
@@ -497,22 +775,47 @@ void
 proc_bootstrap(void)
 {
 
+	/* USER PROCESS INITIALIZATION (TABLE) */
+#if OPT_SHELL
+	spinlock_init(&processTable.lk);	/* lock initialization 								*/
+	for (int i = 0; i < PROC_NSTRIPES; i++) {
+		spinlock_init(&proc_stripes[i]);
+	}
+	processTable.proc = processTable_initproc;
+	processTable.next_free = processTable_initnext;
+	processTable.size = PROC_TABLE_INIT;
+	processTable.nfree = 0;
+	processTable.free_head = processTable.free_tail = 0;
+	spinlock_acquire(&processTable.lk);
+	for (pid_t pid = 1; pid < PROC_TABLE_INIT; pid++) {
+		pid_pushfree(pid);
+	}
+	spinlock_release(&processTable.lk);
+#endif
+
 	/* KERNEL PROCESS INITIALIZATION AND CREATION */
 	kproc = proc_create("[kernel]");
 	if (kproc == NULL) {
 		panic("proc_create for kproc failed\n");
 	}
 
-	/* USER PROCESS INITIALIZATION (TABLE) */
 #if OPT_SHELL
-	spinlock_init(&processTable.lk);	/* lock initialization 								*/
-	processTable.proc[0] = kproc;		/* registering kernel process in the process table 	*/
-	KASSERT(processTable.proc[0] != NULL);
-	for (int i = 1; i <= PROC_MAX; i++) {
-		processTable.proc[i] = NULL;
+	proc_familylock = lock_create("procfamily");
+	if (proc_familylock == NULL) {
+		panic("lock_create for the process family lock failed\n");
 	}
+	kproc->p_pid = 0;
+	kproc->p_exited = false;
+	kproc->p_exiting = false;
+	kproc->p_uthreads = NULL;
+	kproc->p_nexttid = 1;
+	kproc->parent_pid = -1;
+	kproc->p_children = NULL;
+	kproc->p_sibprev = NULL;
+	kproc->p_sibnext = NULL;
+	kproc->p_lastchild = NULL;
+	processTable.proc[0] = kproc;		/* registering kernel process in the process table 	*/
 	processTable.is_active = true;		/* activating the process table 					*/
-	processTable.last_pid = 0;			/* last used PID 									*/
 #endif
 }
 
@@ -540,11 +843,14 @@ proc_create_runprogram(const char *name)
 
 #if OPT_SHELL
 	/* CONSOLE INITIALIZATION FOR STDIN, STDOUT AND STDERR */
-	if (console_init("STDIN", newproc, 0, O_RDONLY) == -1) {
+	if (console_init(newproc, 0, O_RDONLY) == -1) {
+		proc_destroy(newproc);
 		return NULL;
-	} else if (console_init("STDOUT", newproc, 1, O_WRONLY) == -1) {
+	} else if (console_init(newproc, 1, O_WRONLY) == -1) {
+		proc_destroy(newproc);
 		return NULL;
-	} else if (console_init("STDERR", newproc, 2, O_WRONLY) == -1) {
+	} else if (console_init(newproc, 2, O_WRONLY) == -1) {
+		proc_destroy(newproc);
 		return NULL;
 	}
 #endif
@@ -564,6 +870,44 @@ proc_create_runprogram(const char *name)
 	return newproc;
 }
 
+/**
+ * @brief Create a proc for fork(). Like proc_create_runprogram(), but instead of
+ * 		  opening the console again the child shares the file table of the current
+ * 		  process, copy-on-write.
+ *
+ * @param name name of the new process
+ * @return the new process, NULL on failure
+ */
+#if OPT_SHELL
+struct proc *
+proc_create_fork(const char *name)
+{
+	struct proc *newproc;
+
+	newproc = proc_create(name);
+	if (newproc == NULL) {
+		return NULL;
+	}
+
+	/* VM fields */
+	newproc->p_addrspace = NULL;
+
+	/* VFS fields */
+	fdtable_share(curproc, newproc);
+
+	spinlock_acquire(&curproc->p_lock);
+	if (curproc->p_cwd != NULL) {
+		VOP_INCREF(curproc->p_cwd);
+		newproc->p_cwd = curproc->p_cwd;
+	}
+	newproc->p_affinity = curproc->p_affinity;
+	newproc->p_nice = curproc->p_nice;
+	spinlock_release(&curproc->p_lock);
+
+	return newproc;
+}
+#endif
+
 /*
  * Add a thread to a process. Either the thread or the process might
  * or might not be current.
@@ -582,6 +926,11 @@ proc_addthread(struct proc *proc, struct thread *t)
 
 	spinlock_acquire(&proc->p_lock);
 	proc->p_numthreads++;
+#if OPT_SHELL
+	if (proc != kproc) {
+		t->t_nice = proc->p_nice;
+	}
+#endif
 	spinlock_release(&proc->p_lock);
 
 	spl = splhigh();
@@ -593,17 +942,19 @@ proc_addthread(struct proc *proc, struct thread *t)
 
 /*
  * Remove a thread from its process. Either the thread or the process
- * might or might not be current.
+ * might or might not be current. Returns the number of threads left,
+ * so that of several threads leaving at once exactly one sees zero.
  *
  * Turn off interrupts on the local cpu while changing t_proc, in
  * case it's current, to protect against the as_activate call in
  * the timer interrupt context switch, and any other implicit uses
  * of "curproc".
  */
-void
+unsigned
 proc_remthread(struct thread *t)
 {
 	struct proc *proc;
+	unsigned left;
 	int spl;
 
 	proc = t->t_proc;
@@ -611,12 +962,17 @@ proc_remthread(struct thread *t)
 
 	spinlock_acquire(&proc->p_lock);
 	KASSERT(proc->p_numthreads > 0);
-	proc->p_numthreads--;
+	left = --proc->p_numthreads;
+#if OPT_SHELL
+	proc_charge_faults(proc, t);
+#endif
 	spinlock_release(&proc->p_lock);
 
 	spl = splhigh();
 	t->t_proc = NULL;
 	splx(spl);
+
+	return left;
 }
 
 
@@ -666,113 +1022,1092 @@ proc_setas(struct addrspace *newas)
 
 
 /*
- * Adds a new child to the children list. If It is not possible, it returns -1, otherwise 0.
+ * Fills in the process page of the kernel info pages (see kern/kinfo.h) of the
+ * address space of proc, if it has any: called when a program is loaded and when
+ * the parent pid changes. parent_pid is read under p_lock, after whoever changed
+ * it has done so, so the last update always sees the last value.
  */
 #if OPT_SHELL
-int add_new_child(struct proc* proc, pid_t child_pid){
-	struct child_list* app=proc->children_list;
-
-	if(proc->children_list==NULL){
-		proc->children_list=(struct child_list *) kmalloc(sizeof(struct child_list));
-		if(proc->children_list==NULL)
-			return -1;
-		proc->children_list->next_child=NULL;
-		proc->children_list->child_pid=child_pid;
-		return 0;
-	}
-		
+void proc_kinfo_update(struct proc *proc){
+	struct kinfo_proc *kp;
 
-	while(app->next_child!=NULL){
-		app=app->next_child;
+	spinlock_acquire(&proc->p_lock);
+	if(proc->p_addrspace!=NULL){
+		kp=as_kinfo(proc->p_addrspace);
+		if(kp!=NULL){
+			kp->kp_pid=proc->p_pid;
+			kp->kp_ppid=proc->parent_pid;
+		}
 	}
-
-	app->next_child=(struct child_list *) kmalloc(sizeof(struct child_list));
-	if(app->next_child==NULL)
-		return -1;
-	app->next_child->next_child=NULL;
-	app->next_child->child_pid=child_pid;
-	return 0;
+	spinlock_release(&proc->p_lock);
 }
 #endif
 
 
 /*
- * Destroys the child_list of a parent process which is being destroyed.
- * Sets the childrens's parent pid to -1, the "root" process.
- * If It is not possible, it returns -1, otherwise 0.
+ * Adds a new child at the head of the children list and links it to its father.
+ * Children are chained through their p_sibprev/p_sibnext fields, so this takes
+ * constant time and never allocates. The father also keeps the child as its
+ * p_lastchild, as the one it is most likely to wait for next.
  */
 #if OPT_SHELL
-int destroy_child_list(struct proc* proc){
-	struct child_list* app=proc->children_list;
-	struct proc* child_proc;
+void add_new_child(struct proc* proc, struct proc* child){
+	lock_acquire(proc_familylock);
+	KASSERT(child->parent_pid==-1);
+	child->parent_pid=proc->p_pid;
+	child->p_sibprev=NULL;
+	child->p_sibnext=proc->p_children;
+	if(proc->p_children!=NULL)
+		proc->p_children->p_sibprev=child;
+	proc->p_children=child;
+	proc->p_lastchild=child;
+	lock_release(proc_familylock);
+
+	/* A FORKED CHILD ALREADY HAS ITS ADDRESS SPACE */
+	proc_kinfo_update(child);
+}
+#endif
 
 
-	while(app!=NULL){
-		proc->children_list=app->next_child;
+/*
+ * Destroys the child list of a parent process which is exiting or being destroyed.
+ * Sets the childrens's parent pid to -1, the "root" process; children which have
+ * already exited will never be waited for, so they are reaped here, by the worker
+ * thread as in proc_wait(), so that the exit of a parent with many zombies left is
+ * not held up by them.
+ */
+#if OPT_SHELL
+static void proc_reap_work(void *arg);
 
-		/*FINDING THE CHILD STRUCTURE*/
-		child_proc=proc_search(app->child_pid);
-		if(child_proc==NULL)
-			return -1;
+void destroy_child_list(struct proc* proc){
+	struct proc* child_proc;
 
-		/*SETTING THE PARENT PID AS -1*/	
-		child_proc->parent_pid=-1;
+	lock_acquire(proc_familylock);
+	while(proc->p_children!=NULL){
+		child_proc=proc->p_children;
 
-		/*REMOVING THE CHILD*/
-		app->next_child=NULL;
-		kfree(app);
+		/*SETTING THE PARENT PID AS -1*/
+		remove_child_from_list(proc, child_proc);
 
-		app=proc->children_list;
+		/*HANDING THE ZOMBIES NOBODY WILL WAIT FOR TO THE WORKER (work_schedule never sleeps)*/
+		if(child_proc->p_exited){
+			work_init(&child_proc->p_reapwork, proc_reap_work, child_proc);
+			work_schedule(&child_proc->p_reapwork);
+		}
 	}
-	
-	return 0;
+	lock_release(proc_familylock);
 }
 #endif
 
 /*
- * Removes the child (which is being destroyed) from the child list of its parent process.
- * If It is not possible, it returns -1, otherwise 0.
+ * Removes the child (which is exiting or being destroyed) from the child list of its
+ * parent process, in constant time, and sets its parent pid to -1. If the parent
+ * had it as p_lastchild, that is dropped too, so p_lastchild never outlives the link.
+ * The family lock must be held.
  */
 #if OPT_SHELL
-int remove_child_from_list(struct proc* proc, pid_t child_pid){
-	struct child_list* app=proc->children_list;
-	struct child_list* prev_child=NULL;
+void remove_child_from_list(struct proc* proc, struct proc* child){
+	KASSERT(lock_do_i_hold(proc_familylock));
+	KASSERT(child->parent_pid==proc->p_pid);
+
+	if(child->p_sibprev==NULL)
+		proc->p_children=child->p_sibnext;
+	else
+		child->p_sibprev->p_sibnext=child->p_sibnext;
+	if(child->p_sibnext!=NULL)
+		child->p_sibnext->p_sibprev=child->p_sibprev;
+
+	if(proc->p_lastchild==child)
+		proc->p_lastchild=NULL;
+
+	child->p_sibprev=NULL;
+	child->p_sibnext=NULL;
+	child->parent_pid=-1;
+	proc_kinfo_update(child);
+}
+#endif
 
 
-	while(app!=NULL){
-		if(app->child_pid==child_pid){
-			if(prev_child==NULL)
-				proc->children_list=app->next_child;
-			else
-				prev_child->next_child=app->next_child;
-			kfree(app);
-			return 0;
-		}
-		prev_child=app;
-		app=app->next_child;
+/*
+ * Returns the child of the parent process with pid child_pid, or NULL if that
+ * process is not a son of the parent. Looks at the child's parent pid, so it
+ * does not walk the children list; the newest child (the one a shell waits for,
+ * again and again while it runs) is found without going to the process table.
+ * The family lock must be held.
+ */
+#if OPT_SHELL
+static struct proc* proc_getchild(struct proc* proc, pid_t child_pid){
+	struct proc* child;
+	bool mine;
+
+	KASSERT(lock_do_i_hold(proc_familylock));
+
+	/* STILL LINKED TO US, OR IT WOULD HAVE BEEN DROPPED */
+	child=proc->p_lastchild;
+	if(child!=NULL && child->p_pid==child_pid){
+		KASSERT(child->parent_pid==proc->p_pid);
+		return child;
 	}
-	
-	return -1;
+
+	child=proc_search(child_pid);
+	if(child==NULL)
+		return NULL;
+	mine=(child->parent_pid==proc->p_pid);
+
+	/* A CHILD CANNOT BE DESTROYED BY ANYONE ELSE WHILE WE HOLD THE LOCK */
+	proc_release(child);
+	return mine ? child : NULL;
 }
 #endif
 
 
 /*
  * Checks if the process with pid child_pid is a son of the parent process
+ * The family lock must be held.
  * If It is not a child, it returns -1, otherwise 0.
  */
 #if OPT_SHELL
 int is_child(struct proc* proc, pid_t child_pid){
-	struct child_list* app=proc->children_list;
+	return proc_getchild(proc, child_pid)!=NULL ? 0 : -1;
+}
+#endif
 
 
-	while(app!=NULL){
-		if(app->child_pid==child_pid){
-			return 0;
-		}
-		app=app->next_child;
+/**
+ * @brief Return the parent of the given process, or NULL if it is an orphan. The
+ * 		  family lock must be held; the parent cannot go away while it is, since it
+ * 		  would first have to orphan its children.
+ */
+#if OPT_SHELL
+static struct proc *proc_getparent(struct proc *proc) {
+
+	struct proc *parent;
+
+	KASSERT(lock_do_i_hold(proc_familylock));
+
+	if (proc->parent_pid == -1) {
+		return NULL;
+	} else if (proc->parent_pid == kproc->p_pid) {
+		return kproc;
 	}
-	
-	return -1;
+
+	/* NO NEED TO KEEP THE REFERENCE (see above) */
+	parent = proc_search(proc->parent_pid);
+	if (parent != NULL) {
+		proc_release(parent);
+	}
+	return parent;
 }
-#endif
\ No newline at end of file
+#endif
+
+/**
+ * @brief Turn the given (exiting) process into a zombie: orphan its children, then
+ * 		  record that it has exited and wake up its parent. Its threads must already
+ * 		  be gone.
+ * 
+ * @param proc exiting process, whose p_status is already set
+ * @return true if the parent will reap it, false if it is an orphan, which the caller
+ * 		   must destroy itself
+ */
+#if OPT_SHELL
+bool proc_exit(struct proc *proc) {
+
+	struct proc *parent;
+
+	KASSERT(proc->p_numthreads == 0);
+
+	/* ORPHANING OUR CHILDREN (destroying those which already exited) */
+	destroy_child_list(proc);
+
+	/* BECOMING A ZOMBIE, IF SOMEBODY CAN STILL WAIT FOR US */
+	lock_acquire(proc_familylock);
+	parent = proc_getparent(proc);
+	if (parent != NULL) {
+		proc->p_exited = true;
+		cv_broadcast(parent->p_cv, proc_familylock);
+		pollhead_wakeup(&parent->p_childpoll);
+	}
+	lock_release(proc_familylock);
+
+	return parent != NULL;
+}
+#endif
+
+/**
+ * @brief Add the usage in from to the one in to.
+ */
+#if OPT_SHELL
+static void procusage_add(struct procusage *to, const struct procusage *from) {
+
+	to->pu_utime += from->pu_utime;
+	to->pu_stime += from->pu_stime;
+	to->pu_faults += from->pu_faults;
+	to->pu_majfaults += from->pu_majfaults;
+	to->pu_inbytes += from->pu_inbytes;
+	to->pu_outbytes += from->pu_outbytes;
+	to->pu_nsyscalls += from->pu_nsyscalls;
+	for (unsigned i = 0; i < PROC_NSYSCALLS; i++) {
+		to->pu_syscalls[i] += from->pu_syscalls[i];
+	}
+}
+#endif
+
+/**
+ * @brief Destroy a reaped zombie. Run by a worker thread (see proc_wait()).
+ */
+#if OPT_SHELL
+static void proc_reap_work(void *arg) {
+
+	proc_destroy(arg);
+}
+#endif
+
+/**
+ * @brief Wait for a child of the current process to exit, and reap it.
+ * 
+ * @param pid child to wait for, or WAIT_ANY for any child
+ * @param options zero or WNOHANG
+ * @param status exit status of the child (kernel pointer)
+ * @param retpid pid of the child reaped, or 0 if WNOHANG was given and no child
+ * 		  has exited yet
+ * @return zero on success, ECHILD if there is no such child, EINVAL for bad options
+ */
+#if OPT_SHELL
+int proc_wait(pid_t pid, int options, int *status, pid_t *retpid) {
+
+	struct proc *child;
+	int status_ret;
+	pid_t pid_ret;
+
+	if ((options & ~WNOHANG) != 0) {
+		return EINVAL;
+	}
+
+	lock_acquire(proc_familylock);
+	while (true) {
+
+		/* LOOKING FOR A MATCHING CHILD WHICH HAS ALREADY EXITED */
+		if (pid == WAIT_ANY) {
+			if (curproc->p_children == NULL) {
+				lock_release(proc_familylock);
+				return ECHILD;
+			}
+			for (child = curproc->p_children; child != NULL; child = child->p_sibnext) {
+				if (child->p_exited) {
+					break;
+				}
+			}
+		} else {
+			child = proc_getchild(curproc, pid);
+			if (child == NULL) {
+				lock_release(proc_familylock);
+				return ECHILD;
+			} else if (!child->p_exited) {
+				child = NULL;
+			}
+		}
+
+		if (child != NULL) {
+			break;
+		} else if (options & WNOHANG) {
+			lock_release(proc_familylock);
+			*retpid = 0;
+			return 0;
+		}
+
+		/* ANOTHER THREAD CALLED _exit(): THIS ONE HAS TO GO TOO */
+		if (curproc->p_exiting) {
+			lock_release(proc_familylock);
+			return EINTR;
+		}
+
+		/* SLEEPING UNTIL ONE OF OUR CHILDREN EXITS (no wakeup can be missed under the lock) */
+		cv_wait(curproc->p_cv, proc_familylock);
+	}
+
+	/* DETACHING THE ZOMBIE FROM US, SO THAT proc_destroy() DOES NOT LOOK FOR ITS PARENT */
+	remove_child_from_list(curproc, child);
+	lock_release(proc_familylock);
+
+	/* THE CHILD'S USAGE, AND ITS CHILDREN'S, NOW COUNT AS OURS (it has no threads left) */
+	spinlock_acquire(&curproc->p_lock);
+	procusage_add(&curproc->p_cusage, &child->p_usage);
+	procusage_add(&curproc->p_cusage, &child->p_cusage);
+	spinlock_release(&curproc->p_lock);
+
+	/*
+	 * REAPING (proc_destroy() drops the last reference); TEARING DOWN THE ADDRESS SPACE
+	 * AND THE FILES IS LEFT TO A WORKER THREAD, SO THAT waitpid() RETURNS RIGHT AWAY
+	 */
+	status_ret = child->p_status;
+	pid_ret = child->p_pid;
+	work_init(&child->p_reapwork, proc_reap_work, child);
+	work_schedule(&child->p_reapwork);
+	*status = status_ret;
+	*retpid = pid_ret;
+	return 0;
+}
+#endif
+
+/**
+ * @brief Readiness of the child-exit descriptor for poll(): a child of the current
+ * 		  process that can be reaped makes it readable, having no children at all hangs
+ * 		  it up. Registered under the family lock, as proc_exit() wakes it under it.
+ * 
+ * @param pe poll entry to register, or NULL just to look
+ * @return POLLIN, POLLHUP or 0
+ */
+#if OPT_SHELL
+int proc_pollchildren(struct pollent *pe) {
+
+	struct proc *child;
+	int ready;
+
+	lock_acquire(proc_familylock);
+	pollhead_register(&curproc->p_childpoll, pe);
+	ready = (curproc->p_children == NULL) ? POLLHUP : 0;
+	for (child = curproc->p_children; child != NULL; child = child->p_sibnext) {
+		if (child->p_exited) {
+			ready = POLLIN;
+			break;
+		}
+	}
+	lock_release(proc_familylock);
+
+	return ready;
+}
+#endif
+
+/**
+ * @brief Register pe so that a poll() sleeping in this process is woken when another
+ * 		  thread calls _exit(), and tell whether that already happened.
+ * 
+ * @param pe poll entry to register
+ * @return true if the process is exiting
+ */
+#if OPT_SHELL
+bool proc_pollexiting(struct pollent *pe) {
+
+	bool exiting;
+
+	lock_acquire(proc_familylock);
+	pollhead_register(&curproc->p_childpoll, pe);
+	exiting = curproc->p_exiting;
+	lock_release(proc_familylock);
+
+	return exiting;
+}
+#endif
+
+/**
+ * @brief Make the join record of a new user thread of the given process, with a fresh
+ * 		  thread id, and put it on the process list.
+ * 
+ * @param proc process the thread will belong to
+ * @return the record, NULL if out of memory
+ */
+#if OPT_SHELL
+struct uthread *proc_uthread_add(struct proc *proc) {
+
+	struct uthread *ut;
+
+	ut = kmalloc(sizeof(struct uthread));
+	if (ut == NULL) {
+		return NULL;
+	}
+	ut->ut_status = 0;
+	ut->ut_exited = false;
+	ut->ut_joining = false;
+
+	lock_acquire(proc_familylock);
+	ut->ut_tid = proc->p_nexttid++;
+	if (proc->p_nexttid <= 0) {
+		proc->p_nexttid = 1;		// 0 stands for the first thread
+	}
+	ut->ut_next = proc->p_uthreads;
+	proc->p_uthreads = ut;
+	lock_release(proc_familylock);
+
+	return ut;
+}
+#endif
+
+/**
+ * @brief Take off the list and free the record of a thread which could not be started.
+ */
+#if OPT_SHELL
+void proc_uthread_forget(struct proc *proc, struct uthread *ut) {
+
+	struct uthread **pp;
+
+	lock_acquire(proc_familylock);
+	for (pp = &proc->p_uthreads; *pp != ut; pp = &(*pp)->ut_next) {
+		KASSERT(*pp != NULL);
+	}
+	*pp = ut->ut_next;
+	lock_release(proc_familylock);
+
+	kfree(ut);
+}
+#endif
+
+/**
+ * @brief Wait for the user thread tid of the current process to exit, then free its
+ * 		  record.
+ * 
+ * @param tid thread to wait for
+ * @param status value the thread passed to __thread_exit() (kernel pointer)
+ * @return zero on success, ESRCH if there is no such thread, EINVAL if it is the caller
+ * 		   or another thread is already joining it, EINTR if the process is exiting
+ */
+#if OPT_SHELL
+int proc_uthread_join(pid_t tid, int *status) {
+
+	struct proc *proc = curproc;
+	struct uthread *ut, **pp;
+
+	lock_acquire(proc_familylock);
+	for (ut = proc->p_uthreads; ut != NULL; ut = ut->ut_next) {
+		if (ut->ut_tid == tid) {
+			break;
+		}
+	}
+	if (ut == NULL) {
+		lock_release(proc_familylock);
+		return ESRCH;
+	} else if (ut == curthread->t_uthread || ut->ut_joining) {
+		lock_release(proc_familylock);
+		return EINVAL;
+	}
+
+	/* SLEEPING UNTIL IT EXITS (or until the whole process does) */
+	ut->ut_joining = true;
+	while (!ut->ut_exited && !proc->p_exiting) {
+		cv_wait(proc->p_cv, proc_familylock);
+	}
+	if (!ut->ut_exited) {
+		ut->ut_joining = false;
+		lock_release(proc_familylock);
+		return EINTR;
+	}
+
+	/* UNLINKING THE RECORD (the list may have changed while we slept) */
+	for (pp = &proc->p_uthreads; *pp != ut; pp = &(*pp)->ut_next) {
+		KASSERT(*pp != NULL);
+	}
+	*pp = ut->ut_next;
+	lock_release(proc_familylock);
+
+	*status = ut->ut_status;
+	kfree(ut);
+	return 0;
+}
+#endif
+
+/**
+ * @brief Start the exit of the whole process. The first caller sets the exit status;
+ * 		  the other threads leave at their next return to user mode, or as soon as
+ * 		  they wake up if they are waiting for a child, a thread or a futex.
+ * 
+ * @param proc exiting process
+ * @param status encoded exit status
+ */
+#if OPT_SHELL
+void proc_setexiting(struct proc *proc, int status) {
+
+	lock_acquire(proc_familylock);
+	if (!proc->p_exiting) {
+		proc->p_status = status;
+		proc->p_exiting = true;
+	}
+	cv_broadcast(proc->p_cv, proc_familylock);
+	pollhead_wakeup(&proc->p_childpoll);
+	lock_release(proc_familylock);
+
+	/* WAKING THE THREADS SLEEPING ON A FUTEX OR ON A FILE LOCK TOO */
+	futex_wakeproc(proc);
+	rangelock_wakeproc(proc);
+}
+#endif
+
+/**
+ * @brief Kill, as if by SIGKILL, the user process with the most memory committed to its
+ * 		  address space (see as_committed()) among those not exiting yet. Called by the
+ * 		  VM system when a page fault finds no memory left; the victim's memory goes
+ * 		  back when the last of its threads leaves.
+ * 
+ * @return pid of the victim, 0 if there was none
+ */
+#if OPT_SHELL
+pid_t proc_oomkill(void) {
+
+	struct proc *proc, *victim = NULL;
+	unsigned long pages, most = 0;
+	unsigned size;
+	pid_t pid;
+
+	spinlock_acquire(&processTable.lk);
+	size = processTable.size;
+	spinlock_release(&processTable.lk);
+
+	/* AS IN proc_printstats, PROCESSES MAY COME AND GO DURING THE SCAN */
+	for (pid = 1; (unsigned) pid < size; pid++) {
+		proc = proc_search(pid);
+		if (proc == NULL) {
+			continue;
+		}
+		/* (THE ADDRESS SPACE IS DESTROYED ONLY AFTER IT IS TAKEN AWAY UNDER p_lock) */
+		spinlock_acquire(&proc->p_lock);
+		pages = proc->p_addrspace != NULL ? as_committed(proc->p_addrspace) : 0;
+		spinlock_release(&proc->p_lock);
+		if (pages > most && !proc->p_exiting) {
+			if (victim != NULL) {
+				proc_release(victim);
+			}
+			victim = proc;
+			most = pages;
+		} else {
+			proc_release(proc);
+		}
+	}
+	if (victim == NULL) {
+		return 0;
+	}
+
+	/* MARKING THE ADDRESS SPACE FIRST, SO THAT FAULTS WAIT FOR IT TO BE DESTROYED */
+	spinlock_acquire(&victim->p_lock);
+	if (victim->p_addrspace != NULL) {
+		as_oomvictim(victim->p_addrspace);
+	}
+	spinlock_release(&victim->p_lock);
+
+	kprintf("Out of memory: killing process %d (%s), %lu pages committed\n",
+		victim->p_pid, victim->p_name, most);
+	proc_setexiting(victim, _MKWAIT_SIG(SIGKILL));
+
+	pid = victim->p_pid;
+	proc_release(victim);
+	return pid;
+}
+#endif
+
+/**
+ * @brief Make the current thread leave its user process. status goes to whoever joins
+ * 		  the thread; the last thread to leave releases the address space and the files
+ * 		  and turns the process into a zombie (or destroys it, if it is an orphan).
+ * 
+ * @param status value reported to the joiner of this thread
+ */
+#if OPT_SHELL
+void proc_thread_exit(int status) {
+
+	struct proc *proc = curproc;
+	struct uthread *ut = curthread->t_uthread;
+	struct addrspace *as;
+
+	KASSERT(proc != NULL && proc != kproc);
+
+	/* HANDING THE STATUS TO OUR JOINER (who may free the record at once) */
+	if (ut != NULL) {
+		curthread->t_uthread = NULL;
+		lock_acquire(proc_familylock);
+		ut->ut_status = status;
+		ut->ut_exited = true;
+		cv_broadcast(proc->p_cv, proc_familylock);
+		lock_release(proc_familylock);
+	}
+
+	/* LEAVING THE PROCESS: OF SEVERAL THREADS LEAVING AT ONCE, ONLY THE LAST GOES ON */
+	if (proc_remthread(curthread) > 0) {
+		thread_exit();
+	}
+
+	/* A ZOMBIE KEEPS ONLY ITS STATUS: RELEASING MEMORY AND FILES NOW */
+	spinlock_acquire(&proc->p_lock);
+	as = proc->p_addrspace;
+	proc->p_addrspace = NULL;
+	spinlock_release(&proc->p_lock);
+	if (as != NULL) {
+		as_destroy(as);
+	}
+	rangelock_exit(proc);
+	fdtable_release(proc);
+
+	/* SIGNALLING THE TERMINATION OF THE PROCESS (an orphan reaps itself) */
+	if (!proc_exit(proc)) {
+		proc_destroy(proc);
+	}
+
+	/* THE LAST THREAD TERMINATES HERE. BYE BYE */
+	thread_exit();
+}
+#endif
+
+/**
+ * @brief Add to the process the faults the thread counted since they were last charged.
+ * 		  p_lock must be held, and the thread must be current (or not running): its
+ * 		  counters are written without a lock, by the thread itself.
+ */
+#if OPT_SHELL
+static void proc_charge_faults(struct proc *proc, struct thread *t) {
+
+	unsigned faults = t->t_faults, majfaults = t->t_majfaults;
+
+	KASSERT(spinlock_do_i_hold(&proc->p_lock));
+
+	proc->p_usage.pu_faults += faults - t->t_faults_charged;
+	proc->p_usage.pu_majfaults += majfaults - t->t_majfaults_charged;
+	t->t_faults_charged = faults;
+	t->t_majfaults_charged = majfaults;
+}
+#endif
+
+/**
+ * @brief Give a thread of a user process the CPU mask set by proc_setaffinity(), and
+ * 		  the nice value set by proc_setnice(). Called with p_lock held on the thread's
+ * 		  way into the kernel, by the thread itself: if the mask leaves out the current
+ * 		  CPU, thread_switch() moves it at the next yield (hardclock() ticks it right
+ * 		  after charging the tick). Kernel threads keep what thread_setaffinity() and
+ * 		  thread_fork() gave them.
+ * 
+ * @param proc process of the thread
+ * @param t the current thread
+ */
+#if OPT_SHELL
+static void proc_sync_sched(struct proc *proc, struct thread *t) {
+
+	KASSERT(spinlock_do_i_hold(&proc->p_lock));
+
+	if (proc != kproc) {
+		t->t_affinity = proc->p_affinity;
+		t->t_nice = proc->p_nice;
+	}
+}
+#endif
+
+/**
+ * @brief Charge a hardclock to the current process. Called by hardclock(), in interrupt
+ * 		  context, which is also where the faults of a thread that makes no system calls
+ * 		  get charged.
+ * 
+ * @param user the clock interrupted user mode
+ */
+#if OPT_SHELL
+void proc_charge_tick(bool user) {
+
+	struct proc *proc = curproc;
+
+	/* A THREAD ON ITS WAY OUT, OR BOOT */
+	if (proc == NULL) {
+		return;
+	}
+
+	/* IN TIME RATHER THAN TICKS, AS HZ CAN CHANGE */
+	spinlock_acquire(&proc->p_lock);
+	if (user) {
+		proc->p_usage.pu_utime += 1000000 / hz;
+	} else {
+		proc->p_usage.pu_stime += 1000000 / hz;
+	}
+	proc_charge_faults(proc, curthread);
+	proc_sync_sched(proc, curthread);
+	spinlock_release(&proc->p_lock);
+}
+#endif
+
+/**
+ * @brief Charge a system call to the current process, at its start (_exit and a
+ * 		  successful execv never return).
+ * 
+ * @param callno system call number
+ */
+#if OPT_SHELL
+void proc_charge_syscall(int callno) {
+
+	struct proc *proc = curproc;
+
+	spinlock_acquire(&proc->p_lock);
+	proc->p_usage.pu_nsyscalls++;
+	if (callno >= 0 && callno < PROC_NSYSCALLS) {
+		proc->p_usage.pu_syscalls[callno]++;
+	}
+	proc_charge_faults(proc, curthread);
+	proc_sync_sched(proc, curthread);
+	spinlock_release(&proc->p_lock);
+}
+#endif
+
+/**
+ * @brief Charge the bytes moved by a read or a write to the current process.
+ * 
+ * @param write true for a write, false for a read
+ * @param len bytes transferred
+ */
+#if OPT_SHELL
+void proc_charge_io(bool write, size_t len) {
+
+	struct proc *proc = curproc;
+
+	if (len == 0) {
+		return;
+	}
+
+	spinlock_acquire(&proc->p_lock);
+	if (write) {
+		proc->p_usage.pu_outbytes += len;
+	} else {
+		proc->p_usage.pu_inbytes += len;
+	}
+	spinlock_release(&proc->p_lock);
+}
+#endif
+
+/**
+ * @brief Convert microseconds to a struct timeval.
+ */
+#if OPT_SHELL
+static void usecs_to_timeval(uint64_t usecs, struct timeval *tv) {
+
+	tv->tv_sec = usecs / 1000000;
+	tv->tv_usec = usecs % 1000000;
+}
+#endif
+
+/**
+ * @brief Fill in a struct rusage with the usage of the current process or of its
+ * 		  reaped children. Fields we do not keep are zero.
+ * 
+ * @param who RUSAGE_SELF or RUSAGE_CHILDREN
+ * @param ru result (kernel pointer)
+ * @return zero on success, EINVAL for a bad who
+ */
+#if OPT_SHELL
+int proc_getusage(int who, struct rusage *ru) {
+
+	struct proc *proc = curproc;
+	struct procusage *pu;
+
+	if (who == RUSAGE_SELF) {
+		pu = &proc->p_usage;
+	} else if (who == RUSAGE_CHILDREN) {
+		pu = &proc->p_cusage;
+	} else {
+		return EINVAL;
+	}
+
+	bzero(ru, sizeof(*ru));
+	spinlock_acquire(&proc->p_lock);
+	if (who == RUSAGE_SELF) {
+		proc_charge_faults(proc, curthread);
+	}
+	usecs_to_timeval(pu->pu_utime, &ru->ru_utime);
+	usecs_to_timeval(pu->pu_stime, &ru->ru_stime);
+	ru->ru_minflt = pu->pu_faults - pu->pu_majfaults;
+	ru->ru_majflt = pu->pu_majfaults;
+	ru->ru_nsyscalls = pu->pu_nsyscalls;
+	ru->ru_inbytes = pu->pu_inbytes;
+	ru->ru_outbytes = pu->pu_outbytes;
+	spinlock_release(&proc->p_lock);
+
+	return 0;
+}
+#endif
+
+/**
+ * @brief Print one line of the process list. The process must be pinned (kproc, or a
+ * 		  reference from proc_search()); the line is a snapshot, taken under the locks.
+ * 
+ * @param proc process to print
+ * @param syscalls where to copy its per-number system call counts, or NULL
+ */
+#if OPT_SHELL
+static void proc_printone(struct proc *proc, uint32_t *syscalls) {
+
+	struct procusage pu;
+	pid_t ppid;
+	unsigned nthreads;
+	char state;
+
+	lock_acquire(proc_familylock);
+	ppid = proc->parent_pid;
+	state = proc->p_exited ? 'Z' : proc->p_exiting ? 'E' : 'R';
+	lock_release(proc_familylock);
+
+	/* ONLY THE SCALARS, THE WHOLE ARRAY IS TOO BIG FOR THE STACK */
+	spinlock_acquire(&proc->p_lock);
+	nthreads = proc->p_numthreads;
+	pu.pu_utime = proc->p_usage.pu_utime;
+	pu.pu_stime = proc->p_usage.pu_stime;
+	pu.pu_faults = proc->p_usage.pu_faults;
+	pu.pu_majfaults = proc->p_usage.pu_majfaults;
+	pu.pu_inbytes = proc->p_usage.pu_inbytes;
+	pu.pu_outbytes = proc->p_usage.pu_outbytes;
+	pu.pu_nsyscalls = proc->p_usage.pu_nsyscalls;
+	if (syscalls != NULL) {
+		memcpy(syscalls, proc->p_usage.pu_syscalls, sizeof(proc->p_usage.pu_syscalls));
+	}
+	spinlock_release(&proc->p_lock);
+
+	kprintf("%5d %5d %c %3u %5u.%02u %5u.%02u %8u %7u %6u %10llu %10llu %s\n",
+		proc->p_pid, ppid, state, nthreads,
+		(unsigned) (pu.pu_utime / 1000000), (unsigned) (pu.pu_utime % 1000000 / 10000),
+		(unsigned) (pu.pu_stime / 1000000), (unsigned) (pu.pu_stime % 1000000 / 10000),
+		pu.pu_nsyscalls, pu.pu_faults, pu.pu_majfaults,
+		(unsigned long long) pu.pu_inbytes, (unsigned long long) pu.pu_outbytes,
+		proc->p_name);
+}
+#endif
+
+/**
+ * @brief Print the processes and their resource usage (the "ps" menu command). The
+ * 		  kernel's times include the kernel threads, but not the idle loop.
+ * 
+ * @param pid if positive, print only this process, with its system calls by number
+ */
+#if OPT_SHELL
+void proc_printstats(pid_t pid) {
+
+	struct proc *proc;
+	uint32_t *syscalls;
+	unsigned size;
+
+	kprintf("  PID  PPID S THR  USER(s)   SYS(s) SYSCALLS  FAULTS MAJFLT "
+		"     READ     WRITTEN NAME\n");
+
+	if (pid > 0) {
+		proc = proc_search(pid);
+		if (proc == NULL) {
+			kprintf("No process %d\n", pid);
+			return;
+		}
+		syscalls = kmalloc(PROC_NSYSCALLS * sizeof(uint32_t));
+		proc_printone(proc, syscalls);
+		proc_release(proc);
+		if (syscalls == NULL) {
+			return;
+		}
+		kprintf("System calls by number:\n");
+		for (unsigned i = 0; i < PROC_NSYSCALLS; i++) {
+			if (syscalls[i] != 0) {
+				kprintf("    %3u: %u\n", i, syscalls[i]);
+			}
+		}
+		kfree(syscalls);
+		return;
+	}
+
+	/* THE KERNEL IS NOT FOUND BY proc_search(), BUT IT NEVER GOES AWAY */
+	proc_printone(kproc, NULL);
+
+	spinlock_acquire(&processTable.lk);
+	size = processTable.size;
+	spinlock_release(&processTable.lk);
+
+	/* A PROCESS THAT COMES OR GOES DURING THE SCAN MAY OR MAY NOT BE LISTED */
+	for (pid = 1; (unsigned) pid < size; pid++) {
+		proc = proc_search(pid);
+		if (proc != NULL) {
+			proc_printone(proc, NULL);
+			proc_release(proc);
+		}
+	}
+}
+#endif
+
+/**
+ * @brief Add the usage of one process to a kstat snapshot; times are in usecs.
+ */
+#if OPT_SHELL
+static void proc_kstatone(struct kstat *ks, struct proc *proc) {
+
+	struct procusage pu;
+	unsigned nthreads;
+	pid_t pid = proc->p_pid;
+
+	spinlock_acquire(&proc->p_lock);
+	nthreads = proc->p_numthreads;
+	pu.pu_utime = proc->p_usage.pu_utime;
+	pu.pu_stime = proc->p_usage.pu_stime;
+	pu.pu_faults = proc->p_usage.pu_faults;
+	pu.pu_majfaults = proc->p_usage.pu_majfaults;
+	pu.pu_inbytes = proc->p_usage.pu_inbytes;
+	pu.pu_outbytes = proc->p_usage.pu_outbytes;
+	pu.pu_nsyscalls = proc->p_usage.pu_nsyscalls;
+	spinlock_release(&proc->p_lock);
+
+	kstat_put(ks, nthreads, "proc.%d.threads", pid);
+	kstat_put(ks, pu.pu_utime, "proc.%d.utime", pid);
+	kstat_put(ks, pu.pu_stime, "proc.%d.stime", pid);
+	kstat_put(ks, pu.pu_nsyscalls, "proc.%d.syscalls", pid);
+	kstat_put(ks, pu.pu_faults, "proc.%d.faults", pid);
+	kstat_put(ks, pu.pu_majfaults, "proc.%d.majfaults", pid);
+	kstat_put(ks, pu.pu_inbytes, "proc.%d.inbytes", pid);
+	kstat_put(ks, pu.pu_outbytes, "proc.%d.outbytes", pid);
+}
+
+void proc_kstat(struct kstat *ks) {
+
+	struct proc *proc;
+	unsigned size;
+	pid_t pid;
+
+	proc_kstatone(ks, kproc);
+
+	spinlock_acquire(&processTable.lk);
+	size = processTable.size;
+	spinlock_release(&processTable.lk);
+
+	/* AS IN proc_printstats, PROCESSES MAY COME AND GO DURING THE SCAN */
+	for (pid = 1; (unsigned) pid < size; pid++) {
+		proc = proc_search(pid);
+		if (proc != NULL) {
+			proc_kstatone(ks, proc);
+			proc_release(proc);
+		}
+	}
+}
+#endif
+
+/**
+ * @brief Set the CPU mask of a process, and of the calling thread if it is one of its
+ * 		  threads (see proc.h).
+ * 
+ * @param pid process id, 0 for the current process
+ * @param mask the CPUs allowed
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int proc_setaffinity(pid_t pid, uint32_t mask) {
+
+	struct proc *proc;
+
+	/* AT LEAST ONE CPU WE HAVE */
+	if ((mask & thread_cpumask()) == 0) {
+		return EINVAL;
+	}
+
+	if (pid == 0 || pid == curproc->p_pid) {
+		spinlock_acquire(&curproc->p_lock);
+		curproc->p_affinity = mask;
+		spinlock_release(&curproc->p_lock);
+
+		/* THE CALLER MOVES NOW, IF IT HAS TO */
+		return thread_setaffinity(curthread, mask);
+	}
+
+	proc = proc_search(pid);
+	if (proc == NULL) {
+		return ESRCH;
+	}
+	spinlock_acquire(&proc->p_lock);
+	proc->p_affinity = mask;
+	spinlock_release(&proc->p_lock);
+	proc_release(proc);
+
+	return 0;
+}
+#endif
+
+/**
+ * @brief Get the CPU mask of a process.
+ * 
+ * @param pid process id, 0 for the current process
+ * @param mask where to store the mask
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int proc_getaffinity(pid_t pid, uint32_t *mask) {
+
+	struct proc *proc;
+
+	if (pid == 0 || pid == curproc->p_pid) {
+		spinlock_acquire(&curproc->p_lock);
+		*mask = curproc->p_affinity;
+		spinlock_release(&curproc->p_lock);
+		return 0;
+	}
+
+	proc = proc_search(pid);
+	if (proc == NULL) {
+		return ESRCH;
+	}
+	spinlock_acquire(&proc->p_lock);
+	*mask = proc->p_affinity;
+	spinlock_release(&proc->p_lock);
+	proc_release(proc);
+
+	return 0;
+}
+#endif
+
+/**
+ * @brief Set the nice value of a process, and of the calling thread if it is one of
+ * 		  its threads (see proc.h).
+ * 
+ * @param pid process id, 0 for the current process
+ * @param nice the new nice value, clamped to PRIO_MIN..PRIO_MAX
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int proc_setnice(pid_t pid, int nice) {
+
+	struct proc *proc;
+
+	if (nice < PRIO_MIN) {
+		nice = PRIO_MIN;
+	} else if (nice > PRIO_MAX) {
+		nice = PRIO_MAX;
+	}
+
+	if (pid == 0 || pid == curproc->p_pid) {
+		spinlock_acquire(&curproc->p_lock);
+		curproc->p_nice = nice;
+		proc_sync_sched(curproc, curthread);
+		spinlock_release(&curproc->p_lock);
+		return 0;
+	}
+
+	proc = proc_search(pid);
+	if (proc == NULL) {
+		return ESRCH;
+	}
+	spinlock_acquire(&proc->p_lock);
+	proc->p_nice = nice;
+	spinlock_release(&proc->p_lock);
+	proc_release(proc);
+
+	return 0;
+}
+#endif
+
+/**
+ * @brief Get the nice value of a process.
+ * 
+ * @param pid process id, 0 for the current process
+ * @param nice where to store the nice value
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int proc_getnice(pid_t pid, int *nice) {
+
+	struct proc *proc;
+
+	if (pid == 0 || pid == curproc->p_pid) {
+		spinlock_acquire(&curproc->p_lock);
+		*nice = curproc->p_nice;
+		spinlock_release(&curproc->p_lock);
+		return 0;
+	}
+
+	proc = proc_search(pid);
+	if (proc == NULL) {
+		return ESRCH;
+	}
+	spinlock_acquire(&proc->p_lock);
+	*nice = proc->p_nice;
+	spinlock_release(&proc->p_lock);
+	proc_release(proc);
+
+	return 0;
+}
+#endif
@@ -0,0 +1,543 @@
+/**
+ * @file checkpoint.c
+ * @brief Contains the definitions of the checkpoint() and restore() system calls,
+ *        which save the image of a process to a file and bring it back (see checkpoint.h)
+ * @version 0.1
+ * @date 2026-10-15
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#include <types.h>
+#include <proc.h>
+#include <current.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <uio.h>
+#include <synch.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <copyinout.h>
+#include <limits.h>
+#include <lib.h>
+#include <thread.h>
+#include <addrspace.h>
+#include <mips/trapframe.h>
+#include <checkpoint.h>
+#include <syscall.h>
+#include "syscall_SHELL.h"
+
+/**
+ * @brief Whether the current process runs a single thread, as checkpoint() and
+ *        restore() need (the other threads would be left out, or running on the old image).
+ */
+#if OPT_SHELL
+static bool ckpt_alone(void) {
+
+    spinlock_acquire(&curproc->p_lock);
+    bool alone = curproc->p_numthreads == 1;
+    spinlock_release(&curproc->p_lock);
+    return alone;
+}
+#endif
+
+/**
+ * @brief Read or write len bytes of the image at offset off, all of them or fail.
+ *
+ * @param vn the image
+ * @param buf kernel buffer, or user buffer if seg is UIO_USERSPACE
+ * @param len bytes to move
+ * @param off offset in the image
+ * @param rw UIO_READ or UIO_WRITE
+ * @param seg UIO_SYSSPACE or UIO_USERSPACE
+ * @return zero on success, ENOEXEC if the image is too short, ENOSPC if it could not grow
+ */
+#if OPT_SHELL
+static int ckpt_io(struct vnode *vn, void *buf, size_t len, off_t off,
+                   enum uio_rw rw, enum uio_seg seg) {
+
+    struct iovec iov;
+    struct uio u;
+    int err;
+
+    if (seg == UIO_USERSPACE) {
+        uio_uinit(&iov, &u, (userptr_t) buf, len, off, rw);
+    } else {
+        uio_kinit(&iov, &u, buf, len, off, rw);
+    }
+    err = rw == UIO_READ ? VOP_READ(vn, &u) : VOP_WRITE(vn, &u);
+    if (err) {
+        return err;
+    }
+    if (u.uio_resid != 0) {
+        return rw == UIO_READ ? ENOEXEC : ENOSPC;
+    }
+    return 0;
+}
+#endif
+
+/**
+ * @brief Build the file table of the image: one record, followed by its path, for every
+ *        descriptor of the current process open on a file by name. Pipes, sockets and
+ *        devices opened by the kernel are left out.
+ *
+ * @param buf_ret the records, in a new buffer (NULL if there are none)
+ * @param len_ret their size
+ * @param nfiles_ret how many records
+ * @return zero on success, ENOMEM if the buffer could not be allocated
+ */
+#if OPT_SHELL
+static int ckpt_files(char **buf_ret, size_t *len_ret, unsigned *nfiles_ret) {
+
+    struct openfile *of;
+    struct ckpt_file cf;
+    size_t len, pathlen;
+    unsigned nfiles;
+    char *buf;
+    int fd;
+
+    /* NO OTHER THREAD, BUT A FORKED CHILD MAY SHARE THE TABLE */
+    lock_acquire(curproc->p_fdlock);
+
+    /* SIZING THE RECORDS FIRST */
+    len = 0;
+    for (fd = 0; fd < OPEN_MAX; fd++) {
+        of = fd_get(curproc, fd);
+        if (of != NULL && of->path != NULL) {
+            len += sizeof(cf) + ROUNDUP(strlen(of->path), 4);
+        }
+    }
+    buf = NULL;
+    if (len > 0) {
+        buf = kmalloc(len);
+        if (buf == NULL) {
+            lock_release(curproc->p_fdlock);
+            return ENOMEM;
+        }
+        bzero(buf, len);
+    }
+
+    /* THEN FILLING THEM IN */
+    len = 0;
+    nfiles = 0;
+    for (fd = 0; fd < OPEN_MAX; fd++) {
+        of = fd_get(curproc, fd);
+        if (of == NULL || of->path == NULL) {
+            continue;
+        }
+        pathlen = strlen(of->path);
+        cf.cf_fd = fd;
+        cf.cf_flags = of->mode_open | (of->append ? O_APPEND : 0) |
+                      (of->direct ? O_DIRECT : 0);
+        cf.cf_advice = of->advice;
+        cf.cf_pathlen = pathlen;
+        cf.cf_offset = of->offset;
+        memcpy(buf + len, &cf, sizeof(cf));
+        memcpy(buf + len + sizeof(cf), of->path, pathlen);
+        len += sizeof(cf) + ROUNDUP(pathlen, 4);
+        nfiles++;
+    }
+    lock_release(curproc->p_fdlock);
+
+    *buf_ret = buf;
+    *len_ret = len;
+    *nfiles_ret = nfiles;
+    return 0;
+}
+#endif
+
+/**
+ * @brief Save the image of the current process to a file: registers, regions with the
+ *        pages in use, and the files open by name with their offsets. Only the pages up
+ *        to the last one touched in each region are written. A process restored from the
+ *        image returns 1 from this call, the caller itself returns 0.
+ *
+ * @param tf trapframe of the call, saved as the registers of the image; it holds every user
+ *           register because the call takes A_TF and so uses the full exception path
+ * @param path name of the image, created or truncated
+ * @return zero on success, EBUSY if the process has more than one thread, EINVAL if it
+ *         has shared mappings or segments attached, E2BIG if it has too many regions,
+ *         or an error value from the file system
+ */
+#if OPT_SHELL
+int sys_checkpoint_SHELL(struct trapframe *tf, const char *path) {
+
+    struct ckpt_header *hdr;
+    struct ckpt_region *regs;
+    struct addrspace *as;
+    struct vnode *vn;
+    unsigned nregs, nfiles, i;
+    vaddr_t heapbrk;
+    size_t fileslen;
+    char *files;
+    off_t off;
+    int err;
+
+    /* SOME ASSERTIONS */
+    KASSERT(curproc != NULL);
+
+    if (!ckpt_alone()) {
+        return EBUSY;
+    }
+    as = proc_getas();
+    if (as == NULL) {
+        return EINVAL;
+    }
+
+    /* COPYING PATH IN KERNEL SIDE */
+    char *kpath = pathbuf_get();
+    if (kpath == NULL) {
+        return ENOMEM;
+    }
+    err = copyinstr((const_userptr_t) path, kpath, PATH_MAX, NULL);
+    if (err) {
+        pathbuf_put(kpath);
+        return err;
+    }
+
+    /* THE TABLES LIVE IN THE HEAP, THE KERNEL STACK IS SMALL */
+    hdr = kmalloc(sizeof(*hdr));
+    regs = kmalloc(CKPT_MAXREGIONS * sizeof(*regs));
+    if (hdr == NULL || regs == NULL) {
+        err = ENOMEM;
+        goto out;
+    }
+
+    /* DESCRIBING THE ADDRESS SPACE AND THE FILES */
+    err = as_checkpoint(as, regs, CKPT_MAXREGIONS, &nregs, &heapbrk);
+    if (err) {
+        goto out;
+    }
+    err = ckpt_files(&files, &fileslen, &nfiles);
+    if (err) {
+        goto out;
+    }
+
+    /* LAYING OUT THE PAGES AFTER THE TABLES */
+    bzero(hdr, sizeof(*hdr));
+    hdr->ch_magic = CKPT_MAGIC;
+    hdr->ch_version = CKPT_VERSION;
+    hdr->ch_nregions = nregs;
+    hdr->ch_nfiles = nfiles;
+    hdr->ch_heapbrk = heapbrk;
+    off = sizeof(*hdr) + nregs * sizeof(*regs) + fileslen;
+    hdr->ch_datastart = ROUNDUP(off, PAGE_SIZE);
+    size_t namelen = strlen(curthread->t_name);
+    memcpy(hdr->ch_name, curthread->t_name,
+           namelen < CKPT_NAMELEN ? namelen : CKPT_NAMELEN - 1);
+    hdr->ch_tf = *tf;
+    off = hdr->ch_datastart;
+    for (i = 0; i < nregs; i++) {
+        regs[i].cr_fileoff = off;
+        off += regs[i].cr_filesz;
+    }
+
+    /* WRITING THE IMAGE */
+    err = vfs_open(kpath, O_WRONLY | O_CREAT | O_TRUNC, 0664, &vn);
+    if (err) {
+        if (files != NULL) {
+            kfree(files);
+        }
+        goto out;
+    }
+    err = ckpt_io(vn, hdr, sizeof(*hdr), 0, UIO_WRITE, UIO_SYSSPACE);
+    if (!err) {
+        err = ckpt_io(vn, regs, nregs * sizeof(*regs), sizeof(*hdr),
+                      UIO_WRITE, UIO_SYSSPACE);
+    }
+    if (!err && fileslen > 0) {
+        err = ckpt_io(vn, files, fileslen, sizeof(*hdr) + nregs * sizeof(*regs),
+                      UIO_WRITE, UIO_SYSSPACE);
+    }
+    // the pages go straight from the process memory (faulted in, if paged out)
+    for (i = 0; !err && i < nregs; i++) {
+        if (regs[i].cr_filesz > 0) {
+            err = ckpt_io(vn, (void *) regs[i].cr_vbase, regs[i].cr_filesz,
+                          regs[i].cr_fileoff, UIO_WRITE, UIO_USERSPACE);
+        }
+    }
+    vfs_close(vn);
+    if (files != NULL) {
+        kfree(files);
+    }
+
+out:
+    if (hdr != NULL) {
+        kfree(hdr);
+    }
+    if (regs != NULL) {
+        kfree(regs);
+    }
+    pathbuf_put(kpath);
+    return err;
+}
+#endif
+
+/**
+ * @brief Reopen the files of an image, read from its file table at offset off. Nothing
+ *        is installed in the file table yet, so that the restore can still fail.
+ *
+ * @param vn the image
+ * @param off offset of the file table
+ * @param nfiles records in it
+ * @param fds descriptors the files go to
+ * @param ofs the reopened files
+ * @return zero on success, ENOEXEC if the table is malformed, or an error value from
+ *         reopening the files (which are all closed again)
+ */
+#if OPT_SHELL
+static int ckpt_reopen(struct vnode *vn, off_t off, unsigned nfiles,
+                       int *fds, struct openfile **ofs) {
+
+    struct ckpt_file cf;
+    struct openfile *of;
+    struct vnode *fv;
+    unsigned i, j;
+    int err;
+
+    char *name = pathbuf_get();
+    if (name == NULL) {
+        return ENOMEM;
+    }
+
+    for (i = 0; i < nfiles; i++) {
+
+        /* READING THE RECORD AND ITS PATH */
+        err = ckpt_io(vn, &cf, sizeof(cf), off, UIO_READ, UIO_SYSSPACE);
+        if (!err && (cf.cf_fd < 0 || cf.cf_fd >= OPEN_MAX ||
+                     cf.cf_pathlen == 0 || cf.cf_pathlen >= PATH_MAX ||
+                     cf.cf_offset < 0 ||
+                     (cf.cf_flags & ~(O_ACCMODE | O_APPEND | O_DIRECT)) != 0 ||
+                     (cf.cf_flags & O_ACCMODE) == O_ACCMODE)) {
+            err = ENOEXEC;
+        }
+        for (j = 0; !err && j < i; j++) {
+            if (fds[j] == cf.cf_fd) {
+                err = ENOEXEC;
+            }
+        }
+        if (!err) {
+            err = ckpt_io(vn, name, cf.cf_pathlen, off + sizeof(cf),
+                          UIO_READ, UIO_SYSSPACE);
+        }
+        if (err) {
+            break;
+        }
+        name[cf.cf_pathlen] = '\0';
+        off += sizeof(cf) + ROUNDUP(cf.cf_pathlen, 4);
+
+        /* OPENING IT AGAIN, AS OPEN() WOULD */
+        err = openfile_alloc(&of);
+        if (err) {
+            break;
+        }
+        of->path = kstrdup(name);
+        if (of->path == NULL) {
+            openfile_release(of);
+            err = ENOMEM;
+            break;
+        }
+        err = vfs_open(name, cf.cf_flags, 0, &fv);
+        if (err) {
+            openfile_release(of);
+            break;
+        }
+        of->vn = fv;
+        of->offset = cf.cf_offset;
+        of->mode_open = cf.cf_flags & O_ACCMODE;
+        of->direct = (cf.cf_flags & O_DIRECT) != 0;
+        of->append = (cf.cf_flags & O_APPEND) && VOP_ISSEEKABLE(fv);
+        of->advice = cf.cf_advice;
+        of->count_refs = 1;
+        fds[i] = cf.cf_fd;
+        ofs[i] = of;
+    }
+    pathbuf_put(name);
+
+    if (err) {
+        while (i-- > 0) {
+            vfs_close(ofs[i]->vn);
+            openfile_release(ofs[i]);
+        }
+    }
+    return err;
+}
+#endif
+
+/**
+ * @brief Replace the image of the current process with the one saved by checkpoint() in
+ *        a file. The regions are mapped from the file and paged in as they are touched,
+ *        so this costs the reading of the tables only. The files of the image are opened
+ *        again on their descriptors; the other descriptors are left as they are (the
+ *        console, pipes). On success this call does not return: the restored process
+ *        returns 1 from its checkpoint() call.
+ *
+ * @param tf trapframe of the call, overwritten with the registers of the image; the full
+ *           exception path (the call takes A_TF) loads all of them back on return
+ * @param path name of the image
+ * @param retval return value of checkpoint() in the restored process
+ * @return zero on success, EBUSY if the process has more than one thread, ENOEXEC if the
+ *         file is not a valid image, or an error value from the file system or the VM
+ */
+#if OPT_SHELL
+int sys_restore_SHELL(struct trapframe *tf, const char *path, int32_t *retval) {
+
+    struct ckpt_header *hdr;
+    struct ckpt_region *regs;
+    struct openfile **ofs;
+    struct addrspace *newas, *oldas;
+    struct vnode *vn;
+    char *newname;
+    unsigned i;
+    int *fds;
+    int err;
+
+    /* SOME ASSERTIONS */
+    KASSERT(curproc != NULL);
+
+    if (!ckpt_alone()) {
+        return EBUSY;
+    }
+
+    /* COPYING PATH IN KERNEL SIDE */
+    char *kpath = pathbuf_get();
+    if (kpath == NULL) {
+        return ENOMEM;
+    }
+    err = copyinstr((const_userptr_t) path, kpath, PATH_MAX, NULL);
+    if (err) {
+        pathbuf_put(kpath);
+        return err;
+    }
+    err = vfs_open(kpath, O_RDONLY, 0, &vn);
+    pathbuf_put(kpath);
+    if (err) {
+        return err;
+    }
+
+    /* READING AND CHECKING THE TABLES */
+    regs = NULL;
+    fds = NULL;
+    ofs = NULL;
+    newname = NULL;
+    hdr = kmalloc(sizeof(*hdr));
+    if (hdr == NULL) {
+        err = ENOMEM;
+        goto fail;
+    }
+    err = ckpt_io(vn, hdr, sizeof(*hdr), 0, UIO_READ, UIO_SYSSPACE);
+    if (err) {
+        goto fail;
+    }
+    if (hdr->ch_magic != CKPT_MAGIC || hdr->ch_version != CKPT_VERSION ||
+        hdr->ch_nregions > CKPT_MAXREGIONS || hdr->ch_nfiles > OPEN_MAX ||
+        hdr->ch_tf.tf_epc >= USERSPACETOP || (hdr->ch_tf.tf_epc & 3) != 0) {
+        err = ENOEXEC;
+        goto fail;
+    }
+    hdr->ch_name[CKPT_NAMELEN - 1] = '\0';
+    regs = kmalloc(hdr->ch_nregions * sizeof(*regs) + 1);
+    fds = kmalloc(hdr->ch_nfiles * sizeof(*fds) + 1);
+    ofs = kmalloc(hdr->ch_nfiles * sizeof(*ofs) + 1);
+    newname = kstrdup(hdr->ch_name);
+    if (regs == NULL || fds == NULL || ofs == NULL || newname == NULL) {
+        err = ENOMEM;
+        goto fail;
+    }
+    err = ckpt_io(vn, regs, hdr->ch_nregions * sizeof(*regs), sizeof(*hdr),
+                  UIO_READ, UIO_SYSSPACE);
+    if (err) {
+        goto fail;
+    }
+
+    /* OPENING THE FILES, AND MAKING ROOM FOR THEM IN THE FILE TABLE */
+    err = ckpt_reopen(vn, sizeof(*hdr) + hdr->ch_nregions * sizeof(*regs),
+                      hdr->ch_nfiles, fds, ofs);
+    if (err) {
+        goto fail;
+    }
+    lock_acquire(curproc->p_fdlock);
+    for (i = 0; !err && i < hdr->ch_nfiles; i++) {
+        err = fdtable_prepare(curproc, fds[i]);
+    }
+    lock_release(curproc->p_fdlock);
+    if (err) {
+        goto fail_files;
+    }
+
+    /* BUILDING THE NEW ADDRESS SPACE, AS LOADEXEC() DOES */
+    newas = as_create();
+    if (newas == NULL) {
+        err = ENOMEM;
+        goto fail_files;
+    }
+    oldas = proc_setas(newas);
+    as_activate();
+    err = as_restore(newas, vn, regs, hdr->ch_nregions, hdr->ch_heapbrk);
+    if (err) {
+        proc_setas(oldas);
+        as_activate();
+        as_destroy(newas);
+        goto fail_files;
+    }
+
+    /**
+     * NB: must not fail from here on, the old address space is destroyed
+     */
+    if (oldas) {
+        as_destroy(oldas);
+    }
+
+    /* PUTTING THE FILES ON THEIR DESCRIPTORS */
+    lock_acquire(curproc->p_fdlock);
+    for (i = 0; i < hdr->ch_nfiles; i++) {
+        if (fd_get(curproc, fds[i]) != NULL) {
+            fd_close(curproc, fds[i]);
+        }
+        fd_install(curproc, fds[i], ofs[i]);
+    }
+    lock_release(curproc->p_fdlock);
+
+    kfree(curthread->t_name);
+    curthread->t_name = newname;
+    proc_kinfo_update(curproc);
+
+    /* RESUMING AFTER THE CHECKPOINT() CALL (STILL IN USER MODE: THE STATUS IS OURS) */
+    uint32_t status = tf->tf_status;
+    *tf = hdr->ch_tf;
+    tf->tf_status = status;
+    *retval = 1;
+
+    kfree(ofs);
+    kfree(fds);
+    kfree(regs);
+    kfree(hdr);
+    vfs_close(vn);      // the address space keeps its own reference
+    return 0;
+
+fail_files:
+    for (i = 0; i < hdr->ch_nfiles; i++) {
+        vfs_close(ofs[i]->vn);
+        openfile_release(ofs[i]);
+    }
+fail:
+    if (newname != NULL) {
+        kfree(newname);
+    }
+    if (ofs != NULL) {
+        kfree(ofs);
+    }
+    if (fds != NULL) {
+        kfree(fds);
+    }
+    if (regs != NULL) {
+        kfree(regs);
+    }
+    if (hdr != NULL) {
+        kfree(hdr);
+    }
+    vfs_close(vn);
+    return err;
+}
+#endif
@@ -31,16 +31,133 @@
 #include <syscall.h>
 #include "exec.h"
 
+/**
+ * @brief ARGUMENT ARENA
+ *
+ *  Pages beyond the first of each argv are reserved from ea_avail; an
+ *  exec that would overdraw it sleeps on ea_cv. Freed pages go back on
+ *  ea_free (linked through their first word), up to EXEC_ARGKEEP.
+ */
+#if OPT_SHELL
+static struct {
+	struct lock *ea_lock;
+	struct cv *ea_cv;
+	unsigned ea_avail;
+	void *ea_free;
+	unsigned ea_nfree;
+} execarena;
+#endif
+
+/**
+ * @brief EXEC HISTORY
+ *
+ *  Paths of the programs run lately, most recent first, all kmalloc'd.
+ */
+#if OPT_SHELL
+static struct {
+	struct lock *eh_lock;
+	char *eh_paths[EXEC_HISTSIZE];
+	unsigned eh_count;
+} exechist;
+#endif
+
 /**
  * @brief Set things up.
  */
 #if OPT_SHELL
 void exec_bootstrap(void) {
 
-    /* SEM BOOTSTRAP */
-    execthrottle = sem_create("exec", EXEC_BIGBUF_THROTTLE);
-	if (execthrottle == NULL) {
-		panic("Cannot create exec throttle semaphore\n");
+	/* ARENA BOOTSTRAP */
+	execarena.ea_lock = lock_create("execarena");
+	execarena.ea_cv = cv_create("execarena");
+	if (execarena.ea_lock == NULL || execarena.ea_cv == NULL) {
+		panic("Cannot create exec argument arena\n");
+	}
+	execarena.ea_avail = EXEC_ARGBUDGET;
+	execarena.ea_free = NULL;
+	execarena.ea_nfree = 0;
+
+	/* HISTORY BOOTSTRAP */
+	exechist.eh_lock = lock_create("exechist");
+	if (exechist.eh_lock == NULL) {
+		panic("Cannot create exec history\n");
+	}
+	exechist.eh_count = 0;
+}
+#endif
+
+/**
+ * @brief Take NPAGES pages out of the arena, first waiting until RESERVE
+ *        of them fit in the budget. Fails only if memory runs out.
+ */
+#if OPT_SHELL
+static int arena_get(char **pages, unsigned npages, unsigned reserve) {
+
+	unsigned i;
+	void *page;
+
+	KASSERT(reserve <= npages && reserve <= EXEC_ARGBUDGET);
+
+	lock_acquire(execarena.ea_lock);
+	while (execarena.ea_avail < reserve) {
+		cv_wait(execarena.ea_cv, execarena.ea_lock);
+	}
+	execarena.ea_avail -= reserve;
+
+	/* REUSE CACHED PAGES FIRST */
+	for (i = 0; i < npages && execarena.ea_free != NULL; i++) {
+		page = execarena.ea_free;
+		execarena.ea_free = *(void **)page;
+		execarena.ea_nfree--;
+		pages[i] = page;
+	}
+	lock_release(execarena.ea_lock);
+
+	for (; i < npages; i++) {
+		pages[i] = (char *)alloc_kpages(1);
+		if (pages[i] == NULL) {
+			break;
+		}
+	}
+	if (i < npages) {
+		/* GIVE BACK WHAT WE GOT, AND THE RESERVATION */
+		while (i > 0) {
+			i--;
+			free_kpages((vaddr_t)pages[i]);
+		}
+		lock_acquire(execarena.ea_lock);
+		execarena.ea_avail += reserve;
+		cv_broadcast(execarena.ea_cv, execarena.ea_lock);
+		lock_release(execarena.ea_lock);
+		return ENOMEM;
+	}
+	return 0;
+}
+#endif
+
+/**
+ * @brief Return NPAGES pages, and RESERVE pages of budget, to the arena.
+ */
+#if OPT_SHELL
+static void arena_put(char **pages, unsigned npages, unsigned reserve) {
+
+	unsigned i;
+
+	lock_acquire(execarena.ea_lock);
+	for (i = 0; i < npages && execarena.ea_nfree < EXEC_ARGKEEP; i++) {
+		*(void **)pages[i] = execarena.ea_free;
+		execarena.ea_free = pages[i];
+		execarena.ea_nfree++;
+	}
+	if (reserve > 0) {
+		execarena.ea_avail += reserve;
+		cv_broadcast(execarena.ea_cv, execarena.ea_lock);
+	}
+	lock_release(execarena.ea_lock);
+
+	/* FREE THE REST WITHOUT THE LOCK */
+	for (; i < npages; i++) {
+		free_kpages((vaddr_t)pages[i]);
 	}
 }
 #endif
@@ -52,19 +169,66 @@ void exec_bootstrap(void) {
 #if OPT_SHELL
 void argbuf_init(argbuf_t *buf) {
 
-    /* BUFFER INIT */
-	buf->data = NULL;
+	/* BUFFER INIT */
+	buf->npages = 0;
+	buf->reserved = 0;
 	buf->len = 0;
 	buf->max = 0;
 	buf->nargs = 0;
-	buf->tooksem = false;
 
 }
 #endif
 
+/**
+ * @brief Address of the WORD-th pointer-sized slot of the buffer. Slots never
+ *        straddle a page.
+ */
+#if OPT_SHELL
+static userptr_t *argbuf_slot(argbuf_t *buf, size_t word) {
+
+	size_t off = word * sizeof(userptr_t);
+
+	KASSERT(off < buf->max);
+	return (userptr_t *)(buf->pages[off / PAGE_SIZE] + off % PAGE_SIZE);
+}
+#endif
+
+/**
+ * @brief Copy LEN bytes of the buffer, starting at POS, out to user address DEST,
+ *        one copyout per page touched.
+ */
+#if OPT_SHELL
+static int argbuf_push(argbuf_t *buf, size_t pos, userptr_t dest, size_t len) {
+
+	size_t n;
+	int result;
+
+	while (len > 0) {
+		n = PAGE_SIZE - pos % PAGE_SIZE;
+		if (n > len) {
+			n = len;
+		}
+		result = copyout(buf->pages[pos / PAGE_SIZE] + pos % PAGE_SIZE, dest, n);
+		if (result) {
+			return result;
+		}
+		pos += n;
+		dest += n;
+		len -= n;
+	}
+	return 0;
+}
+#endif
+
 /**
  * @brief Copy an argv from user side to kernel side
  * 
+ *  The buffer ends up packed the way the new user stack wants it: the strings
+ *  from the start, back to back, and the argv array (NULL slot included) at the
+ *  very end, growing down. Each slot holds the offset of its string, in reverse
+ *  order since argc is not known until the end; argbuf_copyout() flips and
+ *  rebases them.
+ * 
  * @param buf buffer in the kernel side
  * @param uargv argv in the user side
  * @return zero on success, an error value in case of failure 
@@ -72,8 +236,9 @@ void argbuf_init(argbuf_t *buf) {
 #if OPT_SHELL
 int argbuf_copyin(argbuf_t *buf, userptr_t uargv) {
 
-    userptr_t thisarg;
-	size_t thisarglen;
+	userptr_t thisarg;
+	size_t thisarglen, off, room, start, limit;
+	size_t nslots = buf->max / sizeof(userptr_t);
 	int result;
 
 	/* LOOP EVERY ARGV, COPYING EACH STRING ONE AT A TIME */
@@ -83,7 +248,7 @@ int argbuf_copyin(argbuf_t *buf, userptr_t uargv) {
 		 * First, grab the pointer at argv.
 		 * (argv is incremented at the end of the loop)
 		 */
-		result = copyin(uargv, &thisarg, sizeof(userptr_t));
+		result = copyin32(uargv, (uint32_t *)&thisarg);
 		if (result) {
 			return result;
 		}
@@ -93,16 +258,43 @@ int argbuf_copyin(argbuf_t *buf, userptr_t uargv) {
 			break;
 		}
 
-		/* USE THE POINTER TO FETCH THE ARGUMENT STRING */
-		result = copyinstr(thisarg, buf->data + buf->len, buf->max - buf->len, &thisarglen);
-		if (result == ENAMETOOLONG) {
+		/* THE STRINGS MUST STAY BELOW THE SLOTS, THIS ONE AND THE NULL INCLUDED */
+		if (nslots < (size_t)buf->nargs + 2) {
 			return E2BIG;
-		} else if (result) {
-			return result;
+		}
+		limit = (nslots - buf->nargs - 2) * sizeof(userptr_t);
+		start = buf->len;
+
+		/*
+		 * USE THE POINTER TO FETCH THE ARGUMENT STRING. It may run
+		 * past the end of the current page; copyinstr then fills
+		 * the page exactly, and we carry on into the next one.
+		 */
+		while (true) {
+			if (buf->len >= limit) {
+				return E2BIG;
+			}
+			off = buf->len % PAGE_SIZE;
+			room = PAGE_SIZE - off;
+			if (room > limit - buf->len) {
+				room = limit - buf->len;
+			}
+			result = copyinstr(thisarg, buf->pages[buf->len / PAGE_SIZE] + off, room, &thisarglen);
+			if (result == 0) {
+				/* Note: thisarglen includes the \0. */
+				buf->len += thisarglen;
+				break;
+			} else if (result != ENAMETOOLONG) {
+				return result;
+			}
+			buf->len += room;
+			thisarg += room;
 		}
 
-		/* MOVE TO THE NEXT ARGUMENT. Note: thisarglen includes the \0. */
-		buf->len += thisarglen;
+		/* RECORD WHERE IT STARTS (rebased in argbuf_copyout) */
+		*argbuf_slot(buf, nslots - 2 - buf->nargs) = (userptr_t) start;
+
+		/* MOVE TO THE NEXT ARGUMENT */
 		uargv += sizeof(userptr_t);
 		buf->nargs++;
 	}
@@ -114,6 +306,9 @@ int argbuf_copyin(argbuf_t *buf, userptr_t uargv) {
 /**
  * @brief Copy an argv from kernel side to user side
  * 
+ *  Turns the slots into user pointers in place, then pushes out the argv array
+ *  and the strings with a copyout per page.
+ * 
  * @param buf buffer in the kernel side
  * @param ustackp user stack pointer
  * @param argc_ret number of arguments copied
@@ -124,10 +319,9 @@ int argbuf_copyin(argbuf_t *buf, userptr_t uargv) {
 int argbuf_copyout(argbuf_t *buf, vaddr_t *ustackp, int *argc_ret, userptr_t *uargv_ret) {
 
 	vaddr_t ustack;
-	userptr_t ustringbase, uargvbase, uargv_i;
-	userptr_t thisarg;
-	size_t thisarglen;
-	size_t pos;
+	userptr_t ustringbase, uargvbase;
+	userptr_t *lo, *hi, tmp;
+	size_t nslots, first, last, tablelen;
 	int result;
 
 	/* Begin the stack at the passed in top. */
@@ -136,7 +330,7 @@ int argbuf_copyout(argbuf_t *buf, vaddr_t *ustackp, int *argc_ret, userptr_t *ua
 	/*
 	 * Allocate space.
 	 *
-	 * buf->pos is the amount of space used by the strings; put that
+	 * buf->len is the amount of space used by the strings; put that
 	 * first, then align the stack, then make space for the argv
 	 * pointers. Allow an extra slot for the ending NULL.
 	 */
@@ -145,38 +339,40 @@ int argbuf_copyout(argbuf_t *buf, vaddr_t *ustackp, int *argc_ret, userptr_t *ua
 	ustack -= (ustack & (sizeof(void *) - 1));
 	ustringbase = (userptr_t)ustack;
 
-	ustack -= (buf->nargs + 1) * sizeof(userptr_t);
+	tablelen = (buf->nargs + 1) * sizeof(userptr_t);
+	ustack -= tablelen;
 	uargvbase = (userptr_t)ustack;
 
-	/* Now copy the data out. */
-	pos = 0;
-	uargv_i = uargvbase;
-	while (pos < buf->len) {
-		/* The user address of the string will be ustringbase + pos. */
-		thisarg = ustringbase + pos;
-
-		/* Place it in the argv array. */
-		result = copyout(&thisarg, uargv_i, sizeof(thisarg));
-		if (result) {
-			return result;
+	/*
+	 * REBASE THE SLOTS: [first, last] hold the offsets of the strings
+	 * from the last argument to the first; flip them into argv order.
+	 */
+	nslots = buf->max / sizeof(userptr_t);
+	if (buf->nargs > 0) {
+		first = nslots - 1 - buf->nargs;
+		last = nslots - 2;
+		for (; first < last; first++, last--) {
+			lo = argbuf_slot(buf, first);
+			hi = argbuf_slot(buf, last);
+			tmp = ustringbase + (size_t) *hi;
+			*hi = ustringbase + (size_t) *lo;
+			*lo = tmp;
 		}
-
-		/* Push out the string. */
-		result = copyoutstr(buf->data + pos, thisarg, buf->len - pos, &thisarglen);
-		if (result) {
-			return result;
+		if (first == last) {
+			lo = argbuf_slot(buf, first);
+			*lo = ustringbase + (size_t) *lo;
 		}
-
-		/* thisarglen includes the \0 */
-		pos += thisarglen;
-		uargv_i += sizeof(thisarg);
 	}
-	/* Should have come out even... */
-	KASSERT(pos == buf->len);
 
 	/* Add the NULL. */
-	thisarg = NULL;
-	result = copyout(&thisarg, uargv_i, sizeof(userptr_t));
+	*argbuf_slot(buf, nslots - 1) = NULL;
+
+	/* PUSH OUT THE ARGV ARRAY AND THE STRINGS */
+	result = argbuf_push(buf, buf->max - tablelen, uargvbase, tablelen);
+	if (result) {
+		return result;
+	}
+	result = argbuf_push(buf, 0, ustringbase, buf->len);
 	if (result) {
 		return result;
 	}
@@ -191,21 +387,38 @@ int argbuf_copyout(argbuf_t *buf, vaddr_t *ustackp, int *argc_ret, userptr_t *ua
 
 
 /**
- * @brief Initialize size of the buffer
+ * @brief Grow the buffer to hold at least size bytes, waiting for the
+ *        arena budget if needed
  * 
  * @param buf argv buffer
- * @param size size of the buffer
+ * @param size size of the buffer (at most ARG_MAX)
  * @return zero on success, an error value in case of failure 
  */
 #if OPT_SHELL
 int argbuf_allocate(argbuf_t *buf, size_t size) {
 
-    /* ALLOCATING SPACE FOR DATA */
-    buf->data = (char *) kmalloc(size * sizeof(char));
-	if (buf->data == NULL) {
-		return ENOMEM;
+	unsigned want, more, reserve;
+	int result;
+
+	KASSERT(size <= ARG_MAX);
+
+	want = DIVROUNDUP(size, PAGE_SIZE);
+	if (want <= buf->npages) {
+		return 0;
 	}
-	buf->max = size;
+	more = want - buf->npages;
+
+	/* THE FIRST PAGE OF EACH EXEC DOES NOT COUNT AGAINST THE BUDGET */
+	reserve = (buf->npages == 0) ? more - 1 : more;
+
+	/* ALLOCATING SPACE FOR DATA */
+	result = arena_get(buf->pages + buf->npages, more, reserve);
+	if (result) {
+		return result;
+	}
+	buf->npages = want;
+	buf->reserved += reserve;
+	buf->max = want * PAGE_SIZE;
 	return 0;
 }
 #endif
@@ -217,21 +430,63 @@ int argbuf_allocate(argbuf_t *buf, size_t size) {
  */
 #if OPT_SHELL
 void argbuf_cleanup(argbuf_t *buf) {
-    
-    /* DATA CLEANUP */
-    if (buf->data != NULL) {
-		kfree(buf->data);
-		buf->data = NULL;
+
+	/* DATA AND BUDGET CLEANUP */
+	if (buf->npages > 0) {
+		arena_put(buf->pages, buf->npages, buf->reserved);
 	}
 
+	buf->npages = 0;
+	buf->reserved = 0;
 	buf->len = 0;
 	buf->max = 0;
 	buf->nargs = 0;
+}
+#endif
+
+/**
+ * @brief Find how many bytes of buffer an argv needs (strings and argv
+ *        array), using the first page of BUF as scratch space. Returns
+ *        E2BIG past ARG_MAX.
+ */
+#if OPT_SHELL
+static int argbuf_measure(argbuf_t *buf, userptr_t uargv, size_t *total) {
+
+	userptr_t thisarg;
+	size_t thisarglen;
+	int result;
 
-    /* SEM CLEANUP */
-	if (buf->tooksem) {
-		V(execthrottle);
-		buf->tooksem = false;
+	/* THE ARGV ARRAY GOES IN THE BUFFER TOO: ONE SLOT PER STRING, PLUS THE NULL */
+	*total = sizeof(userptr_t);
+	while (true) {
+		result = copyin32(uargv, (uint32_t *)&thisarg);
+		if (result) {
+			return result;
+		}
+		if (thisarg == NULL) {
+			return 0;
+		}
+		*total += sizeof(userptr_t);
+
+		/* A PAGE-SIZED CHUNK AT A TIME UNTIL THE \0 TURNS UP */
+		while (true) {
+			result = copyinstr(thisarg, buf->pages[0], PAGE_SIZE, &thisarglen);
+			if (result == 0) {
+				*total += thisarglen;
+				break;
+			} else if (result != ENAMETOOLONG) {
+				return result;
+			}
+			*total += PAGE_SIZE;
+			thisarg += PAGE_SIZE;
+			if (*total > ARG_MAX) {
+				return E2BIG;
+			}
+		}
+		if (*total > ARG_MAX) {
+			return E2BIG;
+		}
+		uargv += sizeof(userptr_t);
 	}
 }
 #endif
@@ -246,9 +501,10 @@ void argbuf_cleanup(argbuf_t *buf) {
 #if OPT_SHELL
 int argbuf_fromuser(argbuf_t *buf, userptr_t uargv) {
 
-    int result;
+	size_t total;
+	int result;
 
-	/* ATTEMPT WITH A SMALL BUFFER */
+	/* ATTEMPT WITH A SINGLE PAGE */
 	result = argbuf_allocate(buf, PAGE_SIZE);
 	if (result) {
 		return result;
@@ -258,26 +514,23 @@ int argbuf_fromuser(argbuf_t *buf, userptr_t uargv) {
 	result = argbuf_copyin(buf, uargv);
 	if (result == E2BIG) {
 		/*
-		 * Try again with the full-size buffer. Just start
-		 * over instead of trying to keep the page we already
-		 * did; this is a bit inefficient but it's not that
-		 * important.
+		 * Find out how much the whole argv takes, then reserve
+		 * exactly that many pages and copy it again. Measuring
+		 * first means we never hold budget while waiting for
+		 * more, so concurrent big execs can't deadlock on it.
 		 */
-		argbuf_cleanup(buf);
-		argbuf_init(buf);
-        if (buf == NULL) {
-            return ENOMEM;
-        }
-
-		/* Wait on the semaphore, to throttle this allocation */
-		P(execthrottle);
-		buf->tooksem = true;
+		result = argbuf_measure(buf, uargv, &total);
+		if (result) {
+			return result;
+		}
 
-		result = argbuf_allocate(buf, ARG_MAX);
+		result = argbuf_allocate(buf, total);
 		if (result) {
 			return result;
 		}
 
+		buf->len = 0;
+		buf->nargs = 0;
 		result = argbuf_copyin(buf, uargv);
 	}
 
@@ -285,6 +538,49 @@ int argbuf_fromuser(argbuf_t *buf, userptr_t uargv) {
 }
 #endif
 
+/**
+ * @brief Load the executable path into the new address space, which must be the
+ * 		  current (active) one, and define its stack.
+ * 
+ * @param path pathname of the executable to run
+ * @param newas address space being filled
+ * @param entrypoint virtual address of the starting point
+ * @param stackptr virtual address of the stack
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+static int loadimage(char *path, struct addrspace *newas, vaddr_t *entrypoint, vaddr_t *stackptr) {
+
+	struct vnode *vn;
+	char *histname;
+	int err;
+
+	/* vfs_open may destroy the path */
+	histname = exec_histname(path);
+
+	/* open the file. */
+	err = vfs_open(path, O_RDONLY, 0, &vn);
+	if (err) {
+		kfree(histname);
+		return err;
+	}
+
+	/* Load the executable. */
+	err = load_elf(vn, entrypoint);
+
+	/* Done with the file now. */
+	vfs_close(vn);
+	if (err) {
+		kfree(histname);
+		return err;
+	}
+	exec_remember(histname);
+
+	/* Define the user stack in the address space */
+	return as_define_stack(newas, stackptr);
+}
+#endif
+
 /**
  * @brief Load an executable (common code with runprogram)
  * 
@@ -297,7 +593,6 @@ int argbuf_fromuser(argbuf_t *buf, userptr_t uargv) {
 int loadexec(char *path, vaddr_t *entrypoint, vaddr_t *stackptr) {
 
 	struct addrspace *newas, *oldas;
-	struct vnode *vn;
 	char *newname;
 	int err;
 
@@ -307,17 +602,9 @@ int loadexec(char *path, vaddr_t *entrypoint, vaddr_t *stackptr) {
 		return ENOMEM;
 	}
 
-	/* open the file. */
-	err = vfs_open(path, O_RDONLY, 0, &vn);
-	if (err) {
-		kfree(newname);
-		return err;
-	}
-
 	/* make a new address space. */
 	newas = as_create();
 	if (newas == NULL) {
-		vfs_close(vn);
 		kfree(newname);
 		return ENOMEM;
 	}
@@ -330,9 +617,8 @@ int loadexec(char *path, vaddr_t *entrypoint, vaddr_t *stackptr) {
 	 * Load the executable. If it fails, restore the old address
 	 * space and (re-)activate it.
 	 */
-	err = load_elf(vn, entrypoint);
+	err = loadimage(path, newas, entrypoint, stackptr);
 	if (err) {
-		vfs_close(vn);
 		proc_setas(oldas);
 		as_activate();
 		as_destroy(newas);
@@ -340,19 +626,6 @@ int loadexec(char *path, vaddr_t *entrypoint, vaddr_t *stackptr) {
 		return err;
 	}
 
-	/* Done with the file now. */
-	vfs_close(vn);
-
-	/* Define the user stack in the address space */
-	err = as_define_stack(newas, stackptr);
-	if (err) {
-		proc_setas(oldas);
-		as_activate();
-		as_destroy(newas);
-		kfree(newname);
-		return err;
-        }
-
 	/*
 	 * Wipe out old address space.
 	 *
@@ -370,6 +643,266 @@ int loadexec(char *path, vaddr_t *entrypoint, vaddr_t *stackptr) {
 	kfree(curthread->t_name);
 	curthread->t_name = newname;
 
+	/* The new image has its own kernel info page */
+	proc_kinfo_update(curproc);
+
 	return 0;
 }
-#endif
\ No newline at end of file
+#endif
+
+/**
+ * @brief Build the address space of a spawned process: load the executable and copy
+ * 		  the argv onto its stack. Runs in the first thread of the new process, which
+ * 		  has no address space yet, so the caller's one is never touched.
+ * 
+ * @param path pathname of the executable to run
+ * @param args argv, already copied in
+ * @param entrypoint virtual address of the starting point
+ * @param stackptr virtual address of the stack, below the argv
+ * @param argc_ret number of arguments
+ * @param uargv_ret argv in the new address space
+ * @return zero on success (the process is left without an address space on failure)
+ */
+#if OPT_SHELL
+int loadspawn(char *path, argbuf_t *args, vaddr_t *entrypoint, vaddr_t *stackptr,
+			  int *argc_ret, userptr_t *uargv_ret) {
+
+	struct addrspace *newas;
+	int err;
+
+	KASSERT(proc_getas() == NULL);
+
+	/* make a new address space, and activate it */
+	newas = as_create();
+	if (newas == NULL) {
+		return ENOMEM;
+	}
+	proc_setas(newas);
+	as_activate();
+
+	err = loadimage(path, newas, entrypoint, stackptr);
+	if (!err) {
+		err = argbuf_copyout(args, stackptr, argc_ret, uargv_ret);
+	}
+	if (err) {
+		proc_setas(NULL);
+		as_deactivate();
+		as_destroy(newas);
+		return err;
+	}
+
+	proc_kinfo_update(curproc);
+	return 0;
+}
+#endif
+
+/**
+ * @brief Copy of path for the history, if it names the same file at the next boot.
+ */
+#if OPT_SHELL
+char *exec_histname(const char *path) {
+
+	if (path[0] != '/' && strchr(path, ':') == NULL) {
+		return NULL;
+	}
+	/* NO MEMORY JUST MEANS NO HISTORY */
+	return kstrdup(path);
+}
+#endif
+
+/**
+ * @brief Put name in the history, at the front or (when loading the saved
+ *        file, which is in order already) at the back. Consumes name.
+ */
+#if OPT_SHELL
+static void exechist_add(char *name, bool front) {
+
+	char *drop = NULL;
+	unsigned i, pos;
+
+	lock_acquire(exechist.eh_lock);
+	for (i = 0; i < exechist.eh_count; i++) {
+		if (strcmp(exechist.eh_paths[i], name) == 0) {
+			break;
+		}
+	}
+	if (i < exechist.eh_count || exechist.eh_count == EXEC_HISTSIZE) {
+		if (!front) {
+			/* KNOWN ALREADY, OR NO ROOM AT THE BACK */
+			lock_release(exechist.eh_lock);
+			kfree(name);
+			return;
+		}
+		if (i < exechist.eh_count) {
+			/* MOVE IT UP */
+			drop = name;
+			name = exechist.eh_paths[i];
+			exechist.eh_count--;
+		}
+		else {
+			/* THE OLDEST GOES */
+			i = --exechist.eh_count;
+			drop = exechist.eh_paths[i];
+		}
+	}
+	else {
+		i = exechist.eh_count;
+	}
+
+	/* SLOT I IS FREE: SHIFT THE ONES BEFORE IT DOWN FOR THE FRONT */
+	pos = front ? 0 : i;
+	for (; i > pos; i--) {
+		exechist.eh_paths[i] = exechist.eh_paths[i - 1];
+	}
+	exechist.eh_paths[pos] = name;
+	exechist.eh_count++;
+	lock_release(exechist.eh_lock);
+	kfree(drop);
+}
+#endif
+
+/**
+ * @brief Move a program just loaded to the front of the history.
+ */
+#if OPT_SHELL
+void exec_remember(char *name) {
+
+	if (name != NULL) {
+		exechist_add(name, true);
+	}
+}
+#endif
+
+/**
+ * @brief Body of the prefetch thread: read the saved history, prefetch every
+ *        program in it that still opens, and take those back as the history.
+ *        A request by an exec that runs meanwhile just finds the pages cached
+ *        already, or reads them itself.
+ */
+#if OPT_SHELL
+static void exec_prefetch_thread(void *unused1, unsigned long unused2) {
+
+	struct vnode *vn;
+	struct iovec iov;
+	struct uio ku;
+	char *buf, *name, *line, *ctx, *end;
+	size_t len;
+	int err;
+
+	(void)unused1;
+	(void)unused2;
+
+	buf = kmalloc(EXEC_PREFETCHMAX + 1);
+	name = kstrdup(EXEC_PREFETCHFILE);
+	if (buf == NULL || name == NULL) {
+		kfree(buf);
+		kfree(name);
+		return;
+	}
+
+	/* READ THE LIST (NONE THE FIRST TIME) */
+	err = vfs_open(name, O_RDONLY, 0, &vn);
+	kfree(name);
+	if (err) {
+		kfree(buf);
+		return;
+	}
+	uio_kinit(&iov, &ku, buf, EXEC_PREFETCHMAX, 0, UIO_READ);
+	err = VOP_READ(vn, &ku);
+	vfs_close(vn);
+	if (err) {
+		kfree(buf);
+		return;
+	}
+	len = EXEC_PREFETCHMAX - ku.uio_resid;
+	buf[len] = '\0';
+	if (ku.uio_resid == 0 && (end = strrchr(buf, '\n')) != NULL) {
+		/* THE LAST LINE MAY BE CUT */
+		*end = '\0';
+	}
+
+	for (line = strtok_r(buf, "\n", &ctx); line != NULL; line = strtok_r(NULL, "\n", &ctx)) {
+		if (line[0] == '#') {
+			continue;
+		}
+		name = exec_histname(line);
+		if (name == NULL) {
+			continue;
+		}
+		if (vfs_open(line, O_RDONLY, 0, &vn)) {
+			/* GONE SINCE: FORGET IT */
+			kfree(name);
+			continue;
+		}
+		load_elf_prefetch(vn);
+		vfs_close(vn);
+		exechist_add(name, false);
+	}
+	kfree(buf);
+}
+#endif
+
+/**
+ * @brief Start the prefetch thread. Failing to is not worth a message.
+ */
+#if OPT_SHELL
+void exec_prefetch_start(void) {
+
+	thread_fork("exec prefetch", NULL, exec_prefetch_thread, NULL, 0);
+}
+#endif
+
+/**
+ * @brief Save the history for the next boot, as far as it fits.
+ */
+#if OPT_SHELL
+void exec_history_save(void) {
+
+	static const char header[] = "# Programs prefetched at boot, most recently run first\n";
+	struct vnode *vn;
+	struct iovec iov;
+	struct uio ku;
+	char *buf, *name;
+	size_t len, plen;
+	unsigned i;
+	int err;
+
+	buf = kmalloc(EXEC_PREFETCHMAX);
+	name = kstrdup(EXEC_PREFETCHFILE);
+	if (buf == NULL || name == NULL) {
+		kfree(buf);
+		kfree(name);
+		return;
+	}
+
+	strcpy(buf, header);
+	len = sizeof(header) - 1;
+	lock_acquire(exechist.eh_lock);
+	for (i = 0; i < exechist.eh_count; i++) {
+		plen = strlen(exechist.eh_paths[i]);
+		if (len + plen + 1 > EXEC_PREFETCHMAX) {
+			break;
+		}
+		memcpy(buf + len, exechist.eh_paths[i], plen);
+		len += plen;
+		buf[len++] = '\n';
+	}
+	lock_release(exechist.eh_lock);
+
+	/* NOTHING RUN AND NOTHING SAVED BEFORE: LEAVE THE DISK ALONE */
+	if (i == 0) {
+		kfree(buf);
+		kfree(name);
+		return;
+	}
+
+	err = vfs_open(name, O_WRONLY | O_CREAT | O_TRUNC, 0664, &vn);
+	kfree(name);
+	if (!err) {
+		uio_kinit(&iov, &ku, buf, len, 0, UIO_WRITE);
+		VOP_WRITE(vn, &ku);
+		vfs_close(vn);
+	}
+	kfree(buf);
+}
+#endif
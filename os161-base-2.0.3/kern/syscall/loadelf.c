@@ -52,13 +52,248 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/fcntl.h>
 #include <lib.h>
 #include <uio.h>
 #include <proc.h>
 #include <current.h>
 #include <addrspace.h>
+#include <vm.h>
 #include <vnode.h>
 #include <elf.h>
+#include <stat.h>
+#include <spinlock.h>
+#include "opt-shell.h"
+
+#if OPT_SHELL
+/*
+ * ELF header cache.
+ *
+ * The same few programs are run over and over, so the executable
+ * header and program headers of recently loaded files are kept here,
+ * keyed by vnode. An entry also records the file size, and is only
+ * used if the file still has that size; entries are dropped outright
+ * when the vnode is reclaimed or opened for writing (see
+ * load_elf_purge). The segment contents themselves are shared by the
+ * VM system's text cache.
+ *
+ * Files with more than ELFCACHE_MAXPH program headers are not cached.
+ */
+#define ELFCACHE_SIZE   16
+#define ELFCACHE_MAXPH  8
+
+struct elfcache {
+	struct vnode *ec_vn;            /* NULL if unused */
+	off_t ec_size;                  /* file size when cached */
+	unsigned ec_stamp;              /* for LRU replacement */
+	Elf_Ehdr ec_eh;
+	Elf_Phdr ec_ph[ELFCACHE_MAXPH];
+};
+
+static struct elfcache elfcache[ELFCACHE_SIZE];
+static struct spinlock elfcache_lock = SPINLOCK_INITIALIZER;
+static unsigned elfcache_clock;
+
+/*
+ * Look up V, whose size is now SIZE. On a hit, copies the headers out
+ * and returns true.
+ */
+static
+bool
+elfcache_lookup(struct vnode *v, off_t size, Elf_Ehdr *eh, Elf_Phdr *ph)
+{
+	struct elfcache *ec;
+	unsigned i;
+	bool found = false;
+
+	spinlock_acquire(&elfcache_lock);
+	for (i=0; i<ELFCACHE_SIZE; i++) {
+		ec = &elfcache[i];
+		if (ec->ec_vn == v && ec->ec_size == size) {
+			ec->ec_stamp = ++elfcache_clock;
+			*eh = ec->ec_eh;
+			memcpy(ph, ec->ec_ph, eh->e_phnum * sizeof(Elf_Phdr));
+			found = true;
+			break;
+		}
+	}
+	spinlock_release(&elfcache_lock);
+	return found;
+}
+
+/*
+ * Remember the headers of V, recycling the least recently used entry.
+ */
+static
+void
+elfcache_enter(struct vnode *v, off_t size, const Elf_Ehdr *eh,
+	       const Elf_Phdr *ph)
+{
+	struct elfcache *ec, *victim = NULL;
+	unsigned i;
+
+	KASSERT(eh->e_phnum <= ELFCACHE_MAXPH);
+
+	spinlock_acquire(&elfcache_lock);
+	for (i=0; i<ELFCACHE_SIZE; i++) {
+		ec = &elfcache[i];
+		if (ec->ec_vn == v) {
+			/* stale (the size changed); reuse it */
+			victim = ec;
+			break;
+		}
+		if (victim == NULL || ec->ec_vn == NULL ||
+		    (victim->ec_vn != NULL && ec->ec_stamp < victim->ec_stamp)) {
+			victim = ec;
+		}
+	}
+	victim->ec_vn = v;
+	victim->ec_size = size;
+	victim->ec_stamp = ++elfcache_clock;
+	victim->ec_eh = *eh;
+	memcpy(victim->ec_ph, ph, eh->e_phnum * sizeof(Elf_Phdr));
+	spinlock_release(&elfcache_lock);
+}
+
+/*
+ * Forget the headers of V, which is being reclaimed or may be changed.
+ */
+void
+load_elf_purge(struct vnode *v)
+{
+	unsigned i;
+
+	spinlock_acquire(&elfcache_lock);
+	for (i=0; i<ELFCACHE_SIZE; i++) {
+		if (elfcache[i].ec_vn == v) {
+			elfcache[i].ec_vn = NULL;
+		}
+	}
+	spinlock_release(&elfcache_lock);
+}
+
+/*
+ * Fetch program header I: from PHS if it is among the NPH already
+ * read, from the file otherwise (then adding it to PHS if it is the
+ * next one and fits).
+ */
+static
+int
+load_elf_phdr(struct vnode *v, const Elf_Ehdr *eh, Elf_Phdr *phs,
+	      unsigned *nph, unsigned i, Elf_Phdr *ph)
+{
+	struct iovec iov;
+	struct uio ku;
+	off_t offset;
+	int result;
+
+	if (i < *nph) {
+		*ph = phs[i];
+		return 0;
+	}
+
+	/*
+	 * Note that the expression eh.e_phoff + i*eh.e_phentsize is
+	 * mandated by the ELF standard (see below).
+	 */
+	offset = eh->e_phoff + i*eh->e_phentsize;
+	uio_kinit(&iov, &ku, ph, sizeof(*ph), offset, UIO_READ);
+
+	result = VOP_READ(v, &ku);
+	if (result) {
+		return result;
+	}
+
+	if (ku.uio_resid != 0) {
+		/* short read; problem with executable? */
+		kprintf("ELF: short read on phdr - file truncated?\n");
+		return ENOEXEC;
+	}
+
+	if (i == *nph && i < ELFCACHE_MAXPH) {
+		phs[(*nph)++] = *ph;
+	}
+	return 0;
+}
+
+/*
+ * Read the executable header into EH together with whatever program
+ * headers follow it in the same ELFHEAD_SIZE bytes, which for a
+ * normally linked file is all of them, so getting the headers takes
+ * one read. The program headers found are put in PHS, as many as NPH
+ * says; load_elf_phdr reads any others.
+ */
+#define ELFHEAD_SIZE (sizeof(Elf_Ehdr) + ELFCACHE_MAXPH * sizeof(Elf_Phdr))
+
+static
+int
+load_elf_head(struct vnode *v, Elf_Ehdr *eh, Elf_Phdr *phs, unsigned *nph)
+{
+	union {
+		Elf_Ehdr eh;
+		char bytes[ELFHEAD_SIZE];
+	} head;
+	struct iovec iov;
+	struct uio ku;
+	size_t got;
+	off_t offset;
+	unsigned i;
+	int result;
+
+	uio_kinit(&iov, &ku, &head, sizeof(head), 0, UIO_READ);
+	result = VOP_READ(v, &ku);
+	if (result) {
+		return result;
+	}
+
+	got = sizeof(head) - ku.uio_resid;
+	if (got < sizeof(*eh)) {
+		/* short read; problem with executable? */
+		kprintf("ELF: short read on header - file truncated?\n");
+		return ENOEXEC;
+	}
+	*eh = head.eh;
+
+	*nph = 0;
+	for (i=0; i<eh->e_phnum && i<ELFCACHE_MAXPH; i++) {
+		/* The same rule for where it is as in load_elf_phdr */
+		offset = eh->e_phoff + i*eh->e_phentsize;
+		if (offset < (off_t)sizeof(*eh) ||
+		    offset + sizeof(Elf_Phdr) > got) {
+			break;
+		}
+		memcpy(&phs[i], &head.bytes[offset], sizeof(Elf_Phdr));
+		(*nph)++;
+	}
+	return 0;
+}
+#endif /* OPT_SHELL */
+
+/*
+ * Check to make sure it's a 32-bit ELF-version-1 executable
+ * for our processor type. If it's not, we can't run it.
+ *
+ * Ignore EI_OSABI and EI_ABIVERSION - properly, we should
+ * define our own, but that would require tinkering with the
+ * linker to have it emit our magic numbers instead of the
+ * default ones. (If the linker even supports these fields,
+ * which were not in the original elf spec.)
+ */
+static
+bool
+load_elf_check(const Elf_Ehdr *eh)
+{
+	return eh->e_ident[EI_MAG0] == ELFMAG0 &&
+	    eh->e_ident[EI_MAG1] == ELFMAG1 &&
+	    eh->e_ident[EI_MAG2] == ELFMAG2 &&
+	    eh->e_ident[EI_MAG3] == ELFMAG3 &&
+	    eh->e_ident[EI_CLASS] == ELFCLASS32 &&
+	    eh->e_ident[EI_DATA] == ELFDATA2MSB &&
+	    eh->e_ident[EI_VERSION] == EV_CURRENT &&
+	    eh->e_version == EV_CURRENT &&
+	    eh->e_type == ET_EXEC &&
+	    eh->e_machine == EM_MACHINE;
+}
 
 /*
  * Load a segment at virtual address VADDR. The segment in memory
@@ -74,6 +309,7 @@
  * change this code to not use uiomove, be sure to check for this case
  * explicitly.
  */
+#if !OPT_SHELL
 static
 int
 load_segment(struct addrspace *as, struct vnode *v,
@@ -102,6 +338,8 @@ load_segment(struct addrspace *as, struct vnode *v,
 	u.uio_segflg = is_executable ? UIO_USERISPACE : UIO_USERSPACE;
 	u.uio_rw = UIO_READ;
 	u.uio_space = as;
+	u.uio_direct = false;
+	u.uio_advice = POSIX_FADV_NORMAL;
 
 	result = VOP_READ(v, &u);
 	if (result) {
@@ -144,6 +382,7 @@ load_segment(struct addrspace *as, struct vnode *v,
 
 	return result;
 }
+#endif /* !OPT_SHELL */
 
 /*
  * Load an ELF executable user program into the current address space.
@@ -156,16 +395,44 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	Elf_Ehdr eh;   /* Executable header */
 	Elf_Phdr ph;   /* "Program header" = segment header */
 	int result, i;
+	struct addrspace *as;
+#if !OPT_SHELL
 	struct iovec iov;
 	struct uio ku;
-	struct addrspace *as;
+#else
+	Elf_Phdr phs[ELFCACHE_MAXPH];  /* headers read so far */
+	unsigned nph = 0;
+	struct stat st;
+	bool cached;
+#endif
 
 	as = proc_getas();
 
+#if OPT_SHELL
+	/*
+	 * Use the headers we already have if the file looks unchanged.
+	 */
+	result = VOP_STAT(v, &st);
+	if (result) {
+		return result;
+	}
+	cached = elfcache_lookup(v, st.st_size, &eh, phs);
+	if (cached) {
+		nph = eh.e_phnum;
+		goto defineregions;
+	}
+#endif
+
 	/*
 	 * Read the executable header from offset 0 in the file.
 	 */
 
+#if OPT_SHELL
+	result = load_elf_head(v, &eh, phs, &nph);
+	if (result) {
+		return result;
+	}
+#else
 	uio_kinit(&iov, &ku, &eh, sizeof(eh), 0, UIO_READ);
 	result = VOP_READ(v, &ku);
 	if (result) {
@@ -177,28 +444,9 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 		kprintf("ELF: short read on header - file truncated?\n");
 		return ENOEXEC;
 	}
+#endif
 
-	/*
-	 * Check to make sure it's a 32-bit ELF-version-1 executable
-	 * for our processor type. If it's not, we can't run it.
-	 *
-	 * Ignore EI_OSABI and EI_ABIVERSION - properly, we should
-	 * define our own, but that would require tinkering with the
-	 * linker to have it emit our magic numbers instead of the
-	 * default ones. (If the linker even supports these fields,
-	 * which were not in the original elf spec.)
-	 */
-
-	if (eh.e_ident[EI_MAG0] != ELFMAG0 ||
-	    eh.e_ident[EI_MAG1] != ELFMAG1 ||
-	    eh.e_ident[EI_MAG2] != ELFMAG2 ||
-	    eh.e_ident[EI_MAG3] != ELFMAG3 ||
-	    eh.e_ident[EI_CLASS] != ELFCLASS32 ||
-	    eh.e_ident[EI_DATA] != ELFDATA2MSB ||
-	    eh.e_ident[EI_VERSION] != EV_CURRENT ||
-	    eh.e_version != EV_CURRENT ||
-	    eh.e_type!=ET_EXEC ||
-	    eh.e_machine!=EM_MACHINE) {
+	if (!load_elf_check(&eh)) {
 		return ENOEXEC;
 	}
 
@@ -217,7 +465,16 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	 * to find where the phdr starts.
 	 */
 
+#if OPT_SHELL
+ defineregions:
+#endif
 	for (i=0; i<eh.e_phnum; i++) {
+#if OPT_SHELL
+		result = load_elf_phdr(v, &eh, phs, &nph, i, &ph);
+		if (result) {
+			return result;
+		}
+#else
 		off_t offset = eh.e_phoff + i*eh.e_phentsize;
 		uio_kinit(&iov, &ku, &ph, sizeof(ph), offset, UIO_READ);
 
@@ -231,6 +488,7 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 			kprintf("ELF: short read on phdr - file truncated?\n");
 			return ENOEXEC;
 		}
+#endif
 
 		switch (ph.p_type) {
 		    case PT_NULL: /* skip */ continue;
@@ -263,6 +521,12 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	 */
 
 	for (i=0; i<eh.e_phnum; i++) {
+#if OPT_SHELL
+		result = load_elf_phdr(v, &eh, phs, &nph, i, &ph);
+		if (result) {
+			return result;
+		}
+#else
 		off_t offset = eh.e_phoff + i*eh.e_phentsize;
 		uio_kinit(&iov, &ku, &ph, sizeof(ph), offset, UIO_READ);
 
@@ -276,6 +540,7 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 			kprintf("ELF: short read on phdr - file truncated?\n");
 			return ENOEXEC;
 		}
+#endif
 
 		switch (ph.p_type) {
 		    case PT_NULL: /* skip */ continue;
@@ -288,9 +553,27 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 			return ENOEXEC;
 		}
 
+#if OPT_SHELL
+		/* Just say where the contents are; vm_fault reads them in */
+		if (ph.p_filesz > ph.p_memsz) {
+			kprintf("ELF: warning: segment filesize > segment memsize\n");
+			ph.p_filesz = ph.p_memsz;
+		}
+		result = as_define_file(as, v, ph.p_offset, ph.p_vaddr,
+					ph.p_filesz);
+		/*
+		 * A new or changed program has never been paged in:
+		 * have the file system read the segment ahead, rather
+		 * than a page at a time as it faults.
+		 */
+		if (result == 0 && !cached) {
+			VOP_PREFETCH(v, ph.p_offset, ph.p_filesz);
+		}
+#else
 		result = load_segment(as, v, ph.p_offset, ph.p_vaddr,
 				      ph.p_memsz, ph.p_filesz,
 				      ph.p_flags & PF_X);
+#endif
 		if (result) {
 			return result;
 		}
@@ -301,7 +584,70 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 		return result;
 	}
 
+#if OPT_SHELL
+	/* It loaded fine, so the headers are worth keeping */
+	if (!cached && nph == eh.e_phnum) {
+		elfcache_enter(v, st.st_size, &eh, phs);
+	}
+#endif
+
 	*entrypoint = eh.e_entry;
 
 	return 0;
 }
+
+#if OPT_SHELL
+/*
+ * Warm the caches for a later exec of V: its headers go in the ELF
+ * header cache, its read-only segments in the VM text cache, and the
+ * file system is asked to read the rest ahead. Returns how many text
+ * pages were read in.
+ */
+unsigned
+load_elf_prefetch(struct vnode *v)
+{
+	Elf_Ehdr eh;
+	Elf_Phdr ph;
+	Elf_Phdr phs[ELFCACHE_MAXPH];
+	unsigned nph = 0, n = 0;
+	struct stat st;
+	bool cached;
+	int i;
+
+	if (VOP_STAT(v, &st)) {
+		return 0;
+	}
+	cached = elfcache_lookup(v, st.st_size, &eh, phs);
+	if (cached) {
+		nph = eh.e_phnum;
+	}
+	else if (load_elf_head(v, &eh, phs, &nph) || !load_elf_check(&eh)) {
+		return 0;
+	}
+
+	for (i=0; i<eh.e_phnum; i++) {
+		if (load_elf_phdr(v, &eh, phs, &nph, i, &ph)) {
+			return n;
+		}
+		if (ph.p_type != PT_LOAD) {
+			continue;
+		}
+		if (ph.p_filesz > ph.p_memsz) {
+			ph.p_filesz = ph.p_memsz;
+		}
+		if (ph.p_flags & PF_W) {
+			/* Private copies are made at fault time anyway */
+			VOP_PREFETCH(v, ph.p_offset, ph.p_filesz);
+		}
+		else {
+			n += vm_textprefetch(v, ph.p_vaddr, ph.p_offset,
+					     ph.p_filesz);
+		}
+	}
+
+	if (!cached && nph == eh.e_phnum) {
+		elfcache_enter(v, st.st_size, &eh, phs);
+	}
+	return n;
+}
+#endif
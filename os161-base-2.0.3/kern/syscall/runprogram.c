@@ -44,6 +44,10 @@
 #include <vfs.h>
 #include <syscall.h>
 #include <test.h>
+#include "opt-shell.h"
+#if OPT_SHELL
+#include <exec.h>
+#endif
 
 /*
  * Load program "progname" and start running it in usermode.
@@ -58,10 +62,19 @@ runprogram(char *progname)
 	struct vnode *v;
 	vaddr_t entrypoint, stackptr;
 	int result;
+#if OPT_SHELL
+	char *histname;
+
+	/* vfs_open may destroy progname */
+	histname = exec_histname(progname);
+#endif
 
 	/* Open the file. */
 	result = vfs_open(progname, O_RDONLY, 0, &v);
 	if (result) {
+#if OPT_SHELL
+		kfree(histname);
+#endif
 		return result;
 	}
 
@@ -72,6 +85,9 @@ runprogram(char *progname)
 	as = as_create();
 	if (as == NULL) {
 		vfs_close(v);
+#if OPT_SHELL
+		kfree(histname);
+#endif
 		return ENOMEM;
 	}
 
@@ -84,11 +100,17 @@ runprogram(char *progname)
 	if (result) {
 		/* p_addrspace will go away when curproc is destroyed */
 		vfs_close(v);
+#if OPT_SHELL
+		kfree(histname);
+#endif
 		return result;
 	}
 
 	/* Done with the file now. */
 	vfs_close(v);
+#if OPT_SHELL
+	exec_remember(histname);
+#endif
 
 	/* Define the user stack in the address space */
 	result = as_define_stack(as, &stackptr);
@@ -96,6 +118,9 @@ runprogram(char *progname)
 		/* p_addrspace will go away when curproc is destroyed */
 		return result;
 	}
+#if OPT_SHELL
+	proc_kinfo_update(curproc);
+#endif
 
 	/* Warp to user mode. */
 	enter_new_process(0 /*argc*/, NULL /*userspace addr of argv*/,
@@ -18,11 +18,19 @@
 #include <current.h>
 #include <vnode.h>
 #include <vfs.h>
+#include <fs.h>
+#include <pipe.h>
+#include <childfd.h>
+#include <rangelock.h>
+#include <appendlog.h>
+#include <poll.h>
+#include <clock.h>
 #include <uio.h>
 #include <synch.h>
 #include <kern/errno.h>
 #include <kern/fcntl.h>
 #include <kern/stat.h>
+#include <kern/ioring.h>
 #include <copyinout.h>
 #include <limits.h>
 #include <kern/unistd.h>
@@ -30,586 +38,2720 @@
 #include <stat.h>
 #include <lib.h>
 #include <kern/seek.h>
+#include <spinlock.h>
+#include <kmem_cache.h>
 #include "syscall_SHELL.h"
 
-#define SYSTEM_OPEN_MAX (10*OPEN_MAX)
-
 #if OPT_SHELL
 struct openfile systemFileTable[SYSTEM_OPEN_MAX];
+static struct kmem_cache fdtable_cache =
+    KMEM_CACHE_INITIALIZER("fdtable", sizeof(struct fdtable), NULL, NULL);
+static struct openfile *systemFileTable_freelist = NULL;                    /* LIFO list of the unused entries  */
+static struct spinlock systemFileTable_lock = SPINLOCK_INITIALIZER;         /* protects the free list           */
 #endif
 
 /**
- * @brief sys_write_SHELL() writes up to buflen bytes to the file specified by fd, 
- *        at the location in the file specified by the current seek position of the 
- *        file, taking the data from the space pointed to by buf. The file must be 
- *        open for writing.
- * 
- *        The current seek position of the file is advanced by the number of bytes written.
- *        Each write (or read) operation is atomic relative to other I/O to the same file. 
+ * @brief Initialize the system file table, threading all its entries on the free list.
+ *        Must be called once during the boot, before any process is created.
+ */
+#if OPT_SHELL
+void openfile_bootstrap(void) {
+
+    /* THREADING ENTRIES ON THE FREE LIST (entry 0 ends up on top) */
+    spinlock_acquire(&systemFileTable_lock);
+    systemFileTable_freelist = NULL;
+    for (int index = SYSTEM_OPEN_MAX - 1; index >= 0; index--) {
+        systemFileTable[index].vn = NULL;
+        systemFileTable[index].lock = NULL;
+        spinlock_init(&systemFileTable[index].ref_lock);
+        systemFileTable[index].next_free = systemFileTable_freelist;
+        systemFileTable_freelist = &systemFileTable[index];
+    }
+    spinlock_release(&systemFileTable_lock);
+}
+#endif
+
+/**
+ * @brief Take a free entry from the system file table in constant time. The returned
+ *        entry has no vnode, no references and offset zero; its lock is already created.
  * 
- * @param fd destination file
- * @param buf source buffer
- * @param buflen number of bytes to be written
- * @param retval actual number of bytes written
- * @return zero on success. an error value in case of failure
-*/
+ * @param retval free entry of the system file table
+ * @return zero on success, ENFILE if the system file table is full, ENOMEM if the lock
+ *         of the entry could not be created
+ */
 #if OPT_SHELL
-ssize_t sys_write_SHELL(int fd, const void *buf, size_t buflen, int32_t *retval) {
+int openfile_alloc(struct openfile **retval) {
 
-    /* CHECKING FILE DESCRIPTOR */
-    if (fd < 0 || fd >= OPEN_MAX) {                                 /* fd should be a valid number                          */
-        return EBADF;       
-    } else if (curproc->fileTable[fd] == NULL) {                    /* fd should refer to a valid entry in the fileTable    */
-        return EBADF;
-    } else if (curproc->fileTable[fd]->mode_open == O_RDONLY) {     /* fd should refer to a file allowed to be written      */
-        return EBADF;
+    /* POPPING THE HEAD OF THE FREE LIST */
+    spinlock_acquire(&systemFileTable_lock);
+    struct openfile *of = systemFileTable_freelist;
+    if (of == NULL) {
+        spinlock_release(&systemFileTable_lock);
+        return ENFILE;      // system file table is full
     }
-
-    /* COPYING BUFFER TO KERNEL SIDE (copyin()) */
-    char *kbuffer = (char *) kmalloc(buflen * sizeof(char));
-    if (kbuffer == NULL) {
-        return ENOMEM;
-    } else if (copyin((const_userptr_t) buf, kbuffer, buflen)) {
-        kfree(kbuffer);
-        return EFAULT;
+    systemFileTable_freelist = of->next_free;
+    spinlock_release(&systemFileTable_lock);
+
+    /* CREATING THE LOCK THE FIRST TIME THE ENTRY IS USED (it survives the release) */
+    // this cannot be done while holding the spinlock, since lock_create() calls kmalloc()
+    if (of->lock == NULL) {
+        of->lock = lock_create("FILE_LOCK");
+        if (of->lock == NULL) {
+            openfile_release(of);
+            return ENOMEM;
+        }
     }
 
-    /* PERFORMING WRITING (VOP_WRITE()) */
-    struct iovec iov;
-	struct uio kuio;
-    struct openfile *of = curproc->fileTable[fd];
-    struct vnode *vn = of->vn;
+    /* INITIALIZING ENTRY */
+    of->next_free = NULL;
+    of->vn = NULL;
+    of->offset = 0;
+    of->mode_open = 0;
+    of->direct = false;
+    of->append = false;
+    of->advice = POSIX_FADV_NORMAL;
+    of->path = NULL;
+    of->count_refs = 0;
+
+    *retval = of;
+    return 0;
+}
+#endif
 
-    lock_acquire(of->lock);
-    uio_kinit(&iov, &kuio, kbuffer, buflen, of->offset, UIO_WRITE);
-    int error = VOP_WRITE(vn, &kuio);
-    if (error) {
-        kfree(kbuffer);
-        return error;
+/**
+ * @brief Give back an entry to the free list of the system file table. The vnode of
+ *        the entry must have already been closed and no process may refer to it.
+ * 
+ * @param of entry to release
+ */
+#if OPT_SHELL
+void openfile_release(struct openfile *of) {
+
+    KASSERT(of >= systemFileTable && of < systemFileTable + SYSTEM_OPEN_MAX);
+
+    /* PUSHING ENTRY ON THE FREE LIST */
+    of->vn = NULL;
+    if (of->path != NULL) {
+        kfree(of->path);
+        of->path = NULL;
     }
+    spinlock_acquire(&systemFileTable_lock);
+    of->next_free = systemFileTable_freelist;
+    systemFileTable_freelist = of;
+    spinlock_release(&systemFileTable_lock);
+}
+#endif
 
-    /* REPOSITION OF THE OFFSET */
-    off_t nbytes = kuio.uio_offset - of->offset;
-    *retval = (int32_t) nbytes;
-    of->offset = kuio.uio_offset;
+/**
+ * @brief Index of the lowest zero bit in a word which is known not to be all ones,
+ *        computed with a binary search on the complemented word.
+ */
+#if OPT_SHELL
+static unsigned word_first_zero(uint32_t word) {
+
+    uint32_t w = ~word;
+    unsigned bit = 0;
+
+    KASSERT(w != 0);
+    if ((w & 0x0000ffff) == 0) { bit += 16; w >>= 16; }
+    if ((w & 0x000000ff) == 0) { bit += 8;  w >>= 8;  }
+    if ((w & 0x0000000f) == 0) { bit += 4;  w >>= 4;  }
+    if ((w & 0x00000003) == 0) { bit += 2;  w >>= 2;  }
+    if ((w & 0x00000001) == 0) { bit += 1;            }
+    return bit;
+}
+#endif
 
-    /* FREEING KERNEL BUFFER */
-    lock_release(of->lock);
-    kfree(kbuffer);
+/**
+ * @brief Close the vnode of an open file nobody refers to any more, and give the entry
+ *        back to the system file table. Run by a worker thread (see openfile_decref()).
+ */
+#if OPT_SHELL
+static void openfile_close_work(void *arg) {
 
-    /* TASK COMPLETED SUCCESSFULLY */
-    return 0;
+    struct openfile *of = arg;
+    struct vnode *vn = of->vn;
+
+    of->vn = NULL;
+    vfs_close(vn);
+    openfile_release(of);
 }
 #endif
 
 /**
- * @brief sys_read_SHELL() reads up to buflen bytes from the file specified by fd, at the 
- *        location in the file specified by the current seek position of the file, and 
- *        stores them in the space pointed to by buf. The file must be open for reading.
- *  
- *        The current seek position of the file is advanced by the number of bytes read. 
- * 
- * @param fd source file
- * @param buf destination buffer
- * @param count number of bytes to be read
- * @return zero on success. an error value in case of failure
-*/
+ * @brief Drop one reference to the given open file. When the last reference goes away,
+ *        the vnode is closed and the entry goes back to the system file table; as the
+ *        last close may have to write the file back, this is left to a worker thread,
+ *        so that close() and _exit() do not wait for it.
+ */
 #if OPT_SHELL
-ssize_t sys_read_SHELL(int fd, const void *buf, size_t buflen, int32_t *retval) {
+static void openfile_decref(struct openfile *of) {
 
-    /* CHECKING FILE DESCRIPTOR */
-    if (fd < 0 || fd >= OPEN_MAX) {                                 /* fd should be a valid number                          */
-        return EBADF;       
-    } else if (curproc->fileTable[fd] == NULL) {                    /* fd should refer to a valid entry in the fileTable    */
-        return EBADF;
-    } else if (curproc->fileTable[fd]->mode_open == O_WRONLY) {     /* fd should refer to a file allowed to be read         */
-        return EBADF;
-    } else if (buf == NULL) {
-        return EFAULT;
-    } 
+    /* REDUCING REFERENCES */
+    spinlock_acquire(&of->ref_lock);
+    if (--of->count_refs > 0) {
 
-    /* PREPARING KERNEL BUFFER */
-    char *kbuffer = (char *) kmalloc((buflen+1) * sizeof(char));
-    if (kbuffer == NULL) {
-        return ENOMEM;
+        /* THIS FILE IS STILL REFERENCED BY SOME PROCESS */
+        spinlock_release(&of->ref_lock);
+        return;
     }
+    spinlock_release(&of->ref_lock);
 
-    /* PERFORMING READING (VOP_READ()) */
-    struct openfile *of = curproc->fileTable[fd];
-    struct iovec iov;
-    struct uio kuio;
-    struct vnode *vn = of->vn;
-    lock_acquire(of->lock);
-    uio_kinit(&iov, &kuio, kbuffer, buflen, of->offset, UIO_READ);
-    int err = VOP_READ(vn, &kuio);
-    if (err) {
-        kfree(kbuffer);
-        lock_release(of->lock);
-        return err;
-    }
+    /* NO MORE PROCESS REFER TO THIS FILE, CLOSING ALSO VNODE (LATER) */
+    work_init(&of->close_work, openfile_close_work, of);
+    work_schedule(&of->close_work);
+}
+#endif
 
-    /* REPOSITION OF THE OFFSET */
-    of->offset = kuio.uio_offset;
-    *retval = buflen - kuio.uio_resid;
+/**
+ * @brief Create an empty file table using its inline slots, referenced once.
+ */
+#if OPT_SHELL
+static struct fdtable *fdtable_create(void) {
 
-    /* COPYING BUFFER TO USER SIDE (COPYOUT()) */
-    err = copyout(kbuffer, (userptr_t) buf, *retval);
-    if (err) {
-        kfree(kbuffer);
-        lock_release(of->lock);
-        return EFAULT;
+    struct fdtable *ft = kmem_cache_alloc(&fdtable_cache);
+    if (ft == NULL) {
+        return NULL;
     }
 
-    /* FREEING KERNEL BUFFER */
-    lock_release(of->lock);
-    kfree(kbuffer);
-
-    /* TASK COMPLETED SUCCESSFULLY */
-    return 0;
+    spinlock_init(&ft->ft_lock);
+    ft->ft_refs = 1;
+    ft->ft_size = FDTABLE_INLINE;
+    ft->ft_hint = 0;
+    ft->ft_files = ft->ft_inline;
+    ft->ft_bitmap = ft->ft_inlinemap;
+    ft->ft_cloexec = ft->ft_inlinecloexec;
+    bzero(ft->ft_inline, sizeof(ft->ft_inline));
+    bzero(ft->ft_inlinemap, sizeof(ft->ft_inlinemap));
+    bzero(ft->ft_inlinecloexec, sizeof(ft->ft_inlinecloexec));
+    return ft;
 }
 #endif
 
 /**
- * @brief sys_open_SHELL() opens the file, device, or other kernel object named by the pathname 
- *        provided. The flags argument specifies how to open the file. The optional mode argument 
- *        is only meaningful in Unix and can be ignored. 
- * 
- * ERRORS:
- *      //ENODEV		The device prefix of filename did not exist.
- *      ENOTDIR		A non-final component of filename was not a directory.
- *      //ENOENT		A non-final component of filename did not exist.
- *      //ENOENT		The named file does not exist, and O_CREAT was not specified.
- *      EEXIST		The named file exists, and O_EXCL was specified.
- *      EISDIR		The named object is a directory, and it was to be opened for writing.   
- *      //EMFILE		The process's file table was full, or a process-specific limit on open files was reached.  
- *      //ENFILE		The system file table is full, if such a thing exists, or a system-wide limit on open files was reached.
- *      //ENXIO		The named object is a block device with no mounted filesystem.
- *      ENOSPC		The file was to be created, and the filesystem involved is full.
- *      //EINVAL		flags contained invalid values.
- *      EIO		    A hard I/O error occurred.
- *      //EFAULT		filename was an invalid pointer. 
- * 
- * @param pathname relative or absolute path of the file to open
- * @param openflags how to open the file
- * @param mode can be ignored
- * @param retval file handler of the open file
- * @return zero on success. an error value in case of failure 
+ * @brief Free a file table nobody refers to any more. Its slots must be empty.
  */
 #if OPT_SHELL
-int sys_open_SHELL(userptr_t pathname, int openflags, mode_t mode, int32_t *retval) {
+static void fdtable_destroy(struct fdtable *ft) {
 
-    /* CHECKING INPUT ARGUMENTS */
-    if (pathname == NULL) {
-        return EFAULT;
+    KASSERT(ft->ft_refs == 0);
+    if (ft->ft_files != ft->ft_inline) {
+        kfree(ft->ft_files);    // the bitmaps live in the same block
     }
+    spinlock_cleanup(&ft->ft_lock);
+    kmem_cache_free(&fdtable_cache, ft);
+}
+#endif
 
-    /* COPYING PATHNAME TO KERNEL SIDE */
-    // this is done for two reasons:
-    // 1) security reason
-    // 2) vfs_open may destroy the buffer
-    char *kbuffer = (char *) kmalloc(PATH_MAX * sizeof(char));
-    if (kbuffer == NULL) {
-        return ENOMEM;
-    }
-    size_t len;
-    int err = copyinstr((const_userptr_t) pathname, kbuffer, PATH_MAX, &len); // may return EFAULT
-    if (err) {
-        kfree(kbuffer);
-        return EFAULT;
-    }
+/**
+ * @brief Drop one reference to a file table; the last one closes the files still open
+ *        in it and frees it.
+ */
+#if OPT_SHELL
+static void fdtable_release_table(struct fdtable *ft) {
 
-    /* OPENING WITH VFS UTILITY */
-    struct vnode *v;
-    err = vfs_open(kbuffer, openflags, mode, &v);   // may return ENOENT, ENXIO, ENODEV
-    if (err) {
-        kfree(kbuffer);
-        return err;
-    }
-    kfree(kbuffer);
+    unsigned refs;
 
-    /* RETRIEVING A FREE POSITION IN THE SYSTEM FILETABLE */
-    struct openfile *of = NULL;
-    for (int index = 0; index < SYSTEM_OPEN_MAX; index++) {
-        if (systemFileTable[index].vn == NULL) {
-            of = &systemFileTable[index];
-            of->vn = v;
-            break;
-        }
+    spinlock_acquire(&ft->ft_lock);
+    refs = --ft->ft_refs;
+    spinlock_release(&ft->ft_lock);
+    if (refs > 0) {
+        return;
     }
 
-    /* ASSIGNING OPENFILE TO CURRENT PROCESS FILETABLE */
-    int fd = 3;     // skipping STDIN, STDOUT and STDERR
-    if (of == NULL) {
-        return ENFILE;  // system file table is full
-    } else {
-        for (; fd < OPEN_MAX; fd++) {
-            if (curproc->fileTable[fd] == NULL) {
-                curproc->fileTable[fd] = of;
-                break;
-            }
-        }
-
-        if (fd == OPEN_MAX - 1) {
-            return EMFILE;  // process file table is full
+    /* CLOSING FILES STILL OPEN (gives the entries back to the system file table) */
+    for (unsigned fd = 0; fd < ft->ft_size; fd++) {
+        if (ft->ft_files[fd] != NULL) {
+            openfile_decref(ft->ft_files[fd]);
+            ft->ft_files[fd] = NULL;
         }
-
     }
+    fdtable_destroy(ft);
+}
+#endif
 
-    /* MANAGING OFFSET */
-    // if flag specified O_APPEND, the operation on the file should start at the end
-    // otherwise, it should start at the beginning
-    if (openflags & O_APPEND) {
+/**
+ * @brief Grow a private file table, by doubling, until it has at least minsize slots.
+ *        Slots and bitmaps are allocated as a single block.
+ */
+#if OPT_SHELL
+static int fdtable_grow(struct fdtable *ft, unsigned minsize) {
 
-            /* RETRIEVING FILE SIZE */
-            struct stat filestat;
-            err = VOP_STAT(curproc->fileTable[fd]->vn, &filestat);
-            if (err) {
-                kfree(curproc->fileTable[fd]);
-                curproc->fileTable[fd] = NULL;
-                return err;
-            }
-            curproc->fileTable[fd]->offset = filestat.st_size;
-    } else {
+    unsigned newsize = ft->ft_size;
 
-            /* STARTING FROM THE BEGINNING */
-            curproc->fileTable[fd]->offset = 0;
+    KASSERT(minsize <= OPEN_MAX);
+    if (newsize >= minsize) {
+        return 0;
+    }
+    while (newsize < minsize) {
+        newsize *= 2;
+    }
+    if (newsize > OPEN_MAX) {
+        newsize = OPEN_MAX;
     }
 
-    /* MANAGING REFERENCES */
-    curproc->fileTable[fd]->count_refs = 1;
-
-    /* MANAGING MODE */
-    switch(openflags & O_ACCMODE){
-	    case O_RDONLY:
-			curproc->fileTable[fd]->mode_open = O_RDONLY;
-			break;
-		case O_WRONLY:
-			curproc->fileTable[fd]->mode_open = O_WRONLY;
-			break;
-		case O_RDWR:
-			curproc->fileTable[fd]->mode_open = O_RDWR;
-			break;
-		default:
-			vfs_close(curproc->fileTable[fd]->vn);
-			kfree(curproc->fileTable[fd]);
-			curproc->fileTable[fd] = NULL;
-			return EINVAL;
-	}
-
-    /* CREATING LOCK ON THIS FILE */
-    curproc->fileTable[fd]->lock = lock_create("FILE_LOCK");
-    if (curproc->fileTable[fd]->lock == NULL) {
-        vfs_close(curproc->fileTable[fd]->vn);
-        kfree(curproc->fileTable[fd]);
-        curproc->fileTable[fd] = NULL;
+    unsigned oldwords = DIVROUNDUP(ft->ft_size, 32);
+    unsigned newwords = DIVROUNDUP(newsize, 32);
+    struct openfile **files = kmalloc(newsize * sizeof(struct openfile *) + 2 * newwords * sizeof(uint32_t));
+    if (files == NULL) {
         return ENOMEM;
     }
-
-    /* TASK COMPLETED SUCCESSFULLY */
-    *retval = fd;
+    uint32_t *bitmap = (uint32_t *) (files + newsize);
+    uint32_t *cloexec = bitmap + newwords;
+
+    /* MOVING THE SLOTS IN USE, THE NEW ONES START OUT FREE */
+    memcpy(files, ft->ft_files, ft->ft_size * sizeof(struct openfile *));
+    bzero(files + ft->ft_size, (newsize - ft->ft_size) * sizeof(struct openfile *));
+    memcpy(bitmap, ft->ft_bitmap, oldwords * sizeof(uint32_t));
+    bzero(bitmap + oldwords, (newwords - oldwords) * sizeof(uint32_t));
+    memcpy(cloexec, ft->ft_cloexec, oldwords * sizeof(uint32_t));
+    bzero(cloexec + oldwords, (newwords - oldwords) * sizeof(uint32_t));
+
+    if (ft->ft_files != ft->ft_inline) {
+        kfree(ft->ft_files);
+    }
+    ft->ft_files = files;
+    ft->ft_bitmap = bitmap;
+    ft->ft_cloexec = cloexec;
+    ft->ft_size = newsize;
     return 0;
 }
 #endif
 
 /**
- * @brief the file handle fd is closed.
+ * @brief Make the file table of the given process private (copying it if it is shared
+ *        after a fork) and large enough to hold the file descriptor fd. Must be called
+ *        before fd_install() or fd_close() on that descriptor.
  * 
- * @param fd file descriptor
- * @return zero on success, an error value in case of failure 
-*/
+ * @param proc process owning the file table
+ * @param fd file descriptor about to be modified
+ * @return zero on success, ENOMEM if the table could not be copied or grown
+ */
 #if OPT_SHELL
-int sys_close_SHELL(int fd) {
+int fdtable_prepare(struct proc *proc, int fd) {
 
-    /* CHECKING FILE DESCRIPTOR */
-    if (fd < 0 || fd >= OPEN_MAX) {                                 /* fd should be a valid number                          */
-        return EBADF;       
-    } else if (curproc->fileTable[fd] == NULL) {                    /* fd should refer to a valid entry in the fileTable    */
-        return EBADF;
+    struct fdtable *ft = proc->p_fdtable;
+    bool shared;
+    int err;
+
+    KASSERT(fd >= 0 && fd < OPEN_MAX);
+
+    /* FIRST FILE OF THE PROCESS */
+    if (ft == NULL) {
+        ft = fdtable_create();
+        if (ft == NULL) {
+            return ENOMEM;
+        }
+        proc->p_fdtable = ft;
+        return fdtable_grow(ft, fd + 1);
     }
 
-    /* REDUCING REFERENCES */
-    struct openfile *of = curproc->fileTable[fd];
-    lock_acquire(of->lock);
-    curproc->fileTable[fd] = NULL;
-    if (--of->count_refs > 0) {
+    /* ALREADY PRIVATE: AT MOST GROWING IS NEEDED */
+    spinlock_acquire(&ft->ft_lock);
+    shared = ft->ft_refs > 1;
+    spinlock_release(&ft->ft_lock);
+    if (!shared) {
+        return fdtable_grow(ft, fd + 1);
+    }
 
-        /* THIS FILE IS STILL REFERENCED BY SOME PROCESS */
-        lock_release(of->lock);
-        return 0;
-    } else {
+    /*
+     * SHARED: COPYING THE TABLE. Nobody changes a shared table, so it can be
+     * read without locks; every slot copied is one more reference to its file.
+     * The copy only needs to reach the last descriptor in use (or fd), which
+     * keeps it inline when a table that grew once has few files left, and only
+     * the descriptors in use are visited, a bitmap word at a time.
+     */
+    unsigned words = DIVROUNDUP(ft->ft_size, 32);
+    while (words > 0 && ft->ft_bitmap[words - 1] == 0) {
+        words--;
+    }
+    unsigned minsize = words * 32;
+    if (minsize > ft->ft_size) {
+        minsize = ft->ft_size;
+    }
+    if (minsize < (unsigned) fd + 1) {
+        minsize = fd + 1;
+    }
 
-        /* NO MORE PROCESS REFER TO THIS FILE, CLOSING ALSO VNODE */
-        struct vnode *vn = of->vn;
-        of->vn = NULL;
-        vfs_close(vn);
+    struct fdtable *copy = fdtable_create();
+    if (copy == NULL) {
+        return ENOMEM;
+    }
+    err = fdtable_grow(copy, minsize);
+    if (err) {
+        copy->ft_refs = 0;
+        fdtable_destroy(copy);
+        return err;
+    }
+    for (unsigned word = 0; word < words; word++) {
+        uint32_t inuse = ft->ft_bitmap[word];
+        while (inuse != 0) {
+            unsigned i = word * 32 + word_first_zero(~inuse);
+            struct openfile *of = ft->ft_files[i];
+
+            inuse &= inuse - 1;     // clearing the lowest bit set
+            spinlock_acquire(&of->ref_lock);
+            of->count_refs++;
+            spinlock_release(&of->ref_lock);
+            copy->ft_files[i] = of;
+        }
     }
+    memcpy(copy->ft_bitmap, ft->ft_bitmap, words * sizeof(uint32_t));
+    memcpy(copy->ft_cloexec, ft->ft_cloexec, words * sizeof(uint32_t));
+    copy->ft_hint = (ft->ft_hint < words) ? ft->ft_hint : words;
 
-    lock_release(of->lock);
+    /* SWITCHING TO THE COPY (the old table may have lost its other users meanwhile) */
+    proc->p_fdtable = copy;
+    fdtable_release_table(ft);
     return 0;
 }
 #endif
 
 /**
- * @brief The name of the file referred to by pathname is removed from the filesystem. 
- *        The actual file itself is not removed until no further references to it exist, 
- *        whether those references are on disk or in memory.
+ * @brief Look up a file descriptor of the given process.
  * 
- * @param pathname specify an existing file.
- * @return zero on success, an error value in case of failure.
+ * @param proc process owning the file table
+ * @param fd file descriptor, in the range [0, OPEN_MAX)
+ * @return the open file, or NULL if fd is not in use
  */
 #if OPT_SHELL
-int sys_remove_SHELL(const char *pathname) {
+struct openfile *fd_get(struct proc *proc, int fd) {
 
-    /* NOT IMPLEMENTED (YET?) */
-    (void) pathname;
+    struct fdtable *ft = proc->p_fdtable;
 
-    /* TASK COMPLETED SUCCESSFULLY */
-    return 0;
+    KASSERT(fd >= 0 && fd < OPEN_MAX);
+    if (ft == NULL || (unsigned) fd >= ft->ft_size) {
+        return NULL;
+    }
+    return ft->ft_files[fd];
 }
 #endif
 
 /**
- * @brief The current directory of the current process is set to the directory named by pathname. 
+ * @brief Look up a file descriptor of the given process and take a reference to its open
+ *        file, so that it stays valid even if another thread closes the descriptor.
  * 
- * @param pathname directory to be set as current.
- * @return zero on success, an error value in case of failure.
+ * @param proc process owning the file table
+ * @param fd file descriptor (any value; out of range means not in use)
+ * @return the open file, or NULL if fd is not in use
  */
 #if OPT_SHELL
-int sys_chdir_SHELL(const char *pathname) {
+struct openfile *fd_acquire(struct proc *proc, int fd) {
 
-    /* SOME ASSERTIONS */
-    KASSERT(curthread != NULL);
-    KASSERT(curthread->t_proc != NULL);
+    struct openfile *of;
 
-    /* COPYING PATHNAME FROM USERLAND TO KERNEL LAND */
-    // 1) security reason
-    // 2) pathname may be corrupted by vfs utilities
-    char *kbuffer = (char *) kmalloc(PATH_MAX * sizeof(char));
-    if (kbuffer == NULL) {
-        return ENOMEM;
+    if (fd < 0 || fd >= OPEN_MAX) {
+        return NULL;
     }
-    int err = copyinstr((const_userptr_t) pathname, kbuffer, PATH_MAX, NULL);
-    if (err) {
-        kfree(kbuffer);
-        return err;     // may return EFAULT, ENAMETOOLONG
+
+    /* PINNING THE FILE WHILE NO OTHER THREAD CAN CHANGE THE TABLE */
+    lock_acquire(proc->p_fdlock);
+    of = fd_get(proc, fd);
+    if (of != NULL) {
+        spinlock_acquire(&of->ref_lock);
+        of->count_refs++;
+        spinlock_release(&of->ref_lock);
     }
+    lock_release(proc->p_fdlock);
+    return of;
+}
+#endif
 
-    /* OPEN DIRECTORY POINTED BY PATHANME */
-    struct vnode *vn = NULL;
-    err = vfs_open(kbuffer, O_RDONLY, 0644, &vn);
-    if (err) {
-        kfree(kbuffer);
-        return err; // may return EINVAL, ENOENT
+/**
+ * @brief fd_acquire() for the calls which move the seek position. If the process has a
+ *        single thread, does not share its file table, and has the file in no other slot,
+ *        nobody else can reach the open file until the call returns, since only this very
+ *        thread could make another reference to it (by dup2(), fork() or a new thread).
+ *        Then p_fdlock is skipped, *shared is false and the caller does without of->lock;
+ *        the first call after the file gets shared finds it so, and locks.
+ * 
+ * @param proc process owning the file table (the current one)
+ * @param fd file descriptor (any value; out of range means not in use)
+ * @param shared set to whether of->lock has to be taken around the transfer
+ * @return the open file, or NULL if fd is not in use
+ */
+#if OPT_SHELL
+static struct openfile *fd_acquire_io(struct proc *proc, int fd, bool *shared) {
+
+    struct fdtable *ft = proc->p_fdtable;
+    struct openfile *of;
+
+    /* ONLY THIS THREAD COULD RAISE THESE COUNTS, SO THEY CAN BE READ WITHOUT LOCKS */
+    if (proc->p_numthreads != 1 || ft == NULL || ft->ft_refs != 1) {
+        *shared = true;
+        return fd_acquire(proc, fd);
     }
-    kfree(kbuffer);
 
-    /* CHANGE CURRENT DIRECTORY WITH VFS UTILITY */
-    err = vfs_setcurdir(vn);
-    if (err) {
-        vfs_close(vn);
-        return err;
+    if (fd < 0 || fd >= OPEN_MAX) {
+        return NULL;
+    }
+    of = fd_get(proc, fd);
+    if (of == NULL) {
+        return NULL;
     }
+    spinlock_acquire(&of->ref_lock);
+    *shared = ++of->count_refs > 2;     // our slot, and this call
+    spinlock_release(&of->ref_lock);
+    return of;
+}
+#endif
 
-    /* CLOSING VNODE */
-    vfs_close(vn);
+/**
+ * @brief Take and drop of->lock around a transfer at the seek position, unless
+ *        fd_acquire_io() found the file unshared.
+ */
+#if OPT_SHELL
+static inline void file_io_lock(struct openfile *of, bool shared) {
+    if (shared) {
+        lock_acquire(of->lock);
+    }
+}
 
-    /* TASK COMPLETED SUCCESSFULLY */
-    return 0;
+static inline void file_io_unlock(struct openfile *of, bool shared) {
+    if (shared) {
+        lock_release(of->lock);
+    }
 }
 #endif
 
 /**
- * @brief The name of the current directory is computed and stored in buf, an area of size buflen. 
- *        The length of data actually stored, which must be non-negative, is returned. 
+ * @brief Drop the reference taken by fd_acquire(); the file is closed here if its
+ *        descriptor has been closed meanwhile.
  * 
- * @param buf buffer to store the result
- * @param buflen length of the buffer in which to store the result
- * @param retval the length of data actually stored
- * @return zero on success, an error value in case of failure 
+ * @param of open file returned by fd_acquire()
  */
 #if OPT_SHELL
-int sys_getcwd_SHELL(const char *buf, size_t buflen, int32_t *retval) {
+void fd_release(struct openfile *of) {
+    openfile_decref(of);
+}
+#endif
 
-    /* SOME ASSERTIONS */
-    KASSERT(curthread != NULL);
-    KASSERT(curthread->t_proc != NULL);
+/**
+ * @brief Let the child process share the file table of the parent (copy-on-write).
+ * 
+ * @param parent process whose table is shared
+ * @param child newly created process, which has no file table yet
+ */
+#if OPT_SHELL
+void fdtable_share(struct proc *parent, struct proc *child) {
 
-    /* INITIALIZING DATA FOR READING */
-    struct uio u;
-    struct iovec iov;
-    iov.iov_ubase = (userptr_t) buf;            
-	iov.iov_len = buflen;
-	u.uio_iov = &iov;
-	u.uio_iovcnt = 1;
-	u.uio_resid = buflen;
-	u.uio_offset = 0;
-	u.uio_segflg = UIO_USERSPACE;
-	u.uio_rw = UIO_READ;
-	u.uio_space = curthread->t_proc->p_addrspace;
+    struct fdtable *ft;
 
-    /* READING CURRENT DIRECTORY WITH VFS UTILITIES */
-    int err = vfs_getcwd(&u);
-	if (err) {
-		return err;
-	}
+    KASSERT(child->p_fdtable == NULL);
 
-    /* TASK COMPLETED SUCCESSFULLY */
-    *retval = buflen - u.uio_resid;
-    return 0;
+    /* ANOTHER THREAD OF THE PARENT MAY BE SWITCHING IT TO A PRIVATE COPY */
+    lock_acquire(parent->p_fdlock);
+    ft = parent->p_fdtable;
+    if (ft != NULL) {
+        spinlock_acquire(&ft->ft_lock);
+        ft->ft_refs++;
+        spinlock_release(&ft->ft_lock);
+        child->p_fdtable = ft;
+    }
+    lock_release(parent->p_fdlock);
 }
 #endif
 
-
 /**
- * @brief Alters the current seek position of the file handle fd, seeking to a new position based on pos and whence. 
- * 
- *         If whence is
- * 
- *                  SEEK_SET, the new position is pos.
- *                  SEEK_CUR, the new position is the current position plus pos.
- *                  SEEK_END, the new position is the position of end-of-file plus pos.
- *                  anything else, lseek fails. 
+ * @brief Drop the reference of the given process to its file table. The last process
+ *        to leave closes all the files still open and frees the table.
  * 
- * @param fd file handle
- * @param pos signed quantity indicating the offset to add
- * @param whence flag indicating the operation to perform
- * @param retval_low32 new seek position of the file (lower bytes)
- * @param retval_upp32 new seek position of the file (upper bytes)
- * @return zero on success, and error value in case of failure
+ * @param proc process being destroyed
  */
 #if OPT_SHELL
-int sys_lseek_SHELL(int fd, off_t pos, int whence, int32_t *retval_low32, int32_t *retval_upp32) {
-
-    off_t retval = -1;
+void fdtable_release(struct proc *proc) {
 
-    /* SOME ASSERTIONS */
-    KASSERT(curproc != NULL);
+    struct fdtable *ft = proc->p_fdtable;
 
-    /* CHECKING INPUT ARGUMENTS */
-    if (fd < 0 || fd >= OPEN_MAX) {
-        return EBADF;   // invalid file handler
-    } else if (curproc->fileTable[fd] == NULL) {
-        return EBADF;   // invalid file handler
+    if (ft != NULL) {
+        proc->p_fdtable = NULL;
+        fdtable_release_table(ft);
     }
+}
+#endif
 
-    /* CHECKING FILE */
-    if (!VOP_ISSEEKABLE(curproc->fileTable[fd]->vn)) {
-        return ESPIPE;  // fd refers to an object which does not support seeking.
+/**
+ * @brief Assign the lowest free file descriptor of the given process to the given
+ *        open file, using the bitmap of the process file table. The table is made
+ *        private and grown if it is full.
+ * 
+ * @param proc process owning the file table
+ * @param of open file to install
+ * @param retval file descriptor assigned
+ * @return zero on success, EMFILE if the process file table is full, ENOMEM if it
+ *         could not be copied or grown
+ */
+#if OPT_SHELL
+int fd_alloc(struct proc *proc, struct openfile *of, int *retval) {
+
+    /* MAKING THE TABLE PRIVATE */
+    int err = fdtable_prepare(proc, 0);
+    if (err) {
+        return err;
     }
+    struct fdtable *ft = proc->p_fdtable;
 
-    /* SETTING RETURN VALUE BASED ON WHENCE */
-    struct openfile *of = curproc->fileTable[fd];
-    int err;
-    struct stat info;
-    lock_acquire(of->lock);
-    retval = of->offset;
-    switch (whence) {
-        case SEEK_SET:
-            if (pos < 0) {
-                lock_release(of->lock);
-                return EINVAL;
-            }
-            retval = pos;
-        break;
+    /* SCANNING THE BITMAP A WORD AT A TIME, STARTING FROM THE HINT */
+    unsigned words = DIVROUNDUP(ft->ft_size, 32);
+    for (unsigned word = ft->ft_hint; word < words; word++) {
+        if (ft->ft_bitmap[word] == 0xffffffff) {
+            continue;   // no free fd in this word
+        }
 
-        case SEEK_CUR:
-            if (pos < 0 && -pos > of->offset) {
-                lock_release(of->lock);
-                return EINVAL;
-            }
-            retval = of->offset + pos;
-        break;
-        
-        case SEEK_END:
-            err = VOP_STAT(of->vn, &info);
-            if (err) {
-                lock_release(of->lock);
-                return err;
-            }
-            if (pos < 0 && -pos > info.st_size) {
-                lock_release(of->lock);
-                return EINVAL;
-            }
-            retval = info.st_size - pos;
-        break;
+        int fd = word * 32 + word_first_zero(ft->ft_bitmap[word]);
+        if ((unsigned) fd >= ft->ft_size) {
+            break;      // padding bits of the last word
+        }
 
-        default:
-            lock_release(of->lock);
-            return EINVAL;
+        fd_install(proc, fd, of);
+        ft->ft_hint = word;
+        *retval = fd;
+        return 0;
     }
 
-    /* TODO: MAYBE TRY TO SEEK THE NEW CURRENT POSITION AND CHECK IF IT WORKS (?) */
+    /* TABLE FULL: THE FIRST SLOT PAST ITS END, IF IT CAN GROW */
+    int fd = ft->ft_size;
+    ft->ft_hint = words;
+    if (fd >= OPEN_MAX) {
+        return EMFILE;
+    }
+    err = fdtable_grow(ft, fd + 1);
+    if (err) {
+        return err;
+    }
+    fd_install(proc, fd, of);
+    *retval = fd;
+    return 0;
+}
+#endif
 
-    /* UPDATING FILE */
-    of->offset = retval;
-    lock_release(of->lock);
+/**
+ * @brief Install the given open file on a specific (free) file descriptor of the given process.
+ * 
+ * @param proc process owning the file table, already prepared for fd
+ * @param fd file descriptor, which must be currently unused
+ * @param of open file to install
+ */
+#if OPT_SHELL
+void fd_install(struct proc *proc, int fd, struct openfile *of) {
 
-    /* SPLIT 64BIT RESULT INTO 32 BIT NUMBERS */
-    *retval_low32 = (int32_t) (retval >> 32);                   /* most significant bits */
-    *retval_upp32 = (int32_t) (retval & 0x00000000ffffffff);    /* least significant bits */
+    struct fdtable *ft = proc->p_fdtable;
 
-    /* TASK COMPLETED SUCCESSFULLY */
-    return 0;
+    KASSERT(ft != NULL && ft->ft_refs == 1);
+    KASSERT(fd >= 0 && (unsigned) fd < ft->ft_size);
+    KASSERT(ft->ft_files[fd] == NULL);
+
+    ft->ft_files[fd] = of;
+    ft->ft_bitmap[fd / 32] |= (uint32_t) 1 << (fd % 32);
+    ft->ft_cloexec[fd / 32] &= ~((uint32_t) 1 << (fd % 32));
 }
 #endif
 
+/**
+ * @brief Detach the file descriptor fd from the given process and drop the reference it
+ *        held on its open file. When the last reference goes away, the vnode is closed and
+ *        the entry goes back to the system file table.
+ * 
+ * @param proc process owning the file table, already prepared for fd
+ * @param fd file descriptor, which must refer to an open file
+ */
+#if OPT_SHELL
+void fd_close(struct proc *proc, int fd) {
+
+    struct fdtable *ft = proc->p_fdtable;
+
+    KASSERT(ft != NULL && ft->ft_refs == 1);
+    KASSERT(fd >= 0 && (unsigned) fd < ft->ft_size);
+    KASSERT(ft->ft_files[fd] != NULL);
+
+    /* RELEASING THE FILE DESCRIPTOR */
+    struct openfile *of = ft->ft_files[fd];
+    ft->ft_files[fd] = NULL;
+    ft->ft_bitmap[fd / 32] &= ~((uint32_t) 1 << (fd % 32));
+    ft->ft_cloexec[fd / 32] &= ~((uint32_t) 1 << (fd % 32));
+    if ((unsigned) fd / 32 < ft->ft_hint) {
+        ft->ft_hint = fd / 32;
+    }
+
+    /* AS IN POSIX, CLOSING ANY DESCRIPTOR OF A FILE DROPS THE LOCKS OF THE PROCESS ON IT */
+    if (proc->p_nrangelocks > 0) {
+        rangelock_close(proc, of->vn);
+    }
+
+    openfile_decref(of);
+}
+#endif
 
 /**
- * @brief dup2 clones the file handle oldfd onto the file handle newfd. If newfd names an open file, 
- *        that file is closed. 
+ * @brief Set or clear the close-on-exec flag of a file descriptor.
  * 
- * @param oldfd old file descriptor
- * @param newfd new file descriptor
- * @param retval new file descriptor
- * @return zero on success, an error value on failure 
+ * @param proc process owning the file table, already prepared for fd
+ * @param fd file descriptor, which must refer to an open file
+ * @param on whether the descriptor is to be closed at exec
  */
 #if OPT_SHELL
-int sys_dup2_SHELL(int oldfd, int newfd, int32_t *retval) {
+void fd_setcloexec(struct proc *proc, int fd, bool on) {
 
-    struct openfile *of;
+    struct fdtable *ft = proc->p_fdtable;
+    uint32_t bit = (uint32_t) 1 << (fd % 32);
 
-    /* SOME ASSERTION */
-    KASSERT(curproc != NULL);
+    KASSERT(ft != NULL && ft->ft_refs == 1);
+    KASSERT(fd >= 0 && (unsigned) fd < ft->ft_size);
+    KASSERT(ft->ft_files[fd] != NULL);
 
-    /* CHECKING INPUT ARGUMENTS */
-    if (oldfd < 0 || oldfd >= OPEN_MAX || newfd < 0 || newfd >= OPEN_MAX) {
-        return EBADF;   // invalid file handler
-    } else if (curproc->fileTable[oldfd] == NULL) {
-        return EBADF;   // invalid file handler
-    } else if (oldfd == newfd) {
-        *retval = newfd;
-        return 0;           // using dup2 to clone a file handle onto itself has no effect
-    } 
+    if (on) {
+        ft->ft_cloexec[fd / 32] |= bit;
+    } else {
+        ft->ft_cloexec[fd / 32] &= ~bit;
+    }
+}
+#endif
 
-    /* CHECKING WHETHER newfd REFERS TO AN OPEN FILE */
-    if (curproc->fileTable[newfd] != NULL) {
-        
-        /* newfd REFERS TO AN OPEN FILE --> CLOSE IT */
-        of = curproc->fileTable[newfd];
-        lock_acquire(of->lock);
-        curproc->fileTable[newfd] = NULL;
-        if (--of->count_refs == 0) {
+/**
+ * @brief Make the file table private if it has descriptors to close at exec.
+ * 
+ * @param proc process about to exec
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int fdtable_prepare_exec(struct proc *proc) {
+
+    struct fdtable *ft;
+    unsigned words, word;
+    int err = 0;
+
+    lock_acquire(proc->p_fdlock);
+    ft = proc->p_fdtable;
+    if (ft != NULL) {
+        words = DIVROUNDUP(ft->ft_size, 32);
+        word = 0;
+        while (word < words && ft->ft_cloexec[word] == 0) {
+            word++;
+        }
+        if (word < words) {
+            err = fdtable_prepare(proc, 0);
+        }
+    }
+    lock_release(proc->p_fdlock);
+    return err;
+}
+#endif
 
-            /* NO MORE PROCESS REFER TO THIS FILE, CLOSING ALSO VNODE */
-            struct vnode *vn = of->vn;
-            of->vn = NULL;
-            vfs_close(vn);
+/**
+ * @brief Close the descriptors flagged close-on-exec, a bitmap word at a time.
+ * 
+ * @param proc process whose table was prepared by fdtable_prepare_exec()
+ */
+#if OPT_SHELL
+void fdtable_closeexec(struct proc *proc) {
+
+    struct fdtable *ft;
+    unsigned words;
+
+    lock_acquire(proc->p_fdlock);
+    ft = proc->p_fdtable;
+    words = (ft == NULL) ? 0 : DIVROUNDUP(ft->ft_size, 32);
+    for (unsigned word = 0; word < words; word++) {
+        uint32_t flagged = ft->ft_cloexec[word];
+        while (flagged != 0) {
+            fd_close(proc, word * 32 + word_first_zero(~flagged));     // clears the flag too
+            flagged &= flagged - 1;     // clearing the lowest bit set
         }
-        lock_release(of->lock);
-        of = NULL;
     }
+    lock_release(proc->p_fdlock);
+}
+#endif
 
-    /* INCREMENTIG COUNTING REFERENCES */
-    of = curproc->fileTable[oldfd];
-    lock_acquire(of->lock);
-    of->count_refs++;
-    lock_release(of->lock);
+/**
+ * @brief sys_write_SHELL() writes up to buflen bytes to the file specified by fd, 
+ *        at the location in the file specified by the current seek position of the 
+ *        file, taking the data from the space pointed to by buf. The file must be 
+ *        open for writing.
+ * 
+ *        The current seek position of the file is advanced by the number of bytes written.
+ *        Each write (or read) operation is atomic relative to other I/O to the same file. 
+ *        If the file was opened with O_APPEND, each write goes at the end of the file,
+ *        and concurrent short writes are committed together (see appendlog.h).
+ * 
+ * @param fd destination file
+ * @param buf source buffer
+ * @param buflen number of bytes to be written
+ * @param retval actual number of bytes written
+ * @return zero on success. an error value in case of failure
+*/
+#if OPT_SHELL
+ssize_t sys_write_SHELL(int fd, const void *buf, size_t buflen, int32_t *retval) {
 
-    /* ASSIGNING TO NEW FILE DESCRIPTOR */
-    curproc->fileTable[newfd] = of;     // i.e.     curproc->fileTable[newfd] = curproc->fileTable[oldfd];
+    /* CHECKING FILE DESCRIPTOR (the reference keeps the file open until we are done) */
+    bool shared;
+    struct openfile *of = fd_acquire_io(curproc, fd, &shared);
+    if (of == NULL) {                                               /* fd should refer to a valid entry in the fileTable    */
+        return EBADF;
+    } else if (of->mode_open == O_RDONLY) {                         /* fd should refer to a file allowed to be written      */
+        fd_release(of);
+        return EBADF;
+    }
+
+    /* CHECKING THE BUFFER UP FRONT ON PIPES AND DEVICES (what went out cannot be taken back) */
+    // files are left to the fault handling of uiomove(), as this takes vm_lock
+    int error = 0;
+    if (!VOP_ISSEEKABLE(of->vn)) {
+        error = usercheck((const_userptr_t) buf, buflen, false);
+    }
+    if (error) {
+        fd_release(of);
+        return error;
+    }
+
+    /* PERFORMING WRITING (VOP_WRITE()) */
+    // the uio refers directly to the user buffer: uiomove() copies the data in
+    // chunk by chunk, so no kernel buffer of buflen bytes is ever needed
+    struct iovec iov;
+	struct uio uuio;
+    struct vnode *vn = of->vn;
+
+    if (of->append) {
+
+        /* APPENDING: THE END OF THE FILE IS FOUND BY appendlog_write() */
+        // not under of->lock, so that processes sharing the descriptor can
+        // have their records written out together (group commit)
+        uio_uinit(&iov, &uuio, (userptr_t) buf, buflen, 0, UIO_WRITE);
+        uuio.uio_direct = of->direct;
+        uuio.uio_advice = of->advice;
+        error = appendlog_write(vn, &uuio);
+        file_io_lock(of, shared);
+    } else {
+        file_io_lock(of, shared);
+        uio_uinit(&iov, &uuio, (userptr_t) buf, buflen, of->offset, UIO_WRITE);
+        uuio.uio_direct = of->direct;
+        uuio.uio_advice = of->advice;
+        error = VOP_WRITE(vn, &uuio);
+    }
+    if (error) {
+        file_io_unlock(of, shared);
+        fd_release(of);
+        return error;   // may return EFAULT if buf is not a valid user pointer
+    }
+
+    /* REPOSITION OF THE OFFSET */
+    // counted from uio_resid, as devices like null: consume data without
+    // moving uio_offset
+    size_t nbytes = buflen - uuio.uio_resid;
+    *retval = (int32_t) nbytes;
+    of->offset = uuio.uio_offset;
+    file_io_unlock(of, shared);
+    fd_release(of);
+    proc_charge_io(true, nbytes);
+
+    /* TASK COMPLETED SUCCESSFULLY */
+    return 0;
+}
+#endif
+
+/**
+ * @brief sys_read_SHELL() reads up to buflen bytes from the file specified by fd, at the 
+ *        location in the file specified by the current seek position of the file, and 
+ *        stores them in the space pointed to by buf. The file must be open for reading.
+ *  
+ *        The current seek position of the file is advanced by the number of bytes read. 
+ * 
+ * @param fd source file
+ * @param buf destination buffer
+ * @param count number of bytes to be read
+ * @return zero on success. an error value in case of failure
+*/
+#if OPT_SHELL
+ssize_t sys_read_SHELL(int fd, const void *buf, size_t buflen, int32_t *retval) {
+
+    /* CHECKING FILE DESCRIPTOR (the reference keeps the file open until we are done) */
+    bool shared;
+    struct openfile *of = fd_acquire_io(curproc, fd, &shared);
+    if (of == NULL) {                                               /* fd should refer to a valid entry in the fileTable    */
+        return EBADF;
+    } else if (of->mode_open == O_WRONLY) {                         /* fd should refer to a file allowed to be read         */
+        fd_release(of);
+        return EBADF;
+    } else if (buf == NULL) {
+        fd_release(of);
+        return EFAULT;
+    } 
+
+    /* CHECKING THE BUFFER UP FRONT ON PIPES AND DEVICES (what was taken would be lost) */
+    // files are left to the fault handling of uiomove(), as this takes vm_lock
+    int err = 0;
+    if (!VOP_ISSEEKABLE(of->vn)) {
+        err = usercheck((const_userptr_t) buf, buflen, true);
+    }
+    if (err) {
+        fd_release(of);
+        return err;
+    }
+
+    /* PERFORMING READING (VOP_READ()) */
+    // the uio refers directly to the user buffer: uiomove() copies the data out
+    // chunk by chunk, so no kernel buffer of buflen bytes is ever needed
+    struct iovec iov;
+    struct uio uuio;
+    struct vnode *vn = of->vn;
+    file_io_lock(of, shared);
+    uio_uinit(&iov, &uuio, (userptr_t) buf, buflen, of->offset, UIO_READ);
+    uuio.uio_direct = of->direct;
+    uuio.uio_advice = of->advice;
+    err = VOP_READ(vn, &uuio);
+    if (err) {
+        file_io_unlock(of, shared);
+        fd_release(of);
+        return err;     // may return EFAULT if buf is not a valid user pointer
+    }
+
+    /* REPOSITION OF THE OFFSET */
+    of->offset = uuio.uio_offset;
+    *retval = buflen - uuio.uio_resid;
+    file_io_unlock(of, shared);
+    fd_release(of);
+    proc_charge_io(false, buflen - uuio.uio_resid);
+
+    /* TASK COMPLETED SUCCESSFULLY */
+    return 0;
+}
+#endif
+
+/**
+ * @brief Absolute name of a file opened by the current process, to reopen it from a
+ *        checkpoint image in another directory: a relative path is put after the current
+ *        directory (or, starting with '/', after its volume).
+ * 
+ * @param path name given to open()
+ * @return path itself if it names a device or volume already, otherwise a new string, or
+ *         NULL if there is no memory or no current directory
+ */
+#if OPT_SHELL
+static char *file_abspath(char *path) {
+
+    if (strchr(path, ':') != NULL) {
+        return path;
+    }
+
+    /* READING THE CURRENT DIRECTORY, AS "VOLUME:DIR" */
+    char *cwd = pathbuf_get();
+    if (cwd == NULL) {
+        return NULL;
+    }
+    struct iovec iov;
+    struct uio ku;
+    uio_kinit(&iov, &ku, cwd, PATH_MAX - 1, 0, UIO_READ);
+    if (vfs_getcwd(&ku)) {
+        pathbuf_put(cwd);
+        return NULL;
+    }
+    size_t len = PATH_MAX - 1 - ku.uio_resid;
+    cwd[len] = '\0';
+
+    /* A PATH FROM THE ROOT ONLY KEEPS THE VOLUME */
+    if (path[0] == '/') {
+        len = strchr(cwd, ':') - cwd + 1;
+    }
+    bool slash = path[0] != '/' && cwd[len - 1] != ':';
+
+    char *abs = kmalloc(len + slash + strlen(path) + 1);
+    if (abs != NULL) {
+        memcpy(abs, cwd, len);
+        if (slash) {
+            abs[len] = '/';
+        }
+        strcpy(abs + len + slash, path);
+    }
+    pathbuf_put(cwd);
+    return abs;
+}
+#endif
+
+/**
+ * @brief sys_open_SHELL() opens the file, device, or other kernel object named by the pathname 
+ *        provided. The flags argument specifies how to open the file. The optional mode argument 
+ *        is only meaningful in Unix and can be ignored. 
+ *        With O_DIRECT, reads and writes of whole blocks skip the buffer cache of the file
+ *        system, where it has one (SFS), and go straight between the user buffer and the disk.
+ * 
+ * ERRORS:
+ *      //ENODEV		The device prefix of filename did not exist.
+ *      ENOTDIR		A non-final component of filename was not a directory.
+ *      //ENOENT		A non-final component of filename did not exist.
+ *      //ENOENT		The named file does not exist, and O_CREAT was not specified.
+ *      EEXIST		The named file exists, and O_EXCL was specified.
+ *      EISDIR		The named object is a directory, and it was to be opened for writing.   
+ *      //EMFILE		The process's file table was full, or a process-specific limit on open files was reached.  
+ *      //ENFILE		The system file table is full, if such a thing exists, or a system-wide limit on open files was reached.
+ *      //ENXIO		The named object is a block device with no mounted filesystem.
+ *      ENOSPC		The file was to be created, and the filesystem involved is full.
+ *      //EINVAL		flags contained invalid values.
+ *      EIO		    A hard I/O error occurred.
+ *      //EFAULT		filename was an invalid pointer. 
+ * 
+ * @param pathname relative or absolute path of the file to open
+ * @param openflags how to open the file
+ * @param mode can be ignored
+ * @param retval file handler of the open file
+ * @return zero on success. an error value in case of failure 
+ */
+#if OPT_SHELL
+int sys_open_SHELL(userptr_t pathname, int openflags, mode_t mode, int32_t *retval) {
+
+    /* CHECKING INPUT ARGUMENTS */
+    if (pathname == NULL) {
+        return EFAULT;
+    }
+
+    /* MANAGING MODE */
+    int mode_open;
+    switch(openflags & O_ACCMODE){
+	    case O_RDONLY:
+			mode_open = O_RDONLY;
+			break;
+		case O_WRONLY:
+			mode_open = O_WRONLY;
+			break;
+		case O_RDWR:
+			mode_open = O_RDWR;
+			break;
+		default:
+			return EINVAL;
+	}
+
+    /* COPYING PATHNAME TO KERNEL SIDE */
+    // this is done for two reasons:
+    // 1) security reason
+    // 2) vfs_open may destroy the buffer
+    char *kbuffer = pathbuf_get();     // borrowed from the per-cpu pool
+    if (kbuffer == NULL) {
+        return ENOMEM;
+    }
+    size_t len;
+    int err = copyinstr((const_userptr_t) pathname, kbuffer, PATH_MAX, &len); // may return EFAULT
+    if (err) {
+        pathbuf_put(kbuffer);
+        return EFAULT;
+    }
+
+    /* RETRIEVING A FREE POSITION IN THE SYSTEM FILETABLE */
+    struct openfile *of;
+    err = openfile_alloc(&of);      // may return ENFILE, ENOMEM
+    if (err) {
+        pathbuf_put(kbuffer);
+        return err;
+    }
+
+    /* KEEPING THE NAME FOR CHECKPOINT(), SINCE VFS_OPEN MAY DESTROY THE BUFFER */
+    char *name = kstrdup(kbuffer);     // no memory just means the file is not checkpointed
+
+    /* OPENING WITH VFS UTILITY */
+    struct vnode *v;
+    err = vfs_open(kbuffer, openflags & ~O_CLOEXEC, mode, &v);   // may return ENOENT, ENXIO, ENODEV
+    pathbuf_put(kbuffer);
+    if (err) {
+        if (name != NULL) {
+            kfree(name);
+        }
+        openfile_release(of);
+        return err;
+    }
+    if (name != NULL) {
+        of->path = VOP_ISSEEKABLE(v) ? file_abspath(name) : NULL;
+        if (of->path != name) {
+            kfree(name);
+        }
+    }
+
+    /* MANAGING OFFSET */
+    // if flag specified O_APPEND, the operation on the file should start at the end
+    // otherwise, it should start at the beginning
+    if (openflags & O_APPEND) {
+
+            /* RETRIEVING FILE SIZE */
+            struct stat filestat;
+            err = VOP_STAT(v, &filestat);
+            if (err) {
+                vfs_close(v);
+                openfile_release(of);
+                return err;
+            }
+            of->offset = filestat.st_size;
+    } else {
+
+            /* STARTING FROM THE BEGINNING */
+            of->offset = 0;
+    }
+
+    /* FILLING THE OPENFILE */
+    of->vn = v;
+    of->mode_open = mode_open;
+    of->direct = (openflags & O_DIRECT) != 0;
+    of->append = (openflags & O_APPEND) && VOP_ISSEEKABLE(v);
+    of->advice = POSIX_FADV_NORMAL;
+    of->count_refs = 1;
+
+    /* ASSIGNING OPENFILE TO CURRENT PROCESS FILETABLE */
+    int fd;
+    lock_acquire(curproc->p_fdlock);
+    err = fd_alloc(curproc, of, &fd);   // may return EMFILE
+    if (!err && (openflags & O_CLOEXEC)) {
+        fd_setcloexec(curproc, fd, true);
+    }
+    lock_release(curproc->p_fdlock);
+    if (err) {
+        of->vn = NULL;
+        vfs_close(v);
+        openfile_release(of);
+        return err;
+    }
+
+    /* TASK COMPLETED SUCCESSFULLY */
+    *retval = fd;
+    return 0;
+}
+#endif
+
+/**
+ * @brief the file handle fd is closed.
+ * 
+ * @param fd file descriptor
+ * @return zero on success, an error value in case of failure 
+*/
+#if OPT_SHELL
+int sys_close_SHELL(int fd) {
+    return file_close(curproc, fd);
+}
+#endif
+
+/**
+ * @brief Close a file descriptor of the given process (common code of close() and of
+ *        the file actions of spawn()).
+ * 
+ * @param proc process owning the file table
+ * @param fd file descriptor
+ * @return zero on success, an error value in case of failure 
+ */
+#if OPT_SHELL
+int file_close(struct proc *proc, int fd) {
+
+    /* CHECKING FILE DESCRIPTOR */
+    if (fd < 0 || fd >= OPEN_MAX) {                                 /* fd should be a valid number                          */
+        return EBADF;       
+    }
+
+    /* NO OTHER THREAD OF THE PROCESS CHANGES THE TABLE MEANWHILE */
+    lock_acquire(proc->p_fdlock);
+    if (fd_get(proc, fd) == NULL) {                                 /* fd should refer to a valid entry in the fileTable    */
+        lock_release(proc->p_fdlock);
+        return EBADF;
+    }
+
+    /* UNSHARING THE TABLE, IF THIS PROCESS WAS FORKED */
+    int err = fdtable_prepare(proc, fd);
+    if (err) {
+        lock_release(proc->p_fdlock);
+        return err;
+    }
+
+    /* RELEASING FILE DESCRIPTOR AND REDUCING REFERENCES (calls in progress keep their own) */
+    fd_close(proc, fd);
+    lock_release(proc->p_fdlock);
+
+    /* TASK COMPLETED SUCCESSFULLY */
+    return 0;
+}
+#endif
+
+/**
+ * @brief The name of the file referred to by pathname is removed from the filesystem. 
+ *        The actual file itself is not removed until no further references to it exist, 
+ *        whether those references are on disk or in memory.
+ * 
+ * @param pathname specify an existing file.
+ * @return zero on success, an error value in case of failure.
+ */
+#if OPT_SHELL
+int sys_remove_SHELL(const char *pathname) {
+
+    /* NOT IMPLEMENTED (YET?) */
+    (void) pathname;
+
+    /* TASK COMPLETED SUCCESSFULLY */
+    return 0;
+}
+#endif
+
+/**
+ * @brief The current directory of the current process is set to the directory named by pathname. 
+ * 
+ * @param pathname directory to be set as current.
+ * @return zero on success, an error value in case of failure.
+ */
+#if OPT_SHELL
+int sys_chdir_SHELL(const char *pathname) {
+
+    /* SOME ASSERTIONS */
+    KASSERT(curthread != NULL);
+    KASSERT(curthread->t_proc != NULL);
+
+    /* COPYING PATHNAME FROM USERLAND TO KERNEL LAND */
+    // 1) security reason
+    // 2) pathname may be corrupted by vfs utilities
+    char *kbuffer = pathbuf_get();     // borrowed from the per-cpu pool
+    if (kbuffer == NULL) {
+        return ENOMEM;
+    }
+    int err = copyinstr((const_userptr_t) pathname, kbuffer, PATH_MAX, NULL);
+    if (err) {
+        pathbuf_put(kbuffer);
+        return err;     // may return EFAULT, ENAMETOOLONG
+    }
+
+    /* OPEN DIRECTORY POINTED BY PATHANME */
+    struct vnode *vn = NULL;
+    err = vfs_open(kbuffer, O_RDONLY, 0644, &vn);
+    pathbuf_put(kbuffer);
+    if (err) {
+        return err; // may return EINVAL, ENOENT
+    }
+
+    /* CHANGE CURRENT DIRECTORY WITH VFS UTILITY */
+    err = vfs_setcurdir(vn);
+    if (err) {
+        vfs_close(vn);
+        return err;
+    }
+
+    /* CLOSING VNODE */
+    vfs_close(vn);
+
+    /* TASK COMPLETED SUCCESSFULLY */
+    return 0;
+}
+#endif
+
+/**
+ * @brief The name of the current directory is computed and stored in buf, an area of size buflen. 
+ *        The length of data actually stored, which must be non-negative, is returned. 
+ * 
+ * @param buf buffer to store the result
+ * @param buflen length of the buffer in which to store the result
+ * @param retval the length of data actually stored
+ * @return zero on success, an error value in case of failure 
+ */
+#if OPT_SHELL
+int sys_getcwd_SHELL(const char *buf, size_t buflen, int32_t *retval) {
+
+    /* SOME ASSERTIONS */
+    KASSERT(curthread != NULL);
+    KASSERT(curthread->t_proc != NULL);
+
+    /* INITIALIZING DATA FOR READING */
+    struct uio u;
+    struct iovec iov;
+    uio_uinit(&iov, &u, (userptr_t) buf, buflen, 0, UIO_READ);
+
+    /* READING CURRENT DIRECTORY WITH VFS UTILITIES */
+    int err = vfs_getcwd(&u);
+	if (err) {
+		return err;
+	}
+
+    /* TASK COMPLETED SUCCESSFULLY */
+    *retval = buflen - u.uio_resid;
+    return 0;
+}
+#endif
+
+
+/**
+ * @brief Alters the current seek position of the file handle fd, seeking to a new position based on pos and whence. 
+ * 
+ *         If whence is
+ * 
+ *                  SEEK_SET, the new position is pos.
+ *                  SEEK_CUR, the new position is the current position plus pos.
+ *                  SEEK_END, the new position is the position of end-of-file plus pos.
+ *                  anything else, lseek fails. 
+ * 
+ * @param fd file handle
+ * @param pos signed quantity indicating the offset to add
+ * @param whence flag indicating the operation to perform
+ * @param retval_low32 new seek position of the file (lower bytes)
+ * @param retval_upp32 new seek position of the file (upper bytes)
+ * @return zero on success, and error value in case of failure
+ */
+#if OPT_SHELL
+int sys_lseek_SHELL(int fd, off_t pos, int whence, int32_t *retval_low32, int32_t *retval_upp32) {
+
+    off_t retval = -1;
+
+    /* SOME ASSERTIONS */
+    KASSERT(curproc != NULL);
+
+    /* CHECKING INPUT ARGUMENTS */
+    struct openfile *of = fd_acquire(curproc, fd);
+    if (of == NULL) {
+        return EBADF;   // invalid file handler
+    }
+
+    /* CHECKING FILE */
+    if (!VOP_ISSEEKABLE(of->vn)) {
+        fd_release(of);
+        return ESPIPE;  // fd refers to an object which does not support seeking.
+    }
+
+    /* SETTING RETURN VALUE BASED ON WHENCE */
+    int err;
+    struct stat info;
+    lock_acquire(of->lock);
+    retval = of->offset;
+    switch (whence) {
+        case SEEK_SET:
+            if (pos < 0) {
+                lock_release(of->lock);
+                fd_release(of);
+                return EINVAL;
+            }
+            retval = pos;
+        break;
+
+        case SEEK_CUR:
+            if (pos < 0 && -pos > of->offset) {
+                lock_release(of->lock);
+                fd_release(of);
+                return EINVAL;
+            }
+            retval = of->offset + pos;
+        break;
+        
+        case SEEK_END:
+            err = VOP_STAT(of->vn, &info);
+            if (err) {
+                lock_release(of->lock);
+                fd_release(of);
+                return err;
+            }
+            if (pos < 0 && -pos > info.st_size) {
+                lock_release(of->lock);
+                fd_release(of);
+                return EINVAL;
+            }
+            retval = info.st_size - pos;
+        break;
+
+        default:
+            lock_release(of->lock);
+            fd_release(of);
+            return EINVAL;
+    }
+
+    /* TODO: MAYBE TRY TO SEEK THE NEW CURRENT POSITION AND CHECK IF IT WORKS (?) */
+
+    /* UPDATING FILE */
+    of->offset = retval;
+    lock_release(of->lock);
+    fd_release(of);
+
+    /* SPLIT 64BIT RESULT INTO 32 BIT NUMBERS */
+    *retval_low32 = (int32_t) (retval >> 32);                   /* most significant bits */
+    *retval_upp32 = (int32_t) (retval & 0x00000000ffffffff);    /* least significant bits */
+
+    /* TASK COMPLETED SUCCESSFULLY */
+    return 0;
+}
+#endif
+
+
+/**
+ * @brief dup2 clones the file handle oldfd onto the file handle newfd. If newfd names an open file, 
+ *        that file is closed. 
+ * 
+ * @param oldfd old file descriptor
+ * @param newfd new file descriptor
+ * @param retval new file descriptor
+ * @return zero on success, an error value on failure 
+ */
+#if OPT_SHELL
+int sys_dup2_SHELL(int oldfd, int newfd, int32_t *retval) {
+
+    /* SOME ASSERTION */
+    KASSERT(curproc != NULL);
+
+    int err = file_dup2(curproc, oldfd, newfd);
+    if (err) {
+        return err;
+    }
+
+    /* TASK COMPLETED SUCCESSFULLY */
+    *retval = newfd;
+    return 0;
+}
+#endif
+
+/**
+ * @brief F_GETLK, F_SETLK and F_SETLKW of fcntl(): the byte range described by *uflock,
+ *        from l_start relative to l_whence for l_len bytes (to the end of the file, however
+ *        far it grows, if zero; the l_len bytes before l_start if negative), is tested for
+ *        a lock of another process, or locked or unlocked (see rangelock.h). Shared locks
+ *        need the file open for reading, exclusive ones for writing.
+ * 
+ * @param fd file descriptor
+ * @param cmd F_GETLK, F_SETLK or F_SETLKW
+ * @param uflock user pointer to the struct flock; F_GETLK overwrites it with the lock in
+ *        the way, or just sets l_type to F_UNLCK if there is none
+ * @return zero on success, an error value on failure
+ */
+#if OPT_SHELL
+static int file_lock(int fd, int cmd, userptr_t uflock) {
+
+    struct flock fl;
+    struct stat info;
+    off_t base, start, end;
+    int mode, err;
+
+    struct openfile *of = fd_acquire(curproc, fd);
+    if (of == NULL) {
+        return EBADF;
+    }
+    err = copyin(uflock, &fl, sizeof(fl));
+    if (err) {
+        fd_release(of);
+        return err;
+    }
+
+    /* WHERE THE RANGE IS COUNTED FROM */
+    switch (fl.l_whence) {
+        case SEEK_SET:
+            base = 0;
+            break;
+
+        case SEEK_CUR:
+            lock_acquire(of->lock);
+            base = of->offset;
+            lock_release(of->lock);
+            break;
+
+        case SEEK_END:
+            err = VOP_STAT(of->vn, &info);
+            if (err) {
+                fd_release(of);
+                return err;
+            }
+            base = info.st_size;
+            break;
+
+        default:
+            fd_release(of);
+            return EINVAL;
+    }
+
+    /* TURNING IT INTO [start, end), WITHOUT OVERFLOWING */
+    start = base + fl.l_start;
+    if ((fl.l_start > 0 && start < base) || start < 0) {
+        fd_release(of);
+        return EINVAL;
+    }
+    if (fl.l_len > 0) {
+        end = (fl.l_len >= RANGELOCK_EOF - start) ? RANGELOCK_EOF : start + fl.l_len;
+    } else if (fl.l_len == 0) {
+        end = RANGELOCK_EOF;
+    } else {
+        end = start;
+        start += fl.l_len;
+    }
+    if (start < 0 || start >= end) {
+        fd_release(of);
+        return EINVAL;
+    }
+
+    mode = of->mode_open & O_ACCMODE;
+    switch (fl.l_type) {
+        case F_RDLCK:
+            err = (cmd != F_GETLK && mode == O_WRONLY) ? EBADF : 0;
+            break;
+
+        case F_WRLCK:
+            err = (cmd != F_GETLK && mode == O_RDONLY) ? EBADF : 0;
+            break;
+
+        case F_UNLCK:
+            err = (cmd == F_GETLK) ? EINVAL : 0;
+            break;
+
+        default:
+            err = EINVAL;
+            break;
+    }
+    if (err) {
+        fd_release(of);
+        return err;
+    }
+
+    if (cmd == F_GETLK) {
+        if (!rangelock_test(of->vn, start, end, fl.l_type, &fl)) {
+            fl.l_type = F_UNLCK;
+        }
+        err = copyout(&fl, uflock, sizeof(fl));
+    } else {
+        err = rangelock_set(of->vn, start, end, fl.l_type, cmd == F_SETLKW);   // may sleep
+    }
+
+    fd_release(of);
+    return err;
+}
+#endif
+
+/**
+ * @brief sys_fcntl_SHELL() operates on the file descriptor fd: F_GETFD and F_SETFD get
+ *        and set its flags, of which there is just FD_CLOEXEC, F_GETFL gets the access
+ *        mode the file was opened with, plus O_DIRECT, and F_GETLK, F_SETLK and F_SETLKW
+ *        work on the byte-range locks of the file (see file_lock()).
+ * 
+ * @param fd file descriptor
+ * @param cmd operation to perform
+ * @param arg F_SETFD: the new flags; F_GETLK, F_SETLK, F_SETLKW: user pointer to a
+ *        struct flock
+ * @param retval F_GETFD, F_GETFL: the flags
+ * @return zero on success, an error value on failure 
+ */
+#if OPT_SHELL
+int sys_fcntl_SHELL(int fd, int cmd, int arg, int32_t *retval) {
+
+    struct fdtable *ft;
+    struct openfile *of;
+    int err = 0;
+
+    /* SOME ASSERTION */
+    KASSERT(curproc != NULL);
+
+    /* CHECKING FILE DESCRIPTOR */
+    if (fd < 0 || fd >= OPEN_MAX) {
+        return EBADF;
+    }
+
+    /* LOCKING MAY SLEEP FOR LONG: NOT UNDER p_fdlock */
+    if (cmd == F_GETLK || cmd == F_SETLK || cmd == F_SETLKW) {
+        err = file_lock(fd, cmd, (userptr_t) arg);
+        if (!err) {
+            *retval = 0;
+        }
+        return err;
+    }
+
+    lock_acquire(curproc->p_fdlock);
+    of = fd_get(curproc, fd);
+    if (of == NULL) {
+        lock_release(curproc->p_fdlock);
+        return EBADF;
+    }
+    switch (cmd) {
+        case F_GETFD:
+            ft = curproc->p_fdtable;
+            *retval = (ft->ft_cloexec[fd / 32] & ((uint32_t) 1 << (fd % 32))) ? FD_CLOEXEC : 0;
+            break;
+
+        case F_SETFD:
+            /* THE FLAG BELONGS TO THE DESCRIPTOR: UNSHARING THE TABLE FIRST */
+            err = fdtable_prepare(curproc, fd);     // may return ENOMEM
+            if (!err) {
+                fd_setcloexec(curproc, fd, (arg & FD_CLOEXEC) != 0);
+                *retval = 0;
+            }
+            break;
+
+        case F_GETFL:
+            *retval = of->mode_open | (of->direct ? O_DIRECT : 0) | (of->append ? O_APPEND : 0);
+            break;
+
+        default:
+            err = EINVAL;
+            break;
+    }
+    lock_release(curproc->p_fdlock);
+    return err;
+}
+#endif
+
+/**
+ * @brief sys_pipe_SHELL() creates a pipe and opens its two ends in the current process:
+ *        filehandles[0] for reading and filehandles[1] for writing. What is written to
+ *        the second can be read from the first (see pipe.h).
+ * 
+ * @param filehandles where to store the two file descriptors (user pointer to int[2])
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_pipe_SHELL(userptr_t filehandles) {
+
+    /* RETRIEVING TWO FREE POSITIONS IN THE SYSTEM FILETABLE */
+    struct openfile *rof, *wof;
+    int err = openfile_alloc(&rof);     // may return ENFILE, ENOMEM
+    if (err) {
+        return err;
+    }
+    err = openfile_alloc(&wof);
+    if (err) {
+        openfile_release(rof);
+        return err;
+    }
+
+    /* CREATING THE PIPE */
+    struct vnode *rv, *wv;
+    err = pipe_create(&rv, &wv);        // may return ENOMEM
+    if (err) {
+        openfile_release(wof);
+        openfile_release(rof);
+        return err;
+    }
+
+    /* FILLING THE OPENFILES (pipes are not seekable, the offset stays zero) */
+    rof->vn = rv;
+    rof->mode_open = O_RDONLY;
+    rof->count_refs = 1;
+    wof->vn = wv;
+    wof->mode_open = O_WRONLY;
+    wof->count_refs = 1;
+
+    /* ASSIGNING THEM TO THE CURRENT PROCESS FILETABLE */
+    int fds[2];
+    lock_acquire(curproc->p_fdlock);
+    err = fd_alloc(curproc, rof, &fds[0]);  // may return EMFILE
+    if (err) {
+        lock_release(curproc->p_fdlock);
+        rof->vn = wof->vn = NULL;
+        vfs_close(rv);
+        vfs_close(wv);
+        openfile_release(wof);
+        openfile_release(rof);
+        return err;
+    }
+    err = fd_alloc(curproc, wof, &fds[1]);
+    lock_release(curproc->p_fdlock);
+    if (err) {
+        file_close(curproc, fds[0]);        // takes the read end with it
+        wof->vn = NULL;
+        vfs_close(wv);
+        openfile_release(wof);
+        return err;
+    }
+
+    /* RETURNING THE FILE DESCRIPTORS */
+    err = copyout(fds, filehandles, sizeof(fds));
+    if (err) {
+        file_close(curproc, fds[0]);
+        file_close(curproc, fds[1]);
+        return err;
+    }
+
+    /* TASK COMPLETED SUCCESSFULLY */
+    return 0;
+}
+#endif
+
+/**
+ * @brief Performs the device-specific operation code on the object open as fd (see
+ *        <kern/ioctl.h>), passing it the user pointer data.
+ * 
+ * @param fd file descriptor
+ * @param code operation to perform
+ * @param data operation argument (user pointer)
+ * @return zero on success, an error value on failure 
+ */
+#if OPT_SHELL
+int sys_ioctl_SHELL(int fd, int code, userptr_t data) {
+
+    /* SOME ASSERTIONS */
+    KASSERT(curproc != NULL);
+
+    /* CHECKING INPUT ARGUMENTS */
+    struct openfile *of = fd_acquire(curproc, fd);
+    if (of == NULL) {
+        return EBADF;   // invalid file handler
+    }
+
+    /* THE OBJECT CHECKS THE CODE AND MOVES THE DATA ITSELF */
+    int err = VOP_IOCTL(of->vn, code, data);
+    fd_release(of);
+    return err;
+}
+#endif
+
+/**
+ * @brief Clone the file handle oldfd of the given process onto its file handle newfd
+ *        (common code of dup2() and of the file actions of spawn()).
+ * 
+ * @param proc process owning the file table
+ * @param oldfd old file descriptor
+ * @param newfd new file descriptor
+ * @return zero on success, an error value on failure 
+ */
+#if OPT_SHELL
+int file_dup2(struct proc *proc, int oldfd, int newfd) {
+
+    struct openfile *of;
+
+    /* CHECKING INPUT ARGUMENTS */
+    if (oldfd < 0 || oldfd >= OPEN_MAX || newfd < 0 || newfd >= OPEN_MAX) {
+        return EBADF;   // invalid file handler
+    }
+
+    /* NO OTHER THREAD OF THE PROCESS CHANGES THE TABLE MEANWHILE */
+    lock_acquire(proc->p_fdlock);
+    if (fd_get(proc, oldfd) == NULL) {
+        lock_release(proc->p_fdlock);
+        return EBADF;   // invalid file handler
+    } else if (oldfd == newfd) {
+        lock_release(proc->p_fdlock);
+        return 0;           // using dup2 to clone a file handle onto itself has no effect
+    } 
+
+    /* UNSHARING THE TABLE AND MAKING ROOM FOR newfd */
+    int err = fdtable_prepare(proc, newfd);
+    if (err) {
+        lock_release(proc->p_fdlock);
+        return err;
+    }
+
+    /* CHECKING WHETHER newfd REFERS TO AN OPEN FILE */
+    if (fd_get(proc, newfd) != NULL) {
+        
+        /* newfd REFERS TO AN OPEN FILE --> CLOSE IT */
+        fd_close(proc, newfd);
+    }
+
+    /* INCREMENTIG COUNTING REFERENCES */
+    of = fd_get(proc, oldfd);
+    spinlock_acquire(&of->ref_lock);
+    of->count_refs++;
+    spinlock_release(&of->ref_lock);
+
+    /* ASSIGNING TO NEW FILE DESCRIPTOR */
+    fd_install(proc, newfd, of);     // i.e.     slot newfd = slot oldfd
+    lock_release(proc->p_fdlock);
+
+    /* TASK COMPLETED SUCCESSFULLY */
+    return 0;
+}
+#endif
+
+
+/**
+ * @brief Number of iovec structures that are copied in on the kernel stack by readv()
+ *        and writev(); longer vectors are copied into a kmalloc'ed array instead.
+ */
+#define FAST_IOV_MAX 8
+
+/**
+ * @brief Common code of readv() and writev(): copy the iovec array to the kernel side,
+ *        build a single multi-iovec uio on the user buffers and perform one VOP_READ()
+ *        or VOP_WRITE() holding the lock of the open file.
+ * 
+ * @param fd file descriptor
+ * @param iov user array of iovec structures
+ * @param iovcnt number of entries of iov
+ * @param rw direction of the transfer
+ * @param retval actual number of bytes transferred
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+static int file_vectored_io(int fd, const struct iovec *iov, int iovcnt, enum uio_rw rw, int32_t *retval) {
+
+    /* CHECKING FILE DESCRIPTOR (the reference keeps the file open until we are done) */
+    bool shared;
+    struct openfile *of = fd_acquire_io(curproc, fd, &shared);
+    if (of == NULL) {                                               /* fd should refer to a valid entry in the fileTable    */
+        return EBADF;
+    } else if ((rw == UIO_READ && of->mode_open == O_WRONLY) ||     /* fd should refer to a file allowed to be read         */
+               (rw == UIO_WRITE && of->mode_open == O_RDONLY)) {    /* fd should refer to a file allowed to be written      */
+        fd_release(of);
+        return EBADF;
+    }
+
+    /* CHECKING VECTOR SIZE */
+    if (iovcnt <= 0 || iovcnt > IOV_MAX) {
+        fd_release(of);
+        return EINVAL;
+    } else if (iov == NULL) {
+        fd_release(of);
+        return EFAULT;
+    }
+
+    /* COPYING IOVEC ARRAY TO KERNEL SIDE (on the stack for short vectors) */
+    struct iovec fast_iov[FAST_IOV_MAX];
+    struct iovec *kiov = fast_iov;
+    if (iovcnt > FAST_IOV_MAX) {
+        kiov = (struct iovec *) kmalloc(iovcnt * sizeof(struct iovec));
+        if (kiov == NULL) {
+            fd_release(of);
+            return ENOMEM;
+        }
+    }
+    int err = copyin((const_userptr_t) iov, kiov, iovcnt * sizeof(struct iovec));
+    if (err) {
+        if (kiov != fast_iov) {
+            kfree(kiov);
+        }
+        fd_release(of);
+        return err;
+    }
+
+    /* COMPUTING TOTAL LENGTH (it must fit in the 32-bit return value) */
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (kiov[i].iov_len > (size_t) 0x7fffffff - total) {
+            if (kiov != fast_iov) {
+                kfree(kiov);
+            }
+            fd_release(of);
+            return EINVAL;
+        }
+        total += kiov[i].iov_len;
+    }
+
+    /* PERFORMING THE TRANSFER WITH A SINGLE VOP (uiomove() walks the iovecs) */
+    struct uio uuio;
+    file_io_lock(of, shared);
+    uuio.uio_iov = kiov;
+    uuio.uio_iovcnt = iovcnt;
+    uuio.uio_offset = of->offset;
+    uuio.uio_resid = total;
+    uuio.uio_segflg = UIO_USERSPACE;
+    uuio.uio_rw = rw;
+    uuio.uio_space = proc_getas();
+    uuio.uio_direct = of->direct;
+    uuio.uio_advice = of->advice;
+    if (rw == UIO_READ) {
+        err = VOP_READ(of->vn, &uuio);
+    } else if (of->append) {
+        err = appendlog_write(of->vn, &uuio);
+    } else {
+        err = VOP_WRITE(of->vn, &uuio);
+    }
+    if (!err) {
+
+        /* REPOSITION OF THE OFFSET */
+        *retval = (int32_t) (total - uuio.uio_resid);
+        of->offset = uuio.uio_offset;
+    }
+    file_io_unlock(of, shared);
+    fd_release(of);
+    if (!err) {
+        proc_charge_io(rw == UIO_WRITE, total - uuio.uio_resid);
+    }
+
+    /* FREEING KERNEL COPY OF THE VECTOR */
+    if (kiov != fast_iov) {
+        kfree(kiov);
+    }
+    return err;
+}
+#endif
+
+/**
+ * @brief sys_readv_SHELL() reads from the file specified by fd into the iovcnt buffers 
+ *        described by iov, filling each buffer completely before moving to the next one.
+ *        The whole transfer is performed by a single VOP_READ(), so it is atomic with 
+ *        respect to the seek position of the file, which is advanced by the bytes read.
+ * 
+ * @param fd source file
+ * @param iov user array of iovec structures describing the destination buffers
+ * @param iovcnt number of entries of iov (between 1 and IOV_MAX)
+ * @param retval actual number of bytes read
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_readv_SHELL(int fd, const struct iovec *iov, int iovcnt, int32_t *retval) {
+    return file_vectored_io(fd, iov, iovcnt, UIO_READ, retval);
+}
+#endif
+
+/**
+ * @brief sys_writev_SHELL() writes to the file specified by fd the data gathered from the 
+ *        iovcnt buffers described by iov, in order. The whole transfer is performed by a 
+ *        single VOP_WRITE(), so it is atomic with respect to the seek position of the file, 
+ *        which is advanced by the bytes written.
+ * 
+ * @param fd destination file
+ * @param iov user array of iovec structures describing the source buffers
+ * @param iovcnt number of entries of iov (between 1 and IOV_MAX)
+ * @param retval actual number of bytes written
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_writev_SHELL(int fd, const struct iovec *iov, int iovcnt, int32_t *retval) {
+    return file_vectored_io(fd, iov, iovcnt, UIO_WRITE, retval);
+}
+#endif
+
+/**
+ * @brief Common code of pread() and pwrite(): transfer directly between the user buffer
+ *        and the file at the given offset. The openfile is only read (vnode and mode, which 
+ *        cannot change while we hold a reference to it), so of->lock is not needed: the 
+ *        offset lives in the local uio and the filesystem serializes the actual access.
+ * 
+ * @param fd file descriptor
+ * @param buf user buffer
+ * @param buflen number of bytes to transfer
+ * @param offset position of the file
+ * @param rw direction of the transfer
+ * @param retval actual number of bytes transferred
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+static int file_positional_io(int fd, userptr_t buf, size_t buflen, off_t offset, enum uio_rw rw, int32_t *retval) {
+
+    /* CHECKING FILE DESCRIPTOR (the reference keeps the file open until we are done) */
+    struct openfile *of = fd_acquire(curproc, fd);
+    if (of == NULL) {                                               /* fd should refer to a valid entry in the fileTable    */
+        return EBADF;
+    } else if ((rw == UIO_READ && of->mode_open == O_WRONLY) ||     /* fd should refer to a file allowed to be read         */
+               (rw == UIO_WRITE && of->mode_open == O_RDONLY)) {    /* fd should refer to a file allowed to be written      */
+        fd_release(of);
+        return EBADF;
+    }
+
+    /* CHECKING POSITION */
+    struct vnode *vn = of->vn;
+    if (!VOP_ISSEEKABLE(vn)) {
+        fd_release(of);
+        return ESPIPE;      // positional I/O makes no sense on a non-seekable object
+    } else if (offset < 0) {
+        fd_release(of);
+        return EINVAL;
+    }
+
+    /* PERFORMING THE TRANSFER (without touching of->offset nor of->lock) */
+    struct iovec iov;
+    struct uio uuio;
+    uio_uinit(&iov, &uuio, buf, buflen, offset, rw);
+    uuio.uio_direct = of->direct;
+    uuio.uio_advice = of->advice;
+    int err = (rw == UIO_READ) ? VOP_READ(vn, &uuio) : VOP_WRITE(vn, &uuio);
+    fd_release(of);
+    if (err) {
+        return err;
+    }
+
+    /* TASK COMPLETED SUCCESSFULLY */
+    *retval = (int32_t) (buflen - uuio.uio_resid);
+    proc_charge_io(rw == UIO_WRITE, buflen - uuio.uio_resid);
+    return 0;
+}
+#endif
+
+/**
+ * @brief sys_pread_SHELL() reads up to buflen bytes from the file specified by fd, starting 
+ *        at the explicit position offset, and stores them in buf. The seek position of the 
+ *        file is neither used nor updated, so the lock of the open file is not taken and 
+ *        concurrent positional reads of a shared file can proceed in parallel.
+ * 
+ * @param fd source file (must be seekable)
+ * @param buf destination buffer
+ * @param buflen number of bytes to be read
+ * @param offset position of the file from which to read
+ * @param retval actual number of bytes read
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_pread_SHELL(int fd, void *buf, size_t buflen, off_t offset, int32_t *retval) {
+    return file_positional_io(fd, (userptr_t) buf, buflen, offset, UIO_READ, retval);
+}
+#endif
+
+/**
+ * @brief sys_pwrite_SHELL() writes up to buflen bytes taken from buf to the file specified 
+ *        by fd, starting at the explicit position offset. The seek position of the file is 
+ *        neither used nor updated, and the lock of the open file is not taken.
+ * 
+ * @param fd destination file (must be seekable)
+ * @param buf source buffer
+ * @param buflen number of bytes to be written
+ * @param offset position of the file at which to write
+ * @param retval actual number of bytes written
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_pwrite_SHELL(int fd, const void *buf, size_t buflen, off_t offset, int32_t *retval) {
+    return file_positional_io(fd, (userptr_t) buf, buflen, offset, UIO_WRITE, retval);
+}
+#endif
+
+/**
+ * @brief Size of the kernel buffer sendfile() copies through.
+ */
+#define SENDFILE_CHUNK (16 * 1024)
+
+/**
+ * @brief sys_sendfile_SHELL() copies data between two open files through a kernel buffer,
+ *        a chunk at a time. The lock of each open file is only held for its own half of
+ *        a chunk, so two copies in opposite directions cannot deadlock. If a write comes
+ *        up short, the bytes read but not written are given back to the source (by not
+ *        advancing its position past them) when it is seekable.
+ * 
+ * @param outfd destination file
+ * @param infd source file
+ * @param offset user pointer to the position to read from, or NULL for the seek position
+ * @param count maximum number of bytes to copy
+ * @param retval actual number of bytes copied
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_sendfile_SHELL(int outfd, int infd, userptr_t offset, size_t count, int32_t *retval) {
+
+    /* CHECKING FILE DESCRIPTORS (the references keep the files open until we are done) */
+    struct openfile *in = fd_acquire(curproc, infd);
+    if (in == NULL) {
+        return EBADF;
+    } else if (in->mode_open == O_WRONLY) {                         /* infd should refer to a file allowed to be read       */
+        fd_release(in);
+        return EBADF;
+    }
+    struct openfile *out = fd_acquire(curproc, outfd);
+    if (out == NULL) {
+        fd_release(in);
+        return EBADF;
+    } else if (out->mode_open == O_RDONLY) {                        /* outfd should refer to a file allowed to be written   */
+        fd_release(out);
+        fd_release(in);
+        return EBADF;
+    }
+
+    /* GETTING THE EXPLICIT POSITION, IF ANY */
+    int err = 0;
+    off_t pos = 0;
+    bool seekable = VOP_ISSEEKABLE(in->vn);
+    if (offset != NULL) {
+        if (!seekable) {
+            err = ESPIPE;
+        } else {
+            err = copyin64(offset, (uint64_t *) &pos);
+            if (!err && pos < 0) {
+                err = EINVAL;
+            }
+        }
+    }
+
+    /* THE COUNT MUST FIT IN THE 32-BIT RETURN VALUE */
+    if (count > (size_t) 0x7fffffff) {
+        count = 0x7fffffff;
+    }
+    char *kbuf = NULL;
+    if (!err && count > 0) {
+        kbuf = kvmalloc(SENDFILE_CHUNK);
+        if (kbuf == NULL) {
+            err = ENOMEM;
+        }
+    }
+
+    /* COPYING CHUNK BY CHUNK */
+    size_t done = 0;
+    while (!err && done < count) {
+        struct iovec iov;
+        struct uio kuio;
+        size_t len = count - done < SENDFILE_CHUNK ? count - done : SENDFILE_CHUNK;
+
+        // read into the buffer, at the explicit position or at the seek position of infd
+        if (offset != NULL) {
+            uio_kinit(&iov, &kuio, kbuf, len, pos, UIO_READ);
+            err = VOP_READ(in->vn, &kuio);
+        } else {
+            lock_acquire(in->lock);
+            uio_kinit(&iov, &kuio, kbuf, len, in->offset, UIO_READ);
+            err = VOP_READ(in->vn, &kuio);
+            if (!err) {
+                in->offset = kuio.uio_offset;
+            }
+            lock_release(in->lock);
+        }
+        if (err) {
+            break;
+        }
+        size_t got = len - kuio.uio_resid;
+        proc_charge_io(false, got);
+        if (got == 0) {
+            break;      // end of file
+        }
+
+        // write it all out at the seek position of outfd
+        lock_acquire(out->lock);
+        uio_kinit(&iov, &kuio, kbuf, got, out->offset, UIO_WRITE);
+        err = VOP_WRITE(out->vn, &kuio);
+        size_t put = got - kuio.uio_resid;
+        out->offset += put;
+        lock_release(out->lock);
+        proc_charge_io(true, put);
+        done += put;
+        pos += put;
+
+        // a short write (e.g. a full disk) ends the copy
+        if (put < got) {
+            if (offset == NULL && seekable) {
+                lock_acquire(in->lock);
+                in->offset -= got - put;
+                lock_release(in->lock);
+            }
+            break;
+        }
+        if (got < len) {
+            break;      // short read: nothing more for now
+        }
+    }
+
+    /* A PARTIAL COPY IS A SUCCESS: THE ERROR SHOWS UP AT THE NEXT CALL */
+    if (err && done > 0) {
+        err = 0;
+    }
+    if (!err && offset != NULL) {
+        err = copyout64((uint64_t) pos, offset);
+    }
+    if (kbuf != NULL) {
+        kvfree(kbuf);
+    }
+    fd_release(out);
+    fd_release(in);
+    if (err) {
+        return err;
+    }
+
+    /* TASK COMPLETED SUCCESSFULLY */
+    *retval = (int32_t) done;
+    return 0;
+}
+#endif
+
+/**
+ * @brief sys_fstat_SHELL() copies out the VOP_STAT() of the file specified by fd.
+ * 
+ * @param fd file to examine
+ * @param statbuf destination (user pointer)
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_fstat_SHELL(int fd, userptr_t statbuf) {
+
+    /* CHECKING FILE DESCRIPTOR (the reference keeps the file open until we are done) */
+    struct openfile *of = fd_acquire(curproc, fd);
+    if (of == NULL) {
+        return EBADF;
+    }
+
+    /* ASKING THE FILESYSTEM (no need for of->lock: the offset is not involved) */
+    struct stat kstat;
+    int err = VOP_STAT(of->vn, &kstat);
+    fd_release(of);
+    if (err) {
+        return err;
+    }
+    return copyout(&kstat, statbuf, sizeof(kstat));
+}
+#endif
+
+/**
+ * @brief Common code of stat() and lstat(): look the name up with vfs_lookup(), which
+ *        goes through the name cache, and copy out the VOP_STAT() of the vnode. Nothing
+ *        is opened, so there is no open file nor VOP_EACHOPEN() involved.
+ * 
+ * @param pathname user pointer to the path of the file
+ * @param statbuf destination (user pointer)
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+static int file_stat_path(userptr_t pathname, userptr_t statbuf) {
+
+    /* COPYING PATHNAME FROM USERLAND TO KERNEL LAND (vfs_lookup may change it) */
+    char *kbuffer = pathbuf_get();     // borrowed from the per-cpu pool
+    if (kbuffer == NULL) {
+        return ENOMEM;
+    }
+    int err = copyinstr((const_userptr_t) pathname, kbuffer, PATH_MAX, NULL);
+    if (err) {
+        pathbuf_put(kbuffer);
+        return err;     // may return EFAULT, ENAMETOOLONG
+    }
+
+    /* LOOKING UP AND ASKING THE FILESYSTEM */
+    struct vnode *vn;
+    err = vfs_lookup(kbuffer, &vn);
+    pathbuf_put(kbuffer);
+    if (err) {
+        return err;     // may return ENOENT, ENOTDIR, ENODEV
+    }
+    struct stat kstat;
+    err = VOP_STAT(vn, &kstat);
+    VOP_DECREF(vn);
+    if (err) {
+        return err;
+    }
+    return copyout(&kstat, statbuf, sizeof(kstat));
+}
+#endif
+
+/**
+ * @brief sys_stat_SHELL() retrieves the status of the file named by pathname.
+ * 
+ * @param pathname path of the file
+ * @param statbuf destination (user pointer)
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_stat_SHELL(userptr_t pathname, userptr_t statbuf) {
+    return file_stat_path(pathname, statbuf);
+}
+#endif
+
+/**
+ * @brief sys_lstat_SHELL() retrieves the status of the file named by pathname. Since
+ *        vfs_lookup() never follows a symbolic link in the last component of a path,
+ *        this is the same as stat().
+ * 
+ * @param pathname path of the file
+ * @param statbuf destination (user pointer)
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_lstat_SHELL(userptr_t pathname, userptr_t statbuf) {
+    return file_stat_path(pathname, statbuf);
+}
+#endif
+
+/**
+ * @brief sys_getdents_SHELL() fills buf with entries of the directory specified by fd
+ *        with a single VOP_GETDIRENTS(), so a directory is listed a bufferful at a time
+ *        rather than with one system call per name.
+ * 
+ * @param fd directory to read (must be open for reading)
+ * @param buf destination buffer
+ * @param buflen size of buf
+ * @param retval number of bytes filled in
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_getdents_SHELL(int fd, userptr_t buf, size_t buflen, int32_t *retval) {
+
+    /* CHECKING FILE DESCRIPTOR (the reference keeps the file open until we are done) */
+    struct openfile *of = fd_acquire(curproc, fd);
+    if (of == NULL) {                                               /* fd should refer to a valid entry in the fileTable    */
+        return EBADF;
+    } else if (of->mode_open == O_WRONLY) {                         /* fd should refer to a file allowed to be read         */
+        fd_release(of);
+        return EBADF;
+    }
+
+    /* THE AMOUNT MUST FIT IN THE 32-BIT RETURN VALUE */
+    if (buflen > (size_t) 0x7fffffff) {
+        buflen = 0x7fffffff;
+    }
+
+    /* READING THE ENTRIES (the offset is whatever the filesystem makes it) */
+    struct iovec iov;
+    struct uio uuio;
+    lock_acquire(of->lock);
+    uio_uinit(&iov, &uuio, buf, buflen, of->offset, UIO_READ);
+    int err = VOP_GETDIRENTS(of->vn, &uuio);
+    if (!err) {
+        of->offset = uuio.uio_offset;
+        *retval = (int32_t) (buflen - uuio.uio_resid);
+    }
+    lock_release(of->lock);
+    fd_release(of);
+    return err;
+}
+#endif
+
+/**
+ * @brief Common code of ftruncate() and fpunch(): checks that fd refers to a file open for
+ *        writing and applies the operation to its vnode. offset/length are as for fpunch();
+ *        a negative length means truncation to offset.
+ * 
+ * @param fd file to change (must be open for writing)
+ * @param offset new size, or start of the hole
+ * @param length size of the hole, or -1 for truncation
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+static int file_shrink(int fd, off_t offset, off_t length) {
+
+    /* CHECKING FILE DESCRIPTOR (the reference keeps the file open until we are done) */
+    struct openfile *of = fd_acquire(curproc, fd);
+    if (of == NULL) {                                               /* fd should refer to a valid entry in the fileTable    */
+        return EBADF;
+    } else if (of->mode_open == O_RDONLY) {                         /* fd should refer to a file allowed to be written      */
+        fd_release(of);
+        return EBADF;
+    }
+
+    /* CHECKING ARGUMENTS */
+    if (offset < 0) {
+        fd_release(of);
+        return EINVAL;
+    }
+
+    /* THE FILE SYSTEM DOES THE REST (directories and devices refuse) */
+    int err = (length < 0) ? VOP_TRUNCATE(of->vn, offset) : VOP_PUNCH(of->vn, offset, length);
+    fd_release(of);
+    return err;
+}
+#endif
+
+/**
+ * @brief sys_ftruncate_SHELL() sets the size of the file specified by fd to length,
+ *        discarding its data past that point or extending it with zeros.
+ * 
+ * @param fd file to truncate (must be open for writing)
+ * @param length new size of the file
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_ftruncate_SHELL(int fd, off_t length) {
+    return file_shrink(fd, length, -1);
+}
+#endif
+
+/**
+ * @brief sys_fpunch_SHELL() deallocates the storage of length bytes of the file specified
+ *        by fd, starting at offset; that range then reads as zeros. The size of the file
+ *        does not change, and nothing past the end of the file is affected.
+ * 
+ * @param fd file to punch a hole in (must be open for writing)
+ * @param offset start of the hole
+ * @param length size of the hole (must be positive)
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_fpunch_SHELL(int fd, off_t offset, off_t length) {
+    if (length <= 0) {
+        return EINVAL;
+    }
+    return file_shrink(fd, offset, length);
+}
+#endif
+
+/**
+ * @brief sys_posix_fadvise_SHELL() tells how the file specified by fd is going to be read.
+ *        POSIX_FADV_NORMAL, POSIX_FADV_SEQUENTIAL and POSIX_FADV_RANDOM are remembered in
+ *        the open file (for the whole file, whatever the range) and size the read-ahead
+ *        of every later read through it; POSIX_FADV_WILLNEED starts reading the range into
+ *        the buffer cache, and POSIX_FADV_DONTNEED makes the cached blocks of the range the
+ *        first to be reused.
+ * 
+ * @param fd file the advice is about
+ * @param offset start of the range
+ * @param length size of the range, or zero for up to the end of the file
+ * @param advice one of the POSIX_FADV_* values
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_posix_fadvise_SHELL(int fd, off_t offset, off_t length, int advice) {
+
+    /* CHECKING ARGUMENTS */
+    if (offset < 0 || length < 0) {
+        return EINVAL;
+    }
+    if (length == 0 || length > RANGELOCK_EOF - offset) {
+        length = RANGELOCK_EOF - offset;   // as with fcntl() locks, zero means "to the end"
+    }
+
+    /* CHECKING FILE DESCRIPTOR (the reference keeps the file open until we are done) */
+    struct openfile *of = fd_acquire(curproc, fd);
+    if (of == NULL) {
+        return EBADF;
+    } else if (!VOP_ISSEEKABLE(of->vn)) {
+        fd_release(of);
+        return ESPIPE;      // no file position, so there's no access pattern either
+    }
+
+    /* APPLYING THE ADVICE */
+    int err = 0;
+    switch (advice) {
+        case POSIX_FADV_NORMAL:
+        case POSIX_FADV_SEQUENTIAL:
+        case POSIX_FADV_RANDOM:
+            of->advice = advice;    // read racily by I/O in progress, which is harmless
+            break;
+        case POSIX_FADV_WILLNEED:
+            VOP_PREFETCH(of->vn, offset, length);
+            break;
+        case POSIX_FADV_DONTNEED:
+            VOP_DONTNEED(of->vn, offset, length);
+            break;
+        default:
+            err = EINVAL;
+            break;
+    }
+    fd_release(of);
+    return err;
+}
+#endif
+
+/**
+ * @brief sys_sem_op_SHELL() changes the count of the semfs semaphore open as fd by delta:
+ *        a negative delta is P(-delta), waiting until the count allows it, and a positive
+ *        one is V(delta). This is what read() and write() do on a semaphore, but with no
+ *        buffer to check and no uio to set up.
+ * 
+ * @param fd semaphore (open for reading to P, for writing to V)
+ * @param delta amount to add to the count
+ * @return zero on success, EINVAL if fd is not a semaphore, an error value in case of
+ *         failure
+ */
+#if OPT_SHELL
+int sys_sem_op_SHELL(int fd, int delta) {
+
+    /* CHECKING FILE DESCRIPTOR (the reference keeps the file open until we are done) */
+    struct openfile *of = fd_acquire(curproc, fd);
+    if (of == NULL) {
+        return EBADF;
+    } else if ((delta < 0 && of->mode_open == O_WRONLY) ||     /* P needs read access, as read() */
+               (delta > 0 && of->mode_open == O_RDONLY)) {     /* V needs write access, as write() */
+        fd_release(of);
+        return EBADF;
+    }
+
+    /* NO SEEK POSITION, SO THE OPEN FILE LOCK IS NOT TAKEN: P MAY SLEEP A LONG TIME */
+    int err = semfs_semop(of->vn, delta);
+    fd_release(of);
+    return err;
+}
+#endif
+
+/**
+ * @brief Submissions ioring_enter() copies in (and completions it copies out) at once.
+ */
+#define IORING_BATCH 8
+
+/**
+ * @brief Carry out one submission of an ioring, through the same functions as the
+ *        corresponding system call.
+ * 
+ * @param sqe the submission
+ * @return what the call returns, or minus the error value
+ */
+#if OPT_SHELL
+static int ioring_do(const struct ioring_sqe *sqe) {
+    int32_t retval = 0;
+    int err;
+
+    switch (sqe->sqe_op) {
+        case IORING_OP_READ:
+            err = sys_read_SHELL(sqe->sqe_fd, sqe->sqe_buf, sqe->sqe_len, &retval);
+            break;
+        case IORING_OP_WRITE:
+            err = sys_write_SHELL(sqe->sqe_fd, sqe->sqe_buf, sqe->sqe_len, &retval);
+            break;
+        case IORING_OP_PREAD:
+            err = sys_pread_SHELL(sqe->sqe_fd, sqe->sqe_buf, sqe->sqe_len, sqe->sqe_offset, &retval);
+            break;
+        case IORING_OP_PWRITE:
+            err = sys_pwrite_SHELL(sqe->sqe_fd, sqe->sqe_buf, sqe->sqe_len, sqe->sqe_offset, &retval);
+            break;
+        case IORING_OP_OPEN:
+            err = sys_open_SHELL((userptr_t) sqe->sqe_buf, sqe->sqe_flags, sqe->sqe_mode, &retval);
+            break;
+        case IORING_OP_CLOSE:
+            err = sys_close_SHELL(sqe->sqe_fd);
+            break;
+        default:
+            err = EINVAL;
+            break;
+    }
+    return err ? -err : retval;
+}
+#endif
+
+/**
+ * @brief sys_ioring_enter_SHELL() carries out, in order, the read, write, open and close
+ *        requests queued in the submission ring of a user struct ioring, posting the
+ *        result of each in its completion ring. Submissions are copied in, and
+ *        completions out, IORING_BATCH at a time; only the two indices the kernel owns
+ *        are written back into the struct ioring itself. Requests complete in the order
+ *        they were submitted, each one sleeping on the disk like the call it stands for.
+ * 
+ * @param ring user pointer to the struct ioring
+ * @param retval number of submissions taken
+ * @return zero on success, EINVAL if the ring is malformed, an error value in case of
+ *         failure
+ */
+#if OPT_SHELL
+int sys_ioring_enter_SHELL(userptr_t ring, int32_t *retval) {
+    struct ioring ir;
+    struct ioring_sqe sqes[IORING_BATCH];
+    struct ioring_cqe cqes[IORING_BATCH];
+    struct ioring *uring = (struct ioring *) ring;
+    unsigned mask, pending, room, todo, done, batch, sqslot, cqslot;
+    int err;
+
+    /* READING AND CHECKING THE RING */
+    err = copyin(ring, &ir, sizeof(ir));
+    if (err) {
+        return err;
+    }
+    if (ir.ir_entries == 0 || ir.ir_entries > IORING_MAX_ENTRIES ||
+        (ir.ir_entries & (ir.ir_entries - 1)) != 0) {
+        return EINVAL;
+    }
+    mask = ir.ir_entries - 1;
+    pending = ir.ir_sqtail - ir.ir_sqhead;
+    room = ir.ir_entries - (ir.ir_cqtail - ir.ir_cqhead);
+    if (pending > ir.ir_entries || room > ir.ir_entries) {
+        return EINVAL;
+    }
+    todo = pending < room ? pending : room;
+
+    /* A BATCH AT A TIME, NOT CROSSING THE END OF EITHER RING */
+    done = 0;
+    while (done < todo) {
+        sqslot = (ir.ir_sqhead + done) & mask;
+        cqslot = (ir.ir_cqtail + done) & mask;
+        batch = todo - done;
+        if (batch > IORING_BATCH) {
+            batch = IORING_BATCH;
+        }
+        if (batch > ir.ir_entries - sqslot) {
+            batch = ir.ir_entries - sqslot;
+        }
+        if (batch > ir.ir_entries - cqslot) {
+            batch = ir.ir_entries - cqslot;
+        }
+
+        err = copyin((const_userptr_t) &ir.ir_sq[sqslot], sqes, batch * sizeof(sqes[0]));
+        if (err) {
+            break;
+        }
+        for (unsigned i = 0; i < batch; i++) {
+            cqes[i].cqe_data = sqes[i].sqe_data;
+            cqes[i].cqe_res = ioring_do(&sqes[i]);
+        }
+        /* THE REQUESTS ARE DONE: IF THEIR RESULTS CANNOT BE POSTED, THAT IS THE CALLER'S LOSS */
+        err = copyout(cqes, (userptr_t) &ir.ir_cq[cqslot], batch * sizeof(cqes[0]));
+        done += batch;
+        if (err) {
+            break;
+        }
+    }
+
+    /* PUBLISHING WHAT WAS TAKEN AND POSTED (an error is only reported if nothing was) */
+    if (done > 0) {
+        ir.ir_sqhead += done;
+        ir.ir_cqtail += done;
+        err = copyout32(ir.ir_sqhead, (userptr_t) &uring->ir_sqhead);
+        if (!err) {
+            err = copyout32(ir.ir_cqtail, (userptr_t) &uring->ir_cqtail);
+        }
+    }
+    if (err && done == 0) {
+        return err;
+    }
 
     /* TASK COMPLETED SUCCESSFULLY */
-    *retval = newfd;
+    *retval = (int32_t) done;
+    return 0;
+}
+#endif
+
+/* Number of descriptors sys_poll_SHELL() looks at without allocating memory */
+#define FAST_POLL_MAX 8
+
+/* What poll() keeps for each descriptor while it waits */
+#if OPT_SHELL
+struct pollslot {
+    struct openfile *ps_of;         /* the open file, NULL for a bad or negative fd */
+    struct pollent ps_pe;           /* registration on the file's pollhead */
+};
+#endif
+
+/**
+ * @brief Body of sys_poll_SHELL(), on the pollfd array copied in: look at every file,
+ *        registering to be woken on all of them, and sleep until one of them is ready,
+ *        the timeout expires or another thread of the process calls _exit().
+ * 
+ * @param kpfd pollfd array, whose revents are filled in
+ * @param slots one per entry of kpfd
+ * @param nfds number of entries
+ * @param timeout milliseconds to wait, 0 not to wait, negative to wait forever
+ * @param nready number of entries with revents set
+ * @return zero on success, EINTR if the process is exiting
+ */
+#if OPT_SHELL
+static int file_poll(struct pollfd *kpfd, struct pollslot *slots, unsigned nfds, int timeout, int *nready) {
+
+    struct pollwaiter pw;
+    struct pollent exitpe;
+    struct timespec deadline, delay;
+    unsigned i;
+
+    /* TAKING A REFERENCE ON EVERY FILE, SO THAT NONE GOES AWAY WHILE WE ARE ON IT */
+    pollwaiter_init(&pw);
+    pollent_init(&exitpe, &pw);
+    for (i = 0; i < nfds; i++) {
+        slots[i].ps_of = (kpfd[i].fd >= 0) ? fd_acquire(curproc, kpfd[i].fd) : NULL;
+        pollent_init(&slots[i].ps_pe, &pw);
+    }
+
+    /* COMPUTING THE DEADLINE OF A POSITIVE TIMEOUT */
+    if (timeout > 0) {
+        delay.tv_sec = timeout / 1000;
+        delay.tv_nsec = (timeout % 1000) * 1000000;
+        gettime(&deadline);
+        timespec_add(&deadline, &delay, &deadline);
+    }
+
+    int err = 0;
+    bool timedout = (timeout == 0);
+    for (;;) {
+        /* LOOKING AT EVERY FILE (no need to register once we know we will not sleep) */
+        int ready = 0;
+        for (i = 0; i < nfds; i++) {
+            kpfd[i].revents = 0;
+            if (kpfd[i].fd < 0) {
+                continue;
+            } else if (slots[i].ps_of == NULL) {
+                kpfd[i].revents = POLLNVAL;
+            } else {
+                struct pollent *pe = (timedout || ready > 0) ? NULL : &slots[i].ps_pe;
+                int events = VOP_POLL(slots[i].ps_of->vn, kpfd[i].events, pe);
+                kpfd[i].revents = events & (kpfd[i].events | POLLERR | POLLHUP);
+            }
+            if (kpfd[i].revents != 0) {
+                ready++;
+            }
+        }
+        *nready = ready;
+        if (ready > 0 || timedout) {
+            break;
+        }
+
+        /* ANOTHER THREAD CALLED _exit(): THIS ONE HAS TO GO TOO */
+        if (proc_pollexiting(&exitpe)) {
+            err = EINTR;
+            break;
+        }
+
+        /* SLEEPING UNTIL ONE OF THEM CHANGES, THEN LOOKING AGAIN FROM SCRATCH */
+        timedout = !pollwaiter_sleep(&pw, (timeout > 0) ? &deadline : NULL);
+        for (i = 0; i < nfds; i++) {
+            pollent_unregister(&slots[i].ps_pe);
+        }
+        pollent_unregister(&exitpe);
+    }
+
+    /* LEAVING EVERY POLLHEAD BEFORE OUR ENTRIES AND THE FILES GO AWAY */
+    for (i = 0; i < nfds; i++) {
+        pollent_unregister(&slots[i].ps_pe);
+        if (slots[i].ps_of != NULL) {
+            fd_release(slots[i].ps_of);
+        }
+    }
+    pollent_unregister(&exitpe);
+    pollwaiter_cleanup(&pw);
+    return err;
+}
+#endif
+
+/**
+ * @brief sys_poll_SHELL() waits for any of several files to be ready: for each struct
+ *        pollfd in fds, the events in revents are those asked for in events that are
+ *        ready, plus POLLERR and POLLHUP; a file descriptor that is not open gets
+ *        POLLNVAL, and a negative one is skipped. One call sleeps on the console,
+ *        pipes, semaphores and child-exit descriptors at once (see kern/poll.h).
+ * 
+ * @param fds user array of struct pollfd
+ * @param nfds number of entries of fds
+ * @param timeout milliseconds to wait, 0 not to wait, INFTIM (negative) to wait forever
+ * @param retval number of entries with revents set, 0 on timeout
+ * @return zero on success, EINVAL if nfds exceeds OPEN_MAX, an error value in case of
+ *         failure
+ */
+#if OPT_SHELL
+int sys_poll_SHELL(userptr_t fds, unsigned nfds, int timeout, int32_t *retval) {
+
+    /* CHECKING THE NUMBER OF ENTRIES */
+    if (nfds > OPEN_MAX) {
+        return EINVAL;
+    }
+
+    /* COPYING THE POLLFD ARRAY TO KERNEL SIDE (on the stack for a few entries) */
+    struct pollfd fast_pfd[FAST_POLL_MAX];
+    struct pollslot fast_slots[FAST_POLL_MAX];
+    struct pollfd *kpfd = fast_pfd;
+    struct pollslot *slots = fast_slots;
+    if (nfds > FAST_POLL_MAX) {
+        kpfd = (struct pollfd *) kmalloc(nfds * sizeof(struct pollfd));
+        slots = (struct pollslot *) kmalloc(nfds * sizeof(struct pollslot));
+        if (kpfd == NULL || slots == NULL) {
+            kfree(kpfd);
+            kfree(slots);
+            return ENOMEM;
+        }
+    }
+    int err = copyin((const_userptr_t) fds, kpfd, nfds * sizeof(struct pollfd));
+
+    /* WAITING AND HANDING BACK THE RESULTS */
+    int nready = 0;
+    if (!err) {
+        err = file_poll(kpfd, slots, nfds, timeout, &nready);
+    }
+    if (!err) {
+        err = copyout(kpfd, fds, nfds * sizeof(struct pollfd));
+    }
+    if (kpfd != fast_pfd) {
+        kfree(kpfd);
+        kfree(slots);
+    }
+    if (err) {
+        return err;
+    }
+
+    /* TASK COMPLETED SUCCESSFULLY */
+    *retval = nready;
+    return 0;
+}
+#endif
+
+/**
+ * @brief sys_childfd_SHELL() opens a child-exit descriptor: polling it for POLLIN waits
+ *        for a child of the calling process to exit, so that it can be reaped with
+ *        waitpid() without spinning on WNOHANG; POLLHUP means there are no children
+ *        (see childfd.h).
+ * 
+ * @param retval file descriptor of the new open file
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_childfd_SHELL(int32_t *retval) {
+
+    /* RETRIEVING A FREE POSITION IN THE SYSTEM FILETABLE */
+    struct openfile *of;
+    int err = openfile_alloc(&of);      // may return ENFILE, ENOMEM
+    if (err) {
+        return err;
+    }
+
+    /* CREATING THE VNODE (it can only be polled, the offset stays zero) */
+    struct vnode *v;
+    err = childfd_create(&v);           // may return ENOMEM
+    if (err) {
+        openfile_release(of);
+        return err;
+    }
+    of->vn = v;
+    of->mode_open = O_RDONLY;
+    of->count_refs = 1;
+
+    /* ASSIGNING IT TO THE CURRENT PROCESS FILETABLE */
+    int fd;
+    lock_acquire(curproc->p_fdlock);
+    err = fd_alloc(curproc, of, &fd);   // may return EMFILE
+    lock_release(curproc->p_fdlock);
+    if (err) {
+        of->vn = NULL;
+        vfs_close(v);
+        openfile_release(of);
+        return err;
+    }
+
+    /* TASK COMPLETED SUCCESSFULLY */
+    *retval = fd;
     return 0;
 }
 #endif
@@ -31,8 +31,14 @@
 #include <thread.h>
 #include <addrspace.h>
 #include <kern/wait.h>
+#include <kern/spawn.h>
+#include <kern/time.h>
+#include <kern/resource.h>
+#include <kern/mman.h>
+#include <kern/shm.h>
 #include <mips/trapframe.h>
 #include <syscall.h>
+#include <futex.h>
 #include "exec.h"
 #include "syscall_SHELL.h"
 
@@ -58,86 +64,62 @@ int sys_getpid_SHELL(pid_t *retval) {
 /**
  * @brief Wait for the process specified by pid to exit, and return an encoded exit status 
  *        in the integer pointed to by status. If that process has exited already, waitpid 
- *        returns immediately. If that process does not exist, waitpid fails.
+ *        returns immediately. If that process is not a child, waitpid fails.
  * 
- * @param pid pid of the process to wait
- * @param status exit status of the process to wait
- * @param options not implemented
+ * @param pid pid of the process to wait, or WAIT_ANY for any child
+ * @param status exit status of the process to wait (may be NULL)
+ * @param options zero or WNOHANG, to return 0 at once if no child has exited
  * @return zero on success, an error value in case of failure.
  */
 #if OPT_SHELL
 int sys_waitpid_SHELL(pid_t pid, int *status, int options, int32_t *retval) {
 
+    int kstatus = 0, err;
+    pid_t kpid;
+
     /* SOME ASSERTIONS */
     KASSERT(curproc != NULL);
 
     /* CHECKING ARGUMENTS */
     if (pid == curproc->p_pid) {
         return ECHILD;
-    } else if (status == NULL) {
-        *retval = pid;
-        return 0;
-    }
-    /* TEMPORARY */
-    else if ((int) status == 0x40000000 || (unsigned int) status == (unsigned int) 0x80000000) {
+    } else if ((vaddr_t) status % sizeof(int) != 0) {
         return EFAULT;
-    } else if ((int) status % 4 != 0) {
-        return EFAULT;
-    }
-    /*CHECKING IF TRYING TO WAIT FOR A NON-CHILD PROCESS*/
-    else if(is_child(curproc, pid)==-1){
-        return ECHILD;
     }
 
-    /* OPTIONS */
-    switch (options) {
-        case 0:
-        break;
-        
-        case WNOHANG:
-            *status = 0;
-            *retval = pid;
-            return 0;
-        break;
-
-        default:
-            return EINVAL;
-    }
-
-    /* RETRIEVING PROCESS */
-    struct proc *proc = proc_search(pid);
-    if (proc == NULL) {
-        return ESRCH;
+    /* CHECKING THE STATUS POINTER BEFORE REAPING, SO THAT NO STATUS IS LOST */
+    // against the region table: nothing is written to it before the child is reaped
+    if (status != NULL) {
+        err = usercheck((const_userptr_t) status, sizeof(int), true);
+        if (err) {
+            return err;
+        }
     }
 
-    if (proc->p_numthreads == 0) {
-        *status = proc->p_status;
-        *retval = proc->p_pid;
-        proc_destroy(proc);
-        return 0;
+    /* WAITING FOR (AND REAPING) THE CHILD */
+    err = proc_wait(pid, options, &kstatus, &kpid);
+    if (err) {
+        return err;
     }
 
-    /* WAITING TERMINATION OF THE PROCESS */
-    lock_acquire(proc->p_locklock);
-    cv_wait(proc->p_cv, proc->p_locklock);
-    lock_release(proc->p_locklock);
-
     /* ASSIGNING RETURN STATUS */
-    *status = proc->p_status;
-    *retval = proc->p_pid;
-    if (status == NULL) {
-        return EFAULT;
+    if (status != NULL && kpid != 0) {
+        err = copyout32((uint32_t) kstatus, (userptr_t) status);
+        if (err) {
+            return err;
+        }
     }
 
     /* TASK COMPLETED SUCCESSFULLY */
-    proc_destroy(proc);
+    *retval = kpid;
     return 0;
 }
 #endif
 
 
 /**
- * @brief Cause the current process to exit.
+ * @brief Cause the current process to exit. The other threads of the process, if any,
+ *        leave at their next return to user mode; the last one out releases the process.
  * 
  * @param exitcode reported back to other process(es) via the waitpid() call.
  * @return does not return.
@@ -145,20 +127,11 @@ int sys_waitpid_SHELL(pid_t pid, int *status, int options, int32_t *retval) {
 #if OPT_SHELL
 void sys_exit_SHELL(int exitcode) {
 
-    /* RETRIEVING STATUS OF THE CURRENT PROCESS */
-    struct proc *proc = curproc;
-    proc->p_status = _MKWAIT_EXIT(exitcode);    /* exitcode & 0xff */
+    /* SETTING STATUS OF THE CURRENT PROCESS (unless another thread exited first) */
+    proc_setexiting(curproc, _MKWAIT_EXIT(exitcode));    /* exitcode & 0xff */
 
-    /* REMOVING THREAD BEFORE SIGNALLING DUE TO RACE CONDITIONS */
-    proc_remthread(curthread);        /* remove thread from current process */
-
-    /* SIGNALLING THE TERMINATION OF THE PROCESS */
-    lock_acquire(proc->p_locklock);
-    cv_signal(proc->p_cv, proc->p_locklock);
-    lock_release(proc->p_locklock);
-
-    /* MAIN THREAD TERMINATES HERE. BYE BYE */
-    thread_exit();
+    /* LEAVING: THE LAST THREAD TEARS DOWN THE PROCESS AND SIGNALS ITS TERMINATION */
+    proc_thread_exit(0);
 
     /* WAIT! YOU SHOULD NOT HAPPEN TO BE HERE */
     panic("[!] Wait! You should not be here. Some errors happened during thread_exit()...\n");
@@ -176,7 +149,8 @@ void sys_exit_SHELL(int exitcode) {
  *        However, the file handle objects the file tables point to are shared, so, for instance, 
  *        calls to lseek in one process can affect the other. 
  * 
- * @param ctf trapframe of the process
+ * @param ctf trapframe of the process, with every user register in it: fork takes A_TF,
+ *            so it comes in through the full exception path (see syscalls.def)
  * @param retval PID of the newly created process.
  * @return zero on success, an error value in case of failure. 
  */
@@ -186,15 +160,12 @@ int sys_fork_SHELL(struct trapframe *ctf, pid_t *retval) {
     /* ASSERTING CURRENT PROCESS TO ACTUALLY EXIST */
     KASSERT(curproc != NULL);
 
-    /* CHECKING SPACE AVAILABILITY IN PROCESS TABLE */
-    int index = find_valid_pid();
-    if (index <= 0) {
-        return ENPROC;  /* There are already too many processes on the system. */
-    }
-
-    /* CREATING NEW RUNNABLE PROCESS */
-    struct proc *newproc = proc_create_runprogram(curproc->p_name);
+    /* CREATING NEW RUNNABLE PROCESS (this also gives it a PID in the process table) */
+    struct proc *newproc = proc_create_fork(curproc->p_name);    /* shares the file table */
     if (newproc == NULL) {
+        if (proc_table_full()) {
+            return ENPROC;  /* There are already too many processes on the system. */
+        }
         return ENOMEM;  /* Sufficient virtual memory for the new process was not available. */
     }
 
@@ -206,7 +177,7 @@ int sys_fork_SHELL(struct trapframe *ctf, pid_t *retval) {
     }
 
     /* COPYING PARENT'S TRAPFRAME */
-    struct trapframe *tf_child = (struct trapframe *) kmalloc(sizeof(struct trapframe));
+    struct trapframe *tf_child = proc_trapframe_alloc();
     if(tf_child == NULL){
         proc_destroy(newproc);
         return ENOMEM; 
@@ -217,23 +188,11 @@ int sys_fork_SHELL(struct trapframe *ctf, pid_t *retval) {
     /*DEBUGGING PURPOSE*/
     struct proc *father=curproc;
 
-    /*ADDING NEW CHILD TO FATHER*/
-    if(add_new_child(father, newproc->p_pid)==-1){
-        proc_destroy(newproc);
-        return ENOMEM; 
-    }
-
-
     /*LINKING CHILD TO FATHER*/
-    newproc->parent_pid=father->p_pid;
+    add_new_child(father, newproc);
+    pid_t pid = newproc->p_pid;     /* another of our threads may reap the child at once */
 
-    /* ADDING NEW PROCESS TO THE PROCESS TABLE */
-    err = proc_add((pid_t) index, newproc);
-    if (err == -1) {
-        return ENOMEM;
-    }
-
-    /* CALLING THREAD FORK() AND START NEW THREAD ROUTINE */
+    /* CALLING THREAD FORK() AND START NEW THREAD ROUTINE (only the calling thread is copied) */
     err = thread_fork(
         curthread->t_name,                  /* same name as the parent  */
         newproc,                            /* newly created process    */      
@@ -244,12 +203,12 @@ int sys_fork_SHELL(struct trapframe *ctf, pid_t *retval) {
 
     if (err) {
         proc_destroy(newproc);
-        kfree(tf_child);
+        proc_trapframe_free(tf_child);
         return err;
     }
 
     /* TASK COMPLETED SUCCESSFULLY */
-    *retval = newproc->p_pid;      // parent return pid of child
+    *retval = pid;      // parent return pid of child
     return 0;
 }
 #endif
@@ -269,6 +228,14 @@ int sys_execv_SHELL(const char *progname, char *argv[]) {
 	/* SOME ASSERTIONS */
 	KASSERT(curproc != NULL);
 
+	/* THE OTHER THREADS WOULD BE LEFT RUNNING ON THE OLD IMAGE */
+	spinlock_acquire(&curproc->p_lock);
+	bool alone = curproc->p_numthreads == 1;
+	spinlock_release(&curproc->p_lock);
+	if (!alone) {
+		return EBUSY;
+	}
+
 	/* CASTING PARAMETER */
     userptr_t prog = (userptr_t) progname;
     userptr_t uargv = (userptr_t) argv;
@@ -278,7 +245,7 @@ int sys_execv_SHELL(const char *progname, char *argv[]) {
 	int err;
 
 	/* ALLOCATING SPACE FOR PROGNAME IN KERNEL SIDE */
-	char *kpath = (char *) kmalloc(PATH_MAX * sizeof(char));
+	char *kpath = pathbuf_get();	/* borrowed from the per-cpu pool */
 	if (kpath == NULL) {
 		return ENOMEM;
 	}
@@ -286,7 +253,7 @@ int sys_execv_SHELL(const char *progname, char *argv[]) {
 	/* COPYING PROGNAME IN KERNEL SIDE */
 	err = copyinstr(prog, kpath, PATH_MAX, NULL);
 	if (err) {
-		kfree(kpath);
+		pathbuf_put(kpath);
 		return err;
 	}
 
@@ -296,7 +263,15 @@ int sys_execv_SHELL(const char *progname, char *argv[]) {
 	err = argbuf_fromuser(&kargv, uargv);
 	if (err) {
 		argbuf_cleanup(&kargv);
-		kfree(kpath);
+		pathbuf_put(kpath);
+		return err;
+	}
+
+	/* THE CLOSE-ON-EXEC DESCRIPTORS MUST BE CLOSABLE WITHOUT FAILING AFTER THE LOAD */
+	err = fdtable_prepare_exec(curproc);
+	if (err) {
+		argbuf_cleanup(&kargv);
+		pathbuf_put(kpath);
 		return err;
 	}
 
@@ -308,12 +283,15 @@ int sys_execv_SHELL(const char *progname, char *argv[]) {
 	err = loadexec(kpath, &entrypoint, &stackptr);
 	if (err) {
 		argbuf_cleanup(&kargv);
-		kfree(kpath);
+		pathbuf_put(kpath);
 		return err;
 	}
 
 	/* Goodbye kpath, you useless now... */
-	kfree(kpath);
+	pathbuf_put(kpath);
+
+	/* CLOSING THE CLOSE-ON-EXEC DESCRIPTORS, ALL IN ONE PASS */
+	fdtable_closeexec(curproc);
 
 	/* COPY ARGV FROM KERNEL SIDE TO PROCESS (USER) SIDE */
 	err = argbuf_copyout(&kargv, &stackptr, &argc, &uargv);
@@ -332,4 +310,735 @@ int sys_execv_SHELL(const char *progname, char *argv[]) {
 	panic("enter_new_process returned\n");
 	return EINVAL;
 }
-#endif
\ No newline at end of file
+#endif
+
+/**
+ * @brief What the parent of a spawned process hands to its first thread, which loads
+ *        the new image itself and reports back through ss_done.
+ */
+#if OPT_SHELL
+struct spawn_start {
+    char *ss_path;                  /* program to run (owned by the parent)     */
+    argbuf_t *ss_args;              /* argv in the kernel side (ditto)          */
+    struct semaphore *ss_done;      /* V'd once the child no longer needs them  */
+    int ss_err;                     /* result of the load                       */
+};
+#endif
+
+/**
+ * @brief First thread of a spawned process: build the address space of the new program
+ *        and enter it. If that fails, leave the (still unused) process, which the parent
+ *        then destroys.
+ * 
+ * @param data struct spawn_start of the parent
+ * @param dummy not used
+ */
+#if OPT_SHELL
+static void spawn_child_start(void *data, unsigned long dummy) {
+
+    struct spawn_start *ss = data;
+    vaddr_t entrypoint, stackptr;
+    userptr_t uargv;
+    int argc;
+
+    (void) dummy;
+
+    /* LOADING THE NEW IMAGE INTO OUR (STILL EMPTY) PROCESS */
+    ss->ss_err = loadspawn(ss->ss_path, ss->ss_args, &entrypoint, &stackptr, &argc, &uargv);
+    if (ss->ss_err) {
+        proc_remthread(curthread);
+        V(ss->ss_done);
+        thread_exit();
+    }
+
+    /* ss IS GONE AS SOON AS THE PARENT WAKES UP */
+    V(ss->ss_done);
+
+    /* Warp to user mode. */
+    enter_new_process(argc, uargv, NULL /*uenv*/, stackptr, entrypoint);
+
+    /* SHOULD NOT GET HERE */
+    panic("[!] enter_new_process() returned unexpectedly\n");
+}
+#endif
+
+/**
+ * @brief Start the program progname in a new child process, like fork() followed by
+ *        execv() in the child, but without copying the address space of the caller:
+ *        the first thread of the child loads the new image directly, while the caller
+ *        waits for the outcome. The child shares the file table of the caller and
+ *        applies the given dup2/close actions to it first.
+ * 
+ * @param progname pathname of the program to run 
+ * @param argv an array of 0-terminated strings, terminated by a NULL pointer
+ * @param uactions array of file actions for the child
+ * @param nactions number of entries of uactions
+ * @param retval PID of the newly created process
+ * @return zero on success, and error value in case of failure 
+ */
+#if OPT_SHELL
+int sys_spawn_SHELL(const char *progname, char *argv[], const struct spawn_action *uactions,
+                    int nactions, pid_t *retval) {
+
+    struct spawn_action actions[SPAWN_MAXACTIONS];
+    struct spawn_start ss;
+    struct proc *newproc;
+    argbuf_t kargv;
+    pid_t pid;
+    int i;
+    int err;
+
+    /* SOME ASSERTIONS */
+    KASSERT(curproc != NULL);
+
+    /* COPYING THE FILE ACTIONS IN KERNEL SIDE */
+    if (nactions < 0 || nactions > SPAWN_MAXACTIONS) {
+        return EINVAL;
+    } else if (nactions > 0) {
+        err = copyin((const_userptr_t) uactions, actions, nactions * sizeof(struct spawn_action));
+        if (err) {
+            return err;
+        }
+    }
+
+    /* COPYING PROGNAME IN KERNEL SIDE */
+    char *kpath = pathbuf_get();
+    if (kpath == NULL) {
+        return ENOMEM;
+    }
+    err = copyinstr((const_userptr_t) progname, kpath, PATH_MAX, NULL);
+    if (err) {
+        pathbuf_put(kpath);
+        return err;
+    }
+
+    /* COPY ARGV FROM USER SIDE TO KERNEL SIDE */
+    argbuf_init(&kargv);
+    err = argbuf_fromuser(&kargv, (userptr_t) argv);
+    if (err) {
+        argbuf_cleanup(&kargv);
+        pathbuf_put(kpath);
+        return err;
+    }
+
+    /* THE CHILD TELLS US WHEN IT IS DONE WITH kpath AND kargv */
+    ss.ss_path = kpath;
+    ss.ss_args = &kargv;
+    ss.ss_err = 0;
+    ss.ss_done = sem_create("spawn", 0);
+    if (ss.ss_done == NULL) {
+        argbuf_cleanup(&kargv);
+        pathbuf_put(kpath);
+        return ENOMEM;
+    }
+
+    /* CREATING THE CHILD (it shares our file table and current directory) */
+    newproc = proc_create_fork(kpath);
+    if (newproc == NULL) {
+        sem_destroy(ss.ss_done);
+        argbuf_cleanup(&kargv);
+        pathbuf_put(kpath);
+        return proc_table_full() ? ENPROC : ENOMEM;
+    }
+
+    /* APPLYING THE FILE ACTIONS TO THE CHILD'S TABLE */
+    for (i = 0; i < nactions && !err; i++) {
+        switch (actions[i].sa_op) {
+            case SPAWN_DUP2:
+                err = file_dup2(newproc, actions[i].sa_fd, actions[i].sa_newfd);
+            break;
+
+            case SPAWN_CLOSE:
+                err = file_close(newproc, actions[i].sa_fd);
+            break;
+
+            case SPAWN_NICE:
+                err = proc_setnice(newproc->p_pid, actions[i].sa_fd);
+            break;
+
+            default:
+                err = EINVAL;
+        }
+    }
+
+    /* THE CHILD EXECS: CLOSING ITS CLOSE-ON-EXEC DESCRIPTORS */
+    if (!err) {
+        err = fdtable_prepare_exec(newproc);
+    }
+    if (!err) {
+        fdtable_closeexec(newproc);
+    }
+    if (err) {
+        proc_destroy(newproc);
+        sem_destroy(ss.ss_done);
+        argbuf_cleanup(&kargv);
+        pathbuf_put(kpath);
+        return err;
+    }
+
+    /*LINKING CHILD TO FATHER*/
+    add_new_child(curproc, newproc);
+    pid = newproc->p_pid;
+
+    /* STARTING THE CHILD, WHICH LOADS THE NEW IMAGE (no copy of our address space) */
+    err = thread_fork(kpath, newproc, spawn_child_start, (void *) &ss, 0);
+    if (err) {
+        proc_destroy(newproc);
+        sem_destroy(ss.ss_done);
+        argbuf_cleanup(&kargv);
+        pathbuf_put(kpath);
+        return err;
+    }
+
+    /* WAITING FOR THE LOAD; A CHILD WHICH FAILED HAS ALREADY LEFT ITS PROCESS */
+    P(ss.ss_done);
+    sem_destroy(ss.ss_done);
+    argbuf_cleanup(&kargv);
+    pathbuf_put(kpath);
+    if (ss.ss_err) {
+        proc_destroy(newproc);
+        return ss.ss_err;
+    }
+
+    /* TASK COMPLETED SUCCESSFULLY */
+    *retval = pid;
+    return 0;
+}
+#endif
+
+/**
+ * @brief Start a new thread in the current process, sharing its address space and its
+ *        file table. The thread begins at entry, on the user stack stack, with arg0 and
+ *        arg1 as its first two arguments.
+ * 
+ * @param entry user address where the thread starts
+ * @param arg0 first argument of entry
+ * @param arg1 second argument of entry
+ * @param stack initial stack pointer (8-byte aligned)
+ * @param retval id of the new thread, for __thread_join()
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys___thread_create_SHELL(userptr_t entry, userptr_t arg0, userptr_t arg1, userptr_t stack,
+                              pid_t *retval) {
+
+    struct trapframe *tf;
+    struct uthread *ut;
+    pid_t tid;
+    int err;
+
+    /* SOME ASSERTIONS */
+    KASSERT(curproc != NULL);
+
+    /* CHECKING ARGUMENTS */
+    if (entry == NULL || stack == NULL) {
+        return EFAULT;
+    } else if ((vaddr_t) stack % 8 != 0) {
+        return EINVAL;
+    }
+
+    /* PASSING THE START-UP STATE IN A TRAPFRAME FROM THE FORK POOL */
+    tf = proc_trapframe_alloc();
+    if (tf == NULL) {
+        return ENOMEM;
+    }
+    bzero(tf, sizeof(struct trapframe));
+    tf->tf_epc = (vaddr_t) entry;
+    tf->tf_sp = (vaddr_t) stack;
+    tf->tf_a0 = (uint32_t) arg0;
+    tf->tf_a1 = (uint32_t) arg1;
+
+    /* MAKING ITS JOIN RECORD */
+    ut = proc_uthread_add(curproc);
+    if (ut == NULL) {
+        proc_trapframe_free(tf);
+        return ENOMEM;
+    }
+    tid = ut->ut_tid;   /* it may be joined (and ut freed) before thread_fork returns */
+
+    /* STARTING THE THREAD IN OUR OWN PROCESS */
+    err = thread_fork(curthread->t_name, curproc, call_enter_new_thread, (void *) tf,
+                      (unsigned long) ut);
+    if (err) {
+        proc_uthread_forget(curproc, ut);
+        proc_trapframe_free(tf);
+        return err;
+    }
+
+    /* TASK COMPLETED SUCCESSFULLY */
+    *retval = tid;
+    return 0;
+}
+#endif
+
+/**
+ * @brief Wait for the thread tid of the current process to exit, and collect the status
+ *        it passed to __thread_exit().
+ * 
+ * @param tid thread to wait for
+ * @param status where to store its exit status (may be NULL)
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys___thread_join_SHELL(pid_t tid, int *status) {
+
+    int kstatus = 0, err;
+
+    /* CHECKING THE STATUS POINTER BEFORE JOINING, SO THAT NO STATUS IS LOST */
+    if ((vaddr_t) status % sizeof(int) != 0) {
+        return EFAULT;
+    } else if (status != NULL) {
+        err = copyout32((uint32_t) kstatus, (userptr_t) status);
+        if (err) {
+            return err;
+        }
+    }
+
+    /* WAITING FOR THE THREAD (and freeing its record) */
+    err = proc_uthread_join(tid, &kstatus);
+    if (err) {
+        return err;
+    }
+
+    /* ASSIGNING RETURN STATUS */
+    if (status != NULL) {
+        return copyout32((uint32_t) kstatus, (userptr_t) status);
+    }
+    return 0;
+}
+#endif
+
+/**
+ * @brief Terminate the calling thread, handing status to the thread which joins it. If
+ *        it is the last thread of the process, the process exits with status 0.
+ * 
+ * @param status exit status of the thread
+ * @return does not return.
+ */
+#if OPT_SHELL
+void sys___thread_exit_SHELL(int status) {
+
+    proc_thread_exit(status);
+
+    /* WAIT! YOU SHOULD NOT HAPPEN TO BE HERE */
+    panic("[!] Wait! You should not be here. Some errors happened during thread_exit()...\n");
+}
+#endif
+
+/**
+ * @brief Moves the end of the heap of the current process ("break") by amount bytes,
+ *        which may be negative.
+ * 
+ * @param amount number of bytes to grow (or, if negative, shrink) the heap by
+ * @param retval previous break
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_sbrk_SHELL(intptr_t amount, int32_t *retval) {
+
+    struct addrspace *as;
+    vaddr_t oldbrk;
+    int err;
+
+    as = proc_getas();
+    if (as == NULL) {
+        return ENOMEM;
+    }
+
+    /* MOVING THE BREAK (THE VM SYSTEM DOES THE REST) */
+    err = as_sbrk(as, amount, &oldbrk);
+    if (err) {
+        return err;
+    }
+
+    *retval = (int32_t) oldbrk;
+    return 0;
+}
+#endif
+
+/**
+ * @brief sys_mmap_SHELL() maps part of an open file into the address space of the
+ *        current process. The file must be open for reading, and for writing too
+ *        if the mapping is shared and writable. With MAP_ANON there is no file,
+ *        and the pages start out zero-filled.
+ * 
+ * @param addr address hint (ignored)
+ * @param length number of bytes to map
+ * @param prot protection of the mapping
+ * @param flags MAP_SHARED or MAP_PRIVATE, possibly with MAP_ANON
+ * @param fd file to map (ignored with MAP_ANON)
+ * @param offset page-aligned offset in the file
+ * @param retval address of the mapping
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_mmap_SHELL(userptr_t addr, size_t length, int prot, int flags, int fd,
+                   off_t offset, int32_t *retval) {
+
+    struct addrspace *as;
+    struct openfile *of;
+    vaddr_t va;
+    bool shared;
+    int err;
+
+    (void) addr;
+
+    /* CHECKING THE ARGUMENTS */
+    if ((flags & ~MAP_ANON) != MAP_SHARED && (flags & ~MAP_ANON) != MAP_PRIVATE) {
+        return EINVAL;
+    }
+    if ((prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) != 0) {
+        return EINVAL;
+    }
+    if (length == 0 || offset < 0 || (offset % PAGE_SIZE) != 0) {
+        return EINVAL;
+    }
+    shared = ((flags & ~MAP_ANON) == MAP_SHARED);
+
+    as = proc_getas();
+    if (as == NULL) {
+        return ENOMEM;
+    }
+
+    /* ANONYMOUS MEMORY: NOTHING TO ASK THE FILE SYSTEM */
+    if (flags & MAP_ANON) {
+        err = as_mmap(as, length, prot & PROT_WRITE, shared, NULL, 0, &va);
+        if (err) {
+            return err;
+        }
+        *retval = (int32_t) va;
+        return 0;
+    }
+
+    of = fd_acquire(curproc, fd);
+    if (of == NULL) {
+        return EBADF;
+    }
+    if (of->mode_open == O_WRONLY ||
+        (shared && (prot & PROT_WRITE) && of->mode_open == O_RDONLY)) {
+        fd_release(of);
+        return EACCES;
+    }
+
+    /* ASKING THE FILE SYSTEM, THEN MAPPING (THE REGION KEEPS THE VNODE) */
+    err = VOP_MMAP(of->vn);
+    if (err == 0) {
+        err = as_mmap(as, length, prot & PROT_WRITE, shared, of->vn, offset, &va);
+    }
+    fd_release(of);
+    if (err) {
+        return err;
+    }
+
+    *retval = (int32_t) va;
+    return 0;
+}
+#endif
+
+/**
+ * @brief sys_munmap_SHELL() unmaps a range of the file mappings of the current process.
+ * 
+ * @param addr start of the range
+ * @param length size of the range
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_munmap_SHELL(userptr_t addr, size_t length) {
+
+    struct addrspace *as;
+
+    as = proc_getas();
+    if (as == NULL) {
+        return EINVAL;
+    }
+    return as_munmap(as, (vaddr_t) addr, length);
+}
+#endif
+
+/**
+ * @brief sys_msync_SHELL() writes back the shared file mappings in a range of the
+ *        address space of the current process.
+ * 
+ * @param addr start of the range
+ * @param length size of the range
+ * @param flags MS_ASYNC or MS_SYNC, possibly with MS_INVALIDATE
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_msync_SHELL(userptr_t addr, size_t length, int flags) {
+
+    struct addrspace *as;
+
+    if ((flags & ~(MS_ASYNC | MS_SYNC | MS_INVALIDATE)) != 0 ||
+        (flags & (MS_ASYNC | MS_SYNC)) == (MS_ASYNC | MS_SYNC)) {
+        return EINVAL;
+    }
+
+    as = proc_getas();
+    if (as == NULL) {
+        return ENOMEM;
+    }
+
+    /* THERE'S NOTHING TO INVALIDATE: MAPPINGS SHARE THE FILE'S PAGES */
+    return as_msync(as, (vaddr_t) addr, length, (flags & MS_SYNC) != 0);
+}
+#endif
+
+/**
+ * @brief sys_madvise_SHELL() tells how a range of the address space of the current
+ *        process is going to be used.
+ * 
+ * @param addr start of the range
+ * @param length size of the range
+ * @param advice one of the MADV_* values
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_madvise_SHELL(userptr_t addr, size_t length, int advice) {
+
+    struct addrspace *as;
+
+    if (advice < MADV_NORMAL || advice > MADV_DONTNEED) {
+        return EINVAL;
+    }
+
+    as = proc_getas();
+    if (as == NULL) {
+        return ENOMEM;
+    }
+    return as_madvise(as, (vaddr_t) addr, length, advice);
+}
+#endif
+
+/**
+ * @brief sys_shmget_SHELL() finds or makes a shared memory segment.
+ * 
+ * @param key key of the segment, or IPC_PRIVATE
+ * @param size size of the segment in bytes
+ * @param flags IPC_CREAT, possibly with IPC_EXCL, or 0
+ * @param retval ID of the segment
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_shmget_SHELL(int key, size_t size, int flags, int32_t *retval) {
+
+    int id, err;
+
+    err = vm_shmget(key, size, flags, &id);
+    if (err) {
+        return err;
+    }
+    *retval = id;
+    return 0;
+}
+#endif
+
+/**
+ * @brief sys_shmat_SHELL() attaches a shared memory segment to the current process.
+ * 
+ * @param id ID of the segment
+ * @param addr address hint (ignored)
+ * @param flags SHM_RDONLY or 0
+ * @param retval address of the segment
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_shmat_SHELL(int id, userptr_t addr, int flags, int32_t *retval) {
+
+    struct addrspace *as;
+    vaddr_t va;
+    int err;
+
+    (void) addr;
+
+    if ((flags & ~SHM_RDONLY) != 0) {
+        return EINVAL;
+    }
+
+    as = proc_getas();
+    if (as == NULL) {
+        return ENOMEM;
+    }
+
+    err = as_shmat(as, id, (flags & SHM_RDONLY) != 0, &va);
+    if (err) {
+        return err;
+    }
+    *retval = (int32_t) va;
+    return 0;
+}
+#endif
+
+/**
+ * @brief sys_shmdt_SHELL() detaches a shared memory segment from the current process.
+ * 
+ * @param addr address of the segment
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_shmdt_SHELL(userptr_t addr) {
+
+    struct addrspace *as;
+
+    as = proc_getas();
+    if (as == NULL) {
+        return EINVAL;
+    }
+    return as_shmdt(as, (vaddr_t) addr);
+}
+#endif
+
+/**
+ * @brief Report the resource usage of the current process or of its reaped children:
+ *        CPU time, faults, system calls and bytes read and written.
+ * 
+ * @param who RUSAGE_SELF or RUSAGE_CHILDREN
+ * @param usage where to store the usage (user pointer)
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_getrusage_SHELL(int who, userptr_t usage) {
+
+    struct rusage ru;
+    int err;
+
+    /* COLLECTING THE COUNTERS */
+    err = proc_getusage(who, &ru);
+    if (err) {
+        return err;
+    }
+
+    /* HANDING THEM TO THE USER */
+    return copyout(&ru, usage, sizeof(ru));
+}
+#endif
+
+/**
+ * @brief Restrict a process to the CPUs in a mask.
+ * 
+ * @param pid process id, 0 for the current process
+ * @param mask the CPUs allowed
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_sched_setaffinity_SHELL(pid_t pid, unsigned mask) {
+
+    if (pid < 0) {
+        return ESRCH;
+    }
+    return proc_setaffinity(pid, (uint32_t) mask);
+}
+#endif
+
+/**
+ * @brief Get the CPU mask of a process.
+ * 
+ * @param pid process id, 0 for the current process
+ * @param mask where to store the mask (user pointer)
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_sched_getaffinity_SHELL(pid_t pid, userptr_t mask) {
+
+    uint32_t kmask;
+    int err;
+
+    if (pid < 0) {
+        return ESRCH;
+    }
+    err = proc_getaffinity(pid, &kmask);
+    if (err) {
+        return err;
+    }
+    return copyout32(kmask, mask);
+}
+#endif
+
+/**
+ * @brief Set the nice value of a process. There are no process groups or users, so
+ *        only PRIO_PROCESS is supported.
+ * 
+ * @param which PRIO_PROCESS
+ * @param who process id, 0 for the current process
+ * @param prio the new nice value (clamped to PRIO_MIN..PRIO_MAX)
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_setpriority_SHELL(int which, pid_t who, int prio) {
+
+    if (which != PRIO_PROCESS) {
+        return EINVAL;
+    } else if (who < 0) {
+        return ESRCH;
+    }
+    return proc_setnice(who, prio);
+}
+#endif
+
+/**
+ * @brief Get the nice value of a process.
+ * 
+ * @param which PRIO_PROCESS
+ * @param who process id, 0 for the current process
+ * @param retval the nice value
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys_getpriority_SHELL(int which, pid_t who, int *retval) {
+
+    if (which != PRIO_PROCESS) {
+        return EINVAL;
+    } else if (who < 0) {
+        return ESRCH;
+    }
+    return proc_getnice(who, retval);
+}
+#endif
+
+/**
+ * @brief Sleep on the int at uaddr until another thread of the process wakes it with
+ *        __futex_wake(), provided it still holds val.
+ * 
+ * @param uaddr user address of the futex word
+ * @param val value the caller expects the word to hold
+ * @return zero when woken, an error value otherwise
+ */
+#if OPT_SHELL
+int sys___futex_wait_SHELL(userptr_t uaddr, int val) {
+
+    if (uaddr == NULL) {
+        return EFAULT;
+    }
+    return futex_wait(uaddr, val);
+}
+#endif
+
+/**
+ * @brief Wake up to n threads of the process sleeping on the int at uaddr.
+ * 
+ * @param uaddr user address of the futex word
+ * @param n most threads to wake
+ * @param retval number of threads woken
+ * @return zero on success, an error value in case of failure
+ */
+#if OPT_SHELL
+int sys___futex_wake_SHELL(userptr_t uaddr, int n, int32_t *retval) {
+
+    int woken, err;
+
+    /* CHECKING ARGUMENTS */
+    if (uaddr == NULL) {
+        return EFAULT;
+    } else if (n <= 0) {
+        return EINVAL;
+    }
+
+    err = futex_wake(uaddr, n, &woken);
+    if (err) {
+        return err;
+    }
+
+    *retval = woken;
+    return 0;
+}
+#endif
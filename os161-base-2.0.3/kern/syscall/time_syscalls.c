@@ -28,6 +28,7 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <clock.h>
 #include <copyinout.h>
 #include <syscall.h>
@@ -41,18 +42,76 @@ sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
 	struct timespec ts;
 	int result;
 
-	gettime(&ts);
+	/* 1/hz resolution is plenty, and much cheaper */
+	gettime_coarse(&ts);
 
-	result = copyout(&ts.tv_sec, user_seconds_ptr, sizeof(ts.tv_sec));
+	result = copyout64(ts.tv_sec, user_seconds_ptr);
 	if (result) {
 		return result;
 	}
 
-	result = copyout(&ts.tv_nsec, user_nanoseconds_ptr,
-			 sizeof(ts.tv_nsec));
+	result = copyout32(ts.tv_nsec, user_nanoseconds_ptr);
 	if (result) {
 		return result;
 	}
 
 	return 0;
 }
+
+/*
+ * Get the time from one of the clocks. CLOCK_MONOTONIC is the precise
+ * one, for timing things; for the time of day, unlike __time, we ask
+ * the clock device rather than taking the last hardclock's reading.
+ */
+int
+sys_clock_gettime(int clockid, userptr_t user_ts)
+{
+	struct timespec ts;
+
+	switch (clockid) {
+	    case CLOCK_REALTIME:
+		gettime(&ts);
+		break;
+	    case CLOCK_MONOTONIC:
+		clock_monotonic_ts(&ts);
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	return copyout(&ts, user_ts, sizeof(ts));
+}
+
+/*
+ * Sleep for the given interval. Sleeps are never interrupted, so the
+ * remaining time, if asked for, is always zero.
+ */
+int
+sys_nanosleep(userptr_t user_req, userptr_t user_rem)
+{
+	struct timespec req, deadline;
+	int result;
+
+	result = copyin(user_req, &req, sizeof(req));
+	if (result) {
+		return result;
+	}
+	if (req.tv_sec < 0 || req.tv_nsec < 0 || req.tv_nsec >= 1000000000) {
+		return EINVAL;
+	}
+
+	gettime(&deadline);
+	timespec_add(&deadline, &req, &deadline);
+	timer_sleep(&deadline);
+
+	if (user_rem != NULL) {
+		req.tv_sec = 0;
+		req.tv_nsec = 0;
+		result = copyout(&req, user_rem, sizeof(req));
+		if (result) {
+			return result;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,854 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Kernel microbenchmarks.
+ *
+ * Each benchmark times a series of samples with clock_monotonic, less
+ * the cost of reading the clock. A sample is one operation, or for
+ * operations too cheap to time one at a time, a batch of BENCH_BATCH
+ * of them, whose latency is then the mean over the batch. The report
+ * gives the throughput over the whole run, and the median, 90th and
+ * 99th percentile and worst latencies of the samples, so that two
+ * kernels can be compared by running the same benchmarks on both.
+ *
+ * The contended benchmarks run BENCH_NTHREADS threads at once, each
+ * taking its own samples.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <thread.h>
+#include <current.h>
+#include <vm.h>
+#include <vfs.h>
+#include <test.h>
+
+#define BENCH_MAXSAMPLES 1024		/* samples kept per benchmark */
+#define BENCH_SAMPLES    200		/* samples taken by each thread */
+#define BENCH_BATCH      100		/* operations per sample, if cheap */
+#define BENCH_NTHREADS   4		/* threads in contended benchmarks */
+#define BENCH_PATHLEN    128
+
+static uint64_t bench_samples[BENCH_MAXSAMPLES];
+static unsigned bench_nsamples;
+static uint64_t bench_ops;
+static uint64_t bench_t0;
+static struct spinlock bench_spinlock = SPINLOCK_INITIALIZER;
+
+/* For the benchmarks that run more than one thread */
+static struct semaphore *bench_go, *bench_done;
+static struct semaphore *bench_ping, *bench_pong;
+static struct semaphore *bench_sem;
+static struct lock *bench_lock;
+static struct cv *bench_cv;
+static unsigned bench_nthreads;
+static volatile unsigned bench_turn;
+static uint32_t bench_pongmask;
+
+////////////////////////////////////////////////////////////
+// sampling and reporting
+
+static
+void
+bench_begin(void)
+{
+	bench_nsamples = 0;
+	bench_ops = 0;
+	bench_t0 = clock_monotonic();
+}
+
+/*
+ * Record a sample of NOPS operations that ran from T0 to T1.
+ */
+static
+void
+bench_record(uint64_t t0, uint64_t t1, unsigned nops)
+{
+	uint64_t ns, overhead;
+
+	overhead = clock_monotonic_overhead();
+	ns = t1 - t0;
+	ns = ns > overhead ? ns - overhead : 0;
+
+	spinlock_acquire(&bench_spinlock);
+	if (bench_nsamples < BENCH_MAXSAMPLES) {
+		bench_samples[bench_nsamples++] = ns / nops;
+	}
+	bench_ops += nops;
+	spinlock_release(&bench_spinlock);
+}
+
+static
+uint64_t
+bench_percentile(unsigned pct)
+{
+	return bench_samples[(bench_nsamples - 1) * pct / 100];
+}
+
+/*
+ * Print the results for the samples recorded since bench_begin.
+ */
+static
+void
+bench_end(const char *name)
+{
+	uint64_t wall, t;
+	unsigned i, j;
+
+	wall = clock_monotonic() - bench_t0;
+	if (bench_nsamples == 0 || wall == 0) {
+		kprintf("%-26s no samples\n", name);
+		return;
+	}
+
+	/* Insertion sort; there aren't many */
+	for (i=1; i<bench_nsamples; i++) {
+		t = bench_samples[i];
+		for (j=i; j>0 && bench_samples[j-1] > t; j--) {
+			bench_samples[j] = bench_samples[j-1];
+		}
+		bench_samples[j] = t;
+	}
+
+	kprintf("%-26s %9llu ops/s  p50 %7llu p90 %7llu p99 %7llu "
+		"max %7llu ns\n", name,
+		(unsigned long long)(bench_ops * 1000000000ULL / wall),
+		(unsigned long long)bench_percentile(50),
+		(unsigned long long)bench_percentile(90),
+		(unsigned long long)bench_percentile(99),
+		(unsigned long long)bench_samples[bench_nsamples - 1]);
+}
+
+/*
+ * Start N threads running FUNC(NULL, i), let them go at once, and wait
+ * for them all to call V(bench_done). The samples they take are
+ * reported as NAME.
+ */
+static
+int
+bench_threads(const char *name, void (*func)(void *, unsigned long),
+	      unsigned n)
+{
+	unsigned i, started;
+	int result = 0;
+
+	bench_nthreads = n;
+	for (started=0; started<n; started++) {
+		result = thread_fork(name, NULL, func, NULL, started);
+		if (result) {
+			kprintf("%s: thread_fork: %s\n", name,
+				strerror(result));
+			break;
+		}
+	}
+
+	bench_begin();
+	for (i=0; i<started; i++) {
+		V(bench_go);
+	}
+	for (i=0; i<started; i++) {
+		P(bench_done);
+	}
+	if (result == 0) {
+		bench_end(name);
+	}
+	return result;
+}
+
+/*
+ * Create the synchronization objects the benchmarks share, the first
+ * time (or whichever ones couldn't be made last time).
+ */
+static
+int
+bench_init(void)
+{
+	if (bench_go == NULL) {
+		bench_go = sem_create("bench go", 0);
+	}
+	if (bench_done == NULL) {
+		bench_done = sem_create("bench done", 0);
+	}
+	if (bench_ping == NULL) {
+		bench_ping = sem_create("bench ping", 0);
+	}
+	if (bench_pong == NULL) {
+		bench_pong = sem_create("bench pong", 0);
+	}
+	if (bench_sem == NULL) {
+		bench_sem = sem_create("bench sem", 1);
+	}
+	if (bench_lock == NULL) {
+		bench_lock = lock_create("bench lock");
+	}
+	if (bench_cv == NULL) {
+		bench_cv = cv_create("bench cv");
+	}
+	if (bench_go == NULL || bench_done == NULL || bench_ping == NULL ||
+	    bench_pong == NULL || bench_sem == NULL || bench_lock == NULL ||
+	    bench_cv == NULL) {
+		kprintf("bench: Out of memory\n");
+		return ENOMEM;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// bn1: thread create/destroy
+
+static
+void
+bench_exitthread(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	V(bench_done);
+}
+
+/*
+ * Fork a thread that exits right away, and wait until it has run.
+ * Its thread structure is cleaned up on a later context switch, which
+ * is part of what the following samples measure.
+ */
+int
+benchthread(int nargs, char **args)
+{
+	uint64_t t0;
+	unsigned i;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	result = bench_init();
+	if (result) {
+		return result;
+	}
+	bench_begin();
+	for (i=0; i<BENCH_SAMPLES; i++) {
+		t0 = clock_monotonic();
+		result = thread_fork("bench thread", NULL, bench_exitthread,
+				     NULL, 0);
+		if (result) {
+			kprintf("bn1: thread_fork: %s\n", strerror(result));
+			return result;
+		}
+		P(bench_done);
+		bench_record(t0, clock_monotonic(), 1);
+	}
+	bench_end("thread create/exit");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// bn2: context switch
+
+static
+void
+bench_pongthread(void *junk, unsigned long rounds)
+{
+	(void)junk;
+
+	thread_setaffinity(curthread, bench_pongmask);
+	while (rounds-- > 0) {
+		P(bench_ping);
+		V(bench_pong);
+	}
+	V(bench_done);
+}
+
+/*
+ * Bounce between this thread and another through two semaphores, and
+ * report the time per switch. We stay on this cpu, and so does the
+ * other thread unless PONGMASK sends it elsewhere.
+ */
+static
+int
+bench_pingpong(const char *name, bool samecpu)
+{
+	uint32_t mask, me;
+	uint64_t t0;
+	unsigned i, j;
+	int result;
+
+	mask = thread_getaffinity(curthread);
+	me = (uint32_t)1 << curcpu->c_number;
+	thread_setaffinity(curthread, me);
+	bench_pongmask = samecpu ? me : thread_cpumask() & ~me;
+
+	result = thread_fork(name, NULL, bench_pongthread, NULL,
+			     BENCH_SAMPLES * BENCH_BATCH);
+	if (result) {
+		kprintf("bn2: thread_fork: %s\n", strerror(result));
+		thread_setaffinity(curthread, mask);
+		return result;
+	}
+
+	bench_begin();
+	for (i=0; i<BENCH_SAMPLES; i++) {
+		t0 = clock_monotonic();
+		for (j=0; j<BENCH_BATCH; j++) {
+			V(bench_ping);
+			P(bench_pong);
+		}
+		bench_record(t0, clock_monotonic(), 2 * BENCH_BATCH);
+	}
+	P(bench_done);
+	bench_end(name);
+
+	thread_setaffinity(curthread, mask);
+	return 0;
+}
+
+int
+benchswitch(int nargs, char **args)
+{
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	result = bench_init();
+	if (result) {
+		return result;
+	}
+	result = bench_pingpong("switch, same cpu", true);
+	if (result == 0 && cpu_count() > 1) {
+		result = bench_pingpong("switch, other cpu", false);
+	}
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+// bn3: locks
+
+static
+void
+bench_lockthread(void *junk, unsigned long num)
+{
+	uint64_t t0;
+	unsigned i, j;
+
+	(void)junk;
+	(void)num;
+
+	P(bench_go);
+	for (i=0; i<BENCH_SAMPLES; i++) {
+		t0 = clock_monotonic();
+		for (j=0; j<BENCH_BATCH; j++) {
+			lock_acquire(bench_lock);
+			lock_release(bench_lock);
+		}
+		bench_record(t0, clock_monotonic(), BENCH_BATCH);
+	}
+	V(bench_done);
+}
+
+int
+benchlock(int nargs, char **args)
+{
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	result = bench_init();
+	if (result == 0) {
+		result = bench_threads("lock, uncontended",
+				       bench_lockthread, 1);
+	}
+	if (result == 0) {
+		result = bench_threads("lock, contended", bench_lockthread,
+				       BENCH_NTHREADS);
+	}
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+// bn4: semaphores
+
+static
+void
+bench_semthread(void *junk, unsigned long num)
+{
+	uint64_t t0;
+	unsigned i, j;
+
+	(void)junk;
+	(void)num;
+
+	P(bench_go);
+	for (i=0; i<BENCH_SAMPLES; i++) {
+		t0 = clock_monotonic();
+		for (j=0; j<BENCH_BATCH; j++) {
+			P(bench_sem);
+			V(bench_sem);
+		}
+		bench_record(t0, clock_monotonic(), BENCH_BATCH);
+	}
+	V(bench_done);
+}
+
+int
+benchsem(int nargs, char **args)
+{
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	result = bench_init();
+	if (result == 0) {
+		result = bench_threads("semaphore, uncontended",
+				       bench_semthread, 1);
+	}
+	if (result == 0) {
+		result = bench_threads("semaphore, contended",
+				       bench_semthread, BENCH_NTHREADS);
+	}
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+// bn5: condition variables
+
+/*
+ * Signal with nobody waiting: the cost of the call itself.
+ */
+static
+void
+bench_signalthread(void *junk, unsigned long num)
+{
+	uint64_t t0;
+	unsigned i, j;
+
+	(void)junk;
+	(void)num;
+
+	P(bench_go);
+	lock_acquire(bench_lock);
+	for (i=0; i<BENCH_SAMPLES; i++) {
+		t0 = clock_monotonic();
+		for (j=0; j<BENCH_BATCH; j++) {
+			cv_signal(bench_cv, bench_lock);
+		}
+		bench_record(t0, clock_monotonic(), BENCH_BATCH);
+	}
+	lock_release(bench_lock);
+	V(bench_done);
+}
+
+/*
+ * Pass a turn around a ring of threads: each waits for its turn, then
+ * hands it to the next one and broadcasts. Throughput is in handoffs;
+ * the latency of a sample is per turn, which is once round the ring.
+ */
+static
+void
+bench_ringthread(void *junk, unsigned long num)
+{
+	uint64_t t0;
+	unsigned i, j;
+
+	(void)junk;
+
+	P(bench_go);
+	lock_acquire(bench_lock);
+	for (i=0; i<BENCH_SAMPLES; i++) {
+		t0 = clock_monotonic();
+		for (j=0; j<BENCH_BATCH; j++) {
+			while (bench_turn != num) {
+				cv_wait(bench_cv, bench_lock);
+			}
+			bench_turn = (num + 1) % bench_nthreads;
+			cv_broadcast(bench_cv, bench_lock);
+		}
+		bench_record(t0, clock_monotonic(), BENCH_BATCH);
+	}
+	lock_release(bench_lock);
+	V(bench_done);
+}
+
+int
+benchcv(int nargs, char **args)
+{
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	result = bench_init();
+	if (result == 0) {
+		result = bench_threads("cv signal, no waiters",
+				       bench_signalthread, 1);
+	}
+	if (result == 0) {
+		bench_turn = 0;
+		result = bench_threads("cv handoff, 2 threads",
+				       bench_ringthread, 2);
+	}
+	if (result == 0) {
+		bench_turn = 0;
+		result = bench_threads("cv handoff, 4 threads",
+				       bench_ringthread, BENCH_NTHREADS);
+	}
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+// bn6: kmalloc
+
+static const size_t bench_kmsizes[] = {
+	16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 16384, 0
+};
+
+/*
+ * For each size, allocate BENCH_BATCH blocks and free them again, so
+ * that each sample fills and empties a good part of a page or more.
+ */
+int
+benchkmalloc(int nargs, char **args)
+{
+	static void *ptrs[BENCH_BATCH];
+	char name[32];
+	uint64_t t0;
+	unsigned i, j, k, n;
+
+	(void)nargs;
+	(void)args;
+
+	for (k=0; bench_kmsizes[k] != 0; k++) {
+		bench_begin();
+		for (i=0; i<BENCH_SAMPLES; i++) {
+			t0 = clock_monotonic();
+			for (n=0; n<BENCH_BATCH; n++) {
+				ptrs[n] = kmalloc(bench_kmsizes[k]);
+				if (ptrs[n] == NULL) {
+					break;
+				}
+			}
+			for (j=0; j<n; j++) {
+				kfree(ptrs[j]);
+			}
+			if (n < BENCH_BATCH) {
+				kprintf("bn6: Out of memory\n");
+				return ENOMEM;
+			}
+			bench_record(t0, clock_monotonic(), BENCH_BATCH);
+		}
+		snprintf(name, sizeof(name), "kmalloc/kfree %zu",
+			 bench_kmsizes[k]);
+		bench_end(name);
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// bn7: page allocation
+
+static
+int
+bench_pages(unsigned npages)
+{
+	static vaddr_t pages[BENCH_BATCH];
+	char name[32];
+	uint64_t t0;
+	unsigned i, j, n;
+
+	bench_begin();
+	for (i=0; i<BENCH_SAMPLES; i++) {
+		t0 = clock_monotonic();
+		for (n=0; n<BENCH_BATCH; n++) {
+			pages[n] = alloc_kpages(npages);
+			if (pages[n] == 0) {
+				break;
+			}
+		}
+		for (j=0; j<n; j++) {
+			free_kpages(pages[j]);
+		}
+		if (n < BENCH_BATCH) {
+			kprintf("bn7: Out of memory\n");
+			return ENOMEM;
+		}
+		bench_record(t0, clock_monotonic(), BENCH_BATCH);
+	}
+	snprintf(name, sizeof(name), "alloc/free_kpages %u", npages);
+	bench_end(name);
+	return 0;
+}
+
+int
+benchpages(int nargs, char **args)
+{
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	result = bench_pages(1);
+	if (result == 0) {
+		result = bench_pages(4);
+	}
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+// bn8: vfs_open/vfs_close
+
+/*
+ * Open and close PATH, read-only, over and over. If CREATE is set,
+ * the file is made first and removed afterwards.
+ */
+static
+int
+bench_openclose(const char *path, bool create)
+{
+	char buf[BENCH_PATHLEN], name[BENCH_PATHLEN + 16];
+	struct vnode *vn;
+	uint64_t t0;
+	unsigned i;
+	int result;
+
+	if (strlen(path) >= sizeof(buf)) {
+		kprintf("bn8: %s: %s\n", path, strerror(ENAMETOOLONG));
+		return ENAMETOOLONG;
+	}
+	if (create) {
+		strcpy(buf, path);
+		result = vfs_open(buf, O_WRONLY|O_CREAT, 0664, &vn);
+		if (result) {
+			kprintf("bn8: %s: %s\n", path, strerror(result));
+			return result;
+		}
+		vfs_close(vn);
+	}
+
+	bench_begin();
+	for (i=0; i<BENCH_SAMPLES; i++) {
+		/* vfs_open may change the path */
+		strcpy(buf, path);
+		t0 = clock_monotonic();
+		result = vfs_open(buf, O_RDONLY, 0, &vn);
+		if (result) {
+			kprintf("bn8: %s: %s\n", path, strerror(result));
+			break;
+		}
+		vfs_close(vn);
+		bench_record(t0, clock_monotonic(), 1);
+	}
+	if (result == 0) {
+		snprintf(name, sizeof(name), "open/close %s", path);
+		bench_end(name);
+	}
+
+	if (create) {
+		strcpy(buf, path);
+		(void)vfs_remove(buf);
+	}
+	return result;
+}
+
+/*
+ * With no arguments, a scratch file on emu0 and another on lhd0 (if it
+ * has a file system mounted); otherwise the files named, which have to
+ * exist already.
+ */
+int
+benchvfs(int nargs, char **args)
+{
+	int i, result, err;
+
+	if (nargs == 1) {
+		result = bench_openclose("emu0:benchfile", true);
+		err = bench_openclose("lhd0:benchfile", true);
+		return result ? result : err;
+	}
+
+	result = 0;
+	for (i=1; i<nargs; i++) {
+		err = bench_openclose(args[i], false);
+		if (err) {
+			result = err;
+		}
+	}
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+// bn9: memcpy/memmove/memset
+
+#define BENCH_MEMBUF	(16384 + 16)
+
+static const size_t bench_memsizes[] = { 16, 64, 512, 4096, 16384, 0 };
+static const char *const bench_memnames[] = { "memcpy", "memmove", "memset" };
+
+/*
+ * Time OP (0-2, as in bench_memnames) on LEN bytes with the source at offset
+ * SOFF from a word boundary and the destination at DOFF; memmove is
+ * given overlapping buffers, destination above source, to make it go
+ * backwards. Throughput is in calls; the name gives the layout.
+ */
+static
+void
+bench_mem(unsigned op, char *dst, char *src, size_t len,
+	  unsigned soff, unsigned doff)
+{
+	char name[40];
+	uint64_t t0;
+	unsigned i, j, batch;
+
+	/* Keep each sample to about the same amount of copying */
+	batch = len >= 4096 ? 4 : BENCH_BATCH;
+
+	bench_begin();
+	for (i=0; i<BENCH_SAMPLES; i++) {
+		t0 = clock_monotonic();
+		for (j=0; j<batch; j++) {
+			switch (op) {
+			    case 0:
+				memcpy(dst + doff, src + soff, len);
+				break;
+			    case 1:
+				memmove(src + doff + 8, src + soff, len);
+				break;
+			    default:
+				memset(dst + doff, j, len);
+				break;
+			}
+		}
+		bench_record(t0, clock_monotonic(), batch);
+	}
+	snprintf(name, sizeof(name), "%s %zu +%u+%u", bench_memnames[op],
+		 len, soff, doff);
+	bench_end(name);
+}
+
+/*
+ * First make sure all three give the right answer for every small
+ * length and alignment, then time them.
+ */
+int
+benchmem(int nargs, char **args)
+{
+	char *src, *dst;
+	unsigned k, soff, doff, len, i;
+
+	(void)nargs;
+	(void)args;
+
+	src = kmalloc(BENCH_MEMBUF);
+	dst = kmalloc(BENCH_MEMBUF);
+	if (src == NULL || dst == NULL) {
+		kprintf("bn9: Out of memory\n");
+		kfree(src);
+		kfree(dst);
+		return ENOMEM;
+	}
+
+	for (len=0; len<80; len++) {
+		for (soff=0; soff<8; soff++) {
+			for (doff=0; doff<8; doff++) {
+				for (i=0; i<96; i++) {
+					src[i] = i;
+					dst[i] = 0;
+				}
+				memcpy(dst + doff, src + soff, len);
+				for (i=0; i<96; i++) {
+					KASSERT(dst[i] == (i >= doff && i < doff + len ?
+						(char)(i - doff + soff) : 0));
+				}
+				memset(dst + doff, 0x5a, len);
+				for (i=0; i<96; i++) {
+					KASSERT(dst[i] == (i >= doff && i < doff + len ?
+						0x5a : 0));
+				}
+				memmove(src + doff + 8, src + soff, len);
+				for (i=doff+8; i<doff+8+len; i++) {
+					KASSERT(src[i] == (char)(i - doff - 8 + soff));
+				}
+			}
+		}
+	}
+
+	for (k=0; bench_memsizes[k] != 0; k++) {
+		bench_mem(0, dst, src, bench_memsizes[k], 0, 0);
+		bench_mem(0, dst, src, bench_memsizes[k], 1, 0);
+		bench_mem(0, dst, src, bench_memsizes[k], 1, 3);
+		bench_mem(1, dst, src, bench_memsizes[k] - 8, 0, 0);
+		bench_mem(1, dst, src, bench_memsizes[k] - 8, 1, 0);
+		bench_mem(2, dst, src, bench_memsizes[k], 0, 0);
+		bench_mem(2, dst, src, bench_memsizes[k], 0, 1);
+	}
+
+	kfree(src);
+	kfree(dst);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Run all of them, with default arguments.
+ */
+int
+benchall(int nargs, char **args)
+{
+	static char *noargs[] = { (char *)"bench", NULL };
+	int result, err;
+
+	(void)nargs;
+	(void)args;
+
+	result = benchthread(1, noargs);
+	err = benchswitch(1, noargs);
+	result = result ? result : err;
+	err = benchlock(1, noargs);
+	result = result ? result : err;
+	err = benchsem(1, noargs);
+	result = result ? result : err;
+	err = benchcv(1, noargs);
+	result = result ? result : err;
+	err = benchkmalloc(1, noargs);
+	result = result ? result : err;
+	err = benchpages(1, noargs);
+	result = result ? result : err;
+	err = benchmem(1, noargs);
+	result = result ? result : err;
+	/* (vfs failures don't count: lhd0 may have nothing mounted) */
+	(void)benchvfs(1, noargs);
+	return result;
+}
@@ -101,6 +101,29 @@ bitmaptest(int nargs, char **args)
 		KASSERT(data[i]==0);
 	}
 
+	/* Free a few runs of different lengths and allocate them back */
+	for (i=0; i<TESTSIZE; i++) {
+		data[i] = (i % 97) < (i % 13);
+		if (data[i]) {
+			bitmap_unmark(b, i);
+		}
+	}
+	while (bitmap_alloc_range(b, 5, &x)==0) {
+		KASSERT(x + 5 <= TESTSIZE);
+		for (i=0; i<5; i++) {
+			KASSERT(data[x+i]==1);
+			KASSERT(bitmap_isset(b, x+i));
+			data[x+i] = 0;
+		}
+	}
+	KASSERT(bitmap_findrun(b, 0, 5, &x)!=0);
+	for (i=0; i<TESTSIZE; i++) {
+		if (data[i]) {
+			KASSERT(bitmap_findrun(b, i, 1, &x)==0);
+			KASSERT(x==(unsigned)i);
+		}
+	}
+
 	kprintf("Bitmap test complete\n");
 	return 0;
 }
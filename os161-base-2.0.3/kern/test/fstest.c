@@ -43,6 +43,7 @@
 #include <kern/fcntl.h>
 #include <lib.h>
 #include <uio.h>
+#include <clock.h>
 #include <thread.h>
 #include <synch.h>
 #include <vfs.h>
@@ -56,6 +57,9 @@
 #define NTHREADS 12
 #define NLONG    32
 #define NCREATE  24
+#define NMULTIVOL 4
+#define MVCHUNK  4096
+#define MVBYTES  (256*1024)
 
 static struct semaphore *threadsem = NULL;
 
@@ -674,6 +678,186 @@ docreatestress(const char *filesys)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Multi-volume throughput: a file is written and read back on each
+ * of several filesystems, first on one at a time and then on all of
+ * them at once, one thread each. Volumes that don't share any locks
+ * go about as fast together as separately, so the total throughput
+ * of the concurrent pass should be close to the sum of the others.
+ */
+
+static struct {
+	const char *fs;          /* filesystem, without the colon */
+	int result;              /* 0 or errno */
+	uint64_t ns;             /* how long it took */
+} multivol[NMULTIVOL];
+
+static
+int
+multivol_run(const char *fs, unsigned num)
+{
+	struct vnode *vn;
+	struct iovec iov;
+	struct uio ku;
+	char name[32];
+	char *buf;
+	off_t pos;
+	unsigned i;
+	int err;
+
+	buf = kmalloc(MVCHUNK);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+
+	snprintf(name, sizeof(name), "%s:%s.mv%u", fs, FILENAME, num);
+	err = vfs_open(name, O_RDWR|O_CREAT|O_TRUNC, 0664, &vn);
+	if (err) {
+		kprintf("%s: Could not open test file: %s\n", fs,
+			strerror(err));
+		kfree(buf);
+		return err;
+	}
+
+	for (pos = 0; pos < MVBYTES && err == 0; pos += MVCHUNK) {
+		memset(buf, (int)(pos / MVCHUNK + num), MVCHUNK);
+		uio_kinit(&iov, &ku, buf, MVCHUNK, pos, UIO_WRITE);
+		err = VOP_WRITE(vn, &ku);
+		if (err == 0 && ku.uio_resid > 0) {
+			err = ENOSPC;
+		}
+	}
+	if (err == 0) {
+		err = VOP_FSYNC(vn);
+	}
+	for (pos = 0; pos < MVBYTES && err == 0; pos += MVCHUNK) {
+		uio_kinit(&iov, &ku, buf, MVCHUNK, pos, UIO_READ);
+		err = VOP_READ(vn, &ku);
+		if (err == 0 && ku.uio_resid > 0) {
+			err = EIO;
+		}
+		for (i=0; i<MVCHUNK && err == 0; i++) {
+			if (buf[i] != (char)(pos / MVCHUNK + num)) {
+				kprintf("%s: Test failed: byte %llu "
+					"mismatched\n", fs,
+					(unsigned long long)(pos + i));
+				err = EIO;
+			}
+		}
+	}
+	if (err) {
+		kprintf("%s: %s\n", fs, strerror(err));
+	}
+	vfs_close(vn);
+	kfree(buf);
+
+	snprintf(name, sizeof(name), "%s:%s.mv%u", fs, FILENAME, num);
+	(void)vfs_remove(name);
+	return err;
+}
+
+static
+void
+multivol_thread(void *junk, unsigned long num)
+{
+	uint64_t t0;
+
+	(void)junk;
+
+	t0 = clock_monotonic();
+	multivol[num].result = multivol_run(multivol[num].fs, num);
+	multivol[num].ns = clock_monotonic() - t0;
+
+	V(threadsem);
+}
+
+/* Kbytes per second for BYTES moved in NS nanoseconds */
+static
+unsigned long long
+multivol_rate(uint64_t bytes, uint64_t ns)
+{
+	return ns ? bytes * 1000000000ULL / ns / 1024 : 0;
+}
+
+int
+multivolstress(int nargs, char **args)
+{
+	uint64_t serial, t0, elapsed;
+	unsigned i, n;
+	char *fs;
+	int err;
+
+	if (nargs < 3 || nargs > NMULTIVOL + 1) {
+		kprintf("Usage: fs7 filesystem: filesystem: ... (2 to %d)\n",
+			NMULTIVOL);
+		return EINVAL;
+	}
+
+	init_threadsem();
+	n = nargs - 1;
+	for (i=0; i<n; i++) {
+		/* Allow (but do not require) colon after device name */
+		fs = args[i+1];
+		if (fs[strlen(fs)-1]==':') {
+			fs[strlen(fs)-1] = 0;
+		}
+		multivol[i].fs = fs;
+	}
+
+	kprintf("*** Starting multi-volume throughput test\n");
+
+	/* Each volume on its own */
+	serial = 0;
+	for (i=0; i<n; i++) {
+		multivol_thread(NULL, i);
+		P(threadsem);
+		if (multivol[i].result) {
+			kprintf("*** Test failed\n");
+			return multivol[i].result;
+		}
+		serial += multivol[i].ns;
+		kprintf("%s: alone, %llu KB/s\n", multivol[i].fs,
+			multivol_rate(2 * MVBYTES, multivol[i].ns));
+	}
+
+	/* All of them at once */
+	t0 = clock_monotonic();
+	for (i=0; i<n; i++) {
+		err = thread_fork("multivol", NULL, multivol_thread, NULL, i);
+		if (err) {
+			panic("multivolstress: thread_fork failed %s\n",
+			      strerror(err));
+		}
+	}
+	for (i=0; i<n; i++) {
+		P(threadsem);
+	}
+	elapsed = clock_monotonic() - t0;
+
+	err = 0;
+	for (i=0; i<n; i++) {
+		if (multivol[i].result) {
+			err = multivol[i].result;
+		}
+		kprintf("%s: together, %llu KB/s\n", multivol[i].fs,
+			multivol_rate(2 * MVBYTES, multivol[i].ns));
+	}
+	if (err) {
+		kprintf("*** Test failed\n");
+		return err;
+	}
+
+	kprintf("%u volumes: %llu KB/s one at a time, %llu KB/s together "
+		"(%llu%% of the time)\n", n,
+		multivol_rate((uint64_t)n * 2 * MVBYTES, serial),
+		multivol_rate((uint64_t)n * 2 * MVBYTES, elapsed),
+		(unsigned long long)(serial ? elapsed * 100 / serial : 0));
+	kprintf("*** Multi-volume throughput test done\n");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+
 static
 int
 checkfilesystem(int nargs, char **args)
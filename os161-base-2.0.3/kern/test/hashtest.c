@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Test code for the hash table (hashtable.h).
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <hashtable.h>
+#include <test.h>
+
+#define TESTSIZE	1500	/* enough for several resizes */
+#define NAMELEN		16
+
+struct hashobj {
+	int ho_key;
+	char ho_name[NAMELEN];
+	bool ho_in;			/* in the tables */
+	struct hashnode ho_bykey;
+	struct hashnode ho_byname;
+};
+
+static
+bool
+hashobj_haskey(const struct hashobj *ho, int key)
+{
+	return ho->ho_key == key;
+}
+
+static
+bool
+hashobj_hasname(const struct hashobj *ho, const char *name)
+{
+	return !strcmp(ho->ho_name, name);
+}
+
+static
+unsigned
+hashobj_hashkey(int key)
+{
+	return hash_uint(key);
+}
+
+/* The same hash for every key: everything on one chain */
+static
+unsigned
+hashobj_hashbad(int key)
+{
+	(void)key;
+	return 42;
+}
+
+DECLHASH_BYTYPE(keyhash, struct hashobj, int, static __UNUSED inline);
+DEFHASH_BYTYPE(keyhash, struct hashobj, int, ho_bykey,
+	       hashobj_hashkey, hashobj_haskey, static __UNUSED inline);
+DECLHASH_BYTYPE(namehash, struct hashobj, const char *,
+		static __UNUSED inline);
+DEFHASH_BYTYPE(namehash, struct hashobj, const char *, ho_byname,
+	       hash_string, hashobj_hasname, static __UNUSED inline);
+DECLHASH_BYTYPE(badhash, struct hashobj, int, static __UNUSED inline);
+DEFHASH_BYTYPE(badhash, struct hashobj, int, ho_bykey,
+	       hashobj_hashbad, hashobj_haskey, static __UNUSED inline);
+
+static struct hashobj objs[TESTSIZE];
+
+/*
+ * Check that exactly the objects marked ho_in can be found, by key
+ * and by name, and that iterating visits each of them once.
+ */
+static
+void
+check(struct keyhash *kh, struct namehash *nh)
+{
+	struct hashiter hi;
+	struct hashobj *ho;
+	char name[NAMELEN];
+	unsigned n, visited;
+	int i;
+
+	n = 0;
+	for (i=0; i<TESTSIZE; i++) {
+		snprintf(name, sizeof(name), "obj-%d", i);
+		if (objs[i].ho_in) {
+			KASSERT(keyhash_find(kh, i) == &objs[i]);
+			KASSERT(namehash_find(nh, name) == &objs[i]);
+			n++;
+		}
+		else {
+			KASSERT(keyhash_find(kh, i) == NULL);
+			KASSERT(namehash_find(nh, name) == NULL);
+		}
+	}
+	KASSERT(keyhash_count(kh) == n);
+	KASSERT(namehash_count(nh) == n);
+	KASSERT(keyhash_find(kh, -1) == NULL);
+	KASSERT(namehash_find(nh, "obj-") == NULL);
+
+	visited = 0;
+	keyhash_iterinit(kh, &hi);
+	while ((ho = keyhash_iternext(&hi)) != NULL) {
+		KASSERT(ho->ho_in);
+		ho->ho_in = false;
+		visited++;
+	}
+	KASSERT(visited == n);
+	for (i=0; i<TESTSIZE; i++) {
+		KASSERT(!objs[i].ho_in);
+	}
+	namehash_iterinit(nh, &hi);
+	while ((ho = namehash_iternext(&hi)) != NULL) {
+		KASSERT(!ho->ho_in);
+		ho->ho_in = true;
+		visited--;
+	}
+	KASSERT(visited == 0);
+}
+
+int
+hashtest(int nargs, char **args)
+{
+	struct keyhash kh;
+	struct namehash nh;
+	struct badhash bh;
+	int i, j, r;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting hash table test...\n");
+
+	keyhash_init(&kh);
+	namehash_init(&nh);
+	check(&kh, &nh);
+
+	for (i=0; i<TESTSIZE; i++) {
+		objs[i].ho_key = i;
+		snprintf(objs[i].ho_name, NAMELEN, "obj-%d", i);
+		objs[i].ho_in = false;
+		hashnode_init(&objs[i].ho_bykey, &objs[i]);
+		hashnode_init(&objs[i].ho_byname, &objs[i]);
+	}
+
+	/* Growing, checking along the way (so in the middle of resizes) */
+	for (i=0; i<TESTSIZE; i++) {
+		r = keyhash_add(&kh, i, &objs[i]);
+		KASSERT(r == 0);
+		r = namehash_add(&nh, objs[i].ho_name, &objs[i]);
+		KASSERT(r == 0);
+		objs[i].ho_in = true;
+		if (i % 97 == 0) {
+			check(&kh, &nh);
+		}
+	}
+	check(&kh, &nh);
+	kprintf("hashtest: added %d\n", TESTSIZE);
+
+	/* Random removes and re-adds */
+	for (j=0; j<TESTSIZE*2; j++) {
+		i = random() % TESTSIZE;
+		if (objs[i].ho_in) {
+			keyhash_remove(&kh, &objs[i]);
+			namehash_remove(&nh, &objs[i]);
+			objs[i].ho_in = false;
+		}
+		else {
+			r = keyhash_add(&kh, i, &objs[i]);
+			KASSERT(r == 0);
+			r = namehash_add(&nh, objs[i].ho_name, &objs[i]);
+			KASSERT(r == 0);
+			objs[i].ho_in = true;
+		}
+		if (j % 211 == 0) {
+			check(&kh, &nh);
+		}
+	}
+	check(&kh, &nh);
+	kprintf("hashtest: shuffled\n");
+
+	/* Shrinking to nothing */
+	for (i=0; i<TESTSIZE; i++) {
+		if (objs[i].ho_in) {
+			keyhash_remove(&kh, &objs[i]);
+			namehash_remove(&nh, &objs[i]);
+			objs[i].ho_in = false;
+		}
+		if (i % 101 == 0) {
+			check(&kh, &nh);
+		}
+	}
+	check(&kh, &nh);
+	keyhash_cleanup(&kh);
+	namehash_cleanup(&nh);
+	kprintf("hashtest: emptied\n");
+
+	/* One long chain still works, just slowly */
+	badhash_init(&bh);
+	for (i=0; i<TESTSIZE/10; i++) {
+		r = badhash_add(&bh, i, &objs[i]);
+		KASSERT(r == 0);
+	}
+	for (i=0; i<TESTSIZE/10; i++) {
+		KASSERT(badhash_find(&bh, i) == &objs[i]);
+		badhash_remove(&bh, &objs[i]);
+		KASSERT(badhash_find(&bh, i) == NULL);
+	}
+	KASSERT(badhash_count(&bh) == 0);
+	badhash_cleanup(&bh);
+
+	for (i=0; i<TESTSIZE; i++) {
+		hashnode_cleanup(&objs[i].ho_bykey);
+		hashnode_cleanup(&objs[i].ho_byname);
+	}
+
+	kprintf("Hash table test complete\n");
+	return 0;
+}
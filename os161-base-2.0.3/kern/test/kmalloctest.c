@@ -33,7 +33,9 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <clock.h>
 #include <thread.h>
+#include <current.h>
 #include <synch.h>
 #include <vm.h> /* for PAGE_SIZE */
 #include <test.h>
@@ -378,3 +380,241 @@ kmalloctest4(int nargs, char **args)
 	kprintf("Multipage kmalloc test done\n");
 	return 0;
 }
+
+////////////////////////////////////////////////////////////
+// km5
+
+/*
+ * Allocator scalability: one worker per cpu, each pinned to its cpu,
+ * doing KM5_OPS kmalloc/kfree pairs of a mix of sizes weighted toward
+ * the small ones, as the rest of the kernel uses. Each worker keeps
+ * KM5_LIVE blocks alive, freeing the oldest for each new one, so the
+ * per-cpu caches see both hits and refills. This is run with 1, 2,
+ * ... cpus (or up to the number given), and reports the aggregate
+ * rate and how often kmalloc_spinlock was found held meanwhile. If
+ * the allocator scales, the rate goes up with the cpus and the
+ * contention stays low.
+ */
+
+#define KM5_OPS		20000
+#define KM5_LIVE	32
+#define KM5_NSIZES	16
+
+static const unsigned km5_sizes[KM5_NSIZES] = {
+	16, 24, 16, 32, 40, 64, 24, 48,
+	100, 16, 128, 200, 32, 512, 1000, 2000,
+};
+
+static volatile bool km5_go;
+static struct semaphore *km5_donesem;
+
+static
+void
+km5_thread(void *junk, unsigned long num)
+{
+	void *live[KM5_LIVE];
+	uint32_t seed;
+	unsigned i, size;
+	char *p;
+
+	(void)junk;
+
+	if (thread_setaffinity(curthread, (uint32_t)1 << num)) {
+		panic("km5: cannot move to cpu %lu\n", num);
+	}
+	for (i=0; i<KM5_LIVE; i++) {
+		live[i] = NULL;
+	}
+	/* Private generator, so the workers share nothing but kmalloc */
+	seed = 0x9e3779b9U * (num + 1);
+
+	while (!km5_go) {
+		/* wait for everyone */
+	}
+
+	for (i=0; i<KM5_OPS; i++) {
+		seed = seed * 1103515245U + 12345U;
+		size = km5_sizes[(seed >> 16) % KM5_NSIZES];
+
+		kfree(live[i % KM5_LIVE]);
+		p = kmalloc(size);
+		if (p == NULL) {
+			panic("km5: thread %lu: kmalloc(%u) failed\n",
+			      num, size);
+		}
+		p[0] = p[size - 1] = (char)i;
+		live[i % KM5_LIVE] = p;
+	}
+
+	for (i=0; i<KM5_LIVE; i++) {
+		kfree(live[i]);
+	}
+	V(km5_donesem);
+}
+
+static
+void
+km5_run(unsigned ncpus)
+{
+	unsigned acq0, cont0, acq1, cont1, ops;
+	uint64_t t0, ns;
+	unsigned i;
+	int result;
+
+	km5_go = false;
+	for (i=0; i<ncpus; i++) {
+		result = thread_fork("km5", NULL, km5_thread, NULL, i);
+		if (result) {
+			panic("km5: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	/* let them all get to their cpus */
+	clocksleep(1);
+	kheap_lockstats(&acq0, &cont0);
+	t0 = clock_monotonic();
+	km5_go = true;
+	for (i=0; i<ncpus; i++) {
+		P(km5_donesem);
+	}
+	ns = clock_monotonic() - t0;
+	kheap_lockstats(&acq1, &cont1);
+
+	acq1 -= acq0;
+	cont1 -= cont0;
+	ops = ncpus * KM5_OPS;
+	kprintf("km5: %2u cpus: %7llu ops/s, lock %u acquires, "
+		"%u contended (%u%%)\n", ncpus,
+		ns ? (unsigned long long)(ops * 1000000000ULL / ns) : 0ULL,
+		acq1, cont1, acq1 ? cont1 * 100 / acq1 : 0);
+}
+
+int
+kmalloctest5(int nargs, char **args)
+{
+	unsigned ncpus, max, n;
+	uint32_t mask;
+
+	ncpus = 0;
+	for (mask = thread_cpumask(); mask != 0; mask >>= 1) {
+		ncpus++;
+	}
+	max = ncpus;
+	if (nargs == 2) {
+		max = atoi(args[1]);
+		if (max == 0 || max > ncpus) {
+			kprintf("km5: %s cpus requested, %u available\n",
+				args[1], ncpus);
+			return EINVAL;
+		}
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: km5 [maxcpus]\n");
+		return EINVAL;
+	}
+
+	km5_donesem = sem_create("km5", 0);
+	if (km5_donesem == NULL) {
+		panic("km5: sem_create failed\n");
+	}
+
+	kprintf("Starting kmalloc scalability test, 1 to %u cpus, "
+		"%u ops each...\n", max, KM5_OPS);
+	for (n=1; n<=max; n++) {
+		km5_run(n);
+	}
+
+	sem_destroy(km5_donesem);
+	km5_donesem = NULL;
+	kprintf("kmalloc scalability test done\n");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// km6
+
+/*
+ * vmalloc: allocate buffers of several sizes, fill each with a
+ * pattern of its own, check them all, and free them in a different
+ * order. Then check that kvmalloc and kvfree take either kind of
+ * block.
+ */
+
+#define NUM_KM6_SIZES 6
+
+static
+uint32_t
+km6_pattern(unsigned block, unsigned word)
+{
+	return 0xc0ffee00 ^ (block << 24) ^ word;
+}
+
+int
+kmalloctest6(int nargs, char **args)
+{
+	static const size_t sizes[NUM_KM6_SIZES] = {
+		1, PAGE_SIZE, PAGE_SIZE + 1, 3 * PAGE_SIZE, 17 * PAGE_SIZE - 5,
+		64 * PAGE_SIZE,
+	};
+	uint32_t *ptrs[NUM_KM6_SIZES];
+	unsigned i, j, nwords;
+	void *p;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting vmalloc test...\n");
+
+	for (i=0; i<NUM_KM6_SIZES; i++) {
+		ptrs[i] = vmalloc(sizes[i]);
+		if (ptrs[i] == NULL) {
+			kprintf("km6: vmalloc(%u) failed\n", sizes[i]);
+			while (i-- > 0) {
+				vfree(ptrs[i]);
+			}
+			return ENOMEM;
+		}
+		KASSERT((vaddr_t)ptrs[i] % PAGE_SIZE == 0);
+		nwords = sizes[i] / sizeof(uint32_t);
+		for (j=0; j<nwords; j++) {
+			ptrs[i][j] = km6_pattern(i, j);
+		}
+	}
+
+	for (i=0; i<NUM_KM6_SIZES; i++) {
+		nwords = sizes[i] / sizeof(uint32_t);
+		for (j=0; j<nwords; j++) {
+			if (ptrs[i][j] != km6_pattern(i, j)) {
+				panic("km6: block %u (%u bytes) word %u "
+				      "is 0x%x\n", i, sizes[i], j,
+				      ptrs[i][j]);
+			}
+		}
+	}
+
+	/* Odd ones first, so the holes are not all at one end */
+	for (i=1; i<NUM_KM6_SIZES; i+=2) {
+		vfree(ptrs[i]);
+	}
+	for (i=0; i<NUM_KM6_SIZES; i+=2) {
+		vfree(ptrs[i]);
+	}
+
+	p = kvmalloc(16 * PAGE_SIZE);
+	if (p == NULL) {
+		kprintf("km6: kvmalloc failed\n");
+		return ENOMEM;
+	}
+	kvfree(p);
+	p = vmalloc(16 * PAGE_SIZE);
+	if (p == NULL) {
+		kprintf("km6: vmalloc failed\n");
+		return ENOMEM;
+	}
+	kvfree(p);
+	kvfree(NULL);
+
+	kprintf("kmalloctest6: passed\n");
+	return 0;
+}
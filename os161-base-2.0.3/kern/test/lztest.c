@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Test code for the LZ compressor (lz.h).
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <vm.h>
+#include <lz.h>
+#include <test.h>
+
+#define TESTSIZE	PAGE_SIZE
+
+static unsigned char src[TESTSIZE];
+static unsigned char comp[TESTSIZE + TESTSIZE / 64];
+static unsigned char out[TESTSIZE];
+static uint16_t table[LZ_HASHSIZE];
+
+/*
+ * Compress LEN bytes of src and check that they come back unchanged.
+ * Returns the compressed length.
+ */
+static
+size_t
+roundtrip(size_t len)
+{
+	size_t clen, i;
+
+	clen = lz_compress(src, len, comp, sizeof(comp), table);
+	KASSERT(clen > 0 || len == 0);
+	KASSERT(lz_decompress(comp, clen, out, sizeof(out)) == len);
+	for (i=0; i<len; i++) {
+		KASSERT(src[i] == out[i]);
+	}
+	return clen;
+}
+
+int
+lztest(int nargs, char **args)
+{
+	size_t clen, i, j;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Beginning LZ compressor test...\n");
+
+	/* A zeroed page shrinks to almost nothing */
+	bzero(src, TESTSIZE);
+	clen = roundtrip(TESTSIZE);
+	KASSERT(clen < TESTSIZE / 32);
+	kprintf("lztest: zero page: %u bytes\n", (unsigned)clen);
+
+	/* Repeating patterns, and runs between noise */
+	for (i=0; i<TESTSIZE; i++) {
+		src[i] = i % 37;
+	}
+	clen = roundtrip(TESTSIZE);
+	KASSERT(clen < TESTSIZE / 8);
+	for (i=0; i<TESTSIZE; i++) {
+		src[i] = (random() % 4 == 0) ? random() : 0;
+	}
+	(void)roundtrip(TESTSIZE);
+
+	/* Noise grows, but must not overflow what it's given */
+	for (i=0; i<TESTSIZE; i++) {
+		src[i] = random();
+	}
+	(void)roundtrip(TESTSIZE);
+	KASSERT(lz_compress(src, TESTSIZE, comp, TESTSIZE / 2, table) == 0);
+
+	/* Short inputs, at every length up to a few matches */
+	for (j=0; j<64; j++) {
+		for (i=0; i<j; i++) {
+			src[i] = (i / 5) % 3;
+		}
+		(void)roundtrip(j);
+	}
+	kprintf("lztest: round trips ok\n");
+
+	/* Malformed input is refused: a match reaching before the start */
+	comp[0] = 0x80;
+	comp[1] = 0;
+	comp[2] = 1;
+	KASSERT(lz_decompress(comp, 3, out, sizeof(out)) == 0);
+	/* ...and output that doesn't fit */
+	bzero(src, TESTSIZE);
+	clen = lz_compress(src, TESTSIZE, comp, sizeof(comp), table);
+	KASSERT(lz_decompress(comp, clen, out, TESTSIZE - 1) == 0);
+
+	kprintf("LZ compressor test complete\n");
+	return 0;
+}
@@ -28,17 +28,328 @@
  */
 
 /*
- * Network test code.
+ * Network test code: latency and throughput between two machines.
+ *
+ * Run "net echo" on one machine and "net ping ADDR" on the other to
+ * time round trips, or "net sink" and "net blast ADDR" to measure
+ * one-way throughput. Addresses are the hardware addresses "net"
+ * prints with no arguments.
  */
 #include <types.h>
+#include <kern/errno.h>
+#include <endian.h>
 #include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <net.h>
 #include <test.h>
 
+#define NT_PING		1	/* Echo this back */
+#define NT_DATA		2	/* Throughput data */
+#define NT_STOP		3	/* End of test */
+
+#define NT_DEFCOUNT	100	/* Default packets to send */
+#define NT_DEFSIZE	64	/* Default payload size */
+#define NT_NSTOPS	3	/* Stop packets sent (they can get lost) */
+#define NT_TIMEOUT	1000000	/* Ping timeout, in microseconds */
+
+/* Front of every test packet's payload, in network order */
+struct nt_hdr {
+	uint32_t nh_type;
+	uint32_t nh_seq;
+};
+
+static
+uint64_t
+nt_usecs(void)
+{
+	return clock_monotonic() / 1000;
+}
+
+/*
+ * Send a packet of SIZE bytes to TO. The payload is written straight
+ * into the driver's transmit buffer.
+ */
+static
+int
+nt_send(struct netif *ni, uint16_t to, uint32_t type, uint32_t seq,
+	size_t size)
+{
+	struct netbuf nb;
+	struct nt_hdr *nh;
+	int result;
+
+	result = net_getbuf(ni, &nb, true);
+	if (result) {
+		return result;
+	}
+	if (size < sizeof(*nh)) {
+		size = sizeof(*nh);
+	}
+	nh = nb.nb_data;
+	nh->nh_type = htonl(type);
+	nh->nh_seq = htonl(seq);
+	result = net_send(ni, &nb, to, size);
+	if (result) {
+		net_release(ni, &nb);
+	}
+	return result;
+}
+
+/*
+ * Get the next test packet, or fail with EAGAIN if nothing shows up
+ * by DEADLINE (0 to wait forever). Short packets are dropped.
+ */
+static
+int
+nt_recv(struct netif *ni, struct netbuf *nb, uint64_t deadline)
+{
+	int result;
+
+	while (1) {
+		if (deadline == 0) {
+			result = net_recv(ni, nb, true);
+		}
+		else {
+			/* Poll, so the timing isn't at the mercy of hz */
+			while ((result = net_recv(ni, nb, false)) == EAGAIN) {
+				if (nt_usecs() >= deadline) {
+					return EAGAIN;
+				}
+				thread_yield();
+			}
+		}
+		if (result) {
+			return result;
+		}
+		if (nb->nb_len >= sizeof(struct nt_hdr)) {
+			return 0;
+		}
+		net_release(ni, nb);
+	}
+}
+
+static
+void
+nt_printstats(struct netif *ni)
+{
+	struct netstats ns;
+
+	net_stats(ni, &ns);
+	kprintf("net: rx %u (%u dropped, %u bad), tx %u\n",
+		ns.ns_rxframes, ns.ns_rxdropped, ns.ns_rxbad,
+		ns.ns_txframes);
+}
+
+static
+void
+nt_echo(struct netif *ni)
+{
+	struct netbuf nb;
+	const struct nt_hdr *nh;
+	unsigned n = 0;
+	uint32_t type, seq;
+	uint16_t from;
+	size_t len;
+
+	kprintf("net: echoing at address %u\n", net_addr(ni));
+	while (nt_recv(ni, &nb, 0) == 0) {
+		nh = nb.nb_data;
+		type = ntohl(nh->nh_type);
+		seq = ntohl(nh->nh_seq);
+		from = nb.nb_from;
+		len = nb.nb_len;
+		net_release(ni, &nb);
+		if (type == NT_STOP) {
+			break;
+		}
+		if (type == NT_PING) {
+			nt_send(ni, from, NT_PING, seq, len);
+			n++;
+		}
+	}
+	kprintf("net: echoed %u packets\n", n);
+}
+
+static
+void
+nt_ping(struct netif *ni, uint16_t to, unsigned count, size_t size)
+{
+	struct netbuf nb;
+	const struct nt_hdr *nh;
+	uint64_t start, rtt, min = 0, max = 0, total = 0;
+	unsigned i, got = 0;
+	bool match = false;
+	int result;
+
+	for (i=0; i<count; i++) {
+		start = nt_usecs();
+		result = nt_send(ni, to, NT_PING, i, size);
+		if (result) {
+			kprintf("net: send: %s\n", strerror(result));
+			break;
+		}
+		do {
+			result = nt_recv(ni, &nb, start + NT_TIMEOUT);
+			if (result) {
+				break;
+			}
+			nh = nb.nb_data;
+			match = ntohl(nh->nh_type) == NT_PING &&
+				ntohl(nh->nh_seq) == i && nb.nb_from == to;
+			net_release(ni, &nb);
+		} while (!match);
+		if (result) {
+			continue;
+		}
+		rtt = nt_usecs() - start;
+		if (got == 0 || rtt < min) {
+			min = rtt;
+		}
+		if (rtt > max) {
+			max = rtt;
+		}
+		total += rtt;
+		got++;
+	}
+	for (i=0; i<NT_NSTOPS; i++) {
+		nt_send(ni, to, NT_STOP, 0, 0);
+	}
+
+	kprintf("net: %u/%u replies", got, count);
+	if (got > 0) {
+		kprintf(", rtt min/avg/max %llu/%llu/%llu us",
+			min, total / got, max);
+	}
+	kprintf("\n");
+}
+
+static
+void
+nt_blast(struct netif *ni, uint16_t to, unsigned count, size_t size)
+{
+	uint64_t start, usecs;
+	unsigned i;
+	int result;
+
+	start = nt_usecs();
+	for (i=0; i<count; i++) {
+		result = nt_send(ni, to, NT_DATA, i, size);
+		if (result) {
+			kprintf("net: send: %s\n", strerror(result));
+			break;
+		}
+	}
+	usecs = nt_usecs() - start;
+	for (i=0; i<NT_NSTOPS; i++) {
+		nt_send(ni, to, NT_STOP, 0, 0);
+	}
+
+	if (usecs == 0) {
+		usecs = 1;
+	}
+	kprintf("net: sent %u packets of %u bytes in %llu us, "
+		"%llu packets/s, %llu KB/s\n", count, (unsigned)size, usecs,
+		(uint64_t)count * 1000000 / usecs,
+		(uint64_t)count * size * 1000000 / 1024 / usecs);
+}
+
+static
+void
+nt_sink(struct netif *ni)
+{
+	struct netbuf nb;
+	const struct nt_hdr *nh;
+	uint64_t start = 0, usecs, bytes = 0;
+	unsigned n = 0;
+	uint32_t seq, maxseq = 0;
+
+	kprintf("net: sinking at address %u\n", net_addr(ni));
+	while (nt_recv(ni, &nb, 0) == 0) {
+		nh = nb.nb_data;
+		if (ntohl(nh->nh_type) == NT_STOP) {
+			net_release(ni, &nb);
+			break;
+		}
+		if (ntohl(nh->nh_type) == NT_DATA) {
+			if (n == 0) {
+				start = nt_usecs();
+			}
+			seq = ntohl(nh->nh_seq);
+			if (seq > maxseq) {
+				maxseq = seq;
+			}
+			bytes += nb.nb_len;
+			n++;
+		}
+		net_release(ni, &nb);
+	}
+	if (n == 0) {
+		kprintf("net: no data received\n");
+		return;
+	}
+	usecs = nt_usecs() - start;
+	if (usecs == 0) {
+		usecs = 1;
+	}
+	kprintf("net: got %u of %u packets, %llu bytes in %llu us, "
+		"%llu KB/s\n", n, maxseq + 1, bytes, usecs,
+		bytes * 1000000 / 1024 / usecs);
+}
+
 int
 nettest(int nargs, char **args)
 {
-	(void)nargs;
-	(void)args;
-	kprintf("No network support available\n");
-	return 1;
+	struct netif *ni;
+	unsigned count = NT_DEFCOUNT;
+	size_t size = NT_DEFSIZE;
+	uint16_t to = 0;
+	int result;
+
+	result = net_open(0, &ni);
+	if (result) {
+		kprintf("net: %s\n", strerror(result));
+		return result;
+	}
+
+	if (nargs < 2) {
+		kprintf("Usage: net echo | sink | ping ADDR [COUNT [SIZE]]"
+			" | blast ADDR [COUNT [SIZE]]\n");
+		kprintf("net: address %u\n", net_addr(ni));
+		nt_printstats(ni);
+		net_close(ni);
+		return 0;
+	}
+
+	if (nargs > 2) {
+		to = atoi(args[2]);
+	}
+	if (nargs > 3) {
+		count = atoi(args[3]);
+	}
+	if (nargs > 4) {
+		size = atoi(args[4]);
+	}
+
+	if (!strcmp(args[1], "echo")) {
+		nt_echo(ni);
+	}
+	else if (!strcmp(args[1], "sink")) {
+		nt_sink(ni);
+	}
+	else if (!strcmp(args[1], "ping") && nargs > 2) {
+		nt_ping(ni, to, count, size);
+	}
+	else if (!strcmp(args[1], "blast") && nargs > 2) {
+		nt_blast(ni, to, count, size);
+	}
+	else {
+		kprintf("net: unknown or incomplete command %s\n", args[1]);
+		net_close(ni);
+		return EINVAL;
+	}
+
+	nt_printstats(ni);
+	net_close(ni);
+	return 0;
 }
@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Test code for the priority queue (pqueue.h).
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <pqueue.h>
+#include <test.h>
+
+#define TESTSIZE	700
+
+struct pqtestobj {
+	struct pqnode node;
+	uint64_t key;
+	bool in;
+};
+
+static struct pqtestobj objs[TESTSIZE];
+
+/*
+ * Take everything out with removemin and check that the keys come
+ * out in order and that exactly the objects with ->in set were there.
+ */
+static
+void
+drain(struct pqueue *pq)
+{
+	struct pqnode *pn;
+	struct pqtestobj *obj;
+	unsigned i, n, expected;
+	uint64_t last;
+
+	expected = 0;
+	for (i=0; i<TESTSIZE; i++) {
+		if (objs[i].in) {
+			expected++;
+		}
+	}
+	KASSERT(pqueue_count(pq) == expected);
+
+	n = 0;
+	last = 0;
+	while ((pn = pqueue_removemin(pq)) != NULL) {
+		obj = pn->pn_self;
+		KASSERT(obj->in);
+		KASSERT(pqnode_key(pn) == obj->key);
+		KASSERT(obj->key >= last);
+		KASSERT(!pqueue_inqueue(pq, pn));
+		last = obj->key;
+		obj->in = false;
+		n++;
+	}
+	KASSERT(n == expected);
+	KASSERT(pqueue_isempty(pq));
+	KASSERT(pqueue_count(pq) == 0);
+}
+
+static
+void
+insert(struct pqueue *pq, unsigned i, uint64_t key)
+{
+	objs[i].key = key;
+	objs[i].in = true;
+	pqueue_insert(pq, &objs[i].node, key);
+	KASSERT(pqueue_inqueue(pq, &objs[i].node));
+}
+
+int
+pqueuetest(int nargs, char **args)
+{
+	struct pqueue pq;
+	struct pqtestobj *obj;
+	unsigned i, j;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Beginning priority queue test...\n");
+	pqueue_init(&pq);
+	for (i=0; i<TESTSIZE; i++) {
+		pqnode_init(&objs[i].node, &objs[i]);
+		objs[i].in = false;
+	}
+	KASSERT(pqueue_min(&pq) == NULL);
+	KASSERT(pqueue_removemin(&pq) == NULL);
+
+	/* Ascending, descending, and random keys, with lots of ties */
+	for (i=0; i<TESTSIZE; i++) {
+		insert(&pq, i, i);
+	}
+	KASSERT(pqueue_min(&pq) == &objs[0].node);
+	drain(&pq);
+	for (i=0; i<TESTSIZE; i++) {
+		insert(&pq, i, TESTSIZE - i);
+	}
+	KASSERT(pqueue_min(&pq) == &objs[TESTSIZE-1].node);
+	drain(&pq);
+	for (i=0; i<TESTSIZE; i++) {
+		insert(&pq, i, random() % 50);
+	}
+	drain(&pq);
+	kprintf("pqueuetest: ordering ok\n");
+
+	/* Big keys */
+	for (i=0; i<TESTSIZE; i++) {
+		insert(&pq, i, ((uint64_t)random() << 32) | random());
+	}
+	drain(&pq);
+
+	/* Remove arbitrary nodes, including the root and fresh ones */
+	for (i=0; i<TESTSIZE; i++) {
+		insert(&pq, i, random() % 1000);
+	}
+	obj = pqueue_removemin(&pq)->pn_self;
+	obj->in = false;
+	for (i=0; i<TESTSIZE; i++) {
+		if (objs[i].in && random() % 3 == 0) {
+			pqueue_remove(&pq, &objs[i].node);
+			KASSERT(!pqueue_inqueue(&pq, &objs[i].node));
+			objs[i].in = false;
+		}
+	}
+	obj = pqueue_min(&pq)->pn_self;
+	pqueue_remove(&pq, &obj->node);
+	obj->in = false;
+	drain(&pq);
+	kprintf("pqueuetest: remove ok\n");
+
+	/* Churn: a timer-like mix of inserts, cancels and expiries */
+	for (j=0; j<20*TESTSIZE; j++) {
+		i = random() % TESTSIZE;
+		if (objs[i].in) {
+			pqueue_remove(&pq, &objs[i].node);
+			objs[i].in = false;
+		}
+		else {
+			insert(&pq, i, j + random() % 200);
+		}
+		if (j % 7 == 0 && !pqueue_isempty(&pq)) {
+			obj = pqueue_min(&pq)->pn_self;
+			KASSERT(pqueue_removemin(&pq) == &obj->node);
+			obj->in = false;
+		}
+	}
+	drain(&pq);
+	kprintf("pqueuetest: churn ok\n");
+
+	for (i=0; i<TESTSIZE; i++) {
+		pqnode_cleanup(&objs[i].node);
+	}
+	pqueue_cleanup(&pq);
+	kprintf("Priority queue test complete\n");
+	return 0;
+}
@@ -0,0 +1,262 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Test code for the radix tree (radixtree.h).
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <radixtree.h>
+#include <test.h>
+
+#define TESTSIZE	600
+#define GANGSIZE	17
+
+static uint32_t keys[TESTSIZE];		/* sorted */
+static bool in[TESTSIZE];		/* in the tree */
+static bool dirty[TESTSIZE];		/* ... with RADIX_TAG_DIRTY */
+static int nkeys;
+
+/* The item stored under keys[i] */
+#define ITEM(i) ((void *)&keys[i])
+
+/* Index of KEY in keys[], or -1 */
+static
+int
+findkey(uint32_t key)
+{
+	int lo, hi, mid;
+
+	lo = 0;
+	hi = nkeys;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (keys[mid] == key) {
+			return mid;
+		}
+		if (keys[mid] < key) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	return -1;
+}
+
+static
+void
+addkey(uint32_t key)
+{
+	int i;
+
+	if (nkeys == TESTSIZE || findkey(key) >= 0) {
+		return;
+	}
+	for (i = nkeys; i > 0 && keys[i-1] > key; i--) {
+		keys[i] = keys[i-1];
+	}
+	keys[i] = key;
+	nkeys++;
+}
+
+/*
+ * Check lookups, and gang lookups from FIRST, against in[] and dirty[].
+ */
+static
+void
+check(struct radixtree *rt, uint32_t first)
+{
+	void *items[GANGSIZE];
+	uint32_t got[GANGSIZE];
+	unsigned n, j, count;
+	int i, k;
+	bool anydirty;
+
+	count = 0;
+	anydirty = false;
+	for (i=0; i<nkeys; i++) {
+		KASSERT(radix_lookup(rt, keys[i]) == (in[i] ? ITEM(i) : NULL));
+		KASSERT(radix_tag_get(rt, keys[i], RADIX_TAG_DIRTY) ==
+			(in[i] && dirty[i]));
+		KASSERT(!radix_tag_get(rt, keys[i], RADIX_TAG_WRITEBACK));
+		if (in[i]) {
+			count++;
+			anydirty = anydirty || dirty[i];
+		}
+		if (findkey(keys[i] + 1) < 0) {
+			KASSERT(radix_lookup(rt, keys[i] + 1) == NULL);
+		}
+	}
+	KASSERT(radix_count(rt) == count);
+	KASSERT(radix_tagged(rt, RADIX_TAG_DIRTY) == anydirty);
+
+	/* Everything from FIRST on, a gang at a time */
+	for (i=0; i<nkeys && keys[i] < first; i++);
+	for (;;) {
+		n = radix_gang_lookup(rt, first, items, got, GANGSIZE);
+		KASSERT(n <= GANGSIZE);
+		for (j=0; j<n; j++) {
+			while (i < nkeys && !in[i]) {
+				i++;
+			}
+			KASSERT(i < nkeys);
+			KASSERT(got[j] == keys[i] && items[j] == ITEM(i));
+			i++;
+		}
+		if (n < GANGSIZE || got[n-1] == 0xffffffff) {
+			break;
+		}
+		first = got[n-1] + 1;
+	}
+	while (i < nkeys && !in[i]) {
+		i++;
+	}
+	KASSERT(i == nkeys);
+
+	/* The dirty ones, from the start */
+	k = 0;
+	first = 0;
+	for (;;) {
+		n = radix_gang_lookup_tag(rt, first, items, got, GANGSIZE,
+					  RADIX_TAG_DIRTY);
+		for (j=0; j<n; j++) {
+			while (k < nkeys && !(in[k] && dirty[k])) {
+				k++;
+			}
+			KASSERT(k < nkeys);
+			KASSERT(got[j] == keys[k] && items[j] == ITEM(k));
+			k++;
+		}
+		if (n < GANGSIZE || got[n-1] == 0xffffffff) {
+			break;
+		}
+		first = got[n-1] + 1;
+	}
+	while (k < nkeys && !(in[k] && dirty[k])) {
+		k++;
+	}
+	KASSERT(k == nkeys);
+}
+
+int
+radixtest(int nargs, char **args)
+{
+	struct radixtree rt;
+	int i, j, r;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting radix tree test...\n");
+
+	/* Sparse keys, some in runs, including both ends */
+	nkeys = 0;
+	addkey(0);
+	addkey(0xffffffff);
+	addkey(0x80000000);
+	for (i=0; i<64; i++) {
+		addkey(1000 + i);
+	}
+	while (nkeys < TESTSIZE) {
+		addkey(random() << (random() % 24));
+	}
+	for (i=0; i<nkeys; i++) {
+		in[i] = dirty[i] = false;
+	}
+
+	radix_init(&rt);
+	check(&rt, 0);
+
+	/* Insert in random order; small keys first, so the tree grows */
+	for (j=0; j<2; j++) {
+		for (i=0; i<nkeys; i++) {
+			if ((keys[i] < 100000) != (j == 0) ||
+			    random() % 2 == 0) {
+				continue;
+			}
+			r = radix_insert(&rt, keys[i], ITEM(i));
+			KASSERT(r == 0);
+			in[i] = true;
+		}
+		check(&rt, 0);
+	}
+	for (i=0; i<nkeys; i++) {
+		if (!in[i]) {
+			r = radix_insert(&rt, keys[i], ITEM(i));
+			KASSERT(r == 0);
+			in[i] = true;
+		}
+		r = radix_insert(&rt, keys[i], ITEM(0));
+		KASSERT(r == EEXIST);
+	}
+	check(&rt, 0);
+	check(&rt, 1000 + 10);
+	check(&rt, 0xffffffff);
+	kprintf("radixtest: inserted %d\n", nkeys);
+
+	/* Tags */
+	for (i=0; i<nkeys; i+=3) {
+		radix_tag_set(&rt, keys[i], RADIX_TAG_DIRTY);
+		dirty[i] = true;
+	}
+	check(&rt, 0);
+	for (i=0; i<nkeys; i+=6) {
+		radix_tag_clear(&rt, keys[i], RADIX_TAG_DIRTY);
+		dirty[i] = false;
+	}
+	radix_tag_set(&rt, keys[1], RADIX_TAG_WRITEBACK);
+	KASSERT(radix_tagged(&rt, RADIX_TAG_WRITEBACK));
+	radix_tag_clear(&rt, keys[1], RADIX_TAG_WRITEBACK);
+	KASSERT(!radix_tagged(&rt, RADIX_TAG_WRITEBACK));
+	check(&rt, 0);
+	kprintf("radixtest: tagged\n");
+
+	/* Remove half, at random, then everything */
+	for (i=0; i<nkeys; i++) {
+		if (random() % 2 == 0) {
+			KASSERT(radix_remove(&rt, keys[i]) == ITEM(i));
+			KASSERT(radix_remove(&rt, keys[i]) == NULL);
+			in[i] = false;
+		}
+	}
+	check(&rt, 0);
+	check(&rt, 0x80000000);
+	for (i=nkeys-1; i>=0; i--) {
+		KASSERT(radix_remove(&rt, keys[i]) == (in[i] ? ITEM(i) : NULL));
+		in[i] = false;
+	}
+	check(&rt, 0);
+	radix_cleanup(&rt);
+
+	kprintf("Radix tree test complete\n");
+	return 0;
+}
@@ -0,0 +1,276 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Test code for the byte rings (ringbuf.h).
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <thread.h>
+#include <synch.h>
+#include <ringbuf.h>
+#include <test.h>
+
+#define RINGSIZE	64		/* Small, so it fills and wraps a lot */
+#define STREAMLEN	20000		/* Bytes through the blocking ring */
+#define NPRODUCERS	4
+#define NRECORDS	2000		/* Per producer */
+
+static struct semaphore *ringdone;
+
+static
+bool
+same(const char *a, const char *b, unsigned len)
+{
+	unsigned i;
+
+	for (i=0; i<len; i++) {
+		if (a[i] != b[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Single-threaded: partial puts, wrapping, and get of less than
+ * is there.
+ */
+static
+void
+ringtest_basic(void)
+{
+	struct ringbuf rb;
+	char in[RINGSIZE * 2], out[RINGSIZE * 2];
+	unsigned i, j, len, inpos, outpos;
+	size_t n;
+	int result;
+
+	result = ringbuf_init(&rb, RINGSIZE);
+	KASSERT(result == 0);
+	KASSERT(ringbuf_used(&rb) == 0);
+	KASSERT(ringbuf_space(&rb) == RINGSIZE);
+	KASSERT(ringbuf_get(&rb, out, sizeof(out)) == 0);
+
+	for (i=0; i<sizeof(in); i++) {
+		in[i] = (char)i;
+	}
+	n = ringbuf_put(&rb, in, sizeof(in));
+	KASSERT(n == RINGSIZE);
+	KASSERT(ringbuf_space(&rb) == 0);
+	KASSERT(ringbuf_put(&rb, in, 1) == 0);
+	KASSERT(ringbuf_get(&rb, out, 10) == 10);
+	for (i=0; i<10; i++) {
+		KASSERT(out[i] == in[i]);
+	}
+
+	/* Go round many times with odd-sized pieces of a numbered stream */
+	ringbuf_get(&rb, out, sizeof(out));
+	inpos = outpos = 0;
+	for (i=0; i<500; i++) {
+		len = 1 + i % 23;
+		for (j=0; j<len; j++) {
+			in[j] = (char)(inpos + j);
+		}
+		inpos += ringbuf_put(&rb, in, len);
+		n = ringbuf_get(&rb, out, 1 + i % 19);
+		for (j=0; j<n; j++) {
+			KASSERT(out[j] == (char)(outpos + j));
+		}
+		outpos += n;
+		KASSERT(ringbuf_used(&rb) == inpos - outpos);
+	}
+	n = ringbuf_get(&rb, out, sizeof(out));
+	outpos += n;
+	KASSERT(outpos == inpos);
+	KASSERT(ringbuf_used(&rb) == 0);
+	ringbuf_cleanup(&rb);
+
+	/* Exact content across a wrap */
+	for (i=0; i<sizeof(in); i++) {
+		in[i] = (char)i;
+	}
+	result = ringbuf_init(&rb, RINGSIZE);
+	KASSERT(result == 0);
+	for (i=0; i<5; i++) {
+		KASSERT(ringbuf_put(&rb, in, RINGSIZE - 7) == RINGSIZE - 7);
+		KASSERT(ringbuf_get(&rb, out, RINGSIZE) == RINGSIZE - 7);
+		KASSERT(same(in, out, RINGSIZE - 7));
+	}
+	ringbuf_cleanup(&rb);
+
+	/* mput is all or nothing */
+	result = ringbuf_init(&rb, RINGSIZE);
+	KASSERT(result == 0);
+	KASSERT(ringbuf_mput(&rb, in, RINGSIZE + 1) == false);
+	KASSERT(ringbuf_mput(&rb, in, RINGSIZE) == true);
+	KASSERT(ringbuf_mput(&rb, in, 1) == false);
+	KASSERT(ringbuf_get(&rb, out, sizeof(out)) == RINGSIZE);
+	KASSERT(same(in, out, RINGSIZE));
+	ringbuf_cleanup(&rb);
+	kprintf("ringtest: basic ok (%u bytes through)\n", outpos);
+}
+
+/*
+ * Blocking ring: one thread writes a numbered stream in chunks of
+ * varying size; the test thread reads it back and checks it.
+ */
+static
+void
+ringtest_writer(void *p, unsigned long arg)
+{
+	struct bringbuf *br = p;
+	unsigned char buf[RINGSIZE + 13];
+	unsigned pos, len, i;
+
+	(void)arg;
+	for (pos = 0; pos < STREAMLEN; pos += len) {
+		len = 1 + random() % sizeof(buf);
+		if (len > STREAMLEN - pos) {
+			len = STREAMLEN - pos;
+		}
+		for (i=0; i<len; i++) {
+			buf[i] = (unsigned char)((pos + i) % 251);
+		}
+		bringbuf_write(br, buf, len);
+	}
+	V(ringdone);
+}
+
+static
+void
+ringtest_blocking(void)
+{
+	struct bringbuf br;
+	unsigned char buf[RINGSIZE / 2 + 3];
+	unsigned pos, i;
+	size_t n;
+	int result;
+
+	result = bringbuf_init(&br, "ringtest", RINGSIZE);
+	KASSERT(result == 0);
+	result = thread_fork("ringtest writer", NULL, ringtest_writer,
+			     &br, 0);
+	if (result) {
+		panic("ringtest: thread_fork failed: %s\n", strerror(result));
+	}
+	for (pos = 0; pos < STREAMLEN; pos += n) {
+		n = bringbuf_read(&br, buf, 1 + random() % sizeof(buf));
+		KASSERT(n > 0);
+		for (i=0; i<n; i++) {
+			KASSERT(buf[i] == (pos + i) % 251);
+		}
+	}
+	P(ringdone);
+	KASSERT(ringbuf_used(&br.br_ring) == 0);
+	bringbuf_cleanup(&br);
+	kprintf("ringtest: blocking ok\n");
+}
+
+/*
+ * Several producers: each mputs 4-byte records of its number and a
+ * sequence number. Records must come out whole, each producer's in
+ * order.
+ */
+static
+void
+ringtest_producer(void *p, unsigned long num)
+{
+	struct ringbuf *rb = p;
+	uint16_t rec[2];
+	unsigned i;
+
+	for (i=0; i<NRECORDS; i++) {
+		rec[0] = num;
+		rec[1] = i;
+		while (!ringbuf_mput(rb, rec, sizeof(rec))) {
+			thread_yield();
+		}
+	}
+	V(ringdone);
+}
+
+static
+void
+ringtest_multi(void)
+{
+	struct ringbuf rb;
+	unsigned next[NPRODUCERS];
+	uint16_t rec[2];
+	unsigned i, got;
+	int result;
+
+	result = ringbuf_init(&rb, RINGSIZE);
+	KASSERT(result == 0);
+	for (i=0; i<NPRODUCERS; i++) {
+		next[i] = 0;
+		result = thread_fork("ringtest producer", NULL,
+				     ringtest_producer, &rb, i);
+		if (result) {
+			panic("ringtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (got = 0; got < NPRODUCERS * NRECORDS; got++) {
+		while (ringbuf_get(&rb, rec, sizeof(rec)) == 0) {
+			thread_yield();
+		}
+		KASSERT(rec[0] < NPRODUCERS);
+		KASSERT(rec[1] == next[rec[0]]);
+		next[rec[0]]++;
+	}
+	for (i=0; i<NPRODUCERS; i++) {
+		P(ringdone);
+	}
+	KASSERT(ringbuf_used(&rb) == 0);
+	ringbuf_cleanup(&rb);
+	kprintf("ringtest: %u producers ok\n", NPRODUCERS);
+}
+
+int
+ringtest(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	if (ringdone == NULL) {
+		ringdone = sem_create("ringdone", 0);
+		if (ringdone == NULL) {
+			panic("ringtest: sem_create failed\n");
+		}
+	}
+
+	kprintf("Beginning ring buffer test...\n");
+	ringtest_basic();
+	ringtest_blocking();
+	ringtest_multi();
+	kprintf("Ring buffer test complete\n");
+	return 0;
+}
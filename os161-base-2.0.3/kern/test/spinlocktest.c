@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Contended spinlock test: one thread per cpu, all hammering the same
+ * spinlock, first as a test-and-set lock and then as a ticket lock.
+ * Prints how long each kind took, and how far apart the threads
+ * finished, which is a measure of how fair the lock was.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <current.h>
+#include <synch.h>
+#include <test.h>
+
+#define NSPINLOOPS	5000	/* acquires per thread */
+#define SPINHOLD	20	/* polls with the lock held */
+
+static struct spinlock splk_lock;
+static volatile unsigned splk_count;
+static volatile bool splk_go;
+static struct timespec splk_done[32];
+static struct semaphore *splk_donesem;
+
+static
+void
+splk_thread(void *junk, unsigned long num)
+{
+	volatile unsigned j;
+	unsigned i;
+
+	(void)junk;
+
+	if (thread_setaffinity(curthread, (uint32_t)1 << num)) {
+		panic("sp1: cannot move to cpu %lu\n", num);
+	}
+	while (!splk_go) {
+		/* wait for everyone */
+	}
+
+	for (i=0; i<NSPINLOOPS; i++) {
+		spinlock_acquire(&splk_lock);
+		splk_count++;
+		for (j=0; j<SPINHOLD; j++) {
+			/* nothing */
+		}
+		spinlock_release(&splk_lock);
+	}
+
+	gettime(&splk_done[num]);
+	V(splk_donesem);
+}
+
+static
+void
+splk_run(const char *kind, unsigned ncpus)
+{
+	struct timespec start, first, last, t;
+	unsigned i;
+	int result;
+
+	splk_count = 0;
+	splk_go = false;
+	for (i=0; i<ncpus; i++) {
+		result = thread_fork("sp1", NULL, splk_thread, NULL, i);
+		if (result) {
+			panic("sp1: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	/* let them all get to their cpus */
+	clocksleep(1);
+	gettime(&start);
+	splk_go = true;
+	for (i=0; i<ncpus; i++) {
+		P(splk_donesem);
+	}
+
+	if (splk_count != ncpus * NSPINLOOPS) {
+		panic("sp1: %s: count is %u, should be %u\n", kind,
+		      splk_count, ncpus * NSPINLOOPS);
+	}
+
+	first = last = splk_done[0];
+	for (i=1; i<ncpus; i++) {
+		t = splk_done[i];
+		if (t.tv_sec < first.tv_sec ||
+		    (t.tv_sec == first.tv_sec && t.tv_nsec < first.tv_nsec)) {
+			first = t;
+		}
+		if (t.tv_sec > last.tv_sec ||
+		    (t.tv_sec == last.tv_sec && t.tv_nsec > last.tv_nsec)) {
+			last = t;
+		}
+	}
+	timespec_sub(&last, &start, &t);
+	kprintf("sp1: %-12s %u acquires in %llu.%09lu s", kind, splk_count,
+		(unsigned long long)t.tv_sec, (unsigned long)t.tv_nsec);
+	timespec_sub(&last, &first, &t);
+	kprintf(", first and last thread %llu.%09lu s apart\n",
+		(unsigned long long)t.tv_sec, (unsigned long)t.tv_nsec);
+}
+
+int
+spinlocktest(int nargs, char **args)
+{
+	unsigned ncpus;
+	uint32_t mask;
+
+	(void)nargs;
+	(void)args;
+
+	ncpus = 0;
+	for (mask = thread_cpumask(); mask != 0; mask >>= 1) {
+		ncpus++;
+	}
+	kprintf("Starting contended spinlock test on %u cpus...\n", ncpus);
+
+	splk_donesem = sem_create("sp1", 0);
+	if (splk_donesem == NULL) {
+		panic("sp1: sem_create failed\n");
+	}
+
+	spinlock_init_tas(&splk_lock);
+	splk_run("test-and-set", ncpus);
+	spinlock_cleanup(&splk_lock);
+
+	spinlock_init_ticket(&splk_lock);
+	splk_run("ticket", ncpus);
+	spinlock_cleanup(&splk_lock);
+
+	sem_destroy(splk_donesem);
+	splk_donesem = NULL;
+	kprintf("Spinlock test done.\n");
+	return 0;
+}
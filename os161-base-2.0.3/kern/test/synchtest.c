@@ -32,9 +32,12 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <clock.h>
+#include <cpu.h>
 #include <thread.h>
+#include <current.h>
 #include <synch.h>
 #include <test.h>
 
@@ -399,3 +402,148 @@ cvtest2(int nargs, char **args)
 	kprintf("cvtest2 done\n");
 	return 0;
 }
+
+/*
+ * Priority inheritance: a nice 19 thread holds a lock that a nice -20
+ * thread wants, while two nice 0 threads hog the cpu they all share.
+ * Without inheritance the holder gets a sliver of the cpu and the
+ * wait drags on; with it, the holder runs at -20 until it lets go,
+ * so the wait should stay within a small multiple of the hold time.
+ */
+
+#define PI_HOLDSPINS	2000000
+#define PI_NHOGS	2
+#define PI_SLACK	100000000ULL	/* ns */
+
+static struct lock *pi_testlock;
+static struct semaphore *pi_heldsem;
+static struct semaphore *pi_donesem;
+static volatile bool pi_stop;
+static volatile uint64_t pi_latency;
+
+static
+void
+pi_hold(void)
+{
+	volatile unsigned i;
+
+	for (i=0; i<PI_HOLDSPINS; i++) {
+		/* nothing */
+	}
+}
+
+static
+void
+pi_lowthread(void *junk1, unsigned long junk2)
+{
+	(void)junk1;
+	(void)junk2;
+
+	curthread->t_nice = 19;
+	lock_acquire(pi_testlock);
+	V(pi_heldsem);
+	pi_hold();
+	lock_release(pi_testlock);
+	V(pi_donesem);
+}
+
+static
+void
+pi_hogthread(void *junk1, unsigned long junk2)
+{
+	(void)junk1;
+	(void)junk2;
+
+	while (!pi_stop) {
+		/* nothing */
+	}
+	V(pi_donesem);
+}
+
+static
+void
+pi_highthread(void *junk1, unsigned long junk2)
+{
+	uint64_t t0;
+
+	(void)junk1;
+	(void)junk2;
+
+	curthread->t_nice = -20;
+	t0 = clock_monotonic();
+	lock_acquire(pi_testlock);
+	pi_latency = clock_monotonic() - t0;
+	lock_release(pi_testlock);
+	V(pi_donesem);
+}
+
+int
+locktest2(int nargs, char **args)
+{
+	uint32_t mask;
+	uint64_t t0, hold;
+	unsigned i;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	pi_testlock = lock_create("pi testlock");
+	pi_heldsem = sem_create("pi heldsem", 0);
+	pi_donesem = sem_create("pi donesem", 0);
+	if (pi_testlock == NULL || pi_heldsem == NULL || pi_donesem == NULL) {
+		panic("locktest2: out of memory\n");
+	}
+	pi_stop = false;
+
+	kprintf("Starting lock priority inheritance test...\n");
+
+	/* Everybody shares our cpu; forked threads inherit the mask */
+	mask = thread_getaffinity(curthread);
+	thread_setaffinity(curthread, (uint32_t)1 << curcpu->c_number);
+
+	t0 = clock_monotonic();
+	pi_hold();
+	hold = clock_monotonic() - t0;
+
+	result = thread_fork("pi low", NULL, pi_lowthread, NULL, 0);
+	if (result) {
+		panic("locktest2: thread_fork failed\n");
+	}
+	P(pi_heldsem);
+	for (i=0; i<PI_NHOGS; i++) {
+		result = thread_fork("pi hog", NULL, pi_hogthread, NULL, 0);
+		if (result) {
+			panic("locktest2: thread_fork failed\n");
+		}
+	}
+	result = thread_fork("pi high", NULL, pi_highthread, NULL, 0);
+	if (result) {
+		panic("locktest2: thread_fork failed\n");
+	}
+
+	/* Wait for low and high, then stop the hogs */
+	P(pi_donesem);
+	P(pi_donesem);
+	pi_stop = true;
+	for (i=0; i<PI_NHOGS; i++) {
+		P(pi_donesem);
+	}
+
+	thread_setaffinity(curthread, mask);
+	sem_destroy(pi_donesem);
+	sem_destroy(pi_heldsem);
+	lock_destroy(pi_testlock);
+	pi_donesem = pi_heldsem = NULL;
+	pi_testlock = NULL;
+
+	kprintf("Lock held for %llu us alone, waited for %llu us\n",
+		(unsigned long long)(hold / 1000),
+		(unsigned long long)(pi_latency / 1000));
+	if (pi_latency > 2 * hold + PI_SLACK) {
+		kprintf("Lock priority inheritance test FAILED\n");
+		return ETIMEDOUT;
+	}
+	kprintf("Lock priority inheritance test done.\n");
+	return 0;
+}
@@ -28,19 +28,31 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
+#include <spl.h>
 #include <cpu.h>
+#include <counter.h>
 #include <wchan.h>
+#include <seqlock.h>
 #include <clock.h>
 #include <thread.h>
 #include <current.h>
+#include <proc.h>
+#include <mainbus.h>
+#include <prof.h>
+#include <vm.h>
+#include "opt-shell.h"
 
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution than one second.
+ * Callbacks can be scheduled for points in the future with timers,
+ * which are kept in a priority queue by deadline on the cpu that
+ * armed them. Each cpu's timer is one-shot, programmed for whichever
+ * comes first, its next hardclock or its earliest timer, so timers
+ * fire at their deadline rather than at the next hardclock, and an
+ * idle cpu only wakes up for its timers (and once a second).
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
  * skimp on that because we have a known-good hardware clock.
@@ -51,13 +63,39 @@
  * the scheduler.
  */
 #define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
-#define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
+#define MIGRATE_HARDCLOCKS	16	/* Balance every 16 hardclocks. */
+#define KHEAP_SAMPLE_SECS	5	/* Sample the kernel heap every 5 seconds. */
 
 /*
- * Once a second, everything waiting on lbolt is awakened by CPU 0.
+ * The timer queues, c_timers in each cpu, are pairing heaps
+ * (pqueue.h) keyed by deadline in nanoseconds since the epoch.
+ * Arming and cancelling are O(log n), and the earliest timer alone
+ * says when the cpu's timer has to go off next. Nothing depends on
+ * hz, so changing it doesn't disturb armed timers.
  */
-static struct wchan *lbolt;
-static struct spinlock lbolt_lock;
+#define NS_PER_SEC	1000000000ULL
+
+/*
+ * The time of day as of the last hardclock on any cpu, for readers
+ * that can do with 1/hz resolution (gettime_coarse) and would rather
+ * not go to the clock device.
+ */
+static struct seqlock coarsetime_lock;
+static struct timespec coarsetime;
+
+/* Current hardclock rate. */
+unsigned hz = HZ_DEFAULT;
+
+/*
+ * Sleeping threads wait on one of a few wait channels, picked by
+ * thread address, so that an expiring sleep doesn't wake everyone.
+ */
+#define TIMER_SLEEPQS	16
+
+static struct {
+	struct spinlock tq_lock;
+	struct wchan *tq_wchan;
+} timer_sleepq[TIMER_SLEEPQS];
 
 /*
  * Setup.
@@ -65,10 +103,249 @@ static struct spinlock lbolt_lock;
 void
 hardclock_bootstrap(void)
 {
-	spinlock_init(&lbolt_lock);
-	lbolt = wchan_create("lbolt");
-	if (lbolt == NULL) {
-		panic("Couldn't create lbolt\n");
+	unsigned i;
+
+	seqlock_init(&coarsetime_lock);
+	for (i=0; i<TIMER_SLEEPQS; i++) {
+		spinlock_init(&timer_sleepq[i].tq_lock);
+		timer_sleepq[i].tq_wchan = wchan_create("timersleep");
+		if (timer_sleepq[i].tq_wchan == NULL) {
+			panic("Couldn't create timer wait channels\n");
+		}
+	}
+}
+
+static
+uint64_t
+timespec_to_ns(const struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * NS_PER_SEC + ts->tv_nsec;
+}
+
+/*
+ * Program the timer of the current cpu C for its next event: its
+ * earliest timer or its next hardclock, whichever is first. Called
+ * with c_timers_lock held.
+ */
+static
+void
+clock_program(struct cpu *c, uint64_t now_ns)
+{
+	struct pqnode *pn;
+	uint64_t next;
+
+	KASSERT(c == curcpu->c_self);
+	KASSERT(spinlock_do_i_hold(&c->c_timers_lock));
+
+	next = c->c_nexttick;
+	pn = pqueue_min(&c->c_timers);
+	if (pn != NULL && pqnode_key(pn) < next) {
+		next = pqnode_key(pn);
+	}
+	mainbus_timer_oneshot(next > now_ns ? next - now_ns : 0);
+}
+
+/*
+ * Timer interrupt of the current cpu: run the timers that have come
+ * due, then the hardclock if it has too, having programmed the next
+ * interrupt (hardclock may switch away).
+ */
+void
+clock_interrupt(void)
+{
+	struct cpu *c = curcpu->c_self;
+	struct timespec now;
+	struct pqnode *pn;
+	struct timer *tm;
+	uint64_t now_ns;
+	bool tick;
+
+	gettime(&now);
+	now_ns = timespec_to_ns(&now);
+
+	spinlock_acquire(&c->c_timers_lock);
+	while ((pn = pqueue_min(&c->c_timers)) != NULL &&
+	       pqnode_key(pn) <= now_ns) {
+		pqueue_removemin(&c->c_timers);
+		tm = pn->pn_self;
+		tm->tm_cpu = NULL;
+
+		/* Run it unlocked, so it can start timers */
+		spinlock_release(&c->c_timers_lock);
+		tm->tm_func(tm->tm_data);
+		spinlock_acquire(&c->c_timers_lock);
+	}
+
+	tick = now_ns >= c->c_nexttick;
+	if (tick) {
+		c->c_nexttick = now_ns + NS_PER_SEC / hz;
+	}
+	clock_program(c, now_ns);
+	spinlock_release(&c->c_timers_lock);
+
+	if (tick) {
+		hardclock();
+	}
+}
+
+/*
+ * Set up a timer to call FUNC(DATA) when it expires.
+ */
+void
+timer_init(struct timer *tm, void (*func)(void *), void *data)
+{
+	pqnode_init(&tm->tm_node, tm);
+	tm->tm_func = func;
+	tm->tm_data = data;
+	tm->tm_cpu = NULL;
+}
+
+/*
+ * Arm TM, on the current cpu, to expire once the time of day reaches
+ * DEADLINE. If it was already armed, it is rescheduled. If it is now
+ * the cpu's earliest timer, the cpu's timer is brought forward.
+ */
+void
+timer_start(struct timer *tm, const struct timespec *deadline)
+{
+	struct timespec now;
+	struct cpu *c;
+	uint64_t key;
+	int spl;
+
+	timer_cancel(tm);
+	key = timespec_to_ns(deadline);
+	gettime(&now);
+
+	/* Stay on this cpu until the timer is in its queue */
+	spl = splhigh();
+	c = curcpu->c_self;
+	spinlock_acquire(&c->c_timers_lock);
+	pqueue_insert(&c->c_timers, &tm->tm_node, key);
+	tm->tm_cpu = c;
+	if (pqueue_min(&c->c_timers) == &tm->tm_node) {
+		clock_program(c, timespec_to_ns(&now));
+	}
+	spinlock_release(&c->c_timers_lock);
+	splx(spl);
+}
+
+/*
+ * Disarm TM. Returns true if it was armed; false if it wasn't, or has
+ * already expired, in which case its function may still be running
+ * on the cpu that armed it. The cpu's timer is left alone; if it goes
+ * off for nothing, it is just programmed again.
+ */
+bool
+timer_cancel(struct timer *tm)
+{
+	struct cpu *c;
+	bool armed = false;
+
+	/* Its cpu can only change under the lock of the old one */
+	while (!armed && (c = tm->tm_cpu) != NULL) {
+		spinlock_acquire(&c->c_timers_lock);
+		if (tm->tm_cpu == c) {
+			pqueue_remove(&c->c_timers, &tm->tm_node);
+			tm->tm_cpu = NULL;
+			armed = true;
+		}
+		spinlock_release(&c->c_timers_lock);
+	}
+
+	return armed;
+}
+
+/*
+ * Timed sleep.
+ */
+struct timer_sleeper {
+	struct timer ts_timer;
+	unsigned ts_queue;		/* Index into timer_sleepq */
+	volatile bool ts_done;		/* Set when the timer expires */
+};
+
+static
+void
+timer_wakeup(void *data)
+{
+	struct timer_sleeper *ts = data;
+	unsigned q = ts->ts_queue;
+
+	/* After we let go of tq_lock, TS may be gone */
+	spinlock_acquire(&timer_sleepq[q].tq_lock);
+	ts->ts_done = true;
+	wchan_wakeall(timer_sleepq[q].tq_wchan, &timer_sleepq[q].tq_lock);
+	spinlock_release(&timer_sleepq[q].tq_lock);
+}
+
+/*
+ * Sleep until the time of day reaches DEADLINE.
+ */
+void
+timer_sleep(const struct timespec *deadline)
+{
+	struct timer_sleeper ts;
+	struct timespec now;
+	unsigned q;
+
+	gettime(&now);
+	if (timespec_to_ns(deadline) <= timespec_to_ns(&now)) {
+		return;
+	}
+
+	q = ((uintptr_t)curthread >> 5) % TIMER_SLEEPQS;
+	ts.ts_queue = q;
+	ts.ts_done = false;
+	timer_init(&ts.ts_timer, timer_wakeup, &ts);
+
+	spinlock_acquire(&timer_sleepq[q].tq_lock);
+	timer_start(&ts.ts_timer, deadline);
+	while (!ts.ts_done) {
+		wchan_sleep(timer_sleepq[q].tq_wchan, &timer_sleepq[q].tq_lock);
+	}
+	spinlock_release(&timer_sleepq[q].tq_lock);
+}
+
+/*
+ * Update the coarse time of day. Every cpu does it, as any of them
+ * may go idle and stop taking hardclocks; whoever read the clock last
+ * may get here first, so never go backwards.
+ */
+static
+void
+coarsetime_update(const struct timespec *now)
+{
+	seqlock_write_begin(&coarsetime_lock);
+	if (now->tv_sec > coarsetime.tv_sec ||
+	    (now->tv_sec == coarsetime.tv_sec &&
+	     now->tv_nsec > coarsetime.tv_nsec)) {
+		coarsetime = *now;
+#if OPT_SHELL
+		/* ...and for user programs, in the kernel info page */
+		vm_kinfo_settime(now);
+#endif
+	}
+	seqlock_write_end(&coarsetime_lock);
+}
+
+/*
+ * The time of day as of the last hardclock, without touching the
+ * clock device or any lock. Until the first hardclock there is
+ * nothing to go by, so read the clock.
+ */
+void
+gettime_coarse(struct timespec *ret)
+{
+	unsigned seq;
+
+	do {
+		seq = seqlock_read_begin(&coarsetime_lock);
+		*ret = coarsetime;
+	} while (seqlock_read_retry(&coarsetime_lock, seq));
+
+	if (ret->tv_sec == 0 && ret->tv_nsec == 0) {
+		gettime(ret);
 	}
 }
 
@@ -79,31 +356,102 @@ hardclock_bootstrap(void)
 void
 timerclock(void)
 {
-	/* Just broadcast on lbolt */
-	spinlock_acquire(&lbolt_lock);
-	wchan_wakeall(lbolt, &lbolt_lock);
-	spinlock_release(&lbolt_lock);
+	static unsigned timerclocks;
+
+	timerclocks++;
+	if ((timerclocks % KHEAP_SAMPLE_SECS) == 0) {
+		kheap_sample(timerclocks);
+	}
 }
 
 /*
- * This is called HZ times a second (on each processor) by the timer
- * code.
+ * This is called hz times a second (on each processor) by the timer
+ * code, except while the processor idles.
  */
 void
 hardclock(void)
 {
+	struct timespec now;
+
 	/*
 	 * Collect statistics here as desired.
 	 */
 
-	curcpu->c_hardclocks++;
-	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
+	COUNTER_INC(COUNTER_HARDCLOCKS);
+	gettime(&now);
+	coarsetime_update(&now);
+#if OPT_PROF
+	prof_sample(curthread->t_intr_epc);
+#endif
+	thread_schedhist_sample();
+	kprintf_tick();
+#if OPT_SHELL
+	/* An idle cpu sits in the switch of whatever thread went to sleep */
+	if (!curcpu->c_isidle) {
+		proc_charge_tick(curthread->t_intr_user);
+	}
+#endif
+	/* An idle cpu looks for work whenever it wakes up */
+	if (curcpu->c_isidle ||
+	    (counter_local(COUNTER_HARDCLOCKS) % MIGRATE_HARDCLOCKS) == 0) {
 		thread_consider_migration();
 	}
-	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
+	if ((counter_local(COUNTER_HARDCLOCKS) % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
-	thread_yield();
+	thread_tick();
+}
+
+/*
+ * Idle the current cpu until an interrupt comes in. The periodic tick
+ * is not needed for that, as whoever gives us work sends an IPI, so
+ * it is put off meanwhile for up to a second, still to look for work
+ * now and then; the cpu's own timers go off on time regardless.
+ * Called by the idle loop in thread_switch, with interrupts off.
+ */
+void
+hardclock_idle(void)
+{
+	struct cpu *c = curcpu->c_self;
+	struct timespec now;
+	uint64_t now_ns;
+
+	gettime(&now);
+	now_ns = timespec_to_ns(&now);
+	spinlock_acquire(&c->c_timers_lock);
+	c->c_nexttick = now_ns + NS_PER_SEC;
+	clock_program(c, now_ns);
+	spinlock_release(&c->c_timers_lock);
+
+	cpu_idle();
+
+	/* Back to ticking; we may have slept a while */
+	gettime(&now);
+	now_ns = timespec_to_ns(&now);
+	spinlock_acquire(&c->c_timers_lock);
+	c->c_nexttick = now_ns + NS_PER_SEC / hz;
+	clock_program(c, now_ns);
+	spinlock_release(&c->c_timers_lock);
+
+	coarsetime_update(&now);
+	kprintf_tick();
+}
+
+/*
+ * Change the hardclock rate. A higher rate lowers scheduling latency
+ * and makes timers fire closer to their deadlines, at the cost of
+ * more interrupts on busy cpus; scheduling quanta are counted in
+ * hardclocks, so they shrink with it. The new rate takes effect on
+ * each cpu at its next hardclock.
+ */
+int
+clock_sethz(unsigned newhz)
+{
+	if (newhz < HZ_MIN || newhz > HZ_MAX) {
+		return EINVAL;
+	}
+	hz = newhz;
+	return 0;
 }
 
 /*
@@ -112,10 +460,11 @@ hardclock(void)
 void
 clocksleep(int num_secs)
 {
-	spinlock_acquire(&lbolt_lock);
-	while (num_secs > 0) {
-		wchan_sleep(lbolt, &lbolt_lock);
-		num_secs--;
-	}
-	spinlock_release(&lbolt_lock);
+	struct timespec deadline, delay;
+
+	gettime(&deadline);
+	delay.tv_sec = num_secs;
+	delay.tv_nsec = 0;
+	timespec_add(&deadline, &delay, &deadline);
+	timer_sleep(&deadline);
 }
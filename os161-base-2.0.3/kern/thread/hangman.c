@@ -39,6 +39,29 @@
 
 static struct spinlock hangman_lock = SPINLOCK_INITIALIZER;
 
+/* Checked inline by the HANGMAN_* macros; changed under hangman_lock */
+volatile bool hangman_on;
+
+/* Current generation; records of older ones are stale. Never 0. */
+static unsigned hangman_gen = 1;
+
+/*
+ * Who holds L, and what A waits for, as far as this generation knows.
+ */
+static
+const struct hangman_actor *
+hangman_holder(const struct hangman_lockable *l)
+{
+	return l->l_gen == hangman_gen ? l->l_holding : NULL;
+}
+
+static
+const struct hangman_lockable *
+hangman_waitingfor(const struct hangman_actor *a)
+{
+	return a->a_gen == hangman_gen ? a->a_waiting : NULL;
+}
+
 /*
  * Look for a path through the waits-for graph that goes from START to
  * TARGET.
@@ -54,15 +77,15 @@ hangman_check(const struct hangman_lockable *start,
 {
 	const struct hangman_actor *cur;
 
-	cur = start->l_holding;
+	cur = hangman_holder(start);
 	while (cur != NULL) {
 		if (cur == target) {
 			goto found;
 		}
-		if (cur->a_waiting == NULL) {
+		if (hangman_waitingfor(cur) == NULL) {
 			break;
 		}
-		cur = cur->a_waiting->l_holding;
+		cur = hangman_holder(hangman_waitingfor(cur));
 	}
 	return;
 
@@ -82,12 +105,13 @@ hangman_check(const struct hangman_lockable *start,
 	kprintf("hangman: in %s (%p);\n", target->a_name, target);
 	kprintf("hangman: waiting for %s (%p), but:\n", start->l_name, start);
 	kprintf("   lockable %s (%p)\n", start->l_name, start);
-	cur = start->l_holding;
+	cur = hangman_holder(start);
 	while (cur != target) {
 		kprintf("   held by actor %s (%p)\n", cur->a_name, cur);
 		kprintf("   waiting for lockable %s (%p)\n",
-			cur->a_waiting->l_name, cur->a_waiting);
-		cur = cur->a_waiting->l_holding;
+			hangman_waitingfor(cur)->l_name,
+			hangman_waitingfor(cur));
+		cur = hangman_holder(hangman_waitingfor(cur));
 	}
 	kprintf("   held by actor %s (%p)\n", cur->a_name, cur);
 	panic("Deadlock.\n");
@@ -117,13 +141,19 @@ hangman_wait(struct hangman_actor *a,
 
 	spinlock_acquire(&hangman_lock);
 
-	if (a->a_waiting != NULL) {
+	if (!hangman_on) {
+		/* turned off since the caller looked */
+		spinlock_release(&hangman_lock);
+		return;
+	}
+	if (hangman_waitingfor(a) != NULL) {
 		spinlock_release(&hangman_lock);
 		panic("hangman_wait: already waiting for something?\n");
 	}
 
 	hangman_check(l, a);
 	a->a_waiting = l;
+	a->a_gen = hangman_gen;
 
 	spinlock_release(&hangman_lock);
 }
@@ -139,18 +169,24 @@ hangman_acquire(struct hangman_actor *a,
 
 	spinlock_acquire(&hangman_lock);
 
-	if (a->a_waiting != l) {
+	if (!hangman_on) {
+		spinlock_release(&hangman_lock);
+		return;
+	}
+	/* Not waiting at all is fine: it started before we were on */
+	if (hangman_waitingfor(a) != NULL && hangman_waitingfor(a) != l) {
 		spinlock_release(&hangman_lock);
 		panic("hangman_acquire: not waiting for lock %s (%p)\n",
 		      l->l_name, l);
 	}
-	if (l->l_holding != NULL) {
+	if (hangman_holder(l) != NULL) {
 		spinlock_release(&hangman_lock);
 		panic("hangman_acquire: lock %s (%p) still held by %s (%p)\n",
 		      l->l_name, l, a->a_name, a);
 	}
 
 	l->l_holding = a;
+	l->l_gen = hangman_gen;
 	a->a_waiting = NULL;
 
 	spinlock_release(&hangman_lock);
@@ -167,11 +203,16 @@ hangman_release(struct hangman_actor *a,
 
 	spinlock_acquire(&hangman_lock);
 
-	if (a->a_waiting != NULL) {
+	if (!hangman_on) {
+		spinlock_release(&hangman_lock);
+		return;
+	}
+	if (hangman_waitingfor(a) != NULL) {
 		spinlock_release(&hangman_lock);
 		panic("hangman_release: waiting for something?\n");
 	}
-	if (l->l_holding != a) {
+	/* No holder is fine: it was acquired before we were on */
+	if (hangman_holder(l) != NULL && hangman_holder(l) != a) {
 		spinlock_release(&hangman_lock);
 		panic("hangman_release: not the holder\n");
 	}
@@ -180,3 +221,21 @@ hangman_release(struct hangman_actor *a,
 
 	spinlock_release(&hangman_lock);
 }
+
+/*
+ * Turn checking on or off. Turning it on starts a new generation, so
+ * that nothing recorded before is believed.
+ */
+void
+hangman_enable(bool on)
+{
+	spinlock_acquire(&hangman_lock);
+	if (on && !hangman_on) {
+		hangman_gen++;
+		if (hangman_gen == 0) {
+			hangman_gen = 1;
+		}
+	}
+	hangman_on = on;
+	spinlock_release(&hangman_lock);
+}
@@ -0,0 +1,325 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Lock contention profiler.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <clock.h>
+#include <membar.h>
+#include <spinlock.h>
+#include <lockprof.h>
+#include <kstat.h>
+
+#define LOCKPROF_NCLASSES	128	/* Size of the registry */
+#define LOCKPROF_NAMELEN	23	/* Longest class name kept */
+#define LOCKPROF_NPRINT		20	/* Classes shown by lockprof_print */
+
+struct lockprof_class {
+	spinlock_data_t lc_lock;		/* Protects the counters */
+	const void *lc_site;			/* Spinlock init site, or NULL */
+	char lc_name[LOCKPROF_NAMELEN+1];	/* Lock name, or "" */
+	uint64_t lc_acquires;
+	uint64_t lc_contended;
+	uint64_t lc_waitns;
+	uint64_t lc_maxwaitns;
+	uint64_t lc_holdns;
+};
+
+/*
+ * The registry. Classes are never removed; when it fills up, the last
+ * slot becomes a catch-all. It is protected by a bare spinlock word,
+ * since struct spinlocks are themselves profiled.
+ */
+static struct lockprof_class lockprof_classes[LOCKPROF_NCLASSES];
+static unsigned lockprof_nclasses;
+static volatile spinlock_data_t lockprof_reglock = SPINLOCK_DATA_INITIALIZER;
+
+/* Whether we are collecting. Off until turned on, as gettime isn't
+   usable until the clock device attaches. */
+static volatile bool lockprof_on;
+
+static
+void
+lockprof_lock(volatile spinlock_data_t *sd)
+{
+	splraise(IPL_NONE, IPL_HIGH);
+	while (spinlock_data_get(sd) != 0 ||
+	       spinlock_data_testandset(sd) != 0) {
+		/* spin */
+	}
+	membar_store_any();
+}
+
+static
+void
+lockprof_unlock(volatile spinlock_data_t *sd)
+{
+	membar_any_store();
+	spinlock_data_set(sd, 0);
+	spllower(IPL_HIGH, IPL_NONE);
+}
+
+static
+uint64_t
+lockprof_now(void)
+{
+	return clock_monotonic();
+}
+
+/*
+ * Find the class for NAME (sleep locks) or SITE (spinlocks), adding
+ * it if it's not there yet.
+ */
+static
+struct lockprof_class *
+lockprof_getclass(const char *name, const void *site)
+{
+	struct lockprof_class *lc;
+	char key[LOCKPROF_NAMELEN+1];
+	unsigned i;
+
+	/* Long names are classed by their prefix */
+	for (i=0; i<LOCKPROF_NAMELEN && name != NULL && name[i] != 0; i++) {
+		key[i] = name[i];
+	}
+	key[i] = 0;
+
+	lockprof_lock(&lockprof_reglock);
+	for (i=0; i<lockprof_nclasses; i++) {
+		lc = &lockprof_classes[i];
+		if (lc->lc_site == site && !strcmp(lc->lc_name, key)) {
+			goto done;
+		}
+	}
+	if (lockprof_nclasses == LOCKPROF_NCLASSES) {
+		lc = &lockprof_classes[LOCKPROF_NCLASSES-1];
+		goto done;
+	}
+
+	lc = &lockprof_classes[lockprof_nclasses++];
+	if (lockprof_nclasses == LOCKPROF_NCLASSES) {
+		strcpy(key, "(others)");
+		site = NULL;
+	}
+	lc->lc_site = site;
+	strcpy(lc->lc_name, key);
+
+ done:
+	lockprof_unlock(&lockprof_reglock);
+	return lc;
+}
+
+void
+lockprof_init(struct lockprof *lp, const char *name, const void *site)
+{
+	lp->lp_class = lockprof_getclass(name, site);
+	lp->lp_acquired = 0;
+}
+
+/*
+ * Call before trying for the lock.
+ */
+void
+lockprof_wait(struct lockprof_waiter *w)
+{
+	w->lw_start = lockprof_on ? lockprof_now() : 0;
+	w->lw_contended = false;
+}
+
+/*
+ * Call once the lock is held.
+ */
+void
+lockprof_acquire(struct lockprof *lp, struct lockprof_waiter *w)
+{
+	struct lockprof_class *lc;
+	uint64_t now, wait;
+
+	if (!lockprof_on || w->lw_start == 0) {
+		/* Not collecting, or weren't when we started waiting */
+		lp->lp_acquired = 0;
+		return;
+	}
+
+	if (lp->lp_class == NULL) {
+		/* SPINLOCK_INITIALIZER */
+		lp->lp_class = lockprof_getclass(NULL, NULL);
+	}
+	lc = lp->lp_class;
+
+	now = lockprof_now();
+	wait = now - w->lw_start;
+
+	lockprof_lock(&lc->lc_lock);
+	lc->lc_acquires++;
+	if (w->lw_contended) {
+		lc->lc_contended++;
+	}
+	lc->lc_waitns += wait;
+	if (wait > lc->lc_maxwaitns) {
+		lc->lc_maxwaitns = wait;
+	}
+	lockprof_unlock(&lc->lc_lock);
+
+	lp->lp_acquired = now;
+}
+
+/*
+ * Call just before releasing the lock.
+ */
+void
+lockprof_release(struct lockprof *lp)
+{
+	struct lockprof_class *lc;
+	uint64_t held;
+
+	if (!lockprof_on || lp->lp_acquired == 0) {
+		return;
+	}
+
+	lc = lp->lp_class;
+	held = lockprof_now() - lp->lp_acquired;
+	lp->lp_acquired = 0;
+
+	lockprof_lock(&lc->lc_lock);
+	lc->lc_holdns += held;
+	lockprof_unlock(&lc->lc_lock);
+}
+
+void
+lockprof_enable(bool on)
+{
+	lockprof_on = on;
+}
+
+void
+lockprof_reset(void)
+{
+	struct lockprof_class *lc;
+	unsigned i;
+
+	for (i=0; i<LOCKPROF_NCLASSES; i++) {
+		lc = &lockprof_classes[i];
+		lockprof_lock(&lc->lc_lock);
+		lc->lc_acquires = 0;
+		lc->lc_contended = 0;
+		lc->lc_waitns = 0;
+		lc->lc_maxwaitns = 0;
+		lc->lc_holdns = 0;
+		lockprof_unlock(&lc->lc_lock);
+	}
+}
+
+/*
+ * Print the classes that waited longest, worst first. The counters
+ * are read without locking, so the numbers may be slightly stale.
+ */
+void
+lockprof_print(void)
+{
+	struct lockprof_class *lc, *worst;
+	bool shown[LOCKPROF_NCLASSES];
+	unsigned i, n, nclasses;
+
+	bzero(shown, sizeof(shown));
+	nclasses = lockprof_nclasses;
+
+	kprintf("lockprof is %s\n", lockprof_on ? "on" : "off");
+	kprintf("%-24s %10s %10s %12s %10s %12s\n", "class", "acquires",
+		"contended", "wait(us)", "max(us)", "held(us)");
+
+	for (n=0; n<LOCKPROF_NPRINT; n++) {
+		worst = NULL;
+		for (i=0; i<nclasses; i++) {
+			lc = &lockprof_classes[i];
+			if (shown[i] || lc->lc_acquires == 0) {
+				continue;
+			}
+			if (worst == NULL || lc->lc_waitns > worst->lc_waitns) {
+				worst = lc;
+			}
+		}
+		if (worst == NULL) {
+			break;
+		}
+		shown[worst - lockprof_classes] = true;
+
+		if (worst->lc_site != NULL) {
+			kprintf("spinlock@%-15p", worst->lc_site);
+		}
+		else if (worst->lc_name[0] != 0) {
+			kprintf("%-24s", worst->lc_name);
+		}
+		else {
+			kprintf("%-24s", "(static spinlocks)");
+		}
+		kprintf(" %10llu %10llu %12llu %10llu %12llu\n",
+			worst->lc_acquires, worst->lc_contended,
+			worst->lc_waitns / 1000, worst->lc_maxwaitns / 1000,
+			worst->lc_holdns / 1000);
+	}
+}
+
+/*
+ * Every class that has been acquired, for kstat: lockprof.CLASS.*,
+ * with times in nanoseconds.
+ */
+void
+lockprof_kstat(struct kstat *ks)
+{
+	struct lockprof_class *lc;
+	char name[LOCKPROF_NAMELEN+16];
+	unsigned i, nclasses;
+
+	nclasses = lockprof_nclasses;
+	for (i=0; i<nclasses; i++) {
+		lc = &lockprof_classes[i];
+		if (lc->lc_acquires == 0) {
+			continue;
+		}
+		if (lc->lc_site != NULL) {
+			snprintf(name, sizeof(name), "spinlock@%p", lc->lc_site);
+		}
+		else if (lc->lc_name[0] != 0) {
+			strcpy(name, lc->lc_name);
+		}
+		else {
+			strcpy(name, "static_spinlocks");
+		}
+		kstat_put(ks, lc->lc_acquires, "lockprof.%s.acquires", name);
+		kstat_put(ks, lc->lc_contended, "lockprof.%s.contended", name);
+		kstat_put(ks, lc->lc_waitns, "lockprof.%s.waitns", name);
+		kstat_put(ks, lc->lc_maxwaitns, "lockprof.%s.maxwaitns", name);
+		kstat_put(ks, lc->lc_holdns, "lockprof.%s.holdns", name);
+	}
+}
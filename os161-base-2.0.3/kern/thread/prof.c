@@ -0,0 +1,475 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Kernel PC-sampling profiler.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <cpu.h>
+#include <current.h>
+#include <membar.h>
+#include <uio.h>
+#include <elf.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <vm.h>
+#include <prof.h>
+
+#define PROF_NSAMPLES	1024	/* Ring size, per cpu */
+#define PROF_NAMELEN	39	/* Longest symbol name printed */
+#define PROF_SYMCHUNK	16	/* Symbols read at a time */
+
+/*
+ * Samples from one cpu. Only that cpu writes it, from hardclock; it's
+ * read only while the profiler is off.
+ */
+struct prof_ring {
+	vaddr_t pr_pc[PROF_NSAMPLES];
+	unsigned pr_head;		/* Samples taken; next goes at
+					   pr_head % PROF_NSAMPLES */
+};
+
+/*
+ * A function, and how many samples landed in it. Without a symbol
+ * table each distinct PC gets one of these instead.
+ */
+struct prof_sym {
+	vaddr_t ps_addr;
+	uint32_t ps_size;		/* 0 if unknown */
+	uint32_t ps_name;		/* Offset in the string table */
+	unsigned ps_count;
+};
+
+static struct prof_ring *prof_rings;	/* One per cpu, once allocated */
+static unsigned prof_nrings;
+static volatile bool prof_on;
+
+/*
+ * Start collecting samples, throwing away any from last time.
+ */
+int
+prof_start(void)
+{
+	unsigned i;
+
+	KASSERT(!prof_on);
+
+	if (prof_rings == NULL) {
+		prof_nrings = cpu_count();
+		prof_rings = kmalloc(prof_nrings * sizeof(*prof_rings));
+		if (prof_rings == NULL) {
+			return ENOMEM;
+		}
+	}
+	for (i=0; i<prof_nrings; i++) {
+		prof_rings[i].pr_head = 0;
+	}
+
+	membar_store_store();
+	prof_on = true;
+	return 0;
+}
+
+/*
+ * Stop collecting. A hardclock already past the prof_on check on
+ * another cpu might still store one last sample; that's harmless.
+ */
+void
+prof_stop(void)
+{
+	prof_on = false;
+	membar_any_any();
+}
+
+/*
+ * Record one sample on the current cpu. Called from hardclock.
+ */
+void
+prof_sample(vaddr_t pc)
+{
+	struct prof_ring *pr;
+
+	if (!prof_on) {
+		return;
+	}
+	KASSERT(curcpu->c_number < prof_nrings);
+	pr = &prof_rings[curcpu->c_number];
+	pr->pr_pc[pr->pr_head % PROF_NSAMPLES] = pc;
+	pr->pr_head++;
+}
+
+/*
+ * Read exactly LEN bytes at OFFSET.
+ */
+static
+int
+prof_read(struct vnode *v, off_t offset, void *buf, size_t len)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	uio_kinit(&iov, &ku, buf, len, offset, UIO_READ);
+	result = VOP_READ(v, &ku);
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		return ENOEXEC;
+	}
+	return 0;
+}
+
+/*
+ * Sort symbols by address. There are a couple of thousand at most,
+ * so a shell sort is plenty.
+ */
+static
+void
+prof_sortsyms(struct prof_sym *syms, unsigned nsyms)
+{
+	struct prof_sym tmp;
+	unsigned gap, i, j;
+
+	for (gap = nsyms / 2; gap > 0; gap /= 2) {
+		for (i=gap; i<nsyms; i++) {
+			tmp = syms[i];
+			for (j=i; j>=gap && syms[j-gap].ps_addr > tmp.ps_addr;
+			     j-=gap) {
+				syms[j] = syms[j-gap];
+			}
+			syms[j] = tmp;
+		}
+	}
+}
+
+/*
+ * Load the function symbols from the ELF file V. Returns them sorted,
+ * along with the file offset of their string table.
+ */
+static
+int
+prof_loadsyms(struct vnode *v, struct prof_sym **ret, unsigned *nret,
+	      off_t *strtabret)
+{
+	Elf_Ehdr eh;
+	Elf_Shdr sh, strsh;
+	Elf_Sym esyms[PROF_SYMCHUNK];
+	struct prof_sym *syms;
+	unsigned i, j, n, nents, nsyms;
+	off_t offset;
+	int result;
+
+	result = prof_read(v, 0, &eh, sizeof(eh));
+	if (result) {
+		return result;
+	}
+	if (eh.e_ident[EI_MAG0] != ELFMAG0 ||
+	    eh.e_ident[EI_MAG1] != ELFMAG1 ||
+	    eh.e_ident[EI_MAG2] != ELFMAG2 ||
+	    eh.e_ident[EI_MAG3] != ELFMAG3 ||
+	    eh.e_ident[EI_CLASS] != ELFCLASS32 ||
+	    eh.e_shentsize < sizeof(Elf_Shdr)) {
+		return ENOEXEC;
+	}
+
+	/* Find the symbol table; the kernel isn't normally stripped */
+	for (i=0; i<eh.e_shnum; i++) {
+		result = prof_read(v, eh.e_shoff + i*eh.e_shentsize,
+				   &sh, sizeof(sh));
+		if (result) {
+			return result;
+		}
+		if (sh.sh_type == SHT_SYMTAB) {
+			break;
+		}
+	}
+	if (i == eh.e_shnum || sh.sh_link >= eh.e_shnum) {
+		return ENOENT;
+	}
+	result = prof_read(v, eh.e_shoff + sh.sh_link*eh.e_shentsize,
+			   &strsh, sizeof(strsh));
+	if (result) {
+		return result;
+	}
+
+	nents = sh.sh_size / sizeof(Elf_Sym);
+	if (nents == 0) {
+		return ENOENT;
+	}
+	syms = kmalloc(nents * sizeof(*syms));
+	if (syms == NULL) {
+		return ENOMEM;
+	}
+
+	nsyms = 0;
+	for (i=0; i<nents; i+=n) {
+		n = nents - i;
+		if (n > PROF_SYMCHUNK) {
+			n = PROF_SYMCHUNK;
+		}
+		offset = sh.sh_offset + i*sizeof(Elf_Sym);
+		result = prof_read(v, offset, esyms, n*sizeof(Elf_Sym));
+		if (result) {
+			kfree(syms);
+			return result;
+		}
+		for (j=0; j<n; j++) {
+			if (ELF32_ST_TYPE(esyms[j].st_info) != STT_FUNC ||
+			    esyms[j].st_value == 0) {
+				continue;
+			}
+			syms[nsyms].ps_addr = esyms[j].st_value;
+			syms[nsyms].ps_size = esyms[j].st_size;
+			syms[nsyms].ps_name = esyms[j].st_name;
+			syms[nsyms].ps_count = 0;
+			nsyms++;
+		}
+	}
+
+	prof_sortsyms(syms, nsyms);
+	*ret = syms;
+	*nret = nsyms;
+	*strtabret = strsh.sh_offset;
+	return 0;
+}
+
+/*
+ * Without symbols, make one entry per distinct sampled kernel PC.
+ */
+static
+int
+prof_pcsyms(struct prof_sym **ret, unsigned *nret)
+{
+	struct prof_sym *syms;
+	unsigned i, j, n, nsamples, nsyms;
+
+	nsamples = 0;
+	for (i=0; i<prof_nrings; i++) {
+		n = prof_rings[i].pr_head;
+		nsamples += n < PROF_NSAMPLES ? n : PROF_NSAMPLES;
+	}
+	syms = kmalloc((nsamples + 1) * sizeof(*syms));
+	if (syms == NULL) {
+		return ENOMEM;
+	}
+
+	nsyms = 0;
+	for (i=0; i<prof_nrings; i++) {
+		n = prof_rings[i].pr_head;
+		if (n > PROF_NSAMPLES) {
+			n = PROF_NSAMPLES;
+		}
+		for (j=0; j<n; j++) {
+			if (prof_rings[i].pr_pc[j] < USERSPACETOP) {
+				continue;
+			}
+			syms[nsyms].ps_addr = prof_rings[i].pr_pc[j];
+			syms[nsyms].ps_size = 1;
+			syms[nsyms].ps_name = 0;
+			syms[nsyms].ps_count = 0;
+			nsyms++;
+		}
+	}
+	prof_sortsyms(syms, nsyms);
+
+	/* Squeeze out duplicates */
+	for (i=j=0; i<nsyms; i++) {
+		if (j == 0 || syms[j-1].ps_addr != syms[i].ps_addr) {
+			syms[j++] = syms[i];
+		}
+	}
+
+	*ret = syms;
+	*nret = j;
+	return 0;
+}
+
+/*
+ * Find the symbol PC is in, by binary search.
+ */
+static
+struct prof_sym *
+prof_findsym(struct prof_sym *syms, unsigned nsyms, vaddr_t pc)
+{
+	unsigned lo, hi, mid;
+
+	/* Find the last symbol at or below PC */
+	lo = 0;
+	hi = nsyms;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (syms[mid].ps_addr <= pc) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	if (lo == 0) {
+		return NULL;
+	}
+	if (syms[lo-1].ps_size != 0 &&
+	    pc - syms[lo-1].ps_addr >= syms[lo-1].ps_size) {
+		return NULL;
+	}
+	return &syms[lo-1];
+}
+
+/*
+ * Fetch a symbol's name from the string table.
+ */
+static
+void
+prof_symname(struct vnode *v, off_t offset, char *buf, size_t max)
+{
+	struct iovec iov;
+	struct uio ku;
+
+	uio_kinit(&iov, &ku, buf, max - 1, offset, UIO_READ);
+	if (VOP_READ(v, &ku)) {
+		strcpy(buf, "???");
+		return;
+	}
+	buf[max - 1 - ku.uio_resid] = 0;
+}
+
+/*
+ * Print the TOPN functions with the most samples, matching samples
+ * to functions with the symbol table of the ELF file SYMFILE (which
+ * should be the running kernel), or just by PC if that fails.
+ */
+void
+prof_report(const char *symfile, unsigned topn)
+{
+	struct prof_sym *syms, *ps, *best;
+	struct vnode *v;
+	char *path;
+	char name[PROF_NAMELEN + 1];
+	unsigned i, j, n, nsyms, total, lost, user, unknown;
+	unsigned thousandths;
+	off_t strtab;
+	int result;
+
+	KASSERT(!prof_on);
+	if (prof_rings == NULL) {
+		kprintf("prof: no samples\n");
+		return;
+	}
+
+	v = NULL;
+	syms = NULL;
+	nsyms = 0;
+	strtab = 0;
+	path = kstrdup(symfile);
+	if (path == NULL) {
+		result = ENOMEM;
+	}
+	else {
+		result = vfs_open(path, O_RDONLY, 0, &v);
+		kfree(path);
+	}
+	if (result == 0) {
+		result = prof_loadsyms(v, &syms, &nsyms, &strtab);
+		if (result) {
+			vfs_close(v);
+			v = NULL;
+		}
+	}
+	if (result) {
+		kprintf("prof: no symbols from %s (%s); showing PCs\n",
+			symfile, strerror(result));
+		result = prof_pcsyms(&syms, &nsyms);
+		if (result) {
+			kprintf("prof: %s\n", strerror(result));
+			return;
+		}
+	}
+
+	total = lost = user = unknown = 0;
+	for (i=0; i<prof_nrings; i++) {
+		n = prof_rings[i].pr_head;
+		if (n > PROF_NSAMPLES) {
+			lost += n - PROF_NSAMPLES;
+			n = PROF_NSAMPLES;
+		}
+		for (j=0; j<n; j++) {
+			total++;
+			if (prof_rings[i].pr_pc[j] < USERSPACETOP) {
+				user++;
+				continue;
+			}
+			ps = prof_findsym(syms, nsyms, prof_rings[i].pr_pc[j]);
+			if (ps == NULL) {
+				unknown++;
+				continue;
+			}
+			ps->ps_count++;
+		}
+	}
+
+	kprintf("prof: %u samples on %u cpus (%u overwritten), "
+		"%u in user mode, %u unknown\n",
+		total, prof_nrings, lost, user, unknown);
+
+	for (i=0; i<topn && total > 0; i++) {
+		best = NULL;
+		for (j=0; j<nsyms; j++) {
+			if (syms[j].ps_count > 0 &&
+			    (best == NULL || syms[j].ps_count > best->ps_count)) {
+				best = &syms[j];
+			}
+		}
+		if (best == NULL) {
+			break;
+		}
+		thousandths = best->ps_count * 1000 / total;
+		if (v != NULL) {
+			prof_symname(v, strtab + best->ps_name,
+				     name, sizeof(name));
+		}
+		else {
+			snprintf(name, sizeof(name), "0x%08lx",
+				 (unsigned long)best->ps_addr);
+		}
+		kprintf("%8u %3u.%u%%  %s\n", best->ps_count,
+			thousandths / 10, thousandths % 10, name);
+		/* Done with it */
+		best->ps_count = 0;
+	}
+
+	kfree(syms);
+	if (v != NULL) {
+		vfs_close(v);
+	}
+}
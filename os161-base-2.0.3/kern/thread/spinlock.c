@@ -30,6 +30,7 @@
 /* Make sure to build out-of-line versions of inline functions */
 #define SPINLOCK_INLINE   /* empty */
 #define MEMBAR_INLINE     /* empty */
+#define SEQLOCK_INLINE    /* empty */
 
 #include <types.h>
 #include <lib.h>
@@ -37,22 +38,63 @@
 #include <spl.h>
 #include <spinlock.h>
 #include <membar.h>
+#include <seqlock.h>
 #include <current.h>	/* for curcpu */
 
 /*
  * Spinlocks.
+ *
+ * The lock word of a test-and-set lock is 0 or 1. That of a ticket
+ * lock has SPINLOCK_TICKET set, the next ticket to hand out in bits
+ * 16-30 and the ticket now being served in bits 0-14; the lock is
+ * free when the two are equal. Tickets are taken, and the lock is
+ * handed on, with compare-and-swap, as the word is shared.
  */
 
+#define TICKET_NEXTSHIFT	16
+#define TICKET_NEXTMASK		0x7fff0000
+#define TICKET_SERVINGMASK	0x00007fff
+
+/*
+ * Polls of the lock word per waiter ahead of us, between looks at a
+ * ticket lock.
+ */
+#define TICKET_BACKOFF		16
 
 /*
- * Initialize spinlock.
+ * Initialize spinlock. SITE is who to blame for it (see lockprof).
  */
+static
 void
-spinlock_init(struct spinlock *splk)
+spinlock_init_word(struct spinlock *splk, spinlock_data_t word,
+		   const void *site)
 {
-	spinlock_data_set(&splk->splk_lock, 0);
+	spinlock_data_set(&splk->splk_lock, word);
 	splk->splk_holder = NULL;
 	HANGMAN_LOCKABLEINIT(&splk->splk_hangman, "spinlock");
+	LOCKPROF_SPINLOCKINIT(&splk->splk_prof, site);
+	(void)site;
+}
+
+void
+spinlock_init(struct spinlock *splk)
+{
+	spinlock_init_word(splk, SPINLOCK_WORD_INITIALIZER,
+			   __builtin_return_address(0));
+}
+
+void
+spinlock_init_ticket(struct spinlock *splk)
+{
+	spinlock_init_word(splk, SPINLOCK_TICKET,
+			   __builtin_return_address(0));
+}
+
+void
+spinlock_init_tas(struct spinlock *splk)
+{
+	spinlock_init_word(splk, SPINLOCK_DATA_INITIALIZER,
+			   __builtin_return_address(0));
 }
 
 /*
@@ -61,37 +103,65 @@ spinlock_init(struct spinlock *splk)
 void
 spinlock_cleanup(struct spinlock *splk)
 {
+	spinlock_data_t word;
+
 	KASSERT(splk->splk_holder == NULL);
-	KASSERT(spinlock_data_get(&splk->splk_lock) == 0);
+	word = spinlock_data_get(&splk->splk_lock);
+	if (word & SPINLOCK_TICKET) {
+		KASSERT(((word & TICKET_NEXTMASK) >> TICKET_NEXTSHIFT) ==
+			(word & TICKET_SERVINGMASK));
+	}
+	else {
+		KASSERT(word == 0);
+	}
 }
 
 /*
- * Get the lock.
- *
- * First disable interrupts (otherwise, if we get a timer interrupt we
- * might come back to this lock and deadlock), then use a machine-level
- * atomic operation to wait for the lock to be free.
+ * Wait for our turn at a ticket lock. Everybody ahead of us needs
+ * the lock for a while, so rather than watching the lock word all
+ * the time, look at it again only after about as long as they will
+ * take; that also leaves the bus (and the cache line) to the holder.
  */
-void
-spinlock_acquire(struct spinlock *splk)
+static
+bool
+spinlock_ticket_wait(struct spinlock *splk)
 {
-	struct cpu *mycpu;
+	spinlock_data_t word, ticket, serving;
+	volatile unsigned i;
+	unsigned ahead;
+	bool contended = false;
 
-	splraise(IPL_NONE, IPL_HIGH);
+	/* Take a ticket */
+	do {
+		word = spinlock_data_get(&splk->splk_lock);
+	} while (!spinlock_data_cas(&splk->splk_lock, word,
+		(word & ~TICKET_NEXTMASK) |
+		((word + (1 << TICKET_NEXTSHIFT)) & TICKET_NEXTMASK)));
+	ticket = (word & TICKET_NEXTMASK) >> TICKET_NEXTSHIFT;
 
-	/* this must work before curcpu initialization */
-	if (CURCPU_EXISTS()) {
-		mycpu = curcpu->c_self;
-		if (splk->splk_holder == mycpu) {
-			panic("Deadlock on spinlock %p\n", splk);
+	while (1) {
+		serving = spinlock_data_get(&splk->splk_lock) &
+			TICKET_SERVINGMASK;
+		if (serving == ticket) {
+			break;
+		}
+		contended = true;
+		ahead = (ticket - serving) & TICKET_SERVINGMASK;
+		for (i = 0; i < ahead * TICKET_BACKOFF; i++) {
+			/* nothing */
 		}
-		mycpu->c_spinlocks++;
-
-		HANGMAN_WAIT(&curcpu->c_hangman, &splk->splk_hangman);
-	}
-	else {
-		mycpu = NULL;
 	}
+	return contended;
+}
+
+/*
+ * Wait for a test-and-set lock.
+ */
+static
+bool
+spinlock_tas_wait(struct spinlock *splk)
+{
+	bool contended = false;
 
 	while (1) {
 		/*
@@ -105,20 +175,76 @@ spinlock_acquire(struct spinlock *splk)
 		 * we don't.
 		 */
 		if (spinlock_data_get(&splk->splk_lock) != 0) {
+			contended = true;
 			continue;
 		}
 		if (spinlock_data_testandset(&splk->splk_lock) != 0) {
+			contended = true;
 			continue;
 		}
 		break;
 	}
+	return contended;
+}
+
+/*
+ * Get the lock.
+ *
+ * First disable interrupts (otherwise, if we get a timer interrupt we
+ * might come back to this lock and deadlock), then use a machine-level
+ * atomic operation to wait for the lock to be free. Returns whether
+ * we had to wait.
+ */
+bool
+spinlock_acquire_contended(struct spinlock *splk)
+{
+	struct cpu *mycpu;
+	bool contended;
+	LOCKPROF_WAITER(w);
+
+	splraise(IPL_NONE, IPL_HIGH);
+
+	/* this must work before curcpu initialization */
+	if (CURCPU_EXISTS()) {
+		mycpu = curcpu->c_self;
+		if (splk->splk_holder == mycpu) {
+			panic("Deadlock on spinlock %p\n", splk);
+		}
+		mycpu->c_spinlocks++;
+
+		HANGMAN_WAIT(&curcpu->c_hangman, &splk->splk_hangman);
+	}
+	else {
+		mycpu = NULL;
+	}
+
+	LOCKPROF_WAIT(&w);
+
+	/* The kind of lock never changes, so this can't be stale */
+	if (spinlock_data_get(&splk->splk_lock) & SPINLOCK_TICKET) {
+		contended = spinlock_ticket_wait(splk);
+	}
+	else {
+		contended = spinlock_tas_wait(splk);
+	}
+	if (contended) {
+		LOCKPROF_CONTENDED(&w);
+	}
 
 	membar_store_any();
 	splk->splk_holder = mycpu;
+	LOCKPROF_ACQUIRE(&splk->splk_prof, &w);
 
 	if (CURCPU_EXISTS()) {
 		HANGMAN_ACQUIRE(&curcpu->c_hangman, &splk->splk_hangman);
 	}
+	return contended;
+}
+
+void
+spinlock_acquire(struct spinlock *splk)
+{
+	(void)spinlock_acquire_contended(splk);
 }
 
 /*
@@ -127,6 +253,8 @@ spinlock_acquire(struct spinlock *splk)
 void
 spinlock_release(struct spinlock *splk)
 {
+	spinlock_data_t word;
+
 	/* this must work before curcpu initialization */
 	if (CURCPU_EXISTS()) {
 		KASSERT(splk->splk_holder == curcpu->c_self);
@@ -135,9 +263,21 @@ spinlock_release(struct spinlock *splk)
 		HANGMAN_RELEASE(&curcpu->c_hangman, &splk->splk_hangman);
 	}
 
+	LOCKPROF_RELEASE(&splk->splk_prof);
 	splk->splk_holder = NULL;
 	membar_any_store();
-	spinlock_data_set(&splk->splk_lock, 0);
+	word = spinlock_data_get(&splk->splk_lock);
+	if (word & SPINLOCK_TICKET) {
+		/* Serve the next ticket; others may be taking tickets */
+		while (!spinlock_data_cas(&splk->splk_lock, word,
+			(word & ~TICKET_SERVINGMASK) |
+			((word + 1) & TICKET_SERVINGMASK))) {
+			word = spinlock_data_get(&splk->splk_lock);
+		}
+	}
+	else {
+		spinlock_data_set(&splk->splk_lock, 0);
+	}
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
@@ -154,3 +294,21 @@ spinlock_do_i_hold(struct spinlock *splk)
 	/* Assume we can read splk_holder atomically enough for this to work */
 	return (splk->splk_holder == curcpu->c_self);
 }
+
+/*
+ * Sequence locks (see seqlock.h); only the setup isn't inline.
+ */
+
+void
+seqlock_init(struct seqlock *sl)
+{
+	sl->sl_seq = 0;
+	spinlock_init(&sl->sl_lock);
+}
+
+void
+seqlock_cleanup(struct seqlock *sl)
+{
+	KASSERT((sl->sl_seq & 1) == 0);
+	spinlock_cleanup(&sl->sl_lock);
+}
@@ -40,6 +40,49 @@
 #include <current.h>
 #include <synch.h>
 
+#if OPT_SHELL
+#include <kern/time.h>
+#include <kern/resource.h>
+#include <counter.h>
+#include <membar.h>
+#include <kmem_cache.h>
+#include <spl.h>
+
+/* Locks and CVs come and go with every process; cache them. */
+static struct kmem_cache lock_cache =
+	KMEM_CACHE_INITIALIZER("lock", sizeof(struct lock), NULL, NULL);
+static struct kmem_cache cv_cache =
+	KMEM_CACHE_INITIALIZER("cv", sizeof(struct cv), NULL, NULL);
+
+#define LOCK_ALLOC()		kmem_cache_alloc(&lock_cache)
+#define LOCK_FREE(lk)		kmem_cache_free(&lock_cache, (lk))
+#define CV_ALLOC()		kmem_cache_alloc(&cv_cache)
+#define CV_FREE(cv)		kmem_cache_free(&cv_cache, (cv))
+#else
+#define LOCK_ALLOC()		kmalloc(sizeof(struct lock))
+#define LOCK_FREE(lk)		kfree(lk)
+#define CV_ALLOC()		kmalloc(sizeof(struct cv))
+#define CV_FREE(cv)		kfree(cv)
+#endif
+
+#if OPT_SHELL
+/* Polls of a held lock before lock_acquire gives up and sleeps */
+unsigned lock_spinlimit = LOCK_SPINLIMIT;
+
+/*
+ * Priority inheritance. A thread sleeping on a lock lends its nice
+ * value to the owner, and on down the chain if the owner is itself
+ * asleep on another lock, so that a nice 19 thread holding what a
+ * nice -20 one needs is not starved by everything in between. All
+ * the lk_pi* and t_pi* fields and t_boost are under pi_lock, which
+ * nests inside lk_lock and outside the run queue locks.
+ */
+static struct spinlock pi_lock = SPINLOCK_INITIALIZER;
+
+/* Links followed when passing a loan on, to bound the work on cycles */
+#define PI_MAXCHAIN	16
+#endif
+
 ////////////////////////////////////////////////////////////
 //
 // Semaphore.
@@ -69,6 +112,10 @@ sem_create(const char *name, unsigned initial_count)
 
 	spinlock_init(&sem->sem_lock);
         sem->sem_count = initial_count;
+#if OPT_SHELL
+        sem->sem_nwaiters = 0;
+        sem->sem_vinflight = 0;
+#endif
 
         return sem;
 }
@@ -78,6 +125,19 @@ sem_destroy(struct semaphore *sem)
 {
         KASSERT(sem != NULL);
 
+#if OPT_SHELL
+	/*
+	 * A V that has already raised the count (so that whoever now
+	 * destroys the semaphore may have got it) can still be looking
+	 * at sem_nwaiters and waking a thread up. Wait for it to be
+	 * done. It runs at splhigh, so this doesn't take long.
+	 */
+	while (sem->sem_vinflight != 0) {
+		/* spin */
+	}
+	membar_any_any();
+#endif
+
 	/* wchan_cleanup will assert if anyone's waiting on it */
 	spinlock_cleanup(&sem->sem_lock);
 	wchan_destroy(sem->sem_wchan);
@@ -85,6 +145,123 @@ sem_destroy(struct semaphore *sem)
         kfree(sem);
 }
 
+#if OPT_SHELL
+/*
+ * Add DELTA to the number of V calls in flight (see V).
+ */
+static
+void
+sem_addinflight(struct semaphore *sem, int delta)
+{
+	unsigned n;
+
+	do {
+		n = sem->sem_vinflight;
+	} while (!spinlock_data_cas(&sem->sem_vinflight, n, n + delta));
+}
+
+/*
+ * Try to take one off the count without locking. Fails if the count
+ * is 0.
+ */
+static
+bool
+sem_trydown(struct semaphore *sem)
+{
+	unsigned count;
+
+	do {
+		count = sem->sem_count;
+		if (count == 0) {
+			return false;
+		}
+	} while (!spinlock_data_cas(&sem->sem_count, count, count - 1));
+
+	/* Like a lock acquire: nothing after may move before it. */
+	membar_store_any();
+	return true;
+}
+
+void
+P(struct semaphore *sem)
+{
+        KASSERT(sem != NULL);
+
+        /*
+         * May not block in an interrupt handler.
+         *
+         * For robustness, always check, even if we can actually
+         * complete the P without blocking.
+         */
+        KASSERT(curthread->t_in_interrupt == false);
+
+	/* FAST PATH: THE COUNT IS POSITIVE, NO NEED FOR THE SPINLOCK */
+	if (sem_trydown(sem)) {
+		return;
+	}
+
+	/*
+	 * SLOW PATH: ANNOUNCE OURSELVES IN sem_nwaiters BEFORE LOOKING
+	 * AT THE COUNT AGAIN. V BUMPS THE COUNT BEFORE LOOKING AT
+	 * sem_nwaiters, AND BOTH SIDES PUT A FULL BARRIER IN BETWEEN,
+	 * SO EITHER WE SEE ITS INCREMENT OR IT SEES US AND COMES TO
+	 * WAKE US UP (WHICH IT CAN DO ONLY ONCE WE ARE ON THE WCHAN,
+	 * SINCE IT NEEDS sem_lock).
+	 *
+	 * As before, there is no strict FIFO ordering: a thread on the
+	 * fast path can get the count ahead of one that was woken up,
+	 * which then just goes back to sleep.
+	 */
+	spinlock_acquire(&sem->sem_lock);
+	sem->sem_nwaiters++;
+	membar_any_any();
+	while (!sem_trydown(sem)) {
+		wchan_sleep(sem->sem_wchan, &sem->sem_lock);
+	}
+	KASSERT(sem->sem_nwaiters > 0);
+	sem->sem_nwaiters--;
+	spinlock_release(&sem->sem_lock);
+}
+
+void
+V(struct semaphore *sem)
+{
+	unsigned count;
+	int spl;
+
+        KASSERT(sem != NULL);
+
+	/*
+	 * ONCE THE COUNT IS UP, A P CAN TAKE IT AND ITS CALLER DESTROY
+	 * THE SEMAPHORE, WHILE WE STILL HAVE TO LOOK AT sem_nwaiters
+	 * AND MAYBE WAKE SOMEONE. SO WE COUNT OURSELVES IN sem_vinflight
+	 * FIRST, WHICH sem_destroy WAITS TO GO TO 0, AND DON'T TOUCH THE
+	 * SEMAPHORE AFTER TAKING OURSELVES OUT. INTERRUPTS ARE OFF IN
+	 * BETWEEN SO THAT sem_destroy NEVER WAITS FOR A PREEMPTED THREAD.
+	 */
+	spl = splhigh();
+	sem_addinflight(sem, 1);
+
+	/* Like a lock release: nothing before may move after it. */
+	membar_any_store();
+	do {
+		count = sem->sem_count;
+	} while (!spinlock_data_cas(&sem->sem_count, count, count + 1));
+        KASSERT(count + 1 > 0);
+
+	/* SEE P FOR WHY THIS BARRIER IS NEEDED */
+	membar_any_any();
+	if (sem->sem_nwaiters != 0) {
+		spinlock_acquire(&sem->sem_lock);
+		wchan_wakeone(sem->sem_wchan, &sem->sem_lock);
+		spinlock_release(&sem->sem_lock);
+	}
+
+	membar_any_store();
+	sem_addinflight(sem, -1);
+	splx(spl);
+}
+#else
 void
 P(struct semaphore *sem)
 {
@@ -133,6 +310,7 @@ V(struct semaphore *sem)
 
 	spinlock_release(&sem->sem_lock);
 }
+#endif /* OPT_SHELL */
 
 ////////////////////////////////////////////////////////////
 //
@@ -144,7 +322,7 @@ lock_create(const char *name)
         struct lock *lock;
 
         /* STRUCTURE INIT */
-        lock = kmalloc(sizeof(*lock));
+        lock = LOCK_ALLOC();
         if (lock == NULL) {
                 return NULL;
         }
@@ -152,24 +330,35 @@ lock_create(const char *name)
         /* ASSIGN A NAME TO THE LOCK */
         lock->lk_name = kstrdup(name);
         if (lock->lk_name == NULL) {
-                kfree(lock);
+                LOCK_FREE(lock);
                 return NULL;
         }
 
 	HANGMAN_LOCKABLEINIT(&lock->lk_hangman, lock->lk_name);
+	LOCKPROF_LOCKABLEINIT(&lock->lk_prof, lock->lk_name);
 
 #if OPT_SHELL
         /* CREATING THE NEW WAITING CHANNEL AND CHECKING */
         lock->lk_wchan = wchan_create(lock->lk_name);
         if (lock->lk_wchan == NULL) {
                 kfree(lock->lk_name);
-                kfree(lock);
+                LOCK_FREE(lock);
                 return NULL;
         }
 
         /* INITALIZATION OF THE OWNER AND THE SPINLOCK */
         lock->lk_owner = NULL; // at the beginning, no thread owns this lock
         spinlock_init(&lock->lk_lock);
+
+        /* NO CONTENTION YET */
+        lock->lk_contended = 0;
+        lock->lk_spun = 0;
+        lock->lk_slept = 0;
+
+        /* NOBODY WAITING, NOTHING LENT */
+        lock->lk_piwaiters = NULL;
+        lock->lk_piowner = NULL;
+        lock->lk_pinext = NULL;
 #endif
 
         return lock;
@@ -182,19 +371,242 @@ lock_destroy(struct lock *lock)
 
 #if OPT_SHELL
         /* CLEANING UP USED STUFF */
+        KASSERT(lock->lk_piwaiters == NULL);
+        KASSERT(lock->lk_piowner == NULL);
         spinlock_cleanup(&lock->lk_lock);
         wchan_destroy(lock->lk_wchan);
 #endif
 
         kfree(lock->lk_name);
-        kfree(lock);
+        LOCK_FREE(lock);
+}
+
+#if OPT_SHELL
+/*
+ * The lowest nice value lent to T by the sleepers on the locks it owns.
+ */
+static
+int
+pi_boostof(struct thread *t)
+{
+        struct lock *lk;
+        struct thread *w;
+        int boost = PRIO_MAX, n;
+
+        for (lk = t->t_pilocks; lk != NULL; lk = lk->lk_pinext) {
+                for (w = lk->lk_piwaiters; w != NULL; w = w->t_pinext) {
+                        n = thread_effnice(w);
+                        if (n < boost) {
+                                boost = n;
+                        }
+                }
+        }
+        return boost;
+}
+
+/*
+ * Recompute what T is lent and pass the change on to the owner of
+ * the lock T sleeps on, if any, until nothing changes.
+ */
+static
+void
+pi_update(struct thread *t)
+{
+        int boost, before;
+        unsigned i;
+
+        KASSERT(spinlock_do_i_hold(&pi_lock));
+
+        for (i = 0; t != NULL && i < PI_MAXCHAIN; i++) {
+                boost = pi_boostof(t);
+                if (boost == t->t_boost) {
+                        break;
+                }
+                before = thread_effnice(t);
+                t->t_boost = boost;
+                if (thread_effnice(t) < before) {
+                        thread_boosted(t);
+                }
+                t = t->t_piwait != NULL ? t->t_piwait->lk_piowner : NULL;
+        }
+}
+
+/*
+ * Make NEWOWNER the thread LOCK's sleepers lend to, or nobody if no
+ * sleepers are left, and take the loan back from the previous one.
+ */
+static
+void
+pi_setowner(struct lock *lock, struct thread *newowner)
+{
+        struct thread *old = lock->lk_piowner;
+        struct lock **lkp;
+
+        KASSERT(spinlock_do_i_hold(&pi_lock));
+
+        if (lock->lk_piwaiters == NULL) {
+                newowner = NULL;
+        }
+        if (old == newowner) {
+                /* THE SLEEPERS CHANGED, THOUGH */
+                pi_update(old);
+                return;
+        }
+        if (old != NULL) {
+                for (lkp = &old->t_pilocks; *lkp != lock;
+                     lkp = &(*lkp)->lk_pinext) {
+                        KASSERT(*lkp != NULL);
+                }
+                *lkp = lock->lk_pinext;
+        }
+        lock->lk_piowner = newowner;
+        lock->lk_pinext = NULL;
+        if (newowner != NULL) {
+                lock->lk_pinext = newowner->t_pilocks;
+                newowner->t_pilocks = lock;
+        }
+        pi_update(old);
+        pi_update(newowner);
+}
+
+/*
+ * Take T off the sleepers lending through LOCK.
+ */
+static
+void
+pi_unwait(struct lock *lock, struct thread *t)
+{
+        struct thread **tp;
+
+        KASSERT(spinlock_do_i_hold(&pi_lock));
+        KASSERT(t->t_piwait == lock);
+
+        for (tp = &lock->lk_piwaiters; *tp != t; tp = &(*tp)->t_pinext) {
+                KASSERT(*tp != NULL);
+        }
+        *tp = t->t_pinext;
+        t->t_pinext = NULL;
+        t->t_piwait = NULL;
+}
+
+/*
+ * CALLED WITH lk_lock HELD BEFORE SLEEPING ON LOCK, WHICH OWNER HOLDS:
+ * START LENDING OUR NICE VALUE TO IT (ONCE, IF WE LOOP).
+ */
+static
+void
+pi_sleep(struct lock *lock, struct thread *owner)
+{
+        spinlock_acquire(&pi_lock);
+        if (curthread->t_piwait != lock) {
+                KASSERT(curthread->t_piwait == NULL);
+                curthread->t_piwait = lock;
+                curthread->t_pinext = lock->lk_piwaiters;
+                lock->lk_piwaiters = curthread;
+                pi_setowner(lock, owner);
+        }
+        spinlock_release(&pi_lock);
 }
 
+/*
+ * CALLED WITH lk_lock HELD WHEN LOCK GOES TO NEXT (OR NOBODY): NEXT
+ * STOPS LENDING, AND THE OTHER SLEEPERS LEND TO IT INSTEAD.
+ */
+static
+void
+pi_handoff(struct lock *lock, struct thread *next)
+{
+        spinlock_acquire(&pi_lock);
+        if (next != NULL && next->t_piwait == lock) {
+                pi_unwait(lock, next);
+        }
+        pi_setowner(lock, next);
+        spinlock_release(&pi_lock);
+}
+
+/*
+ * The body of lock_acquire. lock_release hands the lock straight to
+ * the first sleeper, so when we wake up from lk_wchan we may already
+ * own it; this is also how cv_wait gets the lock back after
+ * cv_broadcast moved it to lk_wchan.
+ */
+static
+void
+lock_get(struct lock *lock)
+{
+        struct thread *owner;
+        unsigned polls = 0;
+        bool contended = false, slept = false;
+        LOCKPROF_WAITER(w);
+
+        LOCKPROF_WAIT(&w);
+
+        /* ATTEMPT TO ACQUIRE THE SPINLOCK, OTHERWISE SPIN OR SLEEP */
+        spinlock_acquire(&lock->lk_lock); 
+        COUNTER_INC(COUNTER_LOCK_ACQUIRES);
+        while ((owner = (struct thread *) lock->lk_owner) != NULL) {
+                contended = true;
+                if (owner == curthread) {
+                        /* HANDED OVER BY lock_release WHILE WE SLEPT */
+                        slept = true;
+                        break;
+                }
+                LOCKPROF_CONTENDED(&w);
+
+                /*
+                 * THE OWNER CAN'T GO AWAY WHILE WE HOLD lk_lock, SO IT IS SAFE TO LOOK
+                 * AT IT. IF IT IS RUNNING (ON ANOTHER CPU, AS IT ISN'T US), POLL THE
+                 * LOCK WITHOUT lk_lock FOR A WHILE, AS IT IS LIKELY TO BE RELEASED SOON
+                 */
+                if (owner->t_state == S_RUN && polls < lock_spinlimit) {
+                        spinlock_release(&lock->lk_lock);
+                        while (lock->lk_owner == owner && polls < lock_spinlimit) {
+                                polls++;
+                                membar_load_load();
+                        }
+                        spinlock_acquire(&lock->lk_lock);
+                }
+                else {
+                        slept = true;
+                        pi_sleep(lock, owner);
+                        wchan_sleep(lock->lk_wchan, &lock->lk_lock);
+                }
+        }
+
+        /* GET LOCK OWNERSHIP, IF NOT HANDED OVER ALREADY */
+        KASSERT(lock->lk_owner == NULL || lock->lk_owner == curthread);
+        lock->lk_owner = curthread;
+        if (curthread->t_piwait == lock) {
+                /* NOT HANDED OVER: STILL LENDING, STOP */
+                pi_handoff(lock, curthread);
+        }
+        LOCKPROF_ACQUIRE(&lock->lk_prof, &w);
+
+        /* COUNTING THE CONTENTION, IF ANY (WE MAY HAVE MOVED TO ANOTHER CPU) */
+        if (contended) {
+                lock->lk_contended++;
+                COUNTER_INC(COUNTER_LOCK_CONTENDED);
+                if (slept) {
+                        lock->lk_slept++;
+                        COUNTER_INC(COUNTER_LOCK_SLEPT);
+                }
+                else {
+                        lock->lk_spun++;
+                        COUNTER_INC(COUNTER_LOCK_SPUN);
+                }
+                counter_add(COUNTER_LOCK_POLLS, polls);
+        }
+
+        /* RELEASING SPINLOCK */
+        spinlock_release(&lock->lk_lock);
+}
+#endif
+
 void
 lock_acquire(struct lock *lock)
 {
 	/* Call this (atomically) before waiting for a lock */
-	//HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
+	HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
 
 #if OPT_SHELL
 
@@ -207,31 +619,48 @@ lock_acquire(struct lock *lock)
         /* BE SURE THE CURRENT THREAD HAS INTERRUPTS DISABLED */
         KASSERT(curthread->t_in_interrupt == false);
 
-        /* ATTEMPT TO ACQUIRE THE SPINLOCK, OTHERWISE SLEEP */
-        spinlock_acquire(&lock->lk_lock); 
-        while (lock->lk_owner != NULL) {
-	        wchan_sleep(lock->lk_wchan, &lock->lk_lock);
-        }
-
-        /* GET LOCK OWNERSHIP */
-        KASSERT(lock->lk_owner == NULL);
-        lock->lk_owner = curthread;
-
-        /* RELEASING SPINLOCK */
-        spinlock_release(&lock->lk_lock);
-
+        lock_get(lock);
 #else 
         (void)lock;  // suppress warning until code gets written
 #endif
 	/* Call this (atomically) once the lock is acquired */
-	//HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
+	HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
+}
+
+#if OPT_SHELL
+bool
+lock_tryacquire(struct lock *lock)
+{
+        bool got = false;
+        LOCKPROF_WAITER(w);
+
+        KASSERT(lock != NULL);
+        KASSERT(lock_do_i_hold(lock) == false);
+
+        LOCKPROF_WAIT(&w);
+
+        spinlock_acquire(&lock->lk_lock);
+        if (lock->lk_owner == NULL) {
+                lock->lk_owner = curthread;
+                LOCKPROF_ACQUIRE(&lock->lk_prof, &w);
+                got = true;
+        }
+        spinlock_release(&lock->lk_lock);
+
+        if (got) {
+                /* NEVER WAITED, SO IT CAN'T CLOSE A CYCLE */
+                HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
+                HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
+        }
+        return got;
 }
+#endif
 
 void
 lock_release(struct lock *lock)
 {
 	/* Call this (atomically) when the lock is released */
-	//HANGMAN_RELEASE(&curthread->t_hangman, &lock->lk_hangman);
+	HANGMAN_RELEASE(&curthread->t_hangman, &lock->lk_hangman);
 
 #if OPT_SHELL
         /* BE SURE THAT LOCK EXISTS*/
@@ -240,12 +669,22 @@ lock_release(struct lock *lock)
         /* BE SURE THAT THE CURRENT THREAD OWNS THE LOCK */
         KASSERT(lock_do_i_hold(lock) == true);
 
-        /* ACQUIRE THE LOCK AND CLEAR THE OWNERSHIP */
+        /*
+         * ACQUIRE THE LOCK AND PASS THE OWNERSHIP TO THE OLDEST SLEEPER, IF
+         * ANY, SO THAT NOBODY CAN BARGE IN BEFORE IT GETS TO RUN (FIFO)
+         */
         spinlock_acquire(&lock->lk_lock);
-        lock->lk_owner = NULL;
+        LOCKPROF_RELEASE(&lock->lk_prof);
+        lock->lk_owner = wchan_wakehead(lock->lk_wchan, &lock->lk_lock);
 
-        /* SIGNALLING THREADS WAITING FOR THE LOCK */
-        wchan_wakeone(lock->lk_wchan, &lock->lk_lock);
+        /*
+         * IF ANYBODY WAS LENDING US ITS NICE VALUE THROUGH THIS LOCK, GIVE IT
+         * BACK AND HAVE THE REMAINING SLEEPERS LEND TO THE NEW OWNER. THE NEW
+         * OWNER CAN'T RUN PAST wchan_sleep WITHOUT lk_lock, SO IT IS SAFE.
+         */
+        if (lock->lk_piowner != NULL) {
+                pi_handoff(lock, (struct thread *) lock->lk_owner);
+        }
 
         /* RELEASING THE LOCK */
         spinlock_release(&lock->lk_lock);
@@ -271,6 +710,27 @@ lock_do_i_hold(struct lock *lock)
         return res; 
 }
 
+/*
+ * Print the contention counters of all locks, summed over the cpus.
+ * They are read without locking, so they may be slightly stale.
+ */
+#if OPT_SHELL
+void
+lock_printstats(void)
+{
+        unsigned contended, polls;
+
+        contended = counter_read(COUNTER_LOCK_CONTENDED);
+        polls = counter_read(COUNTER_LOCK_POLLS);
+        kprintf("lock_acquire: %u calls, %u contended: %u spun, %u slept\n",
+                counter_read(COUNTER_LOCK_ACQUIRES), contended,
+                counter_read(COUNTER_LOCK_SPUN),
+                counter_read(COUNTER_LOCK_SLEPT));
+        kprintf("spin limit %u polls; %u polls in all, %u per contended acquire\n",
+                lock_spinlimit, polls, contended > 0 ? polls / contended : 0);
+}
+#endif
+
 ////////////////////////////////////////////////////////////
 //
 // CV
@@ -281,14 +741,14 @@ cv_create(const char *name)
 {
         struct cv *cv;
 
-        cv = kmalloc(sizeof(*cv));
+        cv = CV_ALLOC();
         if (cv == NULL) {
                 return NULL;
         }
 
         cv->cv_name = kstrdup(name);
         if (cv->cv_name==NULL) {
-                kfree(cv);
+                CV_FREE(cv);
                 return NULL;
         }
 
@@ -297,7 +757,7 @@ cv_create(const char *name)
         cv->cv_wchan = wchan_create(cv->cv_name);
         if (cv->cv_wchan == NULL) {
                 kfree(cv->cv_name);
-                kfree(cv);
+                CV_FREE(cv);
                 return NULL;
         }
 
@@ -319,7 +779,7 @@ cv_destroy(struct cv *cv)
 #endif
 
         kfree(cv->cv_name);
-        kfree(cv);
+        CV_FREE(cv);
 }
 
 void
@@ -348,8 +808,12 @@ cv_wait(struct cv *cv, struct lock *lock)
          * G.Cabodi - 2019: spinlock already  released to avoid ownership while (possibly) going 
          * to wait state in lock_acquire. Atomicity wakeup+lock_acquire not guaranteed (but not 
          * necessary!) 
+         *
+         * IF cv_broadcast MOVED US TO THE LOCK'S WCHAN WE ALREADY OWN IT (SEE lock_get)
         */
-	lock_acquire(lock);
+	HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
+	lock_get(lock);
+	HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
 #endif
         (void)cv;    // suppress warning until code gets written
         (void)lock;  // suppress warning until code gets written
@@ -391,16 +855,183 @@ cv_broadcast(struct cv *cv, struct lock *lock)
         /* ASSERT CURRENT THREAD TO ACTUALLY BE THE OWNER OF THE LOCK */
         KASSERT(lock_do_i_hold(lock));
 
-	/* 
-         * G.Cabodi - 2019: here the spinlock is NOT required, as no atomic operation 
-         * has to be done. The spinlock is just acquired because needed by wakeone 
-        */
-
-        /* ACQUIRING THE LOCK AND WAKING UP THE FIRST THREAD IN THE LIST */
+        /*
+         * WAIT MORPHING: WAKING THEM ALL WOULD ONLY HAVE THEM FIGHT FOR THE LOCK
+         * WE HOLD. MOVE THEM TO THE LOCK'S WCHAN INSTEAD; lock_release THEN HANDS
+         * THE LOCK TO THEM ONE AT A TIME. THIS NEEDS ALL WAITERS ON A CV TO USE
+         * THE SAME LOCK, WHICH IS HOW CVS ARE USED ANYWAY.
+         */
 	spinlock_acquire(&cv->cv_lock);
-	wchan_wakeall(cv->cv_wchan,&cv->cv_lock);
+	spinlock_acquire(&lock->lk_lock);
+	wchan_moveall(cv->cv_wchan, &cv->cv_lock, lock->lk_wchan, &lock->lk_lock);
+	spinlock_release(&lock->lk_lock);
 	spinlock_release(&cv->cv_lock);
 #endif
 	(void)cv;    // suppress warning until code gets written
 	(void)lock;  // suppress warning until code gets written
 }
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+	struct rwlock *rw;
+
+	rw = kmalloc(sizeof(*rw));
+	if (rw == NULL) {
+		return NULL;
+	}
+
+	rw->rw_name = kstrdup(name);
+	if (rw->rw_name == NULL) {
+		goto fail_rw;
+	}
+	rw->rw_readwchan = wchan_create(rw->rw_name);
+	if (rw->rw_readwchan == NULL) {
+		goto fail_name;
+	}
+	rw->rw_writewchan = wchan_create(rw->rw_name);
+	if (rw->rw_writewchan == NULL) {
+		goto fail_readwchan;
+	}
+
+	HANGMAN_LOCKABLEINIT(&rw->rw_hangman, rw->rw_name);
+	spinlock_init(&rw->rw_lock);
+	rw->rw_writer = NULL;
+	rw->rw_readers = 0;
+	rw->rw_readwaiting = 0;
+	rw->rw_writewaiting = 0;
+	rw->rw_readpass = 0;
+
+	return rw;
+
+ fail_readwchan:
+	wchan_destroy(rw->rw_readwchan);
+ fail_name:
+	kfree(rw->rw_name);
+ fail_rw:
+	kfree(rw);
+	return NULL;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(rw->rw_writer == NULL);
+	KASSERT(rw->rw_readers == 0);
+
+	/* wchan_cleanup will assert if anyone's waiting on it */
+	spinlock_cleanup(&rw->rw_lock);
+	wchan_destroy(rw->rw_writewchan);
+	wchan_destroy(rw->rw_readwchan);
+	kfree(rw->rw_name);
+	kfree(rw);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer != curthread);
+
+	/* Wait behind a writer, unless we have been let in */
+	while (rw->rw_writer != NULL ||
+	       (rw->rw_writewaiting > 0 && rw->rw_readpass == 0)) {
+		rw->rw_readwaiting++;
+		wchan_sleep(rw->rw_readwchan, &rw->rw_lock);
+		rw->rw_readwaiting--;
+	}
+	if (rw->rw_readpass > 0) {
+		rw->rw_readpass--;
+	}
+	rw->rw_readers++;
+
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_readers > 0);
+	rw->rw_readers--;
+
+	/* The last reader out hands over to a writer */
+	if (rw->rw_readers == 0 && rw->rw_readpass == 0 &&
+	    rw->rw_writewaiting > 0) {
+		wchan_wakeone(rw->rw_writewchan, &rw->rw_lock);
+	}
+
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer != curthread);
+
+	/* Call this (atomically) before waiting for the lock */
+	HANGMAN_WAIT(&curthread->t_hangman, &rw->rw_hangman);
+
+	rw->rw_writewaiting++;
+	while (rw->rw_writer != NULL || rw->rw_readers > 0 ||
+	       rw->rw_readpass > 0) {
+		wchan_sleep(rw->rw_writewchan, &rw->rw_lock);
+	}
+	rw->rw_writewaiting--;
+	rw->rw_writer = curthread;
+
+	/* Call this (atomically) once the lock is acquired */
+	HANGMAN_ACQUIRE(&curthread->t_hangman, &rw->rw_hangman);
+
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer == curthread);
+	rw->rw_writer = NULL;
+
+	/* Call this (atomically) when the lock is released */
+	HANGMAN_RELEASE(&curthread->t_hangman, &rw->rw_hangman);
+
+	/* The readers already waiting go next, then another writer */
+	if (rw->rw_readwaiting > 0) {
+		rw->rw_readpass = rw->rw_readwaiting;
+		wchan_wakeall(rw->rw_readwchan, &rw->rw_lock);
+	}
+	else if (rw->rw_writewaiting > 0) {
+		wchan_wakeone(rw->rw_writewchan, &rw->rw_lock);
+	}
+
+	spinlock_release(&rw->rw_lock);
+}
+
+bool
+rwlock_do_i_write(struct rwlock *rw)
+{
+	bool ret;
+
+	spinlock_acquire(&rw->rw_lock);
+	ret = rw->rw_writer == curthread;
+	spinlock_release(&rw->rw_lock);
+
+	return ret;
+}
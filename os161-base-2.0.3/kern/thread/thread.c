@@ -35,11 +35,14 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/time.h>
+#include <kern/resource.h>
 #include <lib.h>
 #include <array.h>
 #include <cpu.h>
 #include <spl.h>
 #include <spinlock.h>
+#include <membar.h>
 #include <wchan.h>
 #include <thread.h>
 #include <threadlist.h>
@@ -49,12 +52,66 @@
 #include <synch.h>
 #include <addrspace.h>
 #include <mainbus.h>
+#include <clock.h>
 #include <vnode.h>
+#include <kstat.h>
+
+#if OPT_SHELL
+#include <kmem_cache.h>
+
+/* Thread structures and stacks come from their own object caches. */
+static struct kmem_cache thread_cache =
+	KMEM_CACHE_INITIALIZER("thread", sizeof(struct thread), NULL, NULL);
+static struct kmem_cache stack_cache =
+	KMEM_CACHE_INITIALIZER("thread stack", STACK_SIZE, NULL, NULL);
+
+#define THREAD_ALLOC()		kmem_cache_alloc(&thread_cache)
+#define THREAD_FREE(t)		kmem_cache_free(&thread_cache, (t))
+#define STACK_ALLOC()		kmem_cache_alloc(&stack_cache)
+#define STACK_FREE(s)		kmem_cache_free(&stack_cache, (s))
+#else
+#define THREAD_ALLOC()		kmalloc(sizeof(struct thread))
+#define THREAD_FREE(t)		kfree(t)
+#define STACK_ALLOC()		kmalloc(STACK_SIZE)
+#define STACK_FREE(s)		kfree(s)
+#endif
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
 #define THREAD_STACK_MAGIC 0xbaadf00d
 
+#if OPT_MLFQ
+/*
+ * Multi-level feedback queue. A thread that uses up its quantum drops
+ * a level, where the quantum is twice as long; one that blocks before
+ * that rises a level. A thread that has been kept waiting on the run
+ * queue for MLFQ_AGE calls of schedule() rises a level too, so CPU
+ * hogs cannot be starved for good.
+ */
+#define MLFQ_LEVELS		4			/* Number of levels */
+#define MLFQ_QUANTUM(level)	(1U << (level))		/* In hardclocks */
+#define MLFQ_AGE		8			/* In schedule() calls */
+#endif
+
+/*
+ * Nice values. Below zero, a thread's quantum grows by a whole
+ * quantum for every NICE_STEP (rounding up), so at PRIO_MIN it runs
+ * five times as long a turn. Above zero it waits longer for a turn:
+ * with MLFQ it queues a level lower than its own for every two
+ * NICE_STEPs (and a negative value queues it higher), and with
+ * round-robin it is passed over at the head of the run queue, when
+ * there is anything else to run, once for every NICE_STEP.
+ * Neither starves it: aging still lifts it to the top level, and the
+ * round-robin passes over it only so many times in a row.
+ */
+#define NICE_STEP		5
+#define NICE_QUANTA(nice)	((nice) < 0 ? 1 + (NICE_STEP - 1 - (nice)) / NICE_STEP : 1)
+#if OPT_MLFQ
+#define MLFQ_NICELEVELS(nice)	((nice) / (2 * NICE_STEP))
+#else
+#define NICE_SKIPS(nice)	((nice) > 0 ? (unsigned)((nice) + NICE_STEP - 1) / NICE_STEP : 0U)
+#endif
+
 /* Wait channel. A wchan is protected by an associated, passed-in spinlock. */
 struct wchan {
 	const char *wc_name;		/* name for this channel */
@@ -69,6 +126,9 @@ static struct cpuarray allcpus;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+/* True while the scheduler histograms are being collected. */
+static volatile bool schedhist_on;
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -109,26 +169,18 @@ thread_checkstack(struct thread *thread)
 }
 
 /*
- * Create a thread. This is used both to create a first thread
- * for each CPU and to create subsequent forked threads.
+ * Set up a thread structure, new or recycled, apart from its stack.
+ * Returns ENOMEM if the name can't be copied.
  */
 static
-struct thread *
-thread_create(const char *name)
+int
+thread_init(struct thread *thread, const char *name)
 {
-	struct thread *thread;
-
 	DEBUGASSERT(name != NULL);
 
-	thread = kmalloc(sizeof(*thread));
-	if (thread == NULL) {
-		return NULL;
-	}
-
 	thread->t_name = kstrdup(name);
 	if (thread->t_name == NULL) {
-		kfree(thread);
-		return NULL;
+		return ENOMEM;
 	}
 	thread->t_wchan_name = "NEW";
 	thread->t_state = S_READY;
@@ -136,10 +188,12 @@ thread_create(const char *name)
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
 	threadlistnode_init(&thread->t_listnode, thread);
-	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
+	thread->t_affinity = THREAD_ANYCPU;
+	thread->t_nice = 0;
+	thread->t_boost = PRIO_MAX;
 	HANGMAN_ACTORINIT(&thread->t_hangman, thread->t_name);
 
 	/* Interrupt state fields */
@@ -147,11 +201,237 @@ thread_create(const char *name)
 	thread->t_curspl = IPL_HIGH;
 	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
 
+	thread->t_ticks = 0;
+#if OPT_MLFQ
+	/* New threads start at the top */
+	thread->t_level = 0;
+	thread->t_waits = 0;
+#else
+	thread->t_skips = 0;
+#endif
+	thread->t_readyat = 0;
+	thread->t_runat = 0;
+
 	/* If you add to struct thread, be sure to initialize here */
+#if OPT_SHELL
+	thread->t_uthread = NULL;
+	thread->t_pilocks = NULL;
+	thread->t_piwait = NULL;
+	thread->t_pinext = NULL;
+	thread->t_intr_user = false;
+	thread->t_faults = thread->t_faults_charged = 0;
+	thread->t_majfaults = thread->t_majfaults_charged = 0;
+#endif
+
+	return 0;
+}
+
+/*
+ * Create a thread. This is used both to create a first thread
+ * for each CPU and to create subsequent forked threads.
+ */
+static
+struct thread *
+thread_create(const char *name)
+{
+	struct thread *thread;
+
+	thread = THREAD_ALLOC();
+	if (thread == NULL) {
+		return NULL;
+	}
+	if (thread_init(thread, name)) {
+		THREAD_FREE(thread);
+		return NULL;
+	}
+	thread->t_stack = NULL;
+
+	return thread;
+}
+
+/*
+ * Give back the memory of a thread whose other parts are already
+ * cleaned up.
+ */
+static
+void
+thread_free(struct thread *thread)
+{
+	if (thread->t_stack != NULL) {
+		STACK_FREE(thread->t_stack);
+	}
+	threadlistnode_cleanup(&thread->t_listnode);
+	THREAD_FREE(thread);
+}
+
+#if OPT_SHELL
+/*
+ * Per-cpu pools of dead threads, kept together with their stacks
+ * for thread_fork to use again, so creating a thread costs neither
+ * the allocator nor stamping a fresh stack. exorcise fills the pool
+ * of its cpu, up to THREAD_POOL_MAX; thread_fork takes from its own
+ * cpu's pool. The stack guard band is checked on the way in, so a
+ * recycled stack still has its magic numbers. thread_reclaim empties
+ * every pool when the page allocator runs dry.
+ */
+#define THREAD_POOL_MAX 4
+
+/*
+ * Zombies are not destroyed in the tail of every context switch, as
+ * that would put the allocator on the switch path during a storm of
+ * exits. They wait on their cpu's list until it goes idle, which
+ * destroys them all (filling the pool first); a cpu that never idles
+ * keeps at most ZOMBIE_MAX of them and destroys one per switch past
+ * that.
+ */
+#define ZOMBIE_MAX 16
+
+static void exorcise(unsigned keep);
+
+/*
+ * Put a dead thread, which must have a stack, in the pool of the
+ * current cpu. Returns false if the pool is full.
+ */
+static
+bool
+thread_pool_put(struct thread *thread)
+{
+	struct cpu *c;
+	bool kept;
+
+	if (thread->t_stack == NULL) {
+		return false;
+	}
+	thread_checkstack(thread);
+
+	c = curcpu->c_self;
+	spinlock_acquire(&c->c_threadpool_lock);
+	kept = c->c_threadpool.tl_count < THREAD_POOL_MAX;
+	if (kept) {
+		threadlist_addhead(&c->c_threadpool, thread);
+	}
+	spinlock_release(&c->c_threadpool_lock);
+
+	return kept;
+}
+
+/*
+ * Take a thread from the pool of the current cpu and set it up with
+ * name NAME. It comes with its stack. Returns NULL if there is none.
+ */
+static
+struct thread *
+thread_pool_get(const char *name)
+{
+	struct cpu *c;
+	struct thread *thread;
+	void *stack;
+
+	c = curcpu->c_self;
+	spinlock_acquire(&c->c_threadpool_lock);
+	thread = threadlist_remhead(&c->c_threadpool);
+	spinlock_release(&c->c_threadpool_lock);
+	if (thread == NULL) {
+		return NULL;
+	}
+
+	stack = thread->t_stack;
+	if (thread_init(thread, name)) {
+		thread_free(thread);
+		return NULL;
+	}
+	thread->t_stack = stack;
 
 	return thread;
 }
 
+/*
+ * Release the pooled threads of all cpus, and the memory the thread
+ * and stack caches keep spare. Returns the number of pages given
+ * back. Called when kernel memory runs out.
+ */
+unsigned
+thread_reclaim(void)
+{
+	struct threadlist dead;
+	struct thread *thread;
+	struct cpu *c;
+	unsigned i, numcpus;
+	int spl;
+
+	/* Our own zombies first; those of other cpus can't be touched */
+	spl = splhigh();
+	exorcise(0);
+	splx(spl);
+
+	threadlist_init(&dead);
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		spinlock_acquire(&c->c_threadpool_lock);
+		while ((thread = threadlist_remhead(&c->c_threadpool)) != NULL) {
+			threadlist_addtail(&dead, thread);
+		}
+		spinlock_release(&c->c_threadpool_lock);
+	}
+	while ((thread = threadlist_remhead(&dead)) != NULL) {
+		thread_free(thread);
+	}
+	threadlist_cleanup(&dead);
+
+	return kmem_cache_reap(&stack_cache) + kmem_cache_reap(&thread_cache);
+}
+#endif
+
+/*
+ * The idle thread of a cpu. It never goes on a run queue; thread_switch
+ * switches to it when the thread it is switching away from can't
+ * stay on the cpu (see thread_relocate) and there's nothing else to
+ * run, because an idle cpu sits on the stack of the last thread that
+ * ran, and that thread has to be free to move.
+ */
+static
+void
+thread_idle(void *data1, unsigned long data2)
+{
+	(void)data1;
+	(void)data2;
+
+	for (;;) {
+		thread_yield();
+	}
+}
+
+static
+void
+thread_idle_create(struct cpu *c)
+{
+	struct thread *t;
+	int result;
+
+	t = thread_create("<idle>");
+	if (t == NULL) {
+		panic("cpu_create: thread_create failed\n");
+	}
+	t->t_stack = STACK_ALLOC();
+	if (t->t_stack == NULL) {
+		panic("cpu_create: couldn't allocate stack");
+	}
+	thread_checkstack_init(t);
+	t->t_cpu = c;
+
+	result = proc_addthread(kproc, t);
+	if (result) {
+		panic("cpu_create: proc_addthread:: %s\n", strerror(result));
+	}
+
+	/* As in thread_fork */
+	t->t_iplhigh_count++;
+	switchframe_init(t, thread_idle, NULL, 0);
+
+	c->c_idlethread = t;
+}
+
 /*
  * Create a CPU structure. This is used for the bootup CPU and
  * also for secondary CPUs.
@@ -166,19 +446,42 @@ cpu_create(unsigned hardware_number)
 	struct cpu *c;
 	int result;
 	char namebuf[16];
+	unsigned i;
 
 	c = kmalloc(sizeof(*c));
 	if (c == NULL) {
 		panic("cpu_create: Out of memory\n");
 	}
+	/*
+	 * kmalloc aligns blocks to their size (unless debugging with
+	 * GUARDS or LABELS), so the cache line groups line up.
+	 */
 
 	c->c_self = c;
 	c->c_hardware_number = hardware_number;
 
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
-	c->c_hardclocks = 0;
+	pqueue_init(&c->c_timers);
+	spinlock_init(&c->c_timers_lock);
+	c->c_nexttick = 0;
+	for (i=0; i<NCOUNTERS; i++) {
+		c->c_counters[i] = 0;
+	}
+	for (i=0; i<SCHEDHIST_BUCKETS; i++) {
+		c->c_waithist[i] = 0;
+		c->c_slicehist[i] = 0;
+	}
+	for (i=0; i<SCHEDHIST_RQLEN; i++) {
+		c->c_rqhist[i] = 0;
+	}
 	c->c_spinlocks = 0;
+	c->c_idlethread = NULL;
+	c->c_leaving = NULL;
+#if OPT_SHELL
+	threadlist_init(&c->c_threadpool);
+	spinlock_init(&c->c_threadpool_lock);
+#endif
 
 	c->c_isidle = false;
 	threadlist_init(&c->c_runqueue);
@@ -210,7 +513,7 @@ cpu_create(unsigned hardware_number)
 		/*c->c_curthread->t_stack = ... */
 	}
 	else {
-		c->c_curthread->t_stack = kmalloc(STACK_SIZE);
+		c->c_curthread->t_stack = STACK_ALLOC();
 		if (c->c_curthread->t_stack == NULL) {
 			panic("cpu_create: couldn't allocate stack");
 		}
@@ -249,9 +552,20 @@ cpu_create(unsigned hardware_number)
 
 	cpu_machdep_init(c);
 
+	thread_idle_create(c);
+
 	return c;
 }
 
+/*
+ * Number of cpus created so far; cpus are numbered 0 to this minus 1.
+ */
+unsigned
+cpu_count(void)
+{
+	return cpuarray_num(&allcpus);
+}
+
 /*
  * Destroy a thread.
  *
@@ -274,32 +588,38 @@ thread_destroy(struct thread *thread)
 
 	/* Thread subsystem fields */
 	KASSERT(thread->t_proc == NULL);
-	if (thread->t_stack != NULL) {
-		kfree(thread->t_stack);
-	}
-	threadlistnode_cleanup(&thread->t_listnode);
 	thread_machdep_cleanup(&thread->t_machdep);
 
 	/* sheer paranoia */
 	thread->t_wchan_name = "DESTROYED";
 
 	kfree(thread->t_name);
-	kfree(thread);
+	thread->t_name = NULL;
+
+#if OPT_SHELL
+	/* Keep it, with its stack, for the next thread_fork */
+	if (thread_pool_put(thread)) {
+		return;
+	}
+#endif
+	thread_free(thread);
 }
 
 /*
  * Clean up zombies. (Zombies are threads that have exited but still
- * need to have thread_destroy called on them.)
+ * need to have thread_destroy called on them.) The oldest go first,
+ * until only KEEP are left.
  *
- * The list of zombies is per-cpu.
+ * The list of zombies is per-cpu; interrupts must be off.
  */
 static
 void
-exorcise(void)
+exorcise(unsigned keep)
 {
 	struct thread *z;
 
-	while ((z = threadlist_remhead(&curcpu->c_zombies)) != NULL) {
+	while (curcpu->c_zombies.tl_count > keep) {
+		z = threadlist_remhead(&curcpu->c_zombies);
 		KASSERT(z != curthread);
 		KASSERT(z->t_state == S_ZOMBIE);
 		thread_destroy(z);
@@ -398,8 +718,8 @@ thread_bootstrap(void)
  * New CPUs come here once MD initialization is finished. curthread
  * and curcpu should already be initialized.
  *
- * Other than clearing thread_start_cpus() to continue, we don't need
- * to do anything. The startup thread can just exit; we only need it
+ * Other than letting thread_wait_cpus() know, we don't need to do
+ * anything. The startup thread can just exit; we only need it
  * to be able to get into thread_switch() properly.
  */
 void
@@ -427,14 +747,28 @@ void
 thread_start_cpus(void)
 {
 	char buf[64];
-	unsigned i;
 
 	cpu_identify(buf, sizeof(buf));
 	kprintf("cpu0: %s\n", buf);
 
 	cpu_startup_sem = sem_create("cpu_hatch", 0);
+	if (cpu_startup_sem == NULL) {
+		panic("thread_start_cpus: Out of memory\n");
+	}
 	mainbus_start_cpus();
+}
+
+/*
+ * Wait until all the CPUs started by thread_start_cpus have hatched.
+ * They all start at once and hatch in parallel, so this is the one
+ * barrier for all of them.
+ */
+void
+thread_wait_cpus(void)
+{
+	unsigned i;
 
+	KASSERT(cpu_startup_sem != NULL);
 	for (i=0; i<cpuarray_num(&allcpus) - 1; i++) {
 		P(cpu_startup_sem);
 	}
@@ -443,75 +777,294 @@ thread_start_cpus(void)
 }
 
 /*
- * Make a thread runnable.
+ * Hardclocks in a full quantum of thread T.
+ */
+static
+unsigned
+thread_quantum(struct thread *t)
+{
+#if OPT_MLFQ
+	return MLFQ_QUANTUM(t->t_level) * NICE_QUANTA(thread_effnice(t));
+#else
+	return NICE_QUANTA(thread_effnice(t));
+#endif
+}
+
+#if OPT_MLFQ
+/*
+ * The level thread T waits at: its own, shifted by its nice value.
+ */
+static
+int
+thread_rank(struct thread *t)
+{
+	return (int)t->t_level + MLFQ_NICELEVELS(thread_effnice(t));
+}
+#endif
+
+/*
+ * Put a ready thread on the run queue of cpu C, which must be locked.
  *
- * targetcpu might be curcpu; it might not be, too.
+ * With the MLFQ scheduler the run queue is kept sorted by rank, the
+ * highest priority first and in FIFO order within a rank, so the
+ * next thread to run is always at the head, and the ones at the tail
+ * are the first to migrate.
  */
 static
 void
-thread_make_runnable(struct thread *target, bool already_have_lock)
+thread_enqueue(struct cpu *c, struct thread *t)
 {
-	struct cpu *targetcpu;
+#if OPT_MLFQ
+	struct thread *t2;
+	int rank;
 
-	/* Lock the run queue of the target thread's cpu. */
-	targetcpu = target->t_cpu;
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
 
-	if (already_have_lock) {
-		/* The target thread's cpu should be already locked. */
-		KASSERT(spinlock_do_i_hold(&targetcpu->c_runqueue_lock));
-	}
-	else {
-		spinlock_acquire(&targetcpu->c_runqueue_lock);
+	rank = thread_rank(t);
+	THREADLIST_FORALL_REV(t2, c->c_runqueue) {
+		if (thread_rank(t2) <= rank) {
+			threadlist_insertafter(&c->c_runqueue, t2, t);
+			return;
+		}
 	}
+	threadlist_addhead(&c->c_runqueue, t);
+#else
+	threadlist_addtail(&c->c_runqueue, t);
+#endif
+}
 
-	/* Target thread is now ready to run; put it on the run queue. */
-	target->t_state = S_READY;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+/*
+ * True if thread T may run on cpu C.
+ */
+static
+bool
+thread_allowed(struct thread *t, struct cpu *c)
+{
+	return (t->t_affinity & ((uint32_t)1 << c->c_number)) != 0;
+}
 
-	if (targetcpu->c_isidle && targetcpu != curcpu->c_self) {
-		/*
-		 * Other processor is idle; send interrupt to make
-		 * sure it unidles.
-		 */
-		ipi_send(targetcpu, IPI_UNIDLE);
-	}
+/*
+ * Choose a cpu for thread T among those its affinity allows: the one
+ * with the fewest threads waiting to run. The counts are read
+ * without the locks, as a hint.
+ */
+static
+struct cpu *
+thread_pickcpu(struct thread *t)
+{
+	struct cpu *c, *best;
+	unsigned i, numcpus;
 
-	if (!already_have_lock) {
-		spinlock_release(&targetcpu->c_runqueue_lock);
+	best = NULL;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (thread_allowed(t, c) && (best == NULL ||
+		    c->c_runqueue.tl_count < best->c_runqueue.tl_count)) {
+			best = c;
+		}
 	}
+	KASSERT(best != NULL);
+	return best;
 }
 
 /*
- * Create a new thread based on an existing one.
- *
- * The new thread has name NAME, and starts executing in function
- * ENTRYPOINT. DATA1 and DATA2 are passed to ENTRYPOINT.
- *
- * The new thread is created in the process P. If P is null, the
- * process is inherited from the caller. It will start on the same CPU
- * as the caller, unless the scheduler intervenes first.
+ * Wake up one idle cpu, other than TARGETCPU and ourselves, that
+ * thread T may run on, so it comes and steals T. The idle flags are
+ * read without the locks, as a hint: a cpu that just stopped idling
+ * finds little or nothing to steal, and that's all.
  */
-int
-thread_fork(const char *name,
-	    struct proc *proc,
-	    void (*entrypoint)(void *data1, unsigned long data2),
-	    void *data1, unsigned long data2)
+static
+void
+thread_kick_idle(struct thread *t, struct cpu *targetcpu)
 {
-	struct thread *newthread;
-	int result;
+	struct cpu *c;
+	unsigned i, numcpus;
 
-	newthread = thread_create(name);
-	if (newthread == NULL) {
-		return ENOMEM;
-	}
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != targetcpu && c != curcpu->c_self && c->c_isidle &&
+		    thread_allowed(t, c)) {
+			ipi_send(c, IPI_UNIDLE);
+			return;
+		}
+	}
+}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
-	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
+/*
+ * Count NSECS in a log2 histogram of microseconds: bucket 0 is under
+ * 2 usecs, bucket B is 2^B to 2^(B+1)-1, and the last bucket takes
+ * anything longer.
+ */
+static
+void
+schedhist_add(unsigned *hist, uint64_t nsecs)
+{
+	uint64_t usecs;
+	unsigned b;
+
+	usecs = nsecs / 1000;
+	for (b=0; usecs > 1 && b < SCHEDHIST_BUCKETS - 1; b++) {
+		usecs >>= 1;
+	}
+	hist[b]++;
+}
+
+/*
+ * Scheduler histograms for a switch from CUR to NEXT: how long CUR
+ * ran, and how long NEXT waited since thread_make_runnable. Either
+ * time is skipped if it began before collecting did. Called by
+ * thread_switch with interrupts off, so nothing else on this cpu
+ * touches the histograms meanwhile.
+ */
+static
+void
+schedhist_switch(struct thread *cur, struct thread *next)
+{
+	uint64_t now;
+
+	now = clock_monotonic();
+	if (cur != curcpu->c_idlethread && cur->t_runat != 0) {
+		schedhist_add(curcpu->c_slicehist, now - cur->t_runat);
+	}
+	if (next->t_readyat != 0) {
+		schedhist_add(curcpu->c_waithist, now - next->t_readyat);
+		next->t_readyat = 0;
+	}
+	next->t_runat = now;
+}
+
+/*
+ * Make a thread runnable.
+ *
+ * targetcpu might be curcpu; it might not be, too. It is the cpu the
+ * thread last ran on, unless the thread's affinity no longer allows
+ * that one.
+ */
+static
+void
+thread_make_runnable(struct thread *target, bool already_have_lock)
+{
+	struct cpu *targetcpu;
+	bool moveok;
+
+	targetcpu = target->t_cpu;
+
+	if (!already_have_lock && !thread_allowed(target, targetcpu)) {
+		/*
+		 * Move it, unless the old cpu is still idling on its
+		 * stack, in which case it has to go back there first
+		 * and gets moved when it next yields. (c_curthread only
+		 * changes with the run queue lock held.)
+		 */
+		spinlock_acquire(&targetcpu->c_runqueue_lock);
+		moveok = targetcpu->c_curthread != target;
+		spinlock_release(&targetcpu->c_runqueue_lock);
+		if (moveok) {
+			targetcpu = thread_pickcpu(target);
+			target->t_cpu = targetcpu;
+		}
+	}
+
+	/* Lock the run queue of the target thread's cpu. */
+	if (already_have_lock) {
+		/* The target thread's cpu should be already locked. */
+		KASSERT(spinlock_do_i_hold(&targetcpu->c_runqueue_lock));
+	}
+	else {
+		spinlock_acquire(&targetcpu->c_runqueue_lock);
+	}
+
+	/* Target thread is now ready to run; put it on the run queue. */
+	target->t_state = S_READY;
+	target->t_readyat = schedhist_on ? clock_monotonic() : 0;
+	thread_enqueue(targetcpu, target);
+
+	if (targetcpu->c_isidle) {
+		if (targetcpu != curcpu->c_self) {
+			/*
+			 * Other processor is idle; send interrupt to
+			 * make sure it unidles.
+			 */
+			ipi_send(targetcpu, IPI_UNIDLE);
+		}
+	}
+	else if (!already_have_lock) {
+		/*
+		 * It has to wait for the thread running there. If a
+		 * cpu is idle, wake it up instead to steal it.
+		 */
+		thread_kick_idle(target, targetcpu);
+	}
+
+	if (!already_have_lock) {
+		spinlock_release(&targetcpu->c_runqueue_lock);
+	}
+}
+
+/*
+ * Put the thread thread_switch just switched away from, because its
+ * affinity no longer allows this cpu, on the run queue of one it
+ * allows. This has to wait until we're off its stack, like freeing
+ * a zombie.
+ */
+static
+void
+thread_relocate(void)
+{
+	struct thread *t;
+
+	t = curcpu->c_leaving;
+	if (t == NULL) {
+		return;
+	}
+	curcpu->c_leaving = NULL;
+
+	KASSERT(t != curthread);
+	KASSERT(t->t_state == S_READY);
+	thread_make_runnable(t, false);
+}
+
+/*
+ * Create a new thread based on an existing one.
+ *
+ * The new thread has name NAME, and starts executing in function
+ * ENTRYPOINT. DATA1 and DATA2 are passed to ENTRYPOINT.
+ *
+ * The new thread is created in the process P. If P is null, the
+ * process is inherited from the caller. It will start on the same CPU
+ * as the caller, unless the scheduler intervenes first.
+ */
+int
+thread_fork(const char *name,
+	    struct proc *proc,
+	    void (*entrypoint)(void *data1, unsigned long data2),
+	    void *data1, unsigned long data2)
+{
+	struct thread *newthread;
+	int result;
+
+#if OPT_SHELL
+	/* A recycled thread already has a stack */
+	newthread = thread_pool_get(name);
+#else
+	newthread = NULL;
+#endif
+	if (newthread == NULL) {
+		newthread = thread_create(name);
+		if (newthread == NULL) {
+			return ENOMEM;
+		}
+
+		/* Allocate a stack */
+		newthread->t_stack = STACK_ALLOC();
+		if (newthread->t_stack == NULL) {
+			thread_destroy(newthread);
+			return ENOMEM;
+		}
+		thread_checkstack_init(newthread);
 	}
-	thread_checkstack_init(newthread);
 
 	/*
 	 * Now we clone various fields from the parent thread.
@@ -519,6 +1072,8 @@ thread_fork(const char *name,
 
 	/* Thread subsystem fields */
 	newthread->t_cpu = curthread->t_cpu;
+	newthread->t_affinity = curthread->t_affinity;
+	newthread->t_nice = curthread->t_nice;
 
 	/* Attach the new thread to its process */
 	if (proc == NULL) {
@@ -547,6 +1102,8 @@ thread_fork(const char *name,
 	return 0;
 }
 
+static unsigned thread_steal(void);
+
 /*
  * High level, machine-independent context switch code.
  *
@@ -562,6 +1119,9 @@ void
 thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 {
 	struct thread *cur, *next;
+#if !OPT_MLFQ
+	unsigned skips;
+#endif
 	int spl;
 
 	DEBUGASSERT(curcpu->c_curthread == curthread);
@@ -587,8 +1147,12 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* Lock the run queue. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
-	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	/*
+	 * Micro-optimization: if nothing to do, just return. (Unless
+	 * we're the idle thread, or have to leave this cpu.)
+	 */
+	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue) &&
+	    cur != curcpu->c_idlethread && thread_allowed(cur, curcpu)) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
@@ -599,9 +1163,31 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	    case S_RUN:
 		panic("Illegal S_RUN in thread_switch\n");
 	    case S_READY:
-		thread_make_runnable(cur, true /*have lock*/);
+		if (cur == curcpu->c_idlethread) {
+			/* The idle thread stays off the run queue */
+		}
+		else if (!thread_allowed(cur, curcpu)) {
+			/*
+			 * Its affinity has changed. It can't go on
+			 * another cpu's run queue while we're still on
+			 * its stack; thread_relocate moves it once
+			 * we've switched away.
+			 */
+			KASSERT(curcpu->c_leaving == NULL);
+			curcpu->c_leaving = cur;
+		}
+		else {
+			thread_make_runnable(cur, true /*have lock*/);
+		}
 		break;
 	    case S_SLEEP:
+#if OPT_MLFQ
+		/* Blocking before the quantum is used up earns a level */
+		if (cur->t_level > 0) {
+			cur->t_level--;
+		}
+#endif
+		cur->t_ticks = 0;
 		cur->t_wchan_name = wc->wc_name;
 		/*
 		 * Add the thread to the list in the wait channel, and
@@ -622,7 +1208,10 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	cur->t_state = newstate;
 
 	/*
-	 * Get the next thread. While there isn't one, call cpu_idle().
+	 * Get the next thread. While there isn't one, try to steal one
+	 * from another cpu, and failing that idle; but if
+	 * the current thread is leaving, run the idle thread instead,
+	 * to get off its stack.
 	 * curcpu->c_isidle must be true when cpu_idle is
 	 * called. Unlock the runqueue while idling too, to make sure
 	 * things can be added to it.
@@ -633,22 +1222,66 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	 * interrupt from another cpu posting a wakeup) and idling
 	 * *is* atomic with respect to re-enabling interrupts.
 	 *
-	 * Note that c_isidle becomes true briefly even if we don't go
-	 * idle. However, because one is supposed to hold the runqueue
-	 * lock to look at it, this should not be visible or matter.
+	 * c_isidle is the handshake with the threads that wake others
+	 * up: it becomes true, with the run queue locked, only once
+	 * the queue has been found empty, and thread_make_runnable
+	 * sends IPI_UNIDLE only when it sees it true. So an IPI goes
+	 * out exactly when the target may be on its way into
+	 * cpu_idle, and if it arrives before we get there cpu_idle
+	 * returns at once, as the interrupt is pending. Once set,
+	 * c_isidle stays true until we have a thread again.
 	 */
-
-	/* The current cpu is now idle. */
-	curcpu->c_isidle = true;
 	do {
 		next = threadlist_remhead(&curcpu->c_runqueue);
-		if (next == NULL) {
+		if (next == NULL && curcpu->c_leaving != NULL) {
+			next = curcpu->c_idlethread;
+		}
+		else if (next == NULL) {
+			/* The current cpu is now idle. */
+			curcpu->c_isidle = true;
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			/* Before idling, look for work elsewhere */
+			if (thread_steal() == 0) {
+#if OPT_SHELL
+				/*
+				 * Nothing to do, so clean up the
+				 * zombies, except the current thread
+				 * if it is the one just added.
+				 */
+				exorcise(cur->t_state == S_ZOMBIE ? 1 : 0);
+#endif
+				hardclock_idle();
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
 	curcpu->c_isidle = false;
+#if OPT_MLFQ
+	next->t_waits = 0;
+#else
+	/*
+	 * A niced thread lets the others go first, a few times. Its
+	 * skips are worked out once for each thread taken off the queue.
+	 */
+	skips = NICE_SKIPS(thread_effnice(next));
+	while (next->t_skips < skips &&
+	       !threadlist_isempty(&curcpu->c_runqueue)) {
+		next->t_skips++;
+		threadlist_addtail(&curcpu->c_runqueue, next);
+		next = threadlist_remhead(&curcpu->c_runqueue);
+		skips = NICE_SKIPS(thread_effnice(next));
+	}
+	next->t_skips = 0;
+#endif
+	if (next != cur) {
+		COUNTER_INC(COUNTER_SWITCHES);
+		if (schedhist_on) {
+			schedhist_switch(cur, next);
+		}
+		else {
+			next->t_runat = 0;
+		}
+	}
 
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
@@ -717,11 +1350,18 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* Unlock the run queue. */
 	spinlock_release(&curcpu->c_runqueue_lock);
 
+	/* Send off the thread we switched away from, if it's leaving. */
+	thread_relocate();
+
 	/* Activate our address space in the MMU. */
 	as_activate();
 
-	/* Clean up dead threads. */
-	exorcise();
+	/* Clean up dead threads, if too many are waiting. */
+#if OPT_SHELL
+	exorcise(ZOMBIE_MAX);
+#else
+	exorcise(0);
+#endif
 
 	/* Turn interrupts back on. */
 	splx(spl);
@@ -750,11 +1390,18 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
 	/* Release the runqueue lock acquired in thread_switch. */
 	spinlock_release(&curcpu->c_runqueue_lock);
 
+	/* Send off the thread we switched away from, if it's leaving. */
+	thread_relocate();
+
 	/* Activate our address space in the MMU. */
 	as_activate();
 
-	/* Clean up dead threads. */
-	exorcise();
+	/* Clean up dead threads, if too many are waiting. */
+#if OPT_SHELL
+	exorcise(ZOMBIE_MAX);
+#else
+	exorcise(0);
+#endif
 
 	/* Enable interrupts. */
 	spl0();
@@ -824,6 +1471,83 @@ thread_yield(void)
  * the current CPU's run queue by job priority.
  */
 
+#if OPT_MLFQ
+/*
+ * Age the threads waiting on the current CPU's run queue: those that
+ * have waited MLFQ_AGE rounds go up a level. If any did, sort the
+ * queue again.
+ */
+void
+schedule(void)
+{
+	struct threadlist promoted;
+	struct thread *t, *tnext;
+
+	threadlist_init(&promoted);
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+
+	for (t = curcpu->c_runqueue.tl_head.tln_next->tln_self;
+	     t != NULL; t = tnext) {
+		tnext = t->t_listnode.tln_next->tln_self;
+		if (t->t_level == 0 || ++t->t_waits < MLFQ_AGE) {
+			continue;
+		}
+		t->t_level--;
+		t->t_waits = 0;
+		threadlist_remove(&curcpu->c_runqueue, t);
+		threadlist_addtail(&promoted, t);
+	}
+	while ((t = threadlist_remhead(&promoted)) != NULL) {
+		thread_enqueue(curcpu->c_self, t);
+	}
+
+	spinlock_release(&curcpu->c_runqueue_lock);
+	threadlist_cleanup(&promoted);
+}
+
+/*
+ * Charge a hardclock to the current thread. If its quantum is used
+ * up, it drops a level (and yields to its peers); otherwise it goes
+ * on running unless a thread of a higher level is waiting.
+ */
+void
+thread_tick(void)
+{
+	struct thread *cur = curthread;
+	struct thread *head;
+	bool preempt;
+
+	/*
+	 * If we're idle, the current thread is asleep; leave it be.
+	 * (We're in the timer interrupt, so interrupts are off.)
+	 */
+	if (curcpu->c_isidle) {
+		return;
+	}
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	if (++cur->t_ticks >= thread_quantum(cur)) {
+		if (cur->t_level < MLFQ_LEVELS - 1) {
+			cur->t_level++;
+		}
+		cur->t_ticks = 0;
+		preempt = true;
+	}
+	else {
+		head = curcpu->c_runqueue.tl_head.tln_next->tln_self;
+		preempt = head != NULL && thread_rank(head) < thread_rank(cur);
+	}
+	if (!thread_allowed(cur, curcpu)) {
+		/* Its affinity has changed; get it moved */
+		preempt = true;
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	if (preempt) {
+		thread_yield();
+	}
+}
+#else
 void
 schedule(void)
 {
@@ -833,12 +1557,41 @@ schedule(void)
 	 */
 }
 
+/*
+ * Charge a hardclock to the current thread, and yield once its
+ * quantum is used up.
+ */
+void
+thread_tick(void)
+{
+	struct thread *cur = curthread;
+	bool preempt;
+
+	if (curcpu->c_isidle) {
+		return;
+	}
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	preempt = ++cur->t_ticks >= thread_quantum(cur) ||
+		!thread_allowed(cur, curcpu);
+	if (preempt) {
+		cur->t_ticks = 0;
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	if (preempt) {
+		thread_yield();
+	}
+}
+#endif
+
 /*
  * Thread migration.
  *
- * This is also called periodically from hardclock(). If the current
- * CPU is busy and other CPUs are idle, or less busy, it should move
- * threads across to those other other CPUs.
+ * Migration is pull-based: a CPU takes work from the busiest of its
+ * peers (work stealing) when it is about to go idle in thread_switch,
+ * and from hardclock(), which calls thread_consider_migration on
+ * every tick while idle and periodically otherwise.
  *
  * Migrating threads isn't free because of cache affinity; a thread's
  * working cache set will end up having to be moved to the other CPU,
@@ -850,109 +1603,222 @@ schedule(void)
  * System/161 does not (yet) model such cache effects, we'll be very
  * aggressive.
  */
-void
-thread_consider_migration(void)
+
+/*
+ * Steal threads from the peer with the most of them waiting to run,
+ * enough to even out the load between it and us. The peers' run
+ * queue counts are read without their locks, as a hint; only the
+ * victim's lock is taken, to move the threads off its run queue, and
+ * then our own, to put them on ours, never both at once.
+ *
+ * Call with interrupts off and the current cpu's run queue unlocked.
+ * Returns the number of threads taken.
+ */
+static
+unsigned
+thread_steal(void)
 {
-	unsigned my_count, total_count, one_share, to_send;
-	unsigned i, numcpus;
-	struct cpu *c;
-	struct threadlist victims;
-	struct thread *t;
+	struct cpu *c, *victim;
+	struct threadlist stolen;
+	struct thread *t, *tprev;
+	unsigned i, numcpus, mine, most, myload, n;
 
-	my_count = total_count = 0;
+	KASSERT(curthread->t_curspl > 0);
+
+	mine = curcpu->c_runqueue.tl_count;
+	most = 0;
+	victim = NULL;
 	numcpus = cpuarray_num(&allcpus);
 	for (i=0; i<numcpus; i++) {
 		c = cpuarray_get(&allcpus, i);
-		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
-		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
+		if (c != curcpu->c_self && c->c_runqueue.tl_count > most) {
+			most = c->c_runqueue.tl_count;
+			victim = c;
 		}
-		spinlock_release(&c->c_runqueue_lock);
 	}
 
-	one_share = DIVROUNDUP(total_count, numcpus);
-	if (my_count < one_share) {
-		return;
+	/* Loads count the thread running, unless the cpu is idle */
+	myload = mine + (curcpu->c_isidle ? 0 : 1);
+	if (victim == NULL || most + 1 < myload + 2) {
+		return 0;
 	}
 
-	to_send = my_count - one_share;
-	threadlist_init(&victims);
-	spinlock_acquire(&curcpu->c_runqueue_lock);
-	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
-		threadlist_addhead(&victims, t);
+	threadlist_init(&stolen);
+	spinlock_acquire(&victim->c_runqueue_lock);
+	n = 0;
+	t = victim->c_runqueue.tl_tail.tln_prev->tln_self;
+	while (t != NULL &&
+	       victim->c_runqueue.tl_count + 1 >= myload + n + 2) {
+		tprev = t->t_listnode.tln_prev->tln_self;
+		/*
+		 * Ordinarily, the victim's curthread will not appear on
+		 * its run queue. However, it can under the following
+		 * circumstances:
+		 *   - it went to sleep;
+		 *   - the processor became idle, so it remained
+		 *     curthread;
+		 *   - it was reawakened, so it was put on the run queue;
+		 *   - and the processor hasn't fully unidled yet, so all
+		 *     these things are still true.
+		 *
+		 * *Migrating* that thread can cause bad things to happen
+		 * (Exercise: Why? And what?) so leave it, and stop.
+		 */
+		if (t == victim->c_curthread) {
+			break;
+		}
+		/* Pass over the threads not allowed to run here */
+		if (thread_allowed(t, curcpu->c_self)) {
+			threadlist_remove(&victim->c_runqueue, t);
+			t->t_cpu = curcpu->c_self;
+			threadlist_addtail(&stolen, t);
+			n++;
+		}
+		t = tprev;
 	}
-	spinlock_release(&curcpu->c_runqueue_lock);
+	spinlock_release(&victim->c_runqueue_lock);
 
-	for (i=0; i < numcpus && to_send > 0; i++) {
-		c = cpuarray_get(&allcpus, i);
-		if (c == curcpu->c_self) {
-			continue;
+	if (n > 0) {
+		DEBUG(DB_THREADS, "Stole %u threads: cpu %u -> %u",
+		      n, victim->c_number, curcpu->c_number);
+		counter_add(COUNTER_STOLEN, n);
+		spinlock_acquire(&curcpu->c_runqueue_lock);
+		while ((t = threadlist_remhead(&stolen)) != NULL) {
+			thread_enqueue(curcpu->c_self, t);
 		}
-		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
-			t = threadlist_remhead(&victims);
-			/*
-			 * Ordinarily, curthread will not appear on
-			 * the run queue. However, it can under the
-			 * following circumstances:
-			 *   - it went to sleep;
-			 *   - the processor became idle, so it
-			 *     remained curthread;
-			 *   - it was reawakened, so it was put on the
-			 *     run queue;
-			 *   - and the processor hasn't fully unidled
-			 *     yet, so all these things are still true.
-			 *
-			 * If the timer interrupt happens at (almost)
-			 * exactly the proper moment, we can come here
-			 * while things are in this state and see
-			 * curthread. However, *migrating* curthread
-			 * can cause bad things to happen (Exercise:
-			 * Why? And what?) so shuffle it to the end of
-			 * the list and decrement to_send in order to
-			 * skip it. Then it goes back on our own run
-			 * queue below.
-			 */
-			if (t == curthread) {
-				threadlist_addtail(&victims, t);
-				to_send--;
-				continue;
-			}
+		spinlock_release(&curcpu->c_runqueue_lock);
+	}
+	threadlist_cleanup(&stolen);
 
-			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
-			DEBUG(DB_THREADS,
-			      "Migrated thread %s: cpu %u -> %u",
-			      t->t_name, curcpu->c_number, c->c_number);
-			to_send--;
-			if (c->c_isidle) {
-				/*
-				 * Other processor is idle; send
-				 * interrupt to make sure it unidles.
-				 */
-				ipi_send(c, IPI_UNIDLE);
-			}
+	return n;
+}
+
+/*
+ * Even out the load with our peers, by stealing from the busiest.
+ * Called from hardclock().
+ */
+void
+thread_consider_migration(void)
+{
+	thread_steal();
+}
+
+/*
+ * Mask of the cpus in the system.
+ */
+uint32_t
+thread_cpumask(void)
+{
+	unsigned numcpus;
+
+	numcpus = cpuarray_num(&allcpus);
+	KASSERT(numcpus <= 32);
+	return numcpus == 32 ? THREAD_ANYCPU : ((uint32_t)1 << numcpus) - 1;
+}
+
+/*
+ * Set the affinity of thread T. If T is waiting on the run queue of
+ * a cpu it may no longer use, move it now; if it is the current
+ * thread, yield so thread_switch moves it. A thread that is running
+ * on another cpu, or asleep, moves the next time it yields or wakes.
+ */
+int
+thread_setaffinity(struct thread *t, uint32_t mask)
+{
+	struct cpu *c;
+	bool requeue;
+
+	if ((mask & thread_cpumask()) == 0) {
+		return EINVAL;
+	}
+
+	/* Lock the run queue of T's cpu; T might be stolen meanwhile */
+	for (;;) {
+		c = t->t_cpu;
+		spinlock_acquire(&c->c_runqueue_lock);
+		if (c == t->t_cpu) {
+			break;
 		}
 		spinlock_release(&c->c_runqueue_lock);
 	}
 
+	t->t_affinity = mask;
+
 	/*
-	 * Because the code above isn't atomic, the thread counts may have
-	 * changed while we were working and we may end up with leftovers.
-	 * Don't panic; just put them back on our own run queue.
+	 * A ready thread is on the run queue, unless thread_relocate
+	 * is already on its way to move it (then it's on no list).
 	 */
-	if (!threadlist_isempty(&victims)) {
-		spinlock_acquire(&curcpu->c_runqueue_lock);
-		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+	requeue = t->t_state == S_READY && t != c->c_curthread &&
+		t->t_listnode.tln_next != NULL && !thread_allowed(t, c);
+	if (requeue) {
+		threadlist_remove(&c->c_runqueue, t);
+	}
+	spinlock_release(&c->c_runqueue_lock);
+
+	if (requeue) {
+		thread_make_runnable(t, false);
+	}
+	else if (t == curthread && !thread_allowed(t, curcpu->c_self)) {
+		thread_yield();
+	}
+	return 0;
+}
+
+/*
+ * Get the affinity of thread T.
+ */
+uint32_t
+thread_getaffinity(struct thread *t)
+{
+	return t->t_affinity;
+}
+
+/*
+ * The nice value thread T is scheduled by, loans included. t_boost
+ * is read without a lock; a stale value only costs a turn.
+ */
+int
+thread_effnice(struct thread *t)
+{
+	int boost = t->t_boost;
+
+	return boost < t->t_nice ? boost : t->t_nice;
+}
+
+/*
+ * Thread T was lent a lower nice value. If it is on a run queue, move
+ * it to where that puts it: by rank with MLFQ, and with round-robin
+ * to the head, since somebody is waiting for a lock it holds.
+ */
+void
+thread_boosted(struct thread *t)
+{
+	struct cpu *c;
+
+	/* Lock the run queue of T's cpu; T might be stolen meanwhile */
+	for (;;) {
+		c = t->t_cpu;
+		if (c == NULL) {
+			return;
 		}
-		spinlock_release(&curcpu->c_runqueue_lock);
+		spinlock_acquire(&c->c_runqueue_lock);
+		if (c == t->t_cpu) {
+			break;
+		}
+		spinlock_release(&c->c_runqueue_lock);
 	}
 
-	KASSERT(threadlist_isempty(&victims));
-	threadlist_cleanup(&victims);
+	/* (as in thread_setaffinity: not if thread_relocate has it) */
+	if (t->t_state == S_READY && t != c->c_curthread &&
+	    t->t_listnode.tln_next != NULL) {
+		threadlist_remove(&c->c_runqueue, t);
+#if OPT_MLFQ
+		thread_enqueue(c, t);
+#else
+		threadlist_addhead(&c->c_runqueue, t);
+#endif
+	}
+	spinlock_release(&c->c_runqueue_lock);
 }
 
 ////////////////////////////////////////////////////////////
@@ -1023,6 +1889,15 @@ wchan_sleep(struct wchan *wc, struct spinlock *lk)
  */
 void
 wchan_wakeone(struct wchan *wc, struct spinlock *lk)
+{
+	wchan_wakehead(wc, lk);
+}
+
+/*
+ * Wake up the first thread sleeping on a wait channel and return it.
+ */
+struct thread *
+wchan_wakehead(struct wchan *wc, struct spinlock *lk)
 {
 	struct thread *target;
 
@@ -1033,7 +1908,7 @@ wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 
 	if (target == NULL) {
 		/* Nobody was sleeping. */
-		return;
+		return NULL;
 	}
 
 	/*
@@ -1045,6 +1920,7 @@ wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 	 */
 
 	thread_make_runnable(target, false);
+	return target;
 }
 
 /*
@@ -1080,6 +1956,25 @@ wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 	threadlist_cleanup(&list);
 }
 
+/*
+ * Move all threads sleeping on one wait channel to another. They
+ * stay asleep; only the channel they will be woken from changes.
+ */
+void
+wchan_moveall(struct wchan *from, struct spinlock *fromlk,
+	      struct wchan *to, struct spinlock *tolk)
+{
+	struct thread *target;
+
+	KASSERT(spinlock_do_i_hold(fromlk));
+	KASSERT(spinlock_do_i_hold(tolk));
+
+	while ((target = threadlist_remhead(&from->wc_threads)) != NULL) {
+		target->t_wchan_name = to->wc_name;
+		threadlist_addtail(&to->wc_threads, target);
+	}
+}
+
 /*
  * Return nonzero if there are no threads sleeping on the channel.
  * This is meant to be used only for diagnostic purposes.
@@ -1097,12 +1992,255 @@ wchan_isempty(struct wchan *wc, struct spinlock *lk)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Per-cpu counters (see counter.h).
+ */
+
+/* Their names in kstat snapshots. */
+static const char *const counter_names[NCOUNTERS] = {
+	[COUNTER_HARDCLOCKS] = "clock.hardclocks",
+	[COUNTER_LOCK_ACQUIRES] = "lock.acquires",
+	[COUNTER_LOCK_CONTENDED] = "lock.contended",
+	[COUNTER_LOCK_SPUN] = "lock.spun",
+	[COUNTER_LOCK_SLEPT] = "lock.slept",
+	[COUNTER_LOCK_POLLS] = "lock.polls",
+	[COUNTER_PCP_HITS] = "vm.pcp.hits",
+	[COUNTER_PCP_MISSES] = "vm.pcp.misses",
+	[COUNTER_PCP_DRAINS] = "vm.pcp.drains",
+	[COUNTER_SWITCHES] = "sched.switches",
+	[COUNTER_STOLEN] = "sched.stolen",
+	[COUNTER_VM_READFAULTS] = "vm.faults.read",
+	[COUNTER_VM_WRITEFAULTS] = "vm.faults.write",
+	[COUNTER_VM_ROFAULTS] = "vm.faults.readonly",
+	[COUNTER_VM_BADFAULTS] = "vm.faults.bad",
+	[COUNTER_TLB_RANDOM] = "vm.tlb.random",
+};
+
+/*
+ * Add N to counter ID of the current cpu. If we get preempted and
+ * moved to another cpu halfway through, this adds to the old cpu's
+ * copy instead; that is still atomic, so nothing is lost.
+ */
+void
+counter_add(unsigned id, unsigned n)
+{
+	volatile unsigned *counter;
+	unsigned old;
+
+	KASSERT(id < NCOUNTERS);
+	counter = &curcpu->c_self->c_counters[id];
+	do {
+		old = *counter;
+	} while (!spinlock_data_cas(counter, old, old + n));
+}
+
+/*
+ * The current cpu's copy of counter ID.
+ */
+unsigned
+counter_local(unsigned id)
+{
+	KASSERT(id < NCOUNTERS);
+	return curcpu->c_counters[id];
+}
+
+/*
+ * Sum of all cpus' copies of counter ID.
+ */
+unsigned
+counter_read(unsigned id)
+{
+	unsigned i, numcpus, total;
+
+	KASSERT(id < NCOUNTERS);
+	total = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		total += cpuarray_get(&allcpus, i)->c_counters[id];
+	}
+	return total;
+}
+
+/*
+ * Cpu N's copy of counter ID.
+ */
+unsigned
+counter_cpu(unsigned id, unsigned n)
+{
+	KASSERT(id < NCOUNTERS);
+	if (n >= cpuarray_num(&allcpus)) {
+		return 0;
+	}
+	return cpuarray_get(&allcpus, n)->c_counters[id];
+}
+
+/*
+ * Every counter as NAME, the total, and as cpu.N.NAME, the shares.
+ */
+void
+counter_kstat(struct kstat *ks)
+{
+	unsigned id, i, numcpus;
+	struct cpu *c;
+
+	numcpus = cpuarray_num(&allcpus);
+	for (id=0; id<NCOUNTERS; id++) {
+		KASSERT(counter_names[id] != NULL);
+		kstat_put(ks, counter_read(id), "%s", counter_names[id]);
+	}
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		for (id=0; id<NCOUNTERS; id++) {
+			kstat_put(ks, c->c_counters[id], "cpu.%u.%s",
+				  c->c_number, counter_names[id]);
+		}
+	}
+}
+
+/*
+ * Run queue lengths, read without the locks like thread_steal does.
+ */
+void
+thread_kstat(struct kstat *ks)
+{
+	unsigned i, numcpus;
+	struct cpu *c;
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		kstat_put(ks, c->c_runqueue.tl_count, "cpu.%u.runqueue",
+			  c->c_number);
+		kstat_put(ks, c->c_isidle, "cpu.%u.idle", c->c_number);
+	}
+}
+
+/*
+ * Clear the scheduler histograms of all cpus and start collecting.
+ * A cpu counting while it is being cleared may keep a count or two
+ * from before; they are statistics.
+ */
+void
+thread_schedhist_start(void)
+{
+	unsigned i, j, numcpus;
+	struct cpu *c;
+
+	schedhist_on = false;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		for (j=0; j<SCHEDHIST_BUCKETS; j++) {
+			c->c_waithist[j] = 0;
+			c->c_slicehist[j] = 0;
+		}
+		for (j=0; j<SCHEDHIST_RQLEN; j++) {
+			c->c_rqhist[j] = 0;
+		}
+	}
+	membar_any_any();
+	schedhist_on = true;
+}
+
+void
+thread_schedhist_stop(void)
+{
+	schedhist_on = false;
+}
+
+/*
+ * Sample the length of the current cpu's run queue. Called from
+ * hardclock, which doesn't run while the cpu idles, so the samples
+ * are of a busy cpu.
+ */
+void
+thread_schedhist_sample(void)
+{
+	unsigned len;
+
+	if (!schedhist_on) {
+		return;
+	}
+	/* Read without the lock, like thread_steal does */
+	len = curcpu->c_runqueue.tl_count;
+	if (len >= SCHEDHIST_RQLEN) {
+		len = SCHEDHIST_RQLEN - 1;
+	}
+	curcpu->c_rqhist[len]++;
+}
+
+/*
+ * Print the scheduler histograms of every cpu, leaving out empty
+ * buckets.
+ */
+void
+thread_schedhist_print(void)
+{
+	unsigned i, b, numcpus, waits, slices, samples;
+	struct cpu *c;
+	char range[32];
+
+	kprintf("Scheduler histograms (%s):\n",
+		schedhist_on ? "collecting" : "stopped");
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		waits = slices = samples = 0;
+		for (b=0; b<SCHEDHIST_BUCKETS; b++) {
+			waits += c->c_waithist[b];
+			slices += c->c_slicehist[b];
+		}
+		for (b=0; b<SCHEDHIST_RQLEN; b++) {
+			samples += c->c_rqhist[b];
+		}
+		kprintf("cpu %u: %u wakeups, %u timeslices, "
+			"%u run queue samples\n",
+			c->c_number, waits, slices, samples);
+		if (waits + slices > 0) {
+			kprintf("  %-16s %10s %10s\n", "usecs",
+				"wakeup", "timeslice");
+		}
+		for (b=0; b<SCHEDHIST_BUCKETS; b++) {
+			if (c->c_waithist[b] == 0 && c->c_slicehist[b] == 0) {
+				continue;
+			}
+			if (b == SCHEDHIST_BUCKETS - 1) {
+				snprintf(range, sizeof(range), "%u+", 1U << b);
+			}
+			else {
+				snprintf(range, sizeof(range), "%u-%u",
+					 b == 0 ? 0 : 1U << b, (2U << b) - 1);
+			}
+			kprintf("  %-16s %10u %10u\n", range,
+				c->c_waithist[b], c->c_slicehist[b]);
+		}
+		if (samples > 0) {
+			kprintf("  %-16s %10s\n", "run queue", "samples");
+		}
+		for (b=0; b<SCHEDHIST_RQLEN; b++) {
+			if (c->c_rqhist[b] == 0) {
+				continue;
+			}
+			snprintf(range, sizeof(range), "%u%s", b,
+				 b == SCHEDHIST_RQLEN - 1 ? "+" : "");
+			kprintf("  %-16s %10u\n", range, c->c_rqhist[b]);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+
 /*
  * Machine-independent IPI handling
  */
 
 /*
  * Send an IPI (inter-processor interrupt) to the specified CPU.
+ *
+ * IPIs are coalesced: if the target already has one pending, the
+ * interrupt for it is on its way, and interprocessor_interrupt
+ * handles all the pending codes at once (clearing them with the
+ * IPI lock held), so adding the code is enough.
  */
 void
 ipi_send(struct cpu *target, int code)
@@ -1110,8 +2248,10 @@ ipi_send(struct cpu *target, int code)
 	KASSERT(code >= 0 && code < 32);
 
 	spinlock_acquire(&target->c_ipi_lock);
+	if (target->c_ipi_pending == 0) {
+		mainbus_send_ipi(target);
+	}
 	target->c_ipi_pending |= (uint32_t)1 << code;
-	mainbus_send_ipi(target);
 	spinlock_release(&target->c_ipi_lock);
 }
 
@@ -1160,12 +2300,48 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 		target->c_numshootdown = n+1;
 	}
 
+	/* Coalesced, as in ipi_send */
+	if (target->c_ipi_pending == 0) {
+		mainbus_send_ipi(target);
+	}
 	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
-	mainbus_send_ipi(target);
 
 	spinlock_release(&target->c_ipi_lock);
 }
 
+#if OPT_SHELL
+/*
+ * Send a TLB shootdown IPI to all CPUs except the current one.
+ * Returns the number of CPUs it was sent to.
+ */
+unsigned
+ipi_tlbshootdown_broadcast(const struct tlbshootdown *mapping)
+{
+	return ipi_tlbshootdown_mask(mapping, ~(uint32_t)0);
+}
+
+/*
+ * Send a TLB shootdown IPI to the CPUs whose numbers are set in MASK,
+ * except the current one. Returns the number of CPUs it was sent to.
+ */
+unsigned
+ipi_tlbshootdown_mask(const struct tlbshootdown *mapping, uint32_t mask)
+{
+	unsigned i, n = 0;
+	struct cpu *c;
+
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != curcpu->c_self &&
+		    (mask & ((uint32_t)1 << c->c_number)) != 0) {
+			ipi_tlbshootdown(c, mapping);
+			n++;
+		}
+	}
+	return n;
+}
+#endif
+
 /*
  * Handle an incoming interprocessor interrupt.
  */
@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Work queues.
+ *
+ * A queue belongs to one cpu and is only ever touched on that cpu,
+ * with interrupts off: work_schedule pushes onto it at splhigh, and
+ * the worker, which is pinned to the cpu, takes everything off it
+ * at once holding wq_lock (which also means interrupts are off). So
+ * no lock is needed to enqueue, and wq_lock is only there for the
+ * wchan the worker sleeps on when the queue is empty; work_schedule
+ * takes it just to wake the worker up.
+ *
+ * The queue is a stack, newest first; the worker reverses what it
+ * takes off so items run in the order they were scheduled.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <proc.h>
+#include <workqueue.h>
+#include <platform/maxcpus.h>
+
+struct workqueue {
+	struct work *wq_head;		/* newest first */
+	bool wq_idle;			/* worker asleep on wq_wchan */
+	struct spinlock wq_lock;	/* for wq_wchan */
+	struct wchan *wq_wchan;
+};
+
+static struct workqueue workqueues[MAXCPUS];
+
+/*
+ * Set up a work item.
+ */
+void
+work_init(struct work *w, void (*func)(void *), void *arg)
+{
+	w->w_func = func;
+	w->w_arg = arg;
+	w->w_next = NULL;
+}
+
+/*
+ * Queue a work item on the current cpu.
+ */
+void
+work_schedule(struct work *w)
+{
+	struct workqueue *wq;
+	bool idle;
+	int spl;
+
+	KASSERT(w->w_func != NULL);
+
+	/* With interrupts off, we can't move to another cpu either */
+	spl = splhigh();
+	wq = &workqueues[curcpu->c_number];
+	w->w_next = wq->wq_head;
+	wq->wq_head = w;
+	idle = wq->wq_idle;
+	if (idle) {
+		/* Don't wake it twice */
+		wq->wq_idle = false;
+		spinlock_acquire(&wq->wq_lock);
+		wchan_wakeone(wq->wq_wchan, &wq->wq_lock);
+		spinlock_release(&wq->wq_lock);
+	}
+	splx(spl);
+}
+
+/*
+ * Take everything off the queue, oldest first, sleeping until there
+ * is something.
+ */
+static
+struct work *
+workqueue_take(struct workqueue *wq)
+{
+	struct work *w, *next, *list;
+
+	spinlock_acquire(&wq->wq_lock);
+	while (wq->wq_head == NULL) {
+		wq->wq_idle = true;
+		wchan_sleep(wq->wq_wchan, &wq->wq_lock);
+	}
+	w = wq->wq_head;
+	wq->wq_head = NULL;
+	spinlock_release(&wq->wq_lock);
+
+	list = NULL;
+	while (w != NULL) {
+		next = w->w_next;
+		w->w_next = list;
+		list = w;
+		w = next;
+	}
+	return list;
+}
+
+/*
+ * The worker thread of cpu NUM.
+ */
+static
+void
+workqueue_thread(void *data1, unsigned long num)
+{
+	struct workqueue *wq;
+	struct work *w, *next;
+	int result;
+
+	(void)data1;
+
+	/* Stay on our cpu; this moves us there first */
+	result = thread_setaffinity(curthread, (uint32_t)1 << num);
+	if (result) {
+		panic("workqueue: cannot bind worker to cpu %lu\n", num);
+	}
+	KASSERT(curcpu->c_number == num);
+
+	wq = &workqueues[num];
+	while (1) {
+		w = workqueue_take(wq);
+		while (w != NULL) {
+			/* The function may free the item */
+			next = w->w_next;
+			w->w_next = NULL;
+			w->w_func(w->w_arg);
+			w = next;
+		}
+	}
+}
+
+/*
+ * Start a worker on every cpu.
+ */
+void
+workqueue_bootstrap(void)
+{
+	struct workqueue *wq;
+	uint32_t cpus;
+	char name[16];
+	unsigned i;
+	int result;
+
+	cpus = thread_cpumask();
+	for (i=0; i<MAXCPUS && (cpus & ((uint32_t)1 << i)) != 0; i++) {
+		wq = &workqueues[i];
+		spinlock_init(&wq->wq_lock);
+		wq->wq_wchan = wchan_create("workqueue");
+		if (wq->wq_wchan == NULL) {
+			panic("workqueue_bootstrap: Out of memory\n");
+		}
+
+		snprintf(name, sizeof(name), "worker %u", i);
+		result = thread_fork(name, NULL, workqueue_thread, NULL, i);
+		if (result) {
+			panic("workqueue_bootstrap: thread_fork: %s\n",
+			      strerror(result));
+		}
+	}
+}
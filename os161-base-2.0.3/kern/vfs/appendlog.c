@@ -0,0 +1,336 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Group commit of O_APPEND writes.
+ *
+ * Files being appended to have a record, made by the first writer
+ * and freed by the last one, kept in AL_NHASH chains hashed on the
+ * vnode as for the byte-range locks; each chain has a sleep lock and
+ * a CV its writers sleep on.
+ *
+ * At most one write to the file system is in flight per file (the
+ * committer). A small write copies its data into the open batch of
+ * the file, under the chain lock, and waits: the first of its members
+ * to find no committer takes the batch, leaving the file without an
+ * open one, and writes it out at the end of the file with the chain
+ * lock released. Meanwhile the writers coming in fill a new batch,
+ * which goes out as soon as the committer is done. Without contention
+ * a batch holds a single record and goes out at once, as before.
+ *
+ * Writes larger than a batch wait for the committer's turn and go
+ * straight from the user buffer to the file.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <stat.h>
+#include <lib.h>
+#include <uio.h>
+#include <synch.h>
+#include <vnode.h>
+#include <appendlog.h>
+
+#define AL_NHASH  32		/* number of chains (power of two) */
+
+struct al_batch {
+	size_t ab_len;			/* bytes gathered */
+	unsigned ab_refs;		/* writers whose data is in here */
+	bool ab_done;			/* written out (or failed) */
+	int ab_err;			/* result of the write */
+	off_t ab_base;			/* file offset of the first byte */
+	size_t ab_written;		/* bytes the file system took */
+	char ab_buf[APPENDLOG_BATCH];
+};
+
+struct al_file {
+	struct vnode *af_vn;
+	unsigned af_users;		/* writers in appendlog_write() */
+	bool af_committing;		/* a write to the file system is on */
+	struct al_batch *af_open;	/* batch being filled, or NULL */
+	struct al_file *af_next;
+};
+
+struct al_chain {
+	struct lock *ac_lock;
+	struct cv *ac_cv;
+	struct al_file *ac_head;
+};
+
+static struct al_chain al_chains[AL_NHASH];
+
+static
+struct al_chain *
+al_chain(struct vnode *vn)
+{
+	unsigned h;
+
+	h = (uintptr_t)vn >> 6;
+	h ^= h >> 9;
+	return &al_chains[h & (AL_NHASH - 1)];
+}
+
+/*
+ * Find or make the record of VN in chain AC, and count the caller
+ * among its users.
+ */
+static
+struct al_file *
+al_getfile(struct al_chain *ac, struct vnode *vn)
+{
+	struct al_file *af;
+
+	for (af = ac->ac_head; af != NULL; af = af->af_next) {
+		if (af->af_vn == vn) {
+			af->af_users++;
+			return af;
+		}
+	}
+	af = kmalloc(sizeof(*af));
+	if (af == NULL) {
+		return NULL;
+	}
+	af->af_vn = vn;
+	af->af_users = 1;
+	af->af_committing = false;
+	af->af_open = NULL;
+	af->af_next = ac->ac_head;
+	ac->ac_head = af;
+	return af;
+}
+
+/*
+ * The caller is done with AF: free it if it was the last user.
+ */
+static
+void
+al_putfile(struct al_chain *ac, struct al_file *af)
+{
+	struct al_file **pp;
+
+	KASSERT(af->af_users > 0);
+	if (--af->af_users > 0) {
+		return;
+	}
+	KASSERT(af->af_open == NULL && !af->af_committing);
+	for (pp = &ac->ac_head; *pp != af; pp = &(*pp)->af_next) {
+		KASSERT(*pp != NULL);
+	}
+	*pp = af->af_next;
+	kfree(af);
+}
+
+/*
+ * Write UIO at the current end of VN. Called by the committer with
+ * the chain lock released.
+ */
+static
+int
+al_commit(struct vnode *vn, struct uio *uio)
+{
+	struct stat st;
+	int result;
+
+	result = VOP_STAT(vn, &st);
+	if (result) {
+		return result;
+	}
+	uio->uio_offset = st.st_size;
+	return VOP_WRITE(vn, uio);
+}
+
+/*
+ * Wait for the committer's turn on AF and write UIO alone.
+ */
+static
+int
+al_write_alone(struct al_chain *ac, struct al_file *af, struct vnode *vn,
+	       struct uio *uio)
+{
+	int result;
+
+	while (af->af_committing) {
+		cv_wait(ac->ac_cv, ac->ac_lock);
+	}
+	af->af_committing = true;
+	lock_release(ac->ac_lock);
+
+	result = al_commit(vn, uio);
+
+	lock_acquire(ac->ac_lock);
+	af->af_committing = false;
+	cv_broadcast(ac->ac_cv, ac->ac_lock);
+	return result;
+}
+
+/*
+ * Wait until batch AB of AF has been written, writing it out if it
+ * is its turn.
+ */
+static
+void
+al_wait_batch(struct al_chain *ac, struct al_file *af, struct vnode *vn,
+	      struct al_batch *ab)
+{
+	struct iovec iov;
+	struct uio ku;
+
+	while (!ab->ab_done) {
+		if (af->af_committing || af->af_open != ab) {
+			cv_wait(ac->ac_cv, ac->ac_lock);
+			continue;
+		}
+
+		/* take the batch: newcomers start another one */
+		af->af_open = NULL;
+		af->af_committing = true;
+		cv_broadcast(ac->ac_cv, ac->ac_lock);
+		lock_release(ac->ac_lock);
+
+		uio_kinit(&iov, &ku, ab->ab_buf, ab->ab_len, 0, UIO_WRITE);
+		ab->ab_err = al_commit(vn, &ku);
+		ab->ab_base = ku.uio_offset - (ab->ab_len - ku.uio_resid);
+		ab->ab_written = ab->ab_len - ku.uio_resid;
+
+		lock_acquire(ac->ac_lock);
+		ab->ab_done = true;
+		af->af_committing = false;
+		cv_broadcast(ac->ac_cv, ac->ac_lock);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// interface
+
+void
+appendlog_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<AL_NHASH; i++) {
+		al_chains[i].ac_lock = lock_create("appendlog");
+		al_chains[i].ac_cv = cv_create("appendlog");
+		if (al_chains[i].ac_lock == NULL ||
+		    al_chains[i].ac_cv == NULL) {
+			panic("appendlog_bootstrap: Out of memory\n");
+		}
+		al_chains[i].ac_head = NULL;
+	}
+}
+
+int
+appendlog_write(struct vnode *vn, struct uio *uio)
+{
+	struct al_chain *ac;
+	struct al_file *af;
+	struct al_batch *ab;
+	size_t len, pos, mine;
+	int result;
+
+	KASSERT(uio->uio_rw == UIO_WRITE);
+
+	len = uio->uio_resid;
+	if (len == 0) {
+		return 0;
+	}
+
+	ac = al_chain(vn);
+	lock_acquire(ac->ac_lock);
+	af = al_getfile(ac, vn);
+	if (af == NULL) {
+		lock_release(ac->ac_lock);
+		return ENOMEM;
+	}
+
+	if (len > APPENDLOG_BATCH) {
+		result = al_write_alone(ac, af, vn, uio);
+		al_putfile(ac, af);
+		lock_release(ac->ac_lock);
+		return result;
+	}
+
+	/* find room in the open batch, or start one */
+	while ((ab = af->af_open) != NULL &&
+	       ab->ab_len + len > APPENDLOG_BATCH) {
+		cv_wait(ac->ac_cv, ac->ac_lock);
+	}
+	if (ab == NULL) {
+		ab = kmalloc(sizeof(*ab));
+		if (ab == NULL) {
+			/* not worth failing the write for */
+			result = al_write_alone(ac, af, vn, uio);
+			al_putfile(ac, af);
+			lock_release(ac->ac_lock);
+			return result;
+		}
+		ab->ab_len = 0;
+		ab->ab_refs = 0;
+		ab->ab_done = false;
+		ab->ab_err = 0;
+		ab->ab_base = 0;
+		ab->ab_written = 0;
+		af->af_open = ab;
+	}
+
+	/* copy the record in; a bad user pointer leaves the batch as it was */
+	pos = ab->ab_len;
+	result = uiomove(ab->ab_buf + pos, len, uio);
+	if (result) {
+		if (ab->ab_refs == 0) {
+			af->af_open = NULL;
+			kfree(ab);
+		}
+		al_putfile(ac, af);
+		lock_release(ac->ac_lock);
+		return result;
+	}
+	ab->ab_len += len;
+	ab->ab_refs++;
+
+	al_wait_batch(ac, af, vn, ab);
+
+	/* a short write goes to the records that came first */
+	mine = 0;
+	if (ab->ab_written > pos) {
+		mine = ab->ab_written - pos;
+		if (mine > len) {
+			mine = len;
+		}
+	}
+	result = (mine == 0) ? ab->ab_err : 0;
+	uio->uio_resid = len - mine;
+	uio->uio_offset = ab->ab_base + pos + mine;
+
+	if (--ab->ab_refs == 0) {
+		kfree(ab);
+	}
+	al_putfile(ac, af);
+	lock_release(ac->ac_lock);
+	return result;
+}
@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Child-exit descriptors (see childfd.h).
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <stat.h>
+#include <lib.h>
+#include <proc.h>
+#include <vnode.h>
+#include <poll.h>
+#include <childfd.h>
+
+/*
+ * Called when the last reference goes away. Nothing hands out new
+ * references, so just free the vnode.
+ */
+static
+int
+childfd_reclaim(struct vnode *v)
+{
+	spinlock_acquire(&v->vn_countlock);
+	if (vnode_dropref_unless_last(v)) {
+		/* consumed the reference VOP_DECREF gave us */
+		spinlock_release(&v->vn_countlock);
+		return EBUSY;
+	}
+	spinlock_release(&v->vn_countlock);
+
+	vnode_cleanup(v);
+	kfree(v);
+	return 0;
+}
+
+/*
+ * Created open; there is nothing to open by name.
+ */
+static
+int
+childfd_eachopen(struct vnode *v, int flags)
+{
+	(void)v;
+	(void)flags;
+	return ENXIO;
+}
+
+/*
+ * The children looked at are those of whoever polls.
+ */
+static
+int
+childfd_poll(struct vnode *v, int events, struct pollent *pe)
+{
+	(void)v;
+	return proc_pollchildren(pe) & (events | POLLHUP);
+}
+
+static
+int
+childfd_stat(struct vnode *v, struct stat *statbuf)
+{
+	(void)v;
+	bzero(statbuf, sizeof(struct stat));
+	statbuf->st_mode = S_IFCHR | 0400;
+	statbuf->st_nlink = 1;
+	return 0;
+}
+
+static
+int
+childfd_gettype(struct vnode *v, mode_t *ret)
+{
+	(void)v;
+	*ret = S_IFCHR;
+	return 0;
+}
+
+static
+bool
+childfd_isseekable(struct vnode *v)
+{
+	(void)v;
+	return false;
+}
+
+static
+int
+childfd_ioctl(struct vnode *v, int op, userptr_t data)
+{
+	(void)v;
+	(void)op;
+	(void)data;
+	return EINVAL;
+}
+
+static
+int
+childfd_fsync(struct vnode *v)
+{
+	(void)v;
+	return EINVAL;
+}
+
+static
+int
+childfd_truncate(struct vnode *v, off_t len)
+{
+	(void)v;
+	(void)len;
+	return EINVAL;
+}
+
+/*
+ * Function table for child-exit descriptors.
+ */
+static const struct vnode_ops childfd_vnode_ops = {
+	.vop_magic = VOP_MAGIC,
+
+	.vop_eachopen = childfd_eachopen,
+	.vop_reclaim = childfd_reclaim,
+	.vop_read = vopfail_uio_inval,
+	.vop_readlink = vopfail_uio_inval,
+	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_getdirents = vopfail_uio_notdir,
+	.vop_write = vopfail_uio_inval,
+	.vop_ioctl = childfd_ioctl,
+	.vop_stat = childfd_stat,
+	.vop_gettype = childfd_gettype,
+	.vop_isseekable = childfd_isseekable,
+	.vop_fsync = childfd_fsync,
+	.vop_mmap = vopfail_mmap_nosys,
+	.vop_truncate = childfd_truncate,
+	.vop_punch = vopfail_punch_nosys,
+	.vop_poll = childfd_poll,
+	.vop_prefetch = vnode_prefetch_none,
+	.vop_dontneed = vnode_dontneed_none,
+	.vop_namefile = vopfail_uio_nosys,
+	.vop_creat = vopfail_creat_notdir,
+	.vop_symlink = vopfail_symlink_notdir,
+	.vop_mkdir = vopfail_mkdir_notdir,
+	.vop_link = vopfail_link_notdir,
+	.vop_remove = vopfail_string_notdir,
+	.vop_rmdir = vopfail_string_notdir,
+	.vop_rename = vopfail_rename_notdir,
+	.vop_lookup = vopfail_lookup_notdir,
+	.vop_lookparent = vopfail_lookparent_notdir,
+};
+
+/*
+ * Create a child-exit descriptor.
+ */
+int
+childfd_create(struct vnode **ret)
+{
+	struct vnode *v;
+	int result;
+
+	v = kmalloc(sizeof(*v));
+	if (v == NULL) {
+		return ENOMEM;
+	}
+
+	/* vnode_init doesn't actually fail */
+	result = vnode_init(v, &childfd_vnode_ops, NULL, NULL);
+	KASSERT(result == 0);
+
+	*ret = v;
+	return 0;
+}
@@ -150,6 +150,24 @@ dev_ioctl(struct vnode *v, int op, userptr_t data)
 	return DEVOP_IOCTL(d, op, data);
 }
 
+/*
+ * Called for poll(). Pass through if the device knows how, else it is
+ * always ready.
+ */
+static
+int
+dev_poll(struct vnode *v, int events, struct pollent *pe)
+{
+#if OPT_SHELL
+	struct device *d = v->vn_data;
+
+	if (d->d_ops->devop_poll != NULL) {
+		return DEVOP_POLL(d, events, pe);
+	}
+#endif
+	return vnode_poll_ready(v, events, pe);
+}
+
 /*
  * Called for stat().
  * Set the type and the size (block devices only).
@@ -330,6 +348,7 @@ static const struct vnode_ops dev_vnode_ops = {
 	.vop_read = dev_read,
 	.vop_readlink = vopfail_uio_inval,
 	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_getdirents = vopfail_uio_notdir,
 	.vop_write = dev_write,
 	.vop_ioctl = dev_ioctl,
 	.vop_stat = dev_stat,
@@ -338,6 +357,10 @@ static const struct vnode_ops dev_vnode_ops = {
 	.vop_fsync = null_fsync,
 	.vop_mmap = dev_mmap,
 	.vop_truncate = dev_truncate,
+	.vop_punch = vopfail_punch_nosys,
+	.vop_poll = dev_poll,
+	.vop_prefetch = vnode_prefetch_none,
+	.vop_dontneed = vnode_dontneed_none,
 	.vop_namefile = dev_namefile,
 	.vop_creat = vopfail_creat_notdir,
 	.vop_symlink = vopfail_symlink_notdir,
@@ -0,0 +1,266 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Kernel statistics, and the kstat device, "kstat:", which returns
+ * them as text (see kstat.h).
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <stdarg.h>
+#include <lib.h>
+#include <clock.h>
+#include <counter.h>
+#include <synch.h>
+#include <thread.h>
+#include <proc.h>
+#include <syscall.h>
+#include <kmem_cache.h>
+#include <lockprof.h>
+#include <sfs.h>
+#include <test.h>
+#include <vm.h>
+#include <uio.h>
+#include <vfs.h>
+#include <device.h>
+#include <kstat.h>
+#include "opt-shell.h"
+#include "opt-sfs.h"
+
+/* First guess at the size of a snapshot; doubled until it fits */
+#define KSTAT_INITSIZE	8192
+
+/* Longest line; longer names are cut short */
+#define KSTAT_LINELEN	96
+
+struct kstat {
+	char *ks_buf;
+	size_t ks_size;
+	size_t ks_len;
+	bool ks_overflow;	/* Something didn't fit */
+};
+
+/*
+ * Add one "name value" line. Blanks in the name become underscores,
+ * as some of the names come from lock and cache names.
+ */
+void
+kstat_put(struct kstat *ks, uint64_t value, const char *namefmt, ...)
+{
+	char line[KSTAT_LINELEN];
+	va_list ap;
+	size_t len, i;
+
+	va_start(ap, namefmt);
+	vsnprintf(line, sizeof(line) - 24, namefmt, ap);
+	va_end(ap);
+	for (i=0; line[i] != 0; i++) {
+		if (line[i] == ' ' || line[i] == '\t' || line[i] == '\n') {
+			line[i] = '_';
+		}
+	}
+	len = i + snprintf(line + i, sizeof(line) - i, " %llu\n",
+			   (unsigned long long)value);
+
+	/* Leave room for the terminating null */
+	if (ks->ks_len + len >= ks->ks_size) {
+		ks->ks_overflow = true;
+		return;
+	}
+	memcpy(ks->ks_buf + ks->ks_len, line, len);
+	ks->ks_len += len;
+}
+
+static
+void
+kstat_collect(struct kstat *ks)
+{
+	kstat_put(ks, clock_monotonic(), "kstat.time");
+	boot_kstat(ks);
+	counter_kstat(ks);
+	thread_kstat(ks);
+	syscall_kstat(ks);
+	vm_kstat(ks);
+	kheap_kstat(ks);
+#if OPT_SHELL
+	kmem_cache_kstat(ks);
+	proc_kstat(ks);
+#endif
+#if OPT_SFS
+	sfs_buf_kstat(ks);
+	sfs_vncache_kstat(ks);
+#endif
+#if OPT_LOCKPROF
+	lockprof_kstat(ks);
+#endif
+}
+
+/*
+ * Take a snapshot. As kstat_put can't allocate, a snapshot that
+ * doesn't fit is thrown away and taken again in a bigger buffer.
+ */
+int
+kstat_snapshot(char **bufret, size_t *lenret)
+{
+	struct kstat ks;
+
+	ks.ks_size = KSTAT_INITSIZE;
+	while (1) {
+		ks.ks_buf = kvmalloc(ks.ks_size);
+		if (ks.ks_buf == NULL) {
+			return ENOMEM;
+		}
+		ks.ks_len = 0;
+		ks.ks_overflow = false;
+		kstat_collect(&ks);
+		if (!ks.ks_overflow) {
+			break;
+		}
+		kvfree(ks.ks_buf);
+		ks.ks_size *= 2;
+	}
+	ks.ks_buf[ks.ks_len] = 0;
+	*bufret = ks.ks_buf;
+	*lenret = ks.ks_len;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// kstat:
+
+/*
+ * The device has no per-open state, so it keeps the last snapshot
+ * taken: a read at offset 0 takes a new one, and reads further on
+ * continue in it. A reader that reads the whole thing from the start
+ * of a fresh open always gets one consistent snapshot, unless another
+ * reader starts over in between.
+ */
+static struct lock *kstat_lock;
+static char *kstat_buf;
+static size_t kstat_len;
+
+/* For open(): allow reading only. */
+static
+int
+kstateachopen(struct device *dev, int openflags)
+{
+	(void)dev;
+
+	if ((openflags & O_ACCMODE) != O_RDONLY) {
+		return EIO;
+	}
+	return 0;
+}
+
+/* For d_io() */
+static
+int
+kstatio(struct device *dev, struct uio *uio)
+{
+	size_t len;
+	int result;
+
+	(void)dev;
+
+	if (uio->uio_rw != UIO_READ) {
+		return EIO;
+	}
+
+	lock_acquire(kstat_lock);
+	if (uio->uio_offset == 0 || kstat_buf == NULL) {
+		if (kstat_buf != NULL) {
+			kvfree(kstat_buf);
+			kstat_buf = NULL;
+		}
+		result = kstat_snapshot(&kstat_buf, &kstat_len);
+		if (result) {
+			lock_release(kstat_lock);
+			return result;
+		}
+	}
+	result = 0;
+	if (uio->uio_offset < (off_t)kstat_len) {
+		len = kstat_len - uio->uio_offset;
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+		result = uiomove(kstat_buf + uio->uio_offset, len, uio);
+	}
+	lock_release(kstat_lock);
+	return result;
+}
+
+/* For ioctl() */
+static
+int
+kstatioctl(struct device *dev, int op, userptr_t data)
+{
+	(void)dev;
+	(void)op;
+	(void)data;
+
+	return EINVAL;
+}
+
+static const struct device_ops kstat_devops = {
+	.devop_eachopen = kstateachopen,
+	.devop_io = kstatio,
+	.devop_ioctl = kstatioctl,
+};
+
+/*
+ * Function to create and attach kstat:
+ */
+void
+devkstat_create(void)
+{
+	int result;
+	struct device *dev;
+
+	kstat_lock = lock_create("kstat");
+	dev = kmalloc(sizeof(*dev));
+	if (kstat_lock == NULL || dev == NULL) {
+		panic("Could not add kstat device: out of memory\n");
+	}
+
+	dev->d_ops = &kstat_devops;
+
+	dev->d_blocks = 0;
+	dev->d_blocksize = 1;
+
+	dev->d_devnumber = 0; /* assigned by vfs_adddev */
+
+	dev->d_data = NULL;
+
+	result = vfs_adddev("kstat", dev, 0);
+	if (result) {
+		panic("Could not add kstat device: %s\n", strerror(result));
+	}
+}
@@ -29,7 +29,9 @@
 
 /*
  * Implementation of the null device, "null:", which generates an
- * immediate EOF on read and throws away anything written to it.
+ * immediate EOF on read and throws away anything written to it, and
+ * of the zero device, "zero:", which reads as an endless run of zero
+ * bytes and also throws away what is written.
  */
 #include <types.h>
 #include <kern/errno.h>
@@ -94,6 +96,27 @@ static const struct device_ops null_devops = {
 	.devop_ioctl = nullioctl,
 };
 
+/* For d_io() on zero: */
+static
+int
+zeroio(struct device *dev, struct uio *uio)
+{
+	(void)dev; // unused
+
+	/* Writes disappear as on null:; reads are all zeros */
+	if (uio->uio_rw == UIO_WRITE) {
+		uio->uio_resid = 0;
+		return 0;
+	}
+	return uiomovezeros(uio->uio_resid, uio);
+}
+
+static const struct device_ops zero_devops = {
+	.devop_eachopen = nullopen,
+	.devop_io = zeroio,
+	.devop_ioctl = nullioctl,
+};
+
 /*
  * Function to create and attach null:
  */
@@ -122,3 +145,32 @@ devnull_create(void)
 		panic("Could not add null device: %s\n", strerror(result));
 	}
 }
+
+/*
+ * Function to create and attach zero:
+ */
+void
+devzero_create(void)
+{
+	int result;
+	struct device *dev;
+
+	dev = kmalloc(sizeof(*dev));
+	if (dev==NULL) {
+		panic("Could not add zero device: out of memory\n");
+	}
+
+	dev->d_ops = &zero_devops;
+
+	dev->d_blocks = 0;
+	dev->d_blocksize = 1;
+
+	dev->d_devnumber = 0; /* assigned by vfs_adddev */
+
+	dev->d_data = NULL;
+
+	result = vfs_adddev("zero", dev, 0);
+	if (result) {
+		panic("Could not add zero device: %s\n", strerror(result));
+	}
+}
@@ -0,0 +1,426 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Pipes (see pipe.h).
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <limits.h>
+#include <stat.h>
+#include <lib.h>
+#include <uio.h>
+#include <synch.h>
+#include <vm.h>
+#include <vnode.h>
+#include <poll.h>
+#include <pipe.h>
+
+/* Size of the ring buffer, in bytes */
+#define PIPE_SIZE	PAGE_SIZE
+
+/*
+ * The pipe object. Both vnodes point at it with vn_data; it is freed
+ * when the second of them is reclaimed. Everything below pp_lock is
+ * protected by it.
+ */
+struct pipe {
+	struct vnode pp_readvn;		/* read end */
+	struct vnode pp_writevn;	/* write end */
+	struct lock *pp_lock;
+	struct cv *pp_readcv;		/* readers wait here for data */
+	struct cv *pp_writecv;		/* writers wait here for space */
+	struct pollhead pp_poll;	/* poll() waits here, for either */
+	char *pp_buf;			/* ring buffer, PIPE_SIZE bytes */
+	unsigned pp_start;		/* offset of the first byte held */
+	unsigned pp_count;		/* number of bytes held */
+	bool pp_readopen;		/* read end not yet reclaimed */
+	bool pp_writeopen;		/* write end not yet reclaimed */
+};
+
+static
+void
+pipe_destroy(struct pipe *pp)
+{
+	vnode_cleanup(&pp->pp_readvn);
+	vnode_cleanup(&pp->pp_writevn);
+	pollhead_cleanup(&pp->pp_poll);
+	kfree(pp->pp_buf);
+	cv_destroy(pp->pp_writecv);
+	cv_destroy(pp->pp_readcv);
+	lock_destroy(pp->pp_lock);
+	kfree(pp);
+}
+
+/*
+ * Called when the refcount of one of the ends reaches zero. Nothing
+ * hands out new references to a pipe, so no need to wait for anyone;
+ * just tell the other end and free the pipe if that one's gone too.
+ */
+static
+int
+pipe_reclaim(struct vnode *v)
+{
+	struct pipe *pp = v->vn_data;
+	bool destroy;
+
+	spinlock_acquire(&v->vn_countlock);
+	if (vnode_dropref_unless_last(v)) {
+		/* consumed the reference VOP_DECREF gave us */
+		spinlock_release(&v->vn_countlock);
+		return EBUSY;
+	}
+	spinlock_release(&v->vn_countlock);
+
+	lock_acquire(pp->pp_lock);
+	if (v == &pp->pp_readvn) {
+		pp->pp_readopen = false;
+		/* writers now fail with EPIPE */
+		cv_broadcast(pp->pp_writecv, pp->pp_lock);
+	}
+	else {
+		KASSERT(v == &pp->pp_writevn);
+		pp->pp_writeopen = false;
+		/* readers now see EOF */
+		cv_broadcast(pp->pp_readcv, pp->pp_lock);
+	}
+	pollhead_wakeup(&pp->pp_poll);
+	destroy = !pp->pp_readopen && !pp->pp_writeopen;
+	lock_release(pp->pp_lock);
+
+	if (destroy) {
+		pipe_destroy(pp);
+	}
+	return 0;
+}
+
+/*
+ * Pipes are created open; there is nothing to open them by name.
+ */
+static
+int
+pipe_eachopen(struct vnode *v, int flags)
+{
+	(void)v;
+	(void)flags;
+	return ENXIO;
+}
+
+/*
+ * Read: wait until there is something to read or there are no more
+ * writers, then take as much as there is, up to what was asked for.
+ * The data goes straight from the ring to the caller's buffer.
+ */
+static
+int
+pipe_read(struct vnode *v, struct uio *uio)
+{
+	struct pipe *pp = v->vn_data;
+	size_t len;
+	int result;
+
+	if (v != &pp->pp_readvn) {
+		return EBADF;
+	}
+
+	lock_acquire(pp->pp_lock);
+	while (uio->uio_resid > 0 && pp->pp_count == 0 && pp->pp_writeopen) {
+		cv_wait(pp->pp_readcv, pp->pp_lock);
+	}
+
+	/* At most two pieces, if the data wraps around the end */
+	result = 0;
+	while (pp->pp_count > 0 && uio->uio_resid > 0) {
+		len = PIPE_SIZE - pp->pp_start;
+		if (len > pp->pp_count) {
+			len = pp->pp_count;
+		}
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+		result = uiomove(pp->pp_buf + pp->pp_start, len, uio);
+		if (result) {
+			break;
+		}
+		pp->pp_start = (pp->pp_start + len) % PIPE_SIZE;
+		pp->pp_count -= len;
+	}
+	if (pp->pp_count == 0) {
+		/* keep the data in one piece as long as possible */
+		pp->pp_start = 0;
+	}
+	cv_broadcast(pp->pp_writecv, pp->pp_lock);
+	pollhead_wakeup(&pp->pp_poll);
+	lock_release(pp->pp_lock);
+	return result;
+}
+
+/*
+ * Write: put in what fits, waking up readers, and wait for space for
+ * the rest. A write of at most PIPE_BUF bytes waits until it fits in
+ * one go, so it isn't interleaved with others. If the read end goes
+ * away, fail with EPIPE unless some of the data already went in.
+ */
+static
+int
+pipe_write(struct vnode *v, struct uio *uio)
+{
+	struct pipe *pp = v->vn_data;
+	size_t len, want, end, done;
+	int result;
+
+	if (v != &pp->pp_writevn) {
+		return EBADF;
+	}
+
+	lock_acquire(pp->pp_lock);
+	done = 0;
+	result = 0;
+	while (uio->uio_resid > 0) {
+		want = uio->uio_resid <= PIPE_BUF ? uio->uio_resid : 1;
+		while (pp->pp_readopen && PIPE_SIZE - pp->pp_count < want) {
+			cv_wait(pp->pp_writecv, pp->pp_lock);
+		}
+		if (!pp->pp_readopen) {
+			result = (done > 0) ? 0 : EPIPE;
+			break;
+		}
+
+		end = (pp->pp_start + pp->pp_count) % PIPE_SIZE;
+		len = PIPE_SIZE - pp->pp_count;
+		if (len > PIPE_SIZE - end) {
+			len = PIPE_SIZE - end;
+		}
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+		result = uiomove(pp->pp_buf + end, len, uio);
+		if (result) {
+			break;
+		}
+		pp->pp_count += len;
+		done += len;
+		cv_broadcast(pp->pp_readcv, pp->pp_lock);
+		pollhead_wakeup(&pp->pp_poll);
+	}
+	lock_release(pp->pp_lock);
+	return result;
+}
+
+/*
+ * poll: the read end is readable when there is data, and hung up
+ * when the write end is gone; the write end is writable when a write
+ * of PIPE_BUF bytes would go in at once, and in error when the read
+ * end is gone.
+ */
+static
+int
+pipe_poll(struct vnode *v, int events, struct pollent *pe)
+{
+	struct pipe *pp = v->vn_data;
+	int ready = 0;
+
+	lock_acquire(pp->pp_lock);
+	pollhead_register(&pp->pp_poll, pe);
+	if (v == &pp->pp_readvn) {
+		if (pp->pp_count > 0) {
+			ready |= POLLIN & events;
+		}
+		if (!pp->pp_writeopen) {
+			ready |= POLLHUP;
+		}
+	}
+	else {
+		if (PIPE_SIZE - pp->pp_count >= PIPE_BUF) {
+			ready |= POLLOUT & events;
+		}
+		if (!pp->pp_readopen) {
+			ready |= POLLERR;
+		}
+	}
+	lock_release(pp->pp_lock);
+	return ready;
+}
+
+/*
+ * stat: a FIFO whose size is the number of bytes waiting to be read.
+ */
+static
+int
+pipe_stat(struct vnode *v, struct stat *statbuf)
+{
+	struct pipe *pp = v->vn_data;
+
+	bzero(statbuf, sizeof(struct stat));
+	lock_acquire(pp->pp_lock);
+	statbuf->st_size = pp->pp_count;
+	lock_release(pp->pp_lock);
+	statbuf->st_mode = S_IFIFO | 0600;
+	statbuf->st_nlink = 1;
+	statbuf->st_blksize = PIPE_SIZE;
+	return 0;
+}
+
+static
+int
+pipe_gettype(struct vnode *v, mode_t *ret)
+{
+	(void)v;
+	*ret = S_IFIFO;
+	return 0;
+}
+
+static
+bool
+pipe_isseekable(struct vnode *v)
+{
+	(void)v;
+	return false;
+}
+
+static
+int
+pipe_ioctl(struct vnode *v, int op, userptr_t data)
+{
+	(void)v;
+	(void)op;
+	(void)data;
+	return EINVAL;
+}
+
+static
+int
+pipe_fsync(struct vnode *v)
+{
+	(void)v;
+	return EINVAL;
+}
+
+static
+int
+pipe_truncate(struct vnode *v, off_t len)
+{
+	(void)v;
+	(void)len;
+	return EINVAL;
+}
+
+/*
+ * Function table for both ends of pipes.
+ */
+static const struct vnode_ops pipe_vnode_ops = {
+	.vop_magic = VOP_MAGIC,
+
+	.vop_eachopen = pipe_eachopen,
+	.vop_reclaim = pipe_reclaim,
+	.vop_read = pipe_read,
+	.vop_readlink = vopfail_uio_inval,
+	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_getdirents = vopfail_uio_notdir,
+	.vop_write = pipe_write,
+	.vop_ioctl = pipe_ioctl,
+	.vop_stat = pipe_stat,
+	.vop_gettype = pipe_gettype,
+	.vop_isseekable = pipe_isseekable,
+	.vop_fsync = pipe_fsync,
+	.vop_mmap = vopfail_mmap_nosys,
+	.vop_truncate = pipe_truncate,
+	.vop_punch = vopfail_punch_nosys,
+	.vop_poll = pipe_poll,
+	.vop_prefetch = vnode_prefetch_none,
+	.vop_dontneed = vnode_dontneed_none,
+	.vop_namefile = vopfail_uio_nosys,
+	.vop_creat = vopfail_creat_notdir,
+	.vop_symlink = vopfail_symlink_notdir,
+	.vop_mkdir = vopfail_mkdir_notdir,
+	.vop_link = vopfail_link_notdir,
+	.vop_remove = vopfail_string_notdir,
+	.vop_rmdir = vopfail_string_notdir,
+	.vop_rename = vopfail_rename_notdir,
+	.vop_lookup = vopfail_lookup_notdir,
+	.vop_lookparent = vopfail_lookparent_notdir,
+};
+
+/*
+ * Create a pipe.
+ */
+int
+pipe_create(struct vnode **readret, struct vnode **writeret)
+{
+	struct pipe *pp;
+	int result;
+
+	pp = kmalloc(sizeof(*pp));
+	if (pp == NULL) {
+		goto fail;
+	}
+	pp->pp_lock = lock_create("pipe");
+	if (pp->pp_lock == NULL) {
+		goto fail_pp;
+	}
+	pp->pp_readcv = cv_create("pipe read");
+	if (pp->pp_readcv == NULL) {
+		goto fail_lock;
+	}
+	pp->pp_writecv = cv_create("pipe write");
+	if (pp->pp_writecv == NULL) {
+		goto fail_readcv;
+	}
+	pp->pp_buf = kmalloc(PIPE_SIZE);
+	if (pp->pp_buf == NULL) {
+		goto fail_writecv;
+	}
+	pp->pp_start = 0;
+	pp->pp_count = 0;
+	pp->pp_readopen = true;
+	pp->pp_writeopen = true;
+	pollhead_init(&pp->pp_poll);
+
+	/* vnode_init doesn't actually fail */
+	result = vnode_init(&pp->pp_readvn, &pipe_vnode_ops, NULL, pp);
+	KASSERT(result == 0);
+	result = vnode_init(&pp->pp_writevn, &pipe_vnode_ops, NULL, pp);
+	KASSERT(result == 0);
+
+	*readret = &pp->pp_readvn;
+	*writeret = &pp->pp_writevn;
+	return 0;
+
+ fail_writecv:
+	cv_destroy(pp->pp_writecv);
+ fail_readcv:
+	cv_destroy(pp->pp_readcv);
+ fail_lock:
+	lock_destroy(pp->pp_lock);
+ fail_pp:
+	kfree(pp);
+ fail:
+	return ENOMEM;
+}
@@ -0,0 +1,735 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Byte-range locks.
+ *
+ * The locks of a file hang off a record for its vnode, made when the
+ * file gets its first lock and freed when it has none left and
+ * nobody waiting; the records are kept in RL_NHASH chains hashed on
+ * the vnode, each with a sleep lock and a CV its waiters sleep on,
+ * broadcast whenever a lock in the chain goes or shrinks. So files
+ * in different chains are locked and unlocked in parallel.
+ *
+ * The locks of a file form a treap ordered by start (ties broken by
+ * address), with random priorities, each node also keeping the
+ * largest end in its subtree: any lock overlapping a range is found
+ * in O(log n) expected steps, skipping the subtrees which end before
+ * the range and those which start after it.
+ *
+ * A process holds at most one lock on any byte: setting a lock first
+ * takes away the overlapping parts of its own locks, merging those
+ * of the same type, and so it never needs more than two new nodes,
+ * one for the lock and one for the far end of a lock it splits.
+ *
+ * Waiters are also listed, with the process they wait for, to tell
+ * deadlocks (a process which would end up waiting for itself); the
+ * list is protected by a spinlock, so the check spans all chains.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/seek.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <current.h>
+#include <proc.h>
+#include <rangelock.h>
+
+#define RL_NHASH     32		/* number of chains (power of two) */
+#define RL_MAXCHAIN  16		/* wait-for hops followed looking for a deadlock */
+
+struct rangelock {
+	off_t rl_start;			/* first byte */
+	off_t rl_end;			/* past the last byte, or RANGELOCK_EOF */
+	off_t rl_maxend;		/* largest rl_end in this subtree */
+	int rl_type;			/* F_RDLCK or F_WRLCK */
+	struct proc *rl_owner;
+	pid_t rl_pid;			/* for F_GETLK */
+	uint32_t rl_prio;		/* treap priority, higher nearer the root */
+	struct rangelock *rl_left;
+	struct rangelock *rl_right;
+};
+
+struct rl_file {
+	struct vnode *rf_vn;
+	struct rangelock *rf_root;
+	unsigned rf_waiters;		/* threads sleeping on a lock of this file */
+	struct rl_file *rf_next;
+};
+
+struct rl_chain {
+	struct lock *rc_lock;
+	struct cv *rc_cv;
+	struct rl_file *rc_head;
+	uint32_t rc_seed;		/* for the treap priorities */
+};
+
+struct rl_waiter {
+	struct proc *rw_proc;
+	struct proc *rw_for;		/* owner of the lock in the way */
+	struct rl_waiter *rw_next;
+};
+
+static struct rl_chain rl_chains[RL_NHASH];
+
+static struct spinlock rl_waitlock = SPINLOCK_INITIALIZER;
+static struct rl_waiter *rl_waiters;
+
+static
+struct rl_chain *
+rl_chain(struct vnode *vn)
+{
+	unsigned h;
+
+	h = (uintptr_t)vn >> 6;
+	h ^= h >> 9;
+	return &rl_chains[h & (RL_NHASH - 1)];
+}
+
+/*
+ * The record of VN in chain RC, made if CREATE and there is none.
+ */
+static
+struct rl_file *
+rl_getfile(struct rl_chain *rc, struct vnode *vn, bool create)
+{
+	struct rl_file *rf;
+
+	for (rf = rc->rc_head; rf != NULL; rf = rf->rf_next) {
+		if (rf->rf_vn == vn) {
+			return rf;
+		}
+	}
+	if (!create) {
+		return NULL;
+	}
+	rf = kmalloc(sizeof(*rf));
+	if (rf == NULL) {
+		return NULL;
+	}
+	rf->rf_vn = vn;
+	rf->rf_root = NULL;
+	rf->rf_waiters = 0;
+	rf->rf_next = rc->rc_head;
+	rc->rc_head = rf;
+	return rf;
+}
+
+/*
+ * Free RF if nothing refers to it any longer.
+ */
+static
+void
+rl_putfile(struct rl_chain *rc, struct rl_file *rf)
+{
+	struct rl_file **pp;
+
+	if (rf->rf_root != NULL || rf->rf_waiters > 0) {
+		return;
+	}
+	for (pp = &rc->rc_head; *pp != rf; pp = &(*pp)->rf_next) {
+		KASSERT(*pp != NULL);
+	}
+	*pp = rf->rf_next;
+	kfree(rf);
+}
+
+////////////////////////////////////////////////////////////
+// treap
+
+static
+void
+rl_fix(struct rangelock *n)
+{
+	off_t m;
+
+	m = n->rl_end;
+	if (n->rl_left != NULL && n->rl_left->rl_maxend > m) {
+		m = n->rl_left->rl_maxend;
+	}
+	if (n->rl_right != NULL && n->rl_right->rl_maxend > m) {
+		m = n->rl_right->rl_maxend;
+	}
+	n->rl_maxend = m;
+}
+
+static
+bool
+rl_before(const struct rangelock *a, const struct rangelock *b)
+{
+	if (a->rl_start != b->rl_start) {
+		return a->rl_start < b->rl_start;
+	}
+	return (uintptr_t)a < (uintptr_t)b;
+}
+
+static
+struct rangelock *
+rl_insert(struct rangelock *root, struct rangelock *n)
+{
+	struct rangelock *top;
+
+	if (root == NULL) {
+		n->rl_left = n->rl_right = NULL;
+		rl_fix(n);
+		return n;
+	}
+	if (rl_before(n, root)) {
+		root->rl_left = rl_insert(root->rl_left, n);
+		if (root->rl_left->rl_prio > root->rl_prio) {
+			/* rotate right */
+			top = root->rl_left;
+			root->rl_left = top->rl_right;
+			top->rl_right = root;
+			rl_fix(root);
+			root = top;
+		}
+	}
+	else {
+		root->rl_right = rl_insert(root->rl_right, n);
+		if (root->rl_right->rl_prio > root->rl_prio) {
+			/* rotate left */
+			top = root->rl_right;
+			root->rl_right = top->rl_left;
+			top->rl_left = root;
+			rl_fix(root);
+			root = top;
+		}
+	}
+	rl_fix(root);
+	return root;
+}
+
+/*
+ * Join two treaps, all of A coming before all of B.
+ */
+static
+struct rangelock *
+rl_join(struct rangelock *a, struct rangelock *b)
+{
+	if (a == NULL) {
+		return b;
+	}
+	if (b == NULL) {
+		return a;
+	}
+	if (a->rl_prio > b->rl_prio) {
+		a->rl_right = rl_join(a->rl_right, b);
+		rl_fix(a);
+		return a;
+	}
+	b->rl_left = rl_join(a, b->rl_left);
+	rl_fix(b);
+	return b;
+}
+
+static
+struct rangelock *
+rl_remove(struct rangelock *root, struct rangelock *n)
+{
+	KASSERT(root != NULL);
+
+	if (root == n) {
+		return rl_join(n->rl_left, n->rl_right);
+	}
+	if (rl_before(n, root)) {
+		root->rl_left = rl_remove(root->rl_left, n);
+	}
+	else {
+		root->rl_right = rl_remove(root->rl_right, n);
+	}
+	rl_fix(root);
+	return root;
+}
+
+/*
+ * What a search is after: locks of (or not of) OWNER, conflicting
+ * with or to be replaced by a lock of type TYPE on [START, END).
+ */
+struct rl_match {
+	struct proc *owner;
+	off_t start;
+	off_t end;
+	int type;
+	bool (*match)(const struct rangelock *n, const struct rl_match *m);
+};
+
+/*
+ * The first lock, in order, which touches [START, END] (ends
+ * included, so that adjacent locks can be merged) and satisfies M.
+ */
+static
+struct rangelock *
+rl_find(struct rangelock *root, const struct rl_match *m)
+{
+	struct rangelock *n;
+
+	if (root == NULL || root->rl_maxend < m->start) {
+		return NULL;
+	}
+	n = rl_find(root->rl_left, m);
+	if (n != NULL) {
+		return n;
+	}
+	if (root->rl_start > m->end) {
+		return NULL;
+	}
+	if (root->rl_end >= m->start && m->match(root, m)) {
+		return root;
+	}
+	return rl_find(root->rl_right, m);
+}
+
+static
+bool
+rl_overlaps(const struct rangelock *n, const struct rl_match *m)
+{
+	return n->rl_start < m->end && n->rl_end > m->start;
+}
+
+/* A lock of another process in the way */
+static
+bool
+rl_conflicts(const struct rangelock *n, const struct rl_match *m)
+{
+	return n->rl_owner != m->owner && rl_overlaps(n, m) &&
+		(n->rl_type == F_WRLCK || m->type == F_WRLCK);
+}
+
+/* A lock of the owner under the new one, or next to it and of its type */
+static
+bool
+rl_replaced(const struct rangelock *n, const struct rl_match *m)
+{
+	return n->rl_owner == m->owner &&
+		(rl_overlaps(n, m) || n->rl_type == m->type);
+}
+
+/* Any lock of the owner */
+static
+bool
+rl_owned(const struct rangelock *n, const struct rl_match *m)
+{
+	return n->rl_owner == m->owner;
+}
+
+////////////////////////////////////////////////////////////
+// waiting
+
+/*
+ * Register W as the current process waiting for OWNER, unless that
+ * makes a cycle: then return EDEADLK. Only the first waiting thread
+ * of each process met is followed.
+ */
+static
+int
+rl_waitfor(struct rl_waiter *w, struct proc *owner)
+{
+	struct rl_waiter *v;
+	struct proc *p;
+	unsigned hops;
+
+	spinlock_acquire(&rl_waitlock);
+	p = owner;
+	for (hops = 0; p != NULL && hops < RL_MAXCHAIN; hops++) {
+		if (p == curproc) {
+			spinlock_release(&rl_waitlock);
+			return EDEADLK;
+		}
+		for (v = rl_waiters; v != NULL && v->rw_proc != p; v = v->rw_next);
+		p = (v != NULL) ? v->rw_for : NULL;
+	}
+	w->rw_proc = curproc;
+	w->rw_for = owner;
+	w->rw_next = rl_waiters;
+	rl_waiters = w;
+	spinlock_release(&rl_waitlock);
+	return 0;
+}
+
+static
+void
+rl_unwait(struct rl_waiter *w)
+{
+	struct rl_waiter **pp;
+
+	spinlock_acquire(&rl_waitlock);
+	for (pp = &rl_waiters; *pp != w; pp = &(*pp)->rw_next) {
+		KASSERT(*pp != NULL);
+	}
+	*pp = w->rw_next;
+	spinlock_release(&rl_waitlock);
+}
+
+////////////////////////////////////////////////////////////
+// the locks of a process
+
+static
+void
+rl_charge(struct proc *proc, int delta)
+{
+	spinlock_acquire(&proc->p_lock);
+	KASSERT(delta >= 0 || proc->p_nrangelocks >= (unsigned)-delta);
+	proc->p_nrangelocks += delta;
+	spinlock_release(&proc->p_lock);
+}
+
+/*
+ * Make TYPE the lock of OWNER on [START, END) of RF; F_UNLCK just
+ * takes away what is there. SPARE holds (at least) the two nodes
+ * needed; whatever is left is freed. Returns whether other locks
+ * can have become possible.
+ */
+static
+bool
+rl_apply(struct rl_chain *rc, struct rl_file *rf, struct proc *owner,
+	 off_t start, off_t end, int type, struct rangelock *spare)
+{
+	struct rangelock *n, *piece, *kept, *next;
+	struct rl_match m;
+	bool freed;
+	int delta;
+
+	m.owner = owner;
+	m.start = start;
+	m.end = end;
+	m.type = type;
+	m.match = rl_replaced;
+
+	kept = NULL;
+	freed = false;
+	delta = 0;
+	while ((n = rl_find(rf->rf_root, &m)) != NULL) {
+		rf->rf_root = rl_remove(rf->rf_root, n);
+		delta--;
+		if (n->rl_type == type) {
+			/* OF THE SAME TYPE: MERGED INTO THE NEW LOCK */
+			if (n->rl_start < m.start) {
+				m.start = n->rl_start;
+			}
+			if (n->rl_end > m.end) {
+				m.end = n->rl_end;
+			}
+			n->rl_right = spare;
+			spare = n;
+			continue;
+		}
+
+		/* OF THE OTHER TYPE: WHAT STICKS OUT ON EITHER SIDE STAYS */
+		freed = true;
+		if (n->rl_end > m.end) {
+			KASSERT(spare != NULL);
+			piece = spare;
+			spare = spare->rl_right;
+			*piece = *n;
+			piece->rl_start = m.end;
+			piece->rl_prio = rc->rc_seed = rc->rc_seed * 1103515245 + 12345;
+			piece->rl_right = kept;
+			kept = piece;
+		}
+		if (n->rl_start < m.start) {
+			n->rl_end = m.start;
+			n->rl_right = kept;
+			kept = n;
+		}
+		else {
+			n->rl_right = spare;
+			spare = n;
+		}
+	}
+	for (; kept != NULL; kept = next) {
+		next = kept->rl_right;
+		rf->rf_root = rl_insert(rf->rf_root, kept);
+		delta++;
+	}
+	if (type != F_UNLCK) {
+		KASSERT(spare != NULL);
+		n = spare;
+		spare = spare->rl_right;
+		n->rl_start = m.start;
+		n->rl_end = m.end;
+		n->rl_type = type;
+		n->rl_owner = owner;
+		n->rl_pid = owner->p_pid;
+		n->rl_prio = rc->rc_seed = rc->rc_seed * 1103515245 + 12345;
+		rf->rf_root = rl_insert(rf->rf_root, n);
+		delta++;
+	}
+
+	for (; spare != NULL; spare = next) {
+		next = spare->rl_right;
+		kfree(spare);
+	}
+	if (delta != 0) {
+		rl_charge(owner, delta);
+	}
+	return freed;
+}
+
+/*
+ * Drop all locks of PROC on RF.
+ */
+static
+void
+rl_dropall(struct rl_chain *rc, struct rl_file *rf, struct proc *proc)
+{
+	struct rangelock *n;
+	struct rl_match m;
+	int count;
+
+	m.owner = proc;
+	m.start = 0;
+	m.end = RANGELOCK_EOF;
+	m.type = F_UNLCK;
+	m.match = rl_owned;
+
+	count = 0;
+	while ((n = rl_find(rf->rf_root, &m)) != NULL) {
+		rf->rf_root = rl_remove(rf->rf_root, n);
+		kfree(n);
+		count++;
+	}
+	if (count > 0) {
+		rl_charge(proc, -count);
+		if (rf->rf_waiters > 0) {
+			cv_broadcast(rc->rc_cv, rc->rc_lock);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// interface
+
+void
+rangelock_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<RL_NHASH; i++) {
+		rl_chains[i].rc_lock = lock_create("rangelock");
+		rl_chains[i].rc_cv = cv_create("rangelock");
+		if (rl_chains[i].rc_lock == NULL ||
+		    rl_chains[i].rc_cv == NULL) {
+			panic("rangelock_bootstrap: Out of memory\n");
+		}
+		rl_chains[i].rc_head = NULL;
+		rl_chains[i].rc_seed = 0x9e3779b9 * (i + 1);
+	}
+}
+
+bool
+rangelock_test(struct vnode *vn, off_t start, off_t end, int type,
+	       struct flock *fl)
+{
+	struct rl_chain *rc;
+	struct rl_file *rf;
+	struct rangelock *n;
+	struct rl_match m;
+
+	KASSERT(start < end);
+
+	m.owner = curproc;
+	m.start = start;
+	m.end = end;
+	m.type = type;
+	m.match = rl_conflicts;
+
+	rc = rl_chain(vn);
+	lock_acquire(rc->rc_lock);
+	rf = rl_getfile(rc, vn, false);
+	n = (rf != NULL) ? rl_find(rf->rf_root, &m) : NULL;
+	if (n != NULL) {
+		fl->l_type = n->rl_type;
+		fl->l_whence = SEEK_SET;
+		fl->l_start = n->rl_start;
+		fl->l_len = (n->rl_end == RANGELOCK_EOF) ? 0 :
+			n->rl_end - n->rl_start;
+		fl->l_pid = n->rl_pid;
+	}
+	lock_release(rc->rc_lock);
+
+	return n != NULL;
+}
+
+int
+rangelock_set(struct vnode *vn, off_t start, off_t end, int type, bool wait)
+{
+	struct rl_chain *rc;
+	struct rl_file *rf;
+	struct rangelock *spare, *n;
+	struct rl_waiter w;
+	struct rl_match m;
+	unsigned i;
+	int result;
+
+	KASSERT(start < end);
+	KASSERT(type == F_RDLCK || type == F_WRLCK || type == F_UNLCK);
+
+	/* THE NODES rl_apply() MAY NEED, WHILE NOTHING HAS CHANGED YET */
+	spare = NULL;
+	for (i=0; i<2; i++) {
+		n = kmalloc(sizeof(*n));
+		if (n == NULL) {
+			result = ENOMEM;
+			goto out;
+		}
+		n->rl_right = spare;
+		spare = n;
+	}
+
+	m.owner = curproc;
+	m.start = start;
+	m.end = end;
+	m.type = type;
+	m.match = rl_conflicts;
+
+	rc = rl_chain(vn);
+	lock_acquire(rc->rc_lock);
+	rf = rl_getfile(rc, vn, type != F_UNLCK);
+	if (rf == NULL) {
+		lock_release(rc->rc_lock);
+		result = (type == F_UNLCK) ? 0 : ENOMEM;
+		goto out;
+	}
+
+	while (type != F_UNLCK &&
+	       (n = rl_find(rf->rf_root, &m)) != NULL) {
+		if (!wait) {
+			result = EAGAIN;
+			goto fail;
+		}
+		result = rl_waitfor(&w, n->rl_owner);
+		if (result) {
+			goto fail;
+		}
+		/* AFTER REGISTERING, SO THAT rangelock_wakeproc() SEES US */
+		if (curproc->p_exiting) {
+			rl_unwait(&w);
+			result = EINTR;
+			goto fail;
+		}
+		rf->rf_waiters++;
+		cv_wait(rc->rc_cv, rc->rc_lock);
+		rf->rf_waiters--;
+		rl_unwait(&w);
+		if (curproc->p_exiting) {
+			result = EINTR;
+			goto fail;
+		}
+	}
+
+	if (rl_apply(rc, rf, curproc, start, end, type, spare) &&
+	    rf->rf_waiters > 0) {
+		cv_broadcast(rc->rc_cv, rc->rc_lock);
+	}
+	rl_putfile(rc, rf);
+	lock_release(rc->rc_lock);
+	return 0;
+
+ fail:
+	rl_putfile(rc, rf);
+	lock_release(rc->rc_lock);
+ out:
+	while (spare != NULL) {
+		n = spare;
+		spare = spare->rl_right;
+		kfree(n);
+	}
+	return result;
+}
+
+void
+rangelock_close(struct proc *proc, struct vnode *vn)
+{
+	struct rl_chain *rc;
+	struct rl_file *rf;
+
+	rc = rl_chain(vn);
+	lock_acquire(rc->rc_lock);
+	rf = rl_getfile(rc, vn, false);
+	if (rf != NULL) {
+		rl_dropall(rc, rf, proc);
+		rl_putfile(rc, rf);
+	}
+	lock_release(rc->rc_lock);
+}
+
+void
+rangelock_exit(struct proc *proc)
+{
+	struct rl_chain *rc;
+	struct rl_file *rf, *next;
+	struct rl_waiter *w;
+	unsigned i;
+
+	for (i=0; i<RL_NHASH && proc->p_nrangelocks > 0; i++) {
+		rc = &rl_chains[i];
+
+		lock_acquire(rc->rc_lock);
+		for (rf = rc->rc_head; rf != NULL; rf = next) {
+			next = rf->rf_next;
+			rl_dropall(rc, rf, proc);
+			rl_putfile(rc, rf);
+		}
+		lock_release(rc->rc_lock);
+	}
+	KASSERT(proc->p_nrangelocks == 0);
+
+	/* THE ADDRESS MAY BE REUSED: NOBODY WAITS FOR US ANY LONGER */
+	spinlock_acquire(&rl_waitlock);
+	for (w = rl_waiters; w != NULL; w = w->rw_next) {
+		if (w->rw_for == proc) {
+			w->rw_for = NULL;
+		}
+	}
+	spinlock_release(&rl_waitlock);
+}
+
+void
+rangelock_wakeproc(struct proc *proc)
+{
+	struct rl_waiter *w;
+	unsigned i;
+
+	spinlock_acquire(&rl_waitlock);
+	for (w = rl_waiters; w != NULL && w->rw_proc != proc; w = w->rw_next);
+	spinlock_release(&rl_waitlock);
+	if (w == NULL) {
+		return;
+	}
+
+	for (i=0; i<RL_NHASH; i++) {
+		lock_acquire(rl_chains[i].rc_lock);
+		cv_broadcast(rl_chains[i].rc_cv, rl_chains[i].rc_lock);
+		lock_release(rl_chains[i].rc_lock);
+	}
+}
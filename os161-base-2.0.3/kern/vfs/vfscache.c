@@ -0,0 +1,437 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * VFS name lookup cache.
+ *
+ * Remembers the result of VOP_LOOKUP(dir, name) so that repeated
+ * lookups of the same path don't have to go back to the filesystem.
+ * Failed lookups (ENOENT) are remembered too, as negative entries.
+ *
+ * The key is whatever vfs_lookup handed to VOP_LOOKUP: the vnode the
+ * lookup started from and the rest of the path, which may have more
+ * than one component. Entries hold a reference to both vnodes.
+ *
+ * When a name is created, removed or renamed in directory DIR, the
+ * entries for (DIR, name) are dropped, and so is every multi-component
+ * entry on the same filesystem, since such a path may run through the
+ * name that changed. Entries for a filesystem are also dropped before
+ * it is unmounted, so the references they hold don't keep it busy.
+ *
+ * The table is small and fixed-size; when it is full, the least
+ * recently used entry is recycled. It is protected by dcache_lock, a
+ * spinlock, and not by the big VFS lock, so that lookups on different
+ * filesystems don't wait for each other. Dropping an entry may be the
+ * last reference to its vnodes, and reclaiming a vnode can sleep, so
+ * entries being dropped are set aside while the lock is held and
+ * their references let go of after it is released (dcache_reap).
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vfs.h>
+#include <vnode.h>
+
+/* Number of entries, and of hash chains */
+#define DCACHE_SIZE    64
+#define DCACHE_HASH    31
+
+struct dcentry {
+	struct vnode *dc_dir;           /* starting vnode, or NULL if unused */
+	struct vnode *dc_vn;            /* result, or NULL if negative */
+	unsigned dc_hash;               /* hash of (dc_dir, dc_name) */
+	bool dc_reaping;                /* dropped; references not let go yet */
+	struct dcentry *dc_hashnext;    /* hash chain, or reap list */
+	struct dcentry *dc_lruprev;     /* LRU list */
+	struct dcentry *dc_lrunext;
+	char dc_name[VFS_DCACHE_NAMELEN+1];
+};
+
+static struct spinlock dcache_lock = SPINLOCK_INITIALIZER;
+static struct dcentry dcache[DCACHE_SIZE];
+static struct dcentry *dcache_hash[DCACHE_HASH];
+static struct dcentry *dcache_lruhead, *dcache_lrutail;
+static bool dcache_ready;
+
+static
+unsigned
+dcache_hashval(struct vnode *dir, const char *name)
+{
+	unsigned h = (uintptr_t)dir >> 4;
+
+	while (*name) {
+		h = h*33 + (unsigned char)*name++;
+	}
+	return h;
+}
+
+static
+void
+dcache_lru_remove(struct dcentry *dc)
+{
+	if (dc->dc_lruprev != NULL) {
+		dc->dc_lruprev->dc_lrunext = dc->dc_lrunext;
+	}
+	else {
+		dcache_lruhead = dc->dc_lrunext;
+	}
+	if (dc->dc_lrunext != NULL) {
+		dc->dc_lrunext->dc_lruprev = dc->dc_lruprev;
+	}
+	else {
+		dcache_lrutail = dc->dc_lruprev;
+	}
+}
+
+static
+void
+dcache_lru_addtail(struct dcentry *dc)
+{
+	dc->dc_lrunext = NULL;
+	dc->dc_lruprev = dcache_lrutail;
+	if (dcache_lrutail != NULL) {
+		dcache_lrutail->dc_lrunext = dc;
+	}
+	else {
+		dcache_lruhead = dc;
+	}
+	dcache_lrutail = dc;
+}
+
+static
+void
+dcache_lru_addhead(struct dcentry *dc)
+{
+	dc->dc_lruprev = NULL;
+	dc->dc_lrunext = dcache_lruhead;
+	if (dcache_lruhead != NULL) {
+		dcache_lruhead->dc_lruprev = dc;
+	}
+	else {
+		dcache_lrutail = dc;
+	}
+	dcache_lruhead = dc;
+}
+
+/*
+ * Set up the free list the first time through.
+ */
+static
+void
+dcache_init(void)
+{
+	unsigned i;
+
+	for (i=0; i<DCACHE_SIZE; i++) {
+		dcache_lru_addtail(&dcache[i]);
+	}
+	dcache_ready = true;
+}
+
+/*
+ * Take an entry off its hash chain; dcache_lock is held.
+ */
+static
+void
+dcache_unhash(struct dcentry *dc)
+{
+	struct dcentry **pp;
+
+	KASSERT(dc->dc_dir != NULL);
+	KASSERT(!dc->dc_reaping);
+
+	pp = &dcache_hash[dc->dc_hash % DCACHE_HASH];
+	while (*pp != dc) {
+		KASSERT(*pp != NULL);
+		pp = &(*pp)->dc_hashnext;
+	}
+	*pp = dc->dc_hashnext;
+	dc->dc_hashnext = NULL;
+}
+
+/*
+ * Take an entry out of the cache and put it on the list *REAP, still
+ * holding its references; dcache_lock is held.
+ */
+static
+void
+dcache_drop(struct dcentry *dc, struct dcentry **reap)
+{
+	dcache_unhash(dc);
+	dcache_lru_remove(dc);
+	dc->dc_reaping = true;
+	dc->dc_hashnext = *reap;
+	*reap = dc;
+}
+
+/*
+ * Let go of the references of the entries on REAP and make them free
+ * for reuse. Called without dcache_lock, since this may reclaim the
+ * vnodes; nobody else looks at entries while they are being reaped.
+ */
+static
+void
+dcache_reap(struct dcentry *reap)
+{
+	struct dcentry *dc;
+
+	if (reap == NULL) {
+		return;
+	}
+
+	for (dc = reap; dc != NULL; dc = dc->dc_hashnext) {
+		if (dc->dc_vn != NULL) {
+			VOP_DECREF(dc->dc_vn);
+		}
+		VOP_DECREF(dc->dc_dir);
+	}
+
+	spinlock_acquire(&dcache_lock);
+	while (reap != NULL) {
+		dc = reap;
+		reap = dc->dc_hashnext;
+		dc->dc_dir = NULL;
+		dc->dc_vn = NULL;
+		dc->dc_hashnext = NULL;
+		dc->dc_reaping = false;
+		dcache_lru_addhead(dc);
+	}
+	spinlock_release(&dcache_lock);
+}
+
+/*
+ * Find the entry for (DIR, NAME), or NULL; dcache_lock is held.
+ */
+static
+struct dcentry *
+dcache_find(struct vnode *dir, const char *name)
+{
+	struct dcentry *dc;
+	unsigned hash;
+
+	hash = dcache_hashval(dir, name);
+	for (dc = dcache_hash[hash % DCACHE_HASH]; dc != NULL;
+	     dc = dc->dc_hashnext) {
+		if (dc->dc_hash == hash && dc->dc_dir == dir &&
+		    !strcmp(dc->dc_name, name)) {
+			return dc;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Look up (DIR, NAME). On a hit, returns true and stores the lookup's
+ * result in *RESULT: 0 with an incref'd vnode in *RET, or ENOENT for
+ * a negative entry. On a miss, returns false.
+ */
+bool
+vfs_dcache_lookup(struct vnode *dir, const char *name,
+		  struct vnode **ret, int *result)
+{
+	struct dcentry *dc;
+
+	if (strlen(name) > VFS_DCACHE_NAMELEN) {
+		return false;
+	}
+
+	spinlock_acquire(&dcache_lock);
+	if (!dcache_ready) {
+		spinlock_release(&dcache_lock);
+		return false;
+	}
+
+	dc = dcache_find(dir, name);
+	if (dc == NULL) {
+		spinlock_release(&dcache_lock);
+		return false;
+	}
+
+	/* Move to the most-recently-used end */
+	dcache_lru_remove(dc);
+	dcache_lru_addtail(dc);
+
+	if (dc->dc_vn == NULL) {
+		*result = ENOENT;
+	}
+	else {
+		VOP_INCREF(dc->dc_vn);
+		*ret = dc->dc_vn;
+		*result = 0;
+	}
+	spinlock_release(&dcache_lock);
+	return true;
+}
+
+/*
+ * Remember that looking up NAME from DIR yields VN (NULL for ENOENT).
+ */
+void
+vfs_dcache_enter(struct vnode *dir, const char *name, struct vnode *vn)
+{
+	struct dcentry *dc, *reap = NULL;
+	struct vnode *olddir = NULL, *oldvn = NULL;
+
+	if (strlen(name) > VFS_DCACHE_NAMELEN) {
+		return;
+	}
+
+	spinlock_acquire(&dcache_lock);
+	if (!dcache_ready) {
+		dcache_init();
+	}
+
+	/* Don't make duplicates */
+	dc = dcache_find(dir, name);
+	if (dc != NULL) {
+		dcache_drop(dc, &reap);
+	}
+
+	dc = dcache_lruhead;
+	if (dc == NULL) {
+		/* Every entry is being reaped at the moment; skip it */
+		spinlock_release(&dcache_lock);
+		dcache_reap(reap);
+		return;
+	}
+	if (dc->dc_dir != NULL) {
+		/* Recycle it, letting go of its references below */
+		dcache_unhash(dc);
+		olddir = dc->dc_dir;
+		oldvn = dc->dc_vn;
+	}
+
+	VOP_INCREF(dir);
+	if (vn != NULL) {
+		VOP_INCREF(vn);
+	}
+	dc->dc_dir = dir;
+	dc->dc_vn = vn;
+	strcpy(dc->dc_name, name);
+	dc->dc_hash = dcache_hashval(dir, name);
+	dc->dc_hashnext = dcache_hash[dc->dc_hash % DCACHE_HASH];
+	dcache_hash[dc->dc_hash % DCACHE_HASH] = dc;
+
+	dcache_lru_remove(dc);
+	dcache_lru_addtail(dc);
+	spinlock_release(&dcache_lock);
+
+	if (oldvn != NULL) {
+		VOP_DECREF(oldvn);
+	}
+	if (olddir != NULL) {
+		VOP_DECREF(olddir);
+	}
+	dcache_reap(reap);
+}
+
+/*
+ * Drop the entry for exactly (DIR, NAME), if any.
+ */
+void
+vfs_dcache_invalidate_one(struct vnode *dir, const char *name)
+{
+	struct dcentry *dc, *reap = NULL;
+
+	if (strlen(name) > VFS_DCACHE_NAMELEN) {
+		return;
+	}
+
+	spinlock_acquire(&dcache_lock);
+	if (dcache_ready) {
+		dc = dcache_find(dir, name);
+		if (dc != NULL) {
+			dcache_drop(dc, &reap);
+		}
+	}
+	spinlock_release(&dcache_lock);
+
+	dcache_reap(reap);
+}
+
+/*
+ * NAME in directory DIR has been created, removed, or renamed.
+ */
+void
+vfs_dcache_invalidate(struct vnode *dir, const char *name)
+{
+	struct dcentry *dc, *reap = NULL;
+	unsigned i;
+
+	spinlock_acquire(&dcache_lock);
+
+	if (dcache_ready) {
+		if (strlen(name) <= VFS_DCACHE_NAMELEN) {
+			dc = dcache_find(dir, name);
+			if (dc != NULL) {
+				dcache_drop(dc, &reap);
+			}
+		}
+
+		/* Multi-component paths might go through NAME */
+		for (i=0; i<DCACHE_SIZE; i++) {
+			dc = &dcache[i];
+			if (dc->dc_dir != NULL && !dc->dc_reaping &&
+			    dc->dc_dir->vn_fs == dir->vn_fs &&
+			    strchr(dc->dc_name, '/') != NULL) {
+				dcache_drop(dc, &reap);
+			}
+		}
+	}
+
+	spinlock_release(&dcache_lock);
+	dcache_reap(reap);
+}
+
+/*
+ * Drop everything belonging to FS, which is about to be unmounted.
+ */
+void
+vfs_dcache_purgefs(struct fs *fs)
+{
+	struct dcentry *dc, *reap = NULL;
+	unsigned i;
+
+	spinlock_acquire(&dcache_lock);
+
+	if (dcache_ready) {
+		for (i=0; i<DCACHE_SIZE; i++) {
+			dc = &dcache[i];
+			if (dc->dc_dir != NULL && !dc->dc_reaping &&
+			    dc->dc_dir->vn_fs == fs) {
+				dcache_drop(dc, &reap);
+			}
+		}
+	}
+
+	spinlock_release(&dcache_lock);
+	dcache_reap(reap);
+}
@@ -43,6 +43,7 @@
 #include <fs.h>
 #include <vnode.h>
 #include <device.h>
+#include <poll.h>
 
 /*
  * Structure for a single named device.
@@ -72,14 +73,32 @@
  * returns ENXIO. Referencing kd_name on a device that is not
  * mountable and has no filesystem, or kd_rawname on a mountable
  * device, returns the device itself.
+ *
+ * Each of the names a device answers to (kd_name, kd_rawname if set,
+ * and the volume name while a filesystem with one is mounted) is
+ * entered in a hash table by one of the kdname structures embedded
+ * in the knowndev, so name lookups don't have to walk every device
+ * doing string compares. Which of the three matched tells
+ * vfs_getroot what to hand back.
  */
 
+struct knowndev;
+
+struct kdname {
+	const char *kn_name;		/* name, or NULL if not hashed */
+	struct knowndev *kn_kd;		/* device it belongs to */
+	struct kdname *kn_next;		/* hash chain */
+};
+
 struct knowndev {
 	char *kd_name;
 	char *kd_rawname;
 	struct device *kd_device;
 	struct vnode *kd_vnode;
 	struct fs *kd_fs;
+	struct kdname kd_hname;		/* entry for kd_name */
+	struct kdname kd_hraw;		/* entry for kd_rawname */
+	struct kdname kd_hvol;		/* entry for the volume name */
 };
 
 /* A placeholder for kd_fs for devices used as swap */
@@ -90,6 +109,11 @@ DEFARRAY(knowndev, static __UNUSED inline);
 
 static struct knowndevarray *knowndevs;
 
+/* Number of hash chains for device and volume names */
+#define KD_HASH		31
+
+static struct kdname *kdname_hash[KD_HASH];
+
 /* The big lock for all FS ops. Remove for filesystem assignment. */
 static struct lock *vfs_biglock;
 static unsigned vfs_biglock_depth;
@@ -112,7 +136,10 @@ vfs_bootstrap(void)
 	}
 	vfs_biglock_depth = 0;
 
+	poll_bootstrap();
 	devnull_create();
+	devzero_create();
+	devkstat_create();
 	semfs_bootstrap();
 }
 
@@ -166,6 +193,111 @@ vfs_biglock_do_i_hold(void)
 	return lock_do_i_hold(vfs_biglock);
 }
 
+/*
+ * Name hash operations. All of these are covered by vfs_biglock.
+ */
+static
+unsigned
+kdname_hashval(const char *name)
+{
+	unsigned h = 0;
+
+	while (*name) {
+		h = h*33 + (unsigned char)*name++;
+	}
+	return h % KD_HASH;
+}
+
+/*
+ * Enter KN in the table as NAME for KD. NAME must stay valid until
+ * kdname_remove. Entries go on the end of the chain, so if the same
+ * name is somehow entered twice the older device keeps winning, as
+ * it did with the linear scan.
+ */
+static
+void
+kdname_add(struct kdname *kn, struct knowndev *kd, const char *name)
+{
+	struct kdname **pp;
+
+	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(kn->kn_name == NULL);
+
+	kn->kn_name = name;
+	kn->kn_kd = kd;
+	kn->kn_next = NULL;
+
+	pp = &kdname_hash[kdname_hashval(name)];
+	while (*pp != NULL) {
+		pp = &(*pp)->kn_next;
+	}
+	*pp = kn;
+}
+
+/*
+ * Take KN out of the table, if it's in it. This finds the chain
+ * from the name, so must be called before the name is freed.
+ */
+static
+void
+kdname_remove(struct kdname *kn)
+{
+	struct kdname **pp;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	if (kn->kn_name == NULL) {
+		return;
+	}
+
+	pp = &kdname_hash[kdname_hashval(kn->kn_name)];
+	while (*pp != kn) {
+		KASSERT(*pp != NULL);
+		pp = &(*pp)->kn_next;
+	}
+	*pp = kn->kn_next;
+
+	kn->kn_name = NULL;
+	kn->kn_next = NULL;
+}
+
+/*
+ * Find the entry for NAME, or return NULL.
+ */
+static
+struct kdname *
+kdname_find(const char *name)
+{
+	struct kdname *kn;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	for (kn = kdname_hash[kdname_hashval(name)]; kn != NULL;
+	     kn = kn->kn_next) {
+		if (!strcmp(kn->kn_name, name)) {
+			return kn;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Hash the volume name, if any, of the filesystem mounted on KD.
+ */
+static
+void
+kdname_addvol(struct knowndev *kd)
+{
+	const char *volname;
+
+	KASSERT(kd->kd_fs != NULL && kd->kd_fs != SWAP_FS);
+
+	volname = FSOP_GETVOLNAME(kd->kd_fs);
+	if (volname != NULL) {
+		kdname_add(&kd->kd_hvol, kd, volname);
+	}
+}
+
 /*
  * Global sync function - call FSOP_SYNC on all devices.
  */
@@ -197,77 +329,61 @@ vfs_sync(void)
 int
 vfs_getroot(const char *devname, struct vnode **ret)
 {
+	struct kdname *kn;
 	struct knowndev *kd;
-	unsigned i, num;
 
 	KASSERT(vfs_biglock_do_i_hold());
 
-	num = knowndevarray_num(knowndevs);
-	for (i=0; i<num; i++) {
-		kd = knowndevarray_get(knowndevs, i);
-
-		/*
-		 * If this device has a mounted filesystem, and
-		 * DEVNAME names either the filesystem or the device,
-		 * return the root of the filesystem.
-		 *
-		 * If it has no mounted filesystem, it's mountable,
-		 * and DEVNAME names the device, return ENXIO.
-		 */
-
-		if (kd->kd_fs != NULL && kd->kd_fs != SWAP_FS) {
-			const char *volname;
-			volname = FSOP_GETVOLNAME(kd->kd_fs);
+	kn = kdname_find(devname);
+	if (kn == NULL) {
+		/* The device specified by devname doesn't exist. */
+		return ENODEV;
+	}
+	kd = kn->kn_kd;
 
-			if (!strcmp(kd->kd_name, devname) ||
-			    (volname!=NULL && !strcmp(volname, devname))) {
-				return FSOP_GETROOT(kd->kd_fs, ret);
-			}
-		}
-		else {
-			if (kd->kd_rawname!=NULL &&
-			    !strcmp(kd->kd_name, devname)) {
-				return ENXIO;
-			}
-		}
+	/*
+	 * The volume name is only in the table while the filesystem
+	 * is mounted; it names the root of the filesystem.
+	 */
+	if (kn == &kd->kd_hvol) {
+		KASSERT(kd->kd_fs != NULL && kd->kd_fs != SWAP_FS);
+		return FSOP_GETROOT(kd->kd_fs, ret);
+	}
 
-		/*
-		 * If DEVNAME names the device, and we get here, it
-		 * must have no fs and not be mountable. In this case,
-		 * we return the device itself.
-		 */
-		if (!strcmp(kd->kd_name, devname)) {
-			KASSERT(kd->kd_fs==NULL);
-			KASSERT(kd->kd_rawname==NULL);
-			KASSERT(kd->kd_device != NULL);
-			VOP_INCREF(kd->kd_vnode);
-			*ret = kd->kd_vnode;
-			return 0;
-		}
+	/*
+	 * If DEVNAME names the raw device, return the device itself.
+	 */
+	if (kn == &kd->kd_hraw) {
+		KASSERT(kd->kd_device != NULL);
+		VOP_INCREF(kd->kd_vnode);
+		*ret = kd->kd_vnode;
+		return 0;
+	}
 
-		/*
-		 * If the device has a rawname and DEVNAME names that,
-		 * return the device itself.
-		 */
-		if (kd->kd_rawname!=NULL && !strcmp(kd->kd_rawname, devname)) {
-			KASSERT(kd->kd_device != NULL);
-			VOP_INCREF(kd->kd_vnode);
-			*ret = kd->kd_vnode;
-			return 0;
-		}
+	KASSERT(kn == &kd->kd_hname);
 
-		/*
-		 * If none of the above tests matched, we didn't name
-		 * any of the names of this device, so go on to the
-		 * next one.
-		 */
+	/*
+	 * If this device has a mounted filesystem, return its root.
+	 *
+	 * If it has no mounted filesystem and it's mountable, return
+	 * ENXIO.
+	 */
+	if (kd->kd_fs != NULL && kd->kd_fs != SWAP_FS) {
+		return FSOP_GETROOT(kd->kd_fs, ret);
+	}
+	if (kd->kd_rawname != NULL) {
+		return ENXIO;
 	}
 
 	/*
-	 * If we got here, the device specified by devname doesn't exist.
+	 * Otherwise it must have no fs and not be mountable. In this
+	 * case, we return the device itself.
 	 */
-
-	return ENODEV;
+	KASSERT(kd->kd_fs==NULL);
+	KASSERT(kd->kd_device != NULL);
+	VOP_INCREF(kd->kd_vnode);
+	*ret = kd->kd_vnode;
+	return 0;
 }
 
 /*
@@ -318,66 +434,20 @@ mkrawname(const char *name)
 }
 
 
-/*
- * Check if the two strings passed in are the same, if they're both
- * not NULL (the latter part being significant).
- */
-static
-inline
-int
-samestring(const char *a, const char *b)
-{
-	if (a==NULL || b==NULL) {
-		return 0;
-	}
-	return !strcmp(a, b);
-}
-
-/*
- * Check if the first string passed is the same as any of the three others,
- * if they're not NULL.
- */
-static
-inline
-int
-samestring3(const char *a, const char *b, const char *c, const char *d)
-{
-	return samestring(a,b) || samestring(a,c) || samestring(a,d);
-}
-
 /*
  * Check if any of the three names passed in already exists as a device
- * name.
+ * name. Any of them may be NULL.
  */
 
 static
 int
 badnames(const char *n1, const char *n2, const char *n3)
 {
-	const char *volname;
-	unsigned i, num;
-	struct knowndev *kd;
-
 	KASSERT(vfs_biglock_do_i_hold());
 
-	num = knowndevarray_num(knowndevs);
-	for (i=0; i<num; i++) {
-		kd = knowndevarray_get(knowndevs, i);
-
-		if (kd->kd_fs != NULL && kd->kd_fs != SWAP_FS) {
-			volname = FSOP_GETVOLNAME(kd->kd_fs);
-			if (samestring3(volname, n1, n2, n3)) {
-				return 1;
-			}
-		}
-
-		if (samestring3(kd->kd_rawname, n1, n2, n3) ||
-		    samestring3(kd->kd_name, n1, n2, n3)) {
-			return 1;
-		}
-	}
-
-	return 0;
+	return (n1 != NULL && kdname_find(n1) != NULL) ||
+		(n2 != NULL && kdname_find(n2) != NULL) ||
+		(n3 != NULL && kdname_find(n3) != NULL);
 }
 
 /*
@@ -433,6 +503,9 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 	kd->kd_device = dev;
 	kd->kd_vnode = vnode;
 	kd->kd_fs = fs;
+	kd->kd_hname.kn_name = NULL;
+	kd->kd_hraw.kn_name = NULL;
+	kd->kd_hvol.kn_name = NULL;
 
 	if (fs!=NULL) {
 		volname = FSOP_GETVOLNAME(fs);
@@ -453,6 +526,14 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 		dev->d_devnumber = index+1;
 	}
 
+	kdname_add(&kd->kd_hname, kd, name);
+	if (rawname != NULL) {
+		kdname_add(&kd->kd_hraw, kd, rawname);
+	}
+	if (volname != NULL) {
+		kdname_add(&kd->kd_hvol, kd, volname);
+	}
+
 	vfs_biglock_release();
 	return 0;
 
@@ -505,27 +586,19 @@ static
 int
 findmount(const char *devname, struct knowndev **result)
 {
-	struct knowndev *dev;
-	unsigned i, num;
-	bool found = false;
+	struct kdname *kn;
 
 	KASSERT(vfs_biglock_do_i_hold());
 
-	num = knowndevarray_num(knowndevs);
-	for (i=0; !found && i<num; i++) {
-		dev = knowndevarray_get(knowndevs, i);
-		if (dev->kd_rawname==NULL) {
-			/* not mountable/unmountable */
-			continue;
-		}
-
-		if (!strcmp(devname, dev->kd_name)) {
-			*result = dev;
-			found = true;
-		}
+	kn = kdname_find(devname);
+	if (kn == NULL || kn != &kn->kn_kd->kd_hname ||
+	    kn->kn_kd->kd_rawname == NULL) {
+		/* no such device, or not mountable/unmountable */
+		return ENODEV;
 	}
 
-	return found ? 0 : ENODEV;
+	*result = kn->kn_kd;
+	return 0;
 }
 
 /*
@@ -568,6 +641,7 @@ vfs_mount(const char *devname, void *data,
 	KASSERT(fs != SWAP_FS); 
 
 	kd->kd_fs = fs;
+	kdname_addvol(kd);
 
 	volname = FSOP_GETVOLNAME(fs);
 	kprintf("vfs: Mounted %s: on %s\n",
@@ -654,14 +728,21 @@ vfs_unmount(const char *devname)
 	KASSERT(kd->kd_rawname != NULL);
 	KASSERT(kd->kd_device != NULL);
 
+	/* drop cached names, which hold vnode references */
+	vfs_dcache_purgefs(kd->kd_fs);
+
 	/* sync the fs */
 	result = FSOP_SYNC(kd->kd_fs);
 	if (result) {
 		goto fail;
 	}
 
+	/* the volume name belongs to the fs, so unhash it first */
+	kdname_remove(&kd->kd_hvol);
+
 	result = FSOP_UNMOUNT(kd->kd_fs);
 	if (result) {
+		kdname_addvol(kd);
 		goto fail;
 	}
 
@@ -745,6 +826,8 @@ vfs_unmountall(void)
 
 		kprintf("vfs: Unmounting %s:\n", dev->kd_name);
 
+		vfs_dcache_purgefs(dev->kd_fs);
+
 		result = FSOP_SYNC(dev->kd_fs);
 		if (result) {
 			kprintf("vfs: Warning: sync failed for %s: %s, trying "
@@ -763,16 +846,20 @@ vfs_unmountall(void)
 			}
 		}
 
+		kdname_remove(&dev->kd_hvol);
+
 		result = FSOP_UNMOUNT(dev->kd_fs);
 		if (result == EBUSY) {
 			kprintf("vfs: Cannot unmount %s: (busy)\n",
 				dev->kd_name);
+			kdname_addvol(dev);
 			continue;
 		}
 		if (result) {
 			kprintf("vfs: Warning: unmount failed for %s:"
 				" %s, already synced, dropping...\n",
 				dev->kd_name, strerror(result));
+			kdname_addvol(dev);
 			continue;
 		}
 
@@ -42,17 +42,27 @@
 
 static struct vnode *bootfs_vnode = NULL;
 
+/*
+ * The device or volume name bootfs_vnode was set from, without the
+ * colon. Paths starting with this name (which is most of them, since
+ * the boot filesystem is where programs live) can start from
+ * bootfs_vnode directly instead of asking the filesystem for its
+ * root again. Empty when there is no bootfs.
+ */
+static char bootfs_name[NAME_MAX+1];
+
 /*
  * Helper function for actually changing bootfs_vnode.
  */
 static
 void
-change_bootfs(struct vnode *newvn)
+change_bootfs(struct vnode *newvn, const char *newname)
 {
 	struct vnode *oldvn;
 
 	oldvn = bootfs_vnode;
 	bootfs_vnode = newvn;
+	strcpy(bootfs_name, newname);
 
 	if (oldvn != NULL) {
 		VOP_DECREF(oldvn);
@@ -102,7 +112,9 @@ vfs_setbootfs(const char *fsname)
 		return result;
 	}
 
-	change_bootfs(newguy);
+	/* drop the colon for bootfs_name */
+	tmp[strlen(tmp)-1] = 0;
+	change_bootfs(newguy, tmp);
 
 	vfs_biglock_release();
 	return 0;
@@ -115,7 +127,7 @@ void
 vfs_clearbootfs(void)
 {
 	vfs_biglock_acquire();
-	change_bootfs(NULL);
+	change_bootfs(NULL, "");
 	vfs_biglock_release();
 }
 
@@ -178,6 +190,12 @@ getdevice(char *path, char **subpath, struct vnode **startvn)
 		}
 		*subpath = &path[colon+1];
 
+		if (bootfs_vnode != NULL && !strcmp(path, bootfs_name)) {
+			VOP_INCREF(bootfs_vnode);
+			*startvn = bootfs_vnode;
+			return 0;
+		}
+
 		result = vfs_getroot(path, startvn);
 		if (result) {
 			return result;
@@ -215,7 +233,15 @@ getdevice(char *path, char **subpath, struct vnode **startvn)
 		 */
 		KASSERT(vn->vn_fs!=NULL);
 
-		result = FSOP_GETROOT(vn->vn_fs, startvn);
+		if (bootfs_vnode != NULL && vn->vn_fs == bootfs_vnode->vn_fs) {
+			/* on the boot filesystem; we have its root */
+			VOP_INCREF(bootfs_vnode);
+			*startvn = bootfs_vnode;
+			result = 0;
+		}
+		else {
+			result = FSOP_GETROOT(vn->vn_fs, startvn);
+		}
 
 		VOP_DECREF(vn);
 
@@ -237,6 +263,13 @@ getdevice(char *path, char **subpath, struct vnode **startvn)
 /*
  * Name-to-vnode translation.
  * (In BSD, both of these are subsumed by namei().)
+ *
+ * The big VFS lock is only held while getdevice picks the starting
+ * vnode, which involves the device list and bootfs_vnode. The lookup
+ * itself runs under the filesystem's own locks, so lookups on
+ * different filesystems don't wait for each other's disk I/O. The
+ * reference to the starting vnode keeps its filesystem from being
+ * unmounted meanwhile.
  */
 
 int
@@ -247,10 +280,9 @@ vfs_lookparent(char *path, struct vnode **retval,
 	int result;
 
 	vfs_biglock_acquire();
-
 	result = getdevice(path, &path, &startvn);
+	vfs_biglock_release();
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
@@ -267,8 +299,6 @@ vfs_lookparent(char *path, struct vnode **retval,
 	}
 
 	VOP_DECREF(startvn);
-
-	vfs_biglock_release();
 	return result;
 }
 
@@ -276,25 +306,43 @@ int
 vfs_lookup(char *path, struct vnode **retval)
 {
 	struct vnode *startvn;
+	char key[VFS_DCACHE_NAMELEN+1];
+	bool cacheable;
 	int result;
 
 	vfs_biglock_acquire();
-
 	result = getdevice(path, &path, &startvn);
+	vfs_biglock_release();
 	if (result) {
-		vfs_biglock_release();
 		return result;
 	}
 
 	if (strlen(path)==0) {
 		*retval = startvn;
-		vfs_biglock_release();
 		return 0;
 	}
 
+	/* Try the name cache first */
+	if (vfs_dcache_lookup(startvn, path, retval, &result)) {
+		VOP_DECREF(startvn);
+		return result;
+	}
+
+	/* VOP_LOOKUP may scribble on the path, so save the key */
+	cacheable = strlen(path) <= VFS_DCACHE_NAMELEN;
+	if (cacheable) {
+		strcpy(key, path);
+	}
+
 	result = VOP_LOOKUP(startvn, path, retval);
 
+	if (cacheable && result == 0) {
+		vfs_dcache_enter(startvn, key, *retval);
+	}
+	else if (cacheable && result == ENOENT) {
+		vfs_dcache_enter(startvn, key, NULL);
+	}
+
 	VOP_DECREF(startvn);
-	vfs_biglock_release();
 	return result;
 }
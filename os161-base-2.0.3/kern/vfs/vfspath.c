@@ -38,6 +38,9 @@
 #include <lib.h>
 #include <vfs.h>
 #include <vnode.h>
+#include <vm.h>
+#include <addrspace.h>
+#include "opt-shell.h"
 
 
 /* Does most of the work for open(). */
@@ -74,6 +77,10 @@ vfs_open(char *path, int openflags, mode_t mode, struct vnode **ret)
 		}
 
 		result = VOP_CREAT(dir, name, excl, mode, &vn);
+		if (result == 0) {
+			/* Forget any negative entry for the name */
+			vfs_dcache_invalidate(dir, name);
+		}
 
 		VOP_DECREF(dir);
 	}
@@ -93,6 +100,14 @@ vfs_open(char *path, int openflags, mode_t mode, struct vnode **ret)
 		return result;
 	}
 
+#if OPT_SHELL
+	if (canwrite) {
+		/* Running copies keep their pages; new ones read the file again */
+		vm_textcache_purge(vn);
+		load_elf_purge(vn);
+	}
+#endif
+
 	if (openflags & O_TRUNC) {
 		if (canwrite==0) {
 			result = EINVAL;
@@ -146,6 +161,7 @@ vfs_remove(char *path)
 	}
 
 	result = VOP_REMOVE(dir, name);
+	vfs_dcache_invalidate(dir, name);
 	VOP_DECREF(dir);
 
 	return result;
@@ -179,6 +195,8 @@ vfs_rename(char *oldpath, char *newpath)
 	}
 
 	result = VOP_RENAME(olddir, oldname, newdir, newname);
+	vfs_dcache_invalidate(olddir, oldname);
+	vfs_dcache_invalidate(newdir, newname);
 
 	VOP_DECREF(newdir);
 	VOP_DECREF(olddir);
@@ -213,6 +231,7 @@ vfs_link(char *oldpath, char *newpath)
 	}
 
 	result = VOP_LINK(newdir, newname, oldfile);
+	vfs_dcache_invalidate(newdir, newname);
 
 	VOP_DECREF(newdir);
 	VOP_DECREF(oldfile);
@@ -240,6 +259,7 @@ vfs_symlink(const char *contents, char *path)
 	}
 
 	result = VOP_SYMLINK(newdir, newname, contents);
+	vfs_dcache_invalidate(newdir, newname);
 	VOP_DECREF(newdir);
 
 	return result;
@@ -286,6 +306,7 @@ vfs_mkdir(char *path, mode_t mode)
 	}
 
 	result = VOP_MKDIR(parent, name, mode);
+	vfs_dcache_invalidate(parent, name);
 
 	VOP_DECREF(parent);
 
@@ -308,6 +329,7 @@ vfs_rmdir(char *path)
 	}
 
 	result = VOP_RMDIR(parent, name);
+	vfs_dcache_invalidate(parent, name);
 
 	VOP_DECREF(parent);
 
@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Poll support (see poll.h).
+ */
+#include <types.h>
+#include <lib.h>
+#include <wchan.h>
+#include <current.h>
+#include <vnode.h>
+#include <poll.h>
+
+/*
+ * Threads in poll() sleep on one of a few wait channels, picked by
+ * thread address, like the ones of timer_sleep.
+ */
+#define POLL_SLEEPQS	16
+
+static struct {
+	struct spinlock pq_lock;
+	struct wchan *pq_wchan;
+} poll_sleepq[POLL_SLEEPQS];
+
+/*
+ * Setup.
+ */
+void
+poll_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<POLL_SLEEPQS; i++) {
+		spinlock_init(&poll_sleepq[i].pq_lock);
+		poll_sleepq[i].pq_wchan = wchan_create("poll");
+		if (poll_sleepq[i].pq_wchan == NULL) {
+			panic("Couldn't create poll wait channels\n");
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// object side
+
+void
+pollhead_init(struct pollhead *ph)
+{
+	spinlock_init(&ph->ph_lock);
+	ph->ph_first = NULL;
+}
+
+void
+pollhead_cleanup(struct pollhead *ph)
+{
+	KASSERT(ph->ph_first == NULL);
+	spinlock_cleanup(&ph->ph_lock);
+}
+
+/*
+ * Hook PE onto PH. Called by VOP_POLL, with the object's lock held.
+ */
+void
+pollhead_register(struct pollhead *ph, struct pollent *pe)
+{
+	if (pe == NULL) {
+		return;
+	}
+	KASSERT(pe->pe_head == NULL);
+
+	spinlock_acquire(&ph->ph_lock);
+	pe->pe_head = ph;
+	pe->pe_next = ph->ph_first;
+	ph->ph_first = pe;
+	spinlock_release(&ph->ph_lock);
+}
+
+/*
+ * Wake everyone registered on PH. The pollents stay registered until
+ * their owners take them off; waking them again does no harm.
+ *
+ * The caller holds the lock that VOP_POLL registers under, so nobody
+ * can be registering right now and an empty pollhead can be skipped
+ * without taking ph_lock. This makes wakeups on objects nobody polls
+ * (the console, most of all) cost next to nothing.
+ */
+void
+pollhead_wakeup(struct pollhead *ph)
+{
+	struct pollent *pe;
+	unsigned q;
+
+	if (ph->ph_first == NULL) {
+		return;
+	}
+
+	spinlock_acquire(&ph->ph_lock);
+	for (pe = ph->ph_first; pe != NULL; pe = pe->pe_next) {
+		q = pe->pe_waiter->pw_queue;
+		spinlock_acquire(&poll_sleepq[q].pq_lock);
+		pe->pe_waiter->pw_woken = true;
+		wchan_wakeall(poll_sleepq[q].pq_wchan,
+			      &poll_sleepq[q].pq_lock);
+		spinlock_release(&poll_sleepq[q].pq_lock);
+	}
+	spinlock_release(&ph->ph_lock);
+}
+
+////////////////////////////////////////////////////////////
+// poller side
+
+void
+pollent_init(struct pollent *pe, struct pollwaiter *pw)
+{
+	pe->pe_head = NULL;
+	pe->pe_waiter = pw;
+	pe->pe_next = NULL;
+}
+
+/*
+ * Take PE off the pollhead it is on, if any. Once this returns no
+ * wakeup looks at PE or its pollwaiter any more.
+ */
+void
+pollent_unregister(struct pollent *pe)
+{
+	struct pollhead *ph = pe->pe_head;
+	struct pollent **pp;
+
+	if (ph == NULL) {
+		return;
+	}
+
+	spinlock_acquire(&ph->ph_lock);
+	for (pp = &ph->ph_first; *pp != pe; pp = &(*pp)->pe_next) {
+		KASSERT(*pp != NULL);
+	}
+	*pp = pe->pe_next;
+	spinlock_release(&ph->ph_lock);
+
+	pe->pe_head = NULL;
+	pe->pe_next = NULL;
+}
+
+static
+void
+pollwaiter_timeout(void *data)
+{
+	struct pollwaiter *pw = data;
+	unsigned q = pw->pw_queue;
+
+	/* After we let go of pq_lock, PW may be gone */
+	spinlock_acquire(&poll_sleepq[q].pq_lock);
+	pw->pw_timedout = true;
+	wchan_wakeall(poll_sleepq[q].pq_wchan, &poll_sleepq[q].pq_lock);
+	spinlock_release(&poll_sleepq[q].pq_lock);
+}
+
+void
+pollwaiter_init(struct pollwaiter *pw)
+{
+	pw->pw_queue = ((uintptr_t)curthread >> 5) % POLL_SLEEPQS;
+	pw->pw_woken = false;
+	pw->pw_timedout = false;
+	pw->pw_timed = false;
+	timer_init(&pw->pw_timer, pollwaiter_timeout, pw);
+}
+
+/*
+ * Wait for a wakeup or the deadline. The timer is started the first
+ * time and then left running, so that the deadline holds across
+ * however many rounds the caller goes through. Returns false once
+ * the deadline has passed.
+ */
+bool
+pollwaiter_sleep(struct pollwaiter *pw, const struct timespec *deadline)
+{
+	unsigned q = pw->pw_queue;
+	bool timedout;
+
+	spinlock_acquire(&poll_sleepq[q].pq_lock);
+	if (deadline != NULL && !pw->pw_timed) {
+		pw->pw_timed = true;
+		timer_start(&pw->pw_timer, deadline);
+	}
+	while (!pw->pw_woken && !pw->pw_timedout) {
+		wchan_sleep(poll_sleepq[q].pq_wchan, &poll_sleepq[q].pq_lock);
+	}
+	pw->pw_woken = false;
+	timedout = pw->pw_timedout;
+	spinlock_release(&poll_sleepq[q].pq_lock);
+
+	return !timedout;
+}
+
+/*
+ * Stop the timer. If it already went off, its function may still be
+ * on its way to pq_lock; wait for it, as PW is about to go away.
+ */
+void
+pollwaiter_cleanup(struct pollwaiter *pw)
+{
+	unsigned q = pw->pw_queue;
+
+	if (!pw->pw_timed || timer_cancel(&pw->pw_timer)) {
+		return;
+	}
+	spinlock_acquire(&poll_sleepq[q].pq_lock);
+	while (!pw->pw_timedout) {
+		wchan_sleep(poll_sleepq[q].pq_wchan, &poll_sleepq[q].pq_lock);
+	}
+	spinlock_release(&poll_sleepq[q].pq_lock);
+}
+
+////////////////////////////////////////////////////////////
+// VOP_POLL for objects that never make anyone wait
+
+int
+vnode_poll_ready(struct vnode *vn, int events, struct pollent *pe)
+{
+	(void)vn;
+	(void)pe;
+	return events & (POLLIN | POLLOUT);
+}
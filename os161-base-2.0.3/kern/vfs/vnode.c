@@ -32,10 +32,17 @@
  */
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/dirent.h>
 #include <lib.h>
+#include <limits.h>
 #include <synch.h>
+#include <uio.h>
+#include <membar.h>
 #include <vfs.h>
 #include <vnode.h>
+#include <vm.h>
+#include <addrspace.h>
+#include "opt-shell.h"
 
 /*
  * Initialize an abstract vnode.
@@ -63,6 +70,12 @@ vnode_cleanup(struct vnode *vn)
 {
 	KASSERT(vn->vn_refcount == 1);
 
+#if OPT_SHELL
+	/* Its pages may be cached under this address (which will be reused) */
+	vm_textcache_purge(vn);
+	load_elf_purge(vn);
+#endif
+
 	spinlock_cleanup(&vn->vn_countlock);
 
 	vn->vn_ops = NULL;
@@ -79,11 +92,40 @@ vnode_cleanup(struct vnode *vn)
 void
 vnode_incref(struct vnode *vn)
 {
+	unsigned count;
+
 	KASSERT(vn != NULL);
 
-	spinlock_acquire(&vn->vn_countlock);
-	vn->vn_refcount++;
-	spinlock_release(&vn->vn_countlock);
+	/*
+	 * The caller already has a reference (or is the filesystem
+	 * handing out a new one under its own locks), so the count
+	 * can't be on its way to being reclaimed under us.
+	 */
+	do {
+		count = vn->vn_refcount;
+		KASSERT(count > 0);
+	} while (!spinlock_data_cas(&vn->vn_refcount, count, count + 1));
+}
+
+/*
+ * Drop a reference unless it's the last one.
+ * Also used by VOP_RECLAIM to give back the reference it was passed.
+ */
+bool
+vnode_dropref_unless_last(struct vnode *vn)
+{
+	unsigned count;
+
+	/* Like a lock release: our use of the vnode may not move after. */
+	membar_any_store();
+	do {
+		count = vn->vn_refcount;
+		KASSERT(count > 0);
+		if (count == 1) {
+			return false;
+		}
+	} while (!spinlock_data_cas(&vn->vn_refcount, count, count - 1));
+	return true;
 }
 
 /*
@@ -94,31 +136,23 @@ vnode_incref(struct vnode *vn)
 void
 vnode_decref(struct vnode *vn)
 {
-	bool destroy;
 	int result;
 
 	KASSERT(vn != NULL);
 
-	spinlock_acquire(&vn->vn_countlock);
-
-	KASSERT(vn->vn_refcount > 0);
-	if (vn->vn_refcount > 1) {
-		vn->vn_refcount--;
-		destroy = false;
+	if (vnode_dropref_unless_last(vn)) {
+		return;
 	}
-	else {
-		/* Don't decrement; pass the reference to VOP_RECLAIM. */
-		destroy = true;
-	}
-	spinlock_release(&vn->vn_countlock);
-
-	if (destroy) {
-		result = VOP_RECLAIM(vn);
-		if (result != 0 && result != EBUSY) {
-			// XXX: lame.
-			kprintf("vfs: Warning: VOP_RECLAIM: %s\n",
-				strerror(result));
-		}
+
+	/*
+	 * Don't decrement; pass the reference to VOP_RECLAIM, which
+	 * takes vn_countlock and checks again.
+	 */
+	result = VOP_RECLAIM(vn);
+	if (result != 0 && result != EBUSY) {
+		// XXX: lame.
+		kprintf("vfs: Warning: VOP_RECLAIM: %s\n",
+			strerror(result));
 	}
 }
 
@@ -129,6 +163,8 @@ vnode_decref(struct vnode *vn)
 void
 vnode_check(struct vnode *v, const char *opstr)
 {
+	unsigned count;
+
 	/* not safe, and not really needed to check constant fields */
 	/*vfs_biglock_acquire();*/
 
@@ -159,20 +195,69 @@ vnode_check(struct vnode *v, const char *opstr)
 		panic("vnode_check: vop_%s: deadbeef fs pointer\n", opstr);
 	}
 
-	spinlock_acquire(&v->vn_countlock);
+	/* one read; the count is updated atomically */
+	count = v->vn_refcount;
 
-	if (v->vn_refcount < 0) {
+	if ((int)count < 0) {
 		panic("vnode_check: vop_%s: negative refcount %d\n", opstr,
-		      v->vn_refcount);
+		      (int)count);
 	}
-	else if (v->vn_refcount == 0) {
+	else if (count == 0) {
 		panic("vnode_check: vop_%s: zero refcount\n", opstr);
 	}
-	else if (v->vn_refcount > 0x100000) {
-		kprintf("vnode_check: vop_%s: warning: large refcount %d\n",
-			opstr, v->vn_refcount);
+	else if (count > 0x100000) {
+		kprintf("vnode_check: vop_%s: warning: large refcount %u\n",
+			opstr, count);
 	}
-
-	spinlock_release(&v->vn_countlock);
 	/*vfs_biglock_release();*/
 }
+
+/*
+ * VOP_PREFETCH that does nothing.
+ */
+void
+vnode_prefetch_none(struct vnode *vn, off_t pos, off_t len)
+{
+	(void)vn;
+	(void)pos;
+	(void)len;
+}
+
+/*
+ * VOP_DONTNEED that does nothing.
+ */
+void
+vnode_dontneed_none(struct vnode *vn, off_t pos, off_t len)
+{
+	(void)vn;
+	(void)pos;
+	(void)len;
+}
+
+/*
+ * Add a directory entry to a getdents buffer.
+ */
+int
+vnode_putdirent(struct uio *uio, uint32_t ino, unsigned type,
+		const char *name)
+{
+	struct dirent d;
+	size_t namlen, reclen;
+
+	namlen = strlen(name);
+	KASSERT(namlen <= NAME_MAX);
+	reclen = _DIRENT_RECLEN(namlen);
+	if (reclen > uio->uio_resid) {
+		return ENOSPC;
+	}
+
+	d.d_ino = ino;
+	d.d_reclen = reclen;
+	d.d_type = type;
+	d.d_namlen = namlen;
+	/* (the padding too, so no kernel memory gets out) */
+	bzero(d.d_name, sizeof(d.d_name));
+	memcpy(d.d_name, name, namlen);
+
+	return uiomove(&d, reclen, uio);
+}
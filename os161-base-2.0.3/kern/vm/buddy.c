@@ -0,0 +1,659 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
+#include <kstat.h>
+#include <vm.h>
+#include <buddy.h>
+#include <pcpcache.h>
+
+/*
+ * Wrap getfreepages in a spinlock 
+*/
+static struct spinlock freemem_lock = SPINLOCK_INITIALIZER;
+
+/*
+ *  +------+
+ *  | DATA |
+ *  +------+
+ *
+ * Physical pages are managed by a binary buddy allocator. Every page
+ * handed to it at bootstrap belongs to exactly one block of 2^k pages,
+ * aligned to 2^k pages from buddy_base. Free blocks are kept on one
+ * doubly-linked list per order; the list links and the order live in
+ * the first bytes of the free block itself, so the only per-page
+ * metadata is two bits:
+ *
+ *   - buddy_freemap: set on the first page of a free block
+ *   - buddy_tailmap: set on every page of an allocation but the first
+ *
+ * so the length of an allocation is one plus the run of tail bits
+ * after its first page, which free counts a word at a time. Single
+ * pages, by far the most common case, have no tail bits at all.
+ *
+ * Allocations of n pages take a block of the next power of two and
+ * give the unused tail straight back, so no memory is wasted on
+ * rounding. Freeing merges a block with its buddy for as long as the
+ * buddy is free and of the same order.
+*/
+
+struct buddy_block {						/* HEADER STORED IN THE FIRST PAGE OF EACH FREE BLOCK 		*/
+	struct buddy_block *next;
+	struct buddy_block *prev;
+	unsigned order;
+};
+
+paddr_t buddy_base = 0;							/* PHYSICAL ADDRESS OF THE FIRST MANAGED PAGE 				*/
+unsigned long buddy_npages = 0;					/* NUMBER OF MANAGED PAGES 									*/
+unsigned long buddy_nfree = 0;					/* NUMBER OF FREE PAGES 									*/
+static uint32_t *buddy_freemap = NULL;				/* ONE BIT PER PAGE: FIRST PAGE OF A FREE BLOCK 			*/
+static uint32_t *buddy_tailmap = NULL;				/* ONE BIT PER PAGE: NON-FIRST PAGE OF AN ALLOCATION 		*/
+static struct buddy_block *free_lists[BUDDY_MAXORDER + 1];	/* FREE BLOCKS OF EACH ORDER 						*/
+
+static bool allocTableActive = false;				
+
+/*
+ *  +-----------+
+ *  | FUNCTIONS |
+ *  +-----------+
+*/
+
+/**
+ * @brief Check if the allocation table is currently active or not.
+ *        The flag is set once in vm_bootstrap and never cleared, so
+ *        it can be read without taking freemem_lock.
+ * 
+ * @return true if the table is active 
+ */
+bool buddy_isactive(void) {
+	return allocTableActive;
+}
+
+/**
+ * @brief Test, set and clear the bit of page IDX in one of the page bitmaps
+ */
+static bool map_isset(const uint32_t *map, unsigned long idx) {
+	return (map[idx / 32] & (1U << (idx % 32))) != 0;
+}
+
+static void map_set(uint32_t *map, unsigned long idx) {
+	map[idx / 32] |= 1U << (idx % 32);
+}
+
+static void map_clear(uint32_t *map, unsigned long idx) {
+	map[idx / 32] &= ~(1U << (idx % 32));
+}
+
+/**
+ * @brief Mark pages IDX+1 .. IDX+NPAGES-1 as the tail of an allocation starting at IDX
+ */
+static void buddy_settail(unsigned long idx, unsigned long npages) {
+	unsigned long i = idx + 1, end = idx + npages;
+
+	while (i < end) {
+		if (i % 32 == 0 && i + 32 <= end) {
+			buddy_tailmap[i / 32] = 0xffffffff;
+			i += 32;
+		} else {
+			map_set(buddy_tailmap, i++);
+		}
+	}
+}
+
+/**
+ * @brief Length of the allocation starting at page IDX; its tail bits are cleared
+ */
+static unsigned long buddy_takelength(unsigned long idx) {
+	unsigned long i = idx + 1;
+
+	while (i < buddy_npages) {
+		if (i % 32 == 0 && buddy_tailmap[i / 32] == 0xffffffff) {
+			buddy_tailmap[i / 32] = 0;
+			i += 32;
+		} else if (map_isset(buddy_tailmap, i)) {
+			map_clear(buddy_tailmap, i++);
+		} else {
+			break;
+		}
+	}
+	return i - idx;
+}
+
+/**
+ * @brief Kernel virtual address of the free-list header of page IDX
+ */
+static struct buddy_block *buddy_blockof(unsigned long idx) {
+	return (struct buddy_block *) PADDR_TO_KVADDR(buddy_base + idx * PAGE_SIZE);
+}
+
+/**
+ * @brief Page index of a free-list header
+ */
+static unsigned long buddy_indexof(struct buddy_block *blk) {
+	return (((vaddr_t) blk - MIPS_KSEG0) - buddy_base) / PAGE_SIZE;
+}
+
+/**
+ * @brief Put the block starting at page IDX on the free list of ORDER
+ */
+static void buddy_push(unsigned long idx, unsigned order) {
+	struct buddy_block *blk = buddy_blockof(idx);
+
+	blk->prev = NULL;
+	blk->next = free_lists[order];
+	if (blk->next != NULL) {
+		blk->next->prev = blk;
+	}
+	free_lists[order] = blk;
+	blk->order = order;
+	map_set(buddy_freemap, idx);
+}
+
+/**
+ * @brief Take the block starting at page IDX off the free list of ORDER
+ */
+static void buddy_unlink(unsigned long idx, unsigned order) {
+	struct buddy_block *blk = buddy_blockof(idx);
+
+	if (blk->prev != NULL) {
+		blk->prev->next = blk->next;
+	} else {
+		free_lists[order] = blk->next;
+	}
+	if (blk->next != NULL) {
+		blk->next->prev = blk->prev;
+	}
+	map_clear(buddy_freemap, idx);
+}
+
+/**
+ * @brief Free one aligned block, merging it with its buddies as far as possible
+ * 
+ * @param idx first page of the block (aligned to 2^order)
+ * @param order order of the block
+ */
+static void buddy_free_block(unsigned long idx, unsigned order) {
+	unsigned long buddy;
+
+	KASSERT((idx & ((1UL << order) - 1)) == 0);
+
+	/* MERGE WITH THE BUDDY WHILE IT IS FREE AND THE SAME SIZE */
+	while (order < BUDDY_MAXORDER) {
+		buddy = idx ^ (1UL << order);
+		if (buddy + (1UL << order) > buddy_npages ||
+		    !map_isset(buddy_freemap, buddy) ||
+		    buddy_blockof(buddy)->order != order) {
+			break;
+		}
+		buddy_unlink(buddy, order);
+		if (buddy < idx) {
+			idx = buddy;
+		}
+		order++;
+	}
+
+	buddy_push(idx, order);
+}
+
+/**
+ * @brief Free an arbitrary run of pages by splitting it into aligned blocks
+ * 
+ * @param idx first page of the run
+ * @param npages length of the run
+ */
+static void buddy_free_range(unsigned long idx, unsigned long npages) {
+	unsigned long end = idx + npages;
+	unsigned order;
+
+	buddy_nfree += npages;
+	while (idx < end) {
+		/* LARGEST ALIGNED BLOCK STARTING AT IDX THAT FITS */
+		order = 0;
+		while (order < BUDDY_MAXORDER &&
+		       (idx & ((2UL << order) - 1)) == 0 &&
+		       idx + (2UL << order) <= end) {
+			order++;
+		}
+		buddy_free_block(idx, order);
+		idx += 1UL << order;
+	}
+}
+
+/**
+ * @brief Count the free blocks of each order, to see how fragmented memory is
+ * 
+ * @param counts filled in with the number of free blocks of each order
+ * @return int the largest order with a free block, or -1 if there are none
+ */
+static int buddy_countblocks(unsigned counts[BUDDY_MAXORDER + 1]) {
+	struct buddy_block *blk;
+	int k, largest = -1;
+
+	spinlock_acquire(&freemem_lock);
+	for (k = 0; k <= BUDDY_MAXORDER; k++) {
+		counts[k] = 0;
+		for (blk = free_lists[k]; blk != NULL; blk = blk->next) {
+			counts[k]++;
+		}
+		if (counts[k] > 0) {
+			largest = k;
+		}
+	}
+	spinlock_release(&freemem_lock);
+
+	return largest;
+}
+
+/**
+ * @brief Set up the page bitmaps and free lists and take over all the memory
+ *        ram_stealmem has not handed out yet. Called from vm_bootstrap.
+ * 
+ * @return int 0, or ENOMEM if there is no memory for the bitmaps
+ */
+int buddy_bootstrap(void) {
+	paddr_t lastpaddr;
+	unsigned long maxpages, mapwords;
+
+	/* ALLOCATING PAGE BITMAPS (SIZED FOR ALL OF RAM, WHILE WE CAN STILL STEAL MEMORY) */
+	lastpaddr = ram_getsize();
+	maxpages = lastpaddr / PAGE_SIZE;
+	mapwords = DIVROUNDUP(maxpages, 32);
+	buddy_freemap = (uint32_t *) kmalloc(2 * mapwords * sizeof(uint32_t));
+	if (buddy_freemap == NULL) {
+		return ENOMEM;
+	}
+	buddy_tailmap = buddy_freemap + mapwords;
+
+	/* TAKING OVER ALL REMAINING MEMORY (ram_stealmem WILL FAIL FROM NOW ON) */
+	buddy_base = ram_getfirstfree();
+	buddy_npages = (lastpaddr - buddy_base) / PAGE_SIZE;
+	KASSERT(buddy_npages <= maxpages);
+
+	/* INITIALIZE METADATA AND FREE LISTS */
+	bzero(buddy_freemap, 2 * mapwords * sizeof(uint32_t));
+	for (int i = 0; i <= BUDDY_MAXORDER; i++) {
+		free_lists[i] = NULL;
+	}
+
+	/* ENABLING ALLOCATION TABLE */
+	spinlock_acquire(&freemem_lock);
+	buddy_free_range(0, buddy_npages);
+	allocTableActive = true;
+	spinlock_release(&freemem_lock);
+
+	return 0;
+}
+
+/**
+ * @brief Return the physical address of a run of free pages taken from the buddy allocator.
+ * 
+ * @param npages number of pages required to be allocated
+ * @return paddr_t physical address, or 0 if there is no block big enough
+ */
+static paddr_t buddy_alloc(unsigned long npages) {
+
+	unsigned order, k;
+	unsigned long idx;
+
+	KASSERT(spinlock_do_i_hold(&freemem_lock));
+
+	/* SMALLEST ORDER THAT FITS */
+	order = 0;
+	while ((1UL << order) < npages) {
+		order++;
+	}
+	if (order > BUDDY_MAXORDER) {
+		return 0;
+	}
+
+	/* FIND THE SMALLEST NON-EMPTY FREE LIST */
+	for (k = order; k <= BUDDY_MAXORDER && free_lists[k] == NULL; k++);
+	if (k > BUDDY_MAXORDER) {
+		return 0;
+	}
+	idx = buddy_indexof(free_lists[k]);
+	buddy_unlink(idx, k);
+
+	/* SPLIT DOWN TO THE ORDER WE NEED, FREEING THE UPPER HALVES */
+	while (k > order) {
+		k--;
+		buddy_push(idx + (1UL << k), k);
+	}
+
+	/* GIVE BACK THE UNUSED TAIL, AND RECORD THE LENGTH FOR FREEING */
+	buddy_nfree -= 1UL << order;
+	if (npages < (1UL << order)) {
+		buddy_free_range(idx + npages, (1UL << order) - npages);
+	}
+	buddy_settail(idx, npages);
+
+	return buddy_base + idx * PAGE_SIZE;
+}
+
+/**
+ * @brief Return the physical address of a run of NPAGES free pages, or 0 if there
+ *        is none (or the allocator is not active yet). Single pages go through the
+ *        per-cpu cache.
+ * 
+ * @param npages number of pages required to be allocated
+ * @return paddr_t physical address, or 0
+ */
+paddr_t getfreeppages(unsigned long npages) {
+
+	paddr_t addr;
+
+	/* CHECKING IF ALLOCATION TABLE IS ACTIVE (i.e., can use the LAB02 methods) */
+	if (!buddy_isactive() || npages == 0 || npages > BUDDY_MAXALLOC) {
+		return 0;
+	}
+
+	/* SINGLE PAGES GO THROUGH THE PER-CPU CACHE */
+	if (npages == 1 && CURCPU_EXISTS()) {
+		return pcp_getpage();
+	}
+
+	/* GETTING LOCK ON MEMORY */
+	spinlock_acquire(&freemem_lock);
+	addr = buddy_alloc(npages);
+
+	/* RELEASING SPINLOCK */
+	spinlock_release(&freemem_lock);
+
+	return addr;
+}
+
+/**
+ * @brief give back to the buddy allocator the run of pages starting at paddr
+ *        that was returned by getfreeppages.
+ * 
+ * @param paddr starting address of the memory to release
+ */
+void freeppages(paddr_t paddr) {
+
+	unsigned long idx;
+
+	/* CHECKING IF TABLE IS ACTIVE */
+	if (!buddy_isactive()) {
+		return;
+	}
+
+	/* PAGES STOLEN BEFORE vm_bootstrap ARE NOT OURS TO FREE */
+	if (paddr < buddy_base) {
+		return;
+	}
+	idx = (paddr - buddy_base) / PAGE_SIZE;
+	KASSERT(idx < buddy_npages);
+
+	/* MUST NOT BE FREE OR IN THE MIDDLE OF AN ALLOCATION */
+	KASSERT(!map_isset(buddy_freemap, idx) && !map_isset(buddy_tailmap, idx));
+
+	/* SINGLE PAGES (NO TAIL) GO BACK TO THE PER-CPU CACHE */
+	if ((idx + 1 == buddy_npages || !map_isset(buddy_tailmap, idx + 1)) &&
+	    CURCPU_EXISTS()) {
+		pcp_putpage(paddr);
+		return;
+	}
+
+	/* GET LOCK ON MEMORY */
+	spinlock_acquire(&freemem_lock);
+	buddy_free_range(idx, buddy_takelength(idx));
+
+	/* RELEASE LOCK */
+	spinlock_release(&freemem_lock);
+
+	return;
+}
+
+/**
+ * @brief Allocate up to N single pages under one acquisition of freemem_lock,
+ *        for refilling a per-cpu cache.
+ * 
+ * @param pages filled in with the physical addresses of the pages
+ * @param n number of pages wanted
+ * @return unsigned how many were allocated
+ */
+unsigned buddy_allocbatch(paddr_t *pages, unsigned n) {
+
+	unsigned i;
+
+	spinlock_acquire(&freemem_lock);
+	for (i = 0; i < n; i++) {
+		pages[i] = buddy_alloc(1);
+		if (pages[i] == 0) {
+			break;
+		}
+	}
+	spinlock_release(&freemem_lock);
+
+	return i;
+}
+
+/**
+ * @brief Free N single pages under one acquisition of freemem_lock, for draining
+ *        a per-cpu cache.
+ * 
+ * @param pages physical addresses of the pages
+ * @param n number of pages
+ */
+void buddy_freebatch(const paddr_t *pages, unsigned n) {
+
+	unsigned i;
+
+	spinlock_acquire(&freemem_lock);
+	for (i = 0; i < n; i++) {
+		buddy_free_range((pages[i] - buddy_base) / PAGE_SIZE, 1);
+	}
+	spinlock_release(&freemem_lock);
+}
+
+/**
+ * @brief For compaction: choose the block of 2^ORDER pages made up only of free
+ *        pages and pages MOVABLE says can be moved, with the fewest of the latter,
+ *        and take its free pages off the free lists. The caller must keep the
+ *        movable pages from changing meanwhile (compaction holds vm_lock).
+ *
+ * @param order order of the block
+ * @param movable whether the allocated page IDX can be moved
+ * @return unsigned long the index of its first page, or buddy_npages if every
+ *         block has something in the way
+ */
+unsigned long buddy_claim(unsigned order, bool (*movable)(unsigned long idx)) {
+	unsigned long size = 1UL << order;
+	unsigned long start, idx, moves, best, bestmoves, blk;
+
+	spinlock_acquire(&freemem_lock);
+
+	/* Whatever we pick, the pages moved out need somewhere to go */
+	best = buddy_npages;
+	bestmoves = size;
+	if (buddy_nfree < size) {
+		spinlock_release(&freemem_lock);
+		return best;
+	}
+
+	for (start = 0; start + size <= buddy_npages; start += size) {
+		moves = 0;
+		idx = start;
+		while (idx < start + size) {
+			if (map_isset(buddy_freemap, idx)) {
+				idx += 1UL << buddy_blockof(idx)->order;
+			}
+			else if (movable(idx)) {
+				moves++;
+				idx++;
+			}
+			else {
+				break;
+			}
+		}
+		if (idx >= start + size && moves < bestmoves) {
+			best = start;
+			bestmoves = moves;
+			if (moves == 0) {
+				break;
+			}
+		}
+	}
+
+	if (best < buddy_npages) {
+		idx = best;
+		while (idx < best + size) {
+			if (!map_isset(buddy_freemap, idx)) {
+				idx++;
+				continue;
+			}
+			blk = 1UL << buddy_blockof(idx)->order;
+			buddy_unlink(idx, buddy_blockof(idx)->order);
+			buddy_nfree -= blk;
+			if (idx + blk > best + size) {
+				/* Freed since the allocation failed: keep less */
+				buddy_free_range(best + size,
+						 idx + blk - (best + size));
+			}
+			idx += blk;
+		}
+	}
+
+	spinlock_release(&freemem_lock);
+	return best;
+}
+
+/**
+ * @brief Give back NPAGES pages from IDX that buddy_claim took, once compaction
+ *        has given up on them.
+ * 
+ * @param idx first page of the run
+ * @param npages length of the run
+ */
+void buddy_unclaim(unsigned long idx, unsigned long npages) {
+
+	spinlock_acquire(&freemem_lock);
+	buddy_free_range(idx, npages);
+	spinlock_release(&freemem_lock);
+}
+
+/**
+ * @brief Make the first NPAGES pages of the block of 2^ORDER pages at START, which
+ *        buddy_claim took and compaction has emptied, an allocation, and give back
+ *        the rest.
+ * 
+ * @param start first page of the block
+ * @param npages length of the allocation
+ * @param order order of the block
+ * @return paddr_t physical address of the allocation
+ */
+paddr_t buddy_allocclaimed(unsigned long start, unsigned long npages,
+			   unsigned order) {
+
+	KASSERT(npages <= (1UL << order));
+
+	spinlock_acquire(&freemem_lock);
+	buddy_settail(start, npages);
+	if (npages < (1UL << order)) {
+		buddy_free_range(start + npages, (1UL << order) - npages);
+	}
+	spinlock_release(&freemem_lock);
+
+	return buddy_base + start * PAGE_SIZE;
+}
+
+/**
+ * @brief Print how many pages are free (and how many more sit in the per-cpu
+ *        caches) and how many free blocks there are of each size, which shows
+ *        how fragmented memory is.
+ */
+void buddy_printstats(void) {
+
+	unsigned counts[BUDDY_MAXORDER + 1];
+	int largest;
+
+	kprintf("dumbvm: %lu of %lu pages free, %u more in per-cpu caches\n",
+		buddy_nfree, buddy_npages, pcp_cached());
+
+	largest = buddy_countblocks(counts);
+	kprintf("dumbvm: free blocks by size in pages:");
+	for (int k = 0; k <= largest; k++) {
+		kprintf(" %lu:%u", 1UL << k, counts[k]);
+	}
+	kprintf("%s\n", largest < 0 ? " none" : "");
+}
+
+/**
+ * @brief The statistics of buddy_printstats, for kstat (vm.pages.*, vm.freeblocks.*).
+ */
+void buddy_kstat(struct kstat *ks) {
+
+	unsigned counts[BUDDY_MAXORDER + 1];
+	int largest;
+
+	kstat_put(ks, buddy_npages, "vm.pages.total");
+	kstat_put(ks, buddy_nfree, "vm.pages.free");
+
+	largest = buddy_countblocks(counts);
+	kstat_put(ks, largest < 0 ? 0 : 1UL << largest, "vm.pages.largestfree");
+	for (int k = 0; k <= BUDDY_MAXORDER; k++) {
+		kstat_put(ks, counts[k], "vm.freeblocks.%d", k);
+	}
+}
+
+/**
+ * @brief Report the number of free pages (including those sitting in the per-cpu
+ *        caches) and the size, in pages, of the largest free block. Used by the
+ *        kernel heap timeline; callable from interrupt context.
+ */
+void buddy_freestats(unsigned long *freepages, unsigned long *largest) {
+
+	unsigned long cached;
+	int k;
+
+	*freepages = 0;
+	*largest = 0;
+	if (!buddy_isactive()) {
+		return;
+	}
+
+	cached = pcp_cached();
+
+	spinlock_acquire(&freemem_lock);
+	*freepages = buddy_nfree + cached;
+	for (k = BUDDY_MAXORDER; k >= 0 && free_lists[k] == NULL; k--);
+	if (k >= 0) {
+		*largest = 1UL << k;
+	}
+	/* A LONE CACHED PAGE STILL BEATS AN EMPTY BUDDY ALLOCATOR */
+	if (*largest == 0 && cached > 0) {
+		*largest = 1;
+	}
+	spinlock_release(&freemem_lock);
+}
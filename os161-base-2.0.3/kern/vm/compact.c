@@ -0,0 +1,238 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Compaction.
+ *
+ * Allocations of more than one page need a free run of pages, and
+ * once the buddy allocator is fragmented they fail with plenty of
+ * pages free. Most of what sits between the free blocks are private
+ * user pages, though, which can live anywhere: then vm_compact picks
+ * the aligned block of the size wanted that only free pages and the
+ * fewest private user pages are in, takes its free pages off the free
+ * lists, and moves the user pages out, one batch at a time: their
+ * PTEs are made invalid and shot down, the contents copied to new
+ * frames and the PTEs pointed at them. Kernel pages, shared frames
+ * and pages on their way to swap don't move, so a block containing
+ * any of them is never picked.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <cpu.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <kstat.h>
+#include <buddy.h>
+#include <frame.h>
+#include <compact.h>
+#include <vmprivate.h>
+
+#define COMPACT_BATCH	TLBSHOOTDOWN_MAX	/* pages moved per shootdown */
+
+static unsigned compact_runs;		/* allocations compaction was tried for */
+static unsigned compact_fails;		/* ...and failed */
+static unsigned long compact_moved;	/* pages moved */
+
+static
+bool
+compact_movable(unsigned long idx)
+{
+	return frames[idx].fr_refs == 1 && frames[idx].fr_as != NULL;
+}
+
+/*
+ * Move up to COMPACT_BATCH user pages out of the claimed pages from
+ * *IDX to END, advancing *IDX. Returns ENOMEM if there is no frame to
+ * move a page to; the ones moved so far stay moved.
+ */
+static
+int
+compact_batch(unsigned long *idx, unsigned long end)
+{
+	struct addrspace *vas[COMPACT_BATCH];
+	vaddr_t vva[COMPACT_BATCH];
+	paddr_t vold[COMPACT_BATCH], vnew[COMPACT_BATCH];
+	uint32_t *pte;
+	unsigned n, i, run, nsent;
+	paddr_t pa;
+	int result = 0;
+
+	n = 0;
+	for (; *idx < end && n < COMPACT_BATCH; (*idx)++) {
+		if (frames[*idx].fr_refs == 0) {
+			/* one of the free pages we took */
+			continue;
+		}
+		pa = getfreeppages(1);
+		if (pa == 0) {
+			result = ENOMEM;
+			break;
+		}
+		spinlock_acquire(&frame_lock);
+		KASSERT(compact_movable(*idx));
+		vas[n] = frames[*idx].fr_as;
+		vva[n] = frames[*idx].fr_va;
+		frames[*idx].fr_as = NULL;
+		spinlock_release(&frame_lock);
+		vold[n] = buddy_base + *idx * PAGE_SIZE;
+		vnew[n] = pa;
+		n++;
+	}
+
+	/* Nobody may use the old frames while they are copied */
+	for (i=0; i<n; i++) {
+		pte = pt_lookup(vas[i], vva[i], false);
+		KASSERT(pte != NULL);
+		KASSERT((*pte & PTE_VALID) && (*pte & PTE_FRAME) == vold[i]);
+		*pte &= ~PTE_VALID;
+	}
+	nsent = 0;
+	for (i=0; i<n; i += run) {
+		for (run = 1; i + run < n; run++) {
+			if (vas[i + run] != vas[i] ||
+			    vva[i + run] != vva[i] + run * PAGE_SIZE) {
+				break;
+			}
+		}
+		nsent += tlb_shootdown(vas[i], vva[i], run);
+	}
+	tlb_shootdown_wait(nsent);
+
+	for (i=0; i<n; i++) {
+		memcpy((void *)PADDR_TO_KVADDR(vnew[i]),
+		       (const void *)PADDR_TO_KVADDR(vold[i]), PAGE_SIZE);
+		pte = pt_lookup(vas[i], vva[i], false);
+		*pte = vnew[i] | (*pte & ~PTE_FRAME) | PTE_VALID;
+
+		spinlock_acquire(&frame_lock);
+		KASSERT(frames[frame_index(vnew[i])].fr_refs == 0);
+		frames[frame_index(vnew[i])].fr_refs = 1;
+		frames[frame_index(vold[i])].fr_refs = 0;
+		spinlock_release(&frame_lock);
+		frame_setowner(vnew[i], vas[i], vva[i]);
+	}
+	compact_moved += n;
+	return result;
+}
+
+/*
+ * Make a free run of NPAGES pages by moving user pages out of the
+ * way, and allocate it. Returns 0 if it can't be done. Called with
+ * vm_lock held.
+ */
+static
+paddr_t
+vm_compact(unsigned long npages)
+{
+	unsigned long start, end, idx, run;
+	unsigned order;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+
+	order = 0;
+	while ((1UL << order) < npages) {
+		order++;
+	}
+	if (npages <= 1 || order > BUDDY_MAXORDER) {
+		return 0;
+	}
+
+	compact_runs++;
+	start = buddy_claim(order, compact_movable);
+	if (start == buddy_npages) {
+		compact_fails++;
+		return 0;
+	}
+	end = start + (1UL << order);
+
+	idx = start;
+	while (idx < end) {
+		if (compact_batch(&idx, end)) {
+			break;
+		}
+	}
+
+	if (idx < end) {
+		/* Give back what we took and freed up; the rest stays put */
+		for (idx = start; idx < end; idx += run) {
+			for (run = 0; idx + run < end &&
+				     frames[idx + run].fr_refs == 0; run++);
+			if (run > 0) {
+				buddy_unclaim(idx, run);
+			}
+			else {
+				run = 1;
+			}
+		}
+		compact_fails++;
+		return 0;
+	}
+	return buddy_allocclaimed(start, npages, order);
+}
+
+/*
+ * vm_compact for alloc_kpages, which may be called with any lock held
+ * (including one somebody holding vm_lock is waiting for), so don't
+ * wait for vm_lock. Nor compact under the VM's own feet: if we hold
+ * vm_lock already, some page may be half set up.
+ */
+paddr_t
+compact_kpages(unsigned long npages)
+{
+	paddr_t pa;
+
+	if (vm_lock == NULL || frames == NULL || lock_do_i_hold(vm_lock)) {
+		return 0;
+	}
+	if (!lock_tryacquire(vm_lock)) {
+		return 0;
+	}
+	pa = vm_compact(npages);
+	lock_release(vm_lock);
+	return pa;
+}
+
+void
+compact_printstats(void)
+{
+	kprintf("dumbvm: compaction: %u runs, %u failed, %lu pages moved\n",
+		compact_runs, compact_fails, compact_moved);
+}
+
+void
+compact_kstat(struct kstat *ks)
+{
+	kstat_put(ks, compact_runs, "vm.compact.runs");
+	kstat_put(ks, compact_fails, "vm.compact.fails");
+	kstat_put(ks, compact_moved, "vm.compact.moved");
+}
@@ -34,7 +34,11 @@
 #include <thread.h>
 #include <current.h>
 #include <vm.h>
+#include <proc.h>
+#include <addrspace.h>
 #include <copyinout.h>
+#include <kern/iovec.h>
+#include <machine/ucopy.h>
 
 /*
  * User/kernel memory copying functions.
@@ -84,6 +88,10 @@
  * To make use of this code, in addition to tm_badfaultfunc the
  * thread_machdep structure should contain a jmp_buf called
  * "tm_copyjmp".
+ *
+ * The small fixed-size copies (copyin32 and friends) additionally
+ * need the machine-dependent single-access primitives of
+ * <machine/ucopy.h>, which recover from a fault without setjmp.
  */
 
 /*
@@ -214,6 +222,265 @@ copyout(const void *src, userptr_t userdest, size_t len)
 	return 0;
 }
 
+/*
+ * Check the segments of IOV that the first LEN bytes fall in, the way
+ * copyin and copyout check their one block.
+ */
+static
+int
+copycheckv(const struct iovec *iov, unsigned iovcnt, size_t len)
+{
+	unsigned i;
+	size_t seg, stoplen;
+	int result;
+
+	for (i=0; i<iovcnt && len > 0; i++) {
+		seg = iov[i].iov_len < len ? iov[i].iov_len : len;
+		if (seg == 0) {
+			continue;
+		}
+		result = copycheck(iov[i].iov_ubase, seg, &stoplen);
+		if (result) {
+			return result;
+		}
+		if (stoplen != seg) {
+			return EFAULT;
+		}
+		len -= seg;
+	}
+	KASSERT(len == 0);
+	return 0;
+}
+
+/*
+ * copyinv
+ *
+ * Gather LEN bytes from the user segments in IOV into DEST, with the
+ * checks done once up front and one setjmp for all the segments.
+ */
+int
+copyinv(const struct iovec *iov, unsigned iovcnt, void *dest, size_t len)
+{
+	char *d = dest;
+	unsigned i;
+	size_t seg;
+	int result;
+
+	result = copycheckv(iov, iovcnt, len);
+	if (result) {
+		return result;
+	}
+
+	curthread->t_machdep.tm_badfaultfunc = copyfail;
+
+	result = setjmp(curthread->t_machdep.tm_copyjmp);
+	if (result) {
+		curthread->t_machdep.tm_badfaultfunc = NULL;
+		return EFAULT;
+	}
+
+	for (i=0; len > 0; i++) {
+		seg = iov[i].iov_len < len ? iov[i].iov_len : len;
+		memcpy(d, (const void *)iov[i].iov_ubase, seg);
+		d += seg;
+		len -= seg;
+	}
+
+	curthread->t_machdep.tm_badfaultfunc = NULL;
+	return 0;
+}
+
+/*
+ * copyoutv
+ *
+ * Scatter LEN bytes from SRC over the user segments in IOV, likewise.
+ */
+int
+copyoutv(const void *src, const struct iovec *iov, unsigned iovcnt,
+	 size_t len)
+{
+	const char *s = src;
+	unsigned i;
+	size_t seg;
+	int result;
+
+	result = copycheckv(iov, iovcnt, len);
+	if (result) {
+		return result;
+	}
+
+	curthread->t_machdep.tm_badfaultfunc = copyfail;
+
+	result = setjmp(curthread->t_machdep.tm_copyjmp);
+	if (result) {
+		curthread->t_machdep.tm_badfaultfunc = NULL;
+		return EFAULT;
+	}
+
+	for (i=0; len > 0; i++) {
+		seg = iov[i].iov_len < len ? iov[i].iov_len : len;
+		memcpy((void *)iov[i].iov_ubase, s, seg);
+		s += seg;
+		len -= seg;
+	}
+
+	curthread->t_machdep.tm_badfaultfunc = NULL;
+	return 0;
+}
+
+/*
+ * Small copies.
+ *
+ * A single naturally aligned access can't straddle the end of
+ * userspace or a page, so the only address check needed is that it
+ * lies below USERSPACETOP, and a fault can be recovered by the
+ * primitive itself returning EFAULT (see <machine/ucopy.h>): no
+ * copycheck, no setjmp and no memcpy. Misaligned addresses, which
+ * the primitives can't take, go the general way.
+ */
+#define UCOPY_OK(addr, len, align) \
+	(((vaddr_t)(addr) & ((align) - 1)) == 0 && \
+	 (vaddr_t)(addr) <= USERSPACETOP - (len))
+
+int
+copyin8(const_userptr_t usersrc, uint8_t *dest)
+{
+	int result;
+
+	if (!UCOPY_OK(usersrc, 1, 1)) {
+		return EFAULT;
+	}
+	curthread->t_machdep.tm_badfaultfunc = ucopy_fault;
+	result = ufetch_8(usersrc, dest);
+	curthread->t_machdep.tm_badfaultfunc = NULL;
+	return result;
+}
+
+int
+copyin16(const_userptr_t usersrc, uint16_t *dest)
+{
+	int result;
+
+	if (!UCOPY_OK(usersrc, 2, 2)) {
+		return copyin(usersrc, dest, sizeof(*dest));
+	}
+	curthread->t_machdep.tm_badfaultfunc = ucopy_fault;
+	result = ufetch_16(usersrc, dest);
+	curthread->t_machdep.tm_badfaultfunc = NULL;
+	return result;
+}
+
+int
+copyin32(const_userptr_t usersrc, uint32_t *dest)
+{
+	int result;
+
+	if (!UCOPY_OK(usersrc, 4, 4)) {
+		return copyin(usersrc, dest, sizeof(*dest));
+	}
+	curthread->t_machdep.tm_badfaultfunc = ucopy_fault;
+	result = ufetch_32(usersrc, dest);
+	curthread->t_machdep.tm_badfaultfunc = NULL;
+	return result;
+}
+
+/*
+ * Two word accesses; DEST is only written if both succeed.
+ */
+int
+copyin64(const_userptr_t usersrc, uint64_t *dest)
+{
+	union {
+		uint64_t v;
+		uint32_t w[2];
+	} u;
+	int result;
+
+	if (!UCOPY_OK(usersrc, 8, 4)) {
+		return copyin(usersrc, dest, sizeof(*dest));
+	}
+	curthread->t_machdep.tm_badfaultfunc = ucopy_fault;
+	result = ufetch_32(usersrc, &u.w[0]);
+	if (!result) {
+		result = ufetch_32((const_userptr_t)((vaddr_t)usersrc + 4),
+				   &u.w[1]);
+	}
+	curthread->t_machdep.tm_badfaultfunc = NULL;
+	if (!result) {
+		*dest = u.v;
+	}
+	return result;
+}
+
+int
+copyout8(uint8_t val, userptr_t userdest)
+{
+	int result;
+
+	if (!UCOPY_OK(userdest, 1, 1)) {
+		return EFAULT;
+	}
+	curthread->t_machdep.tm_badfaultfunc = ucopy_fault;
+	result = ustore_8(val, userdest);
+	curthread->t_machdep.tm_badfaultfunc = NULL;
+	return result;
+}
+
+int
+copyout16(uint16_t val, userptr_t userdest)
+{
+	int result;
+
+	if (!UCOPY_OK(userdest, 2, 2)) {
+		return copyout(&val, userdest, sizeof(val));
+	}
+	curthread->t_machdep.tm_badfaultfunc = ucopy_fault;
+	result = ustore_16(val, userdest);
+	curthread->t_machdep.tm_badfaultfunc = NULL;
+	return result;
+}
+
+int
+copyout32(uint32_t val, userptr_t userdest)
+{
+	int result;
+
+	if (!UCOPY_OK(userdest, 4, 4)) {
+		return copyout(&val, userdest, sizeof(val));
+	}
+	curthread->t_machdep.tm_badfaultfunc = ucopy_fault;
+	result = ustore_32(val, userdest);
+	curthread->t_machdep.tm_badfaultfunc = NULL;
+	return result;
+}
+
+/*
+ * Two word accesses; like copyout, a fault on the second leaves the
+ * first written.
+ */
+int
+copyout64(uint64_t val, userptr_t userdest)
+{
+	union {
+		uint64_t v;
+		uint32_t w[2];
+	} u;
+	int result;
+
+	if (!UCOPY_OK(userdest, 8, 4)) {
+		return copyout(&val, userdest, sizeof(val));
+	}
+	u.v = val;
+	curthread->t_machdep.tm_badfaultfunc = ucopy_fault;
+	result = ustore_32(u.w[0], userdest);
+	if (!result) {
+		result = ustore_32(u.w[1],
+				   (userptr_t)((vaddr_t)userdest + 4));
+	}
+	curthread->t_machdep.tm_badfaultfunc = NULL;
+	return result;
+}
+
 /*
  * Common string copying function that behaves the way that's desired
  * for copyinstr and copyoutstr.
@@ -254,11 +521,66 @@ copystr(char *dest, const char *src, size_t maxlen, size_t stoplen,
 	return ENAMETOOLONG;
 }
 
+/*
+ * Word-at-a-time version of copystr for copyinstr, where SRC is the
+ * user address. Once SRC is word aligned it is read a word at a time
+ * while no byte of the word is 0 and the whole word is within the
+ * lengths. An aligned word never crosses into another page, so
+ * reading past the end of a string this way can't fault where the
+ * string itself doesn't.
+ */
+#define WORD_HASZERO(w)	(((w) - 0x01010101U) & ~(w) & 0x80808080U)
+
+static
+int
+copystr_words(char *dest, const char *src, size_t maxlen, size_t stoplen,
+	      size_t *gotlen)
+{
+	size_t i, limit;
+	uint32_t w;
+
+	limit = maxlen < stoplen ? maxlen : stoplen;
+	i = 0;
+	while (i < limit && ((vaddr_t)(src + i) & 3) != 0) {
+		dest[i] = src[i];
+		if (src[i] == 0) {
+			goto found;
+		}
+		i++;
+	}
+	while (i + 4 <= limit) {
+		w = *(const uint32_t *)(src + i);
+		if (WORD_HASZERO(w)) {
+			break;
+		}
+		memcpy(dest + i, &w, sizeof(w));
+		i += 4;
+	}
+	for (; i < limit; i++) {
+		dest[i] = src[i];
+		if (src[i] == 0) {
+			goto found;
+		}
+	}
+	if (stoplen < maxlen) {
+		/* ran into user-kernel boundary */
+		return EFAULT;
+	}
+	/* otherwise just ran out of space */
+	return ENAMETOOLONG;
+
+ found:
+	if (gotlen != NULL) {
+		*gotlen = i+1;
+	}
+	return 0;
+}
+
 /*
  * copyinstr
  *
  * Copy a string from user-level address USERSRC to kernel address
- * DEST, as per copystr above. Uses the tm_badfaultfunc/copyfail
+ * DEST, as per copystr_words above. Uses the tm_badfaultfunc/copyfail
  * logic to protect against invalid addresses supplied by a user
  * process.
  */
@@ -281,7 +603,8 @@ copyinstr(const_userptr_t usersrc, char *dest, size_t len, size_t *actual)
 		return EFAULT;
 	}
 
-	result = copystr(dest, (const char *)usersrc, len, stoplen, actual);
+	result = copystr_words(dest, (const char *)usersrc, len, stoplen,
+			       actual);
 
 	curthread->t_machdep.tm_badfaultfunc = NULL;
 	return result;
@@ -319,3 +642,28 @@ copyoutstr(const char *src, userptr_t userdest, size_t len, size_t *actual)
 	curthread->t_machdep.tm_badfaultfunc = NULL;
 	return result;
 }
+
+#if OPT_SHELL
+/*
+ * usercheck
+ *
+ * Check, without touching it, that the block of user memory at
+ * USERPTR of length LEN is all mapped by the current address space,
+ * and writeable if WRITE; see as_checkrange. Unlike copycheck, a
+ * block reaching into the kernel is refused outright.
+ */
+int
+usercheck(const_userptr_t userptr, size_t len, bool write)
+{
+	struct addrspace *as;
+
+	if (len == 0) {
+		return 0;
+	}
+	as = proc_getas();
+	if (as == NULL) {
+		return EFAULT;
+	}
+	return as_checkrange(as, (vaddr_t)userptr, len, write);
+}
+#endif
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Copy-on-write.
+ *
+ * as_copy does not copy memory: both address spaces map the same
+ * frames, marked PTE_COW, and the TLB is only loaded with writable
+ * entries for pages that are not COW. The first write to such a page
+ * traps (VM_FAULT_READONLY, or VM_FAULT_WRITE on a TLB miss) and
+ * vm_fault gives the writer a private copy, or simply makes the page
+ * writable again if nobody else maps the frame any more. frame_refs
+ * counts how many page tables map each frame.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <vmprivate.h>
+#include <frame.h>
+#include <cow.h>
+
+/*
+ * A write hit a PTE_COW page: make it private to this address space.
+ */
+int
+cow_break(struct addrspace *as, vaddr_t va, uint32_t *pte)
+{
+	paddr_t oldpa, newpa;
+	bool shared;
+
+	oldpa = *pte & PTE_FRAME;
+
+	/* If nobody else maps the frame any more, just take it over */
+	spinlock_acquire(&frame_lock);
+	shared = frames[frame_index(oldpa)].fr_refs > 1;
+	spinlock_release(&frame_lock);
+	if (!shared) {
+		*pte &= ~PTE_COW;
+		frame_setowner(oldpa, as, va);
+		return 0;
+	}
+
+	newpa = frame_alloc(false);
+	if (newpa == 0) {
+		return ENOMEM;
+	}
+	memmove((void *)PADDR_TO_KVADDR(newpa),
+		(const void *)PADDR_TO_KVADDR(oldpa), PAGE_SIZE);
+
+	*pte = newpa | (*pte & ~(PTE_FRAME | PTE_COW));
+	frame_decref(oldpa);
+	frame_setowner(newpa, as, va);
+
+	/* Some TLB may still have the old frame cached for us */
+	tlb_invalidate(as, va, 1);
+	return 0;
+}
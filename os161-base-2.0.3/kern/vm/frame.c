@@ -0,0 +1,338 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Frame table.
+ *
+ * Every page of the buddy allocator has an entry, counting how many
+ * page tables (and caches) map the frame. A frame of user memory is
+ * freed when the last reference to it goes.
+ *
+ * When memory runs low, private user pages are paged out to swap.
+ * The frame table remembers which address space and page each
+ * private frame belongs to, and a clock hand sweeps it looking for
+ * frames not referenced since the last sweep (the reference bit is
+ * set whenever a translation is loaded into the TLB). Up to
+ * SWAP_MAXCLUSTER victims are written out together. A paged-out PTE
+ * holds the swap slot instead of a frame, with PTE_SWAP set. Frames
+ * shared copy-on-write are not paged out.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <kstat.h>
+#include <buddy.h>
+#include <frame.h>
+#include <textcache.h>
+#include <mapcache.h>
+#include <zpool.h>
+#include <vmprivate.h>
+
+struct spinlock frame_lock = SPINLOCK_INITIALIZER;
+struct frame *frames = NULL;
+static unsigned long frame_hand;	/* clock hand, a buddy page index */
+
+static unsigned vm_evictions;		/* eviction passes */
+
+/*
+ * Allocate the frame table. Called from vm_bootstrap once the buddy
+ * allocator knows how many pages it manages.
+ */
+int
+frame_bootstrap(void)
+{
+	frames = kmalloc(buddy_npages * sizeof(struct frame));
+	if (frames == NULL) {
+		return ENOMEM;
+	}
+	for (unsigned long i = 0; i < buddy_npages; i++) {
+		frames[i].fr_as = NULL;
+		frames[i].fr_va = 0;
+		frames[i].fr_refs = 0;
+		frames[i].fr_referenced = 0;
+	}
+	frame_hand = 0;
+	return 0;
+}
+
+unsigned long
+frame_index(paddr_t pa)
+{
+	KASSERT(pa >= buddy_base);
+	KASSERT((pa - buddy_base) / PAGE_SIZE < buddy_npages);
+	return (pa - buddy_base) / PAGE_SIZE;
+}
+
+/*
+ * Record that PA is mapped only by AS, at VA, making it pageable.
+ */
+void
+frame_setowner(paddr_t pa, struct addrspace *as, vaddr_t va)
+{
+	struct frame *fr;
+
+	spinlock_acquire(&frame_lock);
+	fr = &frames[frame_index(pa)];
+	KASSERT(fr->fr_refs == 1);
+	fr->fr_as = as;
+	fr->fr_va = va;
+	fr->fr_referenced = 1;
+	spinlock_release(&frame_lock);
+}
+
+/*
+ * Make PA unpageable again, while it is on its way out of AS.
+ */
+void
+frame_disown(paddr_t pa)
+{
+	spinlock_acquire(&frame_lock);
+	frames[frame_index(pa)].fr_as = NULL;
+	spinlock_release(&frame_lock);
+}
+
+void
+frame_incref(paddr_t pa)
+{
+	struct frame *fr;
+
+	spinlock_acquire(&frame_lock);
+	fr = &frames[frame_index(pa)];
+	KASSERT(fr->fr_refs > 0);
+	fr->fr_refs++;
+	fr->fr_as = NULL;		/* shared now */
+	spinlock_release(&frame_lock);
+}
+
+/*
+ * Drop a reference to a frame, freeing it when the last one goes.
+ */
+void
+frame_decref(paddr_t pa)
+{
+	struct frame *fr;
+	unsigned refs;
+
+	spinlock_acquire(&frame_lock);
+	fr = &frames[frame_index(pa)];
+	KASSERT(fr->fr_refs > 0);
+	refs = --fr->fr_refs;
+	if (refs == 0) {
+		fr->fr_as = NULL;
+	}
+	spinlock_release(&frame_lock);
+
+	if (refs == 0) {
+		freeppages(pa);
+	}
+}
+
+/*
+ * Number of references to the frame PA.
+ */
+unsigned
+frame_refs(paddr_t pa)
+{
+	unsigned refs;
+
+	spinlock_acquire(&frame_lock);
+	refs = frames[frame_index(pa)].fr_refs;
+	spinlock_release(&frame_lock);
+	return refs;
+}
+
+/*
+ * Get a frame for a user page, with one reference; zero-filled if
+ * ZERO is set. It is not pageable until frame_setowner is called.
+ * Called with vm_lock held; pages something out if memory is short.
+ */
+paddr_t
+frame_alloc(bool zero)
+{
+	paddr_t pa = 0;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+
+	if (zero) {
+		pa = zpool_take();
+	}
+	if (pa == 0) {
+		if (buddy_nfree < FRAME_RESERVE) {
+			(void)frame_reclaim();
+		}
+		pa = getfreeppages(1);
+		if (pa == 0 && frame_reclaim() == 0) {
+			pa = getfreeppages(1);
+		}
+		if (pa == 0 && !zero) {
+			/* Last resort */
+			pa = zpool_take();
+		}
+		if (pa == 0) {
+			return 0;
+		}
+		if (zero) {
+			bzero((void *)PADDR_TO_KVADDR(pa), PAGE_SIZE);
+		}
+	}
+
+	spinlock_acquire(&frame_lock);
+	KASSERT(frames[frame_index(pa)].fr_refs == 0);
+	frames[frame_index(pa)].fr_refs = 1;
+	frames[frame_index(pa)].fr_as = NULL;
+	spinlock_release(&frame_lock);
+	return pa;
+}
+
+/*
+ * Page out up to SWAP_MAXCLUSTER private frames chosen by the clock
+ * algorithm, into consecutive swap slots. Called with vm_lock held.
+ */
+static
+int
+frame_evict(void)
+{
+	struct addrspace *vas[SWAP_MAXCLUSTER];
+	vaddr_t vva[SWAP_MAXCLUSTER];
+	paddr_t vpa[SWAP_MAXCLUSTER];
+	struct frame *fr;
+	unsigned long scanned, idx;
+	unsigned n, i, run, nsent, slot;
+	uint32_t *pte;
+	int result;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+
+	/* Two sweeps: the first one may only clear reference bits */
+	n = 0;
+	spinlock_acquire(&frame_lock);
+	for (scanned = 0; scanned < 2 * buddy_npages && n < SWAP_MAXCLUSTER;
+	     scanned++) {
+		idx = frame_hand;
+		frame_hand = (frame_hand + 1) % buddy_npages;
+
+		fr = &frames[idx];
+		if (fr->fr_refs != 1 || fr->fr_as == NULL) {
+			continue;
+		}
+		if (fr->fr_referenced) {
+			fr->fr_referenced = 0;
+			continue;
+		}
+		vas[n] = fr->fr_as;
+		vva[n] = fr->fr_va;
+		vpa[n] = buddy_base + idx * PAGE_SIZE;
+		fr->fr_as = NULL;	/* hands off until it's written out */
+		n++;
+	}
+	spinlock_release(&frame_lock);
+
+	if (n == 0) {
+		return ENOMEM;
+	}
+
+	result = swap_alloc(n, &slot);
+	if (result) {
+		for (i=0; i<n; i++) {
+			frame_setowner(vpa[i], vas[i], vva[i]);
+		}
+		return ENOMEM;
+	}
+
+	/*
+	 * Point the PTEs at swap, and make sure nobody still uses the
+	 * frames. Pages next to each other in the same address space go
+	 * out as one range; all the shootdowns are queued before waiting
+	 * for any, so each other cpu takes a single interrupt for them.
+	 */
+	for (i=0; i<n; i++) {
+		pte = pt_lookup(vas[i], vva[i], false);
+		KASSERT(pte != NULL);
+		KASSERT((*pte & PTE_VALID) && (*pte & PTE_FRAME) == vpa[i]);
+		*pte = ((slot + i) << PTE_SLOTSHIFT) | PTE_SWAP |
+			(*pte & PTE_WRITE);
+	}
+	COMPILE_ASSERT(SWAP_MAXCLUSTER <= TLBSHOOTDOWN_MAX);
+	nsent = 0;
+	for (i=0; i<n; i += run) {
+		for (run = 1; i + run < n; run++) {
+			if (vas[i + run] != vas[i] ||
+			    vva[i + run] != vva[i] + run * PAGE_SIZE) {
+				break;
+			}
+		}
+		nsent += tlb_shootdown(vas[i], vva[i], run);
+	}
+	tlb_shootdown_wait(nsent);
+
+	result = swap_write(slot, vpa, n);
+	if (result) {
+		panic("dumbvm: swap write failed: %s\n", strerror(result));
+	}
+
+	for (i=0; i<n; i++) {
+		frame_decref(vpa[i]);
+	}
+	vm_evictions++;
+	return 0;
+}
+
+/*
+ * Free some user memory: text and file cache pages nobody uses first,
+ * since they cost no I/O, then by paging out. Called with vm_lock held.
+ */
+int
+frame_reclaim(void)
+{
+	if (textcache_reclaim() > 0 ||
+	    mapcache_release(NULL, SWAP_MAXCLUSTER) > 0) {
+		return 0;
+	}
+	if (swap_enabled()) {
+		return frame_evict();
+	}
+	return ENOMEM;
+}
+
+void
+frame_printstats(void)
+{
+	kprintf("dumbvm: %u eviction passes\n", vm_evictions);
+}
+
+void
+frame_kstat(struct kstat *ks)
+{
+	kstat_put(ks, vm_evictions, "vm.evictions");
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Kernel info pages (kern/kinfo.h). The time page is shared by every
+ * address space; it is allocated at boot and keeps a reference of its
+ * own, so the mappings never free it. The process page belongs to one
+ * address space, which holds a reference to it besides its mapping.
+ * Neither is ever given an owner, so they are never paged out.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/time.h>
+#include <kern/kinfo.h>
+#include <lib.h>
+#include <cpu.h>
+#include <membar.h>
+#include <synch.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <vmprivate.h>
+#include <frame.h>
+#include <kinfo.h>
+
+static paddr_t kinfo_timepa;
+static struct kinfo_time *kinfo_time;
+
+int
+kinfo_bootstrap(void)
+{
+	lock_acquire(vm_lock);
+	kinfo_timepa = frame_alloc(true);
+	lock_release(vm_lock);
+	if (kinfo_timepa == 0) {
+		return ENOMEM;
+	}
+	kinfo_time = (struct kinfo_time *)PADDR_TO_KVADDR(kinfo_timepa);
+	/* All the cpus have been found by now, if not started */
+	kinfo_time->kt_ncpus = cpu_count();
+	return 0;
+}
+
+/*
+ * Publish the time of day in the time page. Called on every clock
+ * tick, with the coarse time's seqlock held, so there is only ever
+ * one writer.
+ */
+void
+vm_kinfo_settime(const struct timespec *now)
+{
+	struct kinfo_time *kt = kinfo_time;
+
+	if (kt == NULL) {
+		return;
+	}
+	kt->kt_seq++;
+	membar_store_store();
+	kt->kt_sec = now->tv_sec;
+	kt->kt_nsec = now->tv_nsec;
+	membar_store_store();
+	kt->kt_seq++;
+}
+
+struct kinfo_proc *
+as_kinfo(struct addrspace *as)
+{
+	if (as->as_kinfo == 0) {
+		return NULL;
+	}
+	return (struct kinfo_proc *)PADDR_TO_KVADDR(as->as_kinfo);
+}
+
+/*
+ * The frame mapped at VA, which is in the kernel info pages of AS.
+ */
+paddr_t
+kinfo_page(struct addrspace *as, vaddr_t va)
+{
+	return va == KINFO_VADDR ? kinfo_timepa : as->as_kinfo;
+}
+
+/*
+ * Add the kernel info pages to AS. The process page is filled in by
+ * proc.
+ */
+int
+as_define_kinfo(struct addrspace *as)
+{
+	struct region *reg;
+	int result;
+
+	COMPILE_ASSERT(KINFO_PAGESIZE == PAGE_SIZE);
+	result = as_insertregion(as, KINFO_VADDR, KINFO_NPAGES, 0, &reg);
+	if (result) {
+		return result;
+	}
+	reg->kinfo = true;
+	lock_acquire(vm_lock);
+	as->as_kinfo = frame_alloc(true);
+	lock_release(vm_lock);
+	if (as->as_kinfo == 0) {
+		return ENOMEM;
+	}
+	return 0;
+}
@@ -29,8 +29,14 @@
 
 #include <types.h>
 #include <lib.h>
+#include <limits.h>
+#include <spl.h>
 #include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
 #include <vm.h>
+#include <kstat.h>
+#include <platform/maxcpus.h>
 
 /*
  * Kernel malloc.
@@ -111,6 +117,11 @@ fill_deadbeef(void *vptr, size_t len)
  * CHECKGUARDS checks that allocated blocks' guard bands are intact
  * when checking kernel heap pages with SLOW and SLOWER. This is also
  * quite slow in its own right.
+ *
+ * PROFILE keeps, for each allocation site, the number of allocations
+ * and frees and the bytes live now and at most, for kheap_profile to
+ * print. It uses the LABELS headers to find the site of a block being
+ * freed, so it turns LABELS on.
  */
 
 #undef  SLOW
@@ -121,6 +132,24 @@ fill_deadbeef(void *vptr, size_t len)
 #undef CHECKBEEF
 #undef CHECKGUARDS
 
+#undef PROFILE
+
+#ifdef PROFILE
+#define LABELS
+#endif
+
+/*
+ * MAGAZINES puts a small per-cpu cache of free blocks of each size
+ * (a "magazine") in front of the subpage allocator, so most kmalloc
+ * and kfree calls don't need kmalloc_spinlock at all. Magazines hand
+ * out raw blocks, so they are turned off if GUARDS or LABELS is on.
+ */
+#define MAGAZINES
+
+#if defined(GUARDS) || defined(LABELS)
+#undef MAGAZINES
+#endif
+
 ////////////////////////////////////////
 
 #if PAGE_SIZE == 4096
@@ -160,14 +189,108 @@ struct pageref {
 ////////////////////////////////////////
 
 /*
- * Use one spinlock for the whole thing. Making parts of the kmalloc
- * logic per-cpu is worthwhile for scalability; however, for the time
- * being at least we won't, because it adds a lot of complexity and in
- * OS/161 performance and scalability aren't super-critical.
+ * Use one spinlock for the whole thing. The per-cpu magazines (see
+ * below) take most of the traffic off it; they only come here to
+ * refill or drain in batches.
  */
 
 static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
 
+/*
+ * How many times kmalloc_spinlock has been taken, and how many of
+ * those found it held by another cpu. Updated with the lock held;
+ * read without it, like the magazine counters.
+ */
+static unsigned kmalloc_lockcount, kmalloc_lockwaits;
+
+static
+void
+kmalloc_lock(void)
+{
+	if (spinlock_acquire_contended(&kmalloc_spinlock)) {
+		kmalloc_lockwaits++;
+	}
+	kmalloc_lockcount++;
+}
+
+/*
+ * Report the counts above.
+ */
+void
+kheap_lockstats(unsigned *acquires, unsigned *contended)
+{
+	*acquires = kmalloc_lockcount;
+	*contended = kmalloc_lockwaits;
+}
+
+////////////////////////////////////////
+
+#ifdef MAGAZINES
+
+/*
+ * To put a block in a magazine, kfree needs to know its size, and
+ * finding its pageref means walking allbase with the spinlock held.
+ * So we also keep a direct-mapped table from page address to block
+ * type, in the same form as pageaddr_and_blocktype (0 means empty),
+ * which kfree reads without locking. That's safe because the page
+ * holding a block can't go away before the block is freed. A page
+ * whose slot is already taken gets no entry; its blocks are just
+ * freed the slow way.
+ */
+
+#define NPAGETAGS 1024
+#define PAGETAG_SLOT(pa) (((pa) / PAGE_SIZE) % NPAGETAGS)
+
+static vaddr_t pagetags[NPAGETAGS];
+
+static
+void
+pagetag_set(struct pageref *pr)
+{
+	unsigned slot = PAGETAG_SLOT(PR_PAGEADDR(pr));
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	if (pagetags[slot] == 0) {
+		pagetags[slot] = pr->pageaddr_and_blocktype;
+	}
+}
+
+static
+void
+pagetag_clear(struct pageref *pr)
+{
+	unsigned slot = PAGETAG_SLOT(PR_PAGEADDR(pr));
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	if (pagetags[slot] == pr->pageaddr_and_blocktype) {
+		pagetags[slot] = 0;
+	}
+}
+
+/*
+ * Return the block type of the heap page ADDR is on, or -1 if we
+ * don't know.
+ */
+static
+int
+pagetag_lookup(vaddr_t addr)
+{
+	vaddr_t tag;
+
+	tag = pagetags[PAGETAG_SLOT(addr & PAGE_FRAME)];
+	if (tag == 0 || (tag & PAGE_FRAME) != (addr & PAGE_FRAME)) {
+		return -1;
+	}
+	return tag & ~PAGE_FRAME;
+}
+
+#else
+
+#define pagetag_set(pr) ((void)(pr))
+#define pagetag_clear(pr) ((void)(pr))
+
+#endif /* MAGAZINES */
+
 ////////////////////////////////////////
 
 /*
@@ -230,7 +353,7 @@ allocpagerefpage(struct kheap_root *root)
 	 */
 	spinlock_release(&kmalloc_spinlock);
 	va = alloc_kpages(1);
-	spinlock_acquire(&kmalloc_spinlock);
+	kmalloc_lock();
 	if (va == 0) {
 		kprintf("kmalloc: Couldn't get a pageref page\n");
 		return;
@@ -241,7 +364,7 @@ allocpagerefpage(struct kheap_root *root)
 		/* Oops, somebody else allocated it. */
 		spinlock_release(&kmalloc_spinlock);
 		free_kpages(va);
-		spinlock_acquire(&kmalloc_spinlock);
+		kmalloc_lock();
 		/* Once allocated it isn't ever freed. */
 		KASSERT(root->page != NULL);
 		return;
@@ -697,11 +820,189 @@ dump_subpages(unsigned generation)
 
 #endif /* LABELS */
 
+////////////////////////////////////////
+
+#ifdef PROFILE
+
+/*
+ * Per-site counters, in an open hash keyed by the allocation label.
+ * Sites that don't fit are lumped together in the entry with site 0.
+ * Whole-page allocations aren't labeled, so their sites are kept in
+ * a separate table by address; if that is full, they aren't counted.
+ * Everything is protected by kmalloc_spinlock.
+ */
+
+#define PROFILE_NSITES 128
+#define PROFILE_NBIG 128
+
+struct profsite {
+	vaddr_t ps_site;	/* caller, 0 if unused or overflow */
+	unsigned ps_allocs;
+	unsigned ps_frees;
+	size_t ps_live;		/* bytes allocated now */
+	size_t ps_peak;		/* most ever allocated at once */
+};
+
+struct profbig {
+	vaddr_t pb_addr;	/* 0 if unused */
+	vaddr_t pb_site;
+	size_t pb_size;
+};
+
+static struct profsite profsites[PROFILE_NSITES];
+static struct profsite profoverflow;
+static struct profbig profbigs[PROFILE_NBIG];
+static unsigned profbig_lost;
+
+static
+struct profsite *
+profile_site(vaddr_t site)
+{
+	unsigned i, slot;
+
+	slot = (site >> 2) % PROFILE_NSITES;
+	for (i=0; i<PROFILE_NSITES; i++) {
+		if (profsites[slot].ps_site == site) {
+			return &profsites[slot];
+		}
+		if (profsites[slot].ps_site == 0) {
+			profsites[slot].ps_site = site;
+			return &profsites[slot];
+		}
+		slot = (slot + 1) % PROFILE_NSITES;
+	}
+	return &profoverflow;
+}
+
+static
+void
+profile_alloc(vaddr_t site, size_t size)
+{
+	struct profsite *ps;
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	ps = profile_site(site);
+	ps->ps_allocs++;
+	ps->ps_live += size;
+	if (ps->ps_live > ps->ps_peak) {
+		ps->ps_peak = ps->ps_live;
+	}
+}
+
+static
+void
+profile_free(vaddr_t site, size_t size)
+{
+	struct profsite *ps;
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	ps = profile_site(site);
+	ps->ps_frees++;
+	KASSERT(ps->ps_live >= size);
+	ps->ps_live -= size;
+}
+
+/*
+ * Remember the site of a whole-page allocation.
+ */
+static
+void
+profile_bigalloc(vaddr_t addr, vaddr_t site, size_t size)
+{
+	unsigned i;
+
+	kmalloc_lock();
+	for (i=0; i<PROFILE_NBIG; i++) {
+		if (profbigs[i].pb_addr == 0) {
+			profbigs[i].pb_addr = addr;
+			profbigs[i].pb_site = site;
+			profbigs[i].pb_size = size;
+			profile_alloc(site, size);
+			break;
+		}
+	}
+	if (i == PROFILE_NBIG) {
+		profbig_lost++;
+	}
+	spinlock_release(&kmalloc_spinlock);
+}
+
+static
+void
+profile_bigfree(vaddr_t addr)
+{
+	unsigned i;
+
+	kmalloc_lock();
+	for (i=0; i<PROFILE_NBIG; i++) {
+		if (profbigs[i].pb_addr == addr) {
+			profile_free(profbigs[i].pb_site, profbigs[i].pb_size);
+			profbigs[i].pb_addr = 0;
+			break;
+		}
+	}
+	spinlock_release(&kmalloc_spinlock);
+}
+
+#endif /* PROFILE */
+
+/*
+ * Print the allocation sites, biggest peak first.
+ */
+void
+kheap_profile(void)
+{
+#ifdef PROFILE
+	struct profsite sorted[PROFILE_NSITES + 1], tmp;
+	unsigned i, j, n = 0, lost;
+
+	/* Copy out with interrupts off, print afterwards */
+	kmalloc_lock();
+	for (i=0; i<PROFILE_NSITES; i++) {
+		if (profsites[i].ps_site != 0) {
+			sorted[n++] = profsites[i];
+		}
+	}
+	if (profoverflow.ps_allocs > 0) {
+		sorted[n++] = profoverflow;
+	}
+	lost = profbig_lost;
+	spinlock_release(&kmalloc_spinlock);
+
+	for (i=1; i<n; i++) {
+		tmp = sorted[i];
+		for (j=i; j>0 && sorted[j-1].ps_peak < tmp.ps_peak; j--) {
+			sorted[j] = sorted[j-1];
+		}
+		sorted[j] = tmp;
+	}
+
+	kprintf("%-10s %8s %8s %8s %8s\n", "site", "allocs", "frees",
+		"live", "peak");
+	for (i=0; i<n; i++) {
+		if (sorted[i].ps_site == 0) {
+			kprintf("%-10s ", "(other)");
+		}
+		else {
+			kprintf("%p ", (void *)sorted[i].ps_site);
+		}
+		kprintf("%8u %8u %8zu %8zu\n", sorted[i].ps_allocs,
+			sorted[i].ps_frees, sorted[i].ps_live,
+			sorted[i].ps_peak);
+	}
+	if (lost > 0) {
+		kprintf("%u whole-page allocations not tracked\n", lost);
+	}
+#else
+	kprintf("Enable PROFILE in kmalloc.c to use this functionality.\n");
+#endif
+}
+
 void
 kheap_nextgeneration(void)
 {
 #ifdef LABELS
-	spinlock_acquire(&kmalloc_spinlock);
+	kmalloc_lock();
 	mallocgeneration++;
 	spinlock_release(&kmalloc_spinlock);
 #endif
@@ -712,7 +1013,7 @@ kheap_dump(void)
 {
 #ifdef LABELS
 	/* print the whole thing with interrupts off */
-	spinlock_acquire(&kmalloc_spinlock);
+	kmalloc_lock();
 	dump_subpages(mallocgeneration);
 	spinlock_release(&kmalloc_spinlock);
 #else
@@ -727,7 +1028,7 @@ kheap_dumpall(void)
 	unsigned i;
 
 	/* print the whole thing with interrupts off */
-	spinlock_acquire(&kmalloc_spinlock);
+	kmalloc_lock();
 	for (i=0; i<=mallocgeneration; i++) {
 		dump_subpages(i);
 	}
@@ -794,6 +1095,10 @@ subpage_stats(struct pageref *pr)
 	kprintf("\n");
 }
 
+#ifdef MAGAZINES
+static void magazine_printstats(void);
+#endif
+
 /*
  * Print the whole heap.
  */
@@ -803,7 +1108,7 @@ kheap_printstats(void)
 	struct pageref *pr;
 
 	/* print the whole thing with interrupts off */
-	spinlock_acquire(&kmalloc_spinlock);
+	kmalloc_lock();
 
 	kprintf("Subpage allocator status:\n");
 
@@ -812,6 +1117,13 @@ kheap_printstats(void)
 	}
 
 	spinlock_release(&kmalloc_spinlock);
+
+	kprintf("kmalloc_spinlock: %u acquires, %u contended\n",
+		kmalloc_lockcount, kmalloc_lockwaits);
+#ifdef MAGAZINES
+	magazine_printstats();
+#endif
+	pathbuf_printstats();
 }
 
 ////////////////////////////////////////
@@ -866,6 +1178,42 @@ int blocktype(size_t clientsz)
 	return 0;
 }
 
+/*
+ * Take the first block off the free list of PR, which must have one.
+ */
+static
+void *
+subpage_takeblock(struct pageref *pr)
+{
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t fla;		// free list entry address
+	struct freelist *fl;	// free list entry
+	void *retptr;		// our result
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	KASSERT(pr->nfree > 0);
+	KASSERT(pr->freelist_offset < PAGE_SIZE);
+	prpage = PR_PAGEADDR(pr);
+	fla = prpage + pr->freelist_offset;
+	fl = (struct freelist *)fla;
+
+	retptr = fl;
+	fl = fl->next;
+	pr->nfree--;
+
+	if (fl != NULL) {
+		KASSERT(pr->nfree > 0);
+		fla = (vaddr_t)fl;
+		KASSERT(fla - prpage < PAGE_SIZE);
+		pr->freelist_offset = fla - prpage;
+	}
+	else {
+		KASSERT(pr->nfree == 0);
+		pr->freelist_offset = INVALID_OFFSET;
+	}
+	return retptr;
+}
+
 /*
  * Allocate a block of size SZ, where SZ is not large enough to
  * warrant a whole-page allocation.
@@ -907,7 +1255,7 @@ subpage_kmalloc(size_t sz
 	sz = sizes[blktype];
 #endif
 
-	spinlock_acquire(&kmalloc_spinlock);
+	kmalloc_lock();
 
 	checksubpages();
 
@@ -921,31 +1269,16 @@ subpage_kmalloc(size_t sz
 
 		doalloc: /* comes here after getting a whole fresh page */
 
-			KASSERT(pr->freelist_offset < PAGE_SIZE);
-			prpage = PR_PAGEADDR(pr);
-			fla = prpage + pr->freelist_offset;
-			fl = (struct freelist *)fla;
-
-			retptr = fl;
-			fl = fl->next;
-			pr->nfree--;
-
-			if (fl != NULL) {
-				KASSERT(pr->nfree > 0);
-				fla = (vaddr_t)fl;
-				KASSERT(fla - prpage < PAGE_SIZE);
-				pr->freelist_offset = fla - prpage;
-			}
-			else {
-				KASSERT(pr->nfree == 0);
-				pr->freelist_offset = INVALID_OFFSET;
-			}
+			retptr = subpage_takeblock(pr);
 #ifdef GUARDS
 			retptr = establishguardband(retptr, clientsz, sz);
 #endif
 #ifdef LABELS
 			retptr = establishlabel(retptr, label);
 #endif
+#ifdef PROFILE
+			profile_alloc(label, sizes[blktype]);
+#endif
 
 			checksubpages();
 
@@ -975,7 +1308,7 @@ subpage_kmalloc(size_t sz
 	/* deadbeef the whole page, as it probably starts zeroed */
 	fill_deadbeef((void *)prpage, PAGE_SIZE);
 #endif
-	spinlock_acquire(&kmalloc_spinlock);
+	kmalloc_lock();
 
 	pr = allocpageref();
 	if (pr==NULL) {
@@ -1013,82 +1346,64 @@ subpage_kmalloc(size_t sz
 	pr->next_all = allbase;
 	allbase = pr;
 
+	pagetag_set(pr);
+
 	/* This is kind of cheesy, but avoids duplicating the alloc code. */
 	goto doalloc;
 }
 
 /*
- * Free a pointer previously returned from subpage_kmalloc. If the
- * pointer is not on any heap page we recognize, return -1.
+ * Find the pageref for the heap page PTRADDR is on, or NULL if it
+ * isn't on any of our pages.
  */
 static
-int
-subpage_kfree(void *ptr)
+struct pageref *
+subpage_findpage(vaddr_t ptraddr)
 {
-	int blktype;		// index into sizes[] that we're using
-	vaddr_t ptraddr;	// same as ptr
 	struct pageref *pr;	// pageref for page we're freeing in
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
-	vaddr_t fla;		// free list entry address
-	struct freelist *fl;	// free list entry
-	vaddr_t offset;		// offset into page
-#ifdef GUARDS
-	size_t blocksize, smallerblocksize;
-#endif
-
-	ptraddr = (vaddr_t)ptr;
-#ifdef GUARDS
-	if (ptraddr % PAGE_SIZE == 0) {
-		/*
-		 * With guard bands, all client-facing subpage
-		 * pointers are offset by GUARD_PTROFFSET (which is 4)
-		 * from the underlying blocks and are therefore not
-		 * page-aligned. So a page-aligned pointer is not one
-		 * of ours. Catch this up front, as otherwise
-		 * subtracting GUARD_PTROFFSET could give a pointer on
-		 * a page we *do* own, and then we'll panic because
-		 * it's not a valid one.
-		 */
-		return -1;
-	}
-	ptraddr -= GUARD_PTROFFSET;
-#endif
-#ifdef LABELS
-	if (ptraddr % PAGE_SIZE == 0) {
-		/* ditto */
-		return -1;
-	}
-	ptraddr -= LABEL_PTROFFSET;
-#endif
-
-	spinlock_acquire(&kmalloc_spinlock);
-
-	checksubpages();
+	int blktype;		// index into sizes[] that we're using
 
-	/* Silence warnings with gcc 4.8 -Og (but not -O2) */
-	prpage = 0;
-	blktype = 0;
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
 
 	for (pr = allbase; pr; pr = pr->next_all) {
 		prpage = PR_PAGEADDR(pr);
 		blktype = PR_BLOCKTYPE(pr);
-		KASSERT(blktype >= 0 && blktype < NSIZES);
 
 		/* check for corruption */
 		KASSERT(blktype>=0 && blktype<NSIZES);
 		checksubpage(pr);
 
 		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
-			break;
+			return pr;
 		}
 	}
+	return NULL;
+}
 
-	if (pr==NULL) {
-		/* Not on any of our pages - not a subpage allocation */
-		spinlock_release(&kmalloc_spinlock);
-		return -1;
-	}
+/*
+ * Put the block at PTRADDR (client pointer PTR) back on the free list
+ * of its page PR. If that leaves the whole page free, PR is taken off
+ * the lists and freed, and we return true; the caller must then
+ * free_kpages the page after releasing kmalloc_spinlock.
+ */
+static
+bool
+subpage_putblock(struct pageref *pr, vaddr_t ptraddr, void *ptr)
+{
+	int blktype;		// index into sizes[] that we're using
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t fla;		// free list entry address
+	struct freelist *fl;	// free list entry
+	vaddr_t offset;		// offset into page
+#ifdef GUARDS
+	size_t blocksize, smallerblocksize;
+#endif
 
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
 	offset = ptraddr - prpage;
 
 	/* Check for proper positioning and alignment */
@@ -1140,25 +1455,477 @@ subpage_kfree(void *ptr)
 	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
 	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
 		/* Whole page is free. */
+		pagetag_clear(pr);
 		remove_lists(pr, blktype);
 		freepageref(pr);
-		/* Call free_kpages without kmalloc_spinlock. */
-		spinlock_release(&kmalloc_spinlock);
-		free_kpages(prpage);
-	}
-	else {
-		spinlock_release(&kmalloc_spinlock);
+		return true;
 	}
+	return false;
+}
+
+/*
+ * Free a pointer previously returned from subpage_kmalloc. If the
+ * pointer is not on any heap page we recognize, return -1.
+ */
+static
+int
+subpage_kfree(void *ptr)
+{
+	vaddr_t ptraddr;	// same as ptr
+	struct pageref *pr;	// pageref for page we're freeing in
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+
+	ptraddr = (vaddr_t)ptr;
+#ifdef GUARDS
+	if (ptraddr % PAGE_SIZE == 0) {
+		/*
+		 * With guard bands, all client-facing subpage
+		 * pointers are offset by GUARD_PTROFFSET (which is 4)
+		 * from the underlying blocks and are therefore not
+		 * page-aligned. So a page-aligned pointer is not one
+		 * of ours. Catch this up front, as otherwise
+		 * subtracting GUARD_PTROFFSET could give a pointer on
+		 * a page we *do* own, and then we'll panic because
+		 * it's not a valid one.
+		 */
+		return -1;
+	}
+	ptraddr -= GUARD_PTROFFSET;
+#endif
+#ifdef LABELS
+	if (ptraddr % PAGE_SIZE == 0) {
+		/* ditto */
+		return -1;
+	}
+	ptraddr -= LABEL_PTROFFSET;
+#endif
+
+	kmalloc_lock();
+
+	checksubpages();
+
+	pr = subpage_findpage(ptraddr);
+	if (pr==NULL) {
+		/* Not on any of our pages - not a subpage allocation */
+		spinlock_release(&kmalloc_spinlock);
+		return -1;
+	}
+
+#ifdef PROFILE
+	profile_free(((struct malloclabel *)ptr - 1)->label,
+		     sizes[PR_BLOCKTYPE(pr)]);
+#endif
+
+	prpage = PR_PAGEADDR(pr);
+	if (subpage_putblock(pr, ptraddr, ptr)) {
+		/* Call free_kpages without kmalloc_spinlock. */
+		spinlock_release(&kmalloc_spinlock);
+		free_kpages(prpage);
+	}
+	else {
+		spinlock_release(&kmalloc_spinlock);
+	}
+
+#ifdef SLOWER /* Don't get the lock unless checksubpages does something. */
+	kmalloc_lock();
+	checksubpages();
+	spinlock_release(&kmalloc_spinlock);
+#endif
 
-#ifdef SLOWER /* Don't get the lock unless checksubpages does something. */
-	spinlock_acquire(&kmalloc_spinlock);
-	checksubpages();
-	spinlock_release(&kmalloc_spinlock);
-#endif
-
 	return 0;
 }
 
+#ifdef MAGAZINES
+
+////////////////////////////////////////////////////////////
+//
+// Per-cpu magazines.
+//
+// Each cpu keeps, for each block size, a small stack of free blocks.
+// kmalloc pops from the current cpu's stack and kfree pushes onto
+// it, with interrupts off and no lock, like the pathbuf pools
+// below. When a magazine runs dry it is refilled with half a
+// magazine's worth of blocks under one acquisition of
+// kmalloc_spinlock, and when it overflows the older half goes back
+// the same way. Blocks sitting in magazines count as in use as far
+// as the pagerefs (and kheap_printstats) are concerned.
+//
+// A magazine holds at most KMAG_MAXBLOCKS blocks and never more than
+// one page's worth, so the big sizes don't pin much memory. Each
+// cpu's magazines start on a cache line of their own.
+//
+
+#define KMAG_MAXBLOCKS 16
+
+struct kmalloc_magazine {
+	void *km_blocks[KMAG_MAXBLOCKS];
+	unsigned km_nblocks;
+};
+
+struct kmalloc_cpucache {
+	struct kmalloc_magazine kc_mags[NSIZES];
+	unsigned kc_hits;		/* kmalloc served from the magazine */
+	unsigned kc_misses;		/* kmalloc that found it empty */
+	unsigned kc_drains;		/* kfree that found it full */
+} __cacheline_aligned;
+
+static struct kmalloc_cpucache kmalloc_cpucaches[MAXCPUS];
+
+/*
+ * Capacity of a magazine for block type BLKTYPE. Always at least 2.
+ */
+static
+unsigned
+kmag_capacity(unsigned blktype)
+{
+	unsigned n = PAGE_SIZE / sizes[blktype];
+
+	return n < KMAG_MAXBLOCKS ? n : KMAG_MAXBLOCKS;
+}
+
+/*
+ * Take up to N blocks of type BLKTYPE for a magazine, from pages we
+ * already have. Returns how many we got, which is 0 if a new page is
+ * needed; subpage_kmalloc knows how to get one.
+ */
+static
+unsigned
+subpage_getblocks(unsigned blktype, void **blocks, unsigned n)
+{
+	struct pageref *pr;
+	unsigned got = 0;
+
+	kmalloc_lock();
+
+	checksubpages();
+
+	for (pr = sizebases[blktype]; pr != NULL && got < n;
+	     pr = pr->next_samesize) {
+		KASSERT(PR_BLOCKTYPE(pr) == blktype);
+		checksubpage(pr);
+
+		while (pr->nfree > 0 && got < n) {
+			blocks[got++] = subpage_takeblock(pr);
+		}
+	}
+
+	checksubpages();
+
+	spinlock_release(&kmalloc_spinlock);
+	return got;
+}
+
+/*
+ * Free N blocks drained from a magazine. They were all handed out by
+ * the subpage allocator, so they're all on our pages.
+ */
+static
+void
+subpage_putblocks(void **blocks, unsigned n)
+{
+	struct pageref *pr;
+	vaddr_t ptraddr;
+	vaddr_t emptypages[KMAG_MAXBLOCKS];
+	unsigned i, nempty = 0;
+
+	KASSERT(n <= KMAG_MAXBLOCKS);
+
+	kmalloc_lock();
+
+	checksubpages();
+
+	for (i=0; i<n; i++) {
+		ptraddr = (vaddr_t)blocks[i];
+		pr = subpage_findpage(ptraddr);
+		if (pr == NULL) {
+			panic("kfree: magazine held foreign block %p\n",
+			      blocks[i]);
+		}
+		if (subpage_putblock(pr, ptraddr, blocks[i])) {
+			emptypages[nempty++] = ptraddr & PAGE_FRAME;
+		}
+	}
+
+	checksubpages();
+
+	/* Call free_kpages without kmalloc_spinlock. */
+	spinlock_release(&kmalloc_spinlock);
+
+	for (i=0; i<nempty; i++) {
+		free_kpages(emptypages[i]);
+	}
+}
+
+/*
+ * Get a block of type BLKTYPE from the current cpu's magazine,
+ * refilling it if it's empty. Returns NULL if the subpage allocator
+ * needs a new page, in which case the caller should go the slow way.
+ */
+static
+void *
+magazine_get(unsigned blktype)
+{
+	struct kmalloc_cpucache *kc;
+	struct kmalloc_magazine *km;
+	void *blocks[KMAG_MAXBLOCKS / 2];
+	void *ret = NULL;
+	unsigned cap, n;
+	int spl;
+
+	cap = kmag_capacity(blktype);
+
+	spl = splhigh();
+	if (!CURCPU_EXISTS()) {
+		splx(spl);
+		return NULL;
+	}
+	KASSERT(curcpu->c_number < MAXCPUS);
+	kc = &kmalloc_cpucaches[curcpu->c_number];
+	km = &kc->kc_mags[blktype];
+	if (km->km_nblocks > 0) {
+		ret = km->km_blocks[--km->km_nblocks];
+		kc->kc_hits++;
+	}
+	else {
+		kc->kc_misses++;
+	}
+	splx(spl);
+
+	if (ret != NULL) {
+		return ret;
+	}
+
+	/* Empty: refill with half a magazine, keep one for the caller */
+	n = subpage_getblocks(blktype, blocks, cap / 2);
+	if (n == 0) {
+		return NULL;
+	}
+	ret = blocks[--n];
+
+	/*
+	 * We may be on another cpu by now, or another thread may have
+	 * filled the magazine meanwhile; anything that doesn't fit
+	 * goes back.
+	 */
+	spl = splhigh();
+	km = &kmalloc_cpucaches[curcpu->c_number].kc_mags[blktype];
+	while (n > 0 && km->km_nblocks < cap) {
+		km->km_blocks[km->km_nblocks++] = blocks[--n];
+	}
+	splx(spl);
+
+	if (n > 0) {
+		subpage_putblocks(blocks, n);
+	}
+	return ret;
+}
+
+/*
+ * Put PTR in the current cpu's magazine, draining it if it's full.
+ * Returns -1 if PTR isn't on a heap page we have a tag for, in which
+ * case the caller should go the slow way.
+ */
+static
+int
+magazine_put(void *ptr)
+{
+	struct kmalloc_cpucache *kc;
+	struct kmalloc_magazine *km;
+	void *blocks[KMAG_MAXBLOCKS / 2];
+	vaddr_t ptraddr;
+	unsigned cap, n = 0, i;
+	int blktype;
+	int spl;
+
+	ptraddr = (vaddr_t)ptr;
+	blktype = pagetag_lookup(ptraddr);
+	if (blktype < 0) {
+		return -1;
+	}
+	if ((ptraddr & ~PAGE_FRAME) % sizes[blktype] != 0) {
+		panic("kfree: subpage free of invalid addr %p\n", ptr);
+	}
+	cap = kmag_capacity(blktype);
+
+	/* Same as subpage_putblock, for dangling pointers */
+	fill_deadbeef(ptr, sizes[blktype]);
+
+	spl = splhigh();
+	if (!CURCPU_EXISTS()) {
+		splx(spl);
+		return -1;
+	}
+	kc = &kmalloc_cpucaches[curcpu->c_number];
+	km = &kc->kc_mags[blktype];
+	if (km->km_nblocks == cap) {
+		/* Full: drain the older half */
+		n = cap / 2;
+		for (i=0; i<n; i++) {
+			blocks[i] = km->km_blocks[i];
+		}
+		for (i=n; i<cap; i++) {
+			km->km_blocks[i - n] = km->km_blocks[i];
+		}
+		km->km_nblocks = cap - n;
+		kc->kc_drains++;
+	}
+	km->km_blocks[km->km_nblocks++] = ptr;
+	splx(spl);
+
+	if (n > 0) {
+		subpage_putblocks(blocks, n);
+	}
+	return 0;
+}
+
+/*
+ * Print the magazine statistics. Like the pathbuf pool counters,
+ * these are read without synchronization.
+ */
+static
+void
+magazine_printstats(void)
+{
+	unsigned i, j, hits = 0, misses = 0, drains = 0, cached = 0;
+
+	for (i=0; i<MAXCPUS; i++) {
+		hits += kmalloc_cpucaches[i].kc_hits;
+		misses += kmalloc_cpucaches[i].kc_misses;
+		drains += kmalloc_cpucaches[i].kc_drains;
+		for (j=0; j<NSIZES; j++) {
+			cached += kmalloc_cpucaches[i].kc_mags[j].km_nblocks;
+		}
+	}
+	kprintf("Magazines: %u hits, %u misses, %u drains, "
+		"%u blocks cached\n", hits, misses, drains, cached);
+}
+
+#endif /* MAGAZINES */
+
+//
+////////////////////////////////////////////////////////////
+//
+// Heap timeline.
+//
+// kheap_sample is called every few seconds by the timer code. Each
+// call records, in a ring of KHTL_NSAMPLES entries, how many pages
+// each size class holds and how many of their blocks are in use,
+// plus the free physical pages and the largest free block. Blocks
+// sitting in the magazines count as free. kheap_timeline prints the
+// ring, oldest first.
+//
+// Occupancy dropping while a class keeps its pages means subpage
+// fragmentation. Plenty of free pages but a shrinking largest block
+// means the page allocator is fragmenting, and multi-page kmallocs
+// will soon start to fail.
+//
+
+#define KHTL_NSAMPLES 128
+
+struct khsample {
+	unsigned ks_secs;		/* seconds since boot */
+	unsigned ks_pages[NSIZES];	/* pages of each size class */
+	unsigned ks_used[NSIZES];	/* blocks in use in those pages */
+	unsigned long ks_freepages;	/* free physical pages */
+	unsigned long ks_largest;	/* largest free block, in pages */
+};
+
+/* Protected by kmalloc_spinlock */
+static struct khsample khtimeline[KHTL_NSAMPLES];
+static unsigned khtl_count;		/* samples taken so far */
+
+/*
+ * Take one sample. Called from interrupt context; SECS is the time
+ * since boot.
+ */
+void
+kheap_sample(unsigned secs)
+{
+	struct khsample *ks;
+	struct pageref *pr;
+	unsigned long freepages, largest;
+	unsigned i;
+
+	/* Outside kmalloc_spinlock; it takes the page allocator's lock */
+	vm_freestats(&freepages, &largest);
+
+	kmalloc_lock();
+
+	ks = &khtimeline[khtl_count % KHTL_NSAMPLES];
+	ks->ks_secs = secs;
+	ks->ks_freepages = freepages;
+	ks->ks_largest = largest;
+	for (i=0; i<NSIZES; i++) {
+		ks->ks_pages[i] = 0;
+		ks->ks_used[i] = 0;
+		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
+			ks->ks_pages[i]++;
+			ks->ks_used[i] += PAGE_SIZE / sizes[i] - pr->nfree;
+		}
+	}
+#ifdef MAGAZINES
+	{
+		unsigned c, n;
+
+		/* Unsynchronized, like magazine_printstats */
+		for (i=0; i<NSIZES; i++) {
+			for (c=0; c<MAXCPUS; c++) {
+				n = kmalloc_cpucaches[c].kc_mags[i].km_nblocks;
+				ks->ks_used[i] -= n < ks->ks_used[i] ?
+					n : ks->ks_used[i];
+			}
+		}
+	}
+#endif
+	khtl_count++;
+
+	spinlock_release(&kmalloc_spinlock);
+}
+
+/*
+ * Print the timeline. Each size class shows its pages and the
+ * percentage of its blocks in use.
+ */
+void
+kheap_timeline(void)
+{
+	struct khsample ks;
+	unsigned first, n, i, j, cap;
+
+	kmalloc_lock();
+	n = khtl_count < KHTL_NSAMPLES ? khtl_count : KHTL_NSAMPLES;
+	first = khtl_count - n;
+	spinlock_release(&kmalloc_spinlock);
+
+	if (n == 0) {
+		kprintf("Kernel heap timeline: no samples yet\n");
+		return;
+	}
+
+	kprintf("Kernel heap timeline (pages:%%used per size class):\n");
+	kprintf("  secs  free lgst");
+	for (j=0; j<NSIZES; j++) {
+		kprintf(" %8lu", (unsigned long)sizes[j]);
+	}
+	kprintf("\n");
+
+	for (i=first; i<first+n; i++) {
+		/* Copy it out, so we don't print with the lock held */
+		kmalloc_lock();
+		ks = khtimeline[i % KHTL_NSAMPLES];
+		spinlock_release(&kmalloc_spinlock);
+
+		kprintf("%6u %5lu %4lu", ks.ks_secs, ks.ks_freepages,
+			ks.ks_largest);
+		for (j=0; j<NSIZES; j++) {
+			cap = ks.ks_pages[j] * (PAGE_SIZE / sizes[j]);
+			kprintf(" %4u:%3u", ks.ks_pages[j],
+				cap ? ks.ks_used[j] * 100 / cap : 0);
+		}
+		kprintf("\n");
+	}
+}
+
 //
 ////////////////////////////////////////////////////////////
 
@@ -1194,10 +1961,24 @@ kmalloc(size_t sz)
 			return NULL;
 		}
 		KASSERT(address % PAGE_SIZE == 0);
+#ifdef PROFILE
+		profile_bigalloc(address, label, npages * PAGE_SIZE);
+#endif
 
 		return (void *)address;
 	}
 
+#ifdef MAGAZINES
+	{
+		void *ptr;
+
+		ptr = magazine_get(blocktype(sz));
+		if (ptr != NULL) {
+			return ptr;
+		}
+	}
+#endif
+
 #ifdef LABELS
 	return subpage_kmalloc(sz, label);
 #else
@@ -1216,9 +1997,209 @@ kfree(void *ptr)
 	 */
 	if (ptr == NULL) {
 		return;
-	} else if (subpage_kfree(ptr)) {
+	}
+#ifdef MAGAZINES
+	if (magazine_put(ptr) == 0) {
+		return;
+	}
+#endif
+	if (subpage_kfree(ptr)) {
 		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
+#ifdef PROFILE
+		profile_bigfree((vaddr_t)ptr);
+#endif
 		free_kpages((vaddr_t)ptr);
 	}
 }
 
+/*
+ * Allocate a block of size SZ that need not be physically contiguous:
+ * from kmalloc if it can, or else (for more than a page) as scattered
+ * pages mapped together by vmalloc. Free with kvfree.
+ */
+void *
+kvmalloc(size_t sz)
+{
+	void *ptr;
+
+	ptr = kmalloc(sz);
+	if (ptr == NULL && sz > PAGE_SIZE) {
+		ptr = vmalloc(sz);
+	}
+	return ptr;
+}
+
+/*
+ * Free a block returned by kvmalloc, whichever allocator it came from.
+ */
+void
+kvfree(void *ptr)
+{
+	if ((vaddr_t)ptr >= VMALLOC_BASE && (vaddr_t)ptr < VMALLOC_TOP) {
+		vfree(ptr);
+	}
+	else {
+		kfree(ptr);
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Per-cpu pool of PATH_MAX buffers.
+//
+// Path-taking system calls (open, chdir, execv) need a PATH_MAX
+// buffer just for the duration of the call. Rather than going
+// through kmalloc (and its global spinlock) every time, each cpu
+// keeps a few such buffers around. A buffer is taken from the pool
+// of the cpu the caller is running on and given back to the pool of
+// the cpu it is running on at the time, which need not be the same
+// one: the buffers simply migrate. The pools are only ever touched
+// by their own cpu, with interrupts off, so no lock is needed.
+//
+// Buffers are created lazily: a miss falls back to kmalloc, and the
+// buffer then stays in a pool when it is given back, unless that
+// pool is already full.
+//
+
+#define PATHBUF_PERCPU	4
+
+struct pathbuf_pool {
+	char *pp_bufs[PATHBUF_PERCPU];	/* cached buffers */
+	unsigned pp_nbufs;		/* how many of pp_bufs are valid */
+	unsigned pp_hits;		/* pathbuf_get served from the pool */
+	unsigned pp_misses;		/* pathbuf_get that called kmalloc */
+};
+
+static struct pathbuf_pool pathbuf_pools[MAXCPUS];
+
+/*
+ * Get a PATH_MAX buffer. Returns NULL if out of memory.
+ */
+char *
+pathbuf_get(void)
+{
+	struct pathbuf_pool *pp;
+	char *buf = NULL;
+	int spl;
+
+	spl = splhigh();
+	if (CURCPU_EXISTS()) {
+		KASSERT(curcpu->c_number < MAXCPUS);
+		pp = &pathbuf_pools[curcpu->c_number];
+		if (pp->pp_nbufs > 0) {
+			buf = pp->pp_bufs[--pp->pp_nbufs];
+			pp->pp_hits++;
+		}
+		else {
+			pp->pp_misses++;
+		}
+	}
+	splx(spl);
+
+	if (buf == NULL) {
+		buf = kmalloc(PATH_MAX);
+	}
+	return buf;
+}
+
+/*
+ * Give back a buffer obtained from pathbuf_get.
+ */
+void
+pathbuf_put(char *buf)
+{
+	struct pathbuf_pool *pp;
+	int spl;
+
+	if (buf == NULL) {
+		return;
+	}
+
+	spl = splhigh();
+	if (CURCPU_EXISTS()) {
+		pp = &pathbuf_pools[curcpu->c_number];
+		if (pp->pp_nbufs < PATHBUF_PERCPU) {
+			pp->pp_bufs[pp->pp_nbufs++] = buf;
+			buf = NULL;
+		}
+	}
+	splx(spl);
+
+	if (buf != NULL) {
+		kfree(buf);
+	}
+}
+
+/*
+ * Print the pool statistics. The counters are read without
+ * synchronization, so they may be very slightly stale.
+ */
+void
+pathbuf_printstats(void)
+{
+	unsigned i, hits = 0, misses = 0, cached = 0;
+
+	for (i=0; i<MAXCPUS; i++) {
+		hits += pathbuf_pools[i].pp_hits;
+		misses += pathbuf_pools[i].pp_misses;
+		cached += pathbuf_pools[i].pp_nbufs;
+	}
+	kprintf("Path buffer pool: %u hits, %u misses, %u buffers cached\n",
+		hits, misses, cached);
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Heap statistics for kstat: the pages and blocks in use of each
+ * size class (as in the heap timeline, blocks in the magazines
+ * counting as in use here), how often kmalloc_spinlock was taken and
+ * found held, and the magazine and path buffer pool counters.
+ */
+void
+kheap_kstat(struct kstat *ks)
+{
+	struct pageref *pr;
+	unsigned i, pages, used;
+	unsigned hits, misses, cached;
+#ifdef MAGAZINES
+	unsigned drains;
+#endif
+
+	kmalloc_lock();
+	for (i=0; i<NSIZES; i++) {
+		pages = used = 0;
+		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
+			pages++;
+			used += PAGE_SIZE / sizes[i] - pr->nfree;
+		}
+		kstat_put(ks, pages, "kmalloc.%u.pages", (unsigned)sizes[i]);
+		kstat_put(ks, used, "kmalloc.%u.used", (unsigned)sizes[i]);
+	}
+	spinlock_release(&kmalloc_spinlock);
+
+	kstat_put(ks, kmalloc_lockcount, "kmalloc.lock.acquires");
+	kstat_put(ks, kmalloc_lockwaits, "kmalloc.lock.contended");
+
+#ifdef MAGAZINES
+	hits = misses = drains = 0;
+	for (i=0; i<MAXCPUS; i++) {
+		hits += kmalloc_cpucaches[i].kc_hits;
+		misses += kmalloc_cpucaches[i].kc_misses;
+		drains += kmalloc_cpucaches[i].kc_drains;
+	}
+	kstat_put(ks, hits, "kmalloc.magazine.hits");
+	kstat_put(ks, misses, "kmalloc.magazine.misses");
+	kstat_put(ks, drains, "kmalloc.magazine.drains");
+#endif
+
+	hits = misses = cached = 0;
+	for (i=0; i<MAXCPUS; i++) {
+		hits += pathbuf_pools[i].pp_hits;
+		misses += pathbuf_pools[i].pp_misses;
+		cached += pathbuf_pools[i].pp_nbufs;
+	}
+	kstat_put(ks, hits, "kmalloc.pathbuf.hits");
+	kstat_put(ks, misses, "kmalloc.pathbuf.misses");
+	kstat_put(ks, cached, "kmalloc.pathbuf.cached");
+}
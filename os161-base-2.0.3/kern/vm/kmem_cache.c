@@ -0,0 +1,501 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Object caches (see kmem_cache.h).
+ *
+ * A slab is one page from alloc_kpages, with a header at the start
+ * and the objects after it. Since slabs are page-aligned, the slab an
+ * object belongs to is found by masking its address. Free objects are
+ * chained through a link word just past the end of each object, so
+ * whatever the constructor set up in a free object is left alone.
+ *
+ * Each cache has its own spinlock. Memory is taken and given back
+ * (alloc_kpages, kmalloc, constructors and destructors) without it.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vm.h>
+#include <kmem_cache.h>
+#include <kstat.h>
+
+/* Biggest object kept in slabs */
+#define KMEM_SLAB_MAXOBJ	(PAGE_SIZE / 8)
+
+/* Alignment of objects in slabs */
+#define KMEM_ALIGN		8
+
+struct kmem_slab {
+	struct kmem_cache *ks_cache;
+	struct kmem_slab *ks_prev;
+	struct kmem_slab *ks_next;
+	void *ks_free;			/* first free object */
+	unsigned ks_nfree;
+};
+
+#define SLAB_FIRSTOBJ	ROUNDUP(sizeof(struct kmem_slab), KMEM_ALIGN)
+#define OBJ_LINK(kc, obj) \
+	(*(void **)((char *)(obj) + (kc)->kc_stride - sizeof(void *)))
+
+/* All caches that have ever been used, for kmem_cache_printstats */
+static struct kmem_cache *kmem_allcaches;
+static struct spinlock kmem_allcaches_lock = SPINLOCK_INITIALIZER;
+
+////////////////////////////////////////////////////////////
+// Slab lists
+
+static
+void
+slab_push(struct kmem_slab **list, struct kmem_slab *ks)
+{
+	ks->ks_prev = NULL;
+	ks->ks_next = *list;
+	if (*list != NULL) {
+		(*list)->ks_prev = ks;
+	}
+	*list = ks;
+}
+
+static
+void
+slab_remove(struct kmem_slab **list, struct kmem_slab *ks)
+{
+	if (ks->ks_prev != NULL) {
+		ks->ks_prev->ks_next = ks->ks_next;
+	}
+	else {
+		KASSERT(*list == ks);
+		*list = ks->ks_next;
+	}
+	if (ks->ks_next != NULL) {
+		ks->ks_next->ks_prev = ks->ks_prev;
+	}
+	ks->ks_prev = ks->ks_next = NULL;
+}
+
+////////////////////////////////////////////////////////////
+// Getting and releasing memory
+
+/*
+ * Work out the layout, the first time a cache is used.
+ */
+static
+void
+kmem_setup(struct kmem_cache *kc)
+{
+	KASSERT(spinlock_do_i_hold(&kc->kc_lock));
+	KASSERT(kc->kc_size > 0);
+
+	if (kc->kc_size <= KMEM_SLAB_MAXOBJ) {
+		kc->kc_stride = ROUNDUP(kc->kc_size + sizeof(void *),
+					KMEM_ALIGN);
+		kc->kc_perslab = (PAGE_SIZE - SLAB_FIRSTOBJ) / kc->kc_stride;
+	}
+	else {
+		kc->kc_stride = kc->kc_size;
+		kc->kc_perslab = 0;
+	}
+	kc->kc_ready = true;
+
+	spinlock_acquire(&kmem_allcaches_lock);
+	kc->kc_next = kmem_allcaches;
+	kmem_allcaches = kc;
+	spinlock_release(&kmem_allcaches_lock);
+}
+
+/*
+ * Destroy the free objects of a slab and give its page back.
+ */
+static
+void
+kmem_slab_release(struct kmem_cache *kc, struct kmem_slab *ks)
+{
+	void *obj, *next;
+
+	for (obj = ks->ks_free; obj != NULL; obj = next) {
+		next = OBJ_LINK(kc, obj);
+		if (kc->kc_dtor != NULL) {
+			kc->kc_dtor(obj);
+		}
+	}
+	free_kpages((vaddr_t)ks);
+}
+
+/*
+ * Make a new slab, with every object constructed and free.
+ */
+static
+struct kmem_slab *
+kmem_slab_grow(struct kmem_cache *kc)
+{
+	struct kmem_slab *ks;
+	vaddr_t page;
+	void *obj;
+	unsigned i;
+
+	page = alloc_kpages(1);
+	if (page == 0) {
+		return NULL;
+	}
+
+	ks = (struct kmem_slab *)page;
+	ks->ks_cache = kc;
+	ks->ks_prev = ks->ks_next = NULL;
+	ks->ks_free = NULL;
+	ks->ks_nfree = 0;
+
+	/* Backwards, so the free list starts at the lowest address */
+	for (i = kc->kc_perslab; i-- > 0; ) {
+		obj = (void *)(page + SLAB_FIRSTOBJ + i * kc->kc_stride);
+		if (kc->kc_ctor != NULL && kc->kc_ctor(obj) != 0) {
+			kmem_slab_release(kc, ks);
+			return NULL;
+		}
+		OBJ_LINK(kc, obj) = ks->ks_free;
+		ks->ks_free = obj;
+		ks->ks_nfree++;
+	}
+	return ks;
+}
+
+/*
+ * Make a new big object.
+ */
+static
+void *
+kmem_big_grow(struct kmem_cache *kc)
+{
+	void *obj;
+
+	obj = kmalloc(kc->kc_size);
+	if (obj == NULL) {
+		return NULL;
+	}
+	if (kc->kc_ctor != NULL && kc->kc_ctor(obj) != 0) {
+		kfree(obj);
+		return NULL;
+	}
+	return obj;
+}
+
+static
+void
+kmem_count_alloc(struct kmem_cache *kc)
+{
+	kc->kc_allocs++;
+	kc->kc_inuse++;
+	if (kc->kc_inuse > kc->kc_peak) {
+		kc->kc_peak = kc->kc_inuse;
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Interface
+
+struct kmem_cache *
+kmem_cache_create(const char *name, size_t size,
+		  int (*ctor)(void *obj), void (*dtor)(void *obj))
+{
+	struct kmem_cache *kc;
+
+	kc = kmalloc(sizeof(*kc));
+	if (kc == NULL) {
+		return NULL;
+	}
+	bzero(kc, sizeof(*kc));
+	kc->kc_name = name;
+	kc->kc_size = size;
+	kc->kc_ctor = ctor;
+	kc->kc_dtor = dtor;
+	spinlock_init(&kc->kc_lock);
+	return kc;
+}
+
+/*
+ * Destroy a cache made with kmem_cache_create. Every object must have
+ * been freed.
+ */
+void
+kmem_cache_destroy(struct kmem_cache *kc)
+{
+	struct kmem_cache **kcp;
+	struct kmem_slab *ks;
+	unsigned i;
+
+	KASSERT(kc->kc_inuse == 0);
+	KASSERT(kc->kc_full == NULL);
+	KASSERT(kc->kc_partial == NULL);
+
+	if (kc->kc_ready) {
+		spinlock_acquire(&kmem_allcaches_lock);
+		for (kcp = &kmem_allcaches; *kcp != kc; kcp = &(*kcp)->kc_next) {
+			KASSERT(*kcp != NULL);
+		}
+		*kcp = kc->kc_next;
+		spinlock_release(&kmem_allcaches_lock);
+	}
+
+	ks = kc->kc_empty;
+	if (ks != NULL) {
+		slab_remove(&kc->kc_empty, ks);
+		kmem_slab_release(kc, ks);
+	}
+	for (i=0; i<kc->kc_nstash; i++) {
+		if (kc->kc_dtor != NULL) {
+			kc->kc_dtor(kc->kc_stash[i]);
+		}
+		kfree(kc->kc_stash[i]);
+	}
+
+	spinlock_cleanup(&kc->kc_lock);
+	kfree(kc);
+}
+
+void *
+kmem_cache_alloc(struct kmem_cache *kc)
+{
+	struct kmem_slab *ks;
+	void *obj;
+
+	spinlock_acquire(&kc->kc_lock);
+	if (!kc->kc_ready) {
+		kmem_setup(kc);
+	}
+
+	if (kc->kc_perslab == 0) {
+		/* Big objects */
+		obj = NULL;
+		if (kc->kc_nstash > 0) {
+			obj = kc->kc_stash[--kc->kc_nstash];
+			kmem_count_alloc(kc);
+		}
+		spinlock_release(&kc->kc_lock);
+		if (obj != NULL) {
+			return obj;
+		}
+
+		obj = kmem_big_grow(kc);
+		if (obj != NULL) {
+			spinlock_acquire(&kc->kc_lock);
+			kc->kc_nslabs++;
+			kc->kc_grows++;
+			kmem_count_alloc(kc);
+			spinlock_release(&kc->kc_lock);
+		}
+		return obj;
+	}
+
+	if (kc->kc_partial == NULL && kc->kc_empty != NULL) {
+		ks = kc->kc_empty;
+		slab_remove(&kc->kc_empty, ks);
+		slab_push(&kc->kc_partial, ks);
+	}
+	while (kc->kc_partial == NULL) {
+		spinlock_release(&kc->kc_lock);
+		ks = kmem_slab_grow(kc);
+		if (ks == NULL) {
+			return NULL;
+		}
+		spinlock_acquire(&kc->kc_lock);
+		slab_push(&kc->kc_partial, ks);
+		kc->kc_nslabs++;
+		kc->kc_grows++;
+	}
+
+	ks = kc->kc_partial;
+	KASSERT(ks->ks_nfree > 0);
+	obj = ks->ks_free;
+	ks->ks_free = OBJ_LINK(kc, obj);
+	ks->ks_nfree--;
+	if (ks->ks_nfree == 0) {
+		slab_remove(&kc->kc_partial, ks);
+		slab_push(&kc->kc_full, ks);
+	}
+	kmem_count_alloc(kc);
+
+	spinlock_release(&kc->kc_lock);
+	return obj;
+}
+
+/*
+ * Give back OBJ, in its constructed state.
+ */
+void
+kmem_cache_free(struct kmem_cache *kc, void *obj)
+{
+	struct kmem_slab *ks;
+
+	if (obj == NULL) {
+		return;
+	}
+
+	spinlock_acquire(&kc->kc_lock);
+	KASSERT(kc->kc_ready);
+	KASSERT(kc->kc_inuse > 0);
+	kc->kc_frees++;
+	kc->kc_inuse--;
+
+	if (kc->kc_perslab == 0) {
+		/* Big objects: keep a few, throw the rest away */
+		if (kc->kc_nstash < KMEM_STASH) {
+			kc->kc_stash[kc->kc_nstash++] = obj;
+			obj = NULL;
+		}
+		else {
+			kc->kc_nslabs--;
+		}
+		spinlock_release(&kc->kc_lock);
+		if (obj != NULL) {
+			if (kc->kc_dtor != NULL) {
+				kc->kc_dtor(obj);
+			}
+			kfree(obj);
+		}
+		return;
+	}
+
+	ks = (struct kmem_slab *)((vaddr_t)obj & PAGE_FRAME);
+	KASSERT(ks->ks_cache == kc);
+	KASSERT(ks->ks_nfree < kc->kc_perslab);
+
+	OBJ_LINK(kc, obj) = ks->ks_free;
+	ks->ks_free = obj;
+	if (ks->ks_nfree++ == 0) {
+		slab_remove(&kc->kc_full, ks);
+		slab_push(&kc->kc_partial, ks);
+	}
+
+	/* Keep one all-free slab around; give back any others */
+	if (ks->ks_nfree == kc->kc_perslab) {
+		slab_remove(&kc->kc_partial, ks);
+		if (kc->kc_empty == NULL) {
+			slab_push(&kc->kc_empty, ks);
+			ks = NULL;
+		}
+		else {
+			kc->kc_nslabs--;
+		}
+	}
+	else {
+		ks = NULL;
+	}
+	spinlock_release(&kc->kc_lock);
+
+	if (ks != NULL) {
+		kmem_slab_release(kc, ks);
+	}
+}
+
+/*
+ * Give back the memory the cache keeps for later: its all-free slab
+ * and its stash of big objects. Used when memory runs short.
+ */
+unsigned
+kmem_cache_reap(struct kmem_cache *kc)
+{
+	struct kmem_slab *ks;
+	void *stash[KMEM_STASH];
+	unsigned i, n, pages;
+
+	spinlock_acquire(&kc->kc_lock);
+	if (!kc->kc_ready) {
+		spinlock_release(&kc->kc_lock);
+		return 0;
+	}
+	ks = kc->kc_empty;
+	if (ks != NULL) {
+		slab_remove(&kc->kc_empty, ks);
+		kc->kc_nslabs--;
+	}
+	n = kc->kc_nstash;
+	for (i=0; i<n; i++) {
+		stash[i] = kc->kc_stash[i];
+	}
+	kc->kc_nstash = 0;
+	kc->kc_nslabs -= n;
+	spinlock_release(&kc->kc_lock);
+
+	pages = 0;
+	if (ks != NULL) {
+		kmem_slab_release(kc, ks);
+		pages++;
+	}
+	for (i=0; i<n; i++) {
+		if (kc->kc_dtor != NULL) {
+			kc->kc_dtor(stash[i]);
+		}
+		kfree(stash[i]);
+		pages += (kc->kc_size + PAGE_SIZE - 1) / PAGE_SIZE;
+	}
+	return pages;
+}
+
+/*
+ * Print statistics for all caches. The counters are read without
+ * taking each cache's lock, so they may be slightly stale.
+ */
+void
+kmem_cache_printstats(void)
+{
+	struct kmem_cache *kc;
+
+	kprintf("%-16s %5s %6s %6s %8s %8s %6s\n", "cache", "size",
+		"inuse", "peak", "allocs", "frees", "slabs");
+
+	spinlock_acquire(&kmem_allcaches_lock);
+	for (kc = kmem_allcaches; kc != NULL; kc = kc->kc_next) {
+		kprintf("%-16s %5u %6u %6u %8u %8u %6u%s\n", kc->kc_name,
+			(unsigned)kc->kc_size, kc->kc_inuse, kc->kc_peak,
+			kc->kc_allocs, kc->kc_frees, kc->kc_nslabs,
+			kc->kc_perslab == 0 ? " (big)" : "");
+	}
+	spinlock_release(&kmem_allcaches_lock);
+}
+
+/*
+ * The same, for kstat (kmem.NAME.*).
+ */
+void
+kmem_cache_kstat(struct kstat *ks)
+{
+	struct kmem_cache *kc;
+
+	spinlock_acquire(&kmem_allcaches_lock);
+	for (kc = kmem_allcaches; kc != NULL; kc = kc->kc_next) {
+		kstat_put(ks, kc->kc_size, "kmem.%s.size", kc->kc_name);
+		kstat_put(ks, kc->kc_inuse, "kmem.%s.inuse", kc->kc_name);
+		kstat_put(ks, kc->kc_peak, "kmem.%s.peak", kc->kc_name);
+		kstat_put(ks, kc->kc_allocs, "kmem.%s.allocs", kc->kc_name);
+		kstat_put(ks, kc->kc_frees, "kmem.%s.frees", kc->kc_name);
+		kstat_put(ks, kc->kc_nslabs, "kmem.%s.slabs", kc->kc_name);
+	}
+	spinlock_release(&kmem_allcaches_lock);
+}
@@ -0,0 +1,286 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * File page cache, for mmap. Entries are allocated as needed; there
+ * is no limit besides memory, since every page a shared mapping uses
+ * has to be in it.
+ *
+ * Files mapped with mmap go through the file page cache, keyed by
+ * vnode and file offset, which also holds a reference on each frame.
+ * A shared mapping maps the cached frame itself (PTE_SHARED: never
+ * copy-on-write, not even across fork, and never paged out), so all
+ * processes mapping a page see the same memory. A private mapping
+ * maps it copy-on-write, and the first store makes a private copy as
+ * for any other shared frame. Pages that a writable shared mapping
+ * has mapped are marked dirty; they are written back to the file by
+ * msync and when they are unmapped, and are clean again once the
+ * last mapping is gone. Cached pages nobody maps are given back when
+ * memory runs short, and dropped like text cache pages when their
+ * vnode is reclaimed or opened for writing; as with the text cache,
+ * read and write don't see or update pages somebody has mapped.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <uio.h>
+#include <stat.h>
+#include <vnode.h>
+#include <vm.h>
+#include <kstat.h>
+#include <frame.h>
+#include <mapcache.h>
+#include <vmprivate.h>
+
+#define MAPCACHE_HASH	127
+
+static struct mappage *mapcache_hash[MAPCACHE_HASH];
+static unsigned mapcache_nused;
+static unsigned mapcache_hits, mapcache_misses, mapcache_writes;
+
+static
+unsigned
+mapcache_hashval(struct vnode *vn, off_t off)
+{
+	return (((uintptr_t)vn >> 4) ^ (unsigned)(off >> 12)) % MAPCACHE_HASH;
+}
+
+/*
+ * Return the entry for page OFF of VN, or NULL. Called with vm_lock
+ * held.
+ */
+struct mappage *
+mapcache_find(struct vnode *vn, off_t off)
+{
+	struct mappage *mp;
+
+	for (mp = mapcache_hash[mapcache_hashval(vn, off)]; mp != NULL;
+	     mp = mp->mp_hashnext) {
+		if (mp->mp_vn == vn && mp->mp_off == off) {
+			return mp;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * mapcache_find for a page fault, counting a hit or a miss. Called
+ * with vm_lock held.
+ */
+struct mappage *
+mapcache_lookup(struct vnode *vn, off_t off)
+{
+	struct mappage *mp;
+
+	mp = mapcache_find(vn, off);
+	if (mp != NULL) {
+		mapcache_hits++;
+	}
+	else {
+		mapcache_misses++;
+	}
+	return mp;
+}
+
+/*
+ * Enter frame PA, whose reference passes to the cache, as page OFF of
+ * VN. If someone else got the page in first, PA is freed and their
+ * entry returned instead. Returns NULL if out of memory. Called with
+ * vm_lock held.
+ */
+struct mappage *
+mapcache_enter(struct vnode *vn, off_t off, paddr_t pa)
+{
+	struct mappage *mp;
+	unsigned h;
+
+	mp = mapcache_find(vn, off);
+	if (mp != NULL) {
+		/* Someone else read it in while we were reading too */
+		frame_decref(pa);
+		return mp;
+	}
+
+	mp = kmalloc(sizeof(struct mappage));
+	if (mp == NULL) {
+		frame_decref(pa);
+		return NULL;
+	}
+	mp->mp_vn = vn;
+	mp->mp_off = off;
+	mp->mp_pa = pa;
+	mp->mp_dirty = false;
+	h = mapcache_hashval(vn, off);
+	mp->mp_hashnext = mapcache_hash[h];
+	mapcache_hash[h] = mp;
+	mapcache_nused++;
+	return mp;
+}
+
+/*
+ * Remove an entry, dropping its frame reference.
+ */
+static
+void
+mapcache_drop(struct mappage *mp)
+{
+	struct mappage **pp;
+
+	pp = &mapcache_hash[mapcache_hashval(mp->mp_vn, mp->mp_off)];
+	while (*pp != mp) {
+		KASSERT(*pp != NULL);
+		pp = &(*pp)->mp_hashnext;
+	}
+	*pp = mp->mp_hashnext;
+
+	mapcache_nused--;
+	frame_decref(mp->mp_pa);
+	kfree(mp);
+}
+
+/*
+ * Drop entries nobody maps: up to MAX clean ones, or if VN is not
+ * NULL, all of those belonging to VN (dirty or not: VN is going away
+ * or being rewritten, so they can't be written back). Returns how many
+ * were dropped. Called with vm_lock held.
+ */
+unsigned
+mapcache_release(struct vnode *vn, unsigned max)
+{
+	struct mappage *mp, **pp;
+	unsigned h, n = 0;
+
+	for (h=0; h<MAPCACHE_HASH && n<max; h++) {
+		pp = &mapcache_hash[h];
+		while (*pp != NULL && n < max) {
+			mp = *pp;
+			if ((vn == NULL ? !mp->mp_dirty : mp->mp_vn == vn) &&
+			    frame_refs(mp->mp_pa) == 1) {
+				if (mp->mp_dirty) {
+					kprintf("dumbvm: Warning: dropping "
+						"unwritten mapped page\n");
+				}
+				/* this unlinks it, so *pp is the next one */
+				mapcache_drop(mp);
+				n++;
+			}
+			else {
+				pp = &mp->mp_hashnext;
+			}
+		}
+	}
+	return n;
+}
+
+unsigned
+mapcache_count(void)
+{
+	return mapcache_nused;
+}
+
+/*
+ * Count a page written back to its file. Called with vm_lock held.
+ */
+void
+mapcache_countwrite(void)
+{
+	mapcache_writes++;
+}
+
+/*
+ * Read page OFF of the file V into the zero-filled frame PA. Whatever
+ * is past the end of the file stays zero. ADVICE is the madvise
+ * access pattern of the mapping, which the file system reads ahead by
+ * (MADV_* and POSIX_FADV_* have the same values).
+ */
+int
+page_readfile(struct vnode *v, off_t off, paddr_t pa, int advice)
+{
+	struct iovec iov;
+	struct uio ku;
+
+	uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(pa), PAGE_SIZE, off,
+		  UIO_READ);
+	ku.uio_advice = advice;
+	return VOP_READ(v, &ku);
+}
+
+/*
+ * Write the frame PA back as page OFF of V, which is SIZE bytes long.
+ * Only the part inside the file is written: storing past the end of
+ * a mapped file doesn't extend it.
+ */
+int
+page_writefile(struct vnode *v, off_t off, paddr_t pa, off_t size)
+{
+	struct iovec iov;
+	struct uio ku;
+	size_t len;
+
+	if (off >= size) {
+		return 0;
+	}
+	len = size - off < PAGE_SIZE ? size - off : PAGE_SIZE;
+
+	uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(pa), len, off, UIO_WRITE);
+	return VOP_WRITE(v, &ku);
+}
+
+/*
+ * Current size of V, for page_writefile.
+ */
+off_t
+page_filesize(struct vnode *v)
+{
+	struct stat st;
+
+	if (VOP_STAT(v, &st)) {
+		return 0;
+	}
+	return st.st_size;
+}
+
+void
+mapcache_printstats(void)
+{
+	kprintf("dumbvm: file cache: %u pages, %u hits, %u misses, "
+		"%u writebacks\n", mapcache_nused, mapcache_hits,
+		mapcache_misses, mapcache_writes);
+}
+
+void
+mapcache_kstat(struct kstat *ks)
+{
+	kstat_put(ks, mapcache_nused, "vm.filecache.pages");
+	kstat_put(ks, mapcache_hits, "vm.filecache.hits");
+	kstat_put(ks, mapcache_misses, "vm.filecache.misses");
+	kstat_put(ks, mapcache_writes, "vm.filecache.writebacks");
+}
@@ -0,0 +1,685 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * File and anonymous mappings: mmap, munmap, msync and madvise.
+ *
+ * A mapping is a region of its own, placed in the highest gap between
+ * the heap and the stack that fits. Its pages are filled in by
+ * vm_fault: those of a file through the file page cache
+ * (vm/mapcache.c), shared ones with the cached frame itself and
+ * private ones copy-on-write; anonymous shared pages get a zero-filled
+ * frame that as_copy shares with the child, and anonymous private
+ * ones are zero-filled like any other. Shared file pages that may have
+ * been stored to are written back by msync and when they are unmapped.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/mman.h>
+#include <lib.h>
+#include <synch.h>
+#include <thread.h>
+#include <current.h>
+#include <vnode.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <vmprivate.h>
+#include <frame.h>
+#include <mapcache.h>
+#include <mmap.h>
+
+/*
+ * The pages of the mmap region REG that are committed.
+ */
+static
+size_t
+map_commitpages(const struct region *reg)
+{
+	if (reg->mapanon || (!reg->mapshared && reg->writeable_bit)) {
+		return reg->npages;
+	}
+	return 0;
+}
+
+/*
+ * First touch of the page at VA in the file mapping REG: map the file
+ * page from the file cache, reading it in first if it isn't there.
+ * Returns EAGAIN if something was unmapped while we were reading, and
+ * the fault has to be looked at again.
+ */
+int
+page_fillmap(struct addrspace *as, struct region *reg, vaddr_t va,
+	     uint32_t *pte)
+{
+	struct vnode *vn = reg->mapvn;
+	off_t off = reg->mapoff + (va - reg->vbase);
+	int advice = reg->advice;
+	struct mappage *mp;
+	unsigned gen;
+	paddr_t pa;
+	int result;
+
+	mp = mapcache_lookup(vn, off);
+	if (mp == NULL) {
+		curthread->t_majfaults++;
+
+		pa = frame_alloc(true);
+		if (pa == 0) {
+			return ENOMEM;
+		}
+
+		/*
+		 * As in page_fill, don't hold vm_lock across the read.
+		 * Another thread may unmap the region meanwhile, so
+		 * hold on to the vnode ourselves, and afterwards make
+		 * sure nothing was unmapped (so REG is still there) and
+		 * nobody filled the page in first.
+		 */
+		gen = as->as_mapgen;
+		VOP_INCREF(vn);
+		lock_release(vm_lock);
+		result = page_readfile(vn, off, pa, advice);
+		VOP_DECREF(vn);
+		lock_acquire(vm_lock);
+		if (result) {
+			frame_decref(pa);
+			return result;
+		}
+		if (as->as_mapgen != gen || (*pte & PTE_VALID)) {
+			frame_decref(pa);
+			return EAGAIN;
+		}
+
+		mp = mapcache_enter(vn, off, pa);
+		if (mp == NULL) {
+			return ENOMEM;
+		}
+	}
+
+	pa = mp->mp_pa;
+	frame_incref(pa);
+	if (reg->mapshared) {
+		*pte = pa | PTE_VALID | PTE_SHARED;
+		if (reg->writeable_bit) {
+			*pte |= PTE_WRITE;
+			mp->mp_dirty = true;
+		}
+	}
+	else if (reg->writeable_bit) {
+		/* The first store gets a private copy */
+		*pte = pa | PTE_VALID | PTE_WRITE | PTE_COW;
+	}
+	else {
+		*pte = pa | PTE_VALID;
+	}
+	return 0;
+}
+
+/*
+ * Give a page of the shared anonymous mapping REG a zero-filled frame.
+ * Like the pages of a shared file mapping, it is never given an owner,
+ * so it is never paged out, and as_copy shares it with the child.
+ */
+int
+page_fillanon(const struct region *reg, uint32_t *pte)
+{
+	paddr_t pa;
+
+	pa = frame_alloc(true);
+	if (pa == 0) {
+		return ENOMEM;
+	}
+	*pte = pa | PTE_VALID | PTE_SHARED |
+		(reg->writeable_bit ? PTE_WRITE : 0);
+	return 0;
+}
+
+/*
+ * Unmap the pages of the mapping REG, which describes the part of a
+ * region being unmapped (and may be a copy of it, if the region is
+ * already gone from the list). Shared file pages are written back to
+ * the file if they may have been stored to: always if REG is writable,
+ * and otherwise if this is the last mapping of a dirty page. Whoever
+ * writes back a page and leaves nobody else mapping it makes it clean.
+ *
+ * If PTES is not NULL it has room for all the pages: their PTEs are
+ * moved there and shot down first, so vm_lock can be let go for the
+ * writes without anyone seeing the pages any more. Otherwise (from
+ * as_destroy) nobody else uses AS and the page table is worked on in
+ * place. Called with vm_lock held.
+ */
+void
+map_release(struct addrspace *as, const struct region *reg, uint32_t *ptes)
+{
+	struct mappage *mp;
+	uint32_t *pte;
+	vaddr_t va;
+	off_t off, size = -1;
+	paddr_t pa;
+	unsigned i;
+	bool wrote;
+	int result;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+	KASSERT(reg->mapvn != NULL || reg->mapanon);
+
+	/* Tell page_fillmap that anything it was reading may be stale */
+	as->as_mapgen++;
+
+	if (ptes != NULL) {
+		for (i=0; i<reg->npages; i++) {
+			pte = pt_lookup(as, reg->vbase + i * PAGE_SIZE, false);
+			ptes[i] = 0;
+			if (pte == NULL) {
+				continue;
+			}
+			ptes[i] = *pte;
+			*pte = 0;
+			if ((ptes[i] & (PTE_VALID | PTE_SHARED)) == PTE_VALID) {
+				/* Not for frame_evict any more */
+				frame_disown(ptes[i] & PTE_FRAME);
+			}
+		}
+		tlb_invalidate(as, reg->vbase, reg->npages);
+	}
+
+	for (i=0; i<reg->npages; i++) {
+		va = reg->vbase + i * PAGE_SIZE;
+		pte = ptes != NULL ? &ptes[i] : pt_lookup(as, va, false);
+		if (pte == NULL) {
+			continue;
+		}
+		if (*pte & PTE_SWAP) {
+			swap_free(*pte >> PTE_SLOTSHIFT);
+			*pte = 0;
+			continue;
+		}
+		if ((*pte & PTE_VALID) == 0) {
+			continue;
+		}
+
+		pa = *pte & PTE_FRAME;
+		mp = NULL;
+		wrote = false;
+		if ((*pte & PTE_SHARED) && reg->mapvn != NULL) {
+			off = reg->mapoff + (va - reg->vbase);
+			mp = mapcache_find(reg->mapvn, off);
+			KASSERT(mp != NULL && mp->mp_pa == pa);
+
+			/* (two references: the cache's and ours) */
+			if (mp->mp_dirty &&
+			    (reg->writeable_bit || frame_refs(pa) == 2)) {
+				lock_release(vm_lock);
+				if (size < 0) {
+					size = page_filesize(reg->mapvn);
+				}
+				result = page_writefile(reg->mapvn, off, pa,
+							size);
+				lock_acquire(vm_lock);
+				if (result) {
+					kprintf("dumbvm: Warning: writing back "
+						"mapped page: %s\n",
+						strerror(result));
+				}
+				else {
+					wrote = true;
+					mapcache_countwrite();
+				}
+			}
+		}
+
+		*pte = 0;
+		frame_decref(pa);
+		if (wrote && frame_refs(pa) == 1) {
+			mp->mp_dirty = false;
+		}
+	}
+}
+
+/*
+ * Find room for a new region of NPAGES pages, in the highest gap that
+ * fits between the heap and the stack, which leaves the heap as much
+ * room to grow as possible. Hands back the region to link it after,
+ * and its address. Called with vm_lock held.
+ */
+int
+as_placeregion(struct addrspace *as, size_t npages, struct region **prevret,
+	       vaddr_t *ret)
+{
+	struct region *reg, *prev;
+	vaddr_t start, top, base;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+
+	/* The list is sorted, so the last gap that fits is the highest */
+	prev = NULL;
+	base = 0;
+	reg = as->as_heap != NULL ? as->as_heap : as->as_regions;
+	for (; reg != NULL; reg = reg->next) {
+		start = reg->vbase + reg->npages * PAGE_SIZE;
+		top = reg->next != NULL ? reg->next->vbase : USERSPACETOP;
+		if (reg->next != NULL && reg->next == as->as_stack) {
+			/* Leave the stack room to grow, and its guard page */
+			top = USERSTACK - (as->as_stackmax + 1) * PAGE_SIZE;
+		}
+		if (top > start && top - start >= npages * PAGE_SIZE) {
+			prev = reg;
+			base = top - npages * PAGE_SIZE;
+		}
+	}
+	if (prev == NULL) {
+		return ENOMEM;
+	}
+	*prevret = prev;
+	*ret = base;
+	return 0;
+}
+
+/*
+ * Map LEN bytes of V, from the page-aligned OFFSET, into a new region
+ * placed by as_placeregion. The region keeps a reference to V. Pages
+ * are read in by vm_fault. If V is NULL the mapping is anonymous, and
+ * its pages start out zero-filled.
+ */
+int
+as_mmap(struct addrspace *as, size_t len, int writeable, bool shared,
+	struct vnode *v, off_t offset, vaddr_t *ret)
+{
+	struct region *prev, *new;
+	vaddr_t base;
+	size_t npages, commit;
+	int result;
+
+	dumbvm_can_sleep();
+	KASSERT(len > 0);
+	KASSERT((offset & ~(off_t)PAGE_FRAME) == 0);
+
+	if (len > USERSPACETOP) {
+		return ENOMEM;
+	}
+	npages = DIVROUNDUP(len, PAGE_SIZE);
+
+	new = kmalloc(sizeof(struct region));
+	if (new == NULL) {
+		return ENOMEM;
+	}
+	commit = (v == NULL || (!shared && writeable)) ? npages : 0;
+	result = as_reserve(as, commit);
+	if (result) {
+		kfree(new);
+		return result;
+	}
+
+	lock_acquire(vm_lock);
+
+	result = as_placeregion(as, npages, &prev, &base);
+	if (result) {
+		lock_release(vm_lock);
+		as_unreserve(as, commit);
+		kfree(new);
+		return result;
+	}
+
+	new->vbase = base;
+	new->npages = npages;
+	new->writeable_bit = writeable ? 1 : 0;
+	new->old_writeable_bit = new->writeable_bit;
+	new->filevaddr = 0;
+	new->fileoff = 0;
+	new->filesz = 0;
+	new->mapvn = v;
+	new->mapoff = offset;
+	new->mapshared = shared;
+	new->mapanon = (v == NULL);
+	new->kinfo = false;
+	new->shm = NULL;
+	new->advice = MADV_NORMAL;
+	if (v != NULL) {
+		VOP_INCREF(v);
+	}
+
+	new->next = prev->next;
+	prev->next = new;
+	as_regionschanged(as);
+
+	lock_release(vm_lock);
+
+	*ret = base;
+	return 0;
+}
+
+/*
+ * Remove the pages from VADDR to VADDR+LEN from the mmap regions they
+ * are part of, splitting or trimming regions as needed. Parts of the
+ * range that aren't in one are left alone.
+ */
+int
+as_munmap(struct addrspace *as, vaddr_t vaddr, size_t len)
+{
+	struct region *reg, **pp, *rest, gone;
+	struct vnode *dropvn;
+	vaddr_t end, rend, s, e;
+	uint32_t *ptes;
+
+	dumbvm_can_sleep();
+
+	if ((vaddr & ~(vaddr_t)PAGE_FRAME) != 0 || len == 0 ||
+	    len > USERSPACETOP - vaddr) {
+		return EINVAL;
+	}
+	end = ROUNDUP(vaddr + len, PAGE_SIZE);
+
+	/* Done one region at a time, as the lock comes and goes */
+	rest = NULL;
+	while (1) {
+		lock_acquire(vm_lock);
+		for (pp = &as->as_regions; *pp != NULL; pp = &(*pp)->next) {
+			reg = *pp;
+			rend = reg->vbase + reg->npages * PAGE_SIZE;
+			if ((reg->mapvn != NULL || reg->mapanon) &&
+			    reg->vbase < end && rend > vaddr) {
+				break;
+			}
+		}
+		if (*pp == NULL) {
+			lock_release(vm_lock);
+			break;
+		}
+		reg = *pp;
+		rend = reg->vbase + reg->npages * PAGE_SIZE;
+		s = reg->vbase > vaddr ? reg->vbase : vaddr;
+		e = rend < end ? rend : end;
+
+		/* Allocate without the lock; then look again */
+		ptes = kmalloc(((e - s) / PAGE_SIZE) * sizeof(uint32_t));
+		if (ptes == NULL || (s > reg->vbase && e < rend &&
+				     rest == NULL)) {
+			lock_release(vm_lock);
+			if (ptes == NULL) {
+				if (rest != NULL) {
+					kfree(rest);
+				}
+				return ENOMEM;
+			}
+			kfree(ptes);
+			rest = kmalloc(sizeof(struct region));
+			if (rest == NULL) {
+				return ENOMEM;
+			}
+			continue;
+		}
+
+		gone = *reg;
+		gone.vbase = s;
+		gone.npages = (e - s) / PAGE_SIZE;
+		gone.mapoff = reg->mapoff + (s - reg->vbase);
+		gone.next = NULL;
+		if (gone.mapvn != NULL) {
+			VOP_INCREF(gone.mapvn);
+		}
+
+		dropvn = NULL;
+		if (s == reg->vbase && e == rend) {
+			*pp = reg->next;
+			dropvn = reg->mapvn;
+			kfree(reg);
+			as_regionschanged(as);
+		}
+		else if (s == reg->vbase) {
+			reg->mapoff += e - reg->vbase;
+			reg->vbase = e;
+			reg->npages = (rend - e) / PAGE_SIZE;
+		}
+		else if (e == rend) {
+			reg->npages = (s - reg->vbase) / PAGE_SIZE;
+		}
+		else {
+			/* Punching a hole: the part after it is REST */
+			*rest = *reg;
+			rest->vbase = e;
+			rest->npages = (rend - e) / PAGE_SIZE;
+			rest->mapoff = reg->mapoff + (e - reg->vbase);
+			reg->npages = (s - reg->vbase) / PAGE_SIZE;
+			reg->next = rest;
+			if (rest->mapvn != NULL) {
+				VOP_INCREF(rest->mapvn);
+			}
+			rest = NULL;
+			as_regionschanged(as);
+		}
+
+		map_release(as, &gone, ptes);
+		lock_release(vm_lock);
+		as_unreserve(as, map_commitpages(&gone));
+
+		kfree(ptes);
+		if (gone.mapvn != NULL) {
+			VOP_DECREF(gone.mapvn);
+		}
+		if (dropvn != NULL) {
+			VOP_DECREF(dropvn);
+		}
+	}
+
+	if (rest != NULL) {
+		kfree(rest);
+	}
+	return 0;
+}
+
+/*
+ * Write the dirty pages of the shared file mappings from VADDR to
+ * VADDR+LEN back to their files; with WAIT, also push those files to
+ * disk. Returns ENOMEM if part of the range isn't mapped at all (but
+ * does the rest anyway).
+ */
+int
+as_msync(struct addrspace *as, vaddr_t vaddr, size_t len, bool wait)
+{
+	struct region *reg;
+	struct mappage *mp;
+	struct vnode *vn, *lastvn;
+	vaddr_t va, end;
+	uint32_t *pte;
+	off_t off, size;
+	paddr_t pa;
+	int result, err;
+
+	dumbvm_can_sleep();
+
+	if ((vaddr & ~(vaddr_t)PAGE_FRAME) != 0 || len > USERSPACETOP - vaddr) {
+		return EINVAL;
+	}
+	end = ROUNDUP(vaddr + len, PAGE_SIZE);
+
+	/*
+	 * One page at a time: hold on to the frame (and the file) while
+	 * vm_lock is let go for the write, in case of a munmap meanwhile.
+	 */
+	err = 0;
+	lastvn = NULL;
+	size = 0;
+	for (va = vaddr; va < end; va += PAGE_SIZE) {
+		lock_acquire(vm_lock);
+		reg = as_findregion(as, va);
+		if (reg == NULL) {
+			lock_release(vm_lock);
+			err = ENOMEM;
+			continue;
+		}
+		pte = pt_lookup(as, va, false);
+		if (!reg->mapshared || reg->mapvn == NULL || pte == NULL ||
+		    (*pte & PTE_SHARED) == 0) {
+			/* Not a shared file mapping, or not touched yet */
+			lock_release(vm_lock);
+			continue;
+		}
+		vn = reg->mapvn;
+		off = reg->mapoff + (va - reg->vbase);
+		pa = *pte & PTE_FRAME;
+		mp = mapcache_find(vn, off);
+		KASSERT(mp != NULL && mp->mp_pa == pa);
+		if (!mp->mp_dirty) {
+			lock_release(vm_lock);
+			continue;
+		}
+		frame_incref(pa);
+		VOP_INCREF(vn);
+		lock_release(vm_lock);
+
+		if (vn != lastvn) {
+			/* Sync the one we're done with, and start on VN */
+			if (lastvn != NULL) {
+				if (wait) {
+					(void)VOP_FSYNC(lastvn);
+				}
+				VOP_DECREF(lastvn);
+			}
+			VOP_INCREF(vn);
+			lastvn = vn;
+			size = page_filesize(vn);
+		}
+		result = page_writefile(vn, off, pa, size);
+		if (result) {
+			err = result;
+		}
+
+		lock_acquire(vm_lock);
+		if (result == 0) {
+			mapcache_countwrite();
+		}
+		frame_decref(pa);
+		lock_release(vm_lock);
+		VOP_DECREF(vn);
+	}
+
+	if (lastvn != NULL) {
+		if (wait) {
+			result = VOP_FSYNC(lastvn);
+			if (result && err == 0) {
+				err = result;
+			}
+		}
+		VOP_DECREF(lastvn);
+	}
+	return err;
+}
+
+/*
+ * Take ADVICE (MADV_*) about how the pages from VADDR to VADDR+LEN
+ * will be used. MADV_NORMAL, MADV_SEQUENTIAL and MADV_RANDOM are kept
+ * in the regions, whole ones, that the range touches, and say how far
+ * the file is read ahead when a page of a file mapping is faulted in.
+ * MADV_WILLNEED starts reading the file of file mappings in the range
+ * into the buffer cache. MADV_DONTNEED makes the private pages of the
+ * range the first the clock pages out, and the file's cached blocks
+ * the first the buffer cache reuses; nothing is thrown away. Returns
+ * ENOMEM if part of the range isn't mapped at all (but does the rest
+ * anyway).
+ */
+int
+as_madvise(struct addrspace *as, vaddr_t vaddr, size_t len, int advice)
+{
+	struct region *reg;
+	struct vnode *vn;
+	vaddr_t va, pva, end, top;
+	uint32_t *pte;
+	struct frame *fr;
+	off_t off;
+	int err;
+
+	dumbvm_can_sleep();
+
+	if ((vaddr & ~(vaddr_t)PAGE_FRAME) != 0 || len > USERSPACETOP - vaddr) {
+		return EINVAL;
+	}
+	end = ROUNDUP(vaddr + len, PAGE_SIZE);
+
+	/* A region at a time; vm_lock is let go for the file hints */
+	err = 0;
+	va = vaddr;
+	while (va < end) {
+		lock_acquire(vm_lock);
+		reg = as_findregion(as, va);
+		if (reg == NULL) {
+			lock_release(vm_lock);
+			err = ENOMEM;
+			va += PAGE_SIZE;
+			continue;
+		}
+		top = reg->vbase + reg->npages * PAGE_SIZE;
+		if (top > end) {
+			top = end;
+		}
+
+		switch (advice) {
+		    case MADV_NORMAL:
+		    case MADV_SEQUENTIAL:
+		    case MADV_RANDOM:
+			reg->advice = advice;
+			break;
+		    case MADV_DONTNEED:
+			spinlock_acquire(&frame_lock);
+			for (pva = va; pva < top; pva += PAGE_SIZE) {
+				pte = pt_lookup(as, pva, false);
+				if (pte == NULL || (*pte & PTE_VALID) == 0) {
+					continue;
+				}
+				fr = &frames[frame_index(*pte & PTE_FRAME)];
+				if (fr->fr_as == as) {
+					fr->fr_referenced = 0;
+				}
+			}
+			spinlock_release(&frame_lock);
+			break;
+		}
+
+		vn = reg->mapvn;
+		off = reg->mapoff + (va - reg->vbase);
+		if (vn == NULL || (advice != MADV_WILLNEED &&
+				   advice != MADV_DONTNEED)) {
+			lock_release(vm_lock);
+			va = top;
+			continue;
+		}
+		VOP_INCREF(vn);
+		lock_release(vm_lock);
+
+		if (advice == MADV_WILLNEED) {
+			VOP_PREFETCH(vn, off, top - va);
+		}
+		else {
+			VOP_DONTNEED(vn, off, top - va);
+		}
+		VOP_DECREF(vn);
+		va = top;
+	}
+	return err;
+}
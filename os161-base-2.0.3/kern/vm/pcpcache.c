@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <counter.h>
+#include <kstat.h>
+#include <vm.h>
+#include <buddy.h>
+#include <pcpcache.h>
+#include <platform/maxcpus.h>
+
+/*
+ * Per-cpu caches of free single pages. Almost every allocation is a
+ * single page (thread stacks, kmalloc pages), so each cpu keeps a few
+ * free pages of its own and only goes to the buddy allocator (and
+ * freemem_lock) to refill or drain PCP_BATCH pages at a time. A cache
+ * is only touched by its own cpu with interrupts off, and sits on
+ * cache lines of its own. Pages sitting in a cache still count as
+ * allocated as far as the buddy allocator is concerned.
+ */
+#define PCP_HIGH        16					/* MAX PAGES CACHED PER CPU 								*/
+#define PCP_BATCH       8					/* PAGES MOVED PER REFILL/DRAIN 							*/
+
+struct pcp_cache {
+	paddr_t pc_pages[PCP_HIGH];				/* CACHED FREE PAGES (TOP IS THE MOST RECENTLY FREED) 		*/
+	unsigned pc_count;						/* HOW MANY OF pc_pages ARE VALID 							*/
+} __cacheline_aligned;
+
+static struct pcp_cache pcp_caches[MAXCPUS];
+
+/**
+ * @brief Single-page allocation through the per-cpu cache, refilling it in a batch if empty.
+ * 
+ * @return paddr_t physical address, or 0 if out of memory
+ */
+paddr_t pcp_getpage(void) {
+
+	struct pcp_cache *pc;
+	paddr_t pa = 0;
+	int spl;
+
+	/* INTERRUPTS OFF: NOBODY ELSE USES THIS CPU'S CACHE */
+	spl = splhigh();
+	KASSERT(curcpu->c_number < MAXCPUS);
+	pc = &pcp_caches[curcpu->c_number];
+
+	if (pc->pc_count == 0) {
+		/* EMPTY: REFILL FROM THE BUDDY ALLOCATOR UNDER ONE LOCK ACQUISITION */
+		COUNTER_INC(COUNTER_PCP_MISSES);
+		pc->pc_count = buddy_allocbatch(pc->pc_pages, PCP_BATCH);
+	} else {
+		COUNTER_INC(COUNTER_PCP_HITS);
+	}
+
+	if (pc->pc_count > 0) {
+		pa = pc->pc_pages[--pc->pc_count];
+	}
+	splx(spl);
+
+	return pa;
+}
+
+/**
+ * @brief Single-page free into the per-cpu cache, draining a batch to the buddy allocator if full.
+ * 
+ * @param pa physical address of the page to free
+ */
+void pcp_putpage(paddr_t pa) {
+
+	struct pcp_cache *pc;
+	unsigned i;
+	int spl;
+
+	spl = splhigh();
+	pc = &pcp_caches[curcpu->c_number];
+
+	if (pc->pc_count == PCP_HIGH) {
+		/* FULL: GIVE BACK THE OLDEST PCP_BATCH PAGES */
+		COUNTER_INC(COUNTER_PCP_DRAINS);
+		buddy_freebatch(pc->pc_pages, PCP_BATCH);
+		for (i = PCP_BATCH; i < PCP_HIGH; i++) {
+			pc->pc_pages[i - PCP_BATCH] = pc->pc_pages[i];
+		}
+		pc->pc_count -= PCP_BATCH;
+	}
+	pc->pc_pages[pc->pc_count++] = pa;
+
+	splx(spl);
+}
+
+/**
+ * @brief Number of free pages sitting in the per-cpu caches. The counts are read
+ *        without synchronization, so it may be slightly stale.
+ */
+unsigned pcp_cached(void) {
+
+	unsigned cached = 0;
+
+	for (int i = 0; i < MAXCPUS; i++) {
+		cached += pcp_caches[i].pc_count;
+	}
+	return cached;
+}
+
+/**
+ * @brief Print the hit rate of the per-cpu caches, and how often they were drained.
+ */
+void pcp_printstats(void) {
+
+	unsigned hits, misses, drains;
+
+	hits = counter_read(COUNTER_PCP_HITS);
+	misses = counter_read(COUNTER_PCP_MISSES);
+	drains = counter_read(COUNTER_PCP_DRAINS);
+
+	kprintf("dumbvm: per-cpu caches: %u hits, %u misses (%u%% hit rate), "
+		"%u drains\n", hits, misses,
+		hits + misses ? hits * 100 / (hits + misses) : 0, drains);
+}
+
+/**
+ * @brief The pages cached, for kstat (vm.pages.pcpcached). The hit and miss
+ *        counters are per-cpu counters, and go in with the others.
+ */
+void pcp_kstat(struct kstat *ks) {
+	kstat_put(ks, pcp_cached(), "vm.pages.pcpcached");
+}
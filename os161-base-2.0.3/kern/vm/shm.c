@@ -0,0 +1,364 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Shared memory segments (kern/shm.h): shmget, shmat and shmdt.
+ *
+ * A segment is a run of pages any process can attach by its ID, and
+ * find the ID of by its key. Each page gets a zero-filled frame when
+ * some process first touches it, and the segment keeps a reference
+ * to the frame, so processes that attach it later see the same one.
+ * Like the pages of shared mappings, the frames are never paged out.
+ * The segment counts the regions it is attached as, including the
+ * ones as_copy makes, and goes away with the last of them. (One that
+ * was never attached stays until it is.) The table is covered by
+ * vm_lock.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/mman.h>
+#include <kern/shm.h>
+#include <lib.h>
+#include <synch.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <vmprivate.h>
+#include <buddy.h>
+#include <frame.h>
+#include <mmap.h>
+#include <shm.h>
+
+#define SHM_MAXSEGS	64
+#define SHM_MAXGEN	0x100000	/* keeps IDs positive */
+
+struct shmseg {
+	int sh_key;			/* IPC_PRIVATE, or what shmget looks up */
+	int sh_id;			/* slot in shm_segs, plus a generation */
+	size_t sh_npages;
+	paddr_t *sh_pages;		/* frames, or 0 if not touched yet */
+	unsigned sh_attached;		/* regions it is attached as */
+};
+
+static struct shmseg *shm_segs[SHM_MAXSEGS];
+static unsigned shm_gen;
+
+/*
+ * Look up a segment by ID. Called with vm_lock held.
+ */
+static
+struct shmseg *
+shm_lookup(int id)
+{
+	struct shmseg *sh;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+	if (id < 0) {
+		return NULL;
+	}
+	sh = shm_segs[id % SHM_MAXSEGS];
+	if (sh == NULL || sh->sh_id != id) {
+		return NULL;
+	}
+	return sh;
+}
+
+/*
+ * Drop an attachment of SH, destroying it when the last one goes.
+ * Called with vm_lock held, after the attachment's own mappings of
+ * the frames have been dropped.
+ */
+void
+shm_release(struct shmseg *sh)
+{
+	size_t i;
+
+	KASSERT(lock_do_i_hold(vm_lock));
+	KASSERT(sh->sh_attached > 0);
+
+	if (--sh->sh_attached > 0) {
+		return;
+	}
+	KASSERT(shm_segs[sh->sh_id % SHM_MAXSEGS] == sh);
+	shm_segs[sh->sh_id % SHM_MAXSEGS] = NULL;
+	for (i=0; i<sh->sh_npages; i++) {
+		if (sh->sh_pages[i] != 0) {
+			frame_decref(sh->sh_pages[i]);
+		}
+	}
+	vm_uncommit(sh->sh_npages);
+	kfree(sh->sh_pages);
+	kfree(sh);
+}
+
+/*
+ * Map the page at VA of REG, which has a segment attached, giving the
+ * segment a frame for it if it has none yet.
+ */
+int
+page_fillshm(const struct region *reg, vaddr_t va, uint32_t *pte)
+{
+	struct shmseg *sh = reg->shm;
+	size_t i = (va - reg->vbase) / PAGE_SIZE;
+
+	KASSERT(i < sh->sh_npages);
+	if (sh->sh_pages[i] == 0) {
+		sh->sh_pages[i] = frame_alloc(true);
+		if (sh->sh_pages[i] == 0) {
+			return ENOMEM;
+		}
+	}
+	frame_incref(sh->sh_pages[i]);
+	*pte = sh->sh_pages[i] | PTE_VALID | PTE_SHARED |
+		(reg->writeable_bit ? PTE_WRITE : 0);
+	return 0;
+}
+
+/*
+ * Count another attachment of SH, for as_copy. Called with vm_lock
+ * held.
+ */
+void
+shm_attach(struct shmseg *sh)
+{
+	KASSERT(lock_do_i_hold(vm_lock));
+	KASSERT(sh->sh_attached > 0);
+	sh->sh_attached++;
+}
+
+/*
+ * Hand back the ID of the segment with key KEY, of at least SIZE
+ * bytes. With IPC_CREAT in FLAGS one is made if there is none (and
+ * with IPC_EXCL too, there must be none); with IPC_PRIVATE a new one
+ * is always made. No memory is taken until the pages are touched.
+ */
+int
+vm_shmget(int key, size_t size, int flags, int *ret)
+{
+	struct shmseg *sh, *new;
+	size_t npages;
+	unsigned i, slot;
+	bool create;
+	int result;
+
+	dumbvm_can_sleep();
+
+	if ((flags & ~(IPC_CREAT | IPC_EXCL)) != 0) {
+		return EINVAL;
+	}
+	create = key == IPC_PRIVATE || (flags & IPC_CREAT) != 0;
+	if (size > USERSPACETOP) {
+		return ENOMEM;
+	}
+	npages = DIVROUNDUP(size, PAGE_SIZE);
+	if (npages > buddy_npages / 2) {
+		return ENOMEM;
+	}
+
+	/* Allocate and commit without the lock, in case it's needed */
+	new = NULL;
+	if (create && npages > 0) {
+		new = kmalloc(sizeof(struct shmseg));
+		if (new == NULL) {
+			return ENOMEM;
+		}
+		new->sh_pages = kmalloc(npages * sizeof(paddr_t));
+		if (new->sh_pages == NULL) {
+			kfree(new);
+			return ENOMEM;
+		}
+		if (!vm_commit(npages)) {
+			kfree(new->sh_pages);
+			kfree(new);
+			return ENOMEM;
+		}
+		for (i=0; i<npages; i++) {
+			new->sh_pages[i] = 0;
+		}
+		new->sh_key = key;
+		new->sh_npages = npages;
+		new->sh_attached = 0;
+	}
+
+	lock_acquire(vm_lock);
+	sh = NULL;
+	if (key != IPC_PRIVATE) {
+		for (i=0; i<SHM_MAXSEGS; i++) {
+			if (shm_segs[i] != NULL && shm_segs[i]->sh_key == key) {
+				sh = shm_segs[i];
+				break;
+			}
+		}
+	}
+	if (sh != NULL) {
+		if ((flags & (IPC_CREAT | IPC_EXCL)) == (IPC_CREAT | IPC_EXCL)) {
+			result = EEXIST;
+		}
+		else if (npages > sh->sh_npages) {
+			result = EINVAL;
+		}
+		else {
+			*ret = sh->sh_id;
+			result = 0;
+		}
+		lock_release(vm_lock);
+		if (new != NULL) {
+			vm_uncommit(npages);
+			kfree(new->sh_pages);
+			kfree(new);
+		}
+		return result;
+	}
+	if (!create || new == NULL) {
+		lock_release(vm_lock);
+		return create ? EINVAL : ENOENT;
+	}
+
+	for (slot = 0; slot < SHM_MAXSEGS; slot++) {
+		if (shm_segs[slot] == NULL) {
+			break;
+		}
+	}
+	if (slot == SHM_MAXSEGS) {
+		lock_release(vm_lock);
+		vm_uncommit(npages);
+		kfree(new->sh_pages);
+		kfree(new);
+		return ENOSPC;
+	}
+	/* (the generation keeps the IDs of old segments from matching) */
+	new->sh_id = (int)(shm_gen * SHM_MAXSEGS + slot);
+	shm_gen = (shm_gen + 1) % SHM_MAXGEN;
+	shm_segs[slot] = new;
+	*ret = new->sh_id;
+	lock_release(vm_lock);
+	return 0;
+}
+
+/*
+ * Attach the segment ID as a new region, placed by as_placeregion.
+ */
+int
+as_shmat(struct addrspace *as, int id, bool readonly, vaddr_t *ret)
+{
+	struct region *prev, *new;
+	struct shmseg *sh;
+	vaddr_t base;
+	int result;
+
+	dumbvm_can_sleep();
+
+	new = kmalloc(sizeof(struct region));
+	if (new == NULL) {
+		return ENOMEM;
+	}
+
+	lock_acquire(vm_lock);
+	sh = shm_lookup(id);
+	if (sh == NULL) {
+		lock_release(vm_lock);
+		kfree(new);
+		return EINVAL;
+	}
+	result = as_placeregion(as, sh->sh_npages, &prev, &base);
+	if (result) {
+		lock_release(vm_lock);
+		kfree(new);
+		return result;
+	}
+
+	new->vbase = base;
+	new->npages = sh->sh_npages;
+	new->writeable_bit = readonly ? 0 : 1;
+	new->old_writeable_bit = new->writeable_bit;
+	new->filevaddr = 0;
+	new->fileoff = 0;
+	new->filesz = 0;
+	new->mapvn = NULL;
+	new->mapoff = 0;
+	new->mapshared = false;
+	new->mapanon = false;
+	new->kinfo = false;
+	new->shm = sh;
+	new->advice = MADV_NORMAL;
+	sh->sh_attached++;
+
+	new->next = prev->next;
+	prev->next = new;
+	as_regionschanged(as);
+
+	lock_release(vm_lock);
+
+	*ret = base;
+	return 0;
+}
+
+/*
+ * Detach the segment attached at VADDR, dropping the region's
+ * mappings of its frames and then the attachment itself.
+ */
+int
+as_shmdt(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *reg, **pp;
+	uint32_t *pte;
+	size_t i;
+
+	dumbvm_can_sleep();
+
+	lock_acquire(vm_lock);
+	for (pp = &as->as_regions; *pp != NULL; pp = &(*pp)->next) {
+		if ((*pp)->shm != NULL && (*pp)->vbase == vaddr) {
+			break;
+		}
+	}
+	if (*pp == NULL) {
+		lock_release(vm_lock);
+		return EINVAL;
+	}
+	reg = *pp;
+	*pp = reg->next;
+	as_regionschanged(as);
+
+	for (i=0; i<reg->npages; i++) {
+		pte = pt_lookup(as, reg->vbase + i * PAGE_SIZE, false);
+		if (pte == NULL || (*pte & PTE_VALID) == 0) {
+			continue;
+		}
+		KASSERT(*pte & PTE_SHARED);
+		frame_decref(*pte & PTE_FRAME);
+		*pte = 0;
+	}
+	tlb_invalidate(as, reg->vbase, reg->npages);
+	shm_release(reg->shm);
+	lock_release(vm_lock);
+
+	kfree(reg);
+	return 0;
+}
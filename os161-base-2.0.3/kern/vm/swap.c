@@ -0,0 +1,498 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009, 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Swap space.
+ *
+ * The swap device is opened with vfs_swapon at boot and divided into
+ * page-sized slots, tracked in a bitmap. The VM system decides what
+ * to page out; this file only hands out slots and moves pages to and
+ * from them. Pages that are evicted together are given neighbouring
+ * slots and written with a single request.
+ *
+ * If there is no swap device, the system simply runs without swap.
+ *
+ * In front of the device sits a compressed store in memory: a page
+ * that compresses to at most ZSWAP_MAXLEN bytes is kept, compressed,
+ * in kmalloc'd memory instead of being written out, and read back
+ * from there, so idle pages that are mostly zeros (stacks, sparse
+ * heaps) leave memory without any disk I/O. The store holds at most
+ * 1/ZSWAP_FRACTION of RAM; when it is full, its oldest pages are
+ * written back to their slots on the device to make room. A page in
+ * the store still owns its swap slot, which is where it goes when it
+ * is written back, so the VM system sees slots only.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <bitmap.h>
+#include <spinlock.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <vm.h>
+#include <synch.h>
+#include <mainbus.h>
+#include <lz.h>
+#include <kstat.h>
+
+/* Device to swap to */
+#define SWAP_DEVICE	"lhd1:"
+
+static struct vnode *swap_vn;
+static struct bitmap *swap_map;		/* one bit per slot, set if in use */
+static unsigned swap_nslots;
+static unsigned swap_nused;
+static struct spinlock swap_lock = SPINLOCK_INITIALIZER;
+
+/* Statistics */
+static unsigned swap_pageouts, swap_writes, swap_pageins;
+
+/* Compressed store */
+#define ZSWAP_FRACTION	8		/* at most this fraction of RAM */
+
+struct zpage {
+	unsigned zp_slot;
+	unsigned zp_len;		/* compressed length */
+	struct zpage *zp_prev;		/* towards older pages */
+	struct zpage *zp_next;		/* towards newer pages */
+	unsigned char zp_data[];
+};
+
+/* Pages compressing worse go to disk; the rest take half a page at most */
+#define ZSWAP_MAXLEN	(PAGE_SIZE / 2 - sizeof(struct zpage))
+
+static struct lock *zswap_lock;		/* everything below */
+static struct zpage **zswap_pages;	/* per slot: its page, if stored */
+static struct zpage *zswap_oldest, *zswap_newest;
+static size_t zswap_bytes, zswap_maxbytes;
+static unsigned zswap_npages;
+static uint16_t zswap_hash[LZ_HASHSIZE];	/* scratch for lz_compress */
+static unsigned char *zswap_buf;	/* a page of scratch */
+static unsigned zswap_stores, zswap_rejects, zswap_loads, zswap_writebacks;
+
+/*
+ * Open the swap device, if there is one.
+ */
+void
+swap_bootstrap(void)
+{
+	struct stat st;
+	int result;
+
+	result = vfs_swapon(SWAP_DEVICE, &swap_vn);
+	if (result) {
+		kprintf("swap: %s: %s; running without swap\n", SWAP_DEVICE,
+			strerror(result));
+		swap_vn = NULL;
+		return;
+	}
+
+	result = VOP_STAT(swap_vn, &st);
+	if (result) {
+		panic("swap: VOP_STAT on %s: %s\n", SWAP_DEVICE,
+		      strerror(result));
+	}
+
+	swap_nslots = st.st_size / PAGE_SIZE;
+	swap_map = bitmap_create(swap_nslots);
+	if (swap_map == NULL) {
+		panic("swap: out of memory for the slot bitmap\n");
+	}
+
+	zswap_lock = lock_create("zswap");
+	zswap_pages = kmalloc(swap_nslots * sizeof(*zswap_pages));
+	zswap_buf = kmalloc(PAGE_SIZE);
+	if (zswap_lock == NULL || zswap_pages == NULL || zswap_buf == NULL) {
+		panic("swap: out of memory for the compressed store\n");
+	}
+	bzero(zswap_pages, swap_nslots * sizeof(*zswap_pages));
+	zswap_maxbytes = mainbus_ramsize() / ZSWAP_FRACTION;
+
+	kprintf("swap: %u pages on %s, up to %uK compressed in memory\n",
+		swap_nslots, SWAP_DEVICE, (unsigned)(zswap_maxbytes / 1024));
+}
+
+bool
+swap_enabled(void)
+{
+	return swap_map != NULL;
+}
+
+/*
+ * Number of slots, or 0 without swap.
+ */
+unsigned
+swap_size(void)
+{
+	return swap_map != NULL ? swap_nslots : 0;
+}
+
+////////////////////////////////////////////////////////////
+// compressed store
+
+/*
+ * Take ZP out of the store. Called with zswap_lock held.
+ */
+static
+void
+zswap_remove(struct zpage *zp)
+{
+	KASSERT(lock_do_i_hold(zswap_lock));
+	KASSERT(zswap_pages[zp->zp_slot] == zp);
+
+	if (zp->zp_prev != NULL) {
+		zp->zp_prev->zp_next = zp->zp_next;
+	}
+	else {
+		zswap_oldest = zp->zp_next;
+	}
+	if (zp->zp_next != NULL) {
+		zp->zp_next->zp_prev = zp->zp_prev;
+	}
+	else {
+		zswap_newest = zp->zp_prev;
+	}
+	zswap_pages[zp->zp_slot] = NULL;
+	zswap_bytes -= zp->zp_len;
+	zswap_npages--;
+	kfree(zp);
+}
+
+static int swap_writedisk(unsigned slot, void *const *pages, unsigned n);
+
+/*
+ * Make room for LEN more bytes by writing the oldest pages back to
+ * their slots. Called with zswap_lock held.
+ */
+static
+int
+zswap_shrink(size_t len)
+{
+	struct zpage *zp;
+	void *page = zswap_buf;
+	int result;
+
+	KASSERT(lock_do_i_hold(zswap_lock));
+
+	while (zswap_bytes + len > zswap_maxbytes && zswap_oldest != NULL) {
+		zp = zswap_oldest;
+		if (lz_decompress(zp->zp_data, zp->zp_len, zswap_buf,
+				  PAGE_SIZE) != PAGE_SIZE) {
+			panic("swap: compressed page of slot %u is corrupt\n",
+			      zp->zp_slot);
+		}
+		result = swap_writedisk(zp->zp_slot, &page, 1);
+		if (result) {
+			return result;
+		}
+		zswap_remove(zp);
+		zswap_writebacks++;
+	}
+	return 0;
+}
+
+/*
+ * Try to keep the page at KVA, bound for SLOT, compressed in memory.
+ * Returns false if it has to go to the device after all.
+ */
+static
+bool
+zswap_store(unsigned slot, const void *kva)
+{
+	struct zpage *zp;
+	size_t len;
+
+	lock_acquire(zswap_lock);
+	KASSERT(zswap_pages[slot] == NULL);
+	len = lz_compress(kva, PAGE_SIZE, zswap_buf, ZSWAP_MAXLEN,
+			  zswap_hash);
+	if (len == 0 || len > zswap_maxbytes) {
+		zswap_rejects++;
+		lock_release(zswap_lock);
+		return false;
+	}
+	zp = kmalloc(sizeof(*zp) + len);
+	if (zp == NULL) {
+		zswap_rejects++;
+		lock_release(zswap_lock);
+		return false;
+	}
+	zp->zp_slot = slot;
+	zp->zp_len = len;
+	memcpy(zp->zp_data, zswap_buf, len);
+
+	/* zswap_buf is free again: write back what doesn't fit any more */
+	if (zswap_shrink(len)) {
+		kfree(zp);
+		zswap_rejects++;
+		lock_release(zswap_lock);
+		return false;
+	}
+
+	zp->zp_prev = zswap_newest;
+	zp->zp_next = NULL;
+	if (zswap_newest != NULL) {
+		zswap_newest->zp_next = zp;
+	}
+	else {
+		zswap_oldest = zp;
+	}
+	zswap_newest = zp;
+	zswap_pages[slot] = zp;
+	zswap_bytes += len;
+	zswap_npages++;
+	zswap_stores++;
+	lock_release(zswap_lock);
+	return true;
+}
+
+/*
+ * If the page of SLOT is in the store, decompress it into the page at
+ * KVA and drop it from the store; return false if it's on the device.
+ */
+static
+bool
+zswap_load(unsigned slot, void *kva)
+{
+	struct zpage *zp;
+
+	lock_acquire(zswap_lock);
+	zp = zswap_pages[slot];
+	if (zp == NULL) {
+		lock_release(zswap_lock);
+		return false;
+	}
+	if (lz_decompress(zp->zp_data, zp->zp_len, kva,
+			  PAGE_SIZE) != PAGE_SIZE) {
+		panic("swap: compressed page of slot %u is corrupt\n", slot);
+	}
+	zswap_remove(zp);
+	zswap_loads++;
+	lock_release(zswap_lock);
+	return true;
+}
+
+////////////////////////////////////////////////////////////
+// slots
+
+/*
+ * Find N consecutive free slots and mark them in use; the first one
+ * is returned in RET.
+ */
+int
+swap_alloc(unsigned n, unsigned *ret)
+{
+	unsigned slot;
+
+	KASSERT(n > 0 && n <= SWAP_MAXCLUSTER);
+
+	if (swap_map == NULL) {
+		return ENOSPC;
+	}
+
+	spinlock_acquire(&swap_lock);
+	if (bitmap_alloc_range(swap_map, n, &slot)) {
+		spinlock_release(&swap_lock);
+		return ENOSPC;
+	}
+	swap_nused += n;
+	spinlock_release(&swap_lock);
+
+	*ret = slot;
+	return 0;
+}
+
+void
+swap_free(unsigned slot)
+{
+	KASSERT(slot < swap_nslots);
+
+	lock_acquire(zswap_lock);
+	if (zswap_pages[slot] != NULL) {
+		zswap_remove(zswap_pages[slot]);
+	}
+	lock_release(zswap_lock);
+
+	spinlock_acquire(&swap_lock);
+	KASSERT(slot < swap_nslots);
+	KASSERT(bitmap_isset(swap_map, slot));
+	bitmap_unmark(swap_map, slot);
+	swap_nused--;
+	spinlock_release(&swap_lock);
+}
+
+/*
+ * Write the N pages at PAGES to the slots starting at SLOT on the
+ * device, as one request.
+ */
+static
+int
+swap_writedisk(unsigned slot, void *const *pages, unsigned n)
+{
+	struct iovec iov[SWAP_MAXCLUSTER];
+	struct uio u;
+	unsigned i;
+	int result;
+
+	KASSERT(n > 0 && n <= SWAP_MAXCLUSTER);
+
+	for (i=0; i<n; i++) {
+		iov[i].iov_kbase = pages[i];
+		iov[i].iov_len = PAGE_SIZE;
+	}
+	u.uio_iov = iov;
+	u.uio_iovcnt = n;
+	u.uio_offset = (off_t)slot * PAGE_SIZE;
+	u.uio_resid = n * PAGE_SIZE;
+	u.uio_segflg = UIO_SYSSPACE;
+	u.uio_rw = UIO_WRITE;
+	u.uio_space = NULL;
+	u.uio_direct = false;
+	u.uio_advice = POSIX_FADV_NORMAL;
+
+	result = VOP_WRITE(swap_vn, &u);
+	if (result) {
+		return result;
+	}
+	if (u.uio_resid != 0) {
+		return EIO;
+	}
+
+	spinlock_acquire(&swap_lock);
+	swap_pageouts += n;
+	swap_writes++;
+	spinlock_release(&swap_lock);
+	return 0;
+}
+
+/*
+ * Page out the N pages in FRAMES to the slots starting at SLOT: those
+ * that compress well enough stay in memory, and each run of the rest
+ * goes to the device as one request.
+ */
+int
+swap_write(unsigned slot, const paddr_t *frames, unsigned n)
+{
+	void *pages[SWAP_MAXCLUSTER];
+	unsigned i, run;
+	int result;
+
+	KASSERT(n > 0 && n <= SWAP_MAXCLUSTER);
+
+	run = 0;
+	for (i=0; i<n; i++) {
+		pages[i] = (void *)PADDR_TO_KVADDR(frames[i]);
+		if (!zswap_store(slot + i, pages[i])) {
+			run++;
+			continue;
+		}
+		if (run > 0) {
+			result = swap_writedisk(slot + i - run,
+						&pages[i - run], run);
+			if (result) {
+				return result;
+			}
+			run = 0;
+		}
+	}
+	if (run > 0) {
+		return swap_writedisk(slot + n - run, &pages[n - run], run);
+	}
+	return 0;
+}
+
+/*
+ * Read the page in SLOT into the frame PA.
+ */
+int
+swap_read(unsigned slot, paddr_t pa)
+{
+	struct iovec iov;
+	struct uio u;
+	int result;
+
+	if (zswap_load(slot, (void *)PADDR_TO_KVADDR(pa))) {
+		return 0;
+	}
+
+	uio_kinit(&iov, &u, (void *)PADDR_TO_KVADDR(pa), PAGE_SIZE,
+		  (off_t)slot * PAGE_SIZE, UIO_READ);
+	result = VOP_READ(swap_vn, &u);
+	if (result) {
+		return result;
+	}
+	if (u.uio_resid != 0) {
+		return EIO;
+	}
+
+	spinlock_acquire(&swap_lock);
+	swap_pageins++;
+	spinlock_release(&swap_lock);
+	return 0;
+}
+
+void
+swap_printstats(void)
+{
+	if (swap_map == NULL) {
+		kprintf("swap: not enabled\n");
+		return;
+	}
+	kprintf("swap: %u of %u pages in use; %u pageouts in %u writes, "
+		"%u pageins\n", swap_nused, swap_nslots, swap_pageouts,
+		swap_writes, swap_pageins);
+	kprintf("swap: compressed: %u pages in %u of %u bytes; %u stored, "
+		"%u refused, %u loaded, %u written back\n", zswap_npages,
+		(unsigned)zswap_bytes, (unsigned)zswap_maxbytes, zswap_stores,
+		zswap_rejects, zswap_loads, zswap_writebacks);
+}
+
+void
+swap_kstat(struct kstat *ks)
+{
+	if (swap_map == NULL) {
+		return;
+	}
+	kstat_put(ks, swap_nslots, "swap.slots");
+	kstat_put(ks, swap_nused, "swap.used");
+	kstat_put(ks, swap_pageouts, "swap.pageouts");
+	kstat_put(ks, swap_writes, "swap.writes");
+	kstat_put(ks, swap_pageins, "swap.pageins");
+	kstat_put(ks, zswap_npages, "swap.zswap.pages");
+	kstat_put(ks, zswap_bytes, "swap.zswap.bytes");
+	kstat_put(ks, zswap_stores, "swap.zswap.stores");
+	kstat_put(ks, zswap_rejects, "swap.zswap.refused");
+	kstat_put(ks, zswap_loads, "swap.zswap.loads");
+	kstat_put(ks, zswap_writebacks, "swap.zswap.writebacks");
+}
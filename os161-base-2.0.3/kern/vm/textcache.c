@@ -0,0 +1,328 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Text cache.
+ *
+ * Pages of read-only regions that come from an executable are kept in
+ * the text cache, keyed by vnode and virtual address, so every process
+ * running the same program maps the same frames. The cache holds one
+ * reference on each frame; entries whose frame nobody else maps are
+ * the first thing given back when memory is short. Entries for a
+ * vnode are dropped when it is reclaimed (the name cache usually keeps
+ * executables that were run recently referenced) or opened for
+ * writing.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vm.h>
+#include <kstat.h>
+#include <buddy.h>
+#include <frame.h>
+#include <textcache.h>
+#include <mapcache.h>
+#include <vmprivate.h>
+
+#define TEXTCACHE_SIZE	256
+#define TEXTCACHE_HASH	61
+
+struct textpage {
+	struct vnode *tp_vn;		/* executable, or NULL if unused */
+	vaddr_t tp_va;			/* page address in the program */
+	paddr_t tp_pa;			/* frame (one reference is ours) */
+	unsigned tp_stamp;		/* last use, for replacement */
+	struct textpage *tp_hashnext;
+};
+
+static struct textpage textcache[TEXTCACHE_SIZE];
+static struct textpage *textcache_hash[TEXTCACHE_HASH];
+static unsigned textcache_clock;
+static unsigned textcache_nused;
+static unsigned textcache_hits, textcache_misses;
+
+static
+unsigned
+textcache_hashval(struct vnode *vn, vaddr_t va)
+{
+	return (((uintptr_t)vn >> 4) ^ (va >> 12)) % TEXTCACHE_HASH;
+}
+
+static
+struct textpage *
+textcache_find(struct vnode *vn, vaddr_t va)
+{
+	struct textpage *tp;
+
+	for (tp = textcache_hash[textcache_hashval(vn, va)]; tp != NULL;
+	     tp = tp->tp_hashnext) {
+		if (tp->tp_vn == vn && tp->tp_va == va) {
+			return tp;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Empty out an entry, dropping its frame reference.
+ */
+static
+void
+textcache_drop(struct textpage *tp)
+{
+	struct textpage **pp;
+
+	KASSERT(tp->tp_vn != NULL);
+
+	pp = &textcache_hash[textcache_hashval(tp->tp_vn, tp->tp_va)];
+	while (*pp != tp) {
+		KASSERT(*pp != NULL);
+		pp = &(*pp)->tp_hashnext;
+	}
+	*pp = tp->tp_hashnext;
+
+	tp->tp_vn = NULL;
+	tp->tp_hashnext = NULL;
+	textcache_nused--;
+	frame_decref(tp->tp_pa);
+}
+
+/*
+ * Return the cached frame for page VA of executable VN, or 0.
+ * Called with vm_lock held.
+ */
+paddr_t
+textcache_lookup(struct vnode *vn, vaddr_t va)
+{
+	struct textpage *tp;
+
+	tp = textcache_find(vn, va);
+	if (tp == NULL) {
+		textcache_misses++;
+		return 0;
+	}
+	tp->tp_stamp = ++textcache_clock;
+	textcache_hits++;
+	return tp->tp_pa;
+}
+
+/*
+ * Remember that page VA of VN is in frame PA. Replaces the least
+ * recently used entry if the cache is full. Called with vm_lock held.
+ */
+void
+textcache_enter(struct vnode *vn, vaddr_t va, paddr_t pa)
+{
+	struct textpage *tp, *victim = NULL;
+	unsigned i, h;
+
+	if (textcache_find(vn, va) != NULL) {
+		/* Someone else read it in while we were reading too */
+		return;
+	}
+
+	for (i=0; i<TEXTCACHE_SIZE; i++) {
+		tp = &textcache[i];
+		if (tp->tp_vn == NULL) {
+			victim = tp;
+			break;
+		}
+		if (victim == NULL || tp->tp_stamp < victim->tp_stamp) {
+			victim = tp;
+		}
+	}
+	if (victim->tp_vn != NULL) {
+		textcache_drop(victim);
+	}
+
+	frame_incref(pa);
+	victim->tp_vn = vn;
+	victim->tp_va = va;
+	victim->tp_pa = pa;
+	victim->tp_stamp = ++textcache_clock;
+	textcache_nused++;
+	h = textcache_hashval(vn, va);
+	victim->tp_hashnext = textcache_hash[h];
+	textcache_hash[h] = victim;
+}
+
+/*
+ * Free up to SWAP_MAXCLUSTER frames that only the text cache still
+ * uses. Returns how many. Called with vm_lock held.
+ */
+unsigned
+textcache_reclaim(void)
+{
+	struct textpage *tp;
+	unsigned i, n = 0;
+	bool unused;
+
+	for (i=0; i<TEXTCACHE_SIZE && n<SWAP_MAXCLUSTER; i++) {
+		tp = &textcache[i];
+		if (tp->tp_vn == NULL) {
+			continue;
+		}
+		spinlock_acquire(&frame_lock);
+		unused = frames[frame_index(tp->tp_pa)].fr_refs == 1;
+		spinlock_release(&frame_lock);
+		if (unused) {
+			textcache_drop(tp);
+			n++;
+		}
+	}
+	return n;
+}
+
+/*
+ * Forget all cached pages of VN that nobody is using: it is being
+ * reclaimed or written to.
+ */
+void
+vm_textcache_purge(struct vnode *vn)
+{
+	unsigned i;
+
+	if (vm_lock == NULL || (textcache_nused == 0 && mapcache_count() == 0)) {
+		/* Nothing cached (or too early in boot for there to be) */
+		return;
+	}
+
+	lock_acquire(vm_lock);
+	for (i=0; i<TEXTCACHE_SIZE; i++) {
+		if (textcache[i].tp_vn == vn) {
+			textcache_drop(&textcache[i]);
+		}
+	}
+	(void)mapcache_release(vn, (unsigned)-1);
+	lock_release(vm_lock);
+}
+
+/*
+ * Read the part of the page at VA (mapped at physical PA) that comes
+ * from the file image FVADDR..FVADDR+FILESZ, found at file offset
+ * FILEOFF in V.
+ */
+int
+page_readin(struct vnode *v, vaddr_t va, paddr_t pa,
+	    vaddr_t fvaddr, off_t fileoff, size_t filesz)
+{
+	struct iovec iov;
+	struct uio ku;
+	vaddr_t start, end;
+	int result;
+
+	start = va > fvaddr ? va : fvaddr;
+	end = va + PAGE_SIZE < fvaddr + filesz ? va + PAGE_SIZE : fvaddr + filesz;
+	if (start >= end) {
+		return 0;
+	}
+
+	uio_kinit(&iov, &ku, (void *)(PADDR_TO_KVADDR(pa) + (start - va)),
+		  end - start, fileoff + (start - fvaddr), UIO_READ);
+	result = VOP_READ(v, &ku);
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		kprintf("dumbvm: short read on page 0x%x - file truncated?\n",
+			va);
+		return ENOEXEC;
+	}
+	return 0;
+}
+
+/*
+ * Read the pages of a read-only segment of the executable VN into the
+ * text cache ahead of its first run, as page_fill would on first
+ * touch: VADDR, FILEOFF and FILESZ are as passed to as_define_file.
+ * Only fills free cache entries, and stops when free memory is short.
+ * Returns how many pages were read.
+ */
+unsigned
+vm_textprefetch(struct vnode *vn, vaddr_t vaddr, off_t fileoff, size_t filesz)
+{
+	vaddr_t va, top;
+	paddr_t pa;
+	unsigned n = 0;
+	int result;
+
+	top = vaddr + filesz;
+	if (vm_lock == NULL || filesz == 0 || top < vaddr || top > USERSPACETOP) {
+		return 0;
+	}
+
+	lock_acquire(vm_lock);
+	for (va = vaddr & PAGE_FRAME; va < top; va += PAGE_SIZE) {
+		if (textcache_nused >= TEXTCACHE_SIZE ||
+		    buddy_nfree < 2 * FRAME_RESERVE) {
+			break;
+		}
+		if (textcache_find(vn, va) != NULL) {
+			continue;
+		}
+		pa = frame_alloc(true);
+		if (pa == 0) {
+			break;
+		}
+		lock_release(vm_lock);
+		result = page_readin(vn, va, pa, vaddr, fileoff, filesz);
+		lock_acquire(vm_lock);
+		if (result == 0) {
+			textcache_enter(vn, va, pa);
+			n++;
+		}
+		/* The cache keeps the frame, if it took it */
+		frame_decref(pa);
+		if (result) {
+			break;
+		}
+	}
+	lock_release(vm_lock);
+	return n;
+}
+
+void
+textcache_printstats(void)
+{
+	kprintf("dumbvm: text cache: %u pages, %u hits, %u misses\n",
+		textcache_nused, textcache_hits, textcache_misses);
+}
+
+void
+textcache_kstat(struct kstat *ks)
+{
+	kstat_put(ks, textcache_nused, "vm.textcache.pages");
+	kstat_put(ks, textcache_hits, "vm.textcache.hits");
+	kstat_put(ks, textcache_misses, "vm.textcache.misses");
+}
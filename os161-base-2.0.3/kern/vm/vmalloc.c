@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Kernel virtual allocations. vmalloc maps pages taken one at a time,
+ * wherever they are in physical memory, at consecutive addresses in
+ * the vmalloc area at the bottom of kseg2, so that big kernel buffers
+ * don't depend on finding a long enough run of free pages. kvm_ptes
+ * has an entry for each page of the area, in the format of a user
+ * PTE; an allocation is a run of KVM_INUSE entries, the last of which
+ * is marked KVM_LAST, followed by a guard page that is reserved but
+ * never mapped, so that running off the end faults instead of
+ * scribbling on the next allocation.
+ *
+ * The translations are global TLB entries, which match under every
+ * ASID. kvm_fault, in dumbvm, loads them through kvm_getpte without a
+ * lock: an entry is only filled in before vmalloc hands the addresses
+ * out, and only cleared after vfree has shot it down from every TLB.
+ * kvm_lock covers finding and reserving a range.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <membar.h>
+#include <vm.h>
+#include <vmprivate.h>
+#include <vmalloc.h>
+
+#define KVM_INUSE	0x020		/* page (or guard page) of an allocation */
+#define KVM_LAST	0x040		/* last page of an allocation */
+
+static struct spinlock kvm_lock = SPINLOCK_INITIALIZER;
+static uint32_t *kvm_ptes = NULL;
+static unsigned long kvm_nused = 0;	/* pages in use, guard pages included */
+static unsigned long kvm_hint = 0;	/* where to start looking for a range */
+
+int
+kvm_bootstrap(void)
+{
+	kvm_ptes = kmalloc(VMALLOC_NPAGES * sizeof(uint32_t));
+	if (kvm_ptes == NULL) {
+		return ENOMEM;
+	}
+	bzero(kvm_ptes, VMALLOC_NPAGES * sizeof(uint32_t));
+	return 0;
+}
+
+/*
+ * Find NPAGES free entries in a row, first fit from kvm_hint on and
+ * wrapping around once. Returns the index of the first, or
+ * VMALLOC_NPAGES if there is no such run. kvm_lock must be held.
+ */
+static
+unsigned long
+kvm_findrange(unsigned long npages)
+{
+	unsigned long start, run, i, n;
+
+	KASSERT(spinlock_do_i_hold(&kvm_lock));
+
+	start = kvm_hint;
+	run = 0;
+	for (n = 0; n < VMALLOC_NPAGES + npages; n++) {
+		i = (kvm_hint + n) % VMALLOC_NPAGES;
+		if (i == 0) {
+			/* A run can't wrap around the end */
+			run = 0;
+		}
+		if (kvm_ptes[i] != 0) {
+			run = 0;
+			continue;
+		}
+		if (run == 0) {
+			start = i;
+		}
+		if (++run == npages) {
+			kvm_hint = (start + npages) % VMALLOC_NPAGES;
+			return start;
+		}
+	}
+	return VMALLOC_NPAGES;
+}
+
+/*
+ * The page table entry for VA, in the vmalloc area, or 0 before
+ * kvm_bootstrap. Takes no lock; see above.
+ */
+uint32_t
+kvm_getpte(vaddr_t va)
+{
+	if (kvm_ptes == NULL) {
+		return 0;
+	}
+	return kvm_ptes[(va - VMALLOC_BASE) / PAGE_SIZE];
+}
+
+/*
+ * Give back the NPAGES pages (and the guard page) of the allocation
+ * at index START of the vmalloc area, the first NMAPPED of which have
+ * a frame: unmap them everywhere, then free the frames.
+ */
+static
+void
+kvm_release(unsigned long start, unsigned long nmapped, unsigned long npages)
+{
+	vaddr_t va;
+	unsigned long i;
+
+	va = VMALLOC_BASE + start * PAGE_SIZE;
+	if (nmapped > 0) {
+		for (i = 0; i < nmapped; i++) {
+			kvm_ptes[start + i] &= ~PTE_VALID;
+		}
+		membar_any_any();
+
+		kvm_invalidate(va, nmapped);
+
+		for (i = 0; i < nmapped; i++) {
+			free_kpages(PADDR_TO_KVADDR(kvm_ptes[start + i] & PTE_FRAME));
+		}
+	}
+
+	spinlock_acquire(&kvm_lock);
+	for (i = 0; i <= npages; i++) {
+		kvm_ptes[start + i] = 0;
+	}
+	kvm_nused -= npages + 1;
+	spinlock_release(&kvm_lock);
+}
+
+/*
+ * Allocate SIZE bytes of kernel memory, mapped in the vmalloc area
+ * from single pages. Slower to set up than kmalloc, and each page
+ * takes a TLB entry of its own, but it only needs free pages, not
+ * free pages next to each other. May sleep.
+ */
+void *
+vmalloc(size_t size)
+{
+	unsigned long npages, start, i;
+	vaddr_t kva;
+
+	dumbvm_can_sleep();
+	if (kvm_ptes == NULL || size == 0 ||
+	    size > (VMALLOC_NPAGES - 1) * PAGE_SIZE) {
+		return NULL;
+	}
+	npages = DIVROUNDUP(size, PAGE_SIZE);
+
+	/* Reserve the addresses, guard page included */
+	spinlock_acquire(&kvm_lock);
+	start = kvm_findrange(npages + 1);
+	if (start == VMALLOC_NPAGES) {
+		spinlock_release(&kvm_lock);
+		return NULL;
+	}
+	for (i = 0; i <= npages; i++) {
+		kvm_ptes[start + i] = KVM_INUSE;
+	}
+	kvm_ptes[start + npages - 1] |= KVM_LAST;
+	kvm_nused += npages + 1;
+	spinlock_release(&kvm_lock);
+
+	/* Nobody else touches the entries reserved: fill them unlocked */
+	for (i = 0; i < npages; i++) {
+		kva = alloc_kpages(1);
+		if (kva == 0) {
+			kvm_release(start, i, npages);
+			return NULL;
+		}
+		kvm_ptes[start + i] |= (kva - MIPS_KSEG0) | PTE_VALID;
+	}
+	membar_any_any();
+	return (void *)(VMALLOC_BASE + start * PAGE_SIZE);
+}
+
+/*
+ * Free memory returned by vmalloc. May sleep.
+ */
+void
+vfree(void *ptr)
+{
+	vaddr_t va = (vaddr_t)ptr;
+	unsigned long start, npages;
+
+	if (ptr == NULL) {
+		return;
+	}
+	dumbvm_can_sleep();
+	KASSERT(va >= VMALLOC_BASE && va < VMALLOC_TOP);
+	KASSERT(va % PAGE_SIZE == 0);
+
+	start = (va - VMALLOC_BASE) / PAGE_SIZE;
+	/* Must be the start of an allocation: the entry before isn't part of one */
+	KASSERT(kvm_ptes[start] & PTE_VALID);
+	KASSERT(start == 0 ||
+		(kvm_ptes[start - 1] & (PTE_VALID | KVM_LAST)) != PTE_VALID);
+
+	npages = 1;
+	while ((kvm_ptes[start + npages - 1] & KVM_LAST) == 0) {
+		npages++;
+	}
+	kvm_release(start, npages, npages);
+}
+
+void
+vmalloc_printstats(void)
+{
+	kprintf("dumbvm: vmalloc: %lu of %u pages in use (guard pages included)\n",
+		kvm_nused, VMALLOC_NPAGES);
+}
@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * The address space side of checkpoint and restore
+ * (syscall/checkpoint.c): describing the regions of an address space
+ * for an image, and setting one up again from it.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <vnode.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <vmprivate.h>
+#include <kinfo.h>
+#include <checkpoint.h>
+
+/*
+ * Describe the regions of AS for a checkpoint image, in address
+ * order, in REGS (room for MAX of them), handing back how many in
+ * NRET and the break in HEAPBRK. Only cr_fileoff is left for the
+ * caller to fill in. cr_filesz covers the pages up to the last one
+ * that holds anything: the rest of a region has never been touched.
+ * Shared mappings and segments can't be restored as such, so they
+ * make it fail.
+ */
+int
+as_checkpoint(struct addrspace *as, struct ckpt_region *regs, unsigned max,
+	      unsigned *nret, vaddr_t *heapbrk)
+{
+	struct region *reg;
+	uint32_t *pte;
+	vaddr_t va, fileend;
+	unsigned n, i, used;
+
+	dumbvm_can_sleep();
+
+	n = 0;
+	lock_acquire(vm_lock);
+	for (reg = as->as_regions; reg != NULL; reg = reg->next) {
+		if (reg->kinfo) {
+			continue;
+		}
+		if (reg->shm != NULL || reg->mapshared) {
+			lock_release(vm_lock);
+			return EINVAL;
+		}
+		if (n == max) {
+			lock_release(vm_lock);
+			return E2BIG;
+		}
+
+		fileend = reg->filevaddr + reg->filesz;
+		used = 0;
+		for (i=0; i<reg->npages; i++) {
+			va = reg->vbase + i * PAGE_SIZE;
+			pte = pt_lookup(as, va, false);
+			if (reg->mapvn != NULL ||
+			    (pte != NULL && (*pte & (PTE_VALID|PTE_SWAP))) ||
+			    (reg->filesz > 0 && va < fileend &&
+			     va + PAGE_SIZE > reg->filevaddr)) {
+				used = i + 1;
+			}
+		}
+
+		regs[n].cr_vbase = reg->vbase;
+		regs[n].cr_npages = reg->npages;
+		regs[n].cr_flags = 0;
+		if (reg->writeable_bit) {
+			regs[n].cr_flags |= CKPT_REG_WRITE;
+		}
+		if (reg == as->as_heap) {
+			regs[n].cr_flags |= CKPT_REG_HEAP;
+		}
+		if (reg == as->as_stack) {
+			regs[n].cr_flags |= CKPT_REG_STACK;
+		}
+		if (reg->mapvn != NULL || reg->mapanon) {
+			regs[n].cr_flags |= CKPT_REG_MAP;
+		}
+		regs[n].cr_fileoff = 0;
+		regs[n].cr_filesz = used * PAGE_SIZE;
+		n++;
+	}
+	*heapbrk = as->as_heapbrk;
+	lock_release(vm_lock);
+
+	*nret = n;
+	return 0;
+}
+
+/*
+ * Build the (new, empty) address space AS from the N regions REGS of
+ * the checkpoint image VN, with the break at HEAPBRK. No page is read
+ * here: each region is paged in from VN by vm_fault, as the segments
+ * of an executable are, and keeps its reference until AS goes away.
+ * The regions must be sorted and page-aligned, with exactly one heap
+ * and one stack, and their pages within the image.
+ */
+int
+as_restore(struct addrspace *as, struct vnode *vn,
+	   const struct ckpt_region *regs, unsigned n, vaddr_t heapbrk)
+{
+	const struct ckpt_region *cr;
+	struct region *reg;
+	vaddr_t last;
+	size_t commit;
+	unsigned i;
+	int writeable, result;
+
+	dumbvm_can_sleep();
+	KASSERT(!as->as_loaded);
+	KASSERT(as->as_file == NULL);
+
+	last = 0;
+	for (i=0; i<n; i++) {
+		cr = &regs[i];
+		if ((cr->cr_vbase & ~(vaddr_t)PAGE_FRAME) != 0 ||
+		    (cr->cr_fileoff & ~(uint32_t)PAGE_FRAME) != 0 ||
+		    cr->cr_vbase < last || cr->cr_vbase > USERSPACETOP ||
+		    cr->cr_npages > (USERSPACETOP - cr->cr_vbase) / PAGE_SIZE ||
+		    cr->cr_filesz > cr->cr_npages * PAGE_SIZE) {
+			return EINVAL;
+		}
+		last = cr->cr_vbase + cr->cr_npages * PAGE_SIZE;
+
+		/* Committed as as_define_region and as_mmap would */
+		writeable = (cr->cr_flags & CKPT_REG_WRITE) != 0;
+		commit = (writeable || (cr->cr_flags & CKPT_REG_MAP)) ?
+			cr->cr_npages : 0;
+		result = as_reserve(as, commit);
+		if (result) {
+			return result;
+		}
+		result = as_insertregion(as, cr->cr_vbase, cr->cr_npages,
+					 writeable, &reg);
+		if (result) {
+			as_unreserve(as, commit);
+			return result;
+		}
+		if (cr->cr_filesz > 0) {
+			reg->filevaddr = cr->cr_vbase;
+			reg->fileoff = cr->cr_fileoff;
+			reg->filesz = cr->cr_filesz;
+		}
+		/* A private mapping is anonymous once its pages are saved */
+		reg->mapanon = (cr->cr_flags & CKPT_REG_MAP) != 0;
+
+		if (cr->cr_flags & CKPT_REG_HEAP) {
+			if (as->as_heap != NULL || !writeable) {
+				return EINVAL;
+			}
+			as->as_heap = reg;
+		}
+		if (cr->cr_flags & CKPT_REG_STACK) {
+			if (as->as_stack != NULL || !writeable ||
+			    last != USERSTACK) {
+				return EINVAL;
+			}
+			as->as_stack = reg;
+		}
+	}
+
+	if (as->as_heap == NULL || as->as_stack == NULL ||
+	    heapbrk < as->as_heap->vbase ||
+	    heapbrk > as->as_heap->vbase + as->as_heap->npages * PAGE_SIZE) {
+		return EINVAL;
+	}
+	as->as_heapbrk = heapbrk;
+	as->as_stackmax = stack_maxpages();
+	VOP_INCREF(vn);
+	as->as_file = vn;
+	as->as_loaded = true;
+
+	return as_define_kinfo(as);
+}
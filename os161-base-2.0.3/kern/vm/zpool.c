@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Pool of zero-filled pages.
+ *
+ * Most user pages start out zero-filled, so a kernel thread keeps a
+ * small pool of pages zeroed ahead of time and page faults take from
+ * it instead of zeroing on the spot. The thread refills the pool when
+ * it drops below ZPOOL_LOW, one page at a time, yielding in between
+ * so it mostly runs when nothing else wants the cpu. It leaves the
+ * pool alone while free memory is short.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <vm.h>
+#include <kstat.h>
+#include <buddy.h>
+#include <frame.h>
+#include <zpool.h>
+
+#define ZPOOL_SIZE	32
+#define ZPOOL_LOW	(ZPOOL_SIZE / 2)
+
+static paddr_t zpool[ZPOOL_SIZE];
+static unsigned zpool_count;
+static struct spinlock zpool_lock = SPINLOCK_INITIALIZER;
+static struct wchan *zpool_wchan;
+static unsigned zpool_hits, zpool_misses;
+
+/*
+ * Take a page from the pool, or return 0 if it's empty.
+ */
+paddr_t
+zpool_take(void)
+{
+	paddr_t pa = 0;
+
+	spinlock_acquire(&zpool_lock);
+	if (zpool_count > 0) {
+		pa = zpool[--zpool_count];
+		zpool_hits++;
+	}
+	else {
+		zpool_misses++;
+	}
+	if (zpool_count < ZPOOL_LOW && zpool_wchan != NULL) {
+		wchan_wakeone(zpool_wchan, &zpool_lock);
+	}
+	spinlock_release(&zpool_lock);
+	return pa;
+}
+
+static
+void
+zpool_thread(void *unused1, unsigned long unused2)
+{
+	paddr_t pa;
+
+	(void)unused1;
+	(void)unused2;
+
+	while (1) {
+		spinlock_acquire(&zpool_lock);
+		while (zpool_count >= ZPOOL_SIZE ||
+		       buddy_nfree < 2 * FRAME_RESERVE) {
+			wchan_sleep(zpool_wchan, &zpool_lock);
+		}
+		spinlock_release(&zpool_lock);
+
+		pa = getfreeppages(1);
+		if (pa == 0) {
+			continue;
+		}
+		bzero((void *)PADDR_TO_KVADDR(pa), PAGE_SIZE);
+
+		spinlock_acquire(&zpool_lock);
+		if (zpool_count < ZPOOL_SIZE) {
+			zpool[zpool_count++] = pa;
+			pa = 0;
+		}
+		spinlock_release(&zpool_lock);
+		if (pa != 0) {
+			freeppages(pa);
+		}
+
+		thread_yield();
+	}
+}
+
+/*
+ * Start the zeroing thread. Called from vm_bootstrap.
+ */
+int
+zpool_bootstrap(void)
+{
+	zpool_wchan = wchan_create("zpool");
+	if (zpool_wchan == NULL) {
+		return ENOMEM;
+	}
+	return thread_fork("vm zeroer", NULL, zpool_thread, NULL, 0);
+}
+
+void
+zpool_printstats(void)
+{
+	kprintf("dumbvm: zeroed pool: %u pages, %u hits, %u misses\n",
+		zpool_count, zpool_hits, zpool_misses);
+}
+
+void
+zpool_kstat(struct kstat *ks)
+{
+	kstat_put(ks, zpool_count, "vm.zpool.pages");
+	kstat_put(ks, zpool_hits, "vm.zpool.hits");
+	kstat_put(ks, zpool_misses, "vm.zpool.misses");
+}
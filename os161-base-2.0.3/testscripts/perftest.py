@@ -0,0 +1,298 @@
+#!/usr/pkg/bin/python2.7
+# perftest.py - performance regression testing
+# usage: auto/perftest.py [options] [test-commands]
+# options:
+#    --iterations=N	Boot and run the test commands N times (default 3)
+#    --record=FILE	Write the timings to FILE as the new baseline
+#    --compare=FILE	Compare the timings with the baseline in FILE
+#    --tolerance=PCT	Allowed slowdown, in percent (default 10)
+#    --verbose		Copy the System/161 output to stdout
+#    --conf=sys161.conf	Use alternate sys161 config
+#    --ram=N		Force RAM size (default from sys161 config)
+#    --cpus=N		Force number of cpus (default from sys161 config)
+#    --progress=N	Progress monitoring with N-second timeout (default none)
+#    --timeout=N	Global timeout, in seconds (default 1800)
+#    --kernel=KERNEL	Choose kernel to run (default "kernel")
+#
+# The test commands (see the top of runtest.py) default to the kernel
+# "bench" menu command followed by /testbin/procbench and
+# /testbin/sysbench in the shell, with SFS mounted on lhd0:. Every
+# result line they print becomes a metric:
+#
+#    procbench: test=NAME ... p50=N ... unit=usec	p50, lower is better
+#    sysbench: test=NAME [fs=..] [bs=..] ... p50=N	p50, lower is better
+#    sysbench: test=NAME ... rate=N unit=KB/s	rate, higher is better
+#    NAME   N ops/s  p50 N p90 N p99 N max N ns	p50, lower is better
+#
+# (the last being the form of the kernel benchmarks in kern/test/benchtest.c).
+# The value kept for each metric is its median over the iterations.
+#
+# With --compare, a metric that got worse than its baseline by more than
+# the tolerance, or that is missing, is a regression; they are all
+# listed and the exit status is 1. Metrics not in the baseline are
+# reported but don't fail. Both --record and --compare can be given, in
+# which case the comparison is made with the old baseline before it is
+# replaced.
+#
+# The timings are in simulated time and so vary little between runs of
+# the same kernel on the same configuration; compare against baselines
+# made with the same sys161.conf.
+#
+
+import sys
+import re
+import json
+from optparse import OptionParser
+
+import runtest
+
+############################################################
+# global settings
+
+g_conf = None
+g_cpus = None
+g_kernel = None
+g_progress = None
+g_ram = None
+g_timeout = 1800
+g_iterations = 3
+g_record = None
+g_compare = None
+g_tolerance = 10.0
+g_verbose = False
+
+defaultcommands = "mount sfs lhd0:; bench; s; " + \
+	"/testbin/procbench; /testbin/sysbench; exit"
+
+############################################################
+# output capture
+
+#
+# File-like object for runtest.run: keeps the System/161 output and
+# optionally copies it to stdout. pexpect hands over bytes or strings
+# depending on the python version.
+#
+class Capture:
+	def __init__(self, echo):
+		self.echo = echo
+		self.chunks = []
+
+	def write(self, data):
+		if not isinstance(data, str):
+			data = data.decode("latin-1")
+		self.chunks.append(data)
+		if self.echo:
+			sys.stdout.write(data)
+
+	def flush(self):
+		if self.echo:
+			sys.stdout.flush()
+
+	def text(self):
+		return "".join(self.chunks)
+# end Capture
+
+############################################################
+# parsing
+
+userline = re.compile(r"^(procbench|sysbench): (.*)$")
+kernline = re.compile(r"^(\S.*?)\s+(\d+) ops/s\s+p50\s+(\d+) p90\s+(\d+)" +
+	r" p99\s+(\d+) max\s+(\d+) ns$")
+
+#
+# Turn the output of one run into { metric: (value, unit, higherbetter) }.
+#
+def parse(text):
+	metrics = {}
+	for line in text.replace("\r", "").split("\n"):
+		line = line.strip()
+		m = userline.match(line)
+		if m is not None:
+			fields = dict(f.split("=", 1)
+				for f in m.group(2).split() if "=" in f)
+			if "test" not in fields or "unit" not in fields:
+				continue
+			name = "%s.%s" % (m.group(1), fields["test"])
+			for key in ["fs", "bs"]:
+				if key in fields:
+					name += ".%s=%s" % (key, fields[key])
+			if "p50" in fields:
+				metrics[name] = (int(fields["p50"]),
+						fields["unit"], False)
+			elif "rate" in fields:
+				metrics[name] = (int(fields["rate"]),
+						fields["unit"], True)
+			continue
+		m = kernline.match(line)
+		if m is not None:
+			name = "kernel.%s" % m.group(1)
+			metrics[name] = (int(m.group(3)), "nsec", False)
+	return metrics
+# end parse
+
+def median(values):
+	values = sorted(values)
+	return values[len(values) // 2]
+
+############################################################
+# baselines
+
+def load(filename):
+	f = open(filename)
+	baseline = json.load(f)
+	f.close()
+	return baseline["metrics"]
+
+def save(filename, commands, metrics):
+	baseline = {
+		"commands": commands,
+		"iterations": g_iterations,
+		"metrics": metrics,
+	}
+	f = open(filename, "w")
+	json.dump(baseline, f, indent=1, sort_keys=True)
+	f.write("\n")
+	f.close()
+
+#
+# Compare the metrics of this run with a baseline; returns the number
+# of regressions.
+#
+def compare(metrics, baseline):
+	regressions = 0
+	for name in sorted(baseline):
+		old = baseline[name]
+		if name not in metrics:
+			print("REGRESSION %s: missing" % name)
+			regressions += 1
+			continue
+		new = metrics[name]
+		if old["value"] == 0:
+			continue
+		change = 100.0 * (new["value"] - old["value"]) / old["value"]
+		if new["higherbetter"]:
+			worse = -change
+		else:
+			worse = change
+		if worse > g_tolerance:
+			tag = "REGRESSION"
+			regressions += 1
+		else:
+			tag = "ok"
+		print("%s %s: %d -> %d %s (%+.1f%%)" % (tag, name,
+			old["value"], new["value"], new["unit"], change))
+	for name in sorted(metrics):
+		if name not in baseline:
+			print("new %s: %d %s" % (name, metrics[name]["value"],
+				metrics[name]["unit"]))
+	return regressions
+# end compare
+
+############################################################
+# main
+
+def getargs():
+	global g_conf
+	global g_cpus
+	global g_kernel
+	global g_progress
+	global g_ram
+	global g_timeout
+	global g_iterations
+	global g_record
+	global g_compare
+	global g_tolerance
+	global g_verbose
+
+	p = OptionParser()
+
+	p.add_option("-c", "--conf", dest="conf")
+	p.add_option("-C", "--compare", dest="compare")
+	p.add_option("-j", "--cpus", dest="cpus")
+	p.add_option("-k", "--kernel", dest="kernel")
+	p.add_option("-n", "--iterations", dest="iterations")
+	p.add_option("-r", "--ram", dest="ram")
+	p.add_option("-R", "--record", dest="record")
+	p.add_option("-t", "--timeout", dest="timeout")
+	p.add_option("-T", "--tolerance", dest="tolerance")
+	p.add_option("-v", "--verbose", dest="verbose",
+		action="store_true")
+	p.add_option("-Z", "--progress", dest="progress")
+
+	(options, args) = p.parse_args()
+	if options.conf is not None:
+		g_conf = options.conf
+	if options.compare is not None:
+		g_compare = options.compare
+	if options.cpus is not None:
+		g_cpus = int(options.cpus)
+	if options.kernel is not None:
+		g_kernel = options.kernel
+	if options.iterations is not None:
+		g_iterations = int(options.iterations)
+	if options.ram is not None:
+		g_ram = options.ram
+	if options.record is not None:
+		g_record = options.record
+	if options.timeout is not None:
+		g_timeout = int(options.timeout)
+	if options.tolerance is not None:
+		g_tolerance = float(options.tolerance)
+	if options.verbose:
+		g_verbose = True
+	if options.progress is not None:
+		g_progress = int(options.progress)
+
+	if len(args) > 1 or g_iterations < 1 or \
+	   (g_record is None and g_compare is None):
+		sys.stderr.write("Usage: perftest.py [options] " +
+			"--record=FILE|--compare=FILE [test-commands]\n")
+		exit(1)
+	if len(args) == 1:
+		return args[0]
+	return defaultcommands
+# end getargs
+
+testcommands = getargs()
+
+runs = []
+for i in range(g_iterations):
+	out = Capture(g_verbose)
+	msg = runtest.run(testcommands,
+		out,
+		conf=g_conf,
+		ram=g_ram,
+		cpus=g_cpus,
+		progress=g_progress,
+		timeout=g_timeout,
+		kernel=g_kernel)
+	if msg is not None:
+		sys.stderr.write("perftest.py: run %d aborted with %s\n" %
+			(i + 1, msg))
+		exit(1)
+	runs.append(parse(out.text()))
+
+# the median of every metric seen in all iterations
+metrics = {}
+for name in runs[0]:
+	if all(name in r for r in runs):
+		(value, unit, higherbetter) = runs[0][name]
+		metrics[name] = {
+			"value": median([r[name][0] for r in runs]),
+			"unit": unit,
+			"higherbetter": higherbetter,
+		}
+if len(metrics) == 0:
+	sys.stderr.write("perftest.py: no benchmark output\n")
+	exit(1)
+
+regressions = 0
+if g_compare is not None:
+	regressions = compare(metrics, load(g_compare))
+if g_record is not None:
+	save(g_record, testcommands, metrics)
+if regressions > 0:
+	sys.stderr.write("perftest.py: %d regressions beyond %g%%\n" %
+		(regressions, g_tolerance))
+	exit(1)
+exit(0)
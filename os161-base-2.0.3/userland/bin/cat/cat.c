@@ -27,48 +27,108 @@
  * SUCH DAMAGE.
  */
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 #include <err.h>
 
 /*
  * cat - concatenate and print
- * Usage: cat [files]
+ * Usage: cat [-v] [files]
+ *
+ * With -v, says at the end how much was printed and how fast, which
+ * makes cat a quick I/O benchmark.
+ */
+
+/* Least to ask sendfile for at a time. */
+#define COPYSIZE (1024*1024)
+
+/* Bounds on the buffer, when we have to copy through one. */
+#define MINBUF 4096
+#define MAXBUF (64*1024)
+
+/* Bytes printed so far, for -v. */
+static off_t total;
+
+/*
+ * Copy by read and write, for a kernel without sendfile, through a
+ * buffer the size of the larger preferred I/O size of the two files
+ * (within MINBUF and MAXBUF). Returns 0, or -1 on error.
  */
+static
+int
+catbuf(int fd, const struct stat *st)
+{
+	struct stat outst;
+	size_t size;
+	char *buf;
+	ssize_t len, wlen, done;
 
+	size = st->st_blksize;
+	if (fstat(STDOUT_FILENO, &outst) == 0 &&
+	    (size_t)outst.st_blksize > size) {
+		size = outst.st_blksize;
+	}
+	size = size < MINBUF ? MINBUF : size > MAXBUF ? MAXBUF : size;
 
+	buf = malloc(size);
+	if (buf == NULL) {
+		return -1;
+	}
+	while ((len = read(fd, buf, size)) > 0) {
+		for (done = 0; done < len; done += wlen) {
+			wlen = write(STDOUT_FILENO, buf + done, len - done);
+			if (wlen <= 0) {
+				free(buf);
+				return -1;
+			}
+		}
+		total += len;
+	}
+	free(buf);
+	return len < 0 ? -1 : 0;
+}
 
 /* Print a file that's already been opened. */
 static
 void
 docat(const char *name, int fd)
 {
-	char buf[1024];
-	int len, wr, wrtot;
+	struct stat st;
+	ssize_t len;
+	off_t done = 0;
+	size_t size = COPYSIZE;
+
+	if (fstat(fd, &st) < 0) {
+		err(1, "%s: fstat", name);
+	}
+	/* all of a big regular file at once, so it usually takes one call */
+	if (S_ISREG(st.st_mode) && st.st_size > COPYSIZE) {
+		size = st.st_size > 0x7fffffff ? 0x7fffffff : st.st_size;
+	}
 
 	/*
-	 * As long as we get more than zero bytes, we haven't hit EOF.
-	 * Zero means EOF. Less than zero means an error occurred.
-	 * We may read less than we asked for, though, in various cases
-	 * for various reasons.
+	 * Let the kernel copy the data to stdout, without bringing it
+	 * out here. As long as we get more than zero bytes, we haven't
+	 * hit EOF. Zero means EOF. Less than zero means an error
+	 * occurred. We may get less than we asked for, though (a line
+	 * at a time from the console, for instance), so loop.
 	 */
-	while ((len = read(fd, buf, sizeof(buf)))>0) {
-		/*
-		 * Likewise, we may actually write less than we attempted
-		 * to. So loop until we're done.
-		 */
-		wrtot = 0;
-		while (wrtot < len) {
-			wr = write(STDOUT_FILENO, buf+wrtot, len-wrtot);
-			if (wr<0) {
-				err(1, "stdout");
-			}
-			wrtot += wr;
-		}
+	while ((len = sendfile(STDOUT_FILENO, fd, NULL, size))>0) {
+		done += len;
 	}
+	total += done;
 	/*
-	 * If we got a read error, print it and exit.
+	 * If there's no sendfile, do it the old way; otherwise, if we
+	 * got an error, print it and exit.
 	 */
+	if (len<0 && errno == ENOSYS && done == 0) {
+		len = catbuf(fd, &st);
+	}
 	if (len<0) {
 		err(1, "%s", name);
 	}
@@ -101,10 +161,40 @@ cat(const char *file)
 	close(fd);
 }
 
+/* Say how much was printed in how long since start. */
+static
+void
+report(const struct timespec *start)
+{
+	struct timespec end;
+	uint64_t usecs;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	usecs = (uint64_t)(end.tv_sec - start->tv_sec) * 1000000 +
+		end.tv_nsec / 1000 - start->tv_nsec / 1000;
+	if (usecs == 0) {
+		usecs = 1;
+	}
+	warnx("%lld bytes in %llu.%06llu seconds, %llu KB/s",
+	      (long long)total,
+	      (unsigned long long)(usecs / 1000000),
+	      (unsigned long long)(usecs % 1000000),
+	      (unsigned long long)((uint64_t)total * 1000000 / 1024 / usecs));
+}
 
 int
 main(int argc, char *argv[])
 {
+	struct timespec start;
+	int verbose = 0;
+
+	if (argc > 1 && !strcmp(argv[1], "-v")) {
+		verbose = 1;
+		argc--;
+		argv++;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
 	if (argc==1) {
 		/* No args - just do stdin */
 		docat("stdin", STDIN_FILENO);
@@ -116,5 +206,8 @@ main(int argc, char *argv[])
 			cat(argv[i]);
 		}
 	}
+	if (verbose) {
+		report(&start);
+	}
 	return 0;
 }
@@ -27,24 +27,129 @@
  * SUCH DAMAGE.
  */
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <errno.h>
 #include <err.h>
 
 /*
  * cp - copy a file.
- * Usage: cp oldfile newfile
+ * Usage: cp [-v] oldfile newfile
+ *
+ * With -v, says how much was copied and how fast, which makes cp a
+ * quick I/O benchmark.
+ */
+
+/* Least to ask sendfile for at a time. */
+#define COPYSIZE (1024*1024)
+
+/* Bounds on the buffer, when we have to copy through one. */
+#define MINBUF 4096
+#define MAXBUF (64*1024)
+
+/*
+ * How much to ask sendfile for at a time: all of a regular file, if
+ * it's bigger than COPYSIZE, so that it usually goes in one call.
  */
+static
+size_t
+sendsize(const struct stat *st)
+{
+	if (S_ISREG(st->st_mode) && st->st_size > COPYSIZE) {
+		return st->st_size > 0x7fffffff ? 0x7fffffff : st->st_size;
+	}
+	return COPYSIZE;
+}
 
+/*
+ * The buffer size for copying by hand: the larger of the preferred
+ * I/O sizes of the two files, within MINBUF and MAXBUF, but no bigger
+ * than a regular file being copied needs.
+ */
+static
+size_t
+bufsize(const struct stat *from, const struct stat *to)
+{
+	size_t size;
+
+	size = from->st_blksize > to->st_blksize ?
+		from->st_blksize : to->st_blksize;
+	if (size < MINBUF) {
+		size = MINBUF;
+	}
+	if (S_ISREG(from->st_mode) && (off_t)size > from->st_size) {
+		size = from->st_size > MINBUF ? from->st_size : MINBUF;
+	}
+	return size > MAXBUF ? MAXBUF : size;
+}
+
+/*
+ * Copy by read and write, for a kernel without sendfile. Returns the
+ * number of bytes copied, or -1.
+ */
+static
+off_t
+copybuf(int fromfd, int tofd, size_t size)
+{
+	char *buf;
+	ssize_t len, wlen, done;
+	off_t total = 0;
+
+	buf = malloc(size);
+	if (buf == NULL) {
+		return -1;
+	}
+	while ((len = read(fromfd, buf, size)) > 0) {
+		for (done = 0; done < len; done += wlen) {
+			wlen = write(tofd, buf + done, len - done);
+			if (wlen <= 0) {
+				free(buf);
+				return -1;
+			}
+		}
+		total += len;
+	}
+	free(buf);
+	return len < 0 ? -1 : total;
+}
+
+/* Say how much was copied in how long since start. */
+static
+void
+report(const char *from, off_t total, const struct timespec *start)
+{
+	struct timespec end;
+	uint64_t usecs;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	usecs = (uint64_t)(end.tv_sec - start->tv_sec) * 1000000 +
+		end.tv_nsec / 1000 - start->tv_nsec / 1000;
+	if (usecs == 0) {
+		usecs = 1;
+	}
+	warnx("%s: %lld bytes in %llu.%06llu seconds, %llu KB/s", from,
+	      (long long)total,
+	      (unsigned long long)(usecs / 1000000),
+	      (unsigned long long)(usecs % 1000000),
+	      (unsigned long long)((uint64_t)total * 1000000 / 1024 / usecs));
+}
 
 /* Copy one file to another. */
 static
 void
-copy(const char *from, const char *to)
+copy(const char *from, const char *to, int verbose)
 {
+	struct stat fromst, tost;
+	struct timespec start;
 	int fromfd;
 	int tofd;
-	char buf[1024];
-	int len, wr, wrtot;
+	ssize_t len;
+	off_t total = 0;
+	size_t size;
 
 	/*
 	 * Open the files, and give up if they won't open
@@ -57,32 +162,38 @@ copy(const char *from, const char *to)
 	if (tofd<0) {
 		err(1, "%s", to);
 	}
+	if (fstat(fromfd, &fromst) < 0) {
+		err(1, "%s: fstat", from);
+	}
+	if (fstat(tofd, &tost) < 0) {
+		err(1, "%s: fstat", to);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
 
 	/*
+	 * Let the kernel copy the data, without bringing it out here.
 	 * As long as we get more than zero bytes, we haven't hit EOF.
 	 * Zero means EOF. Less than zero means an error occurred.
-	 * We may read less than we asked for, though, in various cases
-	 * for various reasons.
+	 * We may get less than we asked for, though, in various cases
+	 * for various reasons, so loop until we're done.
 	 */
-	while ((len = read(fromfd, buf, sizeof(buf)))>0) {
-		/*
-		 * Likewise, we may actually write less than we attempted
-		 * to. So loop until we're done.
-		 */
-		wrtot = 0;
-		while (wrtot < len) {
-			wr = write(tofd, buf+wrtot, len-wrtot);
-			if (wr<0) {
-				err(1, "%s", to);
-			}
-			wrtot += wr;
-		}
+	size = sendsize(&fromst);
+	while ((len = sendfile(tofd, fromfd, NULL, size))>0) {
+		total += len;
 	}
 	/*
-	 * If we got a read error, print it and exit.
+	 * If there's no sendfile, do it the old way; otherwise, if we
+	 * got an error, print it and exit.
 	 */
+	if (len<0 && errno == ENOSYS && total == 0) {
+		total = copybuf(fromfd, tofd, bufsize(&fromst, &tost));
+		len = total < 0 ? -1 : 0;
+	}
 	if (len<0) {
-		err(1, "%s", from);
+		err(1, "%s to %s", from, to);
+	}
+	if (verbose) {
+		report(from, total, &start);
 	}
 
 	if (close(fromfd) < 0) {
@@ -97,6 +208,8 @@ copy(const char *from, const char *to)
 int
 main(int argc, char *argv[])
 {
+	int verbose = 0;
+
 	/*
 	 * Just do it.
 	 *
@@ -105,9 +218,14 @@ main(int argc, char *argv[])
 	 *
 	 * although this would be pretty easy to add.
 	 */
+	if (argc==4 && !strcmp(argv[1], "-v")) {
+		verbose = 1;
+		argc--;
+		argv++;
+	}
 	if (argc!=3) {
-		errx(1, "Usage: cp OLDFILE NEWFILE");
+		errx(1, "Usage: cp [-v] OLDFILE NEWFILE");
 	}
-	copy(argv[1], argv[2]);
+	copy(argv[1], argv[2], verbose);
 	return 0;
 }
@@ -29,9 +29,11 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <dirent.h>
 #include <errno.h>
 #include <err.h>
 
@@ -92,21 +94,60 @@ int
 isdir(const char *path)
 {
 	struct stat buf;
-	int fd;
 
-	/* Assume stat() may not be implemented; use fstat */
-	fd = open(path, O_RDONLY);
-	if (fd<0) {
+	if (stat(path, &buf)<0) {
 		err(1, "%s", path);
 	}
-	if (fstat(fd, &buf)<0) {
-		err(1, "%s: fstat", path);
-	}
-	close(fd);
 
 	return S_ISDIR(buf.st_mode);
 }
 
+/*
+ * An open directory, read a bufferful of entries at a time.
+ */
+struct dir {
+	const char *path;
+	int fd;
+	int pos, len;			/* what's left in buf */
+	uint32_t buf[1024];		/* (uint32_t to align the records) */
+};
+
+static
+void
+dir_open(struct dir *d, const char *path)
+{
+	d->path = path;
+	d->fd = open(path, O_RDONLY);
+	if (d->fd<0) {
+		err(1, "%s", path);
+	}
+	d->pos = d->len = 0;
+}
+
+/*
+ * Get the next entry, or NULL at the end of the directory.
+ */
+static
+struct dirent *
+dir_next(struct dir *d)
+{
+	struct dirent *ent;
+
+	if (d->pos >= d->len) {
+		d->len = getdents(d->fd, d->buf, sizeof(d->buf));
+		if (d->len<0) {
+			err(1, "%s: getdents", d->path);
+		}
+		d->pos = 0;
+		if (d->len == 0) {
+			return NULL;
+		}
+	}
+	ent = (struct dirent *)((char *)d->buf + d->pos);
+	d->pos += ent->d_reclen;
+	return ent;
+}
+
 /*
  * When listing one of several subdirectories, show the name of the
  * directory.
@@ -139,16 +180,9 @@ print(const char *path)
 	int typech;
 
 	if (lopt || sopt) {
-		int fd;
-
-		fd = open(path, O_RDONLY);
-		if (fd<0) {
+		if (lstat(path, &statbuf)<0) {
 			err(1, "%s", path);
 		}
-		if (fstat(fd, &statbuf)<0) {
-			err(1, "%s: fstat", path);
-		}
-		close(fd);
 	}
 
 	file = basename(path);
@@ -192,10 +226,9 @@ static
 void
 listdir(const char *path, int showheader)
 {
-	int fd;
-	char buf[1024];
+	struct dir d;
+	struct dirent *ent;
 	char newpath[1024];
-	ssize_t len;
 
 	if (showheader) {
 		printheader(path);
@@ -204,70 +237,58 @@ listdir(const char *path, int showheader)
 	/*
 	 * Open it.
 	 */
-	fd = open(path, O_RDONLY);
-	if (fd<0) {
-		err(1, "%s", path);
-	}
+	dir_open(&d, path);
 
 	/*
 	 * List the directory.
 	 */
-	while ((len = getdirentry(fd, buf, sizeof(buf)-1)) > 0) {
-		buf[len] = 0;
-
+	while ((ent = dir_next(&d)) != NULL) {
 		/* Assemble the full name of the new item */
-		snprintf(newpath, sizeof(newpath), "%s/%s", path, buf);
+		snprintf(newpath, sizeof(newpath), "%s/%s", path, ent->d_name);
 
-		if (aopt || buf[0]!='.') {
+		if (aopt || ent->d_name[0]!='.') {
 			/* Print it */
 			print(newpath);
 		}
 	}
-	if (len<0) {
-		err(1, "%s: getdirentry", path);
-	}
 
 	/* Done */
-	close(fd);
+	close(d.fd);
 }
 
 static
 void
 recursedir(const char *path)
 {
-	int fd;
-	char buf[1024];
+	struct dir d;
+	struct dirent *ent;
 	char newpath[1024];
-	int len;
 
 	/*
 	 * Open it.
 	 */
-	fd = open(path, O_RDONLY);
-	if (fd<0) {
-		err(1, "%s", path);
-	}
+	dir_open(&d, path);
 
 	/*
 	 * List the directory.
 	 */
-	while ((len = getdirentry(fd, buf, sizeof(buf)-1)) > 0) {
-		buf[len] = 0;
-
+	while ((ent = dir_next(&d)) != NULL) {
 		/* Assemble the full name of the new item */
-		snprintf(newpath, sizeof(newpath), "%s/%s", path, buf);
+		snprintf(newpath, sizeof(newpath), "%s/%s", path, ent->d_name);
 
-		if (!aopt && buf[0]=='.') {
+		if (!aopt && ent->d_name[0]=='.') {
 			/* skip this one */
 			continue;
 		}
 
-		if (!strcmp(buf, ".") || !strcmp(buf, "..")) {
+		if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..")) {
 			/* always skip these */
 			continue;
 		}
 
-		if (!isdir(newpath)) {
+		/* Only stat it if the filesystem didn't say what it is */
+		if (ent->d_type == DT_UNKNOWN ? !isdir(newpath) :
+		    ent->d_type != DT_DIR) {
 			continue;
 		}
 
@@ -276,11 +297,8 @@ recursedir(const char *path)
 			recursedir(newpath);
 		}
 	}
-	if (len<0) {
-		err(1, "%s", path);
-	}
 
-	close(fd);
+	close(d.fd);
 }
 
 static
@@ -37,6 +37,7 @@
 
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <assert.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -48,6 +49,8 @@
 
 #ifdef HOST
 #include "hostcompat.h"
+#else
+#include <poll.h>
 #endif
 
 #ifndef NARG_MAX
@@ -58,6 +61,13 @@
 /* avoid making this unreasonably large; causes problems under dumbvm */
 #define CMDLINE_MAX 4096
 
+/* most commands in one pipeline */
+#define MAXPIPELINE 16
+
+/* startcmd: leave the nice value alone; nice's default increment */
+#define NICE_INHERIT (PRIO_MIN - 1)
+#define NICE_DEFAULT 10
+
 /* struct to (portably) hold exit info */
 struct exitinfo {
 	unsigned val:8,
@@ -69,27 +79,50 @@ struct exitinfo {
 /* set to nonzero if __time syscall seems to work */
 static int timing = 0;
 
-/* array of backgrounded jobs (allows "foregrounding") */
-#define MAXBG 128
-static pid_t bgpids[MAXBG];
+/* table of backgrounded jobs (allows "foregrounding"), grown as needed */
+#define BGCHUNK 16
+static pid_t *bgpids;
+static int maxbg;
+
+#ifndef HOST
+/* child-exit descriptor, opened close-on-exec by waitpoll (-1 until then) */
+static int childevents = -1;
+#endif
 
 /*
  * can_bg
- * just checks for an open slot.
+ * makes sure there are n open slots, growing the table if need be. fails
+ * only if we run out of memory.
  */
 static
 int
-can_bg(void)
+can_bg(int n)
 {
-	int i;
+	pid_t *newpids;
+	int i, newmax;
 
-	for (i = 0; i < MAXBG; i++) {
+	for (i = 0; i < maxbg && n > 0; i++) {
 		if (bgpids[i] == 0) {
-			return 1;
+			n--;
 		}
 	}
+	if (n == 0) {
+		return 1;
+	}
 
-	return 0;
+	/* no realloc in our libc */
+	newmax = maxbg + (n + BGCHUNK - 1) / BGCHUNK * BGCHUNK;
+	newpids = malloc(newmax * sizeof(pid_t));
+	if (newpids == NULL) {
+		return 0;
+	}
+	for (i = 0; i < newmax; i++) {
+		newpids[i] = i < maxbg ? bgpids[i] : 0;
+	}
+	free(bgpids);
+	bgpids = newpids;
+	maxbg = newmax;
+	return 1;
 }
 
 /*
@@ -102,7 +135,7 @@ void
 remember_bg(pid_t pid)
 {
 	int i;
-	for (i = 0; i < MAXBG; i++) {
+	for (i = 0; i < maxbg; i++) {
 		if (bgpids[i] == 0) {
 			bgpids[i] = pid;
 			return;
@@ -209,48 +242,107 @@ dowait(pid_t pid)
 	}
 }
 
-#ifdef WNOHANG
 /*
- * dowaitpoll
- * like dowait, but uses WNOHANG. returns true if we got something.
+ * reportbg
+ * if pid is a background job, which has exited with status, says so and
+ * forgets it.
  */
 static
-int
-dowaitpoll(pid_t pid)
+void
+reportbg(pid_t pid, int status)
 {
 	struct exitinfo ei;
-	pid_t foundpid;
-	int status;
+	int i;
 
-	foundpid = waitpid(pid, &status, WNOHANG);
-	if (foundpid < 0) {
-		warn("pid %d", pid);
+	for (i = 0; i < maxbg; i++) {
+		if (bgpids[i] == pid) {
+			bgpids[i] = 0;
+			printf("pid %d: ", pid);
+			readstatus(status, &ei);
+			printstatus(&ei, 1);
+			return;
+		}
 	}
-	else if (foundpid != 0) {
-		printf("pid %d: ", pid);
-		readstatus(status, &ei);
-		printstatus(&ei, 1);
-		return 1;
+}
+
+/*
+ * waitstages
+ * waits for the n commands of a foreground pipeline, taking them in whatever
+ * order they exit, so that none is left a zombie until the ones before it are
+ * done. the status is that of the last one. background jobs that exit in the
+ * meantime are reported and forgotten, as in waitpoll.
+ */
+static
+void
+waitstages(pid_t *pids, int n, struct exitinfo *ei)
+{
+	int left, status, i;
+	pid_t pid;
+
+	for (left = n; left > 0; ) {
+		pid = waitpid(WAIT_ANY, &status, 0);
+		if (pid < 0) {
+			warn("waitpid");
+			exitinfo_exit(ei, 255);
+			return;
+		}
+		for (i = 0; i < n; i++) {
+			if (pids[i] == pid) {
+				break;
+			}
+		}
+		if (i < n) {
+			pids[i] = 0;
+			left--;
+			if (i == n - 1) {
+				readstatus(status, ei);
+			}
+			continue;
+		}
+		reportbg(pid, status);
 	}
-	return 0;
 }
 
+#ifdef WNOHANG
 /*
  * waitpoll
- * poll all background jobs for having exited.
+ * collect whichever background jobs have exited, without waiting for the
+ * rest. where there is a child-exit descriptor, only bother once it says
+ * that some child has, so that with nothing to collect this is one poll
+ * no matter how many jobs are running.
  */
 static
 void
 waitpoll(void)
 {
-	int i;
-	for (i=0; i < MAXBG; i++) {
-		if (bgpids[i] != 0) {
-			if (dowaitpoll(bgpids[i])) {
-				bgpids[i] = 0;
-			}
+	pid_t pid;
+	int status;
+#ifndef HOST
+	struct pollfd pfd;
+
+	if (childevents < 0) {
+		childevents = childfd();
+		if (childevents >= 0 &&
+		    fcntl(childevents, F_SETFD, FD_CLOEXEC) < 0) {
+			/* the children would inherit it; do without */
+			close(childevents);
+			childevents = -1;
 		}
 	}
+	if (childevents >= 0) {
+		pfd.fd = childevents;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, 0) >= 0 && (pfd.revents & POLLIN) == 0) {
+			return;
+		}
+	}
+#endif
+	while ((pid = waitpid(WAIT_ANY, &status, WNOHANG)) > 0) {
+		reportbg(pid, status);
+	}
+	if (pid < 0 && errno != ECHILD) {
+		warn("waitpid");
+	}
 }
 #endif /* WNOHANG */
 
@@ -270,7 +362,7 @@ cmd_wait(int ac, char *av[], struct exitinfo *ei)
 	if (ac == 2) {
 		pid = atoi(av[1]);
 		dowait(pid);
-		for (i = 0; i < MAXBG; i++) {
+		for (i = 0; i < maxbg; i++) {
 			if (bgpids[i]==pid) {
 				bgpids[i] = 0;
 			}
@@ -279,7 +371,7 @@ cmd_wait(int ac, char *av[], struct exitinfo *ei)
 		return;
 	}
 	else if (ac == 1) {
-		for (i=0; i < MAXBG; i++) {
+		for (i=0; i < maxbg; i++) {
 			if (bgpids[i] != 0) {
 				dowait(bgpids[i]);
 				bgpids[i] = 0;
@@ -340,6 +432,180 @@ cmd_exit(int ac, char *av[], struct exitinfo *ei)
 	exit(code);
 }
 
+#ifndef HOST
+/*
+ * command location cache
+ * remembers where on the search path each command run without a '/' was
+ * found, so that running it again takes one spawn rather than one failed
+ * spawn for each directory ahead of its own. an entry is dropped when
+ * spawning its path fails, and cmd_hash lists or forgets them. commands
+ * found through a relative directory in PATH aren't remembered, since
+ * where those are depends on the current directory.
+ */
+#define CMDHASH_SIZE 64
+
+struct cmdhash {
+	struct cmdhash *ch_next;
+	const char *ch_name;		/* last component of ch_path */
+	unsigned ch_hits;
+	char ch_path[];
+};
+static struct cmdhash *cmdhash[CMDHASH_SIZE];
+
+/* the link to the entry for name, or the NULL ending its chain */
+static
+struct cmdhash **
+cmdhash_find(const char *name)
+{
+	struct cmdhash **chp;
+	unsigned h = 0;
+	const char *s;
+
+	for (s = name; *s; s++) {
+		h = h * 33 + (unsigned char)*s;
+	}
+	for (chp = &cmdhash[h % CMDHASH_SIZE]; *chp; chp = &(*chp)->ch_next) {
+		if (!strcmp((*chp)->ch_name, name)) {
+			break;
+		}
+	}
+	return chp;
+}
+
+/* puts path at chp, the end of a chain; quietly doesn't without memory */
+static
+void
+cmdhash_add(struct cmdhash **chp, const char *path)
+{
+	struct cmdhash *ch;
+	size_t len;
+
+	len = strlen(path);
+	ch = malloc(sizeof(*ch) + len + 1);
+	if (ch == NULL) {
+		return;
+	}
+	memcpy(ch->ch_path, path, len + 1);
+	ch->ch_name = strrchr(ch->ch_path, '/') + 1;
+	ch->ch_hits = 1;
+	ch->ch_next = NULL;
+	*chp = ch;
+}
+
+/* the errors that mean the program isn't there (any more) */
+static
+int
+notfound(int err)
+{
+	return err == ENOENT || err == ENOTDIR || err == ENOEXEC;
+}
+
+/*
+ * spawncmd
+ * like spawnvp, but looks in the cache first, and adds to it what it had
+ * to search the path for.
+ */
+static
+pid_t
+spawncmd(char **args, const struct spawn_action *actions, int nactions)
+{
+	const char *searchpath, *s, *t;
+	char progpath[PATH_MAX];
+	struct cmdhash **chp, *ch;
+	size_t len;
+	pid_t pid;
+
+	if (strchr(args[0], '/') != NULL) {
+		return spawn(args[0], args, actions, nactions);
+	}
+
+	chp = cmdhash_find(args[0]);
+	ch = *chp;
+	if (ch != NULL) {
+		pid = spawn(ch->ch_path, args, actions, nactions);
+		if (pid >= 0) {
+			ch->ch_hits++;
+			return pid;
+		}
+		if (!notfound(errno)) {
+			return -1;
+		}
+		/* it went away; forget it and look again */
+		*chp = ch->ch_next;
+		free(ch);
+	}
+
+	searchpath = getenv("PATH");
+	if (searchpath == NULL) {
+		errno = ENOENT;
+		return -1;
+	}
+	for (s = searchpath; s != NULL; s = t) {
+		t = strchr(s, ':');
+		if (t != NULL) {
+			len = t - s;
+			t++;
+		}
+		else {
+			len = strlen(s);
+		}
+		if (len == 0 || len >= sizeof(progpath)) {
+			continue;
+		}
+		memcpy(progpath, s, len);
+		snprintf(progpath + len, sizeof(progpath) - len, "/%s", args[0]);
+		pid = spawn(progpath, args, actions, nactions);
+		if (pid >= 0) {
+			if (progpath[0] == '/') {
+				cmdhash_add(cmdhash_find(args[0]), progpath);
+			}
+			return pid;
+		}
+		if (!notfound(errno)) {
+			return -1;
+		}
+	}
+	errno = ENOENT;
+	return -1;
+}
+
+/*
+ * hash
+ * lists the cached command locations, with how many times each was used,
+ * or with -r forgets them all (say, after installing a program earlier on
+ * the path than one already found).
+ */
+static
+void
+cmd_hash(int ac, char *av[], struct exitinfo *ei)
+{
+	struct cmdhash *ch;
+	int i;
+
+	if (ac == 1) {
+		for (i = 0; i < CMDHASH_SIZE; i++) {
+			for (ch = cmdhash[i]; ch; ch = ch->ch_next) {
+				printf("%6u  %s\n", ch->ch_hits, ch->ch_path);
+			}
+		}
+		exitinfo_exit(ei, 0);
+		return;
+	}
+	else if (ac == 2 && !strcmp(av[1], "-r")) {
+		for (i = 0; i < CMDHASH_SIZE; i++) {
+			while ((ch = cmdhash[i]) != NULL) {
+				cmdhash[i] = ch->ch_next;
+				free(ch);
+			}
+		}
+		exitinfo_exit(ei, 0);
+		return;
+	}
+	printf("Usage: hash [-r]\n");
+	exitinfo_exit(ei, 1);
+}
+#endif /* !HOST */
+
 /*
  * a struct of the builtins associates the builtin name with the function that
  * executes it.  they must all take an argc and argv.
@@ -351,26 +617,188 @@ static struct {
 	{ "cd",    cmd_chdir },
 	{ "chdir", cmd_chdir },
 	{ "exit",  cmd_exit },
+#ifndef HOST
+	{ "hash",  cmd_hash },
+#endif
 	{ "wait",  cmd_wait },
 	{ NULL, NULL }
 };
 
+/*
+ * startcmd
+ * runs args[0] in a new process, with infd and outfd (when not -1) as its
+ * standard input and output instead of ours, with closefd (the other end
+ * of the pipe it writes to, if any) closed, and at nice value nice unless
+ * that is NICE_INHERIT. returns the pid, or -1 after saying why not.
+ */
+static
+pid_t
+startcmd(char **args, int infd, int outfd, int closefd, int nice)
+{
+	pid_t pid;
+#ifdef HOST
+	pid = fork();
+	switch (pid) {
+		case -1:
+			/* error */
+			warn("fork");
+			return -1;
+		case 0:
+			/* child */
+			if (infd >= 0) {
+				dup2(infd, STDIN_FILENO);
+				close(infd);
+			}
+			if (outfd >= 0) {
+				dup2(outfd, STDOUT_FILENO);
+				close(outfd);
+			}
+			if (closefd >= 0) {
+				close(closefd);
+			}
+			if (nice != NICE_INHERIT) {
+				setpriority(PRIO_PROCESS, 0, nice);
+			}
+			execvp(args[0], args);
+			warn("%s", args[0]);
+			/*
+			 * Use _exit() instead of exit() in the child
+			 * process to avoid calling atexit() functions,
+			 * which would cause hostcompat (if present) to
+			 * reset the tty state and mess up our input
+			 * handling.
+			 */
+			_exit(1);
+		default:
+			break;
+	}
+#else
+	struct spawn_action actions[6];
+	int nactions = 0;
+
+	if (infd >= 0) {
+		actions[nactions].sa_op = SPAWN_DUP2;
+		actions[nactions].sa_fd = infd;
+		actions[nactions].sa_newfd = STDIN_FILENO;
+		nactions++;
+		actions[nactions].sa_op = SPAWN_CLOSE;
+		actions[nactions].sa_fd = infd;
+		nactions++;
+	}
+	if (outfd >= 0) {
+		actions[nactions].sa_op = SPAWN_DUP2;
+		actions[nactions].sa_fd = outfd;
+		actions[nactions].sa_newfd = STDOUT_FILENO;
+		nactions++;
+		actions[nactions].sa_op = SPAWN_CLOSE;
+		actions[nactions].sa_fd = outfd;
+		nactions++;
+	}
+	if (closefd >= 0) {
+		actions[nactions].sa_op = SPAWN_CLOSE;
+		actions[nactions].sa_fd = closefd;
+		nactions++;
+	}
+	if (nice != NICE_INHERIT) {
+		actions[nactions].sa_op = SPAWN_NICE;
+		actions[nactions].sa_fd = nice;
+		nactions++;
+	}
+
+	/*
+	 * Start the program in a new process directly, rather than
+	 * fork() and execvp(): the kernel then never copies our
+	 * address space only to throw it away in the child.
+	 */
+	pid = spawncmd(args, actions, nactions);
+	if (pid < 0) {
+		warn("%s", args[0]);
+		return -1;
+	}
+#endif
+	return pid;
+}
+
+/*
+ * getnice
+ * handles a leading "nice [-n increment]", taking it off the command line
+ * of nargs words in args. returns the nice value the command is to run at,
+ * NICE_INHERIT if there was no nice, or PRIO_MIN - 2 after saying what's
+ * wrong (a bare "nice" prints the shell's own nice value, like nice(1)).
+ */
+static
+int
+getnice(char **args, int *nargs)
+{
+	int incr = NICE_DEFAULT, cur, skip = 1, sign = 1, ndigits, i;
+	const char *s;
+
+	if (strcmp(args[0], "nice") != 0) {
+		return NICE_INHERIT;
+	}
+	if (*nargs >= 2 && !strcmp(args[1], "-n")) {
+		s = *nargs >= 3 ? args[2] : "";
+		if (*s == '-' || *s == '+') {
+			sign = *s++ == '-' ? -1 : 1;
+		}
+		/* the kernel clamps it; just keep it from overflowing */
+		incr = ndigits = 0;
+		for (; *s >= '0' && *s <= '9'; s++, ndigits++) {
+			if (incr <= PRIO_MAX - PRIO_MIN) {
+				incr = incr * 10 + (*s - '0');
+			}
+		}
+		if (*s != '\0' || ndigits == 0) {
+			printf("Usage: nice [-n increment] command\n");
+			return PRIO_MIN - 2;
+		}
+		incr *= sign;
+		skip = 3;
+	}
+
+	errno = 0;
+	cur = getpriority(PRIO_PROCESS, 0);
+	if (cur == -1 && errno != 0) {
+		cur = 0;
+	}
+	if (*nargs == skip) {
+		if (skip == 1) {
+			printf("%d\n", cur);
+		}
+		else {
+			printf("Usage: nice [-n increment] command\n");
+		}
+		return PRIO_MIN - 2;
+	}
+
+	for (i = skip; i <= *nargs; i++) {
+		args[i - skip] = args[i];
+	}
+	*nargs -= skip;
+
+	cur += incr;
+	return cur < PRIO_MIN ? PRIO_MIN : cur > PRIO_MAX ? PRIO_MAX : cur;
+}
+
 /*
  * docommand
  * tokenizes the command line using strtok.  if there aren't any commands,
- * simply returns.  checks to see if it's a builtin, running it if it is.
- * otherwise, it's a standard command.  check for the '&', try to background
- * the job if possible, otherwise just run it and wait on it.
+ * simply returns.  a leading "nice" runs the rest at another nice value (see
+ * getnice).  checks to see if it's a builtin, running it if it is.
+ * otherwise, it's a standard command, or a pipeline of them separated by
+ * '|'.  check for the '&', try to background the job if possible, otherwise
+ * just run it and wait on it.
  */
 static
 void
 docommand(char *buf, struct exitinfo *ei)
 {
 	char *args[NARG_MAX + 1];
-	int nargs, i;
+	char **cmds[MAXPIPELINE];
+	pid_t pids[MAXPIPELINE];
+	int nargs, ncmds, nstarted, i, nice;
+	int fds[2], infd;
 	char *s;
-	pid_t pid;
-	int status;
 	int bg=0;
 	time_t startsecs, endsecs;
 	unsigned long startnsecs, endnsecs;
@@ -394,18 +822,42 @@ docommand(char *buf, struct exitinfo *ei)
 		return;
 	}
 
-	for (i=0; builtins[i].name; i++) {
-		if (!strcmp(builtins[i].name, args[0])) {
-			builtins[i].func(nargs, args, ei);
-			return;
+	nice = getnice(args, &nargs);
+	if (nice < NICE_INHERIT) {
+		exitinfo_exit(ei, nargs == 1 ? 0 : 1);
+		return;
+	}
+
+	/* split at each "|" into the commands of the pipeline */
+	ncmds = 1;
+	cmds[0] = args;
+	for (i=0; i<nargs; i++) {
+		if (!strcmp(args[i], "|")) {
+			if (ncmds >= MAXPIPELINE) {
+				printf("%s: Too many commands in pipeline\n",
+				       args[0]);
+				exitinfo_exit(ei, 1);
+				return;
+			}
+			args[i] = NULL;
+			cmds[ncmds++] = &args[i+1];
+		}
+	}
+
+	if (ncmds == 1 && nice == NICE_INHERIT) {
+		for (i=0; builtins[i].name; i++) {
+			if (!strcmp(builtins[i].name, args[0])) {
+				builtins[i].func(nargs, args, ei);
+				return;
+			}
 		}
 	}
 
 	/* Not a builtin; run it */
 
-	if (nargs > 0 && !strcmp(args[nargs-1], "&")) {
+	if (args[nargs-1] != NULL && !strcmp(args[nargs-1], "&")) {
 		/* background */
-		if (!can_bg()) {
+		if (!can_bg(ncmds)) {
 			printf("%s: Too many background jobs; wait for "
 			       "some to finish before starting more\n",
 			       args[0]);
@@ -417,48 +869,63 @@ docommand(char *buf, struct exitinfo *ei)
 		bg = 1;
 	}
 
+	for (i=0; i<ncmds; i++) {
+		if (cmds[i][0] == NULL) {
+			printf("sh: Missing command in pipeline\n");
+			exitinfo_exit(ei, 1);
+			return;
+		}
+	}
+
 	if (timing) {
 		__time(&startsecs, &startnsecs);
 	}
 
-	pid = fork();
-	switch (pid) {
-		case -1:
-			/* error */
-			warn("fork");
-			exitinfo_exit(ei, 255);
-			return;
-		case 0:
-			/* child */
-			execvp(args[0], args);
-			warn("%s", args[0]);
-			/*
-			 * Use _exit() instead of exit() in the child
-			 * process to avoid calling atexit() functions,
-			 * which would cause hostcompat (if present) to
-			 * reset the tty state and mess up our input
-			 * handling.
-			 */
-			_exit(1);
-		default:
+	/*
+	 * Start the commands left to right, each reading the pipe the
+	 * one before writes to. We close our copies of the pipe ends as
+	 * soon as they've been handed on, so that each reader sees EOF
+	 * when its writer exits.
+	 */
+	infd = -1;
+	for (nstarted = 0; nstarted < ncmds; nstarted++) {
+		fds[0] = fds[1] = -1;
+		if (nstarted < ncmds - 1 && pipe(fds) < 0) {
+			warn("pipe");
 			break;
+		}
+		pids[nstarted] = startcmd(cmds[nstarted], infd, fds[1],
+					  fds[0], nice);
+		if (infd >= 0) {
+			close(infd);
+		}
+		if (fds[1] >= 0) {
+			close(fds[1]);
+		}
+		infd = fds[0];
+		if (pids[nstarted] < 0) {
+			break;
+		}
+	}
+	if (infd >= 0) {
+		close(infd);
 	}
 
 	/* parent */
 	if (bg) {
-		/* background this command */
-		remember_bg(pid);
-		printf("[%d] %s ... &\n", pid, args[0]);
-		exitinfo_exit(ei, 0);
+		/* background these commands */
+		for (i=0; i<nstarted; i++) {
+			remember_bg(pids[i]);
+			printf("[%d] %s ... &\n", pids[i], cmds[i][0]);
+		}
+		exitinfo_exit(ei, nstarted < ncmds ? 1 : 0);
 		return;
 	}
 
-	if (waitpid(pid, &status, 0) < 0) {
-		warn("waitpid");
-		exitinfo_exit(ei, 255);
-	}
-	else {
-		readstatus(status, ei);
+	/* the status of a pipeline is that of its last command */
+	waitstages(pids, nstarted, ei);
+	if (nstarted < ncmds) {
+		exitinfo_exit(ei, 1);
 	}
 
 	if (timing) {
@@ -491,6 +958,33 @@ getcmd(char *buf, size_t len)
 	size_t pos = 0;
 	int done=0, ch;
 
+	/* stdout is line-buffered; get the prompt out before waiting */
+	fflush(stdout);
+
+#ifdef CONIOC_SETMODE
+	/*
+	 * If the console has a line discipline, let it assemble and
+	 * edit the line and hand it over in one read. Put it back in
+	 * raw mode for the command, which may want keystrokes.
+	 */
+	int mode = CONMODE_CANON;
+	ssize_t r;
+
+	if (ioctl(STDIN_FILENO, CONIOC_SETMODE, &mode) == 0) {
+		r = read(STDIN_FILENO, buf, len-1);
+		mode = CONMODE_RAW;
+		ioctl(STDIN_FILENO, CONIOC_SETMODE, &mode);
+		if (r < 0) {
+			r = 0;
+		}
+		if (r > 0 && buf[r-1] == '\n') {
+			r--;
+		}
+		buf[r] = 0;
+		return;
+	}
+#endif
+
 	/*
 	 * In the absence of a <ctype.h>, assume input is 7-bit ASCII.
 	 */
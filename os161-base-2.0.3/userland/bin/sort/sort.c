@@ -0,0 +1,670 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+
+/*
+ * sort - sort lines of text, in parallel.
+ * Usage: sort [-nr] [-j jobs] [-o outfile] [files]
+ *    -n   Compare the numbers at the start of the lines, not the text.
+ *    -r   Reverse the order.
+ *    -j   Sort with this many processes (default: one per cpu).
+ *    -o   Write to OUTFILE, which may be one of the inputs.
+ *
+ * All the input is read into one MAP_SHARED|MAP_ANON mapping, and the
+ * lines are pointed to from an array in another, so the processes
+ * forked afterwards all work on the same memory. The array is cut
+ * into one slice per job, and each job sorts its own. The sorted runs
+ * are then merged pairwise, in rounds, back and forth between the
+ * array and a second one as large. Each merge is split among several
+ * jobs, by binary search for where each one's share of the output
+ * starts, so all the jobs stay busy down to the last merge.
+ *
+ * The sort is stable: lines that compare equal stay in input order.
+ * Inputs too small to be worth forking for are sorted by one process.
+ *
+ * This program uses these system calls:
+ *    open read write close fstat mmap fork waitpid _exit
+ */
+
+#define MAXJOBS   32		/* most processes to sort with */
+#define MINLINES  4096		/* fewest lines per job worth forking for */
+#define INSERTION 16		/* runs this short are insertion sorted */
+#define CHUNKSIZE (64*1024)	/* reads from pipes and devices */
+#define OUTSIZE   (64*1024)	/* output buffer */
+#define MAXINPUT  0x40000000	/* more than a process can map anyway */
+
+/* Input from something other than a regular file, as it was read. */
+struct chunk {
+	struct chunk *next;
+	size_t len;
+	char data[CHUNKSIZE];
+};
+
+struct input {
+	const char *name;
+	int fd;			/* open until loaded, if a regular file */
+	off_t size;		/* ...and its size */
+	struct chunk *chunks;	/* otherwise, what was read */
+};
+
+static int nopt=0;
+static int ropt=0;
+
+/* The lines, and room to merge them into. */
+static char **lines, **other;
+static size_t nlines;
+
+/* The current round: runs of SRC to sort or merge into DST. */
+static char **src, **dst;
+static size_t runstart[MAXJOBS + 1];
+static unsigned nruns;
+static unsigned parts;		/* jobs per merge */
+
+////////////////////////////////////////////////////////////
+// comparison
+
+/*
+ * Skip to the significant digits of the number at the start of S
+ * (blanks, an optional minus sign, then digits), and say how many
+ * there are and whether the number is negative. No digits is zero.
+ */
+static
+const char *
+number(const char *s, int *neg, size_t *len)
+{
+	size_t n;
+
+	while (*s == ' ' || *s == '\t') {
+		s++;
+	}
+	*neg = (*s == '-');
+	if (*neg) {
+		s++;
+	}
+	while (*s == '0') {
+		s++;
+	}
+	for (n = 0; s[n] >= '0' && s[n] <= '9'; n++);
+	*len = n;
+	if (n == 0) {
+		*neg = 0;
+	}
+	return s;
+}
+
+/*
+ * Compare numbers by their digit strings, so any length works.
+ */
+static
+int
+numcmp(const char *a, const char *b)
+{
+	size_t la, lb;
+	int nega, negb, r;
+
+	a = number(a, &nega, &la);
+	b = number(b, &negb, &lb);
+	if (nega != negb) {
+		return nega ? -1 : 1;
+	}
+	if (la != lb) {
+		r = la < lb ? -1 : 1;
+	}
+	else {
+		r = memcmp(a, b, la);
+	}
+	return nega ? -r : r;
+}
+
+/*
+ * Compare two newline-terminated lines byte by byte; a line that is
+ * the start of another sorts first.
+ */
+static
+int
+textcmp(const char *a, const char *b)
+{
+	while (*a == *b && *a != '\n') {
+		a++;
+		b++;
+	}
+	if (*a == *b) {
+		return 0;
+	}
+	if (*a == '\n') {
+		return -1;
+	}
+	if (*b == '\n') {
+		return 1;
+	}
+	return (unsigned char)*a - (unsigned char)*b;
+}
+
+static
+int
+compare(const char *a, const char *b)
+{
+	int r = 0;
+
+	if (nopt) {
+		r = numcmp(a, b);
+	}
+	if (r == 0) {
+		r = textcmp(a, b);
+	}
+	return ropt ? -r : r;
+}
+
+////////////////////////////////////////////////////////////
+// sorting and merging
+
+/*
+ * Merge A[0..NA) and B[0..NB) into OUT. Ties go to A, which keeps the
+ * sort stable.
+ */
+static
+void
+merge(char **a, size_t na, char **b, size_t nb, char **out)
+{
+	while (na > 0 && nb > 0) {
+		if (compare(*b, *a) < 0) {
+			*out++ = *b++;
+			nb--;
+		}
+		else {
+			*out++ = *a++;
+			na--;
+		}
+	}
+	while (na-- > 0) {
+		*out++ = *a++;
+	}
+	while (nb-- > 0) {
+		*out++ = *b++;
+	}
+}
+
+/*
+ * How many of the first D lines of the merge of A[0..NA) and B[0..NB)
+ * come from A (the rest are from B).
+ */
+static
+size_t
+split(char **a, size_t na, char **b, size_t nb, size_t d)
+{
+	size_t lo, hi, mid;
+
+	lo = d > nb ? d - nb : 0;
+	hi = d < na ? d : na;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (compare(b[d - mid - 1], a[mid]) < 0) {
+			hi = mid;
+		}
+		else {
+			lo = mid + 1;
+		}
+	}
+	return lo;
+}
+
+/*
+ * Merge sort V[0..N) in place, with SCRATCH as large.
+ */
+static
+void
+msort(char **v, char **scratch, size_t n)
+{
+	size_t half, i, j;
+	char *t;
+
+	if (n <= INSERTION) {
+		for (i = 1; i < n; i++) {
+			t = v[i];
+			for (j = i; j > 0 && compare(t, v[j - 1]) < 0; j--) {
+				v[j] = v[j - 1];
+			}
+			v[j] = t;
+		}
+		return;
+	}
+
+	half = n / 2;
+	msort(v, scratch, half);
+	msort(v + half, scratch + half, n - half);
+	if (compare(v[half], v[half - 1]) >= 0) {
+		/* already in order, as in presorted input */
+		return;
+	}
+	merge(v, half, v + half, n - half, scratch);
+	memcpy(v, scratch, n * sizeof(*v));
+}
+
+/* Job JOB of the first round: sort run JOB of SRC in place. */
+static
+void
+sortrun(unsigned job)
+{
+	size_t s = runstart[job];
+
+	msort(src + s, dst + s, runstart[job + 1] - s);
+}
+
+/*
+ * Job JOB of a merge round: its share of merging a pair of runs of
+ * SRC into DST. An odd run out is its own pair, and just copied.
+ */
+static
+void
+mergepart(unsigned job)
+{
+	unsigned pair = job / parts, part = job % parts;
+	size_t base, na, nb, n, d0, d1, i0, i1;
+	char **a, **b;
+
+	base = runstart[2 * pair];
+	a = src + base;
+	na = runstart[2 * pair + 1] - base;
+	if (2 * pair + 1 < nruns) {
+		b = src + runstart[2 * pair + 1];
+		nb = runstart[2 * pair + 2] - runstart[2 * pair + 1];
+	}
+	else {
+		b = NULL;
+		nb = 0;
+	}
+	n = na + nb;
+	d0 = (uint64_t)n * part / parts;
+	d1 = (uint64_t)n * (part + 1) / parts;
+	i0 = split(a, na, b, nb, d0);
+	i1 = split(a, na, b, nb, d1);
+	merge(a + i0, i1 - i0, b + (d0 - i0), (d1 - i1) - (d0 - i0),
+	      dst + base + d0);
+}
+
+/*
+ * Run FUNC for jobs 0 to NJOBS-1, each in a process of its own, except
+ * for the last, which we do ourselves; then wait for all of them. If
+ * we can't fork, we do the job ourselves too.
+ */
+static
+void
+runjobs(void (*func)(unsigned), unsigned njobs)
+{
+	pid_t pids[MAXJOBS];
+	unsigned i;
+	int status;
+
+	for (i = 0; i < njobs - 1; i++) {
+		pids[i] = fork();
+		if (pids[i] == 0) {
+			func(i);
+			_exit(0);
+		}
+		if (pids[i] < 0) {
+			func(i);
+		}
+	}
+	func(njobs - 1);
+
+	for (i = 0; i < njobs - 1; i++) {
+		if (pids[i] < 0) {
+			continue;
+		}
+		if (waitpid(pids[i], &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			errx(1, "Sort process %u failed", i);
+		}
+	}
+}
+
+/*
+ * Sort LINES with NJOBS processes; returns the array the result ends
+ * up in.
+ */
+static
+char **
+sortall(unsigned njobs)
+{
+	unsigned i, npairs;
+	char **t;
+
+	src = lines;
+	dst = other;
+	nruns = njobs;
+	for (i = 0; i <= nruns; i++) {
+		runstart[i] = (uint64_t)nlines * i / nruns;
+	}
+	runjobs(sortrun, nruns);
+
+	while (nruns > 1) {
+		npairs = (nruns + 1) / 2;
+		parts = njobs / npairs;
+		runjobs(mergepart, npairs * parts);
+
+		for (i = 0; i < npairs; i++) {
+			runstart[i] = runstart[2 * i];
+		}
+		runstart[npairs] = nlines;
+		nruns = npairs;
+		t = src;
+		src = dst;
+		dst = t;
+	}
+	return src;
+}
+
+////////////////////////////////////////////////////////////
+// input and output
+
+static
+void *
+getshared(size_t len)
+{
+	void *p;
+
+	p = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANON, -1, 0);
+	if (p == MAP_FAILED) {
+		err(1, "mmap of %zu bytes", len);
+	}
+	return p;
+}
+
+/*
+ * Open an input and find out how big it is. Regular files are read
+ * later, straight into place; anything else has to be read now.
+ */
+static
+void
+openinput(struct input *in)
+{
+	struct chunk *c, **tail;
+	struct stat st;
+	ssize_t r;
+
+	if (!strcmp(in->name, "-")) {
+		in->fd = STDIN_FILENO;
+	}
+	else {
+		in->fd = open(in->name, O_RDONLY);
+		if (in->fd < 0) {
+			err(1, "%s", in->name);
+		}
+	}
+	in->size = 0;
+	in->chunks = NULL;
+	if (fstat(in->fd, &st) == 0 && S_ISREG(st.st_mode)) {
+		in->size = st.st_size;
+		return;
+	}
+
+	tail = &in->chunks;
+	do {
+		c = malloc(sizeof(struct chunk));
+		if (c == NULL) {
+			errx(1, "Out of memory");
+		}
+		r = read(in->fd, c->data, sizeof(c->data));
+		if (r < 0) {
+			err(1, "%s: read", in->name);
+		}
+		c->len = r;
+		c->next = NULL;
+		*tail = c;
+		tail = &c->next;
+		in->size += r;
+	} while (r > 0);
+	if (in->fd != STDIN_FILENO) {
+		close(in->fd);
+	}
+	in->fd = -1;
+}
+
+/*
+ * Put all of an input at P, ending it with a newline if it doesn't
+ * have one; returns how many bytes that took.
+ */
+static
+size_t
+loadinput(struct input *in, char *p)
+{
+	struct chunk *c;
+	size_t len;
+	ssize_t r;
+
+	len = 0;
+	if (in->fd >= 0) {
+		while (len < (size_t)in->size) {
+			r = read(in->fd, p + len, in->size - len);
+			if (r < 0) {
+				err(1, "%s: read", in->name);
+			}
+			if (r == 0) {
+				/* it got shorter */
+				break;
+			}
+			len += r;
+		}
+		if (in->fd != STDIN_FILENO) {
+			close(in->fd);
+		}
+	}
+	while (in->chunks != NULL) {
+		c = in->chunks;
+		in->chunks = c->next;
+		memcpy(p + len, c->data, c->len);
+		len += c->len;
+		free(c);
+	}
+	if (len > 0 && p[len - 1] != '\n') {
+		p[len++] = '\n';
+	}
+	return len;
+}
+
+static
+void
+dowrite(int fd, const char *name, const char *buf, size_t len)
+{
+	ssize_t r;
+
+	while (len > 0) {
+		r = write(fd, buf, len);
+		if (r < 0) {
+			err(1, "%s: write", name);
+		}
+		buf += r;
+		len -= r;
+	}
+}
+
+static
+void
+output(int fd, const char *name, char **v, size_t n)
+{
+	static char buf[OUTSIZE];
+	size_t i, pos, len;
+
+	pos = 0;
+	for (i = 0; i < n; i++) {
+		for (len = 1; v[i][len - 1] != '\n'; len++);
+		if (len > sizeof(buf) - pos) {
+			dowrite(fd, name, buf, pos);
+			pos = 0;
+		}
+		if (len > sizeof(buf)) {
+			dowrite(fd, name, v[i], len);
+			continue;
+		}
+		memcpy(buf + pos, v[i], len);
+		pos += len;
+	}
+	dowrite(fd, name, buf, pos);
+}
+
+////////////////////////////////////////////////////////////
+
+static
+void
+usage(void)
+{
+	errx(1, "Usage: sort [-nr] [-j jobs] [-o outfile] [files]");
+}
+
+int
+main(int argc, char *argv[])
+{
+	static struct input stdinput = { "-", -1, 0, NULL };
+	struct input *inputs;
+	const char *outname = NULL;
+	char *data, *s, *end, **v;
+	unsigned njobs;
+	size_t total;
+	int ninputs, j, k, fd;
+
+	njobs = ncpus();
+	for (j = 1; j < argc && argv[j][0] == '-' && argv[j][1] != 0; j++) {
+		if (!strcmp(argv[j], "--")) {
+			j++;
+			break;
+		}
+		for (k = 1; argv[j][k] != 0; k++) {
+			switch (argv[j][k]) {
+			    case 'n': nopt = 1; break;
+			    case 'r': ropt = 1; break;
+			    case 'j':
+			    case 'o':
+				if (argv[j][k + 1] != 0 || j + 1 >= argc) {
+					usage();
+				}
+				if (argv[j][k] == 'j') {
+					njobs = atoi(argv[++j]);
+				}
+				else {
+					outname = argv[++j];
+				}
+				goto nextarg;
+			    default:
+				usage();
+			}
+		}
+	nextarg: ;
+	}
+	if (njobs < 1) {
+		njobs = 1;
+	}
+	if (njobs > MAXJOBS) {
+		njobs = MAXJOBS;
+	}
+
+	/* Find out how big everything is, then read it all in */
+	ninputs = argc - j;
+	if (ninputs == 0) {
+		inputs = &stdinput;
+		ninputs = 1;
+	}
+	else {
+		inputs = malloc(ninputs * sizeof(struct input));
+		if (inputs == NULL) {
+			errx(1, "Out of memory");
+		}
+		for (k = 0; k < ninputs; k++) {
+			inputs[k].name = argv[j + k];
+		}
+	}
+	total = 0;
+	for (k = 0; k < ninputs; k++) {
+		openinput(&inputs[k]);
+		if (total + inputs[k].size + 1 > MAXINPUT) {
+			errx(1, "%s: Too much input", inputs[k].name);
+		}
+		total += inputs[k].size + 1;
+	}
+	data = getshared(total);
+	total = 0;
+	for (k = 0; k < ninputs; k++) {
+		total += loadinput(&inputs[k], data + total);
+	}
+
+	nlines = 0;
+	for (s = data, end = data + total; s < end; s++) {
+		if (*s == '\n') {
+			nlines++;
+		}
+	}
+
+	/* Only now, as the output may be one of the inputs */
+	if (outname != NULL) {
+		fd = open(outname, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+		if (fd < 0) {
+			err(1, "%s", outname);
+		}
+	}
+	else {
+		outname = "stdout";
+		fd = STDOUT_FILENO;
+	}
+	if (nlines == 0) {
+		return 0;
+	}
+
+	lines = getshared(nlines * sizeof(char *));
+	other = getshared(nlines * sizeof(char *));
+	v = lines;
+	*v++ = data;
+	for (s = data; s < end - 1; s++) {
+		if (*s == '\n') {
+			*v++ = s + 1;
+		}
+	}
+
+	if (njobs > nlines / MINLINES) {
+		njobs = nlines / MINLINES;
+		if (njobs < 1) {
+			njobs = 1;
+		}
+	}
+	output(fd, outname, sortall(njobs), nlines);
+	if (fd != STDOUT_FILENO) {
+		close(fd);
+	}
+	return 0;
+}
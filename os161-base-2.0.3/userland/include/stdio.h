@@ -41,6 +41,27 @@
 /* Constant returned by a bunch of stdio functions on error */
 #define EOF (-1)
 
+/* Size of the buffers of the standard streams */
+#define BUFSIZ 1024
+
+/*
+ * The standard streams (see libc's stdio/streams.c for how they are
+ * buffered). There is no fopen or fprintf; fflush is all that takes
+ * them.
+ */
+typedef struct __file FILE;
+extern FILE *stdin, *stdout, *stderr;
+
+/* Write out what is buffered for output, on f or (if NULL) on all. */
+int fflush(FILE *f);
+
+/*
+ * Buffered output to stdout and input from stdin, like write and read
+ * (for libc internal use only)
+ */
+int __stdout_write(const char *data, size_t len);
+int __stdin_read(char *buf, size_t len);
+
 /*
  * The actual guts of printf
  * (for libc internal use only)
@@ -78,8 +78,16 @@ void free(void *ptr);
 
 /*
  * Sort.
+ *
+ * psort is qsort for large arrays: it sorts with up to NJOBS forked
+ * processes (0 means one per cpu) over shared memory, and merges
+ * their results. Small arrays are just sorted with qsort. It returns
+ * 0, or -1 with errno set if a process failed, in which case DATA is
+ * left as it was.
  */
 void qsort(void *data, unsigned num, size_t size,
 	   int (*f)(const void *, const void *));
+int psort(void *data, unsigned num, size_t size,
+	  int (*f)(const void *, const void *), unsigned njobs);
 
 #endif /* _STDLIB_H_ */
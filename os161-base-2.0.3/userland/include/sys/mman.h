@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SYS_MMAN_H_
+#define _SYS_MMAN_H_
+
+/*
+ * Get the PROT_*, MAP_*, MS_* and MADV_* flags from the kernel.
+ */
+#include <sys/types.h>
+#include <kern/mman.h>
+
+/* What mmap returns on failure. */
+#define MAP_FAILED ((void *)-1)
+
+/*
+ * Map LEN bytes of the file open on FD, starting at the page-aligned
+ * OFFSET, at an address picked by the kernel (ADDR is only a hint,
+ * and OS/161 ignores it). FLAGS is one of MAP_SHARED and MAP_PRIVATE;
+ * MAP_FIXED is not supported. Pages of a shared mapping go back to
+ * the file on msync, munmap or exit. Note that read and write do not
+ * see stores to a mapping until then.
+ *
+ * With MAP_ANON added to FLAGS there is no file, FD and OFFSET are
+ * ignored, and the pages start out zero-filled. A MAP_SHARED|MAP_ANON
+ * mapping is shared with the children forked after it is made, which
+ * is how related processes share memory.
+ */
+void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset);
+int munmap(void *addr, size_t len);
+int msync(void *addr, size_t len, int flags);
+
+/*
+ * Say how the pages from ADDR (page-aligned) to ADDR+LEN will be used:
+ * MADV_SEQUENTIAL and MADV_RANDOM set how far a mapped file is read
+ * ahead on page faults, MADV_WILLNEED starts reading it in, and
+ * MADV_DONTNEED makes the pages the first to go when memory is short.
+ * Nothing is discarded.
+ */
+int madvise(void *addr, size_t len, int advice);
+
+#endif /* _SYS_MMAN_H_ */
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SYS_SHM_H_
+#define _SYS_SHM_H_
+
+/*
+ * Get the IPC_* and SHM_* flags from the kernel.
+ */
+#include <sys/types.h>
+#include <kern/shm.h>
+
+/*
+ * System V-style shared memory. shmget hands back the ID of the
+ * segment with key KEY, of at least SIZE bytes: with IPC_CREAT in
+ * FLAGS it is made if there is none (and with IPC_EXCL too, there
+ * must be none), and IPC_PRIVATE always makes a new one. Its pages
+ * start out zero-filled.
+ *
+ * shmat attaches segment ID at an address picked by the kernel (ADDR
+ * is ignored, as with mmap), read-only with SHM_RDONLY in FLAGS, and
+ * returns that address, or (void *)-1 on failure. Every process it is
+ * attached to sees the same pages. Segments stay attached in children
+ * across fork. shmdt detaches the segment at ADDR; exec and exit
+ * detach them all. A segment goes away when it is detached for the
+ * last time, so keys cannot be used to keep memory around with nobody
+ * attached.
+ */
+int shmget(int key, size_t size, int flags);
+void *shmat(int id, const void *addr, int flags);
+int shmdt(const void *addr);
+
+#endif /* _SYS_SHM_H_ */
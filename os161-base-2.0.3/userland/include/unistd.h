@@ -40,8 +40,10 @@
  */
 #include <kern/fcntl.h>
 #include <kern/ioctl.h>
+#include <kern/iovec.h>
 #include <kern/reboot.h>
 #include <kern/seek.h>
+#include <kern/spawn.h>
 #include <kern/time.h>
 #include <kern/unistd.h>
 #include <kern/wait.h>
@@ -68,6 +70,8 @@
  *     remove:   stdio.h
  *     rename:   stdio.h
  *     time:     time.h
+ *     readv:    sys/uio.h
+ *     writev:   sys/uio.h
  *
  * Also note that the prototypes for open() and mkdir() contain, for
  * compatibility with Unix, an extra argument that is not meaningful
@@ -110,8 +114,8 @@
 
 /* Required. */
 __DEAD void _exit(int code);
-int execv(const char *prog, char *const *args);
-pid_t fork(void);
+int __execv(const char *prog, char *const *args);
+pid_t __fork(void);
 pid_t waitpid(pid_t pid, int *returncode, int flags);
 /*
  * Open actually takes either two or three args: the optional third
@@ -129,10 +133,13 @@ int rmdir(const char *dirname);
 
 /* Recommended. */
 pid_t getpid(void);
+pid_t getppid(void);
 int ioctl(int filehandle, int code, void *buf);
 off_t lseek(int filehandle, off_t pos, int code);
 int fsync(int filehandle);
 int ftruncate(int filehandle, off_t size);
+int fpunch(int filehandle, off_t pos, off_t len);
+int posix_fadvise(int filehandle, off_t pos, off_t len, int advice);
 int remove(const char *filename);
 int rename(const char *oldfile, const char *newfile);
 int link(const char *oldfile, const char *newfile);
@@ -145,9 +152,32 @@ ssize_t getdirentry(int filehandle, char *buf, size_t buflen);
 int symlink(const char *target, const char *linkname);
 ssize_t readlink(const char *path, char *buf, size_t buflen);
 int dup2(int filehandle, int newhandle);
+int fcntl(int filehandle, int cmd, ...);
 int pipe(int filehandles[2]);
 int __time(time_t *seconds, unsigned long *nanoseconds);
+int nanosleep(const struct timespec *req, struct timespec *rem);
 ssize_t __getcwd(char *buf, size_t buflen);
+ssize_t readv(int filehandle, const struct iovec *iov, int iovcnt);
+ssize_t writev(int filehandle, const struct iovec *iov, int iovcnt);
+ssize_t pread(int filehandle, void *buf, size_t size, off_t pos);
+ssize_t pwrite(int filehandle, const void *buf, size_t size, off_t pos);
+ssize_t sendfile(int outhandle, int inhandle, off_t *pos, size_t size);
+int sem_op(int semhandle, int delta);
+int childfd(void);
+pid_t __spawn(const char *prog, char *const *args,
+	      const struct spawn_action *actions, int nactions);
+int checkpoint(const char *path);
+int restore(const char *path);
+int __thread_create(void (*entry)(void *, void *), void *arg0, void *arg1,
+		    void *stacktop);
+int __thread_join(int tid, int *status);
+__DEAD void __thread_exit(int status);
+int sched_setaffinity(pid_t pid, unsigned mask);
+int sched_getaffinity(pid_t pid, unsigned *mask);
+int sched_yield(void);
+int __futex_wait(volatile int *uaddr, int val);
+int __futex_wake(volatile int *uaddr, int n);
+int clock_gettime(int clockid, struct timespec *ts);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
@@ -155,8 +185,19 @@ ssize_t __getcwd(char *buf, size_t buflen);
  * These are not themselves system calls, but wrapper routines in libc.
  */
 
+int execv(const char *prog, char *const *args);	/* flushes stdio, calls __execv */
+pid_t fork(void);				/* flushes stdio, calls __fork */
+pid_t spawn(const char *prog, char *const *args,
+	    const struct spawn_action *actions, int nactions); /* flushes stdio, calls __spawn */
 int execvp(const char *prog, char *const *args); /* calls execv */
+pid_t spawnvp(const char *prog, char *const *args,
+	      const struct spawn_action *actions, int nactions); /* calls spawn */
 char *getcwd(char *buf, size_t buflen);		/* calls __getcwd */
-time_t time(time_t *seconds);			/* calls __time */
+time_t time(time_t *seconds);			/* reads the kinfo page, or calls __time */
+int ncpus(void);				/* reads the kinfo page */
+int thread_create(int (*func)(void *), void *arg,
+		  void *stack, size_t stacksize);	/* calls __thread_create */
+int thread_join(int tid, int *status);		/* calls __thread_join */
+__DEAD void thread_exit(int status);		/* calls __thread_exit */
 
 #endif /* _UNISTD_H_ */
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _UTHREAD_H_
+#define _UTHREAD_H_
+
+#include <sys/cdefs.h>
+#include <sys/null.h>
+#include <stdbool.h>
+
+/*
+ * User-level threads (libuthread, link with -luthread).
+ *
+ * uthreads are cheap: creating one takes a stack off a free list, and
+ * switching between them is a setjmp and a longjmp, with no system
+ * call, so a program can have thousands. They are multiplexed over a
+ * few kernel threads (workers), each with a run queue of its own;
+ * a worker that runs out of uthreads steals from the others, and
+ * sleeps on a futex when there is nothing to steal.
+ *
+ * uthread_main runs FUNC(ARG) as the first uthread on NWORKERS
+ * workers (0 means one per cpu), the calling thread being one of
+ * them, and returns once every uthread has exited. One uthread_main
+ * may run at a time. The other calls are for use from uthreads.
+ *
+ * uthread_create starts FUNC(ARG) in a new uthread: a joinable one,
+ * put in *RET, or if RET is NULL one that is cleaned up as soon as
+ * it exits. uthread_join waits for a joinable uthread to exit, and
+ * then cleans it up; each one must be joined exactly once. Returning
+ * from FUNC is the same as calling uthread_exit. uthread_yield lets
+ * the other uthreads run.
+ *
+ * Mutexes and condition variables block only the uthread, not its
+ * worker, which goes on to run others; their usual rules apply.
+ * A system call that blocks, though, blocks the worker with it.
+ *
+ * Stacks are UTHREAD_STACKSIZE bytes, less the uthread's own state,
+ * and are not checked for overflow except by the occasional assert.
+ */
+
+#define UTHREAD_STACKSIZE  (16*1024)	/* a power of 2 */
+
+struct uthread;		/* Opaque. */
+
+struct uthread_mutex {
+	volatile int um_spin;
+	bool um_held;
+	struct uthread *um_head, *um_tail;	/* waiters */
+};
+
+struct uthread_cond {
+	volatile int uc_spin;
+	struct uthread *uc_head, *uc_tail;	/* waiters */
+};
+
+#define UTHREAD_MUTEX_INITIALIZER	{ 0, false, NULL, NULL }
+#define UTHREAD_COND_INITIALIZER	{ 0, NULL, NULL }
+
+int uthread_main(void (*func)(void *), void *arg, unsigned nworkers);
+
+int uthread_create(struct uthread **ret, void (*func)(void *), void *arg);
+int uthread_join(struct uthread *t);
+__DEAD void uthread_exit(void);
+void uthread_yield(void);
+struct uthread *uthread_self(void);
+
+void uthread_mutex_init(struct uthread_mutex *m);
+void uthread_mutex_lock(struct uthread_mutex *m);
+void uthread_mutex_unlock(struct uthread_mutex *m);
+
+void uthread_cond_init(struct uthread_cond *c);
+void uthread_cond_wait(struct uthread_cond *c, struct uthread_mutex *m);
+void uthread_cond_signal(struct uthread_cond *c);
+void uthread_cond_broadcast(struct uthread_cond *c);
+
+#endif /* _UTHREAD_H_ */
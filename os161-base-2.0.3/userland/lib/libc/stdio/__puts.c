@@ -29,7 +29,6 @@
 
 #include <stdio.h>
 #include <string.h>
-#include <unistd.h>
 
 /*
  * Nonstandard (hence the __) version of puts that doesn't append
@@ -42,10 +41,10 @@ int
 __puts(const char *str)
 {
 	size_t len;
-	ssize_t ret;
+	int ret;
 
 	len = strlen(str);
-	ret = write(STDOUT_FILENO, str, len);
+	ret = __stdout_write(str, len);
 	if (ret == -1) {
 		return EOF;
 	}
@@ -28,7 +28,6 @@
  */
 
 #include <stdio.h>
-#include <unistd.h>
 
 /*
  * C standard I/O function - read character from stdin
@@ -41,7 +40,7 @@ getchar(void)
 	char ch;
 	int len;
 
-	len = read(STDIN_FILENO, &ch, 1);
+	len = __stdin_read(&ch, 1);
 	if (len<=0) {
 		/* end of file or error */
 		return EOF;
@@ -29,7 +29,6 @@
 
 #include <stdio.h>
 #include <stdarg.h>
-#include <unistd.h>
 #include <errno.h>
 
 /*
@@ -44,10 +43,10 @@ static
 void
 __printf_send(void *mydata, const char *data, size_t len)
 {
-	ssize_t ret;
+	int ret;
 	int *err = mydata;
 
-	ret = write(STDOUT_FILENO, data, len);
+	ret = __stdout_write(data, len);
 	*err = (ret == -1) ? errno : 0;
 }
 
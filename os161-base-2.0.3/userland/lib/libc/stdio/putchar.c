@@ -28,13 +28,9 @@
  */
 
 #include <stdio.h>
-#include <unistd.h>
 
 /*
  * C standard function - print a single character.
- *
- * Properly, stdio is supposed to be buffered, but for present purposes
- * writing that code is not really worthwhile.
  */
 
 int
@@ -42,7 +38,7 @@ putchar(int ch)
 {
 	char c = ch;
 	int len;
-	len = write(STDOUT_FILENO, &c, 1);
+	len = __stdout_write(&c, 1);
 	if (len<=0) {
 		return EOF;
 	}
@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+/*
+ * The standard streams.
+ *
+ * stdout is buffered: a line at a time if it's a character device
+ * (that is, the console), BUFSIZ bytes at a time otherwise. stdin is
+ * buffered BUFSIZ bytes at a time too, unless it's a character
+ * device: the console doesn't finish a read in raw mode until it has
+ * a newline or all it was asked for, so a program that wants one
+ * keystroke has to ask for one. Before waiting for input, a line-
+ * buffered stdout is flushed, so that a prompt shows up first. stderr
+ * isn't buffered at all.
+ *
+ * What is waiting to be written is flushed by exit(), and by fork()
+ * and execv() (unix/forkexec.c), so that it neither comes out twice
+ * nor gets lost. _exit() and abort() drop it.
+ *
+ * Like malloc, this is not safe to call from several threads at once.
+ */
+
+#define F_UNKNOWN	0	/* not looked at yet */
+#define F_UNBUF		1	/* unbuffered */
+#define F_LINEBUF	2	/* output flushed at each newline */
+#define F_FULLBUF	3	/* flushed when the buffer is full */
+
+struct __file {
+	int f_fd;
+	int f_mode;		/* F_* */
+	size_t f_pos;		/* input: next byte of f_buf to hand out */
+	size_t f_len;		/* bytes in f_buf */
+	char *f_buf;		/* BUFSIZ bytes, or NULL if unbuffered */
+};
+
+static char inbuf[BUFSIZ], outbuf[BUFSIZ];
+static FILE files[3] = {
+	{ STDIN_FILENO,  F_UNKNOWN, 0, 0, inbuf },
+	{ STDOUT_FILENO, F_UNKNOWN, 0, 0, outbuf },
+	{ STDERR_FILENO, F_UNBUF,   0, 0, NULL },
+};
+
+FILE *stdin = &files[0];
+FILE *stdout = &files[1];
+FILE *stderr = &files[2];
+
+/*
+ * Pick the buffering of stdin or stdout the first time it's used.
+ */
+static
+void
+setmode(FILE *f)
+{
+	struct stat st;
+	int chr;
+
+	chr = fstat(f->f_fd, &st) == 0 && S_ISCHR(st.st_mode);
+	if (f == stdout) {
+		f->f_mode = chr ? F_LINEBUF : F_FULLBUF;
+	}
+	else {
+		f->f_mode = chr ? F_UNBUF : F_FULLBUF;
+	}
+}
+
+/*
+ * Write out len bytes to fd, however many writes it takes. Returns 0 or
+ * an error code.
+ */
+static
+int
+writeall(int fd, const char *data, size_t len)
+{
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = write(fd, data, len);
+		if (ret < 0) {
+			return errno;
+		}
+		if (ret == 0) {
+			return EIO;
+		}
+		data += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+/*
+ * Write out what stdout has buffered. On error it is dropped, so that
+ * the next write doesn't fail over it again.
+ */
+static
+int
+flushout(void)
+{
+	int err;
+
+	err = writeall(stdout->f_fd, stdout->f_buf, stdout->f_len);
+	stdout->f_len = 0;
+	return err;
+}
+
+/*
+ * Write to stdout through the buffer, like write(): returns len or,
+ * setting errno, -1.
+ * (for printf, putchar and __puts)
+ */
+int
+__stdout_write(const char *data, size_t len)
+{
+	size_t total = len, n, i;
+	int err = 0, newline = 0;
+
+	if (stdout->f_mode == F_UNKNOWN) {
+		setmode(stdout);
+	}
+
+	while (len > 0 && err == 0) {
+		if (stdout->f_len == 0 && len >= BUFSIZ) {
+			/* no point copying a big block in; send it along */
+			err = writeall(stdout->f_fd, data, len);
+			break;
+		}
+		n = BUFSIZ - stdout->f_len;
+		if (n > len) {
+			n = len;
+		}
+		for (i = 0; i < n; i++) {
+			newline |= data[i] == '\n';
+		}
+		memcpy(stdout->f_buf + stdout->f_len, data, n);
+		stdout->f_len += n;
+		data += n;
+		len -= n;
+		if (stdout->f_len == BUFSIZ) {
+			err = flushout();
+		}
+	}
+	if (err == 0 && newline && stdout->f_mode == F_LINEBUF &&
+	    stdout->f_len > 0) {
+		err = flushout();
+	}
+	if (err) {
+		errno = err;
+		return -1;
+	}
+	return total;
+}
+
+/*
+ * Read from stdin through the buffer, like read(): returns the number of
+ * bytes, 0 at end of file, or, setting errno, -1.
+ * (for getchar)
+ */
+int
+__stdin_read(char *buf, size_t len)
+{
+	ssize_t ret;
+	size_t n;
+
+	if (stdin->f_mode == F_UNKNOWN) {
+		setmode(stdin);
+	}
+	if (stdin->f_pos == stdin->f_len) {
+		/* about to wait: put out the prompt, if any */
+		if (stdout->f_mode == F_LINEBUF && stdout->f_len > 0) {
+			flushout();
+		}
+		if (stdin->f_mode == F_UNBUF) {
+			return read(stdin->f_fd, buf, len);
+		}
+		ret = read(stdin->f_fd, stdin->f_buf, BUFSIZ);
+		if (ret <= 0) {
+			return ret;
+		}
+		stdin->f_pos = 0;
+		stdin->f_len = ret;
+	}
+	n = stdin->f_len - stdin->f_pos;
+	if (n > len) {
+		n = len;
+	}
+	memcpy(buf, stdin->f_buf + stdin->f_pos, n);
+	stdin->f_pos += n;
+	return n;
+}
+
+/*
+ * C standard I/O function - write out what a stream has buffered, or,
+ * for NULL, what all of them have. Only stdout ever has anything.
+ * Returns 0, or EOF with errno set.
+ */
+int
+fflush(FILE *f)
+{
+	int err;
+
+	if (f != NULL && f != stdout) {
+		return 0;
+	}
+	err = flushout();
+	if (err) {
+		errno = err;
+		return EOF;
+	}
+	return 0;
+}
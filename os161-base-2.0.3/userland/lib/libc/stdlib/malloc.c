@@ -30,10 +30,18 @@
 /*
  * User-level malloc and free implementation.
  *
- * This is a basic first-fit allocator. It's intended to be simple and
- * easy to follow. It performs abysmally if the heap becomes larger than
- * physical memory. To get (much) better out-of-core performance, port
- * the kernel's malloc. :-)
+ * The heap is a sequence of blocks, each with a header giving the
+ * offsets to its neighbours, so free can coalesce with the blocks on
+ * either side in constant time. Adjacent free blocks are always
+ * merged.
+ *
+ * Free blocks are also kept on segregated free lists ("bins"), linked
+ * through their data area. Small sizes get one bin per size, so a
+ * request that has an exact fit is served from the head of a list;
+ * bigger sizes share one bin per power of two, searched best-fit. A
+ * bitmap of non-empty bins finds the next bin with something in it
+ * without looking at the empty ones. The heap is only grown with sbrk
+ * when no bin has a block big enough.
  */
 
 #include <stdlib.h>
@@ -150,9 +158,38 @@ static size_t __malloc_pagesize;
 ////////////////////////////////////////////////////////////
 
 /*
- * Static variables - the bottom and top addresses of the heap.
+ * Static variables - the bottom and top addresses of the heap, and
+ * the header of the highest block (NULL if the heap is empty).
  */
 static uintptr_t __heapbase, __heaptop;
+static struct mheader *__heaplast;
+
+/*
+ * Free lists.
+ *
+ * A free block's data area holds a struct mfree linking it into the
+ * bin for its size. Every block has room for one, as all blocks have
+ * at least MBLOCKSIZE bytes of data.
+ *
+ * Bin i < NSMALLBINS holds blocks of exactly (i+1)*MBLOCKSIZE bytes.
+ * Bin NSMALLBINS+k holds blocks of more than NSMALLBINS<<k blocks
+ * and at most NSMALLBINS<<(k+1), with the last bin taking everything
+ * bigger.
+ */
+struct mfree {
+	struct mheader *mf_next;
+	struct mheader *mf_prev;
+};
+
+#define M_FREE(mh)	((struct mfree *)M_DATA(mh))
+
+#define NSMALLBINS	64
+#define NLARGEBINS	24
+#define NBINS		(NSMALLBINS + NLARGEBINS)
+#define BINMAPWORDS	((NBINS + 31) / 32)
+
+static struct mheader *__malloc_bins[NBINS];
+static uint32_t __malloc_binmap[BINMAPWORDS];
 
 /*
  * Setup function.
@@ -175,6 +212,9 @@ __malloc_init(void)
 	if (1<<MBLOCKSHIFT != MBLOCKSIZE) {
 		errx(1, "malloc: Internal error - MBLOCKSHIFT wrong");
 	}
+	if (sizeof(struct mfree) > MBLOCKSIZE) {
+		errx(1, "malloc: Internal error - MBLOCKSIZE too small");
+	}
 
 	/* init should only be called once. */
 	if (__heapbase!=0 || __heaptop!=0) {
@@ -273,6 +313,147 @@ __malloc_dump(void)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Bin for a free block with SIZE bytes of data.
+ */
+static
+unsigned
+__malloc_binof(size_t size)
+{
+	size_t units = size >> MBLOCKSHIFT;
+	unsigned bin;
+
+	if (units <= NSMALLBINS) {
+		return units - 1;
+	}
+	bin = NSMALLBINS;
+	units = (units - 1) / (2*NSMALLBINS);
+	while (units > 0 && bin < NBINS - 1) {
+		units >>= 1;
+		bin++;
+	}
+	return bin;
+}
+
+/*
+ * Put a free block on its free list.
+ */
+static
+void
+__malloc_link(struct mheader *mh)
+{
+	unsigned bin = __malloc_binof(M_SIZE(mh));
+	struct mheader *head = __malloc_bins[bin];
+
+	M_FREE(mh)->mf_prev = NULL;
+	M_FREE(mh)->mf_next = head;
+	if (head != NULL) {
+		M_FREE(head)->mf_prev = mh;
+	}
+	__malloc_bins[bin] = mh;
+	__malloc_binmap[bin / 32] |= (uint32_t)1 << (bin % 32);
+}
+
+/*
+ * Take a free block off its free list.
+ */
+static
+void
+__malloc_unlink(struct mheader *mh)
+{
+	unsigned bin = __malloc_binof(M_SIZE(mh));
+	struct mfree *mf = M_FREE(mh);
+
+	if (mf->mf_prev != NULL) {
+		M_FREE(mf->mf_prev)->mf_next = mf->mf_next;
+	}
+	else {
+		if (__malloc_bins[bin] != mh) {
+			errx(1, "malloc: Heap corrupt; free block %p "
+			     "not on its list", M_DATA(mh));
+		}
+		__malloc_bins[bin] = mf->mf_next;
+		if (mf->mf_next == NULL) {
+			__malloc_binmap[bin / 32] &=
+				~((uint32_t)1 << (bin % 32));
+		}
+	}
+	if (mf->mf_next != NULL) {
+		M_FREE(mf->mf_next)->mf_prev = mf->mf_prev;
+	}
+}
+
+/*
+ * Return the first non-empty bin at or above BIN, or NBINS if none.
+ */
+static
+unsigned
+__malloc_nextbin(unsigned bin)
+{
+	unsigned word;
+	uint32_t bits;
+
+	word = bin / 32;
+	bits = __malloc_binmap[word] & ~(((uint32_t)1 << (bin % 32)) - 1);
+	while (bits == 0) {
+		if (++word == BINMAPWORDS) {
+			return NBINS;
+		}
+		bits = __malloc_binmap[word];
+	}
+	bin = word * 32;
+	while ((bits & 1) == 0) {
+		bits >>= 1;
+		bin++;
+	}
+	return bin;
+}
+
+/*
+ * Find a free block with at least SIZE bytes of data and take it off
+ * its list. Returns NULL if there isn't one.
+ */
+static
+struct mheader *
+__malloc_findfree(size_t size)
+{
+	struct mheader *mh, *best;
+	unsigned bin;
+
+	bin = __malloc_binof(size);
+	if (bin >= NSMALLBINS) {
+		/* Sizes in a big bin vary; take the best fit from it */
+		best = NULL;
+		for (mh = __malloc_bins[bin]; mh != NULL;
+		     mh = M_FREE(mh)->mf_next) {
+			if (M_SIZE(mh) >= size &&
+			    (best == NULL || M_SIZE(mh) < M_SIZE(best))) {
+				best = mh;
+			}
+		}
+		if (best != NULL) {
+			__malloc_unlink(best);
+			return best;
+		}
+		bin++;
+	}
+
+	/* Anything in a higher bin (or an exact small bin) is big enough */
+	bin = __malloc_nextbin(bin);
+	if (bin == NBINS) {
+		return NULL;
+	}
+	mh = __malloc_bins[bin];
+	if (!M_OK(mh) || mh->mh_inuse) {
+		errx(1, "malloc: Heap corrupt; bad block %p on free list",
+		     M_DATA(mh));
+	}
+	__malloc_unlink(mh);
+	return mh;
+}
+
+////////////////////////////////////////////////////////////
+
 /*
  * Get more memory (at the top of the heap) using sbrk, and
  * return a pointer to it.
@@ -301,7 +482,7 @@ __malloc_sbrk(size_t size)
 /*
  * Make a new (free) block from the block passed in, leaving size
  * bytes for data in the current block. size must be a multiple of
- * MBLOCKSIZE.
+ * MBLOCKSIZE. The new block goes on its free list.
  *
  * Only split if the excess space is at least twice the blocksize -
  * one blocksize to hold a header and one for data.
@@ -343,6 +524,12 @@ __malloc_split(struct mheader *mh, size_t size)
 	if (mhnext != (struct mheader *) __heaptop) {
 		mhnext->mh_prevblock = mhnew->mh_nextblock;
 	}
+	else {
+		__heaplast = mhnew;
+	}
+
+	/* The block above is in use, since free blocks are always merged */
+	__malloc_link(mhnew);
 }
 
 /*
@@ -352,8 +539,6 @@ void *
 malloc(size_t size)
 {
 	struct mheader *mh;
-	uintptr_t i;
-	size_t rightprevblock;
 	size_t morespace;
 	void *p;
 
@@ -372,42 +557,17 @@ malloc(size_t size)
 	__malloc_dump();
 #endif
 
-	/* Round size up to an integral number of blocks. */
-	size = ((size + MBLOCKSIZE - 1) & ~(size_t)(MBLOCKSIZE-1));
-
 	/*
-	 * First-fit search algorithm for available blocks.
-	 * Check to make sure the next/previous sizes all agree.
+	 * Round size up to an integral number of blocks, and to at
+	 * least one, so the block can hold a struct mfree once freed.
 	 */
-	rightprevblock = 0;
-	mh = NULL;
-	for (i=__heapbase; i<__heaptop; i += M_NEXTOFF(mh)) {
-		mh = (struct mheader *) i;
-		if (!M_OK(mh)) {
-			errx(1, "malloc: Heap corrupt; header at 0x%lx"
-			     " has bad magic bits",
-			     (unsigned long) i);
-		}
-		if (mh->mh_prevblock != rightprevblock) {
-			errx(1, "malloc: Heap corrupt; header at 0x%lx"
-			     " has bad previous-block size %lu "
-			     "(should be %lu)",
-			     (unsigned long) i,
-			     (unsigned long) mh->mh_prevblock << MBLOCKSHIFT,
-			     (unsigned long) rightprevblock << MBLOCKSHIFT);
-		}
-		rightprevblock = mh->mh_nextblock;
-
-		/* Can't allocate a block that's in use. */
-		if (mh->mh_inuse) {
-			continue;
-		}
-
-		/* Can't allocate a block that isn't big enough. */
-		if (M_SIZE(mh) < size) {
-			continue;
-		}
+	size = ((size + MBLOCKSIZE - 1) & ~(size_t)(MBLOCKSIZE-1));
+	if (size == 0) {
+		size = MBLOCKSIZE;
+	}
 
+	mh = __malloc_findfree(size);
+	if (mh != NULL) {
 		/* Try splitting block. */
 		__malloc_split(mh, size);
 
@@ -422,17 +582,14 @@ malloc(size_t size)
 #endif
 		return M_DATA(mh);
 	}
-	if (i!=__heaptop) {
-		errx(1, "malloc: Heap corrupt; ran off end");
-	}
 
 	/*
 	 * Didn't find anything. Expand the heap.
 	 *
-	 * If the heap is nonempty and the top block (the one mh is
-	 * left pointing to after the above loop) is free, we can
+	 * If the heap is nonempty and the top block is free, we can
 	 * expand it. Otherwise we need a new block.
 	 */
+	mh = __heaplast;
 	if (mh != NULL && !mh->mh_inuse) {
 		assert(size > M_SIZE(mh));
 		morespace = size - M_SIZE(mh);
@@ -451,18 +608,20 @@ malloc(size_t size)
 
 	if (mh != NULL && !mh->mh_inuse) {
 		/* update old header */
+		__malloc_unlink(mh);
 		mh->mh_nextblock = M_MKFIELD(M_NEXTOFF(mh) + morespace);
 		mh->mh_inuse = 1;
 	}
 	else {
 		/* fill out new header */
 		mh = p;
-		mh->mh_prevblock = rightprevblock;
+		mh->mh_prevblock = __heaplast ? __heaplast->mh_nextblock : 0;
 		mh->mh_magic1 = MMAGIC;
 		mh->mh_magic2 = MMAGIC;
 		mh->mh_pad = 0;
 		mh->mh_inuse = 1;
 		mh->mh_nextblock = M_MKFIELD(morespace);
+		__heaplast = mh;
 	}
 
 	/*
@@ -497,7 +656,8 @@ __malloc_deadbeef(void *ptr, size_t size)
 }
 
 /*
- * Attempt to merge two adjacent blocks (mh below mhnext).
+ * Attempt to merge two adjacent blocks (mh below mhnext). Neither
+ * may be on a free list.
  */
 static
 void
@@ -522,6 +682,9 @@ __malloc_trymerge(struct mheader *mh, struct mheader *mhnext)
 	if (mhnextnext != (struct mheader *)__heaptop) {
 		mhnextnext->mh_prevblock = mh->mh_nextblock;
 	}
+	else {
+		__heaplast = mh;
+	}
 
 	/* Deadbeef out the memory used by the now-obsolete header */
 	__malloc_deadbeef(mhnext, sizeof(struct mheader));
@@ -574,16 +737,24 @@ free(void *x)
 
 	/* Try merging with the block above (but not if we're at the top) */
 	mhnext = M_NEXT(mh);
-	if (mhnext != (struct mheader *)__heaptop) {
+	if (mhnext != (struct mheader *)__heaptop && !mhnext->mh_inuse) {
+		__malloc_unlink(mhnext);
 		__malloc_trymerge(mh, mhnext);
 	}
 
 	/* Try merging with the block below (but not if we're at the bottom) */
 	if (mh != (struct mheader *)__heapbase) {
 		mhprev = M_PREV(mh);
-		__malloc_trymerge(mhprev, mh);
+		if (!mhprev->mh_inuse) {
+			__malloc_unlink(mhprev);
+			__malloc_trymerge(mhprev, mh);
+			mh = mhprev;
+		}
 	}
 
+	/* Whatever we ended up with goes on its free list */
+	__malloc_link(mh);
+
 #ifdef MALLOCDEBUG
 	warnx("free: freed %p", x);
 	__malloc_dump();
@@ -0,0 +1,275 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+/*
+ * psort: qsort for large arrays, in parallel.
+ *
+ * The array is copied into a MAP_SHARED|MAP_ANON mapping, with room
+ * for a second copy, so the processes forked afterwards all work on
+ * the same memory. It is cut into one run per job and each job sorts
+ * its own with qsort. The sorted runs are then merged pairwise, in
+ * rounds, back and forth between the two copies; each merge is split
+ * among several jobs, by binary search for where each one's share of
+ * the output starts, so all the jobs stay busy down to the last merge.
+ * The result is copied back at the end, so if anything goes wrong the
+ * caller's array is left as it was. This is the same scheme as
+ * /bin/sort uses.
+ *
+ * Like qsort, the sort is not stable.
+ */
+
+#define MAXJOBS   32		/* most processes to sort with */
+#define MINELEMS  4096		/* fewest elements per job worth forking for */
+
+typedef int (*cmpfunc)(const void *, const void *);
+
+struct psort {
+	char *src, *dst;	/* this round: runs of SRC go into DST */
+	size_t size;		/* element size */
+	cmpfunc f;
+	unsigned runstart[MAXJOBS + 1];
+	unsigned nruns;
+	unsigned parts;		/* jobs per merge */
+};
+
+#define ELEM(p, i) ((p) + (size_t)(i) * ps->size)
+
+/*
+ * Merge A[0..NA) and B[0..NB) into OUT. Ties go to A.
+ */
+static
+void
+merge(const struct psort *ps, const char *a, unsigned na,
+      const char *b, unsigned nb, char *out)
+{
+	size_t size = ps->size;
+
+	while (na > 0 && nb > 0) {
+		if (ps->f(b, a) < 0) {
+			memcpy(out, b, size);
+			b += size;
+			nb--;
+		}
+		else {
+			memcpy(out, a, size);
+			a += size;
+			na--;
+		}
+		out += size;
+	}
+	memcpy(out, a, (size_t)na * size);
+	out += (size_t)na * size;
+	memcpy(out, b, (size_t)nb * size);
+}
+
+/*
+ * How many of the first D elements of the merge of A[0..NA) and
+ * B[0..NB) come from A (the rest are from B).
+ */
+static
+unsigned
+split(const struct psort *ps, const char *a, unsigned na,
+      const char *b, unsigned nb, unsigned d)
+{
+	unsigned lo, hi, mid;
+
+	lo = d > nb ? d - nb : 0;
+	hi = d < na ? d : na;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (ps->f(ELEM(b, d - mid - 1), ELEM(a, mid)) < 0) {
+			hi = mid;
+		}
+		else {
+			lo = mid + 1;
+		}
+	}
+	return lo;
+}
+
+/* Job JOB of the first round: sort run JOB of SRC in place. */
+static
+void
+sortrun(const struct psort *ps, unsigned job)
+{
+	unsigned s = ps->runstart[job];
+
+	qsort(ELEM(ps->src, s), ps->runstart[job + 1] - s, ps->size, ps->f);
+}
+
+/*
+ * Job JOB of a merge round: its share of merging a pair of runs of
+ * SRC into DST. An odd run out is its own pair, and just copied.
+ */
+static
+void
+mergepart(const struct psort *ps, unsigned job)
+{
+	unsigned pair = job / ps->parts, part = job % ps->parts;
+	unsigned base, na, nb, n, d0, d1, i0, i1;
+	const char *a, *b;
+
+	base = ps->runstart[2 * pair];
+	a = ELEM(ps->src, base);
+	na = ps->runstart[2 * pair + 1] - base;
+	if (2 * pair + 1 < ps->nruns) {
+		b = ELEM(ps->src, ps->runstart[2 * pair + 1]);
+		nb = ps->runstart[2 * pair + 2] - ps->runstart[2 * pair + 1];
+	}
+	else {
+		b = NULL;
+		nb = 0;
+	}
+	n = na + nb;
+	d0 = (uint64_t)n * part / ps->parts;
+	d1 = (uint64_t)n * (part + 1) / ps->parts;
+	i0 = split(ps, a, na, b, nb, d0);
+	i1 = split(ps, a, na, b, nb, d1);
+	merge(ps, ELEM(a, i0), i1 - i0, ELEM(b, d0 - i0),
+	      (d1 - i1) - (d0 - i0), ELEM(ps->dst, base + d0));
+}
+
+/*
+ * Run FUNC for jobs 0 to NJOBS-1, each in a process of its own, except
+ * for the last, which we do ourselves; then wait for all of them. If
+ * we can't fork, we do the job ourselves too. Returns -1 if a job's
+ * process failed (most likely it died in the comparison function).
+ */
+static
+int
+runjobs(const struct psort *ps,
+	void (*func)(const struct psort *, unsigned), unsigned njobs)
+{
+	pid_t pids[MAXJOBS];
+	unsigned i;
+	int status, ret = 0;
+
+	for (i = 0; i < njobs - 1; i++) {
+		pids[i] = fork();
+		if (pids[i] == 0) {
+			func(ps, i);
+			_exit(0);
+		}
+		if (pids[i] < 0) {
+			func(ps, i);
+		}
+	}
+	func(ps, njobs - 1);
+
+	for (i = 0; i < njobs - 1; i++) {
+		if (pids[i] < 0) {
+			continue;
+		}
+		if (waitpid(pids[i], &status, 0) < 0) {
+			ret = -1;
+		}
+		else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			errno = EIO;
+			ret = -1;
+		}
+	}
+	return ret;
+}
+
+int
+psort(void *data, unsigned num, size_t size,
+      int (*f)(const void *, const void *), unsigned njobs)
+{
+	struct psort ps;
+	size_t len;
+	unsigned i, npairs;
+	char *mem, *t;
+	int ret = 0, err;
+
+	if (njobs == 0) {
+		njobs = ncpus();
+	}
+	if (njobs > MAXJOBS) {
+		njobs = MAXJOBS;
+	}
+	if (njobs > num / MINELEMS) {
+		njobs = num / MINELEMS;
+	}
+	if (njobs <= 1 || size == 0 || (size_t)num > (size_t)-1 / 2 / size) {
+		qsort(data, num, size, f);
+		return 0;
+	}
+
+	len = (size_t)num * size;
+	mem = mmap(NULL, 2 * len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANON,
+		   -1, 0);
+	if (mem == MAP_FAILED) {
+		/* Not enough memory to do it in parallel; do it here */
+		qsort(data, num, size, f);
+		return 0;
+	}
+	memcpy(mem, data, len);
+
+	ps.src = mem;
+	ps.dst = mem + len;
+	ps.size = size;
+	ps.f = f;
+	ps.nruns = njobs;
+	for (i = 0; i <= ps.nruns; i++) {
+		ps.runstart[i] = (uint64_t)num * i / ps.nruns;
+	}
+	ret = runjobs(&ps, sortrun, ps.nruns);
+
+	while (ret == 0 && ps.nruns > 1) {
+		npairs = (ps.nruns + 1) / 2;
+		ps.parts = njobs / npairs;
+		ret = runjobs(&ps, mergepart, npairs * ps.parts);
+
+		for (i = 0; i < npairs; i++) {
+			ps.runstart[i] = ps.runstart[2 * i];
+		}
+		ps.runstart[npairs] = num;
+		ps.nruns = npairs;
+		t = ps.src;
+		ps.src = ps.dst;
+		ps.dst = t;
+	}
+
+	if (ret == 0) {
+		memcpy(data, ps.src, len);
+	}
+	err = errno;
+	munmap(mem, 2 * len);
+	errno = err;
+	return ret;
+}
@@ -27,119 +27,190 @@
  * SUCH DAMAGE.
  */
 
+#include <stdint.h>
 #include <stdlib.h>
-#include <string.h>
-#include <assert.h>
 
 /*
  * qsort() for OS/161, where it isn't in libc.
+ *
+ * This is an introsort: quicksort with the median of the first,
+ * middle, and last elements as the pivot, which switches to heapsort
+ * for any part that is taking more than 2*log2(n) levels to split,
+ * so the worst case is O(n log n) no matter the input. Parts of
+ * INSERTION elements or fewer are left to an insertion sort, which
+ * is faster on those than more partitioning. Only O(log n) stack is
+ * used, by recursing on the smaller part and looping on the larger.
  */
-void
-qsort(void *vdata, unsigned num, size_t size,
-      int (*f)(const void *, const void *))
-{
-	unsigned pivot, head, tail;
-	char *data = vdata;
-	char tmp[size];
 
-#define COMPARE(aa, bb) \
-		((aa) == (bb) ? 0 : f(data + (aa) * size, data + (bb) * size))
-#define EXCHANGE(aa, bb) \
-		memcpy(tmp, data + (aa) * size, size);			\
-		memcpy(data + (aa) * size, data + (bb) * size, size);	\
-		memcpy(data + (bb) * size, tmp, size)
+#define INSERTION 12		/* parts this short are insertion sorted */
+
+typedef int (*cmpfunc)(const void *, const void *);
 
+#define ELEM(i) (data + (size_t)(i) * size)
 
-	if (num <= 1) {
+/*
+ * Swap two elements of SIZE bytes, a word at a time if they're word
+ * aligned.
+ */
+static
+void
+exchange(char *a, char *b, size_t size)
+{
+	unsigned *wa, *wb, w;
+	char t;
+
+	if (((uintptr_t)a | (uintptr_t)b | size) % sizeof(unsigned) == 0) {
+		wa = (unsigned *)a;
+		wb = (unsigned *)b;
+		for (; size > 0; size -= sizeof(unsigned)) {
+			w = *wa;
+			*wa++ = *wb;
+			*wb++ = w;
+		}
 		return;
 	}
-	if (num == 2) {
-		if (COMPARE(0, 1) > 0) {
-			EXCHANGE(0, 1);
-			return;
-		}
+	while (size-- > 0) {
+		t = *a;
+		*a++ = *b;
+		*b++ = t;
 	}
+}
 
-	/*
-	 * 1. Pick a pivot value. For simplicity, always use the
-	 * middle of the array.
-	 */
-	pivot = num / 2;
-
-	/*
-	 * 2. Shift all values less than or equal to the pivot value
-	 * to the front of the array.
-	 */
-	head = 0;
-	tail = num - 1;
-
-	while (head < tail) {
-		if (COMPARE(head, pivot) <= 0) {
-			head++;
+static
+void
+insertionsort(char *data, unsigned num, size_t size, cmpfunc f)
+{
+	unsigned i, j;
+
+	for (i = 1; i < num; i++) {
+		for (j = i; j > 0 && f(ELEM(j - 1), ELEM(j)) > 0; j--) {
+			exchange(ELEM(j - 1), ELEM(j), size);
 		}
-		else if (COMPARE(tail, pivot) > 0) {
-			tail--;
+	}
+}
+
+/*
+ * Move element I of a heap of NUM elements down until it is no
+ * smaller than its children.
+ */
+static
+void
+siftdown(char *data, unsigned i, unsigned num, size_t size, cmpfunc f)
+{
+	unsigned child;
+
+	while ((child = 2 * i + 1) < num) {
+		if (child + 1 < num && f(ELEM(child), ELEM(child + 1)) < 0) {
+			child++;
 		}
-		else {
-			EXCHANGE(head, tail);
-			if (pivot == head) {
-				pivot = tail;
-			}
-			else if (pivot == tail) {
-				pivot = head;
-			}
-			head++;
-			tail--;
+		if (f(ELEM(i), ELEM(child)) >= 0) {
+			break;
 		}
+		exchange(ELEM(i), ELEM(child), size);
+		i = child;
 	}
+}
 
-	/*
-	 * 3. If there's an even number of elements and we swapped the
-	 * last two, the head and tail indexes will cross. In this
-	 * case the first entry on the tail side is tail+1. If there's
-	 * an odd number of elements, we stop with head == tail, and
-	 * the first entry on the tail side is this value (hence,
-	 * tail) if it's is greater than the pivot value, and the next
-	 * element (hence, tail+1) if it's less than or equal to the
-	 * pivot value.
-	 *
-	 * Henceforth use "tail" to hold the index of the first entry
-	 * of the back portion of the array.
-	 */
-	if (head > tail || COMPARE(head, pivot) <= 0) {
-		tail++;
+static
+void
+heapsort(char *data, unsigned num, size_t size, cmpfunc f)
+{
+	unsigned i;
+
+	for (i = num / 2; i-- > 0; ) {
+		siftdown(data, i, num, size, f);
+	}
+	for (i = num - 1; i > 0; i--) {
+		exchange(ELEM(0), ELEM(i), size);
+		siftdown(data, 0, i, size, f);
 	}
+}
+
+static
+void
+introsort(char *data, unsigned num, size_t size, cmpfunc f, unsigned depth)
+{
+	unsigned mid, last, head, tail;
+	char *pivot;
 
-	/*
-	 * 4. If we got a bad pivot that gave us only one partition,
-	 * because of the order of the advances in the loop above it
-	 * will always put everything in the front portion of the
-	 * array (so tail == num). This happens if we picked the
-	 * largest value. Move the pivot to the end, if necessary, lop
-	 * off all values equal to it, and recurse on the rest.  (If
-	 * there is no rest, the array is already sorted and we're
-	 * done.)
-	 */
-	if (tail == num) {
-		if (pivot < num - 1) {
-			if (COMPARE(pivot, num - 1) > 0) {
-				EXCHANGE(pivot, num - 1);
+	while (num > INSERTION) {
+		if (depth == 0) {
+			heapsort(data, num, size, f);
+			return;
+		}
+		depth--;
+
+		/*
+		 * 1. Put the first, middle, and last elements in order,
+		 * and use the middle one as the pivot. Park it next to
+		 * the last; that and the first then stop the scans below
+		 * at the ends without any bounds checks.
+		 */
+		mid = num / 2;
+		last = num - 1;
+		if (f(ELEM(mid), ELEM(0)) < 0) {
+			exchange(ELEM(mid), ELEM(0), size);
+		}
+		if (f(ELEM(last), ELEM(mid)) < 0) {
+			exchange(ELEM(last), ELEM(mid), size);
+			if (f(ELEM(mid), ELEM(0)) < 0) {
+				exchange(ELEM(mid), ELEM(0), size);
 			}
 		}
-		tail = num - 1;
-		while (tail > 0 && COMPARE(tail - 1, tail) == 0) {
-			tail--;
+		pivot = ELEM(last - 1);
+		exchange(ELEM(mid), pivot, size);
+
+		/*
+		 * 2. Partition: elements up to the pivot go in front,
+		 * elements from it on go behind. Both scans stop on
+		 * elements equal to the pivot, so runs of equal keys
+		 * split evenly instead of all going to one side.
+		 */
+		head = 0;
+		tail = last - 1;
+		for (;;) {
+			while (f(ELEM(++head), pivot) < 0) {
+				/* nothing */
+			}
+			while (f(ELEM(--tail), pivot) > 0) {
+				/* nothing */
+			}
+			if (head >= tail) {
+				break;
+			}
+			exchange(ELEM(head), ELEM(tail), size);
 		}
-		if (tail > 0) {
-			qsort(vdata, tail, size, f);
+		exchange(ELEM(head), pivot, size);
+
+		/*
+		 * 3. The pivot is now in place at HEAD. Recurse on the
+		 * smaller side and go around again for the larger.
+		 */
+		if (head < num - head - 1) {
+			introsort(data, head, size, f, depth);
+			data = ELEM(head + 1);
+			num = num - head - 1;
+		}
+		else {
+			introsort(ELEM(head + 1), num - head - 1, size, f, depth);
+			num = head;
 		}
-		return;
 	}
-	assert(tail > 0 && tail < num);
+	insertionsort(data, num, size, f);
+}
+
+void
+qsort(void *vdata, unsigned num, size_t size,
+      int (*f)(const void *, const void *))
+{
+	unsigned depth, n;
 
-	/*
-	 * 5. Recurse on each subpart of the array.
-	 */
-	qsort(vdata, tail, size, f);
-	qsort((char *)vdata + tail * size, num - tail, size, f);
+	if (num <= 1 || size == 0) {
+		return;
+	}
+	depth = 0;
+	for (n = num; n > 1; n >>= 1) {
+		depth += 2;
+	}
+	introsort(vdata, num, size, f, depth);
 }
@@ -13,6 +13,12 @@ awk '
     /^\/\*CALLBEGIN\*\// { look=1; }
     /^\/\*CALLEND\*\// { look=0; }
 
+    # Calls that libc answers from the kernel info page (unix/kinfo.c).
+    $2 == "SYS_getpid" || $2 == "SYS_getppid" { next; }
+
+    # Calls that libc wraps (unix/forkexec.c) get a stub named with __.
+    $2 == "SYS_fork" || $2 == "SYS_execv" || $2 == "SYS_spawn" { sub("^SYS_", "SYS___", $2); }
+
     # And, do not read lines that do not match the approximate right pattern.
     look && /^#define SYS_/ && NF==3 {
 	sub("^SYS_", "", $2);
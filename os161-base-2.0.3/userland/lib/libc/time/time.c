@@ -28,15 +28,53 @@
  */
 
 #include <unistd.h>
+#include <kern/kinfo.h>
 
 /*
  * POSIX C function: retrieve time in seconds since the epoch.
- * Uses the OS/161 system call __time, which does the same thing
- * but also returns nanoseconds.
+ *
+ * The kernel publishes the time of day as of the last clock tick in
+ * the kernel info page (see <kern/kinfo.h>), which is as good as it
+ * gets for whole seconds, so this doesn't need a system call. The
+ * page is read the seqlock way: the sequence number is odd while the
+ * kernel is changing it, and different afterwards. Until the first
+ * clock tick there is nothing there, and the OS/161 system call
+ * __time (which also returns nanoseconds) is used instead.
  */
 
+static
+void
+kinfo_sync(void)
+{
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		"sync;"			/* order the loads */
+		".set pop"		/* restore assembler mode */
+		: : : "memory");
+}
+
 time_t
 time(time_t *t)
 {
-	return __time(t, NULL);
+	const volatile struct kinfo_time *kt = KINFO_TIME;
+	unsigned seq;
+	time_t secs;
+
+	do {
+		while ((seq = kt->kt_seq) & 1) {
+			/* the kernel is updating it */
+		}
+		kinfo_sync();
+		secs = kt->kt_sec;
+		kinfo_sync();
+	} while (kt->kt_seq != seq);
+
+	if (secs == 0) {
+		return __time(t, NULL);
+	}
+	if (t != NULL) {
+		*t = secs;
+	}
+	return secs;
 }
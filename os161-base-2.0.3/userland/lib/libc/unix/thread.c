@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2013
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+
+/*
+ * Threads within one process.
+ *
+ * The kernel starts a new thread at ENTRY(ARG0, ARG1) on the stack it
+ * is given; when the thread's function returns, its value becomes the
+ * thread's exit status. The caller supplies the stack, since malloc is
+ * not safe to call from several threads at once. Note too that errno
+ * is shared by all the threads of a process.
+ */
+
+static
+__DEAD
+void
+thread_start(void *func, void *arg)
+{
+	int (*f)(void *) = func;
+
+	__thread_exit(f(arg));
+}
+
+int
+thread_create(int (*func)(void *), void *arg, void *stack, size_t stacksize)
+{
+	uintptr_t top;
+
+	if (stack == NULL || stacksize < 64) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* Leave room for the argument slots; keep it doubleword aligned. */
+	top = ((uintptr_t)stack + stacksize - 16) & ~(uintptr_t)7;
+	return __thread_create(thread_start, (void *)func, arg, (void *)top);
+}
+
+int
+thread_join(int tid, int *status)
+{
+	return __thread_join(tid, status);
+}
+
+void
+thread_exit(int status)
+{
+	__thread_exit(status);
+}
@@ -0,0 +1,802 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <setjmp.h>
+#include <assert.h>
+#include <unistd.h>
+#include <errno.h>
+#include <uthread.h>
+
+/*
+ * User-level threads, M:N over kernel threads. See <uthread.h>.
+ *
+ * Each uthread's state lives at the bottom of its own stack, which is
+ * aligned to its size, so a uthread finds itself from the address of
+ * any local variable. Switching is always between a uthread and the
+ * worker running it: the worker longjmps into the uthread, and the
+ * uthread, to stop running, longjmps back into the worker's loop,
+ * which then does whatever the switch was for (requeueing it,
+ * freeing it, dropping the lock it went to sleep with) on the
+ * worker's own stack. So nothing ever has to happen "after" a
+ * uthread has switched out on its own stack, and a uthread can be
+ * picked up by another worker as soon as that's done.
+ *
+ * Locking, innermost last: a wait queue (mutex, cv, or join) spin,
+ * a run queue's w_lock, sched_lock, stack_lock. The spinlocks yield
+ * the cpu after a while, as their holder may be preempted.
+ */
+
+#define UT_MAGIC      0x75746872	/* "uthr" */
+#define UT_CHUNK      8			/* stacks to mmap at a time */
+#define MAXWORKERS    32
+#define WORKER_STACK  (64*1024)
+#define SPINS         100		/* tries before yielding the cpu */
+
+/*
+ * The jmp_buf slots setjmp keeps the stack pointer and the return
+ * address in (see setjmp.S). A new uthread's context is made by
+ * pointing them at its stack and at uthread_start.
+ */
+#define JB_SP 0
+#define JB_RA 1
+
+/* What a uthread switching out wants done (ut_state) */
+#define UT_RUNNING 0
+#define UT_YIELD   1		/* requeue it */
+#define UT_BLOCK   2		/* drop ut_unlock; somebody will requeue it */
+#define UT_EXIT    3		/* it's done */
+
+struct worker;
+
+struct uthread {
+	unsigned ut_magic;
+	jmp_buf ut_ctx;			/* where it left off */
+	struct worker *ut_worker;	/* the worker running it */
+	struct uthread *ut_next;	/* on a run queue or a wait queue */
+	struct uthread *ut_prev;	/* on a run queue */
+	int ut_state;
+	volatile int *ut_unlock;	/* for UT_BLOCK */
+	void (*ut_func)(void *);
+	void *ut_arg;
+
+	/* Joining, under ut_spin */
+	volatile int ut_spin;
+	bool ut_joinable;
+	bool ut_done;
+	struct uthread *ut_joiner;
+};
+
+struct worker {
+	jmp_buf w_ctx;			/* its loop, in worker_run */
+	struct uthread *w_current;
+	unsigned w_index;
+	int w_tid;			/* kernel thread, -1 for the first */
+	void *w_stack;
+
+	/* The run queue: the worker works at the tail, thieves take the head */
+	volatile int w_lock;
+	struct uthread *w_head, *w_tail;
+};
+
+static struct worker workers[MAXWORKERS];
+static unsigned nworkers;
+
+/* Idle workers sleep on idle_seq, bumped when there's work for them */
+static volatile int sched_lock;
+static volatile int idle_seq;
+static volatile unsigned nidle;
+static unsigned nlive;			/* uthreads not cleaned up yet */
+static bool sched_done;
+
+/* Free stacks */
+static volatile int stack_lock;
+static struct uthread *stack_free;
+
+////////////////////////////////////////////////////////////
+// spinlocks
+
+static
+int
+testandset(volatile int *s)
+{
+	int x, y = 1;
+
+	/* As in the kernel's spinlock_data_testandset */
+	__asm volatile(
+		".set push;"
+		".set mips32;"
+		".set volatile;"
+		"ll %0, 0(%2);"
+		"sc %1, 0(%2);"
+		".set pop"
+		: "=&r" (x), "+r" (y) : "r" (s));
+	return y == 0 ? 1 : x;
+}
+
+static
+void
+spin_acquire(volatile int *s)
+{
+	unsigned n = 0;
+
+	for (;;) {
+		if (*s == 0 && testandset(s) == 0) {
+			break;
+		}
+		if (++n == SPINS) {
+			sched_yield();
+			n = 0;
+		}
+	}
+	__asm volatile("sync" ::: "memory");
+}
+
+static
+void
+spin_release(volatile int *s)
+{
+	__asm volatile("sync" ::: "memory");
+	*s = 0;
+}
+
+////////////////////////////////////////////////////////////
+// stacks
+
+static
+struct uthread *
+stack_get(void)
+{
+	struct uthread *t;
+	uintptr_t base;
+	char *p;
+	unsigned i;
+
+	spin_acquire(&stack_lock);
+	if (stack_free == NULL) {
+		/* One stack more than we need, to align the rest */
+		p = mmap(NULL, (UT_CHUNK + 1) * UTHREAD_STACKSIZE,
+			 PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+		if (p == MAP_FAILED) {
+			spin_release(&stack_lock);
+			errno = ENOMEM;
+			return NULL;
+		}
+		base = ((uintptr_t)p + UTHREAD_STACKSIZE - 1) &
+			~(uintptr_t)(UTHREAD_STACKSIZE - 1);
+		for (i = 0; i < UT_CHUNK; i++) {
+			t = (struct uthread *)(base + i * UTHREAD_STACKSIZE);
+			t->ut_next = stack_free;
+			stack_free = t;
+		}
+	}
+	t = stack_free;
+	stack_free = t->ut_next;
+	spin_release(&stack_lock);
+	return t;
+}
+
+static
+void
+stack_put(struct uthread *t)
+{
+	t->ut_magic = 0;
+	spin_acquire(&stack_lock);
+	t->ut_next = stack_free;
+	stack_free = t;
+	spin_release(&stack_lock);
+}
+
+////////////////////////////////////////////////////////////
+// run queues
+
+static
+struct uthread *
+current(void)
+{
+	struct uthread *t;
+	char here;
+
+	t = (struct uthread *)((uintptr_t)&here &
+			       ~(uintptr_t)(UTHREAD_STACKSIZE - 1));
+	assert(t->ut_magic == UT_MAGIC);
+	return t;
+}
+
+/* Put T on W's run queue, at the tail (AT_TAIL) or the head. */
+static
+void
+rq_put(struct worker *w, struct uthread *t, bool at_tail)
+{
+	spin_acquire(&w->w_lock);
+	if (at_tail) {
+		t->ut_next = NULL;
+		t->ut_prev = w->w_tail;
+		if (w->w_tail != NULL) {
+			w->w_tail->ut_next = t;
+		}
+		else {
+			w->w_head = t;
+		}
+		w->w_tail = t;
+	}
+	else {
+		t->ut_prev = NULL;
+		t->ut_next = w->w_head;
+		if (w->w_head != NULL) {
+			w->w_head->ut_prev = t;
+		}
+		else {
+			w->w_tail = t;
+		}
+		w->w_head = t;
+	}
+	spin_release(&w->w_lock);
+}
+
+/* Take a uthread off W's run queue, from the tail (AT_TAIL) or head. */
+static
+struct uthread *
+rq_take(struct worker *w, bool at_tail)
+{
+	struct uthread *t;
+
+	if (w->w_head == NULL) {
+		/* unlocked peek; we'll be told of new work anyway */
+		return NULL;
+	}
+	spin_acquire(&w->w_lock);
+	t = at_tail ? w->w_tail : w->w_head;
+	if (t != NULL) {
+		if (t->ut_prev != NULL) {
+			t->ut_prev->ut_next = t->ut_next;
+		}
+		else {
+			w->w_head = t->ut_next;
+		}
+		if (t->ut_next != NULL) {
+			t->ut_next->ut_prev = t->ut_prev;
+		}
+		else {
+			w->w_tail = t->ut_prev;
+		}
+		t->ut_next = t->ut_prev = NULL;
+	}
+	spin_release(&w->w_lock);
+	return t;
+}
+
+/*
+ * Make T runnable on W. It goes at the tail, where W looks first, as
+ * whatever woke it up is likely to have left it something warm in
+ * the cache. If any worker is idle, wake one to come and steal.
+ */
+static
+void
+make_ready(struct worker *w, struct uthread *t)
+{
+	rq_put(w, t, true);
+
+	/* Idle workers look at the queues after counting themselves */
+	__asm volatile("sync" ::: "memory");
+	if (nidle > 0) {
+		spin_acquire(&sched_lock);
+		idle_seq++;
+		spin_release(&sched_lock);
+		__futex_wake(&idle_seq, 1);
+	}
+}
+
+/* Find W something to run: its own newest, or another one's oldest. */
+static
+struct uthread *
+find_work(struct worker *w)
+{
+	struct uthread *t;
+	unsigned i;
+
+	t = rq_take(w, true);
+	for (i = 1; t == NULL && i < nworkers; i++) {
+		t = rq_take(&workers[(w->w_index + i) % nworkers], false);
+	}
+	return t;
+}
+
+////////////////////////////////////////////////////////////
+// switching
+
+/*
+ * Stop running the current uthread T, having set what for in its
+ * ut_state, and go back to the worker's loop. Returns when T is run
+ * again, possibly by another worker.
+ */
+static
+void
+switch_out(struct uthread *t)
+{
+	assert(t->ut_magic == UT_MAGIC);
+	if (setjmp(t->ut_ctx) == 0) {
+		longjmp(t->ut_worker->w_ctx, 1);
+	}
+	t->ut_state = UT_RUNNING;
+}
+
+/*
+ * Block the current uthread T, which has put itself on a wait queue
+ * locked by spinlock S. S is dropped once T is off its stack, so
+ * whoever wakes it can put it on a run queue right away.
+ */
+static
+void
+block(struct uthread *t, volatile int *s)
+{
+	t->ut_state = UT_BLOCK;
+	t->ut_unlock = s;
+	switch_out(t);
+}
+
+/* The last uthread is gone; tell the workers to go home. */
+static
+void
+sched_finish(void)
+{
+	spin_acquire(&sched_lock);
+	sched_done = true;
+	idle_seq++;
+	spin_release(&sched_lock);
+	__futex_wake(&idle_seq, MAXWORKERS);
+}
+
+/* T has switched out for good. */
+static
+void
+reap(struct worker *w, struct uthread *t)
+{
+	struct uthread *joiner;
+	bool joinable, last;
+
+	/* Once it's done, a joiner may free it; don't look at it again */
+	joinable = t->ut_joinable;
+	spin_acquire(&t->ut_spin);
+	t->ut_done = true;
+	joiner = t->ut_joiner;
+	spin_release(&t->ut_spin);
+
+	if (joiner != NULL) {
+		make_ready(w, joiner);
+	}
+	if (!joinable) {
+		stack_put(t);
+		spin_acquire(&sched_lock);
+		last = --nlive == 0;
+		spin_release(&sched_lock);
+		if (last) {
+			sched_finish();
+		}
+	}
+}
+
+/* Wait for work; returns false once there will be none. */
+static
+bool
+worker_idle(struct worker *w)
+{
+	struct uthread *t;
+	int seq;
+
+	spin_acquire(&sched_lock);
+	if (sched_done) {
+		spin_release(&sched_lock);
+		return false;
+	}
+	seq = idle_seq;
+	nidle++;
+	spin_release(&sched_lock);
+
+	t = find_work(w);
+	if (t != NULL) {
+		/* Somebody was quick; keep it for ourselves */
+		rq_put(w, t, true);
+	}
+	else {
+		__futex_wait(&idle_seq, seq);
+	}
+
+	spin_acquire(&sched_lock);
+	nidle--;
+	spin_release(&sched_lock);
+	return true;
+}
+
+static
+void
+worker_run(struct worker *w)
+{
+	struct uthread *t;
+
+	for (;;) {
+		t = find_work(w);
+		if (t == NULL) {
+			if (!worker_idle(w)) {
+				break;
+			}
+			continue;
+		}
+
+		t->ut_worker = w;
+		w->w_current = t;
+		if (setjmp(w->w_ctx) == 0) {
+			longjmp(t->ut_ctx, 1);
+		}
+		t = w->w_current;
+		w->w_current = NULL;
+
+		switch (t->ut_state) {
+		    case UT_YIELD:
+			/* At the head, behind everything else of ours */
+			rq_put(w, t, false);
+			break;
+		    case UT_BLOCK:
+			spin_release(t->ut_unlock);
+			break;
+		    case UT_EXIT:
+			reap(w, t);
+			break;
+		    default:
+			abort();
+		}
+	}
+}
+
+static
+int
+worker_thread(void *arg)
+{
+	worker_run(arg);
+	return 0;
+}
+
+/* Where a new uthread starts, on its own stack. */
+static
+void
+uthread_start(void)
+{
+	struct uthread *t = current();
+
+	t->ut_state = UT_RUNNING;
+	t->ut_func(t->ut_arg);
+	uthread_exit();
+}
+
+////////////////////////////////////////////////////////////
+// threads
+
+static
+struct uthread *
+uthread_new(void (*func)(void *), void *arg, bool joinable)
+{
+	struct uthread *t;
+
+	t = stack_get();
+	if (t == NULL) {
+		return NULL;
+	}
+	t->ut_magic = UT_MAGIC;
+	t->ut_worker = NULL;
+	t->ut_next = t->ut_prev = NULL;
+	t->ut_state = UT_RUNNING;
+	t->ut_unlock = NULL;
+	t->ut_func = func;
+	t->ut_arg = arg;
+	t->ut_spin = 0;
+	t->ut_joinable = joinable;
+	t->ut_done = false;
+	t->ut_joiner = NULL;
+
+	/* Leave room for the argument slots; keep it doubleword aligned. */
+	setjmp(t->ut_ctx);
+	t->ut_ctx[JB_SP] = ((uintptr_t)t + UTHREAD_STACKSIZE - 16) &
+		~(uintptr_t)7;
+	t->ut_ctx[JB_RA] = (uintptr_t)uthread_start;
+
+	spin_acquire(&sched_lock);
+	nlive++;
+	spin_release(&sched_lock);
+	return t;
+}
+
+int
+uthread_create(struct uthread **ret, void (*func)(void *), void *arg)
+{
+	struct uthread *t;
+
+	t = uthread_new(func, arg, ret != NULL);
+	if (t == NULL) {
+		return -1;
+	}
+	if (ret != NULL) {
+		*ret = t;
+	}
+	make_ready(current()->ut_worker, t);
+	return 0;
+}
+
+int
+uthread_join(struct uthread *t)
+{
+	bool last;
+
+	if (t->ut_magic != UT_MAGIC || !t->ut_joinable || t == current()) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	spin_acquire(&t->ut_spin);
+	if (!t->ut_done) {
+		assert(t->ut_joiner == NULL);
+		t->ut_joiner = current();
+		block(t->ut_joiner, &t->ut_spin);
+	}
+	else {
+		spin_release(&t->ut_spin);
+	}
+
+	stack_put(t);
+	spin_acquire(&sched_lock);
+	last = --nlive == 0;
+	spin_release(&sched_lock);
+	/* We're still live ourselves, so this can't be the last */
+	assert(!last);
+	return 0;
+}
+
+void
+uthread_exit(void)
+{
+	struct uthread *t = current();
+
+	t->ut_state = UT_EXIT;
+	switch_out(t);
+	/* reap never puts it back */
+	abort();
+}
+
+void
+uthread_yield(void)
+{
+	struct uthread *t = current();
+
+	t->ut_state = UT_YIELD;
+	switch_out(t);
+}
+
+struct uthread *
+uthread_self(void)
+{
+	return current();
+}
+
+/*
+ * Start NWORKERS - 1 kernel threads as workers, and be the first one
+ * ourselves, until all the uthreads are gone. If we can't get all the
+ * workers, we make do with the ones we got.
+ */
+int
+uthread_main(void (*func)(void *), void *arg, unsigned n)
+{
+	struct uthread *t;
+	struct worker *w;
+	unsigned i;
+	int status;
+
+	if (n == 0) {
+		n = ncpus();
+	}
+	if (n > MAXWORKERS) {
+		n = MAXWORKERS;
+	}
+
+	sched_done = false;
+	nidle = 0;
+	nlive = 0;
+	for (i = 0; i < MAXWORKERS; i++) {
+		w = &workers[i];
+		w->w_current = NULL;
+		w->w_index = i;
+		w->w_tid = -1;
+		w->w_stack = NULL;
+		w->w_lock = 0;
+		w->w_head = w->w_tail = NULL;
+	}
+	nworkers = 1;
+
+	t = uthread_new(func, arg, false);
+	if (t == NULL) {
+		return -1;
+	}
+	rq_put(&workers[0], t, true);
+
+	for (i = 1; i < n; i++) {
+		w = &workers[i];
+		w->w_stack = mmap(NULL, WORKER_STACK, PROT_READ|PROT_WRITE,
+				  MAP_PRIVATE|MAP_ANON, -1, 0);
+		if (w->w_stack == MAP_FAILED) {
+			w->w_stack = NULL;
+			break;
+		}
+		/* Count it first, so the others can steal from it */
+		nworkers = i + 1;
+		w->w_tid = thread_create(worker_thread, w, w->w_stack,
+					 WORKER_STACK);
+		if (w->w_tid < 0) {
+			nworkers = i;
+			munmap(w->w_stack, WORKER_STACK);
+			w->w_stack = NULL;
+			break;
+		}
+	}
+
+	worker_run(&workers[0]);
+
+	for (i = 1; i < nworkers; i++) {
+		w = &workers[i];
+		thread_join(w->w_tid, &status);
+		munmap(w->w_stack, WORKER_STACK);
+		w->w_stack = NULL;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// mutexes and condition variables
+
+/* Append T to the wait queue HEAD/TAIL. */
+static
+void
+wq_put(struct uthread **head, struct uthread **tail, struct uthread *t)
+{
+	t->ut_next = NULL;
+	if (*tail != NULL) {
+		(*tail)->ut_next = t;
+	}
+	else {
+		*head = t;
+	}
+	*tail = t;
+}
+
+static
+struct uthread *
+wq_take(struct uthread **head, struct uthread **tail)
+{
+	struct uthread *t = *head;
+
+	if (t != NULL) {
+		*head = t->ut_next;
+		if (*head == NULL) {
+			*tail = NULL;
+		}
+		t->ut_next = NULL;
+	}
+	return t;
+}
+
+void
+uthread_mutex_init(struct uthread_mutex *m)
+{
+	m->um_spin = 0;
+	m->um_held = false;
+	m->um_head = m->um_tail = NULL;
+}
+
+void
+uthread_mutex_lock(struct uthread_mutex *m)
+{
+	struct uthread *t;
+
+	spin_acquire(&m->um_spin);
+	if (!m->um_held) {
+		m->um_held = true;
+		spin_release(&m->um_spin);
+		return;
+	}
+	/* uthread_mutex_unlock hands it straight to us */
+	t = current();
+	wq_put(&m->um_head, &m->um_tail, t);
+	block(t, &m->um_spin);
+}
+
+void
+uthread_mutex_unlock(struct uthread_mutex *m)
+{
+	struct uthread *t;
+
+	spin_acquire(&m->um_spin);
+	assert(m->um_held);
+	t = wq_take(&m->um_head, &m->um_tail);
+	if (t == NULL) {
+		m->um_held = false;
+	}
+	spin_release(&m->um_spin);
+	if (t != NULL) {
+		make_ready(current()->ut_worker, t);
+	}
+}
+
+void
+uthread_cond_init(struct uthread_cond *c)
+{
+	c->uc_spin = 0;
+	c->uc_head = c->uc_tail = NULL;
+}
+
+void
+uthread_cond_wait(struct uthread_cond *c, struct uthread_mutex *m)
+{
+	struct uthread *t = current();
+
+	spin_acquire(&c->uc_spin);
+	wq_put(&c->uc_head, &c->uc_tail, t);
+	uthread_mutex_unlock(m);
+	block(t, &c->uc_spin);
+	uthread_mutex_lock(m);
+}
+
+void
+uthread_cond_signal(struct uthread_cond *c)
+{
+	struct uthread *t;
+
+	spin_acquire(&c->uc_spin);
+	t = wq_take(&c->uc_head, &c->uc_tail);
+	spin_release(&c->uc_spin);
+	if (t != NULL) {
+		make_ready(current()->ut_worker, t);
+	}
+}
+
+void
+uthread_cond_broadcast(struct uthread_cond *c)
+{
+	struct uthread *t, *all;
+	struct worker *w = current()->ut_worker;
+
+	spin_acquire(&c->uc_spin);
+	all = c->uc_head;
+	c->uc_head = c->uc_tail = NULL;
+	spin_release(&c->uc_spin);
+	while ((t = all) != NULL) {
+		all = t->ut_next;
+		make_ready(w, t);
+	}
+}
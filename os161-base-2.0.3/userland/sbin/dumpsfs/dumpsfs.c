@@ -73,6 +73,9 @@ static bool dofiles, dodirs;
 static bool doindirect;
 static bool recurse;
 
+/* Block size of the volume, from the superblock */
+static uint32_t bsize = SFS_BLOCKSIZE;
+
 ////////////////////////////////////////////////////////////
 // printouts
 
@@ -132,16 +135,45 @@ dumplval(const char *desc, const char *lval)
 
 static void dumpinode(uint32_t ino, const char *name);
 
+/*
+ * Read the first LEN bytes of block BLOCK, for the structures that
+ * are smaller than a block.
+ */
+static
+void
+readstart(void *data, size_t len, uint32_t block)
+{
+	char buf[SFS_MAXBLOCKSIZE];
+
+	assert(len <= bsize);
+	diskread(buf, block);
+	memcpy(data, buf, len);
+}
+
+/*
+ * Check the superblock and switch to the volume's block size. Until
+ * then the disk is read in sectors, which the superblock fills.
+ */
 static
 uint32_t
 readsb(void)
 {
 	struct sfs_superblock sb;
 
+	assert(diskblocksize() == sizeof(sb));
 	diskread(&sb, SFS_SUPER_BLOCK);
 	if (SWAP32(sb.sb_magic) != SFS_MAGIC) {
 		errx(1, "Not an sfs filesystem");
 	}
+	bsize = SWAP32(sb.sb_blocksize);
+	if (bsize == 0) {
+		bsize = SFS_BLOCKSIZE;
+	}
+	if (bsize < SFS_BLOCKSIZE || bsize > SFS_MAXBLOCKSIZE ||
+	    (bsize & (bsize - 1)) != 0) {
+		errx(1, "Bad block size %u", bsize);
+	}
+	disksetblocksize(bsize);
 	return SWAP32(sb.sb_nblocks);
 }
 
@@ -152,7 +184,7 @@ dumpsb(void)
 	struct sfs_superblock sb;
 	unsigned i;
 
-	diskread(&sb, SFS_SUPER_BLOCK);
+	readstart(&sb, sizeof(sb), SFS_SUPER_BLOCK);
 	sb.sb_volname[sizeof(sb.sb_volname)-1] = 0;
 
 	printf("Superblock\n");
@@ -160,8 +192,8 @@ dumpsb(void)
 	dumpvalf("Magic", "0x%8x", SWAP32(sb.sb_magic));
 	dumpvalf("Size", "%u blocks", SWAP32(sb.sb_nblocks));
 	dumpvalf("Freemap size", "%u blocks",
-		 SFS_FREEMAPBLOCKS(SWAP32(sb.sb_nblocks)));
-	dumpvalf("Block size", "%u bytes", SFS_BLOCKSIZE);
+		 SFS_FREEMAPBLOCKS(SWAP32(sb.sb_nblocks), bsize));
+	dumpvalf("Block size", "%u bytes", bsize);
 	dumplval("Volume name", sb.sb_volname);
 
 	for (i=0; i<ARRAYCOUNT(sb.reserved); i++) {
@@ -177,9 +209,10 @@ static
 void
 dumpfreemap(uint32_t fsblocks)
 {
-	uint32_t freemapblocks = SFS_FREEMAPBLOCKS(fsblocks);
+	uint32_t freemapblocks = SFS_FREEMAPBLOCKS(fsblocks, bsize);
+	uint32_t bits = SFS_BITSPERBLOCK(bsize);
 	uint32_t i, j, k, bn;
-	uint8_t data[SFS_BLOCKSIZE], mask;
+	uint8_t data[SFS_MAXBLOCKSIZE], mask;
 	char tmp[16];
 
 	printf("Free block bitmap\n");
@@ -189,16 +222,16 @@ dumpfreemap(uint32_t fsblocks)
 		printf("    Freemap block #%u in disk block %u: blocks %u - %u"
 		       " (0x%x - 0x%x)\n",
 		       i, SFS_FREEMAP_START+i,
-		       i*SFS_BITSPERBLOCK, (i+1)*SFS_BITSPERBLOCK - 1,
-		       i*SFS_BITSPERBLOCK, (i+1)*SFS_BITSPERBLOCK - 1);
-		for (j=0; j<SFS_BLOCKSIZE; j++) {
+		       i*bits, (i+1)*bits - 1,
+		       i*bits, (i+1)*bits - 1);
+		for (j=0; j<bsize; j++) {
 			if (j % 8 == 0) {
 				snprintf(tmp, sizeof(tmp), "0x%x",
-					 i*SFS_BITSPERBLOCK + j*8);
+					 i*bits + j*8);
 				printf("%-7s ", tmp);
 			}
 			for (k=0; k<8; k++) {
-				bn = i*SFS_BITSPERBLOCK + j*8 + k;
+				bn = i*bits + j*8 + k;
 				mask = 1U << k;
 				if (bn >= fsblocks) {
 					if (data[j] & mask) {
@@ -232,7 +265,7 @@ static
 void
 dumpindirect(uint32_t block)
 {
-	uint32_t ib[SFS_BLOCKSIZE/sizeof(uint32_t)];
+	uint32_t ib[SFS_DBPERIDB(SFS_MAXBLOCKSIZE)];
 	char tmp[128];
 	unsigned i;
 
@@ -242,7 +275,7 @@ dumpindirect(uint32_t block)
 	printf("Indirect block %u\n", block);
 
 	diskread(ib, block);
-	for (i=0; i<ARRAYCOUNT(ib); i++) {
+	for (i=0; i<SFS_DBPERIDB(bsize); i++) {
 		if (i % 4 == 0) {
 			printf("@%-3u   ", i);
 		}
@@ -260,16 +293,16 @@ uint32_t
 traverse_ib(uint32_t fileblock, uint32_t numblocks, uint32_t block,
 	    void (*doblock)(uint32_t, uint32_t))
 {
-	uint32_t ib[SFS_BLOCKSIZE/sizeof(uint32_t)];
+	uint32_t ib[SFS_DBPERIDB(SFS_MAXBLOCKSIZE)];
 	unsigned i;
 
 	if (block == 0) {
-		memset(ib, 0, sizeof(ib));
+		memset(ib, 0, bsize);
 	}
 	else {
 		diskread(ib, block);
 	}
-	for (i=0; i<ARRAYCOUNT(ib) && fileblock < numblocks; i++) {
+	for (i=0; i<SFS_DBPERIDB(bsize) && fileblock < numblocks; i++) {
 		doblock(fileblock++, SWAP32(ib[i]));
 	}
 	return fileblock;
@@ -283,7 +316,7 @@ traverse(const struct sfs_dinode *sfi, void (*doblock)(uint32_t, uint32_t))
 	uint32_t numblocks;
 	unsigned i;
 
-	numblocks = DIVROUNDUP(SWAP32(sfi->sfi_size), SFS_BLOCKSIZE);
+	numblocks = DIVROUNDUP(SWAP32(sfi->sfi_size), bsize);
 
 	fileblock = 0;
 	for (i=0; i<SFS_NDIRECT && fileblock < numblocks; i++) {
@@ -300,8 +333,8 @@ static
 void
 dumpdirblock(uint32_t fileblock, uint32_t diskblock)
 {
-	struct sfs_direntry sds[SFS_BLOCKSIZE/sizeof(struct sfs_direntry)];
-	int nsds = SFS_BLOCKSIZE/sizeof(struct sfs_direntry);
+	struct sfs_direntry sds[SFS_MAXBLOCKSIZE/sizeof(struct sfs_direntry)];
+	int nsds = bsize/sizeof(struct sfs_direntry);
 	int i;
 
 	(void)fileblock;
@@ -342,8 +375,8 @@ static
 void
 recursedirblock(uint32_t fileblock, uint32_t diskblock)
 {
-	struct sfs_direntry sds[SFS_BLOCKSIZE/sizeof(struct sfs_direntry)];
-	int nsds = SFS_BLOCKSIZE/sizeof(struct sfs_direntry);
+	struct sfs_direntry sds[SFS_MAXBLOCKSIZE/sizeof(struct sfs_direntry)];
+	int nsds = bsize/sizeof(struct sfs_direntry);
 	int i;
 
 	(void)fileblock;
@@ -377,20 +410,20 @@ recursedir(uint32_t ino, const struct sfs_dinode *sfi)
 static
 void dumpfileblock(uint32_t fileblock, uint32_t diskblock)
 {
-	uint8_t data[SFS_BLOCKSIZE];
+	uint8_t data[SFS_MAXBLOCKSIZE];
 	unsigned i, j;
 	char tmp[128];
 
 	if (diskblock == 0) {
-		printf("    0x%6x  [sparse]\n", fileblock * SFS_BLOCKSIZE);
+		printf("    0x%6x  [sparse]\n", fileblock * bsize);
 		return;
 	}
 
 	diskread(data, diskblock);
-	for (i=0; i<SFS_BLOCKSIZE; i++) {
+	for (i=0; i<bsize; i++) {
 		if (i % 16 == 0) {
 			snprintf(tmp, sizeof(tmp), "0x%x",
-				 fileblock * SFS_BLOCKSIZE + i);
+				 fileblock * bsize + i);
 			printf("%8s", tmp);
 		}
 		if (i % 8 == 0) {
@@ -432,7 +465,7 @@ dumpinode(uint32_t ino, const char *name)
 	char tmp[128];
 	unsigned i;
 
-	diskread(&sfi, ino);
+	readstart(&sfi, sizeof(sfi), ino);
 
 	printf("Inode %u", ino);
 	if (name != NULL) {
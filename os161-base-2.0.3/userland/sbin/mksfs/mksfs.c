@@ -29,6 +29,7 @@
 
 #include <sys/types.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <limits.h>
@@ -57,11 +58,27 @@
 
 #include "disk.h"
 
-/* Maximum size of freemap we support */
-#define MAXFREEMAPBLOCKS 32
+/* Maximum size of freemap we support (in bytes) */
+#define MAXFREEMAPBYTES (32 * SFS_BLOCKSIZE)
+
+/*
+ * Journal size: an eighth of the volume, up to what one transaction
+ * can use; volumes too small for MINJOURNALBLOCKS get no journal.
+ */
+#define MAXJOURNALBLOCKS (SFS_JOURNAL_MAXBLOCKS + 2)
+#define MINJOURNALBLOCKS 16
+
+/* Block size of the new volume */
+static uint32_t bsize = SFS_BLOCKSIZE;
 
 /* Free block bitmap */
-static char freemapbuf[MAXFREEMAPBLOCKS * SFS_BLOCKSIZE];
+static char freemapbuf[MAXFREEMAPBYTES];
+
+/* Block being written, for structures smaller than a block */
+static char blockbuf[SFS_MAXBLOCKSIZE];
+
+/* Journal placement (0 blocks if none) */
+static uint32_t journalstart, journalblocks;
 
 /*
  * Assert that the on-disk data structures are correctly sized.
@@ -73,6 +90,39 @@ check(void)
 	assert(sizeof(struct sfs_superblock)==SFS_BLOCKSIZE);
 	assert(sizeof(struct sfs_dinode)==SFS_BLOCKSIZE);
 	assert(SFS_BLOCKSIZE % sizeof(struct sfs_direntry) == 0);
+	assert(sizeof(struct sfs_jdesc)==SFS_BLOCKSIZE);
+	assert(sizeof(struct sfs_jcommit)==SFS_BLOCKSIZE);
+}
+
+/*
+ * Write LEN bytes at the start of block BLOCK, zeroing the rest.
+ */
+static
+void
+writestart(const void *data, size_t len, uint32_t block)
+{
+	assert(len <= bsize);
+	bzero(blockbuf, bsize);
+	memcpy(blockbuf, data, len);
+	diskwrite(blockbuf, block);
+}
+
+/*
+ * Decide where the journal goes: right after the freemap.
+ */
+static
+void
+placejournal(uint32_t fsblocks)
+{
+	journalstart = SFS_FREEMAP_START + SFS_FREEMAPBLOCKS(fsblocks, bsize);
+	journalblocks = fsblocks / 8;
+	if (journalblocks > MAXJOURNALBLOCKS) {
+		journalblocks = MAXJOURNALBLOCKS;
+	}
+	if (journalblocks < MINJOURNALBLOCKS ||
+	    journalstart + journalblocks > fsblocks) {
+		journalstart = journalblocks = 0;
+	}
 }
 
 /*
@@ -96,13 +146,13 @@ static
 void
 initfreemap(uint32_t fsblocks)
 {
-	uint32_t freemapbits = SFS_FREEMAPBITS(fsblocks);
-	uint32_t freemapblocks = SFS_FREEMAPBLOCKS(fsblocks);
+	uint32_t freemapbits = SFS_FREEMAPBITS(fsblocks, bsize);
+	uint32_t freemapblocks = SFS_FREEMAPBLOCKS(fsblocks, bsize);
 	uint32_t i;
 
-	if (freemapblocks > MAXFREEMAPBLOCKS) {
+	if (freemapblocks * bsize > MAXFREEMAPBYTES) {
 		errx(1, "Filesystem too large -- "
-		     "increase MAXFREEMAPBLOCKS and recompile");
+		     "increase MAXFREEMAPBYTES and recompile");
 	}
 
 	/* mark the superblock and root inode in use */
@@ -114,6 +164,11 @@ initfreemap(uint32_t fsblocks)
 		allocblock(SFS_FREEMAP_START + i);
 	}
 
+	/* and so must the journal */
+	for (i=0; i<journalblocks; i++) {
+		allocblock(journalstart + i);
+	}
+
 	/* all blocks in the freemap but past the volume end are "in use" */
 	for (i=fsblocks; i<freemapbits; i++) {
 		allocblock(i);
@@ -140,9 +195,13 @@ writesuper(const char *volname, uint32_t nblocks)
 	sb.sb_magic = SWAP32(SFS_MAGIC);
 	sb.sb_nblocks = SWAP32(nblocks);
 	strcpy(sb.sb_volname, volname);
+	sb.sb_journalstart = SWAP32(journalstart);
+	sb.sb_journalblocks = SWAP32(journalblocks);
+	sb.sb_clean = SWAP32(SFS_CLEAN);
+	sb.sb_blocksize = SWAP32(bsize);
 
 	/* and write it out. */
-	diskwrite(&sb, SFS_SUPER_BLOCK);
+	writestart(&sb, sizeof(sb), SFS_SUPER_BLOCK);
 }
 
 /*
@@ -157,13 +216,30 @@ writefreemap(uint32_t fsblocks)
 	uint32_t i;
 
 	/* Write out each of the blocks in the free block bitmap. */
-	freemapblocks = SFS_FREEMAPBLOCKS(fsblocks);
+	freemapblocks = SFS_FREEMAPBLOCKS(fsblocks, bsize);
 	for (i=0; i<freemapblocks; i++) {
-		ptr = freemapbuf + i*SFS_BLOCKSIZE;
+		ptr = freemapbuf + i*bsize;
 		diskwrite(ptr, SFS_FREEMAP_START+i);
 	}
 }
 
+/*
+ * Write out an empty journal descriptor, so whatever was on the disk
+ * before can't be mistaken for a transaction.
+ */
+static
+void
+writejournal(void)
+{
+	struct sfs_jdesc jd;
+
+	if (journalblocks == 0) {
+		return;
+	}
+	bzero((void *)&jd, sizeof(jd));
+	writestart(&jd, sizeof(jd), journalstart);
+}
+
 /*
  * Write out the root directory inode.
  */
@@ -180,7 +256,7 @@ writerootdir(void)
 	sfi.sfi_linkcount = SWAP16(1);
 
 	/* Write it out */
-	diskwrite(&sfi, SFS_ROOTDIR_INO);
+	writestart(&sfi, sizeof(sfi), SFS_ROOTDIR_INO);
 }
 
 /*
@@ -196,8 +272,19 @@ main(int argc, char **argv)
 	hostcompat_init(argc, argv);
 #endif
 
+	if (argc==5 && !strcmp(argv[1], "-b")) {
+		bsize = atoi(argv[2]);
+		if (bsize < SFS_BLOCKSIZE || bsize > SFS_MAXBLOCKSIZE ||
+		    (bsize & (bsize - 1)) != 0) {
+			errx(1, "Block size must be a power of 2 "
+			     "from %u to %u", SFS_BLOCKSIZE, SFS_MAXBLOCKSIZE);
+		}
+		argc -= 2;
+		argv += 2;
+	}
 	if (argc!=3) {
-		errx(1, "Usage: mksfs device/diskfile volume-name");
+		errx(1, "Usage: mksfs [-b blocksize] device/diskfile "
+		     "volume-name");
 	}
 
 	check();
@@ -222,16 +309,19 @@ main(int argc, char **argv)
 	opendisk(argv[1]);
 	blocksize = diskblocksize();
 
-	if (blocksize!=SFS_BLOCKSIZE) {
-		errx(1, "Device has wrong blocksize %u (should be %u)\n",
-		     blocksize, SFS_BLOCKSIZE);
+	if (bsize % blocksize != 0) {
+		errx(1, "Device has wrong blocksize %u (should divide %u)\n",
+		     blocksize, bsize);
 	}
+	disksetblocksize(bsize);
 	size = diskblocks();
 
 	/* Write out the on-disk structures */
+	placejournal(size);
 	initfreemap(size);
 	writesuper(volname, size);
 	writefreemap(size);
+	writejournal();
 	writerootdir();
 
 	closedisk();
@@ -141,19 +141,23 @@
 #define SET1_x(sfi, field, i)	(*((void)(i), &(sfi)->field))
 #define SETN_x(sfi, field, i)	((sfi)->field[(i)])
 
+/* entries per indirect block; depends on the volume's block size */
+
+#define DBPERIDB	SFS_DBPERIDB(sb_blocksize())
+
 /* region sizes */
 
 #define RANGE_D		1
-#define RANGE_I		(RANGE_D * SFS_DBPERIDB)
-#define RANGE_II	(RANGE_I * SFS_DBPERIDB)
-#define RANGE_III	(RANGE_II * SFS_DBPERIDB)
+#define RANGE_I		(RANGE_D * DBPERIDB)
+#define RANGE_II	(RANGE_I * DBPERIDB)
+#define RANGE_III	(RANGE_II * DBPERIDB)
 
 /* max blocks */
 
 #define INOMAX_D 	NUM_D
-#define INOMAX_I 	(INOMAX_D + SFS_DBPERIDB * NUM_I)
-#define INOMAX_II	(INOMAX_I + SFS_DBPERIDB * NUM_II)
-#define INOMAX_III	(INOMAX_II + SFS_DBPERIDB * NUM_III)
+#define INOMAX_I 	(INOMAX_D + DBPERIDB * NUM_I)
+#define INOMAX_II	(INOMAX_I + DBPERIDB * NUM_II)
+#define INOMAX_III	(INOMAX_II + DBPERIDB * NUM_III)
 
 
 #endif /* IBMACROS_H */
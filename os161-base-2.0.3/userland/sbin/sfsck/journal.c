@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+
+#include "compat.h"
+#include <kern/sfs.h>
+
+#include "disk.h"
+#include "sfs.h"
+#include "sb.h"
+#include "journal.h"
+#include "main.h"
+
+/*
+ * Checksum over the block images of a transaction; this must match
+ * sfs_journal_cksum in the kernel (FNV-1a over the raw bytes).
+ */
+static
+uint32_t
+journal_cksum(uint32_t sum, const unsigned char *data, size_t len)
+{
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		sum ^= data[i];
+		sum *= 16777619;
+	}
+	return sum;
+}
+
+/*
+ * Replay the journal. A transaction counts only if the descriptor,
+ * the commit block, and the checksum of the images all agree; anything
+ * less is one the kernel never finished committing, so it is ignored
+ * (the home blocks still hold the consistent state from before it).
+ * Replaying is idempotent, so this is safe whether or not the kernel
+ * got as far as checkpointing the blocks itself.
+ */
+void
+journal_replay(void)
+{
+	struct sfs_jdesc jd;
+	struct sfs_jcommit jc;
+	uint32_t start, size, i, sum, bsize;
+	unsigned char *images;
+	int replayedsb = 0;
+
+	start = sb_journalstart();
+	size = sb_journalblocks();
+	if (size == 0) {
+		return;
+	}
+
+	sfs_readjdesc(start, &jd);
+	if (jd.jd_magic != SFS_JDESC_MAGIC || jd.jd_count == 0) {
+		return;
+	}
+	if (jd.jd_count > SFS_JOURNAL_MAXBLOCKS ||
+	    jd.jd_count > size - 2) {
+		warnx("Journal descriptor claims %lu blocks (ignored)",
+		      (unsigned long)jd.jd_count);
+		setbadness(EXIT_RECOV);
+		goto clear;
+	}
+
+	sfs_readjcommit(start + jd.jd_count + 1, &jc);
+	if (jc.jc_magic != SFS_JCOMMIT_MAGIC || jc.jc_seq != jd.jd_seq ||
+	    jc.jc_count != jd.jd_count) {
+		/* Never committed; nothing to do. */
+		goto clear;
+	}
+
+	bsize = sb_blocksize();
+	images = malloc(jd.jd_count * (size_t)bsize);
+	if (images == NULL) {
+		errx(EXIT_FATAL, "Out of memory");
+	}
+	sum = 2166136261U;
+	for (i=0; i<jd.jd_count; i++) {
+		diskread(images + i*bsize, start + 1 + i);
+		sum = journal_cksum(sum, images + i*bsize, bsize);
+	}
+	if (sum != jc.jc_checksum) {
+		warnx("Journal checksum mismatch (transaction dropped)");
+		setbadness(EXIT_RECOV);
+		free(images);
+		goto clear;
+	}
+
+	for (i=0; i<jd.jd_count; i++) {
+		if (jd.jd_blocks[i] >= sb_totalblocks() ||
+		    (jd.jd_blocks[i] >= start &&
+		     jd.jd_blocks[i] < start + size)) {
+			warnx("Journal entry %lu names block %lu (skipped)",
+			      (unsigned long)i,
+			      (unsigned long)jd.jd_blocks[i]);
+			setbadness(EXIT_RECOV);
+			continue;
+		}
+		diskwrite(images + i*bsize, jd.jd_blocks[i]);
+		if (jd.jd_blocks[i] == SFS_SUPER_BLOCK) {
+			replayedsb = 1;
+		}
+	}
+	free(images);
+
+	warnx("Replayed %lu journal blocks", (unsigned long)jd.jd_count);
+	setbadness(EXIT_RECOV);
+
+ clear:
+	jd.jd_count = 0;
+	sfs_writejdesc(start, &jd);
+
+	if (replayedsb) {
+		sb_load();
+		sb_check();
+	}
+}
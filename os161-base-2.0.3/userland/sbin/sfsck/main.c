@@ -30,6 +30,7 @@
 #include <assert.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <err.h>
 
 #include "compat.h"
@@ -37,6 +38,7 @@
 #include "disk.h"
 #include "sfs.h"
 #include "sb.h"
+#include "journal.h"
 #include "freemap.h"
 #include "inode.h"
 #include "passes.h"
@@ -64,13 +66,20 @@ setbadness(int code)
 int
 main(int argc, char **argv)
 {
+	int force = 0;
+
 #ifdef HOST
 	hostcompat_init(argc, argv);
 #endif
 
 	/* FUTURE: add -n option */
+	if (argc==3 && !strcmp(argv[1], "-f")) {
+		force = 1;
+		argc--;
+		argv++;
+	}
 	if (argc!=2) {
-		errx(EXIT_USAGE, "Usage: sfsck device/diskfile");
+		errx(EXIT_USAGE, "Usage: sfsck [-f] device/diskfile");
 	}
 
 	opendisk(argv[1]);
@@ -78,6 +87,18 @@ main(int argc, char **argv)
 	sfs_setup();
 	sb_load();
 	sb_check();
+	journal_replay();
+
+	/*
+	 * A volume that was unmounted cleanly, and needed no repairs
+	 * just now, is consistent; don't check it unless asked to.
+	 */
+	if (!force && sb_isclean() && badness == EXIT_CLEAN) {
+		closedisk();
+		warnx("%s: clean", sb_volname());
+		return EXIT_CLEAN;
+	}
+
 	freemap_setup();
 
 	printf("Phase 1 -- check blocks and sizes\n");
@@ -91,6 +112,11 @@ main(int argc, char **argv)
 	printf("Phase 3 -- check reference counts\n");
 	inode_adjust_filelinks();
 
+	/* Anything wrong has been fixed by now, unless it couldn't be */
+	if (badness < EXIT_UNRECOV) {
+		sb_setclean();
+	}
+
 	closedisk();
 
 	warnx("%lu blocks used (of %lu); %lu directories; %lu files",
@@ -36,6 +36,7 @@
 #include "compat.h"
 #include <kern/sfs.h>
 
+#include "disk.h"
 #include "utils.h"
 #include "sfs.h"
 #include "sb.h"
@@ -45,18 +46,30 @@
 static struct sfs_superblock sb;
 
 /*
- * Load the superblock.
+ * Load the superblock, and from then on read the disk in blocks of
+ * the size it gives. (Until then it is read in sectors, and the
+ * superblock is at the start of sector 0 either way.)
  */
 void
 sb_load(void)
 {
+	uint32_t bsize;
+
 	sfs_readsb(SFS_SUPER_BLOCK, &sb);
 	if (sb.sb_magic != SFS_MAGIC) {
 		errx(EXIT_FATAL, "Not an sfs filesystem");
 	}
 
+	bsize = SFS_SB_BLOCKSIZE(&sb);
+	if (bsize < SFS_BLOCKSIZE || bsize > SFS_MAXBLOCKSIZE ||
+	    (bsize & (bsize - 1)) != 0) {
+		errx(EXIT_FATAL, "Bad block size %lu in superblock",
+		     (unsigned long)bsize);
+	}
+	disksetblocksize(bsize);
+
 	assert(sb.sb_nblocks > 0);
-	assert(SFS_FREEMAPBLOCKS(sb.sb_nblocks) > 0);
+	assert(SFS_FREEMAPBLOCKS(sb.sb_nblocks, bsize) > 0);
 }
 
 /*
@@ -83,6 +96,18 @@ sb_check(void)
 		setbadness(EXIT_RECOV);
 		schanged = 1;
 	}
+	if (sb.sb_journalblocks != 0 &&
+	    (sb.sb_journalblocks < 3 ||
+	     sb.sb_journalstart < SFS_FREEMAP_START + sb_freemapblocks() ||
+	     sb.sb_journalstart >= sb.sb_nblocks ||
+	     sb.sb_journalblocks > sb.sb_nblocks - sb.sb_journalstart)) {
+		warnx("Journal at %lu, size %lu is out of range (dropped)",
+		      (unsigned long)sb.sb_journalstart,
+		      (unsigned long)sb.sb_journalblocks);
+		setbadness(EXIT_RECOV);
+		sb.sb_journalstart = sb.sb_journalblocks = 0;
+		schanged = 1;
+	}
 	if (checkzeroed(sb.reserved, sizeof(sb.reserved))) {
 		warnx("Reserved section of superblock not zeroed (fixed)");
 		setbadness(EXIT_RECOV);
@@ -104,6 +129,15 @@ sb_totalblocks(void)
 	return sb.sb_nblocks;
 }
 
+/*
+ * Return the block size.
+ */
+uint32_t
+sb_blocksize(void)
+{
+	return SFS_SB_BLOCKSIZE(&sb);
+}
+
 /*
  * Return the number of freemap blocks.
  * (this function probably ought to go away)
@@ -111,7 +145,41 @@ sb_totalblocks(void)
 uint32_t
 sb_freemapblocks(void)
 {
-	return SFS_FREEMAPBLOCKS(sb.sb_nblocks);
+	return SFS_FREEMAPBLOCKS(sb.sb_nblocks, sb_blocksize());
+}
+
+/*
+ * Return the first block and the size of the journal; the size is 0
+ * if there is none.
+ */
+uint32_t
+sb_journalstart(void)
+{
+	return sb.sb_journalstart;
+}
+
+uint32_t
+sb_journalblocks(void)
+{
+	return sb.sb_journalblocks;
+}
+
+/*
+ * Check or set the clean flag.
+ */
+int
+sb_isclean(void)
+{
+	return sb.sb_clean == SFS_CLEAN;
+}
+
+void
+sb_setclean(void)
+{
+	if (sb.sb_clean != SFS_CLEAN) {
+		sb.sb_clean = SFS_CLEAN;
+		sfs_writesb(SFS_SUPER_BLOCK, &sb);
+	}
 }
 
 /*
@@ -43,9 +43,22 @@ void sb_load(void);
 /* After the superblock is loaded: return volume size. */
 uint32_t sb_totalblocks(void);
 
+/* After the superblock is loaded: return the block size in bytes. */
+uint32_t sb_blocksize(void);
+
 /* After the superblock is loaded: return number of freemap blocks. */
 uint32_t sb_freemapblocks(void);
 
+/* After the superblock is loaded: return the journal's location/size. */
+uint32_t sb_journalstart(void);
+uint32_t sb_journalblocks(void);
+
+/* After the superblock is loaded: was the volume unmounted cleanly? */
+int sb_isclean(void);
+
+/* Mark the volume clean once it has been checked. */
+void sb_setclean(void);
+
 /* After the superblock is loaded: return volume name. */
 const char *sb_volname(void);
 
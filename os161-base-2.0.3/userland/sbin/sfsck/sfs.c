@@ -40,6 +40,7 @@
 #include "utils.h"
 #include "ibmacros.h"
 #include "sfs.h"
+#include "sb.h"
 #include "main.h"
 
 ////////////////////////////////////////////////////////////
@@ -51,6 +52,8 @@ sfs_setup(void)
 	assert(sizeof(struct sfs_superblock)==SFS_BLOCKSIZE);
 	assert(sizeof(struct sfs_dinode)==SFS_BLOCKSIZE);
 	assert(SFS_BLOCKSIZE % sizeof(struct sfs_direntry) == 0);
+	assert(sizeof(struct sfs_jdesc)==SFS_BLOCKSIZE);
+	assert(sizeof(struct sfs_jcommit)==SFS_BLOCKSIZE);
 }
 
 ////////////////////////////////////////////////////////////
@@ -62,6 +65,34 @@ swapsb(struct sfs_superblock *sb)
 {
 	sb->sb_magic = SWAP32(sb->sb_magic);
 	sb->sb_nblocks = SWAP32(sb->sb_nblocks);
+	sb->sb_journalstart = SWAP32(sb->sb_journalstart);
+	sb->sb_journalblocks = SWAP32(sb->sb_journalblocks);
+	sb->sb_clean = SWAP32(sb->sb_clean);
+	sb->sb_blocksize = SWAP32(sb->sb_blocksize);
+}
+
+static
+void
+swapjdesc(struct sfs_jdesc *jd)
+{
+	unsigned i;
+
+	jd->jd_magic = SWAP32(jd->jd_magic);
+	jd->jd_seq = SWAP32(jd->jd_seq);
+	jd->jd_count = SWAP32(jd->jd_count);
+	for (i=0; i<SFS_JOURNAL_MAXBLOCKS; i++) {
+		jd->jd_blocks[i] = SWAP32(jd->jd_blocks[i]);
+	}
+}
+
+static
+void
+swapjcommit(struct sfs_jcommit *jc)
+{
+	jc->jc_magic = SWAP32(jc->jc_magic);
+	jc->jc_seq = SWAP32(jc->jc_seq);
+	jc->jc_count = SWAP32(jc->jc_count);
+	jc->jc_checksum = SWAP32(jc->jc_checksum);
 }
 
 static
@@ -110,8 +141,8 @@ static
 void
 swapindir(uint32_t *entries)
 {
-	int i;
-	for (i=0; i<SFS_DBPERIDB; i++) {
+	unsigned i;
+	for (i=0; i<DBPERIDB; i++) {
 		entries[i] = SWAP32(entries[i]);
 	}
 }
@@ -132,7 +163,7 @@ static
 uint32_t
 ibmap(uint32_t iblock, uint32_t offset, uint32_t entrysize)
 {
-	uint32_t entries[SFS_DBPERIDB];
+	uint32_t entries[SFS_DBPERIDB(SFS_MAXBLOCKSIZE)];
 
 	if (iblock == 0) {
 		return 0;
@@ -144,10 +175,10 @@ ibmap(uint32_t iblock, uint32_t offset, uint32_t entrysize)
 	if (entrysize > 1) {
 		uint32_t index = offset / entrysize;
 		offset %= entrysize;
-		return ibmap(entries[index], offset, entrysize/SFS_DBPERIDB);
+		return ibmap(entries[index], offset, entrysize/DBPERIDB);
 	}
 	else {
-		assert(offset < SFS_DBPERIDB);
+		assert(offset < DBPERIDB);
 		return entries[offset];
 	}
 }
@@ -187,6 +218,35 @@ bmap(const struct sfs_dinode *sfi, uint32_t fileblock)
 ////////////////////////////////////////////////////////////
 // superblock, free block bitmap, and inode I/O
 
+/*
+ * The superblock, inodes, and journal descriptor and commit blocks
+ * take up the start of their blocks; read and write just that part,
+ * zeroing the rest on write.
+ */
+
+static
+void
+readstart(void *data, size_t len, uint32_t blocknum)
+{
+	char buf[SFS_MAXBLOCKSIZE];
+
+	assert(len <= diskblocksize());
+	diskread(buf, blocknum);
+	memcpy(data, buf, len);
+}
+
+static
+void
+writestart(const void *data, size_t len, uint32_t blocknum)
+{
+	char buf[SFS_MAXBLOCKSIZE];
+
+	assert(len <= diskblocksize());
+	bzero(buf, diskblocksize());
+	memcpy(buf, data, len);
+	diskwrite(buf, blocknum);
+}
+
 /*
  *  superblock - blocknum is a disk block number.
  */
@@ -194,7 +254,7 @@ bmap(const struct sfs_dinode *sfi, uint32_t fileblock)
 void
 sfs_readsb(uint32_t blocknum, struct sfs_superblock *sb)
 {
-	diskread(sb, blocknum);
+	readstart(sb, sizeof(*sb), blocknum);
 	swapsb(sb);
 }
 
@@ -202,10 +262,37 @@ void
 sfs_writesb(uint32_t blocknum, struct sfs_superblock *sb)
 {
 	swapsb(sb);
-	diskwrite(sb, blocknum);
+	writestart(sb, sizeof(*sb), blocknum);
 	swapsb(sb);
 }
 
+/*
+ * journal descriptor and commit blocks - blocknum is a disk block
+ * number.
+ */
+
+void
+sfs_readjdesc(uint32_t blocknum, struct sfs_jdesc *jd)
+{
+	readstart(jd, sizeof(*jd), blocknum);
+	swapjdesc(jd);
+}
+
+void
+sfs_writejdesc(uint32_t blocknum, struct sfs_jdesc *jd)
+{
+	swapjdesc(jd);
+	writestart(jd, sizeof(*jd), blocknum);
+	swapjdesc(jd);
+}
+
+void
+sfs_readjcommit(uint32_t blocknum, struct sfs_jcommit *jc)
+{
+	readstart(jc, sizeof(*jc), blocknum);
+	swapjcommit(jc);
+}
+
 /*
  * freemap blocks - whichblock is a block number within the free block
  * bitmap.
@@ -233,7 +320,7 @@ sfs_writefreemapblock(uint32_t whichblock, uint8_t *bits)
 void
 sfs_readinode(uint32_t ino, struct sfs_dinode *sfi)
 {
-	diskread(sfi, ino);
+	readstart(sfi, sizeof(*sfi), ino);
 	swapinode(sfi);
 }
 
@@ -241,7 +328,7 @@ void
 sfs_writeinode(uint32_t ino, struct sfs_dinode *sfi)
 {
 	swapinode(sfi);
-	diskwrite(sfi, ino);
+	writestart(sfi, sizeof(*sfi), ino);
 	swapinode(sfi);
 }
 
@@ -274,7 +361,7 @@ static
 void
 sfs_readdirblock(struct sfs_direntry *d, uint32_t diskblock)
 {
-	const unsigned atonce = SFS_BLOCKSIZE/sizeof(struct sfs_direntry);
+	const unsigned atonce = sb_blocksize()/sizeof(struct sfs_direntry);
 	unsigned j;
 
 	if (diskblock != 0) {
@@ -285,7 +372,7 @@ sfs_readdirblock(struct sfs_direntry *d, uint32_t diskblock)
 	}
 	else {
 		warnx("Warning: sparse directory found");
-		bzero(d, SFS_BLOCKSIZE);
+		bzero(d, sb_blocksize());
 	}
 }
 
@@ -297,7 +384,7 @@ sfs_readdirblock(struct sfs_direntry *d, uint32_t diskblock)
 void
 sfs_readdir(struct sfs_dinode *sfi, struct sfs_direntry *d, unsigned nd)
 {
-	const unsigned atonce = SFS_BLOCKSIZE/sizeof(struct sfs_direntry);
+	const unsigned atonce = sb_blocksize()/sizeof(struct sfs_direntry);
 	unsigned nblocks = SFS_ROUNDUP(nd, atonce) / atonce;
 	unsigned i, j;
 	unsigned left, thismany;
@@ -330,7 +417,7 @@ static
 void
 sfs_writedirblock(struct sfs_direntry *d, uint32_t diskblock)
 {
-	const unsigned atonce = SFS_BLOCKSIZE/sizeof(struct sfs_direntry);
+	const unsigned atonce = sb_blocksize()/sizeof(struct sfs_direntry);
 	unsigned j, bad;
 
 	if (diskblock != 0) {
@@ -362,7 +449,7 @@ sfs_writedirblock(struct sfs_direntry *d, uint32_t diskblock)
 void
 sfs_writedir(const struct sfs_dinode *sfi, struct sfs_direntry *d, unsigned nd)
 {
-	const unsigned atonce = SFS_BLOCKSIZE/sizeof(struct sfs_direntry);
+	const unsigned atonce = sb_blocksize()/sizeof(struct sfs_direntry);
 	unsigned nblocks = SFS_ROUNDUP(nd, atonce) / atonce;
 	unsigned i, j;
 	unsigned left, thismany;
@@ -0,0 +1,143 @@
+/**
+ * @file appendtest.c
+ *
+ * @brief Test for O_APPEND writes from many processes at once.
+ *
+ *        Some children append fixed-size records to the same file, half of them
+ *        through a descriptor of their own and half through the one inherited
+ *        from the parent, so that their writes are committed in batches. Those
+ *        with their own descriptor check that the seek position after each write
+ *        is just past their record. At the end the file has to hold every record
+ *        exactly once, whole, and those of each child in the order written.
+ *
+ * @version 0.1
+ * @date 2026-10-15
+ *
+ * @copyright Copyright (c) 2022
+ *
+*/
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+
+#define TESTFILE "appendtest.dat"
+#define NPROCS   8
+#define NRECS    64
+#define RECLEN   24
+
+static void mkrecord(char *rec, int proc, int n) {
+    memset(rec, '.', RECLEN);
+    snprintf(rec, RECLEN, "proc %02d record %04d", proc, n);
+    rec[strlen(rec)] = '.';
+    rec[RECLEN - 1] = '\n';
+}
+
+static void child(int proc, int fd) {
+    char rec[RECLEN], back[RECLEN];
+    off_t end;
+    int own = (proc % 2 == 0);
+    int n;
+
+    if (own) {
+        fd = open(TESTFILE, O_RDWR|O_APPEND);
+        if (fd < 0) {
+            err(1, "child %d: %s: open", proc, TESTFILE);
+        }
+    }
+    for (n = 0; n < NRECS; n++) {
+        mkrecord(rec, proc, n);
+        if (write(fd, rec, RECLEN) != RECLEN) {
+            err(1, "child %d: write", proc);
+        }
+        if (!own) {
+            continue;
+        }
+
+        /* THE SEEK POSITION IS JUST PAST OUR OWN RECORD */
+        end = lseek(fd, 0, SEEK_CUR);
+        if (end < RECLEN || end % RECLEN != 0) {
+            errx(1, "child %d: seek position %lld after a write", proc, (long long)end);
+        }
+        if (pread(fd, back, RECLEN, end - RECLEN) != RECLEN) {
+            err(1, "child %d: pread", proc);
+        }
+        if (memcmp(rec, back, RECLEN) != 0) {
+            errx(1, "child %d: record %d is not at %lld", proc, n, (long long)(end - RECLEN));
+        }
+    }
+    _exit(0);
+}
+
+int main(void) {
+    char rec[RECLEN], expected[RECLEN];
+    int next[NPROCS];
+    int fd, i, proc, n, status, failed;
+    unsigned total;
+    pid_t pids[NPROCS];
+
+    fd = open(TESTFILE, O_RDWR|O_CREAT|O_TRUNC|O_APPEND, 0664);
+    if (fd < 0) {
+        err(1, "%s: open", TESTFILE);
+    }
+    if ((fcntl(fd, F_GETFL) & O_APPEND) == 0) {
+        errx(1, "F_GETFL does not report O_APPEND");
+    }
+
+    for (i = 0; i < NPROCS; i++) {
+        pids[i] = fork();
+        if (pids[i] < 0) {
+            err(1, "fork");
+        }
+        if (pids[i] == 0) {
+            child(i, fd);
+        }
+    }
+    failed = 0;
+    for (i = 0; i < NPROCS; i++) {
+        if (waitpid(pids[i], &status, 0) < 0) {
+            err(1, "waitpid");
+        }
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            failed = 1;
+        }
+    }
+    if (failed) {
+        errx(1, "some child failed");
+    }
+
+    /* EVERY RECORD IS THERE ONCE, IN ORDER FOR EACH CHILD */
+    for (i = 0; i < NPROCS; i++) {
+        next[i] = 0;
+    }
+    total = 0;
+    if (lseek(fd, 0, SEEK_SET) != 0) {
+        err(1, "lseek");
+    }
+    while (read(fd, rec, RECLEN) == RECLEN) {
+        proc = atoi(rec + 5);
+        n = atoi(rec + 15);
+        if (memcmp(rec, "proc ", 5) != 0 || proc < 0 || proc >= NPROCS) {
+            errx(1, "garbled record at %u", total * RECLEN);
+        }
+        mkrecord(expected, proc, next[proc]);
+        if (memcmp(rec, expected, RECLEN) != 0) {
+            errx(1, "record %d of child %d out of place at %u", n, proc, total * RECLEN);
+        }
+        next[proc]++;
+        total++;
+    }
+    if (total != NPROCS * NRECS) {
+        errx(1, "%u records, expected %u", total, NPROCS * NRECS);
+    }
+
+    close(fd);
+    remove(TESTFILE);
+    printf("appendtest: passed\n");
+    return 0;
+}
@@ -217,6 +217,7 @@ static
 void
 wait_siblings_child(const char *semname)
 {
+	static const struct timespec pollwait = { 0, 10000000 };
 	pid_t pids[2], mypid, otherpid;
 	int rv, fd, semfd, x;
 	char c;
@@ -249,7 +250,7 @@ wait_siblings_child(const char *semname)
 
 	/*
 	 * In case the semaphore above didn't work, as a backup
-	 * busy-wait until the parent writes the pids into the
+	 * poll every 10 ms until the parent writes the pids into the
 	 * file. If the semaphore did work, this shouldn't loop.
 	 */
 	do {
@@ -265,6 +266,9 @@ wait_siblings_child(const char *semname)
 				    mypid);
 			return;
 		}
+		if (rv < (int)sizeof(pids)) {
+			nanosleep(&pollwait, NULL);
+		}
 	} while (rv < (int)sizeof(pids));
 
 	if (mypid==pids[0]) {
@@ -0,0 +1,260 @@
+/**
+ * @file ckpttest.c
+ *
+ * @brief Test for checkpoint() and restore().
+ *
+ *        The process fills its data, heap and stack with known values, opens
+ *        a file and moves its offset, and saves itself. Everything is then
+ *        changed, and a child restores the image: it must come back from
+ *        checkpoint() with 1 and find the values and the offset as they were
+ *        saved, and the parent's changes nowhere. Restoring a file that is not
+ *        an image must fail and leave the caller running. A second image is
+ *        taken with known values in s0-s7, which must be there again both
+ *        after the call and in the process restored from it.
+ *
+ * @version 0.1
+ * @date 2026-10-15
+ *
+ * @copyright Copyright (c) 2022
+ *
+*/
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <kern/syscall.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+
+#define IMAGE    "ckpttest.img"
+#define SIMAGE   "ckpttest-s.img"
+#define DATAFILE "ckpttest.dat"
+#define PAGESIZE 4096
+#define HEAPSIZE (64 * PAGESIZE)
+#define DATAPOS  1000
+
+static int counter = 17;
+static char *heap;
+
+/* FOR checkpoint_sregs(): THE IMAGE, s0-s7 AFTER THE CALL, v0 AND a3 */
+const char sreg_image[] = SIMAGE;
+unsigned sreg_values[8];
+int sreg_v0, sreg_a3;
+
+static char pattern(unsigned i) {
+    return 'A' + (i * 11) % 23;
+}
+
+/* EVERY FOURTH PAGE OF THE HEAP STARTS WITH A PATTERN, THE OTHERS WITH ZEROS */
+static void fillheap(void) {
+    unsigned i;
+
+    for (i = 0; i < HEAPSIZE; i += 4 * PAGESIZE) {
+        memset(heap + i, pattern(i / PAGESIZE), 64);
+    }
+}
+
+static void checkheap(void) {
+    unsigned i, j;
+
+    for (i = 0; i < HEAPSIZE; i += PAGESIZE) {
+        for (j = 0; j < 64; j++) {
+            char want = (i / PAGESIZE) % 4 == 0 ? pattern(i / PAGESIZE) : 0;
+            if (heap[i + j] != want) {
+                errx(1, "restored: heap byte %u is 0x%x, expected 0x%x",
+                     i + j, (unsigned char)heap[i + j], (unsigned char)want);
+            }
+        }
+    }
+}
+
+/*
+ * checkpoint(SIMAGE) WITH s0-s7 SET TO 0x5a000000 + 0x10 * n, AND THEIR VALUES
+ * STORED RIGHT AFTER THE CALL. IT MAKES THE CALL WITH THE SYSCALL INSTRUCTION
+ * ITSELF (AS libc DOES), SO THAT NO CODE RUNS BETWEEN SETTING THE REGISTERS AND
+ * THE CALL OR BETWEEN ITS RETURN AND READING THEM.
+ */
+static void checkpoint_sregs(void) {
+    __asm volatile(
+        ".set push\n"
+        ".set noreorder\n"
+        "li $16, 0x5a000000\n"
+        "li $17, 0x5a000010\n"
+        "li $18, 0x5a000020\n"
+        "li $19, 0x5a000030\n"
+        "li $20, 0x5a000040\n"
+        "li $21, 0x5a000050\n"
+        "li $22, 0x5a000060\n"
+        "li $23, 0x5a000070\n"
+        "lui $4, %%hi(sreg_image)\n"
+        "addiu $4, $4, %%lo(sreg_image)\n"
+        "li $2, %0\n"
+        "syscall\n"
+        "lui $8, %%hi(sreg_values)\n"
+        "addiu $8, $8, %%lo(sreg_values)\n"
+        "sw $16, 0($8)\n"
+        "sw $17, 4($8)\n"
+        "sw $18, 8($8)\n"
+        "sw $19, 12($8)\n"
+        "sw $20, 16($8)\n"
+        "sw $21, 20($8)\n"
+        "sw $22, 24($8)\n"
+        "sw $23, 28($8)\n"
+        "lui $8, %%hi(sreg_v0)\n"
+        "sw $2, %%lo(sreg_v0)($8)\n"
+        "lui $8, %%hi(sreg_a3)\n"
+        "sw $7, %%lo(sreg_a3)($8)\n"
+        ".set pop\n"
+        :
+        : "i" (SYS_checkpoint)
+        : "$2", "$3", "$4", "$5", "$6", "$7", "$8", "$9", "$10", "$11", "$12",
+          "$13", "$14", "$15", "$16", "$17", "$18", "$19", "$20", "$21", "$22",
+          "$23", "$24", "$25", "$31", "hi", "lo", "memory");
+}
+
+static void checksregs(const char *who) {
+    unsigned n;
+
+    for (n = 0; n < 8; n++) {
+        if (sreg_values[n] != 0x5a000000 + 0x10 * n) {
+            errx(1, "%s: s%u is 0x%x, expected 0x%x", who, n, sreg_values[n],
+                 0x5a000000 + 0x10 * n);
+        }
+    }
+}
+
+/* RUNS IN THE RESTORED IMAGE */
+static void restored(int fd, const char *stackdata) {
+    char c;
+
+    if (counter != 18) {
+        errx(1, "restored: counter is %d, expected 18", counter);
+    }
+    if (strcmp(stackdata, "saved on the stack") != 0) {
+        errx(1, "restored: stack holds \"%s\"", stackdata);
+    }
+    checkheap();
+    if (lseek(fd, 0, SEEK_CUR) != DATAPOS) {
+        errx(1, "restored: file offset is not %d", DATAPOS);
+    }
+    if (read(fd, &c, 1) != 1 || c != pattern(DATAPOS)) {
+        errx(1, "restored: wrong data read at the saved offset");
+    }
+    _exit(0);
+}
+
+int main(void) {
+    char stackdata[32];
+    char filebuf[2 * DATAPOS];
+    unsigned i;
+    int fd, r, status;
+    pid_t pid;
+
+    heap = malloc(HEAPSIZE);
+    if (heap == NULL) {
+        errx(1, "malloc failed");
+    }
+    memset(heap, 0, HEAPSIZE);
+    fillheap();
+    strcpy(stackdata, "saved on the stack");
+
+    /* AN OPEN FILE, READ UP TO DATAPOS */
+    for (i = 0; i < sizeof(filebuf); i++) {
+        filebuf[i] = pattern(i);
+    }
+    fd = open(DATAFILE, O_RDWR | O_CREAT | O_TRUNC, 0664);
+    if (fd < 0) {
+        err(1, "%s", DATAFILE);
+    }
+    if (write(fd, filebuf, sizeof(filebuf)) != (ssize_t)sizeof(filebuf)) {
+        err(1, "write");
+    }
+    if (lseek(fd, DATAPOS, SEEK_SET) != DATAPOS) {
+        err(1, "lseek");
+    }
+
+    counter++;
+    r = checkpoint(IMAGE);
+    if (r < 0) {
+        err(1, "checkpoint");
+    }
+    if (r == 1) {
+        restored(fd, stackdata);
+    }
+    if (r != 0) {
+        errx(1, "checkpoint returned %d", r);
+    }
+    printf("checkpoint saved to %s\n", IMAGE);
+
+    /* CHANGING EVERYTHING THE IMAGE HOLDS */
+    counter = 0;
+    memset(heap, 'x', HEAPSIZE);
+    strcpy(stackdata, "changed after");
+    if (lseek(fd, 0, SEEK_SET) != 0) {
+        err(1, "lseek");
+    }
+
+    /* A FILE THAT IS NOT AN IMAGE IS REFUSED */
+    if (restore(DATAFILE) != -1 || errno != ENOEXEC) {
+        errx(1, "restore of a non-image did not fail with ENOEXEC");
+    }
+    if (counter != 0) {
+        errx(1, "failed restore changed the process");
+    }
+
+    /* A CHILD BECOMES THE SAVED IMAGE */
+    pid = fork();
+    if (pid < 0) {
+        err(1, "fork");
+    }
+    if (pid == 0) {
+        restore(IMAGE);
+        err(1, "restore");
+    }
+    if (waitpid(pid, &status, 0) < 0) {
+        err(1, "waitpid");
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        errx(1, "restored child failed");
+    }
+
+    /* s0-s7 COME BACK FROM THE CALL AND FROM THE IMAGE */
+    checkpoint_sregs();
+    if (sreg_a3 != 0) {
+        errno = sreg_v0;
+        err(1, "checkpoint %s", SIMAGE);
+    }
+    if (sreg_v0 == 1) {
+        checksregs("restored");
+        _exit(0);
+    }
+    if (sreg_v0 != 0) {
+        errx(1, "checkpoint returned %d", sreg_v0);
+    }
+    checksregs("checkpoint");
+    pid = fork();
+    if (pid < 0) {
+        err(1, "fork");
+    }
+    if (pid == 0) {
+        restore(SIMAGE);
+        err(1, "restore");
+    }
+    if (waitpid(pid, &status, 0) < 0) {
+        err(1, "waitpid");
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        errx(1, "child restored with s0-s7 failed");
+    }
+
+    close(fd);
+    remove(IMAGE);
+    remove(SIMAGE);
+    remove(DATAFILE);
+    printf("ckpttest: passed\n");
+    return 0;
+}
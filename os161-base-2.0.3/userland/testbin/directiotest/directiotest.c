@@ -0,0 +1,110 @@
+/**
+ * @file directiotest.c
+ *
+ * @brief Test for O_DIRECT.
+ *
+ *        A file is written through an O_DIRECT descriptor, in whole blocks plus an
+ *        unaligned tail, and read back through an ordinary one, and the other way
+ *        round. Blocks cached by the ordinary descriptor are then overwritten
+ *        directly, and have to read back new; a hole left by seeking past the end
+ *        has to read as zeros through either descriptor.
+ *
+ * @version 0.1
+ * @date 2026-10-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+*/
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+
+#define TESTFILE  "directiotest.dat"
+#define BLOCKSIZE 512
+#define NBLOCKS   40
+#define TAIL      100
+#define FILESIZE  (NBLOCKS * BLOCKSIZE + TAIL)
+
+static char buf[FILESIZE];
+static char back[FILESIZE];
+
+static void fill(char seed) {
+    int i;
+
+    for (i = 0; i < FILESIZE; i++) {
+        buf[i] = seed + i % 19;
+    }
+}
+
+static void put(int fd, off_t pos, const char *data, size_t len) {
+    if (pwrite(fd, data, len, pos) != (ssize_t)len) {
+        err(1, "pwrite of %zu bytes at %lld", len, (long long)pos);
+    }
+}
+
+/* THE len BYTES AT pos HAVE TO BE THOSE OF expected AT pos, OR ZEROS IF IT IS NULL */
+static void check(int fd, off_t pos, const char *expected, size_t len, const char *how) {
+    size_t i;
+
+    if (pread(fd, back, len, pos) != (ssize_t)len) {
+        err(1, "%s: pread of %zu bytes at %lld", how, len, (long long)pos);
+    }
+    for (i = 0; i < len; i++) {
+        char c = expected != NULL ? expected[pos + i] : 0;
+        if (back[i] != c) {
+            errx(1, "%s: byte %lld is 0x%x, expected 0x%x", how, (long long)(pos + i),
+                 (unsigned char)back[i], (unsigned char)c);
+        }
+    }
+}
+
+int main(void) {
+    int dfd, fd;
+
+    dfd = open(TESTFILE, O_RDWR|O_CREAT|O_TRUNC|O_DIRECT, 0664);
+    if (dfd < 0) {
+        err(1, "%s: open with O_DIRECT", TESTFILE);
+    }
+    fd = open(TESTFILE, O_RDWR);
+    if (fd < 0) {
+        err(1, "%s: open", TESTFILE);
+    }
+
+    /* WRITTEN DIRECTLY, READ THROUGH THE CACHE */
+    fill('a');
+    put(dfd, 0, buf, FILESIZE);
+    check(fd, 0, buf, FILESIZE, "cached read of direct writes");
+
+    /* WRITTEN THROUGH THE CACHE, READ DIRECTLY (dirty blocks have to be seen) */
+    fill('A');
+    put(fd, 0, buf, FILESIZE);
+    check(dfd, 0, buf, FILESIZE, "direct read of cached writes");
+
+    /* BLOCKS IN THE CACHE OVERWRITTEN DIRECTLY, UNALIGNED AT BOTH ENDS */
+    check(fd, 0, buf, FILESIZE, "cached read");
+    memset(buf + 3 * BLOCKSIZE - 7, 'z', 20 * BLOCKSIZE + 14);
+    put(dfd, 3 * BLOCKSIZE - 7, buf + 3 * BLOCKSIZE - 7, 20 * BLOCKSIZE + 14);
+    check(fd, 0, buf, FILESIZE, "cached read after direct overwrite");
+    check(dfd, 0, buf, FILESIZE, "direct read after direct overwrite");
+
+    /* A HOLE PAST THE OLD END */
+    put(dfd, 2 * FILESIZE, buf, 4 * BLOCKSIZE);
+    check(dfd, FILESIZE, NULL, FILESIZE, "direct read of a hole");
+    check(fd, FILESIZE, NULL, FILESIZE, "cached read of a hole");
+    if (pread(fd, back, 4 * BLOCKSIZE, 2 * FILESIZE) != 4 * BLOCKSIZE ||
+        memcmp(back, buf, 4 * BLOCKSIZE) != 0) {
+        errx(1, "the blocks after the hole are wrong");
+    }
+
+    close(fd);
+    close(dfd);
+    if (remove(TESTFILE) < 0) {
+        err(1, "%s: remove", TESTFILE);
+    }
+    printf("directiotest: passed\n");
+    return 0;
+}
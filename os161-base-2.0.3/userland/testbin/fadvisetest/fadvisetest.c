@@ -0,0 +1,192 @@
+/**
+ * @file fadvisetest.c
+ * 
+ * @brief Test for posix_fadvise() and madvise().
+ * 
+ *        A file is read sequentially, at random and again after each of the
+ *        posix_fadvise() hints, checking every time that the hints change how
+ *        far the file is read ahead and which blocks are cached, but never
+ *        what the reads return. The same is done through a file mapping with
+ *        madvise(), and anonymous memory is checked to survive MADV_DONTNEED.
+ *        Bad advice, ranges and descriptors must be refused.
+ * 
+ * @version 0.1
+ * @date 2026-10-15
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+*/
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+
+#define TESTFILE "fadvisetest.dat"
+#define PAGESIZE 4096
+#define PAGES    16
+#define FILESIZE (PAGES * PAGESIZE)
+#define CHUNK    512
+
+static char buf[FILESIZE];
+
+static char pattern(off_t pos) {
+    return 'a' + (pos * 7) % 19;
+}
+
+/* THE len BYTES AT data, FROM pos IN THE FILE, SHOULD HOLD THE PATTERN */
+static void check(const char *data, off_t pos, size_t len, const char *what) {
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if (data[i] != pattern(pos + i)) {
+            errx(1, "%s: byte %lld is 0x%x, expected 0x%x", what, (long long)(pos + i),
+                 (unsigned char)data[i], (unsigned char)pattern(pos + i));
+        }
+    }
+}
+
+/* READ THE WHOLE FILE THROUGH fd IN CHUNKS, SEQUENTIALLY */
+static void readall(int fd, const char *what) {
+    char chunk[CHUNK];
+    off_t pos;
+
+    if (lseek(fd, 0, SEEK_SET) < 0) {
+        err(1, "lseek");
+    }
+    for (pos = 0; pos < FILESIZE; pos += CHUNK) {
+        if (read(fd, chunk, CHUNK) != CHUNK) {
+            err(1, "%s: read at %lld", what, (long long)pos);
+        }
+        check(chunk, pos, CHUNK, what);
+    }
+}
+
+/* READ CHUNKS OF THE FILE IN A SCATTERED ORDER */
+static void readscattered(int fd, const char *what) {
+    char chunk[CHUNK];
+    unsigned i, n = FILESIZE / CHUNK;
+    off_t pos;
+
+    for (i = 0; i < n; i++) {
+        pos = (off_t)((i * 37) % n) * CHUNK;
+        if (pread(fd, chunk, CHUNK, pos) != CHUNK) {
+            err(1, "%s: pread at %lld", what, (long long)pos);
+        }
+        check(chunk, pos, CHUNK, what);
+    }
+}
+
+static void expect_fail(int result, int error, const char *what) {
+    if (result != -1) {
+        errx(1, "%s: succeeded", what);
+    }
+    if (errno != error) {
+        errx(1, "%s: errno %d, expected %d", what, errno, error);
+    }
+}
+
+int main(void) {
+    int fd, p[2];
+    off_t i;
+    char *map, *anon;
+
+    fd = open(TESTFILE, O_RDWR|O_CREAT|O_TRUNC, 0664);
+    if (fd < 0) {
+        err(1, "%s: open", TESTFILE);
+    }
+    for (i = 0; i < FILESIZE; i++) {
+        buf[i] = pattern(i);
+    }
+    if (write(fd, buf, FILESIZE) != FILESIZE) {
+        err(1, "write");
+    }
+
+    /* ACCESS PATTERNS: THE DATA READ MUST NOT DEPEND ON THEM */
+    if (posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL) < 0) {
+        err(1, "POSIX_FADV_SEQUENTIAL");
+    }
+    readall(fd, "sequential");
+    readscattered(fd, "sequential, scattered");
+    if (posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM) < 0) {
+        err(1, "POSIX_FADV_RANDOM");
+    }
+    readscattered(fd, "random");
+    readall(fd, "random, in order");
+    if (posix_fadvise(fd, 0, 0, POSIX_FADV_NORMAL) < 0) {
+        err(1, "POSIX_FADV_NORMAL");
+    }
+    readall(fd, "normal");
+
+    /* RANGE HINTS, INCLUDING ONE PAST THE END OF THE FILE */
+    if (posix_fadvise(fd, 0, FILESIZE / 2, POSIX_FADV_DONTNEED) < 0) {
+        err(1, "POSIX_FADV_DONTNEED");
+    }
+    readscattered(fd, "after DONTNEED");
+    if (posix_fadvise(fd, FILESIZE / 2, 10 * FILESIZE, POSIX_FADV_WILLNEED) < 0) {
+        err(1, "POSIX_FADV_WILLNEED");
+    }
+    readall(fd, "after WILLNEED");
+
+    /* BAD ADVICE, RANGES AND DESCRIPTORS */
+    expect_fail(posix_fadvise(fd, 0, 0, 99), EINVAL, "bad advice");
+    expect_fail(posix_fadvise(fd, -1, 0, POSIX_FADV_NORMAL), EINVAL, "negative offset");
+    expect_fail(posix_fadvise(fd, 0, -1, POSIX_FADV_NORMAL), EINVAL, "negative length");
+    expect_fail(posix_fadvise(-1, 0, 0, POSIX_FADV_NORMAL), EBADF, "bad descriptor");
+    if (pipe(p) < 0) {
+        err(1, "pipe");
+    }
+    expect_fail(posix_fadvise(p[0], 0, 0, POSIX_FADV_SEQUENTIAL), ESPIPE, "pipe");
+    close(p[0]);
+    close(p[1]);
+
+    /* THE SAME THROUGH A FILE MAPPING */
+    map = mmap(NULL, FILESIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        err(1, "mmap");
+    }
+    if (madvise(map, FILESIZE, MADV_SEQUENTIAL) < 0) {
+        err(1, "MADV_SEQUENTIAL");
+    }
+    check(map, 0, FILESIZE / 2, "mapped, sequential");
+    if (madvise(map + FILESIZE / 2, FILESIZE / 2, MADV_WILLNEED) < 0) {
+        err(1, "MADV_WILLNEED");
+    }
+    if (madvise(map, FILESIZE, MADV_RANDOM) < 0) {
+        err(1, "MADV_RANDOM");
+    }
+    check(map + FILESIZE / 2, FILESIZE / 2, FILESIZE / 2, "mapped, random");
+    if (madvise(map, FILESIZE, MADV_DONTNEED) < 0) {
+        err(1, "MADV_DONTNEED on a mapping");
+    }
+    check(map, 0, FILESIZE, "mapped, after DONTNEED");
+    expect_fail(madvise(map + 1, PAGESIZE, MADV_NORMAL), EINVAL, "unaligned address");
+    expect_fail(madvise(map, PAGESIZE, -1), EINVAL, "bad madvise advice");
+    if (munmap(map, FILESIZE) < 0) {
+        err(1, "munmap");
+    }
+    expect_fail(madvise(map, PAGESIZE, MADV_NORMAL), ENOMEM, "unmapped range");
+
+    /* ANONYMOUS MEMORY KEEPS ITS CONTENTS (MADV_DONTNEED DISCARDS NOTHING HERE) */
+    anon = mmap(NULL, FILESIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+    if (anon == MAP_FAILED) {
+        err(1, "mmap anonymous");
+    }
+    memcpy(anon, buf, FILESIZE);
+    if (madvise(anon, FILESIZE, MADV_DONTNEED) < 0) {
+        err(1, "MADV_DONTNEED on anonymous memory");
+    }
+    check(anon, 0, FILESIZE, "anonymous, after DONTNEED");
+    munmap(anon, FILESIZE);
+
+    close(fd);
+    if (remove(TESTFILE) < 0) {
+        err(1, "%s: remove", TESTFILE);
+    }
+    printf("fadvisetest: passed\n");
+    return 0;
+}
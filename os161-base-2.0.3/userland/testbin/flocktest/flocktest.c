@@ -0,0 +1,186 @@
+/**
+ * @file flocktest.c
+ *
+ * @brief Test for the byte-range locks of fcntl().
+ *
+ *        The parent write-locks the start of a file. A child has to find it in
+ *        the way of F_SETLK and reported by F_GETLK, while it can lock and write
+ *        a disjoint range at once; then it waits in F_SETLKW for the parent's
+ *        range. The parent, asking for the child's range in turn, has to get
+ *        EDEADLK; once it unlocks, the child goes on. Finally closing any
+ *        descriptor of the file has to drop the locks of the process on it.
+ *
+ * @version 0.1
+ * @date 2026-10-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+*/
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <err.h>
+
+#define TESTFILE "flocktest.dat"
+#define FILESIZE 4096
+
+static int setlk(int fd, int cmd, int type, off_t start, off_t len) {
+    struct flock fl;
+
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = start;
+    fl.l_len = len;
+    return fcntl(fd, cmd, &fl);
+}
+
+static void fill(int fd, char c, off_t start, size_t len) {
+    char buf[FILESIZE];
+
+    memset(buf, c, len);
+    if (pwrite(fd, buf, len, start) != (ssize_t)len) {
+        err(1, "pwrite");
+    }
+}
+
+static void expect(int fd, char c, off_t start, size_t len) {
+    char buf[FILESIZE];
+    size_t i;
+
+    if (pread(fd, buf, len, start) != (ssize_t)len) {
+        err(1, "pread");
+    }
+    for (i = 0; i < len; i++) {
+        if (buf[i] != c) {
+            errx(1, "byte %lld is '%c', expected '%c'", (long long)(start + i), buf[i], c);
+        }
+    }
+}
+
+static void child(int fd, int ready) {
+    struct flock fl;
+
+    /* THE PARENT'S RANGE IS TAKEN, EVEN FOR READING */
+    if (setlk(fd, F_SETLK, F_WRLCK, 500, 100) == 0 || errno != EAGAIN) {
+        errx(1, "child: F_SETLK over the parent's lock did not fail with EAGAIN");
+    }
+    if (setlk(fd, F_SETLK, F_RDLCK, 0, 10) == 0 || errno != EAGAIN) {
+        errx(1, "child: F_RDLCK over the parent's lock did not fail with EAGAIN");
+    }
+    fl.l_type = F_WRLCK;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = 500;
+    fl.l_len = 100;
+    if (fcntl(fd, F_GETLK, &fl) < 0) {
+        err(1, "child: F_GETLK");
+    }
+    if (fl.l_type != F_WRLCK || fl.l_start != 0 || fl.l_len != 1000 || fl.l_pid != getppid()) {
+        errx(1, "child: F_GETLK reported type %d, [%lld, +%lld) of pid %d", fl.l_type,
+             (long long)fl.l_start, (long long)fl.l_len, fl.l_pid);
+    }
+
+    /* A DISJOINT RANGE IS FREE */
+    if (setlk(fd, F_SETLK, F_WRLCK, 1000, 1000) < 0) {
+        err(1, "child: F_SETLK on a disjoint range");
+    }
+    fill(fd, 'c', 1000, 1000);
+
+    /* WAITING FOR THE PARENT'S RANGE */
+    if (write(ready, "r", 1) != 1) {
+        err(1, "child: write");
+    }
+    if (setlk(fd, F_SETLKW, F_WRLCK, 0, 100) < 0) {
+        err(1, "child: F_SETLKW");
+    }
+    fill(fd, 'c', 0, 100);
+    _exit(0);
+}
+
+int main(void) {
+    struct timespec nap;
+    int fd, fd2, fds[2], status;
+    char c;
+    pid_t pid;
+
+    fd = open(TESTFILE, O_RDWR|O_CREAT|O_TRUNC, 0664);
+    if (fd < 0) {
+        err(1, "%s: open", TESTFILE);
+    }
+    fill(fd, 'p', 0, FILESIZE);
+    if (pipe(fds) < 0) {
+        err(1, "pipe");
+    }
+
+    if (setlk(fd, F_SETLK, F_WRLCK, 0, 1000) < 0) {
+        err(1, "F_SETLK");
+    }
+    pid = fork();
+    if (pid < 0) {
+        err(1, "fork");
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        child(fd, fds[1]);
+    }
+    close(fds[1]);
+
+    /* ONCE THE CHILD SLEEPS WAITING FOR US, WAITING FOR IT WOULD DEADLOCK */
+    if (read(fds[0], &c, 1) != 1) {
+        errx(1, "the child failed");
+    }
+    nap.tv_sec = 0;
+    nap.tv_nsec = 200 * 1000 * 1000;
+    nanosleep(&nap, NULL);
+    if (setlk(fd, F_SETLKW, F_WRLCK, 1500, 100) == 0 || errno != EDEADLK) {
+        errx(1, "F_SETLKW on the child's range did not fail with EDEADLK");
+    }
+    expect(fd, 'p', 0, 100);
+
+    /* LETTING THE CHILD GO */
+    if (setlk(fd, F_SETLK, F_UNLCK, 0, 0) < 0) {
+        err(1, "F_UNLCK");
+    }
+    if (waitpid(pid, &status, 0) < 0) {
+        err(1, "waitpid");
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        errx(1, "the child failed");
+    }
+    expect(fd, 'c', 0, 100);
+    expect(fd, 'p', 100, 900);
+    expect(fd, 'c', 1000, 1000);
+
+    /* ITS LOCKS WENT WITH IT; OURS GO WITH ANY DESCRIPTOR OF THE FILE */
+    if (setlk(fd, F_SETLK, F_WRLCK, 0, 0) < 0) {
+        err(1, "F_SETLK after the child exited");
+    }
+    fd2 = open(TESTFILE, O_RDONLY);
+    if (fd2 < 0) {
+        err(1, "%s: open", TESTFILE);
+    }
+    close(fd2);
+    pid = fork();
+    if (pid < 0) {
+        err(1, "fork");
+    }
+    if (pid == 0) {
+        _exit(setlk(fd, F_SETLK, F_WRLCK, 0, 0) < 0);
+    }
+    if (waitpid(pid, &status, 0) < 0) {
+        err(1, "waitpid");
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        errx(1, "the lock survived close()");
+    }
+
+    close(fd);
+    remove(TESTFILE);
+    printf("flocktest: passed\n");
+    return 0;
+}
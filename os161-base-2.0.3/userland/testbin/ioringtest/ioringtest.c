@@ -0,0 +1,171 @@
+/**
+ * @file ioringtest.c
+ *
+ * @brief Test for ioring_enter().
+ *
+ *        A file is opened, written with pwrite and read back with pread through
+ *        an ioring of eight slots, and closed, each batch with one call. Twelve
+ *        writes are pushed through the ring without reaping completions in
+ *        between, so that the kernel has to stop when the completion ring is
+ *        full and the indices have to wrap. Bad requests have to fail in their
+ *        completion only, and a malformed ring has to fail the call.
+ *
+ * @version 0.1
+ * @date 2026-10-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+*/
+
+#include <sys/types.h>
+#include <sys/ioring.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+
+#define TESTFILE "ioringtest.dat"
+#define ENTRIES  8
+#define NCHUNKS  12
+#define CHUNK    100
+
+static struct ioring_sqe sq[ENTRIES];
+static struct ioring_cqe cq[ENTRIES];
+static struct ioring ring;
+static char data[NCHUNKS][CHUNK];
+static char back[NCHUNKS][CHUNK];
+
+static void submit(int op, int fd, void *buf, size_t len, off_t offset, unsigned tag) {
+    struct ioring_sqe *sqe;
+
+    if (ring.ir_sqtail - ring.ir_sqhead == ENTRIES) {
+        errx(1, "submission ring full");
+    }
+    sqe = &sq[ring.ir_sqtail % ENTRIES];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->sqe_op = op;
+    sqe->sqe_fd = fd;
+    sqe->sqe_buf = buf;
+    sqe->sqe_len = len;
+    sqe->sqe_offset = offset;
+    sqe->sqe_flags = O_RDWR|O_CREAT|O_TRUNC;
+    sqe->sqe_mode = 0664;
+    sqe->sqe_data = tag;
+    ring.ir_sqtail++;
+}
+
+static void enter(int expected) {
+    int r;
+
+    r = ioring_enter(&ring);
+    if (r < 0) {
+        err(1, "ioring_enter");
+    }
+    if (r != expected) {
+        errx(1, "ioring_enter took %d submissions, expected %d", r, expected);
+    }
+}
+
+/* TAKES THE NEXT COMPLETION, WHICH HAS TO BE FOR TAG */
+static int reap(unsigned tag) {
+    struct ioring_cqe *cqe;
+
+    if (ring.ir_cqhead == ring.ir_cqtail) {
+        errx(1, "no completion for request %u", tag);
+    }
+    cqe = &cq[ring.ir_cqhead % ENTRIES];
+    ring.ir_cqhead++;
+    if (cqe->cqe_data != tag) {
+        errx(1, "completion for request %u, expected %u", cqe->cqe_data, tag);
+    }
+    return cqe->cqe_res;
+}
+
+int main(void) {
+    int fd, i, j, r;
+
+    ring.ir_entries = ENTRIES;
+    ring.ir_sq = sq;
+    ring.ir_cq = cq;
+    for (i = 0; i < NCHUNKS; i++) {
+        for (j = 0; j < CHUNK; j++) {
+            data[i][j] = 'a' + (i + j) % 26;
+        }
+    }
+
+    /* OPEN */
+    submit(IORING_OP_OPEN, -1, (void *)TESTFILE, 0, 0, 100);
+    enter(1);
+    fd = reap(100);
+    if (fd < 0) {
+        errx(1, "%s: open: %s", TESTFILE, strerror(-fd));
+    }
+
+    /* SIX WRITES, THEN SIX MORE WITH ROOM FOR ONLY TWO COMPLETIONS */
+    for (i = 0; i < 6; i++) {
+        submit(IORING_OP_PWRITE, fd, data[i], CHUNK, i * CHUNK, i);
+    }
+    enter(6);
+    for (i = 6; i < NCHUNKS; i++) {
+        submit(IORING_OP_PWRITE, fd, data[i], CHUNK, i * CHUNK, i);
+    }
+    enter(2);
+    for (i = 0; i < 8; i++) {
+        if ((r = reap(i)) != CHUNK) {
+            errx(1, "write %d returned %d", i, r);
+        }
+    }
+    enter(4);
+    for (i = 8; i < NCHUNKS; i++) {
+        if ((r = reap(i)) != CHUNK) {
+            errx(1, "write %d returned %d", i, r);
+        }
+    }
+    enter(0);
+
+    /* READ BACK, BACKWARDS, WITH BAD REQUESTS IN BETWEEN */
+    for (i = NCHUNKS - 1; i >= 0; i -= 2) {
+        submit(IORING_OP_PREAD, fd, back[i], CHUNK, i * CHUNK, i);
+        submit(IORING_OP_PREAD, fd, back[i - 1], CHUNK, (i - 1) * CHUNK, i - 1);
+        submit(IORING_OP_READ, -1, back[0], CHUNK, 0, 200);
+        submit(0, fd, NULL, 0, 0, 201);
+        enter(4);
+        if ((r = reap(i)) != CHUNK || (r = reap(i - 1)) != CHUNK) {
+            errx(1, "read around %d returned %d", i, r);
+        }
+        if ((r = reap(200)) != -EBADF) {
+            errx(1, "read of a bad fd returned %d", r);
+        }
+        if ((r = reap(201)) != -EINVAL) {
+            errx(1, "a bad operation returned %d", r);
+        }
+    }
+    if (memcmp(data, back, sizeof(data)) != 0) {
+        errx(1, "the file does not hold what was written");
+    }
+
+    /* CLOSE, TWICE */
+    submit(IORING_OP_CLOSE, fd, NULL, 0, 0, 300);
+    submit(IORING_OP_CLOSE, fd, NULL, 0, 0, 301);
+    enter(2);
+    if ((r = reap(300)) != 0) {
+        errx(1, "close returned %d", r);
+    }
+    if ((r = reap(301)) != -EBADF) {
+        errx(1, "second close returned %d", r);
+    }
+
+    /* A MALFORMED RING */
+    ring.ir_entries = 3;
+    if (ioring_enter(&ring) >= 0 || errno != EINVAL) {
+        errx(1, "ioring_enter accepted a ring of 3 slots");
+    }
+
+    if (remove(TESTFILE) < 0) {
+        err(1, "%s: remove", TESTFILE);
+    }
+    printf("ioringtest: passed\n");
+    return 0;
+}
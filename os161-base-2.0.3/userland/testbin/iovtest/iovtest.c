@@ -0,0 +1,121 @@
+/**
+ * @file iovtest.c
+ * 
+ * @brief Test for the vectored and positional I/O system calls readv(), writev(),
+ *        pread() and pwrite().
+ * 
+ *        A header and a payload, kept in two separate buffers, are written with a
+ *        single writev(); the file is then read back with a single readv() into two
+ *        buffers of different sizes, and the contents and the seek position are checked.
+ *        Finally pwrite()/pread() are checked not to move the seek position.
+ * 
+ * @version 0.1
+ * @date 2026-10-14
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+*/
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+
+#define TESTFILE "iovtest.dat"
+
+static const char header[] = "HDR:";
+static const char payload[] = "QUO USQUE TANDEM ABUTERE CATILINA PATENTIA NOSTRA\n";
+
+int
+main(void)
+{
+	struct iovec iov[2];
+	char first[7], second[64];
+	size_t total = strlen(header) + strlen(payload);
+	ssize_t r;
+	off_t pos;
+	int fd;
+
+	fd = open(TESTFILE, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s: open", TESTFILE);
+	}
+
+	/* GATHER: header + payload with one call */
+	iov[0].iov_base = (void *)header;
+	iov[0].iov_len = strlen(header);
+	iov[1].iov_base = (void *)payload;
+	iov[1].iov_len = strlen(payload);
+	r = writev(fd, iov, 2);
+	if (r < 0) {
+		err(1, "writev");
+	}
+	if ((size_t)r != total) {
+		errx(1, "writev: wrote %zd bytes, expected %zu", r, total);
+	}
+
+	pos = lseek(fd, 0, SEEK_CUR);
+	if (pos != (off_t)total) {
+		errx(1, "writev: seek position %lld, expected %zu",
+		     (long long)pos, total);
+	}
+
+	/* SCATTER: read everything back into two differently sized buffers */
+	if (lseek(fd, 0, SEEK_SET) != 0) {
+		err(1, "lseek");
+	}
+	iov[0].iov_base = first;
+	iov[0].iov_len = sizeof(first);
+	iov[1].iov_base = second;
+	iov[1].iov_len = sizeof(second);
+	r = readv(fd, iov, 2);
+	if (r < 0) {
+		err(1, "readv");
+	}
+	if ((size_t)r != total) {
+		errx(1, "readv: read %zd bytes, expected %zu", r, total);
+	}
+	if (memcmp(first, header, strlen(header)) != 0 ||
+	    memcmp(first + strlen(header), payload,
+		   sizeof(first) - strlen(header)) != 0 ||
+	    memcmp(second, payload + sizeof(first) - strlen(header),
+		   total - sizeof(first)) != 0) {
+		errx(1, "readv: got wrong data");
+	}
+
+	/* POSITIONAL I/O: must not move the seek position */
+	pos = lseek(fd, 0, SEEK_CUR);
+	r = pwrite(fd, "hdr:", 4, 0);
+	if (r != 4) {
+		err(1, "pwrite");
+	}
+	r = pread(fd, first, 4, 0);
+	if (r != 4) {
+		err(1, "pread");
+	}
+	if (memcmp(first, "hdr:", 4) != 0) {
+		errx(1, "pread: got wrong data");
+	}
+	if (lseek(fd, 0, SEEK_CUR) != pos) {
+		errx(1, "pread/pwrite moved the seek position");
+	}
+
+	/* BAD ARGUMENTS */
+	if (readv(fd, iov, 0) >= 0) {
+		errx(1, "readv with iovcnt 0 succeeded");
+	}
+	if (writev(-1, iov, 1) >= 0) {
+		errx(1, "writev on fd -1 succeeded");
+	}
+	if (pread(fd, first, 1, -1) >= 0) {
+		errx(1, "pread at offset -1 succeeded");
+	}
+
+	close(fd);
+	remove(TESTFILE);
+	printf("iovtest: passed\n");
+	return 0;
+}
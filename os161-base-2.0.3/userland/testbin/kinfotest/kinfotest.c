@@ -0,0 +1,93 @@
+/**
+ * @file kinfotest.c
+ *
+ * @brief Test for the kernel info pages, through getpid(), getppid() and time().
+ *
+ *        A forked child reports its getpid() and getppid() through a pipe, and
+ *        they have to be what fork() returned and the parent's getpid(). time(),
+ *        which reads the time page, has to agree with the __time() system call
+ *        and never go backwards over many calls.
+ *
+ * @version 0.1
+ * @date 2026-10-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+*/
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+#include <err.h>
+
+#define NCALLS 100000
+
+int main(void) {
+    pid_t mypid, child, ids[2];
+    time_t t, last, syst;
+    int fds[2], status, i;
+
+    mypid = getpid();
+    if (mypid <= 0 || getpid() != mypid) {
+        errx(1, "getpid returned %d", (int)mypid);
+    }
+
+    /* THE CHILD HAS TO SEE ITS OWN PID, AND OURS AS ITS PARENT */
+    if (pipe(fds) < 0) {
+        err(1, "pipe");
+    }
+    child = fork();
+    if (child < 0) {
+        err(1, "fork");
+    }
+    if (child == 0) {
+        close(fds[0]);
+        ids[0] = getpid();
+        ids[1] = getppid();
+        if (write(fds[1], ids, sizeof(ids)) != sizeof(ids)) {
+            _exit(1);
+        }
+        _exit(0);
+    }
+    close(fds[1]);
+    if (read(fds[0], ids, sizeof(ids)) != sizeof(ids)) {
+        errx(1, "no pids from the child");
+    }
+    close(fds[0]);
+    if (waitpid(child, &status, 0) < 0) {
+        err(1, "waitpid");
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        errx(1, "the child failed");
+    }
+    if (ids[0] != child) {
+        errx(1, "the child's getpid is %d, fork returned %d", (int)ids[0], (int)child);
+    }
+    if (ids[1] != mypid) {
+        errx(1, "the child's getppid is %d, expected %d", (int)ids[1], (int)mypid);
+    }
+    if (getpid() != mypid) {
+        errx(1, "getpid changed after fork");
+    }
+
+    /* TIME FROM THE PAGE AGREES WITH THE SYSTEM CALL, AND IS MONOTONIC */
+    last = time(NULL);
+    if (__time(&syst, NULL) < 0) {
+        err(1, "__time");
+    }
+    if (syst < last || syst - last > 1) {
+        errx(1, "time says %ld, __time says %ld", (long)last, (long)syst);
+    }
+    for (i = 0; i < NCALLS; i++) {
+        t = time(NULL);
+        if (t < last) {
+            errx(1, "time went back from %ld to %ld", (long)last, (long)t);
+        }
+        last = t;
+    }
+
+    printf("kinfotest: passed\n");
+    return 0;
+}
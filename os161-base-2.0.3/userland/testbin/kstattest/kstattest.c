@@ -0,0 +1,118 @@
+/**
+ * @file kstattest.c
+ *
+ * @brief Test for the kstat: device.
+ *
+ *        kstat: has to refuse to be opened for writing. Read to the end, it has
+ *        to return lines of a name without blanks and a decimal value, among
+ *        them the snapshot time, the context switch count, our own process's
+ *        system call count and the calls to read. A second snapshot has to be
+ *        later, and count the reads of the first one.
+ *
+ * @version 0.1
+ * @date 2026-10-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+*/
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+
+#define KSTAT   "kstat:"
+#define BUFSIZE (256 * 1024)
+
+static char buf[BUFSIZE];
+
+/* READS A WHOLE SNAPSHOT, AND CHECKS THE FORMAT OF EVERY LINE */
+static void snapshot(void) {
+    size_t len = 0;
+    ssize_t r;
+    char *line, *end, *p;
+    int fd, n;
+
+    fd = open(KSTAT, O_RDONLY);
+    if (fd < 0) {
+        err(1, "%s", KSTAT);
+    }
+    while ((r = read(fd, buf + len, 4096)) > 0) {
+        len += r;
+        if (len + 4096 >= BUFSIZE) {
+            errx(1, "the snapshot is over %d bytes", BUFSIZE);
+        }
+    }
+    if (r < 0) {
+        err(1, "%s: read", KSTAT);
+    }
+    close(fd);
+    buf[len] = 0;
+    if (len == 0 || buf[len - 1] != '\n') {
+        errx(1, "the snapshot does not end with a newline");
+    }
+
+    for (line = buf, n = 1; *line != 0; line = end + 1, n++) {
+        end = strchr(line, '\n');
+        p = strchr(line, ' ');
+        if (p == NULL || p > end || p == line || p + 1 == end) {
+            errx(1, "line %d is not a name and a value", n);
+        }
+        for (p++; p < end; p++) {
+            if (*p < '0' || *p > '9') {
+                errx(1, "line %d has a bad value", n);
+            }
+        }
+    }
+}
+
+/* THE VALUE OF COUNTER name IN THE LAST SNAPSHOT */
+static unsigned long long value(const char *name) {
+    size_t len = strlen(name);
+    unsigned long long v;
+    char *line, *end, *p;
+
+    for (line = buf; *line != 0; line = end + 1) {
+        end = strchr(line, '\n');
+        if ((size_t)(end - line) > len && memcmp(line, name, len) == 0 && line[len] == ' ') {
+            v = 0;
+            for (p = line + len + 1; p < end; p++) {
+                v = v * 10 + (*p - '0');
+            }
+            return v;
+        }
+    }
+    errx(1, "no %s in the snapshot", name);
+}
+
+int main(void) {
+    unsigned long long time1, reads1;
+    char name[64];
+
+    if (open(KSTAT, O_WRONLY) >= 0 || open(KSTAT, O_RDWR) >= 0) {
+        errx(1, "%s can be opened for writing", KSTAT);
+    }
+
+    snapshot();
+    time1 = value("kstat.time");
+    reads1 = value("syscall.read.calls");
+    (void)value("sched.switches");
+    (void)value("cpu.0.runqueue");
+    snprintf(name, sizeof(name), "proc.%d.syscalls", (int)getpid());
+    if (value(name) == 0) {
+        errx(1, "%s is 0", name);
+    }
+
+    snapshot();
+    if (value("kstat.time") <= time1) {
+        errx(1, "the second snapshot is not later than the first");
+    }
+    if (value("syscall.read.calls") <= reads1) {
+        errx(1, "the reads of the first snapshot were not counted");
+    }
+
+    printf("kstattest: passed\n");
+    return 0;
+}
@@ -0,0 +1,139 @@
+/**
+ * @file mmaptest.c
+ *
+ * @brief Test for mmap(), msync() and munmap().
+ *
+ *        A file a few pages long is filled with a pattern and mapped shared:
+ *        the mapping is checked against the file, changed, and msync()ed, after
+ *        which read() has to see the change. A private mapping is then changed
+ *        and unmapped, and the file has to be as it was. Finally a hole is
+ *        unmapped in the middle of a mapping, leaving the pages around it usable.
+ *
+ * @version 0.1
+ * @date 2026-10-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+*/
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+
+#define TESTFILE "mmaptest.dat"
+#define PAGES    4
+#define PAGESIZE 4096
+#define FILESIZE (PAGES * PAGESIZE)
+
+static char buf[FILESIZE];
+
+static char pattern(off_t pos) {
+    return 'a' + pos % 23;
+}
+
+/* THE FILE SHOULD HOLD THE PATTERN, EXCEPT FOR what AT EVERY PAGE START */
+static void check(int fd, char what) {
+    off_t i;
+    ssize_t r;
+
+    r = pread(fd, buf, FILESIZE, 0);
+    if (r != FILESIZE) {
+        errx(1, "pread: got %zd bytes, expected %d", r, FILESIZE);
+    }
+    for (i = 0; i < FILESIZE; i++) {
+        char expected = (what != 0 && i % PAGESIZE == 0) ? what : pattern(i);
+        if (buf[i] != expected) {
+            errx(1, "byte %lld of the file is 0x%x, expected 0x%x", (long long)i,
+                 (unsigned char)buf[i], (unsigned char)expected);
+        }
+    }
+}
+
+static char *map(int fd, int prot, int flags, off_t offset, size_t len) {
+    void *p;
+
+    p = mmap(NULL, len, prot, flags, fd, offset);
+    if (p == MAP_FAILED) {
+        err(1, "mmap");
+    }
+    return p;
+}
+
+int main(void) {
+    char *p;
+    off_t i;
+    int fd;
+
+    fd = open(TESTFILE, O_RDWR|O_CREAT|O_TRUNC, 0664);
+    if (fd < 0) {
+        err(1, "%s: open", TESTFILE);
+    }
+    for (i = 0; i < FILESIZE; i++) {
+        buf[i] = pattern(i);
+    }
+    if (write(fd, buf, FILESIZE) != FILESIZE) {
+        err(1, "write");
+    }
+
+    /* BAD ARGUMENTS */
+    if (mmap(NULL, 0, PROT_READ, MAP_SHARED, fd, 0) != MAP_FAILED ||
+        mmap(NULL, PAGESIZE, PROT_READ, MAP_SHARED, fd, 100) != MAP_FAILED ||
+        mmap(NULL, PAGESIZE, PROT_READ, MAP_SHARED|MAP_PRIVATE, fd, 0) != MAP_FAILED ||
+        mmap(NULL, PAGESIZE, PROT_READ, MAP_SHARED, -1, 0) != MAP_FAILED) {
+        errx(1, "mmap accepted bad arguments");
+    }
+
+    /* A SHARED MAPPING SEES THE FILE, AND MSYNC PUTS STORES BACK INTO IT */
+    p = map(fd, PROT_READ|PROT_WRITE, MAP_SHARED, 0, FILESIZE);
+    for (i = 0; i < FILESIZE; i++) {
+        if (p[i] != pattern(i)) {
+            errx(1, "byte %lld of the shared mapping is wrong", (long long)i);
+        }
+    }
+    for (i = 0; i < PAGES; i++) {
+        p[i * PAGESIZE] = 'S';
+    }
+    if (msync(p, FILESIZE, MS_SYNC) < 0) {
+        err(1, "msync");
+    }
+    check(fd, 'S');
+    if (munmap(p, FILESIZE) < 0) {
+        err(1, "munmap");
+    }
+
+    /* A PRIVATE MAPPING STARTING ONE PAGE IN: STORES STAY IN THE PROCESS */
+    p = map(fd, PROT_READ|PROT_WRITE, MAP_PRIVATE, PAGESIZE, FILESIZE - PAGESIZE);
+    if (p[0] != 'S' || p[1] != pattern(PAGESIZE + 1)) {
+        errx(1, "the private mapping does not start at its offset");
+    }
+    for (i = 0; i < PAGES - 1; i++) {
+        p[i * PAGESIZE] = 'P';
+    }
+    if (munmap(p, FILESIZE - PAGESIZE) < 0) {
+        err(1, "munmap");
+    }
+    check(fd, 'S');
+
+    /* UNMAPPING THE MIDDLE OF A MAPPING LEAVES BOTH ENDS */
+    p = map(fd, PROT_READ, MAP_SHARED, 0, FILESIZE);
+    if (munmap(p + PAGESIZE, 2 * PAGESIZE) < 0) {
+        err(1, "munmap of the middle");
+    }
+    if (p[0] != 'S' || p[3 * PAGESIZE + 1] != pattern(3 * PAGESIZE + 1)) {
+        errx(1, "the ends of the mapping are gone");
+    }
+    if (munmap(p, FILESIZE) < 0) {
+        err(1, "munmap");
+    }
+
+    close(fd);
+    if (remove(TESTFILE) < 0) {
+        err(1, "%s: remove", TESTFILE);
+    }
+    printf("mmaptest: passed\n");
+    return 0;
+}
@@ -160,7 +160,7 @@ static int subargc = 0;
 
 static
 void
-spawn(int njobs)
+spawn_jobs(int njobs)
 {
 	struct usem s1, s2;
 	pid_t pids[njobs];
@@ -266,7 +266,7 @@ main(int argc, char *argv[])
 	}
 	subargv[subargc] = NULL;
 
-	spawn(njobs);
+	spawn_jobs(njobs);
 
 	return 0;
 }
@@ -0,0 +1,129 @@
+/**
+ * @file pipetest.c
+ *
+ * @brief Test for pipe().
+ *
+ *        A child writes several ring buffers' worth of a pattern into a pipe, in
+ *        pieces of odd sizes, and the parent reads it back in pieces of other
+ *        sizes and checks it; once the child exits, the parent has to see EOF.
+ *        A read into memory that cannot be written has to fail with EFAULT without
+ *        taking anything out of the pipe. Then writing to a pipe whose read end
+ *        is closed has to end in EPIPE.
+ *
+ * @version 0.1
+ * @date 2026-10-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+*/
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+
+#define TOTAL     (5 * 4096 + 123)
+#define WRITESIZE 1000
+#define READSIZE  777
+
+static char pattern(size_t pos) {
+    return 'a' + pos % 23;
+}
+
+static void writer(int fd) {
+    char buf[WRITESIZE];
+    size_t pos, i, n;
+    ssize_t r;
+
+    for (pos = 0; pos < TOTAL; pos += n) {
+        n = TOTAL - pos < WRITESIZE ? TOTAL - pos : WRITESIZE;
+        for (i = 0; i < n; i++) {
+            buf[i] = pattern(pos + i);
+        }
+        r = write(fd, buf, n);
+        if (r != (ssize_t)n) {
+            err(1, "child: write returned %zd", r);
+        }
+    }
+}
+
+int main(void) {
+    char buf[READSIZE];
+    size_t pos;
+    ssize_t r, i;
+    int fds[2], status;
+    pid_t pid;
+
+    if (pipe(fds) < 0) {
+        err(1, "pipe");
+    }
+
+    /* THE CHILD WRITES, THE PARENT READS */
+    pid = fork();
+    if (pid < 0) {
+        err(1, "fork");
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        writer(fds[1]);
+        _exit(0);
+    }
+    close(fds[1]);
+
+    pos = 0;
+    while ((r = read(fds[0], buf, READSIZE)) > 0) {
+        for (i = 0; i < r; i++) {
+            if (buf[i] != pattern(pos + i)) {
+                errx(1, "byte %zu read from the pipe is wrong", pos + i);
+            }
+        }
+        pos += r;
+    }
+    if (r < 0) {
+        err(1, "read");
+    }
+    if (pos != TOTAL) {
+        errx(1, "read %zu bytes before EOF, expected %d", pos, TOTAL);
+    }
+    if (waitpid(pid, &status, 0) < 0) {
+        err(1, "waitpid");
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        errx(1, "the writer failed");
+    }
+    close(fds[0]);
+
+    /* A BAD BUFFER IS REFUSED BEFORE ANYTHING IS TAKEN (program text is read-only) */
+    if (pipe(fds) < 0) {
+        err(1, "pipe");
+    }
+    if (write(fds[1], "x", 1) != 1) {
+        err(1, "write");
+    }
+    if (read(fds[0], (void *)main, 1) != -1 || errno != EFAULT) {
+        errx(1, "read into program text did not fail with EFAULT");
+    }
+    if (read(fds[0], buf, 1) != 1 || buf[0] != 'x') {
+        errx(1, "the failed read took data out of the pipe");
+    }
+    close(fds[0]);
+    close(fds[1]);
+
+    /* NOBODY TO READ (the close may finish a little later, until then writes fill the pipe) */
+    if (pipe(fds) < 0) {
+        err(1, "pipe");
+    }
+    close(fds[0]);
+    while ((r = write(fds[1], buf, 1)) == 1) {
+        /* nothing */
+    }
+    if (r != -1 || errno != EPIPE) {
+        errx(1, "write with no reader did not fail with EPIPE");
+    }
+    close(fds[1]);
+
+    printf("pipetest: passed\n");
+    return 0;
+}
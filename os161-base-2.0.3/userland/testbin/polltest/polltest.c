@@ -0,0 +1,174 @@
+/**
+ * @file polltest.c
+ *
+ * @brief Test for poll() and the child-exit descriptor.
+ *
+ *        An empty pipe has to be writable but not readable, and readable once a
+ *        byte goes in; with the write end closed it has to be hung up. A poll that
+ *        nothing wakes has to wait out its timeout. A single blocking poll on a pipe
+ *        and a child-exit descriptor has to be woken by a child, first by the byte
+ *        it writes and then by its exit; once it is reaped the descriptor has to be
+ *        hung up. A semaphore has to be readable only while its count isn't 0, and
+ *        bad descriptors have to get POLLNVAL.
+ *
+ * @version 0.1
+ * @date 2026-10-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+*/
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <err.h>
+
+#define SEMNAME  "sem:polltest"
+#define TIMEOUT  300        /* milliseconds */
+
+/* POLLS ONE FILE FOR EVENTS, AND RETURNS ITS revents */
+static short poll1(int fd, short events, int timeout) {
+    struct pollfd pfd;
+    int r;
+
+    pfd.fd = fd;
+    pfd.events = events;
+    pfd.revents = 0x7fff;
+    r = poll(&pfd, 1, timeout);
+    if (r < 0) {
+        err(1, "poll");
+    }
+    if (r != (pfd.revents != 0)) {
+        errx(1, "poll returned %d with revents 0x%x", r, pfd.revents);
+    }
+    return pfd.revents;
+}
+
+static void expect(short got, short want, const char *what) {
+    if (got != want) {
+        errx(1, "%s: revents 0x%x, expected 0x%x", what, got, want);
+    }
+}
+
+static unsigned long elapsed_ms(time_t s0, unsigned long ns0) {
+    time_t s;
+    unsigned long ns;
+
+    if (__time(&s, &ns) < 0) {
+        err(1, "__time");
+    }
+    return (s - s0) * 1000 + ns / 1000000 - ns0 / 1000000;
+}
+
+int main(void) {
+    struct pollfd pfds[3];
+    struct timespec ts;
+    int fds[2], cfd, sfd, status, r;
+    unsigned long ms, ns0;
+    time_t s0;
+    pid_t pid;
+    char ch;
+
+    /* AN EMPTY PIPE, THEN ONE WITH A BYTE IN IT */
+    if (pipe(fds) < 0) {
+        err(1, "pipe");
+    }
+    expect(poll1(fds[0], POLLIN, 0), 0, "empty pipe");
+    expect(poll1(fds[1], POLLOUT, 0), POLLOUT, "write end");
+    if (write(fds[1], "x", 1) != 1) {
+        err(1, "write");
+    }
+    expect(poll1(fds[0], POLLIN|POLLOUT, 0), POLLIN, "pipe with data");
+    if (read(fds[0], &ch, 1) != 1) {
+        err(1, "read");
+    }
+
+    /* NOTHING HAPPENS: THE TIMEOUT HAS TO RUN OUT */
+    if (__time(&s0, &ns0) < 0) {
+        err(1, "__time");
+    }
+    expect(poll1(fds[0], POLLIN, TIMEOUT), 0, "timeout");
+    ms = elapsed_ms(s0, ns0);
+    if (ms + 20 < TIMEOUT) {
+        errx(1, "a poll of %d ms came back after %lu ms", TIMEOUT, ms);
+    }
+
+    /* ONE BLOCKING POLL, WOKEN BY THE CHILD'S BYTE AND THEN BY ITS EXIT */
+    cfd = childfd();
+    if (cfd < 0) {
+        err(1, "childfd");
+    }
+    expect(poll1(cfd, POLLIN, 0), POLLHUP, "no children");
+    pid = fork();
+    if (pid < 0) {
+        err(1, "fork");
+    }
+    if (pid == 0) {
+        ts.tv_sec = 0;
+        ts.tv_nsec = 100000000;
+        nanosleep(&ts, NULL);
+        if (write(fds[1], "y", 1) != 1) {
+            _exit(1);
+        }
+        nanosleep(&ts, NULL);
+        _exit(0);
+    }
+    pfds[0].fd = cfd;
+    pfds[0].events = POLLIN;
+    pfds[1].fd = fds[0];
+    pfds[1].events = POLLIN;
+    pfds[2].fd = -1;
+    pfds[2].events = POLLIN;
+    r = poll(pfds, 3, INFTIM);
+    if (r != 1 || pfds[0].revents != 0 || pfds[1].revents != POLLIN || pfds[2].revents != 0) {
+        errx(1, "woken with %d: 0x%x 0x%x 0x%x (expected the pipe only)", r,
+             pfds[0].revents, pfds[1].revents, pfds[2].revents);
+    }
+    if (read(fds[0], &ch, 1) != 1 || ch != 'y') {
+        errx(1, "the child's byte is missing");
+    }
+    r = poll(pfds, 3, INFTIM);
+    if (r != 1 || pfds[0].revents != POLLIN || pfds[1].revents != 0) {
+        errx(1, "woken with %d: 0x%x 0x%x (expected the child's exit)", r,
+             pfds[0].revents, pfds[1].revents);
+    }
+    if (waitpid(pid, &status, WNOHANG) != pid) {
+        errx(1, "the child polled as exited can't be reaped");
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        errx(1, "the child failed");
+    }
+    expect(poll1(cfd, POLLIN, 0), POLLHUP, "all children reaped");
+    close(cfd);
+
+    /* THE WRITE END GOES AWAY: HUNG UP */
+    close(fds[1]);
+    expect(poll1(fds[0], POLLIN, 0), POLLHUP, "pipe without writer");
+    close(fds[0]);
+
+    /* A SEMAPHORE IS READABLE WHEN P WOULD NOT WAIT */
+    sfd = open(SEMNAME, O_RDWR|O_CREAT|O_TRUNC, 0664);
+    if (sfd < 0) {
+        err(1, "%s: open", SEMNAME);
+    }
+    expect(poll1(sfd, POLLIN|POLLOUT, 0), POLLOUT, "semaphore at 0");
+    if (sem_op(sfd, 1) < 0) {
+        err(1, "%s: sem_op", SEMNAME);
+    }
+    expect(poll1(sfd, POLLIN, 0), POLLIN, "semaphore at 1");
+    close(sfd);
+    if (remove(SEMNAME) < 0) {
+        err(1, "%s: remove", SEMNAME);
+    }
+
+    /* DESCRIPTORS THAT ARE NOT OPEN */
+    expect(poll1(fds[0], POLLIN, 0), POLLNVAL, "closed descriptor");
+    expect(poll1(OPEN_MAX + 5, POLLIN, 0), POLLNVAL, "descriptor out of range");
+
+    printf("polltest: passed\n");
+    return 0;
+}
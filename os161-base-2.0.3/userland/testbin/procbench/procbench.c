@@ -0,0 +1,196 @@
+/**
+ * @file procbench.c
+ * 
+ * @brief Latency benchmark for process creation: fork() alone, fork()+_exit()+waitpid(),
+ *        fork()+execv() of a trivial program, the same with a large argv, and spawn().
+ * 
+ *        Each test is repeated (50 times by default, or as many as given as argument) and
+ *        timed with __time(). For every test one line is printed in the form
+ * 
+ *            procbench: test=NAME iters=N min=A p50=B p90=C p99=D max=E unit=usec
+ * 
+ *        so that the output captured by testscripts/runtest.py can be grepped for
+ *        "^procbench: " and compared across kernel builds.
+ * 
+ *        usage: procbench [iterations]
+ * 
+ * @version 0.1
+ * @date 2026-10-14
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+*/
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <err.h>
+
+#define DEFAULT_ITERS 50
+#define MAX_ITERS 1000
+
+/* trivial program for the exec tests */
+#define TRUEPROG "/bin/true"
+
+/* large argv: BIGARGS strings of BIGARGLEN characters (about half of ARG_MAX) */
+#define BIGARGS 64
+#define BIGARGLEN 511
+
+static unsigned long samples[MAX_ITERS];
+static char bigarg[BIGARGLEN + 1];
+static char *bigargv[BIGARGS + 2];
+
+/**
+ * @brief Microseconds elapsed since the given __time() reading.
+ */
+static unsigned long
+elapsed(time_t startsecs, unsigned long startnsecs)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	__time(&secs, &nsecs);
+	if (nsecs < startnsecs) {
+		nsecs += 1000000000;
+		secs--;
+	}
+	return (unsigned long)(secs - startsecs) * 1000000 + (nsecs - startnsecs) / 1000;
+}
+
+/**
+ * @brief Wait for the given child, which must exit with status 0.
+ */
+static void
+reap(pid_t pid, const char *test)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "%s: waitpid", test);
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "%s: child failed (status 0x%x)", test, status);
+	}
+}
+
+/**
+ * @brief Fork a child that runs PROG with ARGS (or just exits, if PROG is NULL).
+ *        Returns the pid of the child.
+ */
+static pid_t
+forkexec(const char *prog, char **args, const char *test)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "%s: fork", test);
+	}
+	if (pid == 0) {
+		if (prog != NULL) {
+			execv(prog, args);
+			warn("%s: %s", test, prog);
+			_exit(1);
+		}
+		_exit(0);
+	}
+	return pid;
+}
+
+static int
+cmp_ulong(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *)a;
+	unsigned long y = *(const unsigned long *)b;
+
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/**
+ * @brief Sort the samples and print the result line of a test.
+ */
+static void
+report(const char *test, unsigned iters)
+{
+	qsort(samples, iters, sizeof(samples[0]), cmp_ulong);
+	printf("procbench: test=%s iters=%u min=%lu p50=%lu p90=%lu p99=%lu max=%lu unit=usec\n",
+	       test, iters, samples[0],
+	       samples[(iters - 1) * 50 / 100],
+	       samples[(iters - 1) * 90 / 100],
+	       samples[(iters - 1) * 99 / 100],
+	       samples[iters - 1]);
+}
+
+/**
+ * @brief Run one test ITERS times. With WAITED false, only the fork() itself is
+ *        timed and the child is reaped afterwards; otherwise the measure includes
+ *        the child's whole life, up to waitpid(). With SPAWN, the child is started
+ *        with spawn() instead of fork()+execv().
+ */
+static void
+runtest(const char *test, unsigned iters, const char *prog, char **args,
+	int waited, int spawned)
+{
+	time_t secs;
+	unsigned long nsecs;
+	unsigned i;
+	pid_t pid;
+
+	for (i = 0; i < iters; i++) {
+		__time(&secs, &nsecs);
+		if (spawned) {
+			pid = spawn(prog, args, NULL, 0);
+			if (pid < 0) {
+				err(1, "%s: spawn", test);
+			}
+		}
+		else {
+			pid = forkexec(prog, args, test);
+		}
+		if (!waited) {
+			samples[i] = elapsed(secs, nsecs);
+		}
+		reap(pid, test);
+		if (waited) {
+			samples[i] = elapsed(secs, nsecs);
+		}
+	}
+	report(test, iters);
+}
+
+int
+main(int argc, char **argv)
+{
+	char *trueargv[2] = { (char *)TRUEPROG, NULL };
+	unsigned iters = DEFAULT_ITERS;
+	int i;
+
+	if (argc > 1) {
+		iters = atoi(argv[1]);
+		if (iters < 1 || iters > MAX_ITERS) {
+			errx(1, "usage: procbench [iterations], between 1 and %d",
+			     MAX_ITERS);
+		}
+	}
+
+	memset(bigarg, 'a', BIGARGLEN);
+	bigarg[BIGARGLEN] = 0;
+	bigargv[0] = (char *)TRUEPROG;
+	for (i = 1; i <= BIGARGS; i++) {
+		bigargv[i] = bigarg;
+	}
+	bigargv[BIGARGS + 1] = NULL;
+
+	runtest("fork", iters, NULL, NULL, 0, 0);
+	runtest("forkwait", iters, NULL, NULL, 1, 0);
+	runtest("forkexec", iters, TRUEPROG, trueargv, 1, 0);
+	runtest("forkexecbig", iters, TRUEPROG, bigargv, 1, 0);
+	runtest("spawn", iters, TRUEPROG, trueargv, 1, 1);
+	runtest("spawnbig", iters, TRUEPROG, bigargv, 1, 1);
+
+	return 0;
+}
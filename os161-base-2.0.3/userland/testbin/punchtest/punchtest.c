@@ -0,0 +1,104 @@
+/**
+ * @file punchtest.c
+ * 
+ * @brief Test for fpunch() and ftruncate().
+ * 
+ *        A file spanning the direct and indirect blocks of an SFS inode is filled
+ *        with a pattern; a hole with unaligned ends is punched in the middle, and
+ *        the hole is checked to read as zeros while the data around it and the
+ *        size of the file are intact. The file is then cut down with ftruncate()
+ *        and punched up to its end.
+ * 
+ * @version 0.1
+ * @date 2026-10-14
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+*/
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+
+#define TESTFILE "punchtest.dat"
+#define BLOCKS   40
+#define FILESIZE (BLOCKS * 512)
+
+static char buf[FILESIZE];
+
+static char pattern(off_t pos) {
+    return 'a' + pos % 23;
+}
+
+/* THE FILE SHOULD HOLD THE PATTERN, EXCEPT FOR ZEROS IN [hs1, he1) AND [hs2, he2) */
+static void check(int fd, off_t size, off_t hs1, off_t he1, off_t hs2, off_t he2) {
+    off_t end, i;
+    ssize_t r;
+
+    end = lseek(fd, 0, SEEK_END);
+    if (end < 0) {
+        err(1, "lseek");
+    }
+    if (end != size) {
+        errx(1, "size is %lld, expected %lld", (long long)end, (long long)size);
+    }
+    r = pread(fd, buf, size, 0);
+    if (r != size) {
+        errx(1, "pread: got %zd bytes, expected %lld", r, (long long)size);
+    }
+    for (i = 0; i < size; i++) {
+        char expected = ((i >= hs1 && i < he1) || (i >= hs2 && i < he2)) ? 0 : pattern(i);
+        if (buf[i] != expected) {
+            errx(1, "byte %lld is 0x%x, expected 0x%x", (long long)i,
+                 (unsigned char)buf[i], (unsigned char)expected);
+        }
+    }
+}
+
+int main(void) {
+    off_t i;
+    int fd;
+
+    fd = open(TESTFILE, O_RDWR|O_CREAT|O_TRUNC, 0664);
+    if (fd < 0) {
+        err(1, "%s: open", TESTFILE);
+    }
+
+    for (i = 0; i < FILESIZE; i++) {
+        buf[i] = pattern(i);
+    }
+    if (write(fd, buf, FILESIZE) != FILESIZE) {
+        err(1, "write");
+    }
+
+    /* A HOLE ACROSS THE END OF THE DIRECT BLOCKS, WITH PARTIAL BLOCKS AT BOTH ENDS */
+    if (fpunch(fd, 5*512 + 100, 20*512) < 0) {
+        err(1, "fpunch");
+    }
+    check(fd, FILESIZE, 5*512 + 100, 25*512 + 100, 0, 0);
+
+    /* BAD ARGUMENTS */
+    if (fpunch(fd, 0, 0) == 0 || fpunch(fd, -1, 512) == 0) {
+        errx(1, "fpunch accepted a bad range");
+    }
+
+    /* TRUNCATE INTO THE LAST PART, THEN PUNCH FROM THE MIDDLE OF A BLOCK TO PAST EOF */
+    if (ftruncate(fd, 30*512 + 7) < 0) {
+        err(1, "ftruncate");
+    }
+    check(fd, 30*512 + 7, 5*512 + 100, 25*512 + 100, 0, 0);
+    if (fpunch(fd, 28*512 + 1, 10*512) < 0) {
+        err(1, "fpunch to EOF");
+    }
+    check(fd, 30*512 + 7, 5*512 + 100, 25*512 + 100, 28*512 + 1, 30*512 + 7);
+
+    close(fd);
+    if (remove(TESTFILE) < 0) {
+        err(1, "%s: remove", TESTFILE);
+    }
+    printf("punchtest: passed\n");
+    return 0;
+}
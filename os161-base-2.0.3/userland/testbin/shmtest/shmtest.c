@@ -0,0 +1,261 @@
+/**
+ * @file shmtest.c
+ *
+ * @brief Test for anonymous mappings (mmap() with MAP_ANON) and shared memory
+ *        segments (shmget(), shmat() and shmdt()).
+ *
+ *        A shared anonymous mapping, only one page of which has been touched, is
+ *        written all over by a forked child, and the parent has to see every
+ *        store; a second child has to see what the parent wrote back. Stores to a
+ *        private anonymous mapping made by a child have to stay in the child.
+ *        Unmapping the middle of a shared mapping has to leave both ends shared.
+ *        A segment has to be shared with forked children, and with a child that
+ *        looks it up by key and attaches it itself; it has to go away when it
+ *        is detached for the last time.
+ *        ncpus() has to report at least one cpu.
+ *
+ * @version 0.1
+ * @date 2026-10-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+*/
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/shm.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+
+#define PAGES    8
+#define PAGESIZE 4096
+#define MAPSIZE  (PAGES * PAGESIZE)
+#define SHMKEY   161
+
+static char pattern(int pos, char seed) {
+    return seed + pos % 23;
+}
+
+static char *map(int flags) {
+    void *p;
+
+    p = mmap(NULL, MAPSIZE, PROT_READ|PROT_WRITE, flags|MAP_ANON, -1, 0);
+    if (p == MAP_FAILED) {
+        err(1, "mmap");
+    }
+    return p;
+}
+
+/* THE FIRST BYTE OF EVERY PAGE FROM first TO last */
+static int same(const char *p, int first, int last, char seed) {
+    int i;
+
+    for (i = first; i <= last; i++) {
+        if (p[i * PAGESIZE] != pattern(i, seed)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void fill(char *p, int first, int last, char seed) {
+    int i;
+
+    for (i = first; i <= last; i++) {
+        p[i * PAGESIZE] = pattern(i, seed);
+    }
+}
+
+/* RUNS what IN A CHILD, WHICH HAS TO EXIT 0 */
+static void child(const char *what, char *p, int write, char seed) {
+    pid_t pid;
+    int status;
+
+    pid = fork();
+    if (pid < 0) {
+        err(1, "fork");
+    }
+    if (pid == 0) {
+        if (write) {
+            fill(p, 0, PAGES - 1, seed);
+            _exit(0);
+        }
+        _exit(same(p, 0, PAGES - 1, seed) ? 0 : 1);
+    }
+    if (waitpid(pid, &status, 0) < 0) {
+        err(1, "waitpid");
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        errx(1, "%s: the child failed", what);
+    }
+}
+
+int main(void) {
+    pid_t pid;
+    char *p, *q;
+    int i, id, status;
+
+    if (ncpus() < 1) {
+        errx(1, "ncpus says %d", ncpus());
+    }
+
+    /* BAD ARGUMENTS */
+    if (mmap(NULL, PAGESIZE, PROT_READ, MAP_ANON, -1, 0) != MAP_FAILED || errno != EINVAL ||
+        mmap(NULL, 0, PROT_READ, MAP_SHARED|MAP_ANON, -1, 0) != MAP_FAILED) {
+        errx(1, "mmap accepted bad arguments");
+    }
+
+    /* ZERO-FILLED, AND SHARED WITH CHILDREN EVEN WHERE IT WASN'T TOUCHED BEFORE FORK */
+    p = map(MAP_SHARED);
+    for (i = 0; i < PAGESIZE; i++) {
+        if (p[i] != 0) {
+            errx(1, "byte %d of the shared mapping is not zero", i);
+        }
+    }
+    child("shared stores", p, 1, 'a');
+    if (!same(p, 0, PAGES - 1, 'a')) {
+        errx(1, "the child's stores to the shared mapping are not seen");
+    }
+    fill(p, 0, PAGES - 1, 'A');
+    child("shared loads", p, 0, 'A');
+
+    /* UNMAPPING THE MIDDLE LEAVES BOTH ENDS, STILL SHARED */
+    if (munmap(p + PAGESIZE, (PAGES - 2) * PAGESIZE) < 0) {
+        err(1, "munmap of the middle");
+    }
+    if (p[0] != pattern(0, 'A') || p[(PAGES - 1) * PAGESIZE] != pattern(PAGES - 1, 'A')) {
+        errx(1, "the ends of the shared mapping are gone");
+    }
+    p[0] = 'x';
+    p[(PAGES - 1) * PAGESIZE] = 'y';
+    pid = fork();
+    if (pid < 0) {
+        err(1, "fork");
+    }
+    if (pid == 0) {
+        p[0] = 'X';
+        p[(PAGES - 1) * PAGESIZE] = 'Y';
+        _exit(0);
+    }
+    if (waitpid(pid, &status, 0) < 0) {
+        err(1, "waitpid");
+    }
+    if (p[0] != 'X' || p[(PAGES - 1) * PAGESIZE] != 'Y') {
+        errx(1, "the ends of the shared mapping are no longer shared");
+    }
+    if (munmap(p, MAPSIZE) < 0) {
+        err(1, "munmap");
+    }
+
+    /* A CHILD'S STORES TO A PRIVATE MAPPING STAY IN THE CHILD */
+    p = map(MAP_PRIVATE);
+    fill(p, 0, PAGES / 2, 'b');
+    child("private stores", p, 1, 'c');
+    if (!same(p, 0, PAGES / 2, 'b')) {
+        errx(1, "the child's stores to the private mapping are seen");
+    }
+    for (i = (PAGES / 2 + 1) * PAGESIZE; i < MAPSIZE; i++) {
+        if (p[i] != 0) {
+            errx(1, "byte %d of the private mapping is not zero", i);
+        }
+    }
+    if (munmap(p, MAPSIZE) < 0) {
+        err(1, "munmap");
+    }
+
+    /* A PRIVATE SEGMENT, SHARED WITH A CHILD BY FORK */
+    id = shmget(IPC_PRIVATE, MAPSIZE, 0);
+    if (id < 0) {
+        err(1, "shmget");
+    }
+    p = shmat(id, NULL, 0);
+    if (p == (void *)-1) {
+        err(1, "shmat");
+    }
+    for (i = 0; i < MAPSIZE; i++) {
+        if (p[i] != 0) {
+            errx(1, "byte %d of the segment is not zero", i);
+        }
+    }
+    child("segment stores", p, 1, 'd');
+    if (!same(p, 0, PAGES - 1, 'd')) {
+        errx(1, "the child's stores to the segment are not seen");
+    }
+    if (shmdt(p) < 0) {
+        err(1, "shmdt");
+    }
+    if (shmat(id, NULL, 0) != (void *)-1 || errno != EINVAL) {
+        errx(1, "the private segment is still there after its last shmdt");
+    }
+
+    /* A SEGMENT WITH A KEY: ATTACHED TWICE, AND BY A CHILD THAT LOOKS IT UP */
+    id = shmget(SHMKEY, MAPSIZE, IPC_CREAT | IPC_EXCL);
+    if (id < 0) {
+        err(1, "shmget of key %d", SHMKEY);
+    }
+    if (shmget(SHMKEY, MAPSIZE, IPC_CREAT | IPC_EXCL) >= 0 || errno != EEXIST) {
+        errx(1, "shmget with IPC_EXCL found no segment");
+    }
+    if (shmget(SHMKEY, MAPSIZE + 1, 0) >= 0 || errno != EINVAL) {
+        errx(1, "shmget accepted a size bigger than the segment");
+    }
+    if (shmget(SHMKEY, 0, 0) != id) {
+        errx(1, "shmget found another segment for key %d", SHMKEY);
+    }
+    p = shmat(id, NULL, 0);
+    q = shmat(id, NULL, SHM_RDONLY);
+    if (p == (void *)-1 || q == (void *)-1) {
+        err(1, "shmat");
+    }
+    if (p == q) {
+        errx(1, "the segment was attached twice at the same address");
+    }
+    fill(p, 0, PAGES - 1, 'e');
+    if (!same(q, 0, PAGES - 1, 'e')) {
+        errx(1, "stores through one attachment are not seen through the other");
+    }
+    if (shmdt(q) < 0) {
+        err(1, "shmdt");
+    }
+    pid = fork();
+    if (pid < 0) {
+        err(1, "fork");
+    }
+    if (pid == 0) {
+        /* DROP THE INHERITED ONE, AND FIND THE SEGMENT AGAIN */
+        if (shmdt(p) < 0) {
+            _exit(1);
+        }
+        id = shmget(SHMKEY, 0, 0);
+        q = id < 0 ? (void *)-1 : shmat(id, NULL, 0);
+        if (q == (void *)-1 || !same(q, 0, PAGES - 1, 'e')) {
+            _exit(1);
+        }
+        fill(q, 0, PAGES - 1, 'f');
+        _exit(0);
+    }
+    if (waitpid(pid, &status, 0) < 0) {
+        err(1, "waitpid");
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        errx(1, "segment by key: the child failed");
+    }
+    if (!same(p, 0, PAGES - 1, 'f')) {
+        errx(1, "the stores of the child that looked the segment up are not seen");
+    }
+    if (shmdt(p + PAGESIZE) >= 0 || errno != EINVAL) {
+        errx(1, "shmdt accepted an address inside the segment");
+    }
+    if (shmdt(p) < 0) {
+        err(1, "shmdt");
+    }
+    if (shmget(SHMKEY, 0, 0) >= 0 || errno != ENOENT) {
+        errx(1, "key %d still has a segment after its last shmdt", SHMKEY);
+    }
+
+    printf("shmtest: passed\n");
+    return 0;
+}
@@ -0,0 +1,152 @@
+/**
+ * @file stdiotest.c
+ *
+ * @brief Test for the buffered standard streams.
+ *
+ *        With stdout on a file, what is printed has to stay in the buffer until
+ *        it fills or is fflushed, and fork has to flush it so that the child
+ *        doesn't write it a second time. With stdin on a file, getchar has to
+ *        read ahead a buffer at a time and still hand back every byte in order.
+ *
+ * @version 0.1
+ * @date 2026-10-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+
+#define OUTFILE "stdiotest.out"
+#define SAVEFD  20
+#define NLINES  200
+#define LINELEN 20
+
+static char line[LINELEN + 1];
+static char back[NLINES * LINELEN];
+
+static void mkline(int i) {
+    int j;
+
+    for (j = 0; j < LINELEN - 1; j++) {
+        line[j] = 'a' + (i + j) % 26;
+    }
+    line[LINELEN - 1] = '\n';
+    line[LINELEN] = 0;
+}
+
+static off_t sizeof_fd(int fd) {
+    struct stat st;
+
+    if (fstat(fd, &st) < 0) {
+        err(1, "fstat");
+    }
+    return st.st_size;
+}
+
+int main(void) {
+    int console, fd, status, i, ch;
+    off_t size;
+    pid_t pid;
+
+    /* STDOUT ON A FILE, BEFORE ANYTHING IS PRINTED, SO THAT IT IS FULLY BUFFERED */
+    console = dup2(STDOUT_FILENO, SAVEFD);
+    if (console < 0) {
+        err(1, "dup2");
+    }
+    fd = open(OUTFILE, O_RDWR|O_CREAT|O_TRUNC, 0664);
+    if (fd < 0) {
+        err(1, "%s: open", OUTFILE);
+    }
+    if (dup2(fd, STDOUT_FILENO) < 0) {
+        err(1, "dup2");
+    }
+
+    /* A LINE STAYS BUFFERED, FORK FLUSHES IT, AND THE CHILD DOESN'T WRITE IT AGAIN */
+    printf("before fork\n");
+    if (sizeof_fd(fd) != 0) {
+        errx(1, "a line went out without a flush");
+    }
+    pid = fork();
+    if (pid < 0) {
+        err(1, "fork");
+    }
+    if (pid == 0) {
+        exit(0);
+    }
+    if (waitpid(pid, &status, 0) < 0) {
+        err(1, "waitpid");
+    }
+    if (sizeof_fd(fd) != (off_t)strlen("before fork\n")) {
+        errx(1, "after fork the file has %lld bytes", (long long)sizeof_fd(fd));
+    }
+
+    /* MANY LINES GO OUT A BUFFER AT A TIME, THE REST ON FFLUSH */
+    for (i = 0; i < NLINES; i++) {
+        mkline(i);
+        printf("%s", line);
+    }
+    size = sizeof_fd(fd) - strlen("before fork\n");
+    if (size % BUFSIZ != 0 || size == 0 || size > NLINES * LINELEN) {
+        errx(1, "%lld bytes went out before the flush", (long long)size);
+    }
+    if (fflush(stdout) < 0) {
+        err(1, "fflush");
+    }
+    size = sizeof_fd(fd) - strlen("before fork\n");
+    if (size != NLINES * LINELEN) {
+        errx(1, "%lld bytes went out after the flush", (long long)size);
+    }
+    if (pread(fd, back, sizeof(back), strlen("before fork\n")) != sizeof(back)) {
+        err(1, "%s: pread", OUTFILE);
+    }
+    for (i = 0; i < NLINES; i++) {
+        mkline(i);
+        if (memcmp(back + i * LINELEN, line, LINELEN) != 0) {
+            errx(1, "line %d of the output is wrong", i);
+        }
+    }
+
+    /* STDIN ON THE SAME FILE: GETCHAR READS AHEAD, BUT HANDS BACK EVERY BYTE */
+    if (dup2(fd, STDIN_FILENO) < 0) {
+        err(1, "dup2");
+    }
+    if (lseek(STDIN_FILENO, strlen("before fork\n"), SEEK_SET) < 0) {
+        err(1, "lseek");
+    }
+    for (i = 0; i < NLINES * LINELEN; i++) {
+        ch = getchar();
+        if (ch == EOF) {
+            errx(1, "EOF after %d bytes", i);
+        }
+        if (ch != (unsigned char)back[i]) {
+            errx(1, "byte %d read back as 0x%x", i, ch);
+        }
+        if (i == 0 && lseek(STDIN_FILENO, 0, SEEK_CUR) == (off_t)strlen("before fork\n") + 1) {
+            errx(1, "getchar read one byte at a time");
+        }
+    }
+    if (getchar() != EOF) {
+        errx(1, "no EOF at the end of the file");
+    }
+
+    /* BACK TO THE CONSOLE */
+    if (dup2(console, STDOUT_FILENO) < 0) {
+        err(1, "dup2");
+    }
+    close(console);
+    close(fd);
+    if (remove(OUTFILE) < 0) {
+        err(1, "%s: remove", OUTFILE);
+    }
+    printf("stdiotest: passed\n");
+    return 0;
+}
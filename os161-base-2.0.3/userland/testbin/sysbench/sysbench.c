@@ -0,0 +1,492 @@
+/**
+ * @file sysbench.c
+ *
+ * @brief System performance suite: system call round trips, file throughput,
+ *        small file creation and removal, directory lookups and pipe bandwidth.
+ *
+ *        Latencies are measured over batches of calls and reported per call in
+ *        the same form as procbench,
+ *
+ *            sysbench: test=NAME [fs=DIR] iters=N min=A p50=B p90=C p99=D max=E unit=nsec
+ *
+ *        and throughputs and rates as
+ *
+ *            sysbench: test=NAME [fs=DIR] [bs=N] bytes=N usecs=N rate=R unit=KB/s
+ *            sysbench: test=NAME fs=DIR ops=N usecs=N rate=R unit=ops/s
+ *
+ *        one line per metric, so that the output captured by testscripts/runtest.py
+ *        can be grepped for "^sysbench: " and compared across kernel builds.
+ *
+ *        The file tests run in a scratch directory made in each directory given
+ *        (emu0: and lhd0: by default, that is emufs and SFS); a directory that
+ *        cannot be used is skipped with a warning.
+ *
+ *        usage: sysbench [dir ...]
+ *
+ * @version 0.1
+ * @date 2026-10-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <err.h>
+
+/* latency tests: SAMPLES samples of BATCH calls each */
+#define SAMPLES 100
+#define BATCH 100
+
+/* file throughput tests */
+#define FILESIZE (512 * 1024)
+#define MAXBS 16384
+static const unsigned blocksizes[] = { 512, 4096, MAXBS };
+#define NBLOCKSIZES (sizeof(blocksizes) / sizeof(blocksizes[0]))
+
+/* small files for the create, lookup and remove tests */
+#define NFILES 64
+
+/* bytes pushed through the pipe, and read from zero: or written to null:, for
+   each block size */
+#define PIPEBYTES (1024 * 1024)
+
+#define SCRATCH "sysbench.d"
+#define PATHLEN 128
+
+static unsigned long samples[SAMPLES];
+static char buf[MAXBS];
+
+/**
+ * @brief Nanoseconds since boot.
+ */
+static uint64_t
+now(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+		err(1, "clock_gettime");
+	}
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief Microseconds since START, at least 1.
+ */
+static uint64_t
+usecs_since(uint64_t start)
+{
+	uint64_t usecs;
+
+	usecs = (now() - start) / 1000;
+	return usecs > 0 ? usecs : 1;
+}
+
+static int
+cmp_ulong(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *)a;
+	unsigned long y = *(const unsigned long *)b;
+
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/**
+ * @brief Sort the samples and print the result line of a latency test. FS is
+ *        NULL for the tests that do not touch a file system.
+ */
+static void
+report(const char *test, const char *fs)
+{
+	qsort(samples, SAMPLES, sizeof(samples[0]), cmp_ulong);
+	printf("sysbench: test=%s%s%s iters=%u min=%lu p50=%lu p90=%lu p99=%lu max=%lu unit=nsec\n",
+	       test, fs != NULL ? " fs=" : "", fs != NULL ? fs : "",
+	       SAMPLES * BATCH, samples[0],
+	       samples[(SAMPLES - 1) * 50 / 100],
+	       samples[(SAMPLES - 1) * 90 / 100],
+	       samples[(SAMPLES - 1) * 99 / 100],
+	       samples[SAMPLES - 1]);
+}
+
+/**
+ * @brief Print the result line of a throughput test. FS is NULL for pipes and
+ *        devices.
+ */
+static void
+report_bytes(const char *test, const char *fs, unsigned bs, uint64_t bytes,
+	     uint64_t usecs)
+{
+	printf("sysbench: test=%s%s%s bs=%u bytes=%llu usecs=%llu rate=%llu unit=KB/s\n",
+	       test, fs != NULL ? " fs=" : "", fs != NULL ? fs : "", bs,
+	       (unsigned long long)bytes, (unsigned long long)usecs,
+	       (unsigned long long)(bytes * 1000000 / 1024 / usecs));
+}
+
+/**
+ * @brief Print the result line of a rate test.
+ */
+static void
+report_ops(const char *test, const char *fs, unsigned ops, uint64_t usecs)
+{
+	printf("sysbench: test=%s fs=%s ops=%u usecs=%llu rate=%llu unit=ops/s\n",
+	       test, fs, ops, (unsigned long long)usecs,
+	       (unsigned long long)((uint64_t)ops * 1000000 / usecs));
+}
+
+////////////////////////////////////////////////////////////
+// system calls
+
+/**
+ * @brief Round trips through the kernel. getpid() only reads the kinfo page
+ *        these days, so it is measured for comparison next to two calls that
+ *        really trap: __time() and a read of zero bytes.
+ */
+static void
+syscalls(void)
+{
+	uint64_t start;
+	time_t secs;
+	unsigned i, j;
+	int fd;
+
+	for (i = 0; i < SAMPLES; i++) {
+		start = now();
+		for (j = 0; j < BATCH; j++) {
+			(void)getpid();
+		}
+		samples[i] = (now() - start) / BATCH;
+	}
+	report("getpid", NULL);
+
+	for (i = 0; i < SAMPLES; i++) {
+		start = now();
+		for (j = 0; j < BATCH; j++) {
+			__time(&secs, NULL);
+		}
+		samples[i] = (now() - start) / BATCH;
+	}
+	report("time", NULL);
+
+	fd = open("null:", O_RDONLY);
+	if (fd < 0) {
+		err(1, "null:");
+	}
+	for (i = 0; i < SAMPLES; i++) {
+		start = now();
+		for (j = 0; j < BATCH; j++) {
+			if (read(fd, buf, 0) < 0) {
+				err(1, "read0");
+			}
+		}
+		samples[i] = (now() - start) / BATCH;
+	}
+	report("read0", NULL);
+	close(fd);
+}
+
+/**
+ * @brief PIPEBYTES read from zero: and written to null: at every block size:
+ *        the cost of the read and write paths with no file system or device
+ *        behind them, as a baseline for the throughput tests.
+ */
+static void
+devices(void)
+{
+	unsigned bs, k;
+	uint64_t start, total;
+	int zfd, nfd;
+
+	zfd = open("zero:", O_RDONLY);
+	if (zfd < 0) {
+		err(1, "zero:");
+	}
+	nfd = open("null:", O_WRONLY);
+	if (nfd < 0) {
+		err(1, "null:");
+	}
+	for (k = 0; k < NBLOCKSIZES; k++) {
+		bs = blocksizes[k];
+		start = now();
+		for (total = 0; total < PIPEBYTES; total += bs) {
+			if (read(zfd, buf, bs) != (ssize_t)bs) {
+				err(1, "zero: read");
+			}
+		}
+		report_bytes("zeroread", NULL, bs, total, usecs_since(start));
+
+		start = now();
+		for (total = 0; total < PIPEBYTES; total += bs) {
+			if (write(nfd, buf, bs) != (ssize_t)bs) {
+				err(1, "null: write");
+			}
+		}
+		report_bytes("nullwrite", NULL, bs, total, usecs_since(start));
+	}
+	close(nfd);
+	close(zfd);
+}
+
+////////////////////////////////////////////////////////////
+// files
+
+/**
+ * @brief Put DIR and NAME together into PATH.
+ */
+static void
+mkpath(char *path, const char *dir, const char *name)
+{
+	size_t len = strlen(dir);
+	const char *sep;
+
+	sep = len == 0 || dir[len - 1] == ':' || dir[len - 1] == '/' ? "" : "/";
+	if (snprintf(path, PATHLEN, "%s%s%s", dir, sep, name) >= PATHLEN) {
+		errx(1, "%s: path too long", dir);
+	}
+}
+
+/**
+ * @brief Sequential and random reads and writes of a FILESIZE file, at every
+ *        block size. The random tests touch as many blocks as the sequential
+ *        ones, at offsets from a fixed seed so that runs are comparable.
+ */
+static void
+throughput(const char *fs, const char *dir)
+{
+	char path[PATHLEN];
+	unsigned bs, nblocks, i, k;
+	uint64_t start;
+	off_t pos;
+	int fd;
+
+	mkpath(path, dir, "file");
+	for (k = 0; k < NBLOCKSIZES; k++) {
+		bs = blocksizes[k];
+		nblocks = FILESIZE / bs;
+		memset(buf, 'a' + k, bs);
+
+		fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+		if (fd < 0) {
+			err(1, "%s", path);
+		}
+		start = now();
+		for (i = 0; i < nblocks; i++) {
+			if (write(fd, buf, bs) != (ssize_t)bs) {
+				err(1, "%s: write", path);
+			}
+		}
+		if (fsync(fd) < 0) {
+			err(1, "%s: fsync", path);
+		}
+		report_bytes("seqwrite", fs, bs, FILESIZE, usecs_since(start));
+		close(fd);
+
+		fd = open(path, O_RDWR);
+		if (fd < 0) {
+			err(1, "%s", path);
+		}
+		start = now();
+		for (i = 0; i < nblocks; i++) {
+			if (read(fd, buf, bs) != (ssize_t)bs) {
+				err(1, "%s: read", path);
+			}
+		}
+		report_bytes("seqread", fs, bs, FILESIZE, usecs_since(start));
+
+		srandom(bs);
+		start = now();
+		for (i = 0; i < nblocks; i++) {
+			pos = (off_t)(random() % nblocks) * bs;
+			if (pread(fd, buf, bs, pos) != (ssize_t)bs) {
+				err(1, "%s: pread", path);
+			}
+		}
+		report_bytes("randread", fs, bs, FILESIZE, usecs_since(start));
+
+		start = now();
+		for (i = 0; i < nblocks; i++) {
+			pos = (off_t)(random() % nblocks) * bs;
+			if (pwrite(fd, buf, bs, pos) != (ssize_t)bs) {
+				err(1, "%s: pwrite", path);
+			}
+		}
+		if (fsync(fd) < 0) {
+			err(1, "%s: fsync", path);
+		}
+		report_bytes("randwrite", fs, bs, FILESIZE, usecs_since(start));
+		close(fd);
+	}
+	if (remove(path) < 0) {
+		err(1, "%s: remove", path);
+	}
+}
+
+/**
+ * @brief Creation of NFILES empty files, lookups of them and of names that are
+ *        not there, and their removal.
+ */
+static void
+smallfiles(const char *fs, const char *dir)
+{
+	char path[PATHLEN], name[16];
+	struct stat st;
+	uint64_t start;
+	unsigned i, j;
+	int fd;
+
+	start = now();
+	for (i = 0; i < NFILES; i++) {
+		snprintf(name, sizeof(name), "f%u", i);
+		mkpath(path, dir, name);
+		fd = open(path, O_WRONLY|O_CREAT|O_EXCL, 0664);
+		if (fd < 0) {
+			err(1, "%s", path);
+		}
+		close(fd);
+	}
+	report_ops("create", fs, NFILES, usecs_since(start));
+
+	/* the paths are put together outside the timed loops */
+	for (i = 0; i < SAMPLES; i++) {
+		snprintf(name, sizeof(name), "f%u", i % NFILES);
+		mkpath(path, dir, name);
+		start = now();
+		for (j = 0; j < BATCH; j++) {
+			if (stat(path, &st) < 0) {
+				err(1, "%s: stat", path);
+			}
+		}
+		samples[i] = (now() - start) / BATCH;
+	}
+	report("lookup", fs);
+
+	for (i = 0; i < SAMPLES; i++) {
+		snprintf(name, sizeof(name), "missing%u", i % NFILES);
+		mkpath(path, dir, name);
+		start = now();
+		for (j = 0; j < BATCH; j++) {
+			if (stat(path, &st) == 0) {
+				errx(1, "%s is there", path);
+			}
+		}
+		samples[i] = (now() - start) / BATCH;
+	}
+	report("lookupmiss", fs);
+
+	start = now();
+	for (i = 0; i < NFILES; i++) {
+		snprintf(name, sizeof(name), "f%u", i);
+		mkpath(path, dir, name);
+		if (remove(path) < 0) {
+			err(1, "%s: remove", path);
+		}
+	}
+	report_ops("remove", fs, NFILES, usecs_since(start));
+}
+
+/**
+ * @brief Run the file tests in a scratch directory in FS.
+ */
+static void
+files(const char *fs)
+{
+	char dir[PATHLEN];
+
+	mkpath(dir, fs, SCRATCH);
+	if (mkdir(dir, 0775) < 0) {
+		warn("%s: skipped", dir);
+		return;
+	}
+	throughput(fs, dir);
+	smallfiles(fs, dir);
+	if (rmdir(dir) < 0) {
+		err(1, "%s: rmdir", dir);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// pipes
+
+/**
+ * @brief PIPEBYTES written by a child into a pipe and read by us, at every
+ *        block size, timed from before the fork to the end of the data.
+ */
+static void
+pipes(void)
+{
+	unsigned bs, k;
+	uint64_t start, total;
+	ssize_t r;
+	int fds[2], status;
+	pid_t pid;
+
+	for (k = 0; k < NBLOCKSIZES; k++) {
+		bs = blocksizes[k];
+		if (pipe(fds) < 0) {
+			err(1, "pipe");
+		}
+		start = now();
+		pid = fork();
+		if (pid < 0) {
+			err(1, "fork");
+		}
+		if (pid == 0) {
+			close(fds[0]);
+			for (total = 0; total < PIPEBYTES; total += bs) {
+				if (write(fds[1], buf, bs) != (ssize_t)bs) {
+					_exit(1);
+				}
+			}
+			_exit(0);
+		}
+		close(fds[1]);
+		total = 0;
+		while ((r = read(fds[0], buf, bs)) > 0) {
+			total += r;
+		}
+		if (r < 0) {
+			err(1, "pipe: read");
+		}
+		report_bytes("pipe", NULL, bs, total, usecs_since(start));
+		close(fds[0]);
+		if (waitpid(pid, &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 ||
+		    total != PIPEBYTES) {
+			errx(1, "pipe: the writer failed after %llu bytes",
+			     (unsigned long long)total);
+		}
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	static const char *defaults[] = { "emu0:", "lhd0:" };
+	int i;
+
+	syscalls();
+	devices();
+	if (argc > 1) {
+		for (i = 1; i < argc; i++) {
+			files(argv[i]);
+		}
+	}
+	else {
+		for (i = 0; i < 2; i++) {
+			files(defaults[i]);
+		}
+	}
+	pipes();
+
+	return 0;
+}
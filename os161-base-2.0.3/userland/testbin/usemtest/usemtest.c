@@ -31,7 +31,7 @@
  * Simple test for the user-level semaphores provided by semfs, aka
  * "sem:".
  *
- * This should mostly run once you've implemented open, read, write,
+ * This should mostly run once you've implemented open, sem_op,
  * and fork, and run fully once you've also implemented waitpid.
  *
  * The last part of the test will generally hang, sometimes in fork,
@@ -161,15 +161,8 @@ static
 void
 P(struct usem *sem)
 {
-	ssize_t r;
-	char c;
-
-	r = read(sem->fd, &c, 1);
-	if (r < 0) {
-		err(1, "%s: read", sem->name);
-	}
-	if (r == 0) {
-		errx(1, "%s: read: unexpected EOF", sem->name);
+	if (sem_op(sem->fd, -1) < 0) {
+		err(1, "%s: sem_op P", sem->name);
 	}
 }
 
@@ -177,15 +170,8 @@ static
 void
 V(struct usem *sem)
 {
-	ssize_t r;
-	char c;
-
-	r = write(sem->fd, &c, 1);
-	if (r < 0) {
-		err(1, "%s: write", sem->name);
-	}
-	if (r == 0) {
-		errx(1, "%s: write: short count", sem->name);
+	if (sem_op(sem->fd, 1) < 0) {
+		err(1, "%s: sem_op V", sem->name);
 	}
 }
 
@@ -28,32 +28,23 @@
  */
 
 /*
- * Test multiple user level threads inside a process. The program
- * forks 3 threads off 2 to functions, each of which displays a string
- * every once in a while.
- *
- * This won't do much of anything unless you implement user-level
- * threads.
- *
- * It also makes various assumptions about the thread API. In
- * particular, it believes (1) that you create a thread by calling
- * "threadfork()" and passing the address for execution of the new
- * thread to begin at, (2) that if the parent thread exits any child
- * threads will keep running, and (3) child threads will exit if they
- * return from the function they started in. If any or all of these
- * assumptions are not met by your user-level threads, you will need
- * to patch this test accordingly.
- *
- * This is also a rather basic test and you'll probably want to write
- * some more of your own.
+ * Test multiple user level threads inside a process, with the
+ * uthread library (libuthread). The program starts 3 threads off 2
+ * functions, each of which displays a string every once in a while
+ * and yields to the others, and joins them. Then it starts lots of
+ * small tasks that each bump a counter under a mutex, the last of
+ * which signals the waiting first thread.
  */
 
 
 #include <unistd.h>
 #include <stdio.h>
+#include <err.h>
+#include <uthread.h>
 
 #define NTHREADS  3
-#define MAX       1<<25
+#define MAX       (1<<20)
+#define NTASKS    2000
 
 /* counter for the loop in the threads:
    This variable is shared and incremented by each
@@ -61,22 +52,86 @@
 volatile int count = 0;
 
 /* the 2 threads : */
-void ThreadRunner(void);
-void BladeRunner(void);
+static void ThreadRunner(void *);
+static void BladeRunner(void *);
 
-int
-main(int argc, char *argv[])
+/* the small tasks, and what they count */
+static struct uthread_mutex tasklock = UTHREAD_MUTEX_INITIALIZER;
+static struct uthread_cond taskcv = UTHREAD_COND_INITIALIZER;
+static int tasksdone;
+
+/*
+ * stdio is not safe to call from several threads at once, and the
+ * runners may be on different worker kernel threads: they print
+ * under this.
+ */
+static struct uthread_mutex printlock = UTHREAD_MUTEX_INITIALIZER;
+
+static
+void
+say(const char *msg)
+{
+    uthread_mutex_lock(&printlock);
+    printf("%s", msg);
+    uthread_mutex_unlock(&printlock);
+}
+
+static
+void
+task(void *arg)
+{
+    (void)arg;
+
+    uthread_mutex_lock(&tasklock);
+    if (++tasksdone == NTASKS) {
+	uthread_cond_signal(&taskcv);
+    }
+    uthread_mutex_unlock(&tasklock);
+}
+
+static
+void
+first(void *arg)
 {
+    struct uthread *threads[NTHREADS];
     int i;
 
+    (void)arg;
+
+    for (i=0; i<NTHREADS; i++) {
+	if (uthread_create(&threads[i], i ? ThreadRunner : BladeRunner,
+			   NULL) < 0) {
+	    err(1, "uthread_create");
+	}
+    }
+    for (i=0; i<NTHREADS; i++) {
+	if (uthread_join(threads[i]) < 0) {
+	    err(1, "uthread_join");
+	}
+    }
+    printf("\nRunners done.\n");
+
+    for (i=0; i<NTASKS; i++) {
+	if (uthread_create(NULL, task, NULL) < 0) {
+	    err(1, "uthread_create");
+	}
+    }
+    uthread_mutex_lock(&tasklock);
+    while (tasksdone < NTASKS) {
+	uthread_cond_wait(&taskcv, &tasklock);
+    }
+    uthread_mutex_unlock(&tasklock);
+    printf("%d tasks done.\n", tasksdone);
+}
+
+int
+main(int argc, char *argv[])
+{
     (void)argc;
     (void)argv;
 
-    for (i=0; i<NTHREADS; i++) {
-	if (i)
-	    threadfork(ThreadRunner);
-        else
-	    threadfork(BladeRunner);
+    if (uthread_main(first, NULL, 0) < 0) {
+	err(1, "uthread_main");
     }
 
     printf("Parent has left.\n");
@@ -88,22 +143,30 @@ main(int argc, char *argv[])
    random results.
 */
 
+static
 void
-BladeRunner()
+BladeRunner(void *arg)
 {
+    (void)arg;
     while (count < MAX) {
-	if (count % 500 == 0)
-	    printf("Blade ");
+	if (count % 500 == 0) {
+	    say("Blade ");
+	    uthread_yield();
+	}
 	count++;
     }
 }
 
+static
 void
-ThreadRunner()
+ThreadRunner(void *arg)
 {
+    (void)arg;
     while (count < MAX) {
-	if (count % 513 == 0)
-	    printf(" Runner\n");
+	if (count % 513 == 0) {
+	    say(" Runner\n");
+	    uthread_yield();
+	}
 	count++;
     }
 }
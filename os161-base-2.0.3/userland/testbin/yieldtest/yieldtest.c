@@ -0,0 +1,102 @@
+/**
+ * @file yieldtest.c
+ *
+ * @brief Test for sched_yield() and nanosleep().
+ *
+ *        Two threads of one process take turns by spinning on a shared word,
+ *        calling sched_yield() between looks so that the other one gets the CPU
+ *        rather than waiting for the end of the quantum. nanosleep() has to sleep
+ *        at least as long as asked, report no time left, and reject a bad
+ *        timespec.
+ *
+ * @version 0.1
+ * @date 2026-10-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+*/
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <err.h>
+
+#define ROUNDS     1000
+#define STACKSIZE  16384
+#define SLEEPMS    150
+
+static volatile int turn;
+static char stack[STACKSIZE];
+
+/* WAITS FOR ITS TURN, YIELDING, AND HANDS IT OVER, ROUNDS TIMES */
+static void pingpong(int me) {
+    int i;
+
+    for (i = 0; i < ROUNDS; i++) {
+        while (turn != me) {
+            if (sched_yield() < 0) {
+                err(1, "sched_yield");
+            }
+        }
+        turn = !me;
+    }
+}
+
+static int other(void *arg) {
+    (void)arg;
+    pingpong(1);
+    return 0;
+}
+
+int main(void) {
+    struct timespec req, rem;
+    time_t s0, s1;
+    unsigned long ns0, ns1, ms;
+    int tid, status;
+
+    /* TAKING TURNS WITH ANOTHER THREAD */
+    turn = 0;
+    tid = thread_create(other, NULL, stack, sizeof(stack));
+    if (tid < 0) {
+        err(1, "thread_create");
+    }
+    pingpong(0);
+    if (thread_join(tid, &status) < 0) {
+        err(1, "thread_join");
+    }
+    if (status != 0 || turn != 0) {
+        errx(1, "the turns got lost (status %d, turn %d)", status, turn);
+    }
+
+    /* SLEEPING, AT LEAST AS LONG AS ASKED */
+    req.tv_sec = 0;
+    req.tv_nsec = SLEEPMS * 1000000;
+    rem.tv_sec = rem.tv_nsec = 12345;
+    if (__time(&s0, &ns0) < 0) {
+        err(1, "__time");
+    }
+    if (nanosleep(&req, &rem) < 0) {
+        err(1, "nanosleep");
+    }
+    if (__time(&s1, &ns1) < 0) {
+        err(1, "__time");
+    }
+    ms = (s1 - s0) * 1000 + ns1 / 1000000 - ns0 / 1000000;
+    if (ms + 10 < SLEEPMS) {
+        errx(1, "a nanosleep of %d ms came back after %lu ms", SLEEPMS, ms);
+    }
+    if (rem.tv_sec != 0 || rem.tv_nsec != 0) {
+        errx(1, "nanosleep left %ld.%09ld s", (long)rem.tv_sec, (long)rem.tv_nsec);
+    }
+
+    /* A BAD TIMESPEC */
+    req.tv_nsec = 1000000000;
+    if (nanosleep(&req, NULL) == 0 || errno != EINVAL) {
+        errx(1, "nanosleep accepted tv_nsec of 1000000000");
+    }
+
+    printf("yieldtest: passed\n");
+    return 0;
+}